@@ -0,0 +1,24 @@
+# Typed serializers for the structs of idl_file, see idl_fast_gen.py.
+# Defines SUPP_DDS_FAST_SERIAL when out_name.c was generated in dir,
+# without python3 the proxy keeps the generic handlers only.
+function(IDL_FAST_GENERATE idl_file out_name dir)
+  find_program(PYTHON3 python3)
+  if(NOT PYTHON3)
+    message(WARNING "python3 not found, DDS proxy without typed serializers")
+    return()
+  endif()
+
+  execute_process(
+    COMMAND ${PYTHON3} ${CMAKE_SOURCE_DIR}/cmake/idl_fast_gen.py
+            ${idl_file} ${out_name} ${dir}
+    RESULT_VARIABLE IDL_FAST_RESULT)
+  if(NOT IDL_FAST_RESULT EQUAL 0)
+    message(WARNING "idl_fast_gen failed on ${idl_file}, DDS proxy without typed serializers")
+    file(REMOVE ${dir}/${out_name}.c)
+    return()
+  endif()
+
+  # Configure again when the idl changes
+  set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${idl_file})
+  add_definitions(-DSUPP_DDS_FAST_SERIAL)
+endfunction()
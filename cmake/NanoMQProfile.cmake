@@ -0,0 +1,81 @@
+# Footprint profiles, picked with -DNANOMQ_PROFILE=tiny|edge|gateway|server.
+#
+# A profile presets the feature options, the sizes of per worker caches and
+# queues, and the runtime defaults of include/build_profile.h. Anything
+# given with -D on the command line wins over the profile. Options live in
+# the cache, so switch profiles in a fresh build directory.
+
+# Preset an option before its option() line, unless it was given.
+macro(nanomq_profile_option NAME VALUE)
+  if(NOT DEFINED ${NAME})
+    set(${NAME} ${VALUE} CACHE BOOL "Preset by NANOMQ_PROFILE")
+  endif()
+endmacro()
+
+# Preset one of the -D<NAME>=<value> tunables passed on as NANO_<NAME>.
+macro(nanomq_profile_value NAME VALUE)
+  if(NOT DEFINED ${NAME})
+    set(${NAME} ${VALUE})
+  endif()
+endmacro()
+
+string(TOLOWER "${NANOMQ_PROFILE}" _profile)
+
+if(_profile STREQUAL "tiny")
+  # a single core device: MQTT only, nothing sampled or counted
+  set(_profile_id 1)
+  nanomq_profile_option(ENABLE_ACL OFF)
+  nanomq_profile_option(ENABLE_SYSLOG OFF)
+  nanomq_profile_option(ENABLE_RULE_ENGINE OFF)
+  nanomq_profile_option(ENABLE_JWT OFF)
+  nanomq_profile_option(BUILD_CLIENT OFF)
+  nanomq_profile_option(BUILD_NNG_PROXY OFF)
+  add_definitions(-DNANO_NO_STATISTICS)
+  nanomq_profile_value(WORK_ARENA_BLOCK 1024)
+  nanomq_profile_value(MSG_POOL_CAP_256 4)
+  nanomq_profile_value(MSG_POOL_CAP_1K 2)
+  nanomq_profile_value(MSG_POOL_CAP_4K 0)
+  nanomq_profile_value(MSG_POOL_CAP_16K 0)
+  nanomq_profile_value(TOPIC_LEVELS 8)
+  add_definitions(-DNANO_EXCHANGE_RING_LEN=64)
+  add_definitions(-DHTTP_CTX_NUM=1)
+elseif(_profile STREQUAL "edge")
+  # a small gateway box: ACL and the client tools, no engines
+  set(_profile_id 2)
+  nanomq_profile_option(ENABLE_ACL ON)
+  nanomq_profile_option(ENABLE_RULE_ENGINE OFF)
+  nanomq_profile_option(BUILD_NNG_PROXY OFF)
+  nanomq_profile_value(WORK_ARENA_BLOCK 2048)
+  nanomq_profile_value(MSG_POOL_CAP_256 8)
+  nanomq_profile_value(MSG_POOL_CAP_1K 4)
+  nanomq_profile_value(MSG_POOL_CAP_4K 2)
+  nanomq_profile_value(MSG_POOL_CAP_16K 0)
+  nanomq_profile_value(TOPIC_LEVELS 16)
+  add_definitions(-DNANO_EXCHANGE_RING_LEN=256)
+  add_definitions(-DHTTP_CTX_NUM=2)
+elseif(_profile STREQUAL "gateway")
+  # protocol gateway: rules, bridges with an offline cache, $SYS
+  set(_profile_id 3)
+  nanomq_profile_option(ENABLE_ACL ON)
+  nanomq_profile_option(ENABLE_RULE_ENGINE ON)
+  nanomq_profile_option(ENABLE_BRIDGE_CACHE ON)
+  nanomq_profile_option(ENABLE_BRIDGE_DEDUPE ON)
+  nanomq_profile_option(ENABLE_SYS_STATS ON)
+elseif(_profile STREQUAL "server")
+  # many cores and clients: caches and the observability features
+  set(_profile_id 4)
+  nanomq_profile_option(ENABLE_ACL ON)
+  nanomq_profile_option(ENABLE_RULE_ENGINE ON)
+  nanomq_profile_option(ENABLE_MATCH_CACHE ON)
+  nanomq_profile_option(ENABLE_RETAIN_INDEX ON)
+  nanomq_profile_option(ENABLE_TRAFFIC_STATS ON)
+  nanomq_profile_option(ENABLE_LATENCY_STATS ON)
+  nanomq_profile_option(ENABLE_SYS_STATS ON)
+  nanomq_profile_value(WORK_POOL_MAX 64)
+else()
+  message(FATAL_ERROR
+    "NANOMQ_PROFILE must be tiny, edge, gateway or server, not ${NANOMQ_PROFILE}")
+endif()
+
+message("-- Build NanoMQ with the ${_profile} profile --")
+add_definitions(-DNANO_PROFILE=${_profile_id})
@@ -0,0 +1,729 @@
+#!/usr/bin/env python3
+#
+# This software is supplied under the terms of the MIT License, a
+# copy of which should be located in the distribution where this
+# file was obtained (LICENSE.txt).  A copy of the license may also be
+# found online at https://opensource.org/licenses/MIT.
+#
+# Generates typed serializers for the structs of a DDS IDL file, used by
+# the DDS proxy instead of going through cJSON for every sample:
+#
+#   <struct>_fast_json    sample -> JSON, straight into the caller's buffer
+#   <struct>_fast_pack    sample -> packed little endian binary
+#   <struct>_fast_unpack  packed little endian binary -> sample
+#
+# The structs are laid out as idlc generates them. Members the generator
+# does not know (sequences, unions, ...) leave their struct, and every
+# struct holding it, out of dds_fast_map so the generic handlers of
+# idl-serial keep serving them.
+#
+# usage: idl_fast_gen.py <idl file> <out name> <out dir>
+#
+
+import os
+import re
+import sys
+
+BASIC = {
+    'int8': ('int', 1), 'uint8': ('uint', 1), 'octet': ('uint', 1),
+    'int16': ('int', 2), 'uint16': ('uint', 2), 'short': ('int', 2),
+    'int32': ('int', 4), 'uint32': ('uint', 4), 'long': ('int', 4),
+    'int64': ('int', 8), 'uint64': ('uint', 8),
+    'float': ('float', 4), 'double': ('double', 8),
+    'boolean': ('bool', 1), 'char': ('char', 1),
+}
+
+UNSIGNED = {
+    'short': 'uint16', 'long': 'uint32', 'long long': 'uint64',
+}
+
+
+class Unsupported(Exception):
+    pass
+
+
+class Type:
+    def __init__(self, kind, size=0, name=None, bound=0, dims=None):
+        self.kind = kind    # int uint float double bool char enum struct
+                            # string bstring
+        self.size = size
+        self.name = name    # C name of an enum or struct
+        self.bound = bound  # bstring only
+        self.dims = dims or []
+
+
+def strip(text):
+    text = re.sub(r'/\*.*?\*/', ' ', text, flags=re.S)
+    text = re.sub(r'//[^\n]*', ' ', text)
+    return re.sub(r'^\s*#[^\n]*', ' ', text, flags=re.M)
+
+
+def tokenize(text):
+    return re.findall(r'::|[A-Za-z_][A-Za-z_0-9]*|0[xX][0-9a-fA-F]+|\d+|'
+                      r'"[^"]*"|\S', text)
+
+
+class Parser:
+    def __init__(self, toks):
+        self.toks = toks
+        self.pos = 0
+        self.scope = []
+        self.types = {}     # C name -> Type or Unsupported reason
+        self.structs = []   # (C name, [(member, Type)]) in order
+        self.consts = {}
+
+    def peek(self, off=0):
+        i = self.pos + off
+        return self.toks[i] if i < len(self.toks) else None
+
+    def next(self):
+        tok = self.peek()
+        if tok is None:
+            raise SyntaxError('unexpected end of idl')
+        self.pos += 1
+        return tok
+
+    def expect(self, tok):
+        got = self.next()
+        if got != tok:
+            raise SyntaxError('expected %s, got %s' % (tok, got))
+
+    def cname(self, name):
+        return '_'.join(self.scope + [name])
+
+    def skip_block(self):
+        depth = 0
+        while True:
+            tok = self.next()
+            if tok == '{':
+                depth += 1
+            elif tok == '}':
+                depth -= 1
+            elif tok == ';' and depth == 0:
+                return
+
+    def skip_annotation(self):
+        self.expect('@')
+        self.next()
+        while self.peek() == '::':
+            self.next()
+            self.next()
+        if self.peek() == '(':
+            depth = 0
+            while True:
+                tok = self.next()
+                depth += tok == '('
+                depth -= tok == ')'
+                if depth == 0:
+                    return
+
+    def resolve(self, name):
+        parts = name.split('::')
+        if parts[0] == '':
+            parts = parts[1:]
+        # innermost scope first, as IDL does
+        for n in range(len(self.scope), -1, -1):
+            cname = '_'.join(self.scope[:n] + parts)
+            if cname in self.types:
+                return cname
+        raise SyntaxError('unknown type %s' % name)
+
+    def number(self):
+        tok = self.next()
+        if tok in self.consts:
+            return self.consts[tok]
+        return int(tok, 0)
+
+    def type_spec(self):
+        tok = self.next()
+        if tok == 'unsigned':
+            tok = self.next()
+            if tok == 'long' and self.peek() == 'long':
+                self.next()
+                tok = 'long long'
+            return Type(*BASIC[UNSIGNED[tok]])
+        if tok == 'long' and self.peek() == 'long':
+            self.next()
+            return Type(*BASIC['int64'])
+        if tok == 'long' and self.peek() == 'double':
+            raise Unsupported('long double')
+        if tok in BASIC:
+            return Type(*BASIC[tok])
+        if tok == 'string':
+            if self.peek() == '<':
+                self.next()
+                bound = self.number()
+                self.expect('>')
+                return Type('bstring', bound=bound)
+            return Type('string')
+        if tok in ('sequence', 'wstring', 'wchar', 'any', 'fixed', 'map'):
+            if self.peek() == '<':
+                depth = 0
+                while True:
+                    t = self.next()
+                    depth += t == '<'
+                    depth -= t == '>'
+                    if depth == 0:
+                        break
+            raise Unsupported(tok)
+        name = tok
+        while self.peek() == '::':
+            name += self.next() + self.next()
+        ref = self.types[self.resolve(name)]
+        if isinstance(ref, Unsupported):
+            raise ref
+        return Type(ref.kind, ref.size, ref.name, ref.bound, list(ref.dims))
+
+    def declarator(self, base):
+        name = self.next()
+        dims = []
+        while self.peek() == '[':
+            self.next()
+            dims.append(self.number())
+            self.expect(']')
+        t = Type(base.kind, base.size, base.name, base.bound,
+                 dims + base.dims)
+        return name, t
+
+    # Reads the rest of a "type a, b[2];" statement.
+    def declarators(self):
+        err = None
+        try:
+            base = self.type_spec()
+        except Unsupported as e:
+            err = e
+            base = Type('none')
+        decls = []
+        while True:
+            decls.append(self.declarator(base))
+            tok = self.next()
+            if tok == ';':
+                return decls, err
+            if tok != ',':
+                raise SyntaxError('expected ; got %s' % tok)
+
+    def definition(self):
+        tok = self.next()
+        if tok == '@':
+            self.pos -= 1
+            self.skip_annotation()
+        elif tok == ';':
+            pass
+        elif tok == 'module':
+            self.scope.append(self.next())
+            self.expect('{')
+            while self.peek() != '}':
+                self.definition()
+            self.expect('}')
+            self.scope.pop()
+        elif tok == 'enum':
+            cname = self.cname(self.next())
+            self.types[cname] = Type('enum', 4, cname)
+            self.expect('{')
+            while self.next() != '}':
+                pass
+            self.expect(';')
+        elif tok == 'struct':
+            self.struct()
+        elif tok == 'typedef':
+            decls, err = self.declarators()
+            for name, t in decls:
+                self.types[self.cname(name)] = err if err else t
+        elif tok == 'const':
+            self.type_spec()
+            name = self.next()
+            self.expect('=')
+            value = self.next()
+            try:
+                self.consts[name] = int(value, 0)
+            except ValueError:
+                pass
+            while self.next() != ';':
+                pass
+        elif tok in ('union', 'bitmask', 'bitset', 'interface'):
+            name = self.next()
+            self.types[self.cname(name)] = Unsupported(tok)
+            self.skip_block()
+        else:
+            raise SyntaxError('unexpected %s' % tok)
+
+    def struct(self):
+        name = self.next()
+        cname = self.cname(name)
+        if self.peek() == ';':  # forward declaration
+            self.next()
+            return
+        if self.peek() == ':':
+            raise SyntaxError('struct inheritance in %s' % name)
+        self.expect('{')
+        members = []
+        err = None
+        while self.peek() != '}':
+            if self.peek() == '@':
+                self.skip_annotation()
+                continue
+            decls, e = self.declarators()
+            err = err or e
+            members.extend(decls)
+        self.expect('}')
+        self.expect(';')
+        if err:
+            self.types[cname] = Unsupported('%s (%s)' % (err, name))
+            print('idl_fast_gen: %s left to the generic handler: %s' %
+                  (cname, err))
+            return
+        self.types[cname] = Type('struct', 0, cname)
+        self.structs.append((cname, members))
+
+    def parse(self):
+        while self.peek() is not None:
+            self.definition()
+
+
+class Gen:
+    def __init__(self):
+        self.out = []
+        self.depth = 0
+
+    def line(self, ind, text):
+        self.out.append('\t' * ind + text)
+
+    def var(self):
+        self.depth += 1
+        return 'i%d' % (self.depth - 1)
+
+    def loop(self, ind, n, body):
+        i = self.var()
+        self.line(ind, 'for (size_t %s = 0; %s < %d; ++%s) {' % (i, i, n, i))
+        body(ind + 1, i)
+        self.line(ind, '}')
+        self.depth -= 1
+
+    # JSON
+
+    def json(self, ind, expr, t, dims):
+        if dims and not (t.kind == 'char' and len(dims) == 1):
+            def body(ind, i):
+                self.line(ind, 'if (%s > 0)' % i)
+                self.line(ind + 1, 'fast_put(o, ",", 1);')
+                self.json(ind, '%s[%s]' % (expr, i), t, dims[1:])
+            self.line(ind, 'fast_put(o, "[", 1);')
+            self.loop(ind, dims[0], body)
+            self.line(ind, 'fast_put(o, "]", 1);')
+            return
+        if t.kind == 'char' and dims:
+            self.line(ind, 'fast_put_str(o, %s, %d);' % (expr, dims[0]))
+        elif t.kind == 'char':
+            self.line(ind, 'fast_put_str(o, &%s, 1);' % expr)
+        elif t.kind == 'int' or t.kind == 'enum':
+            self.line(ind, 'fast_put_i64(o, (int64_t) %s);' % expr)
+        elif t.kind == 'uint':
+            self.line(ind, 'fast_put_u64(o, (uint64_t) %s);' % expr)
+        elif t.kind == 'float':
+            self.line(ind, 'fast_put_double(o, %s, 9);' % expr)
+        elif t.kind == 'double':
+            self.line(ind, 'fast_put_double(o, %s, 17);' % expr)
+        elif t.kind == 'bool':
+            self.line(ind, 'if (%s)' % expr)
+            self.line(ind + 1, 'fast_put(o, "true", 4);')
+            self.line(ind, 'else')
+            self.line(ind + 1, 'fast_put(o, "false", 5);')
+        elif t.kind == 'string':
+            self.line(ind, 'fast_put_str(o, %s, SIZE_MAX);' % expr)
+        elif t.kind == 'bstring':
+            self.line(ind, 'fast_put_str(o, %s, %d);' % (expr, t.bound + 1))
+        elif t.kind == 'struct':
+            self.line(ind, '%s_json_(o, &%s);' % (t.name, expr))
+
+    # binary, pack and unpack share the walk
+
+    def bin(self, ind, expr, t, dims, unpack):
+        if t.kind == 'char' and dims and len(dims) == 1:
+            self.line(ind, '%s(o, %s, %d);' %
+                      ('fast_get' if unpack else 'fast_put', expr, dims[0]))
+            return
+        if dims:
+            self.loop(ind, dims[0], lambda ind, i: self.bin(
+                ind, '%s[%s]' % (expr, i), t, dims[1:], unpack))
+            return
+        if t.kind in ('int', 'uint', 'char', 'bool', 'enum'):
+            size = t.size
+            if unpack:
+                conv = {'int': 'int%d_t' % (size * 8),
+                        'uint': 'uint%d_t' % (size * 8),
+                        'char': 'char', 'bool': 'bool',
+                        'enum': t.name}[t.kind]
+                if t.kind == 'enum':
+                    expr_v = '(%s) (int32_t) fast_get_u(o, 4)' % conv
+                else:
+                    expr_v = '(%s) fast_get_u(o, %d)' % (conv, size)
+                self.line(ind, '%s = %s;' % (expr, expr_v))
+            else:
+                self.line(ind, 'fast_put_u(o, (uint64_t) %s, %d);' %
+                          (expr, size))
+        elif t.kind == 'float':
+            self.line(ind, '%s(o, &%s, 4);' %
+                      ('fast_get_real' if unpack else 'fast_put_real', expr))
+        elif t.kind == 'double':
+            self.line(ind, '%s(o, &%s, 8);' %
+                      ('fast_get_real' if unpack else 'fast_put_real', expr))
+        elif t.kind == 'string':
+            if unpack:
+                self.line(ind, '%s = fast_get_string(o);' % expr)
+            else:
+                self.line(ind, 'fast_put_string(o, %s, SIZE_MAX);' % expr)
+        elif t.kind == 'bstring':
+            if unpack:
+                self.line(ind, 'fast_get_bstring(o, %s, %d);' %
+                          (expr, t.bound))
+            else:
+                self.line(ind, 'fast_put_string(o, %s, %d);' %
+                          (expr, t.bound + 1))
+        elif t.kind == 'struct':
+            self.line(ind, '%s_%s_(o, &%s);' %
+                      (t.name, 'unpack' if unpack else 'pack', expr))
+
+    def struct(self, cname, members):
+        self.line(0, 'static void')
+        self.line(0, '%s_json_(fast_out *o, const %s *s)' % (cname, cname))
+        self.line(0, '{')
+        for n, (name, t) in enumerate(members):
+            key = '%s"%s":' % ('{' if n == 0 else ',', name)
+            self.line(1, 'fast_put(o, "%s", %d);' %
+                      (key.replace('"', '\\"'), len(key)))
+            self.json(1, 's->%s' % name, t, t.dims)
+        if not members:
+            self.line(1, 'fast_put(o, "{", 1);')
+        self.line(1, 'fast_put(o, "}", 1);')
+        self.line(0, '}')
+        self.line(0, '')
+        for unpack in (False, True):
+            self.line(0, 'static void')
+            if unpack:
+                self.line(0, '%s_unpack_(fast_in *o, %s *s)' %
+                          (cname, cname))
+            else:
+                self.line(0, '%s_pack_(fast_out *o, const %s *s)' %
+                          (cname, cname))
+            self.line(0, '{')
+            if not members:
+                self.line(1, '(void) o;')
+                self.line(1, '(void) s;')
+            for name, t in members:
+                self.bin(1, 's->%s' % name, t, t.dims, unpack)
+            self.line(0, '}')
+            self.line(0, '')
+        # the entry points of dds_fast_map
+        self.line(0, 'static int')
+        self.line(0, '%s_fast_json(const void *sample, char *buf, '
+                     'size_t len)' % cname)
+        self.line(0, '{')
+        self.line(1, 'fast_out o = { (uint8_t *) buf, len, 0 };')
+        self.line(1, '%s_json_(&o, sample);' % cname)
+        self.line(1, 'return fast_done(&o);')
+        self.line(0, '}')
+        self.line(0, '')
+        self.line(0, 'static int')
+        self.line(0, '%s_fast_pack(const void *sample, uint8_t *buf, '
+                     'size_t len)' % cname)
+        self.line(0, '{')
+        self.line(1, 'fast_out o = { buf, len, 0 };')
+        self.line(1, '%s_pack_(&o, sample);' % cname)
+        self.line(1, 'return fast_done(&o);')
+        self.line(0, '}')
+        self.line(0, '')
+        self.line(0, 'static int')
+        self.line(0, '%s_fast_unpack(const uint8_t *buf, size_t len, '
+                     'void *sample)' % cname)
+        self.line(0, '{')
+        self.line(1, 'fast_in o = { buf, len, 0, 0 };')
+        self.line(1, '%s_unpack_(&o, sample);' % cname)
+        self.line(1, 'return o.err || o.pos != len ? -1 : 0;')
+        self.line(0, '}')
+        self.line(0, '')
+
+
+PRELUDE = r'''// Generated by cmake/idl_fast_gen.py from %(idl)s, do not edit.
+
+#if defined(SUPP_DDS_PROXY) && defined(SUPP_DDS_FAST_SERIAL)
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dds/dds.h"
+#include "%(header)s"
+#include "dds_utils.h"
+
+// Writes never pass len, the first that does not fit marks the whole
+// output too small.
+typedef struct {
+	uint8_t *buf;
+	size_t   len;
+	size_t   pos; // SIZE_MAX once it overflowed
+} fast_out;
+
+typedef struct {
+	const uint8_t *buf;
+	size_t         len;
+	size_t         pos;
+	int            err;
+} fast_in;
+
+static inline void
+fast_put(fast_out *o, const void *p, size_t n)
+{
+	if (n == 0)
+		return;
+	if (o->pos > o->len || o->len - o->pos < n) {
+		o->pos = SIZE_MAX;
+		return;
+	}
+	memcpy(o->buf + o->pos, p, n);
+	o->pos += n;
+}
+
+static inline int
+fast_done(fast_out *o)
+{
+	return o->pos > o->len || o->pos > INT32_MAX ? -1 : (int) o->pos;
+}
+
+static inline void
+fast_put_u64(fast_out *o, uint64_t v)
+{
+	char  tmp[20];
+	char *p = tmp + sizeof(tmp);
+
+	do {
+		*--p = (char) ('0' + v %% 10);
+		v /= 10;
+	} while (v != 0);
+	fast_put(o, p, tmp + sizeof(tmp) - p);
+}
+
+static inline void
+fast_put_i64(fast_out *o, int64_t v)
+{
+	if (v < 0) {
+		fast_put(o, "-", 1);
+		fast_put_u64(o, 0 - (uint64_t) v);
+		return;
+	}
+	fast_put_u64(o, (uint64_t) v);
+}
+
+static inline void
+fast_put_double(fast_out *o, double v, int digits)
+{
+	char tmp[32];
+	int  n;
+
+	// JSON has no NaN nor infinity
+	if (!isfinite(v)) {
+		fast_put(o, "null", 4);
+		return;
+	}
+	n = snprintf(tmp, sizeof(tmp), "%%.*g", digits, v);
+	fast_put(o, tmp, n);
+}
+
+// A JSON string of s, stopping at NUL or after max bytes.
+static inline void
+fast_put_str(fast_out *o, const char *s, size_t max)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t            n     = 0;
+	size_t            run   = 0;
+
+	fast_put(o, "\"", 1);
+	while (s != NULL && n < max && s[n] != '\0') {
+		unsigned char c = (unsigned char) s[n];
+
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			n++;
+			continue;
+		}
+		fast_put(o, s + run, n - run);
+		if (c == '"' || c == '\\') {
+			char esc[2] = { '\\', (char) c };
+			fast_put(o, esc, 2);
+		} else {
+			char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4],
+				hex[c & 0xf] };
+			fast_put(o, esc, 6);
+		}
+		run = ++n;
+	}
+	fast_put(o, s + run, n - run);
+	fast_put(o, "\"", 1);
+}
+
+static inline void
+fast_put_u(fast_out *o, uint64_t v, int size)
+{
+	uint8_t tmp[8];
+
+	for (int i = 0; i < size; ++i)
+		tmp[i] = (uint8_t) (v >> (8 * i));
+	fast_put(o, tmp, size);
+}
+
+static inline void
+fast_put_real(fast_out *o, const void *p, int size)
+{
+	uint64_t v  = 0;
+	uint32_t v4 = 0;
+
+	if (size == 4) {
+		memcpy(&v4, p, 4);
+		v = v4;
+	} else {
+		memcpy(&v, p, 8);
+	}
+	fast_put_u(o, v, size);
+}
+
+// u32 length, then the bytes without NUL.
+static inline void
+fast_put_string(fast_out *o, const char *s, size_t max)
+{
+	size_t n = 0;
+
+	while (s != NULL && n < max && s[n] != '\0')
+		n++;
+	fast_put_u(o, n, 4);
+	fast_put(o, s, n);
+}
+
+static inline const uint8_t *
+fast_take(fast_in *o, size_t n)
+{
+	const uint8_t *p;
+
+	if (o->err || o->len - o->pos < n) {
+		o->err = 1;
+		return NULL;
+	}
+	p = o->buf + o->pos;
+	o->pos += n;
+	return p;
+}
+
+static inline void
+fast_get(fast_in *o, void *p, size_t n)
+{
+	const uint8_t *src = fast_take(o, n);
+
+	if (src != NULL)
+		memcpy(p, src, n);
+}
+
+static inline uint64_t
+fast_get_u(fast_in *o, int size)
+{
+	const uint8_t *p = fast_take(o, size);
+	uint64_t       v = 0;
+
+	for (int i = 0; p != NULL && i < size; ++i)
+		v |= (uint64_t) p[i] << (8 * i);
+	return v;
+}
+
+static inline void
+fast_get_real(fast_in *o, void *p, int size)
+{
+	uint64_t v = fast_get_u(o, size);
+	uint32_t v4;
+
+	if (size == 4) {
+		v4 = (uint32_t) v;
+		memcpy(p, &v4, 4);
+	} else {
+		memcpy(p, &v, 8);
+	}
+}
+
+// Unbounded strings are the sample's own, freed with it.
+static inline char *
+fast_get_string(fast_in *o)
+{
+	size_t         n = fast_get_u(o, 4);
+	const uint8_t *p = fast_take(o, n);
+	char          *s;
+
+	if (p == NULL || (s = dds_alloc(n + 1)) == NULL) {
+		o->err = 1;
+		return NULL;
+	}
+	memcpy(s, p, n);
+	s[n] = '\0';
+	return s;
+}
+
+static inline void
+fast_get_bstring(fast_in *o, char *s, size_t bound)
+{
+	size_t         n = fast_get_u(o, 4);
+	const uint8_t *p;
+
+	if (n > bound || (p = fast_take(o, n)) == NULL) {
+		o->err = 1;
+		return;
+	}
+	memcpy(s, p, n);
+	s[n] = '\0';
+}
+
+'''
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.stderr.write('usage: %s <idl file> <out name> <out dir>\n' %
+                         sys.argv[0])
+        return 1
+    idl, out_name, out_dir = sys.argv[1:]
+    with open(idl) as f:
+        p = Parser(tokenize(strip(f.read())))
+    try:
+        p.parse()
+    except (SyntaxError, KeyError, ValueError) as e:
+        sys.stderr.write('idl_fast_gen: %s: %s\n' % (idl, e))
+        return 1
+
+    # idlc names its header after the idl file
+    header = os.path.splitext(os.path.basename(idl))[0] + '.h'
+    g = Gen()
+    g.out.append(PRELUDE % {'idl': os.path.basename(idl), 'header': header})
+    for cname, members in p.structs:
+        g.struct(cname, members)
+    g.line(0, 'const dds_fast_set dds_fast_map[] = {')
+    for cname, _ in p.structs:
+        g.line(1, '{ "%s", %s_fast_json, %s_fast_pack,' %
+               (cname, cname, cname))
+        g.line(2, '%s_fast_unpack },' % cname)
+    if not p.structs:
+        g.line(1, '{ NULL, NULL, NULL, NULL },')
+    g.line(0, '};')
+    g.line(0, '')
+    g.line(0, 'const size_t dds_fast_map_sz = %d;' % len(p.structs))
+    g.line(0, '')
+    g.line(0, '#endif')
+
+    path = os.path.join(out_dir, out_name + '.c')
+    text = '\n'.join(g.out) + '\n'
+    # keep the mtime when nothing changed, no rebuild on every configure
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == text:
+                return 0
+    with open(path, 'w') as f:
+        f.write(text)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,283 +1,920 @@
 #ifdef ACL_SUPP
+#include <stdlib.h>
+#include <string.h>
+
 #include "include/acl_handler.h"
 #include "nng/protocol/mqtt/mqtt_parser.h"
+#include "nng/supplemental/nanolib/cvector.h"
 #include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
 
 // only clientid and username are supported now.
 #define placeholder_clientid "${clientid}"
 #define placeholder_username "${username}"
-char *placeholders[] = {"${clientid}", "${username}"};
 
-static bool
-match_rule_content_str(acl_rule_ct *ct, const char *cmp_str)
+#define ACL_CACHE_LOCKS 64
+
+/*
+ * Rules are compiled once into an index that owns copies of every string it
+ * needs, so a reload never races with a lookup. Per action, rules without
+ * topics are kept in a username hash, a clientid hash and a generic list,
+ * and rules with topics are hung off a trie of their topic levels. Both
+ * carry the original rule position so a lookup still returns the decision
+ * of the first matching rule.
+ */
+
+typedef struct {
+	acl_rule_type type; // ACL_USERNAME, ACL_CLIENTID or ACL_IPADDR
+	bool          all;
+	char         *str;  // NULL if the content can never match
+} acl_cond;
+
+typedef struct {
+	acl_rule_type rule_type;
+	acl_permit    permit;
+	acl_cond     *conds;
+	size_t        cond_count;
+} acl_crule;
+
+typedef struct {
+	uint32_t hash;
+	uint32_t rule;
+} acl_key;
+
+typedef enum {
+	ACL_LEVEL_STR,
+	ACL_LEVEL_PLUS,
+	ACL_LEVEL_HASH,
+	ACL_LEVEL_CLIENTID, // the whole level is ${clientid}
+	ACL_LEVEL_USERNAME, // the whole level is ${username}
+	ACL_LEVEL_TEMPLATE, // placeholders mixed with text, "dev-${clientid}"
+} acl_level_type;
+
+typedef struct acl_node acl_node;
+
+struct acl_node {
+	acl_level_type type;
+	char          *level; // ACL_LEVEL_STR and ACL_LEVEL_TEMPLATE only
+	size_t         len;
+	acl_node     **children; // cvector
+	uint32_t      *rules;    // cvector of rules whose topic ends here
+};
+
+typedef struct {
+	uint32_t *generic; // cvector of rule positions
+	acl_key  *by_user; // cvector sorted by hash, then rule position
+	acl_key  *by_cid;
+	acl_node  trie;
+} acl_action_index;
+
+typedef struct {
+	acl_crule       *rules;
+	size_t           rule_count;
+	acl_action_index act[2]; // [0] ACL_PUB, [1] ACL_SUB
+	nng_atomic_int  *ref;
+} acl_index;
+
+typedef struct {
+	uint32_t pid;
+	uint8_t  act;
+	bool     allow;
+	uint32_t hash;
+	uint64_t gen;
+	char    *topic;
+} acl_cache_entry;
+
+typedef struct {
+	acl_index       *index;
+	nng_mtx         *lock; // guards index
+	acl_cache_entry *slots;
+	size_t           size;
+	nng_mtx         *locks[ACL_CACHE_LOCKS];
+	nng_atomic_u64  *gen;
+	nng_atomic_u64  *hits;
+	nng_atomic_u64  *misses;
+	bool             enabled;
+} acl_state;
+
+// state of one trie lookup
+typedef struct {
+	const acl_index    *idx;
+	const char         *username;
+	const char         *clientid;
+	const char         *ipaddr;
+	uint32_t            best; // first matching rule so far
+	const char         *topic;
+	const topic_levels *tl;
+} acl_walk;
+
+static acl_state acl_ctx = { .enabled = false };
+
+// FNV-1a
+static uint32_t
+acl_hash(const char *str)
 {
-	bool match = false;
-	if (ct->type == ACL_RULE_ALL) {
-		match = true;
-	} else if (ct->type == ACL_RULE_SINGLE_STRING && cmp_str != NULL &&
-	    strcmp(ct->value.str, cmp_str) == 0) {
-		match = true;
+	uint32_t h = 2166136261u;
+	while (*str != '\0') {
+		h ^= (uint8_t) *str++;
+		h *= 16777619u;
 	}
-	return match;
+	return h;
+}
+
+static void
+acl_cond_set(acl_cond *cond, acl_rule_type type, acl_rule_ct *ct)
+{
+	cond->type = type;
+	cond->all  = ct->type == ACL_RULE_ALL;
+	cond->str  = ct->type == ACL_RULE_SINGLE_STRING && ct->value.str != NULL
+	     ? nng_strdup(ct->value.str)
+	     : NULL;
 }
 
 static bool
-check_placeholder(const char *origin)
+acl_cond_match(const acl_cond *cond, const char *username,
+    const char *clientid, const char *ipaddr)
 {
-	if (origin == NULL) {
+	const char *cmp_str;
+
+	if (cond->all) {
+		return true;
+	}
+	switch (cond->type) {
+	case ACL_USERNAME:
+		cmp_str = username;
+		break;
+	case ACL_CLIENTID:
+		cmp_str = clientid;
+		break;
+	case ACL_IPADDR:
+		cmp_str = ipaddr;
+		break;
+	default:
 		return false;
 	}
+	return cond->str != NULL && cmp_str != NULL &&
+	    strcmp(cond->str, cmp_str) == 0;
+}
+
+static void
+acl_node_fini(acl_node *node)
+{
+	for (size_t i = 0; i < cvector_size(node->children); i++) {
+		acl_node_fini(node->children[i]);
+		nng_free(node->children[i], sizeof(acl_node));
+	}
+	cvector_free(node->children);
+	cvector_free(node->rules);
+	nng_strfree(node->level);
+}
 
-	for (size_t i = 0;
-	     i < sizeof(placeholders) / sizeof(placeholders[0]); i++) {
-		if (strstr(origin, placeholders[i]) != NULL) {
-			return true;
+static void
+acl_index_free(acl_index *idx)
+{
+	if (idx == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < idx->rule_count; i++) {
+		acl_crule *r = &idx->rules[i];
+		for (size_t j = 0; j < r->cond_count; j++) {
+			nng_strfree(r->conds[j].str);
 		}
+		nng_free(r->conds, sizeof(acl_cond) * r->cond_count);
+	}
+	nng_free(idx->rules, sizeof(acl_crule) * idx->rule_count);
+	for (int i = 0; i < 2; i++) {
+		cvector_free(idx->act[i].generic);
+		cvector_free(idx->act[i].by_user);
+		cvector_free(idx->act[i].by_cid);
+		acl_node_fini(&idx->act[i].trie);
 	}
+	if (idx->ref != NULL) {
+		nng_atomic_free(idx->ref);
+	}
+	nng_free(idx, sizeof(acl_index));
+}
 
-	return false;
+static int
+acl_key_cmp(const void *a, const void *b)
+{
+	const acl_key *ka = a;
+	const acl_key *kb = b;
+
+	if (ka->hash != kb->hash) {
+		return ka->hash < kb->hash ? -1 : 1;
+	}
+	return ka->rule < kb->rule ? -1 : (ka->rule > kb->rule);
+}
+
+static int
+acl_compile_rule(acl_crule *r, acl_rule *rule)
+{
+	r->rule_type = rule->rule_type;
+	r->permit    = rule->permit;
+
+	switch (rule->rule_type) {
+	case ACL_USERNAME:
+	case ACL_CLIENTID:
+	case ACL_IPADDR:
+		if ((r->conds = nng_zalloc(sizeof(acl_cond))) == NULL) {
+			return NNG_ENOMEM;
+		}
+		r->cond_count = 1;
+		acl_cond_set(&r->conds[0], rule->rule_type, &rule->rule_ct.ct);
+		break;
+	case ACL_AND:
+	case ACL_OR:
+		if (rule->rule_ct.array.count == 0) {
+			break;
+		}
+		r->conds =
+		    nng_zalloc(sizeof(acl_cond) * rule->rule_ct.array.count);
+		if (r->conds == NULL) {
+			return NNG_ENOMEM;
+		}
+		// sub rules of an unknown type never affected the outcome
+		for (size_t j = 0; j < rule->rule_ct.array.count; j++) {
+			acl_sub_rule *sub = rule->rule_ct.array.rules[j];
+			if (sub->rule_type != ACL_USERNAME &&
+			    sub->rule_type != ACL_CLIENTID &&
+			    sub->rule_type != ACL_IPADDR) {
+				continue;
+			}
+			acl_cond_set(&r->conds[r->cond_count++],
+			    sub->rule_type, &sub->rule_ct);
+		}
+		break;
+	default:
+		break;
+	}
+	return 0;
 }
 
-static char * 
-replace_placeholder(char *origin, const char *placeholder, const char *replacement)
+static acl_level_type
+acl_level_type_of(const char *level, size_t len)
 {
-	size_t originLen      = strlen(origin);
-	size_t placeholderLen = strlen(placeholder);
-	size_t replacementLen = strlen(replacement);
-	size_t resultLen      = originLen;
+	const size_t cid_len  = sizeof(placeholder_clientid) - 1;
+	const size_t user_len = sizeof(placeholder_username) - 1;
 
-	const char *p = origin;
-	while ((p = strstr(p, placeholder)) != NULL) {
-		resultLen += replacementLen - placeholderLen;
-		p += placeholderLen;
+	if (len == 1 && level[0] == '+') {
+		return ACL_LEVEL_PLUS;
+	}
+	if (len == 1 && level[0] == '#') {
+		return ACL_LEVEL_HASH;
+	}
+	if (len == cid_len && memcmp(level, placeholder_clientid, len) == 0) {
+		return ACL_LEVEL_CLIENTID;
+	}
+	if (len == user_len && memcmp(level, placeholder_username, len) == 0) {
+		return ACL_LEVEL_USERNAME;
+	}
+	for (size_t i = 0; i + 1 < len; i++) {
+		if (level[i] != '$' || level[i + 1] != '{') {
+			continue;
+		}
+		if ((len - i >= cid_len &&
+		        memcmp(level + i, placeholder_clientid, cid_len) == 0) ||
+		    (len - i >= user_len &&
+		        memcmp(level + i, placeholder_username, user_len) == 0)) {
+			return ACL_LEVEL_TEMPLATE;
+		}
 	}
+	return ACL_LEVEL_STR;
+}
 
-	char *result = (char *) malloc(resultLen + 1);
-	if (result == NULL) {
-		log_error("ACL topic placeholder Memory allocation failed\n");
+static int
+acl_trie_insert(acl_node *root, const char *filter, uint32_t pos)
+{
+	acl_node   *node = root;
+	const char *level = filter;
+
+	for (;;) {
+		const char    *end = strchr(level, '/');
+		size_t         len = end != NULL ? (size_t) (end - level)
+		                                 : strlen(level);
+		acl_level_type type  = acl_level_type_of(level, len);
+		acl_node      *child = NULL;
+
+		for (size_t i = 0; i < cvector_size(node->children); i++) {
+			acl_node *c = node->children[i];
+			if (c->type == type &&
+			    (c->level == NULL ||
+			        (c->len == len &&
+			            memcmp(c->level, level, len) == 0))) {
+				child = c;
+				break;
+			}
+		}
+		if (child == NULL) {
+			if ((child = nng_zalloc(sizeof(acl_node))) == NULL) {
+				return NNG_ENOMEM;
+			}
+			child->type = type;
+			if (type == ACL_LEVEL_STR || type == ACL_LEVEL_TEMPLATE) {
+				if ((child->level = nng_alloc(len + 1)) == NULL) {
+					nng_free(child, sizeof(acl_node));
+					return NNG_ENOMEM;
+				}
+				memcpy(child->level, level, len);
+				child->level[len] = '\0';
+				child->len        = len;
+			}
+			cvector_push_back(node->children, child);
+		}
+		node = child;
+		if (end == NULL) {
+			break;
+		}
+		level = end + 1;
 	}
 
-	char *currentPos = result;
-	p                = origin;
-	char *nextPlaceholder;
-	while ((nextPlaceholder = strstr(p, placeholder)) != NULL) {
-		size_t segmentLen = nextPlaceholder - p;
-		strncpy(currentPos, p, segmentLen);
-		currentPos += segmentLen;
+	// rules are inserted in order, a rule may list the same topic twice
+	size_t n = cvector_size(node->rules);
+	if (n == 0 || node->rules[n - 1] != pos) {
+		cvector_push_back(node->rules, pos);
+	}
+	return 0;
+}
 
-		strcpy(currentPos, replacement);
-		currentPos += replacementLen;
+static int
+acl_index_build(conf_acl *acl, acl_index **idxp)
+{
+	acl_index *idx;
+	int        rv;
 
-		p = nextPlaceholder + placeholderLen;
+	if ((idx = nng_zalloc(sizeof(acl_index))) == NULL) {
+		return NNG_ENOMEM;
 	}
+	if ((rv = nng_atomic_alloc(&idx->ref)) != 0) {
+		nng_free(idx, sizeof(acl_index));
+		return rv;
+	}
+	nng_atomic_set(idx->ref, 1);
+	if (acl->rule_count > 0) {
+		idx->rules = nng_zalloc(sizeof(acl_crule) * acl->rule_count);
+		if (idx->rules == NULL) {
+			acl_index_free(idx);
+			return NNG_ENOMEM;
+		}
+		idx->rule_count = acl->rule_count;
+	}
+
+	for (size_t i = 0; i < acl->rule_count; i++) {
+		if ((rv = acl_compile_rule(&idx->rules[i], acl->rules[i])) != 0) {
+			acl_index_free(idx);
+			return rv;
+		}
+	}
+
+	for (int a = 0; a < 2; a++) {
+		acl_action_index *ai  = &idx->act[a];
+		acl_action_type   act = a == 0 ? ACL_PUB : ACL_SUB;
 
-	strcpy(currentPos, p);
+		for (size_t i = 0; i < idx->rule_count; i++) {
+			acl_crule *r    = &idx->rules[i];
+			acl_rule  *rule = acl->rules[i];
+			acl_key    key  = { .rule = (uint32_t) i };
 
-	origin = result;
+			if (rule->action != ACL_ALL && rule->action != act) {
+				continue;
+			}
+			if (rule->topic_count > 0) {
+				for (size_t j = 0; j < rule->topic_count; j++) {
+					if ((rv = acl_trie_insert(&ai->trie,
+					         rule->topics[j], (uint32_t) i)) != 0) {
+						acl_index_free(idx);
+						return rv;
+					}
+				}
+				continue;
+			}
+			if ((r->rule_type == ACL_USERNAME ||
+			        r->rule_type == ACL_CLIENTID) &&
+			    !r->conds[0].all) {
+				if (r->conds[0].str == NULL) {
+					// can never match, drop it
+					continue;
+				}
+				key.hash = acl_hash(r->conds[0].str);
+				if (r->rule_type == ACL_USERNAME) {
+					cvector_push_back(ai->by_user, key);
+				} else {
+					cvector_push_back(ai->by_cid, key);
+				}
+				continue;
+			}
+			cvector_push_back(ai->generic, (uint32_t) i);
+		}
+		if (cvector_size(ai->by_user) > 1) {
+			qsort(ai->by_user, cvector_size(ai->by_user),
+			    sizeof(acl_key), acl_key_cmp);
+		}
+		if (cvector_size(ai->by_cid) > 1) {
+			qsort(ai->by_cid, cvector_size(ai->by_cid),
+			    sizeof(acl_key), acl_key_cmp);
+		}
+	}
 
-	return result;
+	*idxp = idx;
+	return 0;
 }
 
-static char *
-replace_topic(char *origin, conn_param *param)
+static bool
+acl_rule_match(const acl_crule *r, const char *username,
+    const char *clientid, const char *ipaddr)
 {
-	char *topic  = origin;
-	char *result = NULL;
+	bool match;
 
-	if (conn_param_get_clientid(param) != NULL) {
-		result = replace_placeholder(topic, placeholder_clientid,
-		    (const char *) conn_param_get_clientid(param));
-	}
-	if (conn_param_get_username(param) != NULL) {
-		if (result != NULL)
-			nng_strfree(result);
-		result = replace_placeholder(topic, placeholder_username,
-	    (const char *) conn_param_get_username(param));
+	switch (r->rule_type) {
+	case ACL_USERNAME:
+	case ACL_CLIENTID:
+	case ACL_IPADDR:
+		match = acl_cond_match(&r->conds[0], username, clientid, ipaddr);
+		break;
+	case ACL_AND:
+		match = true;
+		for (size_t i = 0; i < r->cond_count && match; i++) {
+			match = acl_cond_match(
+			    &r->conds[i], username, clientid, ipaddr);
+		}
+		break;
+	case ACL_OR:
+		match = false;
+		for (size_t i = 0; i < r->cond_count && !match; i++) {
+			match = acl_cond_match(
+			    &r->conds[i], username, clientid, ipaddr);
+		}
+		break;
+	case ACL_NONE:
+		match = true;
+		break;
+	default:
+		match = false;
+		break;
 	}
-	
-	return result;
+	return match;
 }
 
-bool
-auth_acl(conf *config, acl_action_type act_type, conn_param *param,
-    const char *topic)
+/*
+ * Match one topic level against a level mixing text and placeholders. A
+ * placeholder with no value to substitute is matched literally.
+ */
+static bool
+acl_level_match(const char *tmpl, const char *level, size_t len,
+    const char *clientid, const char *username)
 {
-	conn_param_clone(param);
-
-	conf_acl *acl = &config->acl;
+	const size_t cid_len  = sizeof(placeholder_clientid) - 1;
+	const size_t user_len = sizeof(placeholder_username) - 1;
+	const char  *end      = level + len;
+	const char  *value;
+	size_t       n = 0;
+
+	while (*tmpl != '\0') {
+		value = NULL;
+		if (clientid != NULL &&
+		    strncmp(tmpl, placeholder_clientid, cid_len) == 0) {
+			value = clientid;
+			n     = cid_len;
+		} else if (username != NULL &&
+		    strncmp(tmpl, placeholder_username, user_len) == 0) {
+			value = username;
+			n     = user_len;
+		}
+		if (value != NULL) {
+			size_t vlen = strlen(value);
+			if ((size_t) (end - level) < vlen ||
+			    memcmp(level, value, vlen) != 0) {
+				return false;
+			}
+			tmpl += n;
+			level += vlen;
+			continue;
+		}
+		if (level == end || *tmpl != *level) {
+			return false;
+		}
+		tmpl++;
+		level++;
+	}
+	return level == end;
+}
 
-	bool match     = false;
-	bool sub_match = true;
-	bool result    = false;
+static inline bool
+acl_level_eq(const char *level, size_t len, const char *value)
+{
+	return strncmp(level, value, len) == 0 && value[len] == '\0';
+}
 
-	for (size_t i = 0; i < acl->rule_count; i++) {
-		acl_rule *      rule   = acl->rules[i];
-		acl_action_type action = rule->action;
+// rules are sorted, so the first one matching the client is the only one
+static void
+acl_walk_rules(const uint32_t *rules, acl_walk *w)
+{
+	for (size_t i = 0; i < cvector_size(rules); i++) {
+		if (rules[i] >= w->best) {
+			return;
+		}
+		if (acl_rule_match(&w->idx->rules[rules[i]], w->username,
+		        w->clientid, w->ipaddr)) {
+			w->best = rules[i];
+			return;
+		}
+	}
+}
 
-		if (action != ACL_ALL && action != act_type) {
-			continue;
+// i is the current level of the topic, w->tl->n once all are consumed.
+static void
+acl_trie_walk(const acl_node *node, uint32_t i, acl_walk *w)
+{
+	const char *level;
+	size_t      len;
+
+	if (i == w->tl->n) {
+		acl_walk_rules(node->rules, w);
+		// "a/#" matches its parent level "a" as well
+		for (size_t k = 0; k < cvector_size(node->children); k++) {
+			if (node->children[k]->type == ACL_LEVEL_HASH) {
+				acl_walk_rules(node->children[k]->rules, w);
+			}
 		}
+		return;
+	}
 
-		switch (rule->rule_type) {
-		case ACL_USERNAME:
-			match = match_rule_content_str(&rule->rule_ct.ct,
-			    (const char *) conn_param_get_username(param));
+	level = topic_level(w->tl, w->topic, i, &len);
+	for (size_t k = 0; k < cvector_size(node->children); k++) {
+		const acl_node *c = node->children[k];
+		switch (c->type) {
+		case ACL_LEVEL_HASH:
+			acl_walk_rules(c->rules, w);
 			break;
-
-		case ACL_CLIENTID:
-			match = match_rule_content_str(&rule->rule_ct.ct,
-			    (const char *) conn_param_get_clientid(param));
+		case ACL_LEVEL_PLUS:
+			acl_trie_walk(c, i + 1, w);
 			break;
-		case ACL_IPADDR:
-			match = match_rule_content_str(&rule->rule_ct.ct,
-			    (const char *) conn_param_get_ip_addr_v4(param));
+		case ACL_LEVEL_STR:
+			if (c->len == len && memcmp(c->level, level, len) == 0) {
+				acl_trie_walk(c, i + 1, w);
+			}
 			break;
-		case ACL_AND:
-			for (size_t j = 0; j < rule->rule_ct.array.count;
-			     j++) {
-				acl_sub_rule *sub_rule =
-				    rule->rule_ct.array.rules[j];
-				switch (sub_rule->rule_type) {
-				case ACL_USERNAME:
-					if (!match_rule_content_str(
-					        &sub_rule->rule_ct,
-					        (const char *)
-					            conn_param_get_username(
-					                param))) {
-						sub_match = false;
-						break;
-					}
-					break;
-
-				case ACL_CLIENTID:
-					if (!match_rule_content_str(
-					        &sub_rule->rule_ct,
-					        (const char *)
-					            conn_param_get_clientid(
-					                param))) {
-						sub_match = false;
-						break;
-					}
-					break;
-
-				case ACL_IPADDR:
-					if (!match_rule_content_str(
-					        &sub_rule->rule_ct,
-					        (const char *)
-					            conn_param_get_ip_addr_v4(
-					                param))) {
-						sub_match = false;
-						break;
-					}
-					break;
-
-				default:
-					break;
-				}
-				if (!sub_match) {
-					break;
-				}
+		case ACL_LEVEL_CLIENTID:
+			if (acl_level_eq(level, len,
+			        w->clientid != NULL ? w->clientid
+			                            : placeholder_clientid)) {
+				acl_trie_walk(c, i + 1, w);
 			}
-			if (sub_match) {
-				match = true;
+			break;
+		case ACL_LEVEL_USERNAME:
+			if (acl_level_eq(level, len,
+			        w->username != NULL ? w->username
+			                            : placeholder_username)) {
+				acl_trie_walk(c, i + 1, w);
 			}
 			break;
-
-		case ACL_OR:
-			for (size_t j = 0; j < rule->rule_ct.array.count;
-			     j++) {
-				acl_sub_rule *sub_rule =
-				    rule->rule_ct.array.rules[j];
-				switch (sub_rule->rule_type) {
-				case ACL_USERNAME:
-					match |= match_rule_content_str(
-					    &sub_rule->rule_ct,
-					    (const char *)
-					        conn_param_get_username(
-					            param));
-					break;
-
-				case ACL_CLIENTID:
-					match |= match_rule_content_str(
-					    &sub_rule->rule_ct,
-					    (const char *)
-					        conn_param_get_clientid(
-					            param));
-					break;
-
-				case ACL_IPADDR:
-					match |= match_rule_content_str(
-					    &sub_rule->rule_ct,
-					    (const char *)
-					        conn_param_get_ip_addr_v4(
-					            param));
-					break;
-
-				default:
-					break;
-				}
-				if (match) {
-					break;
-				}
+		case ACL_LEVEL_TEMPLATE:
+			if (acl_level_match(
+			        c->level, level, len, w->clientid, w->username)) {
+				acl_trie_walk(c, i + 1, w);
 			}
 			break;
+		}
+	}
+}
 
-		case ACL_NONE:
-			match = true;
-			break;
+// first element of a sorted key vector with the given hash
+static size_t
+acl_key_lower(const acl_key *keys, uint32_t hash)
+{
+	size_t lo = 0;
+	size_t hi = cvector_size(keys);
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (keys[mid].hash < hash) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
 
-		default:
-			break;
+/*
+ * Rules without topics: walk the generic list and the username / clientid
+ * buckets of the client as one list merged by rule position.
+ */
+static uint32_t
+acl_first_match(const acl_action_index *ai, const acl_walk *w)
+{
+	size_t   g = 0, u, c;
+	size_t   ng = cvector_size(ai->generic);
+	size_t   nu = cvector_size(ai->by_user);
+	size_t   nc = cvector_size(ai->by_cid);
+	uint32_t uh = 0, ch = 0;
+
+	if (w->username != NULL && nu > 0) {
+		uh = acl_hash(w->username);
+		u  = acl_key_lower(ai->by_user, uh);
+	} else {
+		u = nu;
+	}
+	if (w->clientid != NULL && nc > 0) {
+		ch = acl_hash(w->clientid);
+		c  = acl_key_lower(ai->by_cid, ch);
+	} else {
+		c = nc;
+	}
+
+	for (;;) {
+		uint32_t pos = UINT32_MAX;
+		int      src = -1;
+
+		if (g < ng) {
+			pos = ai->generic[g];
+			src = 0;
+		}
+		if (u < nu && ai->by_user[u].hash == uh &&
+		    ai->by_user[u].rule < pos) {
+			pos = ai->by_user[u].rule;
+			src = 1;
+		}
+		if (c < nc && ai->by_cid[c].hash == ch &&
+		    ai->by_cid[c].rule < pos) {
+			pos = ai->by_cid[c].rule;
+			src = 2;
 		}
+		if (src < 0) {
+			return UINT32_MAX;
+		}
+		g += src == 0;
+		u += src == 1;
+		c += src == 2;
 
-		if (!match) {
-			continue;
+		if (acl_rule_match(&w->idx->rules[pos], w->username,
+		        w->clientid, w->ipaddr)) {
+			return pos;
 		}
+	}
+}
 
-		if (rule->topic_count > 0) {
-			char **topic_array = rule->topics;
-			bool   found       = false;
-			char  *rule_topic  = NULL;
-			for (size_t j = 0;
-			     j < rule->topic_count && found != true; j++) {
-				if (topic_filter(rule->topics[j], topic)) {
-					found = true;
-					break;
-				}
-				if (check_placeholder(rule->topics[j])) {
-					rule_topic = replace_topic(
-					    rule->topics[j], param);
-					if (topic_filter(rule_topic, topic)) {
-						found = true;
-						break;
-					}
-				}
-			}
-			nng_strfree(rule_topic);
-			if (found == false) {
-				match = false;
-				continue;
+// Returns false if no rule matched.
+static bool
+acl_index_eval(acl_index *idx, acl_action_type act_type, conn_param *param,
+    const char *topic, const topic_levels *tl, bool *allow)
+{
+	acl_action_index *ai = &idx->act[act_type == ACL_PUB ? 0 : 1];
+	acl_walk          w  = { .idx = idx, .topic = topic, .tl = tl };
+	topic_levels      split;
+
+	if (tl == NULL) {
+		topic_split(topic, strlen(topic), &split);
+		w.tl = &split;
+	}
+
+	w.username = (const char *) conn_param_get_username(param);
+	w.clientid = (const char *) conn_param_get_clientid(param);
+	w.ipaddr   = (const char *) conn_param_get_ip_addr_v4(param);
+
+	w.best = acl_first_match(ai, &w);
+	acl_trie_walk(&ai->trie, 0, &w);
+	if (w.best == UINT32_MAX) {
+		return false;
+	}
+	*allow = idx->rules[w.best].permit == ACL_ALLOW;
+	return true;
+}
+
+static acl_index *
+acl_index_get(void)
+{
+	acl_index *idx;
+
+	nng_mtx_lock(acl_ctx.lock);
+	if ((idx = acl_ctx.index) != NULL) {
+		nng_atomic_inc(idx->ref);
+	}
+	nng_mtx_unlock(acl_ctx.lock);
+	return idx;
+}
+
+static void
+acl_index_put(acl_index *idx)
+{
+	if (nng_atomic_dec_nv(idx->ref) == 0) {
+		acl_index_free(idx);
+	}
+}
+
+static inline size_t
+acl_cache_slot(uint32_t pid, acl_action_type act, uint32_t hash)
+{
+	uint32_t h = (hash ^ (pid * 2654435761u)) + (uint32_t) act;
+	return h & (acl_ctx.size - 1);
+}
+
+static bool
+acl_cache_get(uint32_t pid, acl_action_type act, const char *topic,
+    uint32_t hash, uint64_t gen, bool *allow)
+{
+	size_t           s     = acl_cache_slot(pid, act, hash);
+	acl_cache_entry *entry = &acl_ctx.slots[s];
+	bool             hit   = false;
+
+	nng_mtx_lock(acl_ctx.locks[s % ACL_CACHE_LOCKS]);
+	if (entry->topic != NULL && entry->gen == gen && entry->pid == pid &&
+	    entry->act == act && entry->hash == hash &&
+	    strcmp(entry->topic, topic) == 0) {
+		*allow = entry->allow;
+		hit    = true;
+	}
+	nng_mtx_unlock(acl_ctx.locks[s % ACL_CACHE_LOCKS]);
+	return hit;
+}
+
+static void
+acl_cache_put(uint32_t pid, acl_action_type act, const char *topic,
+    uint32_t hash, uint64_t gen, bool allow)
+{
+	size_t           s     = acl_cache_slot(pid, act, hash);
+	acl_cache_entry *entry = &acl_ctx.slots[s];
+	char            *dup;
+
+	if ((dup = nng_strdup(topic)) == NULL) {
+		return;
+	}
+	nng_mtx_lock(acl_ctx.locks[s % ACL_CACHE_LOCKS]);
+	nng_strfree(entry->topic);
+	entry->topic = dup;
+	entry->pid   = pid;
+	entry->act   = (uint8_t) act;
+	entry->hash  = hash;
+	entry->gen   = gen;
+	entry->allow = allow;
+	nng_mtx_unlock(acl_ctx.locks[s % ACL_CACHE_LOCKS]);
+}
+
+int
+acl_init(conf_acl *acl, size_t cache_size)
+{
+	int rv;
+
+	if (acl_ctx.enabled) {
+		return acl_reload(acl);
+	}
+	if (cache_size != 0 && (cache_size & (cache_size - 1)) != 0) {
+		log_error("acl cache size %lu is not a power of two", cache_size);
+		return NNG_EINVAL;
+	}
+	if ((rv = nng_mtx_alloc(&acl_ctx.lock)) != 0) {
+		return rv;
+	}
+	if ((rv = acl_index_build(acl, &acl_ctx.index)) != 0) {
+		nng_mtx_free(acl_ctx.lock);
+		return rv;
+	}
+	if (cache_size > 0) {
+		acl_ctx.slots = nng_zalloc(sizeof(acl_cache_entry) * cache_size);
+		if (acl_ctx.slots == NULL) {
+			log_warn("acl decision cache disabled, out of memory");
+			cache_size = 0;
+		}
+	}
+	acl_ctx.size = cache_size;
+	for (int i = 0; i < ACL_CACHE_LOCKS; i++) {
+		if ((rv = nng_mtx_alloc(&acl_ctx.locks[i])) != 0) {
+			while (--i >= 0) {
+				nng_mtx_free(acl_ctx.locks[i]);
 			}
+			nng_free(acl_ctx.slots, sizeof(acl_cache_entry) * cache_size);
+			acl_ctx.slots = NULL;
+			acl_index_put(acl_ctx.index);
+			acl_ctx.index = NULL;
+			nng_mtx_free(acl_ctx.lock);
+			return rv;
 		}
+	}
+	nng_atomic_alloc64(&acl_ctx.gen);
+	nng_atomic_alloc64(&acl_ctx.hits);
+	nng_atomic_alloc64(&acl_ctx.misses);
+	acl_ctx.enabled = true;
+	return 0;
+}
 
-		result = rule->permit == ACL_ALLOW ? match : !match;
+void
+acl_fini(void)
+{
+	if (!acl_ctx.enabled) {
+		return;
+	}
+	acl_ctx.enabled = false;
+	for (size_t i = 0; i < acl_ctx.size; i++) {
+		nng_strfree(acl_ctx.slots[i].topic);
+	}
+	nng_free(acl_ctx.slots, sizeof(acl_cache_entry) * acl_ctx.size);
+	acl_ctx.slots = NULL;
+	acl_ctx.size  = 0;
+	for (int i = 0; i < ACL_CACHE_LOCKS; i++) {
+		nng_mtx_free(acl_ctx.locks[i]);
+	}
+	acl_index_put(acl_ctx.index);
+	acl_ctx.index = NULL;
+	nng_mtx_free(acl_ctx.lock);
+	nng_atomic_free64(acl_ctx.gen);
+	nng_atomic_free64(acl_ctx.hits);
+	nng_atomic_free64(acl_ctx.misses);
+}
 
-		break;
+int
+acl_reload(conf_acl *acl)
+{
+	acl_index *idx;
+	acl_index *old;
+	int        rv;
+
+	if (!acl_ctx.enabled) {
+		return acl_init(acl, NANO_ACL_CACHE_SIZE);
 	}
+	if ((rv = acl_index_build(acl, &idx)) != 0) {
+		log_error("acl reload failed: %d, keep the old rules", rv);
+		return rv;
+	}
+	nng_mtx_lock(acl_ctx.lock);
+	old           = acl_ctx.index;
+	acl_ctx.index = idx;
+	// decisions taken with the old rules are stale from now on
+	nng_atomic_inc64(acl_ctx.gen);
+	nng_mtx_unlock(acl_ctx.lock);
+
+	acl_index_put(old);
+	return 0;
+}
 
-	conn_param_free(param);
+bool
+acl_cache_enabled(void)
+{
+	return acl_ctx.enabled && acl_ctx.size > 0;
+}
 
-	// if (!match && config->acl_nomatch == ACL_ALLOW &&
-	//     acl->rule_count > 0) {
-	// 	return true;
-	// } else {
-	// 	return result;
-	// }
+uint64_t
+acl_cache_hits(void)
+{
+	return acl_ctx.enabled ? nng_atomic_get64(acl_ctx.hits) : 0;
+}
 
-	if (match) {
-		return result;
-	} else {
-		return config->acl_nomatch == ACL_ALLOW ? true : result;
+uint64_t
+acl_cache_misses(void)
+{
+	return acl_ctx.enabled ? nng_atomic_get64(acl_ctx.misses) : 0;
+}
+
+bool
+auth_acl_pipe(conf *config, acl_action_type act_type, uint32_t pid,
+    conn_param *param, const char *topic, const topic_levels *tl)
+{
+	acl_index *idx;
+	bool       allow   = false;
+	bool       matched = false;
+	bool       cached  = false;
+	uint64_t   gen     = 0;
+	uint32_t   hash    = 0;
+	int        rv;
+
+	if (acl_ctx.enabled && pid != 0 && acl_ctx.size > 0) {
+		cached = true;
+		hash   = acl_hash(topic);
+		gen    = nng_atomic_get64(acl_ctx.gen);
+		if (acl_cache_get(pid, act_type, topic, hash, gen, &allow)) {
+			nng_atomic_inc64(acl_ctx.hits);
+			return allow;
+		}
+		nng_atomic_inc64(acl_ctx.misses);
 	}
+
+	conn_param_clone(param);
+	if (acl_ctx.enabled) {
+		idx = acl_index_get();
+	} else if ((rv = acl_index_build(&config->acl, &idx)) != 0) {
+		// acl_init() was never called, compile the rules for this call
+		log_error("acl index build failed: %d", rv);
+		idx = NULL;
+	}
+	if (idx != NULL) {
+		matched =
+		    acl_index_eval(idx, act_type, param, topic, tl, &allow);
+		acl_index_put(idx);
+	}
+	conn_param_free(param);
+
+	if (!matched) {
+		allow = config->acl_nomatch == ACL_ALLOW;
+	}
+	if (cached) {
+		acl_cache_put(pid, act_type, topic, hash, gen, allow);
+	}
+	return allow;
+}
+
+bool
+auth_acl(conf *config, acl_action_type act_type, conn_param *param,
+    const char *topic)
+{
+	return auth_acl_pipe(config, act_type, 0, param, topic, NULL);
 }
 #endif
@@ -33,8 +33,18 @@
 #include "nng/supplemental/nanolib/utils.h"
 
 #include "include/acl_handler.h"
+#include "include/auth_http_cache.h"
 #include "include/bridge.h"
+#include "include/bridge_forward.h"
+#include "include/bridge_queue.h"
+#include "include/bridge_rtt.h"
+#include "include/bridge_subtable.h"
+#include "include/cpu_affinity.h"
 #include "include/nanomq_rule.h"
+#include "include/rule_filter.h"
+#include "include/rule_sink.h"
+#include "include/sqlite_commit.h"
+#include "include/startup.h"
 #include "include/mqtt_api.h"
 #include "include/nanomq.h"
 #include "include/process.h"
@@ -43,14 +53,55 @@
 #include "include/unsub_handler.h"
 #include "include/web_server.h"
 #include "include/rest_api.h"
+#include "include/match_cache.h"
+#include "include/traffic_stats.h"
+#include "include/sub_stats.h"
+#include "include/topic_alias.h"
+#include "include/share_group.h"
+#include "include/proc_stats.h"
+#include "include/latency_stats.h"
+#include "include/profiler.h"
+#include "include/msg_trace.h"
+#include "include/sys_stats.h"
+#include "include/cluster.h"
+#include "include/bridge_dedupe.h"
+#include "include/bridge_zip.h"
+#include "include/retain_index.h"
+#include "include/retain_replay.h"
+#include "include/retain_store.h"
+#include "include/expiry_wheel.h"
 #include "include/webhook_post.h"
+#include "include/exchange_recent.h"
+#include "include/build_profile.h"
+#include "include/webhook_lifecycle.h"
+#include "include/work_lane.h"
+#include "include/work_pool.h"
+#include "include/connect_admit.h"
+#include "include/pub_quota.h"
+#include "include/sub_queue.h"
+#include "include/sub_reap.h"
+#include "include/session_takeover.h"
+#include "include/transform.h"
+#include "include/work_arena.h"
+#include "include/msg_pool.h"
 #include "include/webhook_inproc.h"
 #include "include/cmd_proc.h"
 #include "include/process.h"
 #include "include/nanomq.h"
 
+#if defined(SUPP_BRIDGE_CACHE)
+	#include "include/bridge_cache.h"
+#endif
+#if defined(SUPP_SESSION_SPILL)
+	#include "include/session_spill.h"
+#endif
+#if defined(SUPP_PARQUET)
+	#include "include/exchange_query.h"
+	#include "include/parquet_sink.h"
+#endif
 #if defined(SUPP_ICEORYX)
 	#include "nng/iceoryx_shm/iceoryx_shm.h"
+	#include "include/iceoryx_map.h"
 #endif
 
 #if defined(SUPP_PLUGIN)
@@ -197,145 +248,914 @@ static nng_optspec cmd_opts[] = {
 // so that we can use this to set the timeout to the correct value for
 // use in poll.
 
+// QoS 0 frames encoded once per publish and shared by every bridge node
+#define BRIDGE_FRAME_CACHE 8
+
+typedef struct {
+	uint8_t  qos;
+	uint8_t  retain;
+	uint8_t  proto_ver;
+	bool     zipped;
+	nng_msg *msg;
+} bridge_frame;
+
+static nng_msg *
+bridge_frame_find(bridge_frame *frames, size_t count, const char *topic,
+    uint32_t topic_len, uint8_t qos, uint8_t retain, uint8_t proto_ver,
+    bool zipped)
+{
+	for (size_t i = 0; i < count; i++) {
+		bridge_frame *f = &frames[i];
+		const char   *t;
+		uint32_t      len;
+		if (f->qos != qos || f->retain != retain ||
+		    f->proto_ver != proto_ver || f->zipped != zipped) {
+			continue;
+		}
+		t = nng_mqtt_msg_get_publish_topic(f->msg, &len);
+		if (len == topic_len && memcmp(t, topic, len) == 0) {
+			return f->msg;
+		}
+	}
+	return NULL;
+}
+
+#if defined(SUPP_BRIDGE_DEDUPE)
+/*
+ * Stamp what goes to a v5 bridge. A dup of the properties of a v5
+ * publisher carries its stamp along, anything else gets the id in mid,
+ * made up on first use so every bridge forwards the same one.
+ */
+static property *
+bridge_pub_stamp(nano_work *work, property *props, char *mid, bool *made)
+{
+	property *p;
+
+	if (work->proto_ver == MQTT_PROTOCOL_VERSION_v5 &&
+	    work->pub_packet->bridge_mid != NULL) {
+		return props;
+	}
+	if (!*made) {
+		bridge_dedupe_stamp(mid);
+		*made = true;
+	}
+	p = mqtt_property_set_value_strpair(USER_PROPERTY, BRIDGE_DEDUPE_KEY,
+	    strlen(BRIDGE_DEDUPE_KEY), mid, BRIDGE_DEDUPE_ID_LEN, true);
+	if (props == NULL) {
+		props = property_alloc();
+	}
+	property_append(props, p);
+	return props;
+}
+#endif
+
+#if defined(SUPP_BRIDGE_ZIP)
+/*
+ * Whether the forward to node goes compressed, with the payload in *zbuf.
+ * It is compressed for the first such bridge, *zrv stays NNG_EAGAIN until
+ * then. Properties the receiver would not take in its lazy scan, where it
+ * looks for the marker, are passed on with the payload as it is.
+ */
+static bool
+bridge_pub_zip(nano_work *work, conf_bridge_node *node, bool scanned,
+    uint8_t **zbuf, uint32_t *zlen, int *zrv)
+{
+	struct pub_packet_struct *pp = work->pub_packet;
+
+	if (node->proto_ver != MQTT_PROTOCOL_VERSION_v5 || !scanned ||
+	    !bridge_zip_wanted(node, pp->var_header.publish.topic_name.body)) {
+		return false;
+	}
+	if (*zrv == NNG_EAGAIN) {
+		*zrv = bridge_zip_deflate(work->ctx.id - 1, node,
+		    pp->payload.data, pp->payload.len, zbuf, zlen);
+	} else if (*zrv == 0) {
+		bridge_zip_sent(node, pp->payload.len, *zlen);
+	}
+	return *zrv == 0;
+}
+#endif
+
 static inline void
 bridge_pub_handler(nano_work *work)
 {
-	int      rv    = 0;
-	property *props = NULL;
-	uint32_t  index = work->ctx.id - 1;
-	mqtt_string *topic;
+	property        *props = NULL;
+	uint32_t         index = work->ctx.id - 1;
+	mqtt_string      topic;
+	bridge_forward **fwds;
+	size_t           n;
+	bridge_frame     frames[BRIDGE_FRAME_CACHE];
+	size_t           frame_count = 0;
+#if defined(SUPP_BRIDGE_DEDUPE)
+	char             mid[BRIDGE_DEDUPE_ID_LEN];
+	bool             mid_made = false;
+#endif
+	bool             zip = false;
+#if defined(SUPP_BRIDGE_ZIP)
+	uint8_t         *zbuf = NULL;
+	uint32_t         zlen = 0;
+	int              zrv  = NNG_EAGAIN;
+	// taken before any forward decodes the properties
+	bool             scanned =
+	    work->proto_ver != MQTT_PROTOCOL_VERSION_v5 ||
+	    work->pub_packet->props_scanned;
+#endif
 
+	// bridge clients still coming up in the background
+	if (!startup_ready(STARTUP_BRIDGE)) {
+		return;
+	}
 	// Or we just exclude all topic with $?
 	if ((work->pub_packet->var_header.publish.topic_name.len > strlen("$SYS")) &&
 		strncmp(work->pub_packet->var_header.publish.topic_name.body, "$SYS", strlen("$SYS")) == 0) {
 		return;
 	}
-	topic = nng_zalloc(sizeof(*topic));
-	for (size_t t = 0; t < work->config->bridge.count; t++) {
-		conf_bridge_node *node = work->config->bridge.nodes[t];
-		nng_mtx_lock(node->mtx);		//TODO bridge performance
-		if (node->enable) {
-			for (size_t i = 0; i < node->forwards_count; i++) {
-				rv = 0;
-				topic->body = work->pub_packet->var_header.publish.topic_name.body;
-				topic->len  = work->pub_packet->var_header.publish.topic_name.len;
-				if (topic_filter(node->forwards_list[i]->local_topic,
-							(const char *)topic->body)) {
-					work->state = SEND;
-
-					nng_msg *bridge_msg = NULL;
-					if (work->proto_ver == MQTT_PROTOCOL_VERSION_v5 &&
-						node->proto_ver == MQTT_PROTOCOL_VERSION_v5) {
-						mqtt_property_dup(
-						    &props, work->pub_packet->var_header.publish.properties);
-					}
-					// No change if remote topic == ""
-					if (node->forwards_list[i]->remote_topic_len != 0) {
-						topic->body = node->forwards_list[i]->remote_topic;
-						topic->len = node->forwards_list[i]->remote_topic_len;
-					}
-					if (node->forwards_list[i]->prefix != NULL) {
-						topic->body =
-							nng_strnins(topic->body, node->forwards_list[i]->prefix,
-										topic->len, node->forwards_list[i]->prefix_len);
-						topic->len = strlen(topic->body);
-						rv = NNG_STAT_STRING;	//mark it for free
-					}
-					if (node->forwards_list[i]->suffix != NULL) {
-						char *tmp = topic->body;
-						topic->body =
-							nng_strncat(topic->body, node->forwards_list[i]->suffix,
-										topic->len, node->forwards_list[i]->suffix_len);
-						topic->len = strlen(topic->body);
-						if (rv == NNG_STAT_STRING)
-							nng_free(tmp, strlen(tmp));
-						else
-							rv = NNG_STAT_STRING;	//mark it for free
-					}
-					uint8_t retain;
-					uint8_t qos;
-					retain =
-					    node->forwards_list[i]->retain == NO_RETAIN
-					    ? work->pub_packet->fixed_header.retain
-					    : node->forwards_list[i]->retain;
-					qos    =
-					    node->forwards_list[i]->qos == NO_QOS
-					    ? work->pub_packet->fixed_header.qos
-					    : node->forwards_list[i]->qos;
-					bridge_msg = bridge_publish_msg(
-					    topic->body,
-					    work->pub_packet->payload.data,
-					    work->pub_packet->payload.len,
-					    work->pub_packet->fixed_header.dup,
-					    qos, retain, props);
-					if (rv == NNG_STAT_STRING) {
-						nng_free(topic->body,strlen(topic->body));
-					}
+	n = bridge_forward_begin(index,
+	    work->pub_packet->var_header.publish.topic_name.body,
+	    pub_packet_levels(work->pub_packet), &fwds);
+	for (size_t i = 0; i < n; i++) {
+		bridge_forward   *fwd  = fwds[i];
+		conf_bridge_node *node = fwd->node;
+		if (!node->enable) {
+			continue;
+		}
+		work->state = SEND;
+
+		nng_msg *bridge_msg = NULL;
+		topic.body = (char *) bridge_rewrite_topic(&fwd->rewrite,
+		    work->pub_packet->var_header.publish.topic_name.body,
+		    work->pub_packet->var_header.publish.topic_name.len,
+		    &work->topic_buf, &work->topic_buf_cap, &topic.len);
+		if (topic.body == NULL) {
+			log_error("bridge: alloc remote topic failed");
+			continue;
+		}
+		uint8_t retain;
+		uint8_t qos;
+		retain = fwd->retain == NO_RETAIN
+		    ? work->pub_packet->fixed_header.retain
+		    : fwd->retain;
+		qos = fwd->qos == NO_QOS ? work->pub_packet->fixed_header.qos
+		                         : fwd->qos;
+#if defined(SUPP_BRIDGE_ZIP)
+		zip = bridge_pub_zip(work, node, scanned, &zbuf, &zlen, &zrv);
+#endif
 
-					node->proto_ver == MQTT_PROTOCOL_VERSION_v5
-					    ? nng_mqttv5_msg_encode(bridge_msg)
-					    : nng_mqtt_msg_encode(bridge_msg);
-
-					nng_socket *socket = node->sock;
-
-					// what if send qos msg failed?
-					// nanosdk deal with fail send
-					// and close the pipe
-					if (nng_aio_busy(
-					        node->bridge_aio[index])) {
-						nng_msg_free(bridge_msg);
-						log_info(
-						    "bridging to %s aio busy! "
-						    "msg lost! Ctx: %d",
-						    node->address, work->ctx.id);
-					} else {
-						nng_aio_set_timeout(node->bridge_aio[index],
-											node->cancel_timeout);
-						nng_aio_set_msg(node->bridge_aio[index], bridge_msg);
-						// switch to nng_ctx_send!
-						nng_send_aio(*socket, node->bridge_aio[index]);
-					}
-					rv = SUCCESS;
+		// QoS 1/2 frames get a packet id from their client, so only
+		// QoS 0 frames can be shared
+		if (qos == 0 &&
+		    (bridge_msg = bridge_frame_find(frames, frame_count,
+		         topic.body, topic.len, qos, retain, node->proto_ver,
+		         zip)) != NULL) {
+			nng_msg_clone(bridge_msg);
+		} else {
+			// the previous message owns the last ones
+			props = NULL;
+			if (work->proto_ver == MQTT_PROTOCOL_VERSION_v5 &&
+			    node->proto_ver == MQTT_PROTOCOL_VERSION_v5) {
+				mqtt_property_dup(&props,
+				    pub_packet_properties(
+				        work->pub_packet, work->msg));
+			}
+#if defined(SUPP_BRIDGE_DEDUPE)
+			if (node->proto_ver == MQTT_PROTOCOL_VERSION_v5) {
+				props = bridge_pub_stamp(
+				    work, props, mid, &mid_made);
+			}
+#endif
+			uint8_t *data = work->pub_packet->payload.data;
+			uint32_t len  = work->pub_packet->payload.len;
+#if defined(SUPP_BRIDGE_ZIP)
+			if (zip) {
+				property *p = mqtt_property_set_value_strpair(
+				    USER_PROPERTY, BRIDGE_ZIP_KEY,
+				    strlen(BRIDGE_ZIP_KEY), BRIDGE_ZIP_ZLIB,
+				    BRIDGE_ZIP_VALUE_LEN, true);
+				if (props == NULL) {
+					props = property_alloc();
 				}
+				property_append(props, p);
+				data = zbuf;
+				len  = zlen;
+			}
+#endif
+			bridge_msg = bridge_publish_msg(topic.body, data, len,
+			    work->pub_packet->fixed_header.dup, qos, retain, props);
+
+			node->proto_ver == MQTT_PROTOCOL_VERSION_v5
+			    ? nng_mqttv5_msg_encode(bridge_msg)
+			    : nng_mqtt_msg_encode(bridge_msg);
+
+			if (qos == 0 && frame_count < BRIDGE_FRAME_CACHE) {
+				bridge_frame *f = &frames[frame_count++];
+				f->qos          = qos;
+				f->retain       = retain;
+				f->proto_ver    = node->proto_ver;
+				f->zipped       = zip;
+				f->msg          = bridge_msg;
+				nng_msg_clone(bridge_msg);
+			}
+		}
+
+		// what if send qos msg failed?
+		// nanosdk deal with fail send
+		// and close the pipe
+		bool urgent = false;
+#if defined(SUPP_QUIC)
+		// quic_qos_priority: QoS 1/2 forwards overtake queued QoS 0
+		urgent = node->qos_first && qos > 0;
+#endif
+#if defined(SUPP_BRIDGE_CACHE)
+		// offline or still replaying: keep it on disk for later
+		int cached = bridge_cache_offer(node, bridge_msg);
+		if (cached != NNG_ENOENT) {
+			if (cached == NNG_EAGAIN) {
+				log_info("bridging to %s cache full! msg lost!",
+				    node->address);
 			}
+			continue;
+		}
+#endif
+		if (bridge_queue_send(node, node->bridge_aio[index], bridge_msg,
+		        urgent) == NNG_EAGAIN) {
+			log_info("bridging to %s queue full! "
+			         "msg lost! Ctx: %d",
+			    node->address, work->ctx.id);
 		}
-		nng_mtx_unlock(node->mtx);
 	}
-	nng_free(topic, sizeof(topic));
+	bridge_forward_end(index);
+
+	for (size_t i = 0; i < frame_count; i++) {
+		nng_msg_free(frames[i].msg);
+	}
 	return;
 }
 
+// Aliases only go to sessions that end with the connection, messages kept
+// for a resumed one would reach a new connection that never learnt them.
+static void
+topic_alias_grant(nano_work *work)
+{
+	property      *props;
+	property_data *pd;
+
+	if (work->proto_ver != MQTT_PROTOCOL_VERSION_v5 ||
+	    !conn_param_get_clean_start(work->cparam) ||
+	    (props = conn_param_get_property(work->cparam)) == NULL) {
+		return;
+	}
+	if ((pd = property_get_value(props, SESSION_EXPIRY_INTERVAL)) !=
+	        NULL &&
+	    pd->p_value.u32 != 0) {
+		return;
+	}
+	if ((pd = property_get_value(props, TOPIC_ALIAS_MAXIMUM)) == NULL ||
+	    pd->p_value.u16 == 0) {
+		return;
+	}
+	if (topic_alias_out_open(work->pid.id, pd->p_value.u16) != 0) {
+		log_warn("no topic aliases for pipe %d", work->pid.id);
+	}
+}
+
+// How long the session of work's pipe outlives it (ms), its Session Expiry
+// Interval for v5, NANO_TAKEOVER_GRACE_MS for a v3.1.1 persistent session.
+static nng_time
+session_linger(nano_work *work)
+{
+	property      *props;
+	property_data *pd;
+
+	if (work->proto != PROTO_MQTT_BROKER) {
+		return 0;
+	}
+	if (work->proto_ver != MQTT_PROTOCOL_VERSION_v5) {
+		return conn_param_get_clean_start(work->cparam)
+		    ? 0
+		    : NANO_TAKEOVER_GRACE_MS;
+	}
+	if ((props = conn_param_get_property(work->cparam)) == NULL ||
+	    (pd = property_get_value(props, SESSION_EXPIRY_INTERVAL)) ==
+	        NULL) {
+		return 0;
+	}
+	return (nng_time) pd->p_value.u32 * 1000;
+}
+
+// A send defining an outbound alias completed, the client knows it if it
+// went out.
+static void
+alias_sent_cb(void *arg)
+{
+	nano_work *work = arg;
+	nng_msg   *msg;
+
+	if (nng_aio_result(work->alias_aio) == 0) {
+		topic_alias_out_known(
+		    work->alias_pipe, work->alias, work->alias_stamp);
+	} else if ((msg = nng_aio_get_msg(work->alias_aio)) != NULL) {
+		nng_aio_set_msg(work->alias_aio, NULL);
+		nng_msg_free(msg);
+	}
+}
+
+// false while the last send defining an alias has not completed
+static bool
+alias_aio_ready(nano_work *work)
+{
+	if (work->alias_aio == NULL &&
+	    nng_aio_alloc(&work->alias_aio, alias_sent_cb, work) != 0) {
+		work->alias_aio = NULL;
+		return false;
+	}
+	return !nng_aio_busy(work->alias_aio);
+}
+
+// send work->pid.id its own copy of smsg with the topic as an alias, false
+// when the pipe takes no aliases or the payload is too large to copy. QoS 1
+// and 2 go with the full topic: a retransmission may follow after the
+// alias was given to another topic. The topic goes along with the alias
+// until one of these sends completed on work->alias_aio, the others go
+// the usual way and tell nothing.
+static bool
+send_aliased(nano_work *work, nng_msg *smsg)
+{
+	struct pub_packet_struct *pp = work->pub_packet;
+	nng_msg                  *amsg;
+	uint16_t                  alias;
+	uint32_t                  stamp;
+	bool                      known;
+
+	if (pp == NULL || pp->fixed_header.qos > 0 ||
+	    pp->payload.len > NANO_TOPIC_ALIAS_OUT_MAX_PAYLOAD ||
+	    topic_alias_out_begin(work->pid.id,
+	        pp->var_header.publish.topic_name.body,
+	        pp->var_header.publish.topic_name.len, &alias, &known,
+	        &stamp) != 0) {
+		return false;
+	}
+	if ((amsg = encode_pub_alias(smsg, work, alias, known)) == NULL) {
+		topic_alias_out_end(work->pid.id, alias, false);
+		return false;
+	}
+#if defined(SUPP_TRAFFIC_STATS)
+	traffic_client_out(
+	    work->pid.id, nng_msg_header_len(amsg) + nng_msg_len(amsg));
+#endif
+	if (!known && alias_aio_ready(work)) {
+		work->alias_pipe  = work->pid.id;
+		work->alias       = alias;
+		work->alias_stamp = stamp;
+		nng_aio_set_prov_data(work->alias_aio, &work->alias_pipe);
+		nng_aio_set_msg(work->alias_aio, amsg);
+		nng_ctx_send(work->ctx, work->alias_aio);
+	} else {
+		nng_aio_set_prov_data(work->aio, &work->pid.id);
+		work->msg = amsg;
+		nng_aio_set_msg(work->aio, work->msg);
+		nng_ctx_send(work->ctx, work->aio);
+	}
+	topic_alias_out_end(work->pid.id, alias, true);
+	return true;
+}
+
+static void
+sub_queue_slow(uint32_t pipe, const sub_queue_state *st, void *arg)
+{
+	nano_work  *work = arg;
+	nng_pipe    p    = { .id = pipe };
+	conn_param *cp;
+
+	if (!st->slow) {
+		log_info("pipe %u caught up, %llu dropped while slow", pipe,
+		    (unsigned long long) st->dropped);
+		return;
+	}
+	log_warn("pipe %u is slow: %llu msgs unacknowledged", pipe,
+	    (unsigned long long) st->msgs);
+	if (!work->config->web_hook.enable ||
+	    (cp = nng_pipe_cparam(p)) == NULL) {
+		return;
+	}
+	webhook_client_slow(&work->hook_sock, &work->config->web_hook,
+	    (const char *) conn_param_get_username(cp),
+	    (const char *) conn_param_get_clientid(cp), st->msgs);
+	conn_param_free(cp);
+}
+
+// false when smsg is not to be queued on pipe, which is closed when its
+// policy says so
+static bool
+sub_queue_admit(uint32_t pipe, nng_msg *smsg)
+{
+	nng_pipe p = { .id = pipe };
+
+	switch (sub_queue_check(pipe, (nng_msg_header(smsg)[0] & 0x06) >> 1)) {
+	case SUB_QUEUE_SEND:
+		return true;
+	case SUB_QUEUE_CLOSE:
+		nng_pipe_close(p);
+		return false;
+	case SUB_QUEUE_SKIP:
+	default:
+		return false;
+	}
+}
+
+#if defined(SUPP_SESSION_SPILL)
+// true when a QoS 1/2 smsg was taken for the offline session of pipe
+static bool
+session_spill_offer(nano_work *work, uint32_t pipe, nng_msg *smsg)
+{
+	session_spill_rec rec = {
+		.cmd       = nng_msg_cmd_type(smsg),
+		.proto_ver = work->proto_ver,
+		.head      = nng_msg_header(smsg),
+		.head_len  = nng_msg_header_len(smsg),
+		.body      = nng_msg_body(smsg),
+		.body_len  = nng_msg_len(smsg),
+	};
+	int rv;
+
+	if ((rec.head[0] & 0x06) == 0 ||
+	    (rv = session_spill_put(pipe, &rec)) == NNG_ENOENT) {
+		return false;
+	}
+	if (rv != 0) {
+		log_info("offline session of pipe %u full! msg lost!", pipe);
+	}
+	return true;
+}
+
+// session_spill_online callback, arg is the work of the CONNACK
+static void
+session_spill_replay(void *arg, const session_spill_rec *rec)
+{
+	nano_work *work = arg;
+	nng_msg   *msg;
+
+	if (nng_msg_alloc(&msg, rec->body_len) != 0) {
+		log_error("Mem error");
+		return;
+	}
+	memcpy(nng_msg_body(msg), rec->body, rec->body_len);
+	nng_msg_header_append(msg, rec->head, rec->head_len);
+	nng_msg_set_remaining_len(msg, rec->body_len);
+	nng_msg_set_cmd_type(msg, rec->cmd);
+	nng_mqtt_msg_proto_data_alloc(msg);
+	nng_mqtt_msg_set_connect_proto_version(msg, rec->proto_ver);
+	nng_aio_set_prov_data(work->aio, &work->pid.id);
+	nng_aio_set_msg(work->aio, msg);
+	nng_ctx_send(work->ctx, work->aio);
+}
+#endif
+
+// deliver the encoded smsg to every subscriber pipe in a dbtree pid vector
+static void
+send_to_pipes(nano_work *work, nng_msg *smsg, uint32_t *pipes)
+{
+#if defined(SUPP_CLUSTER)
+	// what a peer sent is for the local subscribers only
+	bool from_peer = work->proto == PROTO_MQTT_BRIDGE &&
+	    cluster_node(work->extra->node);
+#endif
+	for (size_t i = 0; i < cvector_size(pipes); i++) {
+		// closed, its subscriptions are still being removed
+		if (pipes[i] == 0 || sub_reap_dead(pipes[i]) ||
+		    !sub_queue_admit(pipes[i], smsg)) {
+			continue;
+		}
+#if defined(SUPP_CLUSTER)
+		if (from_peer && cluster_peer_pipe(pipes[i])) {
+			continue;
+		}
+#endif
+#if defined(SUPP_SESSION_SPILL)
+		if (session_spill_offer(work, pipes[i], smsg)) {
+			continue;
+		}
+#endif
+		work->pid.id = pipes[i];
+		if (sub_queue_enabled()) {
+			// downgraded by the protocol layer to what pipe was
+			// granted, a QoS 0 delivery is never acknowledged
+			sub_queue_sent(pipes[i],
+			    sub_ctx_qos(pipes[i],
+			        work->pub_packet->var_header.publish.topic_name
+			            .body,
+			        (nng_msg_header(smsg)[0] & 0x06) >> 1));
+		}
+		if (send_aliased(work, smsg)) {
+			continue;
+		}
+		nng_msg_clone(smsg);
+#if defined(SUPP_TRAFFIC_STATS)
+		traffic_client_out(
+		    pipes[i], nng_msg_header_len(smsg) + nng_msg_len(smsg));
+#endif
+		nng_aio_set_prov_data(work->aio, &work->pid.id);
+		work->msg = smsg;
+		nng_aio_set_msg(work->aio, work->msg);
+		nng_ctx_send(work->ctx, work->aio);
+	}
+}
+
+#if defined(SUPP_PLUGIN)
+static void
+plugin_msg_view_fill(nano_work *work, plugin_msg_view *v)
+{
+	struct pub_packet_struct *pp = work->pub_packet;
+
+	memset(v, 0, sizeof(*v));
+	v->topic       = pp->var_header.publish.topic_name.body;
+	v->topic_len   = pp->var_header.publish.topic_name.len;
+	v->payload     = pp->payload.data;
+	v->payload_len = pp->payload.len;
+	v->qos         = pp->fixed_header.qos;
+	v->retain      = pp->fixed_header.retain;
+	v->proto_ver   = work->proto_ver;
+	v->pipe_id     = work->pid.id;
+	v->subscribers = pipe_content_count(work->pipe_ct);
+}
+
+// The user property and the ON_ROUTE hooks, before smsg is encoded.
+static void
+plugin_route(nano_work *work, nng_msg *smsg, plugin_msg_view *view)
+{
+	if (work->pub_packet == NULL) {
+		return;
+	}
+	pub_packet_plugin_property(work, smsg);
+	plugin_msg_view_fill(work, view);
+	plugin_hook_call(HOOK_ON_ROUTE, view);
+}
+
+// Every subscriber pipe the message went to, in a single batch.
+static void
+plugin_deliver(nano_work *work, const plugin_msg_view *route)
+{
+	uint32_t        *vecs[2] = { work->pipe_ct->pipes,
+                work->pipe_ct->shared_pipes };
+	size_t           cap     = pipe_content_count(work->pipe_ct);
+	size_t           size    = cap * (sizeof(plugin_msg_view) + sizeof(void *));
+	size_t           n       = 0;
+	plugin_msg_view *views;
+	void           **data;
+	void            *mem;
+	bool             heap    = false;
+
+	if (work->pub_packet == NULL || cap == 0 ||
+	    !plugin_hook_has(HOOK_ON_DELIVER)) {
+		return;
+	}
+	if ((mem = work_arena_get(work->arena, size)) == NULL) {
+		// the arena is full or there is none
+		if ((mem = nng_alloc(size)) == NULL) {
+			return;
+		}
+		heap = true;
+	}
+	views = mem;
+	data  = (void **) (views + cap);
+	for (int k = 0; k < 2; k++) {
+		for (size_t i = 0; i < cvector_size(vecs[k]); i++) {
+			if (vecs[k][i] == 0) {
+				continue;
+			}
+			views[n]         = *route;
+			views[n].pipe_id = vecs[k][i];
+			data[n]          = &views[n];
+			n++;
+		}
+	}
+	plugin_hook_call_batch(HOOK_ON_DELIVER, data, n);
+	if (heap) {
+		nng_free(mem, size);
+	}
+}
+#endif
+
+#if defined(SUPP_RULE_ENGINE) || defined(SUPP_SYS_STATS)
+// Route a PUBLISH the broker made itself, the way WAIT routes a client
+// PUBLISH but without bridges, hooks or rules, so a rule can never feed
+// itself. msg is freed.
+static void
+route_local(nano_work *work, nng_msg *msg)
+{
+	uint8_t proto = work->proto;
+
+	// no bridge topic reflection for messages of our own
+	work->proto = PROTO_MQTT_BROKER;
+	work->msg   = msg;
+	nng_msg_set_cmd_type(msg, CMD_PUBLISH);
+	if (handle_pub(work, work->pipe_ct, MQTT_PROTOCOL_VERSION_v311, true) ==
+	        SUCCESS &&
+	    pipe_content_count(work->pipe_ct) > 0 &&
+	    encode_pub_message(msg, work, PUBLISH)) {
+		send_to_pipes(work, msg, work->pipe_ct->pipes);
+		send_to_pipes(work, msg, work->pipe_ct->shared_pipes);
+	}
+	if (work->pub_packet != NULL) {
+		free_pub_packet(work->pub_packet);
+		work->pub_packet = NULL;
+	}
+	free_pipe_content(work->pipe_ct);
+	nng_msg_free(msg);
+	work->msg   = NULL;
+	work->proto = proto;
+}
+#endif
+
+#if defined(SUPP_RULE_ENGINE)
+// Route the republishes the rule engine queued for the broker itself.
+static void
+rule_repub_flush(nano_work *work)
+{
+	for (size_t i = 0; i < cvector_size(work->repubs); i++) {
+		route_local(work, work->repubs[i]);
+	}
+	cvector_free(work->repubs);
+	work->repubs = NULL;
+}
+#endif
+
+#if defined(SUPP_SYS_STATS)
+// The $SYS messages go out on a work of their own that is never started,
+// so only the publisher timer ever runs it.
+static void
+sys_stats_publish(void *arg, const sys_stats_msg *msgs, size_t n)
+{
+	nano_work  *work = arg;
+	nng_msg    *msg;
+	mqtt_string topic;
+	mqtt_string data;
+
+	work_arena_reset(work->arena);
+	for (size_t i = 0; i < n; i++) {
+		msg        = NULL;
+		topic.body = (char *) msgs[i].topic;
+		topic.len  = strlen(msgs[i].topic);
+		data.body  = (char *) msgs[i].payload;
+		data.len   = strlen(msgs[i].payload);
+		if (nano_pubmsg_composer(&msg, 0, 0, &data, &topic,
+		        MQTT_PROTOCOL_VERSION_v311, nng_clock()) == NULL) {
+			log_warn("$SYS message %s dropped", msgs[i].topic);
+			continue;
+		}
+		route_local(work, msg);
+	}
+}
+#endif
+
+static void
+auth_http_resume(void *arg, int rv)
+{
+	nano_work *work = arg;
+
+	(void) rv; // cached by now, handle_pub reads it from there
+	nng_aio_set_msg(work->aio, work->msg);
+	nng_aio_finish(work->aio, 0);
+}
+
+// A PUBLISH whose topic has no cached auth_http decision waits on a pool
+// thread for it instead of asking right here, then goes through RECV again.
+static bool
+auth_http_park(nano_work *work)
+{
+	uint8_t *body = nng_msg_body(work->msg);
+	size_t   len  = nng_msg_len(work->msg);
+	size_t   topic_len;
+
+	if (work->auth_parked) {
+		work->auth_parked = false;
+		return false;
+	}
+	if (work->proto != PROTO_MQTT_BROKER ||
+	    !work->config->auth_http.enable || len < 2) {
+		return false;
+	}
+	// the topic leads the variable header, an alias is resolved later
+	topic_len = ((size_t) body[0] << 8) | body[1];
+	if (topic_len == 0 || topic_len + 2 > len ||
+	    auth_http_cache_get(
+	        (const char *) conn_param_get_clientid(work->cparam),
+	        (const char *) conn_param_get_username(work->cparam), false,
+	        (const char *) body + 2, topic_len) != AUTH_HTTP_MISS) {
+		return false;
+	}
+	work->auth_parked = true;
+	if (auth_http_cache_check(work->cparam, false, (const char *) body + 2,
+	        topic_len, auth_http_resume, work) != 0) {
+		work->auth_parked = false;
+		return false;
+	}
+	return true;
+}
+
+static void
+connect_admit_resume(void *arg, int rv)
+{
+	nano_work *work = arg;
+
+	work->admit_refused = rv != 0;
+	nng_aio_set_msg(work->aio, work->msg);
+	nng_aio_finish(work->aio, 0);
+}
+
+// A CONNACK the protocol layer accepted still needs a token of the
+// admission buckets. Without one it waits on the admission thread and goes
+// through RECV again, or turns into "server busy" when refused.
+static bool
+connect_admit_park(nano_work *work)
+{
+	uint8_t *body = nng_msg_body(work->msg);
+	int      rv;
+
+	if (work->admit_parked) {
+		work->admit_parked = false;
+	} else {
+		if (work->proto != PROTO_MQTT_BROKER ||
+		    nng_msg_len(work->msg) < 2 || body[1] != SUCCESS) {
+			return false;
+		}
+		work->admit_parked = true;
+		rv = connect_admit_try(nano_pipe_get_local_port(work->pid),
+		    connect_admit_resume, work);
+		if (rv == NNG_EAGAIN) {
+			return true;
+		}
+		work->admit_parked  = false;
+		work->admit_refused = rv != 0;
+	}
+	if (work->admit_refused) {
+		work->admit_refused = false;
+		// 3 is "server unavailable" of MQTT 3.1.1
+		body[1] = work->proto_ver == MQTT_VERSION_V5 ? SERVER_BUSY : 0x03;
+	}
+	return false;
+}
+
+// Works the elastic pool added on top of `parallel`. Retired ones are kept
+// for reuse as their statistics blocks stay linked in.
+static struct {
+	nng_mtx    *mtx;
+	nano_work **works;
+	size_t      count;
+	size_t      cap;
+	nng_socket  sock;
+	nng_socket  extra_sock;
+	dbtree     *db;
+	dbtree     *db_ret;
+	conf       *config;
+} elastic_;
+
+static void
+work_lane_resume(nano_work *work, nng_msg *msg)
+{
+	nng_aio_set_msg(work->aio, msg);
+	work->state = RECV;
+	nng_aio_finish(work->aio, 0);
+}
+
+// Heavy works take their next packet from the lane, the others from the
+// ctx unless the elastic pool retired them meanwhile.
+static void
+work_recv(nano_work *work)
+{
+	nng_msg *msg;
+
+	if (work->proto == PROTO_MQTT_BROKER && !work->heavy) {
+		work_pool_idle();
+	}
+	work->state = RECV;
+	if (work->heavy) {
+		if ((msg = work_lane_next(work)) != NULL) {
+			work_lane_resume(work, msg);
+		}
+		return;
+	}
+	if (work->pool != WORK_FIXED) {
+		nng_mtx_lock(elastic_.mtx);
+		if (work->pool == WORK_RETIRING) {
+			work->pool = WORK_PARKED;
+			nng_mtx_unlock(elastic_.mtx);
+			work_pool_retired();
+			return;
+		}
+		nng_mtx_unlock(elastic_.mtx);
+	}
+	nng_ctx_recv(work->ctx, work->aio);
+}
+
+// Pass SUBSCRIBE and UNSUBSCRIBE on to a heavy work and go back to
+// receiving, a full lane leaves the packet to this work.
+static bool
+work_lane_hand_off(nano_work *work, nng_msg *msg)
+{
+	work_lane_id lane = work_lane_classify(nng_msg_cmd_type(msg));
+	nano_work   *heavy;
+
+	if (work->proto != PROTO_MQTT_BROKER || work->heavy ||
+	    work->auth_parked || work->admit_parked || work->quota_parked) {
+		return false;
+	}
+	if (lane != WORK_LANE_HEAVY ||
+	    work_lane_submit(msg, (void **) &heavy) != 0) {
+		work_lane_count(lane);
+		return false;
+	}
+	if (heavy != NULL) {
+		work_lane_resume(heavy, msg);
+	}
+	work_recv(work);
+	return true;
+}
+
+// A PUBLISH over the quota of its client is held back on the aio timer
+// and goes through RECV again, is dropped or gets the client disconnected.
+static bool
+pub_quota_park(nano_work *work)
+{
+	uint8_t     *header;
+	nng_duration wait;
+
+	if (work->quota_parked) {
+		work->quota_parked = false;
+		return false;
+	}
+	if (work->proto != PROTO_MQTT_BROKER || !pub_quota_enabled()) {
+		return false;
+	}
+	header = nng_msg_header(work->msg);
+	switch (pub_quota_check(work->pid.id,
+	    nng_msg_header_len(work->msg) + nng_msg_len(work->msg),
+	    (header[0] & 0x06) >> 1, &wait)) {
+	case PUB_QUOTA_PASS:
+		return false;
+	case PUB_QUOTA_DROPPED:
+		// free conn_param due to clone in protocol layer
+		conn_param_free(work->cparam);
+		nng_msg_free(work->msg);
+		work->msg = NULL;
+		work_recv(work);
+		return true;
+	case PUB_QUOTA_WAIT:
+		work->quota_parked = true;
+		nng_aio_set_msg(work->aio, work->msg);
+		nng_sleep_aio(wait, work->aio);
+		return true;
+	case PUB_QUOTA_CLOSE:
+	default:
+		work->code  = MESSAGE_RATE_TOO_HIGH;
+		work->state = CLOSE;
+		conn_param_free(work->cparam);
+		nng_aio_finish(work->aio, 0);
+		return true;
+	}
+}
+
 void
 server_cb(void *arg)
 {
 	nano_work     *work = arg;
 	nng_msg       *msg  = NULL;
 	nng_msg       *smsg = NULL;
+	uint32_t       from;
 	int            rv;
 
-	mqtt_msg_info *msg_info;
 	nng_socket    *newsock = NULL;
 
+	PROF_STATE(work);
 	switch (work->state) {
 	case INIT:
 		// log_debug("INIT ^^^^^^^^ ctx [%d] ^^^^^^^^ \n", work->ctx.id);
 		work->state = RECV;
 		if (work->proto == PROTO_MQTT_BROKER) {
 			log_debug("INIT ^^^^^^^^ ctx [%d] ^^^^^^^^ \n", work->ctx.id);
-			nng_ctx_recv(work->ctx, work->aio);
+			if (!work->heavy) {
+				work_pool_busy(); // work_recv counts it idle
+			}
+			work_recv(work);
 #if defined(SUPP_ICEORYX)
 		} else if (work->proto == PROTO_ICEORYX_BRIDGE) {
-			log_debug("INIT ^^^^^^^^ iceoryx ctx [%d] ^^^^^^^^ \n", work->extra_ctx.id);
+			log_debug("INIT ^^^^^^^^ iceoryx ctx [%d] ^^^^^^^^ \n", work->extra->ctx.id);
 			nng_aio_set_prov_data(work->aio, work->iceoryx_suber);
-			nng_ctx_recv(work->extra_ctx, work->aio);
+			nng_ctx_recv(work->extra->ctx, work->aio);
 #endif
 		} else {
-			log_debug("INIT ^^^^^^^^ extra ctx [%d] ^^^^^^^^ \n", work->extra_ctx.id);
-			nng_ctx_recv(work->extra_ctx, work->aio);
+			log_debug("INIT ^^^^^^^^ extra ctx [%d] ^^^^^^^^ \n", work->extra->ctx.id);
+			nng_ctx_recv(work->extra->ctx, work->aio);
 		}
 		break;
 	case RECV:
 		log_debug("RECV  ^^^^ ctx%d ^^^^\n", work->ctx.id);
+		// the last message is done with, parked ones did not start yet
+		work_arena_reset(work->arena);
+		if (work->proto == PROTO_MQTT_BROKER && !work->heavy &&
+		    !work->auth_parked && !work->admit_parked &&
+		    !work->quota_parked) {
+			work_pool_busy();
+		}
 		msg = nng_aio_get_msg(work->aio);
 		if ((rv = nng_aio_result(work->aio)) != 0) {
 			log_info("RECV aio result: %d", rv);
@@ -343,12 +1163,12 @@ server_cb(void *arg)
 			if (work->proto == PROTO_MQTT_BROKER) {
 				if (msg != NULL)
 					nng_msg_free(msg);
-				nng_ctx_recv(work->ctx, work->aio);
+				work_recv(work);
 				break;
 			} else {
 				// check notify msg of bridge
 				if (rv != NNG_ECONNSHUT || msg == NULL) {
-					nng_ctx_recv(work->extra_ctx, work->aio);
+					nng_ctx_recv(work->extra->ctx, work->aio);
 					break;
 				}
 				log_info("bridge connection closed with reason %d\n", rv);
@@ -365,7 +1185,7 @@ server_cb(void *arg)
 				// msg from upstream
 				work->state = RECV;
 				nng_msg_free(msg);
-				nng_ctx_recv(work->extra_ctx, work->aio);
+				nng_ctx_recv(work->extra->ctx, work->aio);
 				break;
 			}
 		} else if (work->proto == PROTO_HTTP_SERVER ||
@@ -375,7 +1195,7 @@ server_cb(void *arg)
 			    nng_msg_get_type(decode_msg) != CMD_PUBLISH) {
 				conn_param_free(nng_msg_get_conn_param(decode_msg));
 				work->state = RECV;
-				nng_ctx_recv(work->extra_ctx, work->aio);
+				nng_ctx_recv(work->extra->ctx, work->aio);
 				break;
 			}
 			msg = decode_msg;
@@ -392,7 +1212,7 @@ server_cb(void *arg)
 				log_error("Failed to decode iceoryx msg %d", rv);
 				work->state = RECV;
 				nng_aio_set_prov_data(work->aio, work->iceoryx_suber);
-				nng_ctx_recv(work->extra_ctx, work->aio);
+				nng_ctx_recv(work->extra->ctx, work->aio);
 				break;
 			}
 			msg = decode_msg;
@@ -400,16 +1220,21 @@ server_cb(void *arg)
 			nng_msg_iceoryx_free(icemsg, work->iceoryx_suber);
 #endif
 		}
+		if (work_lane_hand_off(work, msg)) {
+			break;
+		}
 		// processing what we got now
 		work->msg       = msg;
 		work->pid       = nng_msg_get_pipe(work->msg);
 		work->cparam    = nng_msg_get_conn_param(work->msg);
 		work->proto_ver = conn_param_get_protover(work->cparam);
 		work->flag      = nng_msg_cmd_type(msg);
+		LATENCY_SAMPLE(work, work->flag == CMD_PUBLISH);
 
 		if (work->flag == CMD_SUBSCRIBE) {
 			smsg = work->msg;
-			work->msg_ret = NULL;
+			work->msg_ret     = NULL;
+			work->ret_cursors = NULL;
 
 			if ((work->sub_pkt = nng_alloc(
 			         sizeof(packet_subscribe))) == NULL)
@@ -430,6 +1255,11 @@ server_cb(void *arg)
 						nng_msg_free(work->msg_ret[i]);
 					cvector_free(work->msg_ret);
 				}
+				for (size_t i = 0;
+				     i < cvector_size(work->ret_cursors); i++)
+					retain_index_close(work->ret_cursors[i]);
+				cvector_free(work->ret_cursors);
+				work->ret_cursors = NULL;
 				if (work->sub_pkt)
 					sub_pkt_free(work->sub_pkt);
 				// free conn_param due to clone in protocol layer
@@ -445,63 +1275,6 @@ server_cb(void *arg)
 				log_error("error in encode suback: [%d]", rv);
 
 			sub_pkt_free(work->sub_pkt);
-			// handle retain (Retain flag handled in npipe)
-			work->msg = NULL;
-			if (work->msg_ret) {
-				log_debug("retain msg [%p] size [%ld] \n",
-				    work->msg_ret, cvector_size(work->msg_ret));
-				for (int i = 0; i < cvector_size(work->msg_ret) &&
-				     check_msg_exp(work->msg_ret[i],
-				         nng_mqtt_msg_get_publish_property(
-				             work->msg_ret[i])); i++) {
-					nng_msg *m = work->msg_ret[i];
-					work->msg = m;
-					work->pub_packet = (struct pub_packet_struct *) nng_zalloc(
-										sizeof(struct pub_packet_struct));
-					void *proto_data = NULL;
-					uint8_t ver = nng_mqtt_msg_get_connect_proto_version(work->msg);
-					if (SUCCESS == decode_pub_message(work, ver)) {
-						bool  bridged = false;
-						proto_data = nng_msg_get_proto_data(work->msg);
-						// TODO replace bridge bool with sub retain bool
-						// bridged = nng_mqtt_msg_get_sub_retain_bool(work->msg, true);
-						if (proto_data != NULL)
-							bridged = nng_mqtt_msg_get_bridge_bool(work->msg);
-						if (bridged) {
-							bridge_handle_topic_reflection(
-							    work, &work->config->bridge);
-						}
-						// dont modify original retain msg;
-						nng_msg *rmsg = NULL;
-						if (nng_msg_dup(&rmsg, work->msg) != 0) {
-							log_error("System Failure while duplicating retain msg");
-						} else {
-							if (work->proto_ver == MQTT_VERSION_V5) {
-								nng_msg_set_cmd_type(rmsg,CMD_PUBLISH_V5);
-							} else {
-								nng_msg_set_cmd_type(rmsg, CMD_PUBLISH);
-							}
-						}
-						// nng_msg_set_proto_data(rmsg, NULL, proto_data);
-						if (encode_pub_message(rmsg, work, PUBLISH)) {
-							nng_mqtt_msg_set_sub_retain_bool(rmsg, true);
-							nng_aio_set_msg(work->aio, rmsg);
-							nng_aio_set_prov_data(work->aio, &work->pid.id);
-							nng_ctx_send(work->ctx, work->aio);
-						} else
-							log_warn("encode retain msg failed!");
-					} else {
-						log_warn("decode retain msg failed!");
-					}
-					free_pub_packet(work->pub_packet);
-					work->pub_packet = NULL;
-					cvector_free(work->pipe_ct->msg_infos);
-					work->pipe_ct->msg_infos = NULL;
-					// free the ref due to dbtree_find_retain
-					nng_msg_free(m);
-				}
-				cvector_free(work->msg_ret);
-			}
 			nng_msg_set_cmd_type(smsg, CMD_SUBACK);
 			nng_aio_set_prov_data(work->aio, &work->pid.id);
 			nng_aio_set_msg(work->aio, smsg);
@@ -509,6 +1282,33 @@ server_cb(void *arg)
 			work->state = SEND;
 			nng_ctx_send(work->ctx, work->aio);
 			smsg = NULL;
+			// handle retain (Retain flag handled in npipe)
+			// retained msgs are streamed by the replay lanes after
+			// SUBACK, so a huge retain set never blocks this ctx
+			if (work->msg_ret) {
+				log_debug("retain msg [%p] size [%ld] \n",
+				    work->msg_ret, cvector_size(work->msg_ret));
+				if ((rv = retain_replay_submit(work->pid.id,
+				         work->proto_ver, work->msg_ret)) != 0) {
+					log_warn("retain replay failed: %d", rv);
+					for (size_t i = 0;
+					     i < cvector_size(work->msg_ret); i++)
+						nng_msg_free(work->msg_ret[i]);
+					cvector_free(work->msg_ret);
+				}
+				work->msg_ret = NULL;
+			}
+			for (size_t i = 0; i < cvector_size(work->ret_cursors);
+			     i++) {
+				if ((rv = retain_replay_stream(work->pid.id,
+				         work->proto_ver, work->ret_cursors[i])) !=
+				    0) {
+					log_warn("retain replay failed: %d", rv);
+					retain_index_close(work->ret_cursors[i]);
+				}
+			}
+			cvector_free(work->ret_cursors);
+			work->ret_cursors = NULL;
 			nng_aio_finish(work->aio, 0);
 			// free conn_param in SEND state
 			break;
@@ -540,14 +1340,50 @@ server_cb(void *arg)
 			//free conn_param in SEND state
 			break;
 		} else if (work->flag == CMD_PUBLISH) {
+			if (pub_quota_park(work)) {
+				break;
+			}
+			if (auth_http_park(work)) {
+				break;
+			}
 			// Set V4/V5 flag for publish msg
 			if (work->proto_ver == MQTT_VERSION_V5) {
 				nng_msg_set_cmd_type(msg, CMD_PUBLISH_V5);
 			} else {
 				nng_msg_set_cmd_type(msg, CMD_PUBLISH);
 			}
-			work->code = handle_pub(
+			uint64_t lat = LATENCY_BEGIN(work);
+			work->code   = handle_pub(
 			    work, work->pipe_ct, work->proto_ver, false);
+			LATENCY_END(work, LATENCY_PUB, lat);
+#if defined(SUPP_BRIDGE_DEDUPE)
+			if (work->code == NO_MATCHING_SUBSCRIBERS &&
+			    work->proto == PROTO_MQTT_BRIDGE) {
+				// a loop brought it back, nothing to do
+				LATENCY_DONE(work);
+				nng_msg_free(work->msg);
+				work->msg = NULL;
+				conn_param_free(work->cparam);
+				free_pub_packet(work->pub_packet);
+				work->pub_packet = NULL;
+				free_pipe_content(work->pipe_ct);
+				work->state = RECV;
+				nng_ctx_recv(work->extra->ctx, work->aio);
+				break;
+			}
+#endif
+#if defined(SUPP_PLUGIN)
+			if (work->code == SUCCESS &&
+			    plugin_hook_has(HOOK_ON_PUBLISH)) {
+				plugin_msg_view view;
+				plugin_msg_view_fill(work, &view);
+				view.client_id = (const char *)
+				    conn_param_get_clientid(work->cparam);
+				view.username = (const char *)
+				    conn_param_get_username(work->cparam);
+				plugin_hook_call(HOOK_ON_PUBLISH, &view);
+			}
+#endif
 			if (work->proto == PROTO_HTTP_SERVER ||
 			    work->proto == PROTO_AWS_BRIDGE) {
 				nng_msg *rep_msg;
@@ -557,7 +1393,7 @@ server_cb(void *arg)
 					work->state = WAIT;
 				else
 					work->state = SEND;
-				nng_ctx_send(work->extra_ctx, work->aio);
+				nng_ctx_send(work->extra->ctx, work->aio);
 				break;
 			}
 			if (work->code != SUCCESS) {
@@ -568,10 +1404,11 @@ server_cb(void *arg)
 					// break or return?
 					break;
 				}
+				MSG_TRACE_END(work);
 				work->state = CLOSE;
 				free_pub_packet(work->pub_packet);
 				work->pub_packet = NULL;
-				cvector_free(work->pipe_ct->msg_infos);
+				free_pipe_content(work->pipe_ct);
 				// free conn_param due to clone in protocol layer
 				conn_param_free(work->cparam);
 				nng_aio_finish(work->aio, 0);
@@ -579,15 +1416,81 @@ server_cb(void *arg)
 				break;
 			}
 		} else if (work->flag == CMD_CONNACK) {
+			if (connect_admit_park(work)) {
+				break;
+			}
 			uint8_t *body        = nng_msg_body(work->msg);
 			uint8_t  reason_code = *(body + 1);
 			if (work->proto == PROTO_MQTT_BROKER) {
+				if (reason_code == SUCCESS) {
+					sub_stats_connect(
+					    work->pid.id, work->proto_ver);
+					topic_alias_grant(work);
+					pub_quota_open(work->pid.id,
+					    (const char *) conn_param_get_username(
+					        work->cparam));
+					sub_queue_open(work->pid.id);
+					// what the last pipe of a persistent
+					// session subscribed moves here
+					from = session_takeover_connect(work->pid.id,
+					    (const char *) conn_param_get_clientid(
+					        work->cparam),
+					    conn_param_get_clean_start(work->cparam));
+					if (from != 0) {
+						sub_ctx_move(work->db, from,
+						    work->pid.id, work->cparam);
+					}
+					sub_ctx_regrant(work->pid.id);
+#if defined(SUPP_TRAFFIC_STATS)
+					traffic_client_open(work->pid.id);
+#endif
+#if defined(SUPP_CLUSTER)
+					cluster_peer_open(work->pid.id,
+					    (const char *) conn_param_get_clientid(
+					        work->cparam));
+#endif
+				}
 				// Return CONNACK to clients of broker
 				nng_aio_set_prov_data(work->aio, &work->pid.id);
 				// clone for sending connect event notification
 				nng_msg_clone(work->msg);
 				nng_aio_set_msg(work->aio, work->msg);
 				nng_ctx_send(work->ctx, work->aio);
+#if defined(SUPP_PLUGIN)
+				if (plugin_hook_has(HOOK_ON_CONNECT)) {
+					plugin_conn_view cv = {
+						.pipe_id   = work->pid.id,
+						.client_id = (const char *)
+						    conn_param_get_clientid(
+						        work->cparam),
+						.username = (const char *)
+						    conn_param_get_username(
+						        work->cparam),
+						.proto_ver = work->proto_ver,
+						.keepalive = conn_param_get_keepalive(
+						    work->cparam),
+						.clean_start =
+						    conn_param_get_clean_start(
+						        work->cparam),
+						.reason = reason_code,
+					};
+					plugin_hook_call(HOOK_ON_CONNECT, &cv);
+				}
+#endif
+#if defined(SUPP_SESSION_SPILL)
+				// what waited offline follows the CONNACK
+				if (reason_code == SUCCESS) {
+					const char *cid = (const char *)
+					    conn_param_get_clientid(work->cparam);
+					if (conn_param_get_clean_start(
+					        work->cparam)) {
+						session_spill_discard(cid);
+					} else {
+						session_spill_online(cid,
+						    session_spill_replay, work);
+					}
+				}
+#endif
 			}
 			smsg = nano_msg_notify_connect(work->cparam, reason_code);
 			hook_entry(work, reason_code);
@@ -612,9 +1515,36 @@ server_cb(void *arg)
 			// uint8_t *payload = nng_msg_payload_ptr(work->msg);
 			// uint8_t reason_code = *(payload+16);
 			// free client ctx
-			if (dbhash_check_id(work->pid.id)) {
+			bool persistent = work->proto == PROTO_MQTT_BROKER &&
+			    !conn_param_get_clean_start(work->cparam);
+			takeover_verdict tv = session_takeover_disconnect(
+			    work->pid.id, session_linger(work));
+			// parked, the subscriptions stay for a takeover. Handed
+			// over, what it subscribed since is left
+			if (tv != TAKEOVER_PARKED &&
+			    dbhash_check_id(work->pid.id)) {
 				destroy_sub_client(work->pid.id, work->db);
 			}
+			sub_stats_disconnect(work->pid.id);
+			topic_alias_release(work->pid.id);
+			pub_quota_close(work->pid.id);
+			sub_queue_close(work->pid.id);
+#if defined(SUPP_SESSION_SPILL)
+			if (persistent && tv != TAKEOVER_HANDED) {
+				session_spill_offline(work->pid.id,
+				    (const char *) conn_param_get_clientid(
+				        work->cparam));
+			}
+#endif
+#if defined(SUPP_TRAFFIC_STATS)
+			traffic_client_close(work->pid.id);
+#endif
+			if (work->config->bridge_mode) {
+				bridge_subtable_release(work->pid.id);
+			}
+#if defined(SUPP_CLUSTER)
+			cluster_peer_close(work->pid.id);
+#endif
 			// bridge's will msg only valid at remote
 			if (work->proto != PROTO_MQTT_BRIDGE) {
 				if (conn_param_get_will_flag(work->cparam) ==
@@ -649,27 +1579,39 @@ server_cb(void *arg)
 				NANO_NNG_FATAL("WAIT nng_ctx_recv/send", rv);	// shall nerver reach here
 			}
 			smsg      = work->msg; // reuse the same msg
-			cvector(mqtt_msg_info) msg_infos;
-			msg_infos = work->pipe_ct->msg_infos;
-
-			log_trace("total subscribed pipes: %ld", cvector_size(msg_infos));
-			if (cvector_size(msg_infos))
-				if (encode_pub_message(smsg, work, PUBLISH)) {
-					for (int i = 0; i < cvector_size(msg_infos) && rv== 0; ++i) {
-						msg_info = &msg_infos[i];
-						nng_msg_clone(smsg);
-						work->pid.id = msg_info->pipe;
-						nng_aio_set_prov_data(work->aio, &work->pid.id);
-						work->msg = smsg;
-						nng_aio_set_msg(work->aio, work->msg);
-						nng_ctx_send(work->ctx, work->aio);
-					}
-				}
+
+			log_trace("total subscribed pipes: %ld",
+			    pipe_content_count(work->pipe_ct));
+			uint64_t lat = LATENCY_BEGIN(work);
+#if defined(SUPP_PLUGIN)
+			plugin_msg_view route;
+			plugin_route(work, smsg, &route);
+#endif
+			if (pipe_content_count(work->pipe_ct) > 0 &&
+			    encode_pub_message(smsg, work, PUBLISH)) {
+				send_to_pipes(work, smsg, work->pipe_ct->pipes);
+				send_to_pipes(
+				    work, smsg, work->pipe_ct->shared_pipes);
+#if defined(SUPP_PLUGIN)
+				plugin_deliver(work, &route);
+#endif
+				MSG_TRACE_EVENT(work, TRACE_EGRESS,
+				    pipe_content_count(work->pipe_ct));
+			}
+			LATENCY_END(work, LATENCY_FANOUT, lat);
 			work->msg = smsg;
 
-			// bridge logic first
-			if (work->config->bridge_mode) {
+			// bridge logic first, peers forward their own messages
+			if (work->config->bridge_mode
+#if defined(SUPP_CLUSTER)
+			    && !(work->proto == PROTO_MQTT_BRIDGE &&
+			        cluster_node(work->extra->node))
+#endif
+			) {
+				lat = LATENCY_BEGIN(work);
 				bridge_pub_handler(work);
+				LATENCY_END(work, LATENCY_BRIDGE, lat);
+				MSG_TRACE_EVENT(work, TRACE_BRIDGE, 1);
 #if defined(SUPP_AWS_BRIDGE)
 				aws_bridge_forward(work);
 #endif
@@ -693,7 +1635,7 @@ server_cb(void *arg)
 #endif
 			uint8_t iceoryx_opt = 0;
 #if defined(SUPP_ICEORYX)
-			iceoryx_opt = 1;
+			iceoryx_opt = iceoryx_map_enabled();
 #endif
 			if (hook_conf->enable || exge_conf->count > 0 || 
 			        rule_opt != RULE_ENG_OFF || iceoryx_opt == 1) {
@@ -702,6 +1644,8 @@ server_cb(void *arg)
 				break;
 			}
 			// skip one IO switching
+			LATENCY_DONE(work);
+			MSG_TRACE_END(work);
 			nng_msg_free(work->msg);
 			smsg = NULL;
 			work->msg = NULL;
@@ -709,22 +1653,24 @@ server_cb(void *arg)
 			conn_param_free(work->cparam);
 			free_pub_packet(work->pub_packet);
 			work->pub_packet = NULL;
-			cvector_free(msg_infos);
-			work->pipe_ct->msg_infos = NULL;
-			init_pipe_content(work->pipe_ct);
+			free_pipe_content(work->pipe_ct);
 			work->state = RECV;
 			if (work->proto != PROTO_MQTT_BROKER) {
-				nng_ctx_recv(work->extra_ctx, work->aio);
+				nng_ctx_recv(work->extra->ctx, work->aio);
 			} else {
-				nng_ctx_recv(work->ctx, work->aio);
+				work_recv(work);
 			}
 		} else if (nng_msg_cmd_type(work->msg) == CMD_PUBACK ||
 		    nng_msg_cmd_type(work->msg) == CMD_PUBREL ||
 		    nng_msg_cmd_type(work->msg) == CMD_PUBCOMP) {
+			// the end of a QoS 1/2 delivery to this client
+			if (nng_msg_cmd_type(work->msg) != CMD_PUBREL) {
+				sub_queue_acked(work->pid.id);
+			}
 			nng_msg_free(work->msg);
 			work->msg   = NULL;
 			work->state = RECV;
-			nng_ctx_recv(work->ctx, work->aio);
+			work_recv(work);
 			break;
 		} else {
 			log_debug("broker has nothing to do");
@@ -732,30 +1678,41 @@ server_cb(void *arg)
 				nng_msg_free(work->msg);
 			work->msg   = NULL;
 			work->state = RECV;
-			nng_ctx_recv(work->ctx, work->aio);
+			work_recv(work);
 			break;
 		}
 		break;
 	case SEND:
 		log_debug("SEND ^^^^ ctx%d ^^^^", work->ctx.id);
 #if defined(SUPP_RULE_ENGINE)
-		if (work->flag == CMD_PUBLISH && work->config->rule_eng.option != RULE_ENG_OFF) {
+		if (work->flag == CMD_PUBLISH &&
+		    work->config->rule_eng.option != RULE_ENG_OFF &&
+		    startup_ready(STARTUP_RULES)) {
+			uint64_t lat = LATENCY_BEGIN(work);
 			rule_engine_insert_sql(work);
+			LATENCY_END(work, LATENCY_RULE, lat);
+			MSG_TRACE_EVENT(work, TRACE_RULE, 1);
 		}
 #endif
 #if defined(SUPP_ICEORYX)
-		if (work->flag == CMD_PUBLISH && work->msg != NULL &&
-		        true == nano_iceoryx_topic_filter("ice/fwd",
-		        work->pub_packet->var_header.publish.topic_name.body,
-		        work->pub_packet->var_header.publish.topic_name.len)) {
-			if (0 != (rv = nano_iceoryx_send_nng_msg(
-			        work->iceoryx_puber, work->msg, &work->iceoryx_sock))) {
-				log_error("Failed to send iceoryx %d", rv);
-			}
+		if (work->flag == CMD_PUBLISH && work->msg != NULL) {
+			iceoryx_map_forward(work->msg,
+			    work->pub_packet->var_header.publish.topic_name.body,
+			    pub_packet_levels(work->pub_packet), &work->iceoryx_ids);
 		}
 #endif
 		// external hook here
+		uint64_t lat = LATENCY_BEGIN(work);
 		hook_entry(work, 0);
+		LATENCY_END(work, LATENCY_HOOK, lat);
+#if defined(SUPP_MSG_TRACE)
+		if (work->config->web_hook.enable) {
+			MSG_TRACE_EVENT(work, TRACE_WEBHOOK, 1);
+		}
+		if (work->config->exchange.count > 0) {
+			MSG_TRACE_EVENT(work, TRACE_EXCHANGE, 1);
+		}
+#endif
 
 		if (NULL != work->msg) {
 			nng_msg_free(work->msg);
@@ -768,24 +1725,27 @@ server_cb(void *arg)
 			free_pub_packet(work->pub_packet);
 			work->pub_packet = NULL;
 		}
-		if (work->pipe_ct->msg_infos != NULL) {
-			cvector_free(work->pipe_ct->msg_infos);
-			work->pipe_ct->msg_infos = NULL;
-			init_pipe_content(work->pipe_ct);
+		free_pipe_content(work->pipe_ct);
+#if defined(SUPP_RULE_ENGINE)
+		if (work->repubs != NULL) {
+			rule_repub_flush(work);
 		}
+#endif
+		LATENCY_DONE(work);
+		MSG_TRACE_END(work);
 		// free conn_param due to clone in protocol layer
 		conn_param_free(work->cparam);
 		work->state = RECV;
 		work->flag  = 0;
 		if (work->proto == PROTO_MQTT_BROKER) {
-			nng_ctx_recv(work->ctx, work->aio);
+			work_recv(work);
 #if defined(SUPP_ICEORYX)
 		} else if (work->proto == PROTO_ICEORYX_BRIDGE) {
 			nng_aio_set_prov_data(work->aio, work->iceoryx_suber);
-			nng_ctx_recv(work->extra_ctx, work->aio);
+			nng_ctx_recv(work->extra->ctx, work->aio);
 #endif
 		} else{
-			nng_ctx_recv(work->extra_ctx, work->aio);
+			nng_ctx_recv(work->extra->ctx, work->aio);
 		}
 		break;
 	case END:
@@ -797,31 +1757,30 @@ server_cb(void *arg)
 			}
 			smsg      = work->msg; // reuse the same msg
 
-			cvector(mqtt_msg_info) msg_infos;
-			msg_infos = work->pipe_ct->msg_infos;
-
-			log_debug("total pipes: %ld", cvector_size(msg_infos));
+			log_debug("total pipes: %ld",
+			    pipe_content_count(work->pipe_ct));
 			//TODO encode abstract msg only
-			if (cvector_size(msg_infos))
-				if (encode_pub_message(smsg, work, PUBLISH))
-					for (int i=0; i<cvector_size(msg_infos); ++i) {
-						msg_info = &msg_infos[i];
-						nng_msg_clone(smsg);
-						work->pid.id = msg_info->pipe;
-						nng_aio_set_prov_data(work->aio, &work->pid.id);
-						work->msg = smsg;
-						nng_aio_set_msg(work->aio, work->msg);
-						nng_ctx_send(work->ctx, work->aio);
-					}
+#if defined(SUPP_PLUGIN)
+			plugin_msg_view route;
+			work->user_property = NULL;
+			plugin_route(work, smsg, &route);
+#endif
+			if (pipe_content_count(work->pipe_ct) > 0 &&
+			    encode_pub_message(smsg, work, PUBLISH)) {
+				send_to_pipes(work, smsg, work->pipe_ct->pipes);
+				send_to_pipes(
+				    work, smsg, work->pipe_ct->shared_pipes);
+#if defined(SUPP_PLUGIN)
+				plugin_deliver(work, &route);
+#endif
+			}
 			hook_entry(work, 0);
 			nng_msg_free(smsg);
 			smsg = NULL;
 			work->msg = NULL;
 			free_pub_packet(work->pub_packet);
 			work->pub_packet = NULL;
-			cvector_free(work->pipe_ct->msg_infos);
-			work->pipe_ct->msg_infos = NULL;
-			init_pipe_content(work->pipe_ct);
+			free_pipe_content(work->pipe_ct);
 
 			// processing will msg
 			if (conn_param_get_will_flag(work->cparam) &&
@@ -867,9 +1826,9 @@ server_cb(void *arg)
 				work->msg = NULL;
 				work->state = RECV;
 				if (work->proto == PROTO_MQTT_BROKER) {
-					nng_ctx_recv(work->ctx, work->aio);
+					work_recv(work);
 				} else {
-					nng_ctx_recv(work->extra_ctx, work->aio);
+					nng_ctx_recv(work->extra->ctx, work->aio);
 				}
 			}
 		}
@@ -888,8 +1847,7 @@ server_cb(void *arg)
 
 		// clear reason code
 		work->code = SUCCESS;
-		work->state = RECV;
-		nng_ctx_recv(work->ctx, work->aio);
+		work_recv(work);
 		break;
 	default:
 		NANO_NNG_FATAL("bad state!", NNG_ESTATE);
@@ -897,92 +1855,325 @@ server_cb(void *arg)
 	}
 }
 
-struct work *
-alloc_work(nng_socket sock)
+// What of a work can fail, undone in reverse by work_unwind.
+static int
+work_alloc(nng_socket sock, nano_work **wp)
 {
-	struct work *w;
-	int          rv;
+	nano_work *w;
+	int        rv;
 
 	if ((w = nng_alloc(sizeof(*w))) == NULL) {
-		NANO_NNG_FATAL("nng_alloc", NNG_ENOMEM);
+		return NNG_ENOMEM;
+	}
+	if ((w->pipe_ct = nng_alloc(sizeof(struct pipe_content))) == NULL) {
+		nng_free(w, sizeof(*w));
+		return NNG_ENOMEM;
 	}
 	if ((rv = nng_aio_alloc(&w->aio, server_cb, w)) != 0) {
-		NANO_NNG_FATAL("nng_aio_alloc", rv);
+		nng_free(w->pipe_ct, sizeof(struct pipe_content));
+		nng_free(w, sizeof(*w));
+		return rv;
 	}
 	if ((rv = nng_ctx_open(&w->ctx, sock)) != 0) {
-		NANO_NNG_FATAL("nng_ctx_open", rv);
+		nng_aio_free(w->aio);
+		nng_free(w->pipe_ct, sizeof(struct pipe_content));
+		nng_free(w, sizeof(*w));
+		return rv;
 	}
 
-	w->pipe_ct = nng_alloc(sizeof(struct pipe_content));
 	init_pipe_content(w->pipe_ct);
 	w->pub_packet = NULL;
-	w->node       = NULL;
+	w->extra      = NULL;
 	w->state      = INIT;
-	return (w);
+	w->heavy      = false;
+	w->pool       = WORK_FIXED;
+	w->topic_buf  = NULL;
+	w->topic_buf_cap = 0;
+	w->alias_aio  = NULL;
+	w->hook_sock.id = 0;
+	*wp = w;
+	return 0;
+}
+
+static void
+work_unwind(nano_work *w)
+{
+	if (w->hook_sock.id != 0) {
+		nng_close(w->hook_sock);
+	}
+	if (w->extra != NULL) {
+		if (w->extra->ctx.id != 0) {
+			nng_ctx_close(w->extra->ctx);
+		}
+		nng_free(w->extra, sizeof(struct work_extra));
+	}
+	nng_ctx_close(w->ctx);
+	nng_aio_free(w->aio);
+	nng_free(w->pipe_ct, sizeof(struct pipe_content));
+	nng_free(w, sizeof(*w));
+}
+
+// The statistics blocks of a work, which go with their modules.
+static void
+work_blocks_alloc(nano_work *w)
+{
+	w->arena      = work_arena_alloc();
+	w->mpool      = msg_pool_alloc();
+#ifdef STATISTICS
+	w->stats = nano_msg_stats_alloc();
+#endif
+#if defined(SUPP_TRAFFIC_STATS)
+	w->traffic = traffic_topics_alloc();
+#endif
+#if defined(SUPP_LATENCY_STATS)
+	w->lat       = latency_block_alloc();
+	w->lat_start = 0;
+#endif
+#if defined(SUPP_PROFILER)
+	w->prof = prof_block_alloc();
+#endif
+#if defined(SUPP_MSG_TRACE)
+	w->trace     = NULL;
+	w->trace_seq = 0;
+#endif
+#if defined(SUPP_RULE_ENGINE)
+	w->rule_vals     = NULL;
+	w->rule_vals_cap = 0;
+	w->repubs        = NULL;
+#endif
 }
 
-nano_work *
-proto_work_init(nng_socket sock, nng_socket extrasock, uint8_t proto,
-    dbtree *db_tree, dbtree *db_tree_ret, conf *config)
+// proto_work_init without the fatal exit, nothing is left behind on error
+static int
+work_init(nng_socket sock, nng_socket extrasock, uint8_t proto,
+    dbtree *db_tree, dbtree *db_tree_ret, conf *config, nano_work **wp)
 {
 	int        rv;
 	nano_work *w;
-	w         = alloc_work(sock);
+
+	if ((rv = work_alloc(sock, &w)) != 0) {
+		return rv;
+	}
 	w->db     = db_tree;
 	w->db_ret = db_tree_ret;
 	w->proto  = proto;
 	w->config = config;
 	w->code   = SUCCESS;
+	if (proto != PROTO_MQTT_BROKER &&
+	    (w->extra = nng_zalloc(sizeof(struct work_extra))) == NULL) {
+		work_unwind(w);
+		return NNG_ENOMEM;
+	}
 
 #if defined(SUPP_ICEORYX)
 	w->iceoryx_suber = NULL;
-	w->iceoryx_puber = NULL;
+	w->iceoryx_ids   = NULL;
 #endif
 
-	w->sqlite_db = NULL;
 #if defined(NNG_SUPP_SQLITE)
+	w->sqlite_db = NULL;
 	nng_socket_get_ptr(sock, NMQ_OPT_MQTT_QOS_DB, &w->sqlite_db);
 #endif
 
 	// only create ctx for extra ctx that are required to receive msg
+	rv = 0;
 	if (config->http_server.enable && proto == PROTO_HTTP_SERVER) {
-		if ((rv = nng_ctx_open(&w->extra_ctx, extrasock)) != 0) {
-			NANO_NNG_FATAL("nng_ctx_open", rv);
-		}
+		rv = nng_ctx_open(&w->extra->ctx, extrasock);
 #if defined(SUPP_ICEORYX)
 	} else if (proto == PROTO_ICEORYX_BRIDGE) {
-			if ((rv = nng_ctx_open(&w->extra_ctx, extrasock)) != 0) {
-				NANO_NNG_FATAL("nng_ctx_open", rv);
-			}
+		rv = nng_ctx_open(&w->extra->ctx, extrasock);
 #endif
 	} else if (config->bridge_mode) {
-		if (proto == PROTO_MQTT_BRIDGE) {
-			if ((rv = nng_ctx_open(&w->extra_ctx, extrasock)) != 0) {
-				NANO_NNG_FATAL("nng_ctx_open", rv);
-			}
+		// a bridge client not up yet gets its ctx in bridge_start
+		if (proto == PROTO_MQTT_BRIDGE && extrasock.id != 0) {
+			rv = nng_ctx_open(&w->extra->ctx, extrasock);
 		} else if (proto == PROTO_AWS_BRIDGE) {
-			if ((rv = nng_ctx_open(&w->extra_ctx, extrasock)) != 0) {
-				NANO_NNG_FATAL("nng_ctx_open", rv);
-			}
+			rv = nng_ctx_open(&w->extra->ctx, extrasock);
 		}
 	}
+	if (rv != 0) {
+		log_error("work nng_ctx_open: %d", rv);
+		work_unwind(w);
+		return rv;
+	}
 
 	if(config->web_hook.enable || config->exchange.count > 0) {
 		if ((rv = nng_push0_open(&w->hook_sock)) != 0) {
-			NANO_NNG_FATAL("nng_socket", rv);
+			log_error("work hook nng_socket: %d", rv);
+			work_unwind(w);
+			return rv;
 		}
 		char *hook_ipc_url = config->hook_ipc_url == NULL
 		    ? HOOK_IPC_URL
 		    : config->hook_ipc_url;
-		if ((rv = nng_dial(w->hook_sock, hook_ipc_url, NULL, 0)) !=
-		    0) {
-			NANO_NNG_FATAL("hook nng_dial", rv);
+		// the hook service may still be coming up, keep redialing
+		if ((rv = nng_dial(w->hook_sock, hook_ipc_url, NULL,
+		         NNG_FLAG_NONBLOCK)) != 0) {
+			log_error("work hook nng_dial: %d", rv);
+			work_unwind(w);
+			return rv;
 		}
 	}
 
+	work_blocks_alloc(w);
+	*wp = w;
+	return 0;
+}
+
+nano_work *
+proto_work_init(nng_socket sock, nng_socket extrasock, uint8_t proto,
+    dbtree *db_tree, dbtree *db_tree_ret, conf *config)
+{
+	nano_work *w;
+	int        rv;
+
+	if ((rv = work_init(sock, extrasock, proto, db_tree, db_tree_ret,
+	         config, &w)) != 0) {
+		NANO_NNG_FATAL("proto_work_init", rv);
+	}
 	return w;
 }
 
+// On the pool thread, a retired work gives back its aio and ctx. Its
+// statistics blocks and hook socket stay for the next growth.
+static void
+elastic_release(nano_work *w)
+{
+	nng_ctx_close(w->ctx);
+	nng_aio_free(w->aio);
+	w->aio = NULL;
+	if (w->alias_aio != NULL) {
+		nng_aio_free(w->alias_aio);
+		w->alias_aio = NULL;
+	}
+	if (w->topic_buf != NULL) {
+		nng_free(w->topic_buf, w->topic_buf_cap);
+		w->topic_buf     = NULL;
+		w->topic_buf_cap = 0;
+	}
+	work_arena_shrink(w->arena);
+	w->pool = WORK_RELEASED;
+}
+
+static int
+elastic_revive(nano_work *w)
+{
+	int rv;
+
+	if ((rv = nng_aio_alloc(&w->aio, server_cb, w)) != 0) {
+		return rv;
+	}
+	if ((rv = nng_ctx_open(&w->ctx, elastic_.sock)) != 0) {
+		nng_aio_free(w->aio);
+		w->aio = NULL;
+		return rv;
+	}
+	w->state = INIT;
+	w->code  = SUCCESS;
+	return 0;
+}
+
+static size_t
+elastic_resize(int delta, void *arg)
+{
+	nano_work *start[NANO_WORK_POOL_MAX > 0 ? NANO_WORK_POOL_MAX : 1];
+	size_t     nstart = 0;
+	size_t     done   = 0;
+
+	(void) arg;
+	nng_mtx_lock(elastic_.mtx);
+	for (size_t i = 0; i < elastic_.count; i++) {
+		if (elastic_.works[i]->pool == WORK_PARKED) {
+			elastic_release(elastic_.works[i]);
+		}
+	}
+	for (size_t i = 0; delta > 0 && done < (size_t) delta && i < elastic_.cap;
+	     i++) {
+		nano_work *w;
+		if (i == elastic_.count) {
+			int rv;
+
+			// short of resources, the pool stays as it is
+			if ((rv = work_init(elastic_.sock, elastic_.extra_sock,
+			         PROTO_MQTT_BROKER, elastic_.db, elastic_.db_ret,
+			         elastic_.config, &w)) != 0) {
+				log_warn("work pool not grown: %d", rv);
+				break;
+			}
+			elastic_.works[elastic_.count++] = w;
+		} else if ((w = elastic_.works[i])->pool != WORK_RELEASED ||
+		    elastic_revive(w) != 0) {
+			continue;
+		}
+		w->pool         = WORK_RUNNING;
+		start[nstart++] = w;
+		done++;
+	}
+	// newest first, the long lived works keep their warm caches
+	for (size_t i = elastic_.count; delta < 0 && done < (size_t) -delta &&
+	     i > 0; i--) {
+		if (elastic_.works[i - 1]->pool == WORK_RUNNING) {
+			elastic_.works[i - 1]->pool = WORK_RETIRING;
+			done++;
+		}
+	}
+	nng_mtx_unlock(elastic_.mtx);
+
+	for (size_t i = 0; i < nstart; i++) {
+		server_cb(start[i]);
+	}
+	if (done > 0) {
+		log_info("work pool %s by %zu", delta > 0 ? "grown" : "shrunk",
+		    done);
+	}
+	return done;
+}
+
+static void
+elastic_init(nng_socket sock, nng_socket extra_sock, dbtree *db_tree,
+    dbtree *db_tree_ret, conf *config)
+{
+	int rv;
+
+	elastic_.sock       = sock;
+	elastic_.extra_sock = extra_sock;
+	elastic_.db         = db_tree;
+	elastic_.db_ret     = db_tree_ret;
+	elastic_.config     = config;
+	if (NANO_WORK_POOL_MAX > config->parallel) {
+		elastic_.cap = NANO_WORK_POOL_MAX - config->parallel;
+	}
+	if ((rv = nng_mtx_alloc(&elastic_.mtx)) != 0 ||
+	    (elastic_.cap > 0 &&
+	        (elastic_.works = nng_zalloc(
+	             elastic_.cap * sizeof(nano_work *))) == NULL)) {
+		NANO_NNG_FATAL("elastic_init", rv != 0 ? rv : NNG_ENOMEM);
+	}
+	if ((rv = work_pool_init(config->parallel,
+	         config->parallel + elastic_.cap,
+	         elastic_.cap > 0 ? elastic_resize : NULL, NULL)) != 0) {
+		log_warn("work pool disabled: %d", rv);
+	}
+}
+
+static void
+elastic_fini(void)
+{
+	work_pool_fini();
+	for (size_t i = 0; i < elastic_.count; i++) {
+		nano_work *w = elastic_.works[i];
+		nng_free(w->pipe_ct, sizeof(struct pipe_content));
+		nng_free(w, sizeof(struct work));
+	}
+	if (elastic_.works != NULL) {
+		nng_free(elastic_.works, elastic_.cap * sizeof(nano_work *));
+	}
+	if (elastic_.mtx != NULL) {
+		nng_mtx_free(elastic_.mtx);
+	}
+	memset(&elastic_, 0, sizeof(elastic_));
+}
+
 static dbtree           *db        = NULL;
 static dbtree           *db_ret    = NULL;
 // TODO For HTTP SUB/UNSUB usage
@@ -1000,21 +2191,14 @@ get_broker_db(void)
 	return db;
 }
 
-int
-broker(conf *nanomq_conf)
-{
-	int        rv, i;
-	uint64_t   num_work;
-	nng_socket sock;
-	nng_socket *bridge_sock;
-	nng_pipe   pipe_id;
-	// add the num of other proto
-	nanomq_conf->total_ctx = nanomq_conf->parallel;		// match with num of aio
-	num_work = nanomq_conf->parallel;					// match with num of works
-
-
 #if defined(SUPP_RULE_ENGINE)
-	conf_rule *cr = &nanomq_conf->rule_eng;
+// Sink DB clients and republish clients, rules skip messages until done.
+static int
+rule_start(void *arg)
+{
+	conf      *nanomq_conf = arg;
+	conf_rule *cr          = &nanomq_conf->rule_eng;
+	int        rv;
 
 #if defined(NNG_SUPP_SQLITE)
 	if (cr->option & RULE_ENG_SDB) {
@@ -1047,6 +2231,10 @@ broker(conf *nanomq_conf)
 		for (int i = 0; i < cvector_size(cr->rules); i++) {
 			if (RULE_FORWORD_REPUB == cr->rules[i].forword_type) {
 				int              index = 0;
+				if (nano_client_is_local(nanomq_conf->url,
+				        cr->rules[i].repub->address)) {
+					continue;
+				}
 				nng_socket *sock  = (nng_socket *) nng_alloc(
 				    sizeof(nng_socket));
 				nano_client(sock, cr->rules[i].repub);
@@ -1054,6 +2242,120 @@ broker(conf *nanomq_conf)
 
 		}
 	}
+
+	rule_filter_lock();
+	if (cr->option != RULE_ENG_OFF && (rv = rule_filter_compile(cr)) != 0) {
+		log_warn("rule table failed: %d, no rule is matched", rv);
+	}
+	rule_filter_unlock();
+	return 0;
+}
+#endif
+
+typedef struct {
+	conf       *config;
+	nano_work **works; // the bridge works, in node order
+} bridge_start_arg;
+
+// Opens the bridge clients one node at a time, then starts the works of
+// each node on its socket. Forwards wait for STARTUP_BRIDGE.
+static int
+bridge_start(void *arg)
+{
+	bridge_start_arg *ba          = arg;
+	conf             *nanomq_conf = ba->config;
+	size_t            w           = 0;
+	int               rv;
+
+	for (size_t t = 0; t < nanomq_conf->bridge.count; t++) {
+		conf_bridge_node *node = nanomq_conf->bridge.nodes[t];
+		if (!node->enable) {
+			continue;
+		}
+#if defined(SUPP_QUIC)
+		if (node->hybrid) {
+			hybrid_bridge_client(node->sock, nanomq_conf, node);
+		} else {
+			bridge_client(node->sock, nanomq_conf, node);
+		}
+#else
+		bridge_client(node->sock, nanomq_conf, node);
+#endif
+		for (size_t i = 0; i < node->parallel; i++, w++) {
+			nano_work *work = ba->works[w];
+			if ((rv = nng_ctx_open(&work->extra->ctx, *node->sock)) !=
+			    0) {
+				log_error("bridge %s ctx open failed %d",
+				    node->name, rv);
+				continue;
+			}
+			server_cb(work);
+		}
+	}
+	nng_free(ba, sizeof(*ba));
+	return 0;
+}
+
+// a parked session nobody took over, arg is the subscription tree
+static void
+takeover_release(void *arg, uint32_t pipe)
+{
+	if (dbhash_check_id(pipe)) {
+		destroy_sub_client(pipe, arg);
+	}
+}
+
+int
+broker(conf *nanomq_conf)
+{
+	int        rv, i;
+	uint64_t   num_work;
+	nng_socket sock;
+	nng_socket *bridge_sock;
+	nng_pipe   pipe_id;
+	size_t     http_ctx = nanomq_conf->http_server.parallel > HTTP_CTX_NUM
+	        ? nanomq_conf->http_server.parallel
+	        : HTTP_CTX_NUM;
+	// add the num of other proto
+	nanomq_conf->total_ctx = nanomq_conf->parallel;		// match with num of aio
+	num_work = nanomq_conf->parallel;					// match with num of works
+	size_t     heavy_works = 0;
+	nano_work *sys_work    = NULL;
+
+	if ((rv = startup_init()) != 0) {
+		log_warn("startup timing disabled: %d", rv);
+	}
+	startup_begin(STARTUP_LISTENER);
+
+	if ((rv = work_lane_init(
+	         NANO_WORK_LANE_HEAVY, NANO_WORK_LANE_DEPTH)) == 0) {
+		heavy_works = NANO_WORK_LANE_HEAVY;
+		nanomq_conf->total_ctx += heavy_works;
+		num_work += heavy_works;
+	} else {
+		log_info("heavy work lane disabled: %d", rv);
+	}
+#if defined(SUPP_SYS_STATS)
+	nanomq_conf->total_ctx++;
+	num_work++;
+#endif
+
+
+#if defined(SUPP_RULE_ENGINE)
+	conf_rule *cr = &nanomq_conf->rule_eng;
+
+	if ((rv = rule_sink_init()) != 0) {
+		NANO_NNG_FATAL("rule_sink_init", rv);
+	}
+	if ((rv = rule_filter_init()) != 0) {
+		NANO_NNG_FATAL("rule_filter_init", rv);
+	}
+
+	// the sinks connect while the listener is served
+	if (cr->option != RULE_ENG_OFF &&
+	    (rv = startup_run(STARTUP_RULES, rule_start, nanomq_conf)) != 0) {
+		NANO_NNG_FATAL("rule_start", rv);
+	}
 #endif
 
 	// init tree
@@ -1070,6 +2372,125 @@ broker(conf *nanomq_conf)
 	dbhash_init_pipe_table();
 	dbhash_init_alias_table();
 
+	// expired retained msgs are purged from db_ret as they fall due
+	if ((rv = expiry_wheel_init(NANO_EXPIRY_WHEEL_TICK_MS)) != 0) {
+		log_warn("message expiry wheel disabled: %d", rv);
+	}
+	if ((rv = retain_store_init(NANO_RETAIN_STORE_BUCKETS)) != 0) {
+		log_warn("retain store disabled: %d", rv);
+	}
+	retain_store_reaper(expire_retain_msg, db_ret);
+#if defined(SUPP_RETAIN_INDEX)
+	// wildcard subscriptions scan it instead of the retain tree
+	if ((rv = retain_index_init()) != 0) {
+		log_warn("retain index disabled: %d", rv);
+	}
+#endif
+
+#if defined(SUPP_SESSION_SPILL)
+	session_spill_conf spill = {
+		.msgs    = NANO_SESSION_SPILL_MSGS,
+		.mem     = NANO_SESSION_SPILL_MEM,
+		.disk    = NANO_SESSION_SPILL_DISK,
+		.segment = NANO_SESSION_SPILL_SEGMENT,
+	};
+	if ((rv = session_spill_init(NANO_SESSION_SPILL_DIR, &spill)) != 0) {
+		log_warn("offline session spill disabled: %d", rv);
+	}
+#endif
+
+#ifdef ACL_SUPP
+	if (nanomq_conf->acl.enable &&
+	    (rv = acl_init(&nanomq_conf->acl, NANO_ACL_CACHE_SIZE)) != 0) {
+		NANO_NNG_FATAL("acl_init", rv);
+	}
+#endif
+
+#if defined(SUPP_MATCH_CACHE)
+	if ((rv = match_cache_init(NANO_MATCH_CACHE_SIZE)) != 0) {
+		log_warn("topic match cache disabled: %d", rv);
+	}
+#endif
+
+	if ((rv = sub_stats_init()) != 0) {
+		log_warn("subscription stats disabled: %d", rv);
+	}
+
+	if ((rv = topic_alias_init()) != 0) {
+		log_warn("per pipe topic alias disabled: %d", rv);
+	}
+
+	if ((rv = share_group_init()) != 0) {
+		log_warn("shared subscription strategies disabled: %d", rv);
+	}
+
+	connect_admit_conf admit = {
+		.pending = NANO_ADMIT_PENDING,
+		.wait_ms = NANO_ADMIT_WAIT_MS,
+	};
+	connect_admit_conf_env(&admit);
+	if (admit.pending == 0) {
+		admit.pending = nanomq_conf->parallel / 2 > 0
+		    ? (uint32_t) nanomq_conf->parallel / 2
+		    : 1;
+	}
+	if ((rv = connect_admit_init(&admit)) != 0) {
+		log_warn("connect admission control disabled: %d", rv);
+	}
+
+	pub_quota_conf quota = {
+		.policy   = PUB_QUOTA_DELAY,
+		.delay_ms = NANO_PUB_QUOTA_DELAY_MS,
+	};
+	pub_quota_conf_env(&quota);
+	if ((rv = pub_quota_init(&quota)) != 0) {
+		log_warn("publish quotas disabled: %d", rv);
+	}
+
+	if (nanomq_conf->auth_http.enable &&
+	    (rv = auth_http_cache_init(&nanomq_conf->auth_http,
+	         NANO_AUTH_HTTP_CACHE_TTL_MS,
+	         NANO_AUTH_HTTP_CACHE_DENY_TTL_MS)) != 0) {
+		log_warn("auth_http cache disabled: %d", rv);
+	}
+
+#if defined(SUPP_TRAFFIC_STATS)
+	if ((rv = traffic_stats_init()) != 0) {
+		log_warn("traffic stats disabled: %d", rv);
+	}
+#endif
+
+#if defined(SUPP_LATENCY_STATS)
+	if ((rv = latency_stats_init()) != 0) {
+		log_warn("latency stats disabled: %d", rv);
+	}
+#endif
+#if defined(SUPP_PROFILER)
+	if ((rv = prof_init()) != 0) {
+		log_warn("profiler disabled: %d", rv);
+	}
+#endif
+#if defined(SUPP_MSG_TRACE)
+	if ((rv = msg_trace_init()) != 0) {
+		log_warn("message tracing disabled: %d", rv);
+	}
+#endif
+	if ((rv = work_arena_init()) != 0) {
+		log_warn("work arenas disabled: %d", rv);
+	}
+	if ((rv = msg_pool_init()) != 0) {
+		log_warn("msg pools disabled: %d", rv);
+	}
+
+#if defined(SUPP_RETAIN_LOG)
+	if ((rv = retain_log_open(
+	         NANO_RETAIN_LOG_DIR, NANO_RETAIN_LOG_SEGMENT)) != 0) {
+		log_warn("retain log disabled: %d", rv);
+	} else {
+		retain_log_load(restore_retain_msg, db_ret);
+	}
+#endif
+
 	log_debug("db init finished");
 	/*  Create the socket. */
 	nanomq_conf->db_root = db;
@@ -1090,10 +2511,10 @@ broker(conf *nanomq_conf)
 		if (rv != 0) {
 			NANO_NNG_FATAL("nng_rep0_open", rv);
 		}
-		// set 4 ctx for HTTP as default
+		// as many ctx for HTTP as REST workers, 4 at least
 		if (nanomq_conf->http_server.enable) {
-			nanomq_conf->total_ctx += HTTP_CTX_NUM;
-			num_work += HTTP_CTX_NUM;
+			nanomq_conf->total_ctx += http_ctx;
+			num_work += http_ctx;
 		}
 	}
 	log_debug("HTTP init finished");
@@ -1121,12 +2542,35 @@ broker(conf *nanomq_conf)
 		}
 		log_debug("exchange %d init finished!\n", i);
 	}
+	// webhook bodies and rule documents are composed off the works
+	bool transforms = nanomq_conf->web_hook.enable;
+#if defined(SUPP_RULE_ENGINE)
+	transforms = transforms || nanomq_conf->rule_eng.option != RULE_ENG_OFF;
+#endif
+	if (transforms &&
+	    (rv = transform_init(NANO_TRANSFORM_THREADS, NANO_TRANSFORM_DEPTH,
+	         NANO_TRANSFORM_BATCH)) != 0) {
+		log_warn("transform stage disabled: %d", rv);
+	}
+
 	// Hook service
 	if (nanomq_conf->web_hook.enable || nanomq_conf->exchange.count > 0) {
+		hook_filter_init(nanomq_conf);
+		if (nanomq_conf->web_hook.enable &&
+		    (rv = webhook_lifecycle_init()) != 0) {
+			log_warn("webhook lifecycle summaries disabled: %d", rv);
+		}
 		start_hook_service(nanomq_conf);
 		log_debug("Hook service started");
 	}
 
+#if defined(SUPP_CLUSTER)
+	// the peer links are bridges like any other from here on
+	if ((rv = cluster_init(nanomq_conf)) != 0) {
+		log_warn("cluster mode disabled: %d", rv);
+	}
+#endif
+
 	// caculate total ctx first
 	if (nanomq_conf->bridge_mode) {
 		for (size_t t = 0; t < nanomq_conf->bridge.count; t++) {
@@ -1154,22 +2598,52 @@ broker(conf *nanomq_conf)
 
 	// init bridging client
 	if (nanomq_conf->bridge_mode) {
+		// hybrid clients start probing as soon as they are up
+		if ((rv = bridge_rtt_init(&nanomq_conf->bridge)) != 0) {
+			NANO_NNG_FATAL("bridge_rtt_init", rv);
+		}
+#if defined(SUPP_BRIDGE_CACHE)
+		// before the clients, they skip the sqlite cache when it is set
+		if ((rv = bridge_cache_init(&nanomq_conf->bridge,
+		         NANO_BRIDGE_CACHE_DIR, NANO_BRIDGE_CACHE_BYTES)) != 0) {
+			log_warn("bridge offline cache disabled: %d", rv);
+		}
+#endif
+		// the clients are opened by bridge_start, the socket stays
+		// zero until then
 		for (size_t t = 0; t < nanomq_conf->bridge.count; t++) {
 			conf_bridge_node *node = nanomq_conf->bridge.nodes[t];
 			if (node->enable) {
-				node->sock = (nng_socket *) nng_alloc(
+				node->sock = (nng_socket *) nng_zalloc(
 				    sizeof(nng_socket));
-#if defined(SUPP_QUIC)
-				if (node->hybrid) {
-					hybrid_bridge_client(node->sock, nanomq_conf, node);
-				} else {
-					bridge_client(node->sock, nanomq_conf, node);
-				}
-#else
-				bridge_client(node->sock, nanomq_conf, node);
-#endif
 			}
 		}
+		// reflection runs on the bridge contexts too
+		if ((rv = bridge_forward_init(
+		         &nanomq_conf->bridge, nanomq_conf->total_ctx)) != 0) {
+			NANO_NNG_FATAL("bridge_forward_init", rv);
+		}
+		if ((rv = bridge_queue_init(&nanomq_conf->bridge,
+		         NANO_BRIDGE_QUEUE_LEN, NANO_BRIDGE_QUEUE_BYTES,
+		         NANO_BRIDGE_QUEUE_POLICY)) != 0) {
+			log_warn("bridge queue disabled: %d", rv);
+		}
+#if defined(SUPP_BRIDGE_DEDUPE)
+		if ((rv = bridge_dedupe_init(NANO_BRIDGE_DEDUPE_BITS,
+		         NANO_BRIDGE_DEDUPE_WINDOW_MS)) != 0) {
+			log_warn("bridge loop suppression disabled: %d", rv);
+		}
+#endif
+#if defined(SUPP_BRIDGE_ZIP)
+		if ((rv = bridge_zip_init(&nanomq_conf->bridge,
+		         nanomq_conf->total_ctx)) != 0) {
+			log_warn("bridge compression disabled: %d", rv);
+		}
+#endif
+		if ((rv = bridge_subtable_init(&nanomq_conf->bridge,
+		         NANO_BRIDGE_SUB_BUCKETS)) != 0) {
+			NANO_NNG_FATAL("bridge_subtable_init", rv);
+		}
 		log_debug("bridge init finished");
 	}
 	// CTX for MQTT Broker service
@@ -1180,11 +2654,21 @@ broker(conf *nanomq_conf)
 		    PROTO_MQTT_BROKER, db, db_ret, nanomq_conf);
 	}
 
+	if ((rv = retain_replay_init(sock, NANO_RETAIN_REPLAY_LANES)) != 0) {
+		NANO_NNG_FATAL("retain_replay_init", rv);
+	}
+
 	// create bridge ctx
 	// only create ctx when there is sub topics
-	size_t tmp = nanomq_conf->parallel;
+	size_t            tmp    = nanomq_conf->parallel;
+	bridge_start_arg *bstart = NULL;
 	if (nanomq_conf->bridge_mode) {
 		log_debug("MQTT bridging service initialization");
+		if ((bstart = nng_zalloc(sizeof(*bstart))) == NULL) {
+			NANO_NNG_FATAL("bridge_start", NNG_ENOMEM);
+		}
+		bstart->config = nanomq_conf;
+		bstart->works  = &works[tmp];
 		// iterates all bridge targets
 		for (size_t t = 0; t < nanomq_conf->bridge.count; t++) {
 			conf_bridge_node *node = nanomq_conf->bridge.nodes[t];
@@ -1194,7 +2678,7 @@ broker(conf *nanomq_conf)
 					works[i] = proto_work_init(sock,
 					    *bridge_sock, PROTO_MQTT_BRIDGE,
 					    db, db_ret, nanomq_conf);
-					works[i]->node = node;
+					works[i]->extra->node = node;
 				}
 				tmp += node->parallel;
 			}
@@ -1221,28 +2705,26 @@ broker(conf *nanomq_conf)
 	// create http server ctx
 	if (nanomq_conf->http_server.enable) {
 		log_debug("http context init");
-		for (i = tmp; i < tmp + HTTP_CTX_NUM; i++) {
+		for (i = tmp; i < tmp + http_ctx; i++) {
 			works[i] = proto_work_init(sock, inproc_sock,
 			    PROTO_HTTP_SERVER, db, db_ret, nanomq_conf);
 		}
-		tmp += HTTP_CTX_NUM;
+		tmp += http_ctx;
 	}
 
 #if defined(SUPP_ICEORYX)
-	nng_socket iceoryx_sock;
-	const char *iceoryx_service = "NanoMQ-Service";
-	const char *iceoryx_instance = "NanoMQ-Instance";
-	const char *iceoryx_event_sub = "topic";
-	const char *iceoryx_event_pub = "ice/fwd";
+	nng_socket       iceoryx_sock;
+	iceoryx_map_conf icemap;
 	nng_iceoryx_open(&iceoryx_sock, "NanoMQ-Iceoryx");
 
-	nng_iceoryx_suber *suber;
-	nng_iceoryx_sub(&iceoryx_sock, "NanoMQ-Iceoryx-Suber",
-		iceoryx_service, iceoryx_instance, iceoryx_event_sub, &suber);
-
-	nng_iceoryx_puber *puber;
-	nng_iceoryx_pub(&iceoryx_sock, "NanoMQ-Iceoryx-Puber",
-		iceoryx_service, iceoryx_instance, iceoryx_event_pub, &puber);
+	// publishers and subscribers as NANOMQ_ICEORYX_MAP has them
+	iceoryx_map_conf_env(&icemap);
+	if ((rv = iceoryx_map_init(iceoryx_sock, &icemap)) != 0) {
+		NANO_NNG_FATAL("iceoryx_map_init", rv);
+	}
+	if ((rv = nano_iceoryx_init()) != 0) {
+		NANO_NNG_FATAL("nano_iceoryx_init", rv);
+	}
 
 	// create iceoryx ctx
 	log_debug("iceoryx context init");
@@ -1253,9 +2735,24 @@ broker(conf *nanomq_conf)
 	tmp += HTTP_CTX_NUM;
 #endif
 
+	// heavy lane works park at INIT until a packet is handed over
+	for (i = tmp; i < tmp + heavy_works; i++) {
+		works[i] = proto_work_init(sock, inproc_sock,
+		    PROTO_MQTT_BROKER, db, db_ret, nanomq_conf);
+		works[i]->heavy = true;
+	}
+	tmp += heavy_works;
+#if defined(SUPP_SYS_STATS)
+	sys_work = works[tmp++] = proto_work_init(
+	    sock, inproc_sock, PROTO_MQTT_BROKER, db, db_ret, nanomq_conf);
+#endif
+
 	// Init exchange part in hook
 	if (nanomq_conf->exchange.count > 0) {
 		hook_exchange_init(nanomq_conf, num_work);
+		if ((rv = exchange_recent_init(num_work)) != 0) {
+			log_error("exchange recent ring init failed %d", rv);
+		}
 		// create exchange senders in hook
 		hook_exchange_sender_init(nanomq_conf, works, num_work);
 		for (i = 0; i < nanomq_conf->exchange.count; i++) {
@@ -1341,6 +2838,7 @@ broker(conf *nanomq_conf)
 					wss_listener, NANO_CONF, nanomq_conf, sizeof(nanomq_conf));
 
 			init_listener_tls(wss_listener, &nanomq_conf->tls);
+			init_listener_ws(wss_listener);
 			if ((rv = nng_listener_start(wss_listener, 0)) != 0) {
 				NANO_NNG_FATAL("nng_listener_start wss", rv);
 			}
@@ -1355,17 +2853,86 @@ broker(conf *nanomq_conf)
 	}
 
 #if defined(SUPP_ICEORYX)
+	// the iceoryx works take the subscribers in turn
+	void **subers;
+	size_t nsubers = iceoryx_map_subers(&subers);
+	size_t turn    = 0;
 	for (i = 0; i < num_work; i++) {
-		works[i]->iceoryx_suber = suber;
-		works[i]->iceoryx_puber = puber;
-		works[i]->iceoryx_sock.data  = iceoryx_sock.data;
-		works[i]->iceoryx_sock.id    = iceoryx_sock.id;
+		if (works[i]->proto == PROTO_ICEORYX_BRIDGE && nsubers > 0) {
+			works[i]->iceoryx_suber = subers[turn++ % nsubers];
+		}
+	}
+#endif
+
+	// counts busy works from their first receive on
+	elastic_init(sock, inproc_sock, db, db_ret, nanomq_conf);
+
+	// retained updates share the QoS db of the broker socket
+#if defined(NNG_SUPP_SQLITE)
+	if (nanomq_conf->sqlite.enable && works[0]->sqlite_db != NULL &&
+	    (rv = sqlite_commit_init(works[0]->sqlite_db,
+	         NANO_SQLITE_COMMIT_BATCH, NANO_SQLITE_COMMIT_LINGER_MS)) != 0) {
+		log_warn("sqlite group commit disabled: %d", rv);
 	}
 #endif
 
+	// persistent sessions keep their subscriptions across reconnects,
+	// the wheel ends those nobody came back for
+	if ((rv = session_takeover_init(takeover_release, db)) != 0) {
+		log_warn("session takeover disabled: %d", rv);
+	}
+
+	// subscriptions of closed pipes leave the tree in batches
+	if ((rv = sub_reap_init(db, NANO_SUB_REAP_BATCH,
+	         NANO_SUB_REAP_LINGER_MS)) != 0) {
+		log_warn("deferred subscription removal disabled: %d", rv);
+	}
+
+	// slow subscriber webhooks go out on the hook socket of the first work
+	sub_queue_conf subq = {
+		.policy = { SUB_QUEUE_DROP_NEWEST, SUB_QUEUE_DROP_NEWEST,
+		    SUB_QUEUE_DROP_NEWEST },
+	};
+	sub_queue_conf_env(&subq);
+	if ((rv = sub_queue_init(&subq, sub_queue_slow, works[0])) != 0) {
+		log_warn("slow consumer detection disabled: %d", rv);
+	}
 	for (i = 0; i < num_work; i++) {
+		// bridge works go once their client is open, the $SYS one
+		// is run by its timer alone
+		if (works[i]->proto == PROTO_MQTT_BRIDGE || works[i] == sys_work) {
+			continue;
+		}
+#if defined(SUPP_ICEORYX)
+		// no in mapping to receive from
+		if (works[i]->proto == PROTO_ICEORYX_BRIDGE &&
+		    works[i]->iceoryx_suber == NULL) {
+			continue;
+		}
+#endif
 		server_cb(works[i]); // this starts them going (INIT state)
 	}
+	startup_done(STARTUP_LISTENER, 0);
+	if (bstart != NULL &&
+	    (rv = startup_run(STARTUP_BRIDGE, bridge_start, bstart)) != 0) {
+		NANO_NNG_FATAL("bridge_start", rv);
+	}
+
+	// bridge queues are all set up by now
+	if ((rv = proc_stats_init(
+	         nanomq_conf, NANO_PROC_STATS_INTERVAL_MS)) != 0) {
+		log_warn("resource sampler disabled: %d", rv);
+	}
+#if defined(SUPP_SYS_STATS)
+	if ((rv = sys_stats_init(sys_stats_publish, sys_work)) != 0) {
+		log_warn("$SYS statistics disabled: %d", rv);
+	}
+#endif
+	// nng has started its taskq, expire and poller threads by now
+	size_t pinned;
+	if ((rv = cpu_affinity_apply(&pinned)) != 0) {
+		log_warn("cpu affinity not applied: %d", rv);
+	}
 
 	if (nanomq_conf->http_server.enable) {
 		nanomq_conf->http_server.broker_sock = &sock;
@@ -1419,6 +2986,8 @@ broker(conf *nanomq_conf)
 	}
 #endif
 	printf("NanoMQ Broker is started successfully!\n");
+	log_info("build profile %s, binary %llu bytes", build_profile_name(),
+	    (unsigned long long) build_profile_binary_size());
 
 #if defined(ENABLE_NANOMQ_TESTS)
 	bool is_testing = true;
@@ -1454,6 +3023,10 @@ broker(conf *nanomq_conf)
 
 	for (;;) {
 		if (keepRunning == 0 || is_testing == true) {
+			// background inits still running finish first
+			startup_fini();
+			// queued webhooks go out while their sockets are open
+			transform_fini();
 #if defined(SUPP_RULE_ENGINE)
 
 #if defined(FDB_SUPPORT)
@@ -1463,12 +3036,47 @@ broker(conf *nanomq_conf)
 				fdb_stop_network();
 			}
 #endif
+			rule_sink_fini();
+			rule_filter_fini();
+#endif
+#if defined(SUPP_ICEORYX)
+			iceoryx_map_fini();
+			nano_iceoryx_fini();
+#endif
+#if defined(NNG_SUPP_SQLITE)
+			sqlite_commit_fini();
 #endif
 			conf *conf = works[0]->config;
 			if(is_testing == true && (conf->bridge.count > 0 || conf->aws_bridge.count > 0)) {
 				// bridge might need more time to response to the resquest
 				nng_msleep(8 * 1000); 
 			}
+#if defined(SUPP_PARQUET)
+			parquet_sink_fini();
+			exchange_query_fini();
+#endif
+			exchange_recent_fini();
+#if defined(SUPP_BRIDGE_CACHE)
+			bridge_cache_fini();
+#endif
+#if defined(SUPP_SESSION_SPILL)
+			session_spill_fini();
+#endif
+#if defined(SUPP_SYS_STATS)
+			// it runs on a work freed below
+			sys_stats_fini();
+#endif
+			// the sampler reads the bridge queues
+			proc_stats_fini();
+			bridge_queue_fini();
+#if defined(SUPP_BRIDGE_DEDUPE)
+			bridge_dedupe_fini();
+#endif
+#if defined(SUPP_BRIDGE_ZIP)
+			bridge_zip_fini();
+#endif
+			bridge_subtable_fini();
+			bridge_rtt_fini();
 			for (size_t t = 0; t < conf->bridge.count; t++) {
 				conf_bridge_node *node = conf->bridge.nodes[t];
 				size_t aio_count = conf->total_ctx;
@@ -1488,12 +3096,48 @@ broker(conf *nanomq_conf)
 			// nng_free(
 			//     conf->bridge.nodes, sizeof(conf_bridge_node **));
 
+			// no resumes may touch the works once freed
+			auth_http_cache_fini();
+			connect_admit_fini();
+			sub_queue_fini();
+			sub_reap_fini();
 			for (size_t i = 0; i < num_work; i++) {
 				nng_free(works[i]->pipe_ct,
 				    sizeof(struct pipe_content));
+				if (works[i]->extra != NULL) {
+					nng_free(works[i]->extra,
+					    sizeof(struct work_extra));
+				}
 				nng_free(works[i], sizeof(struct work));
 			}
 			nng_free(works, num_work * sizeof(struct work *));
+			elastic_fini();
+			work_lane_fini();
+			pub_quota_fini();
+			expiry_wheel_fini();
+			session_takeover_fini();
+			sub_stats_fini();
+			topic_alias_fini();
+			share_group_fini();
+			hook_filter_fini();
+			webhook_lifecycle_fini();
+#if defined(SUPP_TRAFFIC_STATS)
+			traffic_stats_fini();
+#endif
+#if defined(SUPP_LATENCY_STATS)
+			latency_stats_fini();
+#endif
+#if defined(SUPP_PROFILER)
+			prof_fini();
+#endif
+#if defined(SUPP_MSG_TRACE)
+			msg_trace_fini();
+#endif
+#if defined(SUPP_CLUSTER)
+			cluster_fini(conf);
+#endif
+			work_arena_fini();
+			msg_pool_fini();
 			break;
 		}
 		nng_msleep(6000);
@@ -1898,6 +3542,7 @@ broker_start(int argc, char **argv)
 
 	// Priority: config < environment variables < command opts
 	conf_init(nanomq_conf);
+	build_profile_apply(nanomq_conf);
 
 	rc = file_path_parse(argc, argv, &nanomq_conf->conf_file);
 	if (nanomq_conf->conf_file == NULL) {
@@ -2006,6 +3651,7 @@ broker_start_with_conf(void *nmq_conf)
 		}
 
 		conf_init(nanomq_conf);
+		build_profile_apply(nanomq_conf);
 		read_env_conf(nanomq_conf);
 	}
 
@@ -0,0 +1,480 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "include/async_log.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+#if defined(_MSC_VER)
+#define LOG_TLS __declspec(thread)
+#else
+#define LOG_TLS __thread
+#endif
+
+// what the writer formats in one go before it writes
+#define LOG_BATCH_SIZE (64 * 1024)
+// time, level and call site in front of the text, at most
+#define LOG_PREFIX_LEN 192
+
+typedef struct {
+	const char *file;
+	int         line;
+	uint64_t    second;
+	uint32_t    count;
+	uint32_t    suppressed;
+} log_site;
+
+typedef struct {
+	uint64_t    ms;
+	const char *file;
+	const char *func;
+	int         line;
+	int         level;
+	uint32_t    suppressed; // before this one, at its call site
+	uint32_t    len;
+	char        text[NANO_LOG_RECORD_LEN];
+} log_record;
+
+/*
+ * Single producer ring of one thread: only that thread pushes, only the
+ * writer pops, neither takes a lock. The call sites are the producer's.
+ */
+typedef struct {
+	nng_atomic_u64 *head;
+	nng_atomic_u64 *tail;
+	log_site        sites[NANO_LOG_SITES];
+	log_record      recs[NANO_LOG_RING_LEN];
+} log_ring;
+
+static struct {
+	bool        enabled;
+	uint32_t    rate;
+	uint64_t    gen; // of the init, so rings of an earlier one are let go
+	conf_log   *log;
+	uint64_t    file_bytes;
+	char       *batch;
+	size_t      batch_len;
+	nng_mtx    *mtx; // the file, claiming rings, direct writes
+	nng_cv     *cv;
+	nng_thread *writer;
+	bool        stop;
+	log_ring   *rings[NANO_LOG_RINGS];
+	size_t      nrings;
+
+	nng_atomic_u64 *written;
+	nng_atomic_u64 *dropped;
+	nng_atomic_u64 *suppressed;
+	nng_atomic_u64 *direct;
+} alog_;
+
+// bumped by every init, outlives the memset of fini
+static uint64_t alog_gen;
+
+static LOG_TLS log_ring *my_ring;
+static LOG_TLS uint64_t  my_gen;
+
+static void log_writer(void *arg);
+
+void
+async_log_conf_env(async_log_conf *c)
+{
+	const char *s;
+	char       *end;
+	long long   n;
+
+	if ((s = getenv("NANOMQ_LOG_ASYNC")) != NULL) {
+		c->enable = strcmp(s, "on") == 0 || strcmp(s, "1") == 0 ||
+		    strcmp(s, "true") == 0;
+	}
+	if ((s = getenv("NANOMQ_LOG_RATE")) != NULL && *s != '\0') {
+		n = strtoll(s, &end, 10);
+		if (*end == '\0' && n >= 0 && n <= UINT32_MAX) {
+			c->rate = (uint32_t) n;
+		}
+	}
+}
+
+int
+async_log_init(const async_log_conf *c, conf_log *log)
+{
+	int rv;
+
+	if (alog_.enabled || !c->enable) {
+		return 0;
+	}
+	if (log->fp == NULL) {
+		return NNG_EINVAL;
+	}
+	if ((rv = nng_mtx_alloc(&alog_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&alog_.cv, alog_.mtx)) != 0 ||
+	    (rv = nng_atomic_alloc64(&alog_.written)) != 0 ||
+	    (rv = nng_atomic_alloc64(&alog_.dropped)) != 0 ||
+	    (rv = nng_atomic_alloc64(&alog_.suppressed)) != 0 ||
+	    (rv = nng_atomic_alloc64(&alog_.direct)) != 0) {
+		async_log_fini();
+		return rv;
+	}
+	if ((alog_.batch = nng_alloc(LOG_BATCH_SIZE)) == NULL) {
+		async_log_fini();
+		return NNG_ENOMEM;
+	}
+	alog_.rate = c->rate;
+	alog_.log  = log;
+	alog_.gen  = ++alog_gen;
+	fseek(log->fp, 0, SEEK_END);
+	alog_.file_bytes = (uint64_t) ftell(log->fp);
+	if ((rv = nng_thread_create(&alog_.writer, log_writer, NULL)) != 0) {
+		async_log_fini();
+		return rv;
+	}
+	alog_.enabled = true;
+	return 0;
+}
+
+void
+async_log_fini(void)
+{
+	alog_.enabled = false;
+	if (alog_.mtx != NULL) {
+		nng_mtx_lock(alog_.mtx);
+		alog_.stop = true;
+		if (alog_.cv != NULL) {
+			nng_cv_wake(alog_.cv);
+		}
+		nng_mtx_unlock(alog_.mtx);
+	}
+	// the writer drains the rings before it returns
+	if (alog_.writer != NULL) {
+		nng_thread_destroy(alog_.writer);
+	}
+	for (size_t i = 0; i < alog_.nrings; i++) {
+		nng_atomic_free64(alog_.rings[i]->head);
+		nng_atomic_free64(alog_.rings[i]->tail);
+		nng_free(alog_.rings[i], sizeof(log_ring));
+	}
+	if (alog_.batch != NULL) {
+		nng_free(alog_.batch, LOG_BATCH_SIZE);
+	}
+	if (alog_.written != NULL) {
+		nng_atomic_free64(alog_.written);
+	}
+	if (alog_.dropped != NULL) {
+		nng_atomic_free64(alog_.dropped);
+	}
+	if (alog_.suppressed != NULL) {
+		nng_atomic_free64(alog_.suppressed);
+	}
+	if (alog_.direct != NULL) {
+		nng_atomic_free64(alog_.direct);
+	}
+	if (alog_.cv != NULL) {
+		nng_cv_free(alog_.cv);
+	}
+	if (alog_.mtx != NULL) {
+		nng_mtx_free(alog_.mtx);
+	}
+	memset(&alog_, 0, sizeof(alog_));
+}
+
+bool
+async_log_enabled(void)
+{
+	return alog_.enabled;
+}
+
+// The ring of the calling thread, claimed on its first record.
+static log_ring *
+log_ring_get(void)
+{
+	log_ring *ring;
+
+	if (my_gen == alog_.gen) {
+		return my_ring;
+	}
+	my_gen  = alog_.gen;
+	my_ring = NULL;
+	if ((ring = nng_zalloc(sizeof(log_ring))) == NULL) {
+		return NULL;
+	}
+	if (nng_atomic_alloc64(&ring->head) != 0) {
+		nng_free(ring, sizeof(log_ring));
+		return NULL;
+	}
+	if (nng_atomic_alloc64(&ring->tail) != 0) {
+		nng_atomic_free64(ring->head);
+		nng_free(ring, sizeof(log_ring));
+		return NULL;
+	}
+	nng_mtx_lock(alog_.mtx);
+	if (alog_.nrings < NANO_LOG_RINGS) {
+		alog_.rings[alog_.nrings++] = ring;
+		my_ring                     = ring;
+	}
+	nng_mtx_unlock(alog_.mtx);
+	if (my_ring == NULL) {
+		nng_atomic_free64(ring->head);
+		nng_atomic_free64(ring->tail);
+		nng_free(ring, sizeof(log_ring));
+	}
+	return my_ring;
+}
+
+/*
+ * Whether the call site may log one more record this second, with the
+ * number it suppressed since the last one in *suppressed. A site not
+ * found in the few slots of its hash takes the first of them over.
+ */
+static bool
+log_site_admit(log_ring *ring, const log_event *ev, uint64_t ms,
+    uint32_t *suppressed)
+{
+	uintptr_t h  = ((uintptr_t) ev->file >> 3) ^ (uintptr_t) ev->line * 31;
+	log_site *s  = NULL;
+	uint64_t  second = ms / 1000;
+
+	for (int k = 0; k < 4; k++) {
+		log_site *c = &ring->sites[(h + k) % NANO_LOG_SITES];
+		if (c->file == ev->file && c->line == ev->line) {
+			s = c;
+			break;
+		}
+	}
+	if (s == NULL) {
+		s = &ring->sites[h % NANO_LOG_SITES];
+		memset(s, 0, sizeof(*s));
+		s->file = ev->file;
+		s->line = ev->line;
+	}
+	if (s->second != second) {
+		s->second = second;
+		s->count  = 0;
+	}
+	if (s->count >= alog_.rate) {
+		s->suppressed++;
+		return false;
+	}
+	s->count++;
+	*suppressed   = s->suppressed;
+	s->suppressed = 0;
+	return true;
+}
+
+static size_t
+log_format(char *out, size_t size, const log_record *rec)
+{
+	time_t    sec = (time_t) (rec->ms / 1000);
+	struct tm tm;
+	size_t    n;
+	int       rv;
+
+#if defined(_WIN32)
+	localtime_s(&tm, &sec);
+#else
+	localtime_r(&sec, &tm);
+#endif
+	n = strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+	if (rec->suppressed > 0) {
+		rv = snprintf(out + n, size - n,
+		    ".%03d %-5s %s:%d %s: %.*s (%u suppressed)\n",
+		    (int) (rec->ms % 1000), log_level_string(rec->level),
+		    rec->file, rec->line, rec->func, (int) rec->len, rec->text,
+		    rec->suppressed);
+	} else {
+		rv = snprintf(out + n, size - n, ".%03d %-5s %s:%d %s: %.*s\n",
+		    (int) (rec->ms % 1000), log_level_string(rec->level),
+		    rec->file, rec->line, rec->func, (int) rec->len, rec->text);
+	}
+	if (rv < 0) {
+		return n;
+	}
+	return (size_t) rv >= size - n ? size - 1 : n + (size_t) rv;
+}
+
+static void
+log_record_fill(log_record *rec, log_event *ev, uint64_t ms)
+{
+	int n = vsnprintf(rec->text, sizeof(rec->text), ev->fmt, ev->ap);
+
+	rec->ms    = ms;
+	rec->file  = ev->file;
+	rec->func  = ev->func;
+	rec->line  = ev->line;
+	rec->level = ev->level;
+	rec->len   = n < 0 ? 0
+	      : (size_t) n >= sizeof(rec->text) ? sizeof(rec->text) - 1
+	                                        : (uint32_t) n;
+}
+
+// rotate the way log.rotation asks, writer or direct writer with mtx
+static void
+log_rotate(void)
+{
+	conf_log *log = alog_.log;
+	char     *from;
+	char     *to;
+	size_t    size;
+
+	if (log->rotation_sz == 0 || alog_.file_bytes < log->rotation_sz ||
+	    log->abs_path == NULL) {
+		return;
+	}
+	size = strlen(log->abs_path) + 24;
+	if ((from = nng_alloc(size)) == NULL) {
+		return;
+	}
+	if ((to = nng_alloc(size)) == NULL) {
+		nng_free(from, size);
+		return;
+	}
+	fclose(log->fp);
+	for (size_t i = log->rotation_count; i > 1; i--) {
+		snprintf(from, size, "%s.%zu", log->abs_path, i - 1);
+		snprintf(to, size, "%s.%zu", log->abs_path, i);
+		rename(from, to);
+	}
+	if (log->rotation_count > 0) {
+		snprintf(to, size, "%s.1", log->abs_path);
+		rename(log->abs_path, to);
+	} else {
+		remove(log->abs_path);
+	}
+	log->fp          = fopen(log->abs_path, "a");
+	alog_.file_bytes = 0;
+	nng_free(from, size);
+	nng_free(to, size);
+}
+
+static void
+log_batch_flush(void)
+{
+	if (alog_.batch_len > 0 && alog_.log->fp != NULL) {
+		fwrite(alog_.batch, 1, alog_.batch_len, alog_.log->fp);
+		fflush(alog_.log->fp);
+		alog_.file_bytes += alog_.batch_len;
+	}
+	alog_.batch_len = 0;
+	log_rotate();
+}
+
+// Everything the rings hold into the file, with mtx.
+static void
+log_drain(void)
+{
+	uint64_t written = 0;
+
+	for (size_t i = 0; i < alog_.nrings; i++) {
+		log_ring *ring = alog_.rings[i];
+		uint64_t  head = nng_atomic_get64(ring->head);
+		uint64_t  tail = nng_atomic_get64(ring->tail);
+
+		for (; head != tail; head++) {
+			if (LOG_BATCH_SIZE - alog_.batch_len <
+			    LOG_PREFIX_LEN + NANO_LOG_RECORD_LEN + 32) {
+				log_batch_flush();
+			}
+			alog_.batch_len += log_format(
+			    alog_.batch + alog_.batch_len,
+			    LOG_BATCH_SIZE - alog_.batch_len,
+			    &ring->recs[head % NANO_LOG_RING_LEN]);
+			written++;
+		}
+		nng_atomic_set64(ring->head, head);
+	}
+	log_batch_flush();
+	nng_atomic_add64(alog_.written, written);
+}
+
+static void
+log_writer(void *arg)
+{
+	(void) arg;
+	nng_mtx_lock(alog_.mtx);
+	while (!alog_.stop) {
+		nng_cv_until(alog_.cv, nng_clock() + NANO_LOG_FLUSH_MS);
+		log_drain();
+	}
+	log_drain();
+	nng_mtx_unlock(alog_.mtx);
+}
+
+// A thread without a ring writes its record itself.
+static void
+log_direct(log_event *ev, uint64_t ms)
+{
+	log_record rec;
+	char       line[LOG_PREFIX_LEN + NANO_LOG_RECORD_LEN + 32];
+	size_t     n;
+
+	log_record_fill(&rec, ev, ms);
+	rec.suppressed = 0;
+	n              = log_format(line, sizeof(line), &rec);
+	nng_mtx_lock(alog_.mtx);
+	if (alog_.log->fp != NULL) {
+		fwrite(line, 1, n, alog_.log->fp);
+		fflush(alog_.log->fp);
+		alog_.file_bytes += n;
+		log_rotate();
+	}
+	nng_mtx_unlock(alog_.mtx);
+	nng_atomic_inc64(alog_.direct);
+	nng_atomic_inc64(alog_.written);
+}
+
+void
+async_log_event(log_event *ev)
+{
+	log_ring   *ring;
+	log_record *rec;
+	uint64_t    tail;
+	uint64_t    ms;
+	uint32_t    suppressed = 0;
+
+	if (!alog_.enabled) {
+		return;
+	}
+	ms = nng_timestamp();
+	if ((ring = log_ring_get()) == NULL) {
+		log_direct(ev, ms);
+		return;
+	}
+	if (alog_.rate > 0 && ev->level != NNG_LOG_FATAL &&
+	    !log_site_admit(ring, ev, ms, &suppressed)) {
+		nng_atomic_inc64(alog_.suppressed);
+		return;
+	}
+	tail = nng_atomic_get64(ring->tail);
+	if (tail - nng_atomic_get64(ring->head) >= NANO_LOG_RING_LEN) {
+		nng_atomic_inc64(alog_.dropped);
+		return;
+	}
+	rec = &ring->recs[tail % NANO_LOG_RING_LEN];
+	log_record_fill(rec, ev, ms);
+	rec->suppressed = suppressed;
+	nng_atomic_set64(ring->tail, tail + 1);
+}
+
+void
+async_log_stats_get(async_log_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!alog_.enabled) {
+		return;
+	}
+	s->written    = nng_atomic_get64(alog_.written);
+	s->dropped    = nng_atomic_get64(alog_.dropped);
+	s->suppressed = nng_atomic_get64(alog_.suppressed);
+	s->direct     = nng_atomic_get64(alog_.direct);
+	s->rings      = alog_.nrings;
+}
@@ -0,0 +1,168 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/auth_cache.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+#define AUTH_CACHE_SETS (NANO_AUTH_CACHE_SIZE / NANO_AUTH_CACHE_WAYS)
+
+typedef struct {
+	char    *key; // NULL when free
+	size_t   len;
+	uint64_t hash;
+	uint64_t salt;
+	nng_time expire;
+	uint32_t flags;
+} auth_entry;
+
+static struct {
+	nng_mtx   *mtx;
+	auth_entry entries[NANO_AUTH_CACHE_SIZE];
+	bool       enabled;
+} auth_cache_;
+
+uint64_t
+auth_cache_hash(const void *data, size_t len, uint64_t seed)
+{
+	const uint8_t *p = data;
+	uint64_t       h = 14695981039346656037ull ^ seed;
+
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ p[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+int
+auth_cache_init(void)
+{
+	int rv;
+
+	if (auth_cache_.enabled) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&auth_cache_.mtx)) != 0) {
+		return rv;
+	}
+	auth_cache_.enabled = true;
+	return 0;
+}
+
+static void
+auth_entry_clear(auth_entry *e)
+{
+	if (e->key != NULL) {
+		nng_free(e->key, e->len);
+	}
+	memset(e, 0, sizeof(*e));
+}
+
+void
+auth_cache_fini(void)
+{
+	for (size_t i = 0; i < NANO_AUTH_CACHE_SIZE; i++) {
+		auth_entry_clear(&auth_cache_.entries[i]);
+	}
+	if (auth_cache_.mtx != NULL) {
+		nng_mtx_free(auth_cache_.mtx);
+	}
+	memset(&auth_cache_, 0, sizeof(auth_cache_));
+}
+
+bool
+auth_cache_enabled(void)
+{
+	return auth_cache_.enabled;
+}
+
+static auth_entry *
+auth_cache_set(uint64_t hash)
+{
+	return &auth_cache_.entries[(hash % AUTH_CACHE_SETS) *
+	    NANO_AUTH_CACHE_WAYS];
+}
+
+bool
+auth_cache_get(const char *key, size_t len, uint64_t salt, nng_time now,
+    uint32_t *flags)
+{
+	uint64_t    hash;
+	auth_entry *set;
+	bool        hit = false;
+
+	if (!auth_cache_.enabled || len == 0 || len > NANO_AUTH_CACHE_KEY_MAX) {
+		return false;
+	}
+	hash = auth_cache_hash(key, len, 0);
+	set  = auth_cache_set(hash);
+
+	nng_mtx_lock(auth_cache_.mtx);
+	for (int i = 0; i < NANO_AUTH_CACHE_WAYS; i++) {
+		auth_entry *e = &set[i];
+		if (e->key == NULL || e->hash != hash || e->len != len ||
+		    memcmp(e->key, key, len) != 0) {
+			continue;
+		}
+		if (e->salt != salt || now >= e->expire) {
+			auth_entry_clear(e);
+		} else {
+			*flags = e->flags;
+			hit    = true;
+		}
+		break;
+	}
+	nng_mtx_unlock(auth_cache_.mtx);
+	return hit;
+}
+
+void
+auth_cache_put(const char *key, size_t len, uint64_t salt, nng_time expire,
+    uint32_t flags)
+{
+	uint64_t    hash;
+	auth_entry *set;
+	auth_entry *e = NULL;
+	char       *copy;
+
+	if (!auth_cache_.enabled || len == 0 || len > NANO_AUTH_CACHE_KEY_MAX) {
+		return;
+	}
+	if ((copy = nng_alloc(len)) == NULL) {
+		return;
+	}
+	memcpy(copy, key, len);
+	hash = auth_cache_hash(key, len, 0);
+	set  = auth_cache_set(hash);
+
+	nng_mtx_lock(auth_cache_.mtx);
+	// the same key, else a free way, else the one expiring first
+	for (int i = 0; i < NANO_AUTH_CACHE_WAYS; i++) {
+		auth_entry *w = &set[i];
+		if (w->key != NULL && w->hash == hash && w->len == len &&
+		    memcmp(w->key, key, len) == 0) {
+			e = w;
+			break;
+		}
+		if (e == NULL || (e->key != NULL &&
+		        (w->key == NULL || w->expire < e->expire))) {
+			e = w;
+		}
+	}
+	auth_entry_clear(e);
+	e->key    = copy;
+	e->len    = len;
+	e->hash   = hash;
+	e->salt   = salt;
+	e->expire = expire;
+	e->flags  = flags;
+	nng_mtx_unlock(auth_cache_.mtx);
+}
@@ -0,0 +1,372 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/auth_http_cache.h"
+#include "nng/nng.h"
+#include "nng/mqtt/packet.h"
+#include "nng/protocol/mqtt/mqtt.h"
+#include "nng/supplemental/nanolib/mqtt_db.h"
+#include "nng/supplemental/nanolib/nanolib.h"
+#include "nng/supplemental/util/platform.h"
+
+#define AUTH_HTTP_KEY_STACK 256
+
+typedef struct auth_http_entry auth_http_entry;
+struct auth_http_entry {
+	auth_http_entry *next;
+	uint64_t         hash;
+	nng_time         expire;
+	bool             allow;
+	size_t           len;
+	char             key[];
+};
+
+typedef struct {
+	conn_param        *cp;
+	bool               sub;
+	char              *topic;
+	size_t             len;
+	auth_http_cache_cb cb;
+	void              *arg;
+} auth_http_job;
+
+static struct {
+	nng_mtx          *mtx;
+	auth_http_entry **buckets;
+	auth_http_entry **ring; // entries in the order they came in
+	size_t            ring_head;
+	size_t            count;
+	nng_duration      allow_ttl;
+	nng_duration      deny_ttl;
+
+	conf_auth_http *conf;
+	nng_cv         *cv;
+	auth_http_job  *jobs; // NANO_AUTH_HTTP_QUEUE long
+	size_t          job_head;
+	size_t          job_count;
+	nng_thread     *threads[NANO_AUTH_HTTP_THREADS_MAX];
+	size_t          nthreads;
+	bool            stop;
+	bool            enabled;
+} ahc;
+
+static void auth_http_thread(void *arg);
+
+static uint64_t
+auth_http_hash(const char *key, size_t len)
+{
+	uint64_t h = 14695981039346656037ull;
+
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (uint8_t) key[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+int
+auth_http_cache_init(
+    conf_auth_http *conf, nng_duration allow_ttl, nng_duration deny_ttl)
+{
+	int    rv;
+	size_t n;
+
+	if (ahc.enabled) {
+		return 0;
+	}
+	ahc.allow_ttl = allow_ttl;
+	ahc.deny_ttl  = deny_ttl;
+	if ((rv = nng_mtx_alloc(&ahc.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&ahc.cv, ahc.mtx)) != 0) {
+		auth_http_cache_fini();
+		return rv;
+	}
+	if ((ahc.buckets = nng_zalloc(sizeof(auth_http_entry *) *
+	         NANO_AUTH_HTTP_CACHE_SIZE)) == NULL ||
+	    (ahc.ring = nng_zalloc(sizeof(auth_http_entry *) *
+	         NANO_AUTH_HTTP_CACHE_SIZE)) == NULL) {
+		auth_http_cache_fini();
+		return NNG_ENOMEM;
+	}
+	ahc.enabled = true;
+	if (conf == NULL) {
+		return 0;
+	}
+
+	if ((ahc.jobs = nng_zalloc(
+	         sizeof(auth_http_job) * NANO_AUTH_HTTP_QUEUE)) == NULL) {
+		auth_http_cache_fini();
+		return NNG_ENOMEM;
+	}
+	ahc.conf = conf;
+	n        = conf->pool_size;
+	if (n == 0) {
+		n = 1;
+	} else if (n > NANO_AUTH_HTTP_THREADS_MAX) {
+		n = NANO_AUTH_HTTP_THREADS_MAX;
+	}
+	for (; ahc.nthreads < n; ahc.nthreads++) {
+		if ((rv = nng_thread_create(&ahc.threads[ahc.nthreads],
+		         auth_http_thread, NULL)) != 0) {
+			auth_http_cache_fini();
+			return rv;
+		}
+	}
+	return 0;
+}
+
+void
+auth_http_cache_fini(void)
+{
+	if (ahc.mtx != NULL) {
+		nng_mtx_lock(ahc.mtx);
+		ahc.stop = true;
+		if (ahc.cv != NULL) {
+			nng_cv_wake(ahc.cv);
+		}
+		nng_mtx_unlock(ahc.mtx);
+	}
+	for (size_t i = 0; i < ahc.nthreads; i++) {
+		nng_thread_destroy(ahc.threads[i]);
+	}
+	// checks still queued are dropped, their works go with the broker
+	for (size_t i = 0; i < ahc.job_count; i++) {
+		auth_http_job *job =
+		    &ahc.jobs[(ahc.job_head + i) % NANO_AUTH_HTTP_QUEUE];
+		nng_free(job->topic, job->len + 1);
+	}
+	if (ahc.jobs != NULL) {
+		nng_free(ahc.jobs, sizeof(auth_http_job) * NANO_AUTH_HTTP_QUEUE);
+	}
+	if (ahc.ring != NULL) {
+		for (size_t i = 0; i < NANO_AUTH_HTTP_CACHE_SIZE; i++) {
+			if (ahc.ring[i] != NULL) {
+				nng_free(ahc.ring[i],
+				    sizeof(auth_http_entry) + ahc.ring[i]->len);
+			}
+		}
+		nng_free(ahc.ring,
+		    sizeof(auth_http_entry *) * NANO_AUTH_HTTP_CACHE_SIZE);
+	}
+	if (ahc.buckets != NULL) {
+		nng_free(ahc.buckets,
+		    sizeof(auth_http_entry *) * NANO_AUTH_HTTP_CACHE_SIZE);
+	}
+	if (ahc.cv != NULL) {
+		nng_cv_free(ahc.cv);
+	}
+	if (ahc.mtx != NULL) {
+		nng_mtx_free(ahc.mtx);
+	}
+	memset(&ahc, 0, sizeof(ahc));
+}
+
+bool
+auth_http_cache_enabled(void)
+{
+	return ahc.enabled;
+}
+
+// action, clientid, NUL, username, NUL, topic; in buf if it fits
+static char *
+auth_http_key(char *buf, const char *clientid, const char *username,
+    bool sub, const char *topic, size_t len, size_t *key_len)
+{
+	size_t cl, ul;
+	char  *key;
+
+	clientid = clientid == NULL ? "" : clientid;
+	username = username == NULL ? "" : username;
+	cl       = strlen(clientid);
+	ul       = strlen(username);
+	*key_len = 1 + cl + 1 + ul + 1 + len;
+	if (*key_len > AUTH_HTTP_KEY_STACK) {
+		if ((key = nng_alloc(*key_len)) == NULL) {
+			return NULL;
+		}
+	} else {
+		key = buf;
+	}
+	key[0] = sub ? 's' : 'p';
+	memcpy(key + 1, clientid, cl + 1);
+	memcpy(key + 2 + cl, username, ul + 1);
+	if (len > 0) {
+		memcpy(key + 3 + cl + ul, topic, len);
+	}
+	return key;
+}
+
+static void
+auth_http_key_free(char *buf, char *key, size_t key_len)
+{
+	if (key != buf) {
+		nng_free(key, key_len);
+	}
+}
+
+static auth_http_entry **
+auth_http_find(const char *key, size_t len, uint64_t hash)
+{
+	auth_http_entry **ep = &ahc.buckets[hash % NANO_AUTH_HTTP_CACHE_SIZE];
+
+	for (; *ep != NULL; ep = &(*ep)->next) {
+		if ((*ep)->hash == hash && (*ep)->len == len &&
+		    memcmp((*ep)->key, key, len) == 0) {
+			break;
+		}
+	}
+	return ep;
+}
+
+int
+auth_http_cache_get(const char *clientid, const char *username, bool sub,
+    const char *topic, size_t len)
+{
+	char             buf[AUTH_HTTP_KEY_STACK];
+	char            *key;
+	size_t           key_len;
+	uint64_t         hash;
+	auth_http_entry *e;
+	int              rv = AUTH_HTTP_MISS;
+
+	if (!ahc.enabled || (key = auth_http_key(buf, clientid, username, sub,
+	                         topic, len, &key_len)) == NULL) {
+		return AUTH_HTTP_MISS;
+	}
+	hash = auth_http_hash(key, key_len);
+
+	nng_mtx_lock(ahc.mtx);
+	e = *auth_http_find(key, key_len, hash);
+	if (e != NULL && nng_clock() < e->expire) {
+		rv = e->allow ? AUTH_HTTP_ALLOW : AUTH_HTTP_DENY;
+	}
+	nng_mtx_unlock(ahc.mtx);
+	auth_http_key_free(buf, key, key_len);
+	return rv;
+}
+
+void
+auth_http_cache_put(const char *clientid, const char *username, bool sub,
+    const char *topic, size_t len, bool allow)
+{
+	char              buf[AUTH_HTTP_KEY_STACK];
+	char             *key;
+	size_t            key_len;
+	uint64_t          hash;
+	auth_http_entry **ep;
+	auth_http_entry  *e;
+	nng_time          expire;
+
+	if (!ahc.enabled || (key = auth_http_key(buf, clientid, username, sub,
+	                         topic, len, &key_len)) == NULL) {
+		return;
+	}
+	hash   = auth_http_hash(key, key_len);
+	expire = nng_clock() + (allow ? ahc.allow_ttl : ahc.deny_ttl);
+
+	nng_mtx_lock(ahc.mtx);
+	if ((e = *auth_http_find(key, key_len, hash)) == NULL &&
+	    (e = nng_alloc(sizeof(*e) + key_len)) != NULL) {
+		// full, the oldest entry makes room
+		auth_http_entry *old = ahc.ring[ahc.ring_head];
+		if (old != NULL) {
+			ep  = auth_http_find(old->key, old->len, old->hash);
+			*ep = old->next;
+			nng_free(old, sizeof(*old) + old->len);
+			ahc.count--;
+		}
+		e->hash = hash;
+		e->len  = key_len;
+		memcpy(e->key, key, key_len);
+		ep      = &ahc.buckets[hash % NANO_AUTH_HTTP_CACHE_SIZE];
+		e->next = *ep;
+		*ep     = e;
+		ahc.ring[ahc.ring_head] = e;
+		ahc.ring_head = (ahc.ring_head + 1) % NANO_AUTH_HTTP_CACHE_SIZE;
+		ahc.count++;
+	}
+	if (e != NULL) {
+		e->allow  = allow;
+		e->expire = expire;
+	}
+	nng_mtx_unlock(ahc.mtx);
+	auth_http_key_free(buf, key, key_len);
+}
+
+int
+auth_http_cache_check(conn_param *cp, bool sub, const char *topic,
+    size_t len, auth_http_cache_cb cb, void *arg)
+{
+	auth_http_job *job;
+	char          *copy;
+
+	if (!ahc.enabled || ahc.nthreads == 0) {
+		return NNG_ENOTSUP;
+	}
+	if ((copy = nng_alloc(len + 1)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	memcpy(copy, topic, len);
+	copy[len] = '\0';
+
+	nng_mtx_lock(ahc.mtx);
+	if (ahc.stop || ahc.job_count == NANO_AUTH_HTTP_QUEUE) {
+		nng_mtx_unlock(ahc.mtx);
+		nng_free(copy, len + 1);
+		return NNG_EAGAIN;
+	}
+	job = &ahc.jobs[(ahc.job_head + ahc.job_count++) % NANO_AUTH_HTTP_QUEUE];
+	job->cp    = cp;
+	job->sub   = sub;
+	job->topic = copy;
+	job->len   = len;
+	job->cb    = cb;
+	job->arg   = arg;
+	nng_cv_wake1(ahc.cv);
+	nng_mtx_unlock(ahc.mtx);
+	return 0;
+}
+
+static void
+auth_http_thread(void *arg)
+{
+	auth_http_job job;
+	topic_queue  *tq;
+	int           rv;
+
+	(void) arg;
+	for (;;) {
+		nng_mtx_lock(ahc.mtx);
+		while (!ahc.stop && ahc.job_count == 0) {
+			nng_cv_wait(ahc.cv);
+		}
+		if (ahc.stop) {
+			nng_mtx_unlock(ahc.mtx);
+			return;
+		}
+		job          = ahc.jobs[ahc.job_head];
+		ahc.job_head = (ahc.job_head + 1) % NANO_AUTH_HTTP_QUEUE;
+		ahc.job_count--;
+		nng_mtx_unlock(ahc.mtx);
+
+		if ((tq = topic_queue_init(job.topic, job.len)) == NULL) {
+			rv = NNG_ENOMEM;
+		} else {
+			rv = nmq_auth_http_sub_pub(job.cp, job.sub, tq, ahc.conf);
+			topic_queue_release(tq);
+			auth_http_cache_put(
+			    (const char *) conn_param_get_clientid(job.cp),
+			    (const char *) conn_param_get_username(job.cp),
+			    job.sub, job.topic, job.len, rv == 0);
+		}
+		nng_free(job.topic, job.len + 1);
+		job.cb(job.arg, rv);
+	}
+}
@@ -23,10 +23,12 @@
 #include "nng/nng.h"
 #include "nng/protocol/reqrep0/req.h"
 #include "nng/supplemental/nanolib/conf.h"
+#include "nng/supplemental/nanolib/cvector.h"
 #include "nng/supplemental/nanolib/utils.h"
 #include "nng/supplemental/util/platform.h"
 #include "nng/supplemental/nanolib/log.h"
 #include "pub_handler.h"
+#include "topic_match.h"
 
 /**
  * @brief ALPN (Application-Layer Protocol Negotiation) protocol name for AWS
@@ -103,6 +105,228 @@ struct NetworkContext {
 	conf_bridge_node *node;
 };
 
+/**
+ * @brief Timeout for the MQTT_ProcessLoop call that follows a batch of
+ * publishes, in milliseconds.
+ */
+#define AWS_BRIDGE_BATCH_LOOP_TIMEOUT_MS (10U)
+
+/*
+ * Publishes are copied into an aws_pub and queued per node by the broker
+ * workers; the node's mqtt_thread is the only one using the coreMQTT
+ * context. It takes the whole queue in one go, publishes it back to back
+ * and then runs a single MQTT_ProcessLoop for the acks of the batch.
+ */
+typedef struct aws_pub aws_pub;
+struct aws_pub {
+	aws_pub *next;
+	size_t   size; // of this allocation, topic and payload follow it
+	char    *topic;
+	uint8_t *payload;
+	uint32_t payload_len;
+	uint8_t  qos;
+	bool     retain;
+	bool     dup;
+	nng_time stamp;
+};
+
+typedef struct {
+	conf_bridge_node *node;
+	nng_mtx          *mtx;
+	nng_cv           *cv;
+	aws_pub          *head;
+	aws_pub          *tail;
+	size_t            depth;
+	uint64_t          sent;
+	uint64_t          dropped;
+	uint64_t          failed;
+	uint64_t          latency_sum;
+	uint64_t          latency_max;
+	topic_filter_set *forwards; // local topics, by index in forwards_list
+} aws_queue;
+
+static aws_queue **aws_queues = NULL; // cvector, filled before forwarding
+
+MQTTPublishInfo_t aws_bridge_publish_msg(const char *topic, uint8_t *payload,
+    uint32_t len, bool dup, uint8_t qos, bool retain);
+
+static aws_queue *
+aws_queue_find(conf_bridge_node *node)
+{
+	for (size_t i = 0; i < cvector_size(aws_queues); i++) {
+		if (aws_queues[i]->node == node) {
+			return aws_queues[i];
+		}
+	}
+	return NULL;
+}
+
+static aws_queue *
+aws_queue_alloc(conf_bridge_node *node)
+{
+	aws_queue *q;
+
+	if ((q = nng_zalloc(sizeof(aws_queue))) == NULL) {
+		return NULL;
+	}
+	if (nng_mtx_alloc(&q->mtx) != 0) {
+		nng_free(q, sizeof(aws_queue));
+		return NULL;
+	}
+	if (nng_cv_alloc(&q->cv, q->mtx) != 0) {
+		nng_mtx_free(q->mtx);
+		nng_free(q, sizeof(aws_queue));
+		return NULL;
+	}
+	q->node = node;
+	if (topic_filter_set_alloc(&q->forwards) == 0) {
+		for (size_t i = 0; i < node->forwards_count; i++) {
+			if (topic_filter_set_add(q->forwards,
+			        node->forwards_list[i]->local_topic,
+			        (uint32_t) i) != 0) {
+				// matched from the conf instead
+				topic_filter_set_free(q->forwards);
+				q->forwards = NULL;
+				break;
+			}
+		}
+	}
+	cvector_push_back(aws_queues, q);
+	return q;
+}
+
+static void
+aws_queue_push(aws_queue *q, const char *topic, nano_work *work)
+{
+	struct pub_packet_struct *pub       = work->pub_packet;
+	size_t                    topic_len = strlen(topic);
+	size_t                    size =
+	    sizeof(aws_pub) + topic_len + 1 + pub->payload.len;
+	aws_pub *item;
+
+	nng_mtx_lock(q->mtx);
+	if (q->depth >= NANO_AWS_BRIDGE_QUEUE_LEN) {
+		q->dropped++;
+		nng_mtx_unlock(q->mtx);
+		log_warn("aws bridge %s queue full, msg lost", q->node->name);
+		return;
+	}
+	nng_mtx_unlock(q->mtx);
+
+	if ((item = nng_alloc(size)) == NULL) {
+		nng_mtx_lock(q->mtx);
+		q->dropped++;
+		nng_mtx_unlock(q->mtx);
+		return;
+	}
+	item->next        = NULL;
+	item->size        = size;
+	item->topic       = (char *) (item + 1);
+	item->payload     = (uint8_t *) item->topic + topic_len + 1;
+	item->payload_len = pub->payload.len;
+	item->qos         = pub->fixed_header.qos;
+	item->retain      = pub->fixed_header.retain;
+	item->dup         = pub->fixed_header.dup;
+	item->stamp       = nng_clock();
+	memcpy(item->topic, topic, topic_len + 1);
+	if (pub->payload.len > 0) {
+		memcpy(item->payload, pub->payload.data, pub->payload.len);
+	}
+
+	nng_mtx_lock(q->mtx);
+	if (q->tail != NULL) {
+		q->tail->next = item;
+	} else {
+		q->head = item;
+		nng_cv_wake(q->cv);
+	}
+	q->tail = item;
+	q->depth++;
+	nng_mtx_unlock(q->mtx);
+}
+
+/*
+ * Publish what is queued for the node, waiting up to
+ * MQTT_PROCESS_LOOP_TIMEOUT_MS for work, then serve the connection once.
+ */
+static int
+aws_queue_drain(aws_queue *q, MQTTContext_t *mqtt_ctx)
+{
+	aws_pub     *batch;
+	MQTTStatus_t status = MQTTSuccess;
+	uint64_t     sent = 0, failed = 0, lat_sum = 0, lat_max = 0;
+
+	nng_mtx_lock(q->mtx);
+	if (q->head == NULL) {
+		(void) nng_cv_until(
+		    q->cv, nng_clock() + MQTT_PROCESS_LOOP_TIMEOUT_MS);
+	}
+	batch    = q->head;
+	q->head  = NULL;
+	q->tail  = NULL;
+	q->depth = 0;
+	nng_mtx_unlock(q->mtx);
+
+	while (batch != NULL) {
+		aws_pub *item = batch;
+		batch         = item->next;
+		if (status == MQTTSuccess) {
+			MQTTPublishInfo_t pub_info = aws_bridge_publish_msg(
+			    item->topic, item->payload, item->payload_len,
+			    item->dup, item->qos, item->retain);
+			status = MQTT_Publish(
+			    mqtt_ctx, &pub_info, MQTT_GetPacketId(mqtt_ctx));
+			if (status == MQTTNoMemory) {
+				// too many QoS 1 publishes in flight, take the
+				// acks that arrived so far and try once more
+				status = MQTT_ProcessLoop(
+				    mqtt_ctx, AWS_BRIDGE_BATCH_LOOP_TIMEOUT_MS);
+				if (status == MQTTSuccess) {
+					status = MQTT_Publish(mqtt_ctx, &pub_info,
+					    MQTT_GetPacketId(mqtt_ctx));
+				}
+			}
+		}
+		if (status == MQTTSuccess) {
+			uint64_t lat = nng_clock() - item->stamp;
+			lat_sum += lat;
+			lat_max = lat > lat_max ? lat : lat_max;
+			sent++;
+		} else {
+			// the connection is gone, the rest of the batch too
+			failed++;
+		}
+		nng_free(item, item->size);
+	}
+
+	nng_mtx_lock(q->mtx);
+	q->sent += sent;
+	q->failed += failed;
+	q->latency_sum += lat_sum;
+	q->latency_max = lat_max > q->latency_max ? lat_max : q->latency_max;
+	nng_mtx_unlock(q->mtx);
+
+	if (status != MQTTSuccess) {
+		log_error("MQTT_Publish returned with status = %s.",
+		    MQTT_Status_strerror(status));
+		return EXIT_FAILURE;
+	}
+
+	/* Calling MQTT_ProcessLoop to process incoming publish echo and the
+	 * acks of the batch. This function also sends ping request to broker
+	 * if MQTT_KEEP_ALIVE_INTERVAL_SECONDS has expired since the last MQTT
+	 * packet sent and receive ping responses. */
+	status = MQTT_ProcessLoop(mqtt_ctx,
+	    sent > 0 ? AWS_BRIDGE_BATCH_LOOP_TIMEOUT_MS
+	             : MQTT_PROCESS_LOOP_TIMEOUT_MS);
+	if (status != MQTTSuccess) {
+		log_error("MQTT_ProcessLoop returned with status = %s.",
+		    MQTT_Status_strerror(status));
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
 static int
 establish_mqtt_session(MQTTContext_t *mqtt_ctx, bool clean_session,
     bool *broker_session, conf_bridge_node *node)
@@ -465,6 +689,7 @@ mqtt_thread(void *arg)
 	}
 
 	conf_bridge_node *    node        = (conf_bridge_node *) arg;
+	aws_queue *           q           = aws_queue_find(node);
 	int                   mqtt_status = 0;
 	MQTTContext_t *       mqtt_ctx    = nng_zalloc(sizeof(MQTTContext_t));
 	NetworkContext_t *    net_ctx = nng_zalloc(sizeof(NetworkContext_t));
@@ -492,10 +717,7 @@ mqtt_thread(void *arg)
 			if (rv == EXIT_SUCCESS) {
 				rv = subscribe_to_topic(mqtt_ctx, node);
 				while (rv == EXIT_SUCCESS) {
-					rv = MQTT_ProcessLoop(mqtt_ctx,
-					    MQTT_PROCESS_LOOP_TIMEOUT_MS);
-					nng_msleep(
-					    MQTT_PROCESS_LOOP_TIMEOUT_MS);
+					rv = aws_queue_drain(q, mqtt_ctx);
 				}
 				nng_msleep(
 				    MQTT_SUBPUB_LOOP_DELAY_SECONDS * 1000);
@@ -508,7 +730,14 @@ static int
 client_init(conf_bridge_node *node)
 {
 	nng_thread *thread;
-	nng_thread_create(&thread, mqtt_thread, node);
+
+	if (aws_queue_find(node) == NULL && aws_queue_alloc(node) == NULL) {
+		return EXIT_FAILURE;
+	}
+	if (nng_thread_create(&thread, mqtt_thread, node) != 0) {
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
 }
 
 MQTTPublishInfo_t
@@ -527,70 +756,75 @@ aws_bridge_publish_msg(const char *topic, uint8_t *payload, uint32_t len,
 	return pub_info;
 }
 
+static void
+aws_bridge_forward_rule(
+    conf_bridge_node *node, aws_queue *q, topics *rule, nano_work *work)
+{
+	const char *publish_topic;
+
+	// No change if remote topic == ""
+	if (rule->remote_topic_len == 0) {
+		publish_topic = work->pub_packet->var_header.publish.topic_name.body;
+	} else {
+		publish_topic = rule->remote_topic;
+	}
+	if (q == NULL) {
+		log_warn("aws bridge %s is not running", node->name);
+		return;
+	}
+	aws_queue_push(q, publish_topic, work);
+}
+
 void
 aws_bridge_forward(nano_work *work)
 {
-	int rv;
+	const char *topic = work->pub_packet->var_header.publish.topic_name.body;
+	uint32_t   *ids   = NULL;
 
 	for (size_t t = 0; t < work->config->aws_bridge.count; t++) {
 		conf_bridge_node *node = work->config->aws_bridge.nodes[t];
-		if (node->enable) {
-			for (size_t i = 0; i < node->forwards_count; i++) {
-				if (topic_filter(node->forwards_list[i]->local_topic,
-				        work->pub_packet->var_header.publish
-				            .topic_name.body)) {
-					MQTTContext_t *mqtt_ctx = node->sock;
-					uint16_t       packet_id =
-					    MQTT_GetPacketId(mqtt_ctx);
-					char *publish_topic;
-					// No change if remote topic == ""
-					if (node->forwards_list[i]->remote_topic_len == 0) {
-						publish_topic = work->pub_packet->
-							var_header.publish.topic_name.body;
-					} else {
-						publish_topic = node->forwards_list[i]->remote_topic;
-					}
-					MQTTPublishInfo_t pub_info = aws_bridge_publish_msg(
-					    publish_topic,
-					    work->pub_packet->payload.data, work->pub_packet->payload.len,
-					    work->pub_packet->fixed_header.dup,
-					    work->pub_packet->fixed_header.qos,
-					    work->pub_packet->fixed_header.retain);
-
-
-					rv = MQTT_Publish(
-					    mqtt_ctx, &pub_info, packet_id);
-
-					/* Calling MQTT_ProcessLoop to process
-					 * incoming publish echo, since
-					 * application subscribed to the same
-					 * topic the broker will send publish
-					 * message back to the application.
-					 * This function also sends ping
-					 * request to broker if
-					 * MQTT_KEEP_ALIVE_INTERVAL_SECONDS has
-					 * expired since the last MQTT packet
-					 * sent and receive ping responses. */
-					int mqttStatus =
-					    MQTT_ProcessLoop(mqtt_ctx,
-					        MQTT_PROCESS_LOOP_TIMEOUT_MS);
-
-					/* For any error in #MQTT_ProcessLoop,
-					 * exit the loop and disconnect from
-					 * the broker. */
-					if (mqttStatus != MQTTSuccess) {
-						log_error("MQTT_ProcessLoop "
-						          "returned with "
-						          "status = %s.",
-						    MQTT_Status_strerror(
-						        mqttStatus));
-						rv = EXIT_FAILURE;
-						break;
-					}
-				}
+		aws_queue        *q;
+		if (!node->enable) {
+			continue;
+		}
+		if ((q = aws_queue_find(node)) != NULL && q->forwards != NULL) {
+			cvector_clear(ids);
+			topic_filter_set_match(q->forwards, topic,
+			    pub_packet_levels(work->pub_packet), &ids);
+			for (size_t i = 0; i < cvector_size(ids); i++) {
+				aws_bridge_forward_rule(
+				    node, q, node->forwards_list[ids[i]], work);
 			}
+			continue;
 		}
+		for (size_t i = 0; i < node->forwards_count; i++) {
+			if (topic_filter(
+			        node->forwards_list[i]->local_topic, topic)) {
+				aws_bridge_forward_rule(
+				    node, q, node->forwards_list[i], work);
+			}
+		}
+	}
+	cvector_free(ids);
+}
+
+int
+aws_bridge_stat(conf_bridge_node *node, aws_bridge_stats *stats)
+{
+	aws_queue *q = aws_queue_find(node);
+
+	if (q == NULL) {
+		return NNG_ENOENT;
 	}
+	nng_mtx_lock(q->mtx);
+	stats->depth          = q->depth;
+	stats->sent           = q->sent;
+	stats->dropped        = q->dropped;
+	stats->failed         = q->failed;
+	stats->latency_ms     = q->sent > 0 ? q->latency_sum / q->sent : 0;
+	stats->latency_max_ms = q->latency_max;
+	nng_mtx_unlock(q->mtx);
+	return 0;
 }
 
 int
@@ -1,4 +1,9 @@
 #include "include/bridge.h"
+#include "include/bridge_forward.h"
+#include "include/bridge_rtt.h"
+#include "include/bridge_subtable.h"
+#include "include/bridge_zip.h"
+#include "include/cluster.h"
 #include "nng/mqtt/mqtt_client.h"
 #include "nng/nng.h"
 #include "nng/protocol/mqtt/mqtt.h"
@@ -14,6 +19,10 @@
 #include "include/nanomq.h"
 #include "include/mqtt_api.h"
 
+#if defined(SUPP_BRIDGE_CACHE)
+#include "include/bridge_cache.h"
+#endif
+
 #ifdef SUPP_QUIC
 #include "nng/mqtt/mqtt_quic_client.h"
 #endif
@@ -53,6 +62,12 @@ apply_sqlite_config(
 {
 #if defined(NNG_SUPP_SQLITE)
 	int rv;
+#if defined(SUPP_BRIDGE_CACHE)
+	// the segment cache of the broker buffers this node already
+	if (bridge_cache_enabled(config)) {
+		return (0);
+	}
+#endif
 	// create sqlite option
 	nng_mqtt_sqlite_option *opt;
 	if ((rv = nng_mqtt_alloc_sqlite_opt(&opt)) != 0) {
@@ -176,79 +191,113 @@ create_disconnect_msg()
 
 	return msg;
 }
+static void
+bridge_apply_sub_rewrite(
+    nano_work *work, const bridge_rewrite *rw, uint8_t retain)
+{
+	struct pub_packet_struct *pub = work->pub_packet;
+	const char               *topic;
+	uint32_t                  len;
+
+	nng_mqtt_msg_set_bridge_bool(work->msg, true);
+	// TODO replace bridge bool with sub retain bool
+	// nng_mqtt_msg_set_sub_retain_bool(work->msg, true);
+	topic = bridge_rewrite_topic(rw, pub->var_header.publish.topic_name.body,
+	    pub->var_header.publish.topic_name.len, &work->topic_buf,
+	    &work->topic_buf_cap, &len);
+	if (topic == NULL) {
+		log_error("bridge: alloc local_topic failed");
+		return;
+	}
+	pub->fixed_header.retain =
+	    retain == NO_RETAIN ? pub->fixed_header.retain : retain;
+	// No local topic change and keep it as it is if the rule rewrites nothing
+	if (topic != pub->var_header.publish.topic_name.body &&
+	    pub_packet_copy_topic(pub, topic, len) != 0) {
+		log_error("bridge: alloc local_topic failed");
+	}
+}
+
+#if defined(SUPP_BRIDGE_ZIP)
+// Swap a compressed payload for its inflated copy, and the property saying
+// it was compressed for one saying it no longer is.
+static void
+bridge_unzip(nano_work *work, conf_bridge_node *node)
+{
+	struct pub_packet_struct *pub = work->pub_packet;
+	uint8_t                  *data;
+	uint32_t                  len;
+	int                       rv;
+
+	rv = bridge_zip_inflate(work->ctx.id - 1, node, pub->payload.data,
+	    pub->payload.len, &data, &len);
+	if (rv != 0) {
+		// passed on as it came, the property tells subscribers
+		log_warn("bridge: payload from %s does not inflate: %d",
+		    node->name, rv);
+		pub->bridge_zip = NULL;
+		return;
+	}
+	if (pub->payload_owned && pub->payload.data != NULL) {
+		nng_free(pub->payload.data, pub->payload.len + 1);
+	}
+	pub->payload.data  = data;
+	pub->payload.len   = len;
+	pub->payload_owned = true;
+	pub->dirty         = true;
+	memcpy((uint8_t *) pub->bridge_zip, BRIDGE_ZIP_NONE,
+	    BRIDGE_ZIP_VALUE_LEN);
+	pub->bridge_zip = NULL;
+}
+#endif
+
 // TODO move to RECV state of PROTO_BRIDGE, however we need to modify original msg
 // duplicate msg
 static inline void
 bridge_handle_topic_sub_reflection(nano_work *work, conf_bridge_node *node)
 {
-	int rv = 0;
-	mqtt_string *topic;
-	topic = nng_zalloc(sizeof(*topic));
+	const char *body  = work->pub_packet->var_header.publish.topic_name.body;
+	uint32_t    index = work->ctx.id - 1;
+	bridge_sub *sub;
+
+	if (body == NULL) {
+		return;
+	}
+#if defined(SUPP_BRIDGE_ZIP)
+	if (work->pub_packet->bridge_zip != NULL) {
+		bridge_unzip(work, node);
+	}
+#endif
+	// Reminder: We ignore the overlaping matches. only the very first one prevail
+	// There is no way to know msg comes from which topic if we use overlaped wildcard
+	// unless limit this to MQTT v5 sub id.
+	if (bridge_forward_sub_match(index, node, body,
+	        pub_packet_levels(work->pub_packet), &sub) == 0) {
+		if (sub != NULL) {
+			bridge_apply_sub_rewrite(work, &sub->rewrite, sub->retain);
+		}
+		bridge_forward_end(index);
+		return;
+	}
+	bridge_forward_end(index);
+
+	// node is not in the rewrite snapshot, work from its conf
 	for (size_t i = 0; i < node->sub_count; i++) {
-		rv = 0;
-		topic->body = work->pub_packet->var_header.publish.topic_name.body;
-		topic->len  = work->pub_packet->var_header.publish.topic_name.len;
-		if (topic->body != NULL && node->sub_list[i]->remote_topic != NULL) {
-			// Reminder: We ignore the overlaping matches. only the very first one prevail
-			// There is no way to know msg comes from which topic if we use overlaped wildcard
-			// unless limit this to MQTT v5 sub id.
-			if (topic_filter(node->sub_list[i]->remote_topic, topic->body)) {
-				topics *sub_topic = node->sub_list[i];
-
-				// No local topic change and keep it as it is if local topic == ""
-				if (sub_topic->local_topic_len == 0) {
-					goto fix;
-				}
-				topic->body = nng_strdup(sub_topic->local_topic);
-				topic->len = strlen(topic->body);
-				rv = NNG_STAT_STRING;
-				if (topic->body == NULL) {
-					log_error("bridge: alloc local_topic failed");
-					nng_free(topic, sizeof(topic));
-					return;
-				}
-fix:
-				nng_mqtt_msg_set_bridge_bool(work->msg, true);
-				// TODO replace bridge bool with sub retain bool
-				// nng_mqtt_msg_set_sub_retain_bool(work->msg, true);
-				/* check prefix/suffix */
-				if (node->sub_list[i]->prefix != NULL) {
-					char *tmp = topic->body;
-					topic->body =
-						nng_strnins(topic->body, node->sub_list[i]->prefix,
-									topic->len, node->sub_list[i]->prefix_len);
-					topic->len = strlen(topic->body);
-					if (rv == NNG_STAT_STRING)
-						nng_free(tmp, strlen(tmp));
-					rv = NNG_STAT_STRING;	//mark it for free
-				}
-				if (node->sub_list[i]->suffix != NULL) {
-					char *tmp = topic->body;
-					topic->body =
-						nng_strncat(topic->body, node->sub_list[i]->suffix,
-									topic->len, node->sub_list[i]->suffix_len);
-					topic->len = strlen(topic->body);
-					if (rv == NNG_STAT_STRING)
-						nng_free(tmp, strlen(tmp));
-					rv = NNG_STAT_STRING;	//mark it for free
-				}
-				work->pub_packet->fixed_header.retain =
-				    sub_topic->retain == NO_RETAIN
-				    ? work->pub_packet->fixed_header.retain
-				    : sub_topic->retain;
-				/* release old topic area */
-				if (rv != 0) {
-					nng_strfree(work->pub_packet->var_header.publish.topic_name.body);
-					work->pub_packet->var_header.publish.topic_name.body = topic->body;
-					work->pub_packet->var_header.publish.topic_name.len = topic->len;
-				}
-				nng_free(topic, sizeof(topic));
-				return;
-			}
+		topics *sub_topic = node->sub_list[i];
+		if (sub_topic->remote_topic != NULL &&
+		    topic_filter(sub_topic->remote_topic, body)) {
+			bridge_rewrite rw = {
+				.base       = sub_topic->local_topic,
+				.base_len   = sub_topic->local_topic_len,
+				.prefix     = sub_topic->prefix,
+				.prefix_len = sub_topic->prefix_len,
+				.suffix     = sub_topic->suffix,
+				.suffix_len = sub_topic->suffix_len,
+			};
+			bridge_apply_sub_rewrite(work, &rw, sub_topic->retain);
+			return;
 		}
 	}
-	nng_free(topic, sizeof(topic));
-	return;
 }
 
 void
@@ -256,8 +305,9 @@ bridge_handle_topic_reflection(nano_work *work, conf_bridge *bridge)
 {
 	// for saving CPU
 	if (work->flag == CMD_PUBLISH) {
-		if (work->node != NULL)
-			bridge_handle_topic_sub_reflection(work, work->node);
+		if (work->extra != NULL && work->extra->node != NULL)
+			bridge_handle_topic_sub_reflection(
+			    work, work->extra->node);
 		else
 			for (size_t i = 0; i < bridge->count; i++) {
 				conf_bridge_node *node = bridge->nodes[i];
@@ -511,9 +561,71 @@ conn_property(conf_bridge_conn_properties *conf_prop)
 	return NULL;
 }
 
+static bridge_rtt_transport
+hybrid_transport(const char *url)
+{
+	return strncmp(url, quic_scheme, strlen(quic_scheme)) == 0
+	    ? BRIDGE_RTT_QUIC
+	    : BRIDGE_RTT_TCP;
+}
+
+/*
+ * Time the CONNACK of a dial we started and, while a handover is going
+ * on, tell hybrid_handover() whether the new connection made it.
+ */
+static void
+hybrid_connected(bridge_param *bridge_arg, nng_pipe p, bridge_rtt_transport t)
+{
+	int  reason = 0;
+	bool dialled;
+
+	nng_pipe_get_int(p, NNG_OPT_MQTT_CONNECT_REASON, &reason);
+	nng_mtx_lock(bridge_arg->switch_mtx);
+	dialled = bridge_arg->handover == HYBRID_IDLE;
+	if (bridge_arg->handover == HYBRID_DIALLING &&
+	    bridge_arg->handover_sock != NULL &&
+	    nng_socket_id(nng_pipe_socket(p)) ==
+	        nng_socket_id(*bridge_arg->handover_sock)) {
+		bridge_arg->handover = reason == 0 ? HYBRID_READY : HYBRID_FAILED;
+		dialled              = true;
+		nng_cv_wake1(bridge_arg->switch_cv);
+	}
+	if (dialled && bridge_arg->dial_time != 0) {
+		if (reason == 0) {
+			bridge_rtt_record(bridge_arg->config, t,
+			    (nng_duration) (nng_clock() - bridge_arg->dial_time));
+		} else {
+			bridge_rtt_lost(bridge_arg->config, t);
+		}
+		bridge_arg->dial_time = 0;
+	}
+	nng_mtx_unlock(bridge_arg->switch_mtx);
+}
+
+// Losing the socket being handed over to fails the handover, not the bridge.
+static void
+hybrid_disconnected(bridge_param *bridge_arg, nng_pipe p)
+{
+	nng_mtx_lock(bridge_arg->switch_mtx);
+	if (bridge_arg->handover == HYBRID_DIALLING &&
+	    bridge_arg->handover_sock != NULL &&
+	    nng_socket_id(nng_pipe_socket(p)) ==
+	        nng_socket_id(*bridge_arg->handover_sock)) {
+		bridge_arg->handover = HYBRID_FAILED;
+	} else if (bridge_arg->handover != HYBRID_READY) {
+		bridge_arg->disconnected = true;
+#if defined(SUPP_BRIDGE_CACHE)
+		bridge_cache_online(bridge_arg->config, false);
+#endif
+	}
+	nng_cv_wake1(bridge_arg->switch_cv);
+	nng_mtx_unlock(bridge_arg->switch_mtx);
+}
+
 static void
 hybrid_tcp_connect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 {
+	hybrid_connected(arg, p, BRIDGE_RTT_TCP);
 	bridge_tcp_connect_cb(p, ev, arg);
 }
 
@@ -525,11 +637,26 @@ hybrid_tcp_disconnect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 	// get connect reason
 	nng_pipe_get_int(p, NNG_OPT_MQTT_DISCONNECT_REASON, &reason);
 	log_warn("bridge client disconnected! RC [%d] \n", reason);
-	bridge_param *bridge_arg = arg;
+	hybrid_disconnected(arg, p);
+}
 
-	nng_mtx_lock(bridge_arg->switch_mtx);
-	nng_cv_wake1(bridge_arg->switch_cv);
-	nng_mtx_unlock(bridge_arg->switch_mtx);
+// Put new in place of the bridge socket, or park it while a handover dials.
+static void
+hybrid_sock_swap(bridge_param *bridge_arg, nng_socket *new)
+{
+	nng_socket *tsock = bridge_arg->sock;
+
+	if (bridge_arg->handover == HYBRID_DIALLING) {
+		bridge_arg->handover_sock = new;
+		return;
+	}
+	if (tsock) {
+		nng_sock_replace(*tsock, *new);
+		nng_close(*tsock);
+		nng_free(tsock, sizeof(nng_socket));
+	}
+	bridge_arg->config->sock = (void *) new;
+	bridge_arg->sock         = new;
 }
 
 static int
@@ -579,14 +706,7 @@ hybrid_tcp_client(bridge_param *bridge_arg)
 	nng_msg *connmsg   = create_connect_msg(node);
 	bridge_arg->connmsg = connmsg;
 
-	nng_socket *tsock  = bridge_arg->sock;
-	if (tsock) {
-		nng_sock_replace(*tsock, *new);
-		nng_close(*tsock);
-		nng_free(tsock, sizeof(nng_socket));
-	}
-	node->sock         = (void *) new;
-	bridge_arg->sock   = new;
+	hybrid_sock_swap(bridge_arg, new);
 
 	// TCP bridge does not support hot update of connmsg
 	if (0 != nng_dialer_set_ptr(dialer, NNG_OPT_MQTT_CONNMSG, connmsg)) {
@@ -598,6 +718,7 @@ hybrid_tcp_client(bridge_param *bridge_arg)
 	nng_mqtt_set_connect_cb(*new, hybrid_tcp_connect_cb, bridge_arg);
 	nng_mqtt_set_disconnect_cb(*new, hybrid_tcp_disconnect_cb, bridge_arg);
 
+	bridge_arg->dial_time = nng_clock();
 	if (0 != (rv = nng_dialer_start(dialer, NNG_FLAG_ALLOC))) {
 		log_error("nng dialer start failed %d", rv);
 		return rv;
@@ -613,16 +734,13 @@ hybrid_quic_disconnect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 	int reason = 0;
 	nng_pipe_get_int(p, NNG_OPT_MQTT_DISCONNECT_REASON, &reason);
 	log_warn("quic bridge client disconnected! RC [%d] \n", reason);
-	bridge_param *bridge_arg = arg;
-
-	nng_mtx_lock(bridge_arg->switch_mtx);
-	nng_cv_wake1(bridge_arg->switch_cv);
-	nng_mtx_unlock(bridge_arg->switch_mtx);
+	hybrid_disconnected(arg, p);
 }
 
 static void
 hybrid_quic_connect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 {
+	hybrid_connected(arg, p, BRIDGE_RTT_QUIC);
 	bridge_quic_connect_cb(p, ev, arg);
 }
 
@@ -664,14 +782,7 @@ hybrid_quic_client(bridge_param *bridge_arg)
 
 	execone = 0;
 
-	nng_socket *tsock  = bridge_arg->sock;
-	if (tsock) {
-		nng_sock_replace(*tsock, *new);
-		nng_close(*tsock);
-		nng_free(tsock, sizeof(nng_socket));
-	}
-	node->sock         = (void *) new;
-	bridge_arg->sock   = new;
+	hybrid_sock_swap(bridge_arg, new);
 
 	// TCP bridge does not support hot update of connmsg
 	nng_dialer_set_ptr(dialer, NNG_OPT_MQTT_CONNMSG, connmsg);
@@ -680,6 +791,7 @@ hybrid_quic_client(bridge_param *bridge_arg)
 	nng_mqtt_set_connect_cb(*new, hybrid_quic_connect_cb, bridge_arg);
 	nng_mqtt_set_disconnect_cb(*new, hybrid_quic_disconnect_cb, bridge_arg);
 
+	bridge_arg->dial_time = nng_clock();
 	rv = nng_dialer_start(dialer, NNG_FLAG_ALLOC);
 	if (rv != 0) {
 		log_error("nng dialer start failed %d", rv);
@@ -690,6 +802,316 @@ hybrid_quic_client(bridge_param *bridge_arg)
 }
 #endif
 
+static int
+hybrid_client(bridge_param *bridge_arg)
+{
+	const char *address = bridge_arg->config->address;
+
+	if (0 == strncmp(address, tcp_scheme, strlen(tcp_scheme)) ||
+	    0 == strncmp(address, tls_scheme, strlen(tls_scheme))) {
+		return hybrid_tcp_client(bridge_arg);
+#if defined(SUPP_QUIC)
+	} else if (0 == strncmp(address, quic_scheme, strlen(quic_scheme))) {
+		return hybrid_quic_client(bridge_arg);
+#endif
+	}
+	log_error("Unsupported bridge protocol.");
+	return NNG_ENOTSUP;
+}
+
+typedef struct {
+	nng_mtx *mtx;
+	nng_cv  *cv;
+	nng_time start;
+	nng_time connack;
+	int      reason;
+	bool     done;
+	bool     closed;
+} hybrid_probe;
+
+static void
+hybrid_probe_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
+{
+	hybrid_probe *probe  = arg;
+	int           reason = 0;
+
+	nng_pipe_get_int(p, NNG_OPT_MQTT_CONNECT_REASON, &reason);
+	nng_mtx_lock(probe->mtx);
+	if (!probe->done && !probe->closed) {
+		probe->done    = true;
+		probe->reason  = reason;
+		probe->connack = nng_clock();
+		nng_cv_wake(probe->cv);
+	}
+	nng_mtx_unlock(probe->mtx);
+}
+
+/*
+ * CONNECT of a probe: clean session, no will and a client id of its own,
+ * so it never takes over or disturbs the session of the bridge.
+ */
+static nng_msg *
+hybrid_probe_connmsg(conf_bridge_node *node)
+{
+	nng_msg *connmsg;
+	char     clientid[128];
+
+	if (nng_mqtt_msg_alloc(&connmsg, 0) != 0) {
+		return NULL;
+	}
+	nng_mqtt_msg_set_packet_type(connmsg, NNG_MQTT_CONNECT);
+	nng_mqtt_msg_set_connect_keep_alive(connmsg, node->keepalive);
+	nng_mqtt_msg_set_connect_proto_version(connmsg, node->proto_ver);
+	nng_mqtt_msg_set_connect_clean_session(connmsg, true);
+	if (node->clientid) {
+		snprintf(clientid, sizeof(clientid), "%s-probe", node->clientid);
+		nng_mqtt_msg_set_connect_client_id(connmsg, clientid);
+	}
+	if (node->username) {
+		nng_mqtt_msg_set_connect_user_name(connmsg, node->username);
+	}
+	if (node->password) {
+		nng_mqtt_msg_set_connect_password(connmsg, node->password);
+	}
+	if (node->proto_ver == MQTT_PROTOCOL_VERSION_v5) {
+		nng_mqttv5_msg_encode(connmsg);
+	} else {
+		nng_mqtt_msg_encode(connmsg);
+	}
+	return connmsg;
+}
+
+static int
+hybrid_probe_open(nng_socket *sock, conf_bridge_node *node,
+    bridge_rtt_transport t)
+{
+#if defined(SUPP_QUIC)
+	if (t == BRIDGE_RTT_QUIC) {
+		return node->proto_ver == MQTT_PROTOCOL_VERSION_v5
+		    ? nng_mqttv5_quic_client_open(sock)
+		    : nng_mqtt_quic_client_open(sock);
+	}
+#else
+	if (t == BRIDGE_RTT_QUIC) {
+		return NNG_ENOTSUP;
+	}
+#endif
+	return node->proto_ver == MQTT_PROTOCOL_VERSION_v5
+	    ? nng_mqttv5_client_open(sock)
+	    : nng_mqtt_client_open(sock);
+}
+
+/*
+ * Measure one CONNECT/CONNACK round trip to url over a throwaway
+ * connection. It covers the transport handshake as well, which is where
+ * QUIC and TCP differ most on a lossy path.
+ */
+static void
+hybrid_probe_url(bridge_param *bridge_arg, const char *url)
+{
+	conf_bridge_node    *node  = bridge_arg->config;
+	bridge_rtt_transport t     = hybrid_transport(url);
+	hybrid_probe         probe = { 0 };
+	nng_socket           sock;
+	nng_dialer           dialer;
+	nng_msg             *connmsg;
+	bool                 ok = false;
+
+	if (nng_mtx_alloc(&probe.mtx) != 0) {
+		return;
+	}
+	if (nng_cv_alloc(&probe.cv, probe.mtx) != 0) {
+		nng_mtx_free(probe.mtx);
+		return;
+	}
+	if (hybrid_probe_open(&sock, node, t) != 0) {
+		goto done;
+	}
+	if ((connmsg = hybrid_probe_connmsg(node)) == NULL) {
+		nng_close(sock);
+		goto done;
+	}
+	if (nng_dialer_create(&dialer, sock, url) != 0) {
+		nng_msg_free(connmsg);
+		nng_close(sock);
+		goto done;
+	}
+#ifdef NNG_SUPP_TLS
+	if (t == BRIDGE_RTT_TCP && node->tls.enable &&
+	    init_dialer_tls(dialer, node->tls.ca, node->tls.cert, node->tls.key,
+	        node->tls.key_password) != 0) {
+		nng_msg_free(connmsg);
+		nng_close(sock);
+		goto done;
+	}
+#endif
+#if defined(SUPP_QUIC)
+	if (t == BRIDGE_RTT_QUIC) {
+		nano_set_quic_config(&sock, node, &dialer);
+	}
+#endif
+	// the socket owns connmsg from here on
+	nng_dialer_set_ptr(dialer, NNG_OPT_MQTT_CONNMSG, connmsg);
+	nng_socket_set_ptr(sock, NNG_OPT_MQTT_CONNMSG, connmsg);
+	nng_mqtt_set_connect_cb(sock, hybrid_probe_cb, &probe);
+
+	probe.start = nng_clock();
+	if (nng_dialer_start(dialer, NNG_FLAG_ALLOC) == 0) {
+		nng_time deadline =
+		    probe.start + NANO_BRIDGE_HYBRID_PROBE_TIMEOUT_MS;
+		nng_mtx_lock(probe.mtx);
+		while (!probe.done &&
+		    nng_cv_until(probe.cv, deadline) != NNG_ETIMEDOUT)
+			;
+		ok           = probe.done && probe.reason == 0;
+		probe.closed = true;
+		nng_mtx_unlock(probe.mtx);
+	}
+	nng_close(sock);
+
+done:
+	if (ok) {
+		bridge_rtt_record(
+		    node, t, (nng_duration) (probe.connack - probe.start));
+	} else {
+		bridge_rtt_lost(node, t);
+	}
+	log_debug("bridge probe %s %s %ldms", url, ok ? "ok" : "lost",
+	    ok ? (long) (probe.connack - probe.start) : -1L);
+	nng_cv_free(probe.cv);
+	nng_mtx_free(probe.mtx);
+}
+
+/*
+ * Make-before-break switch to url: the new connection is dialled next to
+ * the current one and only replaces it after its CONNACK, so forwarding
+ * keeps going over the old transport until the new one is usable.
+ */
+static int
+hybrid_handover(bridge_param *bridge_arg, char *url)
+{
+	conf_bridge_node *node    = bridge_arg->config;
+	nng_mqtt_client  *client  = bridge_arg->client;
+	nng_msg          *connmsg = bridge_arg->connmsg;
+	char             *address = node->address;
+	nng_socket       *new;
+	nng_time          deadline;
+	int               rv;
+
+	nng_mtx_lock(bridge_arg->switch_mtx);
+	bridge_arg->handover      = HYBRID_DIALLING;
+	bridge_arg->handover_sock = NULL;
+	nng_mtx_unlock(bridge_arg->switch_mtx);
+
+	node->address = url;
+	rv            = hybrid_client(bridge_arg);
+	deadline      = nng_clock() + NANO_BRIDGE_HYBRID_HANDOVER_MS;
+
+	nng_mtx_lock(bridge_arg->switch_mtx);
+	while (rv == 0 && bridge_arg->handover == HYBRID_DIALLING) {
+		if (nng_cv_until(bridge_arg->switch_cv, deadline) ==
+		    NNG_ETIMEDOUT) {
+			bridge_arg->handover = HYBRID_FAILED;
+		}
+	}
+	if (rv == 0 && bridge_arg->handover != HYBRID_READY) {
+		rv = NNG_ECONNREFUSED;
+	}
+	new = bridge_arg->handover_sock;
+	nng_mtx_unlock(bridge_arg->switch_mtx);
+
+	if (rv == 0) {
+		// events of the old socket while it closes are ignored
+		hybrid_sock_swap(bridge_arg, new);
+		if (client) {
+			nng_aio_finish_error(client->send_aio, NNG_ECLOSED);
+			nng_mqtt_client_free(client, true);
+		}
+	} else {
+		if (bridge_arg->client != client) {
+			nng_aio_finish_error(
+			    bridge_arg->client->send_aio, NNG_ECLOSED);
+			nng_mqtt_client_free(bridge_arg->client, true);
+		}
+		if (new != NULL) {
+			nng_close(*new);
+			nng_free(new, sizeof(nng_socket));
+		}
+		bridge_arg->client  = client;
+		bridge_arg->connmsg = connmsg;
+		node->address       = address;
+	}
+
+	nng_mtx_lock(bridge_arg->switch_mtx);
+	if (rv == 0) {
+		bridge_arg->disconnected = false;
+	}
+	bridge_arg->handover      = HYBRID_IDLE;
+	bridge_arg->handover_sock = NULL;
+	bridge_arg->dial_time     = 0;
+	nng_mtx_unlock(bridge_arg->switch_mtx);
+	return rv;
+}
+
+/*
+ * Probe the current transport and the first server of the other one, and
+ * hand the bridge over when the policy prefers the other. Returns the
+ * index of the server the bridge runs on afterwards.
+ */
+static int
+hybrid_probe_round(bridge_param *bridge_arg, char **addrs, int addrslen, int idx)
+{
+	conf_bridge_node    *node = bridge_arg->config;
+	bridge_rtt_transport cur  = hybrid_transport(addrs[idx]);
+	int                  alt  = -1;
+	int                  rv;
+
+	for (int i = 0; i < addrslen && alt < 0; i++) {
+		if (hybrid_transport(addrs[i]) != cur) {
+			alt = i;
+		}
+	}
+	if (alt < 0) {
+		return idx;
+	}
+	hybrid_probe_url(bridge_arg, addrs[idx]);
+	hybrid_probe_url(bridge_arg, addrs[alt]);
+	if (!bridge_rtt_prefer(node, nng_clock())) {
+		return idx;
+	}
+	log_warn("Bridge hands over from %s to %s", addrs[idx], addrs[alt]);
+	if ((rv = hybrid_handover(bridge_arg, addrs[alt])) != 0) {
+		log_warn("Bridge handover to %s failed %d", addrs[alt], rv);
+		return idx;
+	}
+	bridge_rtt_switched(node, hybrid_transport(addrs[alt]), nng_clock());
+	log_warn("!! Bridge has switched to [%d]%s", alt, node->address);
+	return alt;
+}
+
+// Wait for the bridge connection to drop, probing in the meantime.
+static int
+hybrid_watch(bridge_param *bridge_arg, char **addrs, int addrslen, int idx)
+{
+	nng_time deadline = nng_clock() + NANO_BRIDGE_HYBRID_PROBE_MS;
+
+	nng_mtx_lock(bridge_arg->switch_mtx);
+	while (!bridge_arg->disconnected) {
+		if (nng_cv_until(bridge_arg->switch_cv, deadline) !=
+		    NNG_ETIMEDOUT) {
+			continue;
+		}
+		nng_mtx_unlock(bridge_arg->switch_mtx);
+		idx = hybrid_probe_round(bridge_arg, addrs, addrslen, idx);
+		deadline = nng_clock() + NANO_BRIDGE_HYBRID_PROBE_MS;
+		nng_mtx_lock(bridge_arg->switch_mtx);
+	}
+	bridge_arg->disconnected = false;
+	nng_mtx_unlock(bridge_arg->switch_mtx);
+	bridge_rtt_lost(bridge_arg->config, hybrid_transport(addrs[idx]));
+	return idx;
+}
+
 static int
 gen_fallback_url(char *url, char *new) {
 	int pos_ip = 0;
@@ -741,34 +1163,26 @@ hybrid_cb(void *arg)
 	int    idx = -1;
 	for (;;) {
 		// Get next bridge node
-		nng_socket *tsock = bridge_arg->sock;
 		idx = (idx + 1) % addrslen;
 		node->address = addrs[idx];
 		log_warn("!! Bridge has switched to [%d]%s", idx, node->address);
 
-		if (0 == strncmp(node->address, tcp_scheme, strlen(tcp_scheme)) ||
-		    0 == strncmp(node->address, tls_scheme, strlen(tls_scheme))) {
-			if (0 != hybrid_tcp_client(bridge_arg)) {
-				continue;
-			}
-#if defined(SUPP_QUIC)
-		} else if (0 ==
-		    strncmp(node->address, quic_scheme, strlen(quic_scheme))) {
-			if (0 != hybrid_quic_client(bridge_arg)) {
-				continue;
-			}
-#endif
-		} else {
-			log_error("Unsupported bridge protocol.");
+		if (0 != hybrid_client(bridge_arg)) {
+			bridge_rtt_lost(node, hybrid_transport(node->address));
+			continue;
 		}
+		// the old socket closed with the swap, its events are stale
+		nng_mtx_lock(bridge_arg->switch_mtx);
+		bridge_arg->disconnected = false;
+		nng_mtx_unlock(bridge_arg->switch_mtx);
+		bridge_rtt_switched(node, hybrid_transport(node->address), nng_clock());
+
 		if (bridge_arg->exec_cv) {
 			nng_mtx_lock(bridge_arg->exec_mtx);
 			nng_cv_wake1(bridge_arg->exec_cv);
 			nng_mtx_unlock(bridge_arg->exec_mtx);
 		}
-		nng_mtx_lock(bridge_arg->switch_mtx);
-		nng_cv_wait(bridge_arg->switch_cv);
-		nng_mtx_unlock(bridge_arg->switch_mtx);
+		idx = hybrid_watch(bridge_arg, addrs, addrslen, idx);
 		// Free bridge client
 		if (bridge_arg->client) {
 			nng_aio_finish_error(bridge_arg->client->send_aio, NNG_ECLOSED);
@@ -792,8 +1206,12 @@ hybrid_bridge_client(nng_socket *sock, conf *config, conf_bridge_node *node)
 		log_error("memory error in allocating bridge client");
 		return NNG_ENOMEM;
 	}
-	bridge_arg->exec_mtx = NULL;
-	bridge_arg->exec_cv  = NULL;
+	bridge_arg->exec_mtx      = NULL;
+	bridge_arg->exec_cv       = NULL;
+	bridge_arg->disconnected  = false;
+	bridge_arg->handover      = HYBRID_IDLE;
+	bridge_arg->handover_sock = NULL;
+	bridge_arg->dial_time     = 0;
 
 	bridge_arg->config = node;
 	bridge_arg->sock   = sock;
@@ -852,6 +1270,12 @@ bridge_quic_connect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 	char         *addr;
 	uint16_t      port;
 
+#if defined(SUPP_BRIDGE_CACHE)
+	nng_pipe_get_int(p, NNG_OPT_MQTT_CONNECT_REASON, &reason);
+	if (reason == 0) {
+		bridge_cache_online(param->config, true);
+	}
+#endif
 	if (execone > 0) {
 		return;
 	}
@@ -865,6 +1289,9 @@ bridge_quic_connect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 	// nng_pipe_get_ptr(p, NNG_OPT_MQTT_CONNECT_PROPERTY, &prop);
 	log_info("Bridge client connected! RC [%d]", reason);
 	log_info("Local ip4 address [%s] port [%d]", addr, port);
+	if (reason == 0 && param->config->transparent) {
+		bridge_subtable_resync(param->config);
+	}
 
 	if (reason == 0 && param->config->sub_count > 0) {
 		nng_mqtt_client *client = param->client;
@@ -911,6 +1338,9 @@ bridge_quic_disconnect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 	log_warn("bridge client disconnected! RC [%d] \n", reason);
 
 	bridge_param *bridge_arg = arg;
+#if defined(SUPP_BRIDGE_CACHE)
+	bridge_cache_online(bridge_arg->config, false);
+#endif
 	// Free cparam kept
 	// void *cparam = nng_msg_get_conn_param(bridge_arg->connmsg);
 	// if (cparam != NULL)
@@ -947,6 +1377,10 @@ bridge_quic_reload(nng_socket *sock, conf *config, conf_bridge_node *node, bridg
 	}
 	nng_duration duration = (nng_duration) node->backoff_max * 1000;
 	nng_dialer_set(dialer, NNG_OPT_MQTT_RECONNECT_BACKOFF_MAX, &duration, sizeof(nng_duration));
+	// keep one stream per topic after a reload as well
+	if (node->multi_stream) {
+		nng_socket_set_bool(*sock, NNG_OPT_QUIC_ENABLE_MULTISTREAM, true);
+	}
 
 	bridge_arg->client->sock   = *sock;
 	bridge_arg->cancel_timeout = node->cancel_timeout;
@@ -1046,6 +1480,14 @@ bridge_tcp_connect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 	// property *prop;
 	// nng_pipe_get_ptr(p, NNG_OPT_MQTT_CONNECT_PROPERTY, &prop);
 	log_info("Bridge [%s] connected! RC [%d]", param->config->address, reason);
+	if (reason == 0 && param->config->transparent) {
+		bridge_subtable_resync(param->config);
+	}
+#if defined(SUPP_BRIDGE_CACHE)
+	if (reason == 0) {
+		bridge_cache_online(param->config, true);
+	}
+#endif
 
 	/* MQTT SUBSCRIBE */
 	if (reason == 0 && param->config->sub_count > 0) {
@@ -1094,6 +1536,9 @@ bridge_tcp_disconnect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 	log_warn("bridge client disconnected! RC [%d] \n", reason);
 
 	bridge_param *bridge_arg = arg;
+#if defined(SUPP_BRIDGE_CACHE)
+	bridge_cache_online(bridge_arg->config, false);
+#endif
 	// Free cparam kept
 	// void *cparam = nng_msg_get_conn_param(bridge_arg->connmsg);
 	// if (cparam != NULL)
@@ -1571,6 +2016,11 @@ bridge_reload(nng_socket *sock, conf *config, conf_bridge_node *node)
 	bridge_arg->sock         = new;
 	nng_mtx_unlock(reload_lock);
 
+	// publishers keep using the old forward rules until the swap
+	if (bridge_forward_reload(&config->bridge) != 0) {
+		log_warn("bridge %s keeps its previous forward rules", node->name);
+	}
+
 	return 0;
 }
 
@@ -1578,8 +2028,7 @@ bridge_reload(nng_socket *sock, conf *config, conf_bridge_node *node)
 bool
 bridge_sub_handler(nano_work *work)
 {
-	nng_mqtt_topic_qos *topic_qos;
-	topic_node 		   *tnode;
+	topic_node *tnode;
 
 	if (work->flag  == CMD_SUBSCRIBE) {
 		tnode = work->sub_pkt->node;
@@ -1588,6 +2037,12 @@ bridge_sub_handler(nano_work *work)
 	} else {
 		return false;
 	}
+#if defined(SUPP_CLUSTER)
+	// a peer subscribes at every node itself
+	if (cluster_peer_pipe(work->pid.id)) {
+		return true;
+	}
+#endif
 
 	while (tnode != NULL) {
 		// keep no_local to 1, we dont want looping msg
@@ -1609,10 +2064,21 @@ bridge_sub_handler(nano_work *work)
 		for (size_t t = 0; t < work->config->bridge.count; t++) {
 			conf_bridge_node *node = work->config->bridge.nodes[t];
 			bridge_param *param = node->bridge_arg;
+			int           rv;
 			if (!node->enable || !node->transparent)// check transparent enabler
 				continue;
-			// TODO enhance performance, reuse same Subscribe msg
+			// shared filters go upstream once, batched by the table
 			// TODO carry the property as well
+			if (work->flag == CMD_SUBSCRIBE) {
+				rv = bridge_subtable_add(node, work->pid.id,
+				    tnode->topic.body, tnode->topic.len, tnode->qos,
+				    tnode->rap, tnode->retain_handling);
+			} else {
+				rv = bridge_subtable_remove(node, work->pid.id,
+				    tnode->topic.body, tnode->topic.len);
+			}
+			if (rv != NNG_ENOENT)
+				continue;
 			if (work->flag  == CMD_SUBSCRIBE)
 				nng_mqtt_subscribe_async(param->client, subscriptions, 1, NULL);
 			else if (work->flag  == CMD_UNSUBSCRIBE)
@@ -0,0 +1,866 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/bridge.h"
+#include "include/bridge_cache.h"
+#include "nng/mqtt/mqtt_client.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+#define BRIDGE_CACHE_MAGIC 0x4342514eu
+#define BRIDGE_CACHE_BURST 100 // messages per pacing slot
+#define BRIDGE_CACHE_RETRY_MS 1000
+
+// on-disk record, followed by topic and payload
+typedef struct {
+	uint32_t magic;
+	uint32_t sum; // FNV-1a of everything behind it
+	uint32_t payload_len;
+	uint16_t topic_len;
+	uint8_t  qos;
+	uint8_t  retain;
+} cache_rec;
+
+// replay position, rewritten in place
+typedef struct {
+	uint32_t magic;
+	uint32_t seq;
+	uint64_t off;
+} cache_index;
+
+typedef struct {
+	uint32_t seq;
+	int      fd;
+	uint64_t size;
+	uint64_t count;
+} cache_seg;
+
+typedef struct {
+	conf_bridge_node *node;
+	char             *dir;
+	cache_seg        *segs; // cvector, oldest first, replay reads segs[0]
+	uint32_t          next_seq;
+	uint64_t          read_off;
+	uint64_t          read_count; // records of segs[0] already replayed
+	uint64_t          disk;       // bytes of all segment files
+	uint64_t          budget;
+	uint8_t          *wbuf; // records not written to the last segment yet
+	size_t            wlen;
+	size_t            wcap;
+	uint64_t          wcount;
+	uint8_t          *rbuf;
+	size_t            rcap;
+	char             *topic;
+	nng_msg          *retry; // a replayed msg whose send failed
+	int               index_fd;
+	bool              index_dirty;
+	bool              dirty; // written since the last fdatasync
+	bool              online;
+	bool              replaying; // live forwards wait behind the backlog
+	bool              busy;      // aio is sending or pacing
+	bool              pacing;    // aio is a nng_sleep_aio()
+	bool              closed;
+	nng_time          slot;
+	uint32_t          slot_sent;
+	nng_aio          *aio;
+	nng_mtx          *mtx;
+	uint64_t          stored;
+	uint64_t          replayed;
+	uint64_t          dropped;
+} bridge_cache;
+
+static bridge_cache *caches      = NULL;
+static size_t        cache_count = 0;
+static nng_aio      *sync_aio    = NULL;
+
+static uint32_t
+cache_sum(const uint8_t *rec, size_t total)
+{
+	const size_t skip = offsetof(cache_rec, payload_len);
+	uint32_t     h    = 2166136261u;
+
+	for (size_t i = skip; i < total; i++) {
+		h ^= rec[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static bridge_cache *
+cache_find(conf_bridge_node *node)
+{
+	for (size_t i = 0; i < cache_count; i++) {
+		if (caches[i].node == node) {
+			return &caches[i];
+		}
+	}
+	return NULL;
+}
+
+static int
+cache_reserve(uint8_t **bufp, size_t *capp, size_t need)
+{
+	uint8_t *buf;
+	size_t   cap = *capp == 0 ? 4096 : *capp;
+
+	if (need <= *capp) {
+		return 0;
+	}
+	while (cap < need) {
+		cap *= 2;
+	}
+	if ((buf = nng_alloc(cap)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	if (*bufp != NULL) {
+		memcpy(buf, *bufp, *capp);
+		nng_free(*bufp, *capp);
+	}
+	*bufp = buf;
+	*capp = cap;
+	return 0;
+}
+
+static void
+seg_path(bridge_cache *c, uint32_t seq, char *path, size_t len)
+{
+	snprintf(path, len, "%s/cache-%010u.seg", c->dir, seq);
+}
+
+static int
+seg_open(bridge_cache *c, uint32_t seq, bool create, cache_seg *seg)
+{
+	char        path[PATH_MAX];
+	struct stat st;
+	int         fd;
+
+	seg_path(c, seq, path, sizeof(path));
+	fd = open(path, create ? O_RDWR | O_APPEND | O_CREAT | O_EXCL
+	                       : O_RDWR | O_APPEND, 0644);
+	if (fd < 0) {
+		log_error("open %s failed: %s", path, strerror(errno));
+		return NNG_ESYSERR;
+	}
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NNG_ESYSERR;
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	seg->seq   = seq;
+	seg->fd    = fd;
+	seg->size  = st.st_size;
+	seg->count = 0;
+	return 0;
+}
+
+static void
+seg_close(bridge_cache *c, cache_seg *seg, bool remove)
+{
+	char path[PATH_MAX];
+
+	close(seg->fd);
+	if (remove) {
+		seg_path(c, seg->seq, path, sizeof(path));
+		unlink(path);
+	}
+}
+
+/*
+ * Read and verify the record at off. NNG_ENOENT marks the clean end of
+ * the file, NNG_EINVAL a torn or damaged record.
+ */
+static int
+cache_rec_load(int fd, uint64_t off, uint8_t **bufp, size_t *capp,
+    size_t *totalp)
+{
+	cache_rec h;
+	ssize_t   n;
+	size_t    len;
+
+	if ((n = pread(fd, &h, sizeof(h), off)) == 0) {
+		return NNG_ENOENT;
+	}
+	if (n != sizeof(h) || h.magic != BRIDGE_CACHE_MAGIC) {
+		return NNG_EINVAL;
+	}
+	len = (size_t) h.topic_len + h.payload_len;
+	if (sizeof(h) + len > NANO_BRIDGE_CACHE_SEGMENT ||
+	    cache_reserve(bufp, capp, sizeof(h) + len) != 0) {
+		return NNG_EINVAL;
+	}
+	memcpy(*bufp, &h, sizeof(h));
+	if (pread(fd, *bufp + sizeof(h), len, off + sizeof(h)) != (ssize_t) len ||
+	    cache_sum(*bufp, sizeof(h) + len) != h.sum) {
+		return NNG_EINVAL;
+	}
+	*totalp = sizeof(h) + len;
+	return 0;
+}
+
+static void
+cache_index_update(bridge_cache *c)
+{
+	cache_index idx = { .magic = BRIDGE_CACHE_MAGIC };
+
+	if (cvector_size(c->segs) > 0) {
+		idx.seq = c->segs[0].seq;
+		idx.off = c->read_off;
+	} else {
+		idx.seq = c->next_seq;
+	}
+	if (pwrite(c->index_fd, &idx, sizeof(idx), 0) != sizeof(idx)) {
+		log_warn("bridge cache index of %s not written: %s", c->dir,
+		    strerror(errno));
+	}
+	c->index_dirty = false;
+}
+
+// Move buffered records into the last segment.
+static void
+cache_flush(bridge_cache *c)
+{
+	cache_seg *seg;
+	size_t     done = 0;
+	ssize_t    n;
+
+	if (c->wlen == 0) {
+		return;
+	}
+	seg = &c->segs[cvector_size(c->segs) - 1];
+	while (done < c->wlen) {
+		if ((n = write(seg->fd, c->wbuf + done, c->wlen - done)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		done += n;
+	}
+	if (done < c->wlen) {
+		log_error("bridge cache write to %s failed: %s", c->dir,
+		    strerror(errno));
+		// cut the partial record off, later ones must stay readable
+		if (done > 0 && ftruncate(seg->fd, seg->size) != 0) {
+			log_warn("truncate failed: %s", strerror(errno));
+		}
+		c->dropped += c->wcount;
+		c->wlen   = 0;
+		c->wcount = 0;
+		return;
+	}
+	seg->size += c->wlen;
+	seg->count += c->wcount;
+	c->disk += c->wlen;
+	c->wlen   = 0;
+	c->wcount = 0;
+	c->dirty  = true;
+}
+
+static int
+cache_roll(bridge_cache *c)
+{
+	cache_seg seg;
+	size_t    n = cvector_size(c->segs);
+	int       rv;
+
+	if (n > 0) {
+		cache_flush(c);
+		fdatasync(c->segs[n - 1].fd);
+		c->dirty = false;
+	}
+	if ((rv = seg_open(c, c->next_seq, true, &seg)) != 0) {
+		return rv;
+	}
+	c->next_seq++;
+	cvector_push_back(c->segs, seg);
+	return 0;
+}
+
+// Give up on the oldest segment, replayed or not.
+static void
+cache_evict(bridge_cache *c)
+{
+	cache_seg *seg = &c->segs[0];
+
+	c->dropped += seg->count - c->read_count;
+	c->disk -= seg->size;
+	seg_close(c, seg, true);
+	cvector_erase(c->segs, 0);
+	c->read_off    = 0;
+	c->read_count  = 0;
+	c->index_dirty = true;
+}
+
+static int
+cache_append(bridge_cache *c, nng_msg *msg)
+{
+	cache_rec   h = { .magic = BRIDGE_CACHE_MAGIC };
+	const char *topic;
+	uint8_t    *payload;
+	uint32_t    tlen, plen;
+	size_t      total;
+	size_t      n;
+	uint8_t    *p;
+	int         rv;
+
+	topic   = nng_mqtt_msg_get_publish_topic(msg, &tlen);
+	payload = nng_mqtt_msg_get_publish_payload(msg, &plen);
+	if (topic == NULL || tlen > UINT16_MAX) {
+		return NNG_EINVAL;
+	}
+	total = sizeof(h) + tlen + plen;
+	if (total > NANO_BRIDGE_CACHE_SEGMENT) {
+		return NNG_EMSGSIZE;
+	}
+	while (c->disk + c->wlen + total > c->budget &&
+	    cvector_size(c->segs) > 1) {
+		cache_evict(c);
+	}
+	if (c->disk + c->wlen + total > c->budget) {
+		return NNG_ENOSPC;
+	}
+	n = cvector_size(c->segs);
+	if (n == 0 ||
+	    c->segs[n - 1].size + c->wlen + total > NANO_BRIDGE_CACHE_SEGMENT) {
+		if ((rv = cache_roll(c)) != 0) {
+			return rv;
+		}
+	}
+	if (c->wlen + total > NANO_BRIDGE_CACHE_BATCH) {
+		cache_flush(c);
+	}
+	if ((rv = cache_reserve(&c->wbuf, &c->wcap, c->wlen + total)) != 0) {
+		return rv;
+	}
+	h.topic_len   = (uint16_t) tlen;
+	h.payload_len = plen;
+	h.qos         = nng_mqtt_msg_get_publish_qos(msg);
+	h.retain      = nng_mqtt_msg_get_publish_retain(msg);
+	p             = c->wbuf + c->wlen;
+	memcpy(p, &h, sizeof(h));
+	memcpy(p + sizeof(h), topic, tlen);
+	if (plen > 0) {
+		memcpy(p + sizeof(h) + tlen, payload, plen);
+	}
+	((cache_rec *) p)->sum = cache_sum(p, total);
+	c->wlen += total;
+	c->wcount++;
+	return 0;
+}
+
+/*
+ * Next cached message in order, or NULL once everything, including what
+ * is still buffered, has been replayed. Replayed segments are removed.
+ */
+static nng_msg *
+cache_read(bridge_cache *c)
+{
+	cache_rec *h;
+	nng_msg   *msg;
+	size_t     total;
+	int        rv;
+
+	for (;;) {
+		cache_seg *seg;
+
+		if (cvector_size(c->segs) == 0) {
+			return NULL;
+		}
+		seg = &c->segs[0];
+		if (c->read_off >= seg->size) {
+			if (cvector_size(c->segs) == 1 && c->wlen > 0) {
+				cache_flush(c);
+				continue;
+			}
+			c->disk -= seg->size;
+			seg_close(c, seg, true);
+			cvector_erase(c->segs, 0);
+			c->read_off    = 0;
+			c->read_count  = 0;
+			c->index_dirty = true;
+			continue;
+		}
+		rv = cache_rec_load(
+		    seg->fd, c->read_off, &c->rbuf, &c->rcap, &total);
+		if (rv != 0) {
+			log_warn("bridge cache %s: damaged record in segment %u, "
+			         "skipping the rest of it",
+			    c->dir, seg->seq);
+			c->dropped += seg->count > c->read_count
+			    ? seg->count - c->read_count
+			    : 0;
+			c->read_count = seg->count;
+			c->read_off   = seg->size;
+			continue;
+		}
+		break;
+	}
+	h = (cache_rec *) c->rbuf;
+	if (c->topic == NULL && (c->topic = nng_alloc(UINT16_MAX + 1)) == NULL) {
+		return NULL;
+	}
+	memcpy(c->topic, c->rbuf + sizeof(*h), h->topic_len);
+	c->topic[h->topic_len] = '\0';
+	msg = bridge_publish_msg(c->topic,
+	    c->rbuf + sizeof(*h) + h->topic_len, h->payload_len, false, h->qos,
+	    h->retain, NULL);
+	c->node->proto_ver == MQTT_PROTOCOL_VERSION_v5
+	    ? nng_mqttv5_msg_encode(msg)
+	    : nng_mqtt_msg_encode(msg);
+
+	c->read_off += total;
+	c->read_count++;
+	c->index_dirty = true;
+	return msg;
+}
+
+/*
+ * Pick the next message for the replay aio, or arm a pacing sleep. Called
+ * with c->mtx held while the aio is idle.
+ */
+static nng_msg *
+cache_next(bridge_cache *c)
+{
+	nng_duration period = BRIDGE_CACHE_BURST * 1000 /
+	    NANO_BRIDGE_CACHE_REPLAY_RATE;
+	nng_time     now;
+	nng_msg     *msg;
+
+	if (c->busy || c->closed || !c->online) {
+		return NULL;
+	}
+	if ((msg = c->retry) != NULL) {
+		c->retry = NULL;
+	} else if ((msg = cache_read(c)) == NULL) {
+		c->replaying = false;
+		return NULL;
+	}
+	c->busy = true;
+	if (c->slot_sent >= BRIDGE_CACHE_BURST) {
+		now = nng_clock();
+		if (now - c->slot < (nng_time) period) {
+			c->retry  = msg;
+			c->pacing = true;
+			nng_sleep_aio(period - (nng_duration) (now - c->slot), c->aio);
+			return NULL;
+		}
+		c->slot      = now;
+		c->slot_sent = 0;
+	}
+	c->slot_sent++;
+	return msg;
+}
+
+static void
+cache_send(bridge_cache *c, nng_msg *msg)
+{
+	nng_aio_set_timeout(c->aio, c->node->cancel_timeout);
+	nng_aio_set_msg(c->aio, msg);
+	nng_send_aio(*c->node->sock, c->aio);
+}
+
+static void
+cache_cb(void *arg)
+{
+	bridge_cache *c = arg;
+	nng_msg      *msg;
+
+	nng_mtx_lock(c->mtx);
+	c->busy = false;
+	if (c->pacing) {
+		c->pacing = false;
+	} else if (nng_aio_result(c->aio) != 0) {
+		if ((msg = nng_aio_get_msg(c->aio)) != NULL) {
+			nng_aio_set_msg(c->aio, NULL);
+			c->retry = msg;
+		}
+		if (!c->closed && c->online) {
+			c->busy   = true;
+			c->pacing = true;
+			nng_sleep_aio(BRIDGE_CACHE_RETRY_MS, c->aio);
+		}
+		nng_mtx_unlock(c->mtx);
+		return;
+	} else {
+		c->replayed++;
+	}
+	msg = cache_next(c);
+	nng_mtx_unlock(c->mtx);
+
+	if (msg != NULL) {
+		cache_send(c, msg);
+	}
+}
+
+// Flush and sync every node; the fdatasync runs outside the lock.
+static void
+cache_sync_cb(void *arg)
+{
+	(void) arg;
+
+	if (nng_aio_result(sync_aio) != 0) {
+		return;
+	}
+	for (size_t i = 0; i < cache_count; i++) {
+		bridge_cache *c   = &caches[i];
+		int           seg = -1;
+		int           idx = -1;
+
+		nng_mtx_lock(c->mtx);
+		if (!c->closed) {
+			cache_flush(c);
+			if (c->dirty && cvector_size(c->segs) > 0) {
+				seg = dup(c->segs[cvector_size(c->segs) - 1].fd);
+			}
+			c->dirty = false;
+			if (c->index_dirty) {
+				cache_index_update(c);
+				idx = dup(c->index_fd);
+			}
+		}
+		nng_mtx_unlock(c->mtx);
+		if (seg >= 0) {
+			fdatasync(seg);
+			close(seg);
+		}
+		if (idx >= 0) {
+			fdatasync(idx);
+			close(idx);
+		}
+	}
+	nng_sleep_aio(NANO_BRIDGE_CACHE_SYNC_MS, sync_aio);
+}
+
+static int
+seq_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+// Pick up segments left by a previous run, starting at the index position.
+static int
+cache_scan(bridge_cache *c)
+{
+	DIR           *d;
+	struct dirent *ent;
+	uint32_t      *seqs = NULL;
+	cache_index    idx  = { 0 };
+	int            rv   = 0;
+
+	if (pread(c->index_fd, &idx, sizeof(idx), 0) != sizeof(idx) ||
+	    idx.magic != BRIDGE_CACHE_MAGIC) {
+		memset(&idx, 0, sizeof(idx));
+	}
+	if ((d = opendir(c->dir)) == NULL) {
+		log_error("open %s failed: %s", c->dir, strerror(errno));
+		return NNG_ESYSERR;
+	}
+	while ((ent = readdir(d)) != NULL) {
+		uint32_t seq;
+		int      end = 0;
+		if (sscanf(ent->d_name, "cache-%10u.seg%n", &seq, &end) == 1 &&
+		    end > 0 && ent->d_name[end] == '\0') {
+			cvector_push_back(seqs, seq);
+		}
+	}
+	closedir(d);
+	c->next_seq = idx.seq;
+	if (seqs == NULL) {
+		return 0;
+	}
+	qsort(seqs, cvector_size(seqs), sizeof(uint32_t), seq_cmp);
+
+	for (size_t i = 0; i < cvector_size(seqs); i++) {
+		cache_seg seg;
+		uint64_t  off = 0;
+		size_t    total;
+
+		if (seqs[i] < idx.seq) {
+			char path[PATH_MAX];
+			seg_path(c, seqs[i], path, sizeof(path));
+			unlink(path);
+			continue;
+		}
+		if ((rv = seg_open(c, seqs[i], false, &seg)) != 0) {
+			break;
+		}
+		while (cache_rec_load(seg.fd, off, &c->rbuf, &c->rcap, &total) ==
+		    0) {
+			if (seg.seq == idx.seq && off < idx.off) {
+				c->read_count++;
+			}
+			off += total;
+			seg.count++;
+		}
+		if (off < seg.size) {
+			log_warn("bridge cache %s: segment %u cut at %llu bytes",
+			    c->dir, seg.seq, (unsigned long long) off);
+			if (ftruncate(seg.fd, off) != 0) {
+				log_warn("truncate failed: %s", strerror(errno));
+			}
+			seg.size = off;
+		}
+		if (cvector_size(c->segs) == 0 && seg.seq == idx.seq) {
+			c->read_off = idx.off <= off ? idx.off : 0;
+			if (c->read_off == 0) {
+				c->read_count = 0;
+			}
+		}
+		c->disk += seg.size;
+		cvector_push_back(c->segs, seg);
+		c->next_seq = seqs[i] + 1;
+	}
+	cvector_free(seqs);
+	return rv;
+}
+
+static int
+cache_open(bridge_cache *c, const char *root, conf_bridge_node *node,
+    size_t n, uint64_t budget)
+{
+	char   path[PATH_MAX];
+	char   name[64];
+	size_t len = 0;
+	int    rv;
+
+	// node names end up in a path, keep them tame
+	if (node->name != NULL) {
+		for (const char *s = node->name; *s && len < sizeof(name) - 1;
+		     s++) {
+			name[len++] = isalnum((unsigned char) *s) || *s == '-'
+			    ? *s
+			    : '_';
+		}
+	}
+	name[len] = '\0';
+	if (len == 0) {
+		snprintf(name, sizeof(name), "node%lu", (unsigned long) n);
+	}
+	snprintf(path, sizeof(path), "%s/%s", root, name);
+	if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+		log_error("create %s failed: %s", path, strerror(errno));
+		return NNG_ESYSERR;
+	}
+	c->node      = node;
+	c->budget    = budget;
+	c->replaying = true;
+	c->index_fd  = -1;
+	if ((c->dir = nng_strdup(path)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	snprintf(path, sizeof(path), "%s/index", c->dir);
+	if ((c->index_fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+		log_error("open %s failed: %s", path, strerror(errno));
+		return NNG_ESYSERR;
+	}
+	if ((rv = nng_mtx_alloc(&c->mtx)) != 0 ||
+	    (rv = nng_aio_alloc(&c->aio, cache_cb, c)) != 0 ||
+	    (rv = cache_reserve(&c->wbuf, &c->wcap, NANO_BRIDGE_CACHE_BATCH)) !=
+	        0) {
+		return rv;
+	}
+	return cache_scan(c);
+}
+
+int
+bridge_cache_init(conf_bridge *bridge, const char *dir, uint64_t bytes)
+{
+	size_t count = 0;
+	int    rv;
+
+	if (caches != NULL) {
+		return 0;
+	}
+	for (size_t i = 0; i < bridge->count; i++) {
+		if (bridge->nodes[i]->enable) {
+			count++;
+		}
+	}
+	if (count == 0) {
+		return 0;
+	}
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		log_error("create %s failed: %s", dir, strerror(errno));
+		return NNG_ESYSERR;
+	}
+	if ((caches = nng_zalloc(sizeof(bridge_cache) * count)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	for (size_t i = 0; i < bridge->count; i++) {
+		conf_bridge_node *node = bridge->nodes[i];
+		if (!node->enable) {
+			continue;
+		}
+		rv = cache_open(&caches[cache_count++], dir, node, i,
+		    bytes / count);
+		if (rv != 0) {
+			bridge_cache_fini();
+			return rv;
+		}
+		log_info("bridge cache %s opened, %llu bytes pending",
+		    caches[cache_count - 1].dir,
+		    (unsigned long long) (caches[cache_count - 1].disk -
+		        caches[cache_count - 1].read_off));
+	}
+	if ((rv = nng_aio_alloc(&sync_aio, cache_sync_cb, NULL)) != 0) {
+		bridge_cache_fini();
+		return rv;
+	}
+	nng_sleep_aio(NANO_BRIDGE_CACHE_SYNC_MS, sync_aio);
+	return 0;
+}
+
+void
+bridge_cache_fini(void)
+{
+	if (sync_aio != NULL) {
+		nng_aio_stop(sync_aio);
+		nng_aio_free(sync_aio);
+		sync_aio = NULL;
+	}
+	for (size_t i = 0; i < cache_count; i++) {
+		bridge_cache *c = &caches[i];
+
+		if (c->mtx != NULL) {
+			nng_mtx_lock(c->mtx);
+			c->closed = true;
+			nng_mtx_unlock(c->mtx);
+		}
+		if (c->aio != NULL) {
+			nng_aio_stop(c->aio);
+			nng_aio_free(c->aio);
+		}
+		// the cursor is past a msg whose send did not finish, keep
+		// it, if out of order
+		if (c->retry != NULL && c->index_fd >= 0 &&
+		    cache_append(c, c->retry) != 0) {
+			c->dropped++;
+		}
+		if (cvector_size(c->segs) > 0) {
+			cache_flush(c);
+			fdatasync(c->segs[cvector_size(c->segs) - 1].fd);
+		}
+		if (c->index_fd >= 0) {
+			cache_index_update(c);
+			fdatasync(c->index_fd);
+			close(c->index_fd);
+		}
+		for (size_t s = 0; s < cvector_size(c->segs); s++) {
+			seg_close(c, &c->segs[s], false);
+		}
+		cvector_free(c->segs);
+		if (c->retry != NULL) {
+			nng_msg_free(c->retry);
+		}
+		nng_free(c->wbuf, c->wcap);
+		nng_free(c->rbuf, c->rcap);
+		if (c->topic != NULL) {
+			nng_free(c->topic, UINT16_MAX + 1);
+		}
+		nng_strfree(c->dir);
+		if (c->mtx != NULL) {
+			nng_mtx_free(c->mtx);
+		}
+	}
+	nng_free(caches, sizeof(bridge_cache) * cache_count);
+	caches      = NULL;
+	cache_count = 0;
+}
+
+int
+bridge_cache_offer(conf_bridge_node *node, nng_msg *msg)
+{
+	bridge_cache *c = cache_find(node);
+	int           rv;
+
+	if (c == NULL) {
+		return NNG_ENOENT;
+	}
+	nng_mtx_lock(c->mtx);
+	if (c->closed || (c->online && !c->replaying)) {
+		nng_mtx_unlock(c->mtx);
+		return NNG_ENOENT;
+	}
+	if ((rv = cache_append(c, msg)) == 0) {
+		c->stored++;
+	} else {
+		c->dropped++;
+	}
+	nng_mtx_unlock(c->mtx);
+	nng_msg_free(msg);
+	return rv == 0 ? 0 : NNG_EAGAIN;
+}
+
+void
+bridge_cache_online(conf_bridge_node *node, bool online)
+{
+	bridge_cache *c = cache_find(node);
+	nng_msg      *msg = NULL;
+
+	if (c == NULL) {
+		return;
+	}
+	nng_mtx_lock(c->mtx);
+	c->online = online;
+	if (!online) {
+		c->replaying = true;
+	} else {
+		c->slot      = nng_clock();
+		c->slot_sent = 0;
+		msg          = cache_next(c);
+	}
+	nng_mtx_unlock(c->mtx);
+
+	if (msg != NULL) {
+		log_info("bridge %s back online, replaying cached msgs",
+		    node->name);
+		cache_send(c, msg);
+	}
+}
+
+bool
+bridge_cache_enabled(conf_bridge_node *node)
+{
+	return cache_find(node) != NULL;
+}
+
+int
+bridge_cache_stat(conf_bridge_node *node, bridge_cache_stats *stats)
+{
+	bridge_cache *c = cache_find(node);
+
+	if (c == NULL) {
+		return NNG_ENOENT;
+	}
+	nng_mtx_lock(c->mtx);
+	stats->bytes    = c->disk + c->wlen - c->read_off;
+	stats->stored   = c->stored;
+	stats->replayed = c->replayed;
+	stats->dropped  = c->dropped;
+	stats->segments = (uint32_t) cvector_size(c->segs);
+	stats->online   = c->online;
+	nng_mtx_unlock(c->mtx);
+	return 0;
+}
@@ -0,0 +1,213 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/bridge_dedupe.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+// bits set per id, in each generation it is added to
+#define DEDUPE_PROBES 4
+
+static struct {
+	nng_mtx     *mtx;
+	uint64_t    *gens[2]; // gens[cur] takes new ids, both are checked
+	size_t       words;
+	uint64_t     mask; // of a bit index
+	int          cur;
+	nng_time     rotated;
+	nng_duration window;
+	char         origin[16];
+	uint64_t     seq;
+	uint64_t     checked;
+	uint64_t     dropped;
+	uint64_t     stamped;
+	bool         enabled;
+} dedupe_;
+
+static uint64_t
+dedupe_hash(const uint8_t *id, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= id[i];
+		h *= 1099511628211ULL;
+	}
+	// fmix64, FNV alone leaves the low bits of near ids too alike
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static void
+dedupe_rotate(void)
+{
+	nng_time now = nng_clock();
+
+	if (now - dedupe_.rotated < (nng_time) dedupe_.window) {
+		return;
+	}
+	// two windows without a stamp forget everything at once
+	if (now - dedupe_.rotated >= 2 * (nng_time) dedupe_.window) {
+		memset(dedupe_.gens[dedupe_.cur], 0,
+		    dedupe_.words * sizeof(uint64_t));
+	}
+	dedupe_.cur ^= 1;
+	memset(dedupe_.gens[dedupe_.cur], 0, dedupe_.words * sizeof(uint64_t));
+	dedupe_.rotated = now;
+}
+
+// whether the id of h was in either generation, adding it to the current
+static bool
+dedupe_test_set(uint64_t h)
+{
+	uint64_t  h1  = h;
+	uint64_t  h2  = (h >> 32) | 1;
+	uint64_t *cur = dedupe_.gens[dedupe_.cur];
+	uint64_t *old = dedupe_.gens[dedupe_.cur ^ 1];
+	bool      in_cur = true;
+	bool      in_old = true;
+
+	for (int i = 0; i < DEDUPE_PROBES; i++) {
+		uint64_t b   = (h1 + i * h2) & dedupe_.mask;
+		uint64_t bit = (uint64_t) 1 << (b & 63);
+
+		in_cur &= (cur[b >> 6] & bit) != 0;
+		in_old &= (old[b >> 6] & bit) != 0;
+		cur[b >> 6] |= bit;
+	}
+	return in_cur || in_old;
+}
+
+int
+bridge_dedupe_init(size_t bits, nng_duration window)
+{
+	static const char hex[] = "0123456789abcdef";
+	int               rv;
+
+	if (dedupe_.enabled) {
+		return 0;
+	}
+	if (bits < 64 || (bits & (bits - 1)) != 0 || window <= 0) {
+		return NNG_EINVAL;
+	}
+	dedupe_.words = bits / 64;
+	dedupe_.mask  = bits - 1;
+	if ((rv = nng_mtx_alloc(&dedupe_.mtx)) != 0) {
+		return rv;
+	}
+	if ((dedupe_.gens[0] = nng_zalloc(dedupe_.words * sizeof(uint64_t))) ==
+	        NULL ||
+	    (dedupe_.gens[1] = nng_zalloc(dedupe_.words * sizeof(uint64_t))) ==
+	        NULL) {
+		dedupe_.enabled = true;
+		bridge_dedupe_fini();
+		return NNG_ENOMEM;
+	}
+	// random, nodes have no other name shared by all their bridges
+	for (size_t i = 0; i < sizeof(dedupe_.origin); i += 8) {
+		uint32_t r = nng_random();
+		for (size_t j = 0; j < 8; j++) {
+			dedupe_.origin[i + j] = hex[(r >> (j * 4)) & 0xf];
+		}
+	}
+	dedupe_.window  = window;
+	dedupe_.rotated = nng_clock();
+	dedupe_.enabled = true;
+	return 0;
+}
+
+void
+bridge_dedupe_fini(void)
+{
+	if (!dedupe_.enabled) {
+		return;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (dedupe_.gens[i] != NULL) {
+			nng_free(dedupe_.gens[i], dedupe_.words * sizeof(uint64_t));
+		}
+	}
+	if (dedupe_.mtx != NULL) {
+		nng_mtx_free(dedupe_.mtx);
+	}
+	memset(&dedupe_, 0, sizeof(dedupe_));
+}
+
+bool
+bridge_dedupe_enabled(void)
+{
+	return dedupe_.enabled;
+}
+
+bool
+bridge_dedupe_seen(const uint8_t *id, size_t len)
+{
+	uint64_t h = dedupe_hash(id, len);
+	bool     seen;
+
+	if (!dedupe_.enabled) {
+		return false;
+	}
+	nng_mtx_lock(dedupe_.mtx);
+	dedupe_rotate();
+	seen = dedupe_test_set(h);
+	dedupe_.checked++;
+	if (seen) {
+		dedupe_.dropped++;
+	}
+	nng_mtx_unlock(dedupe_.mtx);
+	if (seen) {
+		log_debug("bridged message %.*s seen before, dropped", (int) len,
+		    (const char *) id);
+	}
+	return seen;
+}
+
+void
+bridge_dedupe_stamp(char *id)
+{
+	static const char hex[] = "0123456789abcdef";
+	uint64_t          seq;
+
+	memcpy(id, dedupe_.origin, sizeof(dedupe_.origin));
+	if (!dedupe_.enabled) {
+		memset(id + 16, '0', 16);
+		return;
+	}
+	nng_mtx_lock(dedupe_.mtx);
+	seq = dedupe_.seq++;
+	dedupe_.stamped++;
+	for (int i = 0; i < 16; i++) {
+		id[31 - i] = hex[(seq >> (i * 4)) & 0xf];
+	}
+	dedupe_rotate();
+	// it coming back is a loop as well
+	dedupe_test_set(dedupe_hash((const uint8_t *) id, BRIDGE_DEDUPE_ID_LEN));
+	nng_mtx_unlock(dedupe_.mtx);
+}
+
+void
+bridge_dedupe_stat(bridge_dedupe_stats *stats)
+{
+	if (!dedupe_.enabled) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+	nng_mtx_lock(dedupe_.mtx);
+	stats->checked = dedupe_.checked;
+	stats->dropped = dedupe_.dropped;
+	stats->stamped = dedupe_.stamped;
+	nng_mtx_unlock(dedupe_.mtx);
+}
@@ -0,0 +1,467 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/bridge_forward.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef struct {
+	conf_bridge_node *node;
+	size_t            start; // first rule of node in subs
+	size_t            count;
+	topic_filter_set *remote; // remote topics, by index in the range
+} fwd_sub_range;
+
+typedef struct {
+	bridge_forward   *fwds; // sorted by node, then by rule
+	size_t            count;
+	topic_filter_set *local; // local topics, by index in fwds
+	bridge_sub       *subs;  // sorted like fwds
+	size_t          sub_count;
+	fwd_sub_range  *ranges; // one per node
+	size_t          node_count;
+} fwd_snapshot;
+
+// per worker, reused across publishes
+typedef struct {
+	uint32_t        *ids;  // cvector
+	bridge_forward **fwds; // cvector
+} fwd_scratch;
+
+/*
+ * Snapshots live in a ring of two indexed by generation. A worker announces
+ * the generation it reads in its slot (gen + 1, 0 when idle); before a slot
+ * of the ring is reused the writer waits until nobody announces it anymore.
+ */
+typedef struct {
+	fwd_snapshot   *snaps[2];
+	nng_atomic_u64 *gen;
+	nng_atomic_u64 **active;
+	fwd_scratch    *scratch;
+	size_t          workers;
+	nng_mtx        *lock; // serializes writers
+	bool            enabled;
+} fwd_state;
+
+static fwd_state fwd = { .enabled = false };
+
+static void
+fwd_rewrite_fini(bridge_rewrite *rw)
+{
+	nng_strfree(rw->base);
+	nng_strfree(rw->prefix);
+	nng_strfree(rw->suffix);
+	nng_strfree(rw->topic);
+}
+
+static void
+fwd_snapshot_free(fwd_snapshot *snap)
+{
+	if (snap == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < snap->count; i++) {
+		fwd_rewrite_fini(&snap->fwds[i].rewrite);
+	}
+	for (size_t i = 0; i < snap->sub_count; i++) {
+		nng_strfree(snap->subs[i].remote_topic);
+		fwd_rewrite_fini(&snap->subs[i].rewrite);
+	}
+	for (size_t i = 0; i < snap->node_count; i++) {
+		topic_filter_set_free(snap->ranges[i].remote);
+	}
+	nng_free(snap->fwds, sizeof(bridge_forward) * snap->count);
+	nng_free(snap->subs, sizeof(bridge_sub) * snap->sub_count);
+	nng_free(snap->ranges, sizeof(fwd_sub_range) * snap->node_count);
+	topic_filter_set_free(snap->local);
+	nng_free(snap, sizeof(fwd_snapshot));
+}
+
+static char *
+fwd_strndup(const char *str, size_t len)
+{
+	char *dup;
+
+	if (str == NULL || (dup = nng_alloc(len + 1)) == NULL) {
+		return NULL;
+	}
+	memcpy(dup, str, len);
+	dup[len] = '\0';
+	return dup;
+}
+
+static size_t
+fwd_compose(char *dst, const bridge_rewrite *rw, const char *base,
+    uint32_t base_len)
+{
+	size_t pos = 0;
+
+	if (rw->prefix != NULL) {
+		memcpy(dst, rw->prefix, rw->prefix_len);
+		pos += rw->prefix_len;
+	}
+	memcpy(dst + pos, base, base_len);
+	pos += base_len;
+	if (rw->suffix != NULL) {
+		memcpy(dst + pos, rw->suffix, rw->suffix_len);
+		pos += rw->suffix_len;
+	}
+	dst[pos] = '\0';
+	return pos;
+}
+
+static int
+fwd_rewrite_build(bridge_rewrite *rw, const char *base, uint32_t base_len,
+    const char *prefix, uint32_t prefix_len, const char *suffix,
+    uint32_t suffix_len)
+{
+	if (base_len > 0) {
+		if ((rw->base = fwd_strndup(base, base_len)) == NULL) {
+			return NNG_ENOMEM;
+		}
+		rw->base_len = base_len;
+	}
+	if (prefix != NULL) {
+		if ((rw->prefix = fwd_strndup(prefix, prefix_len)) == NULL) {
+			return NNG_ENOMEM;
+		}
+		rw->prefix_len = prefix_len;
+	}
+	if (suffix != NULL) {
+		if ((rw->suffix = fwd_strndup(suffix, suffix_len)) == NULL) {
+			return NNG_ENOMEM;
+		}
+		rw->suffix_len = suffix_len;
+	}
+	// the message topic is not needed, settle the rewrite now
+	if (rw->base != NULL) {
+		size_t len = rw->prefix_len + rw->base_len + rw->suffix_len;
+		if ((rw->topic = nng_alloc(len + 1)) == NULL) {
+			return NNG_ENOMEM;
+		}
+		rw->topic_len = fwd_compose(rw->topic, rw, rw->base, rw->base_len);
+	}
+	return 0;
+}
+
+static int
+fwd_snapshot_build(conf_bridge *bridge, fwd_snapshot **snapp)
+{
+	fwd_snapshot *snap;
+	size_t        total = 0;
+	size_t        subs  = 0;
+	int           rv    = 0;
+
+	if ((snap = nng_zalloc(sizeof(fwd_snapshot))) == NULL) {
+		return NNG_ENOMEM;
+	}
+	if ((rv = topic_filter_set_alloc(&snap->local)) != 0) {
+		nng_free(snap, sizeof(fwd_snapshot));
+		return rv;
+	}
+	for (size_t t = 0; t < bridge->count; t++) {
+		total += bridge->nodes[t]->forwards_count;
+		subs += bridge->nodes[t]->sub_count;
+	}
+	if ((total > 0 &&
+	        (snap->fwds = nng_zalloc(sizeof(bridge_forward) * total)) ==
+	            NULL) ||
+	    (subs > 0 &&
+	        (snap->subs = nng_zalloc(sizeof(bridge_sub) * subs)) == NULL) ||
+	    (bridge->count > 0 &&
+	        (snap->ranges = nng_zalloc(
+	             sizeof(fwd_sub_range) * bridge->count)) == NULL)) {
+		nng_free(snap->fwds, sizeof(bridge_forward) * total);
+		nng_free(snap->subs, sizeof(bridge_sub) * subs);
+		topic_filter_set_free(snap->local);
+		nng_free(snap, sizeof(fwd_snapshot));
+		return NNG_ENOMEM;
+	}
+	snap->node_count = bridge->count;
+
+	for (size_t t = 0; t < bridge->count && rv == 0; t++) {
+		conf_bridge_node *node = bridge->nodes[t];
+		for (size_t i = 0; i < node->forwards_count && rv == 0; i++) {
+			topics         *rule = node->forwards_list[i];
+			bridge_forward *f    = &snap->fwds[snap->count++];
+
+			f->node   = node;
+			f->qos    = rule->qos;
+			f->retain = rule->retain;
+			if ((rv = fwd_rewrite_build(&f->rewrite, rule->remote_topic,
+			         rule->remote_topic_len, rule->prefix,
+			         rule->prefix_len, rule->suffix,
+			         rule->suffix_len)) == 0) {
+				rv = topic_filter_set_add(snap->local,
+				    rule->local_topic, (uint32_t) (snap->count - 1));
+			}
+		}
+
+		snap->ranges[t].node  = node;
+		snap->ranges[t].start = snap->sub_count;
+		if (rv == 0) {
+			rv = topic_filter_set_alloc(&snap->ranges[t].remote);
+		}
+		for (size_t i = 0; i < node->sub_count && rv == 0; i++) {
+			topics     *rule = node->sub_list[i];
+			bridge_sub *sub  = &snap->subs[snap->sub_count++];
+
+			sub->node   = node;
+			sub->retain = rule->retain;
+			if (rule->remote_topic != NULL &&
+			    (sub->remote_topic = fwd_strndup(rule->remote_topic,
+			         rule->remote_topic_len)) == NULL) {
+				rv = NNG_ENOMEM;
+				break;
+			}
+			if (sub->remote_topic != NULL &&
+			    (rv = topic_filter_set_add(snap->ranges[t].remote,
+			         sub->remote_topic, (uint32_t) i)) != 0) {
+				break;
+			}
+			rv = fwd_rewrite_build(&sub->rewrite, rule->local_topic,
+			    rule->local_topic_len, rule->prefix, rule->prefix_len,
+			    rule->suffix, rule->suffix_len);
+		}
+		snap->ranges[t].count = snap->sub_count - snap->ranges[t].start;
+	}
+	if (rv != 0) {
+		fwd_snapshot_free(snap);
+		return rv;
+	}
+	*snapp = snap;
+	return 0;
+}
+
+int
+bridge_forward_init(conf_bridge *bridge, size_t workers)
+{
+	int rv;
+
+	if (fwd.enabled) {
+		return bridge_forward_reload(bridge);
+	}
+	if (workers == 0) {
+		return NNG_EINVAL;
+	}
+	if ((rv = nng_mtx_alloc(&fwd.lock)) != 0) {
+		return rv;
+	}
+	fwd.active  = nng_zalloc(sizeof(nng_atomic_u64 *) * workers);
+	fwd.scratch = nng_zalloc(sizeof(fwd_scratch) * workers);
+	if (fwd.active == NULL || fwd.scratch == NULL) {
+		nng_free(fwd.active, sizeof(nng_atomic_u64 *) * workers);
+		nng_free(fwd.scratch, sizeof(fwd_scratch) * workers);
+		nng_mtx_free(fwd.lock);
+		return NNG_ENOMEM;
+	}
+	if ((rv = fwd_snapshot_build(bridge, &fwd.snaps[0])) != 0) {
+		nng_free(fwd.active, sizeof(nng_atomic_u64 *) * workers);
+		nng_free(fwd.scratch, sizeof(fwd_scratch) * workers);
+		nng_mtx_free(fwd.lock);
+		return rv;
+	}
+	for (size_t i = 0; i < workers; i++) {
+		nng_atomic_alloc64(&fwd.active[i]);
+	}
+	nng_atomic_alloc64(&fwd.gen);
+	fwd.workers = workers;
+	fwd.enabled = true;
+	return 0;
+}
+
+void
+bridge_forward_fini(void)
+{
+	if (!fwd.enabled) {
+		return;
+	}
+	fwd.enabled = false;
+	for (size_t i = 0; i < fwd.workers; i++) {
+		nng_atomic_free64(fwd.active[i]);
+		cvector_free(fwd.scratch[i].ids);
+		cvector_free(fwd.scratch[i].fwds);
+	}
+	nng_free(fwd.active, sizeof(nng_atomic_u64 *) * fwd.workers);
+	nng_free(fwd.scratch, sizeof(fwd_scratch) * fwd.workers);
+	fwd_snapshot_free(fwd.snaps[0]);
+	fwd_snapshot_free(fwd.snaps[1]);
+	fwd.snaps[0] = fwd.snaps[1] = NULL;
+	nng_atomic_free64(fwd.gen);
+	nng_mtx_free(fwd.lock);
+	fwd.workers = 0;
+}
+
+int
+bridge_forward_reload(conf_bridge *bridge)
+{
+	fwd_snapshot *snap;
+	uint64_t      gen;
+	int           rv;
+
+	if (!fwd.enabled) {
+		return NNG_ECLOSED;
+	}
+	if ((rv = fwd_snapshot_build(bridge, &snap)) != 0) {
+		log_error("bridge forward reload failed: %d", rv);
+		return rv;
+	}
+
+	nng_mtx_lock(fwd.lock);
+	gen = nng_atomic_get64(fwd.gen);
+	// the slot to reuse holds gen - 1, wait for its last readers
+	for (size_t i = 0; i < fwd.workers; i++) {
+		while (gen > 0 && nng_atomic_get64(fwd.active[i]) == gen) {
+			nng_msleep(1);
+		}
+	}
+	fwd_snapshot_free(fwd.snaps[(gen + 1) & 1]);
+	fwd.snaps[(gen + 1) & 1] = snap;
+	nng_atomic_set64(fwd.gen, gen + 1);
+	nng_mtx_unlock(fwd.lock);
+	return 0;
+}
+
+// announce the generation, then make sure it is still the current one
+static fwd_snapshot *
+fwd_enter(size_t worker)
+{
+	uint64_t gen;
+
+	do {
+		gen = nng_atomic_get64(fwd.gen);
+		nng_atomic_set64(fwd.active[worker], gen + 1);
+	} while (nng_atomic_get64(fwd.gen) != gen);
+	return fwd.snaps[gen & 1];
+}
+
+size_t
+bridge_forward_begin(size_t worker, const char *topic, const topic_levels *tl,
+    bridge_forward ***fwdsp)
+{
+	static bridge_forward *none[1];
+	fwd_snapshot          *snap;
+	fwd_scratch           *sc;
+	size_t                 n;
+
+	*fwdsp = none;
+	if (!fwd.enabled || worker >= fwd.workers) {
+		return 0;
+	}
+	snap = fwd_enter(worker);
+	sc   = &fwd.scratch[worker];
+	cvector_clear(sc->ids);
+	cvector_clear(sc->fwds);
+	if ((n = topic_filter_set_match(snap->local, topic, tl, &sc->ids)) ==
+	    0) {
+		return 0;
+	}
+	for (size_t i = 0; i < n; i++) {
+		cvector_push_back(sc->fwds, &snap->fwds[sc->ids[i]]);
+	}
+	*fwdsp = sc->fwds;
+	return n;
+}
+
+void
+bridge_forward_end(size_t worker)
+{
+	if (fwd.enabled && worker < fwd.workers) {
+		nng_atomic_set64(fwd.active[worker], 0);
+	}
+}
+
+int
+bridge_forward_subs(size_t worker, conf_bridge_node *node, bridge_sub **subsp,
+    size_t *countp)
+{
+	fwd_snapshot *snap;
+
+	*countp = 0;
+	if (!fwd.enabled || worker >= fwd.workers) {
+		return NNG_ENOENT;
+	}
+	snap = fwd_enter(worker);
+	for (size_t i = 0; i < snap->node_count; i++) {
+		if (snap->ranges[i].node == node) {
+			*subsp  = &snap->subs[snap->ranges[i].start];
+			*countp = snap->ranges[i].count;
+			return 0;
+		}
+	}
+	return NNG_ENOENT;
+}
+
+int
+bridge_forward_sub_match(size_t worker, conf_bridge_node *node,
+    const char *topic, const topic_levels *tl, bridge_sub **subp)
+{
+	fwd_snapshot *snap;
+	uint32_t      i;
+
+	*subp = NULL;
+	if (!fwd.enabled || worker >= fwd.workers) {
+		return NNG_ENOENT;
+	}
+	snap = fwd_enter(worker);
+	for (size_t k = 0; k < snap->node_count; k++) {
+		fwd_sub_range *r = &snap->ranges[k];
+		if (r->node != node) {
+			continue;
+		}
+		if (topic_filter_set_first(r->remote, topic, tl, &i)) {
+			*subp = &snap->subs[r->start + i];
+		}
+		return 0;
+	}
+	return NNG_ENOENT;
+}
+
+const char *
+bridge_rewrite_topic(const bridge_rewrite *rw, const char *topic,
+    uint32_t len, char **bufp, size_t *capp, uint32_t *lenp)
+{
+	const char *base     = topic;
+	uint32_t    base_len = len;
+	size_t      need;
+
+	if (rw->topic != NULL) {
+		*lenp = rw->topic_len;
+		return rw->topic;
+	}
+	if (rw->base_len > 0) {
+		base     = rw->base;
+		base_len = rw->base_len;
+	}
+	if (rw->prefix == NULL && rw->suffix == NULL) {
+		*lenp = base_len;
+		return base;
+	}
+
+	need = rw->prefix_len + base_len + rw->suffix_len + 1;
+	if (*capp < need) {
+		size_t cap = *capp > 0 ? *capp : 64;
+		char  *buf;
+		while (cap < need) {
+			cap *= 2;
+		}
+		if ((buf = nng_alloc(cap)) == NULL) {
+			return NULL;
+		}
+		nng_free(*bufp, *capp);
+		*bufp = buf;
+		*capp = cap;
+	}
+	*lenp = (uint32_t) fwd_compose(*bufp, rw, base, base_len);
+	return *bufp;
+}
@@ -0,0 +1,347 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/bridge_queue.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+// urgent messages drain before bulk ones and are evicted after them
+enum { BRIDGE_LANE_URGENT, BRIDGE_LANE_BULK, BRIDGE_LANES };
+
+typedef struct {
+	nng_msg **ring;
+	size_t    head;
+	size_t    tail;
+} bridge_lane;
+
+typedef struct {
+	conf_bridge_node   *node;
+	bridge_lane         lanes[BRIDGE_LANES];
+	size_t              mask;
+	size_t              bytes;
+	size_t              max_bytes;
+	size_t              batch; // bytes sent by the current drain run
+	nng_aio            *aio;
+	nng_mtx            *mtx;
+	nng_cv             *cv; // publishers blocked on a full queue
+	bridge_queue_policy policy;
+	bool                busy;  // aio is sending or yielding
+	bool                yield; // aio is a nng_sleep_aio()
+	bool                closed;
+	uint64_t            queued;
+	uint64_t            sent;
+	uint64_t            dropped;
+} bridge_queue;
+
+static bridge_queue *queues      = NULL;
+static size_t        queue_count = 0;
+
+static inline size_t
+bridge_msg_size(nng_msg *msg)
+{
+	return nng_msg_header_len(msg) + nng_msg_len(msg);
+}
+
+static inline size_t
+bridge_lane_depth(bridge_lane *lane)
+{
+	return lane->tail - lane->head;
+}
+
+static inline size_t
+bridge_queue_depth(bridge_queue *q)
+{
+	return bridge_lane_depth(&q->lanes[BRIDGE_LANE_URGENT]) +
+	    bridge_lane_depth(&q->lanes[BRIDGE_LANE_BULK]);
+}
+
+static nng_msg *
+bridge_lane_pop(bridge_queue *q, bridge_lane *lane)
+{
+	nng_msg *msg = lane->ring[lane->head & q->mask];
+
+	lane->ring[lane->head & q->mask] = NULL;
+	lane->head++;
+	q->bytes -= bridge_msg_size(msg);
+	return msg;
+}
+
+// next message to send, urgent lane first
+static nng_msg *
+bridge_queue_pop(bridge_queue *q)
+{
+	bridge_lane *lane = &q->lanes[BRIDGE_LANE_URGENT];
+
+	if (bridge_lane_depth(lane) == 0) {
+		lane = &q->lanes[BRIDGE_LANE_BULK];
+	}
+	return bridge_lane_pop(q, lane);
+}
+
+// oldest message to give up on, bulk lane first
+static nng_msg *
+bridge_queue_evict(bridge_queue *q)
+{
+	bridge_lane *lane = &q->lanes[BRIDGE_LANE_BULK];
+
+	if (bridge_lane_depth(lane) == 0) {
+		lane = &q->lanes[BRIDGE_LANE_URGENT];
+	}
+	return bridge_lane_pop(q, lane);
+}
+
+static bridge_queue *
+bridge_queue_find(conf_bridge_node *node)
+{
+	for (size_t i = 0; i < queue_count; i++) {
+		if (queues[i].node == node) {
+			return &queues[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Pick the next message for the drain aio, or arm a yield once the batch
+ * budget is spent. Called with q->mtx held while the aio is idle.
+ */
+static nng_msg *
+bridge_queue_next(bridge_queue *q)
+{
+	nng_msg *msg;
+
+	if (q->closed || bridge_queue_depth(q) == 0) {
+		q->busy  = false;
+		q->batch = 0;
+		return NULL;
+	}
+	q->busy = true;
+	if (q->batch >= NANO_BRIDGE_QUEUE_BATCH_BYTES) {
+		q->batch = 0;
+		q->yield = true;
+		nng_sleep_aio(0, q->aio);
+		return NULL;
+	}
+	msg = bridge_queue_pop(q);
+	q->batch += bridge_msg_size(msg);
+	nng_cv_wake(q->cv);
+	return msg;
+}
+
+static void
+bridge_queue_kick(bridge_queue *q, nng_msg *msg)
+{
+	nng_aio_set_timeout(q->aio, q->node->cancel_timeout);
+	nng_aio_set_msg(q->aio, msg);
+	nng_send_aio(*q->node->sock, q->aio);
+}
+
+static void
+bridge_queue_cb(void *arg)
+{
+	bridge_queue *q = arg;
+	nng_msg      *msg;
+
+	nng_mtx_lock(q->mtx);
+	if (q->yield) {
+		q->yield = false;
+	} else if (nng_aio_result(q->aio) != 0) {
+		if ((msg = nng_aio_get_msg(q->aio)) != NULL) {
+			nng_aio_set_msg(q->aio, NULL);
+			nng_msg_free(msg);
+		}
+		q->dropped++;
+		log_info("bridging to %s failed, msg lost!", q->node->address);
+	} else {
+		q->sent++;
+	}
+	msg = bridge_queue_next(q);
+	nng_mtx_unlock(q->mtx);
+
+	if (msg != NULL) {
+		bridge_queue_kick(q, msg);
+	}
+}
+
+int
+bridge_queue_init(conf_bridge *bridge, size_t len, size_t bytes,
+    bridge_queue_policy policy)
+{
+	int rv = 0;
+
+	if (queues != NULL) {
+		return 0;
+	}
+	if (len == 0 || (len & (len - 1)) != 0) {
+		log_error("bridge queue length %lu is not a power of two", len);
+		return NNG_EINVAL;
+	}
+	if (bridge->count == 0) {
+		return 0;
+	}
+	if ((queues = nng_zalloc(sizeof(bridge_queue) * bridge->count)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	for (size_t i = 0; i < bridge->count; i++) {
+		bridge_queue *q = &queues[i];
+
+		q->node      = bridge->nodes[i];
+		q->mask      = len - 1;
+		q->max_bytes = bytes;
+		q->policy    = policy;
+		if ((q->lanes[BRIDGE_LANE_URGENT].ring =
+		            nng_zalloc(sizeof(nng_msg *) * len)) == NULL ||
+		    (q->lanes[BRIDGE_LANE_BULK].ring =
+		            nng_zalloc(sizeof(nng_msg *) * len)) == NULL) {
+			rv = NNG_ENOMEM;
+		} else if ((rv = nng_mtx_alloc(&q->mtx)) == 0 &&
+		    (rv = nng_cv_alloc(&q->cv, q->mtx)) == 0) {
+			rv = nng_aio_alloc(&q->aio, bridge_queue_cb, q);
+		}
+		queue_count++;
+		if (rv != 0) {
+			bridge_queue_fini();
+			return rv;
+		}
+	}
+	return 0;
+}
+
+void
+bridge_queue_fini(void)
+{
+	for (size_t i = 0; i < queue_count; i++) {
+		bridge_queue *q = &queues[i];
+
+		if (q->mtx != NULL) {
+			nng_mtx_lock(q->mtx);
+			q->closed = true;
+			nng_cv_wake(q->cv);
+			nng_mtx_unlock(q->mtx);
+		}
+		if (q->aio != NULL) {
+			// a cancelled send is released by bridge_queue_cb()
+			nng_aio_stop(q->aio);
+			nng_aio_free(q->aio);
+		}
+		for (int l = 0; l < BRIDGE_LANES; l++) {
+			bridge_lane *lane = &q->lanes[l];
+			while (lane->ring != NULL && bridge_lane_depth(lane) > 0) {
+				nng_msg_free(bridge_lane_pop(q, lane));
+			}
+			nng_free(lane->ring, sizeof(nng_msg *) * (q->mask + 1));
+		}
+		if (q->cv != NULL) {
+			nng_cv_free(q->cv);
+		}
+		if (q->mtx != NULL) {
+			nng_mtx_free(q->mtx);
+		}
+	}
+	nng_free(queues, sizeof(bridge_queue) * queue_count);
+	queues      = NULL;
+	queue_count = 0;
+}
+
+int
+bridge_queue_send(
+    conf_bridge_node *node, nng_aio *aio, nng_msg *msg, bool urgent)
+{
+	bridge_queue *q = bridge_queue_find(node);
+	bridge_lane  *lane;
+	size_t        size;
+	nng_time      deadline = 0;
+	int           rv       = 0;
+
+	if (q == NULL) {
+		// no queue for this node, keep the old fire-or-drop behaviour
+		if (nng_aio_busy(aio)) {
+			nng_msg_free(msg);
+			return NNG_EAGAIN;
+		}
+		nng_aio_set_timeout(aio, node->cancel_timeout);
+		nng_aio_set_msg(aio, msg);
+		nng_send_aio(*node->sock, aio);
+		return 0;
+	}
+
+	size = bridge_msg_size(msg);
+	lane = &q->lanes[urgent ? BRIDGE_LANE_URGENT : BRIDGE_LANE_BULK];
+	nng_mtx_lock(q->mtx);
+	if (!q->busy && bridge_queue_depth(q) == 0 && !nng_aio_busy(aio)) {
+		q->sent++;
+		nng_mtx_unlock(q->mtx);
+		nng_aio_set_timeout(aio, node->cancel_timeout);
+		nng_aio_set_msg(aio, msg);
+		nng_send_aio(*node->sock, aio);
+		return 0;
+	}
+
+	while (!q->closed &&
+	    (bridge_lane_depth(lane) > q->mask ||
+	        (bridge_queue_depth(q) > 0 && q->bytes + size > q->max_bytes))) {
+		if (q->policy == BRIDGE_QUEUE_DROP_OLD) {
+			nng_msg_free(bridge_lane_depth(lane) > q->mask
+			        ? bridge_lane_pop(q, lane)
+			        : bridge_queue_evict(q));
+			q->dropped++;
+			rv = NNG_EAGAIN;
+			continue;
+		}
+		if (q->policy == BRIDGE_QUEUE_BLOCK) {
+			if (deadline == 0) {
+				deadline = nng_clock() + NANO_BRIDGE_QUEUE_BLOCK_MS;
+			}
+			if (nng_cv_until(q->cv, deadline) != NNG_ETIMEDOUT) {
+				continue;
+			}
+		}
+		q->dropped++;
+		nng_mtx_unlock(q->mtx);
+		nng_msg_free(msg);
+		return NNG_EAGAIN;
+	}
+	if (q->closed) {
+		nng_mtx_unlock(q->mtx);
+		nng_msg_free(msg);
+		return NNG_ECLOSED;
+	}
+
+	lane->ring[lane->tail & q->mask] = msg;
+	lane->tail++;
+	q->bytes += size;
+	q->queued++;
+	msg = q->busy ? NULL : bridge_queue_next(q);
+	nng_mtx_unlock(q->mtx);
+
+	if (msg != NULL) {
+		bridge_queue_kick(q, msg);
+	}
+	return rv;
+}
+
+int
+bridge_queue_stat(conf_bridge_node *node, bridge_queue_stats *stats)
+{
+	bridge_queue *q = bridge_queue_find(node);
+
+	if (q == NULL) {
+		return NNG_ENOENT;
+	}
+	nng_mtx_lock(q->mtx);
+	stats->depth   = bridge_queue_depth(q);
+	stats->bytes   = q->bytes;
+	stats->queued  = q->queued;
+	stats->sent    = q->sent;
+	stats->dropped = q->dropped;
+	nng_mtx_unlock(q->mtx);
+	return 0;
+}
@@ -0,0 +1,221 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/bridge_rtt.h"
+#include "nng/supplemental/util/platform.h"
+
+const uint32_t bridge_rtt_bounds[BRIDGE_RTT_BUCKETS - 1] = { 1, 2, 5, 10,
+	20, 50, 100, 200, 500, 1000, 2000 };
+
+typedef struct {
+	conf_bridge_node    *node;
+	nng_mtx             *mtx;
+	bridge_rtt_stats     stats[BRIDGE_RTT_TRANSPORTS];
+	bridge_rtt_transport active;
+	nng_time             switched;
+} bridge_rtt;
+
+static bridge_rtt *rtts      = NULL;
+static size_t      rtt_count = 0;
+
+static bridge_rtt *
+bridge_rtt_find(conf_bridge_node *node)
+{
+	for (size_t i = 0; i < rtt_count; i++) {
+		if (rtts[i].node == node) {
+			return &rtts[i];
+		}
+	}
+	return NULL;
+}
+
+// the same 1/8 gain TCP uses for its smoothed round trip
+static inline uint32_t
+bridge_rtt_ewma(uint32_t avg, uint32_t sample)
+{
+	return (uint32_t) (((uint64_t) avg * 7 + sample) / 8);
+}
+
+int
+bridge_rtt_init(conf_bridge *bridge)
+{
+	size_t count = 0;
+	int    rv;
+
+	if (rtts != NULL) {
+		return 0;
+	}
+	for (size_t i = 0; i < bridge->count; i++) {
+		if (bridge->nodes[i]->enable && bridge->nodes[i]->hybrid) {
+			count++;
+		}
+	}
+	if (count == 0) {
+		return 0;
+	}
+	if ((rtts = nng_zalloc(sizeof(bridge_rtt) * count)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	for (size_t i = 0; i < bridge->count; i++) {
+		conf_bridge_node *node = bridge->nodes[i];
+		if (!node->enable || !node->hybrid) {
+			continue;
+		}
+		rtts[rtt_count].node = node;
+		if ((rv = nng_mtx_alloc(&rtts[rtt_count].mtx)) != 0) {
+			bridge_rtt_fini();
+			return rv;
+		}
+		rtt_count++;
+	}
+	return 0;
+}
+
+void
+bridge_rtt_fini(void)
+{
+	for (size_t i = 0; i < rtt_count; i++) {
+		nng_mtx_free(rtts[i].mtx);
+	}
+	nng_free(rtts, sizeof(bridge_rtt) * rtt_count);
+	rtts      = NULL;
+	rtt_count = 0;
+}
+
+void
+bridge_rtt_record(
+    conf_bridge_node *node, bridge_rtt_transport t, nng_duration rtt)
+{
+	bridge_rtt       *r = bridge_rtt_find(node);
+	bridge_rtt_stats *st;
+	size_t            b = 0;
+
+	if (r == NULL) {
+		return;
+	}
+	if (rtt < 0) {
+		rtt = 0;
+	}
+	while (b < BRIDGE_RTT_BUCKETS - 1 &&
+	    (uint32_t) rtt > bridge_rtt_bounds[b]) {
+		b++;
+	}
+	nng_mtx_lock(r->mtx);
+	st       = &r->stats[t];
+	st->srtt = st->samples == 0 ? rtt : bridge_rtt_ewma(st->srtt, rtt);
+	st->loss = bridge_rtt_ewma(st->loss, 0);
+	st->samples++;
+	st->buckets[b]++;
+	nng_mtx_unlock(r->mtx);
+}
+
+void
+bridge_rtt_lost(conf_bridge_node *node, bridge_rtt_transport t)
+{
+	bridge_rtt *r = bridge_rtt_find(node);
+
+	if (r == NULL) {
+		return;
+	}
+	nng_mtx_lock(r->mtx);
+	r->stats[t].loss = bridge_rtt_ewma(r->stats[t].loss, 1000);
+	r->stats[t].lost++;
+	nng_mtx_unlock(r->mtx);
+}
+
+void
+bridge_rtt_switched(
+    conf_bridge_node *node, bridge_rtt_transport t, nng_time now)
+{
+	bridge_rtt *r = bridge_rtt_find(node);
+
+	if (r == NULL) {
+		return;
+	}
+	nng_mtx_lock(r->mtx);
+	r->active   = t;
+	r->switched = now;
+	nng_mtx_unlock(r->mtx);
+}
+
+bool
+bridge_rtt_should_switch(
+    const bridge_rtt_stats *cur, const bridge_rtt_stats *alt)
+{
+	if (alt->samples < NANO_BRIDGE_HYBRID_MIN_SAMPLES) {
+		return false;
+	}
+	if (cur->loss >= alt->loss + NANO_BRIDGE_HYBRID_LOSS_PERMILLE) {
+		return true;
+	}
+	if (alt->loss > cur->loss ||
+	    cur->samples < NANO_BRIDGE_HYBRID_MIN_SAMPLES) {
+		return false;
+	}
+	return (uint64_t) alt->srtt * 100 <
+	    (uint64_t) cur->srtt * NANO_BRIDGE_HYBRID_SWITCH_PCT;
+}
+
+bool
+bridge_rtt_prefer(conf_bridge_node *node, nng_time now)
+{
+	bridge_rtt *r = bridge_rtt_find(node);
+	bool        rv;
+
+	if (r == NULL) {
+		return false;
+	}
+	nng_mtx_lock(r->mtx);
+	if (now - r->switched < NANO_BRIDGE_HYBRID_HOLD_MS) {
+		rv = false;
+	} else {
+		rv = bridge_rtt_should_switch(&r->stats[r->active],
+		    &r->stats[r->active == BRIDGE_RTT_TCP ? BRIDGE_RTT_QUIC
+		                                          : BRIDGE_RTT_TCP]);
+	}
+	nng_mtx_unlock(r->mtx);
+	return rv;
+}
+
+int
+bridge_rtt_stat(
+    conf_bridge_node *node, bridge_rtt_transport t, bridge_rtt_stats *stats)
+{
+	bridge_rtt *r = bridge_rtt_find(node);
+
+	if (r == NULL) {
+		return NNG_ENOENT;
+	}
+	nng_mtx_lock(r->mtx);
+	memcpy(stats, &r->stats[t], sizeof(*stats));
+	nng_mtx_unlock(r->mtx);
+	return 0;
+}
+
+int
+bridge_rtt_active(conf_bridge_node *node, bridge_rtt_transport *t)
+{
+	bridge_rtt *r = bridge_rtt_find(node);
+
+	if (r == NULL) {
+		return NNG_ENOENT;
+	}
+	nng_mtx_lock(r->mtx);
+	*t = r->active;
+	nng_mtx_unlock(r->mtx);
+	return 0;
+}
+
+const char *
+bridge_rtt_name(bridge_rtt_transport t)
+{
+	return t == BRIDGE_RTT_QUIC ? "quic" : "tcp";
+}
@@ -0,0 +1,502 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/bridge.h"
+#include "include/bridge_subtable.h"
+#include "nng/mqtt/mqtt_client.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef struct subt_entry  subt_entry;
+typedef struct subt_client subt_client;
+
+typedef struct {
+	conf_bridge_node *node;
+	subt_entry      **buckets;
+	subt_entry      **pending; // cvector, filters waiting for the timer
+} subt_node;
+
+struct subt_entry {
+	subt_entry *next; // bucket chain
+	subt_node  *owner;
+	char       *topic;
+	uint32_t    len;
+	uint32_t    hash;
+	uint32_t    refs;
+	uint8_t     qos;
+	uint8_t     rap;
+	uint8_t     rh;
+	bool        remote; // subscribed upstream, or will be by the next flush
+	bool        dirty;  // qos went up, subscribe again
+	bool        queued;
+};
+
+struct subt_client {
+	subt_client *next;
+	uint32_t     pid;
+	subt_entry **entries; // cvector
+};
+
+typedef struct {
+	subt_node    *nodes;
+	size_t        count;
+	subt_client **clients;
+	size_t        mask;
+	nng_mtx      *lock;
+	nng_aio      *aio;
+	bool          armed;
+	bool          enabled;
+} subt_state;
+
+static subt_state subt = { .enabled = false };
+
+static uint32_t
+subt_hash(const char *str, uint32_t len)
+{
+	uint32_t h = 5381;
+
+	for (uint32_t i = 0; i < len; i++) {
+		h = (h << 5) + h + (uint8_t) str[i];
+	}
+	return h;
+}
+
+static subt_node *
+subt_node_find(conf_bridge_node *node)
+{
+	for (size_t i = 0; i < subt.count; i++) {
+		if (subt.nodes[i].node == node) {
+			return &subt.nodes[i];
+		}
+	}
+	return NULL;
+}
+
+static subt_entry *
+subt_entry_find(subt_node *n, const char *topic, uint32_t len, uint32_t hash)
+{
+	subt_entry *e = n->buckets[hash & subt.mask];
+
+	while (e != NULL &&
+	    (e->hash != hash || e->len != len ||
+	        memcmp(e->topic, topic, len) != 0)) {
+		e = e->next;
+	}
+	return e;
+}
+
+static void
+subt_entry_free(subt_entry *e)
+{
+	subt_entry **pp = &e->owner->buckets[e->hash & subt.mask];
+
+	while (*pp != e) {
+		pp = &(*pp)->next;
+	}
+	*pp = e->next;
+	nng_free(e->topic, e->len + 1);
+	nng_free(e, sizeof(subt_entry));
+}
+
+static subt_client *
+subt_client_find(uint32_t pid, subt_client ***ppp)
+{
+	subt_client **pp = &subt.clients[pid & subt.mask];
+
+	while (*pp != NULL && (*pp)->pid != pid) {
+		pp = &(*pp)->next;
+	}
+	if (ppp != NULL) {
+		*ppp = pp;
+	}
+	return *pp;
+}
+
+static void
+subt_arm(void)
+{
+	if (!subt.armed) {
+		subt.armed = true;
+		nng_sleep_aio(NANO_BRIDGE_SUB_BATCH_MS, subt.aio);
+	}
+}
+
+static void
+subt_queue(subt_entry *e)
+{
+	if (!e->queued) {
+		e->queued = true;
+		cvector_push_back(e->owner->pending, e);
+	}
+	subt_arm();
+}
+
+// Called with the lock held when pid lets go of e.
+static void
+subt_unref(subt_entry *e)
+{
+	if (--e->refs == 0) {
+		subt_queue(e);
+	}
+}
+
+static void
+subt_resubscribe(subt_node *n, nng_mqtt_topic_qos *subs, size_t count)
+{
+	nng_mtx_lock(subt.lock);
+	for (size_t i = 0; i < count; i++) {
+		const char *topic = (const char *) subs[i].topic.buf;
+		uint32_t    len   = subs[i].topic.length;
+		subt_entry *e =
+		    subt_entry_find(n, topic, len, subt_hash(topic, len));
+		if (e != NULL && e->remote) {
+			e->remote = false;
+			subt_queue(e);
+		}
+	}
+	nng_mtx_unlock(subt.lock);
+}
+
+/*
+ * Turn the pending filters of n into at most one SUBSCRIBE and one
+ * UNSUBSCRIBE. Returns true when the batch limit left some for another
+ * packet; filters queued again meanwhile wait for the next timer.
+ */
+static bool
+subt_flush_node(subt_node *n)
+{
+	nng_mqtt_topic_qos *subs   = NULL;
+	nng_mqtt_topic     *unsubs = NULL;
+	size_t              nsub   = 0;
+	size_t              nunsub = 0;
+	size_t              used   = 0;
+	bool                more;
+	bridge_param       *param  = n->node->bridge_arg;
+	int                 rv;
+
+	nng_mtx_lock(subt.lock);
+	if (cvector_size(n->pending) == 0) {
+		nng_mtx_unlock(subt.lock);
+		return false;
+	}
+	subs   = nng_mqtt_topic_qos_array_create(NANO_BRIDGE_SUB_BATCH_MAX);
+	unsubs = nng_mqtt_topic_array_create(NANO_BRIDGE_SUB_BATCH_MAX);
+	for (; used < cvector_size(n->pending); used++) {
+		subt_entry *e = n->pending[used];
+		if (nsub == NANO_BRIDGE_SUB_BATCH_MAX ||
+		    nunsub == NANO_BRIDGE_SUB_BATCH_MAX) {
+			break;
+		}
+		e->queued = false;
+		if (e->refs > 0) {
+			if (!e->remote || e->dirty) {
+				nng_mqtt_topic_qos_array_set(subs, nsub++,
+				    e->topic, e->qos, 1, e->rap, e->rh);
+			}
+			e->remote = true;
+			e->dirty  = false;
+			continue;
+		}
+		if (e->remote) {
+			nng_mqtt_topic_array_set(unsubs, nunsub++, e->topic);
+		}
+		subt_entry_free(e);
+	}
+	// keep what did not fit, in order
+	memmove(n->pending, n->pending + used,
+	    sizeof(subt_entry *) * (cvector_size(n->pending) - used));
+	cvector_set_size(n->pending, cvector_size(n->pending) - used);
+	more = cvector_size(n->pending) > 0;
+	nng_mtx_unlock(subt.lock);
+
+	// no_local stays on, we dont want the messages looping back
+	if (nsub > 0) {
+		log_debug("bridge %s subscribe %lu topics", n->node->name, nsub);
+		nng_aio_set_timeout(
+		    param->client->send_aio, n->node->cancel_timeout);
+		if ((rv = nng_mqtt_subscribe_async(
+		         param->client, subs, nsub, NULL)) != 0) {
+			log_warn("bridge %s subscribe failed: %d, retry",
+			    n->node->name, rv);
+			subt_resubscribe(n, subs, nsub);
+		}
+	}
+	if (nunsub > 0) {
+		log_debug(
+		    "bridge %s unsubscribe %lu topics", n->node->name, nunsub);
+		if ((rv = nng_mqtt_unsubscribe_async(
+		         param->client, unsubs, nunsub, NULL)) != 0) {
+			log_warn("bridge %s unsubscribe failed: %d",
+			    n->node->name, rv);
+		}
+	}
+	nng_mqtt_topic_qos_array_free(subs, NANO_BRIDGE_SUB_BATCH_MAX);
+	nng_mqtt_topic_array_free(unsubs, NANO_BRIDGE_SUB_BATCH_MAX);
+	return more;
+}
+
+static void
+subt_flush_cb(void *arg)
+{
+	(void) arg;
+	if (nng_aio_result(subt.aio) != 0) {
+		return;
+	}
+	nng_mtx_lock(subt.lock);
+	subt.armed = false;
+	nng_mtx_unlock(subt.lock);
+
+	for (size_t i = 0; i < subt.count; i++) {
+		while (subt_flush_node(&subt.nodes[i])) {
+			;
+		}
+	}
+}
+
+int
+bridge_subtable_init(conf_bridge *bridge, size_t buckets)
+{
+	size_t count = 0;
+	int    rv;
+
+	if (subt.enabled) {
+		return 0;
+	}
+	if (buckets == 0 || (buckets & (buckets - 1)) != 0) {
+		log_error("bridge sub buckets %lu is not a power of two", buckets);
+		return NNG_EINVAL;
+	}
+	for (size_t i = 0; i < bridge->count; i++) {
+		if (bridge->nodes[i]->enable && bridge->nodes[i]->transparent) {
+			count++;
+		}
+	}
+	if (count == 0) {
+		return 0;
+	}
+	subt.mask = buckets - 1;
+	if ((subt.nodes = nng_zalloc(sizeof(subt_node) * count)) ==
+	        NULL ||
+	    (subt.clients = nng_zalloc(sizeof(subt_client *) * buckets)) ==
+	        NULL) {
+		rv = NNG_ENOMEM;
+		goto fail;
+	}
+	for (size_t i = 0; i < bridge->count; i++) {
+		conf_bridge_node *node = bridge->nodes[i];
+		if (!node->enable || !node->transparent) {
+			continue;
+		}
+		subt.nodes[subt.count].node = node;
+		if ((subt.nodes[subt.count++].buckets =
+		            nng_zalloc(sizeof(subt_entry *) * buckets)) == NULL) {
+			rv = NNG_ENOMEM;
+			goto fail;
+		}
+	}
+	if ((rv = nng_mtx_alloc(&subt.lock)) != 0 ||
+	    (rv = nng_aio_alloc(&subt.aio, subt_flush_cb, NULL)) != 0) {
+		goto fail;
+	}
+	subt.enabled = true;
+	return 0;
+
+fail:
+	subt.enabled = true;
+	bridge_subtable_fini();
+	return rv;
+}
+
+void
+bridge_subtable_fini(void)
+{
+	if (!subt.enabled) {
+		return;
+	}
+	if (subt.aio != NULL) {
+		nng_aio_stop(subt.aio);
+		nng_aio_free(subt.aio);
+	}
+	for (size_t i = 0; subt.clients != NULL && i <= subt.mask; i++) {
+		while (subt.clients[i] != NULL) {
+			subt_client *c   = subt.clients[i];
+			subt.clients[i] = c->next;
+			cvector_free(c->entries);
+			nng_free(c, sizeof(subt_client));
+		}
+	}
+	for (size_t i = 0; i < subt.count; i++) {
+		subt_node *n = &subt.nodes[i];
+		for (size_t b = 0; n->buckets != NULL && b <= subt.mask; b++) {
+			while (n->buckets[b] != NULL) {
+				subt_entry_free(n->buckets[b]);
+			}
+		}
+		nng_free(n->buckets, sizeof(subt_entry *) * (subt.mask + 1));
+		cvector_free(n->pending);
+	}
+	nng_free(subt.nodes, sizeof(subt_node) * subt.count);
+	nng_free(subt.clients, sizeof(subt_client *) * (subt.mask + 1));
+	if (subt.lock != NULL) {
+		nng_mtx_free(subt.lock);
+	}
+	memset(&subt, 0, sizeof(subt));
+}
+
+int
+bridge_subtable_add(conf_bridge_node *node, uint32_t pid, const char *topic,
+    uint32_t len, uint8_t qos, uint8_t rap, uint8_t rh)
+{
+	subt_node   *n;
+	subt_entry  *e;
+	subt_client *c;
+	uint32_t     hash = subt_hash(topic, len);
+
+	if (!subt.enabled) {
+		return NNG_ENOENT;
+	}
+	nng_mtx_lock(subt.lock);
+	if ((n = subt_node_find(node)) == NULL) {
+		nng_mtx_unlock(subt.lock);
+		return NNG_ENOENT;
+	}
+	if ((e = subt_entry_find(n, topic, len, hash)) == NULL) {
+		if ((e = nng_zalloc(sizeof(subt_entry))) == NULL ||
+		    (e->topic = nng_alloc(len + 1)) == NULL) {
+			nng_free(e, sizeof(subt_entry));
+			nng_mtx_unlock(subt.lock);
+			return NNG_ENOMEM;
+		}
+		memcpy(e->topic, topic, len);
+		e->topic[len] = '\0';
+		e->len        = len;
+		e->hash       = hash;
+		e->owner      = n;
+		e->qos        = qos;
+		e->rap        = rap;
+		e->rh         = rh;
+		e->next       = n->buckets[hash & subt.mask];
+		n->buckets[hash & subt.mask] = e;
+	}
+	if ((c = subt_client_find(pid, NULL)) == NULL) {
+		if ((c = nng_zalloc(sizeof(subt_client))) == NULL) {
+			if (e->refs == 0 && !e->queued) {
+				subt_entry_free(e);
+			}
+			nng_mtx_unlock(subt.lock);
+			return NNG_ENOMEM;
+		}
+		c->pid                        = pid;
+		c->next                       = subt.clients[pid & subt.mask];
+		subt.clients[pid & subt.mask] = c;
+	}
+
+	size_t i = 0;
+	while (i < cvector_size(c->entries) && c->entries[i] != e) {
+		i++;
+	}
+	if (i == cvector_size(c->entries)) {
+		cvector_push_back(c->entries, e);
+		e->refs++;
+	}
+	if (qos > e->qos) {
+		e->qos   = qos;
+		e->dirty = e->remote;
+	}
+	if (!e->remote || e->dirty) {
+		subt_queue(e);
+	}
+	nng_mtx_unlock(subt.lock);
+	return 0;
+}
+
+int
+bridge_subtable_remove(
+    conf_bridge_node *node, uint32_t pid, const char *topic, uint32_t len)
+{
+	subt_node   *n;
+	subt_entry  *e;
+	subt_client *c;
+	subt_client **pp;
+
+	if (!subt.enabled) {
+		return NNG_ENOENT;
+	}
+	nng_mtx_lock(subt.lock);
+	if ((n = subt_node_find(node)) == NULL) {
+		nng_mtx_unlock(subt.lock);
+		return NNG_ENOENT;
+	}
+	e = subt_entry_find(n, topic, len, subt_hash(topic, len));
+	c = subt_client_find(pid, &pp);
+	for (size_t i = 0; e != NULL && c != NULL &&
+	     i < cvector_size(c->entries); i++) {
+		if (c->entries[i] != e) {
+			continue;
+		}
+		cvector_erase(c->entries, i);
+		if (cvector_size(c->entries) == 0) {
+			*pp = c->next;
+			cvector_free(c->entries);
+			nng_free(c, sizeof(subt_client));
+		}
+		subt_unref(e);
+		break;
+	}
+	nng_mtx_unlock(subt.lock);
+	return 0;
+}
+
+void
+bridge_subtable_release(uint32_t pid)
+{
+	subt_client  *c;
+	subt_client **pp;
+
+	if (!subt.enabled) {
+		return;
+	}
+	nng_mtx_lock(subt.lock);
+	if ((c = subt_client_find(pid, &pp)) != NULL) {
+		*pp = c->next;
+		for (size_t i = 0; i < cvector_size(c->entries); i++) {
+			subt_unref(c->entries[i]);
+		}
+		cvector_free(c->entries);
+		nng_free(c, sizeof(subt_client));
+	}
+	nng_mtx_unlock(subt.lock);
+}
+
+void
+bridge_subtable_resync(conf_bridge_node *node)
+{
+	subt_node *n;
+
+	if (!subt.enabled) {
+		return;
+	}
+	nng_mtx_lock(subt.lock);
+	if ((n = subt_node_find(node)) != NULL) {
+		for (size_t b = 0; b <= subt.mask; b++) {
+			for (subt_entry *e = n->buckets[b]; e != NULL;
+			     e = e->next) {
+				if (e->refs > 0) {
+					e->remote = false;
+					e->dirty  = false;
+					subt_queue(e);
+				}
+			}
+		}
+	}
+	nng_mtx_unlock(subt.lock);
+}
@@ -0,0 +1,474 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "include/bridge.h"
+#include "include/bridge_zip.h"
+#include "include/latency_stats.h"
+#include "nng/protocol/mqtt/mqtt.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+// zlib takes no more than its window of a preset dictionary
+#define ZIP_DICT_MAX 32768
+
+typedef struct {
+	conf_bridge_node *node;
+	char             *filter; // on the local topic, NULL for all
+} zip_rule;
+
+typedef struct {
+	conf_bridge_node *node;
+	nng_mtx          *mtx;
+	bridge_zip_stats  stats;
+} zip_node;
+
+// streams of one worker, reset between messages
+typedef struct {
+	z_stream def;
+	z_stream inf;
+	bool     def_ready;
+	bool     inf_ready;
+	uint8_t *buf;
+	size_t   cap;
+} zip_worker;
+
+static struct {
+	zip_rule   *rules;
+	size_t      nrules;
+	size_t      rules_cap;
+	zip_node   *nodes;
+	size_t      nnodes;
+	size_t      nodes_cap;
+	zip_worker *workers;
+	size_t      nworkers;
+	uint8_t    *dict;
+	size_t      dict_len;
+	bool        enabled;
+} zip_;
+
+static zip_node *
+zip_node_find(conf_bridge_node *node)
+{
+	for (size_t i = 0; i < zip_.nnodes; i++) {
+		if (zip_.nodes[i].node == node) {
+			return &zip_.nodes[i];
+		}
+	}
+	return NULL;
+}
+
+static conf_bridge_node *
+zip_node_named(conf_bridge *bridge, const char *name, size_t len)
+{
+	for (size_t i = 0; i < bridge->count; i++) {
+		conf_bridge_node *node = bridge->nodes[i];
+		if (node->name != NULL && strlen(node->name) == len &&
+		    strncmp(node->name, name, len) == 0) {
+			return node;
+		}
+	}
+	return NULL;
+}
+
+static int
+zip_dict_load(const char *path)
+{
+	FILE  *fp;
+	long   size;
+	size_t len;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		return NNG_ENOENT;
+	}
+	if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) <= 0) {
+		fclose(fp);
+		return NNG_EINVAL;
+	}
+	// the strings that matter most go last, keep those
+	len = size > ZIP_DICT_MAX ? ZIP_DICT_MAX : (size_t) size;
+	if (fseek(fp, size - (long) len, SEEK_SET) != 0) {
+		fclose(fp);
+		return NNG_EINVAL;
+	}
+	if ((zip_.dict = nng_alloc(len)) == NULL) {
+		fclose(fp);
+		return NNG_ENOMEM;
+	}
+	if (fread(zip_.dict, 1, len, fp) != len) {
+		fclose(fp);
+		nng_free(zip_.dict, len);
+		zip_.dict = NULL;
+		return NNG_EINVAL;
+	}
+	fclose(fp);
+	zip_.dict_len = len;
+	log_info("bridge compression dictionary %s, %zu bytes, id %08lx",
+	    path, len, adler32(adler32(0, NULL, 0), zip_.dict, (uInt) len));
+	return 0;
+}
+
+static int
+zip_rules_parse(conf_bridge *bridge, const char *s)
+{
+	const char *p = s;
+	size_t      n = 1;
+
+	for (const char *c = s; *c != '\0'; c++) {
+		n += *c == ',';
+	}
+	if ((zip_.rules = nng_zalloc(sizeof(zip_rule) * n)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	zip_.rules_cap = n;
+	while (*p != '\0') {
+		const char       *end   = strchr(p, ',');
+		size_t            len   = end != NULL ? (size_t) (end - p)
+		                                      : strlen(p);
+		const char       *colon = memchr(p, ':', len);
+		size_t            nlen  = colon != NULL ? (size_t) (colon - p)
+		                                        : len;
+		conf_bridge_node *node;
+
+		if (len == 0) {
+			p += end != NULL;
+			continue;
+		}
+		if ((node = zip_node_named(bridge, p, nlen)) == NULL) {
+			log_warn("bridge compression: no bridge %.*s", (int) nlen,
+			    p);
+		} else if (node->proto_ver != MQTT_PROTOCOL_VERSION_v5) {
+			log_warn("bridge compression: %s is no MQTT v5 bridge",
+			    node->name);
+		} else {
+			zip_rule *r = &zip_.rules[zip_.nrules];
+			r->node     = node;
+			if (colon != NULL &&
+			    (r->filter = nng_alloc(len - nlen)) != NULL) {
+				memcpy(r->filter, colon + 1, len - nlen - 1);
+				r->filter[len - nlen - 1] = '\0';
+			} else if (colon != NULL) {
+				return NNG_ENOMEM;
+			}
+			zip_.nrules++;
+		}
+		p += len + (end != NULL);
+	}
+	return 0;
+}
+
+int
+bridge_zip_init(conf_bridge *bridge, size_t workers)
+{
+	const char *rules = getenv("NANOMQ_BRIDGE_ZIP");
+	const char *dict  = getenv("NANOMQ_BRIDGE_ZIP_DICT");
+	int         rv;
+
+	if (zip_.enabled) {
+		return 0;
+	}
+	if (bridge->count == 0 || workers == 0) {
+		return 0;
+	}
+	if ((zip_.nodes = nng_zalloc(sizeof(zip_node) * bridge->count)) ==
+	        NULL ||
+	    (zip_.workers = nng_zalloc(sizeof(zip_worker) * workers)) ==
+	        NULL) {
+		rv = NNG_ENOMEM;
+		goto fail;
+	}
+	zip_.nodes_cap = bridge->count;
+	zip_.nworkers  = workers;
+	for (size_t i = 0; i < bridge->count; i++) {
+		zip_.nodes[i].node = bridge->nodes[i];
+		if ((rv = nng_mtx_alloc(&zip_.nodes[i].mtx)) != 0) {
+			goto fail;
+		}
+		zip_.nnodes++;
+	}
+	if (dict != NULL && *dict != '\0' && (rv = zip_dict_load(dict)) != 0) {
+		log_warn("bridge compression dictionary %s: %d", dict, rv);
+		goto fail;
+	}
+	if (rules != NULL && (rv = zip_rules_parse(bridge, rules)) != 0) {
+		goto fail;
+	}
+	zip_.enabled = true;
+	return 0;
+
+fail:
+	zip_.enabled = true;
+	bridge_zip_fini();
+	return rv;
+}
+
+void
+bridge_zip_fini(void)
+{
+	if (!zip_.enabled) {
+		return;
+	}
+	for (size_t i = 0; i < zip_.nworkers; i++) {
+		zip_worker *w = &zip_.workers[i];
+		if (w->def_ready) {
+			deflateEnd(&w->def);
+		}
+		if (w->inf_ready) {
+			inflateEnd(&w->inf);
+		}
+		if (w->buf != NULL) {
+			nng_free(w->buf, w->cap);
+		}
+	}
+	if (zip_.workers != NULL) {
+		nng_free(zip_.workers, sizeof(zip_worker) * zip_.nworkers);
+	}
+	for (size_t i = 0; i < zip_.nnodes; i++) {
+		nng_mtx_free(zip_.nodes[i].mtx);
+	}
+	if (zip_.nodes != NULL) {
+		nng_free(zip_.nodes, sizeof(zip_node) * zip_.nodes_cap);
+	}
+	for (size_t i = 0; i < zip_.nrules; i++) {
+		nng_strfree(zip_.rules[i].filter);
+	}
+	if (zip_.rules != NULL) {
+		nng_free(zip_.rules, sizeof(zip_rule) * zip_.rules_cap);
+	}
+	if (zip_.dict != NULL) {
+		nng_free(zip_.dict, zip_.dict_len);
+	}
+	memset(&zip_, 0, sizeof(zip_));
+}
+
+bool
+bridge_zip_enabled(void)
+{
+	return zip_.enabled;
+}
+
+bool
+bridge_zip_wanted(conf_bridge_node *node, const char *topic)
+{
+	for (size_t i = 0; i < zip_.nrules; i++) {
+		zip_rule *r = &zip_.rules[i];
+		if (r->node == node &&
+		    (r->filter == NULL || topic_filter(r->filter, topic))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int
+zip_reserve(zip_worker *w, size_t len)
+{
+	uint8_t *buf;
+
+	if (w->cap >= len) {
+		return 0;
+	}
+	if ((buf = nng_alloc(len)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	if (w->buf != NULL) {
+		nng_free(w->buf, w->cap);
+	}
+	w->buf = buf;
+	w->cap = len;
+	return 0;
+}
+
+// like zip_reserve, keeping the first keep bytes
+static int
+zip_grow(zip_worker *w, size_t len, size_t keep)
+{
+	uint8_t *buf;
+
+	if ((buf = nng_alloc(len)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	memcpy(buf, w->buf, keep);
+	nng_free(w->buf, w->cap);
+	w->buf = buf;
+	w->cap = len;
+	return 0;
+}
+
+int
+bridge_zip_deflate(size_t worker, conf_bridge_node *node, const uint8_t *data,
+    uint32_t len, uint8_t **outp, uint32_t *lenp)
+{
+	zip_worker *w;
+	zip_node   *zn = zip_node_find(node);
+	uint64_t    start;
+	int         rv;
+
+	if (!zip_.enabled || worker >= zip_.nworkers) {
+		return NNG_ENOTSUP;
+	}
+	if (len < NANO_BRIDGE_ZIP_MIN) {
+		return NNG_ENOSPC;
+	}
+	w     = &zip_.workers[worker];
+	start = latency_now();
+	if (!w->def_ready) {
+		if (deflateInit(&w->def, NANO_BRIDGE_ZIP_LEVEL) != Z_OK) {
+			return NNG_ENOMEM;
+		}
+		w->def_ready = true;
+	} else {
+		deflateReset(&w->def);
+	}
+	if (zip_.dict != NULL &&
+	    deflateSetDictionary(&w->def, zip_.dict, (uInt) zip_.dict_len) !=
+	        Z_OK) {
+		return NNG_EINTERNAL;
+	}
+	// nothing smaller than the payload is any use
+	if ((rv = zip_reserve(w, len)) != 0) {
+		return rv;
+	}
+	w->def.next_in   = (Bytef *) data;
+	w->def.avail_in  = len;
+	w->def.next_out  = w->buf;
+	w->def.avail_out = len - 1;
+	rv = deflate(&w->def, Z_FINISH) == Z_STREAM_END ? 0 : NNG_ENOSPC;
+	if (zn != NULL) {
+		nng_mtx_lock(zn->mtx);
+		if (rv == 0) {
+			zn->stats.zipped++;
+			zn->stats.zip_in += len;
+			zn->stats.zip_out += w->def.total_out;
+		} else {
+			zn->stats.skipped++;
+		}
+		zn->stats.zip_ns += latency_now() - start;
+		nng_mtx_unlock(zn->mtx);
+	}
+	if (rv == 0) {
+		*outp = w->buf;
+		*lenp = (uint32_t) w->def.total_out;
+	}
+	return rv;
+}
+
+void
+bridge_zip_sent(conf_bridge_node *node, uint32_t len, uint32_t zlen)
+{
+	zip_node *zn = zip_node_find(node);
+
+	if (zn == NULL) {
+		return;
+	}
+	nng_mtx_lock(zn->mtx);
+	zn->stats.zipped++;
+	zn->stats.zip_in += len;
+	zn->stats.zip_out += zlen;
+	nng_mtx_unlock(zn->mtx);
+}
+
+int
+bridge_zip_inflate(size_t worker, conf_bridge_node *node, const uint8_t *data,
+    uint32_t len, uint8_t **outp, uint32_t *lenp)
+{
+	zip_worker *w;
+	zip_node   *zn = zip_node_find(node);
+	uint64_t    start;
+	int         zrv;
+	int         rv = 0;
+
+	if (!zip_.enabled || worker >= zip_.nworkers) {
+		return NNG_ENOTSUP;
+	}
+	w     = &zip_.workers[worker];
+	start = latency_now();
+	if (!w->inf_ready) {
+		if (inflateInit(&w->inf) != Z_OK) {
+			return NNG_ENOMEM;
+		}
+		w->inf_ready = true;
+	} else {
+		inflateReset(&w->inf);
+	}
+	if ((rv = zip_reserve(w, (size_t) len * 4 + 64)) != 0) {
+		return rv;
+	}
+	w->inf.next_in   = (Bytef *) data;
+	w->inf.avail_in  = len;
+	w->inf.next_out  = w->buf;
+	w->inf.avail_out = (uInt) (w->cap > NANO_BRIDGE_ZIP_MAX
+	        ? NANO_BRIDGE_ZIP_MAX
+	        : w->cap);
+	while ((zrv = inflate(&w->inf, Z_NO_FLUSH)) != Z_STREAM_END) {
+		if (zrv == Z_NEED_DICT && zip_.dict != NULL &&
+		    inflateSetDictionary(&w->inf, zip_.dict,
+		        (uInt) zip_.dict_len) == Z_OK) {
+			continue;
+		}
+		if (zrv == Z_BUF_ERROR && w->inf.avail_out == 0 &&
+		    w->inf.total_out < NANO_BRIDGE_ZIP_MAX) {
+			size_t done = w->inf.total_out;
+			size_t cap  = w->cap * 2 > NANO_BRIDGE_ZIP_MAX
+			     ? NANO_BRIDGE_ZIP_MAX
+			     : w->cap * 2;
+			if ((rv = zip_grow(w, cap, done)) != 0) {
+				break;
+			}
+			w->inf.next_out  = w->buf + done;
+			w->inf.avail_out = (uInt) (cap - done);
+			continue;
+		}
+		if (zrv != Z_OK) {
+			// a dictionary we do not have, corrupt or too large
+			rv = zrv == Z_NEED_DICT ? NNG_ENOENT : NNG_EINVAL;
+			break;
+		}
+	}
+	if (rv == 0 && (*outp = nng_alloc(w->inf.total_out + 1)) == NULL) {
+		rv = NNG_ENOMEM;
+	}
+	if (zn != NULL) {
+		nng_mtx_lock(zn->mtx);
+		if (rv == 0) {
+			zn->stats.unzipped++;
+			zn->stats.unzip_in += len;
+			zn->stats.unzip_out += w->inf.total_out;
+		} else {
+			zn->stats.failed++;
+		}
+		zn->stats.unzip_ns += latency_now() - start;
+		nng_mtx_unlock(zn->mtx);
+	}
+	if (rv != 0) {
+		return rv;
+	}
+	memcpy(*outp, w->buf, w->inf.total_out);
+	(*outp)[w->inf.total_out] = '\0';
+	*lenp                     = (uint32_t) w->inf.total_out;
+	return 0;
+}
+
+int
+bridge_zip_stat(conf_bridge_node *node, bridge_zip_stats *stats)
+{
+	zip_node *zn = zip_node_find(node);
+
+	if (zn == NULL) {
+		return NNG_ENOENT;
+	}
+	nng_mtx_lock(zn->mtx);
+	memcpy(stats, &zn->stats, sizeof(*stats));
+	nng_mtx_unlock(zn->mtx);
+	return 0;
+}
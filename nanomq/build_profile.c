@@ -0,0 +1,59 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "include/build_profile.h"
+#include "nng/supplemental/nanolib/log.h"
+
+#if NANO_PLATFORM_LINUX
+#include <sys/stat.h>
+#endif
+
+const char *
+build_profile_name(void)
+{
+	switch (NANO_PROFILE) {
+	case NANO_PROFILE_TINY:
+		return "tiny";
+	case NANO_PROFILE_EDGE:
+		return "edge";
+	case NANO_PROFILE_GATEWAY:
+		return "gateway";
+	case NANO_PROFILE_SERVER:
+		return "server";
+	default:
+		return "none";
+	}
+}
+
+void
+build_profile_apply(conf *config)
+{
+	if (NANO_PROFILE_PARALLEL > 0) {
+		config->parallel = NANO_PROFILE_PARALLEL;
+	}
+	if (NANO_PROFILE_MSQ_LEN > 0) {
+		config->msq_len = NANO_PROFILE_MSQ_LEN;
+	}
+#if defined(ENABLE_LOG) && defined(NANO_PROFILE_LOG_LEVEL)
+	config->log.level = log_level_num(NANO_PROFILE_LOG_LEVEL);
+#endif
+}
+
+uint64_t
+build_profile_binary_size(void)
+{
+#if NANO_PLATFORM_LINUX
+	struct stat st;
+
+	if (stat("/proc/self/exe", &st) == 0) {
+		return (uint64_t) st.st_size;
+	}
+#endif
+	return 0;
+}
@@ -0,0 +1,294 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "include/cluster.h"
+#include "nng/nng.h"
+#include "nng/protocol/mqtt/mqtt.h"
+#include "nng/supplemental/nanolib/cJSON.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+#define CLUSTER_NAME_LEN 64
+
+static struct {
+	nng_mtx          *mtx;
+	conf_bridge_node *nodes[NANO_CLUSTER_PEERS];
+	size_t            count;
+	// the bridge nodes of the config before the links were added
+	conf_bridge_node **conf_nodes;
+	size_t             conf_count;
+	bool               conf_mode;
+	conf_bridge_node **merged;
+	// a peer may connect again before its old session is gone
+	uint32_t pipes[NANO_CLUSTER_PEERS * 2];
+	size_t   npipes;
+	bool     enabled;
+	char     name[CLUSTER_NAME_LEN];
+} cluster_;
+
+static void
+cluster_node_free(conf_bridge_node *node)
+{
+	nng_mtx *mtx = node->mtx;
+
+	conf_bridge_node_destroy(node);
+	if (mtx != NULL) {
+		nng_mtx_free(mtx);
+	}
+	nng_free(node, sizeof(*node));
+}
+
+/*
+ * A transparent v5 bridge to url, through the parser of the config so the
+ * node gets the defaults of any other, then with what a link must have
+ * whatever those are.
+ */
+static int
+cluster_node_alloc(conf *config, const char *url, conf_bridge_node **nodep)
+{
+	conf_bridge_node *node;
+	cJSON            *obj;
+	char              name[32];
+	char              clientid[sizeof(NANO_CLUSTER_CLIENTID_PREFIX) +
+	     CLUSTER_NAME_LEN];
+
+	snprintf(clientid, sizeof(clientid), NANO_CLUSTER_CLIENTID_PREFIX "%s",
+	    cluster_.name);
+	snprintf(name, sizeof(name), "cluster-%zu", cluster_.count);
+	if ((node = nng_zalloc(sizeof(*node))) == NULL) {
+		return NNG_ENOMEM;
+	}
+	if ((obj = cJSON_CreateObject()) == NULL) {
+		nng_free(node, sizeof(*node));
+		return NNG_ENOMEM;
+	}
+	cJSON_AddStringToObject(obj, "server", url);
+	cJSON_AddStringToObject(obj, "clientid", clientid);
+	cJSON_AddNumberToObject(obj, "proto_ver", MQTT_PROTOCOL_VERSION_v5);
+	cJSON_AddBoolToObject(obj, "clean_start", true);
+	cJSON_AddBoolToObject(obj, "transparent", true);
+	conf_bridge_node_parse(node, &config->bridge.sqlite, obj);
+	cJSON_Delete(obj);
+
+	if (node->name != NULL) {
+		nng_strfree(node->name);
+	}
+	node->name = nng_strdup(name);
+	if (node->address == NULL) {
+		node->address = nng_strdup(url);
+	}
+	if (node->clientid == NULL) {
+		node->clientid = nng_strdup(clientid);
+	}
+	node->enable         = true;
+	node->transparent    = true;
+	node->proto_ver      = MQTT_PROTOCOL_VERSION_v5;
+	node->clean_start    = true;
+	node->keepalive      = NANO_CLUSTER_KEEPALIVE;
+	node->parallel       = NANO_CLUSTER_PARALLEL;
+	node->forwards_count = 0;
+	node->sub_count      = 0;
+	if (node->name == NULL || node->address == NULL ||
+	    node->clientid == NULL ||
+	    (node->mtx == NULL && nng_mtx_alloc(&node->mtx) != 0)) {
+		cluster_node_free(node);
+		return NNG_ENOMEM;
+	}
+	*nodep = node;
+	return 0;
+}
+
+static int
+cluster_conf_peers(conf *config, const char *s)
+{
+	char *list;
+	char *save = NULL;
+	int   rv   = 0;
+
+	if ((list = nng_strdup(s)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	for (char *url = strtok_r(list, ",", &save); url != NULL;
+	     url       = strtok_r(NULL, ",", &save)) {
+		if (*url == '\0') {
+			continue;
+		}
+		if (cluster_.count == NANO_CLUSTER_PEERS) {
+			rv = NNG_ENOSPC;
+			break;
+		}
+		if (strncmp(url, "mqtt-tcp://", 11) != 0 &&
+		    strncmp(url, "tls+mqtt-tcp://", 15) != 0 &&
+		    strncmp(url, "mqtt-quic://", 12) != 0) {
+			rv = NNG_EADDRINVAL;
+			break;
+		}
+		if ((rv = cluster_node_alloc(
+		         config, url, &cluster_.nodes[cluster_.count])) != 0) {
+			break;
+		}
+		cluster_.count++;
+	}
+	nng_strfree(list);
+	return rv;
+}
+
+int
+cluster_init(conf *config)
+{
+	const char *peers = getenv("NANOMQ_CLUSTER_PEERS");
+	const char *name  = getenv("NANOMQ_CLUSTER_NAME");
+	size_t      n     = config->bridge.count;
+	int         rv;
+
+	if (cluster_.enabled || peers == NULL || *peers == '\0') {
+		return 0;
+	}
+	if (name != NULL && *name != '\0') {
+		snprintf(cluster_.name, sizeof(cluster_.name), "%s", name);
+	} else if (gethostname(cluster_.name, sizeof(cluster_.name)) != 0) {
+		snprintf(cluster_.name, sizeof(cluster_.name), "%d", getpid());
+	}
+	cluster_.name[sizeof(cluster_.name) - 1] = '\0';
+
+	if ((rv = nng_mtx_alloc(&cluster_.mtx)) != 0 ||
+	    (rv = cluster_conf_peers(config, peers)) != 0) {
+		goto fail;
+	}
+	if (cluster_.count == 0) {
+		rv = NNG_EINVAL;
+		goto fail;
+	}
+	if ((cluster_.merged = nng_alloc(
+	         sizeof(conf_bridge_node *) * (n + cluster_.count))) == NULL) {
+		rv = NNG_ENOMEM;
+		goto fail;
+	}
+	if (n > 0) {
+		memcpy(cluster_.merged, config->bridge.nodes,
+		    sizeof(conf_bridge_node *) * n);
+	}
+	memcpy(cluster_.merged + n, cluster_.nodes,
+	    sizeof(conf_bridge_node *) * cluster_.count);
+	cluster_.conf_nodes  = config->bridge.nodes;
+	cluster_.conf_count  = n;
+	cluster_.conf_mode   = config->bridge_mode;
+	config->bridge.nodes = cluster_.merged;
+	config->bridge.count = n + cluster_.count;
+	config->bridge_mode  = true;
+	cluster_.enabled     = true;
+	log_info("cluster node %s with %zu peers", cluster_.name,
+	    cluster_.count);
+	return 0;
+
+fail:
+	log_warn("NANOMQ_CLUSTER_PEERS \"%s\" ignored: %d", peers, rv);
+	for (size_t i = 0; i < cluster_.count; i++) {
+		cluster_node_free(cluster_.nodes[i]);
+	}
+	if (cluster_.mtx != NULL) {
+		nng_mtx_free(cluster_.mtx);
+	}
+	memset(&cluster_, 0, sizeof(cluster_));
+	return rv;
+}
+
+void
+cluster_fini(conf *config)
+{
+	if (!cluster_.enabled) {
+		return;
+	}
+	config->bridge.nodes = cluster_.conf_nodes;
+	config->bridge.count = cluster_.conf_count;
+	config->bridge_mode  = cluster_.conf_mode;
+	nng_free(cluster_.merged,
+	    sizeof(conf_bridge_node *) * (cluster_.conf_count + cluster_.count));
+	for (size_t i = 0; i < cluster_.count; i++) {
+		cluster_node_free(cluster_.nodes[i]);
+	}
+	nng_mtx_free(cluster_.mtx);
+	memset(&cluster_, 0, sizeof(cluster_));
+}
+
+bool
+cluster_enabled(void)
+{
+	return cluster_.enabled;
+}
+
+bool
+cluster_node(const conf_bridge_node *node)
+{
+	for (size_t i = 0; i < cluster_.count; i++) {
+		if (cluster_.nodes[i] == node) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+cluster_peer_open(uint32_t pipe, const char *client_id)
+{
+	if (!cluster_.enabled || client_id == NULL ||
+	    strncmp(client_id, NANO_CLUSTER_CLIENTID_PREFIX,
+	        sizeof(NANO_CLUSTER_CLIENTID_PREFIX) - 1) != 0) {
+		return;
+	}
+	nng_mtx_lock(cluster_.mtx);
+	if (cluster_.npipes < NANO_CLUSTER_PEERS * 2) {
+		cluster_.pipes[cluster_.npipes++] = pipe;
+	} else {
+		// messages of other peers reach its subscribers twice then
+		log_warn("cluster peer %s beyond %d sessions", client_id,
+		    NANO_CLUSTER_PEERS * 2);
+	}
+	nng_mtx_unlock(cluster_.mtx);
+}
+
+void
+cluster_peer_close(uint32_t pipe)
+{
+	if (!cluster_.enabled) {
+		return;
+	}
+	nng_mtx_lock(cluster_.mtx);
+	for (size_t i = 0; i < cluster_.npipes; i++) {
+		if (cluster_.pipes[i] == pipe) {
+			cluster_.pipes[i] = cluster_.pipes[--cluster_.npipes];
+			break;
+		}
+	}
+	nng_mtx_unlock(cluster_.mtx);
+}
+
+bool
+cluster_peer_pipe(uint32_t pipe)
+{
+	bool found = false;
+
+	if (!cluster_.enabled) {
+		return false;
+	}
+	nng_mtx_lock(cluster_.mtx);
+	for (size_t i = 0; i < cluster_.npipes; i++) {
+		if (cluster_.pipes[i] == pipe) {
+			found = true;
+			break;
+		}
+	}
+	nng_mtx_unlock(cluster_.mtx);
+	return found;
+}
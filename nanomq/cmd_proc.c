@@ -9,6 +9,7 @@
 
 #include "include/cmd_proc.h"
 #include "include/conf_api.h"
+#include "include/connect_admit.h"
 #include "include/nanomq.h"
 #include "nng/protocol/reqrep0/rep.h"
 #include "nng/protocol/reqrep0/req.h"
@@ -29,6 +30,43 @@ struct cmd_work {
 	conf *   config;
 };
 
+static const char *admit_keys[] = { "rate", "burst", "listener_rate",
+	"listener_burst", "pending", "wait_ms" };
+
+static uint32_t *
+admit_field(connect_admit_conf *c, size_t i)
+{
+	uint32_t *fields[] = { &c->rate, &c->burst, &c->listener_rate,
+		&c->listener_burst, &c->pending, &c->wait_ms };
+	return fields[i];
+}
+
+// Limits of the "connect_admit" object a reload carries, the ones it leaves
+// out stay as they are.
+static void
+reload_connect_admit(cJSON *obj)
+{
+	cJSON             *admit = cJSON_GetObjectItem(obj, "connect_admit");
+	connect_admit_conf c;
+
+	if (!cJSON_IsObject(admit) || !connect_admit_enabled()) {
+		return;
+	}
+	connect_admit_conf_get(&c);
+	for (size_t i = 0; i < sizeof(admit_keys) / sizeof(admit_keys[0]);
+	     i++) {
+		cJSON *v = cJSON_GetObjectItem(admit, admit_keys[i]);
+		if (cJSON_IsNumber(v) && v->valuedouble >= 0) {
+			*admit_field(&c, i) = (uint32_t) v->valuedouble;
+		}
+	}
+	connect_admit_tune(&c);
+	log_info("connect admission: %u/s burst %u, per listener %u/s "
+	         "burst %u, %u pending for %ums",
+	    c.rate, c.burst, c.listener_rate, c.listener_burst, c.pending,
+	    c.wait_ms);
+}
+
 static int
 handle_recv(const char *msg, size_t msg_len, conf *config, char **err_msg)
 {
@@ -86,7 +124,11 @@ handle_recv(const char *msg, size_t msg_len, conf *config, char **err_msg)
 	reload_sqlite_config(&config->sqlite, &new_conf->sqlite);
 	reload_auth_config(&config->auths, &new_conf->auths);
 	reload_log_config(config, new_conf);
-
+	reload_acl_config(config, new_conf);
+	reload_bridge_config(config, new_conf);
+	reload_webhook_config(config, new_conf);
+	reload_rule_config(config, new_conf);
+	reload_connect_admit(obj);
 
 	conf_fini(new_conf);
 	cJSON_Delete(obj);
@@ -263,6 +305,23 @@ encode_client_cmd(const char *conf_file, int type)
 	cJSON_AddStringToObject(obj, "cmd", "reload");
 	cJSON_AddStringToObject(obj, "conf_file", conf_file);
 	cJSON_AddNumberToObject(obj, "conf_type", type);
+
+	// NANOMQ_CONNECT_* of the reload command retune admission control
+	connect_admit_conf c;
+	cJSON             *admit = NULL;
+	memset(&c, 0xff, sizeof(c));
+	connect_admit_conf_env(&c);
+	for (size_t i = 0; i < sizeof(admit_keys) / sizeof(admit_keys[0]);
+	     i++) {
+		if (*admit_field(&c, i) == UINT32_MAX) {
+			continue;
+		}
+		if (admit == NULL) {
+			admit = cJSON_AddObjectToObject(obj, "connect_admit");
+		}
+		cJSON_AddNumberToObject(
+		    admit, admit_keys[i], *admit_field(&c, i));
+	}
 	char *cmd = cJSON_PrintUnformatted(obj);
 	cJSON_Delete(obj);
 	return cmd;
@@ -1,6 +1,12 @@
 #include "conf_api.h"
+#include "include/acl_handler.h"
+#include "include/bridge.h"
+#include "include/bridge_forward.h"
 #include "include/mqtt_api.h"
 #include "include/nanomq.h"
+#include "include/nanomq_rule.h"
+#include "include/rule_filter.h"
+#include "include/webhook_post.h"
 
 #include "nng/protocol/pipeline0/push.h"
 #include "include/webhook_inproc.h"
@@ -1191,3 +1197,453 @@ reload_log_config(conf *old, conf *new)
 	}
 #endif
 }
+
+void
+reload_acl_config(conf *cur_conf, conf *new_conf)
+{
+#ifdef ACL_SUPP
+	int      rc = 0;
+	conf_acl acl;
+
+	// compile first, lookups never read the conf rules once indexed
+	if ((rc = acl_reload(&new_conf->acl)) != 0) {
+		log_error("acl reload failed: %d", rc);
+		return;
+	}
+	// the old rules are released along with new_conf
+	acl                       = cur_conf->acl;
+	cur_conf->acl             = new_conf->acl;
+	new_conf->acl             = acl;
+	cur_conf->acl_nomatch     = new_conf->acl_nomatch;
+	cur_conf->acl_deny_action = new_conf->acl_deny_action;
+#endif
+}
+
+void
+reload_webhook_config(conf *cur_conf, conf *new_conf)
+{
+	hook_filter_reload(cur_conf, new_conf);
+}
+
+static bool
+str_equal(const char *a, const char *b)
+{
+	return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+static bool
+topics_equal(const topics *a, const topics *b)
+{
+	return str_equal(a->remote_topic, b->remote_topic) &&
+	    str_equal(a->local_topic, b->local_topic) &&
+	    str_equal(a->prefix, b->prefix) &&
+	    str_equal(a->suffix, b->suffix) && a->qos == b->qos &&
+	    a->retain == b->retain &&
+	    a->retain_as_published == b->retain_as_published &&
+	    a->retain_handling == b->retain_handling;
+}
+
+static bool
+topics_list_equal(topics **a, size_t na, topics **b, size_t nb)
+{
+	if (na != nb) {
+		return false;
+	}
+	for (size_t i = 0; i < na; i++) {
+		if (!topics_equal(a[i], b[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static conf_bridge_node *
+bridge_node_find(conf_bridge *bridge, const char *name)
+{
+	for (size_t i = 0; i < bridge->count; i++) {
+		if (str_equal(bridge->nodes[i]->name, name)) {
+			return bridge->nodes[i];
+		}
+	}
+	return NULL;
+}
+
+// What the connection of node is made of, as the REST API shows it.
+static cJSON *
+bridge_conn_config(conf_bridge *bridge, conf_bridge_node *node)
+{
+	static const char *rest[] = { "enable", "parallel", "forwards",
+		"subscription", "sub_properties" };
+	cJSON             *obj = get_bridge_config(bridge, node->name);
+	cJSON *n = cJSON_GetArrayItem(cJSON_GetObjectItem(obj, "nodes"), 0);
+
+	cJSON_DeleteItemFromObject(obj, "sqlite");
+	for (size_t i = 0; n != NULL && i < sizeof(rest) / sizeof(rest[0]);
+	     i++) {
+		cJSON_DeleteItemFromObject(n, rest[i]);
+	}
+	return obj;
+}
+
+static bool
+bridge_conn_changed(conf_bridge *cur_bridge, conf_bridge_node *cur,
+    conf_bridge *new_bridge, conf_bridge_node *new)
+{
+	cJSON *a;
+	cJSON *b;
+	bool   changed;
+
+	if (cur->tcp.enable != new->tcp.enable ||
+	    cur->tcp.nodelay != new->tcp.nodelay ||
+	    cur->tcp.keepalive != new->tcp.keepalive ||
+	    cur->tcp.quickack != new->tcp.quickack ||
+	    cur->tcp.keepidle != new->tcp.keepidle ||
+	    cur->tcp.keepintvl != new->tcp.keepintvl ||
+	    cur->tcp.keepcnt != new->tcp.keepcnt ||
+	    cur->tcp.sendtimeo != new->tcp.sendtimeo ||
+	    cur->tcp.recvtimeo != new->tcp.recvtimeo ||
+	    cur->backoff_max != new->backoff_max ||
+	    cur->cancel_timeout != new->cancel_timeout ||
+	    cur->resend_interval != new->resend_interval ||
+	    cur->resend_wait != new->resend_wait) {
+		return true;
+	}
+	a       = bridge_conn_config(cur_bridge, cur);
+	b       = bridge_conn_config(new_bridge, new);
+	changed = !cJSON_Compare(a, b, true);
+	cJSON_Delete(a);
+	cJSON_Delete(b);
+	return changed;
+}
+
+/*
+ * Give cur the conf of new, new gets the old one and is freed along with
+ * its conf. What the running bridge owns stays with cur.
+ */
+static void
+bridge_node_swap(conf_bridge_node *cur, conf_bridge_node *new)
+{
+	conf_bridge_node tmp = *cur;
+
+	*cur = *new;
+	*new = tmp;
+#define BRIDGE_NODE_KEEP(f) (new->f = cur->f, cur->f = tmp.f)
+	BRIDGE_NODE_KEEP(enable);
+	BRIDGE_NODE_KEEP(parallel);
+	BRIDGE_NODE_KEEP(sock);
+	BRIDGE_NODE_KEEP(bridge_arg);
+	BRIDGE_NODE_KEEP(bridge_aio);
+	BRIDGE_NODE_KEEP(mtx);
+	BRIDGE_NODE_KEEP(sqlite);
+#undef BRIDGE_NODE_KEEP
+}
+
+// Forwards and subscriptions only, the connection stays as it is.
+static void
+bridge_rules_swap(conf_bridge_node *cur, conf_bridge_node *new)
+{
+	conf_bridge_node tmp = *cur;
+
+	cur->forwards_list  = new->forwards_list;
+	cur->forwards_count = new->forwards_count;
+	cur->sub_list       = new->sub_list;
+	cur->sub_count      = new->sub_count;
+	cur->sub_properties = new->sub_properties;
+	new->forwards_list  = tmp.forwards_list;
+	new->forwards_count = tmp.forwards_count;
+	new->sub_list       = tmp.sub_list;
+	new->sub_count      = tmp.sub_count;
+	new->sub_properties = tmp.sub_properties;
+}
+
+static bool
+bridge_sub_listed(topics **list, size_t count, const topics *t, bool exact)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (exact ? topics_equal(list[i], t)
+		          : str_equal(list[i]->remote_topic, t->remote_topic)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Bring the subscriptions of the connection of cur from old to its own.
+static void
+bridge_sub_sync(conf_bridge_node *cur, topics **old, size_t old_count)
+{
+	nng_mqtt_topic_qos *subs;
+	nng_mqtt_topic     *unsubs;
+	size_t              n = 0;
+
+	unsubs = nng_mqtt_topic_array_create(old_count > 0 ? old_count : 1);
+	for (size_t i = 0; i < old_count; i++) {
+		if (!bridge_sub_listed(
+		        cur->sub_list, cur->sub_count, old[i], false)) {
+			nng_mqtt_topic_array_set(
+			    unsubs, n++, old[i]->remote_topic);
+		}
+	}
+	if (n > 0 &&
+	    bridge_unsubscribe(cur->sock, cur, unsubs, n, NULL) != 0) {
+		log_warn("bridge %s: unsubscribe failed", cur->name);
+	}
+	nng_mqtt_topic_array_free(unsubs, old_count > 0 ? old_count : 1);
+
+	n    = 0;
+	subs = nng_mqtt_topic_qos_array_create(
+	    cur->sub_count > 0 ? cur->sub_count : 1);
+	for (size_t i = 0; i < cur->sub_count; i++) {
+		topics *t = cur->sub_list[i];
+		if (!bridge_sub_listed(old, old_count, t, true)) {
+			nng_mqtt_topic_qos_array_set(subs, n++, t->remote_topic,
+			    t->qos, 1, t->retain_as_published,
+			    t->retain_handling);
+		}
+	}
+	if (n > 0 && bridge_subscribe(cur->sock, cur, subs, n, NULL) != 0) {
+		log_warn("bridge %s: subscribe failed", cur->name);
+	}
+	nng_mqtt_topic_qos_array_free(
+	    subs, cur->sub_count > 0 ? cur->sub_count : 1);
+}
+
+/*
+ * Bridges are matched by name. One whose connection changed reconnects
+ * with its new conf, one whose forwards or subscriptions changed keeps its
+ * connection and has its subscriptions synced; the forward rules of all of
+ * them are swapped in as one snapshot. Bridges added, removed, enabled or
+ * disabled take a restart.
+ */
+void
+reload_bridge_config(conf *cur_conf, conf *new_conf)
+{
+	conf_bridge *cur_bridge = &cur_conf->bridge;
+	conf_bridge *new_bridge = &new_conf->bridge;
+	bool         rules      = false;
+
+	if (!cur_conf->bridge_mode) {
+		if (new_conf->bridge_mode) {
+			log_warn("bridges are started by a restart only");
+		}
+		return;
+	}
+	for (size_t i = 0; i < new_bridge->count; i++) {
+		conf_bridge_node *new = new_bridge->nodes[i];
+		if (new->enable &&
+		    bridge_node_find(cur_bridge, new->name) == NULL) {
+			log_warn(
+			    "bridge %s is new, restart to start it", new->name);
+		}
+	}
+	for (size_t i = 0; i < cur_bridge->count; i++) {
+		conf_bridge_node *cur = cur_bridge->nodes[i];
+		conf_bridge_node *new = bridge_node_find(new_bridge, cur->name);
+		nng_mtx          *mtx = cur->mtx;
+
+		if (new == NULL || new->enable != cur->enable) {
+			log_warn("bridge %s was %s, restart to apply it",
+			    cur->name,
+			    new == NULL ? "removed" : "enabled or disabled");
+			continue;
+		}
+		if (!cur->enable) {
+			continue;
+		}
+		if (bridge_conn_changed(cur_bridge, cur, new_bridge, new)) {
+#if defined(SUPP_QUIC)
+			if (cur->hybrid) {
+				log_warn("bridge %s is hybrid, restart to "
+				         "reconnect it",
+				    cur->name);
+				continue;
+			}
+#endif
+			nng_mtx_lock(mtx);
+			bridge_node_swap(cur, new);
+			nng_mtx_unlock(mtx);
+			log_info(
+			    "bridge %s reconnects with its new conf", cur->name);
+			// the forward rules are reloaded along with it
+			if (bridge_reload(cur->sock, cur_conf, cur) != 0) {
+				log_error("bridge %s reconnect failed", cur->name);
+			}
+			continue;
+		}
+		if (topics_list_equal(cur->forwards_list, cur->forwards_count,
+		        new->forwards_list, new->forwards_count) &&
+		    topics_list_equal(cur->sub_list, cur->sub_count,
+		        new->sub_list, new->sub_count)) {
+			continue;
+		}
+
+		nng_mtx_lock(mtx);
+		bridge_rules_swap(cur, new);
+		nng_mtx_unlock(mtx);
+		bridge_sub_sync(cur, new->sub_list, new->sub_count);
+		log_info("bridge %s: %u forwards, %u subscriptions",
+		    cur->name, (unsigned) cur->forwards_count,
+		    (unsigned) cur->sub_count);
+		rules = true;
+	}
+	if (rules && bridge_forward_reload(cur_bridge) != 0) {
+		log_warn("bridges keep their previous forward rules");
+	}
+}
+
+#if defined(SUPP_RULE_ENGINE)
+// Same statement feeding the same target.
+static bool
+rule_same(const rule *a, const rule *b)
+{
+	if (a->forword_type != b->forword_type ||
+	    !str_equal(a->raw_sql, b->raw_sql)) {
+		return false;
+	}
+	switch (a->forword_type) {
+	case RULE_FORWORD_REPUB:
+		return str_equal(a->repub->address, b->repub->address) &&
+		    str_equal(a->repub->topic, b->repub->topic);
+	case RULE_FORWORD_SQLITE:
+		return str_equal(a->sqlite_table, b->sqlite_table);
+	case RULE_FORWORD_MYSQL:
+		return str_equal(a->mysql->table, b->mysql->table);
+	default:
+		return true;
+	}
+}
+
+static repub_t *
+rule_repub_dup(const repub_t *src)
+{
+	repub_t *repub = rule_repub_init();
+
+	repub->address     = nng_strdup(src->address);
+	repub->topic       = nng_strdup(src->topic);
+	repub->clientid    = src->clientid ? nng_strdup(src->clientid) : NULL;
+	repub->username    = src->username ? nng_strdup(src->username) : NULL;
+	repub->password    = src->password ? nng_strdup(src->password) : NULL;
+	repub->proto_ver   = src->proto_ver;
+	repub->keepalive   = src->keepalive;
+	repub->clean_start = src->clean_start;
+	return repub;
+}
+
+// Append the rule of the file the way the REST API adds one.
+static int
+rule_add(conf *config, const rule *src)
+{
+	conf_rule *cr = &config->rule_eng;
+	repub_t   *repub;
+	rule      *r;
+
+	switch (src->forword_type) {
+	case RULE_FORWORD_REPUB:
+		repub = rule_repub_dup(src->repub);
+		if (!nano_client_is_local(config->url, repub->address)) {
+			nng_socket *sock = nng_alloc(sizeof(nng_socket));
+			if (sock == NULL || nano_client(sock, repub) != 0) {
+				nng_free(sock, sizeof(nng_socket));
+				rule_repub_free(repub);
+				return NNG_ECONNREFUSED;
+			}
+		}
+		rule_sql_parse(cr, src->raw_sql);
+		r               = &cr->rules[cvector_size(cr->rules) - 1];
+		r->forword_type = RULE_FORWORD_REPUB;
+		r->repub        = repub;
+		cr->option |= RULE_ENG_RPB;
+		break;
+#if defined(NNG_SUPP_SQLITE)
+	case RULE_FORWORD_SQLITE:
+		if ((cr->option & RULE_ENG_SDB) == 0) {
+			return NNG_ENOTSUP;
+		}
+		rule_sql_parse(cr, src->raw_sql);
+		r               = &cr->rules[cvector_size(cr->rules) - 1];
+		r->forword_type = RULE_FORWORD_SQLITE;
+		r->sqlite_table = nng_strdup(src->sqlite_table);
+		if (nanomq_client_sqlite(cr, true) == 1) {
+			rule_free(r);
+			cvector_pop_back(cr->rules);
+			return NNG_EINVAL;
+		}
+		break;
+#endif
+	default:
+		// a new database connection, left to a restart
+		return NNG_ENOTSUP;
+	}
+	r->raw_sql = nng_strdup(src->raw_sql);
+	r->enabled = src->enabled;
+	r->rule_id = rule_generate_rule_id();
+	return 0;
+}
+#endif
+
+/*
+ * The rules of the file are matched to the running ones by statement and
+ * target. Matching rules take the enabled state of the file, new repub and
+ * SQLite rules are added like the REST API adds them and rules no longer
+ * in the file are disabled, so the indexes workers hold stay valid. The
+ * filters are compiled and swapped in once. Rules the REST API added are
+ * not in the file either and are disabled as well.
+ */
+void
+reload_rule_config(conf *cur_conf, conf *new_conf)
+{
+#if defined(SUPP_RULE_ENGINE)
+	conf_rule *cr      = &cur_conf->rule_eng;
+	conf_rule *next    = &new_conf->rule_eng;
+	size_t     count   = cvector_size(cr->rules);
+	size_t     changed = 0;
+	bool      *kept;
+	int        rv;
+
+	if (cr->option == RULE_ENG_OFF) {
+		if (cvector_size(next->rules) > 0) {
+			log_warn("the rule engine is started by a restart only");
+		}
+		return;
+	}
+	if ((kept = nng_zalloc(sizeof(bool) * (count + 1))) == NULL) {
+		log_error("rule reload failed: out of memory");
+		return;
+	}
+	rule_filter_lock();
+	for (size_t i = 0; i < cvector_size(next->rules); i++) {
+		rule  *r = &next->rules[i];
+		size_t j = 0;
+
+		while (j < count && (kept[j] || !rule_same(&cr->rules[j], r))) {
+			j++;
+		}
+		if (j < count) {
+			kept[j] = true;
+			changed += cr->rules[j].enabled != r->enabled;
+			cr->rules[j].enabled = r->enabled;
+		} else if ((rv = rule_add(cur_conf, r)) != 0) {
+			log_warn("rule \"%s\" not added: %d, restart to add it",
+			    r->raw_sql, rv);
+		} else {
+			changed++;
+		}
+	}
+	for (size_t j = 0; j < count; j++) {
+		if (!kept[j] && cr->rules[j].enabled) {
+			cr->rules[j].enabled = false;
+			changed++;
+		}
+	}
+	nng_free(kept, sizeof(bool) * (count + 1));
+	if (changed > 0 && (rv = rule_filter_compile(cr)) != 0) {
+		log_warn("rule table failed: %d, the old rules stay", rv);
+	}
+	log_info("rules: %zu changed, %zu in total", changed,
+	    (size_t) cvector_size(cr->rules));
+	rule_filter_unlock();
+#else
+	(void) cur_conf;
+	(void) new_conf;
+#endif
+}
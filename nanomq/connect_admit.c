@@ -0,0 +1,404 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/connect_admit.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef struct admit_entry admit_entry;
+struct admit_entry {
+	admit_entry     *next;
+	connect_admit_cb cb;
+	void            *arg;
+	nng_time         deadline;
+	int              rv;
+};
+
+// Tokens are kept in thousandths so that slow rates refill every tick.
+typedef struct {
+	uint64_t tokens;
+	uint64_t cap;
+	uint32_t rate;
+} admit_bucket;
+
+typedef struct {
+	uint16_t     port;
+	bool         used;
+	admit_bucket bucket;
+	admit_entry *head;
+	admit_entry *tail;
+} admit_listener;
+
+static struct {
+	nng_mtx           *mtx;
+	nng_cv            *cv;
+	nng_thread        *thr;
+	connect_admit_conf conf;
+	admit_bucket       global;
+	admit_listener     listeners[NANO_ADMIT_LISTENERS];
+	size_t             rr; // listener served first next round
+	nng_time           last;
+	uint32_t           pending;
+	uint32_t           pending_max;
+	uint64_t           admitted;
+	uint64_t           queued;
+	uint64_t           refused;
+	uint64_t           expired;
+	bool               limited;
+	bool               closing;
+	bool               enabled;
+} admit_;
+
+// A bucket that was unlimited starts full.
+static void
+bucket_set(admit_bucket *b, uint32_t rate, uint32_t burst, bool fill)
+{
+	fill    = fill || b->rate == 0;
+	b->rate = rate;
+	b->cap  = (uint64_t) (burst > 0 ? burst : rate) * 1000;
+	if (fill || b->tokens > b->cap) {
+		b->tokens = b->cap;
+	}
+}
+
+static void
+bucket_refill(admit_bucket *b, nng_time elapsed)
+{
+	// a rate in tokens per second is thousandths per millisecond
+	b->tokens += (uint64_t) elapsed * b->rate;
+	if (b->tokens > b->cap) {
+		b->tokens = b->cap;
+	}
+}
+
+static void
+admit_refill(void)
+{
+	nng_time now = nng_clock();
+
+	if (now > admit_.last) {
+		bucket_refill(&admit_.global, now - admit_.last);
+		for (size_t i = 0; i < NANO_ADMIT_LISTENERS; i++) {
+			if (admit_.listeners[i].used) {
+				bucket_refill(&admit_.listeners[i].bucket,
+				    now - admit_.last);
+			}
+		}
+	}
+	admit_.last = now;
+}
+
+static bool
+admit_take(admit_listener *l)
+{
+	if ((admit_.global.rate > 0 && admit_.global.tokens < 1000) ||
+	    (l->bucket.rate > 0 && l->bucket.tokens < 1000)) {
+		return false;
+	}
+	if (admit_.global.rate > 0) {
+		admit_.global.tokens -= 1000;
+	}
+	if (l->bucket.rate > 0) {
+		l->bucket.tokens -= 1000;
+	}
+	return true;
+}
+
+static admit_listener *
+admit_listener_find(uint16_t port)
+{
+	admit_listener *l;
+
+	for (size_t i = 0; i < NANO_ADMIT_LISTENERS; i++) {
+		l = &admit_.listeners[i];
+		if (l->used && l->port == port) {
+			return l;
+		}
+		if (!l->used) {
+			l->used = true;
+			l->port = port;
+			bucket_set(&l->bucket, admit_.conf.listener_rate,
+			    admit_.conf.listener_burst, true);
+			return l;
+		}
+	}
+	return &admit_.listeners[NANO_ADMIT_LISTENERS - 1];
+}
+
+// Waiting CONNECTs onto done, one per listener a round so that a busy
+// listener cannot starve the others.
+static admit_entry *
+admit_drain(nng_time now)
+{
+	admit_entry  *done = NULL;
+	admit_entry **tail = &done;
+	bool          progress;
+
+	admit_refill();
+	do {
+		progress = false;
+		for (size_t n = 0; n < NANO_ADMIT_LISTENERS; n++) {
+			admit_listener *l =
+			    &admit_.listeners[(admit_.rr + n) % NANO_ADMIT_LISTENERS];
+			admit_entry *e = l->head;
+
+			if (e == NULL) {
+				continue;
+			}
+			if (e->deadline <= now) {
+				e->rv = NNG_EBUSY;
+				admit_.expired++;
+			} else if (admit_take(l)) {
+				e->rv = 0;
+				admit_.admitted++;
+			} else {
+				continue;
+			}
+			if ((l->head = e->next) == NULL) {
+				l->tail = NULL;
+			}
+			e->next = NULL;
+			*tail   = e;
+			tail    = &e->next;
+			admit_.pending--;
+			progress = true;
+		}
+		admit_.rr = (admit_.rr + 1) % NANO_ADMIT_LISTENERS;
+	} while (progress);
+	return done;
+}
+
+static void
+admit_thread_main(void *arg)
+{
+	(void) arg;
+	nng_mtx_lock(admit_.mtx);
+	while (!admit_.closing) {
+		nng_time     until;
+		admit_entry *done;
+
+		if (admit_.pending == 0) {
+			nng_cv_wait(admit_.cv);
+			continue;
+		}
+		until = nng_clock() + NANO_ADMIT_TICK_MS;
+		while (!admit_.closing && nng_clock() < until) {
+			nng_cv_until(admit_.cv, until);
+		}
+		if (admit_.closing) {
+			break;
+		}
+		done = admit_drain(nng_clock());
+		nng_mtx_unlock(admit_.mtx);
+		while (done != NULL) {
+			admit_entry *e = done;
+			done           = e->next;
+			e->cb(e->arg, e->rv);
+			nng_free(e, sizeof(*e));
+		}
+		nng_mtx_lock(admit_.mtx);
+	}
+	nng_mtx_unlock(admit_.mtx);
+}
+
+static void
+admit_conf_apply(const connect_admit_conf *c, bool fill)
+{
+	admit_.conf    = *c;
+	admit_.limited = c->rate > 0 || c->listener_rate > 0;
+	bucket_set(&admit_.global, c->rate, c->burst, fill);
+	for (size_t i = 0; i < NANO_ADMIT_LISTENERS; i++) {
+		if (admit_.listeners[i].used) {
+			bucket_set(&admit_.listeners[i].bucket,
+			    c->listener_rate, c->listener_burst, fill);
+		}
+	}
+}
+
+int
+connect_admit_init(const connect_admit_conf *c)
+{
+	int rv;
+
+	if (admit_.enabled) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&admit_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&admit_.cv, admit_.mtx)) != 0) {
+		connect_admit_fini();
+		return rv;
+	}
+	admit_conf_apply(c, true);
+	admit_.last = nng_clock();
+	if ((rv = nng_thread_create(&admit_.thr, admit_thread_main, NULL)) !=
+	    0) {
+		admit_.thr = NULL;
+		connect_admit_fini();
+		return rv;
+	}
+	admit_.enabled = true;
+	return 0;
+}
+
+// CONNECTs still waiting are dropped without their callbacks, the broker
+// works they would resume are going away.
+void
+connect_admit_fini(void)
+{
+	if (admit_.thr != NULL) {
+		nng_mtx_lock(admit_.mtx);
+		admit_.closing = true;
+		nng_cv_wake(admit_.cv);
+		nng_mtx_unlock(admit_.mtx);
+		nng_thread_destroy(admit_.thr);
+	}
+	for (size_t i = 0; i < NANO_ADMIT_LISTENERS; i++) {
+		admit_entry *e = admit_.listeners[i].head;
+		while (e != NULL) {
+			admit_entry *next = e->next;
+			nng_free(e, sizeof(*e));
+			e = next;
+		}
+	}
+	if (admit_.cv != NULL) {
+		nng_cv_free(admit_.cv);
+	}
+	if (admit_.mtx != NULL) {
+		nng_mtx_free(admit_.mtx);
+	}
+	memset(&admit_, 0, sizeof(admit_));
+}
+
+bool
+connect_admit_enabled(void)
+{
+	return admit_.enabled;
+}
+
+void
+connect_admit_tune(const connect_admit_conf *c)
+{
+	if (!admit_.enabled) {
+		return;
+	}
+	nng_mtx_lock(admit_.mtx);
+	admit_refill();
+	admit_conf_apply(c, false);
+	nng_cv_wake(admit_.cv);
+	nng_mtx_unlock(admit_.mtx);
+}
+
+void
+connect_admit_conf_get(connect_admit_conf *c)
+{
+	memset(c, 0, sizeof(*c));
+	if (!admit_.enabled) {
+		return;
+	}
+	nng_mtx_lock(admit_.mtx);
+	*c = admit_.conf;
+	nng_mtx_unlock(admit_.mtx);
+}
+
+static void
+admit_env(const char *name, uint32_t *v)
+{
+	const char *s = getenv(name);
+	char       *end;
+	long        n;
+
+	if (s == NULL || *s == '\0') {
+		return;
+	}
+	n = strtol(s, &end, 10);
+	if (*end == '\0' && n >= 0) {
+		*v = (uint32_t) n;
+	}
+}
+
+void
+connect_admit_conf_env(connect_admit_conf *c)
+{
+	admit_env("NANOMQ_CONNECT_RATE", &c->rate);
+	admit_env("NANOMQ_CONNECT_BURST", &c->burst);
+	admit_env("NANOMQ_CONNECT_LISTENER_RATE", &c->listener_rate);
+	admit_env("NANOMQ_CONNECT_LISTENER_BURST", &c->listener_burst);
+	admit_env("NANOMQ_CONNECT_PENDING", &c->pending);
+	admit_env("NANOMQ_CONNECT_WAIT_MS", &c->wait_ms);
+}
+
+int
+connect_admit_try(uint16_t port, connect_admit_cb cb, void *arg)
+{
+	admit_listener *l;
+	admit_entry    *e;
+
+	if (!admit_.enabled) {
+		return 0;
+	}
+	nng_mtx_lock(admit_.mtx);
+	if (!admit_.limited) {
+		admit_.admitted++;
+		nng_mtx_unlock(admit_.mtx);
+		return 0;
+	}
+	admit_refill();
+	l = admit_listener_find(port);
+	// no overtaking of the CONNECTs already waiting on this listener
+	if (l->head == NULL && admit_take(l)) {
+		admit_.admitted++;
+		nng_mtx_unlock(admit_.mtx);
+		return 0;
+	}
+	if (admit_.pending >= admit_.conf.pending ||
+	    (e = nng_alloc(sizeof(*e))) == NULL) {
+		admit_.refused++;
+		nng_mtx_unlock(admit_.mtx);
+		return NNG_EBUSY;
+	}
+	e->next     = NULL;
+	e->cb       = cb;
+	e->arg      = arg;
+	e->rv       = 0;
+	e->deadline = nng_clock() + admit_.conf.wait_ms;
+	if (l->tail != NULL) {
+		l->tail->next = e;
+	} else {
+		l->head = e;
+	}
+	l->tail = e;
+	if (++admit_.pending > admit_.pending_max) {
+		admit_.pending_max = admit_.pending;
+	}
+	admit_.queued++;
+	nng_cv_wake(admit_.cv);
+	nng_mtx_unlock(admit_.mtx);
+	return NNG_EAGAIN;
+}
+
+void
+connect_admit_stats_get(connect_admit_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!admit_.enabled) {
+		return;
+	}
+	nng_mtx_lock(admit_.mtx);
+	s->admitted    = admit_.admitted;
+	s->queued      = admit_.queued;
+	s->refused     = admit_.refused;
+	s->expired     = admit_.expired;
+	s->pending     = admit_.pending;
+	s->pending_max = admit_.pending_max;
+	s->limited     = admit_.limited;
+	nng_mtx_unlock(admit_.mtx);
+}
@@ -0,0 +1,284 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/cpu_affinity.h"
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+#if NANO_PLATFORM_LINUX
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+static const struct {
+	const char *env;
+	const char *comm; // thread name prefix set by nng
+} cpu_groups[CPU_GROUPS] = {
+	[CPU_GROUP_TASKQ]    = { "NANOMQ_CPU_TASKQ", "nng:task" },
+	[CPU_GROUP_EXPIRE]   = { "NANOMQ_CPU_EXPIRE", "nng:aio:expire" },
+	[CPU_GROUP_RESOLVER] = { "NANOMQ_CPU_RESOLVER", "nng:resolver" },
+	[CPU_GROUP_POLL]     = { "NANOMQ_CPU_POLL", "nng:poll" },
+};
+
+const char *
+cpu_group_env(cpu_group g)
+{
+	return g < CPU_GROUPS ? cpu_groups[g].env : NULL;
+}
+
+int
+cpu_list_parse(const char *s, cpu_list *l)
+{
+	memset(l, 0, sizeof(*l));
+	if (s == NULL) {
+		return NNG_EINVAL;
+	}
+	while (*s != '\0') {
+		char *end;
+		long  lo, hi;
+
+		while (isspace((unsigned char) *s)) {
+			s++;
+		}
+		if (!isdigit((unsigned char) *s)) {
+			return NNG_EINVAL;
+		}
+		lo = hi = strtol(s, &end, 10);
+		if (*end == '-') {
+			if (!isdigit((unsigned char) end[1])) {
+				return NNG_EINVAL;
+			}
+			hi = strtol(end + 1, &end, 10);
+		}
+		if (lo > hi || hi >= NANO_CPU_MAX) {
+			return NNG_EINVAL;
+		}
+		for (long c = lo; c <= hi; c++) {
+			l->bits[c / 64] |= (uint64_t) 1 << (c % 64);
+		}
+		while (isspace((unsigned char) *end)) {
+			end++;
+		}
+		if (*end == ',') {
+			end++;
+		} else if (*end != '\0') {
+			return NNG_EINVAL;
+		}
+		s = end;
+	}
+	return cpu_list_count(l) > 0 ? 0 : NNG_EINVAL;
+}
+
+size_t
+cpu_list_count(const cpu_list *l)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < NANO_CPU_MAX / 64; i++) {
+		n += __builtin_popcountll(l->bits[i]);
+	}
+	return n;
+}
+
+bool
+cpu_list_has(const cpu_list *l, int cpu)
+{
+	return cpu >= 0 && cpu < NANO_CPU_MAX &&
+	    (l->bits[cpu / 64] & ((uint64_t) 1 << (cpu % 64))) != 0;
+}
+
+#if NANO_PLATFORM_LINUX
+
+static bool
+cpu_read_line(const char *path, char *buf, size_t size)
+{
+	FILE *fp;
+	char *p;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		return false;
+	}
+	p = fgets(buf, size, fp);
+	fclose(fp);
+	if (p == NULL) {
+		return false;
+	}
+	buf[strcspn(buf, "\n")] = '\0';
+	return true;
+}
+
+size_t
+cpu_affinity_numa_nodes(cpu_list *nodes, size_t cap)
+{
+	char   path[64];
+	char   buf[1024];
+	size_t n = 0;
+
+	for (size_t i = 0; i < NANO_NUMA_MAX && n < cap; i++) {
+		snprintf(path, sizeof(path),
+		    "/sys/devices/system/node/node%zu/cpulist", i);
+		if (!cpu_read_line(path, buf, sizeof(buf))) {
+			break;
+		}
+		// memory only nodes have no CPUs
+		if (cpu_list_parse(buf, &nodes[n]) == 0) {
+			n++;
+		}
+	}
+	if (n == 0 && cap > 0 &&
+	    cpu_read_line("/sys/devices/system/cpu/online", buf, sizeof(buf)) &&
+	    cpu_list_parse(buf, &nodes[0]) == 0) {
+		n = 1;
+	}
+	return n;
+}
+
+typedef struct {
+	bool     set;
+	bool     spread; // one node per thread, round robin
+	cpu_list cpus;
+} cpu_rule;
+
+static int
+cpu_rule_parse(const char *s, cpu_rule *r, const cpu_list *nodes, size_t nn)
+{
+	char *end;
+	long  node;
+
+	memset(r, 0, sizeof(*r));
+	if (s == NULL || *s == '\0') {
+		return 0;
+	}
+	r->set = true;
+	if (strcmp(s, "numa") == 0) {
+		r->spread = true;
+		return nn > 0 ? 0 : NNG_EINVAL;
+	}
+	if (strncmp(s, "numa:", 5) == 0) {
+		node = strtol(s + 5, &end, 10);
+		if (end == s + 5 || *end != '\0' || node < 0 ||
+		    (size_t) node >= nn) {
+			return NNG_EINVAL;
+		}
+		r->cpus = nodes[node];
+		return 0;
+	}
+	return cpu_list_parse(s, &r->cpus);
+}
+
+static bool
+cpu_pin(long tid, const cpu_list *l)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	for (int c = 0; c < NANO_CPU_MAX && c < CPU_SETSIZE; c++) {
+		if (cpu_list_has(l, c)) {
+			CPU_SET(c, &set);
+		}
+	}
+	return sched_setaffinity((pid_t) tid, sizeof(set), &set) == 0;
+}
+
+int
+cpu_affinity_apply(size_t *pinned)
+{
+	cpu_list       nodes[NANO_NUMA_MAX];
+	size_t         nn = cpu_affinity_numa_nodes(nodes, NANO_NUMA_MAX);
+	cpu_rule       rules[CPU_GROUPS];
+	size_t         seen[CPU_GROUPS] = { 0 };
+	bool           any = false;
+	DIR           *dir;
+	struct dirent *de;
+	int            rv;
+
+	*pinned = 0;
+	for (int g = 0; g < CPU_GROUPS; g++) {
+		if ((rv = cpu_rule_parse(
+		         getenv(cpu_groups[g].env), &rules[g], nodes, nn)) != 0) {
+			log_error("%s: bad cpu list", cpu_groups[g].env);
+			return rv;
+		}
+		any = any || rules[g].set;
+	}
+	if (!any) {
+		return 0;
+	}
+	if ((dir = opendir("/proc/self/task")) == NULL) {
+		return NNG_ENOENT;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		char path[64];
+		char comm[32];
+		long tid;
+
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		tid = atol(de->d_name);
+		snprintf(path, sizeof(path), "/proc/self/task/%ld/comm", tid);
+		if (!cpu_read_line(path, comm, sizeof(comm))) {
+			continue;
+		}
+		for (int g = 0; g < CPU_GROUPS; g++) {
+			const cpu_list *l;
+			if (!rules[g].set ||
+			    strncmp(comm, cpu_groups[g].comm,
+			        strlen(cpu_groups[g].comm)) != 0) {
+				continue;
+			}
+			l = rules[g].spread ? &nodes[seen[g] % nn] : &rules[g].cpus;
+			seen[g]++;
+			if (cpu_pin(tid, l)) {
+				(*pinned)++;
+			} else {
+				log_warn("pinning thread %ld (%s) failed", tid, comm);
+			}
+			break;
+		}
+	}
+	closedir(dir);
+	log_info("pinned %zu nng threads over %zu NUMA nodes", *pinned, nn);
+	return 0;
+}
+
+#else
+
+size_t
+cpu_affinity_numa_nodes(cpu_list *nodes, size_t cap)
+{
+	(void) nodes;
+	(void) cap;
+	return 0;
+}
+
+int
+cpu_affinity_apply(size_t *pinned)
+{
+	*pinned = 0;
+	for (int g = 0; g < CPU_GROUPS; g++) {
+		if (getenv(cpu_groups[g].env) != NULL) {
+			return NNG_ENOTSUP;
+		}
+	}
+	return 0;
+}
+
+#endif
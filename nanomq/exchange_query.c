@@ -0,0 +1,264 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/exchange_query.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/nanolib/parquet.h"
+#include "nng/supplemental/util/platform.h"
+
+#define QUERY_SUFFIX ".parquet"
+
+typedef struct {
+	char    *path;
+	uint64_t start_key;
+	uint64_t end_key;
+} query_entry;
+
+static struct {
+	conf_parquet *conf;
+	nng_mtx      *mtx;
+	query_entry  *files; // by start_key
+	size_t        count;
+	nng_time      scanned;
+	bool          ready;
+} index_;
+
+static void
+query_entries_free(query_entry *files, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		nng_strfree(files[i].path);
+	}
+	nng_free(files, sizeof(query_entry) * count);
+}
+
+static int
+query_entry_cmp(const void *a, const void *b)
+{
+	const query_entry *ea = a;
+	const query_entry *eb = b;
+
+	if (ea->start_key != eb->start_key) {
+		return ea->start_key < eb->start_key ? -1 : 1;
+	}
+	return ea->end_key < eb->end_key ? -1 : ea->end_key > eb->end_key;
+}
+
+// "<prefix>-<start_key>~<end_key>.parquet"
+static bool
+query_name_parse(const char *name, uint64_t *start_key, uint64_t *end_key)
+{
+	size_t      len = strlen(name);
+	const char *dash;
+	char        tail;
+
+	if (len <= strlen(QUERY_SUFFIX) ||
+	    strcmp(name + len - strlen(QUERY_SUFFIX), QUERY_SUFFIX) != 0 ||
+	    (dash = strrchr(name, '-')) == NULL) {
+		return false;
+	}
+	if (sscanf(dash + 1, "%" SCNu64 "~%" SCNu64 "%c", start_key, end_key,
+	        &tail) != 3 ||
+	    tail != '.') {
+		return false;
+	}
+	return *start_key <= *end_key;
+}
+
+// Rebuild the index when it is stale. Called with index_.mtx held.
+static int
+query_rescan(void)
+{
+	nng_time       now = nng_clock();
+	DIR           *dir;
+	struct dirent *ent;
+	query_entry   *files = NULL;
+	query_entry   *grown;
+	size_t         count = 0;
+	size_t         cap   = 0;
+	uint64_t       start_key;
+	uint64_t       end_key;
+	char          *path;
+
+	if (index_.scanned != 0 &&
+	    now - index_.scanned < NANO_EXCHANGE_QUERY_RESCAN_MS) {
+		return 0;
+	}
+	if ((dir = opendir(index_.conf->dir)) == NULL) {
+		// nothing written yet
+		query_entries_free(index_.files, index_.count);
+		index_.files   = NULL;
+		index_.count   = 0;
+		index_.scanned = now;
+		return 0;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		if (!query_name_parse(ent->d_name, &start_key, &end_key)) {
+			continue;
+		}
+		if (count == cap) {
+			cap   = cap == 0 ? 64 : cap * 2;
+			grown = nng_alloc(sizeof(query_entry) * cap);
+			if (grown == NULL) {
+				break;
+			}
+			if (count > 0) {
+				memcpy(grown, files, sizeof(query_entry) * count);
+			}
+			nng_free(files, sizeof(query_entry) * count);
+			files = grown;
+		}
+		path = nng_alloc(strlen(index_.conf->dir) + strlen(ent->d_name) + 2);
+		if (path == NULL) {
+			break;
+		}
+		sprintf(path, "%s/%s", index_.conf->dir, ent->d_name);
+		files[count].path      = path;
+		files[count].start_key = start_key;
+		files[count].end_key   = end_key;
+		count++;
+	}
+	closedir(dir);
+	if (ent != NULL) {
+		query_entries_free(files, count);
+		return NNG_ENOMEM;
+	}
+	if (count > 1) {
+		qsort(files, count, sizeof(query_entry), query_entry_cmp);
+	}
+	query_entries_free(index_.files, index_.count);
+	index_.files   = files;
+	index_.count   = count;
+	index_.scanned = now;
+	return 0;
+}
+
+// First entry starting after key. Called with index_.mtx held.
+static size_t
+query_upper(uint64_t key)
+{
+	size_t lo = 0;
+	size_t hi = index_.count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (index_.files[mid].start_key <= key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+int
+exchange_query_init(conf_parquet *conf)
+{
+	int rv;
+
+	if (index_.ready || !conf->enable || conf->dir == NULL) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&index_.mtx)) != 0) {
+		return rv;
+	}
+	index_.conf  = conf;
+	index_.ready = true;
+	return 0;
+}
+
+void
+exchange_query_fini(void)
+{
+	if (!index_.ready) {
+		return;
+	}
+	query_entries_free(index_.files, index_.count);
+	nng_mtx_free(index_.mtx);
+	memset(&index_, 0, sizeof(index_));
+}
+
+int
+exchange_query_span(
+    uint64_t start_key, uint64_t end_key, exchange_query_cb cb, void *arg)
+{
+	exchange_query_file file;
+	size_t              upper;
+	int                 visited = 0;
+	int                 rv;
+
+	if (!index_.ready) {
+		return -NNG_ENOTSUP;
+	}
+	if (start_key > end_key) {
+		return -NNG_EINVAL;
+	}
+	nng_mtx_lock(index_.mtx);
+	if ((rv = query_rescan()) != 0) {
+		nng_mtx_unlock(index_.mtx);
+		return -rv;
+	}
+	upper = query_upper(end_key);
+	for (size_t i = 0; i < upper; i++) {
+		query_entry *e = &index_.files[i];
+
+		if (e->end_key < start_key) {
+			continue;
+		}
+		file.path      = e->path;
+		file.start_key = e->start_key;
+		file.end_key   = e->end_key;
+		visited++;
+		if (cb(&file, arg) != 0) {
+			break;
+		}
+	}
+	nng_mtx_unlock(index_.mtx);
+	return visited;
+}
+
+int
+exchange_query_get(uint64_t key, uint8_t **data, uint32_t *len)
+{
+	parquet_data_packet *pack = NULL;
+	size_t               upper;
+	int                  rv;
+
+	if (!index_.ready) {
+		return NNG_ENOTSUP;
+	}
+	nng_mtx_lock(index_.mtx);
+	if ((rv = query_rescan()) != 0) {
+		nng_mtx_unlock(index_.mtx);
+		return rv;
+	}
+	// newest file first, an older one can only hold the key on a rotation
+	upper = query_upper(key);
+	while (upper-- > 0 && pack == NULL) {
+		query_entry *e = &index_.files[upper];
+		if (e->end_key >= key) {
+			pack = parquet_find_data_packet(index_.conf, e->path, key);
+		}
+	}
+	nng_mtx_unlock(index_.mtx);
+
+	if (pack == NULL) {
+		return NNG_ENOENT;
+	}
+	*data = pack->data;
+	*len  = pack->size;
+	nng_free(pack, sizeof(*pack));
+	return 0;
+}
@@ -0,0 +1,342 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/bridge.h"
+#include "include/exchange_recent.h"
+#include "include/webhook_post.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef struct {
+	uint64_t key;
+	uint32_t exchange;
+	uint32_t topic_len;
+	uint32_t len;
+	char     data[]; // topic, its terminator, payload
+} recent_entry;
+
+// Written by its worker only, read by queries.
+typedef struct {
+	nng_mtx       *mtx;
+	recent_entry **slots;
+	size_t         head;
+	size_t         count;
+	uint64_t       evicted; // key of the newest message dropped, 0 if none
+	uint64_t       drops;
+} recent_ring;
+
+static struct {
+	recent_ring    *rings;
+	size_t          num;
+	size_t          cap;
+	uint64_t        window_ms;
+	uint64_t        start_key; // of init, nothing older was kept
+	nng_atomic_u64 *queries;
+	bool            enabled;
+} recent_;
+
+static size_t
+recent_env(const char *name, size_t def)
+{
+	const char *s = getenv(name);
+	char       *end;
+	long long   v;
+
+	if (s == NULL || *s == '\0') {
+		return def;
+	}
+	v = strtoll(s, &end, 10);
+	if (*end != '\0' || v < 0) {
+		log_warn("%s \"%s\" ignored", name, s);
+		return def;
+	}
+	return (size_t) v;
+}
+
+static inline recent_entry *
+ring_at(recent_ring *r, size_t i)
+{
+	return r->slots[(r->head + i) % recent_.cap];
+}
+
+static void
+ring_drop(recent_ring *r)
+{
+	recent_entry *e = r->slots[r->head];
+
+	r->evicted        = e->key;
+	r->slots[r->head] = NULL;
+	r->head           = (r->head + 1) % recent_.cap;
+	r->count--;
+	r->drops++;
+	nng_free(e, sizeof(*e) + e->topic_len + 1 + e->len);
+}
+
+// First position whose key is not below key.
+static size_t
+ring_lower(recent_ring *r, uint64_t key)
+{
+	size_t lo = 0;
+	size_t hi = r->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (ring_at(r, mid)->key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+int
+exchange_recent_init(uint64_t num_ctx)
+{
+	int rv;
+
+	if (recent_.enabled) {
+		return 0;
+	}
+	recent_.cap =
+	    recent_env("NANOMQ_EXCHANGE_RECENT", NANO_EXCHANGE_RECENT_LEN);
+	recent_.window_ms =
+	    recent_env("NANOMQ_EXCHANGE_RECENT_MS", NANO_EXCHANGE_RECENT_MS);
+	if (recent_.cap == 0 || recent_.window_ms == 0 || num_ctx == 0) {
+		return 0;
+	}
+	if ((rv = nng_atomic_alloc64(&recent_.queries)) != 0) {
+		return rv;
+	}
+	recent_.rings = nng_zalloc(sizeof(recent_ring) * num_ctx);
+	if (recent_.rings == NULL) {
+		exchange_recent_fini();
+		return NNG_ENOMEM;
+	}
+	recent_.num = num_ctx;
+	for (size_t i = 0; i < recent_.num; i++) {
+		recent_ring *r = &recent_.rings[i];
+
+		if ((rv = nng_mtx_alloc(&r->mtx)) != 0) {
+			exchange_recent_fini();
+			return rv;
+		}
+		r->slots = nng_zalloc(sizeof(recent_entry *) * recent_.cap);
+		if (r->slots == NULL) {
+			exchange_recent_fini();
+			return NNG_ENOMEM;
+		}
+	}
+	recent_.start_key = NANO_EXCHANGE_KEY_MIN(nng_timestamp());
+	recent_.enabled   = true;
+	log_info("exchange keeps %zu messages per worker for %llu ms",
+	    recent_.cap, (unsigned long long) recent_.window_ms);
+	return 0;
+}
+
+void
+exchange_recent_fini(void)
+{
+	for (size_t i = 0; i < recent_.num; i++) {
+		recent_ring *r = &recent_.rings[i];
+
+		if (r->slots != NULL) {
+			while (r->count > 0) {
+				ring_drop(r);
+			}
+			nng_free(r->slots, sizeof(recent_entry *) * recent_.cap);
+		}
+		if (r->mtx != NULL) {
+			nng_mtx_free(r->mtx);
+		}
+	}
+	nng_free(recent_.rings, sizeof(recent_ring) * recent_.num);
+	if (recent_.queries != NULL) {
+		nng_atomic_free64(recent_.queries);
+	}
+	memset(&recent_, 0, sizeof(recent_));
+}
+
+bool
+exchange_recent_enabled(void)
+{
+	return recent_.enabled;
+}
+
+int
+exchange_recent_put(uint32_t worker, uint64_t key, uint32_t exchange,
+    const char *topic, const uint8_t *payload, size_t len)
+{
+	recent_ring  *r;
+	recent_entry *e;
+	size_t        tlen = strlen(topic);
+	uint64_t      ms   = NANO_EXCHANGE_KEY_MS(key);
+
+	if (!recent_.enabled) {
+		return NNG_ECLOSED;
+	}
+	if (worker >= recent_.num || len > UINT32_MAX || tlen > UINT32_MAX) {
+		return NNG_EINVAL;
+	}
+	if ((e = nng_alloc(sizeof(*e) + tlen + 1 + len)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	e->key       = key;
+	e->exchange  = exchange;
+	e->topic_len = (uint32_t) tlen;
+	e->len       = (uint32_t) len;
+	memcpy(e->data, topic, tlen + 1);
+	if (len > 0) {
+		memcpy(e->data + tlen + 1, payload, len);
+	}
+
+	r = &recent_.rings[worker];
+	nng_mtx_lock(r->mtx);
+	// full, or the oldest fell out of the window
+	while (r->count > 0 &&
+	    (r->count == recent_.cap ||
+	        NANO_EXCHANGE_KEY_MS(ring_at(r, 0)->key) + recent_.window_ms <
+	            ms)) {
+		ring_drop(r);
+	}
+	r->slots[(r->head + r->count) % recent_.cap] = e;
+	r->count++;
+	nng_mtx_unlock(r->mtx);
+	return 0;
+}
+
+uint64_t
+exchange_recent_since(void)
+{
+	uint64_t since = recent_.start_key;
+
+	if (!recent_.enabled) {
+		return UINT64_MAX;
+	}
+	for (size_t i = 0; i < recent_.num; i++) {
+		recent_ring *r = &recent_.rings[i];
+
+		nng_mtx_lock(r->mtx);
+		if (r->drops > 0 && r->evicted + 1 > since) {
+			since = r->evicted + 1;
+		}
+		nng_mtx_unlock(r->mtx);
+	}
+	return since;
+}
+
+static int
+recent_msg_cmp(const void *a, const void *b)
+{
+	const exchange_recent_msg *ma = a;
+	const exchange_recent_msg *mb = b;
+
+	return ma->key < mb->key ? -1 : ma->key > mb->key;
+}
+
+static void
+recent_msg_fini(exchange_recent_msg *m)
+{
+	nng_strfree(m->topic);
+	nng_free(m->payload, m->len);
+}
+
+exchange_recent_msg *
+exchange_recent_query(uint64_t start_key, uint64_t end_key,
+    const char *filter, size_t limit, bool *more)
+{
+	exchange_recent_msg *msgs = NULL;
+
+	*more = false;
+	if (!recent_.enabled || start_key > end_key || limit == 0) {
+		return NULL;
+	}
+	nng_atomic_inc64(recent_.queries);
+	for (size_t w = 0; w < recent_.num; w++) {
+		recent_ring *r     = &recent_.rings[w];
+		size_t       taken = 0;
+
+		nng_mtx_lock(r->mtx);
+		for (size_t i = ring_lower(r, start_key); i < r->count; i++) {
+			recent_entry       *e = ring_at(r, i);
+			exchange_recent_msg m;
+
+			if (e->key > end_key) {
+				break;
+			}
+			if (filter != NULL && !topic_filter(filter, e->data)) {
+				continue;
+			}
+			// the oldest limit of each worker are enough for all
+			if (taken == limit) {
+				*more = true;
+				break;
+			}
+			m.key      = e->key;
+			m.exchange = e->exchange;
+			m.len      = e->len;
+			m.topic    = nng_strdup(e->data);
+			m.payload  = e->len > 0 ? nng_alloc(e->len) : NULL;
+			if (m.topic == NULL || (e->len > 0 && m.payload == NULL)) {
+				recent_msg_fini(&m);
+				*more = true;
+				break;
+			}
+			if (e->len > 0) {
+				memcpy(m.payload, e->data + e->topic_len + 1, e->len);
+			}
+			cvector_push_back(msgs, m);
+			taken++;
+		}
+		nng_mtx_unlock(r->mtx);
+	}
+	if (msgs == NULL) {
+		return NULL;
+	}
+	qsort(msgs, cvector_size(msgs), sizeof(*msgs), recent_msg_cmp);
+	if (cvector_size(msgs) > limit) {
+		for (size_t i = limit; i < cvector_size(msgs); i++) {
+			recent_msg_fini(&msgs[i]);
+		}
+		cvector_set_size(msgs, limit);
+		*more = true;
+	}
+	return msgs;
+}
+
+void
+exchange_recent_free(exchange_recent_msg *msgs)
+{
+	for (size_t i = 0; i < cvector_size(msgs); i++) {
+		recent_msg_fini(&msgs[i]);
+	}
+	cvector_free(msgs);
+}
+
+void
+exchange_recent_stat(exchange_recent_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	for (size_t i = 0; i < recent_.num; i++) {
+		recent_ring *r = &recent_.rings[i];
+
+		nng_mtx_lock(r->mtx);
+		stats->held += r->count;
+		stats->evicted += r->drops;
+		nng_mtx_unlock(r->mtx);
+	}
+	if (recent_.queries != NULL) {
+		stats->queries = nng_atomic_get64(recent_.queries);
+	}
+}
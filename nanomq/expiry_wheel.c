@@ -0,0 +1,318 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/expiry_wheel.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+#define WHEEL_MASK (EXPIRY_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN ((uint64_t) 1 << (EXPIRY_WHEEL_BITS * EXPIRY_WHEEL_LEVELS))
+
+static struct {
+	nng_mtx      *mtx;
+	nng_cv       *cv;
+	nng_thread   *thr;
+	nng_duration  tick_ms;
+	uint64_t      now; // last tick processed
+	expiry_timer *slots[EXPIRY_WHEEL_LEVELS][EXPIRY_WHEEL_SLOTS];
+	size_t        levels[EXPIRY_WHEEL_LEVELS]; // timers on each level
+	size_t        count;
+	uint64_t      fired;
+	bool          closing;
+	bool          enabled;
+} wheel_;
+
+static void
+wheel_link(expiry_timer **head, expiry_timer *t)
+{
+	if ((t->next = *head) != NULL) {
+		t->next->pprev = &t->next;
+	}
+	*head    = t;
+	t->pprev = head;
+}
+
+static void
+wheel_unlink(expiry_timer *t)
+{
+	wheel_.levels[t->level]--;
+	if (t->next != NULL) {
+		t->next->pprev = t->pprev;
+	}
+	*t->pprev = t->next;
+	t->next   = NULL;
+	t->pprev  = NULL;
+}
+
+// The lowest level whose span still reaches t->tick. A timer is always
+// visited at or before its tick, when its slot comes round or cascades.
+static void
+wheel_place(expiry_timer *t)
+{
+	uint64_t tick  = t->tick;
+	uint64_t delta = tick > wheel_.now ? tick - wheel_.now : 0;
+	int      level;
+
+	if (delta >= WHEEL_SPAN) {
+		// placed again on each pass of the top level until in reach
+		tick  = wheel_.now + WHEEL_SPAN - 1;
+		delta = WHEEL_SPAN - 1;
+	}
+	for (level = 0; level < EXPIRY_WHEEL_LEVELS - 1; level++) {
+		if (delta < ((uint64_t) 1 << (EXPIRY_WHEEL_BITS * (level + 1)))) {
+			break;
+		}
+	}
+	t->level = level;
+	wheel_.levels[level]++;
+	wheel_link(&wheel_.slots[level][(tick >> (EXPIRY_WHEEL_BITS * level)) &
+	               WHEEL_MASK],
+	    t);
+}
+
+static void
+wheel_cascade(int level)
+{
+	expiry_timer **slot =
+	    &wheel_.slots[level]
+	                 [(wheel_.now >> (EXPIRY_WHEEL_BITS * level)) & WHEEL_MASK];
+	expiry_timer *t;
+
+	while ((t = *slot) != NULL) {
+		wheel_unlink(t);
+		wheel_place(t);
+	}
+}
+
+// Moves the wheel to tick and returns what became due, unlinked.
+static expiry_timer *
+wheel_turn(uint64_t tick)
+{
+	expiry_timer  *due  = NULL;
+	expiry_timer **tail = &due;
+
+	while (wheel_.now < tick) {
+		expiry_timer **slot;
+		expiry_timer  *t;
+		int            skip = 0;
+
+		if (wheel_.count == 0) {
+			wheel_.now = tick;
+			break;
+		}
+		// nothing below level skip, so on to its next boundary
+		while (
+		    skip < EXPIRY_WHEEL_LEVELS - 1 && wheel_.levels[skip] == 0) {
+			skip++;
+		}
+		if (skip > 0) {
+			uint64_t next = wheel_.now |
+			    (((uint64_t) 1 << (EXPIRY_WHEEL_BITS * skip)) - 1);
+			if ((wheel_.now = next < tick ? next : tick) == tick) {
+				break;
+			}
+		}
+		wheel_.now++;
+		// higher levels first, what comes down may land in this tick
+		for (int level = EXPIRY_WHEEL_LEVELS - 1; level > 0; level--) {
+			uint64_t low =
+			    ((uint64_t) 1 << (EXPIRY_WHEEL_BITS * level)) - 1;
+			if ((wheel_.now & low) == 0) {
+				wheel_cascade(level);
+			}
+		}
+		slot = &wheel_.slots[0][wheel_.now & WHEEL_MASK];
+		while ((t = *slot) != NULL) {
+			wheel_unlink(t);
+			wheel_.count--;
+			wheel_.fired++;
+			*tail = t;
+			tail  = &t->next;
+		}
+	}
+	return due;
+}
+
+size_t
+expiry_wheel_advance(nng_time now)
+{
+	expiry_timer *due;
+	size_t        n = 0;
+
+	if (!wheel_.enabled) {
+		return 0;
+	}
+	nng_mtx_lock(wheel_.mtx);
+	due = wheel_turn(now / wheel_.tick_ms);
+	nng_mtx_unlock(wheel_.mtx);
+	while (due != NULL) {
+		expiry_timer *t = due;
+		due             = t->next;
+		t->next         = NULL;
+		t->cb(t->arg);
+		n++;
+	}
+	return n;
+}
+
+static void
+wheel_thread_main(void *arg)
+{
+	(void) arg;
+	nng_mtx_lock(wheel_.mtx);
+	while (!wheel_.closing) {
+		nng_time until = nng_clock() + wheel_.tick_ms;
+
+		while (!wheel_.closing && nng_clock() < until) {
+			nng_cv_until(wheel_.cv, until);
+		}
+		if (wheel_.closing) {
+			break;
+		}
+		nng_mtx_unlock(wheel_.mtx);
+		expiry_wheel_advance(nng_clock());
+		nng_mtx_lock(wheel_.mtx);
+	}
+	nng_mtx_unlock(wheel_.mtx);
+}
+
+int
+expiry_wheel_init(nng_duration tick)
+{
+	int rv;
+
+	if (wheel_.enabled) {
+		return 0;
+	}
+	if (tick <= 0) {
+		return NNG_EINVAL;
+	}
+	if ((rv = nng_mtx_alloc(&wheel_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&wheel_.cv, wheel_.mtx)) != 0) {
+		expiry_wheel_fini();
+		return rv;
+	}
+	wheel_.tick_ms = tick;
+	wheel_.now     = nng_clock() / tick;
+	wheel_.enabled = true;
+	if ((rv = nng_thread_create(&wheel_.thr, wheel_thread_main, NULL)) !=
+	    0) {
+		wheel_.thr = NULL;
+		expiry_wheel_fini();
+		return rv;
+	}
+	return 0;
+}
+
+// Timers still scheduled are forgotten without their callbacks, whoever
+// embeds them is torn down as well.
+void
+expiry_wheel_fini(void)
+{
+	if (wheel_.thr != NULL) {
+		nng_mtx_lock(wheel_.mtx);
+		wheel_.closing = true;
+		nng_cv_wake(wheel_.cv);
+		nng_mtx_unlock(wheel_.mtx);
+		nng_thread_destroy(wheel_.thr);
+	}
+	for (int l = 0; l < EXPIRY_WHEEL_LEVELS; l++) {
+		for (int s = 0; s < EXPIRY_WHEEL_SLOTS; s++) {
+			expiry_timer *t;
+			while ((t = wheel_.slots[l][s]) != NULL) {
+				wheel_unlink(t);
+			}
+		}
+	}
+	if (wheel_.cv != NULL) {
+		nng_cv_free(wheel_.cv);
+	}
+	if (wheel_.mtx != NULL) {
+		nng_mtx_free(wheel_.mtx);
+	}
+	memset(&wheel_, 0, sizeof(wheel_));
+}
+
+bool
+expiry_wheel_enabled(void)
+{
+	return wheel_.enabled;
+}
+
+int
+expiry_wheel_add(
+    expiry_timer *t, nng_time deadline, expiry_wheel_cb cb, void *arg)
+{
+	if (!wheel_.enabled) {
+		return NNG_ECLOSED;
+	}
+	t->cb  = cb;
+	t->arg = arg;
+	nng_mtx_lock(wheel_.mtx);
+	if (t->pprev != NULL) {
+		nng_mtx_unlock(wheel_.mtx);
+		return NNG_EBUSY;
+	}
+	// rounded up, a timer never fires before its deadline
+	t->tick = (deadline + wheel_.tick_ms - 1) / wheel_.tick_ms;
+	if (t->tick <= wheel_.now) {
+		t->tick = wheel_.now + 1;
+	}
+	wheel_place(t);
+	wheel_.count++;
+	nng_mtx_unlock(wheel_.mtx);
+	return 0;
+}
+
+bool
+expiry_wheel_cancel(expiry_timer *t)
+{
+	if (!wheel_.enabled) {
+		return false;
+	}
+	nng_mtx_lock(wheel_.mtx);
+	if (t->pprev == NULL) {
+		nng_mtx_unlock(wheel_.mtx);
+		return false;
+	}
+	wheel_unlink(t);
+	wheel_.count--;
+	nng_mtx_unlock(wheel_.mtx);
+	return true;
+}
+
+size_t
+expiry_wheel_count(void)
+{
+	size_t n;
+
+	if (!wheel_.enabled) {
+		return 0;
+	}
+	nng_mtx_lock(wheel_.mtx);
+	n = wheel_.count;
+	nng_mtx_unlock(wheel_.mtx);
+	return n;
+}
+
+uint64_t
+expiry_wheel_fired(void)
+{
+	uint64_t n;
+
+	if (!wheel_.enabled) {
+		return 0;
+	}
+	nng_mtx_lock(wheel_.mtx);
+	n = wheel_.fired;
+	nng_mtx_unlock(wheel_.mtx);
+	return n;
+}
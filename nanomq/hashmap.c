@@ -1,6 +1,5 @@
 #include "include/broker.h"
-
-static nng_mtx *hashmap_mtx = NULL;
+#include "include/profiler.h"
 
 /// @brief Create a hashmap.
 /// @param initial_size The initial size of the hashmap. Must be a power of two.
@@ -10,7 +9,7 @@ static nng_mtx *hashmap_mtx = NULL;
 /// Note that the initial size of the hashmap must be a power of two, and
 /// creation of the hashmap will fail if this is not the case.
 static int hashmap_create(const unsigned initial_size,
-                          struct hashmap_s *const out_hashmap) HASHMAP_USED;
+                          struct hashmap_table_s *const out_hashmap) HASHMAP_USED;
 
 /// @brief Put an element into the hashmap.
 /// @param hashmap The hashmap to insert into.
@@ -22,26 +21,27 @@ static int hashmap_create(const unsigned initial_size,
 /// The key string slice is not copied when creating the hashmap entry, and thus
 /// must remain a valid pointer until the hashmap entry is removed or the
 /// hashmap is destroyed.
-static int hashmap_put(struct hashmap_s *const hashmap, const char *const key,
-                       const unsigned len, uint32_t value) HASHMAP_USED;
+static int hashmap_put(struct hashmap_table_s *const hashmap, const char *const key,
+                       const unsigned len, const unsigned crc,
+                       uint32_t value) HASHMAP_USED;
 
 /// @brief Get an element from the hashmap.
 /// @param hashmap The hashmap to get from.
 /// @param key The string key to use.
 /// @param len The length of the string key.
 /// @return The previously set element, or 0 if none exists.
-static uint32_t hashmap_get(const struct hashmap_s *const hashmap,
+static uint32_t hashmap_get(const struct hashmap_table_s *const hashmap,
                          const char *const key,
-                         const unsigned len) HASHMAP_USED;
+                         const unsigned len, const unsigned crc) HASHMAP_USED;
 
 /// @brief Remove an element from the hashmap.
 /// @param hashmap The hashmap to remove from.
 /// @param key The string key to use.
 /// @param len The length of the string key.
 /// @return On success 0 is returned.
-static int hashmap_remove(struct hashmap_s *const hashmap,
+static int hashmap_remove(struct hashmap_table_s *const hashmap,
                           const char *const key,
-                          const unsigned len) HASHMAP_USED;
+                          const unsigned len, const unsigned crc) HASHMAP_USED;
 
 /// @brief Iterate over all the elements in a hashmap.
 /// @param hashmap The hashmap to iterate over.
@@ -51,7 +51,7 @@ static int hashmap_remove(struct hashmap_s *const hashmap,
 /// Otherwise if the callback function f returned positive then the positive
 /// value is returned.  If the callback function returns -1, the current item
 /// is removed and iteration continues.
-static int hashmap_iterate_pairs(struct hashmap_s *const hashmap,
+static int hashmap_iterate_pairs(struct hashmap_table_s *const hashmap,
                                  int (*f)(void *const,
                                           struct hashmap_element_s *const),
                                  void *const context) HASHMAP_USED;
@@ -60,47 +60,132 @@ static int hashmap_iterate_pairs(struct hashmap_s *const hashmap,
 /// @param hashmap The hashmap to get the size of.
 /// @return The size of the hashmap.
 static unsigned
-hashmap_num_entries(const struct hashmap_s *const hashmap) HASHMAP_USED;
+hashmap_num_entries(const struct hashmap_table_s *const hashmap) HASHMAP_USED;
 
 /// @brief Destroy the hashmap.
 /// @param hashmap The hashmap to destroy.
-static void hashmap_destroy(struct hashmap_s *const hashmap) HASHMAP_USED;
+static void hashmap_destroy(struct hashmap_table_s *const hashmap) HASHMAP_USED;
 
 static unsigned hashmap_crc32_helper(const char *const s,
                                      const unsigned len) HASHMAP_USED;
-static unsigned hashmap_hash_helper_int_helper(const struct hashmap_s *const m,
-                                               const char *const keystring,
-                                               const unsigned len) HASHMAP_USED;
+static unsigned hashmap_hash_helper_int_helper(const struct hashmap_table_s *const m,
+                                               const unsigned crc) HASHMAP_USED;
 static int hashmap_match_helper(const struct hashmap_element_s *const element,
                                 const char *const key,
                                 const unsigned len) HASHMAP_USED;
-static int hashmap_hash_helper(const struct hashmap_s *const m,
+static int hashmap_hash_helper(const struct hashmap_table_s *const m,
                                const char *const key, const unsigned len,
+                               const unsigned crc,
                                unsigned *const out_index) HASHMAP_USED;
 static int
 hashmap_rehash_iterator(void *const new_hash,
                         struct hashmap_element_s *const e) HASHMAP_USED;
-static int hashmap_rehash_helper(struct hashmap_s *const m) HASHMAP_USED;
+static int hashmap_rehash_helper(struct hashmap_table_s *const m) HASHMAP_USED;
 
 #define HASHMAP_CAST(type, x) ((type)x)
 #define HASHMAP_PTR_CAST(type, x) ((type)x)
 #define HASHMAP_NULL 0
 
+static struct hashmap_stripe_s *
+hashmap_stripe(struct hashmap_s *const m, const unsigned crc)
+{
+	return &m->stripes[crc & (HASHMAP_STRIPES - 1)];
+}
+
+// Move up to n elements of the old table into the current one.
+static int
+hashmap_migrate(struct hashmap_stripe_s *const s, unsigned n)
+{
+	struct hashmap_element_s *e;
+
+	for (; n > 0 && s->migrate < s->old.table_size; s->migrate++) {
+		e = &s->old.data[s->migrate];
+		if (!e->in_use) {
+			continue;
+		}
+		if (hashmap_put(&s->cur, e->key, e->key_len, e->crc, e->data) !=
+		    0) {
+			return 1;
+		}
+		memset(e, 0, sizeof(*e));
+		s->old.size--;
+		n--;
+	}
+	if (s->old.data != NULL && s->migrate == s->old.table_size) {
+		hashmap_destroy(&s->old);
+		s->migrate = 0;
+	}
+	return 0;
+}
+
+static int
+hashmap_stripe_put(struct hashmap_stripe_s *const s, const char *const key,
+    const unsigned len, const unsigned crc, uint32_t value)
+{
+	struct hashmap_table_s next;
+	unsigned               index;
+
+	if (hashmap_migrate(s, HASHMAP_MIGRATE_STEP) != 0) {
+		return 1;
+	}
+	if (s->old.data != NULL) {
+		// the key only lives in the current table from now on
+		hashmap_remove(&s->old, key, len, crc);
+	}
+	if (hashmap_hash_helper(&s->cur, key, len, crc, &index)) {
+		struct hashmap_element_s *e = &s->cur.data[index];
+		if (!e->in_use) {
+			e->in_use = 1;
+			s->cur.size++;
+		}
+		e->key     = key;
+		e->key_len = len;
+		e->crc     = crc;
+		e->data    = value;
+		return 0;
+	}
+	// no room in the probe chain, move to a table twice the size
+	if (hashmap_migrate(s, s->old.table_size) != 0 ||
+	    hashmap_create(2 * s->cur.table_size, &next) != 0) {
+		return 1;
+	}
+	s->old     = s->cur;
+	s->cur     = next;
+	s->migrate = 0;
+	return hashmap_put(&s->cur, key, len, crc, value);
+}
+
 int
 nano_hashmap_create(
     const unsigned initial_size, struct hashmap_s *const out_hashmap)
 {
-	nng_mtx_alloc(&hashmap_mtx);
-	return hashmap_create(initial_size, out_hashmap);
+	unsigned size = initial_size / HASHMAP_STRIPES;
+
+	if (0 == initial_size || 0 != (initial_size & (initial_size - 1))) {
+		return 1;
+	}
+	memset(out_hashmap, 0, sizeof(*out_hashmap));
+	for (unsigned i = 0; i < HASHMAP_STRIPES; i++) {
+		struct hashmap_stripe_s *s = &out_hashmap->stripes[i];
+		if (nng_mtx_alloc(&s->mtx) != 0 ||
+		    hashmap_create(size > 0 ? size : 1, &s->cur) != 0) {
+			nano_hashmap_destroy(out_hashmap);
+			return 1;
+		}
+	}
+	return 0;
 }
 
 int
 nano_hashmap_put(struct hashmap_s *const hashmap, const char *const key,
     const unsigned len, uint32_t value)
 {
-	nng_mtx_lock(hashmap_mtx);
-	int ret = hashmap_put(hashmap, key, len, value);
-	nng_mtx_unlock(hashmap_mtx);
+	unsigned                 crc = hashmap_crc32_helper(key, len);
+	struct hashmap_stripe_s *s   = hashmap_stripe(hashmap, crc);
+
+	PROF_LOCK(PROF_LOCK_HASHMAP, s->mtx);
+	int ret = hashmap_stripe_put(s, key, len, crc, value);
+	nng_mtx_unlock(s->mtx);
 	return ret;
 }
 
@@ -108,9 +193,16 @@ uint32_t
 nano_hashmap_get(const struct hashmap_s *const hashmap, const char *const key,
     const unsigned len)
 {
-	nng_mtx_lock(hashmap_mtx);
-	uint32_t ret = hashmap_get(hashmap, key, len);
-	nng_mtx_unlock(hashmap_mtx);
+	unsigned                 crc = hashmap_crc32_helper(key, len);
+	struct hashmap_stripe_s *s =
+	    hashmap_stripe((struct hashmap_s *) hashmap, crc);
+
+	PROF_LOCK(PROF_LOCK_HASHMAP, s->mtx);
+	uint32_t ret = hashmap_get(&s->cur, key, len, crc);
+	if (ret == HASHMAP_NULL && s->old.data != NULL) {
+		ret = hashmap_get(&s->old, key, len, crc);
+	}
+	nng_mtx_unlock(s->mtx);
 	return ret;
 }
 
@@ -118,22 +210,50 @@ int
 nano_hashmap_remove(
     struct hashmap_s *const m, const char *const key, const unsigned len)
 {
-	nng_mtx_lock(hashmap_mtx);
-	int ret = hashmap_remove(m, key, len);
-	nng_mtx_unlock(hashmap_mtx);
+	unsigned                 crc = hashmap_crc32_helper(key, len);
+	struct hashmap_stripe_s *s   = hashmap_stripe(m, crc);
+
+	PROF_LOCK(PROF_LOCK_HASHMAP, s->mtx);
+	int ret = hashmap_remove(&s->cur, key, len, crc);
+	if (ret != 0 && s->old.data != NULL) {
+		ret = hashmap_remove(&s->old, key, len, crc);
+	}
+	hashmap_migrate(s, HASHMAP_MIGRATE_STEP);
+	nng_mtx_unlock(s->mtx);
 	return ret;
 }
 
 void
 nano_hashmap_destroy(struct hashmap_s *const m)
 {
-	nng_mtx_free(hashmap_mtx);
-	hashmap_destroy(m);
+	for (unsigned i = 0; i < HASHMAP_STRIPES; i++) {
+		struct hashmap_stripe_s *s = &m->stripes[i];
+		if (s->mtx != NULL) {
+			nng_mtx_free(s->mtx);
+		}
+		hashmap_destroy(&s->cur);
+		hashmap_destroy(&s->old);
+	}
+	memset(m, 0, sizeof(*m));
+}
+
+unsigned
+nano_hashmap_num_entries(struct hashmap_s *const m)
+{
+	unsigned n = 0;
+
+	for (unsigned i = 0; i < HASHMAP_STRIPES; i++) {
+		struct hashmap_stripe_s *s = &m->stripes[i];
+		nng_mtx_lock(s->mtx);
+		n += hashmap_num_entries(&s->cur) + hashmap_num_entries(&s->old);
+		nng_mtx_unlock(s->mtx);
+	}
+	return n;
 }
 
 int
 hashmap_create(
-    const unsigned initial_size, struct hashmap_s *const out_hashmap)
+    const unsigned initial_size, struct hashmap_table_s *const out_hashmap)
 {
 	out_hashmap->table_size = initial_size;
 	out_hashmap->size       = 0;
@@ -150,12 +270,12 @@ hashmap_create(
 	return 0;
 }
 
-int hashmap_put(struct hashmap_s *const m, const char *const key,
-                const unsigned len, uint32_t value) {
+int hashmap_put(struct hashmap_table_s *const m, const char *const key,
+                const unsigned len, const unsigned crc, uint32_t value) {
   unsigned int index;
 
   /* Find a place to put our value. */
-  while (!hashmap_hash_helper(m, key, len, &index)) {
+  while (!hashmap_hash_helper(m, key, len, crc, &index)) {
     if (hashmap_rehash_helper(m)) {
       return 1;
     }
@@ -165,6 +285,7 @@ int hashmap_put(struct hashmap_s *const m, const char *const key,
   m->data[index].data = value;
   m->data[index].key = key;
   m->data[index].key_len = len;
+  m->data[index].crc = crc;
 
   /* If the hashmap element was not already in use, set that it is being used
    * and bump our size. */
@@ -176,13 +297,13 @@ int hashmap_put(struct hashmap_s *const m, const char *const key,
   return 0;
 }
 
-uint32_t hashmap_get(const struct hashmap_s *const m, const char *const key,
-                  const unsigned len) {
+uint32_t hashmap_get(const struct hashmap_table_s *const m, const char *const key,
+                  const unsigned len, const unsigned crc) {
   unsigned int curr;
   unsigned int i;
 
   /* Find data location */
-  curr = hashmap_hash_helper_int_helper(m, key, len);
+  curr = hashmap_hash_helper_int_helper(m, crc);
 
   /* Linear probing, if necessary */
   for (i = 0; i < HASHMAP_MAX_CHAIN_LENGTH; i++) {
@@ -199,13 +320,13 @@ uint32_t hashmap_get(const struct hashmap_s *const m, const char *const key,
   return HASHMAP_NULL;
 }
 
-int hashmap_remove(struct hashmap_s *const m, const char *const key,
-                   const unsigned len) {
+int hashmap_remove(struct hashmap_table_s *const m, const char *const key,
+                   const unsigned len, const unsigned crc) {
   unsigned int i;
   unsigned int curr;
 
   /* Find key */
-  curr = hashmap_hash_helper_int_helper(m, key, len);
+  curr = hashmap_hash_helper_int_helper(m, crc);
 
   /* Linear probing, if necessary */
   for (i = 0; i < HASHMAP_MAX_CHAIN_LENGTH; i++) {
@@ -227,7 +348,7 @@ int hashmap_remove(struct hashmap_s *const m, const char *const key,
   return 1;
 }
 
-int hashmap_iterate_pairs(struct hashmap_s *const hashmap,
+int hashmap_iterate_pairs(struct hashmap_table_s *const hashmap,
                           int (*f)(void *const,
                                    struct hashmap_element_s *const),
                           void *const context) {
@@ -256,12 +377,12 @@ int hashmap_iterate_pairs(struct hashmap_s *const hashmap,
   return 0;
 }
 
-void hashmap_destroy(struct hashmap_s *const m) {
+void hashmap_destroy(struct hashmap_table_s *const m) {
   free(m->data);
-  memset(m, 0, sizeof(struct hashmap_s));
+  memset(m, 0, sizeof(struct hashmap_table_s));
 }
 
-unsigned hashmap_num_entries(const struct hashmap_s *const m) {
+unsigned hashmap_num_entries(const struct hashmap_table_s *const m) {
   return m->size;
 }
 
@@ -340,10 +461,9 @@ unsigned hashmap_crc32_helper(const char *const s, const unsigned len) {
 #endif
 }
 
-unsigned hashmap_hash_helper_int_helper(const struct hashmap_s *const m,
-                                        const char *const keystring,
-                                        const unsigned len) {
-  unsigned key = hashmap_crc32_helper(keystring, len);
+unsigned hashmap_hash_helper_int_helper(const struct hashmap_table_s *const m,
+                                        const unsigned crc) {
+  unsigned key = crc;
 
   /* Robert Jenkins' 32 bit Mix Function */
   key += (key << 12);
@@ -366,8 +486,9 @@ int hashmap_match_helper(const struct hashmap_element_s *const element,
   return (element->key_len == len) && (0 == memcmp(element->key, key, len));
 }
 
-int hashmap_hash_helper(const struct hashmap_s *const m, const char *const key,
-                        const unsigned len, unsigned *const out_index) {
+int hashmap_hash_helper(const struct hashmap_table_s *const m, const char *const key,
+                        const unsigned len, const unsigned crc,
+                        unsigned *const out_index) {
   unsigned int start, curr;
   unsigned int i;
   int total_in_use;
@@ -378,7 +499,7 @@ int hashmap_hash_helper(const struct hashmap_s *const m, const char *const key,
   }
 
   /* Find the best index */
-  curr = start = hashmap_hash_helper_int_helper(m, key, len);
+  curr = start = hashmap_hash_helper_int_helper(m, crc);
 
   /* First linear probe to check if we've already insert the element */
   total_in_use = 0;
@@ -416,8 +537,8 @@ int hashmap_hash_helper(const struct hashmap_s *const m, const char *const key,
 
 int hashmap_rehash_iterator(void *const new_hash,
                             struct hashmap_element_s *const e) {
-  int temp = hashmap_put(HASHMAP_PTR_CAST(struct hashmap_s *, new_hash), e->key,
-                         e->key_len, e->data);
+  int temp = hashmap_put(HASHMAP_PTR_CAST(struct hashmap_table_s *, new_hash), e->key,
+                         e->key_len, e->crc, e->data);
   if (0 < temp) {
     return 1;
   }
@@ -427,11 +548,11 @@ int hashmap_rehash_iterator(void *const new_hash,
 /*
  * Doubles the size of the hashmap, and rehashes all the elements
  */
-int hashmap_rehash_helper(struct hashmap_s *const m) {
+int hashmap_rehash_helper(struct hashmap_table_s *const m) {
   /* If this multiplication overflows hashmap_create will fail. */
   unsigned new_size = 2 * m->table_size;
 
-  struct hashmap_s new_hash;
+  struct hashmap_table_s new_hash;
 
   int flag = hashmap_create(new_size, &new_hash);
 
@@ -449,7 +570,7 @@ int hashmap_rehash_helper(struct hashmap_s *const m) {
 
   hashmap_destroy(m);
   /* put new hash into old hash structure by copying */
-  memcpy(m, &new_hash, sizeof(struct hashmap_s));
+  memcpy(m, &new_hash, sizeof(struct hashmap_table_s));
 
   return 0;
 }
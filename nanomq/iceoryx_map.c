@@ -0,0 +1,374 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/iceoryx_map.h"
+#include "include/mqtt_api.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef struct {
+	iceoryx_map_entry *entry;
+	nng_iceoryx_puber *puber;
+	nng_mtx           *mtx;
+	nng_aio           *aio;
+	nng_msg           *queue[NANO_ICEORYX_QUEUE_LEN];
+	size_t             head;
+	size_t             len;
+	bool               busy; // aio has a chunk out
+	uint64_t           sent;
+	uint64_t           dropped;
+	uint64_t           failed;
+} icemap_pub;
+
+static struct {
+	nng_socket         sock;
+	iceoryx_map_conf   conf;
+	icemap_pub         pubs[NANO_ICEORYX_MAPS];
+	size_t             npubs;
+	void              *subers[NANO_ICEORYX_MAPS];
+	size_t             nsubers;
+	topic_filter_set  *set; // ids index pubs
+	bool               enabled;
+} icemap_;
+
+static char *
+icemap_strndup(const char *s, size_t n)
+{
+	char *d;
+
+	if ((d = nng_alloc(n + 1)) != NULL) {
+		memcpy(d, s, n);
+		d[n] = '\0';
+	}
+	return d;
+}
+
+static void
+icemap_entry_free(iceoryx_map_entry *e)
+{
+	nng_strfree(e->filter);
+	nng_strfree(e->service);
+	nng_strfree(e->instance);
+	nng_strfree(e->event);
+	memset(e, 0, sizeof(*e));
+}
+
+// "<service>/<instance>/<event>" of len bytes, the event may hold '/'.
+static int
+icemap_endpoint(const char *s, size_t len, iceoryx_map_entry *e)
+{
+	const char *end = s + len;
+	const char *a   = memchr(s, '/', len);
+	const char *b;
+
+	if (a == NULL || a == s || (b = memchr(a + 1, '/', end - a - 1)) ==
+	        NULL || b == a + 1 || b + 1 == end) {
+		return NNG_EINVAL;
+	}
+	e->service  = icemap_strndup(s, a - s);
+	e->instance = icemap_strndup(a + 1, b - a - 1);
+	e->event    = icemap_strndup(b + 1, end - b - 1);
+	if (e->service == NULL || e->instance == NULL || e->event == NULL) {
+		return NNG_ENOMEM;
+	}
+	return 0;
+}
+
+static int
+icemap_entry_parse(const char *s, size_t len, iceoryx_map_entry *e)
+{
+	const char *eq;
+
+	memset(e, 0, sizeof(*e));
+	if (len > 3 && strncmp(s, "in:", 3) == 0) {
+		e->in = true;
+		return icemap_endpoint(s + 3, len - 3, e);
+	}
+	if (len < 4 || strncmp(s, "out:", 4) != 0) {
+		return NNG_EINVAL;
+	}
+	s += 4;
+	len -= 4;
+	if ((eq = memchr(s, '=', len)) == NULL || eq == s) {
+		return NNG_EINVAL;
+	}
+	if ((e->filter = icemap_strndup(s, eq - s)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	return icemap_endpoint(eq + 1, s + len - eq - 1, e);
+}
+
+int
+iceoryx_map_parse(const char *spec, iceoryx_map_conf *c)
+{
+	const char *s = spec;
+	int         rv;
+
+	memset(c, 0, sizeof(*c));
+	while (s != NULL && *s != '\0') {
+		const char *semi = strchr(s, ';');
+		size_t      len  = semi != NULL ? (size_t) (semi - s) : strlen(s);
+
+		if (len > 0) {
+			if (c->count == NANO_ICEORYX_MAPS) {
+				iceoryx_map_conf_free(c);
+				return NNG_ENOSPC;
+			}
+			rv = icemap_entry_parse(s, len, &c->entries[c->count]);
+			if (rv != 0) {
+				icemap_entry_free(&c->entries[c->count]);
+				iceoryx_map_conf_free(c);
+				return rv;
+			}
+			c->count++;
+		}
+		s = semi != NULL ? semi + 1 : NULL;
+	}
+	return 0;
+}
+
+int
+iceoryx_map_conf_env(iceoryx_map_conf *c)
+{
+	const char *s = getenv("NANOMQ_ICEORYX_MAP");
+	int         rv;
+
+	if (s == NULL || *s == '\0') {
+		return iceoryx_map_parse(NANO_ICEORYX_MAP_DEFAULT, c);
+	}
+	if ((rv = iceoryx_map_parse(s, c)) != 0) {
+		log_warn("NANOMQ_ICEORYX_MAP \"%s\" ignored: %d", s, rv);
+		return iceoryx_map_parse(NANO_ICEORYX_MAP_DEFAULT, c);
+	}
+	return 0;
+}
+
+void
+iceoryx_map_conf_free(iceoryx_map_conf *c)
+{
+	for (size_t i = 0; i < c->count; i++) {
+		icemap_entry_free(&c->entries[i]);
+	}
+	c->count = 0;
+}
+
+// Caller holds p->mtx and a chunk is queued.
+static nng_msg *
+icemap_pop(icemap_pub *p)
+{
+	nng_msg *icemsg = p->queue[p->head];
+
+	p->head = (p->head + 1) % NANO_ICEORYX_QUEUE_LEN;
+	p->len--;
+	return icemsg;
+}
+
+// Only the one that set p->busy sends, outside p->mtx.
+static void
+icemap_send(icemap_pub *p, nng_msg *icemsg)
+{
+	nng_aio_set_prov_data(p->aio, p->puber);
+	nng_aio_set_msg(p->aio, icemsg);
+	nng_send_aio(icemap_.sock, p->aio);
+}
+
+static void
+icemap_send_cb(void *arg)
+{
+	icemap_pub *p      = arg;
+	nng_msg    *icemsg = NULL;
+	int         rv;
+
+	nng_mtx_lock(p->mtx);
+	if ((rv = nng_aio_result(p->aio)) != 0) {
+		p->failed++;
+		log_error("iceoryx send to %s failed %d", p->entry->event, rv);
+	} else {
+		p->sent++;
+	}
+	if (p->len > 0 && icemap_.enabled) {
+		icemsg = icemap_pop(p);
+	} else {
+		p->busy = false;
+	}
+	nng_mtx_unlock(p->mtx);
+	if (icemsg != NULL) {
+		icemap_send(p, icemsg);
+	}
+}
+
+static int
+icemap_pub_open(icemap_pub *p, iceoryx_map_entry *e, size_t id)
+{
+	char name[64];
+	int  rv;
+
+	p->entry = e;
+	snprintf(name, sizeof(name), "NanoMQ-Iceoryx-Puber-%zu", id);
+	if ((rv = nng_mtx_alloc(&p->mtx)) != 0 ||
+	    (rv = nng_aio_alloc(&p->aio, icemap_send_cb, p)) != 0) {
+		return rv;
+	}
+	return nng_iceoryx_pub(&icemap_.sock, name, e->service, e->instance,
+	    e->event, &p->puber);
+}
+
+int
+iceoryx_map_init(nng_socket sock, iceoryx_map_conf *c)
+{
+	char name[64];
+	int  rv;
+
+	if (icemap_.enabled) {
+		return NNG_EBUSY;
+	}
+	icemap_.sock = sock;
+	icemap_.conf = *c;
+	memset(c, 0, sizeof(*c));
+	if ((rv = topic_filter_set_alloc(&icemap_.set)) != 0) {
+		goto fail;
+	}
+	for (size_t i = 0; i < icemap_.conf.count; i++) {
+		iceoryx_map_entry *e = &icemap_.conf.entries[i];
+
+		if (e->in) {
+			nng_iceoryx_suber *suber;
+
+			snprintf(name, sizeof(name), "NanoMQ-Iceoryx-Suber-%zu",
+			    icemap_.nsubers);
+			if ((rv = nng_iceoryx_sub(&icemap_.sock, name, e->service,
+			         e->instance, e->event, &suber)) != 0) {
+				goto fail;
+			}
+			icemap_.subers[icemap_.nsubers++] = suber;
+			continue;
+		}
+		if ((rv = topic_filter_set_add(
+		         icemap_.set, e->filter, (uint32_t) icemap_.npubs)) != 0 ||
+		    (rv = icemap_pub_open(&icemap_.pubs[icemap_.npubs], e,
+		         icemap_.npubs)) != 0) {
+			icemap_.npubs++;
+			goto fail;
+		}
+		icemap_.npubs++;
+	}
+	icemap_.enabled = true;
+	for (size_t i = 0; i < icemap_.conf.count; i++) {
+		iceoryx_map_entry *e = &icemap_.conf.entries[i];
+
+		log_info("iceoryx %s %s%s%s/%s/%s", e->in ? "in" : "out",
+		    e->in ? "" : e->filter, e->in ? "" : " -> ", e->service,
+		    e->instance, e->event);
+	}
+	return 0;
+
+fail:
+	log_error("iceoryx mapping init failed %d", rv);
+	iceoryx_map_fini();
+	return rv;
+}
+
+void
+iceoryx_map_fini(void)
+{
+	icemap_.enabled = false;
+	for (size_t i = 0; i < icemap_.npubs; i++) {
+		icemap_pub *p = &icemap_.pubs[i];
+
+		if (p->aio != NULL) {
+			nng_aio_stop(p->aio);
+			nng_aio_free(p->aio);
+		}
+		// queued chunks go back with the publisher
+		if (p->mtx != NULL) {
+			nng_mtx_free(p->mtx);
+		}
+	}
+	if (icemap_.set != NULL) {
+		topic_filter_set_free(icemap_.set);
+	}
+	iceoryx_map_conf_free(&icemap_.conf);
+	memset(&icemap_, 0, sizeof(icemap_));
+}
+
+bool
+iceoryx_map_enabled(void)
+{
+	return icemap_.enabled;
+}
+
+size_t
+iceoryx_map_subers(void ***subersp)
+{
+	*subersp = icemap_.subers;
+	return icemap_.nsubers;
+}
+
+size_t
+iceoryx_map_forward(nng_msg *msg, const char *topic, const topic_levels *tl,
+    uint32_t **ids)
+{
+	size_t n;
+	size_t taken = 0;
+
+	if (!icemap_.enabled || icemap_.npubs == 0) {
+		return 0;
+	}
+	cvector_clear(*ids);
+	n = topic_filter_set_match(icemap_.set, topic, tl, ids);
+	for (size_t i = 0; i < n; i++) {
+		icemap_pub *p    = &icemap_.pubs[(*ids)[i]];
+		nng_msg    *next = NULL;
+		nng_msg    *icemsg;
+
+		nng_mtx_lock(p->mtx);
+		// publishers are not thread safe, chunks are loaned under mtx
+		if (p->len == NANO_ICEORYX_QUEUE_LEN ||
+		    nano_iceoryx_chunk_alloc(p->puber, msg, &icemsg) != 0) {
+			p->dropped++;
+			nng_mtx_unlock(p->mtx);
+			continue;
+		}
+		p->queue[(p->head + p->len) % NANO_ICEORYX_QUEUE_LEN] = icemsg;
+		p->len++;
+		taken++;
+		if (!p->busy) {
+			p->busy = true;
+			next    = icemap_pop(p);
+		}
+		nng_mtx_unlock(p->mtx);
+		if (next != NULL) {
+			icemap_send(p, next);
+		}
+	}
+	return taken;
+}
+
+size_t
+iceoryx_map_stats_get(iceoryx_map_stats *st, size_t n)
+{
+	for (size_t i = 0; i < icemap_.npubs && i < n; i++) {
+		icemap_pub *p = &icemap_.pubs[i];
+
+		nng_mtx_lock(p->mtx);
+		st[i].filter  = p->entry->filter;
+		st[i].event   = p->entry->event;
+		st[i].depth   = p->len + (p->busy ? 1 : 0);
+		st[i].sent    = p->sent;
+		st[i].dropped = p->dropped;
+		st[i].failed  = p->failed;
+		nng_mtx_unlock(p->mtx);
+	}
+	return icemap_.npubs;
+}
@@ -4,9 +4,34 @@
 #include "nng/nng.h"
 #include "nng/supplemental/nanolib/conf.h"
 #include "nng/supplemental/nanolib/acl_conf.h"
+#include "include/topic_scan.h"
 
 #ifdef ACL_SUPP
+// Slots of the ACL decision cache, must be a power of two, 0 disables it.
+#ifndef NANO_ACL_CACHE_SIZE
+#define NANO_ACL_CACHE_SIZE 4096
+#endif
+
+/*
+ * Compile the rules of acl into the lookup index and set up the decision
+ * cache. acl_reload() swaps in a new index built from acl and drops every
+ * cached decision, lookups in flight finish on the old rules.
+ */
+extern int  acl_init(conf_acl *acl, size_t cache_size);
+extern void acl_fini(void);
+extern int  acl_reload(conf_acl *acl);
+
 extern bool auth_acl(
     conf *config, acl_action_type type, conn_param *param, const char *topic);
+/*
+ * Same as auth_acl(), the decision is cached per (pid, type, topic) until
+ * the next reload. tl are the levels of topic if already split, or NULL.
+ */
+extern bool auth_acl_pipe(conf *config, acl_action_type type, uint32_t pid,
+    conn_param *param, const char *topic, const topic_levels *tl);
+
+extern bool     acl_cache_enabled(void);
+extern uint64_t acl_cache_hits(void);
+extern uint64_t acl_cache_misses(void);
 #endif
 #endif
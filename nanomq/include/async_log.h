@@ -0,0 +1,72 @@
+#ifndef NANOMQ_ASYNC_LOG_H
+#define NANOMQ_ASYNC_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/supplemental/nanolib/conf.h"
+#include "nng/supplemental/nanolib/log.h"
+
+// Records each logging thread can have waiting for the writer.
+#ifndef NANO_LOG_RING_LEN
+#define NANO_LOG_RING_LEN 512
+#endif
+
+// Threads with a ring of their own; any further ones write in place.
+#ifndef NANO_LOG_RINGS
+#define NANO_LOG_RINGS 64
+#endif
+
+// Longest message text kept of a record, the rest is cut.
+#ifndef NANO_LOG_RECORD_LEN
+#define NANO_LOG_RECORD_LEN 256
+#endif
+
+// How often the writer drains the rings (ms).
+#ifndef NANO_LOG_FLUSH_MS
+#define NANO_LOG_FLUSH_MS 20
+#endif
+
+// Call sites each thread keeps track of for rate limiting.
+#ifndef NANO_LOG_SITES
+#define NANO_LOG_SITES 256
+#endif
+
+/*
+ * Log file output off the calling thread. A thread logging for the first
+ * time claims a ring of its own, puts the message text of each record in
+ * it without taking a lock and goes on; a writer thread adds time, level and
+ * call site, writes all records in one go per pass and rotates the file
+ * as log.rotation asks. A full ring drops the record and counts it. With
+ * a rate, a call site logs at most that many records per second on each
+ * thread; the rest are counted and the number suppressed goes with the
+ * next record of that site. Fatal records are never limited.
+ *
+ * Set through NANOMQ_LOG_ASYNC ("on") and NANOMQ_LOG_RATE (records per
+ * second, 0 for no limit), only the file output of log.to is async.
+ */
+typedef struct {
+	bool     enable;
+	uint32_t rate;
+} async_log_conf;
+
+typedef struct {
+	uint64_t written;    // records in the file
+	uint64_t dropped;    // refused by a full ring
+	uint64_t suppressed; // over the rate of their call site
+	uint64_t direct;     // written in place by threads without a ring
+	size_t   rings;
+} async_log_stats;
+
+extern void async_log_conf_env(async_log_conf *c);
+// Takes over writing to log->fp, which rotation reopens in place.
+extern int  async_log_init(const async_log_conf *c, conf_log *log);
+// Writes what is left and stops the writer.
+extern void async_log_fini(void);
+extern bool async_log_enabled(void);
+// The log callback for the file output.
+extern void async_log_event(log_event *ev);
+extern void async_log_stats_get(async_log_stats *s);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef NANOMQ_AUTH_CACHE_H
+#define NANOMQ_AUTH_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Credentials remembered by the HTTP API, in sets of NANO_AUTH_CACHE_WAYS.
+#ifndef NANO_AUTH_CACHE_SIZE
+#define NANO_AUTH_CACHE_SIZE 256
+#endif
+#ifndef NANO_AUTH_CACHE_WAYS
+#define NANO_AUTH_CACHE_WAYS 4
+#endif
+
+// Longest lifetime of an entry, JWTs are also bound by their exp claim.
+#ifndef NANO_AUTH_CACHE_TTL_MS
+#define NANO_AUTH_CACHE_TTL_MS 60000
+#endif
+
+// Longer Authorization values are checked every time.
+#ifndef NANO_AUTH_CACHE_KEY_MAX
+#define NANO_AUTH_CACHE_KEY_MAX 4096
+#endif
+
+/*
+ * Authorization values that passed verification, matched byte for byte.
+ * salt names what they were checked against, a hash of the key or the
+ * credentials, so a config reload makes older entries miss. flags is kept
+ * with the entry for the caller.
+ */
+extern int  auth_cache_init(void);
+extern void auth_cache_fini(void);
+extern bool auth_cache_enabled(void);
+
+extern bool auth_cache_get(const char *key, size_t len, uint64_t salt,
+    nng_time now, uint32_t *flags);
+extern void auth_cache_put(const char *key, size_t len, uint64_t salt,
+    nng_time expire, uint32_t flags);
+extern uint64_t auth_cache_hash(const void *data, size_t len, uint64_t seed);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef NANOMQ_AUTH_HTTP_CACHE_H
+#define NANOMQ_AUTH_HTTP_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+#include "nng/protocol/mqtt/mqtt_parser.h"
+
+// auth_http decisions kept, the oldest one gives way to a new one.
+#ifndef NANO_AUTH_HTTP_CACHE_SIZE
+#define NANO_AUTH_HTTP_CACHE_SIZE 4096
+#endif
+#ifndef NANO_AUTH_HTTP_CACHE_TTL_MS
+#define NANO_AUTH_HTTP_CACHE_TTL_MS 30000
+#endif
+// Kept shorter, a deny may come from a timed out request.
+#ifndef NANO_AUTH_HTTP_CACHE_DENY_TTL_MS
+#define NANO_AUTH_HTTP_CACHE_DENY_TTL_MS 5000
+#endif
+
+// Checks waiting for a pool thread, more are made in place.
+#ifndef NANO_AUTH_HTTP_QUEUE
+#define NANO_AUTH_HTTP_QUEUE 1024
+#endif
+#ifndef NANO_AUTH_HTTP_THREADS_MAX
+#define NANO_AUTH_HTTP_THREADS_MAX 16
+#endif
+
+enum {
+	AUTH_HTTP_MISS  = -1,
+	AUTH_HTTP_DENY  = 0,
+	AUTH_HTTP_ALLOW = 1,
+};
+
+typedef void (*auth_http_cache_cb)(void *arg, int rv);
+
+/*
+ * Decisions of auth_http per (clientid, username, action, topic). With
+ * conf set, auth_http.pool_size threads run checks handed over by
+ * auth_http_cache_check(), so a broker ctx can wait for one without
+ * holding a taskq thread. conf may be NULL for a cache without a pool.
+ */
+extern int  auth_http_cache_init(
+    conf_auth_http *conf, nng_duration allow_ttl, nng_duration deny_ttl);
+extern void auth_http_cache_fini(void);
+extern bool auth_http_cache_enabled(void);
+
+extern int  auth_http_cache_get(const char *clientid, const char *username,
+    bool sub, const char *topic, size_t len);
+extern void auth_http_cache_put(const char *clientid, const char *username,
+    bool sub, const char *topic, size_t len, bool allow);
+
+/*
+ * Ask auth_http on a pool thread, cache the answer, then call cb with the
+ * nmq_auth_http_sub_pub() result. cp must stay valid until then.
+ * NNG_EAGAIN when the queue is full and NNG_ENOTSUP without a pool.
+ */
+extern int auth_http_cache_check(conn_param *cp, bool sub, const char *topic,
+    size_t len, auth_http_cache_cb cb, void *arg);
+
+#endif
@@ -4,7 +4,23 @@
 #include "nng/supplemental/nanolib/conf.h"
 #include "broker.h"
 
+// Publishes an AWS bridge node may hold before new ones are dropped.
+#ifndef NANO_AWS_BRIDGE_QUEUE_LEN
+#define NANO_AWS_BRIDGE_QUEUE_LEN 4096
+#endif
+
+typedef struct {
+	uint64_t depth;
+	uint64_t sent;
+	uint64_t dropped;    // queue full or no sender for the node
+	uint64_t failed;     // rejected by MQTT_Publish
+	uint64_t latency_ms; // average from queueing to MQTT_Publish
+	uint64_t latency_max_ms;
+} aws_bridge_stats;
+
 extern int  aws_bridge_client(conf_bridge_node *node);
+// Queue the publish for the sender thread of every matching node.
 extern void aws_bridge_forward(nano_work *work);
+extern int  aws_bridge_stat(conf_bridge_node *node, aws_bridge_stats *stats);
 
 #endif
@@ -10,6 +10,13 @@
 #include "broker.h"
 #include "pub_handler.h"
 
+typedef enum {
+	HYBRID_IDLE,
+	HYBRID_DIALLING, // a make-before-break switch waits for its CONNACK
+	HYBRID_READY,
+	HYBRID_FAILED,
+} hybrid_handover;
+
 typedef struct {
 	nng_socket       *sock;
 	conf_bridge_node *config;		// bridge conf file
@@ -21,6 +28,11 @@ typedef struct {
 	nng_mtx          *exec_mtx;
 	nng_cv           *exec_cv;
 	nng_duration     cancel_timeout;
+	// hybrid bridging only, guarded by switch_mtx
+	bool             disconnected;
+	hybrid_handover  handover;
+	nng_socket      *handover_sock;
+	nng_time         dial_time;
 } bridge_param;
 
 extern bool topic_filter(const char *origin, const char *input);
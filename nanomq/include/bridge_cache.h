@@ -0,0 +1,77 @@
+#ifndef NANOMQ_BRIDGE_CACHE_H
+#define NANOMQ_BRIDGE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+
+#ifndef NANO_BRIDGE_CACHE_DIR
+#define NANO_BRIDGE_CACHE_DIR "/tmp/nanomq_bridge_cache"
+#endif
+
+// Disk budget shared by all bridge nodes, split evenly between them.
+#ifndef NANO_BRIDGE_CACHE_BYTES
+#define NANO_BRIDGE_CACHE_BYTES (256 * 1024 * 1024)
+#endif
+
+// Size at which the segment being written is closed and a new one started.
+#ifndef NANO_BRIDGE_CACHE_SEGMENT
+#define NANO_BRIDGE_CACHE_SEGMENT (4 * 1024 * 1024)
+#endif
+
+// Records are buffered up to this many bytes before they hit the file.
+#ifndef NANO_BRIDGE_CACHE_BATCH
+#define NANO_BRIDGE_CACHE_BATCH (64 * 1024)
+#endif
+
+// Interval of the flush + fdatasync of every node, in milliseconds.
+#ifndef NANO_BRIDGE_CACHE_SYNC_MS
+#define NANO_BRIDGE_CACHE_SYNC_MS 100
+#endif
+
+// Replay pace after a reconnect, in messages per second.
+#ifndef NANO_BRIDGE_CACHE_REPLAY_RATE
+#define NANO_BRIDGE_CACHE_REPLAY_RATE 5000
+#endif
+
+/*
+ * Offline buffer of bridge forwards: while a node has no upstream
+ * connection its PUBLISH messages are appended to sequential segment files
+ * under dir/<node>, flushed and synced in batches. On reconnect they are
+ * replayed in order, paced to NANO_BRIDGE_CACHE_REPLAY_RATE, and live
+ * forwards queue up behind them until the backlog is gone. A small index
+ * file keeps the replay position across restarts.
+ */
+
+typedef struct {
+	uint64_t bytes;    // on disk or buffered, not replayed yet
+	uint64_t stored;   // messages taken while offline
+	uint64_t replayed; // messages sent again after reconnecting
+	uint64_t dropped;  // messages lost to the byte budget
+	uint32_t segments;
+	bool     online;
+} bridge_cache_stats;
+
+extern int  bridge_cache_init(conf_bridge *bridge, const char *dir,
+     uint64_t bytes);
+extern void bridge_cache_fini(void);
+
+/*
+ * Take msg for node if it has to wait: the node is offline, or older
+ * messages are still being replayed. Returns NNG_ENOENT when msg should be
+ * sent right away, the caller keeps it then. Otherwise msg is consumed,
+ * NNG_EAGAIN meaning it did not fit into the byte budget.
+ */
+extern int bridge_cache_offer(conf_bridge_node *node, nng_msg *msg);
+
+// Connection state of node; going online starts the replay.
+extern void bridge_cache_online(conf_bridge_node *node, bool online);
+
+extern bool bridge_cache_enabled(conf_bridge_node *node);
+extern int  bridge_cache_stat(
+     conf_bridge_node *node, bridge_cache_stats *stats);
+
+#endif
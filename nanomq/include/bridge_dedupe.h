@@ -0,0 +1,50 @@
+#ifndef NANOMQ_BRIDGE_DEDUPE_H
+#define NANOMQ_BRIDGE_DEDUPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Bits of each of the two filter generations, power of two.
+#ifndef NANO_BRIDGE_DEDUPE_BITS
+#define NANO_BRIDGE_DEDUPE_BITS (1 << 23)
+#endif
+
+// A generation is cleared this often, an id is known for one to two windows.
+#ifndef NANO_BRIDGE_DEDUPE_WINDOW_MS
+#define NANO_BRIDGE_DEDUPE_WINDOW_MS 10000
+#endif
+
+// User property carrying the stamp of a bridged v5 message.
+#define BRIDGE_DEDUPE_KEY "nanomq-mid"
+// 16 hex digits of the node that stamped it and 16 of its sequence
+#define BRIDGE_DEDUPE_ID_LEN 32
+
+typedef struct {
+	uint64_t checked; // stamped messages that came in over a bridge
+	uint64_t dropped; // of them, ids seen before
+	uint64_t stamped;
+} bridge_dedupe_stats;
+
+/*
+ * Bridged messages are stamped with an id once, at the first node that
+ * forwards them, and keep it on every further hop. A rotating Bloom
+ * filter of two generations remembers the ids a node stamped or
+ * received, so a message coming back around a loop of bridges is dropped
+ * before any matching. Ids that the filter falsely claims to know drop a
+ * message too, rare at the default size.
+ */
+extern int  bridge_dedupe_init(size_t bits, nng_duration window);
+extern void bridge_dedupe_fini(void);
+extern bool bridge_dedupe_enabled(void);
+
+// Whether the received id was seen before; remember it either way.
+extern bool bridge_dedupe_seen(const uint8_t *id, size_t len);
+// A new id in id, BRIDGE_DEDUPE_ID_LEN bytes without a NUL, remembered.
+extern void bridge_dedupe_stamp(char *id);
+
+extern void bridge_dedupe_stat(bridge_dedupe_stats *stats);
+
+#endif
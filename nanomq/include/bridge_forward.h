@@ -0,0 +1,89 @@
+#ifndef NANOMQ_BRIDGE_FORWARD_H
+#define NANOMQ_BRIDGE_FORWARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+#include "include/topic_match.h"
+
+/*
+ * Forward rules of all bridge nodes, compiled into an immutable snapshot
+ * with filter sets over their topics. Publishers read the current
+ * snapshot without taking a lock; a reload builds a new one, swaps it in
+ * and frees the old one once no worker can still be reading it.
+ */
+
+/*
+ * How a bridged topic is rewritten: base replaces the topic of the message
+ * unless it is empty, then prefix and suffix wrap it. When base is set the
+ * result is known up front and kept in topic, so applying the plan costs
+ * nothing.
+ */
+typedef struct {
+	char    *base;
+	uint32_t base_len;
+	char    *prefix;
+	uint32_t prefix_len;
+	char    *suffix;
+	uint32_t suffix_len;
+	char    *topic; // precomputed result, NULL when it depends on the msg
+	uint32_t topic_len;
+} bridge_rewrite;
+
+typedef struct {
+	conf_bridge_node *node;
+	bridge_rewrite    rewrite; // base is the remote topic
+	uint8_t           qos;
+	uint8_t           retain;
+} bridge_forward;
+
+typedef struct {
+	conf_bridge_node *node;
+	char             *remote_topic; // filter subscribed on the remote
+	bridge_rewrite    rewrite;      // base is the local topic
+	uint8_t           retain;
+} bridge_sub;
+
+// workers bounds the context ids (minus one) that read the snapshot.
+extern int  bridge_forward_init(conf_bridge *bridge, size_t workers);
+extern void bridge_forward_fini(void);
+extern int  bridge_forward_reload(conf_bridge *bridge);
+
+/*
+ * Collect the forward rules whose local topic matches topic, in config
+ * order. tl are the levels of topic, split here when NULL. The returned
+ * array belongs to worker and stays valid until bridge_forward_end() is
+ * called by the same worker.
+ */
+extern size_t bridge_forward_begin(size_t worker, const char *topic,
+    const topic_levels *tl, bridge_forward ***fwdsp);
+extern void bridge_forward_end(size_t worker);
+
+/*
+ * The subscription rules of node in config order, read under the same
+ * worker announcement as bridge_forward_begin(). NNG_ENOENT means node is
+ * not part of the snapshot; bridge_forward_end() must be called either way.
+ */
+extern int bridge_forward_subs(size_t worker, conf_bridge_node *node,
+    bridge_sub **subsp, size_t *countp);
+/*
+ * The first subscription rule of node, in config order, whose remote topic
+ * matches topic in *subp, NULL if none does. Same announcement and
+ * NNG_ENOENT as bridge_forward_subs().
+ */
+extern int bridge_forward_sub_match(size_t worker, conf_bridge_node *node,
+    const char *topic, const topic_levels *tl, bridge_sub **subp);
+
+/*
+ * Apply rw to topic. The result is rw->topic, topic itself or a string
+ * composed in *bufp, a per-work buffer of *capp bytes grown on demand.
+ * Returns NULL when the buffer cannot grow.
+ */
+extern const char *bridge_rewrite_topic(const bridge_rewrite *rw,
+    const char *topic, uint32_t len, char **bufp, size_t *capp,
+    uint32_t *lenp);
+
+#endif
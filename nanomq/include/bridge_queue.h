@@ -0,0 +1,69 @@
+#ifndef NANOMQ_BRIDGE_QUEUE_H
+#define NANOMQ_BRIDGE_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+
+typedef enum {
+	BRIDGE_QUEUE_DROP_NEW, // refuse the message being forwarded
+	BRIDGE_QUEUE_DROP_OLD, // evict the oldest queued message
+	BRIDGE_QUEUE_BLOCK,    // wait up to NANO_BRIDGE_QUEUE_BLOCK_MS for room
+} bridge_queue_policy;
+
+// Messages a bridge node may hold while its send path is busy, power of two.
+#ifndef NANO_BRIDGE_QUEUE_LEN
+#define NANO_BRIDGE_QUEUE_LEN 1024
+#endif
+
+#ifndef NANO_BRIDGE_QUEUE_BYTES
+#define NANO_BRIDGE_QUEUE_BYTES (8 * 1024 * 1024)
+#endif
+
+// Bytes sent back to back by one drain run before it yields the thread.
+#ifndef NANO_BRIDGE_QUEUE_BATCH_BYTES
+#define NANO_BRIDGE_QUEUE_BATCH_BYTES (256 * 1024)
+#endif
+
+#ifndef NANO_BRIDGE_QUEUE_POLICY
+#define NANO_BRIDGE_QUEUE_POLICY BRIDGE_QUEUE_DROP_NEW
+#endif
+
+#ifndef NANO_BRIDGE_QUEUE_BLOCK_MS
+#define NANO_BRIDGE_QUEUE_BLOCK_MS 100
+#endif
+
+typedef struct {
+	uint64_t depth;
+	uint64_t bytes;
+	uint64_t queued;  // messages that had to wait in the queue
+	uint64_t sent;    // messages handed to the bridge socket
+	uint64_t dropped; // messages lost to overflow or send errors
+} bridge_queue_stats;
+
+/*
+ * One bounded FIFO per bridge node, drained by a dedicated aio, so a busy
+ * bridge turns into backpressure instead of silent loss.
+ */
+extern int  bridge_queue_init(conf_bridge *bridge, size_t len, size_t bytes,
+     bridge_queue_policy policy);
+extern void bridge_queue_fini(void);
+
+/*
+ * Forward msg to node. It goes straight out on aio when both the aio and the
+ * node queue are idle, otherwise it is queued behind earlier messages.
+ * Queued urgent messages overtake bulk ones, so a backlog of large frames
+ * does not hold up small latency-critical ones.
+ * Ownership of msg always moves to the queue; NNG_EAGAIN tells the caller
+ * that it (or an older message, depending on the policy) was dropped.
+ */
+extern int bridge_queue_send(
+    conf_bridge_node *node, nng_aio *aio, nng_msg *msg, bool urgent);
+
+extern int bridge_queue_stat(
+    conf_bridge_node *node, bridge_queue_stats *stats);
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef NANOMQ_BRIDGE_RTT_H
+#define NANOMQ_BRIDGE_RTT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+
+/*
+ * Round trip and loss estimates of both transports of a hybrid bridge, fed
+ * by timed CONNECT/CONNACK exchanges, and the policy deciding when the
+ * bridge should move over to the other transport before the current one
+ * fails outright.
+ */
+
+typedef enum {
+	BRIDGE_RTT_TCP,
+	BRIDGE_RTT_QUIC,
+	BRIDGE_RTT_TRANSPORTS,
+} bridge_rtt_transport;
+
+// Histogram buckets; the last one has no upper bound.
+#define BRIDGE_RTT_BUCKETS 12
+
+extern const uint32_t bridge_rtt_bounds[BRIDGE_RTT_BUCKETS - 1];
+
+// Interval between two probes of both transports, in milliseconds.
+#ifndef NANO_BRIDGE_HYBRID_PROBE_MS
+#define NANO_BRIDGE_HYBRID_PROBE_MS 15000
+#endif
+
+// A probe without CONNACK within this time counts as lost.
+#ifndef NANO_BRIDGE_HYBRID_PROBE_TIMEOUT_MS
+#define NANO_BRIDGE_HYBRID_PROBE_TIMEOUT_MS 3000
+#endif
+
+// Samples each transport needs before the policy trusts its estimate.
+#ifndef NANO_BRIDGE_HYBRID_MIN_SAMPLES
+#define NANO_BRIDGE_HYBRID_MIN_SAMPLES 3
+#endif
+
+// Switch when the other round trip is below this percentage of ours.
+#ifndef NANO_BRIDGE_HYBRID_SWITCH_PCT
+#define NANO_BRIDGE_HYBRID_SWITCH_PCT 70
+#endif
+
+// Or when our loss exceeds the other one by this much, per mille.
+#ifndef NANO_BRIDGE_HYBRID_LOSS_PERMILLE
+#define NANO_BRIDGE_HYBRID_LOSS_PERMILLE 100
+#endif
+
+// Minimum time between two proactive switches, in milliseconds.
+#ifndef NANO_BRIDGE_HYBRID_HOLD_MS
+#define NANO_BRIDGE_HYBRID_HOLD_MS 60000
+#endif
+
+// Time the new connection of a handover has to reach CONNACK.
+#ifndef NANO_BRIDGE_HYBRID_HANDOVER_MS
+#define NANO_BRIDGE_HYBRID_HANDOVER_MS 5000
+#endif
+
+typedef struct {
+	uint64_t samples; // round trips measured
+	uint64_t lost;    // probes or connections that failed
+	uint32_t srtt;    // smoothed round trip, ms
+	uint32_t loss;    // smoothed loss, per mille
+	uint64_t buckets[BRIDGE_RTT_BUCKETS];
+} bridge_rtt_stats;
+
+// Track every hybrid node of bridge.
+extern int  bridge_rtt_init(conf_bridge *bridge);
+extern void bridge_rtt_fini(void);
+
+extern void bridge_rtt_record(
+    conf_bridge_node *node, bridge_rtt_transport t, nng_duration rtt);
+extern void bridge_rtt_lost(conf_bridge_node *node, bridge_rtt_transport t);
+
+// Note that node now runs over t, which restarts the hold-down period.
+extern void bridge_rtt_switched(
+    conf_bridge_node *node, bridge_rtt_transport t, nng_time now);
+
+/*
+ * True when node should leave its current transport for the other one.
+ * Never true within NANO_BRIDGE_HYBRID_HOLD_MS of the previous switch.
+ */
+extern bool bridge_rtt_prefer(conf_bridge_node *node, nng_time now);
+extern bool bridge_rtt_should_switch(
+    const bridge_rtt_stats *cur, const bridge_rtt_stats *alt);
+
+// NNG_ENOENT for nodes that are not hybrid.
+extern int bridge_rtt_stat(
+    conf_bridge_node *node, bridge_rtt_transport t, bridge_rtt_stats *stats);
+extern int bridge_rtt_active(
+    conf_bridge_node *node, bridge_rtt_transport *t);
+
+extern const char *bridge_rtt_name(bridge_rtt_transport t);
+
+#endif
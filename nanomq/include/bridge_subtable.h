@@ -0,0 +1,52 @@
+#ifndef NANOMQ_BRIDGE_SUBTABLE_H
+#define NANOMQ_BRIDGE_SUBTABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+
+/*
+ * Upstream subscriptions of transparent bridges, reference counted by the
+ * local clients holding them. Only the first subscriber of a filter causes
+ * a SUBSCRIBE and only the last one leaving causes an UNSUBSCRIBE; pending
+ * changes are sent together as multi-topic packets from a short timer.
+ */
+
+// Delay before pending changes go upstream, in milliseconds.
+#ifndef NANO_BRIDGE_SUB_BATCH_MS
+#define NANO_BRIDGE_SUB_BATCH_MS 20
+#endif
+
+// Topics carried by one SUBSCRIBE or UNSUBSCRIBE packet.
+#ifndef NANO_BRIDGE_SUB_BATCH_MAX
+#define NANO_BRIDGE_SUB_BATCH_MAX 64
+#endif
+
+// Hash buckets of the filter and client tables, power of two.
+#ifndef NANO_BRIDGE_SUB_BUCKETS
+#define NANO_BRIDGE_SUB_BUCKETS 1024
+#endif
+
+extern int  bridge_subtable_init(conf_bridge *bridge, size_t buckets);
+extern void bridge_subtable_fini(void);
+
+/*
+ * Take or drop the reference of pid on topic for node. A pid holds at most
+ * one reference per filter, however often it subscribes. NNG_ENOENT means
+ * node is not tracked and the caller has to talk to the bridge itself.
+ */
+extern int bridge_subtable_add(conf_bridge_node *node, uint32_t pid,
+    const char *topic, uint32_t len, uint8_t qos, uint8_t rap, uint8_t rh);
+extern int bridge_subtable_remove(
+    conf_bridge_node *node, uint32_t pid, const char *topic, uint32_t len);
+
+// Drop every reference of a disconnected client.
+extern void bridge_subtable_release(uint32_t pid);
+
+// Subscribe all live filters of node again, after its client reconnected.
+extern void bridge_subtable_resync(conf_bridge_node *node);
+
+#endif
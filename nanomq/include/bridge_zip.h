@@ -0,0 +1,87 @@
+#ifndef NANOMQ_BRIDGE_ZIP_H
+#define NANOMQ_BRIDGE_ZIP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+
+// zlib level of the forwards, 1 fastest to 9 smallest.
+#ifndef NANO_BRIDGE_ZIP_LEVEL
+#define NANO_BRIDGE_ZIP_LEVEL 6
+#endif
+
+// Payloads shorter than this are not worth the header, sent as they are.
+#ifndef NANO_BRIDGE_ZIP_MIN
+#define NANO_BRIDGE_ZIP_MIN 128
+#endif
+
+// Largest payload a received message may inflate to.
+#ifndef NANO_BRIDGE_ZIP_MAX
+#define NANO_BRIDGE_ZIP_MAX (8 * 1024 * 1024)
+#endif
+
+// User property of a compressed v5 forward and its value, the same length
+// as the one replacing it once the payload was inflated.
+#define BRIDGE_ZIP_KEY "nanomq-enc"
+#define BRIDGE_ZIP_ZLIB "zlib"
+#define BRIDGE_ZIP_NONE "none"
+#define BRIDGE_ZIP_VALUE_LEN 4
+
+typedef struct {
+	uint64_t zipped;    // forwards sent compressed
+	uint64_t zip_in;    // their payload bytes before compression
+	uint64_t zip_out;   // and after
+	uint64_t zip_ns;    // time spent compressing
+	uint64_t skipped;   // forwards a rule matched that did not shrink
+	uint64_t unzipped;  // received messages inflated
+	uint64_t unzip_in;  // their payload bytes as received
+	uint64_t unzip_out; // and inflated
+	uint64_t unzip_ns;  // time spent inflating
+	uint64_t failed;    // received ones that did not inflate
+} bridge_zip_stats;
+
+/*
+ * Payload compression of bridge forwards. NANOMQ_BRIDGE_ZIP lists the
+ * forward rules to compress, comma separated, as a bridge name or as
+ * name:filter for the forwards of that bridge whose local topic matches
+ * the filter. Their payloads go out zlib compressed, with a preset
+ * dictionary read from the file NANOMQ_BRIDGE_ZIP_DICT when it is set,
+ * and the BRIDGE_ZIP_KEY user property saying so. Only v5 bridges carry
+ * it. Messages coming in over any bridge with the property are inflated
+ * before they are matched, given the same dictionary.
+ *
+ * workers bounds the context ids (minus one) calling in, each has its
+ * own zlib streams.
+ */
+extern int  bridge_zip_init(conf_bridge *bridge, size_t workers);
+extern void bridge_zip_fini(void);
+extern bool bridge_zip_enabled(void);
+
+// Whether a forward of topic, the local one, to node is compressed.
+extern bool bridge_zip_wanted(conf_bridge_node *node, const char *topic);
+
+/*
+ * Compress the payload for node into *outp, a buffer of worker valid until
+ * its next call. NNG_ENOSPC when it is too short or would not shrink, to
+ * be sent as it is then.
+ */
+extern int bridge_zip_deflate(size_t worker, conf_bridge_node *node,
+    const uint8_t *data, uint32_t len, uint8_t **outp, uint32_t *lenp);
+// Count a forward to node of what an earlier bridge_zip_deflate made.
+extern void bridge_zip_sent(
+    conf_bridge_node *node, uint32_t len, uint32_t zlen);
+
+/*
+ * Inflate a payload received over node into *outp, allocated with room for
+ * a terminating NUL, for the caller to nng_free with *lenp + 1 bytes. data
+ * must not be the buffer of a bridge_zip_deflate() by the same worker.
+ */
+extern int bridge_zip_inflate(size_t worker, conf_bridge_node *node,
+    const uint8_t *data, uint32_t len, uint8_t **outp, uint32_t *lenp);
+
+extern int bridge_zip_stat(conf_bridge_node *node, bridge_zip_stats *stats);
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef NANOMQ_BROKER_H
 #define NANOMQ_BROKER_H
 
+// Broker contexts taking REST publishes, at least http_server.parallel.
+#ifndef HTTP_CTX_NUM
 #define HTTP_CTX_NUM 4
+#endif
 
 #include "nng/supplemental/nanolib/conf.h"
 #include "nng/supplemental/nanolib/nanolib.h"
@@ -17,12 +20,29 @@
 #define PROTO_HTTP_SERVER 0x03
 #define PROTO_ICEORYX_BRIDGE 0x04
 
+// Message counters of the workers, left out by the tiny build profile.
+#if !defined(NANO_NO_STATISTICS)
 #define STATISTICS
+#endif
 
 #if defined(ENABLE_NANOMQ_TESTS)
 	#undef STATISTICS
 #endif
 
+/*
+ * What only the works receiving on another socket than the broker one
+ * use: bridges, the HTTP server, AWS and iceoryx. Broker works, by far the
+ * most of them, go without.
+ */
+struct work_extra {
+	nng_ctx           ctx;  // ctx for bridging/http post
+	conf_bridge_node *node; // only works for bridge ctx
+};
+
+/*
+ * Fields every state transition touches come first and fill the first
+ * cache line on 64-bit targets, the ones of single features follow.
+ */
 typedef struct work nano_work;
 struct work {
 	enum {
@@ -37,37 +57,81 @@ struct work {
 	uint8_t     proto;		  // logic proto
 	uint8_t     proto_ver;   // MQTT version cache
 	uint8_t     flag;        // flag for webhook & rule_engine
+	bool        auth_parked; // PUBLISH back from auth_http
+	bool        admit_parked;  // CONNACK back from connect_admit
+	bool        admit_refused; // ... without a token
+	bool        quota_parked;  // PUBLISH back from its pub_quota delay
+	bool        heavy;       // serves the heavy lane, see work_lane.h
 	nng_aio *   aio;
 	nng_msg *   msg;
-	nng_msg **  msg_ret;
 	nng_ctx     ctx;        // ctx for mqtt broker
-	nng_ctx     extra_ctx; //  ctx for bridging/http post
 	nng_pipe    pid;
+	conn_param *              cparam;
+	struct pub_packet_struct *pub_packet;
+	struct pipe_content *     pipe_ct;
 	dbtree *    db;
 	dbtree *    db_ret;
 	conf *      config;
-
-	conf_bridge_node *node;	// only works for bridge ctx
+	struct work_arena *arena; // what lives as long as the message
+	struct msg_pool   *mpool; // scratch messages, see msg_pool.h
 	reason_code 	  code; // MQTT reason code
+	enum {
+		WORK_FIXED,    // one of `parallel`, lives as long as the broker
+		WORK_RUNNING,  // added by the elastic pool
+		WORK_RETIRING, // stops at its next receive
+		WORK_PARKED,   // stopped, aio and ctx still to release
+		WORK_RELEASED, // kept for reuse, see work_pool.h
+	} pool;
 
-	nng_socket hook_sock;
+#ifdef STATISTICS
+	struct nano_msg_stats *stats; // message counters of this worker
+#endif
+#if defined(SUPP_TRAFFIC_STATS)
+	struct traffic_topics *traffic; // busiest topics this worker saw
+#endif
+#if defined(SUPP_LATENCY_STATS)
+	struct latency_block *lat;
+	uint64_t              lat_start; // RECV time of a timed PUBLISH, or 0
+#endif
+#if defined(SUPP_PROFILER)
+	struct prof_block *prof; // server_cb states of this worker
+#endif
+#if defined(SUPP_MSG_TRACE)
+	struct msg_trace *trace;     // of the PUBLISH in flight, if sampled
+	uint32_t          trace_seq; // PUBLISHes seen, for 1 in N sampling
+#endif
 
-	struct pipe_content *     pipe_ct;
-	conn_param *              cparam;
-	struct pub_packet_struct *pub_packet;
-	packet_subscribe *        sub_pkt;
-	packet_unsubscribe *      unsub_pkt;
+	struct work_extra *extra; // NULL for PROTO_MQTT_BROKER
+	nng_msg **         msg_ret;
+	struct retain_cursor **ret_cursors; // wildcard filters, after SUBACK
+	packet_subscribe *  sub_pkt;
+	packet_unsubscribe *unsub_pkt;
+	nng_socket          hook_sock;
 
+#if defined(NNG_SUPP_SQLITE)
 	void *sqlite_db;
+#endif
+
+	char  *topic_buf; // scratch for bridge topic rewrites
+	size_t topic_buf_cap;
 
+	nng_aio *alias_aio;   // sends defining an outbound topic alias
+	uint32_t alias_pipe;  // what the one in flight defines
+	uint32_t alias_stamp;
+	uint16_t alias;
+
+#if defined(SUPP_RULE_ENGINE)
+	struct rule_value *rule_vals; // payload fields of the matching rule
+	size_t             rule_vals_cap;
+	nng_msg          **repubs; // republishes to the broker itself
+#endif
 
 #if defined(SUPP_PLUGIN)
 	property *user_property;
 #endif
 #if defined(SUPP_ICEORYX)
-	void *iceoryx_suber;
-	void *iceoryx_puber;
-	nng_socket iceoryx_sock;
+	void     *iceoryx_suber;
+	uint32_t *iceoryx_ids; // scratch of iceoryx_map_forward
 #endif
 };
 
@@ -95,6 +159,7 @@ extern void bridge_send_cb(void *arg);
 extern void *broker_start_with_conf(void *nmq_conf);
 
 #ifdef STATISTICS
+extern struct nano_msg_stats *nano_msg_stats_alloc(void);
 extern uint64_t nanomq_get_message_in(void);
 extern uint64_t nanomq_get_message_out(void);
 extern uint64_t nanomq_get_message_drop(void);
@@ -0,0 +1,52 @@
+#ifndef NANOMQ_BUILD_PROFILE_H
+#define NANOMQ_BUILD_PROFILE_H
+
+#include <stdint.h>
+
+#include "nng/supplemental/nanolib/conf.h"
+
+// Footprint profile the build was configured with, see NANOMQ_PROFILE.
+#define NANO_PROFILE_NONE 0
+#define NANO_PROFILE_TINY 1
+#define NANO_PROFILE_EDGE 2
+#define NANO_PROFILE_GATEWAY 3
+#define NANO_PROFILE_SERVER 4
+
+#ifndef NANO_PROFILE
+#define NANO_PROFILE NANO_PROFILE_NONE
+#endif
+
+/*
+ * Runtime defaults of the profile, taken before the config file is read,
+ * so the file, environment and command line still override them. 0 or no
+ * log level keeps the defaults of conf_init.
+ */
+#if NANO_PROFILE == NANO_PROFILE_TINY
+#define NANO_PROFILE_PARALLEL 2
+#define NANO_PROFILE_MSQ_LEN 64
+#define NANO_PROFILE_LOG_LEVEL "warn"
+#elif NANO_PROFILE == NANO_PROFILE_EDGE
+#define NANO_PROFILE_PARALLEL 4
+#define NANO_PROFILE_MSQ_LEN 512
+#define NANO_PROFILE_LOG_LEVEL "warn"
+#elif NANO_PROFILE == NANO_PROFILE_GATEWAY
+#define NANO_PROFILE_PARALLEL 8
+#define NANO_PROFILE_MSQ_LEN 2048
+#define NANO_PROFILE_LOG_LEVEL "info"
+#elif NANO_PROFILE == NANO_PROFILE_SERVER
+#define NANO_PROFILE_PARALLEL 32
+#define NANO_PROFILE_MSQ_LEN 4096
+#define NANO_PROFILE_LOG_LEVEL "info"
+#else
+#define NANO_PROFILE_PARALLEL 0
+#define NANO_PROFILE_MSQ_LEN 0
+#endif
+
+// "tiny", "edge", "gateway", "server" or "none".
+extern const char *build_profile_name(void);
+extern void        build_profile_apply(conf *config);
+
+// Size of the running executable in bytes, 0 where it can't be found.
+extern uint64_t build_profile_binary_size(void);
+
+#endif
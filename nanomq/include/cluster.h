@@ -0,0 +1,53 @@
+#ifndef NANOMQ_CLUSTER_H
+#define NANOMQ_CLUSTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+
+// Peers of NANOMQ_CLUSTER_PEERS at most.
+#ifndef NANO_CLUSTER_PEERS
+#define NANO_CLUSTER_PEERS 16
+#endif
+
+// Bridge works of each peer link.
+#ifndef NANO_CLUSTER_PARALLEL
+#define NANO_CLUSTER_PARALLEL 2
+#endif
+
+#ifndef NANO_CLUSTER_KEEPALIVE
+#define NANO_CLUSTER_KEEPALIVE 60
+#endif
+
+// Client ids of the peer links, the node name follows.
+#define NANO_CLUSTER_CLIENTID_PREFIX "nanomq-cluster-"
+
+/*
+ * A full mesh of nodes, set with NANOMQ_CLUSTER_PEERS as a ',' separated
+ * list of the bridge URLs of the other nodes and NANOMQ_CLUSTER_NAME as
+ * the name of this one, the host name when unset.
+ *
+ * Each peer gets a transparent MQTT v5 bridge of its own: the filters of
+ * the local subscribers are subscribed at every peer, batched by the
+ * bridge subtable and again after a reconnect, so a peer's subscription
+ * tree is the route summary and a publish only crosses the links that
+ * have subscribers behind them. What comes in over a link goes to the
+ * local subscribers only, never to other peers or bridges, and peer
+ * sessions' own subscriptions are not passed on.
+ */
+extern int  cluster_init(conf *config);
+extern void cluster_fini(conf *config);
+extern bool cluster_enabled(void);
+
+// Whether node is the link to a peer.
+extern bool cluster_node(const conf_bridge_node *node);
+
+// Track the broker sessions that peer links of other nodes opened here.
+extern void cluster_peer_open(uint32_t pipe, const char *client_id);
+extern void cluster_peer_close(uint32_t pipe);
+extern bool cluster_peer_pipe(uint32_t pipe);
+
+#endif
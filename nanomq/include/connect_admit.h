@@ -0,0 +1,78 @@
+#ifndef NANOMQ_CONNECT_ADMIT_H
+#define NANOMQ_CONNECT_ADMIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Listeners with a bucket of their own, keyed by local port. Further
+// ports share the last one.
+#ifndef NANO_ADMIT_LISTENERS
+#define NANO_ADMIT_LISTENERS 16
+#endif
+
+// How often waiting CONNECTs are given the tokens that refilled (ms).
+#ifndef NANO_ADMIT_TICK_MS
+#define NANO_ADMIT_TICK_MS 10
+#endif
+
+// CONNECTs waiting for a token at most, 0 for half the broker works as
+// each waits on one, and how long before it is refused (ms).
+#ifndef NANO_ADMIT_PENDING
+#define NANO_ADMIT_PENDING 0
+#endif
+
+#ifndef NANO_ADMIT_WAIT_MS
+#define NANO_ADMIT_WAIT_MS 2000
+#endif
+
+/*
+ * Rates are CONNECTs per second, 0 for unlimited. A burst of 0 is one
+ * second worth of rate. CONNECTs finding no token wait in a queue of at
+ * most `pending` for up to `wait_ms`, and are refused with "server busy"
+ * past either.
+ */
+typedef struct {
+	uint32_t rate;
+	uint32_t burst;
+	uint32_t listener_rate;
+	uint32_t listener_burst;
+	uint32_t pending;
+	uint32_t wait_ms;
+} connect_admit_conf;
+
+typedef struct {
+	uint64_t admitted; // at once or after waiting
+	uint64_t queued;
+	uint64_t refused;  // queue full
+	uint64_t expired;  // waited wait_ms
+	uint32_t pending;
+	uint32_t pending_max;
+	bool     limited;
+} connect_admit_stats;
+
+// rv 0 when the CONNECT got its token, NNG_EBUSY when it is refused.
+typedef void (*connect_admit_cb)(void *arg, int rv);
+
+extern int  connect_admit_init(const connect_admit_conf *c);
+extern void connect_admit_fini(void);
+extern bool connect_admit_enabled(void);
+
+// New limits, taking effect for the CONNECTs already waiting as well.
+extern void connect_admit_tune(const connect_admit_conf *c);
+extern void connect_admit_conf_get(connect_admit_conf *c);
+
+// Fields of c with their NANOMQ_CONNECT_* environment variable set.
+extern void connect_admit_conf_env(connect_admit_conf *c);
+
+/*
+ * 0 admitted at once, NNG_EBUSY refused at once, NNG_EAGAIN queued with
+ * cb to be called from the admission thread later.
+ */
+extern int connect_admit_try(uint16_t port, connect_admit_cb cb, void *arg);
+
+extern void connect_admit_stats_get(connect_admit_stats *s);
+
+#endif
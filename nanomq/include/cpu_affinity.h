@@ -0,0 +1,50 @@
+#ifndef NANOMQ_CPU_AFFINITY_H
+#define NANOMQ_CPU_AFFINITY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef NANO_CPU_MAX
+#define NANO_CPU_MAX 1024
+#endif
+
+// NUMA nodes read from sysfs at most.
+#ifndef NANO_NUMA_MAX
+#define NANO_NUMA_MAX 16
+#endif
+
+typedef struct {
+	uint64_t bits[NANO_CPU_MAX / 64];
+} cpu_list;
+
+// "0-3,8,10-11" style, as in sysfs cpulist files and taskset -c.
+extern int    cpu_list_parse(const char *s, cpu_list *l);
+extern size_t cpu_list_count(const cpu_list *l);
+extern bool   cpu_list_has(const cpu_list *l, int cpu);
+
+typedef enum {
+	CPU_GROUP_TASKQ,    // nng:task, where every broker work runs
+	CPU_GROUP_EXPIRE,   // nng:aio:expire
+	CPU_GROUP_RESOLVER, // nng:resolver
+	CPU_GROUP_POLL,     // nng:poll, socket I/O of the listeners
+	CPU_GROUPS,
+} cpu_group;
+
+/*
+ * Each group is pinned as its NANOMQ_CPU_<GROUP> environment variable says:
+ *   <cpulist>  every thread of the group on these CPUs
+ *   numa       threads spread over the NUMA nodes, each kept on one node
+ *   numa:<n>   every thread of the group on the CPUs of node n
+ * A thread allocates from its own malloc arena, so kept on one node the
+ * messages it builds stay local to it. Unset groups are left alone.
+ * NNG_EINVAL for a variable that does not parse, NNG_ENOTSUP off Linux.
+ */
+extern int cpu_affinity_apply(size_t *pinned);
+
+// CPUs of each NUMA node, a single node of all CPUs without NUMA.
+extern size_t cpu_affinity_numa_nodes(cpu_list *nodes, size_t cap);
+
+extern const char *cpu_group_env(cpu_group g);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef NANOMQ_EXCHANGE_QUERY_H
+#define NANOMQ_EXCHANGE_QUERY_H
+
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+
+// The file index is rebuilt from parquet.dir when older than this.
+#ifndef NANO_EXCHANGE_QUERY_RESCAN_MS
+#define NANO_EXCHANGE_QUERY_RESCAN_MS 1000
+#endif
+
+typedef struct {
+	const char *path;
+	uint64_t    start_key; // smallest key in the file
+	uint64_t    end_key;   // largest key in the file
+} exchange_query_file;
+
+// Return non-zero to stop the walk.
+typedef int (*exchange_query_cb)(const exchange_query_file *file, void *arg);
+
+/*
+ * Index of the parquet files the exchange writes, by the key range each
+ * holds. The parquet writer names every file after its first and last key,
+ * so the index is built from a directory listing without opening a file.
+ */
+extern int  exchange_query_init(conf_parquet *conf);
+extern void exchange_query_fini(void);
+
+/*
+ * Call cb for every file holding keys within [start_key, end_key], in key
+ * order, one file at a time under the index lock. Returns the number of
+ * files visited, or a negative nng error.
+ */
+extern int exchange_query_span(
+    uint64_t start_key, uint64_t end_key, exchange_query_cb cb, void *arg);
+
+/*
+ * Read the payload stored under key from the one file whose range holds
+ * it. *data is released by the caller with nng_free(*data, *len).
+ */
+extern int exchange_query_get(uint64_t key, uint8_t **data, uint32_t *len);
+
+#endif
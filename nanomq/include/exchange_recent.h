@@ -0,0 +1,67 @@
+#ifndef NANOMQ_EXCHANGE_RECENT_H
+#define NANOMQ_EXCHANGE_RECENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Messages each worker keeps in memory unless NANOMQ_EXCHANGE_RECENT sets
+// another number, 0 keeps none.
+#ifndef NANO_EXCHANGE_RECENT_LEN
+#define NANO_EXCHANGE_RECENT_LEN 0
+#endif
+
+// How far back they go, NANOMQ_EXCHANGE_RECENT_MS overrides it.
+#ifndef NANO_EXCHANGE_RECENT_MS
+#define NANO_EXCHANGE_RECENT_MS 600000
+#endif
+
+typedef struct {
+	uint64_t key;
+	uint32_t exchange; // index of the node in conf_exchange
+	char    *topic;
+	uint8_t *payload;
+	uint32_t len;
+} exchange_recent_msg;
+
+typedef struct {
+	uint64_t held;    // messages in memory now
+	uint64_t evicted; // dropped for age or room
+	uint64_t queries;
+} exchange_recent_stats;
+
+/*
+ * The latest messages handed to the exchanges, per worker in the order of
+ * their keys, which grow with every message of a worker. A key range is
+ * found by binary search in each worker's ring, so recent data needs no
+ * trip to the exchange or the parquet files.
+ */
+extern int  exchange_recent_init(uint64_t num_ctx);
+extern void exchange_recent_fini(void);
+extern bool exchange_recent_enabled(void);
+
+extern int exchange_recent_put(uint32_t worker, uint64_t key,
+    uint32_t exchange, const char *topic, const uint8_t *payload,
+    size_t len);
+
+/*
+ * Every message with a key of at least this one is in memory, older ones
+ * only in the files the exchange wrote.
+ */
+extern uint64_t exchange_recent_since(void);
+
+/*
+ * A cvector of copies of the messages with keys within [start_key,
+ * end_key] whose topic matches filter, NULL for all, ascending by key and
+ * at most limit of them. *more tells whether further ones were left out.
+ * Released with exchange_recent_free.
+ */
+extern exchange_recent_msg *exchange_recent_query(uint64_t start_key,
+    uint64_t end_key, const char *filter, size_t limit, bool *more);
+extern void exchange_recent_free(exchange_recent_msg *msgs);
+
+extern void exchange_recent_stat(exchange_recent_stats *stats);
+
+#endif
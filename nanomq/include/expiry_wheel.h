@@ -0,0 +1,58 @@
+#ifndef NANOMQ_EXPIRY_WHEEL_H
+#define NANOMQ_EXPIRY_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Resolution of message expiry (ms), expiry intervals are whole seconds.
+#ifndef NANO_EXPIRY_WHEEL_TICK_MS
+#define NANO_EXPIRY_WHEEL_TICK_MS 250
+#endif
+
+#define EXPIRY_WHEEL_BITS 6
+#define EXPIRY_WHEEL_SLOTS (1 << EXPIRY_WHEEL_BITS)
+#define EXPIRY_WHEEL_LEVELS 4
+
+typedef void (*expiry_wheel_cb)(void *arg);
+
+/*
+ * Embedded in whatever expires, so scheduling and cancelling never
+ * allocate. A timer is owned by the wheel from expiry_wheel_add until it
+ * is cancelled or its callback runs.
+ */
+typedef struct expiry_timer expiry_timer;
+struct expiry_timer {
+	expiry_timer   *next;
+	expiry_timer  **pprev; // NULL while not scheduled
+	uint64_t        tick;
+	int             level;
+	expiry_wheel_cb cb;
+	void           *arg;
+};
+
+/*
+ * Hashed hierarchical timing wheel: four levels of 64 slots cover 2^24
+ * ticks, about 48 days, later deadlines park in the top level and are
+ * placed again on each cascade. Adding and cancelling are O(1), an expiry
+ * costs O(1) plus at most one move per level.
+ */
+extern int  expiry_wheel_init(nng_duration tick);
+extern void expiry_wheel_fini(void);
+extern bool expiry_wheel_enabled(void);
+
+// Run cb(arg) on the wheel thread once deadline has passed.
+extern int expiry_wheel_add(
+    expiry_timer *t, nng_time deadline, expiry_wheel_cb cb, void *arg);
+// False when t was not scheduled or its callback is already due.
+extern bool expiry_wheel_cancel(expiry_timer *t);
+
+// Fire everything due by now, run by the thread every tick.
+extern size_t expiry_wheel_advance(nng_time now);
+
+extern size_t   expiry_wheel_count(void);
+extern uint64_t expiry_wheel_fired(void);
+
+#endif
@@ -53,17 +53,41 @@ typedef struct hashmap_s hashmap_s;
 struct hashmap_element_s {
   const char *key;
   unsigned key_len;
+  unsigned crc; /* of the key, kept for rehashing */
   int in_use;
   uint32_t data;
 };
 
 /* A hashmap has some maximum size and current size, as well as the data to
  * hold. */
-struct hashmap_s {
+struct hashmap_table_s {
   unsigned table_size;
   unsigned size;
   struct hashmap_element_s *data;
+};
+
+/* Keys are spread over stripes by their CRC32, each with its own lock. A
+ * stripe that runs out of room moves its elements to a table twice the size
+ * a few at a time on later puts and removes, looking in both till done. */
+struct hashmap_stripe_s {
+  nng_mtx *mtx;
+  struct hashmap_table_s cur;
+  struct hashmap_table_s old; /* data is NULL unless resizing */
+  unsigned migrate;           /* next index of old to move */
+};
+
+/* Must be a power of two. */
+#ifndef HASHMAP_STRIPES
+#define HASHMAP_STRIPES (16)
+#endif
+
+/* Elements moved from the old table on every put and remove. */
+#ifndef HASHMAP_MIGRATE_STEP
+#define HASHMAP_MIGRATE_STEP (4)
+#endif
 
+struct hashmap_s {
+  struct hashmap_stripe_s stripes[HASHMAP_STRIPES];
 };
 
 
@@ -88,6 +112,8 @@ int nano_hashmap_remove(struct hashmap_s * m, const char *const key,
 
 void nano_hashmap_destroy(struct hashmap_s * m);
 
+unsigned nano_hashmap_num_entries(struct hashmap_s * m);
+
 
 #if defined(__cplusplus)
 }
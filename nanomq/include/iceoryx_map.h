@@ -0,0 +1,85 @@
+#ifndef NANOMQ_ICEORYX_MAP_H
+#define NANOMQ_ICEORYX_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "include/topic_match.h"
+
+// Mappings of NANOMQ_ICEORYX_MAP, in and out together.
+#ifndef NANO_ICEORYX_MAPS
+#define NANO_ICEORYX_MAPS 16
+#endif
+
+// Chunks an out mapping holds while its publisher is busy.
+#ifndef NANO_ICEORYX_QUEUE_LEN
+#define NANO_ICEORYX_QUEUE_LEN 64
+#endif
+
+// What the broker bridged before the mappings were configurable.
+#define NANO_ICEORYX_MAP_DEFAULT                       \
+	"out:ice/fwd=NanoMQ-Service/NanoMQ-Instance/ice/fwd;" \
+	"in:NanoMQ-Service/NanoMQ-Instance/topic"
+
+/*
+ * MQTT to iceoryx and back, set with NANOMQ_ICEORYX_MAP as a list of
+ * mappings separated by ';':
+ *
+ *   out:<filter>=<service>/<instance>/<event>
+ *   in:<service>/<instance>/<event>
+ *
+ * An out mapping publishes every message matching filter on the event,
+ * the event being the rest after the instance so it may hold '/'. Each
+ * such publisher has a queue of its own that one aio sends from, a full
+ * queue drops the message. An in mapping subscribes to the event; chunks
+ * carry their own MQTT packet and go to the subscribers of its topic.
+ */
+typedef struct {
+	bool  in;
+	char *filter; // out only
+	char *service;
+	char *instance;
+	char *event;
+} iceoryx_map_entry;
+
+typedef struct {
+	iceoryx_map_entry entries[NANO_ICEORYX_MAPS];
+	size_t            count;
+} iceoryx_map_conf;
+
+typedef struct {
+	const char *filter;
+	const char *event;
+	size_t      depth; // chunks waiting
+	uint64_t    sent;
+	uint64_t    dropped; // queue full or no chunk to loan
+	uint64_t    failed;  // refused by the publisher
+} iceoryx_map_stats;
+
+// NNG_EINVAL for a malformed entry, NNG_ENOSPC past NANO_ICEORYX_MAPS.
+extern int  iceoryx_map_parse(const char *spec, iceoryx_map_conf *c);
+extern int  iceoryx_map_conf_env(iceoryx_map_conf *c);
+extern void iceoryx_map_conf_free(iceoryx_map_conf *c);
+
+// Opens the publishers and subscribers on sock, owns c afterwards.
+extern int  iceoryx_map_init(nng_socket sock, iceoryx_map_conf *c);
+extern void iceoryx_map_fini(void);
+extern bool iceoryx_map_enabled(void);
+
+// The subscribers of the in mappings, for the iceoryx works to receive on.
+extern size_t iceoryx_map_subers(void ***subersp);
+
+/*
+ * Queue msg, an encoded PUBLISH on topic, to every out mapping matching
+ * it. ids is a cvector of the caller reused as scratch. Returns how many
+ * took it.
+ */
+extern size_t iceoryx_map_forward(nng_msg *msg, const char *topic,
+    const topic_levels *tl, uint32_t **ids);
+
+// Fills at most n, returns the number of out mappings.
+extern size_t iceoryx_map_stats_get(iceoryx_map_stats *st, size_t n);
+
+#endif
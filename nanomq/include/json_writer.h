@@ -0,0 +1,66 @@
+#ifndef NANOMQ_JSON_WRITER_H
+#define NANOMQ_JSON_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+/*
+ * A JSON document written front to back into the body of an nng_msg, for
+ * output that would otherwise be built as a cJSON tree and printed. The
+ * body always has a NUL after the text. Zeroed is a valid empty writer;
+ * json_writer_init() sizes the first allocation so that a document of
+ * about hint bytes takes only that one.
+ *
+ * Commas are put in by the writer: between values at the same level and
+ * between fields, tracked without a stack since a value always ends
+ * whatever came before it. json_write() copies text as it is and leaves
+ * that to the caller. A failed allocation sticks until the writer is
+ * taken or finished.
+ */
+typedef struct {
+	nng_msg *msg;
+	char    *buf;
+	size_t   len;
+	size_t   cap;
+	bool     comma; // a value ends right before
+	bool     failed;
+} json_writer;
+
+extern void json_writer_init(json_writer *w, size_t hint);
+extern void json_writer_fini(json_writer *w);
+// The document as a message of its length, NULL if writing failed.
+extern nng_msg *json_writer_take(json_writer *w);
+
+extern void json_write(json_writer *w, const char *text, size_t len);
+extern void json_write_str(json_writer *w, const char *text);
+
+// '{' or '[' and the matching '}' or ']'
+extern void json_write_begin(json_writer *w, char c);
+extern void json_write_end(json_writer *w, char c);
+extern void json_write_key(json_writer *w, const char *key);
+// s escaped like cJSON does, null for a NULL s
+extern void json_write_string(json_writer *w, const char *s, size_t len);
+extern void json_write_u64(json_writer *w, uint64_t v);
+extern void json_write_i64(json_writer *w, int64_t v);
+extern void json_write_bool(json_writer *w, bool v);
+extern void json_write_null(json_writer *w);
+
+/*
+ * Room for a string value of at most n bytes that need no escaping, to be
+ * filled in place and closed with the length used. NULL if it could not
+ * be had; the commit is still due then.
+ */
+extern char *json_write_string_reserve(json_writer *w, size_t n);
+extern void  json_write_string_commit(json_writer *w, size_t len);
+
+// A key and its value; s is a C string or NULL.
+extern void json_field_str(json_writer *w, const char *key, const char *s);
+extern void json_field_u64(json_writer *w, const char *key, uint64_t v);
+extern void json_field_i64(json_writer *w, const char *key, int64_t v);
+extern void json_field_bool(json_writer *w, const char *key, bool v);
+extern void json_field_null(json_writer *w, const char *key);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef NANOMQ_LATENCY_STATS_H
+#define NANOMQ_LATENCY_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One PUBLISH in this many is timed.
+#ifndef NANO_LATENCY_SAMPLE
+#define NANO_LATENCY_SAMPLE 16
+#endif
+
+enum latency_stage {
+	LATENCY_PUB,       // handle_pub as a whole
+	LATENCY_AUTH_HTTP, // HTTP auth of the publish
+	LATENCY_ACL,
+	LATENCY_MATCH, // subscriber lookup
+	LATENCY_RETAIN,
+	LATENCY_FANOUT, // sends to subscriber pipes
+	LATENCY_BRIDGE,
+	LATENCY_RULE,
+	LATENCY_HOOK, // webhook and exchange
+	LATENCY_TOTAL, // RECV until the worker is done with the message
+	LATENCY_STAGES
+};
+
+/*
+ * Log-linear buckets, four per power of two of nanoseconds, as HDR
+ * histograms use with two significant bits. Values of 2^36 ns and above
+ * land in the last bucket.
+ */
+#define LATENCY_MSB_MAX 35
+#define LATENCY_BUCKETS (4 * LATENCY_MSB_MAX)
+
+typedef struct {
+	uint64_t count;
+	uint64_t sum; // ns
+	uint64_t hist[LATENCY_BUCKETS];
+} latency_hist;
+
+typedef struct latency_block latency_block;
+
+extern int  latency_stats_init(void);
+extern void latency_stats_fini(void);
+extern bool latency_stats_enabled(void);
+
+/*
+ * Each worker records into a block of its own without any lock or atomic;
+ * readers add all blocks up and may see a sample half way in.
+ */
+extern latency_block *latency_block_alloc(void);
+extern bool           latency_sample(latency_block *lb);
+extern void     latency_record(latency_block *lb, int stage, uint64_t ns);
+extern uint64_t latency_now(void);
+
+extern void        latency_collect(latency_hist hist[LATENCY_STAGES]);
+extern const char *latency_stage_name(int stage);
+// Upper bound of the bucket holding quantile q, in ns.
+extern uint64_t latency_quantile(const latency_hist *h, double q);
+// Samples below 2^log2_ns ns.
+extern uint64_t latency_count_below(const latency_hist *h, unsigned log2_ns);
+
+/*
+ * Timing of a nano_work. LATENCY_SAMPLE decides in RECV whether the
+ * message is timed, stages then take LATENCY_BEGIN/LATENCY_END around
+ * them and LATENCY_DONE closes the message. All of it compiles away
+ * without SUPP_LATENCY_STATS.
+ */
+#if defined(SUPP_LATENCY_STATS)
+#define LATENCY_SAMPLE(w, on)                                        \
+	((w)->lat_start =                                            \
+	        (on) && latency_sample((w)->lat) ? latency_now() : 0)
+#define LATENCY_BEGIN(w) ((w)->lat_start != 0 ? latency_now() : 0)
+#define LATENCY_END(w, stage, t)                                    \
+	do {                                                         \
+		if ((t) != 0) {                                      \
+			latency_record(                              \
+			    (w)->lat, (stage), latency_now() - (t)); \
+		}                                                    \
+	} while (0)
+#define LATENCY_DONE(w)                                            \
+	do {                                                        \
+		LATENCY_END(w, LATENCY_TOTAL, (w)->lat_start);      \
+		(w)->lat_start = 0;                                 \
+	} while (0)
+#else
+#define LATENCY_SAMPLE(w, on) ((void) 0)
+#define LATENCY_BEGIN(w) 0
+#define LATENCY_END(w, stage, t) ((void) (t))
+#define LATENCY_DONE(w) ((void) 0)
+#endif
+
+#endif
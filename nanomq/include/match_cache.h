@@ -0,0 +1,60 @@
+#ifndef NANOMQ_MATCH_CACHE_H
+#define NANOMQ_MATCH_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+// Default number of cached topics, must be a power of two.
+#ifndef NANO_MATCH_CACHE_SIZE
+#define NANO_MATCH_CACHE_SIZE 4096
+#endif
+
+/*
+ * A resolved topic -> subscriber set. Entries are immutable once inserted
+ * and reference counted, so a PUBLISH can borrow the pid vector for the
+ * whole fan-out without holding any lock.
+ */
+typedef struct match_cache_entry {
+	char           *topic;
+	uint32_t        hash;
+	uint64_t        gen;
+	nng_atomic_int *ref;
+	uint32_t       *pipes;      // cvector from dbtree_find_clients
+	bool            has_shared; // any shared subscription matched
+} match_cache_entry;
+
+extern int  match_cache_init(size_t size);
+extern void match_cache_fini(void);
+extern bool match_cache_enabled(void);
+
+/*
+ * Bump the subscription generation. Must be called after every change to
+ * the subscription dbtree, so all entries resolved earlier become stale.
+ */
+extern void     match_cache_invalidate(void);
+extern uint64_t match_cache_generation(void);
+
+/*
+ * Look up a concrete topic. Returns a referenced entry which must be given
+ * back by match_cache_release, or NULL on miss.
+ */
+extern match_cache_entry *match_cache_get(const char *topic);
+
+/*
+ * Insert the subscriber set resolved for topic while the generation was gen.
+ * On success the cache takes ownership of pipes and returns a referenced
+ * entry. On failure NULL is returned and pipes still belongs to the caller.
+ */
+extern match_cache_entry *match_cache_put(
+    const char *topic, uint64_t gen, uint32_t *pipes, bool has_shared);
+
+extern void match_cache_release(match_cache_entry *entry);
+
+extern uint64_t match_cache_hits(void);
+extern uint64_t match_cache_misses(void);
+
+#endif
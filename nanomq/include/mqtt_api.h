@@ -10,9 +10,18 @@
 
 #define INPROC_SERVER_URL "inproc://inproc_server"
 
+/*
+ * With SUPP_WS_SHARED_FRAMES, WebSocket listeners build the frame header
+ * of a PUBLISH in a buffer the connection reuses and write it next to the
+ * encoded PUBLISH shared by all subscribers, instead of copying both into
+ * a frame of its own. Needs a transport that knows the option.
+ */
+#define NANO_OPT_WS_SHARED_FRAMES "ws-shared-frames"
+
 int nano_listen(
     nng_socket sid, const char *addr, nng_listener *lp, int flags, conf *conf);
 int init_listener_tls(nng_listener l, conf_tls *tls);
+void init_listener_ws(nng_listener l);
 
 extern int decode_common_mqtt_msg(nng_msg **dest, nng_msg *src);
 extern int encode_common_mqtt_msg(
@@ -28,8 +37,17 @@ extern uint16_t nano_pipe_get_local_port6(nng_pipe p);
 
 #if defined(SUPP_ICEORYX)
 #include "nng/iceoryx_shm/iceoryx_shm.h"
-extern int nano_iceoryx_send_nng_msg(
-    nng_iceoryx_puber *puber, nng_msg *msg, nng_socket *sock);
+
+// Client id of the cparam shared by all messages from iceoryx.
+#define NANO_ICEORYX_CLIENTID "nanomq-iceoryx"
+// Longest MQTT fixed header, type byte and 4 length bytes.
+#define NANO_MQTT_FIXED_HDR_MAX 5
+
+extern int  nano_iceoryx_init(void);
+extern void nano_iceoryx_fini(void);
+// A chunk loaned from puber holding the encoded msg, see iceoryx_map.h.
+extern int  nano_iceoryx_chunk_alloc(
+     nng_iceoryx_puber *puber, nng_msg *msg, nng_msg **icemsgp);
 extern int nano_iceoryx_recv_nng_msg(
     nng_iceoryx_suber *suber, nng_msg *icemsg, nng_msg **msg);
 extern bool nano_iceoryx_topic_filter(char *icetopic, char *topic, uint32_t topicsz);
@@ -0,0 +1,58 @@
+#ifndef NANOMQ_MSG_POOL_H
+#define NANOMQ_MSG_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Messages kept per size class and work, by capacity of the class.
+#ifndef NANO_MSG_POOL_CAP_256
+#define NANO_MSG_POOL_CAP_256 16
+#endif
+#ifndef NANO_MSG_POOL_CAP_1K
+#define NANO_MSG_POOL_CAP_1K 8
+#endif
+#ifndef NANO_MSG_POOL_CAP_4K
+#define NANO_MSG_POOL_CAP_4K 4
+#endif
+#ifndef NANO_MSG_POOL_CAP_16K
+#define NANO_MSG_POOL_CAP_16K 2
+#endif
+
+#define MSG_POOL_CLASSES 4
+
+/*
+ * Recycled scratch messages of a nano_work: variable headers built to be
+ * copied into another message, alias property templates and the like,
+ * which the broker allocates and frees itself. Messages handed to a pipe,
+ * the bridge or a store belong to the protocol layer once sent and are
+ * not pooled. Each work has a pool of its own, only used by it, so the
+ * classes need no lock. A message put back keeps its buffer, cleared, in
+ * the largest class its length fills; the class caps bound what is kept.
+ * A NULL pool falls back to nng_msg_alloc() and nng_msg_free().
+ */
+typedef struct msg_pool msg_pool;
+
+typedef struct {
+	size_t   pools;
+	uint64_t hits;   // served from a pool
+	uint64_t misses; // allocated
+	uint64_t drops;  // freed as the class was full or too large
+	size_t   cached; // messages kept by all pools now
+} msg_pool_stats;
+
+extern int  msg_pool_init(void);
+// Frees every pool and what it keeps.
+extern void msg_pool_fini(void);
+extern bool msg_pool_enabled(void);
+
+extern msg_pool *msg_pool_alloc(void);
+// An empty message with room for size body bytes.
+extern int  msg_pool_get(msg_pool *p, nng_msg **msgp, size_t size);
+extern void msg_pool_put(msg_pool *p, nng_msg *msg);
+
+extern void msg_pool_stats_get(msg_pool_stats *s);
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef NANOMQ_MSG_TRACE_H
+#define NANOMQ_MSG_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "include/topic_scan.h"
+
+// One PUBLISH in this many is traced, NANOMQ_TRACE_SAMPLE overrides it.
+#ifndef NANO_TRACE_SAMPLE
+#define NANO_TRACE_SAMPLE 1024
+#endif
+
+// Traces in flight or waiting for export; beyond that nothing is traced.
+#ifndef NANO_TRACE_POOL
+#define NANO_TRACE_POOL 1024
+#endif
+
+#ifndef NANO_TRACE_EVENTS
+#define NANO_TRACE_EVENTS 16
+#endif
+
+// Spans of one OTLP request, sent at the latest NANO_TRACE_FLUSH_MS late.
+#ifndef NANO_TRACE_BATCH
+#define NANO_TRACE_BATCH 256
+#endif
+
+#ifndef NANO_TRACE_FLUSH_MS
+#define NANO_TRACE_FLUSH_MS 1000
+#endif
+
+// Filters of NANOMQ_TRACE_TOPICS.
+#ifndef NANO_TRACE_TOPICS
+#define NANO_TRACE_TOPICS 16
+#endif
+
+// Length of a W3C traceparent: 00-<trace id>-<parent id>-<flags>
+#define TRACE_PARENT_LEN 55
+
+enum trace_event_kind {
+	TRACE_AUTH,     // auth_http let it through
+	TRACE_ACL,      // value 1 allowed, 0 denied
+	TRACE_MATCH,    // value: subscriber pipes matched
+	TRACE_RETAIN,   // value 1 stored, 0 cleared
+	TRACE_EGRESS,   // value: subscriber pipes sent to
+	TRACE_BRIDGE,   // handed to the bridges
+	TRACE_RULE,     // through the rule engine
+	TRACE_WEBHOOK,  // handed to the webhook
+	TRACE_EXCHANGE, // handed to the exchanges
+	TRACE_EVENT_KINDS
+};
+
+typedef struct msg_trace msg_trace;
+
+/*
+ * Tracing is on when NANOMQ_TRACE_OTLP names an OTLP/HTTP traces endpoint,
+ * e.g. http://127.0.0.1:4318/v1/traces. Spans are sent from a thread of
+ * their own through a webhook_pool, batched into JSON requests.
+ *
+ * NANOMQ_TRACE_TOPICS is a ',' separated list of filter[=n], a message on
+ * the first filter matching its topic being traced one in n times (1 when
+ * left out) instead of one in NANOMQ_TRACE_SAMPLE. 0 traces none.
+ */
+extern int  msg_trace_init(void);
+extern void msg_trace_fini(void);
+extern bool msg_trace_enabled(void);
+
+/*
+ * Head sampling of a decoded PUBLISH. A traceparent of the publisher
+ * decides on its own and becomes the parent; otherwise the topic filters,
+ * then one in NANOMQ_TRACE_SAMPLE counted in *seq of the worker. NULL
+ * when not sampled or all traces are taken. The trace is the worker's
+ * until msg_trace_end.
+ */
+extern msg_trace *msg_trace_begin(uint32_t *seq, const char *topic,
+    const topic_levels *tl, const uint8_t *traceparent, uint32_t pipe,
+    const char *client_id, uint8_t qos);
+extern void msg_trace_event(msg_trace *t, int kind, uint64_t value);
+// traceparent of the span, TRACE_PARENT_LEN bytes without a NUL
+extern void msg_trace_parent(const msg_trace *t, char *buf);
+// Hands the span over to the exporter, which never waits on it.
+extern void msg_trace_end(msg_trace *t);
+
+extern const char *msg_trace_event_name(int kind);
+
+/*
+ * The trace of a nano_work, NULL while its message is not traced. All of
+ * it compiles away without SUPP_MSG_TRACE.
+ */
+#if defined(SUPP_MSG_TRACE)
+#define MSG_TRACE_EVENT(w, kind, value)                            \
+	do {                                                        \
+		if ((w)->trace != NULL) {                           \
+			msg_trace_event((w)->trace, (kind), (value)); \
+		}                                                   \
+	} while (0)
+#define MSG_TRACE_END(w)                             \
+	do {                                          \
+		if ((w)->trace != NULL) {             \
+			msg_trace_end((w)->trace);    \
+			(w)->trace = NULL;            \
+		}                                     \
+	} while (0)
+#else
+#define MSG_TRACE_EVENT(w, kind, value) ((void) 0)
+#define MSG_TRACE_END(w) ((void) 0)
+#endif
+
+#endif
@@ -5,11 +5,14 @@
 #include "nng/supplemental/sqlite/sqlite3.h"
 #include "nng/supplemental/nanolib/conf.h"
 #include "nng/nng.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #if defined(SUPP_RULE_ENGINE)
 extern int nano_client(nng_socket *sock, repub_t *repub);
+// Whether a repub address names the listener at url, the broker itself.
+extern bool nano_client_is_local(const char *url, const char *address);
 extern int nano_client_publish(nng_socket *sock, const char *topic,
     uint8_t *payload, uint32_t len, uint8_t qos, property *props);
 extern int nanomq_client_sqlite(conf_rule *cr, bool init_last);
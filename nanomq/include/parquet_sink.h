@@ -0,0 +1,70 @@
+#ifndef NANOMQ_PARQUET_SINK_H
+#define NANOMQ_PARQUET_SINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+
+// Batches handed to the parquet writer at the same time.
+#ifndef NANO_PARQUET_WRITERS
+#define NANO_PARQUET_WRITERS 2
+#endif
+
+// Rows of one batch, written out as one row group.
+#ifndef NANO_PARQUET_ROW_GROUP_ROWS
+#define NANO_PARQUET_ROW_GROUP_ROWS 4096
+#endif
+
+// Payload bytes after which a batch is flushed before it is full.
+#ifndef NANO_PARQUET_BATCH_BYTES
+#define NANO_PARQUET_BATCH_BYTES (4 * 1024 * 1024)
+#endif
+
+// Age of its first row after which a batch is flushed, in milliseconds.
+#ifndef NANO_PARQUET_BATCH_AGE_MS
+#define NANO_PARQUET_BATCH_AGE_MS 1000
+#endif
+
+// Flushed batches that may wait for a writer before producers block.
+#ifndef NANO_PARQUET_PENDING
+#define NANO_PARQUET_PENDING 4
+#endif
+
+// Longest a producer blocks for a writer before its rows are dropped.
+#ifndef NANO_PARQUET_BLOCK_MS
+#define NANO_PARQUET_BLOCK_MS 1000
+#endif
+
+typedef struct {
+	uint64_t batches; // batches written
+	uint64_t rows;    // rows written
+	uint64_t failed;  // batches the writer reported an error for
+	uint64_t blocked; // puts that had to wait for a writer
+	uint64_t dropped; // rows lost after waiting NANO_PARQUET_BLOCK_MS
+} parquet_sink_stats;
+
+/*
+ * Rows taken from the exchange, gathered by topic into double-buffered
+ * batches: one fills while earlier ones wait for or sit in one of the
+ * NANO_PARQUET_WRITERS writers. A batch is flushed when it holds
+ * NANO_PARQUET_ROW_GROUP_ROWS rows or NANO_PARQUET_BATCH_BYTES of payload,
+ * or NANO_PARQUET_BATCH_AGE_MS after its first row, sorted by key so that
+ * range lookups stay cheap. Compression follows parquet.compress.
+ */
+extern int  parquet_sink_init(conf_parquet *conf);
+extern void parquet_sink_fini(void);
+
+/*
+ * Append the len rows of msgs, NULL entries skipped, to the batch of topic.
+ * Ownership of the rows and of the msgs array moves to the sink. When every
+ * writer is busy and NANO_PARQUET_PENDING batches wait already, the caller
+ * blocks for up to NANO_PARQUET_BLOCK_MS; NNG_EAGAIN tells it that rows
+ * were dropped after all.
+ */
+extern int parquet_sink_put(const char *topic, nng_msg **msgs, size_t len);
+
+extern void parquet_sink_stat(parquet_sink_stats *stats);
+
+#endif
@@ -9,6 +9,10 @@
 #ifndef NANOMQ_PLUGIN_H
 #define NANOMQ_PLUGIN_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "nng/nng.h"
 #include "nng/supplemental/nanolib/conf.h"
 #include "nng/supplemental/nanolib/log.h"
@@ -18,17 +22,78 @@ struct nano_plugin {
 	int (*init)(void);
 };
 
+/*
+ * What the hooks of each point get as data:
+ * HOOK_USER_PROPERTY  char *[2], key and value of a v5 user property to add
+ *                     (malloc'd), asked once per message
+ * HOOK_ON_CONNECT     plugin_conn_view *, after the CONNACK went out
+ * HOOK_ON_PUBLISH     plugin_msg_view *, a PUBLISH of a client, decoded
+ * HOOK_ON_ROUTE       plugin_msg_view *, before it is sent to subscribers
+ * HOOK_ON_DELIVER     plugin_msg_view *, one per subscriber it was sent to
+ */
 enum hook_point {
 	HOOK_USER_PROPERTY,
+	HOOK_ON_CONNECT,
+	HOOK_ON_PUBLISH,
+	HOOK_ON_ROUTE,
+	HOOK_ON_DELIVER,
+	HOOK_POINT_NUM,
 };
 
+/*
+ * Read-only views into the broker's own message and connection, valid for
+ * the call only: copy what has to outlive it. Strings are NUL terminated,
+ * NULL where the broker does not have them at that point.
+ */
+typedef struct {
+	const char    *topic;
+	uint32_t       topic_len;
+	const uint8_t *payload;
+	uint32_t       payload_len;
+	uint8_t        qos;
+	bool           retain;
+	uint8_t        proto_ver;
+	uint32_t       pipe_id;     // publisher, or subscriber for ON_DELIVER
+	const char    *client_id;   // of the publisher
+	const char    *username;    // of the publisher
+	size_t         subscribers; // matched, from ON_ROUTE on
+} plugin_msg_view;
+
+typedef struct {
+	uint32_t    pipe_id;
+	const char *client_id;
+	const char *username;
+	uint8_t     proto_ver;
+	uint16_t    keepalive;
+	bool        clean_start;
+	uint8_t     reason; // of the CONNACK
+} plugin_conn_view;
+
+/*
+ * Hooks of a point run by ascending order, those of the same order as they
+ * were registered. One returning non-zero ends the run and that is what
+ * plugin_hook_call() returns. A batch hook gets the data of N calls at
+ * once; plugin_hook_call() hands it a batch of one, and plugin_hook_call_batch()
+ * calls plain hooks once per element. Hooks are registered while plugins
+ * load at startup and called from every worker thread at once.
+ */
 struct plugin_hook {
 	unsigned int point;
+	int          order;
 	int (*cb)(void *data);
+	int (*batch)(void **data, size_t n);
 };
 
+// Order 0.
 extern int plugin_hook_register(unsigned int point, int (*cb)(void *data));
-extern int plugin_hook_call(unsigned int point, void *data);
+extern int plugin_hook_register_ordered(
+    unsigned int point, int order, int (*cb)(void *data));
+extern int plugin_hook_register_batch(
+    unsigned int point, int order, int (*cb)(void **data, size_t n));
+// Cheap enough to ask before building the data for a call.
+extern bool plugin_hook_has(unsigned int point);
+extern int  plugin_hook_call(unsigned int point, void *data);
+extern int  plugin_hook_call_batch(unsigned int point, void **data, size_t n);
 extern int plugin_register(char *path);
 extern void plugins_clear();
 extern int plugin_init(struct nano_plugin *plugin);
@@ -0,0 +1,57 @@
+#ifndef NANOMQ_PROC_STATS_H
+#define NANOMQ_PROC_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+
+#ifndef NANO_PROC_STATS_INTERVAL_MS
+#define NANO_PROC_STATS_INTERVAL_MS 5000
+#endif
+
+// Samples kept for /api/v4/resources, ten minutes at the default interval.
+#ifndef NANO_PROC_STATS_HISTORY
+#define NANO_PROC_STATS_HISTORY 120
+#endif
+
+// Threads of the process followed for per thread CPU time.
+#ifndef NANO_PROC_STATS_THREADS
+#define NANO_PROC_STATS_THREADS 256
+#endif
+
+typedef struct {
+	nng_time time;
+	float    cpu_percent; // share of all CPUs of the host
+	uint64_t memory;      // RSS bytes
+	uint32_t fds;
+	uint32_t threads;
+	uint32_t taskq_threads;
+	float    taskq_cpu_percent;     // nng taskq threads summed, of one CPU
+	float    taskq_cpu_max_percent; // busiest taskq thread, of one CPU
+	uint32_t connections;
+	uint32_t topics;
+	uint32_t subscribers;
+	uint64_t bridge_queue_depth; // all MQTT bridge nodes
+	uint64_t aws_queue_depth;    // all AWS bridge nodes
+} proc_sample;
+
+/*
+ * A thread samples the process and broker every interval into a ring of
+ * NANO_PROC_STATS_HISTORY entries, so scrapes only copy the last one out.
+ * CPU, memory, fd and thread figures come from /proc and stay 0 on other
+ * platforms. Bridge queues are read from config, which may be NULL.
+ */
+extern int  proc_stats_init(conf *config, nng_duration interval);
+extern void proc_stats_fini(void);
+extern bool proc_stats_enabled(void);
+
+extern bool proc_stats_latest(proc_sample *s);
+// Largest value of every field over all samples taken.
+extern bool proc_stats_max(proc_sample *s);
+// Copy up to cap samples to s, oldest first.
+extern size_t proc_stats_history(proc_sample *s, size_t cap);
+
+#endif
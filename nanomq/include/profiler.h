@@ -0,0 +1,102 @@
+#ifndef NANOMQ_PROFILER_H
+#define NANOMQ_PROFILER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+#ifndef NANO_PROF_HZ
+#define NANO_PROF_HZ 99
+#endif
+
+#ifndef NANO_PROF_MAX_SECONDS
+#define NANO_PROF_MAX_SECONDS 300
+#endif
+
+// Samples of one run at most, later ones are counted as dropped.
+#ifndef NANO_PROF_MAX_SAMPLES
+#define NANO_PROF_MAX_SAMPLES 32768
+#endif
+
+// Frames kept of each sample.
+#ifndef NANO_PROF_DEPTH
+#define NANO_PROF_DEPTH 32
+#endif
+
+// A lock wait this long, in ns, counts as contended.
+#ifndef NANO_PROF_CONTENDED_NS
+#define NANO_PROF_CONTENDED_NS 1000
+#endif
+
+// States of server_cb, in the order of nano_work's state.
+#define PROF_STATES 7
+
+enum prof_lock_id {
+	PROF_LOCK_BRIDGE_NODE, // conf_bridge_node mtx
+	PROF_LOCK_HASHMAP,     // clientid hashmap stripes
+	PROF_LOCK_RULE,        // rule_mutex of the rule engine
+	PROF_LOCK_EXCHANGE,    // ex_mtx of webhook exchanges
+	PROF_LOCK_REST_JOB,    // job_lock of the REST workers
+	PROF_LOCKS
+};
+
+typedef struct {
+	uint64_t acquired;
+	uint64_t contended; // waits of NANO_PROF_CONTENDED_NS and more
+	uint64_t wait_ns;   // summed over contended waits
+	uint64_t wait_max_ns;
+} prof_lock_stats;
+
+typedef struct {
+	uint64_t states[PROF_STATES]; // server_cb calls per state
+	prof_lock_stats locks[PROF_LOCKS];
+} prof_counters;
+
+typedef struct prof_block prof_block;
+
+extern int  prof_init(void);
+extern void prof_fini(void);
+extern bool prof_enabled(void);
+
+/*
+ * Samples the threads of the process on a CPU time timer at hz for secs
+ * seconds and folds the stacks into *folded, one "thread;outer;...;inner
+ * count" line per distinct stack, *len long and freed with nng_strfree.
+ * Frames without a symbol are written as module+0xoffset. Only one run is
+ * taken at a time, others fail with NNG_EBUSY. Counters before and after
+ * the run go to before and after when not NULL.
+ */
+extern int prof_run(unsigned secs, unsigned hz, char **folded, size_t *len,
+    uint64_t *samples, uint64_t *dropped, prof_counters *before,
+    prof_counters *after);
+
+/*
+ * Each worker counts its server_cb states in a block of its own without
+ * any lock or atomic, readers add all blocks up.
+ */
+extern prof_block *prof_block_alloc(void);
+extern void        prof_state(prof_block *pb, int state);
+
+extern void prof_lock(int id, nng_mtx *mtx);
+extern void prof_collect(prof_counters *pc);
+
+extern const char *prof_state_name(int state);
+extern const char *prof_lock_name(int id);
+
+/*
+ * PROF_LOCK stands in for nng_mtx_lock of the locks above and
+ * PROF_STATE counts a server_cb call, both compile down to the plain call
+ * or nothing without SUPP_PROFILER.
+ */
+#if defined(SUPP_PROFILER)
+#define PROF_LOCK(id, mtx) prof_lock((id), (mtx))
+#define PROF_STATE(w) prof_state((w)->prof, (int) (w)->state)
+#else
+#define PROF_LOCK(id, mtx) nng_mtx_lock(mtx)
+#define PROF_STATE(w) ((void) 0)
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef NANOMQ_PUB_BULK_H
+#define NANOMQ_PUB_BULK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Records of a POST /api/v4/mqtt/publish_bulk body, taken one at a time
+ * straight from the request buffer.
+ *
+ * NDJSON: one publish object per line, blank lines are skipped.
+ * Binary: records of, all integers big endian,
+ *   u8 flags (bits 0-1 QoS, bit 2 retain) | u16 topic length | topic |
+ *   u32 payload length | payload
+ */
+typedef enum {
+	PUB_BULK_NDJSON,
+	PUB_BULK_BINARY,
+} pub_bulk_format;
+
+typedef struct {
+	const uint8_t  *buf;
+	size_t          len;
+	size_t          off; // start of the next record
+	pub_bulk_format format;
+} pub_bulk_reader;
+
+typedef struct {
+	const char    *topic; // not NUL terminated
+	size_t         topic_len;
+	const uint8_t *payload; // the whole line for NDJSON
+	size_t         payload_len;
+	uint8_t        qos;
+	bool           retain;
+} pub_bulk_record;
+
+extern void pub_bulk_reader_init(pub_bulk_reader *r, pub_bulk_format format,
+    const void *buf, size_t len);
+
+/*
+ * 0 with the next record in rec, NNG_ENOENT once the body is used up.
+ * NNG_EINVAL for a well framed binary record with an empty topic or a bad
+ * QoS, skipped so the caller can go on. NNG_EPROTO for a truncated binary
+ * record, nothing after it can be read.
+ */
+extern int pub_bulk_next(pub_bulk_reader *r, pub_bulk_record *rec);
+
+#endif
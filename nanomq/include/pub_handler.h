@@ -6,6 +6,11 @@
 #define NANOMQ_PUB_HANDLER_H
 
 #include "broker.h"
+#include "match_cache.h"
+#include "topic_scan.h"
+#if defined(SUPP_RETAIN_LOG)
+#include "retain_log.h"
+#endif
 #include <nng/mqtt/packet.h>
 #include <nng/nng.h>
 #include <nng/protocol/mqtt/mqtt.h>
@@ -46,26 +51,117 @@ struct mqtt_payload {
 	uint32_t len;
 };
 
+// Topics up to this length are kept inside pub_packet_struct itself
+#define PUB_TOPIC_INLINE_LEN 127
+
+/*
+ * For PUBLISH decoded by handle_pub the payload is a view into the body of
+ * work->msg (kept NUL terminated right behind the body) and short topics
+ * live in topic_inline. Only a rewritten topic (topic alias, bridge
+ * reflection) or a copying decode put them elsewhere, in the work arena
+ * when there is one or on the heap.
+ */
 struct pub_packet_struct {
 	struct fixed_header   fixed_header;
 	union variable_header var_header;
 	struct mqtt_payload   payload;
+
+	uint8_t proto;         // version used by decode
+	bool    topic_owned;   // topic_name.body is heap memory
+	bool    payload_owned; // payload.data is heap memory
+	bool    dirty;         // variable header differs from the wire
+	char    topic_inline[PUB_TOPIC_INLINE_LEN + 1];
+
+	// found by decode along with the topic checks, see pub_packet_levels
+	topic_levels levels;
+
+	// the struct and long topics live in the arena of the work, if any
+	struct work_arena *arena;
+	struct msg_pool   *mpool; // of the work, for alias_props
+
+	// properties of the aliased copies, see encode_pub_alias
+	nng_msg *alias_props;
+	uint32_t alias_slot;
+
+	// v5 properties left undecoded in the body at prop_pos, with the
+	// two the broker itself needs picked up when they were checked
+	bool     props_lazy;
+	bool     props_scanned; // pub_props_scan took all, lazy or still empty
+	uint32_t prop_pos;
+	uint16_t topic_alias;
+	uint32_t expiry;
+	// value of a "traceparent" user property in the body, TRACE_PARENT_LEN
+	// bytes, found by the scan of lazy properties only
+	const uint8_t *traceparent;
+	// the same for the BRIDGE_DEDUPE_KEY stamp, BRIDGE_DEDUPE_ID_LEN bytes
+	const uint8_t *bridge_mid;
+	// and a BRIDGE_ZIP_KEY of BRIDGE_ZIP_ZLIB, rewritten once inflated
+	const uint8_t *bridge_zip;
 };
 
+// Subscriber pipes matched by one PUBLISH. Both are the cvectors returned
+// by dbtree_find_clients/dbtree_find_shared_clients, owned until
+// free_pipe_content. A pid of 0 marks an empty slot and must be skipped.
+// When cached is set, pipes is borrowed from that match cache entry.
 struct pipe_content {
-	mqtt_msg_info *msg_infos;
+	uint32_t                 *pipes;
+	uint32_t                 *shared_pipes;
+	struct match_cache_entry *cached;
 };
 
 bool encode_pub_message(
     nng_msg *dest_msg, nano_work *work, mqtt_control_packet_types cmd);
+nng_msg *encode_pub_alias(
+    nng_msg *smsg, nano_work *work, uint16_t alias, bool known);
 reason_code decode_pub_message(nano_work *work, uint8_t proto);
+/*
+ * Properties of a v5 PUBLISH, decoded on first use from msg, the message
+ * pub_packet came from or a copy of it, before its body is re-encoded.
+ */
+property *pub_packet_properties(
+    struct pub_packet_struct *pub_packet, nng_msg *msg);
+// Topic Alias the publisher sent, 0 for none.
+uint16_t pub_packet_alias(struct pub_packet_struct *pub_packet);
+reason_code decode_pub_view(nano_work *work, uint8_t proto);
+void pub_packet_set_topic(
+    struct pub_packet_struct *pub_packet, char *topic, uint32_t len);
+int  pub_packet_copy_topic(
+     struct pub_packet_struct *pub_packet, const char *topic, uint32_t len);
+// Levels of the topic, split again only after it was rewritten.
+const topic_levels *pub_packet_levels(struct pub_packet_struct *pub_packet);
 void free_pub_packet(struct pub_packet_struct *pub_packet);
-void free_msg_infos(mqtt_msg_info *msg_infos);
 void init_pipe_content(struct pipe_content *pipe_ct);
+void free_pipe_content(struct pipe_content *pipe_ct);
+size_t pipe_content_count(struct pipe_content *pipe_ct);
+
+// Subscribers up to this many are deduplicated by a plain scan, more by a
+// hash set taken from the work arena.
+#ifndef NANO_PIPE_DEDUP_LINEAR
+#define NANO_PIPE_DEDUP_LINEAR 16
+#endif
+
+/*
+ * Keep one pid of a pipe whose subscriptions overlap (a/# and a/+/c) and
+ * drop empty slots, in place and in order. The protocol layer encodes one
+ * delivery per pipe with the highest QoS and all subscription identifiers
+ * of its filters matching the topic. Returns the pids left.
+ */
+size_t pipe_content_dedup(uint32_t *pipes, struct work_arena *arena);
 void init_pub_packet_property(struct pub_packet_struct *pub_packet);
 bool check_msg_exp(nng_msg *msg, property *prop);
+#if defined(SUPP_PLUGIN)
+void pub_packet_plugin_property(nano_work *work, nng_msg *msg);
+#endif
 
 reason_code handle_pub(nano_work *work, struct pipe_content *pipe_ct,
     uint8_t proto, bool is_event);
 
+// retain_store_reaper callback, arg is the retain dbtree
+void expire_retain_msg(void *db_ret, const char *topic, nng_msg *msg);
+
+#if defined(SUPP_RETAIN_LOG)
+// retain_log_load callback, arg is the retain dbtree
+void restore_retain_msg(void *db_ret, const retain_log_rec *rec);
+#endif
+
 #endif // NNG_PUB_HANDLER_H
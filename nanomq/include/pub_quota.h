@@ -0,0 +1,73 @@
+#ifndef NANOMQ_PUB_QUOTA_H
+#define NANOMQ_PUB_QUOTA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Pipes and usernames are spread over this many locks each.
+#ifndef NANO_PUB_QUOTA_SHARDS
+#define NANO_PUB_QUOTA_SHARDS 64
+#endif
+
+// Longest a PUBLISH over quota is held back (ms).
+#ifndef NANO_PUB_QUOTA_DELAY_MS
+#define NANO_PUB_QUOTA_DELAY_MS 1000
+#endif
+
+typedef enum {
+	PUB_QUOTA_DROP,       // QoS 0 over quota is dropped, QoS 1/2 delayed
+	PUB_QUOTA_DELAY,      // the work holds the PUBLISH until it fits
+	PUB_QUOTA_DISCONNECT, // the client is disconnected
+	PUB_QUOTA_POLICIES,
+} pub_quota_policy;
+
+/*
+ * Rates are per second, 0 for unlimited, a bucket holding one second of
+ * its rate. The user rates are shared by all clients of one username.
+ */
+typedef struct {
+	uint32_t         msg_rate;
+	uint64_t         byte_rate;
+	uint32_t         user_msg_rate;
+	uint64_t         user_byte_rate;
+	pub_quota_policy policy;
+	uint32_t         delay_ms;
+} pub_quota_conf;
+
+typedef enum {
+	PUB_QUOTA_PASS,
+	PUB_QUOTA_DROPPED,
+	PUB_QUOTA_WAIT, // pass after *wait ms
+	PUB_QUOTA_CLOSE,
+} pub_quota_verdict;
+
+typedef struct {
+	uint64_t violations[PUB_QUOTA_POLICIES];
+	uint64_t delay_ms; // total PUBLISH were held back
+	size_t   clients;
+	size_t   users;
+} pub_quota_stats;
+
+// Not enabled, and every PUBLISH passes, unless c sets a rate.
+extern int  pub_quota_init(const pub_quota_conf *c);
+extern void pub_quota_fini(void);
+extern bool pub_quota_enabled(void);
+
+// Fields of c with their NANOMQ_PUB_QUOTA_* environment variable set.
+extern void pub_quota_conf_env(pub_quota_conf *c);
+
+// Buckets of a client from its CONNACK until its disconnect event.
+extern void pub_quota_open(uint32_t pipe, const char *username);
+extern void pub_quota_close(uint32_t pipe);
+
+// Charge one PUBLISH of bytes to the buckets of pipe.
+extern pub_quota_verdict pub_quota_check(
+    uint32_t pipe, size_t bytes, uint8_t qos, nng_duration *wait);
+
+extern void pub_quota_stats_get(pub_quota_stats *s);
+extern const char *pub_quota_policy_name(pub_quota_policy p);
+
+#endif
@@ -22,6 +22,14 @@
 #define REST_HOST "http://0.0.0.0:%u"
 #define REST_URL REST_HOST REST_URI_ROOT
 
+// Entries of a /clients or /subscriptions page without and with ?limit=.
+#ifndef NANO_REST_PAGE_LIMIT
+#define NANO_REST_PAGE_LIMIT 1000
+#endif
+#ifndef NANO_REST_PAGE_LIMIT_MAX
+#define NANO_REST_PAGE_LIMIT_MAX 10000
+#endif
+
 #define getNumberValue(obj, item, key, value, rv)           \
 	{                                                   \
 		item = cJSON_GetObjectItem(obj, key);       \
@@ -91,11 +99,14 @@ typedef struct http_msg {
 	size_t   data_len;
 	char *   data;
 	bool     encrypt_data;
+	size_t   etag_len;
+	char *   etag; // If-None-Match of a request, ETag of a response
 } http_msg;
 
 extern void     put_http_msg(http_msg *msg, const char *content_type,
         const char *method, const char *uri, const char *token, const char *data,
         size_t data_sz);
+extern void     put_http_etag(http_msg *msg, const char *etag);
 extern void     destory_http_msg(http_msg *msg);
 extern http_msg process_request(
     http_msg *msg, conf_http_server *config, nng_socket *sock);
@@ -0,0 +1,58 @@
+#ifndef NANOMQ_RETAIN_INDEX_H
+#define NANOMQ_RETAIN_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Topics a cursor looks at per hold of the index lock.
+#ifndef NANO_RETAIN_INDEX_VISIT
+#define NANO_RETAIN_INDEX_VISIT 1024
+#endif
+
+/*
+ * Topics of the in-memory retained messages in one array, sorted level by
+ * level, so the topics under a literal prefix are a single run and
+ * a wildcard filter is answered by a cursor walking that run only. A
+ * cursor hands out a limited number of messages per call and holds no lock
+ * in between, it resumes behind the last topic it returned, so retained
+ * messages added or removed meanwhile are seen or missed like those of a
+ * later or earlier SUBSCRIBE. The index holds a reference to every msg.
+ */
+typedef struct retain_cursor retain_cursor;
+
+typedef struct {
+	uint64_t topics;
+	uint64_t scans;   // cursors opened
+	uint64_t visited; // topics looked at by cursors
+	uint64_t matched;
+} retain_index_stats;
+
+extern int  retain_index_init(void);
+extern void retain_index_fini(void);
+extern bool retain_index_enabled(void);
+
+// Set or replace the retained msg of topic, a reference is taken.
+extern int  retain_index_put(const char *topic, nng_msg *msg);
+extern void retain_index_remove(const char *topic);
+
+/*
+ * A cursor over the retained messages matching filter, NULL when the
+ * index is not enabled, filter has no wildcard or is a shared one, the
+ * caller asks the retain tree then.
+ */
+extern retain_cursor *retain_index_open(const char *filter);
+extern void           retain_index_close(retain_cursor *c);
+
+/*
+ * Append up to limit references of matching messages to the cvector
+ * *msgs. Returns how many were added, 0 once the cursor is done.
+ */
+extern size_t retain_index_next(
+    retain_cursor *c, nng_msg ***msgs, size_t limit);
+
+extern void retain_index_stats_get(retain_index_stats *s);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef NANOMQ_RETAIN_LOG_H
+#define NANOMQ_RETAIN_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+#ifndef NANO_RETAIN_LOG_DIR
+#define NANO_RETAIN_LOG_DIR "/tmp/nanomq_retain"
+#endif
+
+// Size of one mmap'ed segment file (bytes).
+#ifndef NANO_RETAIN_LOG_SEGMENT
+#define NANO_RETAIN_LOG_SEGMENT (64 * 1024 * 1024)
+#endif
+
+/*
+ * Persistent retain backend: an append-only log of retained PUBLISH packets
+ * spread over mmap'ed segment files, with an in-memory index of the latest
+ * record of every topic. Replaced and deleted messages are dropped by
+ * compaction once the log holds more garbage than live data.
+ */
+
+typedef struct {
+	const char    *topic;
+	uint8_t        proto_ver;
+	const uint8_t *head; // MQTT fixed header
+	size_t         head_len;
+	const uint8_t *body;
+	size_t         body_len;
+	uint32_t       expiry; // remaining seconds, 0 if the msg never expires
+} retain_log_rec;
+
+typedef void (*retain_log_cb)(void *arg, const retain_log_rec *rec);
+
+/*
+ * Map all segments found in dir (created if missing) and rebuild the topic
+ * index from them.
+ */
+extern int  retain_log_open(const char *dir, size_t seg_size);
+extern void retain_log_close(void);
+extern bool retain_log_enabled(void);
+
+/*
+ * Hand every live retained message to cb, then compact the log if it is
+ * worth it. Records are only valid during the callback.
+ */
+extern int retain_log_load(retain_log_cb cb, void *arg);
+
+extern int retain_log_put(const char *topic, uint8_t proto_ver,
+    const void *head, size_t head_len, const void *body, size_t body_len,
+    uint32_t expiry);
+extern int retain_log_del(const char *topic);
+
+extern uint64_t retain_log_live_count(void);
+extern uint64_t retain_log_live_bytes(void);
+extern uint64_t retain_log_dead_bytes(void);
+
+#endif
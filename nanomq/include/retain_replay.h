@@ -0,0 +1,46 @@
+#ifndef NANOMQ_RETAIN_REPLAY_H
+#define NANOMQ_RETAIN_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "include/retain_index.h"
+
+// Number of dedicated replay contexts, jobs are spread over them by pipe id.
+#ifndef NANO_RETAIN_REPLAY_LANES
+#define NANO_RETAIN_REPLAY_LANES 2
+#endif
+
+// Retained messages handed to the protocol layer per lane and per tick.
+#ifndef NANO_RETAIN_REPLAY_BATCH
+#define NANO_RETAIN_REPLAY_BATCH 64
+#endif
+
+// Pause between two ticks of a busy lane (ms), lets the pipes drain.
+#ifndef NANO_RETAIN_REPLAY_INTERVAL
+#define NANO_RETAIN_REPLAY_INTERVAL 1
+#endif
+
+extern int  retain_replay_init(nng_socket sock, size_t lanes);
+extern void retain_replay_fini(void);
+
+/*
+ * Queue retained messages for delivery to a freshly subscribed pipe.
+ * msgs is a cvector of referenced messages (as returned by
+ * dbtree_find_retain), ownership of the vector and of every reference moves
+ * to the replay queue on success.
+ */
+extern int retain_replay_submit(
+    uint32_t pid, uint8_t proto_ver, nng_msg **msgs);
+
+/*
+ * Queue the retained messages a wildcard cursor of the retain index finds,
+ * fetched a batch per tick while the job is sent. The cursor moves to the
+ * replay queue on success.
+ */
+extern int retain_replay_stream(
+    uint32_t pid, uint8_t proto_ver, retain_cursor *cursor);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef NANOMQ_RETAIN_STORE_H
+#define NANOMQ_RETAIN_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+#include "include/expiry_wheel.h"
+
+// Default number of hash buckets, must be a power of two.
+#ifndef NANO_RETAIN_STORE_BUCKETS
+#define NANO_RETAIN_STORE_BUCKETS 4096
+#endif
+
+/*
+ * Side table of the in-memory retain dbtree. Every retained message gets an
+ * entry when it is inserted, holding its expiry and the ready-to-send
+ * PUBLISH images for v3.1.x and v5 subscribers. Images are encoded on first
+ * use and handed out as clones, so replaying a retained message costs a
+ * single encode per protocol version for its whole lifetime.
+ */
+
+extern int  retain_store_init(size_t buckets);
+extern void retain_store_fini(void);
+extern bool retain_store_enabled(void);
+
+/*
+ * Track msg, which is about to be inserted into the retain tree under
+ * topic. expiry is the MQTT v5 message expiry interval in seconds, 0 if
+ * none. The store does not take a reference, msg must be removed before
+ * the tree releases it.
+ */
+extern int  retain_store_add(nng_msg *msg, const char *topic, uint32_t expiry);
+extern void retain_store_remove(nng_msg *msg);
+
+/*
+ * Called on the expiry wheel thread once a tracked msg with an expiry is
+ * due, to take it out of the retain tree. msg is only a key to compare
+ * with what the tree holds under topic, it may have been released since.
+ */
+typedef void (*retain_store_reap_cb)(
+    void *arg, const char *topic, nng_msg *msg);
+extern void retain_store_reaper(retain_store_reap_cb cb, void *arg);
+
+/*
+ * Get the PUBLISH image of a tracked retained msg for a subscriber speaking
+ * proto_ver. On success *wirep holds a new reference to the shared image.
+ * Returns NNG_ENOENT if msg is not tracked, NNG_ETIMEDOUT if it expired.
+ */
+extern int retain_store_wire(
+    nng_msg *msg, uint8_t proto_ver, nng_msg **wirep);
+
+/*
+ * Encode a retained message as PUBLISH for a subscriber speaking proto_ver.
+ * Returns a new message, or NULL on failure.
+ */
+extern nng_msg *retain_store_encode(nng_msg *msg, uint8_t proto_ver);
+
+extern uint64_t retain_store_count(void);
+extern uint64_t retain_store_bytes(void);
+extern uint64_t retain_store_expired(void);
+
+#endif
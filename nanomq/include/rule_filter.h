@@ -0,0 +1,119 @@
+#ifndef NANOMQ_RULE_FILTER_H
+#define NANOMQ_RULE_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/supplemental/nanolib/cJSON.h"
+#include "nng/supplemental/nanolib/conf.h"
+#include "include/broker.h"
+#include "include/topic_match.h"
+
+#if defined(SUPP_RULE_ENGINE)
+
+// Candidate rules one PUBLISH collects from the topic index before the
+// dispatch gives up on it and walks every rule.
+#ifndef NANO_RULE_MATCH_MAX
+#define NANO_RULE_MATCH_MAX 64
+#endif
+
+/*
+ * JSON payload of one PUBLISH, parsed on first use and then shared by every
+ * rule the message is matched against.
+ */
+typedef struct {
+	struct pub_packet_struct *pp;
+	cJSON                    *root; // NULL when the payload is not JSON
+	bool                      parsed;
+} rule_doc;
+
+// A payload field the matching rule took out, indexed like rule.payload.
+// str and obj point into the rule_doc and live as long as it does.
+typedef struct rule_value {
+	int         type; // cJSON_Number, cJSON_String, cJSON_Object or 0
+	long        num;
+	const char *str;
+	cJSON      *obj;
+} rule_value;
+
+extern void   rule_doc_init(rule_doc *doc, struct pub_packet_struct *pp);
+extern cJSON *rule_doc_get(rule_doc *doc);
+extern void   rule_doc_fini(rule_doc *doc);
+
+// Shards readers count themselves into, a worker picks one by its id.
+#ifndef NANO_RULE_EPOCH_SHARDS
+#define NANO_RULE_EPOCH_SHARDS 16
+#endif
+
+/*
+ * The rules one PUBLISH is matched against: a version of the table that
+ * stays as it is, and alive, until rule_filter_leave.
+ */
+typedef struct {
+	rule    *rules; // copies, index them like rule_filter_lookup does
+	size_t   count;
+	uint64_t version;
+	void    *table;
+	uint32_t shard;
+	uint8_t  parity;
+	bool     entered;
+} rule_view;
+
+typedef struct {
+	bool     enabled;
+	uint64_t evals;   // messages the rule was matched against
+	uint64_t hits;    // of them passing it
+	uint64_t eval_ns; // spent matching
+} rule_filter_stats;
+
+/*
+ * The WHERE clause of every rule, compiled once when rules are loaded or
+ * changed through the REST API: thresholds parsed to integers, strings
+ * measured, integer checks ordered before string ones and the payload
+ * field walk last. Matching a PUBLISH then reads the program only.
+ *
+ * Programs sit in a versioned table together with copies of the rules and
+ * a trie of their FROM topics. rule_filter_compile builds the next version
+ * from conf_rule.rules and swaps it in; PUBLISH workers take no lock, the
+ * old version is freed once the last of them left it. Writers of
+ * conf_rule.rules hold rule_filter_lock over the change and the compile,
+ * anything they unlink from a rule goes through rule_filter_defer.
+ */
+extern int  rule_filter_init(void);
+extern void rule_filter_fini(void);
+extern void rule_filter_lock(void);
+extern void rule_filter_unlock(void);
+extern int  rule_filter_compile(conf_rule *cr);
+
+// Call fn(arg) once no reader can see the table of now any more.
+extern void rule_filter_defer(void (*fn)(void *), void *arg);
+
+// Writer side, the counters and flag of a rule live across versions.
+extern int      rule_filter_enable(uint32_t rule_id, bool enabled);
+extern int      rule_filter_stat(uint32_t rule_id, rule_filter_stats *stats);
+extern uint64_t rule_filter_version(void);
+
+extern void rule_filter_enter(rule_view *v, uint32_t worker);
+extern void rule_filter_leave(rule_view *v);
+
+/*
+ * Store in idx, ascending, the indexes of the rules of v whose FROM topic
+ * may match topic, and return how many there are. tl are the levels of
+ * topic, split here when NULL. A result above cap, also returned while the
+ * index is missing, means the caller has to walk every rule.
+ */
+extern size_t rule_filter_lookup(rule_view *v, const char *topic,
+    const topic_levels *tl, uint32_t *idx, size_t cap);
+
+/*
+ * Whether the PUBLISH of work passes the enabled rule v->rules[index],
+ * counted into its stats. The payload fields the rule selects are left in
+ * work->rule_vals until the next call.
+ */
+extern bool rule_filter_match(
+    nano_work *work, rule_doc *doc, rule_view *v, size_t index);
+
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef NANOMQ_RULE_SINK_H
+#define NANOMQ_RULE_SINK_H
+
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+
+#if defined(SUPP_RULE_ENGINE)
+
+// Rows written in one transaction.
+#ifndef NANO_RULE_SINK_BATCH
+#define NANO_RULE_SINK_BATCH 256
+#endif
+
+// Age of the oldest queued row after which a short batch is written.
+#ifndef NANO_RULE_SINK_LINGER_MS
+#define NANO_RULE_SINK_LINGER_MS 100
+#endif
+
+// Rows a sink holds before new ones are dropped.
+#ifndef NANO_RULE_SINK_QUEUE
+#define NANO_RULE_SINK_QUEUE 8192
+#endif
+
+/*
+ * Rule engine rows bound for SQLite or MySQL, queued per database
+ * connection and written by a thread of that connection. Consecutive rows
+ * of the same table and columns become one multi-row INSERT, and every
+ * batch runs in one transaction, so broker workers never wait on the
+ * database. type is RULE_FORWORD_SQLITE with a sqlite3 handle or
+ * RULE_FORWORD_MYSQL with a MYSQL handle.
+ */
+extern int  rule_sink_init(void);
+extern void rule_sink_fini(void);
+
+/*
+ * Queue the row "(v1, v2, ...)" for "table (c1, c2, ...)". Returns
+ * NNG_EAGAIN when the sink already holds NANO_RULE_SINK_QUEUE rows.
+ */
+extern int rule_sink_insert(
+    uint8_t type, void *db, const char *cols, const char *row);
+
+// Queue schema statements, one per line, ordered with the rows around them.
+extern int rule_sink_exec(uint8_t type, void *db, const char *stmts);
+
+// Write what is queued for db and stop its thread, before db is closed.
+extern void rule_sink_close(void *db);
+
+#endif
+
+#endif
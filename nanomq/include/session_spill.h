@@ -0,0 +1,102 @@
+#ifndef NANOMQ_SESSION_SPILL_H
+#define NANOMQ_SESSION_SPILL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+#ifndef NANO_SESSION_SPILL_DIR
+#define NANO_SESSION_SPILL_DIR "/tmp/nanomq_session"
+#endif
+
+// Most recent messages of one offline session kept in memory.
+#ifndef NANO_SESSION_SPILL_MSGS
+#define NANO_SESSION_SPILL_MSGS 32
+#endif
+
+// Memory shared by all offline sessions (bytes).
+#ifndef NANO_SESSION_SPILL_MEM
+#define NANO_SESSION_SPILL_MEM (64 * 1024 * 1024)
+#endif
+
+// Disk shared by all offline sessions (bytes).
+#ifndef NANO_SESSION_SPILL_DISK
+#define NANO_SESSION_SPILL_DISK (1024 * 1024 * 1024)
+#endif
+
+// Size at which the segment being written is closed and a new one started.
+#ifndef NANO_SESSION_SPILL_SEGMENT
+#define NANO_SESSION_SPILL_SEGMENT (4 * 1024 * 1024)
+#endif
+
+/*
+ * Offline queue of persistent sessions. The QoS 1/2 messages for a client
+ * that went away with clean_start unset are kept here instead of the
+ * protocol layer: its latest msgs messages in memory, older ones appended
+ * to sequential segment files shared by all sessions. Past the memory
+ * budget the least recently queued sessions are spilled to disk whole.
+ * Each disk record points back at the previous one of its session, so a
+ * session costs the same few bytes of memory however much it has on disk.
+ * Segments are dropped once nothing in them waits any more, and the files
+ * do not outlive the broker, neither do the sessions of the protocol layer.
+ */
+
+typedef struct {
+	size_t   msgs;
+	uint64_t mem;
+	uint64_t disk;
+	uint64_t segment;
+} session_spill_conf;
+
+// A queued PUBLISH, only valid during the callback.
+typedef struct {
+	uint8_t        cmd; // nng cmd type, CMD_PUBLISH or CMD_PUBLISH_V5
+	uint8_t        proto_ver;
+	const uint8_t *head; // MQTT fixed header
+	size_t         head_len;
+	const uint8_t *body;
+	size_t         body_len;
+} session_spill_rec;
+
+typedef void (*session_spill_cb)(void *arg, const session_spill_rec *rec);
+
+typedef struct {
+	size_t   sessions;
+	uint64_t mem;  // bytes of queued messages in memory
+	uint64_t disk; // bytes of all segment files
+	uint32_t segments;
+	uint64_t queued;
+	uint64_t spilled;
+	uint64_t replayed;
+	uint64_t dropped; // over the disk budget, or discarded with a session
+} session_spill_stats;
+
+// dir is created if missing, segments left over in it are removed.
+extern int  session_spill_init(const char *dir, const session_spill_conf *c);
+extern void session_spill_fini(void);
+extern bool session_spill_enabled(void);
+
+// pipe went away keeping its session, messages for it are queued from now.
+extern int session_spill_offline(uint32_t pipe, const char *clientid);
+
+/*
+ * Queue rec for pipe if it is offline. Returns NNG_ENOENT when pipe has no
+ * offline session and rec should be sent as usual, NNG_ENOSPC when an older
+ * message of the session was dropped as the disk budget is spent.
+ */
+extern int session_spill_put(uint32_t pipe, const session_spill_rec *rec);
+
+/*
+ * clientid is back: cb gets every queued message, oldest first, and the
+ * session is forgotten. Returns the number replayed, 0 without a session.
+ */
+extern size_t session_spill_online(
+    const char *clientid, session_spill_cb cb, void *arg);
+// clientid is back with a clean start, its queue is dropped.
+extern void session_spill_discard(const char *clientid);
+
+extern void session_spill_stats_get(session_spill_stats *s);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef NANOMQ_SESSION_TAKEOVER_H
+#define NANOMQ_SESSION_TAKEOVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// How long the subscriptions of a closed MQTT v3.1.1 persistent session
+// wait for its client to come back (ms), 0 removes them on disconnect. v5
+// sessions wait their Session Expiry Interval.
+#ifndef NANO_TAKEOVER_GRACE_MS
+#define NANO_TAKEOVER_GRACE_MS 10000
+#endif
+
+/*
+ * Subscriptions of a persistent session follow its client id from pipe to
+ * pipe instead of being removed from the tree and subscribed again. A
+ * CONNECT without clean start takes over what the previous pipe of the
+ * client id subscribed, whether that pipe is still open or closed and
+ * within its linger: the caller moves the tree entries to the new pipe
+ * then, so fan-out never looks at sessions. They leave the tree once the
+ * session ends, by a clean start, a disconnect without linger or a linger
+ * after which nobody came back.
+ */
+typedef enum {
+	TAKEOVER_CLOSE,  // remove its subscriptions
+	TAKEOVER_PARKED, // kept for a reconnect within its linger
+	TAKEOVER_HANDED, // another pipe took them over already
+} takeover_verdict;
+
+// Called for the pipe of a session that ended while parked, to remove its
+// subscriptions.
+typedef void (*takeover_release_cb)(void *arg, uint32_t pipe);
+
+typedef struct {
+	uint64_t takeovers;
+	uint64_t parked;
+	uint64_t expired; // parked sessions nobody came back for
+	size_t   sessions;
+} takeover_stats;
+
+extern int  session_takeover_init(takeover_release_cb cb, void *arg);
+extern void session_takeover_fini(void);
+extern bool session_takeover_enabled(void);
+
+/*
+ * pipe was accepted for clientid. Returns the pipe whose subscriptions go
+ * to it now, 0 if none. A clean start ends the previous session, its pipe
+ * goes to the release callback when it was parked, or is closed by the
+ * protocol layer otherwise.
+ */
+extern uint32_t session_takeover_connect(
+    uint32_t pipe, const char *clientid, bool clean_start);
+
+// pipe went away, its session lingers ms for a takeover, 0 ends it now.
+extern takeover_verdict session_takeover_disconnect(
+    uint32_t pipe, nng_time linger);
+
+extern void session_takeover_stats_get(takeover_stats *s);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef NANOMQ_SHARE_GROUP_H
+#define NANOMQ_SHARE_GROUP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+	SHARE_ROUND_ROBIN,
+	SHARE_RANDOM,
+	SHARE_STICKY,         // by hash of the publisher clientid
+	SHARE_LEAST_INFLIGHT, // fewer dispatches of two random members
+	SHARE_LOCAL_FIRST,    // round robin over loopback/IPC members first
+	SHARE_STRATEGIES,
+} share_strategy;
+
+// Strategy of groups no one has picked one for.
+#ifndef NANO_SHARE_STRATEGY
+#define NANO_SHARE_STRATEGY SHARE_ROUND_ROBIN
+#endif
+
+typedef struct {
+	uint32_t    pipe;
+	const char *clientid;
+	bool        local;
+	uint64_t    dispatched;
+} share_member_info;
+
+typedef struct {
+	const char        *group; // not terminated, group_len long
+	size_t             group_len;
+	const char        *filter;
+	share_strategy     strategy;
+	uint64_t           dispatched;
+	size_t             nmembers;
+	share_member_info *members;
+} share_group_info;
+
+extern int  share_group_init(void);
+extern void share_group_fini(void);
+extern bool share_group_enabled(void);
+
+/*
+ * Members of every $share/ group, next to the dbtree. Callers report the
+ * shared subscriptions made and dropped, and hand the pipes picked by
+ * dbtree_find_shared_clients to share_group_pick, which puts the member
+ * the strategy of each group chooses in place of the tree's pick.
+ */
+extern void share_group_join(const char *topic, uint32_t pipe,
+    const char *clientid, const char *ip);
+extern void share_group_leave(const char *topic, uint32_t pipe);
+extern void share_group_pick(
+    const char *topic, uint32_t *pipes, const char *clientid);
+
+extern const char *share_strategy_name(share_strategy s);
+extern int         share_strategy_parse(const char *name, share_strategy *s);
+// group NULL sets the default of groups without a strategy of their own
+extern int share_group_set_strategy(const char *group, share_strategy s);
+extern share_strategy share_group_default_strategy(void);
+
+// Call cb on every group with the registry locked.
+extern void share_group_foreach(
+    void (*cb)(const share_group_info *, void *), void *arg);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef NANOMQ_SQLITE_COMMIT_H
+#define NANOMQ_SQLITE_COMMIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+#if defined(NNG_SUPP_SQLITE)
+
+// Operations written in one transaction.
+#ifndef NANO_SQLITE_COMMIT_BATCH
+#define NANO_SQLITE_COMMIT_BATCH 256
+#endif
+
+// Age of the oldest queued operation after which a short batch commits.
+#ifndef NANO_SQLITE_COMMIT_LINGER_MS
+#define NANO_SQLITE_COMMIT_LINGER_MS 5
+#endif
+
+// Operations queued before workers wait for the writer to catch up.
+#ifndef NANO_SQLITE_COMMIT_QUEUE
+#define NANO_SQLITE_COMMIT_QUEUE 8192
+#endif
+
+/*
+ * Group commit of the retained message updates bound for the QoS database
+ * of the broker socket. Workers queue them and go on, a single writer
+ * thread applies them in order, every batch of up to batch operations or
+ * linger ms in one transaction, with the database in WAL mode. A full
+ * queue makes workers wait rather than drop or reorder updates.
+ */
+typedef struct {
+	uint64_t ops;
+	uint64_t commits;
+	uint64_t stalls; // workers that waited on a full queue
+	size_t   batch_max;
+	size_t   queued;
+} sqlite_commit_stats;
+
+extern int  sqlite_commit_init(void *db, size_t batch, nng_duration linger);
+// Commits what is queued, before db is closed.
+extern void sqlite_commit_fini(void);
+extern bool sqlite_commit_enabled(void);
+
+// NNG_ECLOSED when not enabled, the caller writes to db itself then.
+extern int sqlite_commit_set_retain(
+    const char *topic, nng_msg *msg, uint8_t proto_ver);
+extern int sqlite_commit_remove_retain(const char *topic);
+
+// Wait until everything queued so far is committed, before reading db.
+extern void sqlite_commit_sync(void);
+
+extern void sqlite_commit_stats_get(sqlite_commit_stats *s);
+
+#endif
+
+#endif
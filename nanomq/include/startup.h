@@ -0,0 +1,56 @@
+#ifndef NANOMQ_STARTUP_H
+#define NANOMQ_STARTUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Time to ready of the subsystems brought up by broker(). The listener is
+ * served first; rule engine sinks, bridge clients and the webhook service
+ * come up in the background and each is ready once its clients, pools or
+ * sockets are. A subsystem that is not ready yet is skipped by the message
+ * path: a rule or a bridge forward misses the messages published before,
+ * webhook events queue on the hook socket of the works until the service
+ * listens.
+ *
+ * Without startup_init every subsystem reads as ready.
+ */
+typedef enum {
+	STARTUP_LISTENER,
+	STARTUP_RULES,
+	STARTUP_BRIDGE,
+	STARTUP_WEBHOOK,
+	STARTUP_SUBSYSTEMS,
+} startup_subsystem;
+
+typedef enum {
+	STARTUP_OFF,     // not configured
+	STARTUP_PENDING, // being brought up
+	STARTUP_READY,
+	STARTUP_FAILED,
+} startup_state;
+
+typedef struct {
+	const char   *name;
+	startup_state state;
+	uint64_t      begin_ms; // since startup_init
+	uint64_t      ready_ms; // since startup_init, 0 while pending
+	int           rv;
+} startup_stat;
+
+typedef int (*startup_fn)(void *arg);
+
+extern int  startup_init(void);
+// Waits for the background inits that are still running.
+extern void startup_fini(void);
+extern bool startup_enabled(void);
+extern void startup_begin(startup_subsystem s);
+// Logs the time to ready, or the error when rv is not 0.
+extern void startup_done(startup_subsystem s, int rv);
+// Runs fn on a thread of its own, startup_done gets what it returns.
+extern int  startup_run(startup_subsystem s, startup_fn fn, void *arg);
+extern bool startup_ready(startup_subsystem s);
+extern void startup_stats_get(startup_stat st[STARTUP_SUBSYSTEMS]);
+extern const char *startup_name(startup_subsystem s);
+
+#endif
@@ -9,6 +9,7 @@
 typedef struct {
 	uint32_t pid;
 	dbtree *db;
+	bool deleted; // some removed from db inline
 }  sub_destroy_info;
 
 /*
@@ -28,6 +29,23 @@ int sub_ctx_handle(nano_work *);
  */
 int sub_ctx_del(void *db, char *topic, uint32_t pid);
 
+/*
+ * Move the subscriptions of pipe from to pipe to, on the tree and in
+ * dbhash, returning how many there were
+ */
+size_t sub_ctx_move(void *db, uint32_t from, uint32_t to, conn_param *cparam);
+
+/*
+ * Tell sub_queue the highest QoS of the subscriptions of pid
+ */
+void sub_ctx_regrant(uint32_t pid);
+
+/*
+ * The QoS a message of qos on topic goes to pid at, the lower of qos and
+ * the highest QoS of the subscriptions of pid matching topic
+ */
+uint8_t sub_ctx_qos(uint32_t pid, const char *topic, uint8_t qos);
+
 /*
  * Free the client ctx
  */
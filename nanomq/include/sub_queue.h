@@ -0,0 +1,93 @@
+#ifndef NANOMQ_SUB_QUEUE_H
+#define NANOMQ_SUB_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Pipes are spread over this many locks.
+#ifndef NANO_SUB_QUEUE_SHARDS
+#define NANO_SUB_QUEUE_SHARDS 64
+#endif
+
+// How often the subscribers are checked against the limit (ms).
+#ifndef NANO_SUB_QUEUE_SAMPLE_MS
+#define NANO_SUB_QUEUE_SAMPLE_MS 200
+#endif
+
+/*
+ * The send queues of pipes live in the protocol layer, which does not
+ * tell their depth. What the broker sees itself is bounded instead: the
+ * QoS 1 and 2 messages it handed to a pipe that the client has not
+ * acknowledged yet (PUBACK, PUBCOMP). The protocol layer sends them at
+ * the QoS granted to the subscription, so the caller tells the QoS of the
+ * matching subscription with the highest one, see sub_ctx_qos(). QoS 0
+ * messages leave no trace after the hand-over, they follow the policy of
+ * a pipe slow by the others.
+ */
+typedef enum {
+	SUB_QUEUE_DROP_NEWEST, // new messages are not sent
+	SUB_QUEUE_DISCONNECT,
+	SUB_QUEUE_POLICIES,
+} sub_queue_policy;
+
+// A limit of 0 is unlimited. A pipe stays slow until it is below half.
+typedef struct {
+	uint64_t         msgs;
+	sub_queue_policy policy[3]; // by QoS
+} sub_queue_conf;
+
+typedef enum {
+	SUB_QUEUE_SEND,
+	SUB_QUEUE_SKIP,  // drop this message for this pipe
+	SUB_QUEUE_CLOSE, // disconnect the pipe
+} sub_queue_verdict;
+
+typedef struct {
+	uint64_t msgs;    // unacknowledged QoS 1/2 messages
+	uint64_t dropped; // while slow
+	nng_time since;   // became slow, 0 while not
+	uint8_t  granted; // highest QoS of its subscriptions
+	bool     slow;
+} sub_queue_state;
+
+typedef struct {
+	uint64_t slow_events;
+	uint64_t dropped[SUB_QUEUE_POLICIES];
+	size_t   slow;
+} sub_queue_stats;
+
+// A pipe became slow or recovered, called from the sampling thread.
+typedef void (*sub_queue_slow_cb)(
+    uint32_t pipe, const sub_queue_state *st, void *arg);
+
+// Not enabled unless c sets a limit.
+extern int  sub_queue_init(
+     const sub_queue_conf *c, sub_queue_slow_cb slow, void *arg);
+extern void sub_queue_fini(void);
+extern bool sub_queue_enabled(void);
+
+// Fields of c with their NANOMQ_SUB_QUEUE_* environment variable set.
+extern void sub_queue_conf_env(sub_queue_conf *c);
+
+extern void sub_queue_open(uint32_t pipe);
+extern void sub_queue_close(uint32_t pipe);
+
+// What to do with a message of qos about to be queued on pipe.
+extern sub_queue_verdict sub_queue_check(uint32_t pipe, uint8_t qos);
+// A message was handed to pipe at qos, and one acknowledged by its client.
+extern void sub_queue_sent(uint32_t pipe, uint8_t qos);
+extern void sub_queue_acked(uint32_t pipe);
+// The highest QoS granted to pipe, after its subscriptions changed.
+extern void sub_queue_granted(uint32_t pipe, uint8_t qos);
+
+// One round of sampling, run by the thread every NANO_SUB_QUEUE_SAMPLE_MS.
+extern void sub_queue_sample(void);
+
+extern bool sub_queue_get(uint32_t pipe, sub_queue_state *st);
+extern void sub_queue_stats_get(sub_queue_stats *s);
+extern const char *sub_queue_policy_name(sub_queue_policy p);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef NANOMQ_SUB_REAP_H
+#define NANOMQ_SUB_REAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/mqtt_db.h"
+
+// Subscriptions removed from the tree in one pass.
+#ifndef NANO_SUB_REAP_BATCH
+#define NANO_SUB_REAP_BATCH 4096
+#endif
+
+// Age of the oldest queued removal after which a short batch goes.
+#ifndef NANO_SUB_REAP_LINGER_MS
+#define NANO_SUB_REAP_LINGER_MS 20
+#endif
+
+/*
+ * Deferred removal of the subscriptions of closed pipes. The disconnect
+ * of a pipe only queues its filters and marks the pipe dead, so fan-out
+ * skips it at once; a single thread then deletes them from the tree in
+ * batches sorted by filter, so the removals of a storm of disconnects
+ * walk each branch once while it is in cache, and invalidates the match
+ * cache once per batch. A pipe is no longer dead once all its filters
+ * are gone from the tree. NANOMQ_SUB_REAP=0 removes them inline.
+ */
+typedef struct {
+	uint64_t removed;
+	uint64_t batches;
+	size_t   batch_max;
+	size_t   queued;
+	size_t   dead; // pipes with removals queued
+} sub_reap_stats;
+
+extern int  sub_reap_init(dbtree *db, size_t batch, nng_duration linger);
+// Removes what is queued, before db is destroyed.
+extern void sub_reap_fini(void);
+extern bool sub_reap_enabled(void);
+
+// NNG_ECLOSED when not enabled, the caller deletes from the tree itself.
+extern int sub_reap_put(uint32_t pipe, const char *topic);
+
+// Whether the subscriptions of pipe are still being removed.
+extern bool sub_reap_dead(uint32_t pipe);
+
+// Wait until everything queued so far is removed.
+extern void sub_reap_sync(void);
+
+extern void sub_reap_stats_get(sub_reap_stats *s);
+
+#endif
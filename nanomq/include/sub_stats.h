@@ -0,0 +1,34 @@
+#ifndef NANOMQ_SUB_STATS_H
+#define NANOMQ_SUB_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	uint64_t topics;        // distinct filters with a subscriber
+	uint64_t subscriptions; // pipe and filter pairs
+	uint64_t shared;        // subscriptions to $share/ filters
+	uint64_t connections;
+	uint64_t conn_v31;
+	uint64_t conn_v311;
+	uint64_t conn_v5;
+} sub_stats;
+
+extern int  sub_stats_init(void);
+extern void sub_stats_fini(void);
+extern bool sub_stats_enabled(void);
+
+/*
+ * Live counters for the metrics endpoints, kept next to the dbtree and the
+ * pipe map so a scrape never has to walk either. Callers report changes
+ * to the subscription dbtree and CONNACK / disconnect events of pipes.
+ */
+extern void sub_stats_subscribe(const char *topic);
+extern void sub_stats_unsubscribe(const char *topic);
+extern void sub_stats_connect(uint32_t pipe, uint8_t proto_ver);
+extern void sub_stats_disconnect(uint32_t pipe);
+
+extern void sub_stats_get(sub_stats *s);
+
+#endif
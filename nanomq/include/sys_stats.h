@@ -0,0 +1,74 @@
+#ifndef NANOMQ_SYS_STATS_H
+#define NANOMQ_SYS_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "include/latency_stats.h"
+#include "include/sub_stats.h"
+
+// Interval of the $SYS publisher unless NANOMQ_SYS_INTERVAL sets one.
+#ifndef NANO_SYS_STATS_INTERVAL_MS
+#define NANO_SYS_STATS_INTERVAL_MS 10000
+#endif
+
+#define SYS_STATS_TOPIC_PREFIX "$SYS/brokers/"
+
+// Messages of one interval at most, and their sizes including the NUL.
+#define SYS_STATS_MSGS 5
+#define SYS_STATS_NODE_LEN 64
+#define SYS_STATS_TOPIC_LEN 128
+#define SYS_STATS_PAYLOAD_LEN 1024
+
+typedef struct {
+	uint64_t count;
+	uint64_t p50; // ns
+	uint64_t p99;
+	uint64_t p999;
+} sys_stats_latency;
+
+typedef struct {
+	nng_time          time;
+	uint64_t          msg_in;
+	uint64_t          msg_out;
+	uint64_t          msg_drop;
+	sub_stats         subs;
+	uint64_t          bridge_queue_depth; // all MQTT bridge nodes
+	uint64_t          slow_subscribers;
+	uint64_t          slow_events;
+	uint64_t          slow_dropped; // by every policy
+	bool              latency;      // the histograms are kept
+	sys_stats_latency stages[LATENCY_STAGES];
+} sys_stats_sample;
+
+typedef struct {
+	char topic[SYS_STATS_TOPIC_LEN];
+	char payload[SYS_STATS_PAYLOAD_LEN]; // JSON
+} sys_stats_msg;
+
+// Gets the messages of an interval to route them as PUBLISHes.
+typedef void (*sys_stats_publish_cb)(
+    void *arg, const sys_stats_msg *msgs, size_t n);
+
+/*
+ * Broker statistics published every NANOMQ_SYS_INTERVAL milliseconds
+ * under $SYS/brokers/<node>/, where node is NANOMQ_SYS_NODE or else the
+ * host name. An interval of 0 leaves it off. A sample only reads the live
+ * counters the metrics endpoints use, never the trees; rates are taken
+ * over the time since the previous sample.
+ */
+extern int  sys_stats_init(sys_stats_publish_cb cb, void *arg);
+extern void sys_stats_fini(void);
+extern bool sys_stats_enabled(void);
+
+extern void sys_stats_sample_take(sys_stats_sample *s);
+/*
+ * The messages of cur into msgs, rates against prev which may be NULL for
+ * the first sample. Returns how many were written, up to cap.
+ */
+extern size_t sys_stats_compose(const char *node, const sys_stats_sample *prev,
+    const sys_stats_sample *cur, sys_stats_msg *msgs, size_t cap);
+
+#endif
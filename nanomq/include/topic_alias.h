@@ -0,0 +1,64 @@
+#ifndef NANOMQ_TOPIC_ALIAS_H
+#define NANOMQ_TOPIC_ALIAS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Pipes are spread over this many locks, a power of two.
+#ifndef NANO_TOPIC_ALIAS_SHARDS
+#define NANO_TOPIC_ALIAS_SHARDS 64
+#endif
+
+// Most aliases the broker assigns a subscriber, whatever it grants.
+#ifndef NANO_TOPIC_ALIAS_OUT_MAX
+#define NANO_TOPIC_ALIAS_OUT_MAX 64
+#endif
+
+// Shorter topics gain nothing from the 3 byte alias property.
+#ifndef NANO_TOPIC_ALIAS_OUT_MIN_LEN
+#define NANO_TOPIC_ALIAS_OUT_MIN_LEN 8
+#endif
+
+// An aliased publish is a copy for one subscriber, larger payloads are
+// sent shared by all of them with the full topic instead.
+#ifndef NANO_TOPIC_ALIAS_OUT_MAX_PAYLOAD
+#define NANO_TOPIC_ALIAS_OUT_MAX_PAYLOAD (16 * 1024)
+#endif
+
+extern int  topic_alias_init(void);
+extern void topic_alias_fini(void);
+extern bool topic_alias_enabled(void);
+
+/*
+ * MQTT v5 topic aliases of every pipe, in an array per pipe indexed by the
+ * alias number and grown up to the largest alias the client sent. A lookup
+ * copies the topic to buf, NNG_ENOSPC sets len to the size needed and
+ * NNG_ENOENT means the alias was never set on this pipe. The table goes
+ * with the pipe on release.
+ */
+extern int  topic_alias_set(
+     uint32_t pipe, uint16_t alias, const char *topic, size_t len);
+extern int  topic_alias_get(
+     uint32_t pipe, uint16_t alias, char *buf, size_t cap, size_t *len);
+extern void topic_alias_release(uint32_t pipe);
+
+/*
+ * Aliases the broker assigns to topics it sends a pipe, up to the Topic
+ * Alias Maximum the client granted, least recently used first to go.
+ * topic_alias_out_begin returns 0 with the alias and whether the client
+ * already knows it, and keeps the pipe locked until topic_alias_out_end
+ * so the publish defining an alias is queued before any that use it.
+ * keep false forgets an alias that could not be sent. NNG_ENOENT means
+ * the pipe takes no aliases or the topic is not worth one. The client
+ * knows an alias once topic_alias_out_known is told with its stamp that
+ * a publish defining it was sent, until then each one defines it again.
+ */
+extern int  topic_alias_out_open(uint32_t pipe, uint16_t max);
+extern int  topic_alias_out_begin(uint32_t pipe, const char *topic,
+     size_t len, uint16_t *alias, bool *known, uint32_t *stamp);
+extern void topic_alias_out_end(uint32_t pipe, uint16_t alias, bool keep);
+extern void topic_alias_out_known(
+    uint32_t pipe, uint16_t alias, uint32_t stamp);
+
+#endif
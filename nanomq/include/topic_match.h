@@ -0,0 +1,48 @@
+#ifndef NANOMQ_TOPIC_MATCH_H
+#define NANOMQ_TOPIC_MATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "include/topic_scan.h"
+
+/*
+ * Topic filters compiled once, when the config or a subscription is
+ * loaded, and matched against the levels of a topic split by topic_scan()
+ * or topic_split(). They match like topic_filter(): '+' takes one level,
+ * '#' the rest of the topic, "a/#" covering "a" as well. A wildcard is one
+ * only when it is the whole level, and '#' has to be the last one.
+ */
+typedef struct topic_pattern topic_pattern;
+
+// NNG_EINVAL for a '#' that is not the last level.
+extern int  topic_pattern_compile(const char *filter, topic_pattern **pp);
+extern void topic_pattern_free(topic_pattern *p);
+extern bool topic_pattern_match(
+    const topic_pattern *p, const char *topic, const topic_levels *tl);
+
+/*
+ * Filters with ids in a trie by level, the literal levels of each node
+ * sorted by hash, so a topic is matched against all of them in one walk.
+ * Built once and only read afterwards, by any number of threads.
+ */
+typedef struct topic_filter_set topic_filter_set;
+
+extern int  topic_filter_set_alloc(topic_filter_set **sp);
+extern void topic_filter_set_free(topic_filter_set *s);
+extern int  topic_filter_set_add(
+     topic_filter_set *s, const char *filter, uint32_t id);
+extern size_t topic_filter_set_count(const topic_filter_set *s);
+
+/*
+ * Append to the cvector *ids the ids of the filters matching topic,
+ * ascending, and return how many were added.
+ */
+extern size_t topic_filter_set_match(const topic_filter_set *s,
+    const char *topic, const topic_levels *tl, uint32_t **ids);
+// The lowest id matching topic in *id, false if none does.
+extern bool topic_filter_set_first(const topic_filter_set *s,
+    const char *topic, const topic_levels *tl, uint32_t *id);
+
+#endif
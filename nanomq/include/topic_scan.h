@@ -0,0 +1,38 @@
+#ifndef NANOMQ_TOPIC_SCAN_H
+#define NANOMQ_TOPIC_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Levels whose end is recorded, deeper ones are found again when asked for.
+#ifndef NANO_TOPIC_LEVELS
+#define NANO_TOPIC_LEVELS 32
+#endif
+
+/*
+ * The levels of a topic name: level i ends at end[i], the offset of the '/'
+ * closing it or len for the last one, and the next starts right behind.
+ * "a/" has the levels "a" and "", an empty topic a single empty one. n is
+ * 0 until the topic has been split.
+ */
+typedef struct {
+	uint32_t len;
+	uint32_t n;
+	uint32_t end[NANO_TOPIC_LEVELS];
+} topic_levels;
+
+/*
+ * Check that topic is a valid PUBLISH topic name, UTF-8 as MQTT wants it
+ * with no wildcard, and split it on the way. Runs of printable ASCII are
+ * checked 16 bytes at a time with SSE2 or NEON when available.
+ * Returns NNG_EINVAL if it is not.
+ */
+extern int topic_scan(const char *topic, size_t len, topic_levels *tl);
+// Only split topic, which is known to be valid.
+extern void topic_split(const char *topic, size_t len, topic_levels *tl);
+// Start of level i < tl->n of topic, its length in *len.
+extern const char *topic_level(
+    const topic_levels *tl, const char *topic, uint32_t i, size_t *len);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef NANOMQ_TRAFFIC_STATS_H
+#define NANOMQ_TRAFFIC_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+// Topics each worker keeps counts for.
+#ifndef NANO_TRAFFIC_TOPICS
+#define NANO_TRAFFIC_TOPICS 32
+#endif
+
+// Length topics are cut to, including the NUL.
+#ifndef NANO_TRAFFIC_TOPIC_LEN
+#define NANO_TRAFFIC_TOPIC_LEN 128
+#endif
+
+// Interval topic rates are taken over.
+#ifndef NANO_TRAFFIC_WINDOW_MS
+#define NANO_TRAFFIC_WINDOW_MS 10000
+#endif
+
+// PUBLISH packets of one client, bytes as sent on the wire
+typedef struct {
+	uint64_t msg_in;
+	uint64_t bytes_in;
+	uint64_t msg_out;
+	uint64_t bytes_out;
+} traffic_client;
+
+typedef struct {
+	char     topic[NANO_TRAFFIC_TOPIC_LEN];
+	uint64_t msgs;
+	uint64_t bytes; // payload
+	uint64_t error; // msgs may be overstated by up to this much
+} traffic_topic;
+
+typedef struct traffic_topics traffic_topics;
+
+extern int  traffic_stats_init(void);
+extern void traffic_stats_fini(void);
+extern bool traffic_stats_enabled(void);
+
+/*
+ * Per client counters, kept from the CONNACK of a pipe until its
+ * disconnect event. Traffic of pipes without an entry is not counted.
+ */
+extern void traffic_client_open(uint32_t pipe);
+extern void traffic_client_close(uint32_t pipe);
+extern void traffic_client_in(uint32_t pipe, size_t bytes);
+extern void traffic_client_out(uint32_t pipe, size_t bytes);
+extern bool traffic_client_get(uint32_t pipe, traffic_client *tc);
+
+/*
+ * The busiest PUBLISH topics. Each worker counts the ones it sees in a
+ * Space-Saving summary of NANO_TRAFFIC_TOPICS slots, locked by that worker
+ * alone; readers merge the summaries of the last full window. A topic
+ * outside the top slots may be missed, one inside is never undercounted.
+ */
+extern traffic_topics *traffic_topics_alloc(void);
+extern void traffic_topic_add(
+    traffic_topics *tt, const char *topic, size_t len, size_t bytes);
+
+// Fill top with up to cap topics of the last window, busiest first.
+extern size_t traffic_topic_top(traffic_topic *top, size_t cap);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef NANOMQ_TRANSFORM_H
+#define NANOMQ_TRANSFORM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Threads of the transform stage, 0 runs every transform inline.
+#ifndef NANO_TRANSFORM_THREADS
+#define NANO_TRANSFORM_THREADS 2
+#endif
+
+// Transforms waiting for a thread, further ones run inline.
+#ifndef NANO_TRANSFORM_DEPTH
+#define NANO_TRANSFORM_DEPTH 4096
+#endif
+
+// Transforms a thread takes off the queue at a time.
+#ifndef NANO_TRANSFORM_BATCH
+#define NANO_TRANSFORM_BATCH 32
+#endif
+
+// Plain message.publish payloads from this size on are escaped on the
+// stage, encoded ones always are.
+#ifndef NANO_TRANSFORM_MIN_BYTES
+#define NANO_TRANSFORM_MIN_BYTES 1024
+#endif
+
+typedef enum {
+	TRANSFORM_WEBHOOK,   // message.publish bodies, payload encoding
+	TRANSFORM_RULE_JSON, // republish and FoundationDB documents
+	TRANSFORM_RULE_SQL,  // SQLite and MySQL clauses
+	TRANSFORMS,
+} transform_kind;
+
+typedef void (*transform_fn)(void *arg);
+
+typedef struct {
+	uint64_t offloaded; // run on the stage
+	uint64_t inlined;   // run by the work that routed the message
+	uint64_t overflow;  // of those, the ones that found the queue full
+	uint64_t cpu_ns;    // thread CPU time spent in them, wherever they ran
+	uint64_t depth;     // waiting right now, of all kinds
+	uint64_t depth_max;
+	uint64_t batches;
+} transform_stats;
+
+/*
+ * The encodings and compositions done for every matching message, off the
+ * works that route it. A transform owns what its arg references, message
+ * payloads are held by reference rather than copied, and frees it when
+ * done. The queue is FIFO and bounded, once full the work runs the
+ * transform itself, so routing never waits on the stage. Threads take up
+ * to batch transforms per pass. The CPU time of each transform is counted
+ * per kind, also of the ones that run inline. NANOMQ_TRANSFORM=0 leaves
+ * the stage off.
+ */
+extern int  transform_init(size_t threads, size_t depth, size_t batch);
+// Runs what is queued, before the sockets the transforms send on close.
+extern void transform_fini(void);
+extern bool transform_enabled(void);
+
+/*
+ * Queue fn(arg) for the stage. NNG_ECLOSED when it is not enabled and
+ * NNG_EAGAIN when the queue is full, the caller runs it with
+ * transform_run() then.
+ */
+extern int  transform_submit(transform_kind kind, transform_fn fn, void *arg);
+extern void transform_run(transform_kind kind, transform_fn fn, void *arg);
+
+// For compositions that stay inline: CPU time of this thread, and the
+// time since then counted for kind.
+extern uint64_t transform_cpu_now(void);
+extern void     transform_account(transform_kind kind, uint64_t since);
+
+extern const char *transform_name(transform_kind kind);
+extern void transform_stats_get(transform_kind kind, transform_stats *s);
+
+#endif
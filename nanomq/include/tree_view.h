@@ -0,0 +1,69 @@
+#ifndef NANOMQ_TREE_VIEW_H
+#define NANOMQ_TREE_VIEW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "include/json_writer.h"
+
+// Least age of a snapshot before a change of the tree rebuilds it (ms).
+#ifndef NANO_TREE_VIEW_MIN_MS
+#define NANO_TREE_VIEW_MIN_MS 1000
+#endif
+
+/*
+ * Read-only snapshots of the subscription tree for the REST dumps. One
+ * walk of the tree by dbtree_get_tree() is copied into a snapshot that
+ * any number of requests read without a tree lock, it is rebuilt only
+ * once the subscription generation moved on and it is at least min_age
+ * old, so pollers cost the routing path one walk per min_age at most.
+ * Without the match cache there is no generation and a snapshot is
+ * rebuilt by age alone. While one request rebuilds, the others are served
+ * the previous snapshot. Snapshots are reference counted, a replaced one
+ * is freed by the last reader.
+ */
+typedef struct tree_view tree_view;
+
+typedef struct {
+	uint64_t builds;
+	uint64_t served; // requests answered from a snapshot
+	size_t   nodes;  // of the current snapshot
+} tree_view_stats;
+
+extern int  tree_view_init(nng_duration min_age);
+extern void tree_view_fini(void);
+extern bool tree_view_enabled(void);
+
+/*
+ * The current snapshot, held, if it is still good for generation gen.
+ * NULL when it is due for a rebuild, the caller then walks the tree and
+ * hands the result to tree_view_publish().
+ */
+extern tree_view *tree_view_hold(uint64_t gen);
+
+/*
+ * Make the levels of dbtree_info that dbtree_get_tree() returned, with
+ * the client ids as its callback gave them, the current snapshot. The
+ * levels are freed. Returns the new snapshot held, NULL without memory.
+ */
+extern tree_view *tree_view_publish(uint64_t gen, void **levels);
+extern void       tree_view_release(tree_view *v);
+
+// Content hash of the snapshot, for an ETag.
+extern uint64_t tree_view_hash(const tree_view *v);
+
+/*
+ * Write the snapshot as the data array of GET /topic-tree: one array per
+ * level, each node with its topic level, cld_cnt and clientid. Only the
+ * node at prefix, a topic of levels or NULL for the root, and what is
+ * below it, at most depth levels of it, 0 for all. Returns NNG_ENOENT
+ * when nothing is at prefix.
+ */
+extern int tree_view_write(const tree_view *v, json_writer *w,
+    const char *prefix, size_t depth);
+
+extern void tree_view_stats_get(tree_view_stats *s);
+
+#endif
@@ -22,6 +22,20 @@
 #define HTTP_DEFAULT_PASSWORD "public"
 #define HTTP_DEFAULT_PORT 8081
 
+// Workers each REST lane may grow to, the fast lane starts with
+// http_server.parallel and the slow one with NANO_REST_SLOW_WORKERS.
+#ifndef NANO_REST_WORKERS_MAX
+#define NANO_REST_WORKERS_MAX 32
+#endif
+#ifndef NANO_REST_SLOW_WORKERS
+#define NANO_REST_SLOW_WORKERS 2
+#endif
+
+// In flight requests served from the preallocated job pool.
+#ifndef NANO_REST_JOBS
+#define NANO_REST_JOBS 256
+#endif
+
 extern int  start_rest_server(conf *conf);
 extern void stop_rest_server(void);
 
@@ -0,0 +1,22 @@
+#ifndef NANOMQ_WEBHOOK_CODEC_H
+#define NANOMQ_WEBHOOK_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Room for the encoding of n bytes, the terminating NUL included.
+#define WEBHOOK_BASE64_SIZE(n) ((((n) + 2) / 3) * 4 + 1)
+#define WEBHOOK_BASE62_SIZE(n) (((n) * 8 + 5) / 6 + 1)
+
+/*
+ * Payload encodings of the message.publish webhook. base64 is the standard
+ * one with padding. base62 is base64 without padding whose '+' and '/' are
+ * written as 'A' and 'B', lossy but free of URL characters. Both write the
+ * NUL and return the length before it. Whole blocks are encoded with SSSE3
+ * or NEON when the target has it, the rest a group of three bytes at a
+ * time.
+ */
+extern size_t webhook_base64_encode(const uint8_t *in, size_t len, char *out);
+extern size_t webhook_base62_encode(const uint8_t *in, size_t len, char *out);
+
+#endif
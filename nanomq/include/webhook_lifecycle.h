@@ -0,0 +1,52 @@
+#ifndef NANOMQ_WEBHOOK_LIFECYCLE_H
+#define NANOMQ_WEBHOOK_LIFECYCLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Window lifecycle events are summed up over unless NANOMQ_WEBHOOK_LIFECYCLE
+// sets one, 0 sends every event on its own.
+#ifndef NANO_WEBHOOK_LIFECYCLE_MS
+#define NANO_WEBHOOK_LIFECYCLE_MS 0
+#endif
+
+// Client ids listed in one summary, further events are only counted.
+#ifndef NANO_WEBHOOK_LIFECYCLE_IDS
+#define NANO_WEBHOOK_LIFECYCLE_IDS 1000
+#endif
+
+typedef enum {
+	HOOK_LIFECYCLE_CONNACK,
+	HOOK_LIFECYCLE_DISCONNECT,
+	HOOK_LIFECYCLES,
+} hook_lifecycle_kind;
+
+typedef struct {
+	uint64_t events;    // counted into summaries
+	uint64_t summaries; // sent
+	uint64_t omitted;   // client ids left out of full summaries
+} hook_lifecycle_stats;
+
+/*
+ * client.connack and client.disconnected events of a window go out as one
+ * client_connack_batch or client_disconnected_batch event each, with the
+ * client ids in the order they came, how many there were, how many of
+ * them failed and the rate per second. A reconnect storm then costs a
+ * request per window instead of one per client.
+ */
+extern int  webhook_lifecycle_init(void);
+extern void webhook_lifecycle_fini(void);
+extern bool webhook_lifecycle_enabled(void);
+
+// Count an event into the summary of its window, to be sent on sock.
+extern int webhook_lifecycle_add(nng_socket *sock, hook_lifecycle_kind kind,
+    const char *client_id, bool ok);
+// Send the summaries of the window so far, the timer does every window.
+extern void webhook_lifecycle_flush(void);
+
+extern void webhook_lifecycle_stat(hook_lifecycle_stats *stats);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef NANOMQ_WEBHOOK_POOL_H
+#define NANOMQ_WEBHOOK_POOL_H
+
+#include <stdint.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/conf.h"
+
+// Requests written ahead on one connection before its first response.
+#ifndef NANO_WEBHOOK_PIPELINE
+#define NANO_WEBHOOK_PIPELINE 8
+#endif
+
+// A connection without requests for this long is closed, in milliseconds.
+#ifndef NANO_WEBHOOK_IDLE_MS
+#define NANO_WEBHOOK_IDLE_MS 30000
+#endif
+
+// Timeout of a connect, and of writing a request or reading its response.
+#ifndef NANO_WEBHOOK_TIMEOUT_MS
+#define NANO_WEBHOOK_TIMEOUT_MS 3000
+#endif
+
+// Delay before dialling again after a failed connect, in milliseconds.
+#ifndef NANO_WEBHOOK_RETRY_MS
+#define NANO_WEBHOOK_RETRY_MS 1000
+#endif
+
+// Messages waiting for a connection; the newest are dropped beyond that.
+#ifndef NANO_WEBHOOK_QUEUE_LEN
+#define NANO_WEBHOOK_QUEUE_LEN 4096
+#endif
+
+/*
+ * Events merged into one JSON array body per request. 1 posts every event
+ * on its own; a batch goes out as soon as it reaches the event or byte
+ * limit, or NANO_WEBHOOK_BATCH_LINGER_MS after its first event.
+ */
+#ifndef NANO_WEBHOOK_BATCH_EVENTS
+#define NANO_WEBHOOK_BATCH_EVENTS 1
+#endif
+
+#ifndef NANO_WEBHOOK_BATCH_BYTES
+#define NANO_WEBHOOK_BATCH_BYTES (64 * 1024)
+#endif
+
+#ifndef NANO_WEBHOOK_BATCH_LINGER_MS
+#define NANO_WEBHOOK_BATCH_LINGER_MS 50
+#endif
+
+typedef struct webhook_pool webhook_pool;
+
+typedef struct {
+	uint32_t conns;   // connections currently open
+	uint64_t queued;  // messages waiting for a connection
+	uint64_t sent;    // requests answered by the endpoint
+	uint64_t failed;  // requests lost to connection errors or 4xx/5xx
+	uint64_t dropped; // events refused because the queue was full
+	uint64_t dials;   // connections opened since start
+} webhook_pool_stats;
+
+/*
+ * Keep-alive HTTP/1.1 connections to the endpoint of conf, at most
+ * conf->pool_size of them, opened as load requires. Every connection
+ * pipelines up to NANO_WEBHOOK_PIPELINE POST requests, reusing their
+ * request objects, and reads the responses back asynchronously.
+ */
+extern int  webhook_pool_alloc(webhook_pool **poolp, conf_web_hook *conf);
+extern void webhook_pool_free(webhook_pool *pool);
+
+/*
+ * Post the body of msg, on its own or as part of a batch, gzip compressed
+ * when built with SUPP_WEBHOOK_GZIP. Ownership of msg always moves to the
+ * pool.
+ */
+extern int webhook_pool_send(webhook_pool *pool, nng_msg *msg);
+
+extern void webhook_pool_stat(webhook_pool *pool, webhook_pool_stats *stats);
+
+#endif
@@ -4,8 +4,35 @@
 #include "webhook_inproc.h"
 #include "broker.h"
 
+// PUBLISH hand-offs a worker queues while its last exchange send is still in
+// flight; further ones are dropped so routing never waits on the exchange.
+#ifndef NANO_EXCHANGE_RING_LEN
+#define NANO_EXCHANGE_RING_LEN 1024
+#endif
+
+/*
+ * Exchange keys: wall clock ms above a sequence within the ms and the
+ * worker index, so the keys of [from, to] ms range over
+ * [NANO_EXCHANGE_KEY_MIN(from), NANO_EXCHANGE_KEY_MAX(to)].
+ */
+#define NANO_EXCHANGE_KEY_WORKER_BITS 10
+#define NANO_EXCHANGE_KEY_SEQ_BITS 10
+#define NANO_EXCHANGE_KEY_LOW_BITS \
+	(NANO_EXCHANGE_KEY_WORKER_BITS + NANO_EXCHANGE_KEY_SEQ_BITS)
+#define NANO_EXCHANGE_KEY_MIN(ms) ((uint64_t) (ms) << NANO_EXCHANGE_KEY_LOW_BITS)
+#define NANO_EXCHANGE_KEY_MAX(ms) \
+	(NANO_EXCHANGE_KEY_MIN(ms) | ((1ull << NANO_EXCHANGE_KEY_LOW_BITS) - 1))
+#define NANO_EXCHANGE_KEY_MS(key) ((uint64_t) (key) >> NANO_EXCHANGE_KEY_LOW_BITS)
+
+typedef struct {
+	uint64_t queued;  // hand-offs waiting for their worker's sender
+	uint64_t stalls;  // hand-offs that found the previous send in flight
+	uint64_t dropped; // hand-offs refused because the ring was full
+} hook_exchange_stats;
+
+// msg is the message pub_packet was decoded from, NULL encodes inline.
 extern int webhook_msg_publish(nng_socket *sock, conf_web_hook *hook_conf,
-    pub_packet_struct *pub_packet, const char *username,
+    pub_packet_struct *pub_packet, nng_msg *msg, const char *username,
     const char *client_id);
 extern int webhook_client_connack(nng_socket *sock, conf_web_hook *hook_conf,
     uint8_t proto_ver, uint16_t keepalive, uint8_t reason,
@@ -13,8 +40,16 @@ extern int webhook_client_connack(nng_socket *sock, conf_web_hook *hook_conf,
 extern int webhook_client_disconnect(nng_socket *sock,
     conf_web_hook *hook_conf, uint8_t proto_ver, uint16_t keepalive,
     uint8_t reason, const char *username, const char *client_id);
+extern int webhook_client_slow(nng_socket *sock, conf_web_hook *hook_conf,
+    const char *username, const char *client_id, uint64_t unacked_msgs);
 extern int hook_entry(nano_work *work, uint8_t reason);
+// Compile the topics of the webhook rules and exchanges once.
+extern int  hook_filter_init(conf *nanomq_conf);
+// The rules of new_conf, taken over by cur_conf; url and pool stay.
+extern int  hook_filter_reload(conf *cur_conf, conf *new_conf);
+extern void hook_filter_fini(void);
 extern int hook_exchange_init(conf *nanomq_conf, uint64_t num_ctx);
 extern int hook_exchange_sender_init(conf *nanomq_conf, struct work **works, uint64_t num_ctx);
+extern void hook_exchange_stat(hook_exchange_stats *stats);
 
 #endif
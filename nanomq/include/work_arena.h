@@ -0,0 +1,56 @@
+#ifndef NANOMQ_WORK_ARENA_H
+#define NANOMQ_WORK_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Block every arena starts with, and the least one it grows by (bytes).
+#ifndef NANO_WORK_ARENA_BLOCK
+#define NANO_WORK_ARENA_BLOCK 4096
+#endif
+
+// Largest first block a reset grows to after a message needed more.
+#ifndef NANO_WORK_ARENA_MAX
+#define NANO_WORK_ARENA_MAX (64 * 1024)
+#endif
+
+/*
+ * Bump allocator of a nano_work for what only lives as long as the message
+ * being handled: the pub_packet, rewritten topics and the like. There is
+ * nothing to free, the work resets its arena when it takes the next message.
+ * Only the worker owning an arena allocates from it, without any lock.
+ * A message outgrowing the arena gets more blocks from the heap, which the
+ * reset frees again after growing the first block to fit next time.
+ * work_arena_get() returns NULL for a NULL arena, callers then go to the
+ * heap as before.
+ */
+typedef struct work_arena work_arena;
+
+typedef struct {
+	size_t   arenas;
+	uint64_t allocs;   // served from an arena
+	uint64_t bytes;    // ... in total
+	uint64_t blocks;   // heap allocations of the arenas themselves
+	uint64_t resets;   // messages done with
+	size_t   high;     // most any one message used
+	size_t   reserved; // bytes held by all arenas now
+} work_arena_stats;
+
+extern int  work_arena_init(void);
+// Frees every arena.
+extern void work_arena_fini(void);
+extern bool work_arena_enabled(void);
+
+extern work_arena *work_arena_alloc(void);
+extern void       *work_arena_get(work_arena *a, size_t size);
+extern void       *work_arena_zget(work_arena *a, size_t size);
+// NUL terminated copy of len bytes of s.
+extern char *work_arena_strndup(work_arena *a, const char *s, size_t len);
+extern void  work_arena_reset(work_arena *a);
+// Back to the first block of NANO_WORK_ARENA_BLOCK, for an idle work.
+extern void work_arena_shrink(work_arena *a);
+
+extern void work_arena_stats_get(work_arena_stats *s);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef NANOMQ_WORK_LANE_H
+#define NANOMQ_WORK_LANE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Broker works kept for the heavy lane, taken on top of `parallel`.
+// 0 runs every packet on the works that received it.
+#ifndef NANO_WORK_LANE_HEAVY
+#define NANO_WORK_LANE_HEAVY 2
+#endif
+
+// Heavy packets waiting for a free heavy work, further ones run inline.
+#ifndef NANO_WORK_LANE_DEPTH
+#define NANO_WORK_LANE_DEPTH 1024
+#endif
+
+typedef enum {
+	WORK_LANE_CONTROL, // acks, CONNACK and disconnect events
+	WORK_LANE_PUBLISH,
+	WORK_LANE_HEAVY, // SUBSCRIBE and UNSUBSCRIBE, tree and retain walks
+	WORK_LANES,
+} work_lane_id;
+
+typedef struct {
+	uint64_t handled; // packets run on this lane
+	uint64_t depth;   // waiting right now
+	uint64_t depth_max;
+	uint64_t overflow; // run inline as the queue was full
+} work_lane_stats;
+
+/*
+ * Heavy packets are handed from the receiving works to a few dedicated
+ * ones, so PUBLISH and ack traffic keeps its works while SUBSCRIBE storms
+ * walk the trees. The queue is FIFO and bounded, once full the receiving
+ * work runs the packet itself, so neither side ever starves.
+ */
+extern int  work_lane_init(size_t workers, size_t depth);
+extern void work_lane_fini(void);
+extern bool work_lane_enabled(void);
+
+extern work_lane_id work_lane_classify(uint8_t cmd);
+// Count a packet run by the work that received it.
+extern void work_lane_count(work_lane_id lane);
+
+/*
+ * Queue a heavy item. When a heavy work is parked it is popped into
+ * *worker and the caller hands it item directly, nothing is queued then.
+ * NNG_EAGAIN when the queue is full, NNG_ECLOSED while disabled.
+ */
+extern int work_lane_submit(void *item, void **worker);
+// Next queued item for worker, or NULL after parking it.
+extern void *work_lane_next(void *worker);
+
+extern void work_lane_stats_get(work_lane_id lane, work_lane_stats *s);
+extern const char *work_lane_name(work_lane_id lane);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef NANOMQ_WORK_POOL_H
+#define NANOMQ_WORK_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nng/nng.h"
+
+// Upper bound of broker works, `parallel` being the lower one. The pool
+// stays fixed at `parallel` unless this is larger.
+#ifndef NANO_WORK_POOL_MAX
+#define NANO_WORK_POOL_MAX 0
+#endif
+
+// Busy works are sampled this often (ms), a decision follows every
+// NANO_WORK_POOL_WINDOW samples.
+#ifndef NANO_WORK_POOL_SAMPLE_MS
+#define NANO_WORK_POOL_SAMPLE_MS 100
+#endif
+
+#ifndef NANO_WORK_POOL_WINDOW
+#define NANO_WORK_POOL_WINDOW 10
+#endif
+
+// Utilization (percent) above which the pool grows and below which it
+// shrinks, after that many windows in a row.
+#ifndef NANO_WORK_POOL_HIGH
+#define NANO_WORK_POOL_HIGH 80
+#endif
+
+#ifndef NANO_WORK_POOL_LOW
+#define NANO_WORK_POOL_LOW 30
+#endif
+
+#ifndef NANO_WORK_POOL_GROW_AFTER
+#define NANO_WORK_POOL_GROW_AFTER 2
+#endif
+
+#ifndef NANO_WORK_POOL_SHRINK_AFTER
+#define NANO_WORK_POOL_SHRINK_AFTER 30
+#endif
+
+typedef struct {
+	uint32_t min;
+	uint32_t max;
+	uint32_t size; // works receiving, retiring ones excluded
+	uint32_t busy; // works holding a packet right now
+	float    utilization; // percent busy over the last window
+	uint64_t grown;  // works added since start
+	uint64_t shrunk; // works retired since start
+	bool     elastic;
+} work_pool_stats;
+
+/*
+ * Called from the pool thread after every window. A positive delta asks
+ * for that many new works, a negative one for works to retire at their
+ * next receive; 0 only lets retired works be released. Returns how many
+ * works were actually added or marked.
+ */
+typedef size_t (*work_pool_resize_cb)(int delta, void *arg);
+
+/*
+ * A thread samples the busy works into the utilization either way, it only
+ * resizes the pool through cb when max > min.
+ */
+extern int  work_pool_init(
+     size_t min, size_t max, work_pool_resize_cb cb, void *arg);
+extern void work_pool_fini(void);
+extern bool work_pool_enabled(void);
+
+extern void work_pool_busy(void);
+extern void work_pool_idle(void);
+// A work marked for retirement has stopped receiving.
+extern void work_pool_retired(void);
+
+// One window of the hysteresis, queue_depth being packets waiting for works.
+extern int work_pool_step(float utilization, uint64_t queue_depth);
+
+extern void work_pool_stats_get(work_pool_stats *s);
+
+#endif
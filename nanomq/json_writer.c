@@ -0,0 +1,290 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/json_writer.h"
+
+#define JSON_WRITER_MIN 256
+
+void
+json_writer_init(json_writer *w, size_t hint)
+{
+	memset(w, 0, sizeof(*w));
+	if (nng_msg_alloc(&w->msg, hint + 1) != 0) {
+		w->msg    = NULL;
+		w->failed = true;
+		return;
+	}
+	w->buf    = nng_msg_body(w->msg);
+	w->cap    = hint + 1;
+	w->buf[0] = '\0';
+}
+
+void
+json_writer_fini(json_writer *w)
+{
+	if (w->msg != NULL) {
+		nng_msg_free(w->msg);
+	}
+	memset(w, 0, sizeof(*w));
+}
+
+nng_msg *
+json_writer_take(json_writer *w)
+{
+	nng_msg *msg = w->msg;
+
+	if (w->failed || msg == NULL) {
+		json_writer_fini(w);
+		return NULL;
+	}
+	// shrinking only moves the length, the NUL stays behind it
+	nng_msg_realloc(msg, w->len);
+	memset(w, 0, sizeof(*w));
+	return msg;
+}
+
+// room for n more bytes and the NUL
+static bool
+json_grow(json_writer *w, size_t n)
+{
+	size_t cap;
+
+	if (w->failed) {
+		return false;
+	}
+	if (w->len + n + 1 <= w->cap) {
+		return true;
+	}
+	cap = w->cap < JSON_WRITER_MIN ? JSON_WRITER_MIN : w->cap;
+	while (w->len + n + 1 > cap) {
+		cap *= 2;
+	}
+	if (w->msg == NULL) {
+		if (nng_msg_alloc(&w->msg, cap) != 0) {
+			w->msg    = NULL;
+			w->failed = true;
+			return false;
+		}
+	} else if (nng_msg_realloc(w->msg, cap) != 0) {
+		w->failed = true;
+		return false;
+	}
+	w->buf = nng_msg_body(w->msg);
+	w->cap = cap;
+	return true;
+}
+
+void
+json_write(json_writer *w, const char *text, size_t len)
+{
+	if (!json_grow(w, len)) {
+		return;
+	}
+	memcpy(w->buf + w->len, text, len);
+	w->len += len;
+	w->buf[w->len] = '\0';
+}
+
+void
+json_write_str(json_writer *w, const char *text)
+{
+	json_write(w, text, strlen(text));
+}
+
+// the separator before a value, and the value is there
+static inline void
+json_value(json_writer *w)
+{
+	if (w->comma) {
+		json_write(w, ",", 1);
+	}
+	w->comma = true;
+}
+
+void
+json_write_begin(json_writer *w, char c)
+{
+	json_value(w);
+	json_write(w, &c, 1);
+	w->comma = false;
+}
+
+void
+json_write_end(json_writer *w, char c)
+{
+	json_write(w, &c, 1);
+	w->comma = true;
+}
+
+void
+json_write_key(json_writer *w, const char *key)
+{
+	json_write_string(w, key, strlen(key));
+	json_write(w, ":", 1);
+	w->comma = false;
+}
+
+void
+json_write_string(json_writer *w, const char *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char       *span;
+	char              esc[6] = { '\\', 'u', '0', '0' };
+
+	if (s == NULL) {
+		json_write_null(w);
+		return;
+	}
+	json_value(w);
+	json_write(w, "\"", 1);
+	span = s;
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char) s[i];
+		size_t        n = 2;
+
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+		json_write(w, span, (size_t) (s + i - span));
+		span = s + i + 1;
+		switch (c) {
+		case '"':
+		case '\\':
+			esc[1] = (char) c;
+			break;
+		case '\b':
+			esc[1] = 'b';
+			break;
+		case '\f':
+			esc[1] = 'f';
+			break;
+		case '\n':
+			esc[1] = 'n';
+			break;
+		case '\r':
+			esc[1] = 'r';
+			break;
+		case '\t':
+			esc[1] = 't';
+			break;
+		default:
+			esc[1] = 'u';
+			esc[4] = hex[c >> 4];
+			esc[5] = hex[c & 0xf];
+			n      = 6;
+			break;
+		}
+		json_write(w, esc, n);
+	}
+	json_write(w, span, (size_t) (s + len - span));
+	json_write(w, "\"", 1);
+}
+
+void
+json_write_u64(json_writer *w, uint64_t v)
+{
+	char  digits[20];
+	char *p = digits + sizeof(digits);
+
+	do {
+		*--p = (char) ('0' + v % 10);
+		v /= 10;
+	} while (v != 0);
+	json_value(w);
+	json_write(w, p, (size_t) (digits + sizeof(digits) - p));
+}
+
+void
+json_write_i64(json_writer *w, int64_t v)
+{
+	if (v >= 0) {
+		json_write_u64(w, (uint64_t) v);
+		return;
+	}
+	json_value(w);
+	json_write(w, "-", 1);
+	w->comma = false;
+	json_write_u64(w, 0 - (uint64_t) v);
+}
+
+void
+json_write_bool(json_writer *w, bool v)
+{
+	json_value(w);
+	if (v) {
+		json_write(w, "true", 4);
+	} else {
+		json_write(w, "false", 5);
+	}
+}
+
+void
+json_write_null(json_writer *w)
+{
+	json_value(w);
+	json_write(w, "null", 4);
+}
+
+char *
+json_write_string_reserve(json_writer *w, size_t n)
+{
+	json_value(w);
+	json_write(w, "\"", 1);
+	// the closing quote as well
+	if (!json_grow(w, n + 1)) {
+		return NULL;
+	}
+	return w->buf + w->len;
+}
+
+void
+json_write_string_commit(json_writer *w, size_t len)
+{
+	if (!w->failed) {
+		w->len += len;
+	}
+	json_write(w, "\"", 1);
+}
+
+void
+json_field_str(json_writer *w, const char *key, const char *s)
+{
+	json_write_key(w, key);
+	json_write_string(w, s, s != NULL ? strlen(s) : 0);
+}
+
+void
+json_field_u64(json_writer *w, const char *key, uint64_t v)
+{
+	json_write_key(w, key);
+	json_write_u64(w, v);
+}
+
+void
+json_field_i64(json_writer *w, const char *key, int64_t v)
+{
+	json_write_key(w, key);
+	json_write_i64(w, v);
+}
+
+void
+json_field_bool(json_writer *w, const char *key, bool v)
+{
+	json_write_key(w, key);
+	json_write_bool(w, v);
+}
+
+void
+json_field_null(json_writer *w, const char *key)
+{
+	json_write_key(w, key);
+	json_write_null(w);
+}
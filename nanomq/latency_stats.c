@@ -0,0 +1,229 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+#include <time.h>
+
+#include "include/latency_stats.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+struct latency_block {
+	latency_block *next;
+	uint64_t       seq; // messages offered to latency_sample
+	latency_hist   stage[LATENCY_STAGES];
+};
+
+static struct {
+	nng_mtx       *mtx;
+	latency_block *blocks;
+	bool           enabled;
+} latency_;
+
+static const char *stage_names[LATENCY_STAGES] = {
+	[LATENCY_PUB]       = "handle_pub",
+	[LATENCY_AUTH_HTTP] = "auth_http",
+	[LATENCY_ACL]       = "acl",
+	[LATENCY_MATCH]     = "match",
+	[LATENCY_RETAIN]    = "retain",
+	[LATENCY_FANOUT]    = "fanout",
+	[LATENCY_BRIDGE]    = "bridge",
+	[LATENCY_RULE]      = "rule_engine",
+	[LATENCY_HOOK]      = "webhook",
+	[LATENCY_TOTAL]     = "total",
+};
+
+static inline unsigned
+latency_msb(uint64_t v)
+{
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(v);
+#else
+	unsigned msb = 0;
+	while (v >>= 1) {
+		msb++;
+	}
+	return msb;
+#endif
+}
+
+static inline size_t
+latency_bucket(uint64_t ns)
+{
+	unsigned msb;
+
+	if (ns < 4) {
+		return ns;
+	}
+	if ((msb = latency_msb(ns)) > LATENCY_MSB_MAX) {
+		return LATENCY_BUCKETS - 1;
+	}
+	return msb * 4 + ((ns >> (msb - 2)) & 3) - 4;
+}
+
+static uint64_t
+latency_bucket_upper(size_t idx)
+{
+	unsigned msb;
+
+	if (idx < 4) {
+		return idx + 1;
+	}
+	msb = idx / 4 + 1;
+	return (uint64_t) (4 + idx % 4 + 1) << (msb - 2);
+}
+
+int
+latency_stats_init(void)
+{
+	int rv;
+
+	if (latency_.enabled) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&latency_.mtx)) != 0) {
+		return rv;
+	}
+	latency_.enabled = true;
+	return 0;
+}
+
+void
+latency_stats_fini(void)
+{
+	latency_block *lb;
+
+	if (!latency_.enabled) {
+		return;
+	}
+	while ((lb = latency_.blocks) != NULL) {
+		latency_.blocks = lb->next;
+		nng_free(lb, sizeof(*lb));
+	}
+	nng_mtx_free(latency_.mtx);
+	memset(&latency_, 0, sizeof(latency_));
+}
+
+bool
+latency_stats_enabled(void)
+{
+	return latency_.enabled;
+}
+
+latency_block *
+latency_block_alloc(void)
+{
+	latency_block *lb;
+
+	if (!latency_.enabled || (lb = nng_zalloc(sizeof(*lb))) == NULL) {
+		return NULL;
+	}
+	nng_mtx_lock(latency_.mtx);
+	lb->next        = latency_.blocks;
+	latency_.blocks = lb;
+	nng_mtx_unlock(latency_.mtx);
+	return lb;
+}
+
+bool
+latency_sample(latency_block *lb)
+{
+	return lb != NULL && lb->seq++ % NANO_LATENCY_SAMPLE == 0;
+}
+
+void
+latency_record(latency_block *lb, int stage, uint64_t ns)
+{
+	latency_hist *h = &lb->stage[stage];
+
+	h->count++;
+	h->sum += ns;
+	h->hist[latency_bucket(ns)]++;
+}
+
+uint64_t
+latency_now(void)
+{
+#if defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return (uint64_t) nng_clock() * 1000000;
+#endif
+}
+
+void
+latency_collect(latency_hist hist[LATENCY_STAGES])
+{
+	memset(hist, 0, sizeof(latency_hist) * LATENCY_STAGES);
+	if (!latency_.enabled) {
+		return;
+	}
+	nng_mtx_lock(latency_.mtx);
+	for (latency_block *lb = latency_.blocks; lb != NULL; lb = lb->next) {
+		for (int s = 0; s < LATENCY_STAGES; s++) {
+			const latency_hist *src = &lb->stage[s];
+			hist[s].count += src->count;
+			hist[s].sum += src->sum;
+			for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+				hist[s].hist[i] += src->hist[i];
+			}
+		}
+	}
+	nng_mtx_unlock(latency_.mtx);
+}
+
+const char *
+latency_stage_name(int stage)
+{
+	return stage >= 0 && stage < LATENCY_STAGES ? stage_names[stage]
+	                                            : "unknown";
+}
+
+uint64_t
+latency_quantile(const latency_hist *h, double q)
+{
+	uint64_t total = 0;
+	uint64_t rank;
+	uint64_t seen = 0;
+
+	// count may run ahead of the buckets while a worker records
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+		total += h->hist[i];
+	}
+	if (total == 0) {
+		return 0;
+	}
+	rank = (uint64_t) (q * total);
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += h->hist[i];
+		if (seen > rank) {
+			return latency_bucket_upper(i);
+		}
+	}
+	return latency_bucket_upper(LATENCY_BUCKETS - 1);
+}
+
+uint64_t
+latency_count_below(const latency_hist *h, unsigned log2_ns)
+{
+	size_t   end = log2_ns < 2 ? ((size_t) 1 << log2_ns)
+	                           : (size_t) log2_ns * 4 - 4;
+	uint64_t n   = 0;
+
+	if (end > LATENCY_BUCKETS) {
+		end = LATENCY_BUCKETS;
+	}
+	for (size_t i = 0; i < end; i++) {
+		n += h->hist[i];
+	}
+	return n;
+}
@@ -0,0 +1,216 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/match_cache.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/log.h"
+
+// slots are direct mapped and guarded by a fixed set of striped locks
+#define MATCH_CACHE_LOCKS 64
+
+typedef struct {
+	match_cache_entry **slots;
+	size_t              size;
+	nng_mtx            *locks[MATCH_CACHE_LOCKS];
+	nng_atomic_u64     *gen;
+	nng_atomic_u64     *hits;
+	nng_atomic_u64     *misses;
+	bool                enabled;
+} match_cache;
+
+static match_cache cache = { .enabled = false };
+
+// FNV-1a
+static uint32_t
+match_cache_hash(const char *topic)
+{
+	uint32_t h = 2166136261u;
+	while (*topic != '\0') {
+		h ^= (uint8_t) *topic++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void
+match_cache_entry_free(match_cache_entry *entry)
+{
+	nng_strfree(entry->topic);
+	cvector_free(entry->pipes);
+	nng_atomic_free(entry->ref);
+	nng_free(entry, sizeof(match_cache_entry));
+}
+
+int
+match_cache_init(size_t size)
+{
+	int rv;
+
+	if (cache.enabled) {
+		return 0;
+	}
+	if (size == 0 || (size & (size - 1)) != 0) {
+		log_error("match cache size %lu is not a power of two", size);
+		return NNG_EINVAL;
+	}
+	cache.slots = nng_zalloc(sizeof(match_cache_entry *) * size);
+	if (cache.slots == NULL) {
+		return NNG_ENOMEM;
+	}
+	cache.size = size;
+	for (int i = 0; i < MATCH_CACHE_LOCKS; i++) {
+		if ((rv = nng_mtx_alloc(&cache.locks[i])) != 0) {
+			while (--i >= 0) {
+				nng_mtx_free(cache.locks[i]);
+			}
+			nng_free(cache.slots, sizeof(match_cache_entry *) * size);
+			cache.slots = NULL;
+			return rv;
+		}
+	}
+	nng_atomic_alloc64(&cache.gen);
+	nng_atomic_alloc64(&cache.hits);
+	nng_atomic_alloc64(&cache.misses);
+	cache.enabled = true;
+	log_info("topic match cache enabled with %lu slots", size);
+	return 0;
+}
+
+void
+match_cache_fini(void)
+{
+	if (!cache.enabled) {
+		return;
+	}
+	cache.enabled = false;
+	for (size_t i = 0; i < cache.size; i++) {
+		if (cache.slots[i] != NULL) {
+			match_cache_release(cache.slots[i]);
+		}
+	}
+	nng_free(cache.slots, sizeof(match_cache_entry *) * cache.size);
+	cache.slots = NULL;
+	cache.size  = 0;
+	for (int i = 0; i < MATCH_CACHE_LOCKS; i++) {
+		nng_mtx_free(cache.locks[i]);
+	}
+	nng_atomic_free64(cache.gen);
+	nng_atomic_free64(cache.hits);
+	nng_atomic_free64(cache.misses);
+}
+
+bool
+match_cache_enabled(void)
+{
+	return cache.enabled;
+}
+
+void
+match_cache_invalidate(void)
+{
+	if (cache.enabled) {
+		nng_atomic_inc64(cache.gen);
+	}
+}
+
+uint64_t
+match_cache_generation(void)
+{
+	return cache.enabled ? nng_atomic_get64(cache.gen) : 0;
+}
+
+match_cache_entry *
+match_cache_get(const char *topic)
+{
+	match_cache_entry *entry;
+	uint32_t           hash;
+	size_t             idx;
+	uint64_t           gen;
+
+	if (!cache.enabled || topic == NULL) {
+		return NULL;
+	}
+	hash = match_cache_hash(topic);
+	idx  = hash & (cache.size - 1);
+	gen  = nng_atomic_get64(cache.gen);
+
+	nng_mtx_lock(cache.locks[idx % MATCH_CACHE_LOCKS]);
+	entry = cache.slots[idx];
+	if (entry != NULL && entry->hash == hash && entry->gen == gen &&
+	    strcmp(entry->topic, topic) == 0) {
+		nng_atomic_inc(entry->ref);
+	} else {
+		entry = NULL;
+	}
+	nng_mtx_unlock(cache.locks[idx % MATCH_CACHE_LOCKS]);
+
+	nng_atomic_inc64(entry != NULL ? cache.hits : cache.misses);
+	return entry;
+}
+
+match_cache_entry *
+match_cache_put(
+    const char *topic, uint64_t gen, uint32_t *pipes, bool has_shared)
+{
+	match_cache_entry *entry;
+	match_cache_entry *old;
+	size_t             idx;
+
+	if (!cache.enabled || topic == NULL) {
+		return NULL;
+	}
+	if ((entry = nng_zalloc(sizeof(match_cache_entry))) == NULL) {
+		return NULL;
+	}
+	if ((entry->topic = nng_strdup(topic)) == NULL ||
+	    nng_atomic_alloc(&entry->ref) != 0) {
+		nng_strfree(entry->topic);
+		nng_free(entry, sizeof(match_cache_entry));
+		return NULL;
+	}
+	// one reference for the slot, one for the caller
+	nng_atomic_set(entry->ref, 2);
+	entry->hash       = match_cache_hash(topic);
+	entry->gen        = gen;
+	entry->pipes      = pipes;
+	entry->has_shared = has_shared;
+
+	idx = entry->hash & (cache.size - 1);
+	nng_mtx_lock(cache.locks[idx % MATCH_CACHE_LOCKS]);
+	old              = cache.slots[idx];
+	cache.slots[idx] = entry;
+	nng_mtx_unlock(cache.locks[idx % MATCH_CACHE_LOCKS]);
+
+	if (old != NULL) {
+		match_cache_release(old);
+	}
+	return entry;
+}
+
+void
+match_cache_release(match_cache_entry *entry)
+{
+	if (entry != NULL && nng_atomic_dec_nv(entry->ref) == 0) {
+		match_cache_entry_free(entry);
+	}
+}
+
+uint64_t
+match_cache_hits(void)
+{
+	return cache.enabled ? nng_atomic_get64(cache.hits) : 0;
+}
+
+uint64_t
+match_cache_misses(void)
+{
+	return cache.enabled ? nng_atomic_get64(cache.misses) : 0;
+}
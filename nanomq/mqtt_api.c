@@ -13,8 +13,11 @@
 #include <arpa/inet.h>
 #endif
 
+#include <string.h>
+
 #include "mqtt_api.h"
 #include "nanomq.h"
+#include "include/async_log.h"
 #include "nng/nng.h"
 #include "nng/protocol/mqtt/mqtt_parser.h"
 #include "nng/supplemental/nanolib/file.h"
@@ -25,6 +28,34 @@
 #include <syslog.h>
 #endif
 
+/**
+ * @brief ask ws:// and wss:// listeners for frames around the shared
+ * PUBLISH, built with SUPP_WS_SHARED_FRAMES. Once per listener, before
+ * it starts. Optional, the listener works without.
+ */
+void
+init_listener_ws(nng_listener l)
+{
+#if defined(SUPP_WS_SHARED_FRAMES)
+	char *url = NULL;
+	int   rv;
+
+	nng_listener_get_string(l, NNG_OPT_URL, &url);
+	if (url == NULL ||
+	    (strstr(url, "ws://") == NULL && strstr(url, "wss://") == NULL)) {
+		nng_strfree(url);
+		return;
+	}
+	if ((rv = nng_listener_set_bool(l, NANO_OPT_WS_SHARED_FRAMES, true)) !=
+	    0) {
+		log_info("%s: no shared frames in transport: %d", url, rv);
+	}
+	nng_strfree(url);
+#else
+	(void) l;
+#endif
+}
+
 /**
  * @brief create listener for MQTT
  * and start listen
@@ -44,6 +75,7 @@ nano_listen(nng_socket sid, const char *addr, nng_listener *lp, int flags,
 
 	nng_listener_create(&l, sid, addr);
 	nng_listener_set(l, NANO_CONF, config, sizeof(conf));
+	init_listener_ws(l);
 	if ((rv = nng_listener_start(l, 0)) != 0) {
 		nng_listener_close(l);
 		return (rv);
@@ -107,7 +139,9 @@ static conn_param *
 create_cparam(const char *clientid, uint8_t proto_ver)
 {
 	conn_param *cparam;
-	conn_param_alloc(&cparam);
+	if (conn_param_alloc(&cparam) != 0) {
+		return NULL;
+	}
 	conn_param_set_clientid(cparam, clientid);
 	conn_param_set_proto_ver(cparam, proto_ver);
 	return cparam;
@@ -226,7 +260,8 @@ log_file_init(conf_log *log)
 int
 log_init(conf_log *log)
 {
-	int rv = 0;
+	int            rv   = 0;
+	async_log_conf alog = { 0 };
 
 	log_set_level(log->level);
 
@@ -239,7 +274,13 @@ log_init(conf_log *log)
 		    0 != (rv = nng_mtx_alloc(&log_file_mtx))) {
 			return rv;
 		}
-		log_add_fp(log->fp, log->level, log_file_mtx, log);
+		async_log_conf_env(&alog);
+		if (alog.enable && async_log_init(&alog, log) == 0) {
+			log_add_callback(
+			    async_log_event, NULL, log->level, NULL, log);
+		} else {
+			log_add_fp(log->fp, log->level, log_file_mtx, log);
+		}
 	}
 
 #if defined(SUPP_SYSLOG)
@@ -264,6 +305,8 @@ log_fini(conf_log *log)
 	}
 #endif
 	log_clear_callback();
+	// after the callback is gone, so nothing is left behind in a ring
+	async_log_fini();
 
 	return 0;
 }
@@ -354,74 +397,99 @@ nano_iceoryx_topic_filter(char *icetopic, char *topic, uint32_t topicsz)
 	return (0 == strncmp(icetopic, topic, topicsz));
 }
 
+// One cparam stands for the whole bridge, messages take a reference.
+static conn_param *iceoryx_cparam = NULL;
+
+int
+nano_iceoryx_init(void)
+{
+	if (iceoryx_cparam != NULL) {
+		return 0;
+	}
+	if ((iceoryx_cparam = create_cparam(
+	         NANO_ICEORYX_CLIENTID, MQTT_PROTOCOL_VERSION_v311)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	return 0;
+}
+
+void
+nano_iceoryx_fini(void)
+{
+	if (iceoryx_cparam != NULL) {
+		conn_param_free(iceoryx_cparam);
+		iceoryx_cparam = NULL;
+	}
+}
+
+/*
+ * The chunk is loaned from the publisher and written in two appends, the
+ * prefix of header length, fixed header and body length, then the body.
+ */
 int
-nano_iceoryx_send_nng_msg(nng_iceoryx_puber *puber, nng_msg *msg, nng_socket *sock)
+nano_iceoryx_chunk_alloc(
+    nng_iceoryx_puber *puber, nng_msg *msg, nng_msg **icemsgp)
 {
 	int      rv;
 	nng_msg *icemsg;
 	size_t   icehdrlen = nng_msg_header_len(msg);
-	size_t   icelen = nng_msg_len(msg);
-	uint8_t  icehdrbuf[1];
-	uint8_t  icebuf[4];
+	size_t   icelen    = nng_msg_len(msg);
+	uint8_t  prefix[1 + NANO_MQTT_FIXED_HDR_MAX + 4];
 
+	if (icehdrlen > NANO_MQTT_FIXED_HDR_MAX) {
+		return NNG_EINVAL;
+	}
 	log_debug("iceoryx send a msg sz %d", icehdrlen + icelen + 5);
 	rv = nng_msg_iceoryx_alloc(&icemsg, puber, (int)(icehdrlen + icelen + 5));
 	if (rv != 0)
 		return rv;
 
-	// append header
-	icehdrbuf[0] = (uint8_t)icehdrlen;
-	nng_msg_iceoryx_append(icemsg, icehdrbuf, 1);
-	nng_msg_iceoryx_append(icemsg, nng_msg_header(msg), icehdrlen);
-
-	// append body
-	NNI_PUT32(icebuf, icelen);
-	nng_msg_iceoryx_append(icemsg, icebuf, 4);
+	prefix[0] = (uint8_t) icehdrlen;
+	memcpy(prefix + 1, nng_msg_header(msg), icehdrlen);
+	NNI_PUT32(prefix + 1 + icehdrlen, icelen);
+	nng_msg_iceoryx_append(icemsg, prefix, icehdrlen + 5);
 	nng_msg_iceoryx_append(icemsg, nng_msg_body(msg), icelen);
 
-	nng_aio *aio;
-	nng_aio_alloc(&aio, NULL, NULL);
-	nng_aio_set_prov_data(aio, puber);
-	nng_aio_set_msg(aio, icemsg);
-	nng_send_aio(*sock, aio);
-	log_debug("iceoryx sending and wait");
-	nng_aio_wait(aio);
-	rv = nng_aio_result(aio);
-	nng_aio_free(aio);
-
-	return rv;
+	*icemsgp = icemsg;
+	return 0;
 }
 
+// The chunk is copied once into a message of its size, the caller gives
+// the chunk back right after.
 int
 nano_iceoryx_recv_nng_msg(nng_iceoryx_suber *suber, nng_msg *icemsg, nng_msg **msgp)
 {
-	int      rv;
-	nng_msg *msg;
-	size_t   icehdrlen;
-	size_t   icebodylen;
-	uint8_t *icebuf;
+	int         rv;
+	nng_msg    *msg;
+	size_t      icehdrlen;
+	uint32_t    icebodylen;
+	uint8_t    *icebuf;
+	conn_param *cparam;
 
+	(void) suber;
 	log_debug("iceoryx recving msg");
 
-	rv = nng_mqtt_msg_alloc(&msg, 0);
-	if (rv != 0)
-		return rv;
+	icebuf    = nng_msg_payload_ptr(icemsg);
+	icehdrlen = *(uint8_t *) icebuf;
+	NNI_GET32(icebuf + 1 + icehdrlen, icebodylen);
 
-	icebuf = nng_msg_payload_ptr(icemsg);
-	// decode header
-	icehdrlen = *(uint8_t *)icebuf;
-	rv = nng_msg_header_append(msg, icebuf + 1, icehdrlen);
-	if (rv != 0)
+	if ((rv = nng_mqtt_msg_alloc(&msg, icebodylen)) != 0) {
 		return rv;
-
-	// decode body
-	NNI_GET32(icebuf + 1 + icehdrlen, icebodylen);
-	rv = nng_msg_append(msg, icebuf + 1 + icehdrlen + 4, icebodylen);
-	if (rv != 0)
+	}
+	if ((rv = nng_msg_header_append(msg, icebuf + 1, icehdrlen)) != 0) {
+		nng_msg_free(msg);
 		return rv;
-
-	// Create a cparam ...
-	conn_param *cparam = create_cparam("atestclientid", MQTT_PROTOCOL_VERSION_v311);
+	}
+	memcpy(nng_msg_body(msg), icebuf + 1 + icehdrlen + 4, icebodylen);
+
+	if (iceoryx_cparam != NULL) {
+		cparam = iceoryx_cparam;
+		conn_param_clone(cparam);
+	} else if ((cparam = create_cparam(NANO_ICEORYX_CLIENTID,
+	                MQTT_PROTOCOL_VERSION_v311)) == NULL) {
+		nng_msg_free(msg);
+		return NNG_ENOMEM;
+	}
 	nng_mqtt_msg_decode(msg);
 	nng_msg_set_conn_param(msg, cparam);
 
@@ -0,0 +1,183 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/msg_pool.h"
+#include "nng/supplemental/util/platform.h"
+
+static const size_t class_size[MSG_POOL_CLASSES] = { 256, 1024, 4096,
+	16384 };
+static const size_t class_cap[MSG_POOL_CLASSES] = { NANO_MSG_POOL_CAP_256,
+	NANO_MSG_POOL_CAP_1K, NANO_MSG_POOL_CAP_4K, NANO_MSG_POOL_CAP_16K };
+
+#define MSG_POOL_SLOTS                                \
+	(NANO_MSG_POOL_CAP_256 + NANO_MSG_POOL_CAP_1K + \
+	    NANO_MSG_POOL_CAP_4K + NANO_MSG_POOL_CAP_16K)
+
+struct msg_pool {
+	msg_pool *next;
+	nng_msg  *slots[MSG_POOL_SLOTS];
+	nng_msg **free[MSG_POOL_CLASSES]; // stack of each class in slots
+	size_t    count[MSG_POOL_CLASSES];
+	uint64_t  hits;
+	uint64_t  misses;
+	uint64_t  drops;
+};
+
+static struct {
+	nng_mtx  *mtx;
+	msg_pool *pools;
+	bool      enabled;
+} pool_;
+
+int
+msg_pool_init(void)
+{
+	int rv;
+
+	if (pool_.enabled) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&pool_.mtx)) != 0) {
+		return rv;
+	}
+	pool_.enabled = true;
+	return 0;
+}
+
+void
+msg_pool_fini(void)
+{
+	msg_pool *p;
+
+	if (!pool_.enabled) {
+		return;
+	}
+	while ((p = pool_.pools) != NULL) {
+		pool_.pools = p->next;
+		for (int c = 0; c < MSG_POOL_CLASSES; c++) {
+			while (p->count[c] > 0) {
+				nng_msg_free(p->free[c][--p->count[c]]);
+			}
+		}
+		nng_free(p, sizeof(*p));
+	}
+	nng_mtx_free(pool_.mtx);
+	memset(&pool_, 0, sizeof(pool_));
+}
+
+bool
+msg_pool_enabled(void)
+{
+	return pool_.enabled;
+}
+
+msg_pool *
+msg_pool_alloc(void)
+{
+	msg_pool *p;
+	size_t    off = 0;
+
+	if (!pool_.enabled || (p = nng_zalloc(sizeof(*p))) == NULL) {
+		return NULL;
+	}
+	for (int c = 0; c < MSG_POOL_CLASSES; c++) {
+		p->free[c] = p->slots + off;
+		off += class_cap[c];
+	}
+	nng_mtx_lock(pool_.mtx);
+	p->next     = pool_.pools;
+	pool_.pools = p;
+	nng_mtx_unlock(pool_.mtx);
+	return p;
+}
+
+int
+msg_pool_get(msg_pool *p, nng_msg **msgp, size_t size)
+{
+	int c = 0;
+	int rv;
+
+	while (c < MSG_POOL_CLASSES && class_size[c] < size) {
+		c++;
+	}
+	if (p != NULL && c < MSG_POOL_CLASSES) {
+		// a larger class serves as well
+		for (int k = c; k < MSG_POOL_CLASSES; k++) {
+			if (p->count[k] > 0) {
+				p->hits++;
+				*msgp = p->free[k][--p->count[k]];
+				return 0;
+			}
+		}
+		size = class_size[c];
+	}
+	if (p != NULL) {
+		p->misses++;
+	}
+	if ((rv = nng_msg_alloc(msgp, size)) == 0) {
+		nng_msg_clear(*msgp);
+	}
+	return rv;
+}
+
+void
+msg_pool_put(msg_pool *p, nng_msg *msg)
+{
+	size_t len;
+	int    c;
+
+	if (p == NULL) {
+		nng_msg_free(msg);
+		return;
+	}
+	len = nng_msg_len(msg);
+	if (len > class_size[MSG_POOL_CLASSES - 1] * 4) {
+		p->drops++;
+		nng_msg_free(msg);
+		return;
+	}
+	// every pooled message was allocated with class 0 room at least,
+	// so growing to the class it fills is no allocation
+	c = MSG_POOL_CLASSES - 1;
+	while (c > 0 && class_size[c] > len) {
+		c--;
+	}
+	if (p->count[c] == class_cap[c] ||
+	    (len < class_size[c] &&
+	        nng_msg_realloc(msg, class_size[c]) != 0)) {
+		p->drops++;
+		nng_msg_free(msg);
+		return;
+	}
+	nng_msg_clear(msg);
+	nng_msg_header_clear(msg);
+	p->free[c][p->count[c]++] = msg;
+}
+
+void
+msg_pool_stats_get(msg_pool_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!pool_.enabled) {
+		return;
+	}
+	nng_mtx_lock(pool_.mtx);
+	for (msg_pool *p = pool_.pools; p != NULL; p = p->next) {
+		s->pools++;
+		s->hits += p->hits;
+		s->misses += p->misses;
+		s->drops += p->drops;
+		for (int c = 0; c < MSG_POOL_CLASSES; c++) {
+			s->cached += p->count[c];
+		}
+	}
+	nng_mtx_unlock(pool_.mtx);
+}
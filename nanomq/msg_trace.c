@@ -0,0 +1,605 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "include/json_writer.h"
+#include "include/msg_trace.h"
+#include "include/topic_match.h"
+#include "include/webhook_pool.h"
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+// kept of a client id and a topic, longer ones are cut
+#define TRACE_CLIENT_LEN 64
+#define TRACE_TOPIC_LEN 128
+
+typedef struct {
+	uint64_t time; // unix ns
+	uint64_t value;
+	uint32_t kind;
+} trace_event;
+
+struct msg_trace {
+	msg_trace  *next;
+	uint8_t     trace_id[16];
+	uint8_t     span_id[8];
+	uint8_t     parent_id[8];
+	bool        has_parent;
+	uint8_t     qos;
+	uint8_t     nevents;
+	uint32_t    pipe;
+	uint64_t    start; // unix ns
+	uint64_t    end;
+	char        client_id[TRACE_CLIENT_LEN];
+	char        topic[TRACE_TOPIC_LEN];
+	trace_event events[NANO_TRACE_EVENTS];
+};
+
+static struct {
+	nng_mtx          *mtx;
+	nng_cv           *cv;
+	msg_trace        *traces; // NANO_TRACE_POOL of them
+	msg_trace        *free;
+	msg_trace        *done; // ended, oldest first
+	msg_trace       **done_tail;
+	size_t            ndone;
+	nng_thread       *thr;
+	webhook_pool     *pool;
+	topic_filter_set *topics;
+	uint32_t          topic_rate[NANO_TRACE_TOPICS];
+	nng_atomic_u64   *topic_seq[NANO_TRACE_TOPICS];
+	size_t            ntopics;
+	uint32_t          sample;
+	bool              stop;
+	bool              enabled;
+	conf_web_hook     otlp;
+	conf_http_header  header;
+	conf_http_header *headers[1];
+} trace_;
+
+static const char *event_names[TRACE_EVENT_KINDS] = {
+	[TRACE_AUTH]     = "auth",
+	[TRACE_ACL]      = "acl",
+	[TRACE_MATCH]    = "match",
+	[TRACE_RETAIN]   = "retain",
+	[TRACE_EGRESS]   = "egress",
+	[TRACE_BRIDGE]   = "bridge",
+	[TRACE_RULE]     = "rule_engine",
+	[TRACE_WEBHOOK]  = "webhook",
+	[TRACE_EXCHANGE] = "exchange",
+};
+
+static uint64_t
+trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+trace_random(uint8_t *id, size_t len)
+{
+	for (size_t i = 0; i < len; i += 4) {
+		uint32_t r = nng_random();
+		size_t   n = len - i < 4 ? len - i : 4;
+		memcpy(id + i, &r, n);
+	}
+}
+
+static int
+trace_hex_val(uint8_t c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	return -1; // W3C allows lowercase only
+}
+
+static bool
+trace_hex_decode(const uint8_t *s, uint8_t *id, size_t len)
+{
+	uint8_t any = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		int hi = trace_hex_val(s[i * 2]);
+		int lo = trace_hex_val(s[i * 2 + 1]);
+		if (hi < 0 || lo < 0) {
+			return false;
+		}
+		id[i] = (uint8_t) (hi << 4 | lo);
+		any |= id[i];
+	}
+	// all zero ids are invalid
+	return any != 0;
+}
+
+static void
+trace_hex_encode(const uint8_t *id, size_t len, char *s)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	for (size_t i = 0; i < len; i++) {
+		s[i * 2]     = hex[id[i] >> 4];
+		s[i * 2 + 1] = hex[id[i] & 0xf];
+	}
+}
+
+/*
+ * 00-<32 hex trace id>-<16 hex parent id>-<2 hex flags>. A traceparent
+ * that does not parse is ignored, as if there were none.
+ */
+static bool
+trace_parse_parent(const uint8_t *tp, msg_trace *t, bool *sampled)
+{
+	uint8_t flags;
+
+	if (tp[0] != '0' || tp[1] != '0' || tp[2] != '-' || tp[35] != '-' ||
+	    tp[52] != '-' || !trace_hex_decode(tp + 3, t->trace_id, 16) ||
+	    !trace_hex_decode(tp + 36, t->parent_id, 8)) {
+		return false;
+	}
+	if (trace_hex_val(tp[53]) < 0 || trace_hex_val(tp[54]) < 0) {
+		return false;
+	}
+	flags    = (uint8_t) (trace_hex_val(tp[53]) << 4 | trace_hex_val(tp[54]));
+	*sampled = (flags & 1) != 0;
+	return true;
+}
+
+static int
+trace_conf_topics(const char *s)
+{
+	char *list;
+	char *save = NULL;
+	int   rv;
+
+	if ((rv = topic_filter_set_alloc(&trace_.topics)) != 0) {
+		return rv;
+	}
+	if ((list = nng_strdup(s)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	for (char *f = strtok_r(list, ",", &save); f != NULL;
+	     f       = strtok_r(NULL, ",", &save)) {
+		char *eq   = strchr(f, '=');
+		long  rate = 1;
+
+		if (trace_.ntopics == NANO_TRACE_TOPICS) {
+			rv = NNG_ENOSPC;
+			break;
+		}
+		if (eq != NULL) {
+			char *end;
+			*eq  = '\0';
+			rate = strtol(eq + 1, &end, 10);
+			if (*end != '\0' || rate < 0) {
+				rv = NNG_EINVAL;
+				break;
+			}
+		}
+		if ((rv = topic_filter_set_add(
+		         trace_.topics, f, (uint32_t) trace_.ntopics)) != 0 ||
+		    (rv = nng_atomic_alloc64(
+		         &trace_.topic_seq[trace_.ntopics])) != 0) {
+			break;
+		}
+		trace_.topic_rate[trace_.ntopics++] = (uint32_t) rate;
+	}
+	nng_strfree(list);
+	return rv;
+}
+
+/*
+ * resourceSpans -> scopeSpans -> spans of OTLP/HTTP JSON, ids in hex and
+ * 64 bit integers as strings as its JSON mapping has them.
+ */
+static void
+trace_attr_str(json_writer *w, const char *key, const char *value)
+{
+	json_write_begin(w, '{');
+	json_field_str(w, "key", key);
+	json_write_key(w, "value");
+	json_write_begin(w, '{');
+	json_field_str(w, "stringValue", value);
+	json_write_end(w, '}');
+	json_write_end(w, '}');
+}
+
+static void
+trace_attr_int(json_writer *w, const char *key, uint64_t value)
+{
+	char num[24];
+
+	snprintf(num, sizeof(num), "%llu", (unsigned long long) value);
+	json_write_begin(w, '{');
+	json_field_str(w, "key", key);
+	json_write_key(w, "value");
+	json_write_begin(w, '{');
+	json_field_str(w, "intValue", num);
+	json_write_end(w, '}');
+	json_write_end(w, '}');
+}
+
+static void
+trace_field_time(json_writer *w, const char *key, uint64_t ns)
+{
+	char num[24];
+
+	snprintf(num, sizeof(num), "%llu", (unsigned long long) ns);
+	json_field_str(w, key, num);
+}
+
+static void
+trace_write_span(json_writer *w, const msg_trace *t)
+{
+	char id[33];
+
+	json_write_begin(w, '{');
+	trace_hex_encode(t->trace_id, 16, id);
+	id[32] = '\0';
+	json_field_str(w, "traceId", id);
+	trace_hex_encode(t->span_id, 8, id);
+	id[16] = '\0';
+	json_field_str(w, "spanId", id);
+	if (t->has_parent) {
+		trace_hex_encode(t->parent_id, 8, id);
+		json_field_str(w, "parentSpanId", id);
+	}
+	json_field_str(w, "name", "publish");
+	json_field_u64(w, "kind", 5); // SPAN_KIND_CONSUMER
+	trace_field_time(w, "startTimeUnixNano", t->start);
+	trace_field_time(w, "endTimeUnixNano", t->end);
+
+	json_write_key(w, "attributes");
+	json_write_begin(w, '[');
+	trace_attr_str(w, "messaging.system", "mqtt");
+	trace_attr_str(w, "messaging.destination.name", t->topic);
+	trace_attr_str(w, "messaging.client_id", t->client_id);
+	trace_attr_int(w, "messaging.mqtt.qos", t->qos);
+	trace_attr_int(w, "nanomq.pipe", t->pipe);
+	json_write_end(w, ']');
+
+	json_write_key(w, "events");
+	json_write_begin(w, '[');
+	for (uint8_t i = 0; i < t->nevents; i++) {
+		const trace_event *e = &t->events[i];
+
+		json_write_begin(w, '{');
+		trace_field_time(w, "timeUnixNano", e->time);
+		json_field_str(w, "name", msg_trace_event_name(e->kind));
+		json_write_key(w, "attributes");
+		json_write_begin(w, '[');
+		trace_attr_int(w, "value", e->value);
+		json_write_end(w, ']');
+		json_write_end(w, '}');
+	}
+	json_write_end(w, ']');
+	json_write_end(w, '}');
+}
+
+static void
+trace_export(msg_trace *list, size_t n)
+{
+	json_writer w;
+	nng_msg    *msg;
+	int         rv;
+
+	json_writer_init(&w, n * 1024);
+	json_write_begin(&w, '{');
+	json_write_key(&w, "resourceSpans");
+	json_write_begin(&w, '[');
+	json_write_begin(&w, '{');
+	json_write_key(&w, "resource");
+	json_write_begin(&w, '{');
+	json_write_key(&w, "attributes");
+	json_write_begin(&w, '[');
+	trace_attr_str(&w, "service.name", "nanomq");
+	json_write_end(&w, ']');
+	json_write_end(&w, '}');
+	json_write_key(&w, "scopeSpans");
+	json_write_begin(&w, '[');
+	json_write_begin(&w, '{');
+	json_write_key(&w, "scope");
+	json_write_begin(&w, '{');
+	json_field_str(&w, "name", "nanomq");
+	json_write_end(&w, '}');
+	json_write_key(&w, "spans");
+	json_write_begin(&w, '[');
+	for (msg_trace *t = list; t != NULL; t = t->next) {
+		trace_write_span(&w, t);
+	}
+	json_write_end(&w, ']');
+	json_write_end(&w, '}');
+	json_write_end(&w, ']');
+	json_write_end(&w, '}');
+	json_write_end(&w, ']');
+	json_write_end(&w, '}');
+
+	if ((msg = json_writer_take(&w)) == NULL) {
+		log_warn("trace export of %zu spans lost: out of memory", n);
+		return;
+	}
+	if ((rv = webhook_pool_send(trace_.pool, msg)) != 0) {
+		log_warn("trace export of %zu spans lost: %d", n, rv);
+	}
+}
+
+static void
+trace_export_run(void *arg)
+{
+	(void) arg;
+	nng_mtx_lock(trace_.mtx);
+	// what ended before the stop still goes out
+	while (!trace_.stop || trace_.ndone > 0) {
+		msg_trace *list;
+		msg_trace *last = NULL;
+		size_t     n;
+
+		if (trace_.ndone < NANO_TRACE_BATCH && !trace_.stop) {
+			nng_cv_until(trace_.cv, nng_clock() + NANO_TRACE_FLUSH_MS);
+		}
+		if (trace_.ndone == 0) {
+			continue;
+		}
+		list             = trace_.done;
+		n                = trace_.ndone;
+		trace_.done      = NULL;
+		trace_.done_tail = &trace_.done;
+		trace_.ndone     = 0;
+		nng_mtx_unlock(trace_.mtx);
+
+		trace_export(list, n);
+		for (msg_trace *t = list; t != NULL; t = t->next) {
+			last = t;
+		}
+
+		nng_mtx_lock(trace_.mtx);
+		last->next  = trace_.free;
+		trace_.free = list;
+	}
+	nng_mtx_unlock(trace_.mtx);
+}
+
+int
+msg_trace_init(void)
+{
+	const char *url    = getenv("NANOMQ_TRACE_OTLP");
+	const char *sample = getenv("NANOMQ_TRACE_SAMPLE");
+	const char *topics = getenv("NANOMQ_TRACE_TOPICS");
+	int         rv;
+
+	if (trace_.enabled || url == NULL || *url == '\0') {
+		return 0;
+	}
+#if NANO_WEBHOOK_BATCH_EVENTS > 1
+	// batches would wrap each OTLP request into a JSON array
+	log_warn("tracing needs NANO_WEBHOOK_BATCH_EVENTS 1");
+	return NNG_ENOTSUP;
+#endif
+	trace_.sample = NANO_TRACE_SAMPLE;
+	if (sample != NULL && *sample != '\0') {
+		char *end;
+		long  n = strtol(sample, &end, 10);
+		if (*end != '\0' || n < 0) {
+			log_warn("NANOMQ_TRACE_SAMPLE \"%s\" ignored", sample);
+		} else {
+			trace_.sample = (uint32_t) n;
+		}
+	}
+	if (topics != NULL && *topics != '\0' &&
+	    (rv = trace_conf_topics(topics)) != 0) {
+		log_warn("NANOMQ_TRACE_TOPICS \"%s\" ignored: %d", topics, rv);
+		topic_filter_set_free(trace_.topics);
+		for (size_t i = 0; i < trace_.ntopics; i++) {
+			nng_atomic_free64(trace_.topic_seq[i]);
+		}
+		trace_.topics  = NULL;
+		trace_.ntopics = 0;
+	}
+
+	trace_.header.key        = (char *) "Content-Type";
+	trace_.header.value      = (char *) "application/json";
+	trace_.headers[0]        = &trace_.header;
+	trace_.otlp.url          = (char *) url;
+	trace_.otlp.headers      = trace_.headers;
+	trace_.otlp.header_count = 1;
+	trace_.otlp.pool_size    = 1;
+	trace_.done_tail         = &trace_.done;
+
+	if ((trace_.traces = nng_zalloc(sizeof(msg_trace) * NANO_TRACE_POOL)) ==
+	    NULL) {
+		rv = NNG_ENOMEM;
+		goto fail;
+	}
+	for (size_t i = 0; i < NANO_TRACE_POOL; i++) {
+		trace_.traces[i].next = trace_.free;
+		trace_.free           = &trace_.traces[i];
+	}
+	if ((rv = nng_mtx_alloc(&trace_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&trace_.cv, trace_.mtx)) != 0 ||
+	    (rv = webhook_pool_alloc(&trace_.pool, &trace_.otlp)) != 0 ||
+	    (rv = nng_thread_create(&trace_.thr, trace_export_run, NULL)) !=
+	        0) {
+		goto fail;
+	}
+	nng_thread_set_name(trace_.thr, "nanomq:trace");
+	trace_.enabled = true;
+	log_info("tracing one in %u publishes to %s", trace_.sample, url);
+	return 0;
+
+fail:
+	trace_.enabled = true;
+	msg_trace_fini();
+	return rv;
+}
+
+void
+msg_trace_fini(void)
+{
+	if (!trace_.enabled) {
+		return;
+	}
+	if (trace_.thr != NULL) {
+		nng_mtx_lock(trace_.mtx);
+		trace_.stop = true;
+		nng_cv_wake(trace_.cv);
+		nng_mtx_unlock(trace_.mtx);
+		nng_thread_destroy(trace_.thr);
+	}
+	if (trace_.pool != NULL) {
+		webhook_pool_free(trace_.pool);
+	}
+	if (trace_.cv != NULL) {
+		nng_cv_free(trace_.cv);
+	}
+	if (trace_.mtx != NULL) {
+		nng_mtx_free(trace_.mtx);
+	}
+	if (trace_.topics != NULL) {
+		topic_filter_set_free(trace_.topics);
+	}
+	for (size_t i = 0; i < trace_.ntopics; i++) {
+		nng_atomic_free64(trace_.topic_seq[i]);
+	}
+	if (trace_.traces != NULL) {
+		nng_free(trace_.traces, sizeof(msg_trace) * NANO_TRACE_POOL);
+	}
+	memset(&trace_, 0, sizeof(trace_));
+}
+
+bool
+msg_trace_enabled(void)
+{
+	return trace_.enabled;
+}
+
+static bool
+trace_sampled(uint32_t *seq, const char *topic, const topic_levels *tl)
+{
+	uint32_t id;
+
+	if (trace_.topics != NULL &&
+	    topic_filter_set_first(trace_.topics, topic, tl, &id)) {
+		uint32_t rate = trace_.topic_rate[id];
+
+		// racing workers may both see one count, close enough
+		nng_atomic_inc64(trace_.topic_seq[id]);
+		return rate != 0 &&
+		    nng_atomic_get64(trace_.topic_seq[id]) % rate == 0;
+	}
+	return trace_.sample != 0 && (*seq)++ % trace_.sample == 0;
+}
+
+msg_trace *
+msg_trace_begin(uint32_t *seq, const char *topic, const topic_levels *tl,
+    const uint8_t *traceparent, uint32_t pipe, const char *client_id,
+    uint8_t qos)
+{
+	msg_trace upstream;
+	msg_trace *t;
+	bool      sampled = false;
+	bool      parent  = false;
+
+	if (!trace_.enabled || topic == NULL) {
+		return NULL;
+	}
+	if (traceparent != NULL) {
+		parent = trace_parse_parent(traceparent, &upstream, &sampled);
+	}
+	if (!parent) {
+		sampled = trace_sampled(seq, topic, tl);
+	}
+	if (!sampled) {
+		return NULL;
+	}
+
+	nng_mtx_lock(trace_.mtx);
+	if ((t = trace_.free) != NULL) {
+		trace_.free = t->next;
+	}
+	nng_mtx_unlock(trace_.mtx);
+	if (t == NULL) {
+		return NULL;
+	}
+
+	t->next       = NULL;
+	t->has_parent = parent;
+	t->qos        = qos;
+	t->nevents    = 0;
+	t->pipe       = pipe;
+	t->start      = trace_now();
+	t->end        = 0;
+	if (parent) {
+		memcpy(t->trace_id, upstream.trace_id, sizeof(t->trace_id));
+		memcpy(t->parent_id, upstream.parent_id, sizeof(t->parent_id));
+	} else {
+		trace_random(t->trace_id, sizeof(t->trace_id));
+	}
+	trace_random(t->span_id, sizeof(t->span_id));
+	snprintf(t->client_id, sizeof(t->client_id), "%s",
+	    client_id != NULL ? client_id : "");
+	snprintf(t->topic, sizeof(t->topic), "%s", topic);
+	return t;
+}
+
+void
+msg_trace_event(msg_trace *t, int kind, uint64_t value)
+{
+	trace_event *e;
+
+	if (t->nevents == NANO_TRACE_EVENTS) {
+		return;
+	}
+	e        = &t->events[t->nevents++];
+	e->time  = trace_now();
+	e->kind  = (uint32_t) kind;
+	e->value = value;
+}
+
+void
+msg_trace_parent(const msg_trace *t, char *buf)
+{
+	memcpy(buf, "00-", 3);
+	trace_hex_encode(t->trace_id, 16, buf + 3);
+	buf[35] = '-';
+	trace_hex_encode(t->span_id, 8, buf + 36);
+	memcpy(buf + 52, "-01", 3);
+}
+
+void
+msg_trace_end(msg_trace *t)
+{
+	bool wake;
+
+	t->end = trace_now();
+	nng_mtx_lock(trace_.mtx);
+	*trace_.done_tail = t;
+	trace_.done_tail  = &t->next;
+	wake              = ++trace_.ndone == NANO_TRACE_BATCH;
+	if (wake) {
+		nng_cv_wake(trace_.cv);
+	}
+	nng_mtx_unlock(trace_.mtx);
+}
+
+const char *
+msg_trace_event_name(int kind)
+{
+	return kind >= 0 && kind < TRACE_EVENT_KINDS ? event_names[kind]
+	                                             : "unknown";
+}
@@ -61,6 +61,58 @@ nano_client_publish(nng_socket *sock, const char *topic, uint8_t *payload,
 	return 0;
 }
 
+// host and port of "scheme://host:port", false for any other shape
+static bool
+url_host_port(const char *url, const char **host, size_t *hlen,
+    const char **port)
+{
+	const char *h = strstr(url, "://");
+	const char *p;
+
+	if (h == NULL) {
+		return false;
+	}
+	h += 3;
+	if ((p = strrchr(h, ':')) == NULL || p == h || p[1] == '\0') {
+		return false;
+	}
+	*host = h;
+	*hlen = p - h;
+	*port = p + 1;
+	return true;
+}
+
+bool
+nano_client_is_local(const char *listen, const char *address)
+{
+	static const char *loopback[] = { "127.0.0.1", "localhost",
+		"0.0.0.0", "[::1]" };
+	const char *lhost, *host;
+	const char *lport, *port;
+	size_t      llen, len;
+
+	if (listen == NULL || address == NULL ||
+	    (strncmp(address, "mqtt-tcp://", strlen("mqtt-tcp://")) != 0 &&
+	        strncmp(address, "tcp://", strlen("tcp://")) != 0)) {
+		return false;
+	}
+	if (!url_host_port(listen, &lhost, &llen, &lport) ||
+	    !url_host_port(address, &host, &len, &port) ||
+	    strcmp(lport, port) != 0) {
+		return false;
+	}
+	if (len == llen && strncmp(host, lhost, len) == 0) {
+		return true;
+	}
+	for (size_t i = 0; i < sizeof(loopback) / sizeof(loopback[0]); i++) {
+		if (len == strlen(loopback[i]) &&
+		    strncmp(host, loopback[i], len) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
 static void
 disconnect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 {
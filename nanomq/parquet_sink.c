@@ -0,0 +1,435 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/parquet_sink.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/nanolib/parquet.h"
+#include "nng/supplemental/util/platform.h"
+
+// age flushes are checked this often, so a batch waits at most 1.25x its age
+#define SINK_TICK_MS (NANO_PARQUET_BATCH_AGE_MS / 4 + 1)
+
+typedef struct {
+	const char *topic;
+	nng_msg   **rows;
+	size_t      len;
+} sink_batch;
+
+typedef struct sink_topic sink_topic;
+struct sink_topic {
+	char       *name;
+	sink_batch  fill; // the batch rows are appended to
+	size_t      bytes;
+	nng_time    first;
+	sink_topic *next;
+};
+
+typedef struct {
+	nng_aio   *aio;
+	sink_batch batch;
+	bool       busy;
+} sink_writer;
+
+static struct {
+	nng_mtx           *mtx;
+	nng_cv            *cv; // producers and fini waiting for writers
+	nng_aio           *tick;
+	sink_topic        *topics;
+	sink_batch         pending[NANO_PARQUET_PENDING];
+	size_t             head;
+	size_t             tail;
+	sink_writer        writers[NANO_PARQUET_WRITERS];
+	bool               ready;
+	bool               closed;
+	parquet_sink_stats stats;
+} sink;
+
+static inline size_t
+sink_row_size(nng_msg *msg)
+{
+	return nng_msg_len(msg) -
+	    (size_t) (nng_msg_payload_ptr(msg) - (uint8_t *) nng_msg_body(msg));
+}
+
+static inline bool
+sink_has_room(void)
+{
+	return sink.tail - sink.head < NANO_PARQUET_PENDING;
+}
+
+static void
+sink_batch_free(sink_batch *batch)
+{
+	for (size_t i = 0; i < batch->len; i++) {
+		nng_msg_free(batch->rows[i]);
+	}
+	if (batch->rows != NULL) {
+		nng_free(batch->rows, sizeof(nng_msg *) * NANO_PARQUET_ROW_GROUP_ROWS);
+	}
+	batch->rows = NULL;
+	batch->len  = 0;
+}
+
+static sink_topic *
+sink_topic_find(const char *name)
+{
+	sink_topic *t;
+
+	for (t = sink.topics; t != NULL; t = t->next) {
+		if (strcmp(t->name, name) == 0) {
+			return t;
+		}
+	}
+	if ((t = nng_zalloc(sizeof(*t))) == NULL) {
+		return NULL;
+	}
+	if ((t->name = nng_strdup(name)) == NULL) {
+		nng_free(t, sizeof(*t));
+		return NULL;
+	}
+	t->fill.topic = t->name;
+	t->next       = sink.topics;
+	sink.topics   = t;
+	return t;
+}
+
+static int
+sink_key_cmp(const void *a, const void *b)
+{
+	nng_time ka = nng_msg_get_timestamp(*(nng_msg *const *) a);
+	nng_time kb = nng_msg_get_timestamp(*(nng_msg *const *) b);
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+/*
+ * Hand the batch of w to the parquet writer, sorted by key. Called with
+ * sink.mtx held; the writer completes w->aio from its own thread.
+ */
+static int
+sink_write(sink_writer *w)
+{
+	sink_batch      *batch = &w->batch;
+	uint64_t        *keys;
+	void           **datas;
+	uint32_t        *lens;
+	parquet_object  *obj;
+
+	qsort(batch->rows, batch->len, sizeof(nng_msg *), sink_key_cmp);
+	keys  = nng_alloc(sizeof(uint64_t) * batch->len);
+	datas = nng_alloc(sizeof(void *) * batch->len);
+	lens  = nng_alloc(sizeof(uint32_t) * batch->len);
+	if (keys == NULL || datas == NULL || lens == NULL) {
+		nng_free(keys, sizeof(uint64_t) * batch->len);
+		nng_free(datas, sizeof(void *) * batch->len);
+		nng_free(lens, sizeof(uint32_t) * batch->len);
+		return NNG_ENOMEM;
+	}
+	for (size_t i = 0; i < batch->len; i++) {
+		keys[i]  = nng_msg_get_timestamp(batch->rows[i]);
+		datas[i] = nng_msg_payload_ptr(batch->rows[i]);
+		lens[i]  = (uint32_t) sink_row_size(batch->rows[i]);
+	}
+	if (!nng_aio_begin(w->aio)) {
+		nng_free(keys, sizeof(uint64_t) * batch->len);
+		nng_free(datas, sizeof(void *) * batch->len);
+		nng_free(lens, sizeof(uint32_t) * batch->len);
+		return NNG_ECLOSED;
+	}
+	obj = parquet_object_alloc(keys, (uint8_t **) datas, lens,
+	    (int) batch->len, w->aio, (void *) batch->rows);
+	obj->topic = (char *) batch->topic;
+	parquet_write_batch_async(obj);
+	return 0;
+}
+
+// Give waiting batches to idle writers. Called with sink.mtx held.
+static void
+sink_dispatch(void)
+{
+	for (int i = 0; i < NANO_PARQUET_WRITERS && sink.tail != sink.head;
+	     i++) {
+		sink_writer *w = &sink.writers[i];
+
+		if (w->busy) {
+			continue;
+		}
+		w->batch = sink.pending[sink.head % NANO_PARQUET_PENDING];
+		sink.head++;
+		nng_cv_wake(sink.cv);
+		if (sink_write(w) != 0) {
+			log_error("parquet batch of %lu rows on %s lost",
+			    w->batch.len, w->batch.topic);
+			sink.stats.failed++;
+			sink_batch_free(&w->batch);
+			i--; // this writer is still idle
+			continue;
+		}
+		w->busy = true;
+	}
+}
+
+// Move the rows of t to the writer queue. Called with sink.mtx held.
+static void
+sink_seal(sink_topic *t)
+{
+	if (t->fill.len == 0) {
+		return;
+	}
+	sink.pending[sink.tail % NANO_PARQUET_PENDING] = t->fill;
+	sink.tail++;
+	t->fill.rows = NULL;
+	t->fill.len  = 0;
+	t->bytes     = 0;
+	sink_dispatch();
+}
+
+static void
+sink_writer_cb(void *arg)
+{
+	sink_writer *w    = arg;
+	int          rv   = nng_aio_result(w->aio);
+	uint32_t    *lenp = (uint32_t *) nng_aio_get_msg(w->aio);
+	size_t       rows = w->batch.len;
+
+	nng_aio_set_msg(w->aio, NULL);
+	nng_aio_set_prov_data(w->aio, NULL);
+	if (lenp != NULL) {
+		nng_free(lenp, sizeof(uint32_t));
+	}
+	sink_batch_free(&w->batch);
+
+	nng_mtx_lock(sink.mtx);
+	if (rv != 0) {
+		log_warn("parquet batch of %lu rows on %s failed: %d", rows,
+		    w->batch.topic, rv);
+		sink.stats.failed++;
+	} else {
+		sink.stats.batches++;
+		sink.stats.rows += rows;
+	}
+	w->busy = false;
+	sink_dispatch();
+	nng_cv_wake(sink.cv);
+	nng_mtx_unlock(sink.mtx);
+}
+
+static void
+sink_tick_cb(void *arg)
+{
+	nng_time now;
+
+	(void) arg;
+	if (nng_aio_result(sink.tick) != 0) {
+		return;
+	}
+	nng_mtx_lock(sink.mtx);
+	now = nng_clock();
+	for (sink_topic *t = sink.topics; t != NULL && sink_has_room();
+	     t = t->next) {
+		if (t->fill.len > 0 &&
+		    now - t->first >= NANO_PARQUET_BATCH_AGE_MS) {
+			sink_seal(t);
+		}
+	}
+	if (!sink.closed) {
+		nng_sleep_aio(SINK_TICK_MS, sink.tick);
+	}
+	nng_mtx_unlock(sink.mtx);
+}
+
+int
+parquet_sink_init(conf_parquet *conf)
+{
+	int rv;
+
+	if (sink.ready || !conf->enable) {
+		return 0;
+	}
+	memset(&sink, 0, sizeof(sink));
+	if ((rv = nng_mtx_alloc(&sink.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&sink.cv, sink.mtx)) != 0 ||
+	    (rv = nng_aio_alloc(&sink.tick, sink_tick_cb, NULL)) != 0) {
+		goto fail;
+	}
+	for (int i = 0; i < NANO_PARQUET_WRITERS; i++) {
+		if ((rv = nng_aio_alloc(&sink.writers[i].aio, sink_writer_cb,
+		         &sink.writers[i])) != 0) {
+			goto fail;
+		}
+	}
+	sink.ready = true;
+	nng_sleep_aio(SINK_TICK_MS, sink.tick);
+	return 0;
+
+fail:
+	for (int i = 0; i < NANO_PARQUET_WRITERS; i++) {
+		if (sink.writers[i].aio != NULL) {
+			nng_aio_free(sink.writers[i].aio);
+		}
+	}
+	if (sink.tick != NULL) {
+		nng_aio_free(sink.tick);
+	}
+	if (sink.cv != NULL) {
+		nng_cv_free(sink.cv);
+	}
+	if (sink.mtx != NULL) {
+		nng_mtx_free(sink.mtx);
+	}
+	memset(&sink, 0, sizeof(sink));
+	return rv;
+}
+
+void
+parquet_sink_fini(void)
+{
+	nng_time    deadline;
+	sink_topic *t;
+	bool        busy;
+
+	if (!sink.ready) {
+		return;
+	}
+	// write out what is gathered, giving the writers a bounded time
+	nng_mtx_lock(sink.mtx);
+	sink.closed = true;
+	deadline    = nng_clock() + NANO_PARQUET_BLOCK_MS;
+	for (t = sink.topics; t != NULL; t = t->next) {
+		while (t->fill.len > 0) {
+			if (sink_has_room()) {
+				sink_seal(t);
+			} else if (nng_cv_until(sink.cv, deadline) == NNG_ETIMEDOUT) {
+				break;
+			}
+		}
+	}
+	for (;;) {
+		busy = sink.tail != sink.head;
+		for (int i = 0; i < NANO_PARQUET_WRITERS; i++) {
+			busy = busy || sink.writers[i].busy;
+		}
+		if (!busy || nng_cv_until(sink.cv, deadline) == NNG_ETIMEDOUT) {
+			break;
+		}
+	}
+	nng_mtx_unlock(sink.mtx);
+
+	nng_aio_stop(sink.tick);
+	for (int i = 0; i < NANO_PARQUET_WRITERS; i++) {
+		nng_aio_stop(sink.writers[i].aio);
+		nng_aio_free(sink.writers[i].aio);
+		sink_batch_free(&sink.writers[i].batch);
+	}
+	nng_aio_free(sink.tick);
+	while (sink.head != sink.tail) {
+		sink_batch_free(&sink.pending[sink.head % NANO_PARQUET_PENDING]);
+		sink.head++;
+	}
+	while ((t = sink.topics) != NULL) {
+		sink.topics = t->next;
+		sink_batch_free(&t->fill);
+		nng_strfree(t->name);
+		nng_free(t, sizeof(*t));
+	}
+	nng_cv_free(sink.cv);
+	nng_mtx_free(sink.mtx);
+	memset(&sink, 0, sizeof(sink));
+}
+
+int
+parquet_sink_put(const char *topic, nng_msg **msgs, size_t len)
+{
+	sink_topic *t;
+	nng_time    deadline = 0;
+	size_t      i        = 0;
+	size_t      dropped  = 0;
+
+	if (topic == NULL) {
+		topic = "";
+	}
+	if (!sink.ready) {
+		for (; i < len; i++) {
+			nng_msg_free(msgs[i]);
+		}
+		nng_free(msgs, sizeof(nng_msg *) * len);
+		return NNG_ECLOSED;
+	}
+	nng_mtx_lock(sink.mtx);
+	if (!sink.closed && (t = sink_topic_find(topic)) != NULL) {
+		for (; i < len; i++) {
+			if (msgs[i] == NULL) {
+				continue;
+			}
+			// a full batch waits for room, which is the backpressure
+			while (t->fill.len == NANO_PARQUET_ROW_GROUP_ROWS) {
+				if (sink_has_room()) {
+					sink_seal(t);
+					break;
+				}
+				if (deadline == 0) {
+					deadline = nng_clock() + NANO_PARQUET_BLOCK_MS;
+					sink.stats.blocked++;
+				}
+				if (nng_cv_until(sink.cv, deadline) == NNG_ETIMEDOUT) {
+					break;
+				}
+			}
+			if (t->fill.len == NANO_PARQUET_ROW_GROUP_ROWS) {
+				break;
+			}
+			if (t->fill.rows == NULL &&
+			    (t->fill.rows = nng_alloc(sizeof(nng_msg *) *
+			         NANO_PARQUET_ROW_GROUP_ROWS)) == NULL) {
+				break;
+			}
+			if (t->fill.len == 0) {
+				t->first = nng_clock();
+			}
+			t->fill.rows[t->fill.len++] = msgs[i];
+			t->bytes += sink_row_size(msgs[i]);
+			msgs[i] = NULL;
+			if ((t->fill.len == NANO_PARQUET_ROW_GROUP_ROWS ||
+			        t->bytes >= NANO_PARQUET_BATCH_BYTES) &&
+			    sink_has_room()) {
+				sink_seal(t);
+			}
+		}
+	}
+	for (; i < len; i++) {
+		if (msgs[i] != NULL) {
+			nng_msg_free(msgs[i]);
+			dropped++;
+		}
+	}
+	sink.stats.dropped += dropped;
+	nng_mtx_unlock(sink.mtx);
+	nng_free(msgs, sizeof(nng_msg *) * len);
+
+	if (dropped > 0) {
+		log_warn("parquet sink dropped %lu rows on %s", dropped, topic);
+		return NNG_EAGAIN;
+	}
+	return 0;
+}
+
+void
+parquet_sink_stat(parquet_sink_stats *stats)
+{
+	if (!sink.ready) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+	nng_mtx_lock(sink.mtx);
+	*stats = sink.stats;
+	nng_mtx_unlock(sink.mtx);
+}
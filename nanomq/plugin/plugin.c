@@ -12,40 +12,108 @@
 #include "nng/supplemental/util/platform.h"
 #include "nng/supplemental/nanolib/cvector.h"
 #include <dlfcn.h>
+#include <string.h>
 
 struct nano_plugin **g_plugins;
-struct plugin_hook **g_hooks;
 
-int plugin_hook_register(unsigned int point, int (*cb)(void *data))
+// cvectors by point, sorted by order
+static struct plugin_hook **g_hooks[HOOK_POINT_NUM];
+
+static int hook_add(unsigned int point, int order, int (*cb)(void *data),
+    int (*batch)(void **data, size_t n))
 {
 	struct plugin_hook *hook = NULL;
+	size_t at;
+	size_t n;
 
-	/* already existed */
-	for (int i = 0; i < cvector_size(g_hooks); i++) {
-		if (g_hooks[i]->point == point) {
-			g_hooks[i]->cb = cb;
-			log_warn("plugin_hook_register: %d already existed and replace with new callback", point);
-			return 0;
-		}
+	if (point >= HOOK_POINT_NUM) {
+		return NNG_EINVAL;
 	}
-
 	if ((hook = nng_alloc(sizeof(struct plugin_hook))) == NULL) {
 		return NNG_ENOMEM;
 	}
 
 	hook->point = point;
+	hook->order = order;
 	hook->cb = cb;
+	hook->batch = batch;
 
-	cvector_push_back(g_hooks, hook);
+	/* behind those of the same order */
+	for (at = 0; at < cvector_size(g_hooks[point]); at++) {
+		if (g_hooks[point][at]->order > order) {
+			break;
+		}
+	}
+	cvector_push_back(g_hooks[point], hook);
+	n = cvector_size(g_hooks[point]);
+	memmove(&g_hooks[point][at + 1], &g_hooks[point][at],
+	    (n - 1 - at) * sizeof(struct plugin_hook *));
+	g_hooks[point][at] = hook;
 
 	return 0;
 }
 
+int plugin_hook_register(unsigned int point, int (*cb)(void *data))
+{
+	return plugin_hook_register_ordered(point, 0, cb);
+}
+
+int plugin_hook_register_ordered(
+    unsigned int point, int order, int (*cb)(void *data))
+{
+	if (cb == NULL) {
+		return NNG_EINVAL;
+	}
+	return hook_add(point, order, cb, NULL);
+}
+
+int plugin_hook_register_batch(
+    unsigned int point, int order, int (*cb)(void **data, size_t n))
+{
+	if (cb == NULL) {
+		return NNG_EINVAL;
+	}
+	return hook_add(point, order, NULL, cb);
+}
+
+bool plugin_hook_has(unsigned int point)
+{
+	return point < HOOK_POINT_NUM && cvector_size(g_hooks[point]) > 0;
+}
+
 int plugin_hook_call(unsigned int point, void *data)
 {
-	for (int i = 0; i < cvector_size(g_hooks); i++) {
-		if (g_hooks[i]->point == point) {
-			return g_hooks[i]->cb(data);
+	if (!plugin_hook_has(point)) {
+		return 0;
+	}
+	for (size_t i = 0; i < cvector_size(g_hooks[point]); i++) {
+		struct plugin_hook *hook = g_hooks[point][i];
+		int rv = hook->cb != NULL ? hook->cb(data) : hook->batch(&data, 1);
+		if (rv != 0) {
+			return rv;
+		}
+	}
+
+	return 0;
+}
+
+int plugin_hook_call_batch(unsigned int point, void **data, size_t n)
+{
+	if (!plugin_hook_has(point) || n == 0) {
+		return 0;
+	}
+	for (size_t i = 0; i < cvector_size(g_hooks[point]); i++) {
+		struct plugin_hook *hook = g_hooks[point][i];
+		int rv = 0;
+		if (hook->batch != NULL) {
+			rv = hook->batch(data, n);
+		} else {
+			for (size_t k = 0; k < n && rv == 0; k++) {
+				rv = hook->cb(data[k]);
+			}
+		}
+		if (rv != 0) {
+			return rv;
 		}
 	}
 
@@ -91,6 +159,15 @@ void plugins_clear()
 		nng_free(plugin, sizeof(struct nano_plugin));
 	}
 	cvector_free(g_plugins);
+	g_plugins = NULL;
+
+	for (int p = 0; p < HOOK_POINT_NUM; p++) {
+		for (size_t i = 0; i < cvector_size(g_hooks[p]); i++) {
+			nng_free(g_hooks[p][i], sizeof(struct plugin_hook));
+		}
+		cvector_free(g_hooks[p]);
+		g_hooks[p] = NULL;
+	}
 
 	return;
 }
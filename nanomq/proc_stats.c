@@ -0,0 +1,415 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/bridge_queue.h"
+#include "include/proc_stats.h"
+#include "include/sub_stats.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/nanolib/mqtt_db.h"
+#include "nng/supplemental/util/platform.h"
+
+#if defined(SUPP_AWS_BRIDGE)
+#include "include/aws_bridge.h"
+#endif
+
+#if NANO_PLATFORM_LINUX
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+// comm of the worker threads of nng taskqs
+#define PROC_STATS_TASKQ "nng:task"
+
+typedef struct {
+	long          tid;
+	unsigned long ticks;
+} proc_thread;
+
+static struct {
+	nng_mtx     *mtx;
+	nng_cv      *cv;
+	nng_thread  *thr;
+	conf        *config;
+	nng_duration interval;
+	bool         closing;
+	bool         enabled;
+	proc_sample  ring[NANO_PROC_STATS_HISTORY];
+	size_t       head; // next slot to write
+	size_t       count;
+	proc_sample  max;
+	// sampler thread only
+	long         last_cpu;
+	long         last_proc;
+	proc_thread  threads[NANO_PROC_STATS_THREADS];
+	size_t       nthreads;
+} proc_;
+
+#if NANO_PLATFORM_LINUX
+static long
+proc_cpu_time(void)
+{
+	FILE    *fd;
+	char     buff[256];
+	uint32_t user, nice, sys, idle, iowait, irq, sirq, steal;
+	int      rc;
+
+	if ((fd = fopen("/proc/stat", "r")) == NULL) {
+		return -1;
+	}
+	if (fgets(buff, sizeof(buff), fd) == NULL) {
+		fclose(fd);
+		return -1;
+	}
+	fclose(fd);
+	rc = sscanf(buff, "%*s %u %u %u %u %u %u %u %u", &user, &nice, &sys,
+	    &idle, &iowait, &irq, &sirq, &steal);
+	if (rc != 8) {
+		return -1;
+	}
+	return user + nice + sys + idle + iowait + irq + sirq + steal;
+}
+
+// Fields of a stat file from the one after the parenthesised comm.
+static char *
+proc_read_stat(const char *path, char *buf, size_t size)
+{
+	FILE  *fp;
+	size_t n;
+	char  *p;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		return NULL;
+	}
+	n = fread(buf, 1, size - 1, fp);
+	fclose(fp);
+	buf[n] = '\0';
+	if ((p = strrchr(buf, ')')) == NULL) {
+		return NULL;
+	}
+	return p + 1;
+}
+
+static uint32_t
+proc_fd_count(void)
+{
+	DIR           *dir;
+	struct dirent *de;
+	uint32_t       n = 0;
+
+	if ((dir = opendir("/proc/self/fd")) == NULL) {
+		return 0;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] != '.') {
+			n++;
+		}
+	}
+	closedir(dir);
+	// leave out the descriptor of dir itself
+	return n > 0 ? n - 1 : 0;
+}
+
+static bool
+proc_thread_last(long tid, unsigned long *ticks)
+{
+	for (size_t i = 0; i < proc_.nthreads; i++) {
+		if (proc_.threads[i].tid == tid) {
+			*ticks = proc_.threads[i].ticks;
+			return true;
+		}
+	}
+	return false;
+}
+
+// CPU time of the taskq threads since the last sample, elapsed in ticks.
+static void
+proc_sample_taskq(proc_sample *s, double elapsed)
+{
+	DIR           *dir;
+	struct dirent *de;
+	proc_thread    seen[NANO_PROC_STATS_THREADS];
+	size_t         n = 0;
+	char           path[64];
+	char           buf[512];
+
+	if ((dir = opendir("/proc/self/task")) == NULL) {
+		return;
+	}
+	while ((de = readdir(dir)) != NULL && n < NANO_PROC_STATS_THREADS) {
+		unsigned long utime, stime, last;
+		long          tid;
+		FILE         *fp;
+		char         *p;
+		double        pct;
+
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		tid = atol(de->d_name);
+		snprintf(path, sizeof(path), "/proc/self/task/%ld/comm", tid);
+		if ((fp = fopen(path, "r")) == NULL) {
+			continue;
+		}
+		p = fgets(buf, sizeof(buf), fp);
+		fclose(fp);
+		if (p == NULL ||
+		    strncmp(buf, PROC_STATS_TASKQ, strlen(PROC_STATS_TASKQ)) !=
+		        0) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "/proc/self/task/%ld/stat", tid);
+		if ((p = proc_read_stat(path, buf, sizeof(buf))) == NULL ||
+		    sscanf(p,
+		        " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+		        &utime, &stime) != 2) {
+			continue;
+		}
+		seen[n].tid   = tid;
+		seen[n].ticks = utime + stime;
+		s->taskq_threads++;
+		// threads new since the last sample count from the next one
+		if (elapsed > 0 && proc_thread_last(tid, &last)) {
+			pct = 100.0 * (seen[n].ticks - last) / elapsed;
+			s->taskq_cpu_percent += pct;
+			if (pct > s->taskq_cpu_max_percent) {
+				s->taskq_cpu_max_percent = pct;
+			}
+		}
+		n++;
+	}
+	closedir(dir);
+	memcpy(proc_.threads, seen, sizeof(proc_thread) * n);
+	proc_.nthreads = n;
+}
+
+static void
+proc_sample_process(proc_sample *s, nng_duration elapsed_ms)
+{
+	long cpu_time = proc_cpu_time();
+	long utime, stime, cutime, cstime, threads, rss;
+	long proc_time;
+	char path[64];
+	char buf[1024];
+	char *p;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", getpid());
+	if (cpu_time == -1 ||
+	    (p = proc_read_stat(path, buf, sizeof(buf))) == NULL ||
+	    sscanf(p,
+	        " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld "
+	        "%*d %*d %ld %*d %*u %*u %ld",
+	        &utime, &stime, &cutime, &cstime, &threads, &rss) != 6) {
+		log_error("reading process stats failed");
+		return;
+	}
+	proc_time  = utime + stime + cutime + cstime;
+	s->memory  = (uint64_t) rss * getpagesize();
+	s->threads = threads;
+	s->fds     = proc_fd_count();
+	if (proc_.last_cpu != 0 && cpu_time > proc_.last_cpu) {
+		s->cpu_percent = 100.0 * (proc_time - proc_.last_proc) /
+		    (cpu_time - proc_.last_cpu);
+	}
+	proc_.last_cpu  = cpu_time;
+	proc_.last_proc = proc_time;
+
+	proc_sample_taskq(
+	    s, (double) elapsed_ms * sysconf(_SC_CLK_TCK) / 1000);
+}
+#endif
+
+static void
+proc_sample_queues(proc_sample *s)
+{
+	conf *config = proc_.config;
+
+	if (config == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < config->bridge.count; i++) {
+		bridge_queue_stats st;
+		if (bridge_queue_stat(config->bridge.nodes[i], &st) == 0) {
+			s->bridge_queue_depth += st.depth;
+		}
+	}
+#if defined(SUPP_AWS_BRIDGE)
+	for (size_t i = 0; i < config->aws_bridge.count; i++) {
+		aws_bridge_stats st;
+		if (aws_bridge_stat(config->aws_bridge.nodes[i], &st) == 0) {
+			s->aws_queue_depth += st.depth;
+		}
+	}
+#endif
+}
+
+#define proc_max(field)                                               \
+	proc_.max.field =                                              \
+	    s->field > proc_.max.field ? s->field : proc_.max.field
+
+static void
+proc_record(const proc_sample *s)
+{
+	proc_.ring[proc_.head] = *s;
+	proc_.head = (proc_.head + 1) % NANO_PROC_STATS_HISTORY;
+	if (proc_.count < NANO_PROC_STATS_HISTORY) {
+		proc_.count++;
+	}
+	proc_.max.time = s->time;
+	proc_max(cpu_percent);
+	proc_max(memory);
+	proc_max(fds);
+	proc_max(threads);
+	proc_max(taskq_threads);
+	proc_max(taskq_cpu_percent);
+	proc_max(taskq_cpu_max_percent);
+	proc_max(connections);
+	proc_max(topics);
+	proc_max(subscribers);
+	proc_max(bridge_queue_depth);
+	proc_max(aws_queue_depth);
+}
+
+static void
+proc_thread_main(void *arg)
+{
+	nng_time last = 0;
+
+	(void) arg;
+	nng_mtx_lock(proc_.mtx);
+	while (!proc_.closing) {
+		proc_sample s;
+		sub_stats   ss;
+		nng_time    now = nng_clock();
+
+		nng_mtx_unlock(proc_.mtx);
+
+		memset(&s, 0, sizeof(s));
+		s.time = now;
+#if NANO_PLATFORM_LINUX
+		proc_sample_process(&s, last != 0 ? now - last : 0);
+#endif
+		sub_stats_get(&ss);
+		s.connections = ss.connections;
+		s.topics      = ss.topics;
+		s.subscribers = dbhash_get_pipe_cnt();
+		proc_sample_queues(&s);
+		last = now;
+
+		nng_mtx_lock(proc_.mtx);
+		proc_record(&s);
+		while (!proc_.closing && nng_clock() < now + proc_.interval) {
+			nng_cv_until(proc_.cv, now + proc_.interval);
+		}
+	}
+	nng_mtx_unlock(proc_.mtx);
+}
+
+int
+proc_stats_init(conf *config, nng_duration interval)
+{
+	int rv;
+
+	if (proc_.enabled) {
+		return 0;
+	}
+	proc_.config   = config;
+	proc_.interval = interval > 0 ? interval : NANO_PROC_STATS_INTERVAL_MS;
+	if ((rv = nng_mtx_alloc(&proc_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&proc_.cv, proc_.mtx)) != 0 ||
+	    (rv = nng_thread_create(&proc_.thr, proc_thread_main, NULL)) !=
+	        0) {
+		proc_.thr = NULL;
+		proc_stats_fini();
+		return rv;
+	}
+	proc_.enabled = true;
+	return 0;
+}
+
+void
+proc_stats_fini(void)
+{
+	if (proc_.thr != NULL) {
+		nng_mtx_lock(proc_.mtx);
+		proc_.closing = true;
+		nng_cv_wake(proc_.cv);
+		nng_mtx_unlock(proc_.mtx);
+		nng_thread_destroy(proc_.thr);
+	}
+	if (proc_.cv != NULL) {
+		nng_cv_free(proc_.cv);
+	}
+	if (proc_.mtx != NULL) {
+		nng_mtx_free(proc_.mtx);
+	}
+	memset(&proc_, 0, sizeof(proc_));
+}
+
+bool
+proc_stats_enabled(void)
+{
+	return proc_.enabled;
+}
+
+bool
+proc_stats_latest(proc_sample *s)
+{
+	bool found;
+
+	if (!proc_.enabled) {
+		return false;
+	}
+	nng_mtx_lock(proc_.mtx);
+	if ((found = proc_.count > 0)) {
+		*s = proc_.ring[(proc_.head + NANO_PROC_STATS_HISTORY - 1) %
+		    NANO_PROC_STATS_HISTORY];
+	}
+	nng_mtx_unlock(proc_.mtx);
+	return found;
+}
+
+bool
+proc_stats_max(proc_sample *s)
+{
+	bool found;
+
+	if (!proc_.enabled) {
+		return false;
+	}
+	nng_mtx_lock(proc_.mtx);
+	if ((found = proc_.count > 0)) {
+		*s = proc_.max;
+	}
+	nng_mtx_unlock(proc_.mtx);
+	return found;
+}
+
+size_t
+proc_stats_history(proc_sample *s, size_t cap)
+{
+	size_t n;
+	size_t start;
+
+	if (!proc_.enabled) {
+		return 0;
+	}
+	nng_mtx_lock(proc_.mtx);
+	n     = proc_.count < cap ? proc_.count : cap;
+	start = (proc_.head + NANO_PROC_STATS_HISTORY - n) %
+	    NANO_PROC_STATS_HISTORY;
+	for (size_t i = 0; i < n; i++) {
+		s[i] = proc_.ring[(start + i) % NANO_PROC_STATS_HISTORY];
+	}
+	nng_mtx_unlock(proc_.mtx);
+	return n;
+}
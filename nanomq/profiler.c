@@ -0,0 +1,579 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/latency_stats.h"
+#include "include/profiler.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <unistd.h>
+#define PROF_UNWIND 1
+#endif
+
+#if NANO_PLATFORM_LINUX
+#include <sys/syscall.h>
+#endif
+
+// the handler and the signal trampoline on top of every sample
+#define PROF_SKIP 2
+
+typedef struct {
+	int   tid;
+	int   depth;
+	void *pc[NANO_PROF_DEPTH];
+} prof_sample;
+
+struct prof_block {
+	prof_block *next;
+	uint64_t    states[PROF_STATES];
+};
+
+typedef struct {
+	nng_atomic_u64 *acquired;
+	nng_atomic_u64 *contended;
+	nng_atomic_u64 *wait_ns;
+	nng_atomic_u64 *wait_max_ns;
+} prof_lock_ctr;
+
+static struct {
+	nng_mtx        *mtx;
+	prof_block     *blocks;
+	prof_lock_ctr   locks[PROF_LOCKS];
+	nng_atomic_int *running;
+	nng_atomic_int *next; // next free slot of samples
+	nng_atomic_u64 *dropped;
+	prof_sample    *samples;
+	int             cap;
+	bool            enabled;
+} prof_;
+
+static const char *state_names[PROF_STATES] = {
+	"INIT", "RECV", "WAIT", "SEND", "HOOK", "END", "CLOSE",
+};
+
+static const char *lock_names[PROF_LOCKS] = {
+	[PROF_LOCK_BRIDGE_NODE] = "bridge_node",
+	[PROF_LOCK_HASHMAP]     = "hashmap",
+	[PROF_LOCK_RULE]        = "rule",
+	[PROF_LOCK_EXCHANGE]    = "exchange",
+	[PROF_LOCK_REST_JOB]    = "rest_job",
+};
+
+int
+prof_init(void)
+{
+	int rv;
+
+	if (prof_.enabled) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&prof_.mtx)) != 0 ||
+	    (rv = nng_atomic_alloc(&prof_.running)) != 0 ||
+	    (rv = nng_atomic_alloc(&prof_.next)) != 0 ||
+	    (rv = nng_atomic_alloc64(&prof_.dropped)) != 0) {
+		goto fail;
+	}
+	for (int i = 0; i < PROF_LOCKS; i++) {
+		prof_lock_ctr *c = &prof_.locks[i];
+		if ((rv = nng_atomic_alloc64(&c->acquired)) != 0 ||
+		    (rv = nng_atomic_alloc64(&c->contended)) != 0 ||
+		    (rv = nng_atomic_alloc64(&c->wait_ns)) != 0 ||
+		    (rv = nng_atomic_alloc64(&c->wait_max_ns)) != 0) {
+			goto fail;
+		}
+	}
+	prof_.enabled = true;
+	return 0;
+
+fail:
+	prof_.enabled = true;
+	prof_fini();
+	return rv;
+}
+
+void
+prof_fini(void)
+{
+	prof_block *pb;
+
+	if (!prof_.enabled) {
+		return;
+	}
+	while ((pb = prof_.blocks) != NULL) {
+		prof_.blocks = pb->next;
+		nng_free(pb, sizeof(*pb));
+	}
+	for (int i = 0; i < PROF_LOCKS; i++) {
+		prof_lock_ctr *c = &prof_.locks[i];
+		if (c->acquired != NULL) {
+			nng_atomic_free64(c->acquired);
+		}
+		if (c->contended != NULL) {
+			nng_atomic_free64(c->contended);
+		}
+		if (c->wait_ns != NULL) {
+			nng_atomic_free64(c->wait_ns);
+		}
+		if (c->wait_max_ns != NULL) {
+			nng_atomic_free64(c->wait_max_ns);
+		}
+	}
+	if (prof_.dropped != NULL) {
+		nng_atomic_free64(prof_.dropped);
+	}
+	if (prof_.next != NULL) {
+		nng_atomic_free(prof_.next);
+	}
+	if (prof_.running != NULL) {
+		nng_atomic_free(prof_.running);
+	}
+	if (prof_.mtx != NULL) {
+		nng_mtx_free(prof_.mtx);
+	}
+	memset(&prof_, 0, sizeof(prof_));
+}
+
+bool
+prof_enabled(void)
+{
+	return prof_.enabled;
+}
+
+prof_block *
+prof_block_alloc(void)
+{
+	prof_block *pb;
+
+	if (!prof_.enabled || (pb = nng_zalloc(sizeof(*pb))) == NULL) {
+		return NULL;
+	}
+	nng_mtx_lock(prof_.mtx);
+	pb->next     = prof_.blocks;
+	prof_.blocks = pb;
+	nng_mtx_unlock(prof_.mtx);
+	return pb;
+}
+
+void
+prof_state(prof_block *pb, int state)
+{
+	if (pb != NULL && state >= 0 && state < PROF_STATES) {
+		pb->states[state]++;
+	}
+}
+
+void
+prof_lock(int id, nng_mtx *mtx)
+{
+	prof_lock_ctr *c;
+	uint64_t       t;
+
+	if (!prof_.enabled) {
+		nng_mtx_lock(mtx);
+		return;
+	}
+	c = &prof_.locks[id];
+	t = latency_now();
+	nng_mtx_lock(mtx);
+	t = latency_now() - t;
+
+	nng_atomic_inc64(c->acquired);
+	if (t >= NANO_PROF_CONTENDED_NS) {
+		nng_atomic_inc64(c->contended);
+		nng_atomic_add64(c->wait_ns, t);
+		// two waiters may race here, the maximum is a close one
+		if (t > nng_atomic_get64(c->wait_max_ns)) {
+			nng_atomic_set64(c->wait_max_ns, t);
+		}
+	}
+}
+
+void
+prof_collect(prof_counters *pc)
+{
+	memset(pc, 0, sizeof(*pc));
+	if (!prof_.enabled) {
+		return;
+	}
+	nng_mtx_lock(prof_.mtx);
+	for (prof_block *pb = prof_.blocks; pb != NULL; pb = pb->next) {
+		for (int s = 0; s < PROF_STATES; s++) {
+			pc->states[s] += pb->states[s];
+		}
+	}
+	nng_mtx_unlock(prof_.mtx);
+	for (int i = 0; i < PROF_LOCKS; i++) {
+		prof_lock_ctr *c = &prof_.locks[i];
+
+		pc->locks[i].acquired    = nng_atomic_get64(c->acquired);
+		pc->locks[i].contended   = nng_atomic_get64(c->contended);
+		pc->locks[i].wait_ns     = nng_atomic_get64(c->wait_ns);
+		pc->locks[i].wait_max_ns = nng_atomic_get64(c->wait_max_ns);
+	}
+}
+
+const char *
+prof_state_name(int state)
+{
+	return state >= 0 && state < PROF_STATES ? state_names[state]
+	                                         : "unknown";
+}
+
+const char *
+prof_lock_name(int id)
+{
+	return id >= 0 && id < PROF_LOCKS ? lock_names[id] : "unknown";
+}
+
+#if defined(PROF_UNWIND)
+
+static int
+prof_tid(void)
+{
+#if NANO_PLATFORM_LINUX
+	return (int) syscall(SYS_gettid);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Runs on whichever thread the CPU time tick lands on. Only claims a slot
+ * and unwinds into it, backtrace was called once before so that it does
+ * not load the unwinder in here.
+ */
+static void
+prof_sigprof(int sig)
+{
+	int          saved = errno;
+	int          slot;
+	prof_sample *s;
+
+	(void) sig;
+	do {
+		slot = nng_atomic_get(prof_.next);
+		if (slot >= prof_.cap) {
+			nng_atomic_inc64(prof_.dropped);
+			errno = saved;
+			return;
+		}
+	} while (!nng_atomic_cas(prof_.next, slot, slot + 1));
+
+	s        = &prof_.samples[slot];
+	s->tid   = prof_tid();
+	s->depth = backtrace(s->pc, NANO_PROF_DEPTH);
+	errno    = saved;
+}
+
+typedef struct {
+	char  *buf;
+	size_t len;
+	size_t cap;
+} prof_buf;
+
+static int
+prof_cat(prof_buf *b, const char *s, size_t n)
+{
+	if (b->len + n + 1 > b->cap) {
+		size_t cap = b->cap == 0 ? 4096 : b->cap;
+		char  *buf;
+
+		while (b->len + n + 1 > cap) {
+			cap *= 2;
+		}
+		if ((buf = nng_alloc(cap)) == NULL) {
+			return NNG_ENOMEM;
+		}
+		if (b->len > 0) {
+			memcpy(buf, b->buf, b->len);
+		}
+		if (b->buf != NULL) {
+			nng_free(b->buf, b->cap);
+		}
+		b->buf = buf;
+		b->cap = cap;
+	}
+	memcpy(b->buf + b->len, s, n);
+	b->len += n;
+	b->buf[b->len] = '\0';
+	return 0;
+}
+
+typedef struct {
+	int  tid;
+	char name[32];
+} prof_thread;
+
+#define PROF_THREADS 256
+
+// comm of the thread, as nng set it, while it is still around
+static const char *
+prof_thread_name(prof_thread *threads, int *n, int tid)
+{
+	prof_thread *t;
+
+	for (int i = 0; i < *n; i++) {
+		if (threads[i].tid == tid) {
+			return threads[i].name;
+		}
+	}
+	if (*n == PROF_THREADS) {
+		return "thread";
+	}
+	t      = &threads[(*n)++];
+	t->tid = tid;
+	snprintf(t->name, sizeof(t->name), "thread");
+#if NANO_PLATFORM_LINUX
+	char  path[64];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+	if ((fp = fopen(path, "r")) != NULL) {
+		if (fgets(t->name, sizeof(t->name), fp) != NULL) {
+			for (char *c = t->name; *c != '\0'; c++) {
+				// separators of the folded format
+				if (*c == '\n' || *c == ';' || *c == ' ') {
+					*c = *c == '\n' ? '\0' : '_';
+				}
+			}
+		}
+		fclose(fp);
+	}
+#endif
+	return t->name;
+}
+
+static void
+prof_frame(char *dst, size_t size, void *pc)
+{
+	Dl_info info;
+
+	if (dladdr(pc, &info) == 0) {
+		memset(&info, 0, sizeof(info));
+	}
+	if (info.dli_sname != NULL) {
+		snprintf(dst, size, "%s", info.dli_sname);
+	} else if (info.dli_fname != NULL) {
+		const char *base = strrchr(info.dli_fname, '/');
+		snprintf(dst, size, "%s+0x%lx",
+		    base != NULL ? base + 1 : info.dli_fname,
+		    (unsigned long) ((uintptr_t) pc -
+		        (uintptr_t) info.dli_fbase));
+	} else {
+		snprintf(dst, size, "0x%lx", (unsigned long) (uintptr_t) pc);
+	}
+}
+
+static int
+prof_strcmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static int
+prof_fold(prof_sample *samples, int n, char **folded, size_t *len)
+{
+	prof_thread *threads;
+	char       **lines;
+	int          nthreads = 0;
+	int          nlines   = 0;
+	prof_buf     line     = { 0 };
+	prof_buf     out      = { 0 };
+	int          rv       = 0;
+
+	threads = nng_alloc(sizeof(prof_thread) * PROF_THREADS);
+	lines   = nng_zalloc(sizeof(char *) * (n > 0 ? n : 1));
+	if (threads == NULL || lines == NULL) {
+		rv = NNG_ENOMEM;
+		goto done;
+	}
+	for (int i = 0; i < n; i++) {
+		prof_sample *s = &samples[i];
+		char         frame[256];
+		const char  *name;
+
+		if (s->depth <= PROF_SKIP) {
+			continue;
+		}
+		name     = prof_thread_name(threads, &nthreads, s->tid);
+		line.len = 0;
+		rv       = prof_cat(&line, name, strlen(name));
+		for (int d = s->depth - 1; rv == 0 && d >= PROF_SKIP; d--) {
+			// callers are return addresses, one past the call
+			prof_frame(frame, sizeof(frame),
+			    (char *) s->pc[d] - (d > PROF_SKIP ? 1 : 0));
+			if ((rv = prof_cat(&line, ";", 1)) == 0) {
+				rv = prof_cat(&line, frame, strlen(frame));
+			}
+		}
+		if (rv != 0 || (lines[nlines] = nng_strdup(line.buf)) == NULL) {
+			rv = rv != 0 ? rv : NNG_ENOMEM;
+			goto done;
+		}
+		nlines++;
+	}
+
+	qsort(lines, nlines, sizeof(char *), prof_strcmp);
+	for (int i = 0; i < nlines && rv == 0;) {
+		char count[24];
+		int  j = i + 1;
+
+		while (j < nlines && strcmp(lines[i], lines[j]) == 0) {
+			j++;
+		}
+		snprintf(count, sizeof(count), " %d\n", j - i);
+		if ((rv = prof_cat(&out, lines[i], strlen(lines[i]))) == 0) {
+			rv = prof_cat(&out, count, strlen(count));
+		}
+		i = j;
+	}
+	if (rv == 0 && out.buf == NULL) {
+		rv = prof_cat(&out, "", 0);
+	}
+
+done:
+	if (line.buf != NULL) {
+		nng_free(line.buf, line.cap);
+	}
+	if (lines != NULL) {
+		for (int i = 0; i < nlines; i++) {
+			nng_strfree(lines[i]);
+		}
+		nng_free(lines, sizeof(char *) * (n > 0 ? n : 1));
+	}
+	if (threads != NULL) {
+		nng_free(threads, sizeof(prof_thread) * PROF_THREADS);
+	}
+	if (rv != 0) {
+		if (out.buf != NULL) {
+			nng_free(out.buf, out.cap);
+		}
+		return rv;
+	}
+	*folded = out.buf;
+	*len    = out.len;
+	return 0;
+}
+
+int
+prof_run(unsigned secs, unsigned hz, char **folded, size_t *len,
+    uint64_t *samples, uint64_t *dropped, prof_counters *before,
+    prof_counters *after)
+{
+	struct sigaction sa;
+	struct sigaction old;
+	struct itimerval it;
+	void            *warm[4];
+	long             ncpu;
+	uint64_t         cap;
+	int              n;
+	int              rv;
+
+	if (!prof_.enabled) {
+		return NNG_ENOTSUP;
+	}
+	if (secs == 0 || secs > NANO_PROF_MAX_SECONDS || hz == 0 ||
+	    hz > 1000) {
+		return NNG_EINVAL;
+	}
+	if (!nng_atomic_cas(prof_.running, 0, 1)) {
+		return NNG_EBUSY;
+	}
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	cap  = (uint64_t) secs * hz * (ncpu > 0 ? ncpu : 1);
+	prof_.cap =
+	    cap < NANO_PROF_MAX_SAMPLES ? (int) cap : NANO_PROF_MAX_SAMPLES;
+	if ((prof_.samples = nng_zalloc(sizeof(prof_sample) * prof_.cap)) ==
+	    NULL) {
+		nng_atomic_set(prof_.running, 0);
+		return NNG_ENOMEM;
+	}
+	nng_atomic_set(prof_.next, 0);
+	nng_atomic_set64(prof_.dropped, 0);
+	(void) backtrace(warm, 4);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = prof_sigprof;
+	sa.sa_flags   = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPROF, &sa, &old);
+	if (before != NULL) {
+		prof_collect(before);
+	}
+
+	memset(&it, 0, sizeof(it));
+	it.it_interval.tv_usec = 1000000 / hz;
+	it.it_value            = it.it_interval;
+	setitimer(ITIMER_PROF, &it, NULL);
+	nng_msleep(secs * 1000);
+	memset(&it, 0, sizeof(it));
+	setitimer(ITIMER_PROF, &it, NULL);
+
+	if (after != NULL) {
+		prof_collect(after);
+	}
+	// ignoring drops pending ticks, handlers under way get to finish
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPROF, &sa, NULL);
+	nng_msleep(10);
+	if (old.sa_handler != SIG_DFL) {
+		sigaction(SIGPROF, &old, NULL);
+	}
+
+	n = nng_atomic_get(prof_.next);
+	n = n < prof_.cap ? n : prof_.cap;
+	if (samples != NULL) {
+		*samples = n;
+	}
+	if (dropped != NULL) {
+		*dropped = nng_atomic_get64(prof_.dropped);
+	}
+	rv = prof_fold(prof_.samples, n, folded, len);
+
+	nng_free(prof_.samples, sizeof(prof_sample) * prof_.cap);
+	prof_.samples = NULL;
+	prof_.cap     = 0;
+	nng_atomic_set(prof_.running, 0);
+	return rv;
+}
+
+#else
+
+int
+prof_run(unsigned secs, unsigned hz, char **folded, size_t *len,
+    uint64_t *samples, uint64_t *dropped, prof_counters *before,
+    prof_counters *after)
+{
+	(void) secs;
+	(void) hz;
+	(void) folded;
+	(void) len;
+	(void) samples;
+	(void) dropped;
+	(void) before;
+	(void) after;
+	return NNG_ENOTSUP;
+}
+
+#endif
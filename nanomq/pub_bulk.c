@@ -0,0 +1,105 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/pub_bulk.h"
+#include "nng/nng.h"
+
+#define PUB_BULK_QOS_MASK 0x03
+#define PUB_BULK_RETAIN 0x04
+
+void
+pub_bulk_reader_init(pub_bulk_reader *r, pub_bulk_format format,
+    const void *buf, size_t len)
+{
+	r->buf    = buf;
+	r->len    = buf == NULL ? 0 : len;
+	r->off    = 0;
+	r->format = format;
+}
+
+static int
+pub_bulk_next_line(pub_bulk_reader *r, pub_bulk_record *rec)
+{
+	const uint8_t *line;
+	const uint8_t *end;
+	size_t         n;
+
+	while (r->off < r->len) {
+		line = r->buf + r->off;
+		end  = memchr(line, '\n', r->len - r->off);
+		n    = end == NULL ? r->len - r->off : (size_t) (end - line);
+		r->off += end == NULL ? n : n + 1;
+		if (n > 0 && line[n - 1] == '\r') {
+			n--;
+		}
+		if (n == 0) {
+			continue;
+		}
+		memset(rec, 0, sizeof(*rec));
+		rec->payload     = line;
+		rec->payload_len = n;
+		return 0;
+	}
+	return NNG_ENOENT;
+}
+
+static int
+pub_bulk_next_binary(pub_bulk_reader *r, pub_bulk_record *rec)
+{
+	const uint8_t *p    = r->buf + r->off;
+	size_t         left = r->len - r->off;
+	uint8_t        flags;
+	size_t         topic_len;
+	size_t         payload_len;
+
+	if (left == 0) {
+		return NNG_ENOENT;
+	}
+	if (left < 3) {
+		return NNG_EPROTO;
+	}
+	flags     = p[0];
+	topic_len = ((size_t) p[1] << 8) | p[2];
+	p += 3;
+	left -= 3;
+	if (left < topic_len + 4) {
+		return NNG_EPROTO;
+	}
+	rec->topic     = (const char *) p;
+	rec->topic_len = topic_len;
+	p += topic_len;
+	payload_len = ((size_t) p[0] << 24) | ((size_t) p[1] << 16) |
+	    ((size_t) p[2] << 8) | p[3];
+	p += 4;
+	left -= topic_len + 4;
+	if (left < payload_len) {
+		return NNG_EPROTO;
+	}
+	rec->payload     = p;
+	rec->payload_len = payload_len;
+	rec->qos         = flags & PUB_BULK_QOS_MASK;
+	rec->retain      = (flags & PUB_BULK_RETAIN) != 0;
+	r->off           = (size_t) (p + payload_len - r->buf);
+
+	if (topic_len == 0 || rec->qos > 2) {
+		return NNG_EINVAL;
+	}
+	return 0;
+}
+
+int
+pub_bulk_next(pub_bulk_reader *r, pub_bulk_record *rec)
+{
+	if (r->format == PUB_BULK_BINARY) {
+		return pub_bulk_next_binary(r, rec);
+	}
+	return pub_bulk_next_line(r, rec);
+}
@@ -7,6 +7,7 @@
 // found online at https://opensource.org/licenses/MIT.
 //
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -25,6 +26,24 @@
 #include "include/pub_handler.h"
 #include "include/sub_handler.h"
 #include "include/acl_handler.h"
+#include "include/auth_http_cache.h"
+#include "include/match_cache.h"
+#include "include/share_group.h"
+#include "include/topic_alias.h"
+#include "include/traffic_stats.h"
+#include "include/latency_stats.h"
+#include "include/profiler.h"
+#include "include/msg_trace.h"
+#include "include/bridge_dedupe.h"
+#include "include/bridge_zip.h"
+#include "include/rule_filter.h"
+#include "include/rule_sink.h"
+#include "include/retain_index.h"
+#include "include/retain_store.h"
+#include "include/sqlite_commit.h"
+#include "include/work_arena.h"
+#include "include/msg_pool.h"
+#include "include/transform.h"
 #include "nng/protocol/mqtt/mqtt_parser.h"
 #include "nng/supplemental/util/platform.h"
 #include "nng/supplemental/sqlite/sqlite3.h"
@@ -38,40 +57,77 @@
 #define SUPPORT_MQTT5_0 1
 
 #ifdef STATISTICS
-typedef struct {
-	bool            initialed;
-	nng_atomic_u64 *msg_in;
-	nng_atomic_u64 *msg_out;
-	nng_atomic_u64 *msg_drop;
-} msg_statistics;
+/*
+ * One block per worker, written by that worker only, so publishing never
+ * bounces a shared line between cores; readers add the blocks up. Two
+ * cache lines per block keep the counters of neighbouring blocks apart
+ * whatever alignment the allocator hands out.
+ */
+struct nano_msg_stats {
+	uint64_t               in;
+	uint64_t               out;
+	uint64_t               drop;
+	struct nano_msg_stats *next;
+	uint8_t pad[128 - 3 * sizeof(uint64_t) - sizeof(void *)];
+};
+
+static struct {
+	nng_mtx               *mtx;
+	struct nano_msg_stats *head;
+} msg_stats_;
+
+struct nano_msg_stats *
+nano_msg_stats_alloc(void)
+{
+	struct nano_msg_stats *st;
 
-static msg_statistics g_msg = { .initialed = false };
+	// workers are allocated at start, before any of them runs
+	if (msg_stats_.mtx == NULL && nng_mtx_alloc(&msg_stats_.mtx) != 0) {
+		return NULL;
+	}
+	if ((st = nng_zalloc(sizeof(*st))) == NULL) {
+		return NULL;
+	}
+	nng_mtx_lock(msg_stats_.mtx);
+	st->next        = msg_stats_.head;
+	msg_stats_.head = st;
+	nng_mtx_unlock(msg_stats_.mtx);
+	return st;
+}
 
-static void
-msg_statistics_init(msg_statistics *m)
+static uint64_t
+msg_stats_sum(size_t off)
 {
-	nng_atomic_alloc64(&m->msg_in);
-	nng_atomic_alloc64(&m->msg_out);
-	nng_atomic_alloc64(&m->msg_drop);
-	m->initialed = true;
+	uint64_t sum = 0;
+
+	if (msg_stats_.mtx == NULL) {
+		return 0;
+	}
+	nng_mtx_lock(msg_stats_.mtx);
+	for (struct nano_msg_stats *st = msg_stats_.head; st != NULL;
+	     st                        = st->next) {
+		sum += *(volatile uint64_t *) ((uint8_t *) st + off);
+	}
+	nng_mtx_unlock(msg_stats_.mtx);
+	return sum;
 }
 
 uint64_t
 nanomq_get_message_in()
 {
-	return g_msg.initialed ? nng_atomic_get64(g_msg.msg_in) : 0;
+	return msg_stats_sum(offsetof(struct nano_msg_stats, in));
 }
 
 uint64_t
 nanomq_get_message_out()
 {
-	return g_msg.initialed ? nng_atomic_get64(g_msg.msg_out) : 0;
+	return msg_stats_sum(offsetof(struct nano_msg_stats, out));
 }
 
 uint64_t
 nanomq_get_message_drop()
 {
-	return g_msg.initialed ? nng_atomic_get64(g_msg.msg_drop) : 0;
+	return msg_stats_sum(offsetof(struct nano_msg_stats, drop));
 }
 
 #endif
@@ -87,318 +143,136 @@ void
 init_pipe_content(struct pipe_content *pipe_ct)
 {
 	log_debug("pub_handler: init pipe_info");
-	pipe_ct->msg_infos     = NULL;
+	pipe_ct->pipes        = NULL;
+	pipe_ct->shared_pipes = NULL;
+	pipe_ct->cached       = NULL;
 }
 
-static void
-foreach_client(
-    uint32_t *cli_ctx_list, nano_work *pub_work, struct pipe_content *pipe_ct)
+void
+free_pipe_content(struct pipe_content *pipe_ct)
 {
-	uint32_t pids;
-	int      ctx_list_len;
-
-	ctx_list_len = cvector_size(cli_ctx_list);
-
-	// Dont using msg info buf, Just for Cheat Compiler
-	mqtt_msg_info *msg_info     = NULL;
-	mqtt_msg_info  msg_info_buf = { 0 };
-
-	cvector(mqtt_msg_info) msg_infos = pipe_ct->msg_infos;
-	cvector_grow(msg_infos, ctx_list_len);
-
-	for (int i = 0; i < ctx_list_len; i++) {
-		pids = cli_ctx_list[i];
-
-#ifdef STATISTICS
-		// TODO
-		// nng_atomic_inc64(ctx->recv_cnt);
-		nng_atomic_inc64(g_msg.msg_out);
-#endif
-		if (pids == 0) {
-			continue;
-		}
-
-		// TODO using pid instead of msg_info
-		cvector_push_back(msg_infos, msg_info_buf);
-		size_t csize = cvector_size(msg_infos);
-		msg_info     = (mqtt_msg_info *) &msg_infos[csize - 1];
-
-		msg_info->pipe = pids;
+	if (pipe_ct->cached != NULL) {
+		match_cache_release(pipe_ct->cached);
+		pipe_ct->cached = NULL;
+	} else {
+		cvector_free(pipe_ct->pipes);
 	}
-	pipe_ct->msg_infos = msg_infos;
+	cvector_free(pipe_ct->shared_pipes);
+	pipe_ct->pipes        = NULL;
+	pipe_ct->shared_pipes = NULL;
 }
 
-#if defined(SUPP_RULE_ENGINE)
-static bool
-cmp_int(int value_checked, int value_seted, rule_cmp_type type)
+size_t
+pipe_content_count(struct pipe_content *pipe_ct)
 {
-	bool filter = true;
-	switch (type)
-	{
-	case RULE_CMP_EQUAL:
-		if (value_checked != value_seted) {
-			filter = false;
-		}
-		break;
-	case RULE_CMP_UNEQUAL:
-		if (value_checked == value_seted) {
-			filter = false;
-		}
-		break;
-
-	case RULE_CMP_GREATER:
-		if (value_checked <= value_seted) {
-			filter = false;
-		}
-		break;
-	case RULE_CMP_LESS:
-		if (value_checked >= value_seted) {
-			filter = false;
-		}
-		break;
-	case RULE_CMP_GREATER_AND_EQUAL:
-		if (value_checked < value_seted) {
-			filter = false;
-		}
-		break;
-	case RULE_CMP_LESS_AND_EQUAL:
-		if (value_checked > value_seted) {
-			filter = false;
-		}
-		break;
-	
-	default:
-		break;
-	}
-	return filter;
+	return cvector_size(pipe_ct->pipes) +
+	    cvector_size(pipe_ct->shared_pipes);
 }
 
-static bool
-cmp_str(
-    const char *value_checked, int len, char *value_seted, rule_cmp_type type)
+size_t
+pipe_content_dedup(uint32_t *pipes, struct work_arena *arena)
 {
-	if (value_checked == NULL) {
-		return false;
+	size_t    n = cvector_size(pipes);
+	size_t    kept = 0;
+	size_t    cap;
+	size_t    size;
+	uint32_t *set;
+	bool      heap = false;
+
+	if (n <= NANO_PIPE_DEDUP_LINEAR) {
+		for (size_t i = 0; i < n; i++) {
+			size_t j;
+
+			if (pipes[i] == 0) {
+				continue;
+			}
+			for (j = 0; j < kept; j++) {
+				if (pipes[j] == pipes[i]) {
+					break;
+				}
+			}
+			if (j == kept) {
+				pipes[kept++] = pipes[i];
+			}
+		}
+		cvector_set_size(pipes, kept);
+		return kept;
 	}
 
-	bool filter = true;
-	switch (type) {
-	case RULE_CMP_EQUAL:
-		if (strncmp(value_checked, value_seted, len)) {
-			filter = false;
-		}
-		break;
-	case RULE_CMP_UNEQUAL:
-		if (!strncmp(value_checked, value_seted, len)) {
-			filter = false;
+	// open addressing, at most half full
+	cap = 2 * NANO_PIPE_DEDUP_LINEAR;
+	while (cap < 2 * n) {
+		cap <<= 1;
+	}
+	size = cap * sizeof(uint32_t);
+	if ((set = work_arena_zget(arena, size)) == NULL) {
+		// the arena is full or there is none
+		if ((set = nng_zalloc(size)) == NULL) {
+			return n;
 		}
-		break;
-	default:
-		log_debug("Unsupport compare symbol, string only support equal "
-		        "and unequal!");
-		break;
+		heap = true;
 	}
-	return filter;
-}
+	for (size_t i = 0; i < n; i++) {
+		size_t h;
 
-static bool
-payload_filter(pub_packet_struct *pp, rule *info)
-{
-	bool   filter = true;
-	cJSON *jp = cJSON_ParseWithLength(pp->payload.data, pp->payload.len);
-	cJSON *jp_reset = jp;
-	// info->payload size equal 0, implicit there is no
-	// payload filter need to be check, so filter is true.
-	for (int pi = 0; pi < cvector_size(info->payload); pi++) {
-		jp                    = jp_reset; // reset jp;
-		rule_payload *payload = info->payload[pi];
-		for (int k = 0; k < cvector_size(payload->psa); k++) {
-			if (jp == NULL) {
-				filter = false;
-				break;
-			}
-			jp = cJSON_GetObjectItem(jp, payload->psa[k]);
+		if (pipes[i] == 0) {
+			continue;
 		}
-
-		if (jp == NULL || filter == false) {
-			filter = false;
-			break;
+		h = (pipes[i] * 2654435761u) & (cap - 1);
+		while (set[h] != 0 && set[h] != pipes[i]) {
+			h = (h + 1) & (cap - 1);
 		}
-
-		switch (jp->type) {
-		case cJSON_Number:;
-			long num = cJSON_GetNumberValue(jp);
-
-			if (payload->filter && !cmp_int(num, atoi(payload->filter), payload->cmp_type)) {
-				filter = false;
-			} else {
-				payload->value = (void *) num;
-				payload->type  = cJSON_Number;
-			}
-			break;
-		case cJSON_String:;
-			char *str = cJSON_GetStringValue(jp);
-			if (payload->filter && !cmp_str(str, strlen(str), payload->filter, payload->cmp_type)) {
-				filter = false;
-			} else {
-				if (payload->value)
-					free(payload->value);
-				payload->value = nng_strdup(str);
-				payload->type  = cJSON_String;
-			}
-			break;
-		case cJSON_Object:;
-			cJSON *filter_obj = cJSON_Parse(payload->filter);
-			if (!payload->is_store && filter_obj && !cJSON_Compare(jp, filter_obj, true)) {
-				filter = false;
-			} else {
-				// if (payload->value)
-				// 	cJSON_Delete((cJSON*) payload->value);
-				payload->value = cJSON_Duplicate(jp, 1);
-				payload->type  = cJSON_Object;
-			}
-			break;
-
-		default:
-			break;
+		if (set[h] == 0) {
+			set[h]        = pipes[i];
+			pipes[kept++] = pipes[i];
 		}
 	}
-	cJSON_Delete(jp_reset);
-
-
-	return filter;
+	if (heap) {
+		nng_free(set, size);
+	}
+	cvector_set_size(pipes, kept);
+	return kept;
 }
 
-static bool
-rule_engine_filter(nano_work *work, rule *info)
+// Resolve the subscribers of topic, from the match cache when possible.
+// Shared subscriptions pick a group member per message, so they are
+// never served from the cache, only their absence is remembered.
+static void
+match_clients(dbtree *db, char *topic, struct pipe_content *pipe_ct,
+    const char *clientid, struct work_arena *arena)
 {
-	pub_packet_struct *pp     = work->pub_packet;
-	char	      *topic  = pp->var_header.publish.topic_name.body;
-	conn_param        *cp     = work->cparam;
-	bool               filter = true;
-	if (RULE_FORWORD_REPUB == info->forword_type) {
-		const char *cid = (const char *) conn_param_get_clientid(cp);
-		if (info->repub->clientid && cmp_str(cid, strlen(cid), info->repub->clientid,
-		        RULE_CMP_EQUAL)) {
-			return false;
+	match_cache_entry *entry;
+	uint64_t           gen;
+
+	if ((entry = match_cache_get(topic)) != NULL) {
+		pipe_ct->cached = entry;
+		pipe_ct->pipes  = entry->pipes;
+		if (entry->has_shared) {
+			pipe_ct->shared_pipes =
+			    dbtree_find_shared_clients(db, topic);
+			share_group_pick(topic, pipe_ct->shared_pipes, clientid);
 		}
+		return;
 	}
 
-	if (topic_filter(info->topic, topic)) {
-		if (info->filter) {
-			for (size_t j = 0; j < 9; j++) {
-				char *val = NULL;
-				if (j < 8) {
-					val = info->filter[j];
-				}
-				if (val != NULL || j == RULE_PAYLOAD_FIELD) {
-					switch (j) {
-					case RULE_QOS:
-						filter = cmp_int(
-						    pp->fixed_header.qos,
-						    atoi(val),
-						    info->cmp_type[j]);
-						break;
-					case RULE_ID:
-						filter = cmp_int(
-						    pp->var_header.publish
-						        .packet_id,
-						    atoi(val),
-						    info->cmp_type[j]);
-						break;
-					case RULE_TOPIC:
-						filter = cmp_str(topic,
-						    strlen(topic), val,
-						    info->cmp_type[j]);
-						break;
-					case RULE_CLIENTID:;
-						const char *cid = (const char
-						        *)
-						    conn_param_get_clientid(
-						        cp);
-						filter = cmp_str(cid,
-						    strlen(cid), val,
-						    info->cmp_type[j]);
-
-						break;
-					case RULE_USERNAME:;
-						const char *username =
-						    (const char *)
-						        conn_param_get_username(
-						            cp);
-						filter = cmp_str(username,
-						    strlen(username), val,
-						    info->cmp_type[j]);
-						break;
-					case RULE_PASSWORD:;
-						const char *password =
-						    (const char *)
-						        conn_param_get_password(
-						            cp);
-						filter = cmp_str(password,
-						    strlen(password), val,
-						    info->cmp_type[j]);
-						break;
-					case RULE_TIMESTAMP:
-						filter = cmp_int(
-						    (unsigned long) time(NULL),
-						    atoi(val),
-						    info->cmp_type[j]);
-						break;
-					case RULE_PAYLOAD_ALL:
-						if (!pp->payload.data ||
-						    pp->payload.len <= 0) {
-							filter = false;
-							break;
-						}
-
-						if (val != NULL) {
-							filter = cmp_str(
-							    pp->payload.data,
-							    pp->payload.len,
-							    val,
-							    info->cmp_type[j]);
-						}
-
-						break;
-					case RULE_PAYLOAD_FIELD:
-						if (!pp->payload.data ||
-						    pp->payload.len <= 0) {
-							filter = false;
-							break;
-						}
-
-						filter =
-						    payload_filter(pp, info);
-						break;
-					default:
-						break;
-					}
-					if (filter == false) {
-						break;
-					}
-				}
-			}
-		} else {
-			if (!pp->payload.data || pp->payload.len <= 0) {
-				filter = false;
-			}
-
-			payload_filter(pp, info);
-			filter = true;
-		}
-	} else {
-		// printf("MISMATCH filter: %s, topic: %s\n", info->topic,
-		// topic);
-		filter = false;
+	// read generation before walking the tree, a concurrent
+	// sub/unsub then leaves the new entry stale instead of wrong
+	gen                   = match_cache_generation();
+	pipe_ct->pipes        = dbtree_find_clients(db, topic);
+	pipe_ct->shared_pipes = dbtree_find_shared_clients(db, topic);
+	share_group_pick(topic, pipe_ct->shared_pipes, clientid);
+	// cached vectors are deduplicated once, before they are shared
+	pipe_content_dedup(pipe_ct->pipes, arena);
+
+	if (match_cache_enabled()) {
+		pipe_ct->cached = match_cache_put(topic, gen, pipe_ct->pipes,
+		    pipe_ct->shared_pipes != NULL);
 	}
-
-	return filter;
 }
 
-
+#if defined(SUPP_RULE_ENGINE)
 static char*
-generate_key(rule *info, int j, nano_work *work)
+generate_key(rule *info, int j, nano_work *work, rule_doc *doc)
 {
 	pub_packet_struct *pp = work->pub_packet;
 	conn_param        *cp = work->cparam;
@@ -474,13 +348,16 @@ generate_key(rule *info, int j, nano_work *work)
 			}
 			break;
 		case RULE_PAYLOAD_FIELD:;
-			cJSON *jp = cJSON_ParseWithLength(pp->payload.data, pp->payload.len);
+			cJSON *jp = rule_doc_get(doc);
 			for (int k = 0; k < cvector_size(info->key->key_arr); k++) {
 				if (jp == NULL) {
 					break;
 				}
 				jp = cJSON_GetObjectItem(jp, info->key->key_arr[k]);
 			}
+			if (jp == NULL) {
+				break;
+			}
 
 			switch (jp->type)
 			{
@@ -519,10 +396,11 @@ generate_key(rule *info, int j, nano_work *work)
 
 
 static int
-add_info_to_json(rule *info, cJSON *jso, int j, nano_work *work)
+add_info_to_json(rule *info, cJSON *jso, int j, nano_work *work, rule_doc *doc)
 {
-	pub_packet_struct *pp = work->pub_packet;
-	conn_param        *cp = work->cparam;
+	pub_packet_struct *pp   = work->pub_packet;
+	conn_param        *cp   = work->cparam;
+	rule_value        *vals = work->rule_vals;
 	if (info->flag[j]) {
 		switch (j) {
 		case RULE_QOS:
@@ -591,18 +469,18 @@ add_info_to_json(rule *info, cJSON *jso, int j, nano_work *work)
 			break;
 		case RULE_PAYLOAD_ALL:;
 			char *payload = pp->payload.data;
-			cJSON *jp = cJSON_ParseWithLength(payload, pp->payload.len);
+			cJSON *jp = rule_doc_get(doc);
 
 			if (info->as[j]) {
 				if (jp) {
-					cJSON_AddItemToObject(jso, info->as[j], jp);
+					cJSON_AddItemReferenceToObject(jso, info->as[j], jp);
 				} else {
 					cJSON_AddStringToObject(
 					    jso, info->as[j], payload);
 				}
 			} else {
 				if (jp) {
-					cJSON_AddItemToObject(jso, "payload", jp);
+					cJSON_AddItemReferenceToObject(jso, "payload", jp);
 				} else {
 					cJSON_AddStringToObject(
 					    jso, "payload", payload);
@@ -613,12 +491,12 @@ add_info_to_json(rule *info, cJSON *jso, int j, nano_work *work)
 			for (int pi = 0; pi < cvector_size(info->payload);
 			     pi++) {
 				if (info->payload[pi]->is_store) {
-					switch (info->payload[pi]->type) {
+					switch (vals[pi].type) {
 					case cJSON_Number:
 						if (info->payload[pi]->pas) {
 							cJSON_AddNumberToObject(jso,
 							    info->payload[pi]->pas,
-							    (long) info->payload[pi]->value);
+							    vals[pi].num);
 
 						}
 						break;
@@ -626,14 +504,14 @@ add_info_to_json(rule *info, cJSON *jso, int j, nano_work *work)
 						if (info->payload[pi]->pas) {
 							cJSON_AddStringToObject(jso,
 							    info->payload[pi]->pas,
-							    (char *) info->payload[pi]->value);
+							    vals[pi].str);
 						}
 						break;
 					case cJSON_Object:
 						if (info->payload[pi]->pas) {
-							cJSON_AddItemToObject(jso,
+							cJSON_AddItemReferenceToObject(jso,
 							    info->payload[pi]->pas,
-							    (cJSON*) info->payload[pi]->value);
+							    vals[pi].obj);
 						}
 						break;
 					default:
@@ -654,8 +532,9 @@ add_info_to_json(rule *info, cJSON *jso, int j, nano_work *work)
 static char *
 compose_sql_clause(rule *info, char *key, char *value, bool is_need_set, int j, nano_work *work)
 {
-	pub_packet_struct *pp = work->pub_packet;
-	conn_param        *cp = work->cparam;
+	pub_packet_struct *pp   = work->pub_packet;
+	conn_param        *cp   = work->cparam;
+	rule_value        *vals = work->rule_vals;
 	char *ret = NULL;
 	char tmp[800];
 
@@ -760,7 +639,7 @@ compose_sql_clause(rule *info, char *key, char *value, bool is_need_set, int j,
 				if (info->payload[pi]->is_store) {
 					if (info->payload[pi]->pas) {
 
-						switch (info->payload[pi]->type) {
+						switch (vals[pi].type) {
 						case cJSON_Number:
 								if (is_need_set) {
 									  if (RULE_FORWORD_SQLITE == info->forword_type) {
@@ -773,11 +652,11 @@ compose_sql_clause(rule *info, char *key, char *value, bool is_need_set, int j,
 								strcat(key, ", ");
 								if (strlen(value) > strlen("VALUES (")) {
 									memset(tmp, 0, 800);
-									sprintf(tmp, "%s, %ld", value, (long) info->payload[pi]->value);
+									sprintf(tmp, "%s, %ld", value, vals[pi].num);
 									strcpy(value, tmp);
 								} else {
 									memset(tmp, 0, 800);
-									sprintf(tmp, "%s %ld", value, (long) info->payload[pi]->value);
+									sprintf(tmp, "%s %ld", value, vals[pi].num);
 									strcpy(value, tmp);
 								}
 							break;
@@ -794,11 +673,11 @@ compose_sql_clause(rule *info, char *key, char *value, bool is_need_set, int j,
 								strcat(key, ", ");
 								if (strlen(value) > strlen("VALUES (")) {
 									memset(tmp, 0, 800);
-									sprintf(tmp, "%s, \'%s\'", value, (char*) info->payload[pi]->value);
+									sprintf(tmp, "%s, \'%s\'", value, vals[pi].str);
 									strcpy(value, tmp);
 								} else {
 									memset(tmp, 0, 800);
-									sprintf(tmp, "%s \'%s\'", value, (char*) info->payload[pi]->value);
+									sprintf(tmp, "%s \'%s\'", value, vals[pi].str);
 									strcpy(value, tmp);
 								}
 							}
@@ -814,7 +693,7 @@ compose_sql_clause(rule *info, char *key, char *value, bool is_need_set, int j,
 								}
 								strcat(key, info->payload[pi]->pas);
 								strcat(key, ", ");
-								char *cjson_obj = cJSON_PrintUnformatted((cJSON*) info->payload[pi]->value);
+								char *cjson_obj = cJSON_PrintUnformatted(vals[pi].obj);
 								if (strlen(value) > strlen("VALUES (")) {
 									memset(tmp, 0, 800);
 									sprintf(tmp, "%s, \'%s\'", value, cjson_obj);
@@ -856,11 +735,27 @@ compose_sql_clause(rule *info, char *key, char *value, bool is_need_set, int j,
 	return ret;
 }
 
+// A republish to the broker itself skips the MQTT client: it is composed
+// here and routed by the worker once every rule had the message.
+static void
+rule_repub_local(nano_work *work, char *topic, char *payload)
+{
+	nng_msg    *msg     = NULL;
+	mqtt_string t_topic = { .body = topic, .len = strlen(topic) };
+	mqtt_string t_data  = { .body = payload, .len = strlen(payload) };
+
+	if (nano_pubmsg_composer(&msg, 0, 0, &t_data, &t_topic,
+	        MQTT_PROTOCOL_VERSION_v311, nng_clock()) == NULL) {
+		log_warn("rule republish to %s dropped", topic);
+		return;
+	}
+	cvector_push_back(work->repubs, msg);
+}
+
 int
 rule_engine_insert_sql(nano_work *work)
 {
-	rule  *rules = work->config->rule_eng.rules;
-	size_t             rule_size  = cvector_size(rules);
+	rule_view          view;
 	pub_packet_struct *pp         = work->pub_packet;
 	conn_param        *cp         = work->cparam;
 	static uint32_t    index      = 0;
@@ -871,28 +766,45 @@ rule_engine_insert_sql(nano_work *work)
 
 	nng_mtx *rule_mutex = work->config->rule_eng.rule_mutex;
 
-	for (size_t i = 0; i < rule_size; i++) {
-		if (true == rules[i].enabled && rule_engine_filter(work, &rules[i])) {
+	// REST changes to the rules wait for us, not the other way round
+	rule_filter_enter(&view, work->ctx.id);
+	rule  *rules     = view.rules;
+	size_t rule_size = view.count;
+
+	// only rules whose FROM topic can match, unless the index falls short
+	uint32_t hits[NANO_RULE_MATCH_MAX];
+	size_t   nhits = rule_filter_lookup(&view,
+	    pp->var_header.publish.topic_name.body, pub_packet_levels(pp), hits,
+	    NANO_RULE_MATCH_MAX);
+	bool     scan  = nhits > NANO_RULE_MATCH_MAX;
+	rule_doc doc;
+
+	rule_doc_init(&doc, pp);
+	for (size_t k = 0; k < (scan ? rule_size : nhits); k++) {
+		size_t i = scan ? k : hits[k];
+		if (rule_filter_match(work, &doc, &view, i)) {
 #if defined(FDB_SUPPORT)
 			char fdb_key[pp->var_header.publish.topic_name.len+sizeof(uint64_t)];
 			if (RULE_ENG_FDB & work->config->rule_eng.option && RULE_FORWORD_FDB == rules[i].forword_type) {
-				cJSON *jso = NULL;
-				jso        = cJSON_CreateObject();
+				uint64_t since = transform_cpu_now();
+				cJSON   *jso   = NULL;
+				jso            = cJSON_CreateObject();
 
 				for (size_t j = 0; j < 9; j++) {
 					add_info_to_json(
-					    &rules[i], jso, j, work);
+					    &rules[i], jso, j, work, &doc);
 				}
 
 				char *key = NULL;
 				for (size_t j = 0; j < 9; j++) {
-					key = generate_key(&rules[i], j, work);
+					key = generate_key(&rules[i], j, work, &doc);
 					if (key != NULL) {
 						break;
 					}
 				}
 
 				char *dest = cJSON_PrintUnformatted(jso);
+				transform_account(TRANSFORM_RULE_JSON, since);
 				log_debug("%s", key);
 				log_debug("%s", dest);
 
@@ -924,18 +836,27 @@ rule_engine_insert_sql(nano_work *work)
 #endif
 
 			if (RULE_ENG_RPB & work->config->rule_eng.option && RULE_FORWORD_REPUB == rules[i].forword_type) {
-				cJSON *jso = NULL;
-				jso        = cJSON_CreateObject();
+				uint64_t since = transform_cpu_now();
+				cJSON   *jso   = NULL;
+				jso            = cJSON_CreateObject();
 
 				for (size_t j = 0; j < 9; j++) {
 					add_info_to_json(
-					    &rules[i], jso, j, work);
+					    &rules[i], jso, j, work, &doc);
 				}
 
 				char *dest = cJSON_PrintUnformatted(jso);
 				repub_t *repub = rules[i].repub;
 
-				nano_client_publish(repub->sock, repub->topic, dest, strlen(dest), 0, NULL);
+				transform_account(TRANSFORM_RULE_JSON, since);
+
+				if (nano_client_is_local(
+				        work->config->url, repub->address)) {
+					rule_repub_local(work, repub->topic, dest);
+				} else if (repub->sock != NULL) {
+					nano_client_publish(repub->sock, repub->topic,
+					    dest, strlen(dest), 0, NULL);
+				}
 				log_debug("%s", repub->topic);
 				log_debug("%s", dest);
 
@@ -945,12 +866,13 @@ rule_engine_insert_sql(nano_work *work)
 
 #if defined(NNG_SUPP_SQLITE)
 			if (RULE_ENG_SDB & work->config->rule_eng.option && RULE_FORWORD_SQLITE == rules[i].forword_type) {
+				uint64_t since = transform_cpu_now();
 				char sql_clause[1024] = "INSERT INTO ";
 				char key[128]         = { 0 };
 				snprintf(key, 128, "%s (", rules[i].sqlite_table);
 				char value[800]       = "VALUES (";
 				for (size_t j = 0; j < 9; j++) {
-					nng_mtx_lock(rule_mutex);
+					PROF_LOCK(PROF_LOCK_RULE, rule_mutex);
 					if (true == is_first_time) {
 						is_need_set   = true;
 					}
@@ -959,22 +881,9 @@ rule_engine_insert_sql(nano_work *work)
 					        key, value, is_need_set, j, work);
 					if (ret) {
 						log_debug("%s", ret);
-						log_debug("%s", ret);
-						sqlite3 *sdb =
-						    (sqlite3 *) work->config
-						        ->rule_eng.rdb[0];
-						char *err_msg = NULL;
-						int   rc      = sqlite3_exec(
-						           sdb, ret, 0, 0, &err_msg);
-						// FIXME: solve in a more
-						// elegant way 
-						if (rc != SQLITE_OK) {
-							// fprintf(stderr, "SQL error: num %d %s\n",
-							//     rc, err_msg);
-							sqlite3_free(err_msg);
-							// sqlite3_close(sdb);
-							// return 1;
-						}
+						rule_sink_exec(RULE_FORWORD_SQLITE,
+						    work->config->rule_eng.rdb[0],
+						    ret);
 
 						free(ret);
 						ret = NULL;
@@ -998,22 +907,12 @@ rule_engine_insert_sql(nano_work *work)
 				strcat(sql_clause, key);
 				strcat(sql_clause, value);
 				strcat(sql_clause, ";");
+				transform_account(TRANSFORM_RULE_SQL, since);
 
 				log_debug("%s", sql_clause);
-				log_debug("%s", sql_clause);
-				sqlite3 *sdb = (sqlite3 *) work->config->rule_eng.rdb[0];
-				char    *err_msg = NULL;
-				int      rc      = sqlite3_exec(
-				              sdb, sql_clause, 0, 0, &err_msg);
-				if (rc != SQLITE_OK) {
-					fprintf(stderr, "SQL error: %s\n",
-					    err_msg);
-					sqlite3_free(err_msg);
-					sqlite3_close(sdb);
-
-					return 1;
-				}
-
+				rule_sink_insert(RULE_FORWORD_SQLITE,
+				    work->config->rule_eng.rdb[0], key,
+				    value + strlen("VALUES "));
 			}
 
 #endif
@@ -1021,12 +920,13 @@ rule_engine_insert_sql(nano_work *work)
 
 #if defined(SUPP_MYSQL)
 			if (RULE_ENG_MDB & work->config->rule_eng.option && RULE_FORWORD_MYSQL == rules[i].forword_type) {
+				uint64_t since = transform_cpu_now();
 				char sql_clause[1024] = "INSERT INTO ";
 				char key[128]         = { 0 };
 				snprintf(key, 128, "%s (", rules[i].mysql->table);
 				char value[800]       = "VALUES (";
 				for (size_t j = 0; j < 9; j++) {
-					nng_mtx_lock(rule_mutex);
+					PROF_LOCK(PROF_LOCK_RULE, rule_mutex);
 					if (true == is_first_time_mysql) {
 						is_need_set_mysql   = true;
 					}
@@ -1037,27 +937,11 @@ rule_engine_insert_sql(nano_work *work)
 					if (ret && is_need_set_mysql) {
 						is_need_set_mysql = false;
 						log_debug("%s", ret);
-
-						char *p   = ret;
-						char *p_b = ret;
-
-						while (NULL != p) {
-							char *p = strchr(p_b, '\n');
-							if (NULL != p) {
-								*p = '\0';
-  								if (mysql_query(rules[i].mysql->conn, p_b)) {
-  									// fprintf(stderr, "%s\n", mysql_error(rules[i].mysql->conn));
-  								}
-								p_b = ++p;
-
-							} else {
-								break;
-							}
-						}
-
-						free(ret);
-						ret = NULL;
+						rule_sink_exec(RULE_FORWORD_MYSQL,
+						    rules[i].mysql->conn, ret);
 					}
+					free(ret);
+					ret = NULL;
 
 					if (true == is_first_time_mysql) {
 						is_first_time_mysql = false;
@@ -1077,23 +961,96 @@ rule_engine_insert_sql(nano_work *work)
 				strcat(sql_clause, key);
 				strcat(sql_clause, value);
 				strcat(sql_clause, ";");
+				transform_account(TRANSFORM_RULE_SQL, since);
 
 				log_debug("%s", sql_clause);
-  				if (mysql_query(rules[i].mysql->conn, sql_clause)) {
-  					fprintf(stderr, "%s\n", mysql_error(rules[i].mysql->conn));
-  					mysql_close(rules[i].mysql->conn);
-  					exit(1);
-  				}
+				rule_sink_insert(RULE_FORWORD_MYSQL,
+				    rules[i].mysql->conn, key,
+				    value + strlen("VALUES "));
 			}
 #endif
 		}
 	}
+	rule_doc_fini(&doc);
+	rule_filter_leave(&view);
 
 	return 0;
 }
 
 
 #endif
+
+static void
+pub_topic_put(struct pub_packet_struct *pub_packet, char *topic, uint32_t len,
+    bool owned)
+{
+	if (pub_packet->topic_owned &&
+	    pub_packet->var_header.publish.topic_name.body != NULL) {
+		nng_free(pub_packet->var_header.publish.topic_name.body,
+		    pub_packet->var_header.publish.topic_name.len + 1);
+	}
+	pub_packet->var_header.publish.topic_name.body = topic;
+	pub_packet->var_header.publish.topic_name.len  = len;
+	pub_packet->topic_owned                        = owned;
+	pub_packet->dirty                              = true;
+	pub_packet->levels.n                           = 0;
+}
+
+// Topic for auth_http, out of the work arena when there is one and only to
+// be released without it.
+static struct topic_queue *
+pub_auth_topic(nano_work *work, const char *topic, uint32_t len)
+{
+	struct topic_queue *tq;
+
+	if (work->arena == NULL) {
+		return topic_queue_init((char *) topic, len);
+	}
+	if ((tq = work_arena_zget(work->arena, sizeof(*tq))) == NULL ||
+	    (tq->topic = work_arena_strndup(work->arena, topic, len)) ==
+	        NULL) {
+		return NULL;
+	}
+	return tq;
+}
+
+#if defined(SUPP_MSG_TRACE)
+/*
+ * Start the trace of a sampled PUBLISH and pass it on to v5 subscribers as
+ * the parent of theirs: the traceparent of the publisher is rewritten in
+ * the body, same length, or one is added as a user property.
+ */
+static void
+pub_trace_begin(nano_work *work, const char *topic, uint8_t proto)
+{
+	struct pub_packet_struct *pp = work->pub_packet;
+	char                      tp[TRACE_PARENT_LEN];
+	property                 *prop;
+
+	work->trace = msg_trace_begin(&work->trace_seq, topic,
+	    pub_packet_levels(pp), pp->traceparent, work->pid.id,
+	    work->cparam != NULL
+	        ? (const char *) conn_param_get_clientid(work->cparam)
+	        : NULL,
+	    pp->fixed_header.qos);
+	if (work->trace == NULL || proto != MQTT_PROTOCOL_VERSION_v5) {
+		return;
+	}
+	msg_trace_parent(work->trace, tp);
+	if (pp->traceparent != NULL) {
+		memcpy((uint8_t *) pp->traceparent, tp, TRACE_PARENT_LEN);
+		return;
+	}
+	prop = mqtt_property_set_value_strpair(USER_PROPERTY, "traceparent",
+	    11, tp, TRACE_PARENT_LEN, true);
+	if (pub_packet_properties(pp, work->msg) == NULL) {
+		pp->var_header.publish.properties = property_alloc();
+	}
+	property_append(pp->var_header.publish.properties, prop);
+	pp->dirty = true;
+}
+#endif
+
 /**
  * 
 	only deal with locale publishing
@@ -1110,22 +1067,27 @@ handle_pub(nano_work *work, struct pipe_content *pipe_ct, uint8_t proto,
 {
 	reason_code result          = SUCCESS;
 	char      **topic_queue     = NULL;
-	uint32_t   *cli_ctx_list    = NULL;
-	uint32_t   *shared_cli_list = NULL;
 	char       *topic           = NULL;
-	pipe_ct->msg_infos          = NULL;
+	uint64_t    lat;
+	init_pipe_content(pipe_ct);
 
 #ifdef STATISTICS
-	if (!g_msg.initialed) {
-		msg_statistics_init(&g_msg);
+	if (work->stats != NULL) {
+		work->stats->in++;
 	}
-	nng_atomic_inc64(g_msg.msg_in);
 #endif
 
-	work->pub_packet = (struct pub_packet_struct *) nng_zalloc(
-	    sizeof(struct pub_packet_struct));
+	work->pub_packet =
+	    work_arena_zget(work->arena, sizeof(struct pub_packet_struct));
+	if (work->pub_packet != NULL) {
+		work->pub_packet->arena = work->arena;
+	} else {
+		work->pub_packet = (struct pub_packet_struct *) nng_zalloc(
+		    sizeof(struct pub_packet_struct));
+	}
+	work->pub_packet->mpool = work->mpool;
 
-	result = decode_pub_message(work, proto);
+	result = decode_pub_view(work, proto);
 	if (SUCCESS != result) {
 		log_warn("decode message failed.");
 		return result;
@@ -1134,52 +1096,119 @@ handle_pub(nano_work *work, struct pipe_content *pipe_ct, uint8_t proto,
 	if (PUBLISH != work->pub_packet->fixed_header.packet_type) {
 		return MALFORMED_PACKET;
 	}
+#if defined(SUPP_BRIDGE_DEDUPE)
+	// came around a loop of bridges, the caller drops it
+	if (work->proto == PROTO_MQTT_BRIDGE &&
+	    work->pub_packet->bridge_mid != NULL &&
+	    bridge_dedupe_seen(
+	        work->pub_packet->bridge_mid, BRIDGE_DEDUPE_ID_LEN)) {
+		return NO_MATCHING_SUBSCRIBERS;
+	}
+#endif
 
 	topic        = work->pub_packet->var_header.publish.topic_name.body;
 	uint32_t len = work->pub_packet->var_header.publish.topic_name.len;
 
 	if (work->config != NULL && work->config->auth_http.enable) {
-		struct topic_queue *tq = topic_queue_init(topic, len);
-		if (tq == NULL) {
+		const char *cid =
+		    (const char *) conn_param_get_clientid(work->cparam);
+		const char *user =
+		    (const char *) conn_param_get_username(work->cparam);
+		int cached = auth_http_cache_get(cid, user, false, topic, len);
+		if (cached == AUTH_HTTP_DENY) {
+			log_error("Auth failed! publish packet!");
+			return NOT_AUTHORIZED;
+		}
+		struct topic_queue *tq = NULL;
+		if (cached == AUTH_HTTP_MISS &&
+		    (tq = pub_auth_topic(work, topic, len)) == NULL) {
 			log_error("topic_queue_init failed!");
-		} else {
+		} else if (tq != NULL) {
+			lat    = LATENCY_BEGIN(work);
 			int rv = nmq_auth_http_sub_pub(work->cparam, false, tq, &work->config->auth_http);
+			LATENCY_END(work, LATENCY_AUTH_HTTP, lat);
+			if (work->arena == NULL) {
+				topic_queue_release(tq);
+			}
+			auth_http_cache_put(cid, user, false, topic, len, rv == 0);
 			if (rv != 0) {
 				log_error("Auth failed! publish packet!");
-				topic_queue_release(tq);
 				return NOT_AUTHORIZED;
 			}
 		}
-
-		topic_queue_release(tq);
 	}
 
 	// deal with topic alias
 	if (proto == MQTT_PROTOCOL_VERSION_v5) {
-		property_data *pdata = property_get_value(
-		    work->pub_packet->var_header.publish.properties,
-		    TOPIC_ALIAS);
+		uint16_t alias = pub_packet_alias(work->pub_packet);
 		log_trace("len: %d, topic: %s", len, topic);
 		if (len > 0 && topic != NULL) {
-			if (pdata) {
+			if (alias != 0 && topic_alias_enabled()) {
+				int rv = topic_alias_set(
+				    work->pid.id, alias, topic, len);
+				if (rv != 0) {
+					return rv == NNG_EINVAL ? TOPIC_ALIAS_INVALID
+					                        : UNSPECIFIED_ERROR;
+				}
+			} else if (alias != 0) {
 				dbhash_insert_atpair(
-				    work->pid.id, pdata->p_value.u16, topic);
+				    work->pid.id, alias, topic);
 			}
 		} else {
-			if (pdata) {
+			if (alias != 0 && topic_alias_enabled()) {
+				char   buf[PUB_TOPIC_INLINE_LEN + 1];
+				char  *tp = buf;
+				size_t tlen;
+				int    rv = topic_alias_get(work->pid.id,
+				       alias, buf, sizeof(buf), &tlen);
+				bool   heap = false;
+				if (rv == NNG_ENOSPC) {
+					// too long to sit inline, hand over a copy
+					if ((tp = work_arena_get(
+					         work->arena, tlen + 1)) == NULL) {
+						tp   = nng_alloc(tlen + 1);
+						heap = true;
+					}
+					if (tp == NULL) {
+						return UNSPECIFIED_ERROR;
+					}
+					rv = topic_alias_get(work->pid.id,
+					    alias, tp, tlen + 1, &tlen);
+				}
+				if (rv != 0) {
+					if (heap) {
+						nng_free(tp, tlen + 1);
+					}
+					log_error("could not find "
+					          "topic by alias: %d",
+					    alias);
+					return TOPIC_FILTER_INVALID;
+				}
+				if (tp == buf) {
+					pub_packet_copy_topic(
+					    work->pub_packet, buf, tlen);
+				} else {
+					pub_topic_put(
+					    work->pub_packet, tp, tlen, heap);
+				}
+				len   = tlen;
+				topic = work->pub_packet->var_header.publish
+				            .topic_name.body;
+			} else if (alias != 0) {
 				const char *tp = dbhash_find_atpair(
-				    work->pid.id, pdata->p_value.u16);
+				    work->pid.id, alias);
 				if (tp) {
+					len = strlen(tp);
+					if (pub_packet_copy_topic(
+					        work->pub_packet, tp, len) != 0) {
+						return UNSPECIFIED_ERROR;
+					}
 					topic = work->pub_packet->var_header
-					            .publish.topic_name.body =
-					    nng_strdup(tp);
-					len = work->pub_packet->var_header
-					          .publish.topic_name.len =
-					    strlen(tp);
+					            .publish.topic_name.body;
 				} else {
 					log_error("could not find "
 					          "topic by alias: %d",
-					    pdata->p_value.u16);
+					    alias);
 					return TOPIC_FILTER_INVALID;
 				}
 			}
@@ -1203,11 +1232,24 @@ handle_pub(nano_work *work, struct pipe_content *pipe_ct, uint8_t proto,
 
 	topic = work->pub_packet->var_header.publish.topic_name.body;
 
+#if defined(SUPP_MSG_TRACE)
+	if (!is_event) {
+		pub_trace_begin(work, topic, proto);
+		if (work->config != NULL && work->config->auth_http.enable) {
+			MSG_TRACE_EVENT(work, TRACE_AUTH, 1);
+		}
+	}
+#endif
+
 #ifdef ACL_SUPP
 	if (!is_event && work->cparam) {
 		if (work->config->acl.enable) {
-			bool rv = auth_acl(
-			    work->config, ACL_PUB, work->cparam, topic);
+			lat     = LATENCY_BEGIN(work);
+			bool rv = auth_acl_pipe(work->config, ACL_PUB,
+			    work->pid.id, work->cparam, topic,
+			    pub_packet_levels(work->pub_packet));
+			LATENCY_END(work, LATENCY_ACL, lat);
+			MSG_TRACE_EVENT(work, TRACE_ACL, rv);
 			if (!rv) {
 				log_warn("acl deny");
 				if (work->config->acl_deny_action ==
@@ -1224,30 +1266,44 @@ handle_pub(nano_work *work, struct pipe_content *pipe_ct, uint8_t proto,
 		}
 	}
 #endif
-	cli_ctx_list = dbtree_find_clients(work->db, topic);
-
-	shared_cli_list = dbtree_find_shared_clients(work->db, topic);
-
-#ifdef STATISTICS
-	if (cli_ctx_list == NULL && shared_cli_list == NULL) {
-		nng_atomic_inc64(g_msg.msg_drop);
+#if defined(SUPP_TRAFFIC_STATS)
+	if (!is_event) {
+		traffic_client_in(work->pid.id,
+		    nng_msg_header_len(work->msg) + nng_msg_len(work->msg));
+		traffic_topic_add(work->traffic, topic, strlen(topic),
+		    work->pub_packet->payload.len);
 	}
 #endif
+	// One pid per subscriber pipe, shared subscriptions are deliveries
+	// of their own and stay as picked.
+	lat = LATENCY_BEGIN(work);
+	match_clients(work->db, topic, pipe_ct,
+	    work->cparam != NULL ? conn_param_get_clientid(work->cparam)
+	                         : NULL,
+	    work->arena);
+	LATENCY_END(work, LATENCY_MATCH, lat);
+	MSG_TRACE_EVENT(work, TRACE_MATCH, pipe_content_count(pipe_ct));
 
-	if (cli_ctx_list != NULL) {
-		foreach_client(cli_ctx_list, work, pipe_ct);
-	}
-	log_debug("pipe_info size: [%ld]", cvector_size(cli_ctx_list));
-	cvector_free(cli_ctx_list);
-
-	if (shared_cli_list != NULL) {
-		foreach_client(shared_cli_list, work, pipe_ct);
+#ifdef STATISTICS
+	if (work->stats != NULL) {
+		if (pipe_ct->pipes == NULL && pipe_ct->shared_pipes == NULL) {
+			work->stats->drop++;
+		} else {
+			work->stats->out += pipe_content_count(pipe_ct);
+		}
 	}
-	cvector_free(shared_cli_list);
+#endif
+	log_debug("pipe_info size: [%ld]", pipe_content_count(pipe_ct));
 
 #if ENABLE_RETAIN
 	// Exclude DISCONNECT_EV msg?
+	lat = LATENCY_BEGIN(work);
 	handle_pub_retain(work, topic);
+	LATENCY_END(work, LATENCY_RETAIN, lat);
+	if (work->pub_packet->fixed_header.retain) {
+		MSG_TRACE_EVENT(work, TRACE_RETAIN,
+		    work->pub_packet->payload.len > 0);
+	}
 #endif
 	return result;
 }
@@ -1260,9 +1316,12 @@ static void inline handle_pub_retain_sqlite(const nano_work *work, char *topic)
 {
 	if (work->pub_packet->fixed_header.retain) {
 		if (work->pub_packet->payload.len > 0) {
-			nng_mqtt_qos_db_set_retain(
-			    work->sqlite_db, topic, work->msg, work->proto_ver);
-		} else {
+			if (sqlite_commit_set_retain(
+			        topic, work->msg, work->proto_ver) != 0) {
+				nng_mqtt_qos_db_set_retain(work->sqlite_db, topic,
+				    work->msg, work->proto_ver);
+			}
+		} else if (sqlite_commit_remove_retain(topic) != 0) {
 			nng_mqtt_qos_db_remove_retain(work->sqlite_db, topic);
 		}
 	}
@@ -1270,6 +1329,39 @@ static void inline handle_pub_retain_sqlite(const nano_work *work, char *topic)
 
 #endif
 
+// Full decode for retained msgs the store can not track, check_msg_exp
+// needs the publish properties then.
+static int
+retain_msg_decode(nng_msg *msg, uint8_t proto_ver)
+{
+	if (proto_ver == MQTT_PROTOCOL_VERSION_v5) {
+		return nng_mqttv5_msg_decode(msg);
+	} else if (proto_ver == MQTT_PROTOCOL_VERSION_v311 ||
+	    proto_ver == MQTT_PROTOCOL_VERSION_v31) {
+		return nng_mqtt_msg_decode(msg);
+	}
+	return 0;
+}
+
+static uint32_t
+pub_expiry_interval(const nano_work *work)
+{
+	property      *prop = work->pub_packet->var_header.publish.properties;
+	property_data *data;
+
+	if (work->proto_ver != MQTT_PROTOCOL_VERSION_v5) {
+		return 0;
+	}
+	if (work->pub_packet->props_lazy) {
+		return work->pub_packet->expiry;
+	}
+	if (prop == NULL) {
+		return 0;
+	}
+	data = property_get_value(prop, MESSAGE_EXPIRY_INTERVAL);
+	return data != NULL ? data->p_value.u32 : 0;
+}
+
 static void inline handle_pub_retain(const nano_work *work, char *topic)
 {
 #if defined(NNG_SUPP_SQLITE)
@@ -1288,90 +1380,246 @@ static void inline handle_pub_retain(const nano_work *work, char *topic)
 			}
 			if (nng_msg_get_proto_data(ret) == NULL)
 				nng_mqtt_msg_proto_data_alloc(ret);
-			if (work->proto_ver == MQTT_PROTOCOL_VERSION_v5) {
-				if (nng_mqttv5_msg_decode(ret) != 0) {
-					log_warn("decode retain msg failed, drop msg");
-					nng_msg_free(ret);
-					return;
-				}
-			} else if (work->proto_ver == MQTT_PROTOCOL_VERSION_v311 ||
-					   work->proto_ver == MQTT_PROTOCOL_VERSION_v31) {
-				if (nng_mqtt_msg_decode(ret) != 0) {
-					log_warn("decode retain msg failed, "
-					         "drop msg");
-					nng_msg_free(ret);
-					return;
-				}
-			}
 			nng_mqtt_msg_set_connect_proto_version(ret, work->proto_ver);
+			// The store already knows the expiry and encodes the
+			// subscriber images from the raw body, so the decode
+			// roundtrip is only needed when it is unavailable.
+			if (retain_store_add(
+			        ret, topic, pub_expiry_interval(work)) != 0 &&
+			    retain_msg_decode(ret, work->proto_ver) != 0) {
+				log_warn("decode retain msg failed, drop msg");
+				nng_msg_free(ret);
+				return;
+			}
 			// Dont set Sub retain, which is preserved for differing bridging retain msg
 			old_ret = dbtree_insert_retain(work->db_ret, topic, ret);
+			retain_index_put(topic, ret);
+#if defined(SUPP_RETAIN_LOG)
+			retain_log_put(topic, work->proto_ver, nng_msg_header(ret),
+			    nng_msg_header_len(ret), nng_msg_body(ret),
+			    nng_msg_len(ret), pub_expiry_interval(work));
+#endif
 		} else {
 			log_debug("delete retain message");
 			old_ret = dbtree_delete_retain(work->db_ret, topic);
+			retain_index_remove(topic);
+#if defined(SUPP_RETAIN_LOG)
+			retain_log_del(topic);
+#endif
 		}
 
 		if (old_ret != NULL) {
 			log_debug("Overwrite retain message!");
+			retain_store_remove(old_ret);
 			nng_msg_free(old_ret);
 		}
 	}
 }
+
+void
+expire_retain_msg(void *db_ret, const char *topic, nng_msg *msg)
+{
+	nng_msg *ret = dbtree_delete_retain(db_ret, (char *) topic);
+
+	if (ret == NULL) {
+		return;
+	}
+	if (ret != msg) {
+		// replaced since the timer was due, the new one stays
+		if ((ret = dbtree_insert_retain(db_ret, (char *) topic, ret)) !=
+		    NULL) {
+			retain_store_remove(ret);
+			nng_msg_free(ret);
+		}
+		return;
+	}
+	log_debug("retain message of %s expired", topic);
+	retain_index_remove(topic);
+#if defined(SUPP_RETAIN_LOG)
+	retain_log_del(topic);
 #endif
+	retain_store_remove(ret);
+	nng_msg_free(ret);
+}
 
+#if defined(SUPP_RETAIN_LOG)
+void
+restore_retain_msg(void *db_ret, const retain_log_rec *rec)
+{
+	nng_msg *msg, *old_ret;
+
+	if (nng_msg_alloc(&msg, rec->body_len) != 0) {
+		log_error("Mem error");
+		return;
+	}
+	memcpy(nng_msg_body(msg), rec->body, rec->body_len);
+	nng_msg_header_append(msg, rec->head, rec->head_len);
+	nng_msg_set_remaining_len(msg, rec->body_len);
+	nng_msg_set_cmd_type(msg,
+	    rec->proto_ver == MQTT_PROTOCOL_VERSION_v5 ? CMD_PUBLISH_V5
+	                                               : CMD_PUBLISH);
+	nng_mqtt_msg_proto_data_alloc(msg);
+	nng_mqtt_msg_set_connect_proto_version(msg, rec->proto_ver);
+	if (retain_store_add(msg, (char *) rec->topic, rec->expiry) != 0 &&
+	    retain_msg_decode(msg, rec->proto_ver) != 0) {
+		log_warn("decode restored retain msg of %s failed", rec->topic);
+		nng_msg_free(msg);
+		return;
+	}
+	old_ret = dbtree_insert_retain(db_ret, (char *) rec->topic, msg);
+	retain_index_put(rec->topic, msg);
+	if (old_ret != NULL) {
+		retain_store_remove(old_ret);
+		nng_msg_free(old_ret);
+	}
+}
+#endif
+#endif
+
+
+// Keep a NUL right behind the body, so a payload borrowed from msg can still
+// be handed to the string based consumers (rule engine, webhook).
+static int
+pub_msg_terminate(nng_msg *msg)
+{
+	int rv;
+
+	if ((rv = nng_msg_append(msg, "", 1)) == 0) {
+		nng_msg_chop(msg, 1);
+	}
+	return rv;
+}
+
+static bool
+pub_payload_in_msg(struct pub_packet_struct *pub_packet, nng_msg *msg)
+{
+	uint8_t *body = nng_msg_body(msg);
+
+	return !pub_packet->payload_owned && pub_packet->payload.len > 0 &&
+	    pub_packet->payload.data >= body &&
+	    pub_packet->payload.data + pub_packet->payload.len <=
+	    body + nng_msg_len(msg);
+}
+
+// true when the body of msg still is exactly what would be encoded
+static bool
+pub_body_reusable(struct pub_packet_struct *pub_packet, uint8_t proto)
+{
+	if (pub_packet->dirty) {
+		return false;
+	}
+	if ((proto == MQTT_PROTOCOL_VERSION_v5) !=
+	    (pub_packet->proto == MQTT_PROTOCOL_VERSION_v5)) {
+		return false;
+	}
+	// undecoded properties are still exactly what came in
+	return proto != MQTT_PROTOCOL_VERSION_v5 ||
+	    pub_packet->var_header.publish.prop_len == 0 ||
+	    pub_packet->props_lazy;
+}
+
+void
+pub_packet_set_topic(
+    struct pub_packet_struct *pub_packet, char *topic, uint32_t len)
+{
+	pub_topic_put(pub_packet, topic, len, true);
+}
+
+// Copy topic into pub_packet, inline when it is short enough
+int
+pub_packet_copy_topic(
+    struct pub_packet_struct *pub_packet, const char *topic, uint32_t len)
+{
+	char *dst;
+
+	if (len > PUB_TOPIC_INLINE_LEN) {
+		if ((dst = work_arena_strndup(pub_packet->arena, topic, len)) !=
+		    NULL) {
+			pub_topic_put(pub_packet, dst, len, false);
+			return 0;
+		}
+		if ((dst = nng_alloc(len + 1)) == NULL) {
+			return NNG_ENOMEM;
+		}
+		memcpy(dst, topic, len);
+		dst[len] = '\0';
+		pub_packet_set_topic(pub_packet, dst, len);
+		return 0;
+	}
+	if (pub_packet->topic_owned &&
+	    pub_packet->var_header.publish.topic_name.body != NULL) {
+		nng_free(pub_packet->var_header.publish.topic_name.body,
+		    pub_packet->var_header.publish.topic_name.len + 1);
+	}
+	memmove(pub_packet->topic_inline, topic, len);
+	pub_packet->topic_inline[len]                  = '\0';
+	pub_packet->var_header.publish.topic_name.body = pub_packet->topic_inline;
+	pub_packet->var_header.publish.topic_name.len  = len;
+	pub_packet->topic_owned                        = false;
+	pub_packet->dirty                              = true;
+	pub_packet->levels.n                           = 0;
+	return 0;
+}
+
+const topic_levels *
+pub_packet_levels(struct pub_packet_struct *pub_packet)
+{
+	if (pub_packet->levels.n == 0) {
+		topic_split(pub_packet->var_header.publish.topic_name.body,
+		    pub_packet->var_header.publish.topic_name.len,
+		    &pub_packet->levels);
+	}
+	return &pub_packet->levels;
+}
 
 void
 free_pub_packet(struct pub_packet_struct *pub_packet)
 {
 	if (pub_packet != NULL) {
 		if (pub_packet->fixed_header.packet_type == PUBLISH) {
-			if (pub_packet->var_header.publish.topic_name.body !=
-			        NULL &&
-			    pub_packet->var_header.publish.topic_name.len >
-			        0) {
+			if (pub_packet->topic_owned &&
+			    pub_packet->var_header.publish.topic_name.body !=
+			        NULL) {
 				nng_free(pub_packet->var_header.publish
 				             .topic_name.body,
 				    pub_packet->var_header.publish.topic_name
 				            .len +
 				        1);
-				pub_packet->var_header.publish.topic_name
-				    .body = NULL;
-				pub_packet->var_header.publish.topic_name.len =
-				    0;
 				log_debug("free topic");
 			}
+			pub_packet->var_header.publish.topic_name.body = NULL;
+			pub_packet->var_header.publish.topic_name.len  = 0;
 
-			if (pub_packet->var_header.publish.prop_len > 0) {
+			if (pub_packet->var_header.publish.prop_len > 0 &&
+			    pub_packet->var_header.publish.properties != NULL) {
 				property_free(
 				    pub_packet->var_header.publish.properties);
 				pub_packet->var_header.publish.prop_len = 0;
 				log_debug("free properties");
 			}
 
-			if (pub_packet->payload.len > 0 &&
+			if (pub_packet->payload_owned &&
 			    pub_packet->payload.data != NULL) {
 				nng_free(pub_packet->payload.data,
 				    pub_packet->payload.len + 1);
-				pub_packet->payload.data = NULL;
-				pub_packet->payload.len  = 0;
 				log_debug("free payload");
 			}
+			pub_packet->payload.data = NULL;
+			pub_packet->payload.len  = 0;
 		}
 
-		nng_free(pub_packet, sizeof(struct pub_packet_struct));
+		if (pub_packet->alias_props != NULL) {
+			msg_pool_put(pub_packet->mpool, pub_packet->alias_props);
+		}
+		// the arena of the work takes it back with the next message
+		if (pub_packet->arena == NULL) {
+			nng_free(pub_packet, sizeof(struct pub_packet_struct));
+		}
 		pub_packet = NULL;
 		log_debug("free pub_packet");
 	}
 }
 
-void
-free_msg_infos(mqtt_msg_info *msg_infos)
-{
-	if (msg_infos != NULL) {
-		free(msg_infos);
-	}
-}
-
 static uint32_t
 append_bytes_with_type(
     nng_msg *msg, uint8_t type, uint8_t *content, uint32_t len)
@@ -1386,6 +1634,73 @@ append_bytes_with_type(
 	return 1;
 }
 
+// topic name, packet identifier and properties of PUBLISH
+static bool
+encode_pub_varheader(nng_msg *msg, nano_work *work, uint8_t proto)
+{
+	// topic name
+	if (work->pub_packet->var_header.publish.topic_name.len > 0) {
+		nng_msg_append_u16(msg,
+		    work->pub_packet->var_header.publish.topic_name.len);
+		nng_msg_append(msg,
+		    work->pub_packet->var_header.publish.topic_name.body,
+		    work->pub_packet->var_header.publish.topic_name.len);
+	}
+
+	// identifier
+	if (work->pub_packet->fixed_header.qos > 0) {
+		nng_msg_append_u16(
+		    msg, work->pub_packet->var_header.publish.packet_id);
+	}
+	log_debug("after topic and id len in msg already [%ld]",
+	    nng_msg_len(msg));
+
+#if SUPPORT_MQTT5_0
+	if (MQTT_PROTOCOL_VERSION_v5 == proto) {
+		if (encode_properties(msg,
+		        work->pub_packet->var_header.publish.properties,
+		        CMD_PUBLISH) != 0) {
+			return false;
+		}
+	}
+#endif
+	return true;
+}
+
+#if defined(SUPP_PLUGIN)
+/*
+ * Add the user property of the HOOK_USER_PROPERTY plugins to a v5 PUBLISH,
+ * asked once per message however often and for whomever it is encoded.
+ */
+void
+pub_packet_plugin_property(nano_work *work, nng_msg *msg)
+{
+	struct pub_packet_struct *pp           = work->pub_packet;
+	char                     *uproperty[2] = { NULL, NULL };
+
+	if (pp == NULL || work->user_property != NULL ||
+	    nng_msg_cmd_type(msg) != CMD_PUBLISH_V5 ||
+	    !plugin_hook_has(HOOK_USER_PROPERTY)) {
+		return;
+	}
+	plugin_hook_call(HOOK_USER_PROPERTY, uproperty);
+	if (uproperty[0] == NULL || uproperty[1] == NULL) {
+		free(uproperty[0]);
+		free(uproperty[1]);
+		return;
+	}
+	work->user_property = mqtt_property_set_value_strpair(USER_PROPERTY,
+	    uproperty[0], strlen(uproperty[0]), uproperty[1],
+	    strlen(uproperty[1]), false);
+	if (pub_packet_properties(pp, msg) == NULL) {
+		pp->var_header.publish.properties = property_alloc();
+	}
+	property_append(pp->var_header.publish.properties, work->user_property);
+	// the properties on the wire no longer are the ones to send
+	pp->dirty = true;
+}
+#endif
+
 /**
  * @brief encode dest_msg with work.
  * @param dest_msg nng_msg
@@ -1397,17 +1712,15 @@ bool
 encode_pub_message(
     nng_msg *dest_msg, nano_work *work, mqtt_control_packet_types cmd)
 {
-	uint8_t  tmp[4]     = { 0 };
-	uint32_t arr_len    = 0;
-	int      append_res = 0;
-	uint8_t  proto      = 0;
-	uint32_t buf;
+	uint8_t  tmp[4]  = { 0 };
+	uint32_t arr_len = 0;
+	uint8_t  proto   = 0;
+
+	struct pub_packet_struct *pp = work->pub_packet;
 
 	log_debug("start encode message");
 	if (dest_msg == NULL)
 		return false;
-	nng_msg_clear(dest_msg);
-	nng_msg_header_clear(dest_msg);
 	if (nng_msg_cmd_type(dest_msg) == CMD_PUBLISH_V5) {
 		proto = MQTT_PROTOCOL_VERSION_v5;
 	} else if (nng_msg_cmd_type(dest_msg) == CMD_PUBLISH) {
@@ -1416,96 +1729,70 @@ encode_pub_message(
 
 	switch (cmd) {
 	case PUBLISH:
-		/*fixed header*/
-		work->pub_packet->fixed_header.packet_type = cmd;
-		append_res = nng_msg_header_append(
-		    dest_msg, (uint8_t *) &work->pub_packet->fixed_header, 1);
-
-		/*variable header*/
-		// topic name
-		if (work->pub_packet->var_header.publish.topic_name.len > 0) {
-			append_res = nng_msg_append_u16(dest_msg,
-			    work->pub_packet->var_header.publish.topic_name
-			        .len);
-
-			append_res = nng_msg_append(dest_msg,
-			    work->pub_packet->var_header.publish.topic_name
-			        .body,
-			    work->pub_packet->var_header.publish.topic_name
-			        .len);
-		}
-
-		// identifier
-		if (work->pub_packet->fixed_header.qos > 0) {
-			append_res = nng_msg_append_u16(dest_msg,
-			    work->pub_packet->var_header.publish.packet_id);
+		if (pp->props_lazy && (!pub_payload_in_msg(pp, dest_msg) ||
+		                          !pub_body_reusable(pp, proto))) {
+			// last chance, the body is rebuilt from here
+			pub_packet_properties(pp, dest_msg);
 		}
-		log_debug("after topic and id len in msg already [%ld]",
-		    nng_msg_len(dest_msg));
-
-#if SUPPORT_MQTT5_0
-		if (MQTT_PROTOCOL_VERSION_v5 == proto) {
-#if defined(SUPP_PLUGIN)
-			char *uproperty[2];
-			uproperty[0] = NULL;
-			uproperty[1] = NULL;
-			plugin_hook_call(HOOK_USER_PROPERTY, uproperty);
-			if (uproperty[0] != NULL && uproperty[1] != NULL) {
-				work->user_property =
-				    mqtt_property_set_value_strpair(USER_PROPERTY,
-				        uproperty[0], strlen(uproperty[0]),
-				        uproperty[1], strlen(uproperty[1]),
-				        false);
-
-				if (work->pub_packet->var_header.publish
-				        .properties == NULL) {
-					work->pub_packet->var_header.publish
-					    .properties = property_alloc();
-				}
-
-				property_append(work->pub_packet->var_header
-							.publish.properties, work->user_property);
+		nng_msg_header_clear(dest_msg);
+		if (!pub_payload_in_msg(pp, dest_msg)) {
+			nng_msg_clear(dest_msg);
+			if (!encode_pub_varheader(dest_msg, work, proto)) {
+				return false;
 			}
-
-#endif
-			int rv;
-			rv = encode_properties(dest_msg,
-			    work->pub_packet->var_header.publish.properties,
-				CMD_PUBLISH);
-
-			if (rv != 0) {
+			// payload
+			if (pp->payload.len > 0) {
+				nng_msg_append(dest_msg, pp->payload.data,
+				    pp->payload.len);
+			}
+		} else if (!pub_body_reusable(pp, proto)) {
+			// Payload is a view into dest_msg: re-encode only
+			// the variable header in front of it.
+			nng_msg *vh;
+			uint32_t off = (uint32_t) (pp->payload.data -
+			    (uint8_t *) nng_msg_body(dest_msg));
+
+			if (msg_pool_get(work->mpool, &vh, 0) != 0) {
 				return false;
 			}
-
-			// rv = encode_properties(dest_msg, NULL);
-			if (nng_msg_get_proto_data(dest_msg) == NULL) {
-				// decoded in handle_pub_retain. Protocol layer gonna take use of property
-				nng_mqtt_msg_proto_data_alloc(dest_msg);
+			if (!encode_pub_varheader(vh, work, proto)) {
+				msg_pool_put(work->mpool, vh);
+				return false;
 			}
+			nng_msg_trim(dest_msg, off);
+			nng_msg_insert(
+			    dest_msg, nng_msg_body(vh), nng_msg_len(vh));
+			msg_pool_put(work->mpool, vh);
+			pub_msg_terminate(dest_msg);
+			pp->payload.data = (uint8_t *) nng_msg_body(dest_msg) +
+			    nng_msg_len(dest_msg) - pp->payload.len;
+			nng_msg_set_payload_ptr(dest_msg, pp->payload.data);
 		}
-#endif
+		// else the body already carries this exact publish
 
-		// payload
-		if (work->pub_packet->payload.len > 0) {
-			// nng_msg_set_payload_ptr(msg, nng_msg_body());
-			append_res = nng_msg_append(dest_msg,
-			    work->pub_packet->payload.data,
-			    work->pub_packet->payload.len);
+#if SUPPORT_MQTT5_0
+		if (MQTT_PROTOCOL_VERSION_v5 == proto &&
+		    nng_msg_get_proto_data(dest_msg) == NULL) {
+			// decoded in handle_pub_retain. Protocol layer gonna
+			// take use of property
+			nng_mqtt_msg_proto_data_alloc(dest_msg);
 		}
-
+#endif
 		log_debug("after payload len in msg already [%ld]",
 		    nng_msg_len(dest_msg));
 
-		work->pub_packet->fixed_header.remain_len =
-		    nng_msg_len(dest_msg);
-		arr_len = put_var_integer(
-		    tmp, work->pub_packet->fixed_header.remain_len);
-		append_res = nng_msg_header_append(dest_msg, tmp, arr_len);
+		/*fixed header*/
+		pp->fixed_header.packet_type = cmd;
+		nng_msg_header_append(
+		    dest_msg, (uint8_t *) &pp->fixed_header, 1);
+		pp->fixed_header.remain_len = nng_msg_len(dest_msg);
+		arr_len = put_var_integer(tmp, pp->fixed_header.remain_len);
+		nng_msg_header_append(dest_msg, tmp, arr_len);
 		nng_msg_set_remaining_len(
-		    dest_msg, work->pub_packet->fixed_header.remain_len);
+		    dest_msg, pp->fixed_header.remain_len);
 		log_debug("header len [%ld] remain len [%d]\n",
 		    nng_msg_header_len(dest_msg),
-		    work->pub_packet->fixed_header.remain_len);
+		    pp->fixed_header.remain_len);
 		break;
 
 	case PUBREL:
@@ -1516,6 +1803,8 @@ encode_pub_message(
 		nng_msg_set_cmd_type(dest_msg, CMD_PUBREC);
 	case PUBCOMP:
 		log_debug("encode %d message", cmd);
+		nng_msg_clear(dest_msg);
+		nng_msg_header_clear(dest_msg);
 		nng_msg_set_cmd_type(dest_msg, CMD_PUBCOMP);
 		struct pub_packet_struct pub_response = {
 			.fixed_header.packet_type = cmd,
@@ -1548,6 +1837,8 @@ encode_pub_message(
 		}
 		break;
 	default:
+		nng_msg_clear(dest_msg);
+		nng_msg_header_clear(dest_msg);
 		break;
 	}
 
@@ -1555,23 +1846,369 @@ encode_pub_message(
 	return true;
 }
 
-/**
- * @brief decode work->msg to fill work->pub_packet.
- * @param work nano_work
- * @param proto check protocol verison, more need to be done in MQTTv5
- * @return reason_code
+// Length of the Variable Byte Integer at p, 0 if malformed.
+static uint32_t
+pub_var_int_len(const uint8_t *p, size_t len, uint32_t *value)
+{
+	uint32_t pos = 0;
+
+	*value = 0;
+	while (pos < len && pos < 4) {
+		*value |= (uint32_t) (p[pos] & 0x7f) << (7 * pos);
+		if ((p[pos++] & 0x80) == 0) {
+			return pos;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Property section shared by every aliased copy of pp, its length included,
+ * encoded on the first copy. The alias of a subscriber is patched into
+ * the two bytes at alias_slot. A Topic Alias of the publisher is its own
+ * and takes the slot, found by encoding it once with each byte value.
  */
-reason_code
-decode_pub_message(nano_work *work, uint8_t proto)
+static int
+pub_alias_template(struct pub_packet_struct *pp, nng_msg *smsg)
+{
+	property      *props = NULL;
+	property_data *pd;
+	nng_msg       *t  = NULL;
+	nng_msg       *pm = NULL;
+	uint8_t        tmp[4];
+	uint8_t        prop[3] = { TOPIC_ALIAS, 0, 0 };
+	uint8_t       *a;
+	uint8_t       *b;
+	uint32_t       plen = 0;
+	uint32_t       pos  = 0;
+	uint32_t       len;
+	uint32_t       i;
+	uint16_t       own;
+	int            rv;
+
+	if (pp->alias_props != NULL) {
+		return 0;
+	}
+	if ((rv = msg_pool_get(pp->mpool, &t, 0)) != 0 ||
+	    (rv = msg_pool_get(pp->mpool, &pm, 0)) != 0) {
+		goto out;
+	}
+	if (pp->props_lazy && pp->topic_alias == 0) {
+		// unchanged, the raw properties follow ours verbatim
+		a = (uint8_t *) nng_msg_body(smsg) + pp->prop_pos;
+		b = a + pub_var_int_len(a, nng_msg_len(smsg) - pp->prop_pos,
+		            &plen);
+		nng_msg_append(pm, b, plen);
+	} else if (pp->proto == MQTT_PROTOCOL_VERSION_v5) {
+		props = pub_packet_properties(pp, smsg);
+	}
+	pd = props != NULL ? property_get_value(props, TOPIC_ALIAS) : NULL;
+	if (pd == NULL) {
+		if (props != NULL &&
+		    (encode_properties(pm, props, CMD_PUBLISH) != 0 ||
+		        (pos = pub_var_int_len(nng_msg_body(pm),
+		                 nng_msg_len(pm), &plen)) == 0)) {
+			rv = NNG_EPROTO;
+			goto out;
+		}
+		len = put_var_integer(tmp, plen + sizeof(prop));
+		nng_msg_append(t, tmp, len);
+		nng_msg_append(t, prop, sizeof(prop));
+		if (plen > 0) {
+			nng_msg_append(t, (uint8_t *) nng_msg_body(pm) + pos, plen);
+		}
+		pp->alias_slot  = len + 1;
+		pp->alias_props = t;
+		t               = NULL;
+		goto out;
+	}
+	own             = pd->p_value.u16;
+	pd->p_value.u16 = 0;
+	if ((rv = encode_properties(t, props, CMD_PUBLISH)) == 0) {
+		pd->p_value.u16 = 0xffff;
+		rv              = encode_properties(pm, props, CMD_PUBLISH);
+	}
+	pd->p_value.u16 = own;
+	if (rv != 0) {
+		goto out;
+	}
+	len = nng_msg_len(t);
+	a   = nng_msg_body(t);
+	b   = nng_msg_body(pm);
+	i   = 0;
+	while (i < len && a[i] == b[i]) {
+		i++;
+	}
+	if (len != nng_msg_len(pm) || i + 2 > len || a[i] != 0 ||
+	    a[i + 1] != 0 || b[i] != 0xff || b[i + 1] != 0xff ||
+	    memcmp(a + i + 2, b + i + 2, len - i - 2) != 0) {
+		rv = NNG_EPROTO;
+		goto out;
+	}
+	pp->alias_slot  = i;
+	pp->alias_props = t;
+	t               = NULL;
+
+out:
+	if (t != NULL) {
+		msg_pool_put(pp->mpool, t);
+	}
+	if (pm != NULL) {
+		msg_pool_put(pp->mpool, pm);
+	}
+	return rv;
+}
+
+/*
+ * A v5 copy of smsg for one subscriber, carrying alias as its Topic Alias
+ * and the topic only when the subscriber does not know the alias yet. Any
+ * alias the publisher used is its own and gets replaced. Only QoS 0 is
+ * sent this way, nothing retransmits it once aliases have moved on.
+ */
+nng_msg *
+encode_pub_alias(nng_msg *smsg, nano_work *work, uint16_t alias, bool known)
+{
+	struct pub_packet_struct *pp  = work->pub_packet;
+	nng_msg                  *msg = NULL;
+	nng_msg                  *vh  = NULL;
+	uint8_t                   tmp[4];
+	uint8_t                  *slot;
+	uint32_t                  arr_len;
+
+	if (pub_alias_template(pp, smsg) != 0 ||
+	    nng_msg_dup(&msg, smsg) != 0 ||
+	    msg_pool_get(pp->mpool, &vh, 0) != 0) {
+		goto fail;
+	}
+	if (known) {
+		nng_msg_append_u16(vh, 0);
+	} else {
+		nng_msg_append_u16(vh, pp->var_header.publish.topic_name.len);
+		nng_msg_append(vh, pp->var_header.publish.topic_name.body,
+		    pp->var_header.publish.topic_name.len);
+	}
+	if (pp->fixed_header.qos > 0) {
+		nng_msg_append_u16(vh, pp->var_header.publish.packet_id);
+	}
+	arr_len = nng_msg_len(vh);
+	if (nng_msg_append(vh, nng_msg_body(pp->alias_props),
+	        nng_msg_len(pp->alias_props)) != 0) {
+		goto fail;
+	}
+	slot    = (uint8_t *) nng_msg_body(vh) + arr_len + pp->alias_slot;
+	slot[0] = alias >> 8;
+	slot[1] = alias & 0xff;
+
+	nng_msg_header_clear(msg);
+	if (pub_payload_in_msg(pp, smsg)) {
+		// the copy already holds the payload, only the variable
+		// header in front of it is replaced
+		nng_msg_trim(msg,
+		    (size_t) (pp->payload.data - (uint8_t *) nng_msg_body(smsg)));
+		if (nng_msg_insert(msg, nng_msg_body(vh), nng_msg_len(vh)) !=
+		    0) {
+			goto fail;
+		}
+	} else {
+		nng_msg_clear(msg);
+		nng_msg_append(msg, nng_msg_body(vh), nng_msg_len(vh));
+		if (pp->payload.len > 0) {
+			nng_msg_append(msg, pp->payload.data, pp->payload.len);
+		}
+	}
+	msg_pool_put(pp->mpool, vh);
+
+	nng_msg_set_cmd_type(msg, CMD_PUBLISH_V5);
+	if (nng_msg_get_proto_data(msg) == NULL) {
+		nng_mqtt_msg_proto_data_alloc(msg);
+	}
+	pp->fixed_header.packet_type = PUBLISH;
+	pp->fixed_header.remain_len  = nng_msg_len(msg);
+	nng_msg_header_append(msg, (uint8_t *) &pp->fixed_header, 1);
+	arr_len = put_var_integer(tmp, pp->fixed_header.remain_len);
+	nng_msg_header_append(msg, tmp, arr_len);
+	nng_msg_set_remaining_len(msg, pp->fixed_header.remain_len);
+	return msg;
+
+fail:
+	if (vh != NULL) {
+		msg_pool_put(pp->mpool, vh);
+	}
+	if (msg != NULL) {
+		nng_msg_free(msg);
+	}
+	return NULL;
+}
+
+// A UTF-8 string property at p, its length in *n, false if malformed.
+static bool
+pub_prop_str(const uint8_t *p, const uint8_t *end, uint32_t *n)
+{
+	uint32_t len;
+
+	if (end - p < 2) {
+		return false;
+	}
+	NNI_GET16(p, len);
+	if ((uint32_t) (end - p - 2) < len ||
+	    utf8_check((const char *) p + 2, len) != 0) {
+		return false;
+	}
+	*n = len + 2;
+	return true;
+}
+
+/*
+ * Walk the PUBLISH properties in p without decoding them. True when each
+ * is one a client may send and well formed, so that the checks of
+ * check_properties have nothing to find, anything else is left to them
+ * and the full decode. Topic Alias and Message Expiry Interval are
+ * picked up on the way.
+ */
+static bool
+pub_props_scan(struct pub_packet_struct *pp, const uint8_t *p, uint32_t len)
+{
+	const uint8_t *end  = p + len;
+	uint64_t       seen = 0;
+	uint32_t       n;
+	uint32_t       m;
+	uint8_t        id;
+
+	pp->topic_alias = 0;
+	pp->expiry      = 0;
+	pp->traceparent = NULL;
+	pp->bridge_mid  = NULL;
+	pp->bridge_zip  = NULL;
+	while (p < end) {
+		id = *p++;
+		if (id != USER_PROPERTY) {
+			if (id >= 64 || (seen & ((uint64_t) 1 << id)) != 0) {
+				return false;
+			}
+			seen |= (uint64_t) 1 << id;
+		}
+		switch (id) {
+		case PAYLOAD_FORMAT_INDICATOR:
+			// a UTF-8 payload is for the full check to look at
+			if (p >= end || *p != 0) {
+				return false;
+			}
+			n = 1;
+			break;
+		case MESSAGE_EXPIRY_INTERVAL:
+			if (end - p < 4) {
+				return false;
+			}
+			NNI_GET32(p, pp->expiry);
+			n = 4;
+			break;
+		case TOPIC_ALIAS:
+			if (end - p < 2) {
+				return false;
+			}
+			NNI_GET16(p, pp->topic_alias);
+			if (pp->topic_alias == 0) {
+				return false;
+			}
+			n = 2;
+			break;
+		case CONTENT_TYPE:
+			if (!pub_prop_str(p, end, &n)) {
+				return false;
+			}
+			break;
+		case RESPONSE_TOPIC:
+			if (!pub_prop_str(p, end, &n) ||
+			    memchr(p + 2, '+', n - 2) != NULL ||
+			    memchr(p + 2, '#', n - 2) != NULL) {
+				return false;
+			}
+			break;
+		case CORRELATION_DATA:
+			if (end - p < 2) {
+				return false;
+			}
+			NNI_GET16(p, n);
+			if ((uint32_t) (end - p - 2) < n) {
+				return false;
+			}
+			n += 2;
+			break;
+		case USER_PROPERTY:
+			if (!pub_prop_str(p, end, &n) ||
+			    !pub_prop_str(p + n, end, &m)) {
+				return false;
+			}
+			if (n == 13 && m == TRACE_PARENT_LEN + 2 &&
+			    memcmp(p + 2, "traceparent", 11) == 0) {
+				pp->traceparent = p + n + 2;
+			} else if (n == sizeof(BRIDGE_DEDUPE_KEY) + 1 &&
+			    m == BRIDGE_DEDUPE_ID_LEN + 2 &&
+			    memcmp(p + 2, BRIDGE_DEDUPE_KEY, n - 2) == 0) {
+				pp->bridge_mid = p + n + 2;
+			} else if (n == sizeof(BRIDGE_ZIP_KEY) + 1 &&
+			    m == BRIDGE_ZIP_VALUE_LEN + 2 &&
+			    memcmp(p + 2, BRIDGE_ZIP_KEY, n - 2) == 0 &&
+			    memcmp(p + n + 2, BRIDGE_ZIP_ZLIB,
+			        BRIDGE_ZIP_VALUE_LEN) == 0) {
+				pp->bridge_zip = p + n + 2;
+			}
+			n += m;
+			break;
+		default:
+			// Subscription Identifier and the rest
+			return false;
+		}
+		p += n;
+	}
+	return true;
+}
+
+property *
+pub_packet_properties(struct pub_packet_struct *pub_packet, nng_msg *msg)
+{
+	uint32_t pos;
+
+	if (pub_packet->props_lazy) {
+		pos                    = pub_packet->prop_pos;
+		pub_packet->props_lazy = false;
+		pub_packet->var_header.publish.properties = decode_properties(
+		    msg, &pos, &pub_packet->var_header.publish.prop_len, true);
+	}
+	return pub_packet->var_header.publish.properties;
+}
+
+uint16_t
+pub_packet_alias(struct pub_packet_struct *pub_packet)
+{
+	property_data *pd;
+
+	if (pub_packet->props_lazy) {
+		return pub_packet->topic_alias;
+	}
+	pd = property_get_value(
+	    pub_packet->var_header.publish.properties, TOPIC_ALIAS);
+	return pd != NULL ? pd->p_value.u16 : 0;
+}
+
+/*
+ * Fill work->pub_packet from work->msg. With borrow set the payload is
+ * left in the message body instead of being copied.
+ */
+static reason_code
+decode_pub(nano_work *work, uint8_t proto, bool borrow)
 {
 	uint32_t pos      = 0;
 	uint32_t used_pos = 0;
-	uint32_t len, len_of_varint;
-	bool     is_copy = false;
+	uint32_t len;
 
 	nng_msg                  *msg        = work->msg;
 	struct pub_packet_struct *pub_packet = work->pub_packet;
 
+	if (borrow && pub_msg_terminate(msg) != 0) {
+		borrow = false;
+	}
+
 	uint8_t *msg_body = nng_msg_body(msg);
 	size_t   msg_len  = nng_msg_len(msg);
 
@@ -1580,6 +2217,8 @@ decode_pub_message(nano_work *work, uint8_t proto)
 	pub_packet->fixed_header =
 	    *(struct fixed_header *) nng_msg_header(msg);
 	pub_packet->fixed_header.remain_len = nng_msg_remaining_len(msg);
+	pub_packet->proto                   = proto;
+	pub_packet->dirty                   = false;
 
 	log_debug(
 	    "cmd: %d, retain: %d, qos: %d, dup: %d, remaining length: %d",
@@ -1596,35 +2235,39 @@ decode_pub_message(nano_work *work, uint8_t proto)
 	case PUBLISH:
 		// variable header
 		// topic length
-		pub_packet->var_header.publish.topic_name.body =
-		    (char *) copyn_utf8_str(msg_body, &pos, (int *) &len, msg_len);
-		if (len >= 0)
-			// topic could be NULL here (topic alias)
-			pub_packet->var_header.publish.topic_name.len = len;
-		else {
+		if (msg_len < 2) {
 			log_warn("Invalid msg: Protocol error!");
 			return PROTOCOL_ERROR;
 		}
-
-		if (pub_packet->var_header.publish.topic_name.body != NULL) {
-			if (strchr(
-			        pub_packet->var_header.publish.topic_name.body,
-			        '+') != NULL ||
-			    strchr(
-			        pub_packet->var_header.publish.topic_name.body,
-			        '#') != NULL) {
-
-				// protocol error
-				log_error(
-				    "protocol error in topic:[%s], len: [%d]",
-				    pub_packet->var_header.publish.topic_name
-				        .body,
-				    pub_packet->var_header.publish.topic_name
-				        .len);
-
+		NNI_GET16(msg_body, len);
+		pos = 2;
+		if (len > msg_len - pos) {
+			log_warn("Invalid msg: Protocol error!");
+			return PROTOCOL_ERROR;
+		}
+		// topic could be empty here (topic alias)
+		if (len > 0) {
+			// UTF-8, wildcards and the levels in one pass
+			if (topic_scan((const char *) msg_body + pos, len,
+			        &pub_packet->levels) != 0) {
+				log_error("protocol error in topic:[%.*s], "
+				          "len: [%d]",
+				    len, msg_body + pos, len);
 				return PROTOCOL_ERROR;
 			}
+			char *topic = pub_packet->topic_inline;
+			if (len > PUB_TOPIC_INLINE_LEN) {
+				if ((topic = nng_alloc(len + 1)) == NULL) {
+					return UNSPECIFIED_ERROR;
+				}
+				pub_packet->topic_owned = true;
+			}
+			memcpy(topic, msg_body + pos, len);
+			topic[len] = '\0';
+			pub_packet->var_header.publish.topic_name.body = topic;
+			pos += len;
 		}
+		pub_packet->var_header.publish.topic_name.len = len;
 
 		// TODO if topic_len = 0 && mqtt_version = 5.0, search topic
 		// alias from nano_db
@@ -1636,6 +2279,9 @@ decode_pub_message(nano_work *work, uint8_t proto)
 		    pub_packet->fixed_header.qos);
 
 		if (pub_packet->fixed_header.qos > 0) {
+			if (pos + 2 > msg_len) {
+				return PROTOCOL_ERROR;
+			}
 			NNI_GET16(msg_body + pos,
 			    pub_packet->var_header.publish.packet_id);
 			log_debug("identifier: [%d]",
@@ -1644,25 +2290,49 @@ decode_pub_message(nano_work *work, uint8_t proto)
 		}
 		used_pos = pos;
 
+		pub_packet->traceparent   = NULL;
+		pub_packet->bridge_mid    = NULL;
+		pub_packet->bridge_zip    = NULL;
+		pub_packet->props_scanned = false;
 		if (MQTT_PROTOCOL_VERSION_v5 == proto) {
-			// we copy property each time to avoid memcpy_param_overlap
-			// although it reduce overall performance
-			pub_packet->var_header.publish.properties =
-			    decode_properties(msg, &pos,
-			        &pub_packet->var_header.publish.prop_len,
-			        true);
-			log_debug("property len: %d",
-			    pub_packet->var_header.publish.prop_len);
-
-			if (pub_packet->var_header.publish.properties) {
-				if (check_properties(
-				        pub_packet->var_header.publish
-				            .properties, msg) != 0) {
-					// check if subid exist in publish msg from client
-				    // property_get_value(pub_packet->var_header
-				    //                        .publish.properties,
-				    //     SUBSCRIPTION_IDENTIFIER) != NULL
-					return PROTOCOL_ERROR;
+			uint32_t plen = 0;
+			uint32_t vlen = pub_var_int_len(
+			    msg_body + pos, msg_len - pos, &plen);
+
+			// most publishes are never asked for their properties,
+			// they stay in the body until somebody does
+			if (vlen > 0 && plen <= msg_len - pos - vlen &&
+			    pub_props_scan(
+			        pub_packet, msg_body + pos + vlen, plen)) {
+				pub_packet->props_lazy    = plen > 0;
+				pub_packet->props_scanned = true;
+				pub_packet->prop_pos      = pos;
+				pub_packet->var_header.publish.prop_len = plen;
+				pos += vlen + plen;
+			} else {
+				pub_packet->props_lazy  = false;
+				pub_packet->traceparent = NULL;
+				pub_packet->bridge_mid  = NULL;
+				pub_packet->bridge_zip  = NULL;
+				// we copy property each time to avoid memcpy_param_overlap
+				// although it reduce overall performance
+				pub_packet->var_header.publish.properties =
+				    decode_properties(msg, &pos,
+				        &pub_packet->var_header.publish.prop_len,
+				        true);
+				log_debug("property len: %d",
+				    pub_packet->var_header.publish.prop_len);
+
+				if (pub_packet->var_header.publish.properties) {
+					if (check_properties(
+					        pub_packet->var_header.publish
+					            .properties, msg) != 0) {
+						// check if subid exist in publish msg from client
+					    // property_get_value(pub_packet->var_header
+					    //                        .publish.properties,
+					    //     SUBSCRIPTION_IDENTIFIER) != NULL
+						return PROTOCOL_ERROR;
+					}
 				}
 			}
 		}
@@ -1681,11 +2351,20 @@ decode_pub_message(nano_work *work, uint8_t proto)
 		nng_msg_set_payload_ptr(msg, msg_body + pos);
 
 		if (pub_packet->payload.len > 0) {
-			pub_packet->payload.data =
-			    nng_zalloc(pub_packet->payload.len + 1);
-			memcpy(pub_packet->payload.data,
-			    (uint8_t *) (msg_body + pos),
-			    pub_packet->payload.len);
+			if (borrow) {
+				pub_packet->payload.data = msg_body + pos;
+			} else {
+				pub_packet->payload.data =
+				    nng_zalloc(pub_packet->payload.len + 1);
+				if (pub_packet->payload.data == NULL) {
+					pub_packet->payload.len = 0;
+					return UNSPECIFIED_ERROR;
+				}
+				memcpy(pub_packet->payload.data,
+				    (uint8_t *) (msg_body + pos),
+				    pub_packet->payload.len);
+				pub_packet->payload_owned = true;
+			}
 			log_debug("payload: [%s], len = %u",
 			    pub_packet->payload.data, pub_packet->payload.len);
 		}
@@ -1720,6 +2399,31 @@ decode_pub_message(nano_work *work, uint8_t proto)
 	return SUCCESS;
 }
 
+/**
+ * @brief decode work->msg to fill work->pub_packet, copying the payload.
+ * @param work nano_work
+ * @param proto check protocol verison, more need to be done in MQTTv5
+ * @return reason_code
+ */
+reason_code
+decode_pub_message(nano_work *work, uint8_t proto)
+{
+	return decode_pub(work, proto, false);
+}
+
+/**
+ * @brief decode work->msg to fill work->pub_packet as a view, the payload
+ *        stays valid as long as work->msg is neither freed nor modified.
+ * @param work nano_work
+ * @param proto check protocol verison, more need to be done in MQTTv5
+ * @return reason_code
+ */
+reason_code
+decode_pub_view(nano_work *work, uint8_t proto)
+{
+	return decode_pub(work, proto, true);
+}
+
 /**
  * byte array to hex string
  *
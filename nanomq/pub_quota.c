@@ -0,0 +1,438 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/pub_quota.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/idhash.h"
+#include "nng/supplemental/util/platform.h"
+
+// Tokens are kept in thousandths so that slow rates refill every
+// millisecond. A bucket goes negative for the PUBLISH it holds back.
+typedef struct {
+	int64_t  tokens;
+	int64_t  cap;
+	int64_t  rate;
+	nng_time last;
+} quota_bucket;
+
+typedef struct {
+	quota_bucket msgs;
+	quota_bucket bytes;
+	size_t       refs;
+} quota_user;
+
+typedef struct {
+	quota_bucket msgs;
+	quota_bucket bytes;
+	quota_user  *user; // NULL without username or user rates
+	uint64_t     user_key;
+} quota_client;
+
+typedef struct {
+	nng_mtx    *mtx;
+	nng_id_map *map;
+} quota_shard;
+
+static struct {
+	quota_shard     clients[NANO_PUB_QUOTA_SHARDS];
+	quota_shard     users[NANO_PUB_QUOTA_SHARDS]; // by username hash
+	pub_quota_conf  conf;
+	nng_atomic_u64 *violations[PUB_QUOTA_POLICIES];
+	nng_atomic_u64 *delay_ms;
+	bool            enabled;
+} quota_;
+
+static const char *quota_policy_names[PUB_QUOTA_POLICIES] = {
+	[PUB_QUOTA_DROP]       = "drop",
+	[PUB_QUOTA_DELAY]      = "delay",
+	[PUB_QUOTA_DISCONNECT] = "disconnect",
+};
+
+const char *
+pub_quota_policy_name(pub_quota_policy p)
+{
+	return p < PUB_QUOTA_POLICIES ? quota_policy_names[p] : NULL;
+}
+
+static void
+bucket_init(quota_bucket *b, uint64_t rate, nng_time now)
+{
+	b->rate   = (int64_t) rate;
+	b->cap    = (int64_t) rate * 1000;
+	b->tokens = b->cap;
+	b->last   = now;
+}
+
+static void
+bucket_refill(quota_bucket *b, nng_time now)
+{
+	if (b->rate == 0 || now <= b->last) {
+		return;
+	}
+	// a rate per second is thousandths per millisecond
+	b->tokens += (int64_t) (now - b->last) * b->rate;
+	if (b->tokens > b->cap) {
+		b->tokens = b->cap;
+	}
+	b->last = now;
+}
+
+// Milliseconds until the bucket is back at cost.
+static nng_duration
+bucket_wait(const quota_bucket *b, int64_t cost)
+{
+	if (b->rate == 0 || b->tokens >= cost) {
+		return 0;
+	}
+	return (nng_duration) ((cost - b->tokens + b->rate - 1) / b->rate);
+}
+
+static void
+bucket_debit(quota_bucket *b, int64_t cost)
+{
+	int64_t floor = -(int64_t) quota_.conf.delay_ms * b->rate;
+
+	if (b->rate == 0) {
+		return;
+	}
+	if ((b->tokens -= cost) < floor) {
+		b->tokens = floor;
+	}
+}
+
+static uint64_t
+quota_user_key(const char *username)
+{
+	uint64_t h = 14695981039346656037ull;
+
+	for (const char *p = username; *p != '\0'; p++) {
+		h = (h ^ (uint8_t) *p) * 1099511628211ull;
+	}
+	// id maps keep 0 for themselves
+	return h != 0 ? h : 1;
+}
+
+static void
+quota_free_client(void *key, void *value, void *arg)
+{
+	(void) key;
+	(void) arg;
+	nng_free(value, sizeof(quota_client));
+}
+
+static void
+quota_free_user(void *key, void *value, void *arg)
+{
+	(void) key;
+	(void) arg;
+	nng_free(value, sizeof(quota_user));
+}
+
+int
+pub_quota_init(const pub_quota_conf *c)
+{
+	int rv;
+
+	if (quota_.enabled) {
+		return 0;
+	}
+	if (c->msg_rate == 0 && c->byte_rate == 0 && c->user_msg_rate == 0 &&
+	    c->user_byte_rate == 0) {
+		return 0;
+	}
+	quota_.conf = *c;
+	for (size_t i = 0; i < NANO_PUB_QUOTA_SHARDS; i++) {
+		if ((rv = nng_mtx_alloc(&quota_.clients[i].mtx)) != 0 ||
+		    (rv = nng_id_map_alloc(&quota_.clients[i].map, 0, 0, 0)) !=
+		        0 ||
+		    (rv = nng_mtx_alloc(&quota_.users[i].mtx)) != 0 ||
+		    (rv = nng_id_map_alloc(&quota_.users[i].map, 0, 0, 0)) !=
+		        0) {
+			pub_quota_fini();
+			return rv;
+		}
+	}
+	for (int p = 0; p < PUB_QUOTA_POLICIES; p++) {
+		if ((rv = nng_atomic_alloc64(&quota_.violations[p])) != 0) {
+			pub_quota_fini();
+			return rv;
+		}
+	}
+	if ((rv = nng_atomic_alloc64(&quota_.delay_ms)) != 0) {
+		pub_quota_fini();
+		return rv;
+	}
+	quota_.enabled = true;
+	return 0;
+}
+
+void
+pub_quota_fini(void)
+{
+	for (size_t i = 0; i < NANO_PUB_QUOTA_SHARDS; i++) {
+		if (quota_.clients[i].map != NULL) {
+			nng_id_map_foreach2(
+			    quota_.clients[i].map, quota_free_client, NULL);
+			nng_id_map_free(quota_.clients[i].map);
+		}
+		if (quota_.users[i].map != NULL) {
+			nng_id_map_foreach2(
+			    quota_.users[i].map, quota_free_user, NULL);
+			nng_id_map_free(quota_.users[i].map);
+		}
+		if (quota_.clients[i].mtx != NULL) {
+			nng_mtx_free(quota_.clients[i].mtx);
+		}
+		if (quota_.users[i].mtx != NULL) {
+			nng_mtx_free(quota_.users[i].mtx);
+		}
+	}
+	for (int p = 0; p < PUB_QUOTA_POLICIES; p++) {
+		if (quota_.violations[p] != NULL) {
+			nng_atomic_free64(quota_.violations[p]);
+		}
+	}
+	if (quota_.delay_ms != NULL) {
+		nng_atomic_free64(quota_.delay_ms);
+	}
+	memset(&quota_, 0, sizeof(quota_));
+}
+
+bool
+pub_quota_enabled(void)
+{
+	return quota_.enabled;
+}
+
+static void
+quota_env(const char *name, uint64_t *v)
+{
+	const char *s = getenv(name);
+	char       *end;
+	long long   n;
+
+	if (s == NULL || *s == '\0') {
+		return;
+	}
+	n = strtoll(s, &end, 10);
+	if (*end == '\0' && n >= 0) {
+		*v = (uint64_t) n;
+	}
+}
+
+void
+pub_quota_conf_env(pub_quota_conf *c)
+{
+	uint64_t    v;
+	const char *s;
+
+	v = c->msg_rate;
+	quota_env("NANOMQ_PUB_QUOTA_MSGS", &v);
+	c->msg_rate = (uint32_t) v;
+	quota_env("NANOMQ_PUB_QUOTA_BYTES", &c->byte_rate);
+	v = c->user_msg_rate;
+	quota_env("NANOMQ_PUB_QUOTA_USER_MSGS", &v);
+	c->user_msg_rate = (uint32_t) v;
+	quota_env("NANOMQ_PUB_QUOTA_USER_BYTES", &c->user_byte_rate);
+	v = c->delay_ms;
+	quota_env("NANOMQ_PUB_QUOTA_DELAY_MS", &v);
+	c->delay_ms = (uint32_t) v;
+	if ((s = getenv("NANOMQ_PUB_QUOTA_POLICY")) != NULL) {
+		for (int p = 0; p < PUB_QUOTA_POLICIES; p++) {
+			if (strcmp(s, quota_policy_names[p]) == 0) {
+				c->policy = p;
+			}
+		}
+	}
+}
+
+// Drop the client and its reference to the username bucket.
+static void
+quota_client_release(quota_client *qc)
+{
+	quota_shard *us;
+
+	if (qc->user != NULL) {
+		us = &quota_.users[qc->user_key % NANO_PUB_QUOTA_SHARDS];
+		nng_mtx_lock(us->mtx);
+		if (--qc->user->refs == 0) {
+			nng_id_remove(us->map, qc->user_key);
+			nng_free(qc->user, sizeof(quota_user));
+		}
+		nng_mtx_unlock(us->mtx);
+	}
+	nng_free(qc, sizeof(*qc));
+}
+
+void
+pub_quota_open(uint32_t pipe, const char *username)
+{
+	quota_shard  *cs = &quota_.clients[pipe % NANO_PUB_QUOTA_SHARDS];
+	quota_client *qc;
+	quota_client *old;
+	nng_time      now = nng_clock();
+
+	if (!quota_.enabled || (qc = nng_zalloc(sizeof(*qc))) == NULL) {
+		return;
+	}
+	bucket_init(&qc->msgs, quota_.conf.msg_rate, now);
+	bucket_init(&qc->bytes, quota_.conf.byte_rate, now);
+	if (username != NULL && *username != '\0' &&
+	    (quota_.conf.user_msg_rate > 0 || quota_.conf.user_byte_rate > 0)) {
+		// usernames hashing alike share one bucket
+		uint64_t     key = quota_user_key(username);
+		quota_shard *us  = &quota_.users[key % NANO_PUB_QUOTA_SHARDS];
+		quota_user  *qu;
+
+		nng_mtx_lock(us->mtx);
+		if ((qu = nng_id_get(us->map, key)) == NULL &&
+		    (qu = nng_zalloc(sizeof(*qu))) != NULL) {
+			bucket_init(&qu->msgs, quota_.conf.user_msg_rate, now);
+			bucket_init(&qu->bytes, quota_.conf.user_byte_rate, now);
+			if (nng_id_set(us->map, key, qu) != 0) {
+				nng_free(qu, sizeof(*qu));
+				qu = NULL;
+			}
+		}
+		if (qu != NULL) {
+			qu->refs++;
+			qc->user     = qu;
+			qc->user_key = key;
+		}
+		nng_mtx_unlock(us->mtx);
+	}
+	nng_mtx_lock(cs->mtx);
+	// a pipe id reused before its disconnect event replaces the old one
+	old = nng_id_get(cs->map, pipe);
+	if (nng_id_set(cs->map, pipe, qc) != 0) {
+		old = qc;
+	}
+	nng_mtx_unlock(cs->mtx);
+	if (old != NULL) {
+		quota_client_release(old);
+	}
+}
+
+void
+pub_quota_close(uint32_t pipe)
+{
+	quota_shard  *cs = &quota_.clients[pipe % NANO_PUB_QUOTA_SHARDS];
+	quota_client *qc;
+
+	if (!quota_.enabled) {
+		return;
+	}
+	nng_mtx_lock(cs->mtx);
+	if ((qc = nng_id_get(cs->map, pipe)) != NULL) {
+		nng_id_remove(cs->map, pipe);
+	}
+	nng_mtx_unlock(cs->mtx);
+	if (qc != NULL) {
+		quota_client_release(qc);
+	}
+}
+
+static nng_duration
+quota_max(nng_duration a, nng_duration b)
+{
+	return a > b ? a : b;
+}
+
+pub_quota_verdict
+pub_quota_check(uint32_t pipe, size_t bytes, uint8_t qos, nng_duration *wait)
+{
+	quota_shard      *cs = &quota_.clients[pipe % NANO_PUB_QUOTA_SHARDS];
+	quota_shard      *us = NULL;
+	quota_client     *qc;
+	quota_bucket     *b[4];
+	int64_t           cost[4];
+	size_t            n = 2;
+	nng_duration      need = 0;
+	nng_time          now;
+	pub_quota_policy  action = PUB_QUOTA_DELAY;
+	pub_quota_verdict verdict;
+
+	*wait = 0;
+	if (!quota_.enabled) {
+		return PUB_QUOTA_PASS;
+	}
+	cost[0] = cost[2] = 1000;
+	cost[1] = cost[3] = (int64_t) bytes * 1000;
+	nng_mtx_lock(cs->mtx);
+	if ((qc = nng_id_get(cs->map, pipe)) == NULL) {
+		nng_mtx_unlock(cs->mtx);
+		return PUB_QUOTA_PASS;
+	}
+	b[0] = &qc->msgs;
+	b[1] = &qc->bytes;
+	if (qc->user != NULL) {
+		us = &quota_.users[qc->user_key % NANO_PUB_QUOTA_SHARDS];
+		nng_mtx_lock(us->mtx);
+		b[n++] = &qc->user->msgs;
+		b[n++] = &qc->user->bytes;
+	}
+	now = nng_clock();
+	for (size_t i = 0; i < n; i++) {
+		bucket_refill(b[i], now);
+		need = quota_max(need, bucket_wait(b[i], cost[i]));
+	}
+	if (need == 0) {
+		for (size_t i = 0; i < n; i++) {
+			bucket_debit(b[i], cost[i]);
+		}
+		verdict = PUB_QUOTA_PASS;
+	} else if (quota_.conf.policy == PUB_QUOTA_DISCONNECT) {
+		verdict = PUB_QUOTA_CLOSE;
+		action  = PUB_QUOTA_DISCONNECT;
+	} else if (quota_.conf.policy == PUB_QUOTA_DROP && qos == 0) {
+		verdict = PUB_QUOTA_DROPPED;
+		action  = PUB_QUOTA_DROP;
+	} else {
+		// paid for now, held back until the buckets are even again
+		for (size_t i = 0; i < n; i++) {
+			bucket_debit(b[i], cost[i]);
+			*wait = quota_max(*wait, bucket_wait(b[i], 0));
+		}
+		verdict = PUB_QUOTA_WAIT;
+		action  = PUB_QUOTA_DELAY;
+	}
+	if (us != NULL) {
+		nng_mtx_unlock(us->mtx);
+	}
+	nng_mtx_unlock(cs->mtx);
+	if (verdict != PUB_QUOTA_PASS) {
+		nng_atomic_inc64(quota_.violations[action]);
+		nng_atomic_add64(quota_.delay_ms, (uint64_t) *wait);
+	}
+	return verdict;
+}
+
+void
+pub_quota_stats_get(pub_quota_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!quota_.enabled) {
+		return;
+	}
+	for (int p = 0; p < PUB_QUOTA_POLICIES; p++) {
+		s->violations[p] = nng_atomic_get64(quota_.violations[p]);
+	}
+	s->delay_ms = nng_atomic_get64(quota_.delay_ms);
+	for (size_t i = 0; i < NANO_PUB_QUOTA_SHARDS; i++) {
+		nng_mtx_lock(quota_.clients[i].mtx);
+		s->clients += nng_id_count(quota_.clients[i].map);
+		nng_mtx_unlock(quota_.clients[i].mtx);
+		nng_mtx_lock(quota_.users[i].mtx);
+		s->users += nng_id_count(quota_.users[i].map);
+		nng_mtx_unlock(quota_.users[i].mtx);
+	}
+}
@@ -22,14 +22,60 @@
 
 #include "include/rest_api.h"
 #include "include/bridge.h"
+#include "include/bridge_forward.h"
+#include "include/bridge_queue.h"
+#include "include/bridge_rtt.h"
+#include "include/bridge_zip.h"
+#ifdef SUPP_AWS_BRIDGE
+#include "include/aws_bridge.h"
+#endif
 #include "include/conf_api.h"
+#include "include/json_writer.h"
+#include "include/tree_view.h"
 #include "include/broker.h"
+#include "include/build_profile.h"
 #include "include/nanomq.h"
 #include "include/nanomq_rule.h"
+#include "include/rule_filter.h"
+#include "include/rule_sink.h"
 #include "include/sub_handler.h"
+#include "include/sub_stats.h"
+#include "include/share_group.h"
+#include "include/proc_stats.h"
+#include "include/pub_bulk.h"
+#include "include/acl_handler.h"
+#include "include/auth_cache.h"
+#include "include/match_cache.h"
+#include "include/traffic_stats.h"
+#include "include/latency_stats.h"
+#include "include/profiler.h"
+#include "include/retain_store.h"
 #include "include/version.h"
+#include "include/work_lane.h"
+#include "include/connect_admit.h"
+#include "include/pub_quota.h"
+#include "include/sub_queue.h"
+#include "include/work_arena.h"
+#include "include/transform.h"
+#include "include/msg_pool.h"
+#include "include/async_log.h"
+#include "include/startup.h"
+#if defined(SUPP_ICEORYX)
+#include "include/iceoryx_map.h"
+#endif
+#if defined(SUPP_SESSION_SPILL)
+#include "include/session_spill.h"
+#include "include/sqlite_commit.h"
+#endif
+#include "include/work_pool.h"
+#ifdef SUPP_PARQUET
+#include "include/exchange_query.h"
+#endif
+#include "include/exchange_recent.h"
+#include "include/webhook_post.h"
 #include "include/mqtt_api.h"
 
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -55,7 +101,7 @@
 #endif
 
 typedef int (handle_mqtt_msg_cb) (cJSON *, nng_socket *);
-#define METRICS_DATA_SIZE 2048
+#define METRICS_DATA_SIZE 32768
 
 typedef struct {
 	char *key;
@@ -126,6 +172,18 @@ static endpoints api_ep[] = {
 	    .method = "GET",
 	    .descr  = "A list of subscriptions of a client",
 	},
+	{
+	    .path   = "/shared_subscriptions",
+	    .name   = "list_shared_subscriptions",
+	    .method = "GET",
+	    .descr  = "Shared subscription groups and their dispatch counts",
+	},
+	{
+	    .path   = "/shared_subscriptions",
+	    .name   = "set_shared_strategy",
+	    .method = "PUT",
+	    .descr  = "Set the dispatch strategy of a shared group",
+	},
 	{
 	    .path   = "/rules/",
 	    .name   = "list_rules",
@@ -210,6 +268,12 @@ static endpoints api_ep[] = {
 	    .method = "POST",
 	    .descr  = "Batch publish MQTT messages",
 	},
+	{
+	    .path   = "/mqtt/publish_bulk",
+	    .name   = "mqtt_publish_bulk",
+	    .method = "POST",
+	    .descr  = "Publish NDJSON or binary records of one body",
+	},
 	{
 	    .path   = "/mqtt/unsubscribe_batch",
 	    .name   = "mqtt_unsubscribe_batch",
@@ -330,6 +394,24 @@ static endpoints api_ep[] = {
 	    .method = "GET",
 	    .descr  = "Returns all prometheus data",
 	},
+	{
+	    .path   = "/latency",
+	    .name   = "latency",
+	    .method = "GET",
+	    .descr  = "Returns latency percentiles of the publish stages",
+	},
+	{
+	    .path   = "/resources",
+	    .name   = "resources",
+	    .method = "GET",
+	    .descr  = "Returns recent samples of process resources",
+	},
+	{
+	    .path   = "/debug/profile",
+	    .name   = "debug_profile",
+	    .method = "GET",
+	    .descr  = "Samples broker threads and returns their stacks folded",
+	},
 };
 
 static tree **      uri_parse_tree(const char *path, size_t *count);
@@ -351,6 +433,12 @@ static http_msg get_prometheus(http_msg *msg, kv **params, size_t param_num,
     const char *client_id, const char *username, nng_socket *broker_sock);
 static http_msg get_metrics(http_msg *msg, kv **params, size_t param_num,
     const char *client_id, const char *username, nng_socket *broker_sock);
+static http_msg get_latency(http_msg *msg);
+static http_msg get_debug_profile(
+    http_msg *msg, kv **params, size_t param_num);
+static http_msg get_shared_subscriptions(http_msg *msg);
+static http_msg put_shared_strategy(http_msg *msg);
+static http_msg get_resources(http_msg *msg);
 static http_msg get_subscriptions(
     http_msg *msg, kv **params, size_t param_num, const char *client_id);
 static http_msg  get_rules(
@@ -360,7 +448,13 @@ static http_msg  put_rules(
 static http_msg  delete_rules(
     http_msg *msg, kv **params, size_t param_num, const char *rule_id);
 static http_msg post_rules(http_msg *msg);
-static http_msg get_tree(http_msg *msg);
+static http_msg get_tree(http_msg *msg, kv **params, size_t param_num);
+#ifdef SUPP_PARQUET
+static http_msg get_exchange_files(
+    http_msg *msg, kv **params, size_t param_num);
+static http_msg get_exchange_data(
+    http_msg *msg, kv **params, size_t param_num);
+#endif
 static http_msg post_ctrl(http_msg *msg, const char *type);
 static http_msg show_reload_config(http_msg *msg);
 static http_msg post_reload_config(http_msg *msg);
@@ -371,6 +465,8 @@ static http_msg post_mqtt_msg(
     http_msg *msg, nng_socket *sock, handle_mqtt_msg_cb cb);
 static http_msg post_mqtt_msg_batch(
     http_msg *msg, nng_socket *sock, handle_mqtt_msg_cb cb);
+static http_msg post_mqtt_publish_bulk(
+    http_msg *msg, kv **params, size_t param_num, nng_socket *sock);
 static http_msg get_mqtt_bridge(http_msg *msg, const char *name);
 static http_msg put_mqtt_bridge(http_msg *msg, const char *name);
 static http_msg post_mqtt_bridge_sub(http_msg *msg, const char *name);
@@ -628,6 +724,19 @@ put_http_msg(http_msg *msg, const char *content_type, const char *method,
 	}
 }
 
+void
+put_http_etag(http_msg *msg, const char *etag)
+{
+	if (msg->etag_len > 0) {
+		nng_strfree(msg->etag);
+		msg->etag_len = 0;
+	}
+	if (etag != NULL && *etag != '\0' &&
+	    (msg->etag = nng_strdup(etag)) != NULL) {
+		msg->etag_len = strlen(etag);
+	}
+}
+
 void
 destory_http_msg(http_msg *msg)
 {
@@ -653,14 +762,47 @@ destory_http_msg(http_msg *msg)
 		nng_strfree(msg->uri);
 		msg->uri_len = 0;
 	}
+	if (msg->etag_len > 0) {
+		nng_strfree(msg->etag);
+		msg->etag_len = 0;
+	}
 }
 
+// flags of a cached JWT
+#define AUTH_JWT_BODY_ENCODE 0x01
+
 #ifdef SUPP_JWT
 
+// Until exp, or NANO_AUTH_CACHE_TTL_MS, 0 for a token not worth keeping.
+static nng_time
+jwt_cache_expire(
+    struct l8w8jwt_claim *claim, size_t claim_count, nng_time now)
+{
+	struct l8w8jwt_claim *exp_claim =
+	    l8w8jwt_get_claim(claim, claim_count, "exp", strlen("exp"));
+	nng_time expire = now + NANO_AUTH_CACHE_TTL_MS;
+
+	if (exp_claim != NULL && exp_claim->value != NULL) {
+		long long left =
+		    strtoll(exp_claim->value, NULL, 10) - (long long) time(NULL);
+		if (left <= 0) {
+			// valid within exp_tolerance_seconds only
+			return 0;
+		}
+		if ((uint64_t) left * 1000 < NANO_AUTH_CACHE_TTL_MS) {
+			expire = now + (uint64_t) left * 1000;
+		}
+	}
+	return expire;
+}
+
 static enum result_code
 jwt_authorize(http_msg *msg)
 {
 	enum result_code result = SUCCEED;
+	uint64_t         salt;
+	uint32_t         flags;
+	nng_time         now;
 
 	if (msg->token_len <= 0 ||
 	    sscanf(msg->token, "Bearer %s", msg->token) != 1) {
@@ -669,6 +811,20 @@ jwt_authorize(http_msg *msg)
 
 	conf_http_server *server = get_http_server_conf();
 
+	// skip the signature check of a token verified lately
+	salt = auth_cache_hash(
+	    server->jwt.public_key, server->jwt.public_key_len, 0);
+	if (server->jwt.iss) {
+		salt = auth_cache_hash(
+		    server->jwt.iss, strlen(server->jwt.iss), salt);
+	}
+	now = nng_clock();
+	if (auth_cache_get(
+	        msg->token, strlen(msg->token), salt, now, &flags)) {
+		msg->encrypt_data = (flags & AUTH_JWT_BODY_ENCODE) != 0;
+		return SUCCEED;
+	}
+
 	struct l8w8jwt_decoding_params params;
 	l8w8jwt_decoding_params_init(&params);
 
@@ -709,6 +865,11 @@ jwt_authorize(http_msg *msg)
 				msg->encrypt_data = false;
 			}
 		}
+		nng_time expire = jwt_cache_expire(claim, claim_count, now);
+		if (expire != 0) {
+			auth_cache_put(msg->token, strlen(msg->token), salt,
+			    expire, msg->encrypt_data ? AUTH_JWT_BODY_ENCODE : 0);
+		}
 	} else {
 		log_error("decode jwt token failed: return %d, result: %d", rv,
 		    validation_result);
@@ -738,19 +899,28 @@ static enum result_code
 basic_authorize(http_msg *msg)
 {
 	enum result_code result = SUCCEED;
+	uint64_t         salt;
+	uint32_t         flags;
 
 	if (msg->token_len <= 0 ||
 	    sscanf(msg->token, "Basic %s", msg->token) != 1) {
 		return EMPTY_USERNAME_OR_PASSWORD;
 	}
 
-	size_t   token_len = strlen(msg->token);
-	uint8_t *token     = nng_alloc(token_len + 1);
+	conf_http_server *server = get_http_server_conf();
+
+	size_t token_len = strlen(msg->token);
+	salt = auth_cache_hash(server->username, strlen(server->username), 0);
+	salt = auth_cache_hash(server->password, strlen(server->password), salt);
+	if (auth_cache_get(msg->token, token_len, salt, nng_clock(), &flags)) {
+		return SUCCEED;
+	}
+
+	uint8_t *token = nng_alloc(token_len + 1);
 	memcpy(token, msg->token, token_len);
 	token[token_len] = '\0';
 
 	// Authorize username:password
-	conf_http_server *server = get_http_server_conf();
 
 	size_t auth_len =
 	    strlen(server->username) + strlen(server->password) + 2;
@@ -768,10 +938,13 @@ basic_authorize(http_msg *msg)
 
 	if (strcmp(auth, (const char *) decode) != 0) {
 		result = WRONG_USERNAME_OR_PASSWORD;
+	} else {
+		auth_cache_put(msg->token, token_len, salt,
+		    nng_clock() + NANO_AUTH_CACHE_TTL_MS, 0);
 	}
 
 	nng_free(auth, auth_len);
-	nng_free(decode, msg->token_len);
+	nng_free(decode, decode_len);
 	nng_free(token, token_len);
 
 	return result;
@@ -819,6 +992,20 @@ process_request(http_msg *msg, conf_http_server *config, nng_socket *sock)
 		    strcmp(uri_ct->sub_tree[1]->node, "prometheus") == 0) {
 			ret = get_prometheus(msg, uri_ct->params,
 			    uri_ct->params_count, NULL, NULL, config->broker_sock);
+		} else if (uri_ct->sub_count == 2 &&
+		    uri_ct->sub_tree[1]->end &&
+		    strcmp(uri_ct->sub_tree[1]->node, "latency") == 0) {
+			ret = get_latency(msg);
+		} else if (uri_ct->sub_count == 2 &&
+		    uri_ct->sub_tree[1]->end &&
+		    strcmp(uri_ct->sub_tree[1]->node, "resources") == 0) {
+			ret = get_resources(msg);
+		} else if (uri_ct->sub_count == 3 &&
+		    uri_ct->sub_tree[2]->end &&
+		    strcmp(uri_ct->sub_tree[1]->node, "debug") == 0 &&
+		    strcmp(uri_ct->sub_tree[2]->node, "profile") == 0) {
+			ret = get_debug_profile(
+			    msg, uri_ct->params, uri_ct->params_count);
 		} else if (uri_ct->sub_count == 2 &&
 		    uri_ct->sub_tree[1]->end &&
 		    strcmp(uri_ct->sub_tree[1]->node, "metrics") == 0) {
@@ -852,6 +1039,11 @@ process_request(http_msg *msg, conf_http_server *config, nng_socket *sock)
 		    strcmp(uri_ct->sub_tree[1]->node, "subscriptions") == 0) {
 			ret = get_subscriptions(msg, uri_ct->params,
 			    uri_ct->params_count, uri_ct->sub_tree[2]->node);
+		} else if (uri_ct->sub_count == 2 &&
+		    uri_ct->sub_tree[1]->end &&
+		    strcmp(uri_ct->sub_tree[1]->node,
+		        "shared_subscriptions") == 0) {
+			ret = get_shared_subscriptions(msg);
 
 		} else if (uri_ct->sub_count == 2 &&
 		    uri_ct->sub_tree[1]->end &&
@@ -867,7 +1059,28 @@ process_request(http_msg *msg, conf_http_server *config, nng_socket *sock)
 		} else if (uri_ct->sub_count == 2 &&
 		    uri_ct->sub_tree[1]->end &&
 		    strcmp(uri_ct->sub_tree[1]->node, "topic-tree") == 0) {
-			ret = get_tree(msg);
+			ret = get_tree(
+			    msg, uri_ct->params, uri_ct->params_count);
+#ifdef SUPP_PARQUET
+		} else if (uri_ct->sub_count == 3 &&
+		    uri_ct->sub_tree[2]->end &&
+		    strcmp(uri_ct->sub_tree[1]->node, "exchange") == 0 &&
+		    strcmp(uri_ct->sub_tree[2]->node, "files") == 0) {
+			ret = get_exchange_files(
+			    msg, uri_ct->params, uri_ct->params_count);
+		} else if (uri_ct->sub_count == 3 &&
+		    uri_ct->sub_tree[2]->end &&
+		    strcmp(uri_ct->sub_tree[1]->node, "exchange") == 0 &&
+		    strcmp(uri_ct->sub_tree[2]->node, "data") == 0) {
+			ret = get_exchange_data(
+			    msg, uri_ct->params, uri_ct->params_count);
+#endif
+		} else if (uri_ct->sub_count == 3 &&
+		    uri_ct->sub_tree[2]->end &&
+		    strcmp(uri_ct->sub_tree[1]->node, "exchange") == 0 &&
+		    strcmp(uri_ct->sub_tree[2]->node, "recent") == 0) {
+			ret = get_exchange_recent(
+			    msg, uri_ct->params, uri_ct->params_count);
 		} else if (uri_ct->sub_count == 2 &&
 		    uri_ct->sub_tree[1]->end &&
 		    strcmp(uri_ct->sub_tree[1]->node, "reload") == 0) {
@@ -941,6 +1154,12 @@ process_request(http_msg *msg, conf_http_server *config, nng_socket *sock)
 		    strcmp(uri_ct->sub_tree[2]->node, "publish_batch") == 0) {
 			ret =
 			    post_mqtt_msg_batch(msg, sock, handle_publish_msg);
+		} else if (uri_ct->sub_count == 3 &&
+		    uri_ct->sub_tree[2]->end &&
+		    strcmp(uri_ct->sub_tree[1]->node, "mqtt") == 0 &&
+		    strcmp(uri_ct->sub_tree[2]->node, "publish_bulk") == 0) {
+			ret = post_mqtt_publish_bulk(
+			    msg, uri_ct->params, uri_ct->params_count, sock);
 		}
 
 		/* else if (uri_ct->sub_count == 3 &&
@@ -982,6 +1201,11 @@ process_request(http_msg *msg, conf_http_server *config, nng_socket *sock)
 		    uri_ct->sub_tree[2]->end &&
 		    strcmp(uri_ct->sub_tree[1]->node, "bridges") == 0) {
 			ret = put_mqtt_bridge(msg, uri_ct->sub_tree[2]->node);
+		} else if (uri_ct->sub_count == 2 &&
+		    uri_ct->sub_tree[1]->end &&
+		    strcmp(uri_ct->sub_tree[1]->node,
+		        "shared_subscriptions") == 0) {
+			ret = put_shared_strategy(msg);
 		} else {
 			status = NNG_HTTP_STATUS_NOT_FOUND;
 			code   = UNKNOWN_MISTAKE;
@@ -1110,6 +1334,24 @@ get_brokers(http_msg *msg)
 	cJSON_AddStringToObject(item, "sysdescr", "NanoMQ Broker");
 	cJSON_AddStringToObject(item, "uptime", runtime);
 	cJSON_AddStringToObject(item, "version", version);
+	cJSON_AddStringToObject(item, "profile", build_profile_name());
+	cJSON_AddNumberToObject(
+	    item, "binary_size", (double) build_profile_binary_size());
+	if (work_pool_enabled()) {
+		work_pool_stats ws;
+		cJSON          *workers = cJSON_CreateObject();
+		work_pool_stats_get(&ws);
+		cJSON_AddBoolToObject(workers, "elastic", ws.elastic);
+		cJSON_AddNumberToObject(workers, "size", ws.size);
+		cJSON_AddNumberToObject(workers, "min", ws.min);
+		cJSON_AddNumberToObject(workers, "max", ws.max);
+		cJSON_AddNumberToObject(workers, "busy", ws.busy);
+		cJSON_AddNumberToObject(
+		    workers, "utilization", ws.utilization);
+		cJSON_AddNumberToObject(workers, "grown", ws.grown);
+		cJSON_AddNumberToObject(workers, "shrunk", ws.shrunk);
+		cJSON_AddItemToObject(item, "workers", workers);
+	}
 	cJSON_AddItemToArray(array, item);
 	cJSON_AddItemToObject(res_obj, "data", array);
 
@@ -1172,10 +1414,154 @@ get_nodes(http_msg *msg, nng_socket *broker_sock)
 	return res;
 }
 
+static const char *
+find_param(kv **params, size_t param_num, const char *key)
+{
+	for (size_t i = 0; i < param_num; i++) {
+		if (params[i] != NULL && strcmp(params[i]->key, key) == 0) {
+			return params[i]->value;
+		}
+	}
+	return NULL;
+}
+
+static bool
+parse_u64_param(kv **params, size_t param_num, const char *key,
+    uint64_t *value)
+{
+	const char *str = find_param(params, param_num, key);
+	char       *end;
+
+	if (str == NULL || *str == '\0') {
+		return false;
+	}
+	*value = strtoull(str, &end, 10);
+	return *end == '\0';
+}
+
+typedef struct {
+	size_t   limit;
+	size_t   page; // from 1, used without a cursor
+	bool     has_cursor;
+	uint64_t cursor; // next entry to return
+} rest_page;
+
+/*
+ * ?limit=&page= or ?limit=&cursor=, a cursor being the next_cursor of the
+ * page before. Entries are ordered by pipe id so a cursor stays valid
+ * while clients come and go.
+ */
+static int
+rest_page_parse(kv **params, size_t param_num, rest_page *pg)
+{
+	uint64_t v;
+
+	pg->limit      = NANO_REST_PAGE_LIMIT;
+	pg->page       = 1;
+	pg->has_cursor = false;
+	pg->cursor     = 0;
+	if (parse_u64_param(params, param_num, "limit", &v)) {
+		if (v == 0 || v > NANO_REST_PAGE_LIMIT_MAX) {
+			return REQ_PARAM_ERROR;
+		}
+		pg->limit = v;
+	} else if (find_param(params, param_num, "limit") != NULL) {
+		return REQ_PARAM_ERROR;
+	}
+	if (parse_u64_param(params, param_num, "page", &v)) {
+		if (v == 0) {
+			return REQ_PARAM_ERROR;
+		}
+		pg->page = v;
+	} else if (find_param(params, param_num, "page") != NULL) {
+		return REQ_PARAM_ERROR;
+	}
+	if (parse_u64_param(params, param_num, "cursor", &v)) {
+		pg->has_cursor = true;
+		pg->cursor     = v;
+	} else if (find_param(params, param_num, "cursor") != NULL) {
+		return REQ_PARAM_ERROR;
+	}
+	return SUCCEED;
+}
+
+static void
+json_write_meta(json_writer *w, const rest_page *pg, size_t count,
+    bool has_next, uint64_t next)
+{
+	char meta[192];
+
+	if (has_next) {
+		snprintf(meta, sizeof(meta),
+		    "],\"meta\":{\"page\":%zu,\"limit\":%zu,\"count\":%zu,"
+		    "\"hasnext\":true,\"next_cursor\":%llu}}",
+		    pg->page, pg->limit, count, (unsigned long long) next);
+	} else {
+		snprintf(meta, sizeof(meta),
+		    "],\"meta\":{\"page\":%zu,\"limit\":%zu,\"count\":%zu,"
+		    "\"hasnext\":false}}",
+		    pg->page, pg->limit, count);
+	}
+	json_write_str(w, meta);
+}
+
+static http_msg
+json_writer_response(http_msg *msg, json_writer *w)
+{
+	http_msg res = { .status = NNG_HTTP_STATUS_OK };
+
+	if (w->failed) {
+		json_writer_fini(w);
+		return error_response(
+		    msg, NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR, UNKNOWN_MISTAKE);
+	}
+	put_http_msg(
+	    &res, "application/json", NULL, NULL, NULL, w->buf, w->len);
+	json_writer_fini(w);
+	return res;
+}
+
+static int
+pipe_id_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+// First index of pipes, sorted, at or after the start of page pg.
+static size_t
+rest_page_start(const uint32_t *pipes, size_t n, const rest_page *pg)
+{
+	size_t lo = 0;
+	size_t hi = n;
+
+	if (!pg->has_cursor) {
+		uint64_t skip = (uint64_t) (pg->page - 1) * pg->limit;
+		return skip < n ? skip : n;
+	}
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (pipes[mid] < pg->cursor) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
 typedef struct {
-	cJSON *array;
-	char * client_id;
-	char * username;
+	const char *client_id;
+	const char *username;
+	int         conn_state;  // -1 for any, else the nng_pipe_status
+	int         proto_ver;   // 0 for any
+	int         clean_start; // -1 for any
+	uint32_t   *pipes;
+	size_t      count;
+	size_t      cap;
+	bool        failed;
 } client_info;
 
 typedef struct {
@@ -1190,30 +1576,75 @@ typedef struct {
 	float    cpu_percent;
 } client_stats;
 
+// Collect the pipes passing the filters of info, no JSON made yet.
 static void
-get_client_cb(void *key, void *value, void *json_obj)
+get_client_cb(void *key, void *value, void *arg)
 {
-	client_info   *info    = json_obj;
+	client_info   *info    = arg;
 	uint32_t       pipe_id = *(uint32_t *) key;
 	nng_pipe       pipe    = { .id = pipe_id };
 	bool           status  = nng_pipe_status(pipe);
-	conn_param    *cp      = nng_pipe_cparam(pipe);
-	const uint8_t *cid     = conn_param_get_clientid(cp);
-	if (info->client_id != NULL) {
-		if (strcmp(info->client_id, (const char *) cid) != 0) {
-			conn_param_free(cp);
+	conn_param    *cp;
+	const uint8_t *cid;
+	const uint8_t *user_name;
+
+	(void) value;
+	if (info->failed ||
+	    (info->conn_state >= 0 && info->conn_state != status)) {
+		return;
+	}
+	if (info->client_id != NULL || info->username != NULL ||
+	    info->proto_ver != 0 || info->clean_start >= 0) {
+		if ((cp = nng_pipe_cparam(pipe)) == NULL) {
 			return;
 		}
-	}
-	const uint8_t *user_name = conn_param_get_username(cp);
-	if (info->username != NULL) {
-		if (user_name == NULL ||
-		    strcmp(info->username, (const char *) user_name) != 0) {
+		cid       = conn_param_get_clientid(cp);
+		user_name = conn_param_get_username(cp);
+		if ((info->client_id != NULL &&
+		        (cid == NULL ||
+		            strcmp(info->client_id, (const char *) cid) !=
+		                0)) ||
+		    (info->username != NULL &&
+		        (user_name == NULL ||
+		            strcmp(info->username, (const char *) user_name) !=
+		                0)) ||
+		    (info->proto_ver != 0 &&
+		        conn_param_get_protover(cp) != info->proto_ver) ||
+		    (info->clean_start >= 0 &&
+		        conn_param_get_clean_start(cp) != info->clean_start)) {
 			conn_param_free(cp);
 			return;
 		}
+		conn_param_free(cp);
+	}
+	if (info->count == info->cap) {
+		size_t    cap = info->cap == 0 ? 1024 : info->cap * 2;
+		uint32_t *pipes;
+		if ((pipes = realloc(info->pipes, cap * sizeof(uint32_t))) ==
+		    NULL) {
+			info->failed = true;
+			return;
+		}
+		info->pipes = pipes;
+		info->cap   = cap;
 	}
+	info->pipes[info->count++] = pipe_id;
+}
+
+// Write the client of pipe_id as the next element, false if it is gone.
+static bool
+get_client_write(json_writer *w, uint32_t pipe_id)
+{
+	nng_pipe       pipe    = { .id = pipe_id };
+	bool           status  = nng_pipe_status(pipe);
+	conn_param    *cp      = nng_pipe_cparam(pipe);
 
+	// gone since it was collected
+	if (cp == NULL) {
+		return false;
+	}
+	const uint8_t *cid       = conn_param_get_clientid(cp);
+	const uint8_t *user_name = conn_param_get_username(cp);
 	uint16_t      keep_alive  = conn_param_get_keepalive(cp);
 	const uint8_t proto_ver   = conn_param_get_protover(cp);
 	const char   *proto_name  = (const char *) conn_param_get_pro_name(cp);
@@ -1221,100 +1652,118 @@ get_client_cb(void *key, void *value, void *json_obj)
 	const mqtt_string *will_topic = (const mqtt_string *) conn_param_get_will_topic(cp);
 	const mqtt_string *will_msg   = (const mqtt_string *) conn_param_get_will_msg(cp);
 
-	cJSON *data_info_elem;
-	data_info_elem = cJSON_CreateObject();
-	cJSON_AddStringToObject(data_info_elem, "client_id", (char *) cid);
-	cJSON_AddStringToObject(data_info_elem, "username",
-	    user_name == NULL ? "" : (char *) user_name);
-	cJSON_AddNumberToObject(data_info_elem, "keepalive", keep_alive);
-	if (status)
-		cJSON_AddStringToObject(data_info_elem, "conn_state", "disconnected");
-	else
-		cJSON_AddStringToObject(data_info_elem, "conn_state", "connected");
-	cJSON_AddBoolToObject(data_info_elem, "clean_start", clean_start);
-	cJSON_AddStringToObject(data_info_elem, "proto_name", proto_name);
-	cJSON_AddNumberToObject(data_info_elem, "proto_ver", proto_ver);
+	json_write_begin(w, '{');
+	json_field_str(w, "client_id", (const char *) cid);
+	json_field_str(w, "username",
+	    user_name == NULL ? "" : (const char *) user_name);
+	json_field_u64(w, "keepalive", keep_alive);
+	json_field_str(
+	    w, "conn_state", status ? "disconnected" : "connected");
+	json_field_bool(w, "clean_start", clean_start);
+	json_field_str(w, "proto_name", proto_name);
+	json_field_u64(w, "proto_ver", proto_ver);
 	if(will_topic != NULL) {
-		cJSON_AddStringToObject(data_info_elem, "will_topic", will_topic->body);
+		json_field_str(w, "will_topic", will_topic->body);
 	}
 	if(will_msg != NULL) {
-		cJSON_AddStringToObject(data_info_elem, "will_msg", will_msg->body);
+		json_field_str(w, "will_msg", will_msg->body);
 	}
-	// #ifdef STATISTICS
-	// 		cJSON_AddNumberToObject(data_info_elem, "recv_msg",
-	// 		    ctxt->recv_cnt != NULL ?
-	// nng_atomic_get64(ctxt->recv_cnt) : 0); #endif
-	cJSON_AddItemToArray(info->array, data_info_elem);
-
-	conn_param_free(cp);
-}
-
-static void
-get_metric_cb(void *key, void *value, void *stats)
-{
-	client_stats *s = (client_stats *) stats;
-	s->sessions++;
-	uint32_t       pipe_id = *(uint32_t *) key;
-	nng_pipe       pipe    = { .id = pipe_id };
-	bool           status  = nng_pipe_status(pipe);
-
-	conn_param    *cp      = nng_pipe_cparam(pipe);
-	const uint8_t *cid     = conn_param_get_clientid(cp);
-	if (!status) s->connections++;
+#if defined(SUPP_TRAFFIC_STATS)
+	traffic_client tc;
+	if (traffic_client_get(pipe_id, &tc)) {
+		json_field_u64(w, "recv_msg", tc.msg_in);
+		json_field_u64(w, "recv_bytes", tc.bytes_in);
+		json_field_u64(w, "send_msg", tc.msg_out);
+		json_field_u64(w, "send_bytes", tc.bytes_out);
+	}
+#endif
+	sub_queue_state sq;
+	if (sub_queue_get(pipe_id, &sq)) {
+		json_field_bool(w, "slow", sq.slow);
+		json_field_u64(w, "unacked_msg", sq.msgs);
+	}
+	json_write_end(w, '}');
 
 	conn_param_free(cp);
-
-	// #ifdef STATISTICS
-	// 		cJSON_AddNumberToObject(data_info_elem, "recv_msg",
-	// 		    ctxt->recv_cnt != NULL ?
-	// nng_atomic_get64(ctxt->recv_cnt) : 0); #endif
+	return true;
 }
 
 static http_msg
 get_clients(http_msg *msg, kv **params, size_t param_num,
     const char *client_id, const char *username, nng_socket *broker_sock)
 {
-	http_msg res = { .status = NNG_HTTP_STATUS_OK };
-
- 	cJSON *data_info;
-	cJSON *res_obj;
-	data_info = cJSON_CreateArray();
-
+	json_writer w = { 0 };
+	rest_page   pg;
 	nng_id_map *pipe_id_map;
-
-	if (nng_socket_get_ptr(*broker_sock, NMQ_OPT_MQTT_PIPES,
-	        (void **) &pipe_id_map) != 0) {
-		goto out;
-	}
-
+	const char *state;
+	uint64_t    ver;
+	size_t      start;
+	size_t      n = 0;
 
 	client_info info = {
-		.array     = data_info,
-		.client_id = (char *) client_id,
-		.username  = (char *) username,
+		.client_id   = client_id,
+		.username    = username,
+		.conn_state  = -1,
+		.clean_start = -1,
 	};
 
-	nng_id_map_foreach2(pipe_id_map, get_client_cb, &info);
-
- out:
-
- 	res_obj = cJSON_CreateObject();
- 	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
-
- 	// cJSON *meta = cJSON_CreateObject();
-
- 	// cJSON_AddItemToObject(res_obj, "meta", meta);
- 	// TODO add meta content: page, limit, count
- 	cJSON_AddItemToObject(res_obj, "data", data_info);
- 	char *dest = cJSON_PrintUnformatted(res_obj);
- 	cJSON_Delete(res_obj);
+	if (rest_page_parse(params, param_num, &pg) != SUCCEED) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
+	}
+	if (info.client_id == NULL) {
+		info.client_id = find_param(params, param_num, "clientid");
+	}
+	if (info.username == NULL) {
+		info.username = find_param(params, param_num, "username");
+	}
+	if ((state = find_param(params, param_num, "conn_state")) != NULL) {
+		if (strcmp(state, "connected") == 0) {
+			info.conn_state = 0;
+		} else if (strcmp(state, "disconnected") == 0) {
+			info.conn_state = 1;
+		} else {
+			return error_response(
+			    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
+		}
+	}
+	if ((state = find_param(params, param_num, "clean_start")) != NULL) {
+		if (strcmp(state, "true") == 0) {
+			info.clean_start = 1;
+		} else if (strcmp(state, "false") == 0) {
+			info.clean_start = 0;
+		} else {
+			return error_response(
+			    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
+		}
+	}
+	if (parse_u64_param(params, param_num, "proto_ver", &ver)) {
+		info.proto_ver = (int) ver;
+	} else if (find_param(params, param_num, "proto_ver") != NULL) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
+	}
 
- 	put_http_msg(
- 	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+	if (nng_socket_get_ptr(*broker_sock, NMQ_OPT_MQTT_PIPES,
+	        (void **) &pipe_id_map) == 0) {
+		nng_id_map_foreach2(pipe_id_map, get_client_cb, &info);
+	}
+	w.failed = info.failed;
+	qsort(info.pipes, info.count, sizeof(uint32_t), pipe_id_cmp);
+	start = rest_page_start(info.pipes, info.count, &pg);
 
- 	cJSON_free(dest);
+	json_write_str(&w, "{\"code\":0,\"data\":[");
+	for (size_t i = start; i < info.count && n < pg.limit; i++) {
+		if (get_client_write(&w, info.pipes[i])) {
+			n++;
+		}
+		start = i + 1;
+	}
+	json_write_meta(&w, &pg, info.count, start < info.count,
+	    start < info.count ? info.pipes[start] : 0);
+	free(info.pipes);
 
-	return res;
+	return json_writer_response(msg, &w);
 }
 
 static void
@@ -1373,273 +1822,1464 @@ compose_metrics(char *ret, client_stats *ms, client_stats *s)
 	    ms->cpu_percent);
 }
 
-#define max_stats(s, ms, field) ms->field > s->field ? ms->field : s->field
+static void
+compose_sub_stats_metrics(char *ret, size_t size, const sub_stats *ss)
+{
+	char fmt[] = "# TYPE nanomq_subscriptions_count gauge"
+	             "\n# HELP nanomq_subscriptions_count"
+	             "\nnanomq_subscriptions_count %llu"
+	             "\n# TYPE nanomq_subscriptions_shared_count gauge"
+	             "\n# HELP nanomq_subscriptions_shared_count"
+	             "\nnanomq_subscriptions_shared_count %llu"
+	             "\n# TYPE nanomq_connections_version_count gauge"
+	             "\n# HELP nanomq_connections_version_count"
+	             "\nnanomq_connections_version_count{version=\"3.1\"} %llu"
+	             "\nnanomq_connections_version_count{version=\"3.1.1\"} %llu"
+	             "\nnanomq_connections_version_count{version=\"5\"} %llu\n";
+
+	snprintf(ret, size, fmt, (unsigned long long) ss->subscriptions,
+	    (unsigned long long) ss->shared,
+	    (unsigned long long) ss->conn_v31,
+	    (unsigned long long) ss->conn_v311,
+	    (unsigned long long) ss->conn_v5);
+}
 
 static void
-update_max_stats(client_stats *ms, client_stats *s)
+compose_proc_stats_metrics(char *ret, size_t size, const proc_sample *ps)
 {
-	// TODO not strictly the maximum value.
-	ms->topics      = max_stats(s, ms, topics);
-	ms->sessions    = max_stats(s, ms, sessions);
-	ms->connections = max_stats(s, ms, connections);
-	ms->subscribers = max_stats(s, ms, subscribers);
-	ms->memory      = max_stats(s, ms, memory);
-	ms->cpu_percent = max_stats(s, ms, cpu_percent);
+	char fmt[] = "# TYPE nanomq_fds_count gauge"
+	             "\n# HELP nanomq_fds_count"
+	             "\nnanomq_fds_count %u"
+	             "\n# TYPE nanomq_threads_count gauge"
+	             "\n# HELP nanomq_threads_count"
+	             "\nnanomq_threads_count %u"
+	             "\n# TYPE nanomq_taskq_cpu_usage gauge"
+	             "\n# HELP nanomq_taskq_cpu_usage"
+	             "\nnanomq_taskq_cpu_usage %.2f"
+	             "\n# TYPE nanomq_taskq_cpu_usage_max gauge"
+	             "\n# HELP nanomq_taskq_cpu_usage_max"
+	             "\nnanomq_taskq_cpu_usage_max %.2f"
+	             "\n# TYPE nanomq_bridge_queue_depth gauge"
+	             "\n# HELP nanomq_bridge_queue_depth"
+	             "\nnanomq_bridge_queue_depth %llu\n";
+
+	snprintf(ret, size, fmt, ps->fds, ps->threads, ps->taskq_cpu_percent,
+	    ps->taskq_cpu_max_percent,
+	    (unsigned long long) ps->bridge_queue_depth);
 }
 
-static void *
-get_client_exist_cb(uint32_t pid)
+static void
+compose_match_cache_metrics(char *ret, size_t size)
 {
-	return (void*) (long long) pid;
+	char fmt[] = "# TYPE nanomq_match_cache_hits counter"
+	             "\n# HELP nanomq_match_cache_hits"
+	             "\nnanomq_match_cache_hits %llu"
+	             "\n# TYPE nanomq_match_cache_misses counter"
+	             "\n# HELP nanomq_match_cache_misses"
+	             "\nnanomq_match_cache_misses %llu\n";
+
+	snprintf(ret, size, fmt, (unsigned long long) match_cache_hits(),
+	    (unsigned long long) match_cache_misses());
 }
 
-static size_t
-get_topics_count()
-{
-	dbtree        *db = get_broker_db();
-	dbtree_info ***vn =
-	    (dbtree_info ***) dbtree_get_tree(db, get_client_exist_cb);
-	size_t counter = 0;
-
-	for (int i = 0; i < cvector_size(vn); i++) {
-		for (int j = 0; j < cvector_size(vn[i]); j++) {
-			nng_free(vn[i][j]->topic, strlen(vn[i][j]->topic));
-			if (vn[i][j]->clients) {
-				counter++;
+static void
+compose_retain_store_metrics(char *ret, size_t size)
+{
+	char fmt[] = "# TYPE nanomq_retain_messages gauge"
+	             "\n# HELP nanomq_retain_messages"
+	             "\nnanomq_retain_messages %llu"
+	             "\n# TYPE nanomq_retain_image_bytes gauge"
+	             "\n# HELP nanomq_retain_image_bytes"
+	             "\nnanomq_retain_image_bytes %llu"
+	             "\n# TYPE nanomq_retain_expired counter"
+	             "\n# HELP nanomq_retain_expired"
+	             "\nnanomq_retain_expired %llu\n";
+
+	snprintf(ret, size, fmt, (unsigned long long) retain_store_count(),
+	    (unsigned long long) retain_store_bytes(),
+	    (unsigned long long) retain_store_expired());
+}
+
+static void
+compose_work_arena_metrics(char *ret, size_t size)
+{
+	work_arena_stats st;
+
+	work_arena_stats_get(&st);
+	snprintf(ret, size,
+	    "# TYPE nanomq_work_arena_allocs counter"
+	    "\n# HELP nanomq_work_arena_allocs"
+	    "\nnanomq_work_arena_allocs %llu"
+	    "\n# TYPE nanomq_work_arena_blocks counter"
+	    "\n# HELP nanomq_work_arena_blocks"
+	    "\nnanomq_work_arena_blocks %llu"
+	    "\n# TYPE nanomq_work_arena_bytes gauge"
+	    "\n# HELP nanomq_work_arena_bytes"
+	    "\nnanomq_work_arena_bytes %zu"
+	    "\n# TYPE nanomq_work_arena_high_bytes gauge"
+	    "\n# HELP nanomq_work_arena_high_bytes"
+	    "\nnanomq_work_arena_high_bytes %zu\n",
+	    (unsigned long long) st.allocs, (unsigned long long) st.blocks,
+	    st.reserved, st.high);
+}
+
+static void
+compose_msg_pool_metrics(char *ret, size_t size)
+{
+	msg_pool_stats st;
+
+	msg_pool_stats_get(&st);
+	snprintf(ret, size,
+	    "# TYPE nanomq_msg_pool_hits counter"
+	    "\n# HELP nanomq_msg_pool_hits"
+	    "\nnanomq_msg_pool_hits %llu"
+	    "\n# TYPE nanomq_msg_pool_misses counter"
+	    "\n# HELP nanomq_msg_pool_misses"
+	    "\nnanomq_msg_pool_misses %llu"
+	    "\n# TYPE nanomq_msg_pool_drops counter"
+	    "\n# HELP nanomq_msg_pool_drops"
+	    "\nnanomq_msg_pool_drops %llu"
+	    "\n# TYPE nanomq_msg_pool_cached gauge"
+	    "\n# HELP nanomq_msg_pool_cached"
+	    "\nnanomq_msg_pool_cached %zu\n",
+	    (unsigned long long) st.hits, (unsigned long long) st.misses,
+	    (unsigned long long) st.drops, st.cached);
+}
+
+static void
+compose_work_lane_metrics(char *ret, size_t size)
+{
+	size_t          len = 0;
+	work_lane_stats st;
+
+	len += snprintf(ret + len, size - len,
+	    "# TYPE nanomq_work_lane_handled counter"
+	    "\n# HELP nanomq_work_lane_handled\n");
+	for (int i = 0; i < WORK_LANES && len < size; i++) {
+		work_lane_stats_get(i, &st);
+		len += snprintf(ret + len, size - len,
+		    "nanomq_work_lane_handled{lane=\"%s\"} %llu\n",
+		    work_lane_name(i), (unsigned long long) st.handled);
+	}
+	if (len >= size) {
+		return;
+	}
+	work_lane_stats_get(WORK_LANE_HEAVY, &st);
+	snprintf(ret + len, size - len,
+	    "# TYPE nanomq_work_lane_depth gauge"
+	    "\n# HELP nanomq_work_lane_depth"
+	    "\nnanomq_work_lane_depth{lane=\"heavy\"} %llu"
+	    "\n# TYPE nanomq_work_lane_depth_max gauge"
+	    "\n# HELP nanomq_work_lane_depth_max"
+	    "\nnanomq_work_lane_depth_max{lane=\"heavy\"} %llu"
+	    "\n# TYPE nanomq_work_lane_overflow counter"
+	    "\n# HELP nanomq_work_lane_overflow"
+	    "\nnanomq_work_lane_overflow{lane=\"heavy\"} %llu\n",
+	    (unsigned long long) st.depth, (unsigned long long) st.depth_max,
+	    (unsigned long long) st.overflow);
+}
+
+static void
+compose_transform_metrics(char *ret, size_t size)
+{
+	static const char *names[] = { "offloaded", "inline", "overflow",
+		"cpu_ns" };
+	size_t          len = 0;
+	uint64_t        v[4][TRANSFORMS];
+	transform_stats st;
+
+	for (int k = 0; k < TRANSFORMS; k++) {
+		transform_stats_get(k, &st);
+		v[0][k] = st.offloaded;
+		v[1][k] = st.inlined;
+		v[2][k] = st.overflow;
+		v[3][k] = st.cpu_ns;
+	}
+	for (int m = 0; m < 4 && len < size; m++) {
+		len += snprintf(ret + len, size - len,
+		    "# TYPE nanomq_transform_%s counter"
+		    "\n# HELP nanomq_transform_%s\n",
+		    names[m], names[m]);
+		for (int k = 0; k < TRANSFORMS && len < size; k++) {
+			len += snprintf(ret + len, size - len,
+			    "nanomq_transform_%s{kind=\"%s\"} %llu\n",
+			    names[m], transform_name(k),
+			    (unsigned long long) v[m][k]);
+		}
+	}
+	if (len >= size) {
+		return;
+	}
+	snprintf(ret + len, size - len,
+	    "# TYPE nanomq_transform_depth gauge"
+	    "\n# HELP nanomq_transform_depth"
+	    "\nnanomq_transform_depth %llu"
+	    "\n# TYPE nanomq_transform_depth_max gauge"
+	    "\n# HELP nanomq_transform_depth_max"
+	    "\nnanomq_transform_depth_max %llu"
+	    "\n# TYPE nanomq_transform_batches counter"
+	    "\n# HELP nanomq_transform_batches"
+	    "\nnanomq_transform_batches %llu\n",
+	    (unsigned long long) st.depth, (unsigned long long) st.depth_max,
+	    (unsigned long long) st.batches);
+}
+
+static void
+compose_connect_admit_metrics(char *ret, size_t size)
+{
+	connect_admit_stats st;
+
+	connect_admit_stats_get(&st);
+	snprintf(ret, size,
+	    "# TYPE nanomq_connect_admitted counter"
+	    "\n# HELP nanomq_connect_admitted"
+	    "\nnanomq_connect_admitted %llu"
+	    "\n# TYPE nanomq_connect_queued counter"
+	    "\n# HELP nanomq_connect_queued"
+	    "\nnanomq_connect_queued %llu"
+	    "\n# TYPE nanomq_connect_refused counter"
+	    "\n# HELP nanomq_connect_refused"
+	    "\nnanomq_connect_refused{reason=\"queue_full\"} %llu"
+	    "\nnanomq_connect_refused{reason=\"timeout\"} %llu"
+	    "\n# TYPE nanomq_connect_pending gauge"
+	    "\n# HELP nanomq_connect_pending"
+	    "\nnanomq_connect_pending %u"
+	    "\n# TYPE nanomq_connect_pending_max gauge"
+	    "\n# HELP nanomq_connect_pending_max"
+	    "\nnanomq_connect_pending_max %u\n",
+	    (unsigned long long) st.admitted, (unsigned long long) st.queued,
+	    (unsigned long long) st.refused, (unsigned long long) st.expired,
+	    st.pending, st.pending_max);
+}
+
+static void
+compose_pub_quota_metrics(char *ret, size_t size)
+{
+	size_t          len = 0;
+	pub_quota_stats st;
+
+	pub_quota_stats_get(&st);
+	len += snprintf(ret + len, size - len,
+	    "# TYPE nanomq_pub_quota_violations counter"
+	    "\n# HELP nanomq_pub_quota_violations\n");
+	for (int p = 0; p < PUB_QUOTA_POLICIES && len < size; p++) {
+		len += snprintf(ret + len, size - len,
+		    "nanomq_pub_quota_violations{action=\"%s\"} %llu\n",
+		    pub_quota_policy_name(p),
+		    (unsigned long long) st.violations[p]);
+	}
+	if (len >= size) {
+		return;
+	}
+	snprintf(ret + len, size - len,
+	    "# TYPE nanomq_pub_quota_delay_ms counter"
+	    "\n# HELP nanomq_pub_quota_delay_ms"
+	    "\nnanomq_pub_quota_delay_ms %llu"
+	    "\n# TYPE nanomq_pub_quota_users gauge"
+	    "\n# HELP nanomq_pub_quota_users"
+	    "\nnanomq_pub_quota_users %zu\n",
+	    (unsigned long long) st.delay_ms, st.users);
+}
+
+static void
+compose_sub_queue_metrics(char *ret, size_t size)
+{
+	size_t          len = 0;
+	sub_queue_stats st;
+
+	sub_queue_stats_get(&st);
+	len += snprintf(ret + len, size - len,
+	    "# TYPE nanomq_sub_queue_slow gauge"
+	    "\n# HELP nanomq_sub_queue_slow"
+	    "\nnanomq_sub_queue_slow %zu"
+	    "\n# TYPE nanomq_sub_queue_slow_events counter"
+	    "\n# HELP nanomq_sub_queue_slow_events"
+	    "\nnanomq_sub_queue_slow_events %llu"
+	    "\n# TYPE nanomq_sub_queue_dropped counter"
+	    "\n# HELP nanomq_sub_queue_dropped\n",
+	    st.slow, (unsigned long long) st.slow_events);
+	for (int p = 0; p < SUB_QUEUE_POLICIES && len < size; p++) {
+		len += snprintf(ret + len, size - len,
+		    "nanomq_sub_queue_dropped{action=\"%s\"} %llu\n",
+		    sub_queue_policy_name(p),
+		    (unsigned long long) st.dropped[p]);
+	}
+}
+
+static void
+compose_async_log_metrics(char *ret, size_t size)
+{
+	async_log_stats st;
+
+	async_log_stats_get(&st);
+	snprintf(ret, size,
+	    "# TYPE nanomq_log_written counter"
+	    "\n# HELP nanomq_log_written"
+	    "\nnanomq_log_written %llu"
+	    "\n# TYPE nanomq_log_dropped counter"
+	    "\n# HELP nanomq_log_dropped"
+	    "\nnanomq_log_dropped %llu"
+	    "\n# TYPE nanomq_log_suppressed counter"
+	    "\n# HELP nanomq_log_suppressed"
+	    "\nnanomq_log_suppressed %llu"
+	    "\n# TYPE nanomq_log_direct counter"
+	    "\n# HELP nanomq_log_direct"
+	    "\nnanomq_log_direct %llu"
+	    "\n# TYPE nanomq_log_rings gauge"
+	    "\n# HELP nanomq_log_rings"
+	    "\nnanomq_log_rings %zu\n",
+	    (unsigned long long) st.written, (unsigned long long) st.dropped,
+	    (unsigned long long) st.suppressed,
+	    (unsigned long long) st.direct, st.rings);
+}
+
+static void
+compose_startup_metrics(char *ret, size_t size)
+{
+	startup_stat st[STARTUP_SUBSYSTEMS];
+	int          len;
+
+	startup_stats_get(st);
+	len = snprintf(ret, size,
+	    "# TYPE nanomq_startup_state gauge"
+	    "\n# HELP nanomq_startup_state 0 off, 1 pending, 2 ready, 3 failed\n");
+	for (int i = 0; i < STARTUP_SUBSYSTEMS && len > 0 && (size_t) len < size;
+	     i++) {
+		len += snprintf(ret + len, size - len,
+		    "nanomq_startup_state{subsystem=\"%s\"} %d\n", st[i].name,
+		    (int) st[i].state);
+	}
+	if (len < 0 || (size_t) len >= size) {
+		return;
+	}
+	len += snprintf(ret + len, size - len,
+	    "# TYPE nanomq_startup_ready_ms gauge"
+	    "\n# HELP nanomq_startup_ready_ms time from start until ready\n");
+	for (int i = 0; i < STARTUP_SUBSYSTEMS && len > 0 && (size_t) len < size;
+	     i++) {
+		if (st[i].state != STARTUP_READY) {
+			continue;
+		}
+		len += snprintf(ret + len, size - len,
+		    "nanomq_startup_ready_ms{subsystem=\"%s\"} %llu\n",
+		    st[i].name, (unsigned long long) st[i].ready_ms);
+	}
+}
+
+#if defined(SUPP_ICEORYX)
+static void
+compose_iceoryx_metrics(char *ret, size_t size)
+{
+	static const char *names[] = { "queue_depth", "sent", "dropped",
+		"failed" };
+	iceoryx_map_stats  st[NANO_ICEORYX_MAPS];
+	size_t             n   = iceoryx_map_stats_get(st, NANO_ICEORYX_MAPS);
+	int                len = 0;
+
+	for (int m = 0; m < 4 && len >= 0 && (size_t) len < size; m++) {
+		len += snprintf(ret + len, size - len,
+		    "# TYPE nanomq_iceoryx_%s %s\n# HELP nanomq_iceoryx_%s "
+		    "per out mapping\n",
+		    names[m], m == 0 ? "gauge" : "counter", names[m]);
+		for (size_t i = 0; i < n && len > 0 && (size_t) len < size;
+		     i++) {
+			uint64_t v = m == 0 ? st[i].depth
+			    : m == 1        ? st[i].sent
+			    : m == 2        ? st[i].dropped
+			                    : st[i].failed;
+			len += snprintf(ret + len, size - len,
+			    "nanomq_iceoryx_%s{filter=\"%s\",event=\"%s\"} "
+			    "%llu\n",
+			    names[m], st[i].filter, st[i].event,
+			    (unsigned long long) v);
+		}
+	}
+}
+#endif
+
+#if defined(SUPP_SESSION_SPILL)
+static void
+compose_session_spill_metrics(char *ret, size_t size)
+{
+	session_spill_stats st;
+
+	session_spill_stats_get(&st);
+	snprintf(ret, size,
+	    "# TYPE nanomq_session_offline gauge"
+	    "\n# HELP nanomq_session_offline"
+	    "\nnanomq_session_offline %zu"
+	    "\n# TYPE nanomq_session_queue_mem_bytes gauge"
+	    "\n# HELP nanomq_session_queue_mem_bytes"
+	    "\nnanomq_session_queue_mem_bytes %llu"
+	    "\n# TYPE nanomq_session_queue_disk_bytes gauge"
+	    "\n# HELP nanomq_session_queue_disk_bytes"
+	    "\nnanomq_session_queue_disk_bytes %llu"
+	    "\n# TYPE nanomq_session_queue_spilled counter"
+	    "\n# HELP nanomq_session_queue_spilled"
+	    "\nnanomq_session_queue_spilled %llu"
+	    "\n# TYPE nanomq_session_queue_replayed counter"
+	    "\n# HELP nanomq_session_queue_replayed"
+	    "\nnanomq_session_queue_replayed %llu"
+	    "\n# TYPE nanomq_session_queue_dropped counter"
+	    "\n# HELP nanomq_session_queue_dropped"
+	    "\nnanomq_session_queue_dropped %llu\n",
+	    st.sessions, (unsigned long long) st.mem,
+	    (unsigned long long) st.disk, (unsigned long long) st.spilled,
+	    (unsigned long long) st.replayed, (unsigned long long) st.dropped);
+}
+#endif
+
+#if defined(NNG_SUPP_SQLITE)
+static void
+compose_sqlite_commit_metrics(char *ret, size_t size)
+{
+	sqlite_commit_stats st;
+
+	sqlite_commit_stats_get(&st);
+	snprintf(ret, size,
+	    "# TYPE nanomq_sqlite_commit_ops counter"
+	    "\n# HELP nanomq_sqlite_commit_ops"
+	    "\nnanomq_sqlite_commit_ops %llu"
+	    "\n# TYPE nanomq_sqlite_commits counter"
+	    "\n# HELP nanomq_sqlite_commits"
+	    "\nnanomq_sqlite_commits %llu"
+	    "\n# TYPE nanomq_sqlite_commit_batch_max gauge"
+	    "\n# HELP nanomq_sqlite_commit_batch_max"
+	    "\nnanomq_sqlite_commit_batch_max %zu"
+	    "\n# TYPE nanomq_sqlite_commit_queued gauge"
+	    "\n# HELP nanomq_sqlite_commit_queued"
+	    "\nnanomq_sqlite_commit_queued %zu"
+	    "\n# TYPE nanomq_sqlite_commit_stalls counter"
+	    "\n# HELP nanomq_sqlite_commit_stalls"
+	    "\nnanomq_sqlite_commit_stalls %llu\n",
+	    (unsigned long long) st.ops, (unsigned long long) st.commits,
+	    st.batch_max, st.queued, (unsigned long long) st.stalls);
+}
+#endif
+
+#if defined(SUPP_TRAFFIC_STATS)
+// Prometheus label value of topic, quotes, backslashes and newlines escaped.
+static void
+escape_metric_label(char *dst, size_t size, const char *src)
+{
+	size_t n = 0;
+
+	for (; *src != '\0' && n + 3 < size; src++) {
+		if (*src == '"' || *src == '\\') {
+			dst[n++] = '\\';
+			dst[n++] = *src;
+		} else if (*src == '\n') {
+			dst[n++] = '\\';
+			dst[n++] = 'n';
+		} else {
+			dst[n++] = *src;
+		}
+	}
+	dst[n] = '\0';
+}
+
+static void
+compose_traffic_metrics(char *ret, size_t size)
+{
+	traffic_topic top[NANO_TRAFFIC_TOPICS];
+	char          label[NANO_TRAFFIC_TOPIC_LEN * 2];
+	size_t        n   = traffic_topic_top(top, NANO_TRAFFIC_TOPICS);
+	int           len = 0;
+
+	len = snprintf(ret, size,
+	    "# TYPE nanomq_topic_messages_rate gauge"
+	    "\n# HELP nanomq_topic_messages_rate"
+	    "\n# TYPE nanomq_topic_bytes_rate gauge"
+	    "\n# HELP nanomq_topic_bytes_rate\n");
+	for (size_t i = 0; i < n && len > 0 && (size_t) len < size; i++) {
+		escape_metric_label(label, sizeof(label), top[i].topic);
+		len += snprintf(ret + len, size - len,
+		    "nanomq_topic_messages_rate{topic=\"%s\"} %.2f"
+		    "\nnanomq_topic_bytes_rate{topic=\"%s\"} %.2f\n",
+		    label, top[i].msgs * 1000.0 / NANO_TRAFFIC_WINDOW_MS, label,
+		    top[i].bytes * 1000.0 / NANO_TRAFFIC_WINDOW_MS);
+	}
+}
+#endif
+
+// Buckets at 1us, 4us, 16us ... 4s, as powers of four of nanoseconds.
+#define LATENCY_PROM_LOG2_MIN 10
+#define LATENCY_PROM_LOG2_MAX 32
+
+static void
+compose_latency_metrics(char *ret, size_t size)
+{
+	latency_hist hist[LATENCY_STAGES];
+	int          len;
+
+	latency_collect(hist);
+	len = snprintf(ret, size,
+	    "# TYPE nanomq_stage_latency_seconds histogram"
+	    "\n# HELP nanomq_stage_latency_seconds sampled time per stage\n");
+	for (int s = 0; s < LATENCY_STAGES; s++) {
+		const char *name = latency_stage_name(s);
+
+		for (unsigned k = LATENCY_PROM_LOG2_MIN;
+		     k <= LATENCY_PROM_LOG2_MAX && len > 0 && (size_t) len < size;
+		     k += 2) {
+			len += snprintf(ret + len, size - len,
+			    "nanomq_stage_latency_seconds_bucket{stage=\"%s\","
+			    "le=\"%g\"} %llu\n",
+			    name, (double) (1ULL << k) / 1e9,
+			    (unsigned long long) latency_count_below(
+			        &hist[s], k));
+		}
+		if (len < 0 || (size_t) len >= size) {
+			break;
+		}
+		len += snprintf(ret + len, size - len,
+		    "nanomq_stage_latency_seconds_bucket{stage=\"%s\","
+		    "le=\"+Inf\"} %llu"
+		    "\nnanomq_stage_latency_seconds_sum{stage=\"%s\"} %g"
+		    "\nnanomq_stage_latency_seconds_count{stage=\"%s\"} %llu\n",
+		    name, (unsigned long long) hist[s].count, name,
+		    hist[s].sum / 1e9, name, (unsigned long long) hist[s].count);
+	}
+}
+
+#ifdef ACL_SUPP
+static void
+compose_acl_cache_metrics(char *ret, size_t size)
+{
+	char fmt[] = "# TYPE nanomq_acl_cache_hits counter"
+	             "\n# HELP nanomq_acl_cache_hits"
+	             "\nnanomq_acl_cache_hits %llu"
+	             "\n# TYPE nanomq_acl_cache_misses counter"
+	             "\n# HELP nanomq_acl_cache_misses"
+	             "\nnanomq_acl_cache_misses %llu\n";
+
+	snprintf(ret, size, fmt, (unsigned long long) acl_cache_hits(),
+	    (unsigned long long) acl_cache_misses());
+}
+#endif
+
+#ifdef SUPP_AWS_BRIDGE
+static void
+compose_aws_bridge_metrics(char *ret, size_t size, conf_bridge *bridge)
+{
+	size_t len = 0;
+
+	len += snprintf(ret + len, size - len,
+	    "# TYPE nanomq_aws_bridge_queue_depth gauge"
+	    "\n# HELP nanomq_aws_bridge_queue_depth"
+	    "\n# TYPE nanomq_aws_bridge_sent counter"
+	    "\n# HELP nanomq_aws_bridge_sent"
+	    "\n# TYPE nanomq_aws_bridge_dropped counter"
+	    "\n# HELP nanomq_aws_bridge_dropped"
+	    "\n# TYPE nanomq_aws_bridge_latency_ms gauge"
+	    "\n# HELP nanomq_aws_bridge_latency_ms"
+	    "\n# TYPE nanomq_aws_bridge_latency_max_ms gauge"
+	    "\n# HELP nanomq_aws_bridge_latency_max_ms\n");
+	for (size_t i = 0; i < bridge->count && len < size; i++) {
+		conf_bridge_node *node = bridge->nodes[i];
+		aws_bridge_stats  st;
+		if (aws_bridge_stat(node, &st) != 0) {
+			continue;
+		}
+		len += snprintf(ret + len, size - len,
+		    "nanomq_aws_bridge_queue_depth{node=\"%s\"} %llu"
+		    "\nnanomq_aws_bridge_sent{node=\"%s\"} %llu"
+		    "\nnanomq_aws_bridge_dropped{node=\"%s\"} %llu"
+		    "\nnanomq_aws_bridge_latency_ms{node=\"%s\"} %llu"
+		    "\nnanomq_aws_bridge_latency_max_ms{node=\"%s\"} %llu\n",
+		    node->name, (unsigned long long) st.depth, node->name,
+		    (unsigned long long) st.sent, node->name,
+		    (unsigned long long) (st.dropped + st.failed), node->name,
+		    (unsigned long long) st.latency_ms, node->name,
+		    (unsigned long long) st.latency_max_ms);
+	}
+}
+#endif
+
+#define max_stats(s, ms, field) ms->field > s->field ? ms->field : s->field
+
+static void
+update_max_stats(client_stats *ms, client_stats *s)
+{
+	// TODO not strictly the maximum value.
+	ms->topics      = max_stats(s, ms, topics);
+	ms->sessions    = max_stats(s, ms, sessions);
+	ms->connections = max_stats(s, ms, connections);
+	ms->subscribers = max_stats(s, ms, subscribers);
+	ms->memory      = max_stats(s, ms, memory);
+	ms->cpu_percent = max_stats(s, ms, cpu_percent);
+}
+
+static http_msg
+get_prometheus(http_msg *msg, kv **params, size_t param_num,
+    const char *client_id, const char *username, nng_socket *broker_sock)
+{
+	http_msg res = { .status = NNG_HTTP_STATUS_OK };
+
+	client_stats stats     = { 0 };
+	client_stats max_stats = { 0 };
+	sub_stats    ss;
+	proc_sample  ps = { 0 };
+	proc_sample  pm;
+
+	sub_stats_get(&ss);
+	stats.connections      = ss.connections;
+	stats.sessions         = ss.connections;
+	stats.subscribers      = dbhash_get_pipe_cnt();
+	stats.topics           = ss.topics;
+#ifdef STATISTICS
+	stats.message_received = nanomq_get_message_in();
+	stats.message_sent     = nanomq_get_message_out();
+	stats.message_dropped  = nanomq_get_message_drop();
+#endif
+
+	if (proc_stats_latest(&ps)) {
+		stats.memory      = ps.memory;
+		stats.cpu_percent = ps.cpu_percent;
+	}
+	if (proc_stats_max(&pm)) {
+		max_stats.connections = pm.connections;
+		max_stats.sessions    = pm.connections;
+		max_stats.topics      = pm.topics;
+		max_stats.subscribers = pm.subscribers;
+		max_stats.memory      = pm.memory;
+		max_stats.cpu_percent = pm.cpu_percent;
+	}
+
+	char dest[METRICS_DATA_SIZE] = { 0 };
+	update_max_stats(&max_stats, &stats);
+	compose_metrics(dest, &max_stats, &stats);
+	if (proc_stats_enabled()) {
+		size_t len = strlen(dest);
+		compose_proc_stats_metrics(
+		    dest + len, METRICS_DATA_SIZE - len, &ps);
+	}
+	if (sub_stats_enabled()) {
+		size_t len = strlen(dest);
+		compose_sub_stats_metrics(
+		    dest + len, METRICS_DATA_SIZE - len, &ss);
+	}
+	if (match_cache_enabled()) {
+		size_t len = strlen(dest);
+		compose_match_cache_metrics(
+		    dest + len, METRICS_DATA_SIZE - len);
+	}
+	if (retain_store_enabled()) {
+		size_t len = strlen(dest);
+		compose_retain_store_metrics(
+		    dest + len, METRICS_DATA_SIZE - len);
+	}
+	if (work_lane_enabled()) {
+		size_t len = strlen(dest);
+		compose_work_lane_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+	if (work_arena_enabled()) {
+		size_t len = strlen(dest);
+		compose_work_arena_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+	if (transform_enabled()) {
+		size_t len = strlen(dest);
+		compose_transform_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+	if (msg_pool_enabled()) {
+		size_t len = strlen(dest);
+		compose_msg_pool_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+	if (connect_admit_enabled()) {
+		size_t len = strlen(dest);
+		compose_connect_admit_metrics(
+		    dest + len, METRICS_DATA_SIZE - len);
+	}
+	if (pub_quota_enabled()) {
+		size_t len = strlen(dest);
+		compose_pub_quota_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+	if (sub_queue_enabled()) {
+		size_t len = strlen(dest);
+		compose_sub_queue_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+	if (async_log_enabled()) {
+		size_t len = strlen(dest);
+		compose_async_log_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+	if (startup_enabled()) {
+		size_t len = strlen(dest);
+		compose_startup_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+#if defined(SUPP_ICEORYX)
+	if (iceoryx_map_enabled()) {
+		size_t len = strlen(dest);
+		compose_iceoryx_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+#endif
+#if defined(SUPP_SESSION_SPILL)
+	if (session_spill_enabled()) {
+		size_t len = strlen(dest);
+		compose_session_spill_metrics(
+		    dest + len, METRICS_DATA_SIZE - len);
+	}
+#endif
+#if defined(NNG_SUPP_SQLITE)
+	if (sqlite_commit_enabled()) {
+		size_t len = strlen(dest);
+		compose_sqlite_commit_metrics(
+		    dest + len, METRICS_DATA_SIZE - len);
+	}
+#endif
+#if defined(SUPP_TRAFFIC_STATS)
+	if (traffic_stats_enabled()) {
+		size_t len = strlen(dest);
+		compose_traffic_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+#endif
+	if (latency_stats_enabled()) {
+		size_t len = strlen(dest);
+		compose_latency_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+#ifdef ACL_SUPP
+	if (acl_cache_enabled()) {
+		size_t len = strlen(dest);
+		compose_acl_cache_metrics(dest + len, METRICS_DATA_SIZE - len);
+	}
+#endif
+#ifdef SUPP_AWS_BRIDGE
+	if (get_global_conf()->aws_bridge.count > 0) {
+		size_t len = strlen(dest);
+		compose_aws_bridge_metrics(dest + len, METRICS_DATA_SIZE - len,
+		    &get_global_conf()->aws_bridge);
+	}
+#endif
+
+	put_http_msg(&res, "text/plain", NULL, NULL, NULL, dest, strlen(dest));
+
+	return res;
+}
+
+static http_msg
+get_metrics(http_msg *msg, kv **params, size_t param_num,
+    const char *client_id, const char *username, nng_socket *broker_sock)
+{
+	http_msg res     = { .status = NNG_HTTP_STATUS_OK };
+	cJSON   *res_obj = cJSON_CreateObject();
+	cJSON   *metrics = cJSON_CreateArray();
+
+	proc_sample ps = { 0 };
+
+	proc_stats_latest(&ps);
+	char cpu[16] = { 0 };
+	char mem[64] = { 0 };
+	snprintf(cpu, 16, "%.2f%%", ps.cpu_percent);
+	snprintf(mem, 64, "%llu", (unsigned long long) ps.memory);
+
+	cJSON_AddItemToObject(res_obj, "metrics", metrics);
+	cJSON_AddStringToObject(res_obj, "cpuinfo", cpu);
+	cJSON_AddStringToObject(res_obj, "memory", mem);
+
+#if defined(SUPP_TRAFFIC_STATS)
+	if (traffic_stats_enabled()) {
+		traffic_topic top[NANO_TRAFFIC_TOPICS];
+		size_t        n = traffic_topic_top(top, NANO_TRAFFIC_TOPICS);
+		cJSON        *topics = cJSON_CreateArray();
+
+		for (size_t i = 0; i < n; i++) {
+			cJSON *t = cJSON_CreateObject();
+			cJSON_AddStringToObject(t, "topic", top[i].topic);
+			cJSON_AddNumberToObject(t, "messages", top[i].msgs);
+			cJSON_AddNumberToObject(t, "bytes", top[i].bytes);
+			cJSON_AddNumberToObject(t, "error", top[i].error);
+			cJSON_AddNumberToObject(t, "rate",
+			    top[i].msgs * 1000.0 / NANO_TRAFFIC_WINDOW_MS);
+			cJSON_AddItemToArray(topics, t);
+		}
+		cJSON_AddNumberToObject(
+		    res_obj, "topics_window_ms", NANO_TRAFFIC_WINDOW_MS);
+		cJSON_AddItemToObject(res_obj, "topics", topics);
+	}
+#endif
+
+	// cJSON *meta = cJSON_CreateObject();
+	// cJSON_AddItemToObject(res_obj, "meta", meta);
+	// TODO add meta content: page, limit, count
+	char *dest = cJSON_PrintUnformatted(res_obj);
+	put_http_msg(&res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+
+	cJSON_free(dest);
+	cJSON_Delete(res_obj);
+
+	return res;
+}
+
+static http_msg
+get_latency(http_msg *msg)
+{
+	http_msg     res     = { .status = NNG_HTTP_STATUS_OK };
+	cJSON       *res_obj = cJSON_CreateObject();
+	cJSON       *stages  = cJSON_CreateArray();
+	latency_hist hist[LATENCY_STAGES];
+
+	latency_collect(hist);
+	for (int s = 0; latency_stats_enabled() && s < LATENCY_STAGES; s++) {
+		cJSON *stage = cJSON_CreateObject();
+		double count = hist[s].count;
+
+		cJSON_AddStringToObject(stage, "stage", latency_stage_name(s));
+		cJSON_AddNumberToObject(stage, "count", count);
+		// microseconds
+		cJSON_AddNumberToObject(stage, "mean",
+		    count > 0 ? hist[s].sum / count / 1000.0 : 0);
+		cJSON_AddNumberToObject(
+		    stage, "p50", latency_quantile(&hist[s], 0.5) / 1000.0);
+		cJSON_AddNumberToObject(
+		    stage, "p99", latency_quantile(&hist[s], 0.99) / 1000.0);
+		cJSON_AddNumberToObject(
+		    stage, "p999", latency_quantile(&hist[s], 0.999) / 1000.0);
+		cJSON_AddItemToArray(stages, stage);
+	}
+	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
+	cJSON_AddNumberToObject(res_obj, "sample", NANO_LATENCY_SAMPLE);
+	cJSON_AddItemToObject(res_obj, "data", stages);
+
+	char *dest = cJSON_PrintUnformatted(res_obj);
+	put_http_msg(
+	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+
+	cJSON_free(dest);
+	cJSON_Delete(res_obj);
+
+	return res;
+}
+
+/*
+ * ?seconds=&hz=&format=json|folded. The request holds its REST worker for
+ * the whole run, the other workers keep serving.
+ */
+static http_msg
+get_debug_profile(http_msg *msg, kv **params, size_t param_num)
+{
+	http_msg      res     = { .status = NNG_HTTP_STATUS_OK };
+	const char   *format  = find_param(params, param_num, "format");
+	uint64_t      secs    = 30;
+	uint64_t      hz      = NANO_PROF_HZ;
+	uint64_t      samples = 0;
+	uint64_t      dropped = 0;
+	char         *folded  = NULL;
+	size_t        len     = 0;
+	prof_counters before;
+	prof_counters after;
+	int           rv;
+
+	if (!prof_enabled()) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_NOT_FOUND, PLUGIN_IS_CLOSED);
+	}
+	if ((find_param(params, param_num, "seconds") != NULL &&
+	        !parse_u64_param(params, param_num, "seconds", &secs)) ||
+	    (find_param(params, param_num, "hz") != NULL &&
+	        !parse_u64_param(params, param_num, "hz", &hz)) ||
+	    secs == 0 || secs > NANO_PROF_MAX_SECONDS || hz == 0 ||
+	    hz > 1000 ||
+	    (format != NULL && strcmp(format, "json") != 0 &&
+	        strcmp(format, "folded") != 0)) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
+	}
+
+	rv = prof_run((unsigned) secs, (unsigned) hz, &folded, &len,
+	    &samples, &dropped, &before, &after);
+	if (rv == NNG_EBUSY) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_CONFLICT, UNKNOWN_MISTAKE);
+	} else if (rv != 0) {
+		log_warn("profile failed: %d", rv);
+		return error_response(
+		    msg, NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR, UNKNOWN_MISTAKE);
+	}
+
+	if (format != NULL && strcmp(format, "folded") == 0) {
+		put_http_msg(&res, "text/plain", NULL, NULL, NULL, folded, len);
+		nng_strfree(folded);
+		return res;
+	}
+
+	cJSON *res_obj = cJSON_CreateObject();
+	cJSON *states  = cJSON_CreateObject();
+	cJSON *locks   = cJSON_CreateArray();
+
+	// both counted over the run only
+	for (int i = 0; i < PROF_STATES; i++) {
+		cJSON_AddNumberToObject(states, prof_state_name(i),
+		    after.states[i] - before.states[i]);
+	}
+	for (int i = 0; i < PROF_LOCKS; i++) {
+		const prof_lock_stats *a    = &after.locks[i];
+		const prof_lock_stats *b    = &before.locks[i];
+		cJSON                 *lock = cJSON_CreateObject();
+
+		cJSON_AddStringToObject(lock, "name", prof_lock_name(i));
+		cJSON_AddNumberToObject(
+		    lock, "acquired", a->acquired - b->acquired);
+		cJSON_AddNumberToObject(
+		    lock, "contended", a->contended - b->contended);
+		cJSON_AddNumberToObject(
+		    lock, "wait_us", (a->wait_ns - b->wait_ns) / 1000.0);
+		// since start, a maximum does not subtract
+		cJSON_AddNumberToObject(
+		    lock, "wait_max_us", a->wait_max_ns / 1000.0);
+		cJSON_AddItemToArray(locks, lock);
+	}
+	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
+	cJSON_AddNumberToObject(res_obj, "seconds", secs);
+	cJSON_AddNumberToObject(res_obj, "hz", hz);
+	cJSON_AddNumberToObject(res_obj, "samples", samples);
+	cJSON_AddNumberToObject(res_obj, "dropped", dropped);
+	cJSON_AddItemToObject(res_obj, "states", states);
+	cJSON_AddItemToObject(res_obj, "locks", locks);
+	cJSON_AddStringToObject(res_obj, "folded", folded);
+	nng_strfree(folded);
+
+	char *dest = cJSON_PrintUnformatted(res_obj);
+	put_http_msg(
+	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+
+	cJSON_free(dest);
+	cJSON_Delete(res_obj);
+
+	return res;
+}
+
+static void
+shared_group_cb(const share_group_info *info, void *arg)
+{
+	cJSON *data    = arg;
+	cJSON *obj     = cJSON_CreateObject();
+	cJSON *members = cJSON_CreateArray();
+	char  *group   = nng_alloc(info->group_len + 1);
+
+	if (group != NULL) {
+		memcpy(group, info->group, info->group_len);
+		group[info->group_len] = '\0';
+		cJSON_AddStringToObject(obj, "group", group);
+		nng_free(group, info->group_len + 1);
+	}
+	cJSON_AddStringToObject(obj, "topic", info->filter);
+	cJSON_AddStringToObject(
+	    obj, "strategy", share_strategy_name(info->strategy));
+	cJSON_AddNumberToObject(obj, "dispatched", info->dispatched);
+	for (size_t i = 0; i < info->nmembers; i++) {
+		cJSON *m = cJSON_CreateObject();
+		if (info->members[i].clientid != NULL) {
+			cJSON_AddStringToObject(
+			    m, "clientid", info->members[i].clientid);
+		}
+		cJSON_AddBoolToObject(m, "local", info->members[i].local);
+		cJSON_AddNumberToObject(
+		    m, "dispatched", info->members[i].dispatched);
+		cJSON_AddItemToArray(members, m);
+	}
+	cJSON_AddItemToObject(obj, "members", members);
+	cJSON_AddItemToArray(data, obj);
+}
+
+static http_msg
+get_shared_subscriptions(http_msg *msg)
+{
+	http_msg res     = { .status = NNG_HTTP_STATUS_OK };
+	cJSON   *res_obj = cJSON_CreateObject();
+	cJSON   *data    = cJSON_CreateArray();
+
+	share_group_foreach(shared_group_cb, data);
+	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
+	cJSON_AddStringToObject(res_obj, "default",
+	    share_strategy_name(share_group_default_strategy()));
+	cJSON_AddItemToObject(res_obj, "data", data);
+
+	char *dest = cJSON_PrintUnformatted(res_obj);
+	put_http_msg(
+	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+
+	cJSON_free(dest);
+	cJSON_Delete(res_obj);
+
+	return res;
+}
+
+// {"strategy": "sticky", "group": "g"}, without a group sets the default
+static http_msg
+put_shared_strategy(http_msg *msg)
+{
+	http_msg       res = { .status = NNG_HTTP_STATUS_OK };
+	share_strategy s;
+	cJSON         *req = cJSON_ParseWithLength(msg->data, msg->data_len);
+	cJSON         *group;
+
+	if (!cJSON_IsObject(req)) {
+		cJSON_Delete(req);
+		return error_response(msg, NNG_HTTP_STATUS_BAD_REQUEST,
+		    REQ_PARAMS_JSON_FORMAT_ILLEGAL);
+	}
+	group = cJSON_GetObjectItem(req, "group");
+	if (share_strategy_parse(cJSON_GetStringValue(cJSON_GetObjectItem(
+	                             req, "strategy")),
+	        &s) != 0 ||
+	    (group != NULL && !cJSON_IsString(group)) ||
+	    share_group_set_strategy(
+	        group != NULL ? group->valuestring : NULL, s) != 0) {
+		cJSON_Delete(req);
+		return error_response(
+		    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
+	}
+	cJSON_Delete(req);
+
+	cJSON *res_obj = cJSON_CreateObject();
+	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
+	char *dest = cJSON_PrintUnformatted(res_obj);
+	put_http_msg(
+	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+	cJSON_free(dest);
+	cJSON_Delete(res_obj);
+
+	return res;
+}
+
+static http_msg
+get_resources(http_msg *msg)
+{
+	http_msg     res     = { .status = NNG_HTTP_STATUS_OK };
+	cJSON       *res_obj = cJSON_CreateObject();
+	cJSON       *data    = cJSON_CreateArray();
+	proc_sample *samples;
+	size_t       n = 0;
+
+	if ((samples = nng_alloc(
+	         sizeof(proc_sample) * NANO_PROC_STATS_HISTORY)) != NULL) {
+		n = proc_stats_history(samples, NANO_PROC_STATS_HISTORY);
+	}
+	for (size_t i = 0; i < n; i++) {
+		proc_sample *ps  = &samples[i];
+		cJSON       *obj = cJSON_CreateObject();
+
+		cJSON_AddNumberToObject(obj, "time", ps->time);
+		cJSON_AddNumberToObject(obj, "cpu", ps->cpu_percent);
+		cJSON_AddNumberToObject(obj, "memory", ps->memory);
+		cJSON_AddNumberToObject(obj, "fds", ps->fds);
+		cJSON_AddNumberToObject(obj, "threads", ps->threads);
+		cJSON_AddNumberToObject(obj, "taskq_threads", ps->taskq_threads);
+		cJSON_AddNumberToObject(obj, "taskq_cpu", ps->taskq_cpu_percent);
+		cJSON_AddNumberToObject(
+		    obj, "taskq_cpu_max", ps->taskq_cpu_max_percent);
+		cJSON_AddNumberToObject(obj, "connections", ps->connections);
+		cJSON_AddNumberToObject(obj, "topics", ps->topics);
+		cJSON_AddNumberToObject(obj, "subscribers", ps->subscribers);
+		cJSON_AddNumberToObject(
+		    obj, "bridge_queue_depth", ps->bridge_queue_depth);
+		cJSON_AddNumberToObject(
+		    obj, "aws_bridge_queue_depth", ps->aws_queue_depth);
+		cJSON_AddItemToArray(data, obj);
+	}
+	if (samples != NULL) {
+		nng_free(samples, sizeof(proc_sample) * NANO_PROC_STATS_HISTORY);
+	}
+	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
+	cJSON_AddNumberToObject(
+	    res_obj, "interval_ms", NANO_PROC_STATS_INTERVAL_MS);
+	cJSON_AddItemToObject(res_obj, "data", data);
+
+	char *dest = cJSON_PrintUnformatted(res_obj);
+	put_http_msg(
+	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+
+	cJSON_free(dest);
+	cJSON_Delete(res_obj);
+
+	return res;
+}
+
+static int
+ptpair_cmp(const void *a, const void *b)
+{
+	const dbhash_ptpair_t *x = *(dbhash_ptpair_t *const *) a;
+	const dbhash_ptpair_t *y = *(dbhash_ptpair_t *const *) b;
+
+	return pipe_id_cmp(&x->pipe, &y->pipe);
+}
+
+/*
+ * Subscriptions are listed by pipe id, then in subscribe order within the
+ * pipe; the cursor holds the pipe in its upper and the offset in its lower
+ * 32 bits.
+ */
+static http_msg
+get_subscriptions(
+    http_msg *msg, kv **params, size_t param_num, const char *client_id)
+{
+	json_writer       w = { 0 };
+	rest_page         pg;
+	sub_stats         ss;
+	dbhash_ptpair_t **pt;
+	size_t            size;
+	uint64_t          skip;
+	const char       *topic;
+	uint64_t          qos   = 0;
+	bool              has_qos;
+	bool              filtered;
+	size_t            n     = 0;
+	size_t            count = 0;
+	bool              done  = false;
+	uint64_t          next  = 0;
+
+	if (rest_page_parse(params, param_num, &pg) != SUCCEED) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
+	}
+	if (client_id == NULL) {
+		client_id = find_param(params, param_num, "clientid");
+	}
+	topic   = find_param(params, param_num, "topic");
+	has_qos = parse_u64_param(params, param_num, "qos", &qos);
+	if ((!has_qos && find_param(params, param_num, "qos") != NULL) ||
+	    qos > 2) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
+	}
+	filtered = client_id != NULL || topic != NULL || has_qos;
+	skip     = pg.has_cursor ? 0 : (uint64_t) (pg.page - 1) * pg.limit;
+
+	pt   = dbhash_get_ptpair_all();
+	size = cvector_size(pt);
+	if (size > 0) {
+		qsort(pt, size, sizeof(dbhash_ptpair_t *), ptpair_cmp);
+	}
+
+	json_write_str(&w, "{\"code\":0,\"data\":[");
+	for (size_t i = 0; i < size; i++) {
+		uint32_t     pipe = pt[i]->pipe;
+		nng_pipe     p    = { .id = pipe };
+		conn_param  *cp;
+		const char  *cid = NULL;
+		topic_queue *tq;
+		topic_queue *tn;
+		uint64_t     pos = (uint64_t) pipe << 32;
+
+		// without a filter the total is known, stop with the page
+		if (!filtered &&
+		    (done || (pg.has_cursor && pos + UINT32_MAX < pg.cursor))) {
+			if (done) {
+				break;
+			}
+			continue;
+		}
+		if ((cp = nng_pipe_cparam(p)) != NULL) {
+			cid = (const char *) conn_param_get_clientid(cp);
+		}
+		if (client_id != NULL &&
+		    (cid == NULL || strcmp(client_id, cid) != 0)) {
+			if (cp != NULL) {
+				conn_param_free(cp);
+			}
+			continue;
+		}
+		tq = dbhash_copy_topic_queue(pipe);
+		for (; tq != NULL; tq = tn, pos++) {
+			tn = tq->next;
+			if ((topic != NULL && strcmp(topic, tq->topic) != 0) ||
+			    (has_qos && tq->qos != qos)) {
+				goto next_topic;
+			}
+			count++;
+			if (done || (pg.has_cursor && pos < pg.cursor)) {
+				// before the page or after it
+			} else if (skip > 0) {
+				skip--;
+			} else if (n == pg.limit) {
+				done = true;
+				next = pos;
+			} else {
+				json_write_begin(&w, '{');
+				json_field_str(&w, "clientid", cid ? cid : "");
+				json_field_str(&w, "topic", tq->topic);
+				json_field_u64(&w, "qos", tq->qos);
+				json_write_end(&w, '}');
+				n++;
 			}
-			cvector_free(vn[i][j]->clients);
-			nng_free(vn[i][j], sizeof(dbtree_info));
+		next_topic:
+			nng_free(tq->topic, strlen(tq->topic));
+			nng_free(tq, sizeof(topic_queue));
+		}
+		if (cp != NULL) {
+			conn_param_free(cp);
 		}
-		cvector_free(vn[i]);
 	}
-	cvector_free(vn);
-	return counter;
-}
-
-static long
-get_cpu_time()
-{
-	FILE *fd;
-	char  buff[256];
+	for (size_t i = 0; i < size; i++) {
+		dbhash_ptpair_free(pt[i]);
+	}
+	cvector_free(pt);
 
-	fd = fopen("/proc/stat", "r");
-	if (fd == NULL) {
-		log_error("open /proc/stat failed!");
-		return -1;
+	if (!filtered) {
+		sub_stats_get(&ss);
+		count = ss.subscriptions;
 	}
+	json_write_meta(&w, &pg, count, done, next);
 
-	fgets(buff, sizeof(buff), fd);
-	uint32_t user, nice, sys, idle, iowait, irq, sirq, steal;
+	return json_writer_response(msg, &w);
+}
 
-	int rc = sscanf(buff, "%*s %u %u %u %u %u %u %u %u", &user, &nice, &sys, &idle,
-	    &iowait, &irq, &sirq, &steal);
+/*
+ * Key range of an exchange query: start_key/end_key as stored, or from/to
+ * in ms of wall clock, either bound left open when missing.
+ */
+static bool
+exchange_query_range(
+    kv **params, size_t param_num, uint64_t *start_key, uint64_t *end_key)
+{
+	uint64_t v;
+
+	*start_key = 0;
+	*end_key   = UINT64_MAX;
+	if (parse_u64_param(params, param_num, "from", &v)) {
+		*start_key = NANO_EXCHANGE_KEY_MIN(v);
+	} else if (find_param(params, param_num, "from") != NULL) {
+		return false;
+	}
+	if (parse_u64_param(params, param_num, "to", &v)) {
+		*end_key = NANO_EXCHANGE_KEY_MAX(v);
+	} else if (find_param(params, param_num, "to") != NULL) {
+		return false;
+	}
+	if (parse_u64_param(params, param_num, "start_key", &v)) {
+		*start_key = v;
+	} else if (find_param(params, param_num, "start_key") != NULL) {
+		return false;
+	}
+	if (parse_u64_param(params, param_num, "end_key", &v)) {
+		*end_key = v;
+	} else if (find_param(params, param_num, "end_key") != NULL) {
+		return false;
+	}
+	return *start_key <= *end_key;
+}
 
-	fclose(fd);
+#ifdef SUPP_PARQUET
 
-	if (rc != 8) {
-		log_error("scanf error!");
-		return -1;
-	}
-	long ret = user + nice + sys + idle + iowait + irq + sirq + steal;
-	return ret;
+static int
+exchange_file_to_json(const exchange_query_file *file, void *arg)
+{
+	cJSON *array = arg;
+	cJSON *item  = cJSON_CreateObject();
+	char   key[24];
+
+	cJSON_AddStringToObject(item, "file", file->path);
+	snprintf(key, sizeof(key), "%" PRIu64, file->start_key);
+	cJSON_AddStringToObject(item, "start_key", key);
+	snprintf(key, sizeof(key), "%" PRIu64, file->end_key);
+	cJSON_AddStringToObject(item, "end_key", key);
+	cJSON_AddItemToArray(array, item);
+	return 0;
 }
 
-#if NANO_PLATFORM_LINUX
-static long
-update_process_info(client_stats *s)
+static http_msg
+get_exchange_files(http_msg *msg, kv **params, size_t param_num)
 {
-	static long last_cpu_time  = 0;
-	static long last_proc_time = 0;
+	http_msg res = { .status = NNG_HTTP_STATUS_OK };
+	uint64_t start_key;
+	uint64_t end_key;
+	cJSON   *res_obj;
+	cJSON   *data;
+	int      rv;
 
-	long cpu_time = get_cpu_time();
-	if (cpu_time == -1) {
-		s->cpu_percent = -1;
-		return -1;
+	if (!exchange_query_range(params, param_num, &start_key, &end_key)) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
+	}
+	data = cJSON_CreateArray();
+	rv   = exchange_query_span(
+            start_key, end_key, exchange_file_to_json, data);
+	if (rv < 0) {
+		cJSON_Delete(data);
+		return error_response(msg,
+		    rv == -NNG_ENOTSUP ? NNG_HTTP_STATUS_NOT_FOUND
+		                       : NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR,
+		    UNKNOWN_MISTAKE);
 	}
 
-	int  pid = getpid();
-	char stat_file[256];
-	snprintf(stat_file, sizeof(stat_file), "/proc/%d/stat", pid);
+	res_obj = cJSON_CreateObject();
+	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
+	cJSON_AddItemToObject(res_obj, "data", data);
+	char *dest = cJSON_PrintUnformatted(res_obj);
+	put_http_msg(
+	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+	cJSON_free(dest);
+	cJSON_Delete(res_obj);
+	return res;
+}
 
-	FILE *fp = fopen(stat_file, "r");
-	if (fp == NULL) {
-		perror("Error opening file");
-		return -1;
+static http_msg
+get_exchange_data(http_msg *msg, kv **params, size_t param_num)
+{
+	http_msg res = { .status = NNG_HTTP_STATUS_OK };
+	uint64_t key;
+	uint8_t *data;
+	uint32_t len;
+	char    *encoded;
+	cJSON   *res_obj;
+	cJSON   *item;
+	int      rv;
+
+	if (!parse_u64_param(params, param_num, "key", &key)) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
 	}
-
-	long utime, stime, cutime, cstime, rss;
-	if (fscanf(fp,
-	        "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu "
-	        "%lu %ld %ld %*d %*d %*d %*d %*u %*u %ld",
-	        &utime, &stime, &cutime, &cstime, &rss) != 5) {
-		perror("Error reading file");
-		fclose(fp);
-		return -1;
+	if ((rv = exchange_query_get(key, &data, &len)) != 0) {
+		return error_response(msg,
+		    rv == NNG_ENOENT || rv == NNG_ENOTSUP
+		        ? NNG_HTTP_STATUS_NOT_FOUND
+		        : NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR,
+		    UNKNOWN_MISTAKE);
 	}
-	fclose(fp);
-
-	s->memory = rss * getpagesize();
-
-	long   proc_time   = utime + stime + cutime + cstime;
-	double cpu_percent = 100.0 *
-	    ((double) (proc_time - last_proc_time) /
-	        (cpu_time - last_cpu_time == 0 ? -1
-	                                       : cpu_time - last_cpu_time));
-	s->cpu_percent = cpu_percent <= 0 ? 0 : cpu_percent;
-	log_debug("NanoMQ memory usage: %ld\n", s->memory);
-	log_debug("NanoMQ cpu usage: %.2f %\n", s->cpu_percent);
+	if ((encoded = nng_zalloc(BASE64_ENCODE_OUT_SIZE(len) + 1)) == NULL) {
+		nng_free(data, len);
+		return error_response(msg,
+		    NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR, UNKNOWN_MISTAKE);
+	}
+	base64_encode(data, len, encoded);
+	nng_free(data, len);
 
-	last_proc_time = proc_time;
-	last_cpu_time  = cpu_time;
+	res_obj = cJSON_CreateObject();
+	item    = cJSON_CreateObject();
+	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
+	cJSON_AddStringToObject(item, "key", find_param(params, param_num, "key"));
+	cJSON_AddStringToObject(item, "payload", encoded);
+	cJSON_AddItemToObject(res_obj, "data", item);
+	nng_strfree(encoded);
 
-	return 0;
+	char *dest = cJSON_PrintUnformatted(res_obj);
+	put_http_msg(
+	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+	cJSON_free(dest);
+	cJSON_Delete(res_obj);
+	return res;
 }
+
 #endif
 
+/*
+ * Messages of the range still held in memory. What is older than the ring
+ * reaches back to is answered with the parquet files holding it.
+ */
 static http_msg
-get_prometheus(http_msg *msg, kv **params, size_t param_num,
-    const char *client_id, const char *username, nng_socket *broker_sock)
+get_exchange_recent(http_msg *msg, kv **params, size_t param_num)
 {
-	http_msg res = { .status = NNG_HTTP_STATUS_OK };
-
-	client_stats stats = { 0 };
-	static client_stats max_stats = { 0 };
-	nng_id_map *pipe_id_map;
-
-	if (nng_socket_get_ptr(*broker_sock, NMQ_OPT_MQTT_PIPES,
-	        (void **) &pipe_id_map) != 0) {
-		goto out;
+	http_msg             res = { .status = NNG_HTTP_STATUS_OK };
+	exchange_recent_msg *msgs;
+	uint64_t             start_key;
+	uint64_t             end_key;
+	uint64_t             since;
+	uint64_t             limit = 100;
+	bool                 more;
+	cJSON               *res_obj;
+	cJSON               *data;
+	char                 key[24];
+
+	if (!exchange_query_range(params, param_num, &start_key, &end_key) ||
+	    (find_param(params, param_num, "limit") != NULL &&
+	        (!parse_u64_param(params, param_num, "limit", &limit) ||
+	            limit == 0))) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
 	}
+	if (!exchange_recent_enabled()) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_NOT_FOUND, UNKNOWN_MISTAKE);
+	}
+	since = exchange_recent_since();
+	msgs  = exchange_recent_query(start_key, end_key,
+	    find_param(params, param_num, "topic"), (size_t) limit, &more);
 
-	nng_id_map_foreach2(pipe_id_map, get_metric_cb, &stats);
-	stats.subscribers      = dbhash_get_pipe_cnt();
-	stats.topics           = get_topics_count();
-#ifdef STATISTICS
-	stats.message_received = nanomq_get_message_in();
-	stats.message_sent     = nanomq_get_message_out();
-	stats.message_dropped  = nanomq_get_message_drop();
-#endif
-
-#if NANO_PLATFORM_LINUX
-	update_process_info(&stats);
+	res_obj = cJSON_CreateObject();
+	data    = cJSON_CreateArray();
+	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
+	for (size_t i = 0; i < cvector_size(msgs); i++) {
+		cJSON *item = cJSON_CreateObject();
+		char  *encoded =
+		    nng_zalloc(BASE64_ENCODE_OUT_SIZE(msgs[i].len) + 1);
+
+		snprintf(key, sizeof(key), "%" PRIu64, msgs[i].key);
+		cJSON_AddStringToObject(item, "key", key);
+		cJSON_AddStringToObject(item, "topic", msgs[i].topic);
+		if (encoded != NULL) {
+			base64_encode(msgs[i].payload, msgs[i].len, encoded);
+			cJSON_AddStringToObject(item, "payload", encoded);
+			nng_strfree(encoded);
+		}
+		cJSON_AddItemToArray(data, item);
+	}
+	exchange_recent_free(msgs);
+	cJSON_AddItemToObject(res_obj, "data", data);
+	cJSON_AddBoolToObject(res_obj, "more", more);
+	snprintf(key, sizeof(key), "%" PRIu64, since);
+	cJSON_AddStringToObject(res_obj, "since", key);
+#ifdef SUPP_PARQUET
+	if (start_key < since) {
+		cJSON *files = cJSON_CreateArray();
+
+		exchange_query_span(start_key,
+		    end_key < since ? end_key : since - 1, exchange_file_to_json,
+		    files);
+		cJSON_AddItemToObject(res_obj, "files", files);
+	}
 #endif
 
-	char dest[METRICS_DATA_SIZE] = { 0 };
-	update_max_stats(&max_stats, &stats);
-	compose_metrics(dest, &max_stats, &stats);
-
-out:
-	put_http_msg(&res, "text/plain", NULL, NULL, NULL, dest, strlen(dest));
-
+	char *dest = cJSON_PrintUnformatted(res_obj);
+	put_http_msg(
+	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+	cJSON_free(dest);
+	cJSON_Delete(res_obj);
 	return res;
 }
 
-static http_msg
-get_metrics(http_msg *msg, kv **params, size_t param_num,
-    const char *client_id, const char *username, nng_socket *broker_sock)
+#if defined(SUPP_RULE_ENGINE)
+// Workers may still match a PUBLISH against what a change unlinks from a
+// rule, it is freed once they left the table from before the change.
+static void
+rule_deferred_free(void *arg)
 {
-	http_msg res     = { .status = NNG_HTTP_STATUS_OK };
-	cJSON   *res_obj = cJSON_CreateObject();
-	cJSON   *metrics = cJSON_CreateArray();
-
-	client_stats stats = { 0 };
-
-#if NANO_PLATFORM_LINUX
-	update_process_info(&stats);
-#endif
-	char cpu[16] = { 0 };
-	char mem[64] = { 0 };
-	snprintf(cpu, 16, "%.2f%%", stats.cpu_percent);
-	snprintf(mem, 64, "%ld", stats.memory);
+	rule_free(arg);
+	nng_free(arg, sizeof(rule));
+}
 
-	cJSON_AddItemToObject(res_obj, "metrics", metrics);
-	cJSON_AddStringToObject(res_obj, "cpuinfo", cpu);
-	cJSON_AddStringToObject(res_obj, "memory", mem);
+static void
+rule_defer_free(rule *r)
+{
+	rule *copy;
 
-	// cJSON *meta = cJSON_CreateObject();
-	// cJSON_AddItemToObject(res_obj, "meta", meta);
-	// TODO add meta content: page, limit, count
-	char *dest = cJSON_PrintUnformatted(res_obj);
-	put_http_msg(&res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+	if ((copy = nng_alloc(sizeof(rule))) == NULL) {
+		log_warn("rule %u left allocated: out of memory", r->rule_id);
+		return;
+	}
+	*copy = *r;
+	rule_filter_defer(rule_deferred_free, copy);
+}
 
-	cJSON_free(dest);
-	cJSON_Delete(res_obj);
+static void
+rule_deferred_strfree(void *arg)
+{
+	nng_strfree(arg);
+}
 
-	return res;
+static void
+rule_deferred_repub_free(void *arg)
+{
+	rule_repub_free(arg);
 }
 
-static http_msg
-get_subscriptions(
-    http_msg *msg, kv **params, size_t param_num, const char *client_id)
+static void
+rule_deferred_mysql_free(void *arg)
 {
-	http_msg res = { 0 };
- 	res.status   = NNG_HTTP_STATUS_OK;
-
- 	cJSON *res_obj   = NULL;
- 	cJSON *data_info = NULL;
- 	data_info        = cJSON_CreateArray();
- 	res_obj          = cJSON_CreateObject();
-
- 	dbtree *          db   = get_broker_db();
- 	dbhash_ptpair_t **pt   = dbhash_get_ptpair_all();
- 	size_t            size = cvector_size(pt);
- 	for (size_t i = 0; i < size; i++) {
- 		const char * cid     = NULL;
-		nng_pipe p = { .id = pt[i]->pipe };
-		conn_param *cp = nng_pipe_cparam(p);
-
- 		if (cp) {
- 			cid = (const char *) conn_param_get_clientid(
- 			    cp);
-			conn_param_free(cp);
-			if (client_id) {
-				if (strcmp(client_id, cid) != 0) {
- 					goto skip;
- 				}
-			}
-		}
+	rule_mysql *mysql = arg;
 
- 		// topic_queue *tn = pt[i]->topic;
-		topic_queue *tq = dbhash_copy_topic_queue(pt[i]->pipe);
-		topic_queue *reap_node = tq;
- 		while (tq) {
- 			cJSON *subscribe = cJSON_CreateObject();
- 			if (cid) {
- 				cJSON_AddStringToObject(
- 				    subscribe, "clientid", cid);
- 			} else {
- 				cJSON_AddStringToObject(
- 				    subscribe, "clientid", "");
- 			}
- 			cJSON_AddStringToObject(
- 			    subscribe, "topic", tq->topic);
- 			cJSON_AddNumberToObject(subscribe, "qos", tq->qos);
- 			cJSON_AddItemToArray(data_info, subscribe);
- 			tq = tq->next;
-			nng_free(reap_node->topic, strlen(reap_node->topic));
-			nng_free(reap_node, sizeof(topic_queue));
-			reap_node = tq;
- 		}
- 	skip:
- 		dbhash_ptpair_free(pt[i]);
- 	}
- 	cvector_free(pt);
-
- 	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
- 	// cJSON *meta = cJSON_CreateObject();
- 	// cJSON_AddItemToObject(res_obj, "meta", meta);
- 	// TODO add meta content: page, limit, count
- 	cJSON_AddItemToObject(res_obj, "data", data_info);
-
- 	char *dest = cJSON_PrintUnformatted(res_obj);
-
- 	put_http_msg(
- 	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
-
- 	cJSON_free(dest);
- 	cJSON_Delete(res_obj);
-	return res;
+	rule_sink_close(mysql->conn);
+	rule_mysql_free(mysql);
 }
+#endif
 
 #if defined(NNG_SUPP_SQLITE)  && defined(SUPP_RULE_ENGINE)
 
@@ -1832,11 +3472,14 @@ post_rules_repub(conf_rule *cr, cJSON *jso_params, char *rawsql)
 		return MISSING_KEY_REQUEST_PARAMES;
 	}
 
-	nng_socket *sock = (nng_socket *) nng_alloc(sizeof(nng_socket));
-	if (nano_client(sock, repub) != 0) {
-		rule_repub_free(repub);
-		nng_free(sock, sizeof(nng_socket));
-		return MISSING_KEY_REQUEST_PARAMES;
+	// the broker routes republishes to itself, no client needed
+	if (!nano_client_is_local(get_global_conf()->url, repub->address)) {
+		nng_socket *sock = (nng_socket *) nng_alloc(sizeof(nng_socket));
+		if (nano_client(sock, repub) != 0) {
+			rule_repub_free(repub);
+			nng_free(sock, sizeof(nng_socket));
+			return MISSING_KEY_REQUEST_PARAMES;
+		}
 	}
 
 	rule_sql_parse(cr, rawsql);
@@ -1877,6 +3520,7 @@ post_rules(http_msg *msg)
 
 	cJSON *jso_actions = cJSON_GetObjectItem(req, "actions");
 	cJSON *jso_action  = NULL;
+	rule_filter_lock();
 	cJSON_ArrayForEach(jso_action, jso_actions)
 	{
 		cJSON *jso_name = cJSON_GetObjectItem(jso_action, "name");
@@ -1909,6 +3553,7 @@ post_rules(http_msg *msg)
 			log_error("Unsupport forword type !");
 			rc = PLUGIN_IS_CLOSED;
 		error:
+			rule_filter_unlock();
 			cJSON_Delete(req);
 			cJSON_Delete(res_obj);
 			return error_response(
@@ -1916,6 +3561,8 @@ post_rules(http_msg *msg)
 		}
 	}
 
+	rule_filter_compile(cr);
+
 	cJSON *jso_desc = cJSON_GetObjectItem(req, "description");
 	if (jso_desc) {
 		char *desc = cJSON_GetStringValue(jso_desc);
@@ -1932,6 +3579,7 @@ post_rules(http_msg *msg)
 	cJSON_AddBoolToObject(data_info, "enabled",
 	    cr->rules[cvector_size(cr->rules) - 1].enabled);
 	cJSON_AddItemToObject(res_obj, "data", data_info);
+	rule_filter_unlock();
 	cJSON_AddItemToObject(res_obj, "actions", actions);
 	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
 #else
@@ -1949,6 +3597,7 @@ post_rules(http_msg *msg)
 	return res;
 }
 
+#if defined(SUPP_RULE_ENGINE)
 static int
 put_rules_repub_parse(cJSON *jso_params, repub_t *repub)
 {
@@ -1958,13 +3607,15 @@ put_rules_repub_parse(cJSON *jso_params, repub_t *repub)
 	{
 		if (!nng_strcasecmp(jso_param->string, "topic")) {
 			if (repub->topic) {
-				nng_strfree(repub->topic);
+				rule_filter_defer(
+				    rule_deferred_strfree, repub->topic);
 			}
 			repub->topic = nng_strdup(jso_param->valuestring);
 			log_debug("topic: %s\n", jso_param->valuestring);
 		} else if (!nng_strcasecmp(jso_param->string, "address")) {
 			if (repub->address) {
-				nng_strfree(repub->address);
+				rule_filter_defer(
+				    rule_deferred_strfree, repub->address);
 			}
 			repub->address = nng_strdup(jso_param->valuestring);
 			log_debug("address: %s\n", jso_param->valuestring);
@@ -1976,19 +3627,22 @@ put_rules_repub_parse(cJSON *jso_params, repub_t *repub)
 			log_debug("keepalive: %d\n", jso_param->valueint);
 		} else if (!nng_strcasecmp(jso_param->string, "clientid")) {
 			if (repub->clientid) {
-				nng_strfree(repub->clientid);
+				rule_filter_defer(
+				    rule_deferred_strfree, repub->clientid);
 			}
 			repub->clientid = nng_strdup(jso_param->valuestring);
 			log_debug("clientid: %s\n", jso_param->valuestring);
 		} else if (!nng_strcasecmp(jso_param->string, "username")) {
 			if (repub->username) {
-				nng_strfree(repub->username);
+				rule_filter_defer(
+				    rule_deferred_strfree, repub->username);
 			}
 			repub->username = nng_strdup(jso_param->valuestring);
 			log_debug("username: %s\n", jso_param->valuestring);
 		} else if (!nng_strcasecmp(jso_param->string, "password")) {
 			if (repub->password) {
-				nng_strfree(repub->password);
+				rule_filter_defer(
+				    rule_deferred_strfree, repub->password);
 			}
 			repub->password = nng_strdup(jso_param->valuestring);
 			log_debug("password: %s\n", jso_param->valuestring);
@@ -2035,7 +3689,8 @@ put_rules_mysql_parse(cJSON *jso_params, rule_mysql *mysql)
 		if (jso_param) {
 			if (!nng_strcasecmp(jso_param->string, "table")) {
 				if (mysql->table) {
-					nng_strfree(mysql->table);
+					rule_filter_defer(
+					    rule_deferred_strfree, mysql->table);
 				}
 				mysql->table =
 				    nng_strdup(jso_param->valuestring);
@@ -2044,7 +3699,8 @@ put_rules_mysql_parse(cJSON *jso_params, rule_mysql *mysql)
 			} else if (!nng_strcasecmp(
 			               jso_param->string, "username")) {
 				if (mysql->username) {
-					nng_strfree(mysql->username);
+					rule_filter_defer(
+					    rule_deferred_strfree, mysql->username);
 				}
 				mysql->username =
 				    nng_strdup(jso_param->valuestring);
@@ -2053,7 +3709,8 @@ put_rules_mysql_parse(cJSON *jso_params, rule_mysql *mysql)
 			} else if (!nng_strcasecmp(
 			               jso_param->string, "password")) {
 				if (mysql->password) {
-					nng_strfree(mysql->password);
+					rule_filter_defer(
+					    rule_deferred_strfree, mysql->password);
 				}
 				mysql->password =
 				    nng_strdup(jso_param->valuestring);
@@ -2062,7 +3719,8 @@ put_rules_mysql_parse(cJSON *jso_params, rule_mysql *mysql)
 			} else if (!nng_strcasecmp(
 			               jso_param->string, "host")) {
 				if (mysql->host) {
-					nng_strfree(mysql->host);
+					rule_filter_defer(
+					    rule_deferred_strfree, mysql->host);
 				}
 				mysql->host =
 				    nng_strdup(jso_param->valuestring);
@@ -2131,6 +3789,8 @@ put_rules_update_action(cJSON *jso_actions, rule *new_rule, conf_rule *cr)
 	return rc;
 }
 
+#endif
+
 static http_msg
 put_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
 {
@@ -2162,6 +3822,7 @@ put_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
 	sscanf(rule_id, "rule:%u", &id);
 	int i = 0;
 
+	rule_filter_lock();
 	// Get old rule;
 	for (; i < cvector_size(cr->rules); i++) {
 		if (rule_id && cr->rules[i].rule_id == id) {
@@ -2203,10 +3864,10 @@ put_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
 		// Maybe cvector_push_back() will realloc,
 		// so for safety reassign it.
 		old_rule = &cr->rules[i];
-		rule_free(old_rule);
+		rule_defer_free(old_rule);
 		cvector_erase(cr->rules, i);
 	} else {
-		if (old_rule->repub) {
+		if (old_rule->repub && old_rule->repub->sock) {
 			nng_close(*(nng_socket *) old_rule->repub->sock);
 		}
 		new_rule = old_rule;
@@ -2223,6 +3884,7 @@ put_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
 		rc = put_rules_update_action(jso_actions, new_rule, cr);
 		if (rc != SUCCEED) {
 		error:
+			rule_filter_unlock();
 			cJSON_Delete(res_obj);
 			cJSON_Delete(req);
 			return error_response(
@@ -2235,7 +3897,15 @@ put_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
 			// 	nng_close(*(nng_socket*) old_rule->repub->sock);
 			// }
 			if (RULE_FORWORD_REPUB == new_rule->forword_type) {
-				nano_client(new_rule->repub->sock, new_rule->repub);
+				repub_t *repub = new_rule->repub;
+				if (!nano_client_is_local(
+				        get_global_conf()->url, repub->address)) {
+					if (repub->sock == NULL) {
+						repub->sock =
+						    nng_alloc(sizeof(nng_socket));
+					}
+					nano_client(repub->sock, repub);
+				}
 			} else if (RULE_FORWORD_SQLITE == new_rule->forword_type)
 			{
 #if defined(NNG_SUPP_SQLITE)
@@ -2248,6 +3918,14 @@ put_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
 		}
 	}
 
+	// switching a rule on or off needs no new table
+	if (jso_sql == NULL && jso_actions == NULL && jso_enabled != NULL &&
+	    rule_filter_enable(id, new_rule->enabled) == 0) {
+		log_debug("rule %u enabled: %d", id, new_rule->enabled);
+	} else {
+		rule_filter_compile(cr);
+	}
+
 	// cJSON *jso_desc = cJSON_GetObjectItem(req, "description");
 	// char *desc= cJSON_GetStringValue(jso_desc);
 
@@ -2259,6 +3937,7 @@ put_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
 	cJSON_AddBoolToObject(data_info, "enabled", new_rule->enabled);
 	cJSON_AddItemToObject(res_obj, "data", data_info);
 	cJSON_AddItemToObject(res_obj, "actions", actions);
+	rule_filter_unlock();
 
 	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
 #else
@@ -2290,6 +3969,7 @@ delete_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
 		conf      *config = get_global_conf();
 		conf_rule *cr     = &config->rule_eng;
 		int        i      = 0;
+		rule_filter_lock();
 		size_t     size   = cvector_size(cr->rules);
 		for (; i < size; i++) {
 			if (cr->rules[i].rule_id == id) {
@@ -2297,19 +3977,23 @@ delete_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
 				switch (re->forword_type)
 				{
 				case RULE_FORWORD_MYSQL:
-					rule_mysql_free(re->mysql);
+					rule_filter_defer(
+					    rule_deferred_mysql_free, re->mysql);
 					break;
 				case RULE_FORWORD_REPUB:
-					rule_repub_free(re->repub);
+					rule_filter_defer(
+					    rule_deferred_repub_free, re->repub);
 					break;
 				default:
 					break;
 				}
-				rule_free(re);
+				rule_defer_free(re);
 				cvector_erase(cr->rules, i);
+				rule_filter_compile(cr);
 				break;
 			}
 		}
+		rule_filter_unlock();
 
 		if (size == i) {
 			goto error;
@@ -2342,6 +4026,7 @@ error:
 	    msg, NNG_HTTP_STATUS_BAD_REQUEST, MISSING_KEY_REQUEST_PARAMES);
 }
 
+#if defined(SUPP_RULE_ENGINE)
 static void
 get_rules_helper(cJSON *data, rule *r)
 {
@@ -2364,7 +4049,19 @@ get_rules_helper(cJSON *data, rule *r)
 	cJSON_AddStringToObject(data, "rawsql", r->raw_sql);
 	cJSON_AddNumberToObject(data, "id", r->rule_id);
 	cJSON_AddBoolToObject(data, "enabled", r->enabled);
+
+	rule_filter_stats st;
+	if (rule_filter_stat(r->rule_id, &st) == 0) {
+		cJSON *metrics = cJSON_CreateObject();
+		cJSON_AddNumberToObject(metrics, "matched", (double) st.hits);
+		cJSON_AddNumberToObject(
+		    metrics, "evaluated", (double) st.evals);
+		cJSON_AddNumberToObject(
+		    metrics, "eval_ns", (double) st.eval_ns);
+		cJSON_AddItemToObject(data, "metrics", metrics);
+	}
 }
+#endif
 
 static http_msg
 get_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
@@ -2388,6 +4085,7 @@ get_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
 	conf      *config = get_global_conf();
 	conf_rule *cr     = &config->rule_eng;
 	int        i      = 0;
+	rule_filter_lock();
 	for (; i < cvector_size(cr->rules); i++) {
 		if (rule_id) {
 			if (cr->rules[i].rule_id == id) {
@@ -2402,7 +4100,10 @@ get_rules(http_msg *msg, kv **params, size_t param_num, const char *rule_id)
 		}
 	}
 
-	if (rule_id && cvector_size(cr->rules) == i) {
+	size_t size = cvector_size(cr->rules);
+	rule_filter_unlock();
+
+	if (rule_id && size == i) {
 		cJSON_Delete(res_obj);
 		cJSON_Delete(data);
 		return error_response(msg, NNG_HTTP_STATUS_BAD_REQUEST,
@@ -2439,50 +4140,101 @@ get_client_info_cb(uint32_t pid)
 	return (void *) clientid;
 }
 
-static http_msg
-get_tree(http_msg *msg)
+/*
+ * Content hashes as entity tags. A poller sending the tag of what it has
+ * in If-None-Match gets a 304 without a body while nothing changed.
+ */
+static void
+etag_format(char *buf, size_t size, char kind, uint64_t hash)
 {
-	http_msg res     = { 0 };
-	res.status       = NNG_HTTP_STATUS_OK;
-	cJSON *res_obj   = NULL;
-	cJSON *data_info = NULL;
-	res_obj          = cJSON_CreateObject();
-	data_info        = cJSON_CreateArray();
-	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
-	cJSON_AddItemToObject(res_obj, "data", data_info);
+	snprintf(buf, size, "\"%c%016llx\"", kind, (unsigned long long) hash);
+}
 
-	dbtree        *db = get_broker_db();
-	dbtree_info ***vn =
-	    (dbtree_info ***) dbtree_get_tree(db, get_client_info_cb);
+static bool
+etag_match(const http_msg *msg, const char *etag)
+{
+	const char *p;
+	size_t      n = strlen(etag);
 
-	for (int i = 0; i < cvector_size(vn); i++) {
-		cJSON *data_info_elem = cJSON_CreateArray();
-		cJSON_AddItemToArray(data_info, data_info_elem);
-		for (int j = 0; j < cvector_size(vn[i]); j++) {
-			cJSON *elem = cJSON_CreateObject();
-			cJSON_AddItemToArray(data_info_elem, elem);
-			cJSON_AddStringToObject(
-			    elem, "topic", vn[i][j]->topic);
-			nng_free(vn[i][j]->topic, strlen(vn[i][j]->topic));
-			cJSON_AddNumberToObject(
-			    elem, "cld_cnt", vn[i][j]->cld_cnt);
-			cJSON *clients = cJSON_CreateStringArray(
-			    (const char *const *) vn[i][j]->clients,
-			    cvector_size(vn[i][j]->clients));
-			cvector_free(vn[i][j]->clients);
-			nng_free(vn[i][j], sizeof(dbtree_info));
-			cJSON_AddItemToObject(elem, "clientid", clients);
-		}
-		cvector_free(vn[i]);
-	}
-	cvector_free(vn);
-	char *dest = cJSON_PrintUnformatted(res_obj);
+	if (msg->etag_len == 0) {
+		return false;
+	}
+	if (strcmp(msg->etag, "*") == 0) {
+		return true;
+	}
+	// a list of tags, weak ones compare the same for a GET
+	for (p = msg->etag; (p = strstr(p, etag)) != NULL; p += n) {
+		if ((p == msg->etag || p[-1] == ' ' || p[-1] == ',' ||
+		        p[-1] == '/') &&
+		    (p[n] == '\0' || p[n] == ',' || p[n] == ' ')) {
+			return true;
+		}
+	}
+	return false;
+}
 
-	put_http_msg(
-	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
+static http_msg
+not_modified(const char *etag)
+{
+	http_msg res = { .status = NNG_HTTP_STATUS_NOT_MODIFIED };
 
-	cJSON_free(dest);
-	cJSON_Delete(res_obj);
+	put_http_etag(&res, etag);
+	return res;
+}
+
+/*
+ * ?prefix= a topic whose node and subtree only are listed, ?depth= the
+ * levels from there. Served from a snapshot of the tree, see tree_view.h.
+ */
+static http_msg
+get_tree(http_msg *msg, kv **params, size_t param_num)
+{
+	json_writer w = { 0 };
+	http_msg    res;
+	tree_view  *v;
+	uint64_t    gen    = match_cache_generation();
+	uint64_t    depth  = 0;
+	const char *prefix = find_param(params, param_num, "prefix");
+	char        etag[24];
+	int         rv;
+
+	if (!parse_u64_param(params, param_num, "depth", &depth) &&
+	    find_param(params, param_num, "depth") != NULL) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAM_ERROR);
+	}
+	// the one walk of the tree, when the snapshot is due
+	if ((v = tree_view_hold(gen)) == NULL) {
+		v = tree_view_publish(
+		    gen, dbtree_get_tree(get_broker_db(), get_client_info_cb));
+	}
+	if (v == NULL) {
+		return error_response(
+		    msg, NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR, UNKNOWN_MISTAKE);
+	}
+	etag_format(etag, sizeof(etag), 't', tree_view_hash(v));
+	if (etag_match(msg, etag)) {
+		tree_view_release(v);
+		return not_modified(etag);
+	}
+
+	json_write_str(&w, "{\"code\":0,\"data\":");
+	if ((rv = tree_view_write(v, &w, prefix, (size_t) depth)) ==
+	    NNG_ENOENT) {
+		// nothing subscribed there
+		json_write_str(&w, "[]");
+	}
+	json_write_str(&w, "}");
+	tree_view_release(v);
+	if (rv == NNG_ENOTSUP) {
+		json_writer_fini(&w);
+		return error_response(
+		    msg, NNG_HTTP_STATUS_INTERNAL_SERVER_ERROR, UNKNOWN_MISTAKE);
+	}
+	res = json_writer_response(msg, &w);
+	if (res.status == NNG_HTTP_STATUS_OK) {
+		put_http_etag(&res, etag);
+	}
 	return res;
 }
 
@@ -2755,12 +4507,26 @@ get_config(http_msg *msg, const char *type)
 	cJSON_AddNumberToObject(res_obj, "code", code);
 	cJSON_AddItemToObject(res_obj, "data", conf_obj);
 
-	char *dest = cJSON_PrintUnformatted(res_obj);
+	char    *dest = cJSON_PrintUnformatted(res_obj);
+	size_t   len  = strlen(dest);
+	uint64_t hash = 14695981039346656037ull;
+	char     etag[24];
 
-	put_http_msg(
-	    &res, "application/json", NULL, NULL, NULL, dest, strlen(dest));
-	cJSON_free(dest);
 	cJSON_Delete(res_obj);
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (uint8_t) dest[i];
+		hash *= 1099511628211ull;
+	}
+	etag_format(etag, sizeof(etag), 'c', hash);
+	if (res.status == NNG_HTTP_STATUS_OK && etag_match(msg, etag)) {
+		cJSON_free(dest);
+		return not_modified(etag);
+	}
+	put_http_msg(&res, "application/json", NULL, NULL, NULL, dest, len);
+	if (res.status == NNG_HTTP_STATUS_OK) {
+		put_http_etag(&res, etag);
+	}
+	cJSON_free(dest);
 	return res;
 }
 
@@ -3210,12 +4976,17 @@ handle_subscribe_msg(cJSON *sub_obj, nng_socket *sock)
 			topic_exist = dbhash_check_topic(pid, topic_str);
 			if (!topic_exist) {
 				dbtree_insert_client(db, topic_str, pid);
+				match_cache_invalidate();
+				sub_stats_subscribe(topic_str);
+				// address unknown, never taken for local
+				share_group_join(topic_str, pid, clientid, NULL);
 
 				dbhash_insert_topic(pid, topic_str, qos);
 			}
 
 			topic_index++;
 		}
+		sub_ctx_regrant(pid);
 	}
 	dbtree_print(db);
 
@@ -3341,6 +5112,143 @@ out:
 	    msg, NNG_HTTP_STATUS_BAD_REQUEST, REQ_PARAMS_JSON_FORMAT_ILLEGAL);
 }
 
+// A binary safe publish of one bulk record, topic NUL terminated.
+static int
+send_publish_raw(nng_socket *sock, const char *clientid, const char *topic,
+    const uint8_t *payload, size_t payload_len, uint8_t qos, bool retain)
+{
+	nng_msg *pub_msg;
+	nng_msg *msg = NULL;
+	int      rv;
+
+	if ((rv = nng_mqtt_msg_alloc(&pub_msg, 0)) != 0) {
+		return rv;
+	}
+	nng_mqtt_msg_set_packet_type(pub_msg, NNG_MQTT_PUBLISH);
+	nng_mqtt_msg_set_publish_payload(
+	    pub_msg, (uint8_t *) payload, payload_len);
+	nng_mqtt_msg_set_publish_qos(pub_msg, qos);
+	nng_mqtt_msg_set_publish_retain(pub_msg, retain);
+	nng_mqtt_msg_set_publish_topic(pub_msg, topic);
+
+	if ((rv = encode_common_mqtt_msg(
+	         &msg, pub_msg, clientid, MQTT_PROTOCOL_VERSION_v311)) != 0 ||
+	    (rv = nng_sendmsg(*sock, msg, 0)) != 0) {
+		nng_msg_free(msg);
+	}
+	return rv;
+}
+
+static int
+publish_bulk_ndjson(const pub_bulk_record *rec, const char *clientid,
+    nng_socket *sock)
+{
+	cJSON *obj;
+	int    rv;
+
+	obj = cJSON_ParseWithLength(
+	    (const char *) rec->payload, rec->payload_len);
+	if (!cJSON_IsObject(obj)) {
+		cJSON_Delete(obj);
+		return REQ_PARAMS_JSON_FORMAT_ILLEGAL;
+	}
+	if (cJSON_GetObjectItem(obj, "clientid") == NULL) {
+		cJSON_AddStringToObject(obj, "clientid", clientid);
+	}
+	rv = handle_publish_msg(obj, sock);
+	cJSON_Delete(obj);
+	return rv;
+}
+
+/*
+ * The body is walked record by record, each one published as soon as it is
+ * decoded, and only a code per record is kept for the response. A record
+ * that does not publish leaves the rest of the body going, a truncated
+ * binary record ends it.
+ */
+static http_msg
+post_mqtt_publish_bulk(
+    http_msg *msg, kv **params, size_t param_num, nng_socket *sock)
+{
+	pub_bulk_reader r;
+	pub_bulk_record rec;
+	pub_bulk_format format   = PUB_BULK_NDJSON;
+	json_writer     w        = { 0 };
+	const char     *clientid = find_param(params, param_num, "clientid");
+	const char     *fmt      = find_param(params, param_num, "format");
+	char           *topic    = NULL;
+	size_t          topic_sz = 0;
+	size_t          count    = 0;
+	size_t          failed   = 0;
+	int             code     = SUCCEED;
+	char            tail[96];
+
+	if (fmt != NULL) {
+		if (strcmp(fmt, "binary") == 0) {
+			format = PUB_BULK_BINARY;
+		} else if (strcmp(fmt, "ndjson") != 0) {
+			return error_response(msg, NNG_HTTP_STATUS_BAD_REQUEST,
+			    REQ_PARAM_ERROR);
+		}
+	} else if (msg->content_type != NULL &&
+	    nng_strncasecmp(msg->content_type, "application/octet-stream",
+	        strlen("application/octet-stream")) == 0) {
+		format = PUB_BULK_BINARY;
+	}
+	if (clientid == NULL || *clientid == '\0') {
+		clientid = "nanomq-http-bulk";
+	}
+
+	json_write_str(&w, "{\"data\":[");
+	pub_bulk_reader_init(&r, format, msg->data, msg->data_len);
+	for (;;) {
+		int rv = pub_bulk_next(&r, &rec);
+		int item;
+
+		if (rv == NNG_ENOENT) {
+			break;
+		} else if (rv == NNG_EPROTO) {
+			code = REQ_PARAM_ERROR;
+			break;
+		} else if (rv != 0) {
+			item = REQ_PARAM_ERROR;
+		} else if (format == PUB_BULK_NDJSON) {
+			item = publish_bulk_ndjson(&rec, clientid, sock);
+		} else {
+			if (rec.topic_len + 1 > topic_sz) {
+				char *buf = realloc(topic, rec.topic_len + 1);
+				if (buf == NULL) {
+					w.failed = true;
+					break;
+				}
+				topic    = buf;
+				topic_sz = rec.topic_len + 1;
+			}
+			memcpy(topic, rec.topic, rec.topic_len);
+			topic[rec.topic_len] = '\0';
+			item = send_publish_raw(sock, clientid, topic,
+			           rec.payload, rec.payload_len, rec.qos,
+			           rec.retain) == 0
+			    ? SUCCEED
+			    : UNKNOWN_MISTAKE;
+		}
+
+		snprintf(tail, sizeof(tail), count > 0 ? ",%d" : "%d", item);
+		json_write_str(&w, tail);
+		count++;
+		if (item != SUCCEED) {
+			failed++;
+		}
+	}
+	free(topic);
+
+	snprintf(tail, sizeof(tail),
+	    "],\"count\":%zu,\"failed\":%zu,\"code\":%d}", count, failed,
+	    code);
+	json_write_str(&w, tail);
+	return json_writer_response(msg, &w);
+}
+
 static http_msg
 get_mqtt_bridge(http_msg *msg, const char *name)
 {
@@ -3353,6 +5261,99 @@ get_mqtt_bridge(http_msg *msg, const char *name)
 	cJSON *bridge = get_bridge_config(&config->bridge, name);
 	cJSON_AddItemToObject(bridge_json, "bridge", bridge);
 
+	cJSON *queues = cJSON_CreateArray();
+	for (size_t i = 0; i < config->bridge.count; i++) {
+		conf_bridge_node  *node = config->bridge.nodes[i];
+		bridge_queue_stats st;
+		if ((name != NULL && strcmp(name, node->name) != 0) ||
+		    bridge_queue_stat(node, &st) != 0) {
+			continue;
+		}
+		cJSON *queue_obj = cJSON_CreateObject();
+		cJSON_AddStringOrNullToObject(queue_obj, "name", node->name);
+		cJSON_AddNumberToObject(queue_obj, "depth", st.depth);
+		cJSON_AddNumberToObject(queue_obj, "bytes", st.bytes);
+		cJSON_AddNumberToObject(queue_obj, "queued", st.queued);
+		cJSON_AddNumberToObject(queue_obj, "sent", st.sent);
+		cJSON_AddNumberToObject(queue_obj, "dropped", st.dropped);
+		cJSON_AddItemToArray(queues, queue_obj);
+	}
+	cJSON_AddItemToObject(bridge_json, "queues", queues);
+
+	cJSON *rtts = cJSON_CreateArray();
+	for (size_t i = 0; i < config->bridge.count; i++) {
+		conf_bridge_node    *node = config->bridge.nodes[i];
+		bridge_rtt_transport active;
+		if ((name != NULL && strcmp(name, node->name) != 0) ||
+		    bridge_rtt_active(node, &active) != 0) {
+			continue;
+		}
+		cJSON *rtt_obj = cJSON_CreateObject();
+		cJSON_AddStringOrNullToObject(rtt_obj, "name", node->name);
+		cJSON_AddStringToObject(
+		    rtt_obj, "transport", bridge_rtt_name(active));
+		for (int t = 0; t < BRIDGE_RTT_TRANSPORTS; t++) {
+			bridge_rtt_stats st;
+			bridge_rtt_stat(node, t, &st);
+			cJSON *tp_obj = cJSON_CreateObject();
+			cJSON_AddNumberToObject(tp_obj, "samples", st.samples);
+			cJSON_AddNumberToObject(tp_obj, "lost", st.lost);
+			cJSON_AddNumberToObject(tp_obj, "srtt_ms", st.srtt);
+			cJSON_AddNumberToObject(tp_obj, "loss_permille", st.loss);
+			cJSON *hist = cJSON_CreateArray();
+			for (int b = 0; b < BRIDGE_RTT_BUCKETS; b++) {
+				cJSON *bucket = cJSON_CreateObject();
+				if (b < BRIDGE_RTT_BUCKETS - 1) {
+					cJSON_AddNumberToObject(
+					    bucket, "le", bridge_rtt_bounds[b]);
+				} else {
+					cJSON_AddStringToObject(bucket, "le", "+Inf");
+				}
+				cJSON_AddNumberToObject(
+				    bucket, "count", st.buckets[b]);
+				cJSON_AddItemToArray(hist, bucket);
+			}
+			cJSON_AddItemToObject(tp_obj, "histogram", hist);
+			cJSON_AddItemToObject(rtt_obj, bridge_rtt_name(t), tp_obj);
+		}
+		cJSON_AddItemToArray(rtts, rtt_obj);
+	}
+	cJSON_AddItemToObject(bridge_json, "rtt", rtts);
+
+#if defined(SUPP_BRIDGE_ZIP)
+	cJSON *zips = cJSON_CreateArray();
+	for (size_t i = 0; i < config->bridge.count; i++) {
+		conf_bridge_node *node = config->bridge.nodes[i];
+		bridge_zip_stats  st;
+		if ((name != NULL && strcmp(name, node->name) != 0) ||
+		    bridge_zip_stat(node, &st) != 0) {
+			continue;
+		}
+		cJSON *zip_obj = cJSON_CreateObject();
+		cJSON *tx_obj  = cJSON_CreateObject();
+		cJSON *rx_obj  = cJSON_CreateObject();
+		cJSON_AddStringOrNullToObject(zip_obj, "name", node->name);
+		cJSON_AddNumberToObject(tx_obj, "messages", st.zipped);
+		cJSON_AddNumberToObject(tx_obj, "skipped", st.skipped);
+		cJSON_AddNumberToObject(tx_obj, "bytes_in", st.zip_in);
+		cJSON_AddNumberToObject(tx_obj, "bytes_out", st.zip_out);
+		cJSON_AddNumberToObject(tx_obj, "ratio",
+		    st.zip_in > 0 ? (double) st.zip_out / st.zip_in : 0);
+		cJSON_AddNumberToObject(tx_obj, "cpu_us", st.zip_ns / 1000);
+		cJSON_AddItemToObject(zip_obj, "sent", tx_obj);
+		cJSON_AddNumberToObject(rx_obj, "messages", st.unzipped);
+		cJSON_AddNumberToObject(rx_obj, "failed", st.failed);
+		cJSON_AddNumberToObject(rx_obj, "bytes_in", st.unzip_in);
+		cJSON_AddNumberToObject(rx_obj, "bytes_out", st.unzip_out);
+		cJSON_AddNumberToObject(rx_obj, "ratio",
+		    st.unzip_out > 0 ? (double) st.unzip_in / st.unzip_out : 0);
+		cJSON_AddNumberToObject(rx_obj, "cpu_us", st.unzip_ns / 1000);
+		cJSON_AddItemToObject(zip_obj, "received", rx_obj);
+		cJSON_AddItemToArray(zips, zip_obj);
+	}
+	cJSON_AddItemToObject(bridge_json, "compression", zips);
+#endif
+
 	cJSON *res_obj = cJSON_CreateObject();
 	cJSON_AddNumberToObject(res_obj, "code", SUCCEED);
 	cJSON_AddItemToObject(res_obj, "data", bridge_json);
@@ -3392,7 +5393,7 @@ put_mqtt_bridge(http_msg *msg, const char *name)
 			continue;
 		}
 
-		nng_mtx_lock(node->mtx);
+		PROF_LOCK(PROF_LOCK_BRIDGE_NODE, node->mtx);
 		conf_bridge_node_destroy(node);
 		conf_bridge_node_parse(node, &bridge->sqlite, node_obj);
 		node->parallel = parallel;
@@ -3629,7 +5630,7 @@ post_mqtt_bridge_sub(http_msg *msg, const char *name)
 	for (size_t i = 0; i < bridge->count; i++) {
 		conf_bridge_node *node = bridge->nodes[i];
 
-		nng_mtx_lock(node->mtx);
+		PROF_LOCK(PROF_LOCK_BRIDGE_NODE, node->mtx);
 		if (name != NULL && strcmp(node->name, name) != 0) {
 			nng_mtx_unlock(node->mtx);
 			continue;
@@ -3654,7 +5655,7 @@ post_mqtt_bridge_sub(http_msg *msg, const char *name)
 
 		if (rv == 0) {
 			// Add to sub_list in node only when bridge_subscribe successfully
-			nng_mtx_lock(node->mtx);
+			PROF_LOCK(PROF_LOCK_BRIDGE_NODE, node->mtx);
 			if (sub_count > 0) {
 				// TODO handle repeated topics
 				cvector_copy(sub_topics, node->sub_list);
@@ -3665,6 +5666,7 @@ post_mqtt_bridge_sub(http_msg *msg, const char *name)
 				node->sub_properties = sub_props;
 			}
 			nng_mtx_unlock(node->mtx);
+			bridge_forward_reload(bridge);
 		}
 
 		nng_mqtt_topic_qos_array_free(topic_list, sub_count);
@@ -3757,7 +5759,7 @@ post_mqtt_bridge_unsub(http_msg *msg, const char *name)
 	conf_bridge *bridge = &config->bridge;
 	for (size_t i = 0; i < bridge->count; i++) {
 		conf_bridge_node *node = bridge->nodes[i];
-		nng_mtx_lock(node->mtx);
+		PROF_LOCK(PROF_LOCK_BRIDGE_NODE, node->mtx);
 		if (name != NULL && strcmp(node->name, name) != 0) {
 			nng_mtx_unlock(node->mtx);
 			continue;
@@ -3794,7 +5796,7 @@ post_mqtt_bridge_unsub(http_msg *msg, const char *name)
 			break;
 		}
 
-		nng_mtx_lock(node->mtx);
+		PROF_LOCK(PROF_LOCK_BRIDGE_NODE, node->mtx);
 		for (size_t i = 0; i < unsub_count; i++) {
 			char *unsub_topic = unsub_topics[i];
 			for (size_t j = 0; j < node->sub_count; j++) {
@@ -3814,6 +5816,7 @@ post_mqtt_bridge_unsub(http_msg *msg, const char *name)
 			}
 		}
 		nng_mtx_unlock(node->mtx);
+		bridge_forward_reload(bridge);
 		break;
 	}
 
@@ -0,0 +1,373 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/retain_index.h"
+#include "include/topic_match.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef struct {
+	nng_msg *msg;
+	size_t   len;
+	char     topic[];
+} ridx_entry;
+
+struct retain_cursor {
+	topic_pattern *pattern;
+	char          *prefix; // the literal levels before the first wildcard
+	size_t         plen;
+	bool           dollar; // a leading wildcard, $ topics do not match
+	char          *last;   // last topic visited, NULL before the first
+	size_t         last_len;
+	size_t         last_cap;
+	bool           done;
+};
+
+static struct {
+	nng_mtx     *mtx;
+	ridx_entry **v;
+	size_t       n;
+	size_t       cap;
+	uint64_t     scans;
+	uint64_t     visited;
+	uint64_t     matched;
+	bool         enabled;
+} ridx_;
+
+// '/' before any other byte, so a topic is followed by those below it
+static inline int
+ridx_byte(const char *s, size_t i)
+{
+	return s[i] == '/' ? 0 : (uint8_t) s[i] + 1;
+}
+
+static int
+ridx_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+	size_t n = alen < blen ? alen : blen;
+
+	for (size_t i = 0; i < n; i++) {
+		int d = ridx_byte(a, i) - ridx_byte(b, i);
+		if (d != 0) {
+			return d;
+		}
+	}
+	return alen < blen ? -1 : alen > blen;
+}
+
+// first entry not below topic
+static size_t
+ridx_lower(const char *topic, size_t len)
+{
+	size_t lo = 0;
+	size_t hi = ridx_.n;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (ridx_cmp(ridx_.v[mid]->topic, ridx_.v[mid]->len, topic, len) <
+		    0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static bool
+ridx_found(size_t i, const char *topic, size_t len)
+{
+	return i < ridx_.n && ridx_.v[i]->len == len &&
+	    memcmp(ridx_.v[i]->topic, topic, len) == 0;
+}
+
+int
+retain_index_init(void)
+{
+	int rv;
+
+	if (ridx_.enabled) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&ridx_.mtx)) != 0) {
+		return rv;
+	}
+	ridx_.enabled = true;
+	return 0;
+}
+
+void
+retain_index_fini(void)
+{
+	if (!ridx_.enabled) {
+		return;
+	}
+	ridx_.enabled = false;
+	for (size_t i = 0; i < ridx_.n; i++) {
+		nng_msg_free(ridx_.v[i]->msg);
+		nng_free(ridx_.v[i], sizeof(ridx_entry) + ridx_.v[i]->len + 1);
+	}
+	if (ridx_.v != NULL) {
+		nng_free(ridx_.v, ridx_.cap * sizeof(ridx_entry *));
+	}
+	nng_mtx_free(ridx_.mtx);
+	memset(&ridx_, 0, sizeof(ridx_));
+}
+
+bool
+retain_index_enabled(void)
+{
+	return ridx_.enabled;
+}
+
+int
+retain_index_put(const char *topic, nng_msg *msg)
+{
+	ridx_entry *e;
+	nng_msg    *old;
+	size_t      len = strlen(topic);
+	size_t      i;
+
+	if (!ridx_.enabled) {
+		return NNG_ECLOSED;
+	}
+	nng_msg_clone(msg);
+	nng_mtx_lock(ridx_.mtx);
+	i = ridx_lower(topic, len);
+	if (ridx_found(i, topic, len)) {
+		old               = ridx_.v[i]->msg;
+		ridx_.v[i]->msg   = msg;
+		nng_mtx_unlock(ridx_.mtx);
+		nng_msg_free(old);
+		return 0;
+	}
+	if (ridx_.n == ridx_.cap) {
+		size_t       cap = ridx_.cap ? ridx_.cap * 2 : 64;
+		ridx_entry **v;
+
+		if ((v = nng_alloc(cap * sizeof(ridx_entry *))) == NULL) {
+			nng_mtx_unlock(ridx_.mtx);
+			nng_msg_free(msg);
+			return NNG_ENOMEM;
+		}
+		if (ridx_.v != NULL) {
+			memcpy(v, ridx_.v, ridx_.n * sizeof(ridx_entry *));
+			nng_free(ridx_.v, ridx_.cap * sizeof(ridx_entry *));
+		}
+		ridx_.v   = v;
+		ridx_.cap = cap;
+	}
+	if ((e = nng_alloc(sizeof(ridx_entry) + len + 1)) == NULL) {
+		nng_mtx_unlock(ridx_.mtx);
+		nng_msg_free(msg);
+		return NNG_ENOMEM;
+	}
+	e->msg = msg;
+	e->len = len;
+	memcpy(e->topic, topic, len + 1);
+	memmove(&ridx_.v[i + 1], &ridx_.v[i], (ridx_.n - i) * sizeof(ridx_entry *));
+	ridx_.v[i] = e;
+	ridx_.n++;
+	nng_mtx_unlock(ridx_.mtx);
+	return 0;
+}
+
+void
+retain_index_remove(const char *topic)
+{
+	ridx_entry *e = NULL;
+	size_t      len;
+	size_t      i;
+
+	if (!ridx_.enabled) {
+		return;
+	}
+	len = strlen(topic);
+	nng_mtx_lock(ridx_.mtx);
+	i = ridx_lower(topic, len);
+	if (ridx_found(i, topic, len)) {
+		e = ridx_.v[i];
+		ridx_.n--;
+		memmove(&ridx_.v[i], &ridx_.v[i + 1],
+		    (ridx_.n - i) * sizeof(ridx_entry *));
+	}
+	nng_mtx_unlock(ridx_.mtx);
+	if (e != NULL) {
+		nng_msg_free(e->msg);
+		nng_free(e, sizeof(ridx_entry) + len + 1);
+	}
+}
+
+retain_cursor *
+retain_index_open(const char *filter)
+{
+	retain_cursor *c;
+	const char    *level = filter;
+	size_t         plen  = 0;
+	bool           wild  = false;
+
+	if (!ridx_.enabled || strncmp(filter, "$share/", 7) == 0) {
+		return NULL;
+	}
+	// the literal prefix ends at the first level that is a wildcard
+	for (;;) {
+		const char *end = strchr(level, '/');
+		size_t      n   = end ? (size_t) (end - level) : strlen(level);
+
+		if (n == 1 && (level[0] == '+' || level[0] == '#')) {
+			wild = true;
+			break;
+		}
+		if (end == NULL) {
+			break;
+		}
+		plen  = end - filter;
+		level = end + 1;
+	}
+	if (!wild || (c = nng_zalloc(sizeof(*c))) == NULL) {
+		return NULL;
+	}
+	if (topic_pattern_compile(filter, &c->pattern) != 0 ||
+	    (c->prefix = nng_alloc(plen + 1)) == NULL) {
+		retain_index_close(c);
+		return NULL;
+	}
+	memcpy(c->prefix, filter, plen);
+	c->prefix[plen] = '\0';
+	c->plen         = plen;
+	c->dollar       = level == filter;
+
+	nng_mtx_lock(ridx_.mtx);
+	ridx_.scans++;
+	nng_mtx_unlock(ridx_.mtx);
+	return c;
+}
+
+void
+retain_index_close(retain_cursor *c)
+{
+	if (c == NULL) {
+		return;
+	}
+	if (c->pattern != NULL) {
+		topic_pattern_free(c->pattern);
+	}
+	if (c->prefix != NULL) {
+		nng_free(c->prefix, c->plen + 1);
+	}
+	if (c->last != NULL) {
+		nng_free(c->last, c->last_cap);
+	}
+	nng_free(c, sizeof(*c));
+}
+
+// topic is the prefix or lies below it
+static bool
+ridx_in_run(const retain_cursor *c, const ridx_entry *e)
+{
+	return c->plen == 0 ||
+	    (e->len >= c->plen && memcmp(e->topic, c->prefix, c->plen) == 0 &&
+	        (e->len == c->plen || e->topic[c->plen] == '/'));
+}
+
+static int
+ridx_remember(retain_cursor *c, const ridx_entry *e)
+{
+	if (e->len + 1 > c->last_cap) {
+		size_t cap  = e->len + 1 > 2 * c->last_cap ? e->len + 1
+		                                           : 2 * c->last_cap;
+		char  *last = nng_alloc(cap);
+
+		if (last == NULL) {
+			return NNG_ENOMEM;
+		}
+		if (c->last != NULL) {
+			nng_free(c->last, c->last_cap);
+		}
+		c->last     = last;
+		c->last_cap = cap;
+	}
+	memcpy(c->last, e->topic, e->len + 1);
+	c->last_len = e->len;
+	return 0;
+}
+
+size_t
+retain_index_next(retain_cursor *c, nng_msg ***msgs, size_t limit)
+{
+	size_t added = 0;
+
+	if (!ridx_.enabled) {
+		c->done = true;
+	}
+	// the lock is held for a bounded number of topics at a time, a
+	// sparse match must not stall the publishers of retained messages
+	while (added == 0 && !c->done && limit > 0) {
+		topic_levels tl;
+		size_t       i;
+		size_t       seen = 0;
+
+		nng_mtx_lock(ridx_.mtx);
+		if (c->last == NULL) {
+			i = ridx_lower(c->prefix, c->plen);
+		} else {
+			i = ridx_lower(c->last, c->last_len);
+			if (ridx_found(i, c->last, c->last_len)) {
+				i++;
+			}
+		}
+		for (; i < ridx_.n && added < limit &&
+		     seen < NANO_RETAIN_INDEX_VISIT;
+		     i++, seen++) {
+			ridx_entry *e = ridx_.v[i];
+
+			if (!ridx_in_run(c, e)) {
+				break;
+			}
+			if (c->dollar && e->topic[0] == '$') {
+				continue;
+			}
+			topic_split(e->topic, e->len, &tl);
+			if (!topic_pattern_match(c->pattern, e->topic, &tl)) {
+				continue;
+			}
+			nng_msg_clone(e->msg);
+			cvector_push_back(*msgs, e->msg);
+			added++;
+		}
+		if (i >= ridx_.n || !ridx_in_run(c, ridx_.v[i])) {
+			c->done = true;
+		} else if (i > 0 && ridx_remember(c, ridx_.v[i - 1]) != 0) {
+			c->done = true;
+		}
+		ridx_.visited += seen;
+		ridx_.matched += added;
+		nng_mtx_unlock(ridx_.mtx);
+	}
+	return added;
+}
+
+void
+retain_index_stats_get(retain_index_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!ridx_.enabled) {
+		return;
+	}
+	nng_mtx_lock(ridx_.mtx);
+	s->topics  = ridx_.n;
+	s->scans   = ridx_.scans;
+	s->visited = ridx_.visited;
+	s->matched = ridx_.matched;
+	nng_mtx_unlock(ridx_.mtx);
+}
@@ -0,0 +1,692 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "include/retain_log.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+#define RETAIN_LOG_MAGIC 0x524d514eu
+#define RETAIN_LOG_DEL 0x01
+#define RETAIN_LOG_ALIGN(n) (((n) + 7) & ~(size_t) 7)
+#define RETAIN_LOG_BUCKETS 1024
+
+// on-disk record, followed by topic, fixed header, body and padding
+typedef struct {
+	uint32_t magic; // written last, a torn record ends the segment
+	uint32_t size;  // whole record, 8 bytes aligned
+	uint32_t sum;   // FNV-1a of everything behind this header
+	uint32_t expire; // wall clock seconds, 0 = never
+	uint32_t head_len;
+	uint32_t body_len;
+	uint16_t topic_len;
+	uint8_t  proto_ver;
+	uint8_t  flags;
+	uint32_t reserved;
+} retain_log_hdr;
+
+typedef struct {
+	uint32_t seq;
+	int      fd;
+	uint8_t *base;
+	size_t   size;
+	size_t   used;
+	bool     sealed; // no more appends, e.g. under compaction
+} retain_seg;
+
+typedef struct retain_log_idx retain_log_idx;
+
+// latest record of a topic
+struct retain_log_idx {
+	uint32_t        hash;
+	uint32_t        seg; // position in segs
+	uint32_t        off;
+	retain_log_idx *next;
+};
+
+typedef struct {
+	char            *dir;
+	size_t           seg_size;
+	retain_seg      *segs; // cvector, ascending seq
+	uint32_t         next_seq;
+	retain_log_idx **buckets;
+	size_t           nbuckets;
+	uint64_t         live_count;
+	uint64_t         live_bytes;
+	uint64_t         dead_bytes;
+	nng_mtx         *mtx;
+	bool             enabled;
+} retain_log;
+
+static retain_log rlog = { .enabled = false };
+
+static uint32_t
+retain_log_sum(uint32_t h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static inline retain_log_hdr *
+rec_at(uint32_t seg, uint32_t off)
+{
+	return (retain_log_hdr *) (rlog.segs[seg].base + off);
+}
+
+static inline char *
+rec_topic(retain_log_hdr *h)
+{
+	return (char *) (h + 1);
+}
+
+static bool
+rec_valid(retain_seg *seg, size_t off)
+{
+	retain_log_hdr *h;
+	size_t          len;
+
+	if (off + sizeof(retain_log_hdr) > seg->size) {
+		return false;
+	}
+	h = (retain_log_hdr *) (seg->base + off);
+	if (h->magic != RETAIN_LOG_MAGIC || h->size % 8 != 0 ||
+	    h->size > seg->size - off) {
+		return false;
+	}
+	len = (size_t) h->topic_len + h->head_len + h->body_len;
+	if (len > h->size - sizeof(retain_log_hdr)) {
+		return false;
+	}
+	return h->sum == retain_log_sum(2166136261u, h + 1, len);
+}
+
+static bool
+rec_blank(retain_seg *seg, size_t off)
+{
+	static const retain_log_hdr zero = { 0 };
+
+	return off + sizeof(retain_log_hdr) > seg->size ||
+	    memcmp(seg->base + off, &zero, sizeof(zero)) == 0;
+}
+
+static void
+idx_grow(void)
+{
+	size_t           n = rlog.nbuckets * 2;
+	retain_log_idx **b = nng_zalloc(sizeof(retain_log_idx *) * n);
+	retain_log_idx  *e;
+
+	if (b == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < rlog.nbuckets; i++) {
+		while ((e = rlog.buckets[i]) != NULL) {
+			rlog.buckets[i] = e->next;
+			e->next         = b[e->hash & (n - 1)];
+			b[e->hash & (n - 1)] = e;
+		}
+	}
+	nng_free(rlog.buckets, sizeof(retain_log_idx *) * rlog.nbuckets);
+	rlog.buckets  = b;
+	rlog.nbuckets = n;
+}
+
+static retain_log_idx **
+idx_find(const char *topic, size_t len, uint32_t hash)
+{
+	retain_log_idx **pp = &rlog.buckets[hash & (rlog.nbuckets - 1)];
+
+	for (; *pp != NULL; pp = &(*pp)->next) {
+		retain_log_hdr *h = rec_at((*pp)->seg, (*pp)->off);
+		if ((*pp)->hash == hash && h->topic_len == len &&
+		    memcmp(rec_topic(h), topic, len) == 0) {
+			break;
+		}
+	}
+	return pp;
+}
+
+// account the record at seg/off as the latest state of its topic
+static void
+idx_apply(uint32_t seg, uint32_t off)
+{
+	retain_log_hdr  *h    = rec_at(seg, off);
+	uint32_t         hash = retain_log_sum(2166136261u, rec_topic(h), h->topic_len);
+	retain_log_idx **pp   = idx_find(rec_topic(h), h->topic_len, hash);
+	retain_log_idx  *e    = *pp;
+
+	if (e != NULL) {
+		uint32_t old = rec_at(e->seg, e->off)->size;
+		rlog.live_bytes -= old;
+		rlog.dead_bytes += old;
+	}
+	if (h->flags & RETAIN_LOG_DEL) {
+		rlog.dead_bytes += h->size;
+		if (e != NULL) {
+			*pp = e->next;
+			nng_free(e, sizeof(retain_log_idx));
+			rlog.live_count--;
+		}
+		return;
+	}
+	if (e == NULL) {
+		if ((e = nng_zalloc(sizeof(retain_log_idx))) == NULL) {
+			log_error("retain log index out of memory");
+			rlog.dead_bytes += h->size;
+			return;
+		}
+		e->hash = hash;
+		*pp     = e;
+		rlog.live_count++;
+	}
+	e->seg = seg;
+	e->off = off;
+	rlog.live_bytes += h->size;
+	if (rlog.live_count > rlog.nbuckets * 2) {
+		idx_grow();
+	}
+}
+
+static int
+seg_open(uint32_t seq, bool create, retain_seg *seg)
+{
+	char        path[PATH_MAX];
+	struct stat st;
+	int         fd;
+	int         rv;
+
+	snprintf(path, sizeof(path), "%s/retain-%010u.seg", rlog.dir, seq);
+	fd = open(path, create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0644);
+	if (fd < 0) {
+		log_error("open %s failed: %s", path, strerror(errno));
+		return NNG_ESYSERR;
+	}
+	if (create && (rv = posix_fallocate(fd, 0, rlog.seg_size)) != 0) {
+		log_error("allocate %s failed: %s", path, strerror(rv));
+		close(fd);
+		unlink(path);
+		return NNG_ENOSPC;
+	}
+	if (fstat(fd, &st) != 0 ||
+	    (size_t) st.st_size < sizeof(retain_log_hdr)) {
+		close(fd);
+		return NNG_EINVAL;
+	}
+	seg->base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    fd, 0);
+	if (seg->base == MAP_FAILED) {
+		log_error("mmap %s failed: %s", path, strerror(errno));
+		close(fd);
+		if (create) {
+			unlink(path);
+		}
+		return NNG_ESYSERR;
+	}
+	seg->seq    = seq;
+	seg->fd     = fd;
+	seg->size   = st.st_size;
+	seg->used   = 0;
+	seg->sealed = false;
+	return 0;
+}
+
+static void
+seg_close(retain_seg *seg, bool remove)
+{
+	char path[PATH_MAX];
+
+	munmap(seg->base, seg->size);
+	close(seg->fd);
+	if (remove) {
+		snprintf(
+		    path, sizeof(path), "%s/retain-%010u.seg", rlog.dir, seg->seq);
+		unlink(path);
+	}
+}
+
+static int
+log_append(const retain_log_hdr *tmpl, const char *topic, const void *head,
+    const void *body, uint32_t *segp, uint32_t *offp)
+{
+	size_t          len  = (size_t) tmpl->topic_len + tmpl->head_len +
+	    tmpl->body_len;
+	size_t          need = RETAIN_LOG_ALIGN(sizeof(retain_log_hdr) + len);
+	size_t          n    = cvector_size(rlog.segs);
+	retain_seg     *seg;
+	retain_log_hdr *h;
+	uint8_t        *p;
+	int             rv;
+
+	if (need > rlog.seg_size) {
+		return NNG_EMSGSIZE;
+	}
+	if (n == 0 || rlog.segs[n - 1].sealed ||
+	    rlog.segs[n - 1].used + need > rlog.segs[n - 1].size) {
+		retain_seg s;
+		if ((rv = seg_open(rlog.next_seq, true, &s)) != 0) {
+			return rv;
+		}
+		rlog.next_seq++;
+		if (n > 0) {
+			rlog.segs[n - 1].sealed = true;
+		}
+		cvector_push_back(rlog.segs, s);
+		n++;
+	}
+	seg = &rlog.segs[n - 1];
+	h   = (retain_log_hdr *) (seg->base + seg->used);
+	p   = (uint8_t *) (h + 1);
+	memcpy(p, topic, tmpl->topic_len);
+	p += tmpl->topic_len;
+	if (tmpl->head_len > 0) {
+		memcpy(p, head, tmpl->head_len);
+		p += tmpl->head_len;
+	}
+	if (tmpl->body_len > 0) {
+		memcpy(p, body, tmpl->body_len);
+	}
+	*h       = *tmpl;
+	h->magic = 0;
+	h->size  = (uint32_t) need;
+	h->sum   = retain_log_sum(2166136261u, h + 1, len);
+	h->magic = RETAIN_LOG_MAGIC;
+
+	*segp = (uint32_t) (n - 1);
+	*offp = (uint32_t) seg->used;
+	seg->used += need;
+	return 0;
+}
+
+// Copy every live record into fresh segments and drop the old ones. On
+// failure both generations are kept, the index stays valid either way.
+static int
+retain_log_compact(void)
+{
+	size_t          nold = cvector_size(rlog.segs);
+	retain_seg     *segs = NULL;
+	retain_log_idx *e, **pp;
+	uint32_t        now = (uint32_t) time(NULL);
+	uint64_t        live = rlog.live_bytes;
+	int             rv   = 0;
+
+	if (nold == 0) {
+		return 0;
+	}
+	rlog.segs[nold - 1].sealed = true;
+	for (size_t i = 0; i < rlog.nbuckets && rv == 0; i++) {
+		pp = &rlog.buckets[i];
+		while ((e = *pp) != NULL) {
+			retain_log_hdr *h = rec_at(e->seg, e->off);
+			char           *t = rec_topic(h);
+			if (e->seg >= nold) {
+				pp = &e->next;
+				continue;
+			}
+			if (h->expire != 0 && h->expire <= now) {
+				rlog.live_bytes -= h->size;
+				rlog.live_count--;
+				*pp = e->next;
+				nng_free(e, sizeof(retain_log_idx));
+				continue;
+			}
+			rv = log_append(h, t, t + h->topic_len,
+			    t + h->topic_len + h->head_len, &e->seg, &e->off);
+			if (rv != 0) {
+				break;
+			}
+			pp = &e->next;
+		}
+	}
+	if (rv != 0) {
+		log_warn("retain log compaction failed: %d", rv);
+		return rv;
+	}
+
+	for (size_t i = 0; i < nold; i++) {
+		seg_close(&rlog.segs[i], true);
+	}
+	for (size_t i = nold; i < cvector_size(rlog.segs); i++) {
+		cvector_push_back(segs, rlog.segs[i]);
+	}
+	cvector_free(rlog.segs);
+	rlog.segs = segs;
+	for (size_t i = 0; i < rlog.nbuckets; i++) {
+		for (e = rlog.buckets[i]; e != NULL; e = e->next) {
+			e->seg -= (uint32_t) nold;
+		}
+	}
+	log_info("retain log compacted, %llu bytes dropped",
+	    (unsigned long long) (rlog.dead_bytes + live - rlog.live_bytes));
+	rlog.dead_bytes = 0;
+	return 0;
+}
+
+static inline void
+retain_log_maybe_compact(void)
+{
+	if (rlog.dead_bytes > rlog.live_bytes &&
+	    rlog.dead_bytes > rlog.seg_size) {
+		retain_log_compact();
+	}
+}
+
+static int
+seq_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+static int
+retain_log_scan(void)
+{
+	DIR           *d;
+	struct dirent *ent;
+	uint32_t      *seqs = NULL;
+	int            rv   = 0;
+
+	if ((d = opendir(rlog.dir)) == NULL) {
+		log_error("open %s failed: %s", rlog.dir, strerror(errno));
+		return NNG_ESYSERR;
+	}
+	while ((ent = readdir(d)) != NULL) {
+		uint32_t seq;
+		int      end = 0;
+		if (sscanf(ent->d_name, "retain-%10u.seg%n", &seq, &end) == 1 &&
+		    end > 0 && ent->d_name[end] == '\0') {
+			cvector_push_back(seqs, seq);
+		}
+	}
+	closedir(d);
+	if (seqs == NULL) {
+		return 0;
+	}
+	qsort(seqs, cvector_size(seqs), sizeof(uint32_t), seq_cmp);
+
+	for (size_t i = 0; i < cvector_size(seqs); i++) {
+		retain_seg seg;
+		uint32_t   si;
+		size_t     off = 0;
+
+		if ((rv = seg_open(seqs[i], false, &seg)) != 0) {
+			break;
+		}
+		cvector_push_back(rlog.segs, seg);
+		si = (uint32_t) (cvector_size(rlog.segs) - 1);
+		while (rec_valid(&rlog.segs[si], off)) {
+			idx_apply(si, (uint32_t) off);
+			off += rec_at(si, (uint32_t) off)->size;
+		}
+		rlog.segs[si].used = off;
+		// older segments never get appended to again, neither does
+		// one ending with a torn record
+		rlog.segs[si].sealed = i + 1 < cvector_size(seqs) ||
+		    !rec_blank(&rlog.segs[si], off);
+		rlog.next_seq        = seqs[i] + 1;
+	}
+	cvector_free(seqs);
+	return rv;
+}
+
+static void
+retain_log_reset(void)
+{
+	retain_log_idx *e;
+
+	for (size_t i = 0; i < cvector_size(rlog.segs); i++) {
+		seg_close(&rlog.segs[i], false);
+	}
+	cvector_free(rlog.segs);
+	rlog.segs = NULL;
+	for (size_t i = 0; i < rlog.nbuckets; i++) {
+		while ((e = rlog.buckets[i]) != NULL) {
+			rlog.buckets[i] = e->next;
+			nng_free(e, sizeof(retain_log_idx));
+		}
+	}
+	nng_free(rlog.buckets, sizeof(retain_log_idx *) * rlog.nbuckets);
+	rlog.buckets  = NULL;
+	rlog.nbuckets = 0;
+	nng_strfree(rlog.dir);
+	rlog.dir        = NULL;
+	rlog.live_count = 0;
+	rlog.live_bytes = 0;
+	rlog.dead_bytes = 0;
+	rlog.next_seq   = 0;
+}
+
+int
+retain_log_open(const char *dir, size_t seg_size)
+{
+	int rv;
+
+	if (rlog.enabled) {
+		return 0;
+	}
+	if (dir == NULL || seg_size < 4096 || seg_size > UINT32_MAX) {
+		return NNG_EINVAL;
+	}
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		log_error("create %s failed: %s", dir, strerror(errno));
+		return NNG_ESYSERR;
+	}
+	if ((rlog.dir = nng_strdup(dir)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	rlog.seg_size = seg_size;
+	rlog.nbuckets = RETAIN_LOG_BUCKETS;
+	rlog.buckets  = nng_zalloc(sizeof(retain_log_idx *) * rlog.nbuckets);
+	if (rlog.buckets == NULL) {
+		nng_strfree(rlog.dir);
+		rlog.dir = NULL;
+		return NNG_ENOMEM;
+	}
+	if ((rv = nng_mtx_alloc(&rlog.mtx)) != 0) {
+		retain_log_reset();
+		return rv;
+	}
+	if ((rv = retain_log_scan()) != 0) {
+		retain_log_reset();
+		nng_mtx_free(rlog.mtx);
+		return rv;
+	}
+	rlog.enabled = true;
+	log_info("retain log %s opened, %llu live msgs in %lu segments", dir,
+	    (unsigned long long) rlog.live_count, cvector_size(rlog.segs));
+	return 0;
+}
+
+void
+retain_log_close(void)
+{
+	if (!rlog.enabled) {
+		return;
+	}
+	nng_mtx_lock(rlog.mtx);
+	rlog.enabled = false;
+	nng_mtx_unlock(rlog.mtx);
+	retain_log_reset();
+	nng_mtx_free(rlog.mtx);
+}
+
+bool
+retain_log_enabled(void)
+{
+	return rlog.enabled;
+}
+
+int
+retain_log_load(retain_log_cb cb, void *arg)
+{
+	retain_log_rec  rec;
+	retain_log_idx *e;
+	char           *topic;
+	uint32_t        now = (uint32_t) time(NULL);
+	uint64_t        n   = 0;
+
+	if (!rlog.enabled) {
+		return NNG_ECLOSED;
+	}
+	if ((topic = nng_alloc(UINT16_MAX + 1)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	nng_mtx_lock(rlog.mtx);
+	for (size_t i = 0; i < rlog.nbuckets; i++) {
+		for (e = rlog.buckets[i]; e != NULL; e = e->next) {
+			retain_log_hdr *h = rec_at(e->seg, e->off);
+			uint8_t        *p = (uint8_t *) rec_topic(h);
+
+			if (h->expire != 0 && h->expire <= now) {
+				continue;
+			}
+			memcpy(topic, p, h->topic_len);
+			topic[h->topic_len] = '\0';
+			rec.topic           = topic;
+			rec.proto_ver       = h->proto_ver;
+			rec.head            = p + h->topic_len;
+			rec.head_len        = h->head_len;
+			rec.body            = rec.head + h->head_len;
+			rec.body_len        = h->body_len;
+			rec.expiry          = h->expire != 0 ? h->expire - now : 0;
+			cb(arg, &rec);
+			n++;
+		}
+	}
+	if (rlog.dead_bytes > rlog.live_bytes) {
+		retain_log_compact();
+	}
+	nng_mtx_unlock(rlog.mtx);
+	nng_free(topic, UINT16_MAX + 1);
+	log_info("%llu retained msgs restored from %s", (unsigned long long) n,
+	    rlog.dir);
+	return 0;
+}
+
+int
+retain_log_put(const char *topic, uint8_t proto_ver, const void *head,
+    size_t head_len, const void *body, size_t body_len, uint32_t expiry)
+{
+	retain_log_hdr tmpl = { 0 };
+	size_t         len;
+	uint32_t       seg, off;
+	int            rv;
+
+	if (!rlog.enabled) {
+		return NNG_ECLOSED;
+	}
+	if ((len = strlen(topic)) > UINT16_MAX || head_len > UINT32_MAX ||
+	    body_len > UINT32_MAX) {
+		return NNG_EINVAL;
+	}
+	tmpl.topic_len = (uint16_t) len;
+	tmpl.proto_ver = proto_ver;
+	tmpl.head_len  = (uint32_t) head_len;
+	tmpl.body_len  = (uint32_t) body_len;
+	tmpl.expire    = expiry > 0 ? (uint32_t) time(NULL) + expiry : 0;
+
+	nng_mtx_lock(rlog.mtx);
+	if ((rv = log_append(&tmpl, topic, head, body, &seg, &off)) == 0) {
+		idx_apply(seg, off);
+		retain_log_maybe_compact();
+	}
+	nng_mtx_unlock(rlog.mtx);
+	if (rv != 0) {
+		log_warn("persist retain msg of %s failed: %d", topic, rv);
+	}
+	return rv;
+}
+
+int
+retain_log_del(const char *topic)
+{
+	retain_log_hdr tmpl = { 0 };
+	size_t         len;
+	uint32_t       seg, off;
+	int            rv = 0;
+
+	if (!rlog.enabled) {
+		return NNG_ECLOSED;
+	}
+	if ((len = strlen(topic)) > UINT16_MAX) {
+		return NNG_EINVAL;
+	}
+	tmpl.topic_len = (uint16_t) len;
+	tmpl.flags     = RETAIN_LOG_DEL;
+
+	nng_mtx_lock(rlog.mtx);
+	// nothing to delete, spare the tombstone
+	if (*idx_find(topic, len, retain_log_sum(2166136261u, topic, len)) !=
+	    NULL) {
+		if ((rv = log_append(&tmpl, topic, NULL, NULL, &seg, &off)) ==
+		    0) {
+			idx_apply(seg, off);
+			retain_log_maybe_compact();
+		}
+	}
+	nng_mtx_unlock(rlog.mtx);
+	return rv;
+}
+
+uint64_t
+retain_log_live_count(void)
+{
+	uint64_t v;
+
+	if (!rlog.enabled) {
+		return 0;
+	}
+	nng_mtx_lock(rlog.mtx);
+	v = rlog.live_count;
+	nng_mtx_unlock(rlog.mtx);
+	return v;
+}
+
+uint64_t
+retain_log_live_bytes(void)
+{
+	uint64_t v;
+
+	if (!rlog.enabled) {
+		return 0;
+	}
+	nng_mtx_lock(rlog.mtx);
+	v = rlog.live_bytes;
+	nng_mtx_unlock(rlog.mtx);
+	return v;
+}
+
+uint64_t
+retain_log_dead_bytes(void)
+{
+	uint64_t v;
+
+	if (!rlog.enabled) {
+		return 0;
+	}
+	nng_mtx_lock(rlog.mtx);
+	v = rlog.dead_bytes;
+	nng_mtx_unlock(rlog.mtx);
+	return v;
+}
@@ -0,0 +1,288 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/retain_index.h"
+#include "include/retain_replay.h"
+#include "include/retain_store.h"
+#include "include/pub_handler.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/log.h"
+
+typedef struct retain_job retain_job;
+
+// retained messages still to be sent to one subscriber
+struct retain_job {
+	uint32_t       pid;
+	uint8_t        proto_ver;
+	nng_msg      **msgs;
+	size_t         next;
+	retain_cursor *cursor; // refills msgs once they are sent, if any
+	retain_job    *link;
+};
+
+typedef struct {
+	nng_ctx     ctx;
+	nng_aio    *send_aio;
+	nng_aio    *tick_aio;
+	nng_mtx    *mtx;
+	retain_job *head;
+	retain_job *tail;
+	bool        running; // a tick is scheduled or in progress
+	bool        closed;
+} replay_lane;
+
+static struct {
+	replay_lane *lanes;
+	size_t       count;
+	bool         enabled;
+} replay = { .enabled = false };
+
+static void
+retain_job_free(retain_job *job)
+{
+	for (size_t i = job->next; i < cvector_size(job->msgs); i++) {
+		nng_msg_free(job->msgs[i]);
+	}
+	cvector_free(job->msgs);
+	retain_index_close(job->cursor);
+	nng_free(job, sizeof(retain_job));
+}
+
+static void
+replay_send(replay_lane *lane, retain_job *job, nng_msg *m)
+{
+	nng_msg *rmsg = NULL;
+	int      rv;
+
+	rv = retain_store_wire(m, job->proto_ver, &rmsg);
+	if (rv == NNG_ENOENT) {
+		// not tracked by the store, e.g. loaded from sqlite
+		if (!check_msg_exp(m, nng_mqtt_msg_get_publish_property(m))) {
+			// expired msg is already released by check_msg_exp
+			// with sqlite
+#if !defined(NNG_SUPP_SQLITE)
+			nng_msg_free(m);
+#endif
+			return;
+		}
+		rmsg = retain_store_encode(m, job->proto_ver);
+	}
+	// free the ref due to dbtree_find_retain
+	nng_msg_free(m);
+	if (rmsg == NULL) {
+		return;
+	}
+	nng_aio_set_msg(lane->send_aio, rmsg);
+	nng_aio_set_prov_data(lane->send_aio, &job->pid);
+	nng_ctx_send(lane->ctx, lane->send_aio);
+}
+
+static void
+replay_lane_cb(void *arg)
+{
+	replay_lane *lane = arg;
+	retain_job  *job;
+
+	nng_mtx_lock(lane->mtx);
+	if (lane->closed || (job = lane->head) == NULL) {
+		lane->running = false;
+		nng_mtx_unlock(lane->mtx);
+		return;
+	}
+	lane->head = job->link;
+	if (lane->head == NULL) {
+		lane->tail = NULL;
+	}
+	nng_mtx_unlock(lane->mtx);
+
+	// the next chunk of a wildcard scan, never the whole set at once
+	if (job->cursor != NULL && job->next >= cvector_size(job->msgs)) {
+		cvector_free(job->msgs);
+		job->msgs = NULL;
+		job->next = 0;
+		if (retain_index_next(
+		        job->cursor, &job->msgs, NANO_RETAIN_REPLAY_BATCH) == 0) {
+			retain_index_close(job->cursor);
+			job->cursor = NULL;
+		}
+	}
+	for (size_t n = 0; n < NANO_RETAIN_REPLAY_BATCH &&
+	     job->next < cvector_size(job->msgs); n++) {
+		replay_send(lane, job, job->msgs[job->next++]);
+	}
+
+	nng_mtx_lock(lane->mtx);
+	if ((job->next < cvector_size(job->msgs) || job->cursor != NULL) &&
+	    !lane->closed) {
+		// round robin, a huge replay must not starve later subscribers
+		job->link = NULL;
+		if (lane->tail != NULL) {
+			lane->tail->link = job;
+		} else {
+			lane->head = job;
+		}
+		lane->tail = job;
+		job        = NULL;
+	}
+	if (lane->head != NULL && !lane->closed) {
+		nng_sleep_aio(NANO_RETAIN_REPLAY_INTERVAL, lane->tick_aio);
+	} else {
+		lane->running = false;
+	}
+	nng_mtx_unlock(lane->mtx);
+
+	if (job != NULL) {
+		retain_job_free(job);
+	}
+}
+
+static int
+replay_submit(uint32_t pid, uint8_t proto_ver, nng_msg **msgs,
+    retain_cursor *cursor)
+{
+	replay_lane *lane;
+	retain_job  *job;
+
+	if (!replay.enabled) {
+		return NNG_ECLOSED;
+	}
+	if ((job = nng_zalloc(sizeof(retain_job))) == NULL) {
+		return NNG_ENOMEM;
+	}
+	job->pid       = pid;
+	job->proto_ver = proto_ver;
+	job->msgs      = msgs;
+	job->cursor    = cursor;
+
+	lane = &replay.lanes[pid % replay.count];
+	nng_mtx_lock(lane->mtx);
+	if (lane->closed) {
+		nng_mtx_unlock(lane->mtx);
+		nng_free(job, sizeof(retain_job));
+		return NNG_ECLOSED;
+	}
+	if (lane->tail != NULL) {
+		lane->tail->link = job;
+	} else {
+		lane->head = job;
+	}
+	lane->tail = job;
+	if (!lane->running) {
+		lane->running = true;
+		nng_sleep_aio(0, lane->tick_aio);
+	}
+	nng_mtx_unlock(lane->mtx);
+	return 0;
+}
+
+int
+retain_replay_submit(uint32_t pid, uint8_t proto_ver, nng_msg **msgs)
+{
+	return replay_submit(pid, proto_ver, msgs, NULL);
+}
+
+int
+retain_replay_stream(uint32_t pid, uint8_t proto_ver, retain_cursor *cursor)
+{
+	return replay_submit(pid, proto_ver, NULL, cursor);
+}
+
+static void
+replay_lane_fini(replay_lane *lane)
+{
+	retain_job *job;
+
+	nng_mtx_lock(lane->mtx);
+	lane->closed = true;
+	nng_mtx_unlock(lane->mtx);
+
+	nng_aio_stop(lane->tick_aio);
+	while ((job = lane->head) != NULL) {
+		lane->head = job->link;
+		retain_job_free(job);
+	}
+	lane->tail = NULL;
+	nng_ctx_close(lane->ctx);
+	nng_aio_free(lane->tick_aio);
+	nng_aio_free(lane->send_aio);
+	nng_mtx_free(lane->mtx);
+}
+
+static int
+replay_lane_init(replay_lane *lane, nng_socket sock)
+{
+	int rv;
+
+	if ((rv = nng_mtx_alloc(&lane->mtx)) != 0) {
+		return rv;
+	}
+	if ((rv = nng_aio_alloc(&lane->send_aio, NULL, NULL)) != 0) {
+		nng_mtx_free(lane->mtx);
+		return rv;
+	}
+	if ((rv = nng_aio_alloc(&lane->tick_aio, replay_lane_cb, lane)) != 0) {
+		nng_aio_free(lane->send_aio);
+		nng_mtx_free(lane->mtx);
+		return rv;
+	}
+	if ((rv = nng_ctx_open(&lane->ctx, sock)) != 0) {
+		nng_aio_free(lane->tick_aio);
+		nng_aio_free(lane->send_aio);
+		nng_mtx_free(lane->mtx);
+		return rv;
+	}
+	return 0;
+}
+
+int
+retain_replay_init(nng_socket sock, size_t lanes)
+{
+	int rv;
+
+	if (replay.enabled) {
+		return 0;
+	}
+	if (lanes == 0) {
+		return NNG_EINVAL;
+	}
+	if ((replay.lanes = nng_zalloc(sizeof(replay_lane) * lanes)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	for (size_t i = 0; i < lanes; i++) {
+		if ((rv = replay_lane_init(&replay.lanes[i], sock)) != 0) {
+			while (i-- > 0) {
+				replay_lane_fini(&replay.lanes[i]);
+			}
+			nng_free(replay.lanes, sizeof(replay_lane) * lanes);
+			replay.lanes = NULL;
+			return rv;
+		}
+	}
+	replay.count   = lanes;
+	replay.enabled = true;
+	log_info("retain replay started with %lu lanes", lanes);
+	return 0;
+}
+
+void
+retain_replay_fini(void)
+{
+	if (!replay.enabled) {
+		return;
+	}
+	replay.enabled = false;
+	for (size_t i = 0; i < replay.count; i++) {
+		replay_lane_fini(&replay.lanes[i]);
+	}
+	nng_free(replay.lanes, sizeof(replay_lane) * replay.count);
+	replay.lanes = NULL;
+	replay.count = 0;
+}
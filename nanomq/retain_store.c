@@ -0,0 +1,365 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/retain_store.h"
+#include "include/broker.h"
+#include "include/pub_handler.h"
+#include "nng/supplemental/nanolib/log.h"
+
+#define RETAIN_STORE_LOCKS 64
+
+typedef struct retain_entry retain_entry;
+
+struct retain_entry {
+	nng_msg        *msg;      // key, owned by the retain dbtree
+	nng_time        deadline; // 0 when the msg never expires
+	nng_atomic_int *ref;
+	nng_msg        *wire[2];  // [0] for v3.1.x and [1] for v5
+	char           *topic;    // kept while the expiry timer is scheduled
+	expiry_timer    timer;
+	retain_entry   *next;
+};
+
+typedef struct {
+	retain_entry       **buckets;
+	size_t               size;
+	nng_mtx             *locks[RETAIN_STORE_LOCKS];
+	nng_atomic_u64      *count;
+	nng_atomic_u64      *bytes;
+	nng_atomic_u64      *expired;
+	retain_store_reap_cb reap;
+	void                *reap_arg;
+	bool                 enabled;
+} retain_store;
+
+static retain_store store = { .enabled = false };
+
+static inline size_t
+retain_store_bucket(nng_msg *msg)
+{
+	uint32_t h = (uint32_t) ((uintptr_t) msg >> 4) * 2654435761u;
+	return h & (store.size - 1);
+}
+
+static inline nng_mtx *
+retain_store_lock(size_t bucket)
+{
+	return store.locks[bucket % RETAIN_STORE_LOCKS];
+}
+
+static inline uint64_t
+retain_wire_size(nng_msg *wire)
+{
+	return nng_msg_header_len(wire) + nng_msg_len(wire);
+}
+
+static void
+retain_entry_release(retain_entry *entry)
+{
+	if (nng_atomic_dec_nv(entry->ref) != 0) {
+		return;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (entry->wire[i] != NULL) {
+			nng_atomic_sub64(store.bytes, retain_wire_size(entry->wire[i]));
+			nng_msg_free(entry->wire[i]);
+		}
+	}
+	if (entry->topic != NULL) {
+		nng_strfree(entry->topic);
+	}
+	nng_atomic_free(entry->ref);
+	nng_free(entry, sizeof(retain_entry));
+}
+
+static bool
+retain_entry_tracked(retain_entry *entry)
+{
+	retain_entry *e;
+	size_t        b = retain_store_bucket(entry->msg);
+
+	nng_mtx_lock(retain_store_lock(b));
+	for (e = store.buckets[b]; e != NULL && e != entry; e = e->next) {
+	}
+	nng_mtx_unlock(retain_store_lock(b));
+	return e != NULL;
+}
+
+// The timer holds a ref of its entry, so the entry is still there even if
+// the msg was removed while the callback was due.
+static void
+retain_entry_expire(void *arg)
+{
+	retain_entry *entry = arg;
+
+	if (store.reap != NULL && retain_entry_tracked(entry)) {
+		nng_atomic_inc64(store.expired);
+		store.reap(store.reap_arg, entry->topic, entry->msg);
+	}
+	retain_entry_release(entry);
+}
+
+nng_msg *
+retain_store_encode(nng_msg *msg, uint8_t proto_ver)
+{
+	nano_work                 work = { 0 };
+	struct pub_packet_struct *pp;
+	nng_msg                  *rmsg = NULL;
+
+	if ((pp = nng_zalloc(sizeof(struct pub_packet_struct))) == NULL) {
+		return NULL;
+	}
+	work.msg        = msg;
+	work.pub_packet = pp;
+	work.proto_ver  = proto_ver;
+
+	if (decode_pub_message(
+	        &work, nng_mqtt_msg_get_connect_proto_version(msg)) != SUCCESS) {
+		log_warn("decode retain msg failed!");
+		goto out;
+	}
+	// dont modify original retain msg
+	if (nng_msg_dup(&rmsg, msg) != 0) {
+		log_error("System Failure while duplicating retain msg");
+		goto out;
+	}
+	nng_msg_set_cmd_type(rmsg,
+	    proto_ver == MQTT_VERSION_V5 ? CMD_PUBLISH_V5 : CMD_PUBLISH);
+	if (!encode_pub_message(rmsg, &work, PUBLISH)) {
+		log_warn("encode retain msg failed!");
+		nng_msg_free(rmsg);
+		rmsg = NULL;
+		goto out;
+	}
+	nng_mqtt_msg_set_sub_retain_bool(rmsg, true);
+
+out:
+	free_pub_packet(pp);
+	return rmsg;
+}
+
+int
+retain_store_init(size_t buckets)
+{
+	int rv;
+
+	if (store.enabled) {
+		return 0;
+	}
+	if (buckets == 0 || (buckets & (buckets - 1)) != 0) {
+		log_error("retain store size %lu is not a power of two", buckets);
+		return NNG_EINVAL;
+	}
+	store.buckets = nng_zalloc(sizeof(retain_entry *) * buckets);
+	if (store.buckets == NULL) {
+		return NNG_ENOMEM;
+	}
+	store.size = buckets;
+	for (int i = 0; i < RETAIN_STORE_LOCKS; i++) {
+		if ((rv = nng_mtx_alloc(&store.locks[i])) != 0) {
+			while (--i >= 0) {
+				nng_mtx_free(store.locks[i]);
+			}
+			nng_free(store.buckets, sizeof(retain_entry *) * buckets);
+			store.buckets = NULL;
+			return rv;
+		}
+	}
+	nng_atomic_alloc64(&store.count);
+	nng_atomic_alloc64(&store.bytes);
+	nng_atomic_alloc64(&store.expired);
+	store.enabled = true;
+	return 0;
+}
+
+void
+retain_store_fini(void)
+{
+	retain_entry *entry;
+
+	if (!store.enabled) {
+		return;
+	}
+	store.enabled = false;
+	for (size_t i = 0; i < store.size; i++) {
+		while ((entry = store.buckets[i]) != NULL) {
+			store.buckets[i] = entry->next;
+			if (expiry_wheel_cancel(&entry->timer)) {
+				retain_entry_release(entry);
+			}
+			retain_entry_release(entry);
+		}
+	}
+	nng_free(store.buckets, sizeof(retain_entry *) * store.size);
+	store.buckets = NULL;
+	store.size    = 0;
+	for (int i = 0; i < RETAIN_STORE_LOCKS; i++) {
+		nng_mtx_free(store.locks[i]);
+	}
+	nng_atomic_free64(store.count);
+	nng_atomic_free64(store.bytes);
+	nng_atomic_free64(store.expired);
+	store.reap = NULL;
+}
+
+bool
+retain_store_enabled(void)
+{
+	return store.enabled;
+}
+
+void
+retain_store_reaper(retain_store_reap_cb cb, void *arg)
+{
+	store.reap_arg = arg;
+	store.reap     = cb;
+}
+
+int
+retain_store_add(nng_msg *msg, const char *topic, uint32_t expiry)
+{
+	retain_entry *entry;
+	size_t        b;
+
+	if (!store.enabled) {
+		return NNG_ECLOSED;
+	}
+	if ((entry = nng_zalloc(sizeof(retain_entry))) == NULL) {
+		return NNG_ENOMEM;
+	}
+	if (nng_atomic_alloc(&entry->ref) != 0) {
+		nng_free(entry, sizeof(retain_entry));
+		return NNG_ENOMEM;
+	}
+	nng_atomic_set(entry->ref, 1);
+	entry->msg      = msg;
+	entry->deadline = expiry > 0 ? nng_clock() + (nng_time) expiry * 1000 : 0;
+
+	b = retain_store_bucket(msg);
+	nng_mtx_lock(retain_store_lock(b));
+	entry->next      = store.buckets[b];
+	store.buckets[b] = entry;
+	nng_mtx_unlock(retain_store_lock(b));
+
+	nng_atomic_inc64(store.count);
+
+	// without the wheel expired msgs are only skipped on replay
+	if (entry->deadline != 0 && topic != NULL && expiry_wheel_enabled() &&
+	    (entry->topic = nng_strdup(topic)) != NULL) {
+		nng_atomic_inc(entry->ref);
+		if (expiry_wheel_add(&entry->timer, entry->deadline,
+		        retain_entry_expire, entry) != 0) {
+			nng_atomic_dec_nv(entry->ref);
+		}
+	}
+	return 0;
+}
+
+void
+retain_store_remove(nng_msg *msg)
+{
+	retain_entry **pp;
+	retain_entry  *entry = NULL;
+	size_t         b;
+
+	if (!store.enabled || msg == NULL) {
+		return;
+	}
+	b = retain_store_bucket(msg);
+	nng_mtx_lock(retain_store_lock(b));
+	for (pp = &store.buckets[b]; *pp != NULL; pp = &(*pp)->next) {
+		if ((*pp)->msg == msg) {
+			entry = *pp;
+			*pp   = entry->next;
+			break;
+		}
+	}
+	nng_mtx_unlock(retain_store_lock(b));
+
+	if (entry != NULL) {
+		nng_atomic_sub64(store.count, 1);
+		if (expiry_wheel_cancel(&entry->timer)) {
+			retain_entry_release(entry);
+		}
+		retain_entry_release(entry);
+	}
+}
+
+int
+retain_store_wire(nng_msg *msg, uint8_t proto_ver, nng_msg **wirep)
+{
+	retain_entry *entry;
+	nng_msg      *wire;
+	size_t        b;
+	int           v = proto_ver == MQTT_VERSION_V5 ? 1 : 0;
+
+	if (!store.enabled) {
+		return NNG_ENOENT;
+	}
+	b = retain_store_bucket(msg);
+	nng_mtx_lock(retain_store_lock(b));
+	for (entry = store.buckets[b]; entry != NULL; entry = entry->next) {
+		if (entry->msg == msg) {
+			break;
+		}
+	}
+	if (entry == NULL) {
+		nng_mtx_unlock(retain_store_lock(b));
+		return NNG_ENOENT;
+	}
+	if (entry->deadline != 0 && nng_clock() > entry->deadline) {
+		nng_mtx_unlock(retain_store_lock(b));
+		return NNG_ETIMEDOUT;
+	}
+	if ((wire = entry->wire[v]) != NULL) {
+		nng_msg_clone(wire);
+		nng_mtx_unlock(retain_store_lock(b));
+		*wirep = wire;
+		return 0;
+	}
+	nng_atomic_inc(entry->ref);
+	nng_mtx_unlock(retain_store_lock(b));
+
+	// encode outside of the lock, the caller holds a ref on msg
+	if ((wire = retain_store_encode(msg, proto_ver)) == NULL) {
+		retain_entry_release(entry);
+		return NNG_EINVAL;
+	}
+	nng_mtx_lock(retain_store_lock(b));
+	if (entry->wire[v] == NULL) {
+		nng_msg_clone(wire);
+		entry->wire[v] = wire;
+		nng_atomic_add64(store.bytes, retain_wire_size(wire));
+	}
+	nng_mtx_unlock(retain_store_lock(b));
+	retain_entry_release(entry);
+
+	*wirep = wire;
+	return 0;
+}
+
+uint64_t
+retain_store_count(void)
+{
+	return store.enabled ? nng_atomic_get64(store.count) : 0;
+}
+
+uint64_t
+retain_store_bytes(void)
+{
+	return store.enabled ? nng_atomic_get64(store.bytes) : 0;
+}
+
+uint64_t
+retain_store_expired(void)
+{
+	return store.enabled ? nng_atomic_get64(store.expired) : 0;
+}
@@ -0,0 +1,1062 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "include/bridge.h"
+#include "include/latency_stats.h"
+#include "include/pub_handler.h"
+#include "include/rule_filter.h"
+#include "nng/mqtt/packet.h"
+#include "nng/supplemental/nanolib/cJSON.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+#if defined(SUPP_RULE_ENGINE)
+
+// Fields kept in rule.filter, RULE_PAYLOAD_FIELD is walked apart.
+#define FILTER_FIELDS 8
+
+typedef struct {
+	uint8_t     field;
+	uint8_t     cmp;
+	long        num;
+	const char *str;
+	size_t      len;
+} filter_op;
+
+typedef struct {
+	uint32_t       rule_id;
+	const char    *topic;
+	size_t         topic_len;
+	bool           topic_exact;
+	topic_pattern *pattern; // NULL matches with topic_filter()
+	const char    *repub_cid;
+	size_t         repub_cid_len;
+	bool           has_filter;
+	uint8_t        nops;
+	filter_op      ops[FILTER_FIELDS];
+	long          *payload_num; // parsed rule_payload filters, NULL per message
+	cJSON        **payload_obj;
+	size_t         npayload;
+} filter_prog;
+
+// One level of the FROM topics, children sorted by word.
+typedef struct topic_node {
+	char               *word;
+	size_t              len;
+	struct topic_node **children; // cvector
+	struct topic_node  *plus;
+	uint32_t           *rules; // cvector, filter ends at this level
+	uint32_t           *hash;  // cvector, filter ends with "#" below it
+} topic_node;
+
+// Counters of one rule, handed from table to table while its rule_id stays.
+typedef struct {
+	uint32_t        rule_id;
+	uint32_t        tables; // holding it, changed by the writer only
+	nng_atomic_int *enabled;
+	nng_atomic_u64 *evals;
+	nng_atomic_u64 *hits;
+	nng_atomic_u64 *eval_ns;
+} rule_stat;
+
+// One version of the rules, never changed once published.
+typedef struct {
+	rule        *rules; // copied from conf_rule.rules, pointers shared
+	filter_prog *progs;
+	rule_stat  **stats;
+	size_t       count;
+	uint64_t     version;
+	topic_node  *root; // NULL falls back to walking every rule
+} filter_table;
+
+typedef struct {
+	void (*fn)(void *);
+	void *arg;
+} filter_defer;
+
+typedef struct {
+	uint32_t           *idx;
+	size_t              cap;
+	size_t              n;
+	const char         *topic;
+	const topic_levels *tl;
+} topic_hits;
+
+/*
+ * Readers count themselves into the shard of their worker for the parity
+ * of the epoch they entered in and read the table of that parity. A writer
+ * publishes the next table under the other parity, moves the epoch on and
+ * waits for the readers of the old parity to leave before it frees what
+ * they could still see. Readers never wait.
+ */
+static struct {
+	nng_mtx        *mtx; // writers
+	nng_atomic_u64 *epoch;
+	nng_atomic_int *readers[NANO_RULE_EPOCH_SHARDS][2];
+	filter_table   *tables[2];
+	uint64_t        version;
+	filter_defer   *deferred; // cvector, run after the next grace period
+} filters_;
+
+// Cheapest checks first, the first failing one ends the match.
+static const uint8_t filter_order[FILTER_FIELDS] = {
+	RULE_QOS,
+	RULE_ID,
+	RULE_TIMESTAMP,
+	RULE_TOPIC,
+	RULE_CLIENTID,
+	RULE_USERNAME,
+	RULE_PASSWORD,
+	RULE_PAYLOAD_ALL,
+};
+
+static bool
+filter_is_int(uint8_t field)
+{
+	return field == RULE_QOS || field == RULE_ID ||
+	    field == RULE_TIMESTAMP;
+}
+
+static bool
+cmp_int(long value_checked, long value_seted, uint8_t type)
+{
+	switch (type) {
+	case RULE_CMP_EQUAL:
+		return value_checked == value_seted;
+	case RULE_CMP_UNEQUAL:
+		return value_checked != value_seted;
+	case RULE_CMP_GREATER:
+		return value_checked > value_seted;
+	case RULE_CMP_LESS:
+		return value_checked < value_seted;
+	case RULE_CMP_GREATER_AND_EQUAL:
+		return value_checked >= value_seted;
+	case RULE_CMP_LESS_AND_EQUAL:
+		return value_checked <= value_seted;
+	default:
+		return true;
+	}
+}
+
+static bool
+cmp_equal(bool equal, uint8_t type)
+{
+	switch (type) {
+	case RULE_CMP_EQUAL:
+		return equal;
+	case RULE_CMP_UNEQUAL:
+		return !equal;
+	default:
+		return true;
+	}
+}
+
+// Also comparing the terminator saves a strlen of checked.
+static bool
+cmp_cstr(const char *checked, const char *seted, size_t len, uint8_t type)
+{
+	if (checked == NULL) {
+		return false;
+	}
+	return cmp_equal(strncmp(checked, seted, len + 1) == 0, type);
+}
+
+static bool
+cmp_bytes(const char *checked, size_t checked_len, const char *seted,
+    size_t len, uint8_t type)
+{
+	return cmp_equal(
+	    checked_len == len && memcmp(checked, seted, len) == 0, type);
+}
+
+static void
+prog_build(filter_prog *p, rule *r)
+{
+	memset(p, 0, sizeof(*p));
+	p->rule_id     = r->rule_id;
+	p->topic       = r->topic;
+	p->topic_len   = r->topic != NULL ? strlen(r->topic) : 0;
+	p->topic_exact = r->topic != NULL && strpbrk(r->topic, "+#") == NULL;
+	if (r->topic != NULL && !p->topic_exact &&
+	    topic_pattern_compile(r->topic, &p->pattern) != 0) {
+		// matched with topic_filter() instead
+		p->pattern = NULL;
+	}
+
+	if (RULE_FORWORD_REPUB == r->forword_type && r->repub != NULL &&
+	    r->repub->clientid != NULL) {
+		p->repub_cid     = r->repub->clientid;
+		p->repub_cid_len = strlen(r->repub->clientid);
+	}
+
+	p->has_filter = r->filter != NULL;
+	for (size_t i = 0; p->has_filter && i < FILTER_FIELDS; i++) {
+		uint8_t    field = filter_order[i];
+		char      *val   = r->filter[field];
+		filter_op *op;
+
+		if (val == NULL) {
+			continue;
+		}
+		op        = &p->ops[p->nops++];
+		op->field = field;
+		op->cmp   = r->cmp_type[field];
+		op->str   = val;
+		op->len   = strlen(val);
+		if (filter_is_int(field)) {
+			op->num = atol(val);
+		} else if (op->cmp != RULE_CMP_EQUAL &&
+		    op->cmp != RULE_CMP_UNEQUAL) {
+			log_warn("rule %u: strings only compare equal or unequal",
+			    r->rule_id);
+		}
+	}
+
+	p->npayload = cvector_size(r->payload);
+	if (p->npayload == 0) {
+		return;
+	}
+	p->payload_num = nng_alloc(sizeof(long) * p->npayload);
+	p->payload_obj = nng_alloc(sizeof(cJSON *) * p->npayload);
+	if (p->payload_num == NULL || p->payload_obj == NULL) {
+		// parsed per message instead
+		nng_free(p->payload_num, sizeof(long) * p->npayload);
+		nng_free(p->payload_obj, sizeof(cJSON *) * p->npayload);
+		p->payload_num = NULL;
+		p->payload_obj = NULL;
+		return;
+	}
+	for (size_t i = 0; i < p->npayload; i++) {
+		const char *f = r->payload[i]->filter;
+
+		p->payload_num[i] = f != NULL ? atol(f) : 0;
+		p->payload_obj[i] = f != NULL ? cJSON_Parse(f) : NULL;
+	}
+}
+
+static void
+prog_free(filter_prog *p)
+{
+	topic_pattern_free(p->pattern);
+	if (p->payload_obj != NULL) {
+		for (size_t i = 0; i < p->npayload; i++) {
+			cJSON_Delete(p->payload_obj[i]);
+		}
+		nng_free(p->payload_obj, sizeof(cJSON *) * p->npayload);
+	}
+	if (p->payload_num != NULL) {
+		nng_free(p->payload_num, sizeof(long) * p->npayload);
+	}
+}
+
+// Fields of the rule being matched go to per-work scratch, the
+// rule_payload of the shared rule is left alone.
+static int
+rule_values_reserve(nano_work *work, size_t n)
+{
+	rule_value *vals;
+
+	if (n > work->rule_vals_cap) {
+		if ((vals = nng_alloc(sizeof(rule_value) * n)) == NULL) {
+			return NNG_ENOMEM;
+		}
+		nng_free(work->rule_vals, sizeof(rule_value) * work->rule_vals_cap);
+		work->rule_vals     = vals;
+		work->rule_vals_cap = n;
+	}
+	if (n > 0) {
+		memset(work->rule_vals, 0, sizeof(rule_value) * n);
+	}
+	return 0;
+}
+
+static bool
+payload_filter(
+    rule_doc *doc, rule *info, const filter_prog *p, rule_value *vals)
+{
+	bool   filter = true;
+	cJSON *root   = rule_doc_get(doc);
+	cJSON *jp;
+	// info->payload size equal 0, implicit there is no
+	// payload filter need to be check, so filter is true.
+	for (size_t pi = 0; pi < cvector_size(info->payload); pi++) {
+		jp                    = root;
+		rule_payload *payload = info->payload[pi];
+		for (size_t k = 0; k < cvector_size(payload->psa); k++) {
+			if (jp == NULL) {
+				break;
+			}
+			jp = cJSON_GetObjectItem(jp, payload->psa[k]);
+		}
+
+		if (jp == NULL) {
+			filter = false;
+			break;
+		}
+
+		switch (jp->type) {
+		case cJSON_Number:;
+			long num = cJSON_GetNumberValue(jp);
+			long seted = p->payload_num != NULL
+			    ? p->payload_num[pi]
+			    : (payload->filter ? atol(payload->filter) : 0);
+
+			if (payload->filter &&
+			    !cmp_int(num, seted, payload->cmp_type)) {
+				filter = false;
+			} else {
+				vals[pi].num  = num;
+				vals[pi].type = cJSON_Number;
+			}
+			break;
+		case cJSON_String:;
+			char *str = cJSON_GetStringValue(jp);
+			if (payload->filter &&
+			    !cmp_equal(strcmp(str, payload->filter) == 0,
+			        payload->cmp_type)) {
+				filter = false;
+			} else {
+				vals[pi].str  = str;
+				vals[pi].type = cJSON_String;
+			}
+			break;
+		case cJSON_Object:;
+			cJSON *filter_obj = p->payload_obj != NULL
+			    ? p->payload_obj[pi]
+			    : cJSON_Parse(payload->filter);
+			if (!payload->is_store && filter_obj &&
+			    !cJSON_Compare(jp, filter_obj, true)) {
+				filter = false;
+			} else {
+				vals[pi].obj  = jp;
+				vals[pi].type = cJSON_Object;
+			}
+			if (p->payload_obj == NULL) {
+				cJSON_Delete(filter_obj);
+			}
+			break;
+
+		default:
+			break;
+		}
+		if (!filter) {
+			break;
+		}
+	}
+
+	return filter;
+}
+
+static bool
+prog_match(const filter_prog *p, nano_work *work, rule_doc *doc, rule *r)
+{
+	pub_packet_struct *pp        = work->pub_packet;
+	const char        *topic     = pp->var_header.publish.topic_name.body;
+	size_t             topic_len = pp->var_header.publish.topic_name.len;
+	conn_param        *cp        = work->cparam;
+	bool               filter    = true;
+
+	// a republished message must not trigger its own rule again
+	if (p->repub_cid != NULL &&
+	    cmp_cstr((const char *) conn_param_get_clientid(cp), p->repub_cid,
+	        p->repub_cid_len, RULE_CMP_EQUAL)) {
+		return false;
+	}
+	if (p->topic_exact) {
+		if (topic_len != p->topic_len ||
+		    memcmp(topic, p->topic, topic_len) != 0) {
+			return false;
+		}
+	} else if (p->pattern != NULL
+	        ? !topic_pattern_match(p->pattern, topic, pub_packet_levels(pp))
+	        : !topic_filter(p->topic, topic)) {
+		return false;
+	}
+
+	if (rule_values_reserve(work, p->npayload) != 0) {
+		return false;
+	}
+	if (!p->has_filter) {
+		payload_filter(doc, r, p, work->rule_vals);
+		return true;
+	}
+
+	for (uint8_t i = 0; i < p->nops && filter; i++) {
+		const filter_op *op = &p->ops[i];
+
+		switch (op->field) {
+		case RULE_QOS:
+			filter = cmp_int(pp->fixed_header.qos, op->num, op->cmp);
+			break;
+		case RULE_ID:
+			filter = cmp_int(
+			    pp->var_header.publish.packet_id, op->num, op->cmp);
+			break;
+		case RULE_TIMESTAMP:
+			filter = cmp_int((long) time(NULL), op->num, op->cmp);
+			break;
+		case RULE_TOPIC:
+			filter = cmp_bytes(
+			    topic, topic_len, op->str, op->len, op->cmp);
+			break;
+		case RULE_CLIENTID:
+			filter = cmp_cstr(
+			    (const char *) conn_param_get_clientid(cp),
+			    op->str, op->len, op->cmp);
+			break;
+		case RULE_USERNAME:
+			filter = cmp_cstr(
+			    (const char *) conn_param_get_username(cp),
+			    op->str, op->len, op->cmp);
+			break;
+		case RULE_PASSWORD:
+			filter = cmp_cstr(
+			    (const char *) conn_param_get_password(cp),
+			    op->str, op->len, op->cmp);
+			break;
+		case RULE_PAYLOAD_ALL:
+			filter = pp->payload.data != NULL &&
+			    pp->payload.len > 0 &&
+			    cmp_bytes((const char *) pp->payload.data,
+			        pp->payload.len, op->str, op->len, op->cmp);
+			break;
+		default:
+			break;
+		}
+	}
+	if (!filter) {
+		return false;
+	}
+
+	if (!pp->payload.data || pp->payload.len <= 0) {
+		return false;
+	}
+	return payload_filter(doc, r, p, work->rule_vals);
+}
+
+static topic_node *
+topic_node_alloc(const char *word, size_t len)
+{
+	topic_node *n;
+
+	if ((n = nng_alloc(sizeof(*n))) == NULL) {
+		return NULL;
+	}
+	memset(n, 0, sizeof(*n));
+	if ((n->word = nng_alloc(len + 1)) == NULL) {
+		nng_free(n, sizeof(*n));
+		return NULL;
+	}
+	memcpy(n->word, word, len);
+	n->word[len] = '\0';
+	n->len       = len;
+	return n;
+}
+
+static void
+topic_node_free(topic_node *n)
+{
+	if (n == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < cvector_size(n->children); i++) {
+		topic_node_free(n->children[i]);
+	}
+	topic_node_free(n->plus);
+	cvector_free(n->children);
+	cvector_free(n->rules);
+	cvector_free(n->hash);
+	nng_free(n->word, n->len + 1);
+	nng_free(n, sizeof(*n));
+}
+
+static int
+topic_word_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+	int rv = memcmp(a, b, alen < blen ? alen : blen);
+
+	if (rv != 0) {
+		return rv;
+	}
+	return alen < blen ? -1 : alen > blen;
+}
+
+static int
+topic_node_cmp(const void *a, const void *b)
+{
+	const topic_node *na = *(topic_node *const *) a;
+	const topic_node *nb = *(topic_node *const *) b;
+
+	return topic_word_cmp(na->word, na->len, nb->word, nb->len);
+}
+
+static topic_node *
+topic_node_find(const topic_node *n, const char *word, size_t len)
+{
+	size_t lo = 0;
+	size_t hi = cvector_size(n->children);
+
+	while (lo < hi) {
+		size_t      mid = lo + (hi - lo) / 2;
+		topic_node *c   = n->children[mid];
+		int         rv  = topic_word_cmp(word, len, c->word, c->len);
+
+		if (rv == 0) {
+			return c;
+		}
+		if (rv < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return NULL;
+}
+
+// Children are appended while building, sorted once for the lookups.
+static void
+topic_node_sort(topic_node *n)
+{
+	size_t count = cvector_size(n->children);
+
+	if (count > 1) {
+		qsort(n->children, count, sizeof(topic_node *), topic_node_cmp);
+	}
+	for (size_t i = 0; i < count; i++) {
+		topic_node_sort(n->children[i]);
+	}
+	if (n->plus != NULL) {
+		topic_node_sort(n->plus);
+	}
+}
+
+static int
+topic_node_add(topic_node *n, const char *filter, uint32_t index)
+{
+	const char *word = filter;
+
+	for (;;) {
+		const char *end = strchr(word, '/');
+		size_t      len = end != NULL ? (size_t) (end - word) : strlen(word);
+		topic_node *next;
+
+		if (len == 1 && word[0] == '#') {
+			cvector_push_back(n->hash, index);
+			return 0;
+		}
+		if (len == 1 && word[0] == '+') {
+			if (n->plus == NULL &&
+			    (n->plus = topic_node_alloc(word, len)) == NULL) {
+				return NNG_ENOMEM;
+			}
+			next = n->plus;
+		} else {
+			for (size_t i = 0; i < cvector_size(n->children); i++) {
+				next = n->children[i];
+				if (topic_word_cmp(word, len, next->word,
+				        next->len) == 0) {
+					goto found;
+				}
+			}
+			if ((next = topic_node_alloc(word, len)) == NULL) {
+				return NNG_ENOMEM;
+			}
+			cvector_push_back(n->children, next);
+		}
+	found:
+		n = next;
+		if (end == NULL) {
+			cvector_push_back(n->rules, index);
+			return 0;
+		}
+		word = end + 1;
+	}
+}
+
+static void
+topic_hits_add(topic_hits *h, const uint32_t *rules)
+{
+	for (size_t i = 0; i < cvector_size(rules); i++) {
+		if (h->n < h->cap) {
+			h->idx[h->n] = rules[i];
+		}
+		h->n++;
+	}
+}
+
+// n was reached by the levels before level i, by all of them if i is tl->n.
+static void
+topic_node_match(const topic_node *n, uint32_t i, topic_hits *h)
+{
+	const char *word;
+	size_t      len;
+	topic_node *child;
+
+	// "a/#" also matches "a"
+	topic_hits_add(h, n->hash);
+	if (i == h->tl->n) {
+		topic_hits_add(h, n->rules);
+		return;
+	}
+	if (h->n > h->cap) {
+		return;
+	}
+	word = topic_level(h->tl, h->topic, i, &len);
+	if ((child = topic_node_find(n, word, len)) != NULL) {
+		topic_node_match(child, i + 1, h);
+	}
+	if (n->plus != NULL) {
+		topic_node_match(n->plus, i + 1, h);
+	}
+}
+
+// Disabled rules are indexed too, they are switched without a new table.
+static topic_node *
+topic_index_build(const rule *rules, size_t n)
+{
+	topic_node *root;
+
+	if ((root = topic_node_alloc("", 0)) == NULL) {
+		return NULL;
+	}
+	for (size_t i = 0; i < n; i++) {
+		const rule *r = &rules[i];
+
+		if (r->topic == NULL) {
+			// left to rule_filter_match, as before
+			cvector_push_back(root->hash, (uint32_t) i);
+		} else if (topic_node_add(root, r->topic, (uint32_t) i) != 0) {
+			topic_node_free(root);
+			return NULL;
+		}
+	}
+	topic_node_sort(root);
+	return root;
+}
+
+void
+rule_doc_init(rule_doc *doc, struct pub_packet_struct *pp)
+{
+	doc->pp     = pp;
+	doc->root   = NULL;
+	doc->parsed = false;
+}
+
+cJSON *
+rule_doc_get(rule_doc *doc)
+{
+	pub_packet_struct *pp = doc->pp;
+
+	if (!doc->parsed) {
+		doc->parsed = true;
+		if (pp->payload.data != NULL && pp->payload.len > 0) {
+			doc->root = cJSON_ParseWithLength(
+			    (const char *) pp->payload.data, pp->payload.len);
+		}
+	}
+	return doc->root;
+}
+
+void
+rule_doc_fini(rule_doc *doc)
+{
+	cJSON_Delete(doc->root);
+	doc->root = NULL;
+}
+
+static void
+stat_free(rule_stat *st)
+{
+	if (st->enabled != NULL) {
+		nng_atomic_free(st->enabled);
+	}
+	if (st->evals != NULL) {
+		nng_atomic_free64(st->evals);
+	}
+	if (st->hits != NULL) {
+		nng_atomic_free64(st->hits);
+	}
+	if (st->eval_ns != NULL) {
+		nng_atomic_free64(st->eval_ns);
+	}
+	nng_free(st, sizeof(*st));
+}
+
+static rule_stat *
+stat_alloc(uint32_t rule_id)
+{
+	rule_stat *st;
+
+	if ((st = nng_zalloc(sizeof(*st))) == NULL) {
+		return NULL;
+	}
+	st->rule_id = rule_id;
+	if (nng_atomic_alloc(&st->enabled) != 0 ||
+	    nng_atomic_alloc64(&st->evals) != 0 ||
+	    nng_atomic_alloc64(&st->hits) != 0 ||
+	    nng_atomic_alloc64(&st->eval_ns) != 0) {
+		stat_free(st);
+		return NULL;
+	}
+	return st;
+}
+
+// The counters of rule_id in t, skipping those already taken by upto.
+static rule_stat *
+stat_find(const filter_table *t, uint32_t rule_id, size_t upto,
+    rule_stat *const *taken)
+{
+	for (size_t i = 0; t != NULL && i < t->count; i++) {
+		rule_stat *st = t->stats[i];
+		size_t     j  = 0;
+
+		if (st->rule_id != rule_id) {
+			continue;
+		}
+		while (j < upto && taken[j] != st) {
+			j++;
+		}
+		if (j == upto) {
+			return st;
+		}
+	}
+	return NULL;
+}
+
+static void
+table_free(filter_table *t)
+{
+	if (t == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < t->count; i++) {
+		prog_free(&t->progs[i]);
+		if (--t->stats[i]->tables == 0) {
+			stat_free(t->stats[i]);
+		}
+	}
+	nng_free(t->rules, sizeof(rule) * t->count);
+	nng_free(t->progs, sizeof(filter_prog) * t->count);
+	nng_free(t->stats, sizeof(rule_stat *) * t->count);
+	topic_node_free(t->root);
+	nng_free(t, sizeof(*t));
+}
+
+static filter_table *
+table_current(void)
+{
+	return filters_.tables[nng_atomic_get64(filters_.epoch) & 1];
+}
+
+static int
+table_build(filter_table **tp, conf_rule *cr)
+{
+	filter_table *cur = table_current();
+	filter_table *t;
+	size_t        n = cvector_size(cr->rules);
+
+	if ((t = nng_zalloc(sizeof(*t))) == NULL) {
+		return NNG_ENOMEM;
+	}
+	if (n > 0 &&
+	    ((t->rules = nng_alloc(sizeof(rule) * n)) == NULL ||
+	        (t->progs = nng_alloc(sizeof(filter_prog) * n)) == NULL ||
+	        (t->stats = nng_zalloc(sizeof(rule_stat *) * n)) == NULL)) {
+		nng_free(t->rules, sizeof(rule) * n);
+		nng_free(t->progs, sizeof(filter_prog) * n);
+		nng_free(t, sizeof(*t));
+		return NNG_ENOMEM;
+	}
+	for (size_t i = 0; i < n; i++) {
+		rule      *r  = &cr->rules[i];
+		rule_stat *st = stat_find(cur, r->rule_id, i, t->stats);
+
+		if (st == NULL && (st = stat_alloc(r->rule_id)) == NULL) {
+			t->count = i;
+			table_free(t);
+			return NNG_ENOMEM;
+		}
+		st->tables++;
+		nng_atomic_set(st->enabled, r->enabled ? 1 : 0);
+		t->stats[i] = st;
+		t->rules[i] = *r;
+		prog_build(&t->progs[i], &t->rules[i]);
+		t->count = i + 1;
+	}
+	if ((t->root = topic_index_build(t->rules, n)) == NULL) {
+		log_warn("rule topic index failed, every rule is visited");
+	}
+	t->version = ++filters_.version;
+	*tp        = t;
+	return 0;
+}
+
+// Wait for the readers of parity to leave, new ones enter the other one.
+static void
+filter_sync(int parity)
+{
+	for (size_t s = 0; s < NANO_RULE_EPOCH_SHARDS; s++) {
+		while (nng_atomic_get(filters_.readers[s][parity]) != 0) {
+			nng_msleep(1);
+		}
+	}
+}
+
+static void
+filter_run_deferred(void)
+{
+	for (size_t i = 0; i < cvector_size(filters_.deferred); i++) {
+		filters_.deferred[i].fn(filters_.deferred[i].arg);
+	}
+	cvector_free(filters_.deferred);
+	filters_.deferred = NULL;
+}
+
+int
+rule_filter_init(void)
+{
+	int rv;
+
+	if (filters_.mtx != NULL) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&filters_.mtx)) != 0 ||
+	    (rv = nng_atomic_alloc64(&filters_.epoch)) != 0) {
+		rule_filter_fini();
+		return rv;
+	}
+	for (size_t s = 0; s < NANO_RULE_EPOCH_SHARDS; s++) {
+		for (int p = 0; p < 2; p++) {
+			rv = nng_atomic_alloc(&filters_.readers[s][p]);
+			if (rv != 0) {
+				rule_filter_fini();
+				return rv;
+			}
+		}
+	}
+	return 0;
+}
+
+void
+rule_filter_lock(void)
+{
+	nng_mtx_lock(filters_.mtx);
+}
+
+void
+rule_filter_unlock(void)
+{
+	nng_mtx_unlock(filters_.mtx);
+}
+
+int
+rule_filter_compile(conf_rule *cr)
+{
+	filter_table *t;
+	uint64_t      e;
+	int           rv;
+
+	if ((rv = rule_filter_init()) != 0 || (rv = table_build(&t, cr)) != 0) {
+		return rv;
+	}
+	e = nng_atomic_get64(filters_.epoch);
+	filters_.tables[(e + 1) & 1] = t;
+	nng_atomic_inc64(filters_.epoch);
+
+	filter_sync((int) (e & 1));
+	table_free(filters_.tables[e & 1]);
+	filters_.tables[e & 1] = NULL;
+	filter_run_deferred();
+	log_debug("rule table %" PRIu64 ": %zu rules", t->version, t->count);
+	return 0;
+}
+
+void
+rule_filter_defer(void (*fn)(void *), void *arg)
+{
+	filter_defer d = { .fn = fn, .arg = arg };
+
+	if (filters_.epoch == NULL) {
+		// no table, nobody can see it
+		fn(arg);
+		return;
+	}
+	cvector_push_back(filters_.deferred, d);
+}
+
+int
+rule_filter_enable(uint32_t rule_id, bool enabled)
+{
+	rule_stat *st;
+
+	if (filters_.epoch == NULL ||
+	    (st = stat_find(table_current(), rule_id, 0, NULL)) == NULL) {
+		return NNG_ENOENT;
+	}
+	nng_atomic_set(st->enabled, enabled ? 1 : 0);
+	return 0;
+}
+
+int
+rule_filter_stat(uint32_t rule_id, rule_filter_stats *stats)
+{
+	rule_stat *st;
+
+	memset(stats, 0, sizeof(*stats));
+	if (filters_.epoch == NULL ||
+	    (st = stat_find(table_current(), rule_id, 0, NULL)) == NULL) {
+		return NNG_ENOENT;
+	}
+	stats->enabled = nng_atomic_get(st->enabled) != 0;
+	stats->evals   = nng_atomic_get64(st->evals);
+	stats->hits    = nng_atomic_get64(st->hits);
+	stats->eval_ns = nng_atomic_get64(st->eval_ns);
+	return 0;
+}
+
+uint64_t
+rule_filter_version(void)
+{
+	filter_table *t;
+
+	if (filters_.epoch == NULL || (t = table_current()) == NULL) {
+		return 0;
+	}
+	return t->version;
+}
+
+void
+rule_filter_fini(void)
+{
+	table_free(filters_.tables[0]);
+	table_free(filters_.tables[1]);
+	filter_run_deferred();
+	for (size_t s = 0; s < NANO_RULE_EPOCH_SHARDS; s++) {
+		for (int p = 0; p < 2; p++) {
+			if (filters_.readers[s][p] != NULL) {
+				nng_atomic_free(filters_.readers[s][p]);
+			}
+		}
+	}
+	if (filters_.epoch != NULL) {
+		nng_atomic_free64(filters_.epoch);
+	}
+	if (filters_.mtx != NULL) {
+		nng_mtx_free(filters_.mtx);
+	}
+	memset(&filters_, 0, sizeof(filters_));
+}
+
+void
+rule_filter_enter(rule_view *v, uint32_t worker)
+{
+	nng_atomic_int *readers;
+	filter_table   *t;
+	uint64_t        e;
+
+	memset(v, 0, sizeof(*v));
+	if (filters_.epoch == NULL) {
+		return;
+	}
+	v->shard = worker % NANO_RULE_EPOCH_SHARDS;
+	for (;;) {
+		e       = nng_atomic_get64(filters_.epoch);
+		readers = filters_.readers[v->shard][e & 1];
+		nng_atomic_inc(readers);
+		if (nng_atomic_get64(filters_.epoch) == e) {
+			break;
+		}
+		// a writer moved on meanwhile, its grace period must not see us
+		nng_atomic_dec_nv(readers);
+	}
+	v->parity  = (uint8_t) (e & 1);
+	v->entered = true;
+	if ((t = filters_.tables[v->parity]) != NULL) {
+		v->table   = t;
+		v->rules   = t->rules;
+		v->count   = t->count;
+		v->version = t->version;
+	}
+}
+
+void
+rule_filter_leave(rule_view *v)
+{
+	if (v->entered) {
+		nng_atomic_dec_nv(filters_.readers[v->shard][v->parity]);
+		v->entered = false;
+	}
+}
+
+size_t
+rule_filter_lookup(rule_view *v, const char *topic, const topic_levels *tl,
+    uint32_t *idx, size_t cap)
+{
+	const filter_table *t = v->table;
+	topic_hits          h = { .idx = idx, .cap = cap, .n = 0, .topic = topic };
+	topic_levels        split;
+
+	if (t == NULL || t->root == NULL || topic == NULL) {
+		return SIZE_MAX;
+	}
+	if (tl == NULL) {
+		topic_split(topic, strlen(topic), &split);
+		tl = &split;
+	}
+	h.tl = tl;
+	topic_node_match(t->root, 0, &h);
+	if (h.n > cap) {
+		return h.n;
+	}
+	// keep the order rules were added in
+	for (size_t i = 1; i < h.n; i++) {
+		uint32_t val = idx[i];
+		size_t   j   = i;
+
+		for (; j > 0 && idx[j - 1] > val; j--) {
+			idx[j] = idx[j - 1];
+		}
+		idx[j] = val;
+	}
+	return h.n;
+}
+
+bool
+rule_filter_match(nano_work *work, rule_doc *doc, rule_view *v, size_t index)
+{
+	const filter_table *t = v->table;
+	rule_stat          *st;
+	uint64_t            start;
+	bool                hit;
+
+	if (t == NULL || index >= t->count) {
+		return false;
+	}
+	st = t->stats[index];
+	if (nng_atomic_get(st->enabled) == 0) {
+		return false;
+	}
+	start = latency_now();
+	hit   = prog_match(&t->progs[index], work, doc, &t->rules[index]);
+	nng_atomic_add64(st->eval_ns, latency_now() - start);
+	nng_atomic_inc64(st->evals);
+	if (hit) {
+		nng_atomic_inc64(st->hits);
+	}
+	return hit;
+}
+
+#endif
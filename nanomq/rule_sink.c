@@ -0,0 +1,409 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "include/rule_sink.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+#if defined(NNG_SUPP_SQLITE)
+#include "nng/supplemental/sqlite/sqlite3.h"
+#endif
+#if defined(SUPP_MYSQL)
+#include <mysql.h>
+#endif
+
+#if defined(SUPP_RULE_ENGINE)
+
+typedef struct sink_row {
+	struct sink_row *next;
+	size_t           size;
+	nng_time         when;
+	char            *cols; // NULL when text holds schema statements
+	char            *text;
+	char             buf[];
+} sink_row;
+
+typedef struct rule_sink {
+	struct rule_sink *next;
+	uint8_t           type;
+	void             *db;
+	nng_mtx          *mtx;
+	nng_cv           *cv;
+	nng_thread       *thr;
+	sink_row         *head;
+	sink_row         *tail;
+	size_t            count;
+	bool              closing;
+	uint64_t          dropped;
+	uint64_t          failed;
+	char             *sql; // statement buffer, writer thread only
+	size_t            sql_cap;
+} rule_sink;
+
+static struct {
+	nng_mtx   *mtx;
+	rule_sink *sinks;
+} sinks_;
+
+static int
+sink_query(rule_sink *s, const char *sql)
+{
+	switch (s->type) {
+#if defined(NNG_SUPP_SQLITE)
+	case RULE_FORWORD_SQLITE:;
+		char *err_msg = NULL;
+		if (sqlite3_exec(s->db, sql, 0, 0, &err_msg) != SQLITE_OK) {
+			log_debug("rule sink sql error: %s", err_msg);
+			sqlite3_free(err_msg);
+			return NNG_EINVAL;
+		}
+		return 0;
+#endif
+#if defined(SUPP_MYSQL)
+	case RULE_FORWORD_MYSQL:
+		if (mysql_query(s->db, sql) != 0) {
+			log_debug("rule sink sql error: %s", mysql_error(s->db));
+			return NNG_EINVAL;
+		}
+		return 0;
+#endif
+	default:
+		return NNG_ENOTSUP;
+	}
+}
+
+static int
+sink_reserve(rule_sink *s, size_t len)
+{
+	char  *sql;
+	size_t cap = s->sql_cap == 0 ? 4096 : s->sql_cap;
+
+	if (len <= s->sql_cap) {
+		return 0;
+	}
+	while (cap < len) {
+		cap *= 2;
+	}
+	if ((sql = nng_alloc(cap)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	nng_free(s->sql, s->sql_cap);
+	s->sql     = sql;
+	s->sql_cap = cap;
+	return 0;
+}
+
+// Schema changes may fail when a column exists already, that is fine.
+static void
+sink_exec_lines(rule_sink *s, char *stmts)
+{
+	char *line = stmts;
+	char *end;
+
+	while (line != NULL && *line != '\0') {
+		if ((end = strchr(line, '\n')) != NULL) {
+			*end = '\0';
+		}
+		if (*line != '\0') {
+			sink_query(s, line);
+		}
+		line = end != NULL ? end + 1 : NULL;
+	}
+}
+
+// Rows from row on sharing its columns, written as one INSERT.
+static sink_row *
+sink_insert_run(rule_sink *s, sink_row *row)
+{
+	sink_row *r;
+	size_t    len = strlen("INSERT INTO  VALUES ;") + strlen(row->cols);
+	size_t    n   = 0;
+	size_t    off;
+
+	for (r = row; r != NULL && r->cols != NULL &&
+	     strcmp(r->cols, row->cols) == 0;
+	     r = r->next) {
+		len += strlen(r->text) + 2;
+		n++;
+	}
+	if (sink_reserve(s, len + 1) != 0) {
+		s->failed += n;
+		return r;
+	}
+	off = sprintf(s->sql, "INSERT INTO %s VALUES ", row->cols);
+	for (sink_row *w = row; w != r; w = w->next) {
+		off += sprintf(s->sql + off, "%s%s", w == row ? "" : ", ", w->text);
+	}
+	s->sql[off++] = ';';
+	s->sql[off]   = '\0';
+	if (sink_query(s, s->sql) != 0) {
+		s->failed += n;
+	}
+	return r;
+}
+
+static void
+sink_write(rule_sink *s, sink_row *rows)
+{
+	sink_row *row = rows;
+	sink_row *next;
+
+	sink_query(s,
+	    s->type == RULE_FORWORD_MYSQL ? "START TRANSACTION" : "BEGIN");
+	while (row != NULL) {
+		if (row->cols == NULL) {
+			sink_exec_lines(s, row->text);
+			row = row->next;
+		} else {
+			row = sink_insert_run(s, row);
+		}
+	}
+	sink_query(s, "COMMIT");
+
+	for (row = rows; row != NULL; row = next) {
+		next = row->next;
+		nng_free(row, row->size);
+	}
+}
+
+static void
+sink_thread(void *arg)
+{
+	rule_sink *s = arg;
+	sink_row  *rows;
+	sink_row  *last;
+	size_t     n;
+
+	nng_mtx_lock(s->mtx);
+	for (;;) {
+		while (!s->closing &&
+		    (s->count == 0 ||
+		        (s->count < NANO_RULE_SINK_BATCH &&
+		            nng_clock() <
+		                s->head->when + NANO_RULE_SINK_LINGER_MS))) {
+			if (s->count == 0) {
+				nng_cv_wait(s->cv);
+			} else {
+				nng_cv_until(s->cv,
+				    s->head->when + NANO_RULE_SINK_LINGER_MS);
+			}
+		}
+		if (s->count == 0) {
+			// closing and drained
+			break;
+		}
+		rows = last = s->head;
+		for (n = 1; n < NANO_RULE_SINK_BATCH && last->next != NULL;
+		     n++) {
+			last = last->next;
+		}
+		s->head    = last->next;
+		last->next = NULL;
+		if (s->head == NULL) {
+			s->tail = NULL;
+		}
+		s->count -= n;
+		nng_mtx_unlock(s->mtx);
+
+		sink_write(s, rows);
+
+		nng_mtx_lock(s->mtx);
+	}
+	nng_mtx_unlock(s->mtx);
+}
+
+static void
+sink_free(rule_sink *s)
+{
+	if (s->thr != NULL) {
+		nng_mtx_lock(s->mtx);
+		s->closing = true;
+		nng_cv_wake(s->cv);
+		nng_mtx_unlock(s->mtx);
+		nng_thread_destroy(s->thr);
+	}
+	if (s->dropped > 0 || s->failed > 0) {
+		log_warn("rule sink: %llu rows dropped, %llu failed",
+		    (unsigned long long) s->dropped,
+		    (unsigned long long) s->failed);
+	}
+	if (s->cv != NULL) {
+		nng_cv_free(s->cv);
+	}
+	if (s->mtx != NULL) {
+		nng_mtx_free(s->mtx);
+	}
+	nng_free(s->sql, s->sql_cap);
+	nng_free(s, sizeof(*s));
+}
+
+static rule_sink *
+sink_alloc(uint8_t type, void *db)
+{
+	rule_sink *s;
+
+	if ((s = nng_alloc(sizeof(*s))) == NULL) {
+		return NULL;
+	}
+	memset(s, 0, sizeof(*s));
+	s->type = type;
+	s->db   = db;
+	if (nng_mtx_alloc(&s->mtx) != 0 || nng_cv_alloc(&s->cv, s->mtx) != 0 ||
+	    nng_thread_create(&s->thr, sink_thread, s) != 0) {
+		s->thr = NULL;
+		sink_free(s);
+		return NULL;
+	}
+	return s;
+}
+
+// Sink of db, started on first use. Called with sinks_.mtx held.
+static rule_sink *
+sink_get(uint8_t type, void *db)
+{
+	rule_sink *s;
+
+	for (s = sinks_.sinks; s != NULL; s = s->next) {
+		if (s->db == db) {
+			return s;
+		}
+	}
+	if ((s = sink_alloc(type, db)) != NULL) {
+		s->next      = sinks_.sinks;
+		sinks_.sinks = s;
+	}
+	return s;
+}
+
+static int
+sink_put(uint8_t type, void *db, const char *cols, const char *text)
+{
+	rule_sink *s;
+	sink_row  *row;
+	size_t     clen = cols != NULL ? strlen(cols) + 1 : 0;
+	size_t     tlen = strlen(text) + 1;
+	size_t     size = sizeof(*row) + clen + tlen;
+	int        rv   = 0;
+
+	if (db == NULL || sinks_.mtx == NULL) {
+		return NNG_EINVAL;
+	}
+	if ((row = nng_alloc(size)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	row->next = NULL;
+	row->size = size;
+	row->when = nng_clock();
+	row->cols = NULL;
+	row->text = row->buf + clen;
+	if (cols != NULL) {
+		row->cols = row->buf;
+		memcpy(row->cols, cols, clen);
+	}
+	memcpy(row->text, text, tlen);
+
+	// the list lock keeps rule_sink_close from freeing s under us
+	nng_mtx_lock(sinks_.mtx);
+	if ((s = sink_get(type, db)) == NULL) {
+		nng_mtx_unlock(sinks_.mtx);
+		nng_free(row, size);
+		return NNG_ENOMEM;
+	}
+	nng_mtx_lock(s->mtx);
+	if (s->count >= NANO_RULE_SINK_QUEUE) {
+		if (s->dropped++ % 1024 == 0) {
+			log_warn("rule sink full, rows are dropped");
+		}
+		rv = NNG_EAGAIN;
+	} else {
+		if (s->tail != NULL) {
+			s->tail->next = row;
+		} else {
+			s->head = row;
+		}
+		s->tail = row;
+		s->count++;
+		if (s->count == 1 || s->count == NANO_RULE_SINK_BATCH) {
+			nng_cv_wake1(s->cv);
+		}
+		row = NULL;
+	}
+	nng_mtx_unlock(s->mtx);
+	nng_mtx_unlock(sinks_.mtx);
+
+	if (row != NULL) {
+		nng_free(row, size);
+	}
+	return rv;
+}
+
+int
+rule_sink_init(void)
+{
+	if (sinks_.mtx != NULL) {
+		return 0;
+	}
+	return nng_mtx_alloc(&sinks_.mtx);
+}
+
+void
+rule_sink_fini(void)
+{
+	rule_sink *s;
+
+	if (sinks_.mtx == NULL) {
+		return;
+	}
+	while ((s = sinks_.sinks) != NULL) {
+		sinks_.sinks = s->next;
+		sink_free(s);
+	}
+	nng_mtx_free(sinks_.mtx);
+	sinks_.mtx = NULL;
+}
+
+int
+rule_sink_insert(uint8_t type, void *db, const char *cols, const char *row)
+{
+	return sink_put(type, db, cols, row);
+}
+
+int
+rule_sink_exec(uint8_t type, void *db, const char *stmts)
+{
+	return sink_put(type, db, NULL, stmts);
+}
+
+void
+rule_sink_close(void *db)
+{
+	rule_sink **pp;
+	rule_sink  *s = NULL;
+
+	if (sinks_.mtx == NULL) {
+		return;
+	}
+	nng_mtx_lock(sinks_.mtx);
+	for (pp = &sinks_.sinks; *pp != NULL; pp = &(*pp)->next) {
+		if ((*pp)->db == db) {
+			s   = *pp;
+			*pp = s->next;
+			break;
+		}
+	}
+	nng_mtx_unlock(sinks_.mtx);
+	if (s != NULL) {
+		sink_free(s);
+	}
+}
+
+#endif
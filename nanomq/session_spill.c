@@ -0,0 +1,661 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/session_spill.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/idhash.h"
+#include "nng/supplemental/util/platform.h"
+
+#define SPILL_MAGIC 0x5353514eu
+#define SPILL_BUCKETS 4096
+
+// where a record is on disk, seq 0 for nowhere
+typedef struct {
+	uint32_t seq;
+	uint32_t len; // header included
+	uint64_t off;
+} spill_loc;
+
+// on-disk record, followed by fixed header and body
+typedef struct {
+	uint32_t  magic;
+	uint32_t  head_len;
+	uint32_t  body_len;
+	uint8_t   cmd;
+	uint8_t   proto_ver;
+	uint16_t  pad;
+	spill_loc prev; // previous record of the same session
+} spill_hdr;
+
+typedef struct spill_msg spill_msg;
+struct spill_msg {
+	spill_msg *next;
+	uint32_t   head_len;
+	uint32_t   body_len;
+	uint8_t    cmd;
+	uint8_t    proto_ver;
+	uint8_t    data[]; // head, then body
+};
+
+typedef struct spill_session spill_session;
+struct spill_session {
+	spill_session *next;  // hash chain
+	spill_session *newer; // sessions holding memory, by last queued
+	spill_session *older;
+	char          *clientid;
+	uint32_t       pipe;
+	spill_msg     *head; // oldest in memory
+	spill_msg     *tail;
+	size_t         mem_msgs;
+	spill_loc      last; // newest on disk
+	size_t         disk_msgs;
+	bool           in_lru;
+};
+
+typedef struct {
+	uint32_t seq;
+	int      fd;
+	uint64_t size;
+	uint64_t live; // records not replayed or discarded yet
+} spill_seg;
+
+static struct {
+	nng_mtx           *mtx;
+	char              *dir;
+	session_spill_conf conf;
+	spill_session     *buckets[SPILL_BUCKETS];
+	nng_id_map        *pipes; // pipe id -> offline session
+	spill_session     *lru_new;
+	spill_session     *lru_old;
+	spill_seg         *segs; // oldest first, the last one is written
+	size_t             nsegs;
+	size_t             segcap;
+	uint32_t           next_seq;
+	nng_atomic_int    *offline; // sessions, for a lock free fast path
+	size_t             sessions;
+	uint64_t           mem;
+	uint64_t           disk;
+	uint64_t           queued;
+	uint64_t           spilled;
+	uint64_t           replayed;
+	uint64_t           dropped;
+	bool               enabled;
+} spill_;
+
+static uint32_t
+spill_hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s != '\0') {
+		h ^= (uint8_t) *s++;
+		h *= 16777619u;
+	}
+	return h & (SPILL_BUCKETS - 1);
+}
+
+static spill_session **
+spill_find(const char *clientid)
+{
+	spill_session **pp = &spill_.buckets[spill_hash(clientid)];
+
+	while (*pp != NULL && strcmp((*pp)->clientid, clientid) != 0) {
+		pp = &(*pp)->next;
+	}
+	return pp;
+}
+
+static void
+lru_remove(spill_session *s)
+{
+	if (!s->in_lru) {
+		return;
+	}
+	if (s->newer != NULL) {
+		s->newer->older = s->older;
+	} else {
+		spill_.lru_new = s->older;
+	}
+	if (s->older != NULL) {
+		s->older->newer = s->newer;
+	} else {
+		spill_.lru_old = s->newer;
+	}
+	s->newer  = NULL;
+	s->older  = NULL;
+	s->in_lru = false;
+}
+
+static void
+lru_touch(spill_session *s)
+{
+	lru_remove(s);
+	if ((s->older = spill_.lru_new) != NULL) {
+		s->older->newer = s;
+	} else {
+		spill_.lru_old = s;
+	}
+	spill_.lru_new = s;
+	s->in_lru      = true;
+}
+
+static inline uint64_t
+msg_cost(const spill_msg *m)
+{
+	return sizeof(*m) + m->head_len + m->body_len;
+}
+
+static spill_seg *
+seg_find(uint32_t seq)
+{
+	for (size_t i = 0; i < spill_.nsegs; i++) {
+		if (spill_.segs[i].seq == seq) {
+			return &spill_.segs[i];
+		}
+	}
+	return NULL;
+}
+
+static void
+seg_path(char *path, size_t size, uint32_t seq)
+{
+	snprintf(path, size, "%s/%08u.seg", spill_.dir, seq);
+}
+
+static void
+seg_remove(size_t i)
+{
+	char path[PATH_MAX];
+
+	close(spill_.segs[i].fd);
+	seg_path(path, sizeof(path), spill_.segs[i].seq);
+	unlink(path);
+	spill_.disk -= spill_.segs[i].size;
+	memmove(&spill_.segs[i], &spill_.segs[i + 1],
+	    (spill_.nsegs - i - 1) * sizeof(spill_seg));
+	spill_.nsegs--;
+}
+
+// One record of seq is done with, its segment goes once nothing is left.
+static void
+seg_release(uint32_t seq)
+{
+	spill_seg *seg = seg_find(seq);
+
+	if (seg != NULL && --seg->live == 0 &&
+	    seg != &spill_.segs[spill_.nsegs - 1]) {
+		seg_remove(seg - spill_.segs);
+	}
+}
+
+static int
+seg_open(void)
+{
+	char       path[PATH_MAX];
+	spill_seg *seg;
+
+	if (spill_.nsegs == spill_.segcap) {
+		size_t     cap  = spill_.segcap > 0 ? spill_.segcap * 2 : 8;
+		spill_seg *segs = realloc(spill_.segs, cap * sizeof(spill_seg));
+		if (segs == NULL) {
+			return NNG_ENOMEM;
+		}
+		spill_.segs   = segs;
+		spill_.segcap = cap;
+	}
+	seg      = &spill_.segs[spill_.nsegs];
+	seg->seq = spill_.next_seq++;
+	seg_path(path, sizeof(path), seg->seq);
+	if ((seg->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		log_error("session spill segment %s: %s", path, strerror(errno));
+		return NNG_ESYSERR;
+	}
+	seg->size = 0;
+	seg->live = 0;
+	spill_.nsegs++;
+	return 0;
+}
+
+// Append the oldest message in memory of s to the current segment.
+static int
+spill_write(spill_session *s, spill_msg *m)
+{
+	spill_hdr  h;
+	spill_seg *seg;
+	uint64_t   len = sizeof(h) + m->head_len + m->body_len;
+	int        rv;
+
+	if (spill_.disk + len > spill_.conf.disk) {
+		return NNG_ENOSPC;
+	}
+	seg = spill_.nsegs > 0 ? &spill_.segs[spill_.nsegs - 1] : NULL;
+	if (seg == NULL ||
+	    (seg->size > 0 && seg->size + len > spill_.conf.segment)) {
+		// the one written so far goes now if everything in it is gone
+		if (seg != NULL && seg->live == 0) {
+			seg_remove(spill_.nsegs - 1);
+		}
+		if ((rv = seg_open()) != 0) {
+			return rv;
+		}
+		seg = &spill_.segs[spill_.nsegs - 1];
+	}
+	memset(&h, 0, sizeof(h));
+	h.magic     = SPILL_MAGIC;
+	h.head_len  = m->head_len;
+	h.body_len  = m->body_len;
+	h.cmd       = m->cmd;
+	h.proto_ver = m->proto_ver;
+	h.prev      = s->last;
+	if (pwrite(seg->fd, &h, sizeof(h), seg->size) != sizeof(h) ||
+	    pwrite(seg->fd, m->data, m->head_len + m->body_len,
+	        seg->size + sizeof(h)) != (ssize_t) (m->head_len + m->body_len)) {
+		log_error("session spill write: %s", strerror(errno));
+		return NNG_ESYSERR;
+	}
+	s->last.seq = seg->seq;
+	s->last.len = (uint32_t) len;
+	s->last.off = seg->size;
+	s->disk_msgs++;
+	seg->size += len;
+	seg->live++;
+	spill_.disk += len;
+	spill_.spilled++;
+	return 0;
+}
+
+// Move the oldest message in memory of s to disk, or drop it.
+static void
+spill_oldest(spill_session *s)
+{
+	spill_msg *m = s->head;
+
+	if ((s->head = m->next) == NULL) {
+		s->tail = NULL;
+		lru_remove(s);
+	}
+	s->mem_msgs--;
+	spill_.mem -= msg_cost(m);
+	if (spill_write(s, m) != 0) {
+		spill_.dropped++;
+	}
+	nng_free(m, msg_cost(m));
+}
+
+static void
+spill_budget(void)
+{
+	while (spill_.mem > spill_.conf.mem && spill_.lru_old != NULL) {
+		spill_session *s = spill_.lru_old;
+		while (s->head != NULL) {
+			spill_oldest(s);
+		}
+	}
+}
+
+static int
+rec_read(spill_loc loc, spill_hdr *h, uint8_t **bufp, size_t *capp)
+{
+	spill_seg *seg = seg_find(loc.seq);
+	size_t     len;
+
+	if (seg == NULL ||
+	    pread(seg->fd, h, sizeof(*h), loc.off) != sizeof(*h) ||
+	    h->magic != SPILL_MAGIC) {
+		return NNG_EINVAL;
+	}
+	if (bufp == NULL) {
+		return 0;
+	}
+	len = h->head_len + h->body_len;
+	if (len > *capp) {
+		uint8_t *buf = realloc(*bufp, len);
+		if (buf == NULL) {
+			return NNG_ENOMEM;
+		}
+		*bufp = buf;
+		*capp = len;
+	}
+	if (pread(seg->fd, *bufp, len, loc.off + sizeof(*h)) != (ssize_t) len) {
+		return NNG_EINVAL;
+	}
+	return 0;
+}
+
+static void
+session_free(spill_session *s)
+{
+	nng_strfree(s->clientid);
+	nng_free(s, sizeof(*s));
+}
+
+// Take s out of every index, its queue is the caller's from now on.
+static void
+session_detach(spill_session **pp)
+{
+	spill_session *s = *pp;
+
+	*pp = s->next;
+	if (s->pipe != 0 && nng_id_get(spill_.pipes, s->pipe) == s) {
+		nng_id_remove(spill_.pipes, s->pipe);
+	}
+	lru_remove(s);
+	for (spill_msg *m = s->head; m != NULL; m = m->next) {
+		spill_.mem -= msg_cost(m);
+	}
+	spill_.sessions--;
+	nng_atomic_dec_nv(spill_.offline);
+}
+
+/*
+ * Disk records of s oldest first, then those in memory. Without cb they
+ * count as dropped. The lock is let go around each callback, which is fine
+ * as s is no longer reachable and segments stay while they hold records.
+ */
+static size_t
+session_drain(spill_session *s, session_spill_cb cb, void *arg)
+{
+	spill_loc        *locs = NULL;
+	uint8_t          *buf  = NULL;
+	size_t            cap  = 0;
+	size_t            n    = 0;
+	size_t            done = 0;
+	spill_hdr         h;
+	session_spill_rec rec;
+
+	if (s->disk_msgs > 0 &&
+	    (locs = nng_alloc(s->disk_msgs * sizeof(spill_loc))) != NULL) {
+		spill_loc loc = s->last;
+		while (n < s->disk_msgs && loc.seq != 0 &&
+		    rec_read(loc, &h, NULL, NULL) == 0) {
+			locs[s->disk_msgs - ++n] = loc;
+			loc                      = h.prev;
+		}
+	}
+	if (n < s->disk_msgs) {
+		log_warn("session %s lost %zu spilled messages", s->clientid,
+		    s->disk_msgs - n);
+		spill_.dropped += s->disk_msgs - n;
+	}
+	for (size_t i = s->disk_msgs - n; locs != NULL && i < s->disk_msgs;
+	     i++) {
+		bool ok = rec_read(locs[i], &h, &buf, &cap) == 0;
+		seg_release(locs[i].seq);
+		if (!ok || cb == NULL) {
+			spill_.dropped++;
+			continue;
+		}
+		rec.cmd       = h.cmd;
+		rec.proto_ver = h.proto_ver;
+		rec.head      = buf;
+		rec.head_len  = h.head_len;
+		rec.body      = buf + h.head_len;
+		rec.body_len  = h.body_len;
+		nng_mtx_unlock(spill_.mtx);
+		cb(arg, &rec);
+		nng_mtx_lock(spill_.mtx);
+		spill_.replayed++;
+		done++;
+	}
+	if (locs != NULL) {
+		nng_free(locs, s->disk_msgs * sizeof(spill_loc));
+	}
+	free(buf);
+	while (s->head != NULL) {
+		spill_msg *m = s->head;
+		s->head      = m->next;
+		if (cb == NULL) {
+			spill_.dropped++;
+		} else {
+			rec.cmd       = m->cmd;
+			rec.proto_ver = m->proto_ver;
+			rec.head      = m->data;
+			rec.head_len  = m->head_len;
+			rec.body      = m->data + m->head_len;
+			rec.body_len  = m->body_len;
+			nng_mtx_unlock(spill_.mtx);
+			cb(arg, &rec);
+			nng_mtx_lock(spill_.mtx);
+			spill_.replayed++;
+			done++;
+		}
+		nng_free(m, msg_cost(m));
+	}
+	return done;
+}
+
+static void
+spill_clear_dir(void)
+{
+	DIR           *d;
+	struct dirent *ent;
+	char           path[PATH_MAX];
+	size_t         len;
+
+	if ((d = opendir(spill_.dir)) == NULL) {
+		return;
+	}
+	while ((ent = readdir(d)) != NULL) {
+		len = strlen(ent->d_name);
+		if (len > 4 && strcmp(ent->d_name + len - 4, ".seg") == 0) {
+			snprintf(path, sizeof(path), "%s/%s", spill_.dir,
+			    ent->d_name);
+			unlink(path);
+		}
+	}
+	closedir(d);
+}
+
+int
+session_spill_init(const char *dir, const session_spill_conf *c)
+{
+	int rv;
+
+	if (spill_.enabled) {
+		return 0;
+	}
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		log_error("session spill dir %s: %s", dir, strerror(errno));
+		return NNG_ESYSERR;
+	}
+	if ((spill_.dir = nng_strdup(dir)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	if ((rv = nng_mtx_alloc(&spill_.mtx)) != 0 ||
+	    (rv = nng_id_map_alloc(&spill_.pipes, 0, 0, 0)) != 0 ||
+	    (rv = nng_atomic_alloc(&spill_.offline)) != 0) {
+		session_spill_fini();
+		return rv;
+	}
+	spill_.conf     = *c;
+	spill_.next_seq = 1;
+	spill_clear_dir();
+	spill_.enabled = true;
+	return 0;
+}
+
+void
+session_spill_fini(void)
+{
+	for (size_t b = 0; b < SPILL_BUCKETS; b++) {
+		spill_session *s;
+		while ((s = spill_.buckets[b]) != NULL) {
+			spill_.buckets[b] = s->next;
+			while (s->head != NULL) {
+				spill_msg *m = s->head;
+				s->head      = m->next;
+				nng_free(m, msg_cost(m));
+			}
+			session_free(s);
+		}
+	}
+	while (spill_.nsegs > 0) {
+		seg_remove(spill_.nsegs - 1);
+	}
+	free(spill_.segs);
+	if (spill_.pipes != NULL) {
+		nng_id_map_free(spill_.pipes);
+	}
+	if (spill_.offline != NULL) {
+		nng_atomic_free(spill_.offline);
+	}
+	if (spill_.mtx != NULL) {
+		nng_mtx_free(spill_.mtx);
+	}
+	if (spill_.dir != NULL) {
+		nng_strfree(spill_.dir);
+	}
+	memset(&spill_, 0, sizeof(spill_));
+}
+
+bool
+session_spill_enabled(void)
+{
+	return spill_.enabled;
+}
+
+int
+session_spill_offline(uint32_t pipe, const char *clientid)
+{
+	spill_session **pp;
+	spill_session  *s;
+
+	if (!spill_.enabled || clientid == NULL) {
+		return NNG_ECLOSED;
+	}
+	nng_mtx_lock(spill_.mtx);
+	pp = spill_find(clientid);
+	if ((s = *pp) == NULL) {
+		if ((s = nng_zalloc(sizeof(*s))) == NULL ||
+		    (s->clientid = nng_strdup(clientid)) == NULL) {
+			if (s != NULL) {
+				nng_free(s, sizeof(*s));
+			}
+			nng_mtx_unlock(spill_.mtx);
+			return NNG_ENOMEM;
+		}
+		*pp = s;
+		spill_.sessions++;
+		nng_atomic_inc(spill_.offline);
+	} else if (s->pipe != 0) {
+		nng_id_remove(spill_.pipes, s->pipe);
+	}
+	s->pipe = pipe;
+	nng_id_set(spill_.pipes, pipe, s);
+	nng_mtx_unlock(spill_.mtx);
+	return 0;
+}
+
+int
+session_spill_put(uint32_t pipe, const session_spill_rec *rec)
+{
+	spill_session *s;
+	spill_msg     *m;
+	uint64_t       dropped;
+	size_t         len = rec->head_len + rec->body_len;
+
+	if (!spill_.enabled || nng_atomic_get(spill_.offline) == 0) {
+		return NNG_ENOENT;
+	}
+	nng_mtx_lock(spill_.mtx);
+	if ((s = nng_id_get(spill_.pipes, pipe)) == NULL) {
+		nng_mtx_unlock(spill_.mtx);
+		return NNG_ENOENT;
+	}
+	if ((m = nng_alloc(sizeof(*m) + len)) == NULL) {
+		spill_.dropped++;
+		nng_mtx_unlock(spill_.mtx);
+		return NNG_ENOMEM;
+	}
+	m->next      = NULL;
+	m->head_len  = (uint32_t) rec->head_len;
+	m->body_len  = (uint32_t) rec->body_len;
+	m->cmd       = rec->cmd;
+	m->proto_ver = rec->proto_ver;
+	memcpy(m->data, rec->head, rec->head_len);
+	memcpy(m->data + rec->head_len, rec->body, rec->body_len);
+	if (s->tail != NULL) {
+		s->tail->next = m;
+	} else {
+		s->head = m;
+	}
+	s->tail = m;
+	s->mem_msgs++;
+	spill_.mem += msg_cost(m);
+	spill_.queued++;
+	lru_touch(s);
+
+	dropped = spill_.dropped;
+	if (s->mem_msgs > spill_.conf.msgs) {
+		spill_oldest(s);
+	}
+	spill_budget();
+	dropped = spill_.dropped - dropped;
+	nng_mtx_unlock(spill_.mtx);
+	return dropped > 0 ? NNG_ENOSPC : 0;
+}
+
+size_t
+session_spill_online(const char *clientid, session_spill_cb cb, void *arg)
+{
+	spill_session **pp;
+	spill_session  *s;
+	size_t          n;
+
+	if (!spill_.enabled || clientid == NULL ||
+	    nng_atomic_get(spill_.offline) == 0) {
+		return 0;
+	}
+	nng_mtx_lock(spill_.mtx);
+	pp = spill_find(clientid);
+	if ((s = *pp) == NULL) {
+		nng_mtx_unlock(spill_.mtx);
+		return 0;
+	}
+	session_detach(pp);
+	n = session_drain(s, cb, arg);
+	nng_mtx_unlock(spill_.mtx);
+	session_free(s);
+	return n;
+}
+
+void
+session_spill_discard(const char *clientid)
+{
+	session_spill_online(clientid, NULL, NULL);
+}
+
+void
+session_spill_stats_get(session_spill_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!spill_.enabled) {
+		return;
+	}
+	nng_mtx_lock(spill_.mtx);
+	s->sessions = spill_.sessions;
+	s->mem      = spill_.mem;
+	s->disk     = spill_.disk;
+	s->segments = (uint32_t) spill_.nsegs;
+	s->queued   = spill_.queued;
+	s->spilled  = spill_.spilled;
+	s->replayed = spill_.replayed;
+	s->dropped  = spill_.dropped;
+	nng_mtx_unlock(spill_.mtx);
+}
@@ -0,0 +1,282 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/expiry_wheel.h"
+#include "include/session_takeover.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/idhash.h"
+#include "nng/supplemental/util/platform.h"
+
+#define TAKEOVER_BUCKETS 4096
+
+typedef struct tk_session tk_session;
+
+struct tk_session {
+	tk_session  *next;
+	char        *clientid;
+	uint32_t     pipe; // the owner, open or parked
+	bool         parked;
+	bool         detached; // no longer found by its client id
+	expiry_timer timer;
+};
+
+// value of the pipes whose session another pipe took over while they were
+// still open, until their disconnect
+static char tk_handed;
+
+static struct {
+	nng_mtx            *mtx;
+	tk_session         *buckets[TAKEOVER_BUCKETS];
+	nng_id_map         *pipes; // owner -> session, or &tk_handed
+	takeover_release_cb release;
+	void               *release_arg;
+	uint64_t            takeovers;
+	uint64_t            parked;
+	uint64_t            expired;
+	size_t              sessions;
+	bool                enabled;
+} takeover_;
+
+static uint32_t
+tk_hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s != '\0') {
+		h ^= (uint8_t) *s++;
+		h *= 16777619u;
+	}
+	return h & (TAKEOVER_BUCKETS - 1);
+}
+
+static tk_session **
+tk_find(const char *clientid)
+{
+	tk_session **pp = &takeover_.buckets[tk_hash(clientid)];
+
+	while (*pp != NULL && strcmp((*pp)->clientid, clientid) != 0) {
+		pp = &(*pp)->next;
+	}
+	return pp;
+}
+
+static void
+tk_detach(tk_session *s)
+{
+	tk_session **pp;
+
+	if (s->detached) {
+		return;
+	}
+	for (pp = tk_find(s->clientid); *pp != NULL && *pp != s;
+	     pp = &(*pp)->next) {
+	}
+	if (*pp == s) {
+		*pp = s->next;
+	}
+	s->next     = NULL;
+	s->detached = true;
+	takeover_.sessions--;
+}
+
+static void
+tk_free(tk_session *s)
+{
+	nng_strfree(s->clientid);
+	nng_free(s, sizeof(*s));
+}
+
+// on the wheel thread, nobody came back in time
+static void
+tk_expire(void *arg)
+{
+	tk_session *s = arg;
+
+	nng_mtx_lock(takeover_.mtx);
+	tk_detach(s);
+	nng_id_remove(takeover_.pipes, s->pipe);
+	takeover_.expired++;
+	nng_mtx_unlock(takeover_.mtx);
+
+	log_debug("session %s not taken over, pipe %u released", s->clientid,
+	    s->pipe);
+	if (takeover_.release != NULL) {
+		takeover_.release(takeover_.release_arg, s->pipe);
+	}
+	tk_free(s);
+}
+
+uint32_t
+session_takeover_connect(uint32_t pipe, const char *clientid, bool clean_start)
+{
+	tk_session *s;
+	uint32_t    ended = 0;
+	uint32_t    taken = 0;
+
+	if (!takeover_.enabled || clientid == NULL) {
+		return 0;
+	}
+	nng_mtx_lock(takeover_.mtx);
+	if ((s = *tk_find(clientid)) != NULL && s->pipe == pipe) {
+		nng_mtx_unlock(takeover_.mtx);
+		return 0;
+	}
+	if (s != NULL && s->parked && !expiry_wheel_cancel(&s->timer)) {
+		// expiring right now, the timer releases it
+		tk_detach(s);
+		s = NULL;
+	}
+	if (s != NULL && clean_start) {
+		tk_detach(s);
+		if (s->parked) {
+			nng_id_remove(takeover_.pipes, s->pipe);
+			ended = s->pipe;
+			tk_free(s);
+		}
+		// an open one ends with the disconnect of its pipe
+		s = NULL;
+	}
+	if (s != NULL) {
+		if (s->parked) {
+			nng_id_remove(takeover_.pipes, s->pipe);
+		} else if (nng_id_set(takeover_.pipes, s->pipe, &tk_handed) !=
+		    0) {
+			nng_id_remove(takeover_.pipes, s->pipe);
+		}
+		taken     = s->pipe;
+		s->pipe   = pipe;
+		s->parked = false;
+		takeover_.takeovers++;
+	} else if ((s = nng_zalloc(sizeof(*s))) == NULL ||
+	    (s->clientid = nng_strdup(clientid)) == NULL) {
+		if (s != NULL) {
+			nng_free(s, sizeof(*s));
+		}
+		s = NULL;
+	} else {
+		tk_session **pp = tk_find(clientid);
+
+		s->pipe = pipe;
+		s->next = *pp;
+		*pp     = s;
+		takeover_.sessions++;
+	}
+	if (s != NULL && nng_id_set(takeover_.pipes, pipe, s) != 0) {
+		log_warn("session %s: pipe %u not tracked", clientid, pipe);
+	}
+	nng_mtx_unlock(takeover_.mtx);
+
+	if (ended != 0 && takeover_.release != NULL) {
+		takeover_.release(takeover_.release_arg, ended);
+	}
+	return taken;
+}
+
+takeover_verdict
+session_takeover_disconnect(uint32_t pipe, nng_time linger)
+{
+	tk_session *s;
+
+	if (!takeover_.enabled) {
+		return TAKEOVER_CLOSE;
+	}
+	nng_mtx_lock(takeover_.mtx);
+	if ((s = nng_id_get(takeover_.pipes, pipe)) == NULL) {
+		nng_mtx_unlock(takeover_.mtx);
+		return TAKEOVER_CLOSE;
+	}
+	if (s == (tk_session *) &tk_handed) {
+		nng_id_remove(takeover_.pipes, pipe);
+		nng_mtx_unlock(takeover_.mtx);
+		return TAKEOVER_HANDED;
+	}
+	// parking needs the wheel
+	if (!s->detached && linger > 0 && expiry_wheel_enabled() &&
+	    expiry_wheel_add(&s->timer, nng_clock() + linger, tk_expire, s) ==
+	        0) {
+		s->parked = true;
+		takeover_.parked++;
+		nng_mtx_unlock(takeover_.mtx);
+		return TAKEOVER_PARKED;
+	}
+	tk_detach(s);
+	nng_id_remove(takeover_.pipes, pipe);
+	nng_mtx_unlock(takeover_.mtx);
+
+	tk_free(s);
+	return TAKEOVER_CLOSE;
+}
+
+int
+session_takeover_init(takeover_release_cb cb, void *arg)
+{
+	const char *s = getenv("NANOMQ_SESSION_TAKEOVER");
+	int         rv;
+
+	if (takeover_.enabled) {
+		return 0;
+	}
+	if (s != NULL && strcmp(s, "0") == 0) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&takeover_.mtx)) != 0 ||
+	    (rv = nng_id_map_alloc(&takeover_.pipes, 0, 0, 0)) != 0) {
+		session_takeover_fini();
+		return rv;
+	}
+	takeover_.release     = cb;
+	takeover_.release_arg = arg;
+	takeover_.enabled     = true;
+	return 0;
+}
+
+void
+session_takeover_fini(void)
+{
+	tk_session *s;
+
+	// after expiry_wheel_fini, no timer of a parked session is left
+	if (takeover_.mtx != NULL) {
+		for (size_t i = 0; i < TAKEOVER_BUCKETS; i++) {
+			while ((s = takeover_.buckets[i]) != NULL) {
+				takeover_.buckets[i] = s->next;
+				tk_free(s);
+			}
+		}
+		nng_mtx_free(takeover_.mtx);
+	}
+	if (takeover_.pipes != NULL) {
+		nng_id_map_free(takeover_.pipes);
+	}
+	memset(&takeover_, 0, sizeof(takeover_));
+}
+
+bool
+session_takeover_enabled(void)
+{
+	return takeover_.enabled;
+}
+
+void
+session_takeover_stats_get(takeover_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!takeover_.enabled) {
+		return;
+	}
+	nng_mtx_lock(takeover_.mtx);
+	s->takeovers = takeover_.takeovers;
+	s->parked    = takeover_.parked;
+	s->expired   = takeover_.expired;
+	s->sessions  = takeover_.sessions;
+	nng_mtx_unlock(takeover_.mtx);
+}
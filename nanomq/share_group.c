@@ -0,0 +1,604 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/bridge.h"
+#include "include/share_group.h"
+#include "include/topic_match.h"
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/util/idhash.h"
+#include "nng/supplemental/util/platform.h"
+
+#define SHARE_PREFIX "$share/"
+#define SHARE_PREFIX_LEN 7
+#define SHARE_BUCKETS 1024
+
+typedef struct {
+	uint32_t pipe;
+	char    *clientid;
+	bool     local;
+	uint64_t dispatched;
+} share_member;
+
+typedef struct share_grp share_grp;
+struct share_grp {
+	share_grp     *next;
+	uint32_t       hash;
+	char          *topic;  // $share/<group>/<filter>
+	size_t         glen;   // of <group>
+	const char    *filter; // into topic
+	topic_pattern *pattern; // of filter, NULL if it did not compile
+	share_strategy strategy;
+	bool           own;    // strategy set for this group by name
+	uint64_t       dispatched;
+	uint64_t       stamp;  // last share_group_pick that used the group
+	uint32_t       cursor;
+	uint32_t       lcursor;
+	share_member  *members;
+	size_t         nmembers;
+	size_t         cap;
+	uint32_t      *locals; // indexes of local members
+	size_t         nlocals;
+};
+
+typedef struct {
+	share_grp **groups;
+	size_t      n;
+	size_t      cap;
+} pipe_groups;
+
+typedef struct share_override share_override;
+struct share_override {
+	share_override *next;
+	share_strategy  strategy;
+	char            group[];
+};
+
+static const char *share_names[SHARE_STRATEGIES] = {
+	[SHARE_ROUND_ROBIN]    = "round_robin",
+	[SHARE_RANDOM]         = "random",
+	[SHARE_STICKY]         = "sticky",
+	[SHARE_LEAST_INFLIGHT] = "least_inflight",
+	[SHARE_LOCAL_FIRST]    = "local_first",
+};
+
+static struct {
+	nng_mtx        *mtx;
+	share_grp     **buckets;
+	nng_id_map     *pipes; // pipe id -> pipe_groups
+	share_override *overrides;
+	share_strategy  strategy;
+	uint64_t        stamp;
+	bool            enabled;
+} share_;
+
+static uint32_t
+share_hash(const char *s, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (uint8_t) s[i]) * 16777619u;
+	}
+	return h;
+}
+
+const char *
+share_strategy_name(share_strategy s)
+{
+	return s < SHARE_STRATEGIES ? share_names[s] : "unknown";
+}
+
+int
+share_strategy_parse(const char *name, share_strategy *s)
+{
+	for (int i = 0; name != NULL && i < SHARE_STRATEGIES; i++) {
+		if (strcmp(name, share_names[i]) == 0) {
+			*s = i;
+			return 0;
+		}
+	}
+	return NNG_EINVAL;
+}
+
+int
+share_group_init(void)
+{
+	int rv;
+
+	if (share_.enabled) {
+		return 0;
+	}
+	if ((share_.buckets = nng_zalloc(
+	         sizeof(share_grp *) * SHARE_BUCKETS)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	if ((rv = nng_mtx_alloc(&share_.mtx)) != 0 ||
+	    (rv = nng_id_map_alloc(&share_.pipes, 0, 0, 0)) != 0) {
+		share_group_fini();
+		return rv;
+	}
+	share_.strategy = NANO_SHARE_STRATEGY;
+	share_.enabled  = true;
+	return 0;
+}
+
+static void
+share_grp_free(share_grp *g)
+{
+	for (size_t i = 0; i < g->nmembers; i++) {
+		nng_strfree(g->members[i].clientid);
+	}
+	if (g->cap > 0) {
+		nng_free(g->members, sizeof(share_member) * g->cap);
+		nng_free(g->locals, sizeof(uint32_t) * g->cap);
+	}
+	topic_pattern_free(g->pattern);
+	nng_strfree(g->topic);
+	nng_free(g, sizeof(*g));
+}
+
+static void
+pipe_groups_free(void *key, void *value, void *arg)
+{
+	pipe_groups *pg = value;
+
+	(void) key;
+	(void) arg;
+	nng_free(pg->groups, sizeof(share_grp *) * pg->cap);
+	nng_free(pg, sizeof(*pg));
+}
+
+void
+share_group_fini(void)
+{
+	share_override *o;
+
+	for (size_t i = 0; share_.buckets != NULL && i < SHARE_BUCKETS; i++) {
+		share_grp *g;
+		while ((g = share_.buckets[i]) != NULL) {
+			share_.buckets[i] = g->next;
+			share_grp_free(g);
+		}
+	}
+	if (share_.buckets != NULL) {
+		nng_free(share_.buckets, sizeof(share_grp *) * SHARE_BUCKETS);
+	}
+	while ((o = share_.overrides) != NULL) {
+		share_.overrides = o->next;
+		nng_free(o, sizeof(*o) + strlen(o->group) + 1);
+	}
+	if (share_.pipes != NULL) {
+		nng_id_map_foreach2(share_.pipes, pipe_groups_free, NULL);
+		nng_id_map_free(share_.pipes);
+	}
+	if (share_.mtx != NULL) {
+		nng_mtx_free(share_.mtx);
+	}
+	memset(&share_, 0, sizeof(share_));
+}
+
+bool
+share_group_enabled(void)
+{
+	return share_.enabled;
+}
+
+static share_grp **
+share_find(const char *topic, size_t len, uint32_t hash)
+{
+	share_grp **gp = &share_.buckets[hash & (SHARE_BUCKETS - 1)];
+
+	for (; *gp != NULL; gp = &(*gp)->next) {
+		if ((*gp)->hash == hash && strncmp((*gp)->topic, topic, len) == 0 &&
+		    (*gp)->topic[len] == '\0') {
+			break;
+		}
+	}
+	return gp;
+}
+
+static share_override *
+share_override_find(const char *group, size_t glen)
+{
+	for (share_override *o = share_.overrides; o != NULL; o = o->next) {
+		if (strncmp(o->group, group, glen) == 0 && o->group[glen] == '\0') {
+			return o;
+		}
+	}
+	return NULL;
+}
+
+static bool
+share_ip_local(const char *ip)
+{
+	// no address for IPC and inproc clients
+	return ip == NULL || ip[0] == '\0' || strncmp(ip, "127.", 4) == 0 ||
+	    strcmp(ip, "::1") == 0 || strcmp(ip, "localhost") == 0;
+}
+
+static void
+share_locals_rebuild(share_grp *g)
+{
+	g->nlocals = 0;
+	for (size_t i = 0; i < g->nmembers; i++) {
+		if (g->members[i].local) {
+			g->locals[g->nlocals++] = (uint32_t) i;
+		}
+	}
+}
+
+static int
+share_grp_grow(share_grp *g)
+{
+	size_t        cap = g->cap == 0 ? 4 : g->cap * 2;
+	share_member *members;
+	uint32_t     *locals;
+
+	if ((members = nng_alloc(sizeof(share_member) * cap)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	if ((locals = nng_alloc(sizeof(uint32_t) * cap)) == NULL) {
+		nng_free(members, sizeof(share_member) * cap);
+		return NNG_ENOMEM;
+	}
+	if (g->cap > 0) {
+		memcpy(members, g->members, sizeof(share_member) * g->nmembers);
+		memcpy(locals, g->locals, sizeof(uint32_t) * g->nlocals);
+		nng_free(g->members, sizeof(share_member) * g->cap);
+		nng_free(g->locals, sizeof(uint32_t) * g->cap);
+	}
+	g->members = members;
+	g->locals  = locals;
+	g->cap     = cap;
+	return 0;
+}
+
+static share_grp *
+share_grp_new(const char *topic, size_t len, uint32_t hash)
+{
+	share_grp      *g;
+	const char     *slash;
+	share_override *o;
+
+	slash = memchr(topic + SHARE_PREFIX_LEN, '/', len - SHARE_PREFIX_LEN);
+	if (slash == NULL || (g = nng_zalloc(sizeof(*g))) == NULL) {
+		return NULL;
+	}
+	if ((g->topic = nng_alloc(len + 1)) == NULL) {
+		nng_free(g, sizeof(*g));
+		return NULL;
+	}
+	memcpy(g->topic, topic, len);
+	g->topic[len] = '\0';
+	g->hash       = hash;
+	g->glen       = slash - topic - SHARE_PREFIX_LEN;
+	g->filter     = g->topic + (slash - topic) + 1;
+	if (topic_pattern_compile(g->filter, &g->pattern) != 0) {
+		g->pattern = NULL;
+	}
+	g->strategy   = share_.strategy;
+	if ((o = share_override_find(topic + SHARE_PREFIX_LEN, g->glen)) !=
+	    NULL) {
+		g->strategy = o->strategy;
+		g->own      = true;
+	}
+	return g;
+}
+
+static int
+pipe_groups_add(uint32_t pipe, share_grp *g)
+{
+	pipe_groups *pg;
+	int          rv;
+
+	if ((pg = nng_id_get(share_.pipes, pipe)) == NULL) {
+		if ((pg = nng_zalloc(sizeof(*pg))) == NULL) {
+			return NNG_ENOMEM;
+		}
+		if ((rv = nng_id_set(share_.pipes, pipe, pg)) != 0) {
+			nng_free(pg, sizeof(*pg));
+			return rv;
+		}
+	}
+	if (pg->n == pg->cap) {
+		size_t      cap = pg->cap == 0 ? 2 : pg->cap * 2;
+		share_grp **v   = nng_alloc(sizeof(share_grp *) * cap);
+		if (v == NULL) {
+			return NNG_ENOMEM;
+		}
+		if (pg->cap > 0) {
+			memcpy(v, pg->groups, sizeof(share_grp *) * pg->n);
+			nng_free(pg->groups, sizeof(share_grp *) * pg->cap);
+		}
+		pg->groups = v;
+		pg->cap    = cap;
+	}
+	pg->groups[pg->n++] = g;
+	return 0;
+}
+
+static void
+pipe_groups_del(uint32_t pipe, share_grp *g)
+{
+	pipe_groups *pg;
+
+	if ((pg = nng_id_get(share_.pipes, pipe)) == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < pg->n; i++) {
+		if (pg->groups[i] == g) {
+			pg->groups[i] = pg->groups[--pg->n];
+			break;
+		}
+	}
+	if (pg->n == 0) {
+		nng_id_remove(share_.pipes, pipe);
+		pipe_groups_free(NULL, pg, NULL);
+	}
+}
+
+void
+share_group_join(
+    const char *topic, uint32_t pipe, const char *clientid, const char *ip)
+{
+	size_t       len;
+	uint32_t     hash;
+	share_grp  **gp;
+	share_grp   *g;
+	share_member m;
+
+	if (!share_.enabled || topic == NULL ||
+	    strncmp(topic, SHARE_PREFIX, SHARE_PREFIX_LEN) != 0) {
+		return;
+	}
+	len  = strlen(topic);
+	hash = share_hash(topic, len);
+
+	nng_mtx_lock(share_.mtx);
+	if ((g = *(gp = share_find(topic, len, hash))) == NULL) {
+		if ((g = share_grp_new(topic, len, hash)) == NULL) {
+			nng_mtx_unlock(share_.mtx);
+			return;
+		}
+		*gp = g;
+	}
+	for (size_t i = 0; i < g->nmembers; i++) {
+		if (g->members[i].pipe == pipe) {
+			nng_mtx_unlock(share_.mtx);
+			return;
+		}
+	}
+	if ((g->nmembers == g->cap && share_grp_grow(g) != 0) ||
+	    pipe_groups_add(pipe, g) != 0) {
+		nng_mtx_unlock(share_.mtx);
+		return;
+	}
+	m.pipe       = pipe;
+	m.clientid   = clientid != NULL ? nng_strdup(clientid) : NULL;
+	m.local      = share_ip_local(ip);
+	m.dispatched = 0;
+	if (m.local) {
+		g->locals[g->nlocals++] = (uint32_t) g->nmembers;
+	}
+	g->members[g->nmembers++] = m;
+	nng_mtx_unlock(share_.mtx);
+}
+
+void
+share_group_leave(const char *topic, uint32_t pipe)
+{
+	size_t      len;
+	uint32_t    hash;
+	share_grp **gp;
+	share_grp  *g;
+
+	if (!share_.enabled || topic == NULL ||
+	    strncmp(topic, SHARE_PREFIX, SHARE_PREFIX_LEN) != 0) {
+		return;
+	}
+	len  = strlen(topic);
+	hash = share_hash(topic, len);
+
+	nng_mtx_lock(share_.mtx);
+	if ((g = *(gp = share_find(topic, len, hash))) == NULL) {
+		nng_mtx_unlock(share_.mtx);
+		return;
+	}
+	for (size_t i = 0; i < g->nmembers; i++) {
+		if (g->members[i].pipe != pipe) {
+			continue;
+		}
+		nng_strfree(g->members[i].clientid);
+		g->members[i] = g->members[--g->nmembers];
+		share_locals_rebuild(g);
+		pipe_groups_del(pipe, g);
+		break;
+	}
+	if (g->nmembers == 0) {
+		*gp = g->next;
+		share_grp_free(g);
+	}
+	nng_mtx_unlock(share_.mtx);
+}
+
+static share_member *
+share_choose(share_grp *g, const char *clientid)
+{
+	uint32_t a, b;
+
+	switch (g->strategy) {
+	case SHARE_RANDOM:
+		return &g->members[nng_random() % g->nmembers];
+	case SHARE_STICKY:
+		if (clientid == NULL) {
+			break;
+		}
+		return &g->members[share_hash(clientid, strlen(clientid)) %
+		    g->nmembers];
+	case SHARE_LEAST_INFLIGHT:
+		a = nng_random() % g->nmembers;
+		b = nng_random() % g->nmembers;
+		return g->members[a].dispatched <= g->members[b].dispatched
+		    ? &g->members[a]
+		    : &g->members[b];
+	case SHARE_LOCAL_FIRST:
+		if (g->nlocals > 0) {
+			return &g->members[g->locals[g->lcursor++ % g->nlocals]];
+		}
+		break;
+	default:
+		break;
+	}
+	return &g->members[g->cursor++ % g->nmembers];
+}
+
+void
+share_group_pick(const char *topic, uint32_t *pipes, const char *clientid)
+{
+	pipe_groups  *pg;
+	share_grp    *g;
+	share_member *m;
+	uint64_t      stamp;
+	topic_levels  tl;
+
+	if (!share_.enabled || pipes == NULL) {
+		return;
+	}
+	topic_split(topic, strlen(topic), &tl);
+	nng_mtx_lock(share_.mtx);
+	stamp = ++share_.stamp;
+	for (size_t i = 0; i < cvector_size(pipes); i++) {
+		if ((pg = nng_id_get(share_.pipes, pipes[i])) == NULL) {
+			continue;
+		}
+		// the group the tree picked this pipe for, each used once
+		for (size_t j = 0; j < pg->n; j++) {
+			g = pg->groups[j];
+			if (g->stamp == stamp ||
+			    !(g->pattern != NULL
+			            ? topic_pattern_match(g->pattern, topic, &tl)
+			            : topic_filter(g->filter, topic))) {
+				continue;
+			}
+			m        = share_choose(g, clientid);
+			pipes[i] = m->pipe;
+			m->dispatched++;
+			g->dispatched++;
+			g->stamp = stamp;
+			break;
+		}
+	}
+	nng_mtx_unlock(share_.mtx);
+}
+
+int
+share_group_set_strategy(const char *group, share_strategy s)
+{
+	share_override *o;
+	size_t          glen;
+
+	if (!share_.enabled) {
+		return NNG_ECLOSED;
+	}
+	if (s >= SHARE_STRATEGIES) {
+		return NNG_EINVAL;
+	}
+	nng_mtx_lock(share_.mtx);
+	if (group == NULL) {
+		share_.strategy = s;
+		for (size_t i = 0; i < SHARE_BUCKETS; i++) {
+			for (share_grp *g = share_.buckets[i]; g; g = g->next) {
+				if (!g->own) {
+					g->strategy = s;
+				}
+			}
+		}
+		nng_mtx_unlock(share_.mtx);
+		return 0;
+	}
+	glen = strlen(group);
+	if ((o = share_override_find(group, glen)) == NULL) {
+		if ((o = nng_alloc(sizeof(*o) + glen + 1)) == NULL) {
+			nng_mtx_unlock(share_.mtx);
+			return NNG_ENOMEM;
+		}
+		memcpy(o->group, group, glen + 1);
+		o->next          = share_.overrides;
+		share_.overrides = o;
+	}
+	o->strategy = s;
+	for (size_t i = 0; i < SHARE_BUCKETS; i++) {
+		for (share_grp *g = share_.buckets[i]; g; g = g->next) {
+			if (g->glen == glen &&
+			    strncmp(g->topic + SHARE_PREFIX_LEN, group, glen) ==
+			        0) {
+				g->strategy = s;
+				g->own      = true;
+			}
+		}
+	}
+	nng_mtx_unlock(share_.mtx);
+	return 0;
+}
+
+share_strategy
+share_group_default_strategy(void)
+{
+	return share_.strategy;
+}
+
+void
+share_group_foreach(void (*cb)(const share_group_info *, void *), void *arg)
+{
+	share_group_info   info;
+	share_member_info *members = NULL;
+	size_t             cap     = 0;
+
+	if (!share_.enabled) {
+		return;
+	}
+	nng_mtx_lock(share_.mtx);
+	for (size_t i = 0; i < SHARE_BUCKETS; i++) {
+		for (share_grp *g = share_.buckets[i]; g != NULL; g = g->next) {
+			if (g->nmembers > cap) {
+				if (cap > 0) {
+					nng_free(members,
+					    sizeof(share_member_info) * cap);
+				}
+				cap = g->cap;
+				if ((members = nng_alloc(sizeof(
+				         share_member_info) * cap)) == NULL) {
+					nng_mtx_unlock(share_.mtx);
+					return;
+				}
+			}
+			for (size_t k = 0; k < g->nmembers; k++) {
+				members[k].pipe       = g->members[k].pipe;
+				members[k].clientid   = g->members[k].clientid;
+				members[k].local      = g->members[k].local;
+				members[k].dispatched = g->members[k].dispatched;
+			}
+			info.group      = g->topic + SHARE_PREFIX_LEN;
+			info.group_len  = g->glen;
+			info.filter     = g->filter;
+			info.strategy   = g->strategy;
+			info.dispatched = g->dispatched;
+			info.nmembers   = g->nmembers;
+			info.members    = members;
+			cb(&info, arg);
+		}
+	}
+	nng_mtx_unlock(share_.mtx);
+	if (cap > 0) {
+		nng_free(members, sizeof(share_member_info) * cap);
+	}
+}
@@ -0,0 +1,306 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/sqlite_commit.h"
+#include "nng/mqtt/mqtt_client.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+#if defined(NNG_SUPP_SQLITE)
+#include "nng/supplemental/sqlite/sqlite3.h"
+
+typedef struct commit_op {
+	struct commit_op *next;
+	size_t            size;
+	nng_time          when;
+	nng_msg          *msg; // NULL to remove the retained msg of topic
+	uint8_t           proto_ver;
+	char              topic[];
+} commit_op;
+
+static struct {
+	nng_mtx     *mtx;
+	nng_cv      *cv;   // writer, ops queued or closing
+	nng_cv      *done; // workers, a batch committed
+	nng_thread  *thr;
+	sqlite3     *db;
+	size_t       batch;
+	nng_duration linger;
+	commit_op   *head;
+	commit_op   *tail;
+	size_t       count;
+	uint64_t     queued_seq; // ops ever queued
+	uint64_t     done_seq;   // ops ever committed
+	uint64_t     commits;
+	uint64_t     stalls;
+	size_t       batch_max;
+	bool         closing;
+	bool         enabled;
+} commit_;
+
+static void
+commit_exec(const char *sql)
+{
+	char *err = NULL;
+
+	if (sqlite3_exec(commit_.db, sql, NULL, NULL, &err) != SQLITE_OK) {
+		log_warn("sqlite commit: %s: %s", sql, err ? err : "error");
+		sqlite3_free(err);
+	}
+}
+
+static void
+commit_write(commit_op *ops)
+{
+	commit_op *op;
+	commit_op *next;
+
+	commit_exec("BEGIN");
+	for (op = ops; op != NULL; op = op->next) {
+		if (op->msg != NULL) {
+			nng_mqtt_qos_db_set_retain(
+			    commit_.db, op->topic, op->msg, op->proto_ver);
+		} else {
+			nng_mqtt_qos_db_remove_retain(commit_.db, op->topic);
+		}
+	}
+	commit_exec("COMMIT");
+
+	for (op = ops; op != NULL; op = next) {
+		next = op->next;
+		if (op->msg != NULL) {
+			nng_msg_free(op->msg);
+		}
+		nng_free(op, op->size);
+	}
+}
+
+static void
+commit_thread(void *arg)
+{
+	commit_op *ops;
+	commit_op *last;
+	size_t     n;
+
+	(void) arg;
+	nng_mtx_lock(commit_.mtx);
+	for (;;) {
+		while (!commit_.closing &&
+		    (commit_.count == 0 ||
+		        (commit_.count < commit_.batch &&
+		            nng_clock() < commit_.head->when + commit_.linger))) {
+			if (commit_.count == 0) {
+				nng_cv_wait(commit_.cv);
+			} else {
+				nng_cv_until(
+				    commit_.cv, commit_.head->when + commit_.linger);
+			}
+		}
+		if (commit_.count == 0) {
+			// closing and drained
+			break;
+		}
+		ops = last = commit_.head;
+		for (n = 1; n < commit_.batch && last->next != NULL; n++) {
+			last = last->next;
+		}
+		commit_.head = last->next;
+		last->next   = NULL;
+		if (commit_.head == NULL) {
+			commit_.tail = NULL;
+		}
+		commit_.count -= n;
+		nng_mtx_unlock(commit_.mtx);
+
+		commit_write(ops);
+
+		nng_mtx_lock(commit_.mtx);
+		commit_.done_seq += n;
+		commit_.commits++;
+		if (n > commit_.batch_max) {
+			commit_.batch_max = n;
+		}
+		nng_cv_wake(commit_.done);
+	}
+	nng_mtx_unlock(commit_.mtx);
+}
+
+static int
+commit_put(const char *topic, nng_msg *msg, uint8_t proto_ver)
+{
+	commit_op *op;
+	size_t     tlen = strlen(topic) + 1;
+	size_t     size = sizeof(*op) + tlen;
+
+	if (!commit_.enabled) {
+		return NNG_ECLOSED;
+	}
+	if ((op = nng_alloc(size)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	op->next      = NULL;
+	op->size      = size;
+	op->when      = nng_clock();
+	op->msg       = NULL;
+	op->proto_ver = proto_ver;
+	memcpy(op->topic, topic, tlen);
+	// copied, the publish is still sent on and may be rewritten
+	if (msg != NULL && nng_msg_dup(&op->msg, msg) != 0) {
+		nng_free(op, size);
+		return NNG_ENOMEM;
+	}
+
+	nng_mtx_lock(commit_.mtx);
+	if (commit_.count >= NANO_SQLITE_COMMIT_QUEUE && !commit_.closing) {
+		commit_.stalls++;
+		while (commit_.count >= NANO_SQLITE_COMMIT_QUEUE &&
+		    !commit_.closing) {
+			nng_cv_wait(commit_.done);
+		}
+	}
+	if (commit_.closing) {
+		nng_mtx_unlock(commit_.mtx);
+		if (op->msg != NULL) {
+			nng_msg_free(op->msg);
+		}
+		nng_free(op, size);
+		return NNG_ECLOSED;
+	}
+	if (commit_.tail != NULL) {
+		commit_.tail->next = op;
+	} else {
+		commit_.head = op;
+	}
+	commit_.tail = op;
+	commit_.count++;
+	commit_.queued_seq++;
+	if (commit_.count == 1 || commit_.count == commit_.batch) {
+		nng_cv_wake(commit_.cv);
+	}
+	nng_mtx_unlock(commit_.mtx);
+	return 0;
+}
+
+int
+sqlite_commit_set_retain(const char *topic, nng_msg *msg, uint8_t proto_ver)
+{
+	return commit_put(topic, msg, proto_ver);
+}
+
+int
+sqlite_commit_remove_retain(const char *topic)
+{
+	return commit_put(topic, NULL, 0);
+}
+
+void
+sqlite_commit_sync(void)
+{
+	uint64_t seq;
+
+	if (!commit_.enabled) {
+		return;
+	}
+	nng_mtx_lock(commit_.mtx);
+	seq = commit_.queued_seq;
+	if (commit_.done_seq < seq) {
+		// no reason to linger with a reader waiting
+		if (commit_.head != NULL) {
+			commit_.head->when = 0;
+			nng_cv_wake(commit_.cv);
+		}
+		while (commit_.done_seq < seq) {
+			nng_cv_wait(commit_.done);
+		}
+	}
+	nng_mtx_unlock(commit_.mtx);
+}
+
+int
+sqlite_commit_init(void *db, size_t batch, nng_duration linger)
+{
+	int rv;
+
+	if (commit_.enabled) {
+		return 0;
+	}
+	if (db == NULL || batch == 0 || linger < 0) {
+		return NNG_EINVAL;
+	}
+	if ((rv = nng_mtx_alloc(&commit_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&commit_.cv, commit_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&commit_.done, commit_.mtx)) != 0) {
+		sqlite_commit_fini();
+		return rv;
+	}
+	commit_.db     = db;
+	commit_.batch  = batch;
+	commit_.linger = linger;
+	// readers no longer wait on the writer, nor it on them
+	commit_exec("PRAGMA journal_mode=WAL");
+	if ((rv = nng_thread_create(&commit_.thr, commit_thread, NULL)) != 0) {
+		commit_.thr = NULL;
+		sqlite_commit_fini();
+		return rv;
+	}
+	commit_.enabled = true;
+	return 0;
+}
+
+void
+sqlite_commit_fini(void)
+{
+	if (commit_.thr != NULL) {
+		nng_mtx_lock(commit_.mtx);
+		commit_.closing = true;
+		nng_cv_wake(commit_.cv);
+		nng_cv_wake(commit_.done);
+		nng_mtx_unlock(commit_.mtx);
+		nng_thread_destroy(commit_.thr);
+		log_info("sqlite commit: %llu ops in %llu commits",
+		    (unsigned long long) commit_.done_seq,
+		    (unsigned long long) commit_.commits);
+	}
+	if (commit_.done != NULL) {
+		nng_cv_free(commit_.done);
+	}
+	if (commit_.cv != NULL) {
+		nng_cv_free(commit_.cv);
+	}
+	if (commit_.mtx != NULL) {
+		nng_mtx_free(commit_.mtx);
+	}
+	memset(&commit_, 0, sizeof(commit_));
+}
+
+bool
+sqlite_commit_enabled(void)
+{
+	return commit_.enabled;
+}
+
+void
+sqlite_commit_stats_get(sqlite_commit_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!commit_.enabled) {
+		return;
+	}
+	nng_mtx_lock(commit_.mtx);
+	s->ops       = commit_.done_seq;
+	s->commits   = commit_.commits;
+	s->stalls    = commit_.stalls;
+	s->batch_max = commit_.batch_max;
+	s->queued    = commit_.count;
+	nng_mtx_unlock(commit_.mtx);
+}
+
+#endif
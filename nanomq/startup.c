@@ -0,0 +1,211 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/startup.h"
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef struct {
+	nng_atomic_int *state;
+	nng_time        begin;
+	nng_time        ready;
+	int             rv;
+	nng_thread     *thr;
+	startup_fn      fn;
+	void           *arg;
+} startup_sub;
+
+static struct {
+	nng_mtx    *mtx;
+	nng_time    boot;
+	startup_sub subs[STARTUP_SUBSYSTEMS];
+} startup_;
+
+static const char *startup_names[STARTUP_SUBSYSTEMS] = {
+	[STARTUP_LISTENER] = "listener",
+	[STARTUP_RULES]    = "rule_engine",
+	[STARTUP_BRIDGE]   = "bridge",
+	[STARTUP_WEBHOOK]  = "webhook",
+};
+
+const char *
+startup_name(startup_subsystem s)
+{
+	return s < STARTUP_SUBSYSTEMS ? startup_names[s] : "unknown";
+}
+
+int
+startup_init(void)
+{
+	int rv;
+
+	if (startup_.mtx != NULL) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&startup_.mtx)) != 0) {
+		return rv;
+	}
+	for (int i = 0; i < STARTUP_SUBSYSTEMS; i++) {
+		if ((rv = nng_atomic_alloc(&startup_.subs[i].state)) != 0) {
+			startup_fini();
+			return rv;
+		}
+	}
+	startup_.boot = nng_clock();
+	return 0;
+}
+
+void
+startup_fini(void)
+{
+	for (int i = 0; i < STARTUP_SUBSYSTEMS; i++) {
+		startup_sub *sub = &startup_.subs[i];
+
+		if (sub->thr != NULL) {
+			nng_thread_destroy(sub->thr);
+		}
+		if (sub->state != NULL) {
+			nng_atomic_free(sub->state);
+		}
+	}
+	if (startup_.mtx != NULL) {
+		nng_mtx_free(startup_.mtx);
+	}
+	memset(&startup_, 0, sizeof(startup_));
+}
+
+bool
+startup_enabled(void)
+{
+	return startup_.mtx != NULL;
+}
+
+void
+startup_begin(startup_subsystem s)
+{
+	if (startup_.mtx == NULL || s >= STARTUP_SUBSYSTEMS) {
+		return;
+	}
+	nng_mtx_lock(startup_.mtx);
+	startup_.subs[s].begin = nng_clock();
+	startup_.subs[s].ready = 0;
+	startup_.subs[s].rv    = 0;
+	nng_atomic_set(startup_.subs[s].state, STARTUP_PENDING);
+	nng_mtx_unlock(startup_.mtx);
+}
+
+void
+startup_done(startup_subsystem s, int rv)
+{
+	startup_sub *sub;
+	nng_time     now;
+
+	if (startup_.mtx == NULL || s >= STARTUP_SUBSYSTEMS) {
+		return;
+	}
+	sub = &startup_.subs[s];
+	now = nng_clock();
+	nng_mtx_lock(startup_.mtx);
+	if (sub->begin == 0) {
+		sub->begin = now;
+	}
+	// state last, a reader seeing READY finds the times set
+	sub->ready = now;
+	sub->rv    = rv;
+	nng_atomic_set(sub->state, rv == 0 ? STARTUP_READY : STARTUP_FAILED);
+	nng_mtx_unlock(startup_.mtx);
+
+	if (rv != 0) {
+		log_warn("%s failed to start after %llu ms: %d",
+		    startup_names[s], (unsigned long long) (now - sub->begin),
+		    rv);
+	} else {
+		log_info("%s ready in %llu ms (%llu ms after start)",
+		    startup_names[s], (unsigned long long) (now - sub->begin),
+		    (unsigned long long) (now - startup_.boot));
+	}
+}
+
+static void
+startup_thread(void *arg)
+{
+	startup_sub *sub = arg;
+
+	startup_done((startup_subsystem) (sub - startup_.subs),
+	    sub->fn(sub->arg));
+}
+
+int
+startup_run(startup_subsystem s, startup_fn fn, void *arg)
+{
+	startup_sub *sub;
+	int          rv;
+
+	if (s >= STARTUP_SUBSYSTEMS) {
+		return NNG_EINVAL;
+	}
+	if (startup_.mtx == NULL) {
+		return fn(arg);
+	}
+	sub = &startup_.subs[s];
+	if (sub->thr != NULL) {
+		return NNG_EBUSY;
+	}
+	startup_begin(s);
+	sub->fn  = fn;
+	sub->arg = arg;
+	if ((rv = nng_thread_create(&sub->thr, startup_thread, sub)) != 0) {
+		// no thread, bring it up in place
+		sub->thr = NULL;
+		startup_done(s, fn(arg));
+	}
+	return 0;
+}
+
+bool
+startup_ready(startup_subsystem s)
+{
+	int state;
+
+	if (startup_.mtx == NULL || s >= STARTUP_SUBSYSTEMS) {
+		return true;
+	}
+	state = nng_atomic_get(startup_.subs[s].state);
+	return state == STARTUP_READY || state == STARTUP_OFF;
+}
+
+void
+startup_stats_get(startup_stat st[STARTUP_SUBSYSTEMS])
+{
+	memset(st, 0, sizeof(startup_stat) * STARTUP_SUBSYSTEMS);
+	for (int i = 0; i < STARTUP_SUBSYSTEMS; i++) {
+		st[i].name = startup_names[i];
+	}
+	if (startup_.mtx == NULL) {
+		return;
+	}
+	nng_mtx_lock(startup_.mtx);
+	for (int i = 0; i < STARTUP_SUBSYSTEMS; i++) {
+		startup_sub *sub = &startup_.subs[i];
+
+		st[i].state = nng_atomic_get(sub->state);
+		st[i].rv    = sub->rv;
+		if (st[i].state == STARTUP_OFF) {
+			continue;
+		}
+		st[i].begin_ms = sub->begin - startup_.boot;
+		if (sub->ready != 0) {
+			st[i].ready_ms = sub->ready - startup_.boot;
+		}
+	}
+	nng_mtx_unlock(startup_.mtx);
+}
@@ -5,6 +5,9 @@
 // file was obtained (LICENSE.txt).  A copy of the license may also be
 // found online at https://opensource.org/licenses/MIT.
 //
+#include <stdlib.h>
+#include <string.h>
+
 #include "nng/nng.h"
 #include "nng/mqtt/packet.h"
 #include "nng/protocol/mqtt/mqtt_parser.h"
@@ -13,11 +16,20 @@
 #include "nng/supplemental/nanolib/log.h"
 #include "nng/supplemental/nanolib/conf.h"
 
+#include "include/bridge.h"
 #include "include/broker.h"
 #include "include/nanomq.h"
 #include "include/pub_handler.h"
 #include "include/sub_handler.h"
+#include "include/sub_stats.h"
+#include "include/sub_reap.h"
+#include "include/sub_queue.h"
+#include "include/share_group.h"
 #include "include/acl_handler.h"
+#include "include/auth_http_cache.h"
+#include "include/retain_index.h"
+#include "include/sqlite_commit.h"
+#include "include/work_arena.h"
 
 /**
  * @brief decode msg in work->payload to create topic_nodes.
@@ -258,14 +270,215 @@ encode_suback_msg(nng_msg *msg, nano_work *work)
 	return 0;
 }
 
+/*
+ * An allow of several filters holds for each of them. A deny is only known
+ * to be about the one filter sent, the others stay unknown.
+ */
+static void
+auth_http_sub_cache(
+    nano_work *work, const char *cid, const char *user, bool allow)
+{
+	topic_node *tn = work->sub_pkt->node;
+
+	if (!allow && tn != NULL && tn->next != NULL) {
+		return;
+	}
+	for (; tn != NULL; tn = tn->next) {
+		auth_http_cache_put(
+		    cid, user, true, tn->topic.body, tn->topic.len, allow);
+	}
+}
+
+typedef struct {
+	topic_node *tn;
+	uint32_t    order; // in the packet, equal filters keep it
+	bool        exist; // subscribed before this filter
+} sub_batch_item;
+
+static int
+sub_batch_cmp(const void *a, const void *b)
+{
+	const sub_batch_item *x  = a;
+	const sub_batch_item *y  = b;
+	int                   rv = strcmp(x->tn->topic.body, y->tn->topic.body);
+
+	if (rv != 0) {
+		return rv;
+	}
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+// The filters of tn the client may subscribe to, NULL for none. heap is
+// what to nng_free() after, 0 when they came from the arena of work.
+static sub_batch_item *
+sub_batch_collect(nano_work *work, size_t *count, size_t *heap)
+{
+	sub_batch_item *items;
+	topic_node     *tn;
+	size_t          n = 0;
+	size_t          size;
+
+	for (tn = work->sub_pkt->node; tn != NULL; tn = tn->next) {
+		n++;
+	}
+	size  = n * sizeof(sub_batch_item);
+	*heap = 0;
+	if (n == 0) {
+		*count = 0;
+		return NULL;
+	}
+	if ((items = work_arena_get(work->arena, size)) == NULL) {
+		if ((items = nng_alloc(size)) == NULL) {
+			*count = 0;
+			return NULL;
+		}
+		*heap = size;
+	}
+	n = 0;
+	for (tn = work->sub_pkt->node; tn != NULL; tn = tn->next) {
+		log_debug("topicLen: [%d] body: [%s]", tn->topic.len,
+		    tn->topic.body);
+		if (tn->topic.body == NULL) {
+			continue;
+		}
+#ifdef ACL_SUPP
+		/* Add items which not included in dbhash */
+		if (work->config->acl.enable &&
+		    !auth_acl_pipe(work->config, ACL_SUB, work->pid.id,
+		        work->cparam, tn->topic.body, NULL)) {
+			log_warn("acl deny");
+			tn->reason_code = NMQ_AUTH_SUB_ERROR;
+			if (work->config->acl_deny_action == ACL_DISCONNECT) {
+				log_warn("acl deny, disconnect client");
+				// TODO disconnect client or return error code
+				continue;
+			} else if (work->config->acl_deny_action ==
+			    ACL_IGNORE) {
+				log_warn("acl deny, ignore");
+				continue;
+			}
+		} else if (work->config->acl.enable) {
+			log_info("acl allow");
+		}
+#endif
+		items[n].tn    = tn;
+		items[n].order = (uint32_t) n;
+		items[n].exist = false;
+		n++;
+	}
+	*count = n;
+	return items;
+}
+
+// Retained messages of one filter into work->msg_ret.
+static void
+sub_batch_retain(nano_work *work, nng_msg **retain)
+{
+	if (retain == NULL) {
+		return;
+	}
+	if (work->msg_ret == NULL) {
+		work->msg_ret = retain;
+		return;
+	}
+	for (size_t i = 0; i < cvector_size(retain); i++) {
+		if (retain[i] != NULL) {
+			cvector_push_back(work->msg_ret, retain[i]);
+		}
+	}
+	cvector_free(retain);
+}
+
+/*
+ * All filters of one SUBSCRIBE in three passes: ACL, then the inserts in
+ * filter order so consecutive ones walk the shared prefix of the tree
+ * while it is still in cache, then the retained messages of all of them.
+ * The match cache is invalidated and SQLite synced once per packet rather
+ * than once per filter.
+ */
+static void
+sub_batch_handle(nano_work *work)
+{
+	sub_batch_item *items;
+	size_t          n;
+	size_t          heap;
+	bool            inserted = false;
+#if defined(NNG_SUPP_SQLITE)
+	bool synced = false;
+#endif
+
+	if ((items = sub_batch_collect(work, &n, &heap)) == NULL) {
+		return;
+	}
+	if (n > 1) {
+		qsort(items, n, sizeof(*items), sub_batch_cmp);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		topic_node *tn    = items[i].tn;
+		char       *topic = tn->topic.body;
+
+		items[i].exist = dbhash_check_topic(work->pid.id, topic);
+		if (items[i].exist) {
+			// qos, retain handling, no local of an existing
+			// subscription are updated by the protocol layer
+			continue;
+		}
+		dbtree_insert_client(work->db, topic, work->pid.id);
+		sub_stats_subscribe(topic);
+		share_group_join(topic, work->pid.id,
+		    conn_param_get_clientid(work->cparam),
+		    (const char *) conn_param_get_ip_addr_v4(work->cparam));
+		dbhash_insert_topic(work->pid.id, topic, tn->qos);
+		inserted = true;
+	}
+	if (inserted) {
+		match_cache_invalidate();
+	}
+	sub_ctx_regrant(work->pid.id);
+
+	for (size_t i = 0; i < n; i++) {
+		uint8_t        rh = items[i].tn->retain_handling;
+		retain_cursor *cursor;
+
+		if (rh != 0 && (rh != 1 || items[i].exist)) {
+			continue;
+		}
+#if defined(NNG_SUPP_SQLITE)
+		if (work->config->sqlite.enable && work->sqlite_db != NULL) {
+			nng_msg **msg_vec;
+
+			// retained updates still queued are seen as well
+			if (!synced) {
+				sqlite_commit_sync();
+				synced = true;
+			}
+			msg_vec = nng_mqtt_qos_db_find_retain(
+			    work->sqlite_db, items[i].tn->topic.body);
+			sub_batch_retain(work, msg_vec);
+			continue;
+		}
+#endif
+		// a wildcard is streamed from the index after SUBACK
+		if ((cursor = retain_index_open(items[i].tn->topic.body)) !=
+		    NULL) {
+			cvector_push_back(work->ret_cursors, cursor);
+			continue;
+		}
+		sub_batch_retain(work,
+		    dbtree_find_retain(work->db_ret, items[i].tn->topic.body));
+	}
+
+	if (heap != 0) {
+		nng_free(items, heap);
+	}
+}
+
 // generate ctx for each topic
 // this should be moved to RECV
 int
 sub_ctx_handle(nano_work *work)
 {
-	int topic_len = 0;
-	int topic_exist = 0;
-	char *topic_str = NULL;
 	bool auth_http_reject = false;
 	topic_node *tn = NULL;
 
@@ -280,12 +493,36 @@ sub_ctx_handle(nano_work *work)
 	tn = work->sub_pkt->node;
 	if (work->config->auth_http.enable) {
 		topic_queue *tq = NULL;
+		const char  *cid =
+		    (const char *) conn_param_get_clientid(work->cparam);
+		const char *user =
+		    (const char *) conn_param_get_username(work->cparam);
+		// ask auth_http only if some filter has no cached decision
+		int cached = AUTH_HTTP_ALLOW;
+		for (tn = work->sub_pkt->node; tn != NULL; tn = tn->next) {
+			int c = auth_http_cache_get(
+			    cid, user, true, tn->topic.body, tn->topic.len);
+			if (c == AUTH_HTTP_DENY) {
+				cached = AUTH_HTTP_DENY;
+				break;
+			} else if (c == AUTH_HTTP_MISS) {
+				cached = AUTH_HTTP_MISS;
+			}
+		}
 		tn = work->sub_pkt->node;
-		tq = init_topic_queue_with_topic_node(tn);
-		if (tq == NULL) {
+		if (cached == AUTH_HTTP_MISS) {
+			tq = init_topic_queue_with_topic_node(tn);
+		}
+		if (cached == AUTH_HTTP_MISS && tq == NULL) {
 			log_error("topic_queue is NULL");
-		} else {
-			int rv = nmq_auth_http_sub_pub(work->cparam, true, tq, &work->config->auth_http);
+		} else if (cached != AUTH_HTTP_ALLOW) {
+			int rv = cached == AUTH_HTTP_DENY
+			    ? NMQ_AUTH_SUB_ERROR
+			    : nmq_auth_http_sub_pub(work->cparam, true, tq,
+			          &work->config->auth_http);
+			if (cached == AUTH_HTTP_MISS) {
+				auth_http_sub_cache(work, cid, user, rv == 0);
+			}
 			if (rv != 0) {
 				log_error("Auth failed! subscribe packet!");
 				/*
@@ -304,102 +541,17 @@ sub_ctx_handle(nano_work *work)
 			} else {
 				log_info("Auth success! subscribe packet!");
 			}
-			topic_queue_release(tq);
+			if (tq != NULL) {
+				topic_queue_release(tq);
+			}
 		}
 	}
 
 #ifdef STATISTICS
 	// TODO
 #endif
-	nng_msg **retain = work->msg_ret;
-	tn = work->sub_pkt->node;
-	while (tn != NULL && auth_http_reject == false) {
-		topic_len = tn->topic.len;
-		topic_str = tn->topic.body;
-		log_debug("topicLen: [%d] body: [%s]", topic_len, topic_str);
-
-		if (!topic_str)
-			goto next;
-#ifdef ACL_SUPP
-		/* Add items which not included in dbhash */
-		if (work->config->acl.enable) {
-			bool auth_result = auth_acl(
-			    work->config, ACL_SUB, work->cparam, topic_str);
-			if (!auth_result) {
-				log_warn("acl deny");
-				tn->reason_code = NMQ_AUTH_SUB_ERROR;
-				if (work->config->acl_deny_action ==
-				    ACL_DISCONNECT) {
-					log_warn("acl deny, disconnect client");
-					// TODO disconnect client or return error code
-					goto next;
-				} else if (work->config->acl_deny_action ==
-				    ACL_IGNORE) {
-					log_warn("acl deny, ignore");
-					goto next;
-				}
-			} else {
-				log_info("acl allow");
-			}
-		}
-#endif
-
-		topic_exist = dbhash_check_topic(work->pid.id, topic_str);
-		if (!topic_exist) {
-			dbtree_insert_client(
-			    work->db, topic_str, work->pid.id);
-
-			dbhash_insert_topic(work->pid.id, topic_str, tn->qos);
-		}
-
-		// Note.
-		// if topic already exists then update sub options.
-		// qos, retain handling, no local (already did in protocol
-		// layer)
-
-		// Retain msg
-		uint8_t rh = tn->retain_handling;
-
-#if defined(NNG_SUPP_SQLITE)
-		if (work->config->sqlite.enable && work->sqlite_db != NULL) {
-			if (rh == 0 || (rh == 1 && !topic_exist)) {
-				nng_msg **msg_vec = nng_mqtt_qos_db_find_retain(work->sqlite_db, topic_str);
-				if (msg_vec != NULL) {
-					for (size_t i = 0; i < cvector_size(msg_vec); i++) {
-						if (msg_vec[i] != NULL) {
-							cvector_push_back(work->msg_ret, msg_vec[i]);
-						}
-					}
-					cvector_free(msg_vec);
-				}
-			}
-			goto next;
-		}
-#endif
-		if (rh == 0 || (rh == 1 && !topic_exist)) {
-			retain = dbtree_find_retain(work->db_ret, topic_str);
-		}
-		work->msg_ret = (work->msg_ret == NULL) ? retain : work->msg_ret;
-		for (size_t i = 0; retain != NULL &&
-				i < cvector_size(retain) &&
-				work->msg_ret != retain;
-				i++) {
-			if (!retain[i]) {
-				continue;
-			}
-			cvector_push_back(work->msg_ret, retain[i]);
-		}
-		if (retain != work->msg_ret) {
-			cvector_free(retain);
-			retain = NULL;
-		}
-		
-		if (!work->msg_ret) {
-			goto next;
-		}
-
-	next:
-		tn = tn->next;
+	if (auth_http_reject == false) {
+		sub_batch_handle(work);
 	}
 
 #ifdef DEBUG
@@ -412,19 +564,114 @@ sub_ctx_handle(nano_work *work)
 int
 sub_ctx_del(void *db, char *topic, uint32_t pid)
 {
+	if (dbhash_check_topic(pid, topic)) {
+		sub_stats_unsubscribe(topic);
+		share_group_leave(topic, pid);
+	}
 	dbtree_delete_client((dbtree *)db, topic, pid);
+	match_cache_invalidate();
 
 	dbhash_del_topic(pid, topic);
+	sub_ctx_regrant(pid);
 
 	return 0;
 }
 
+size_t
+sub_ctx_move(void *db, uint32_t from, uint32_t to, conn_param *cparam)
+{
+	topic_queue *tq;
+	topic_queue *tn;
+	size_t       n = 0;
+
+	for (tq = dbhash_copy_topic_queue(from); tq != NULL; tq = tn) {
+		tn = tq->next;
+		if (dbhash_check_topic(to, tq->topic)) {
+			// subscribed again already, one of them goes
+			sub_stats_unsubscribe(tq->topic);
+		} else {
+			dbtree_insert_client((dbtree *) db, tq->topic, to);
+			share_group_join(tq->topic, to,
+			    conn_param_get_clientid(cparam),
+			    (const char *) conn_param_get_ip_addr_v4(cparam));
+			dbhash_insert_topic(to, tq->topic, tq->qos);
+		}
+		share_group_leave(tq->topic, from);
+		dbtree_delete_client((dbtree *) db, tq->topic, from);
+		dbhash_del_topic(from, tq->topic);
+		nng_free(tq->topic, strlen(tq->topic));
+		nng_free(tq, sizeof(topic_queue));
+		n++;
+	}
+	if (n > 0) {
+		match_cache_invalidate();
+	}
+	return n;
+}
+
+void
+sub_ctx_regrant(uint32_t pid)
+{
+	topic_queue *tq;
+	topic_queue *tn;
+	uint8_t      qos = 0;
+
+	if (!sub_queue_enabled()) {
+		return;
+	}
+	for (tq = dbhash_copy_topic_queue(pid); tq != NULL; tq = tn) {
+		tn = tq->next;
+		if (tq->qos > qos) {
+			qos = tq->qos;
+		}
+		nng_free(tq->topic, strlen(tq->topic));
+		nng_free(tq, sizeof(topic_queue));
+	}
+	sub_queue_granted(pid, qos);
+}
+
+uint8_t
+sub_ctx_qos(uint32_t pid, const char *topic, uint8_t qos)
+{
+	topic_queue *tq;
+	topic_queue *tn;
+	const char  *filter;
+	uint8_t      granted = 0;
+
+	if (qos == 0) {
+		return 0;
+	}
+	for (tq = dbhash_copy_topic_queue(pid); tq != NULL; tq = tn) {
+		tn     = tq->next;
+		filter = tq->topic;
+		// a shared one is matched without $share/<group>/
+		if (strncmp(filter, "$share/", 7) == 0 &&
+		    (filter = strchr(filter + 7, '/')) != NULL) {
+			filter++;
+		}
+		if (filter != NULL && tq->qos > granted &&
+		    topic_filter(filter, topic)) {
+			granted = tq->qos;
+		}
+		nng_free(tq->topic, strlen(tq->topic));
+		nng_free(tq, sizeof(topic_queue));
+	}
+	return qos < granted ? qos : granted;
+}
+
 static void *
 destroy_sub_client_cb(void *args, char *topic)
 {
 	sub_destroy_info *des = (sub_destroy_info *) args;
 
-	dbtree_delete_client(des->db, topic, des->pid);
+	// a shared one goes at once, the group would pick the dead member
+	if (strncmp(topic, "$share/", 7) == 0 ||
+	    sub_reap_put(des->pid, topic) != 0) {
+		dbtree_delete_client(des->db, topic, des->pid);
+		des->deleted = true;
+	}
+	sub_stats_unsubscribe(topic);
+	share_group_leave(topic, des->pid);
 
 	return NULL;
 }
@@ -438,9 +685,14 @@ destroy_sub_client(uint32_t pid, dbtree * db)
 	sub_destroy_info sdi = {
 		.pid = pid,
 		.db = db,
+		.deleted = false,
 	};
 
 	dbhash_del_topic_queue(pid, &destroy_sub_client_cb, (void *) &sdi);
+	// the reaper invalidates for what it removes
+	if (sdi.deleted) {
+		match_cache_invalidate();
+	}
 
 	return;
 }
@@ -0,0 +1,420 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/sub_queue.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/idhash.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef struct {
+	nng_mtx    *mtx;
+	nng_id_map *map; // pipe id -> sub_queue_state
+} sub_queue_shard;
+
+typedef struct {
+	uint32_t        pipe;
+	sub_queue_state st;
+} sub_queue_change;
+
+static struct {
+	sub_queue_shard    shards[NANO_SUB_QUEUE_SHARDS];
+	sub_queue_conf     conf;
+	sub_queue_slow_cb  slow_cb;
+	void              *arg;
+	nng_atomic_int    *slow; // pipes slow right now, 0 skips all lookups
+	nng_atomic_u64    *events;
+	nng_atomic_u64    *dropped[SUB_QUEUE_POLICIES];
+	nng_mtx           *mtx;
+	nng_cv            *cv;
+	nng_thread        *thr;
+	bool               closing;
+	bool               enabled;
+} subq_;
+
+static const char *subq_policy_names[SUB_QUEUE_POLICIES] = {
+	[SUB_QUEUE_DROP_NEWEST] = "drop_newest",
+	[SUB_QUEUE_DISCONNECT]  = "disconnect",
+};
+
+const char *
+sub_queue_policy_name(sub_queue_policy p)
+{
+	return p < SUB_QUEUE_POLICIES ? subq_policy_names[p] : NULL;
+}
+
+static inline sub_queue_shard *
+subq_shard_of(uint32_t pipe)
+{
+	return &subq_.shards[pipe % NANO_SUB_QUEUE_SHARDS];
+}
+
+static void
+subq_thread_main(void *arg)
+{
+	(void) arg;
+	nng_mtx_lock(subq_.mtx);
+	while (!subq_.closing) {
+		nng_time until = nng_clock() + NANO_SUB_QUEUE_SAMPLE_MS;
+
+		while (!subq_.closing && nng_clock() < until) {
+			nng_cv_until(subq_.cv, until);
+		}
+		if (subq_.closing) {
+			continue;
+		}
+		nng_mtx_unlock(subq_.mtx);
+		sub_queue_sample();
+		nng_mtx_lock(subq_.mtx);
+	}
+	nng_mtx_unlock(subq_.mtx);
+}
+
+static void
+subq_free(void *key, void *value, void *arg)
+{
+	(void) key;
+	(void) arg;
+	nng_free(value, sizeof(sub_queue_state));
+}
+
+int
+sub_queue_init(const sub_queue_conf *c, sub_queue_slow_cb slow, void *arg)
+{
+	int rv;
+
+	if (subq_.enabled || c->msgs == 0) {
+		return 0;
+	}
+	for (int q = 0; q < 3; q++) {
+		if (c->policy[q] >= SUB_QUEUE_POLICIES) {
+			return NNG_EINVAL;
+		}
+	}
+	subq_.conf    = *c;
+	subq_.slow_cb = slow;
+	subq_.arg     = arg;
+	for (size_t i = 0; i < NANO_SUB_QUEUE_SHARDS; i++) {
+		if ((rv = nng_mtx_alloc(&subq_.shards[i].mtx)) != 0 ||
+		    (rv = nng_id_map_alloc(&subq_.shards[i].map, 0, 0, 0)) !=
+		        0) {
+			sub_queue_fini();
+			return rv;
+		}
+	}
+	for (int p = 0; p < SUB_QUEUE_POLICIES; p++) {
+		if ((rv = nng_atomic_alloc64(&subq_.dropped[p])) != 0) {
+			sub_queue_fini();
+			return rv;
+		}
+	}
+	if ((rv = nng_atomic_alloc(&subq_.slow)) != 0 ||
+	    (rv = nng_atomic_alloc64(&subq_.events)) != 0 ||
+	    (rv = nng_mtx_alloc(&subq_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&subq_.cv, subq_.mtx)) != 0) {
+		sub_queue_fini();
+		return rv;
+	}
+	if ((rv = nng_thread_create(&subq_.thr, subq_thread_main, NULL)) !=
+	    0) {
+		subq_.thr = NULL;
+		sub_queue_fini();
+		return rv;
+	}
+	subq_.enabled = true;
+	return 0;
+}
+
+void
+sub_queue_fini(void)
+{
+	if (subq_.thr != NULL) {
+		nng_mtx_lock(subq_.mtx);
+		subq_.closing = true;
+		nng_cv_wake(subq_.cv);
+		nng_mtx_unlock(subq_.mtx);
+		nng_thread_destroy(subq_.thr);
+	}
+	for (size_t i = 0; i < NANO_SUB_QUEUE_SHARDS; i++) {
+		if (subq_.shards[i].map != NULL) {
+			nng_id_map_foreach2(subq_.shards[i].map, subq_free, NULL);
+			nng_id_map_free(subq_.shards[i].map);
+		}
+		if (subq_.shards[i].mtx != NULL) {
+			nng_mtx_free(subq_.shards[i].mtx);
+		}
+	}
+	for (int p = 0; p < SUB_QUEUE_POLICIES; p++) {
+		if (subq_.dropped[p] != NULL) {
+			nng_atomic_free64(subq_.dropped[p]);
+		}
+	}
+	if (subq_.slow != NULL) {
+		nng_atomic_free(subq_.slow);
+	}
+	if (subq_.events != NULL) {
+		nng_atomic_free64(subq_.events);
+	}
+	if (subq_.cv != NULL) {
+		nng_cv_free(subq_.cv);
+	}
+	if (subq_.mtx != NULL) {
+		nng_mtx_free(subq_.mtx);
+	}
+	memset(&subq_, 0, sizeof(subq_));
+}
+
+bool
+sub_queue_enabled(void)
+{
+	return subq_.enabled;
+}
+
+static void
+subq_env(const char *name, uint64_t *v)
+{
+	const char *s = getenv(name);
+	char       *end;
+	long long   n;
+
+	if (s == NULL || *s == '\0') {
+		return;
+	}
+	n = strtoll(s, &end, 10);
+	if (*end == '\0' && n >= 0) {
+		*v = (uint64_t) n;
+	}
+}
+
+void
+sub_queue_conf_env(sub_queue_conf *c)
+{
+	static const char *policy_envs[3] = { "NANOMQ_SUB_QUEUE_POLICY_QOS0",
+		"NANOMQ_SUB_QUEUE_POLICY_QOS1", "NANOMQ_SUB_QUEUE_POLICY_QOS2" };
+
+	subq_env("NANOMQ_SUB_QUEUE_MSGS", &c->msgs);
+	for (int q = 0; q < 3; q++) {
+		const char *s = getenv(policy_envs[q]);
+		for (int p = 0; s != NULL && p < SUB_QUEUE_POLICIES; p++) {
+			if (strcmp(s, subq_policy_names[p]) == 0) {
+				c->policy[q] = p;
+			}
+		}
+	}
+}
+
+void
+sub_queue_open(uint32_t pipe)
+{
+	sub_queue_shard *sh = subq_shard_of(pipe);
+	sub_queue_state *st;
+
+	if (!subq_.enabled || (st = nng_zalloc(sizeof(*st))) == NULL) {
+		return;
+	}
+	nng_mtx_lock(sh->mtx);
+	if (nng_id_get(sh->map, pipe) != NULL ||
+	    nng_id_set(sh->map, pipe, st) != 0) {
+		nng_free(st, sizeof(*st));
+	}
+	nng_mtx_unlock(sh->mtx);
+}
+
+void
+sub_queue_close(uint32_t pipe)
+{
+	sub_queue_shard *sh = subq_shard_of(pipe);
+	sub_queue_state *st;
+
+	if (!subq_.enabled) {
+		return;
+	}
+	nng_mtx_lock(sh->mtx);
+	if ((st = nng_id_get(sh->map, pipe)) != NULL) {
+		nng_id_remove(sh->map, pipe);
+		if (st->slow) {
+			nng_atomic_dec_nv(subq_.slow);
+		}
+		nng_free(st, sizeof(*st));
+	}
+	nng_mtx_unlock(sh->mtx);
+}
+
+sub_queue_verdict
+sub_queue_check(uint32_t pipe, uint8_t qos)
+{
+	sub_queue_shard  *sh = subq_shard_of(pipe);
+	sub_queue_state  *st;
+	sub_queue_policy  policy;
+	sub_queue_verdict v = SUB_QUEUE_SEND;
+
+	if (!subq_.enabled || nng_atomic_get(subq_.slow) == 0) {
+		return SUB_QUEUE_SEND;
+	}
+	policy = subq_.conf.policy[qos < 3 ? qos : 2];
+	nng_mtx_lock(sh->mtx);
+	if ((st = nng_id_get(sh->map, pipe)) != NULL && st->slow) {
+		// either way this message is not sent to pipe
+		v = policy == SUB_QUEUE_DISCONNECT ? SUB_QUEUE_CLOSE
+		                                   : SUB_QUEUE_SKIP;
+		st->dropped++;
+	}
+	nng_mtx_unlock(sh->mtx);
+	if (v != SUB_QUEUE_SEND) {
+		nng_atomic_inc64(subq_.dropped[policy]);
+	}
+	return v;
+}
+
+void
+sub_queue_sent(uint32_t pipe, uint8_t qos)
+{
+	sub_queue_shard *sh = subq_shard_of(pipe);
+	sub_queue_state *st;
+
+	if (!subq_.enabled || qos == 0) {
+		return;
+	}
+	nng_mtx_lock(sh->mtx);
+	if ((st = nng_id_get(sh->map, pipe)) != NULL && st->granted > 0) {
+		st->msgs++;
+	}
+	nng_mtx_unlock(sh->mtx);
+}
+
+void
+sub_queue_granted(uint32_t pipe, uint8_t qos)
+{
+	sub_queue_shard *sh = subq_shard_of(pipe);
+	sub_queue_state *st;
+
+	if (!subq_.enabled) {
+		return;
+	}
+	nng_mtx_lock(sh->mtx);
+	if ((st = nng_id_get(sh->map, pipe)) != NULL) {
+		st->granted = qos;
+	}
+	nng_mtx_unlock(sh->mtx);
+}
+
+void
+sub_queue_acked(uint32_t pipe)
+{
+	sub_queue_shard *sh = subq_shard_of(pipe);
+	sub_queue_state *st;
+
+	if (!subq_.enabled) {
+		return;
+	}
+	nng_mtx_lock(sh->mtx);
+	// acks of messages sent before the pipe was opened here are not
+	// counted either
+	if ((st = nng_id_get(sh->map, pipe)) != NULL && st->msgs > 0) {
+		st->msgs--;
+	}
+	nng_mtx_unlock(sh->mtx);
+}
+
+typedef struct {
+	sub_queue_change *changes;
+	size_t            count;
+	size_t            cap;
+} subq_round;
+
+static void
+subq_sample_one(void *key, void *value, void *arg)
+{
+	subq_round      *r    = arg;
+	sub_queue_state *st   = value;
+	uint32_t         pipe = *(uint32_t *) key;
+	bool             over;
+	bool             under;
+
+	over  = st->msgs > subq_.conf.msgs;
+	under = st->msgs <= subq_.conf.msgs / 2;
+	if (st->slow ? !under : !over) {
+		return;
+	}
+	st->slow = !st->slow;
+	if (st->slow) {
+		st->since = nng_clock();
+		nng_atomic_inc(subq_.slow);
+		nng_atomic_inc64(subq_.events);
+	} else {
+		st->since = 0;
+		nng_atomic_dec_nv(subq_.slow);
+	}
+	if (r->count == r->cap) {
+		size_t            cap = r->cap > 0 ? r->cap * 2 : 16;
+		sub_queue_change *c   = realloc(r->changes, cap * sizeof(*c));
+		if (c == NULL) {
+			return;
+		}
+		r->changes = c;
+		r->cap     = cap;
+	}
+	r->changes[r->count].pipe = pipe;
+	r->changes[r->count].st   = *st;
+	r->count++;
+}
+
+void
+sub_queue_sample(void)
+{
+	subq_round r = { 0 };
+
+	if (!subq_.enabled) {
+		return;
+	}
+	for (size_t i = 0; i < NANO_SUB_QUEUE_SHARDS; i++) {
+		nng_mtx_lock(subq_.shards[i].mtx);
+		nng_id_map_foreach2(subq_.shards[i].map, subq_sample_one, &r);
+		nng_mtx_unlock(subq_.shards[i].mtx);
+		for (size_t c = 0; c < r.count && subq_.slow_cb != NULL; c++) {
+			subq_.slow_cb(
+			    r.changes[c].pipe, &r.changes[c].st, subq_.arg);
+		}
+		r.count = 0;
+	}
+	free(r.changes);
+}
+
+bool
+sub_queue_get(uint32_t pipe, sub_queue_state *st)
+{
+	sub_queue_shard *sh = subq_shard_of(pipe);
+	sub_queue_state *found;
+
+	if (!subq_.enabled) {
+		return false;
+	}
+	nng_mtx_lock(sh->mtx);
+	if ((found = nng_id_get(sh->map, pipe)) != NULL) {
+		*st = *found;
+	}
+	nng_mtx_unlock(sh->mtx);
+	return found != NULL;
+}
+
+void
+sub_queue_stats_get(sub_queue_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!subq_.enabled) {
+		return;
+	}
+	s->slow        = (size_t) nng_atomic_get(subq_.slow);
+	s->slow_events = nng_atomic_get64(subq_.events);
+	for (int p = 0; p < SUB_QUEUE_POLICIES; p++) {
+		s->dropped[p] = nng_atomic_get64(subq_.dropped[p]);
+	}
+}
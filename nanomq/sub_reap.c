@@ -0,0 +1,326 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/match_cache.h"
+#include "include/sub_reap.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef struct reap_op {
+	struct reap_op *next;
+	size_t          size;
+	nng_time        when;
+	uint32_t        pipe;
+	char            topic[];
+} reap_op;
+
+static struct {
+	nng_mtx        *mtx;
+	nng_cv         *cv;   // reaper, removals queued or closing
+	nng_cv         *done; // sync, a batch removed
+	nng_thread     *thr;
+	nng_id_map     *pipes; // pipe id -> removals queued, as a pointer
+	nng_atomic_int *dead;  // fan-out looks at pipes only while non zero
+	dbtree         *db;
+	size_t          batch;
+	nng_duration    linger;
+	reap_op        *head;
+	reap_op        *tail;
+	size_t          count;
+	uint64_t        queued_seq;
+	uint64_t        done_seq;
+	uint64_t        batches;
+	size_t          batch_max;
+	bool            closing;
+	bool            enabled;
+} reap_;
+
+// by filter, so the same branch is walked on end
+static int
+reap_cmp(const void *a, const void *b)
+{
+	const reap_op *x  = *(const reap_op *const *) a;
+	const reap_op *y  = *(const reap_op *const *) b;
+	int            rv = strcmp(x->topic, y->topic);
+
+	if (rv != 0) {
+		return rv;
+	}
+	return x->pipe < y->pipe ? -1 : x->pipe > y->pipe;
+}
+
+static void
+reap_remove(reap_op *ops, size_t n)
+{
+	reap_op **sorted;
+	reap_op  *op;
+	reap_op  *next;
+	size_t    i = 0;
+
+	if ((sorted = nng_alloc(n * sizeof(reap_op *))) != NULL) {
+		for (op = ops; op != NULL; op = op->next) {
+			sorted[i++] = op;
+		}
+		qsort(sorted, n, sizeof(reap_op *), reap_cmp);
+		for (i = 0; i < n; i++) {
+			dbtree_delete_client(
+			    reap_.db, sorted[i]->topic, sorted[i]->pipe);
+		}
+		nng_free(sorted, n * sizeof(reap_op *));
+	} else {
+		for (op = ops; op != NULL; op = op->next) {
+			dbtree_delete_client(reap_.db, op->topic, op->pipe);
+		}
+	}
+	match_cache_invalidate();
+
+	// out of the tree, the pipes need no more skipping
+	nng_mtx_lock(reap_.mtx);
+	for (op = ops; op != NULL; op = op->next) {
+		uintptr_t left =
+		    (uintptr_t) nng_id_get(reap_.pipes, op->pipe) - 1;
+
+		if (left == 0) {
+			nng_id_remove(reap_.pipes, op->pipe);
+			nng_atomic_dec_nv(reap_.dead);
+		} else {
+			nng_id_set(reap_.pipes, op->pipe, (void *) left);
+		}
+	}
+	nng_mtx_unlock(reap_.mtx);
+
+	for (op = ops; op != NULL; op = next) {
+		next = op->next;
+		nng_free(op, op->size);
+	}
+}
+
+static void
+reap_thread(void *arg)
+{
+	reap_op *ops;
+	reap_op *last;
+	size_t   n;
+
+	(void) arg;
+	nng_mtx_lock(reap_.mtx);
+	for (;;) {
+		while (!reap_.closing &&
+		    (reap_.count == 0 ||
+		        (reap_.count < reap_.batch &&
+		            nng_clock() < reap_.head->when + reap_.linger))) {
+			if (reap_.count == 0) {
+				nng_cv_wait(reap_.cv);
+			} else {
+				nng_cv_until(
+				    reap_.cv, reap_.head->when + reap_.linger);
+			}
+		}
+		if (reap_.count == 0) {
+			// closing and drained
+			break;
+		}
+		ops = last = reap_.head;
+		for (n = 1; n < reap_.batch && last->next != NULL; n++) {
+			last = last->next;
+		}
+		reap_.head = last->next;
+		last->next = NULL;
+		if (reap_.head == NULL) {
+			reap_.tail = NULL;
+		}
+		reap_.count -= n;
+		nng_mtx_unlock(reap_.mtx);
+
+		reap_remove(ops, n);
+
+		nng_mtx_lock(reap_.mtx);
+		reap_.done_seq += n;
+		reap_.batches++;
+		if (n > reap_.batch_max) {
+			reap_.batch_max = n;
+		}
+		nng_cv_wake(reap_.done);
+	}
+	nng_mtx_unlock(reap_.mtx);
+}
+
+int
+sub_reap_put(uint32_t pipe, const char *topic)
+{
+	reap_op  *op;
+	size_t    tlen = strlen(topic) + 1;
+	size_t    size = sizeof(*op) + tlen;
+	uintptr_t queued;
+	int       rv;
+
+	if (!reap_.enabled) {
+		return NNG_ECLOSED;
+	}
+	if ((op = nng_alloc(size)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	op->next = NULL;
+	op->size = size;
+	op->when = nng_clock();
+	op->pipe = pipe;
+	memcpy(op->topic, topic, tlen);
+
+	nng_mtx_lock(reap_.mtx);
+	queued = (uintptr_t) nng_id_get(reap_.pipes, pipe);
+	if (reap_.closing ||
+	    (rv = nng_id_set(reap_.pipes, pipe, (void *) (queued + 1))) != 0) {
+		nng_mtx_unlock(reap_.mtx);
+		nng_free(op, size);
+		return reap_.closing ? NNG_ECLOSED : rv;
+	}
+	if (queued == 0) {
+		nng_atomic_inc(reap_.dead);
+	}
+	if (reap_.tail != NULL) {
+		reap_.tail->next = op;
+	} else {
+		reap_.head = op;
+	}
+	reap_.tail = op;
+	reap_.count++;
+	reap_.queued_seq++;
+	if (reap_.count == 1 || reap_.count == reap_.batch) {
+		nng_cv_wake(reap_.cv);
+	}
+	nng_mtx_unlock(reap_.mtx);
+	return 0;
+}
+
+bool
+sub_reap_dead(uint32_t pipe)
+{
+	bool dead;
+
+	if (!reap_.enabled || nng_atomic_get(reap_.dead) == 0) {
+		return false;
+	}
+	nng_mtx_lock(reap_.mtx);
+	dead = nng_id_get(reap_.pipes, pipe) != NULL;
+	nng_mtx_unlock(reap_.mtx);
+	return dead;
+}
+
+void
+sub_reap_sync(void)
+{
+	uint64_t seq;
+
+	if (!reap_.enabled) {
+		return;
+	}
+	nng_mtx_lock(reap_.mtx);
+	seq = reap_.queued_seq;
+	if (reap_.done_seq < seq) {
+		if (reap_.head != NULL) {
+			reap_.head->when = 0;
+			nng_cv_wake(reap_.cv);
+		}
+		while (reap_.done_seq < seq) {
+			nng_cv_wait(reap_.done);
+		}
+	}
+	nng_mtx_unlock(reap_.mtx);
+}
+
+int
+sub_reap_init(dbtree *db, size_t batch, nng_duration linger)
+{
+	const char *s = getenv("NANOMQ_SUB_REAP");
+	int         rv;
+
+	if (reap_.enabled) {
+		return 0;
+	}
+	if (db == NULL || batch == 0 || linger < 0) {
+		return NNG_EINVAL;
+	}
+	if (s != NULL && strcmp(s, "0") == 0) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&reap_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&reap_.cv, reap_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&reap_.done, reap_.mtx)) != 0 ||
+	    (rv = nng_id_map_alloc(&reap_.pipes, 0, 0, 0)) != 0 ||
+	    (rv = nng_atomic_alloc(&reap_.dead)) != 0) {
+		sub_reap_fini();
+		return rv;
+	}
+	reap_.db     = db;
+	reap_.batch  = batch;
+	reap_.linger = linger;
+	if ((rv = nng_thread_create(&reap_.thr, reap_thread, NULL)) != 0) {
+		reap_.thr = NULL;
+		sub_reap_fini();
+		return rv;
+	}
+	reap_.enabled = true;
+	return 0;
+}
+
+void
+sub_reap_fini(void)
+{
+	if (reap_.thr != NULL) {
+		nng_mtx_lock(reap_.mtx);
+		reap_.closing = true;
+		nng_cv_wake(reap_.cv);
+		nng_mtx_unlock(reap_.mtx);
+		nng_thread_destroy(reap_.thr);
+		log_info("sub reap: %llu subscriptions in %llu batches",
+		    (unsigned long long) reap_.done_seq,
+		    (unsigned long long) reap_.batches);
+	}
+	if (reap_.dead != NULL) {
+		nng_atomic_free(reap_.dead);
+	}
+	if (reap_.pipes != NULL) {
+		nng_id_map_free(reap_.pipes);
+	}
+	if (reap_.done != NULL) {
+		nng_cv_free(reap_.done);
+	}
+	if (reap_.cv != NULL) {
+		nng_cv_free(reap_.cv);
+	}
+	if (reap_.mtx != NULL) {
+		nng_mtx_free(reap_.mtx);
+	}
+	memset(&reap_, 0, sizeof(reap_));
+}
+
+bool
+sub_reap_enabled(void)
+{
+	return reap_.enabled;
+}
+
+void
+sub_reap_stats_get(sub_reap_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!reap_.enabled) {
+		return;
+	}
+	nng_mtx_lock(reap_.mtx);
+	s->removed   = reap_.done_seq;
+	s->batches   = reap_.batches;
+	s->batch_max = reap_.batch_max;
+	s->queued    = reap_.count;
+	s->dead      = (size_t) nng_atomic_get(reap_.dead);
+	nng_mtx_unlock(reap_.mtx);
+}
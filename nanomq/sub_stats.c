@@ -0,0 +1,271 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/sub_stats.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/idhash.h"
+#include "nng/supplemental/util/platform.h"
+
+#define SUB_STATS_BUCKETS 1024
+#define SUB_STATS_SHARE "$share/"
+
+typedef struct sub_filter sub_filter;
+struct sub_filter {
+	sub_filter *next;
+	uint32_t    hash;
+	uint32_t    refs; // subscribers of this filter
+	size_t      len;
+	char        topic[];
+};
+
+static struct {
+	nng_mtx     *mtx;
+	sub_filter **buckets;
+	size_t       nbuckets;
+	nng_id_map  *pipes; // pipe id -> protocol version
+	sub_stats    stats;
+	bool         enabled;
+} sub_stats_;
+
+static uint32_t
+sub_stats_hash(const char *topic, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (uint8_t) topic[i]) * 16777619u;
+	}
+	return h;
+}
+
+int
+sub_stats_init(void)
+{
+	int rv;
+
+	if (sub_stats_.enabled) {
+		return 0;
+	}
+	if ((sub_stats_.buckets = nng_zalloc(
+	         sizeof(sub_filter *) * SUB_STATS_BUCKETS)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	sub_stats_.nbuckets = SUB_STATS_BUCKETS;
+	if ((rv = nng_mtx_alloc(&sub_stats_.mtx)) != 0 ||
+	    (rv = nng_id_map_alloc(&sub_stats_.pipes, 0, 0, 0)) != 0) {
+		sub_stats_fini();
+		return rv;
+	}
+	sub_stats_.enabled = true;
+	return 0;
+}
+
+void
+sub_stats_fini(void)
+{
+	for (size_t i = 0; i < sub_stats_.nbuckets; i++) {
+		sub_filter *f;
+		while ((f = sub_stats_.buckets[i]) != NULL) {
+			sub_stats_.buckets[i] = f->next;
+			nng_free(f, sizeof(*f) + f->len + 1);
+		}
+	}
+	if (sub_stats_.buckets != NULL) {
+		nng_free(sub_stats_.buckets,
+		    sizeof(sub_filter *) * sub_stats_.nbuckets);
+	}
+	if (sub_stats_.pipes != NULL) {
+		nng_id_map_free(sub_stats_.pipes);
+	}
+	if (sub_stats_.mtx != NULL) {
+		nng_mtx_free(sub_stats_.mtx);
+	}
+	memset(&sub_stats_, 0, sizeof(sub_stats_));
+}
+
+bool
+sub_stats_enabled(void)
+{
+	return sub_stats_.enabled;
+}
+
+// Double the buckets once filters outnumber them, kept as is on ENOMEM.
+static void
+sub_stats_grow(void)
+{
+	size_t       n = sub_stats_.nbuckets * 2;
+	sub_filter **buckets;
+
+	if ((buckets = nng_zalloc(sizeof(sub_filter *) * n)) == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < sub_stats_.nbuckets; i++) {
+		sub_filter *f;
+		while ((f = sub_stats_.buckets[i]) != NULL) {
+			sub_stats_.buckets[i] = f->next;
+			f->next               = buckets[f->hash & (n - 1)];
+			buckets[f->hash & (n - 1)] = f;
+		}
+	}
+	nng_free(sub_stats_.buckets, sizeof(sub_filter *) * sub_stats_.nbuckets);
+	sub_stats_.buckets  = buckets;
+	sub_stats_.nbuckets = n;
+}
+
+static sub_filter **
+sub_stats_find(const char *topic, size_t len, uint32_t hash)
+{
+	sub_filter **fp = &sub_stats_.buckets[hash & (sub_stats_.nbuckets - 1)];
+
+	for (; *fp != NULL; fp = &(*fp)->next) {
+		if ((*fp)->hash == hash && (*fp)->len == len &&
+		    memcmp((*fp)->topic, topic, len) == 0) {
+			break;
+		}
+	}
+	return fp;
+}
+
+void
+sub_stats_subscribe(const char *topic)
+{
+	size_t       len;
+	uint32_t     hash;
+	sub_filter **fp;
+	sub_filter  *f;
+
+	if (!sub_stats_.enabled || topic == NULL) {
+		return;
+	}
+	len  = strlen(topic);
+	hash = sub_stats_hash(topic, len);
+
+	nng_mtx_lock(sub_stats_.mtx);
+	if ((f = *(fp = sub_stats_find(topic, len, hash))) == NULL) {
+		if ((f = nng_alloc(sizeof(*f) + len + 1)) == NULL) {
+			nng_mtx_unlock(sub_stats_.mtx);
+			return;
+		}
+		f->next = NULL;
+		f->hash = hash;
+		f->refs = 0;
+		f->len  = len;
+		memcpy(f->topic, topic, len + 1);
+		*fp = f;
+		if (++sub_stats_.stats.topics > sub_stats_.nbuckets) {
+			sub_stats_grow();
+		}
+	}
+	f->refs++;
+	sub_stats_.stats.subscriptions++;
+	if (strncmp(topic, SUB_STATS_SHARE, strlen(SUB_STATS_SHARE)) == 0) {
+		sub_stats_.stats.shared++;
+	}
+	nng_mtx_unlock(sub_stats_.mtx);
+}
+
+void
+sub_stats_unsubscribe(const char *topic)
+{
+	size_t       len;
+	uint32_t     hash;
+	sub_filter **fp;
+	sub_filter  *f;
+
+	if (!sub_stats_.enabled || topic == NULL) {
+		return;
+	}
+	len  = strlen(topic);
+	hash = sub_stats_hash(topic, len);
+
+	nng_mtx_lock(sub_stats_.mtx);
+	if ((f = *(fp = sub_stats_find(topic, len, hash))) != NULL) {
+		sub_stats_.stats.subscriptions--;
+		if (strncmp(topic, SUB_STATS_SHARE, strlen(SUB_STATS_SHARE)) ==
+		    0) {
+			sub_stats_.stats.shared--;
+		}
+		if (--f->refs == 0) {
+			*fp = f->next;
+			nng_free(f, sizeof(*f) + f->len + 1);
+			sub_stats_.stats.topics--;
+		}
+	}
+	nng_mtx_unlock(sub_stats_.mtx);
+}
+
+static uint64_t *
+sub_stats_version(uint8_t proto_ver)
+{
+	switch (proto_ver) {
+	case 3:
+		return &sub_stats_.stats.conn_v31;
+	case 4:
+		return &sub_stats_.stats.conn_v311;
+	case 5:
+		return &sub_stats_.stats.conn_v5;
+	default:
+		return NULL;
+	}
+}
+
+void
+sub_stats_connect(uint32_t pipe, uint8_t proto_ver)
+{
+	uint64_t *ver;
+
+	if (!sub_stats_.enabled) {
+		return;
+	}
+	nng_mtx_lock(sub_stats_.mtx);
+	// the version is kept off by one, a NULL value means no entry
+	if (nng_id_get(sub_stats_.pipes, pipe) == NULL &&
+	    nng_id_set(sub_stats_.pipes, pipe,
+	        (void *) (uintptr_t) (proto_ver + 1)) == 0) {
+		sub_stats_.stats.connections++;
+		if ((ver = sub_stats_version(proto_ver)) != NULL) {
+			(*ver)++;
+		}
+	}
+	nng_mtx_unlock(sub_stats_.mtx);
+}
+
+void
+sub_stats_disconnect(uint32_t pipe)
+{
+	void     *value;
+	uint64_t *ver;
+
+	if (!sub_stats_.enabled) {
+		return;
+	}
+	nng_mtx_lock(sub_stats_.mtx);
+	if ((value = nng_id_get(sub_stats_.pipes, pipe)) != NULL) {
+		nng_id_remove(sub_stats_.pipes, pipe);
+		sub_stats_.stats.connections--;
+		if ((ver = sub_stats_version((uintptr_t) value - 1)) != NULL) {
+			(*ver)--;
+		}
+	}
+	nng_mtx_unlock(sub_stats_.mtx);
+}
+
+void
+sub_stats_get(sub_stats *s)
+{
+	if (!sub_stats_.enabled) {
+		memset(s, 0, sizeof(*s));
+		return;
+	}
+	nng_mtx_lock(sub_stats_.mtx);
+	*s = sub_stats_.stats;
+	nng_mtx_unlock(sub_stats_.mtx);
+}
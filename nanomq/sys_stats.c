@@ -0,0 +1,246 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "include/broker.h"
+#include "include/proc_stats.h"
+#include "include/sub_queue.h"
+#include "include/sys_stats.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+static struct {
+	nng_aio             *aio;
+	nng_duration         interval;
+	sys_stats_publish_cb cb;
+	void                *arg;
+	char                 node[SYS_STATS_NODE_LEN];
+	// timer callback only
+	sys_stats_sample     last;
+	bool                 has_last;
+	bool                 enabled;
+} sys_;
+
+void
+sys_stats_sample_take(sys_stats_sample *s)
+{
+	sub_queue_stats sq;
+	proc_sample     ps;
+
+	memset(s, 0, sizeof(*s));
+	s->time = nng_clock();
+#ifdef STATISTICS
+	s->msg_in   = nanomq_get_message_in();
+	s->msg_out  = nanomq_get_message_out();
+	s->msg_drop = nanomq_get_message_drop();
+#endif
+	sub_stats_get(&s->subs);
+	if (proc_stats_latest(&ps)) {
+		s->bridge_queue_depth = ps.bridge_queue_depth;
+	}
+	sub_queue_stats_get(&sq);
+	s->slow_subscribers = sq.slow;
+	s->slow_events      = sq.slow_events;
+	for (int p = 0; p < SUB_QUEUE_POLICIES; p++) {
+		s->slow_dropped += sq.dropped[p];
+	}
+
+	if ((s->latency = latency_stats_enabled())) {
+		latency_hist hist[LATENCY_STAGES];
+
+		latency_collect(hist);
+		for (int i = 0; i < LATENCY_STAGES; i++) {
+			s->stages[i].count = hist[i].count;
+			s->stages[i].p50   = latency_quantile(&hist[i], 0.5);
+			s->stages[i].p99   = latency_quantile(&hist[i], 0.99);
+			s->stages[i].p999  = latency_quantile(&hist[i], 0.999);
+		}
+	}
+}
+
+// per second, counters going back (a restart of them) give 0
+static double
+sys_rate(uint64_t prev, uint64_t cur, nng_duration ms)
+{
+	return ms > 0 && cur > prev ? (cur - prev) * 1000.0 / ms : 0;
+}
+
+static bool
+sys_topic(sys_stats_msg *m, const char *node, const char *name)
+{
+	int n = snprintf(m->topic, sizeof(m->topic),
+	    SYS_STATS_TOPIC_PREFIX "%s/%s", node, name);
+
+	return n > 0 && (size_t) n < sizeof(m->topic);
+}
+
+size_t
+sys_stats_compose(const char *node, const sys_stats_sample *prev,
+    const sys_stats_sample *cur, sys_stats_msg *msgs, size_t cap)
+{
+	sys_stats_msg *m;
+	nng_duration   ms = prev != NULL ? (nng_duration) (cur->time - prev->time)
+	                                 : 0;
+	size_t         n  = 0;
+	size_t         len;
+
+	if (n < cap && sys_topic(m = &msgs[n], node, "messages")) {
+		snprintf(m->payload, sizeof(m->payload),
+		    "{\"received\":%llu,\"sent\":%llu,\"dropped\":%llu,"
+		    "\"received_rate\":%.2f,\"sent_rate\":%.2f,"
+		    "\"dropped_rate\":%.2f}",
+		    (unsigned long long) cur->msg_in,
+		    (unsigned long long) cur->msg_out,
+		    (unsigned long long) cur->msg_drop,
+		    sys_rate(prev ? prev->msg_in : 0, cur->msg_in, ms),
+		    sys_rate(prev ? prev->msg_out : 0, cur->msg_out, ms),
+		    sys_rate(prev ? prev->msg_drop : 0, cur->msg_drop, ms));
+		n++;
+	}
+	if (n < cap && sys_topic(m = &msgs[n], node, "connections")) {
+		snprintf(m->payload, sizeof(m->payload),
+		    "{\"count\":%llu,\"v31\":%llu,\"v311\":%llu,\"v5\":%llu}",
+		    (unsigned long long) cur->subs.connections,
+		    (unsigned long long) cur->subs.conn_v31,
+		    (unsigned long long) cur->subs.conn_v311,
+		    (unsigned long long) cur->subs.conn_v5);
+		n++;
+	}
+	if (n < cap && sys_topic(m = &msgs[n], node, "subscriptions")) {
+		snprintf(m->payload, sizeof(m->payload),
+		    "{\"count\":%llu,\"topics\":%llu,\"shared\":%llu}",
+		    (unsigned long long) cur->subs.subscriptions,
+		    (unsigned long long) cur->subs.topics,
+		    (unsigned long long) cur->subs.shared);
+		n++;
+	}
+	if (n < cap && sys_topic(m = &msgs[n], node, "queues")) {
+		snprintf(m->payload, sizeof(m->payload),
+		    "{\"bridge\":%llu,\"slow_subscribers\":%llu,"
+		    "\"slow_events\":%llu,\"slow_dropped\":%llu}",
+		    (unsigned long long) cur->bridge_queue_depth,
+		    (unsigned long long) cur->slow_subscribers,
+		    (unsigned long long) cur->slow_events,
+		    (unsigned long long) cur->slow_dropped);
+		n++;
+	}
+	// microseconds, of all samples since the start
+	if (cur->latency && n < cap &&
+	    sys_topic(m = &msgs[n], node, "latency")) {
+		len = snprintf(m->payload, sizeof(m->payload), "{");
+		for (int i = 0; i < LATENCY_STAGES &&
+		     len < sizeof(m->payload); i++) {
+			const sys_stats_latency *l = &cur->stages[i];
+
+			len += snprintf(m->payload + len, sizeof(m->payload) - len,
+			    "%s\"%s\":{\"count\":%llu,\"p50\":%.1f,"
+			    "\"p99\":%.1f,\"p999\":%.1f}",
+			    i > 0 ? "," : "", latency_stage_name(i),
+			    (unsigned long long) l->count, l->p50 / 1000.0,
+			    l->p99 / 1000.0, l->p999 / 1000.0);
+		}
+		if (len + 1 < sizeof(m->payload)) {
+			strcpy(m->payload + len, "}");
+			n++;
+		}
+	}
+	return n;
+}
+
+static void
+sys_stats_tick(void *arg)
+{
+	sys_stats_msg    msgs[SYS_STATS_MSGS];
+	sys_stats_sample cur;
+	size_t           n;
+
+	(void) arg;
+	if (nng_aio_result(sys_.aio) != 0) {
+		return;
+	}
+	sys_stats_sample_take(&cur);
+	n = sys_stats_compose(
+	    sys_.node, sys_.has_last ? &sys_.last : NULL, &cur, msgs,
+	    SYS_STATS_MSGS);
+	sys_.last     = cur;
+	sys_.has_last = true;
+	sys_.cb(sys_.arg, msgs, n);
+	nng_sleep_aio(sys_.interval, sys_.aio);
+}
+
+int
+sys_stats_init(sys_stats_publish_cb cb, void *arg)
+{
+	const char *interval = getenv("NANOMQ_SYS_INTERVAL");
+	const char *node     = getenv("NANOMQ_SYS_NODE");
+	int         rv;
+
+	if (sys_.enabled) {
+		return 0;
+	}
+	sys_.interval = NANO_SYS_STATS_INTERVAL_MS;
+	if (interval != NULL && *interval != '\0') {
+		char *end;
+		long  ms = strtol(interval, &end, 10);
+		if (*end != '\0' || ms < 0) {
+			log_warn("NANOMQ_SYS_INTERVAL \"%s\" ignored", interval);
+		} else {
+			sys_.interval = (nng_duration) ms;
+		}
+	}
+	if (sys_.interval == 0) {
+		return 0;
+	}
+	if (node != NULL && *node != '\0') {
+		snprintf(sys_.node, sizeof(sys_.node), "%s", node);
+	} else if (gethostname(sys_.node, sizeof(sys_.node)) != 0) {
+		snprintf(sys_.node, sizeof(sys_.node), "%d", getpid());
+	}
+	sys_.node[sizeof(sys_.node) - 1] = '\0';
+	// a level of its own, never a wildcard
+	for (char *c = sys_.node; *c != '\0'; c++) {
+		if (*c == '/' || *c == '+' || *c == '#') {
+			*c = '_';
+		}
+	}
+
+	if ((rv = nng_aio_alloc(&sys_.aio, sys_stats_tick, NULL)) != 0) {
+		return rv;
+	}
+	sys_.cb       = cb;
+	sys_.arg      = arg;
+	sys_.has_last = false;
+	sys_.enabled  = true;
+	log_info("$SYS statistics of %s every %d ms", sys_.node,
+	    (int) sys_.interval);
+	nng_sleep_aio(sys_.interval, sys_.aio);
+	return 0;
+}
+
+void
+sys_stats_fini(void)
+{
+	if (!sys_.enabled) {
+		return;
+	}
+	// waits for a tick running, later ones end as canceled
+	nng_aio_stop(sys_.aio);
+	nng_aio_free(sys_.aio);
+	memset(&sys_, 0, sizeof(sys_));
+}
+
+bool
+sys_stats_enabled(void)
+{
+	return sys_.enabled;
+}
@@ -0,0 +1,143 @@
+#include "include/async_log.h"
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nng/supplemental/util/platform.h"
+
+#define LOG_TEST_PATH "/tmp/nanomq_async_log_test.log"
+#define LOG_TEST_THREADS 4
+#define LOG_TEST_RECORDS 5000
+
+static void
+emit(int line, int level, const char *fmt, ...)
+{
+	log_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.file  = __FILE__;
+	ev.func  = "emit";
+	ev.line  = line;
+	ev.level = level;
+	ev.fmt   = fmt;
+	va_start(ev.ap, fmt);
+	async_log_event(&ev);
+	va_end(ev.ap);
+}
+
+static void
+producer(void *arg)
+{
+	int id = *(int *) arg;
+
+	for (int i = 0; i < LOG_TEST_RECORDS; i++) {
+		emit(100 + id, NNG_LOG_INFO, "thread %d record %d", id, i);
+	}
+}
+
+static size_t
+count_lines(const char *path, const char *needle)
+{
+	FILE  *fp = fopen(path, "r");
+	char   line[1024];
+	size_t n = 0;
+
+	if (fp == NULL) {
+		return 0;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		n += needle == NULL || strstr(line, needle) != NULL;
+	}
+	fclose(fp);
+	return n;
+}
+
+int
+main()
+{
+	async_log_conf  c   = { .enable = true, .rate = 3 };
+	conf_log        log = { 0 };
+	async_log_stats st;
+	nng_thread     *thr[LOG_TEST_THREADS];
+	int             ids[LOG_TEST_THREADS];
+
+	remove(LOG_TEST_PATH);
+	log.abs_path = LOG_TEST_PATH;
+	log.fp       = fopen(LOG_TEST_PATH, "a");
+	assert(log.fp != NULL);
+
+	async_log_stats_get(&st);
+	assert(st.written == 0 && !async_log_enabled());
+	c.enable = false;
+	assert(async_log_init(&c, &log) == 0 && !async_log_enabled());
+	c.enable = true;
+	assert(async_log_init(&c, &log) == 0 && async_log_enabled());
+
+	// one site over its rate, fatal records go through regardless
+	for (int i = 0; i < 10; i++) {
+		emit(10, NNG_LOG_WARN, "burst %d", i);
+	}
+	emit(11, NNG_LOG_ERROR, "other site");
+	for (int i = 0; i < 5; i++) {
+		emit(12, NNG_LOG_FATAL, "fatal %d", i);
+	}
+	async_log_stats_get(&st);
+	assert(st.suppressed == 7 && st.rings == 1);
+	async_log_fini();
+	assert(!async_log_enabled());
+	assert(count_lines(LOG_TEST_PATH, "burst") == 3);
+	assert(count_lines(LOG_TEST_PATH, "burst 2") == 1);
+	assert(count_lines(LOG_TEST_PATH, "other site") == 1);
+	assert(count_lines(LOG_TEST_PATH, "fatal") == 5);
+
+	// a suppressed count rides on the next record of its site
+	assert(async_log_init(&c, &log) == 0);
+	for (int i = 0; i < 6; i++) {
+		emit(20, NNG_LOG_INFO, "tick");
+	}
+	nng_msleep(1100);
+	emit(20, NNG_LOG_INFO, "tock");
+	async_log_fini();
+	assert(count_lines(LOG_TEST_PATH, "tock (3 suppressed)") == 1);
+
+	// without a rate every record is either written or dropped, the
+	// producers are done so the dropped count is final before fini
+	c.rate = 0;
+	assert(async_log_init(&c, &log) == 0);
+	for (int i = 0; i < LOG_TEST_THREADS; i++) {
+		ids[i] = i;
+		assert(nng_thread_create(&thr[i], producer, &ids[i]) == 0);
+	}
+	for (int i = 0; i < LOG_TEST_THREADS; i++) {
+		nng_thread_destroy(thr[i]);
+	}
+	async_log_stats_get(&st);
+	async_log_fini();
+	assert(st.rings == LOG_TEST_THREADS);
+	assert(st.suppressed == 0);
+	assert(count_lines(LOG_TEST_PATH, "thread ") + st.dropped ==
+	    (uint64_t) LOG_TEST_THREADS * LOG_TEST_RECORDS);
+	printf("dropped %llu of %d\n", (unsigned long long) st.dropped,
+	    LOG_TEST_THREADS * LOG_TEST_RECORDS);
+
+	// rotation keeps the current file small
+	log.rotation_sz    = 4096;
+	log.rotation_count = 2;
+	assert(async_log_init(&c, &log) == 0);
+	for (int i = 0; i < 200; i++) {
+		emit(30, NNG_LOG_INFO, "rotate %d", i);
+		if (i % 50 == 49) {
+			nng_msleep(2 * NANO_LOG_FLUSH_MS);
+		}
+	}
+	async_log_fini();
+	assert(count_lines(LOG_TEST_PATH ".1", NULL) > 0);
+	assert(count_lines(LOG_TEST_PATH ".3", NULL) == 0);
+
+	fclose(log.fp);
+	remove(LOG_TEST_PATH);
+	remove(LOG_TEST_PATH ".1");
+	remove(LOG_TEST_PATH ".2");
+	return 0;
+}
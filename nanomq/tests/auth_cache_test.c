@@ -0,0 +1,60 @@
+#include "include/auth_cache.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+int main()
+{
+	const char *tok = "eyJhbGciOiJSUzI1NiJ9.e30.sig";
+	size_t      len = strlen(tok);
+	uint32_t    flags;
+	char        key[32];
+
+	// nothing is kept while disabled
+	assert(auth_cache_enabled() == false);
+	auth_cache_put(tok, len, 1, 1000, 0);
+	assert(auth_cache_get(tok, len, 1, 0, &flags) == false);
+
+	assert(auth_cache_init() == 0);
+	assert(auth_cache_enabled());
+
+	auth_cache_put(tok, len, 1, 1000, 7);
+	assert(auth_cache_get(tok, len, 1, 999, &flags) && flags == 7);
+	// the full value must match, not just a prefix
+	assert(auth_cache_get(tok, len - 1, 1, 0, &flags) == false);
+	// expired
+	assert(auth_cache_get(tok, len, 1, 1000, &flags) == false);
+	assert(auth_cache_get(tok, len, 1, 0, &flags) == false);
+
+	// checked against other credentials, drops the entry
+	auth_cache_put(tok, len, 1, 1000, 0);
+	assert(auth_cache_get(tok, len, 2, 0, &flags) == false);
+	assert(auth_cache_get(tok, len, 1, 0, &flags) == false);
+
+	// a put of the same value refreshes it
+	auth_cache_put(tok, len, 1, 1000, 0);
+	auth_cache_put(tok, len, 1, 5000, 3);
+	assert(auth_cache_get(tok, len, 1, 4000, &flags) && flags == 3);
+
+	// bounded, older entries give way
+	for (int i = 0; i < NANO_AUTH_CACHE_SIZE * 4; i++) {
+		snprintf(key, sizeof(key), "token-%d", i);
+		auth_cache_put(key, strlen(key), 1, 10000 + i, 0);
+	}
+	int kept = 0;
+	for (int i = 0; i < NANO_AUTH_CACHE_SIZE * 4; i++) {
+		snprintf(key, sizeof(key), "token-%d", i);
+		kept += auth_cache_get(key, strlen(key), 1, 0, &flags);
+	}
+	assert(kept > 0 && kept <= NANO_AUTH_CACHE_SIZE);
+	snprintf(key, sizeof(key), "token-%d", NANO_AUTH_CACHE_SIZE * 4 - 1);
+	assert(auth_cache_get(key, strlen(key), 1, 0, &flags));
+
+	// empty and oversized values are never cached
+	auth_cache_put("", 0, 1, 1000, 0);
+	assert(auth_cache_get("", 0, 1, 0, &flags) == false);
+
+	auth_cache_fini();
+	assert(auth_cache_enabled() == false);
+	return 0;
+}
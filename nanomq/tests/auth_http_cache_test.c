@@ -0,0 +1,78 @@
+#include "include/auth_http_cache.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nng/supplemental/util/platform.h"
+
+int main()
+{
+	char topic[600];
+
+	// nothing is kept while disabled
+	assert(auth_http_cache_enabled() == false);
+	auth_http_cache_put("c", "u", false, "a/b", 3, true);
+	assert(auth_http_cache_get("c", "u", false, "a/b", 3) ==
+	    AUTH_HTTP_MISS);
+
+	assert(auth_http_cache_init(NULL, 200, 50) == 0);
+	assert(auth_http_cache_enabled());
+
+	// the action, clientid, username and topic all make the key
+	auth_http_cache_put("c", "u", false, "a/b", 3, true);
+	assert(auth_http_cache_get("c", "u", false, "a/b", 3) ==
+	    AUTH_HTTP_ALLOW);
+	assert(auth_http_cache_get("c", "u", true, "a/b", 3) ==
+	    AUTH_HTTP_MISS);
+	assert(auth_http_cache_get("c", "v", false, "a/b", 3) ==
+	    AUTH_HTTP_MISS);
+	assert(auth_http_cache_get("cu", "", false, "a/b", 3) ==
+	    AUTH_HTTP_MISS);
+	assert(auth_http_cache_get("c", "u", false, "a/b/c", 3) ==
+	    AUTH_HTTP_ALLOW);
+	assert(auth_http_cache_get(NULL, NULL, false, "a/b", 3) ==
+	    AUTH_HTTP_MISS);
+
+	// denies are cached for a shorter time
+	auth_http_cache_put("c", "u", true, "x", 1, false);
+	assert(auth_http_cache_get("c", "u", true, "x", 1) == AUTH_HTTP_DENY);
+	nng_msleep(100);
+	assert(auth_http_cache_get("c", "u", true, "x", 1) == AUTH_HTTP_MISS);
+	assert(auth_http_cache_get("c", "u", false, "a/b", 3) ==
+	    AUTH_HTTP_ALLOW);
+	nng_msleep(150);
+	assert(auth_http_cache_get("c", "u", false, "a/b", 3) ==
+	    AUTH_HTTP_MISS);
+
+	// a new decision replaces the old one
+	auth_http_cache_put("c", "u", false, "a/b", 3, true);
+	auth_http_cache_put("c", "u", false, "a/b", 3, false);
+	assert(auth_http_cache_get("c", "u", false, "a/b", 3) ==
+	    AUTH_HTTP_DENY);
+
+	// keys too long for the stack
+	memset(topic, 't', sizeof(topic));
+	auth_http_cache_put("c", "u", false, topic, sizeof(topic), true);
+	assert(auth_http_cache_get("c", "u", false, topic, sizeof(topic)) ==
+	    AUTH_HTTP_ALLOW);
+
+	// bounded, the oldest entries go first
+	for (int i = 0; i < NANO_AUTH_HTTP_CACHE_SIZE + 10; i++) {
+		snprintf(topic, sizeof(topic), "t/%d", i);
+		auth_http_cache_put(
+		    "c", "u", false, topic, strlen(topic), true);
+	}
+	assert(auth_http_cache_get("c", "u", false, "t/0", 3) ==
+	    AUTH_HTTP_MISS);
+	snprintf(topic, sizeof(topic), "t/%d", NANO_AUTH_HTTP_CACHE_SIZE + 9);
+	assert(auth_http_cache_get("c", "u", false, topic, strlen(topic)) ==
+	    AUTH_HTTP_ALLOW);
+
+	// no pool without a config
+	assert(auth_http_cache_check(NULL, false, "a", 1, NULL, NULL) ==
+	    NNG_ENOTSUP);
+
+	auth_http_cache_fini();
+	assert(auth_http_cache_enabled() == false);
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include "include/bridge_forward.h"
+#include <assert.h>
+#include <string.h>
+
+static topics
+forward_rule(char *local, char *remote)
+{
+	topics t           = { 0 };
+	t.local_topic      = local;
+	t.local_topic_len  = strlen(local);
+	t.remote_topic     = remote;
+	t.remote_topic_len = strlen(remote);
+	return t;
+}
+
+int main()
+{
+	bridge_forward **fwds;
+
+	topics a = forward_rule("a/#", "ra");
+	topics b = forward_rule("x", "rx");
+	topics c = forward_rule("a/+", "rc");
+	topics d = forward_rule("#", "");
+
+	topics *list1[] = { &a, &b };
+	topics *list2[] = { &c, &d };
+
+	conf_bridge_node node1 = { 0 };
+	conf_bridge_node node2 = { 0 };
+	node1.enable           = true;
+	node1.forwards_count   = 2;
+	node1.forwards_list    = list1;
+	node2.enable           = true;
+	node2.forwards_count   = 2;
+	node2.forwards_list    = list2;
+
+	conf_bridge_node *nodes[] = { &node1, &node2 };
+	conf_bridge       bridge  = { 0 };
+	bridge.count              = 2;
+	bridge.nodes              = nodes;
+
+	// nothing matches before init
+	assert(bridge_forward_begin(0, "a/b", NULL, &fwds) == 0);
+	bridge_forward_end(0);
+
+	assert(bridge_forward_init(&bridge, 0) != 0);
+	assert(bridge_forward_init(&bridge, 2) == 0);
+
+	// matches come back in config order
+	assert(bridge_forward_begin(0, "a/b", NULL, &fwds) == 3);
+	assert(fwds[0]->node == &node1);
+	assert(strcmp(fwds[0]->rewrite.base, "ra") == 0);
+	assert(fwds[1]->node == &node2);
+	assert(strcmp(fwds[1]->rewrite.base, "rc") == 0);
+	assert(fwds[2]->rewrite.base_len == 0);
+	bridge_forward_end(0);
+
+	// "a/#" also covers "a"
+	assert(bridge_forward_begin(1, "a", NULL, &fwds) == 2);
+	bridge_forward_end(1);
+	assert(bridge_forward_begin(1, "x/y", NULL, &fwds) == 1);
+	bridge_forward_end(1);
+	assert(bridge_forward_begin(2, "x", NULL, &fwds) == 0);
+
+	// the snapshot owns its strings, the conf can go away after reload
+	node2.forwards_count = 1;
+	assert(bridge_forward_begin(0, "x", NULL, &fwds) == 2);
+	assert(bridge_forward_reload(&bridge) == 0);
+	assert(strcmp(fwds[0]->rewrite.topic, "rx") == 0);
+	assert(fwds[1]->rewrite.topic == NULL);
+	bridge_forward_end(0);
+	assert(bridge_forward_begin(0, "x", NULL, &fwds) == 1);
+	assert(strcmp(fwds[0]->rewrite.base, "rx") == 0);
+	bridge_forward_end(0);
+
+	// static rewrites are settled at load, dynamic ones use the buffer
+	a.prefix     = "p/";
+	a.prefix_len = 2;
+	d.suffix     = "/s";
+	d.suffix_len = 2;
+	topics s     = forward_rule("l", "r/#");
+	topics *sl[] = { &s };
+	node2.forwards_count = 2;
+	node2.sub_count      = 1;
+	node2.sub_list       = sl;
+	assert(bridge_forward_reload(&bridge) == 0);
+
+	char       *buf = NULL;
+	size_t      cap = 0;
+	const char *t;
+	uint32_t    len;
+	assert(bridge_forward_begin(0, "a/b", NULL, &fwds) == 3);
+	assert(strcmp(fwds[0]->rewrite.topic, "p/ra") == 0);
+	t = bridge_rewrite_topic(&fwds[0]->rewrite, "a/b", 3, &buf, &cap, &len);
+	assert(t == fwds[0]->rewrite.topic && len == 4 && buf == NULL);
+	t = bridge_rewrite_topic(&fwds[1]->rewrite, "a/b", 3, &buf, &cap, &len);
+	assert(t == fwds[1]->rewrite.topic);
+	t = bridge_rewrite_topic(&fwds[2]->rewrite, "a/b", 3, &buf, &cap, &len);
+	assert(t == buf && len == 5 && strcmp(t, "a/b/s") == 0);
+	bridge_forward_end(0);
+
+	bridge_sub *subs;
+	size_t      count;
+	assert(bridge_forward_subs(1, &node1, &subs, &count) == 0);
+	assert(count == 0);
+	bridge_forward_end(1);
+	assert(bridge_forward_subs(1, &node2, &subs, &count) == 0);
+	assert(count == 1 && strcmp(subs[0].remote_topic, "r/#") == 0);
+	assert(strcmp(subs[0].rewrite.topic, "l") == 0);
+	bridge_forward_end(1);
+	bridge_sub *sub;
+	assert(bridge_forward_sub_match(1, &node2, "r/x", NULL, &sub) == 0);
+	assert(sub == &subs[0]);
+	bridge_forward_end(1);
+	assert(bridge_forward_sub_match(1, &node2, "q", NULL, &sub) == 0);
+	assert(sub == NULL);
+	bridge_forward_end(1);
+	conf_bridge_node other = { 0 };
+	assert(bridge_forward_subs(1, &other, &subs, &count) == NNG_ENOENT);
+	bridge_forward_end(1);
+	assert(bridge_forward_sub_match(1, &other, "r", NULL, &sub) ==
+	    NNG_ENOENT);
+	bridge_forward_end(1);
+	nng_free(buf, cap);
+
+	bridge_forward_fini();
+	return 0;
+}
@@ -0,0 +1,73 @@
+#include "include/bridge_rtt.h"
+#include <assert.h>
+#include <string.h>
+
+int main()
+{
+	bridge_rtt_stats     tcp, quic;
+	bridge_rtt_transport active;
+
+	conf_bridge_node hybrid = { 0 };
+	conf_bridge_node plain  = { 0 };
+	hybrid.enable           = true;
+	hybrid.hybrid           = true;
+	plain.enable            = true;
+
+	conf_bridge_node *nodes[] = { &hybrid, &plain };
+	conf_bridge       bridge  = { 0 };
+	bridge.count              = 2;
+	bridge.nodes              = nodes;
+
+	assert(bridge_rtt_init(&bridge) == 0);
+	assert(bridge_rtt_stat(&plain, BRIDGE_RTT_TCP, &tcp) == NNG_ENOENT);
+	assert(bridge_rtt_active(&plain, &active) == NNG_ENOENT);
+
+	bridge_rtt_switched(&hybrid, BRIDGE_RTT_TCP, 1000);
+	assert(bridge_rtt_active(&hybrid, &active) == 0);
+	assert(active == BRIDGE_RTT_TCP);
+
+	// too few samples to trust QUIC yet
+	for (int i = 0; i < NANO_BRIDGE_HYBRID_MIN_SAMPLES; i++) {
+		bridge_rtt_record(&hybrid, BRIDGE_RTT_TCP, 400);
+	}
+	bridge_rtt_record(&hybrid, BRIDGE_RTT_QUIC, 40);
+	assert(!bridge_rtt_prefer(&hybrid, 1000 + NANO_BRIDGE_HYBRID_HOLD_MS));
+
+	for (int i = 1; i < NANO_BRIDGE_HYBRID_MIN_SAMPLES; i++) {
+		bridge_rtt_record(&hybrid, BRIDGE_RTT_QUIC, 40);
+	}
+	// held down right after the last switch, free to move afterwards
+	assert(!bridge_rtt_prefer(&hybrid, 1001));
+	assert(bridge_rtt_prefer(&hybrid, 1000 + NANO_BRIDGE_HYBRID_HOLD_MS));
+
+	assert(bridge_rtt_stat(&hybrid, BRIDGE_RTT_TCP, &tcp) == 0);
+	assert(bridge_rtt_stat(&hybrid, BRIDGE_RTT_QUIC, &quic) == 0);
+	assert(tcp.samples == NANO_BRIDGE_HYBRID_MIN_SAMPLES);
+	assert(tcp.srtt == 400 && quic.srtt == 40);
+	assert(tcp.buckets[8] == NANO_BRIDGE_HYBRID_MIN_SAMPLES); // <= 500ms
+	assert(quic.buckets[5] == NANO_BRIDGE_HYBRID_MIN_SAMPLES); // <= 50ms
+
+	// after switching to QUIC, the slower TCP is no reason to go back
+	bridge_rtt_switched(&hybrid, BRIDGE_RTT_QUIC, 2000);
+	assert(!bridge_rtt_prefer(&hybrid, 2000 + NANO_BRIDGE_HYBRID_HOLD_MS));
+
+	// but a lossy QUIC is
+	for (int i = 0; i < 4; i++) {
+		bridge_rtt_lost(&hybrid, BRIDGE_RTT_QUIC);
+	}
+	assert(bridge_rtt_stat(&hybrid, BRIDGE_RTT_QUIC, &quic) == 0);
+	assert(quic.lost == 4 && quic.loss >= NANO_BRIDGE_HYBRID_LOSS_PERMILLE);
+	assert(bridge_rtt_prefer(&hybrid, 2000 + NANO_BRIDGE_HYBRID_HOLD_MS));
+
+	// similar round trips never flap
+	memset(&tcp, 0, sizeof(tcp));
+	memset(&quic, 0, sizeof(quic));
+	tcp.samples = quic.samples = NANO_BRIDGE_HYBRID_MIN_SAMPLES;
+	tcp.srtt                   = 100;
+	quic.srtt                  = 90;
+	assert(!bridge_rtt_should_switch(&tcp, &quic));
+	assert(!bridge_rtt_should_switch(&quic, &tcp));
+
+	bridge_rtt_fini();
+	return 0;
+}
@@ -0,0 +1,124 @@
+#include "include/bridge_zip.h"
+#include "nng/protocol/mqtt/mqtt.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DICT_PATH "/tmp/nanomq_bridge_zip_test.dict"
+
+static const char telemetry[] =
+    "{\"device\":\"sensor-0042\",\"site\":\"plant-north\",\"temperature\":"
+    "21.5,\"humidity\":48.25,\"pressure\":1013.2,\"battery\":87,"
+    "\"status\":\"ok\",\"firmware\":\"2.4.1\",\"ts\":1700000000123}";
+
+int main()
+{
+	conf_bridge_node  cloud = { 0 };
+	conf_bridge_node  edge  = { 0 };
+	conf_bridge_node *nodes[] = { &cloud, &edge };
+	conf_bridge       bridge  = { .count = 2, .nodes = nodes };
+	bridge_zip_stats  st;
+	uint8_t          *z;
+	uint32_t          zlen;
+	uint8_t          *out;
+	uint32_t          len;
+	uint32_t          plain;
+	FILE             *fp;
+
+	cloud.name      = "cloud";
+	cloud.proto_ver = MQTT_PROTOCOL_VERSION_v5;
+	edge.name       = "edge";
+	edge.proto_ver  = MQTT_PROTOCOL_VERSION_v311;
+
+	// rules name v5 bridges, with or without a filter
+	setenv("NANOMQ_BRIDGE_ZIP", "cloud:telemetry/#,,edge,nobody", 1);
+	unsetenv("NANOMQ_BRIDGE_ZIP_DICT");
+	assert(bridge_zip_init(&bridge, 2) == 0);
+	assert(bridge_zip_enabled());
+	assert(bridge_zip_wanted(&cloud, "telemetry/a/b"));
+	assert(bridge_zip_wanted(&cloud, "cmd/a") == false);
+	assert(bridge_zip_wanted(&edge, "telemetry/a/b") == false);
+
+	// short payloads and ones that would not shrink go as they are
+	assert(bridge_zip_deflate(0, &cloud, (const uint8_t *) "hi", 2, &z,
+	           &zlen) == NNG_ENOSPC);
+	uint8_t noise[256];
+	for (size_t i = 0; i < sizeof(noise); i++) {
+		noise[i] = (uint8_t) rand();
+	}
+	assert(bridge_zip_deflate(0, &cloud, noise, sizeof(noise), &z,
+	           &zlen) == NNG_ENOSPC);
+
+	assert(bridge_zip_deflate(0, &cloud, (const uint8_t *) telemetry,
+	           sizeof(telemetry) - 1, &z, &zlen) == 0);
+	assert(zlen < sizeof(telemetry) - 1);
+	plain = zlen;
+	bridge_zip_sent(&edge, sizeof(telemetry) - 1, zlen);
+	assert(bridge_zip_inflate(1, &edge, z, zlen, &out, &len) == 0);
+	assert(len == sizeof(telemetry) - 1);
+	assert(memcmp(out, telemetry, len) == 0 && out[len] == '\0');
+	nng_free(out, len + 1);
+
+	// garbage does not inflate
+	assert(bridge_zip_inflate(1, &edge, noise, sizeof(noise), &out,
+	           &len) != 0);
+
+	assert(bridge_zip_stat(&cloud, &st) == 0);
+	assert(st.zipped == 1 && st.skipped == 1);
+	assert(st.zip_in == sizeof(telemetry) - 1 && st.zip_out == plain);
+	assert(bridge_zip_stat(&edge, &st) == 0);
+	assert(st.zipped == 1 && st.unzipped == 1 && st.failed == 1);
+	assert(st.unzip_in == plain && st.unzip_out == sizeof(telemetry) - 1);
+	bridge_zip_fini();
+	assert(bridge_zip_enabled() == false);
+
+	// a shared dictionary of sample traffic makes it smaller still
+	assert((fp = fopen(DICT_PATH, "wb")) != NULL);
+	fputs(telemetry, fp);
+	fclose(fp);
+	setenv("NANOMQ_BRIDGE_ZIP", "cloud", 1);
+	setenv("NANOMQ_BRIDGE_ZIP_DICT", DICT_PATH, 1);
+	assert(bridge_zip_init(&bridge, 2) == 0);
+	assert(bridge_zip_wanted(&cloud, "anything"));
+	assert(bridge_zip_deflate(0, &cloud, (const uint8_t *) telemetry,
+	           sizeof(telemetry) - 1, &z, &zlen) == 0);
+	assert(zlen < plain / 2);
+	// through another worker, the buffer of this one is reused
+	assert(bridge_zip_inflate(1, &cloud, z, zlen, &out, &len) == 0);
+	assert(len == sizeof(telemetry) - 1);
+	assert(memcmp(out, telemetry, len) == 0);
+	nng_free(out, len + 1);
+
+	// payloads inflating to many times their size
+	static char big[200000];
+	memset(big, 'x', sizeof(big));
+	assert(bridge_zip_deflate(0, &cloud, (const uint8_t *) big,
+	           sizeof(big), &z, &zlen) == 0);
+	uint8_t *copy = nng_alloc(zlen);
+	memcpy(copy, z, zlen);
+	assert(bridge_zip_inflate(0, &cloud, copy, zlen, &out, &len) == 0);
+	assert(len == sizeof(big) && memcmp(out, big, len) == 0);
+	nng_free(out, len + 1);
+	nng_free(copy, zlen);
+
+	// not without the dictionary it was made with
+	assert(bridge_zip_deflate(0, &cloud, (const uint8_t *) telemetry,
+	           sizeof(telemetry) - 1, &z, &zlen) == 0);
+	copy = nng_alloc(zlen);
+	memcpy(copy, z, zlen);
+	bridge_zip_fini();
+	unsetenv("NANOMQ_BRIDGE_ZIP_DICT");
+	assert(bridge_zip_init(&bridge, 1) == 0);
+	assert(bridge_zip_inflate(0, &cloud, copy, zlen, &out, &len) ==
+	    NNG_ENOENT);
+	nng_free(copy, zlen);
+	bridge_zip_fini();
+
+	// a missing dictionary file is an error
+	setenv("NANOMQ_BRIDGE_ZIP_DICT", DICT_PATH ".none", 1);
+	assert(bridge_zip_init(&bridge, 1) == NNG_ENOENT);
+	assert(bridge_zip_enabled() == false);
+	remove(DICT_PATH);
+	return 0;
+}
@@ -0,0 +1,790 @@
+/*
+ * Microbenchmarks of the broker hot paths, the baseline optimizations of
+ * them are measured against:
+ *
+ *   broker_bench [--quick] [-r reps] [-m ms] [-f filter]
+ *
+ * Every case first doubles its batch until one batch runs for -m ms, which
+ * also warms up caches and allocators, then times -r batches of that size.
+ * ns/op is the median of those batches next to the fastest and the slowest,
+ * allocs/op counts malloc, calloc and realloc calls of all of them (glibc
+ * only). -f runs the cases whose name contains filter.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "include/acl_handler.h"
+#include "include/bridge.h"
+#include "include/bridge_forward.h"
+#include "include/hashmap.h"
+#include "include/nanomq.h"
+#include "include/pub_handler.h"
+#include "include/rule_filter.h"
+#include "nng/protocol/mqtt/mqtt_parser.h"
+#include "nng/supplemental/nanolib/cvector.h"
+
+#define BENCH_REPS_MAX 31
+#define BENCH_PAYLOAD 256
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define BENCH_NO_ALLOCS
+#endif
+#endif
+#if !defined(__GLIBC__) || defined(__SANITIZE_ADDRESS__)
+#define BENCH_NO_ALLOCS
+#endif
+
+#if !defined(BENCH_NO_ALLOCS)
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+static uint64_t bench_allocs;
+
+void *
+malloc(size_t sz)
+{
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(sz);
+}
+
+void *
+calloc(size_t n, size_t sz)
+{
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(n, sz);
+}
+
+void *
+realloc(void *p, size_t sz)
+{
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(p, sz);
+}
+#endif
+
+typedef void (*bench_op)(void *);
+
+static struct {
+	int         reps;
+	uint64_t    target_ns;
+	const char *filter;
+} bench_ = { 7, 100000000, NULL };
+
+static volatile uintptr_t bench_sink;
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t
+bench_alloc_count(void)
+{
+#if !defined(BENCH_NO_ALLOCS)
+	return __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED);
+#else
+	return 0;
+#endif
+}
+
+static bool
+bench_want(const char *name)
+{
+	return bench_.filter == NULL || strstr(name, bench_.filter) != NULL;
+}
+
+static uint64_t
+bench_batch(bench_op op, void *arg, uint64_t n)
+{
+	uint64_t start = bench_now();
+
+	for (uint64_t i = 0; i < n; i++) {
+		op(arg);
+	}
+	return bench_now() - start;
+}
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+bench_run(const char *name, bench_op op, void *arg)
+{
+	double   ns[BENCH_REPS_MAX];
+	uint64_t n = 1;
+	uint64_t allocs;
+
+	if (!bench_want(name)) {
+		return;
+	}
+	while (bench_batch(op, arg, n) < bench_.target_ns &&
+	    n < ((uint64_t) 1 << 40)) {
+		n *= 2;
+	}
+
+	allocs = bench_alloc_count();
+	for (int r = 0; r < bench_.reps; r++) {
+		ns[r] = (double) bench_batch(op, arg, n) / (double) n;
+	}
+	allocs = bench_alloc_count() - allocs;
+	qsort(ns, bench_.reps, sizeof(double), bench_cmp);
+
+	printf("%-40s %10.1f %10.1f %10.1f ", name, ns[bench_.reps / 2],
+	    ns[0], ns[bench_.reps - 1]);
+#if !defined(BENCH_NO_ALLOCS)
+	printf("%10.2f", (double) allocs / ((double) n * bench_.reps));
+#else
+	printf("%10s", "-");
+#endif
+	printf(" %12llu\n", (unsigned long long) n);
+	fflush(stdout);
+}
+
+// A v3.1.1 PUBLISH as the protocol layer hands it to the broker.
+static nng_msg *
+bench_pub_msg(const char *topic, uint8_t qos, size_t payload_len)
+{
+	nng_msg            *msg;
+	struct fixed_header fh = { 0 };
+	uint8_t             payload[BENCH_PAYLOAD];
+
+	assert(payload_len <= sizeof(payload));
+	memset(payload, 'x', payload_len);
+	fh.packet_type = PUBLISH;
+	fh.qos         = qos;
+
+	assert(nng_msg_alloc(&msg, 0) == 0);
+	nng_msg_append_u16(msg, (uint16_t) strlen(topic));
+	nng_msg_append(msg, topic, strlen(topic));
+	if (qos > 0) {
+		nng_msg_append_u16(msg, 1);
+	}
+	nng_msg_append(msg, payload, payload_len);
+	nng_msg_set_remaining_len(msg, nng_msg_len(msg));
+	nng_msg_header_append(msg, &fh, sizeof(fh));
+	nng_msg_set_cmd_type(msg, CMD_PUBLISH);
+	return msg;
+}
+
+static nano_work *
+bench_work(nng_msg *msg)
+{
+	nano_work *work = nng_zalloc(sizeof(*work));
+
+	assert(work != NULL);
+	work->proto_ver = MQTT_PROTOCOL_VERSION_v311;
+	work->msg       = msg;
+	return work;
+}
+
+static void
+bench_work_free(nano_work *work)
+{
+	if (work->pub_packet != NULL) {
+		free_pub_packet(work->pub_packet);
+	}
+	nng_msg_free(work->msg);
+	nng_free(work, sizeof(*work));
+}
+
+static void
+op_decode(void *arg)
+{
+	nano_work *work = arg;
+
+	work->pub_packet = nng_zalloc(sizeof(struct pub_packet_struct));
+	decode_pub_message(work, MQTT_PROTOCOL_VERSION_v311);
+	free_pub_packet(work->pub_packet);
+	work->pub_packet = NULL;
+}
+
+static void
+op_decode_view(void *arg)
+{
+	nano_work *work = arg;
+
+	work->pub_packet = nng_zalloc(sizeof(struct pub_packet_struct));
+	decode_pub_view(work, MQTT_PROTOCOL_VERSION_v311);
+	free_pub_packet(work->pub_packet);
+	work->pub_packet = NULL;
+}
+
+static nng_msg *bench_dest;
+
+static void
+op_encode(void *arg)
+{
+	nano_work *work = arg;
+
+	encode_pub_message(bench_dest, work, PUBLISH);
+}
+
+static void
+bench_codec(void)
+{
+	nano_work *work;
+
+	work =
+	    bench_work(bench_pub_msg("bench/codec/topic", 1, BENCH_PAYLOAD));
+	bench_run("decode_pub_message/v311/256B", op_decode, work);
+	bench_run("decode_pub_view/v311/256B", op_decode_view, work);
+
+	// the payload is a copy, the whole body is encoded again
+	work->pub_packet = nng_zalloc(sizeof(struct pub_packet_struct));
+	assert(decode_pub_message(work, MQTT_PROTOCOL_VERSION_v311) ==
+	    SUCCESS);
+	assert(nng_msg_alloc(&bench_dest, 0) == 0);
+	nng_msg_set_cmd_type(bench_dest, CMD_PUBLISH);
+	bench_run("encode_pub_message/v311/256B", op_encode, work);
+
+	nng_msg_free(bench_dest);
+	bench_work_free(work);
+}
+
+static void
+op_handle_pub(void *arg)
+{
+	nano_work          *work = arg;
+	struct pipe_content pipe_ct;
+
+	handle_pub(work, &pipe_ct, MQTT_PROTOCOL_VERSION_v311, true);
+	bench_sink = pipe_content_count(&pipe_ct);
+	free_pipe_content(&pipe_ct);
+	free_pub_packet(work->pub_packet);
+	work->pub_packet = NULL;
+}
+
+static void
+bench_fanout(void)
+{
+	static const size_t subs[] = { 1, 10, 100, 1000, 10000 };
+	dbtree             *db;
+	uint32_t            pid = 1;
+	char                topic[64];
+	char                name[64];
+
+	if (!bench_want("handle_pub")) {
+		return;
+	}
+	dbtree_create(&db);
+	dbhash_init_pipe_table();
+	for (size_t i = 0; i < sizeof(subs) / sizeof(subs[0]); i++) {
+		snprintf(topic, sizeof(topic), "fan/%zu/+", subs[i]);
+		for (size_t j = 0; j < subs[i]; j++) {
+			dbtree_insert_client(db, topic, pid++);
+		}
+	}
+
+	for (size_t i = 0; i < sizeof(subs) / sizeof(subs[0]); i++) {
+		nano_work *work;
+
+		snprintf(topic, sizeof(topic), "fan/%zu/x", subs[i]);
+		work     = bench_work(bench_pub_msg(topic, 0, BENCH_PAYLOAD));
+		work->db = db;
+		snprintf(name, sizeof(name), "handle_pub/fanout/%zu", subs[i]);
+		bench_run(name, op_handle_pub, work);
+		bench_work_free(work);
+	}
+
+	dbhash_destroy_pipe_table();
+	dbtree_destory(db);
+}
+
+#ifdef ACL_SUPP
+typedef struct {
+	conf       *config;
+	conn_param *cparam;
+	char        topic[64];
+} bench_acl_arg;
+
+static void
+op_auth_acl(void *arg)
+{
+	bench_acl_arg *a = arg;
+
+	bench_sink = auth_acl(a->config, ACL_PUB, a->cparam, a->topic);
+}
+
+// One rule per client id, each allowing the topics of its own client.
+static void
+bench_acl_rules(conf *config, size_t count)
+{
+	char buf[64];
+
+	config->acl.enable     = true;
+	config->acl.rule_count = count;
+	config->acl.rules      = nng_zalloc(sizeof(acl_rule *) * count);
+	config->acl_nomatch    = ACL_DENY;
+	for (size_t i = 0; i < count; i++) {
+		acl_rule *r = nng_zalloc(sizeof(*r));
+
+		snprintf(buf, sizeof(buf), "client-%zu", i);
+		r->id                   = i;
+		r->permit               = ACL_ALLOW;
+		r->action               = ACL_PUB;
+		r->rule_type            = ACL_CLIENTID;
+		r->rule_ct.ct.type      = ACL_RULE_SINGLE_STRING;
+		r->rule_ct.ct.value.str = nng_strdup(buf);
+
+		snprintf(buf, sizeof(buf), "acl/%zu/#", i);
+		r->topic_count = 1;
+		r->topics      = nng_zalloc(sizeof(char *));
+		r->topics[0]   = nng_strdup(buf);
+
+		config->acl.rules[i] = r;
+	}
+}
+
+static void
+bench_acl_free(conf *config)
+{
+	for (size_t i = 0; i < config->acl.rule_count; i++) {
+		acl_rule *r = config->acl.rules[i];
+
+		nng_strfree(r->rule_ct.ct.value.str);
+		nng_strfree(r->topics[0]);
+		nng_free(r->topics, sizeof(char *));
+		nng_free(r, sizeof(*r));
+	}
+	nng_free(config->acl.rules, sizeof(acl_rule *) * config->acl.rule_count);
+	nng_free(config, sizeof(conf));
+}
+
+static void
+bench_acl(void)
+{
+	static const size_t rules[] = { 10, 1000, 10000 };
+	char                cid[64];
+	char                name[64];
+
+	if (!bench_want("auth_acl")) {
+		return;
+	}
+	for (size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); i++) {
+		bench_acl_arg a;
+
+		a.config = nng_zalloc(sizeof(conf));
+		bench_acl_rules(a.config, rules[i]);
+		// decisions are cached per pipe only, auth_acl() evaluates
+		assert(acl_init(&a.config->acl, 0) == 0);
+
+		// the last rule is the one that matches
+		snprintf(cid, sizeof(cid), "client-%zu", rules[i] - 1);
+		assert(conn_param_alloc(&a.cparam) == 0);
+		conn_param_set_clientid(a.cparam, cid);
+		snprintf(a.topic, sizeof(a.topic), "acl/%zu/x/y", rules[i] - 1);
+		snprintf(name, sizeof(name), "auth_acl/hit/%zu", rules[i]);
+		bench_run(name, op_auth_acl, &a);
+		conn_param_free(a.cparam);
+
+		assert(conn_param_alloc(&a.cparam) == 0);
+		conn_param_set_clientid(a.cparam, "nobody");
+		snprintf(name, sizeof(name), "auth_acl/miss/%zu", rules[i]);
+		bench_run(name, op_auth_acl, &a);
+		conn_param_free(a.cparam);
+
+		acl_fini();
+		bench_acl_free(a.config);
+	}
+}
+#endif
+
+#if defined(SUPP_RULE_ENGINE)
+typedef struct {
+	nano_work *work;
+} bench_rule_arg;
+
+// What the rule engine does for one PUBLISH before any rule sinks it.
+static void
+op_rule_filter(void *arg)
+{
+	bench_rule_arg           *a  = arg;
+	struct pub_packet_struct *pp = a->work->pub_packet;
+	uint32_t                  hits[NANO_RULE_MATCH_MAX];
+	size_t                    n;
+	size_t                    matched = 0;
+	bool                      scan;
+	rule_doc                  doc;
+	rule_view                 view;
+
+	rule_filter_enter(&view, 0);
+	n = rule_filter_lookup(&view, pp->var_header.publish.topic_name.body,
+	    pub_packet_levels(pp), hits, NANO_RULE_MATCH_MAX);
+	scan = n > NANO_RULE_MATCH_MAX;
+	rule_doc_init(&doc, pp);
+	for (size_t k = 0; k < (scan ? view.count : n); k++) {
+		size_t i = scan ? k : hits[k];
+		if (rule_filter_match(a->work, &doc, &view, i)) {
+			matched++;
+		}
+	}
+	rule_doc_fini(&doc);
+	rule_filter_leave(&view);
+	bench_sink = matched;
+}
+
+static void
+bench_rule(void)
+{
+	static const size_t rules[] = { 10, 100, 1000 };
+	static const char   json[]  = "{\"temp\": 25, \"hum\": 60}";
+	char                sql[128];
+	char                topic[64];
+	char                name[64];
+
+	if (!bench_want("rule_engine_filter")) {
+		return;
+	}
+	for (size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); i++) {
+		conf_rule      cr = { 0 };
+		bench_rule_arg a;
+		nng_msg       *msg;
+
+		for (size_t j = 0; j < rules[i]; j++) {
+			snprintf(sql, sizeof(sql),
+			    "SELECT payload.temp FROM \"rule/%zu/+\" WHERE "
+			    "payload.temp > 20",
+			    j);
+			rule_sql_parse(&cr, sql);
+			rule *r    = &cr.rules[cvector_size(cr.rules) - 1];
+			r->raw_sql = nng_strdup(sql);
+			r->enabled = true;
+			r->rule_id = (uint32_t) j + 1;
+		}
+		assert(rule_filter_compile(&cr) == 0);
+
+		snprintf(topic, sizeof(topic), "rule/%zu/dev", rules[i] / 2);
+		msg = bench_pub_msg(topic, 0, 0);
+		nng_msg_append(msg, json, strlen(json));
+		nng_msg_set_remaining_len(msg, nng_msg_len(msg));
+		a.work             = bench_work(msg);
+		a.work->pub_packet = nng_zalloc(sizeof(struct pub_packet_struct));
+		assert(decode_pub_view(a.work, MQTT_PROTOCOL_VERSION_v311) ==
+		    SUCCESS);
+
+		snprintf(name, sizeof(name), "rule_engine_filter/%zu", rules[i]);
+		bench_run(name, op_rule_filter, &a);
+
+		nng_free(a.work->rule_vals,
+		    sizeof(rule_value) * a.work->rule_vals_cap);
+		bench_work_free(a.work);
+		rule_filter_fini();
+		for (size_t j = 0; j < cvector_size(cr.rules); j++) {
+			rule_free(&cr.rules[j]);
+		}
+		cvector_free(cr.rules);
+	}
+}
+#endif
+
+typedef struct {
+	const char *filter;
+	const char *topic;
+} bench_filter_arg;
+
+static void
+op_topic_filter(void *arg)
+{
+	bench_filter_arg *a = arg;
+
+	bench_sink = topic_filter(a->filter, a->topic);
+}
+
+static void
+bench_topic_filter(void)
+{
+	bench_filter_arg exact = { "factory/line1/cell4/plc/temperature",
+		"factory/line1/cell4/plc/temperature" };
+	bench_filter_arg plus  = { "factory/+/+/plc/+",
+		 "factory/line1/cell4/plc/temperature" };
+	bench_filter_arg hash  = { "factory/line1/#",
+		 "factory/line1/cell4/plc/temperature" };
+	bench_filter_arg miss  = { "factory/line2/#",
+		 "factory/line1/cell4/plc/temperature" };
+
+	bench_run("topic_filter/exact", op_topic_filter, &exact);
+	bench_run("topic_filter/plus", op_topic_filter, &plus);
+	bench_run("topic_filter/hash", op_topic_filter, &hash);
+	bench_run("topic_filter/miss", op_topic_filter, &miss);
+}
+
+typedef struct {
+	nano_work *work;
+	char      *buf;
+	size_t     cap;
+} bench_bridge_arg;
+
+// bridge_pub_handler() of the broker up to the bridge queue: forward
+// rules, topic rewrite and one encoded PUBLISH per node.
+static void
+op_bridge_pub(void *arg)
+{
+	bench_bridge_arg         *a  = arg;
+	struct pub_packet_struct *pp = a->work->pub_packet;
+	bridge_forward          **fwds;
+	size_t                    n;
+
+	n = bridge_forward_begin(0, pp->var_header.publish.topic_name.body,
+	    pub_packet_levels(pp), &fwds);
+	for (size_t i = 0; i < n; i++) {
+		const char *topic;
+		uint32_t    len;
+		nng_msg    *msg;
+
+		topic = bridge_rewrite_topic(&fwds[i]->rewrite,
+		    pp->var_header.publish.topic_name.body,
+		    pp->var_header.publish.topic_name.len, &a->buf, &a->cap,
+		    &len);
+		msg = bridge_publish_msg(topic, pp->payload.data,
+		    pp->payload.len, false, pp->fixed_header.qos, false, NULL);
+		nng_mqtt_msg_encode(msg);
+		nng_msg_free(msg);
+	}
+	bridge_forward_end(0);
+	bench_sink = n;
+}
+
+static topics
+bench_forward(char *local, char *remote)
+{
+	topics t           = { 0 };
+	t.local_topic      = local;
+	t.local_topic_len  = strlen(local);
+	t.remote_topic     = remote;
+	t.remote_topic_len = strlen(remote);
+	return t;
+}
+
+static void
+bench_bridge(void)
+{
+	bench_bridge_arg a    = { 0 };
+	topics           fwd1 = bench_forward("bridge/#", "");
+	topics           fwd2 = bench_forward("bridge/+/x", "cloud/x");
+	topics           fwd3 = bench_forward("other/#", "");
+	topics          *list1[] = { &fwd1, &fwd3 };
+	topics          *list2[] = { &fwd2 };
+	conf_bridge_node node1   = { 0 };
+	conf_bridge_node node2   = { 0 };
+
+	if (!bench_want("bridge_pub_handler")) {
+		return;
+	}
+	node1.enable         = true;
+	node1.proto_ver      = MQTT_PROTOCOL_VERSION_v311;
+	node1.forwards_count = 2;
+	node1.forwards_list  = list1;
+	node2.enable         = true;
+	node2.proto_ver      = MQTT_PROTOCOL_VERSION_v311;
+	node2.forwards_count = 1;
+	node2.forwards_list  = list2;
+
+	conf_bridge_node *nodes[] = { &node1, &node2 };
+	conf_bridge       bridge  = { 0 };
+	bridge.count              = 2;
+	bridge.nodes              = nodes;
+	assert(bridge_forward_init(&bridge, 1) == 0);
+
+	a.work = bench_work(bench_pub_msg("bridge/dev/x", 0, BENCH_PAYLOAD));
+	a.work->pub_packet = nng_zalloc(sizeof(struct pub_packet_struct));
+	assert(decode_pub_view(a.work, MQTT_PROTOCOL_VERSION_v311) == SUCCESS);
+	bench_run("bridge_pub_handler/2nodes/256B", op_bridge_pub, &a);
+
+	nng_free(a.buf, a.cap);
+	bench_work_free(a.work);
+	bridge_forward_fini();
+}
+
+#define BENCH_KEYS 10000
+
+typedef struct {
+	hashmap_s *map;
+	char      *keys[BENCH_KEYS];
+	size_t     next;
+} bench_map_arg;
+
+static void
+op_hashmap_get(void *arg)
+{
+	bench_map_arg *a   = arg;
+	char          *key = a->keys[a->next++ % BENCH_KEYS];
+
+	bench_sink = nano_hashmap_get(a->map, key, strlen(key));
+}
+
+static void
+op_hashmap_put_remove(void *arg)
+{
+	bench_map_arg *a   = arg;
+	char          *key = a->keys[a->next++ % BENCH_KEYS];
+
+	nano_hashmap_remove(a->map, key, strlen(key));
+	nano_hashmap_put(a->map, key, strlen(key), 1);
+}
+
+#define BENCH_CHURN_THREADS 4
+#define BENCH_CHURN_KEYS 1000
+
+typedef struct {
+	hashmap_s *map;
+	char      *keys[BENCH_CHURN_KEYS];
+} bench_churn_thr;
+
+typedef struct {
+	int             threads;
+	bench_churn_thr thr[BENCH_CHURN_THREADS];
+} bench_churn_arg;
+
+// One thread of a reconnect storm, its client ids come and go.
+static void
+bench_churn_cb(void *arg)
+{
+	bench_churn_thr *t = arg;
+
+	for (size_t i = 0; i < BENCH_CHURN_KEYS; i++) {
+		nano_hashmap_put(t->map, t->keys[i], strlen(t->keys[i]), i + 1);
+	}
+	for (size_t i = 0; i < BENCH_CHURN_KEYS; i++) {
+		bench_sink =
+		    nano_hashmap_get(t->map, t->keys[i], strlen(t->keys[i]));
+	}
+	for (size_t i = 0; i < BENCH_CHURN_KEYS; i++) {
+		nano_hashmap_remove(t->map, t->keys[i], strlen(t->keys[i]));
+	}
+}
+
+static void
+op_hashmap_churn(void *arg)
+{
+	bench_churn_arg *a = arg;
+	nng_thread      *thr[BENCH_CHURN_THREADS];
+
+	for (int t = 0; t < a->threads; t++) {
+		assert(nng_thread_create(&thr[t], bench_churn_cb, &a->thr[t]) ==
+		    0);
+	}
+	for (int t = 0; t < a->threads; t++) {
+		nng_thread_destroy(thr[t]);
+	}
+}
+
+// Threads churning their own keys next to the resident ones of a, one op
+// is a round of all of them.
+static void
+bench_hashmap_churn(bench_map_arg *a)
+{
+	bench_churn_arg *c;
+	char             key[32];
+	char             name[64];
+
+	c = nng_zalloc(sizeof(*c));
+	for (int t = 0; t < BENCH_CHURN_THREADS; t++) {
+		c->thr[t].map = a->map;
+		for (size_t i = 0; i < BENCH_CHURN_KEYS; i++) {
+			snprintf(key, sizeof(key), "churn-%d-%zu", t, i);
+			c->thr[t].keys[i] = nng_strdup(key);
+		}
+	}
+	for (c->threads = 1; c->threads <= BENCH_CHURN_THREADS;
+	     c->threads *= 2) {
+		snprintf(name, sizeof(name), "nano_hashmap/churn/%dthreads/%d",
+		    c->threads, BENCH_CHURN_KEYS);
+		bench_run(name, op_hashmap_churn, c);
+	}
+	assert(nano_hashmap_num_entries(a->map) == BENCH_KEYS);
+
+	for (int t = 0; t < BENCH_CHURN_THREADS; t++) {
+		for (size_t i = 0; i < BENCH_CHURN_KEYS; i++) {
+			nng_strfree(c->thr[t].keys[i]);
+		}
+	}
+	nng_free(c, sizeof(*c));
+}
+
+static void
+bench_hashmap(void)
+{
+	bench_map_arg *a;
+	char           key[32];
+
+	if (!bench_want("nano_hashmap")) {
+		return;
+	}
+	a      = nng_zalloc(sizeof(*a));
+	a->map = nng_zalloc(sizeof(hashmap_s));
+	assert(nano_hashmap_create(1024, a->map) == 0);
+	for (size_t i = 0; i < BENCH_KEYS; i++) {
+		snprintf(key, sizeof(key), "client-%zu", i);
+		a->keys[i] = nng_strdup(key);
+		assert(nano_hashmap_put(
+		           a->map, a->keys[i], strlen(a->keys[i]), i + 1) == 0);
+	}
+
+	bench_run("nano_hashmap/get/10000", op_hashmap_get, a);
+	bench_run("nano_hashmap/remove_put/10000", op_hashmap_put_remove, a);
+	bench_hashmap_churn(a);
+
+	nano_hashmap_destroy(a->map);
+	nng_free(a->map, sizeof(hashmap_s));
+	for (size_t i = 0; i < BENCH_KEYS; i++) {
+		nng_strfree(a->keys[i]);
+	}
+	nng_free(a, sizeof(*a));
+}
+
+int
+main(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--quick") == 0) {
+			// a smoke run for ctest
+			bench_.reps      = 3;
+			bench_.target_ns = 2000000;
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			bench_.reps = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			bench_.target_ns = (uint64_t) atoi(argv[++i]) * 1000000;
+		} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			bench_.filter = argv[++i];
+		} else {
+			fprintf(stderr,
+			    "Usage: %s [--quick] [-r reps] [-m ms] [-f filter]\n",
+			    argv[0]);
+			return 1;
+		}
+	}
+	if (bench_.reps < 1 || bench_.reps > BENCH_REPS_MAX) {
+		fprintf(stderr, "reps must be 1 to %d\n", BENCH_REPS_MAX);
+		return 1;
+	}
+
+	printf("%-40s %10s %10s %10s %10s %12s\n", "case", "ns/op", "min",
+	    "max", "allocs/op", "batch");
+	bench_codec();
+	bench_fanout();
+#ifdef ACL_SUPP
+	bench_acl();
+#endif
+#if defined(SUPP_RULE_ENGINE)
+	bench_rule();
+#endif
+	bench_topic_filter();
+	bench_bridge();
+	bench_hashmap();
+	return 0;
+}
@@ -0,0 +1,504 @@
+/*
+ * Load harness of the routing path: the broker runs in this process on a
+ * loopback listener and synthetic MQTT clients drive it through the nng
+ * client sockets, so only the broker and the loopback socket are measured.
+ *
+ *   broker_load [--topology fanout|fanin|shared|retained] [--pubs n]
+ *               [--subs n] [--topics n] [--qos 0|1] [--size bytes]
+ *               [--rate msg/s] [--threads n] [--port port]
+ *               [--warmup s] [--duration s] [--pause] [--quick]
+ *
+ *   fanout    one publisher, every subscriber on its topic
+ *   fanin     every publisher on a topic of its own, one subscriber of all
+ *   shared    publishers of fanin, subscribers in one $share group
+ *   retained  publishers of fanin set retained on --topics topics each
+ *
+ * --rate paces each publisher, 0 publishes as fast as the socket takes it.
+ * Counters of the process (task clock, context switches and, where the
+ * kernel allows, cycles, instructions and cache misses) are read around
+ * the --duration window only and reported per delivered message.
+ *
+ * For flame graphs build with -fno-omit-frame-pointer, run with --pause and
+ * a long --duration, then attach a sampling profiler to the pid it prints,
+ * e.g. perf record -F 999 -g -p <pid>, before pressing enter.
+ */
+#include "include/broker.h"
+#include "tests_api.h"
+
+#include <nng/mqtt/mqtt_client.h>
+#include <sys/resource.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+typedef enum {
+	LOAD_FANOUT,
+	LOAD_FANIN,
+	LOAD_SHARED,
+	LOAD_RETAINED,
+} load_topology;
+
+static const char *load_names[] = { "fanout", "fanin", "shared", "retained" };
+
+static struct {
+	load_topology topo;
+	int           pubs;
+	int           subs;
+	int           topics;
+	int           qos;
+	int           size;
+	int           rate;
+	int           threads;
+	int           port;
+	int           warmup;
+	int           duration;
+	bool          pause;
+} load_ = { LOAD_FANOUT, -1, -1, 100, 0, 64, 0, 0, 1899, 2, 10, false };
+
+typedef struct {
+	nng_socket  sock;
+	nng_aio    *aio; // receive of a subscriber
+	nng_thread *thr; // send loop of a publisher
+	int         id;
+} load_client;
+
+static nng_atomic_int *load_connected;
+static nng_atomic_u64 *load_sent;
+static nng_atomic_u64 *load_recv;
+static nng_atomic_u64 *load_errors;
+
+static volatile bool load_stop = false;
+
+#if defined(__linux__)
+static const struct {
+	uint32_t    type;
+	uint64_t    config;
+	const char *name;
+} load_events[] = {
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock(ns)" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "ctx-switches" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+};
+#define LOAD_EVENTS (sizeof(load_events) / sizeof(load_events[0]))
+
+static int load_perf_fd[LOAD_EVENTS];
+
+// Must run before nng starts any thread, only threads created afterwards
+// are counted.
+static void
+load_perf_open(void)
+{
+	for (size_t i = 0; i < LOAD_EVENTS; i++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size           = sizeof(attr);
+		attr.type           = load_events[i].type;
+		attr.config         = load_events[i].config;
+		attr.inherit        = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv     = 1;
+		load_perf_fd[i] =
+		    (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+}
+
+static void
+load_perf_read(uint64_t *v)
+{
+	for (size_t i = 0; i < LOAD_EVENTS; i++) {
+		if (load_perf_fd[i] < 0 ||
+		    read(load_perf_fd[i], &v[i], sizeof(v[i])) !=
+		        sizeof(v[i])) {
+			v[i] = 0;
+		}
+	}
+}
+#else
+#define LOAD_EVENTS 0
+#endif
+
+static void
+load_usage(const char *name)
+{
+	fprintf(stderr,
+	    "Usage: %s [--topology fanout|fanin|shared|retained] [--pubs n]\n"
+	    "       [--subs n] [--topics n] [--qos 0|1] [--size bytes]\n"
+	    "       [--rate msg/s] [--threads n] [--port port]\n"
+	    "       [--warmup s] [--duration s] [--pause] [--quick]\n",
+	    name);
+	exit(EXIT_FAILURE);
+}
+
+static void
+load_args(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (strcmp(arg, "--pause") == 0) {
+			load_.pause = true;
+			continue;
+		} else if (strcmp(arg, "--quick") == 0) {
+			// a smoke run for ctest
+			load_.warmup   = 0;
+			load_.duration = 1;
+			load_.pubs     = load_.pubs < 0 ? 2 : load_.pubs;
+			load_.subs     = load_.subs < 0 ? 4 : load_.subs;
+			continue;
+		}
+		if (val == NULL) {
+			load_usage(argv[0]);
+		}
+		i++;
+		if (strcmp(arg, "--topology") == 0) {
+			size_t n = sizeof(load_names) / sizeof(load_names[0]);
+			size_t t;
+			for (t = 0; t < n; t++) {
+				if (strcmp(val, load_names[t]) == 0) {
+					break;
+				}
+			}
+			if (t == n) {
+				load_usage(argv[0]);
+			}
+			load_.topo = (load_topology) t;
+		} else if (strcmp(arg, "--pubs") == 0) {
+			load_.pubs = atoi(val);
+		} else if (strcmp(arg, "--subs") == 0) {
+			load_.subs = atoi(val);
+		} else if (strcmp(arg, "--topics") == 0) {
+			load_.topics = atoi(val);
+		} else if (strcmp(arg, "--qos") == 0) {
+			load_.qos = atoi(val);
+		} else if (strcmp(arg, "--size") == 0) {
+			load_.size = atoi(val);
+		} else if (strcmp(arg, "--rate") == 0) {
+			load_.rate = atoi(val);
+		} else if (strcmp(arg, "--threads") == 0) {
+			load_.threads = atoi(val);
+		} else if (strcmp(arg, "--port") == 0) {
+			load_.port = atoi(val);
+		} else if (strcmp(arg, "--warmup") == 0) {
+			load_.warmup = atoi(val);
+		} else if (strcmp(arg, "--duration") == 0) {
+			load_.duration = atoi(val);
+		} else {
+			load_usage(argv[0]);
+		}
+	}
+
+	// the side the topology does not fix
+	switch (load_.topo) {
+	case LOAD_FANOUT:
+		load_.pubs = 1;
+		load_.subs = load_.subs < 0 ? 100 : load_.subs;
+		break;
+	case LOAD_FANIN:
+		load_.pubs = load_.pubs < 0 ? 100 : load_.pubs;
+		load_.subs = 1;
+		break;
+	case LOAD_SHARED:
+		load_.pubs = load_.pubs < 0 ? 4 : load_.pubs;
+		load_.subs = load_.subs < 0 ? 16 : load_.subs;
+		break;
+	case LOAD_RETAINED:
+		load_.pubs = load_.pubs < 0 ? 4 : load_.pubs;
+		load_.subs = 1;
+		break;
+	}
+	if (load_.pubs < 1 || load_.subs < 1 || load_.topics < 1 ||
+	    load_.qos < 0 || load_.qos > 1 || load_.size < 0 ||
+	    load_.duration < 1) {
+		load_usage(argv[0]);
+	}
+	if (load_.threads <= 0) {
+		load_.threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	}
+}
+
+static void
+load_connect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
+{
+	(void) p;
+	(void) ev;
+	(void) arg;
+	nng_atomic_inc(load_connected);
+}
+
+static void
+load_client_open(load_client *c, const char *kind)
+{
+	char       url[64];
+	char       cid[64];
+	nng_dialer dialer;
+	nng_msg   *msg;
+	int        rv;
+
+	snprintf(url, sizeof(url), "mqtt-tcp://127.0.0.1:%d", load_.port);
+	snprintf(cid, sizeof(cid), "load-%s-%d", kind, c->id);
+	if ((rv = nng_mqtt_client_open(&c->sock)) != 0) {
+		nng_fatal("nng_mqtt_client_open", rv);
+	}
+	nng_mqtt_set_connect_cb(c->sock, load_connect_cb, c);
+
+	nng_mqtt_msg_alloc(&msg, 0);
+	nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_CONNECT);
+	nng_mqtt_msg_set_connect_proto_version(msg, MQTT_PROTOCOL_VERSION_v311);
+	nng_mqtt_msg_set_connect_keep_alive(msg, 600);
+	nng_mqtt_msg_set_connect_clean_session(msg, true);
+	nng_mqtt_msg_set_connect_client_id(msg, cid);
+
+	if ((rv = nng_dialer_create(&dialer, c->sock, url)) != 0) {
+		nng_fatal("nng_dialer_create", rv);
+	}
+	nng_dialer_set_ptr(dialer, NNG_OPT_MQTT_CONNMSG, msg);
+	nng_dialer_start(dialer, NNG_FLAG_NONBLOCK);
+}
+
+static void
+load_recv_cb(void *arg)
+{
+	load_client *c = arg;
+	nng_msg     *msg;
+
+	if (nng_aio_result(c->aio) != 0) {
+		return;
+	}
+	msg = nng_aio_get_msg(c->aio);
+	if (nng_mqtt_msg_get_packet_type(msg) == NNG_MQTT_PUBLISH) {
+		nng_atomic_inc64(load_recv);
+	}
+	nng_msg_free(msg);
+	nng_recv_aio(c->sock, c->aio);
+}
+
+static void
+load_subscribe(load_client *c)
+{
+	nng_mqtt_topic_qos *tq;
+	const char         *topic;
+	int                 rv;
+
+	switch (load_.topo) {
+	case LOAD_FANOUT:
+		topic = "load/0";
+		break;
+	case LOAD_SHARED:
+		topic = "$share/load/load/#";
+		break;
+	default:
+		topic = "load/#";
+		break;
+	}
+	tq = nng_mqtt_topic_qos_array_create(1);
+	nng_mqtt_topic_qos_array_set(tq, 0, topic, load_.qos, 1, 0, 0);
+	nng_mqtt_subscribe(c->sock, tq, 1, NULL);
+	nng_mqtt_topic_qos_array_free(tq, 1);
+
+	if ((rv = nng_aio_alloc(&c->aio, load_recv_cb, c)) != 0) {
+		nng_fatal("nng_aio_alloc", rv);
+	}
+	nng_recv_aio(c->sock, c->aio);
+}
+
+static void
+load_pub_run(void *arg)
+{
+	load_client *c       = arg;
+	uint8_t     *payload = nng_alloc(load_.size + 1);
+	char         topic[64];
+	nng_time     start   = nng_clock();
+	uint64_t     k       = 0;
+
+	memset(payload, 'x', load_.size);
+	while (!load_stop) {
+		nng_msg *msg;
+
+		if (load_.rate > 0 &&
+		    k >= (nng_clock() - start) * (uint64_t) load_.rate / 1000) {
+			nng_msleep(1);
+			continue;
+		}
+		switch (load_.topo) {
+		case LOAD_FANOUT:
+			snprintf(topic, sizeof(topic), "load/0");
+			break;
+		case LOAD_RETAINED:
+			snprintf(topic, sizeof(topic), "load/%d/%d", c->id,
+			    (int) (k % (uint64_t) load_.topics));
+			break;
+		default:
+			snprintf(topic, sizeof(topic), "load/%d", c->id);
+			break;
+		}
+		k++;
+
+		nng_mqtt_msg_alloc(&msg, 0);
+		nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_PUBLISH);
+		nng_mqtt_msg_set_publish_qos(msg, load_.qos);
+		nng_mqtt_msg_set_publish_retain(
+		    msg, load_.topo == LOAD_RETAINED);
+		nng_mqtt_msg_set_publish_topic(msg, topic);
+		nng_mqtt_msg_set_publish_payload(msg, payload, load_.size);
+		if (nng_sendmsg(c->sock, msg, 0) != 0) {
+			nng_msg_free(msg);
+			nng_atomic_inc64(load_errors);
+		} else {
+			nng_atomic_inc64(load_sent);
+		}
+	}
+	nng_free(payload, load_.size + 1);
+}
+
+static void
+load_wait_connected(int n)
+{
+	nng_time until = nng_clock() + 10000;
+
+	while (nng_atomic_get(load_connected) < n) {
+		if (nng_clock() > until) {
+			fprintf(stderr, "only %d of %d clients connected\n",
+			    nng_atomic_get(load_connected), n);
+			exit(EXIT_FAILURE);
+		}
+		nng_msleep(10);
+	}
+}
+
+static double
+load_tv(const struct timeval *tv)
+{
+	return (double) tv->tv_sec + (double) tv->tv_usec / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+	nng_thread   *nmq;
+	conf         *nmq_conf;
+	load_client  *pubs;
+	load_client  *subs;
+	char          url[64];
+	struct rusage ru0, ru1;
+	uint64_t      sent0, recv0, sent1, recv1;
+	nng_time      t0, t1;
+#if defined(__linux__)
+	uint64_t      ev0[LOAD_EVENTS], ev1[LOAD_EVENTS];
+
+	load_perf_open();
+#endif
+	load_args(argc, argv);
+
+	nng_atomic_alloc(&load_connected);
+	nng_atomic_alloc64(&load_sent);
+	nng_atomic_alloc64(&load_recv);
+	nng_atomic_alloc64(&load_errors);
+
+	nmq_conf = get_dflt_conf();
+	snprintf(url, sizeof(url), "nmq-tcp://127.0.0.1:%d", load_.port);
+	nmq_conf->url                    = url;
+	nmq_conf->num_taskq_thread       = load_.threads;
+	nmq_conf->max_taskq_thread       = load_.threads;
+	nmq_conf->parallel               = 64 * load_.threads;
+	nmq_conf->max_packet_size        = load_.size + 1024;
+	nmq_conf->client_max_packet_size = load_.size + 1024;
+	nmq_conf->msq_len                = 65536;
+	nng_thread_create(&nmq, (void *) broker_start_with_conf, nmq_conf);
+	nng_msleep(500);
+
+	pubs = nng_zalloc(sizeof(load_client) * load_.pubs);
+	subs = nng_zalloc(sizeof(load_client) * load_.subs);
+	for (int i = 0; i < load_.subs; i++) {
+		subs[i].id = i;
+		load_client_open(&subs[i], "sub");
+	}
+	for (int i = 0; i < load_.pubs; i++) {
+		pubs[i].id = i;
+		load_client_open(&pubs[i], "pub");
+	}
+	load_wait_connected(load_.subs + load_.pubs);
+	for (int i = 0; i < load_.subs; i++) {
+		load_subscribe(&subs[i]);
+	}
+	nng_msleep(200); // SUBACKs
+
+	printf("topology %s pubs %d subs %d qos %d size %d rate %d threads "
+	       "%d\n",
+	    load_names[load_.topo], load_.pubs, load_.subs, load_.qos,
+	    load_.size, load_.rate, load_.threads);
+	for (int i = 0; i < load_.pubs; i++) {
+		nng_thread_create(&pubs[i].thr, load_pub_run, &pubs[i]);
+	}
+	nng_msleep(load_.warmup * 1000);
+	if (load_.pause) {
+		printf("pid %d under load, attach the profiler and press "
+		       "enter\n",
+		    (int) getpid());
+		fflush(stdout);
+		(void) getchar();
+	}
+
+	getrusage(RUSAGE_SELF, &ru0);
+#if defined(__linux__)
+	load_perf_read(ev0);
+#endif
+	sent0 = nng_atomic_get64(load_sent);
+	recv0 = nng_atomic_get64(load_recv);
+	t0    = nng_clock();
+	for (int s = 1; s <= load_.duration; s++) {
+		uint64_t in  = nng_atomic_get64(load_sent);
+		uint64_t out = nng_atomic_get64(load_recv);
+
+		nng_msleep(1000);
+		printf("%4ds  in %10llu msg/s  out %10llu msg/s\n", s,
+		    (unsigned long long) (nng_atomic_get64(load_sent) - in),
+		    (unsigned long long) (nng_atomic_get64(load_recv) - out));
+		fflush(stdout);
+	}
+	t1    = nng_clock();
+	sent1 = nng_atomic_get64(load_sent);
+	recv1 = nng_atomic_get64(load_recv);
+#if defined(__linux__)
+	load_perf_read(ev1);
+#endif
+	getrusage(RUSAGE_SELF, &ru1);
+
+	load_stop = true;
+	for (int i = 0; i < load_.pubs; i++) {
+		nng_thread_destroy(pubs[i].thr);
+	}
+
+	double secs = (double) (t1 - t0) / 1000;
+	double out  = (double) (recv1 - recv0);
+	printf("in %.0f msg/s  out %.0f msg/s  send errors %llu\n",
+	    (double) (sent1 - sent0) / secs, out / secs,
+	    (unsigned long long) nng_atomic_get64(load_errors));
+	printf("cpu user %.2fs sys %.2fs, %.2f us/msg out\n",
+	    load_tv(&ru1.ru_utime) - load_tv(&ru0.ru_utime),
+	    load_tv(&ru1.ru_stime) - load_tv(&ru0.ru_stime),
+	    out > 0 ? (load_tv(&ru1.ru_utime) - load_tv(&ru0.ru_utime) +
+	                  load_tv(&ru1.ru_stime) - load_tv(&ru0.ru_stime)) *
+	            1e6 / out
+	            : 0);
+#if defined(__linux__)
+	for (size_t i = 0; i < LOAD_EVENTS; i++) {
+		if (load_perf_fd[i] < 0) {
+			printf("%-16s n/a\n", load_events[i].name);
+			continue;
+		}
+		printf("%-16s %14llu  %10.1f /msg out\n", load_events[i].name,
+		    (unsigned long long) (ev1[i] - ev0[i]),
+		    out > 0 ? (double) (ev1[i] - ev0[i]) / out : 0);
+	}
+#endif
+
+	// a run that moved nothing is broken, not slow
+	assert(recv1 > recv0);
+	return 0;
+}
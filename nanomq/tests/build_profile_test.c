@@ -0,0 +1,36 @@
+#include "include/build_profile.h"
+#include <assert.h>
+#include <string.h>
+
+int
+main()
+{
+	conf config;
+
+	memset(&config, 0, sizeof(config));
+	config.parallel = 7;
+	config.msq_len  = 9;
+	build_profile_apply(&config);
+	assert(config.parallel ==
+	    (NANO_PROFILE_PARALLEL > 0 ? NANO_PROFILE_PARALLEL : 7));
+	assert(config.msq_len ==
+	    (NANO_PROFILE_MSQ_LEN > 0 ? NANO_PROFILE_MSQ_LEN : 9));
+
+	switch (NANO_PROFILE) {
+	case NANO_PROFILE_TINY:
+		assert(strcmp(build_profile_name(), "tiny") == 0);
+		break;
+	case NANO_PROFILE_SERVER:
+		assert(strcmp(build_profile_name(), "server") == 0);
+		break;
+	case NANO_PROFILE_NONE:
+		assert(strcmp(build_profile_name(), "none") == 0);
+		break;
+	default:
+		break;
+	}
+#if NANO_PLATFORM_LINUX
+	assert(build_profile_binary_size() > 0);
+#endif
+	return 0;
+}
@@ -0,0 +1,70 @@
+#include "include/cluster.h"
+#include "nng/protocol/mqtt/mqtt.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main()
+{
+	conf             *config;
+	conf_bridge_node  other = { 0 };
+	conf_bridge_node *nodes[] = { &other };
+
+	assert((config = nng_zalloc(sizeof(conf))) != NULL);
+	config->bridge.nodes = nodes;
+	config->bridge.count = 1;
+
+	// no peers, no cluster
+	assert(cluster_init(config) == 0);
+	assert(cluster_enabled() == false);
+	assert(config->bridge.count == 1);
+
+	// a bad URL keeps the config as it was
+	setenv("NANOMQ_CLUSTER_PEERS", "mqtt-tcp://10.0.0.2:1883,10.0.0.3", 1);
+	assert(cluster_init(config) == NNG_EADDRINVAL);
+	assert(cluster_enabled() == false);
+	assert(config->bridge.count == 1 && config->bridge.nodes == nodes);
+
+	setenv("NANOMQ_CLUSTER_PEERS",
+	    "mqtt-tcp://10.0.0.2:1883,,mqtt-tcp://10.0.0.3:1883", 1);
+	setenv("NANOMQ_CLUSTER_NAME", "n1", 1);
+	assert(cluster_init(config) == 0);
+	assert(cluster_enabled());
+	assert(config->bridge_mode);
+
+	// the links follow the bridges of the config
+	assert(config->bridge.count == 3);
+	assert(config->bridge.nodes[0] == &other);
+	assert(cluster_node(&other) == false);
+	for (size_t i = 1; i < 3; i++) {
+		conf_bridge_node *node = config->bridge.nodes[i];
+		assert(cluster_node(node));
+		assert(node->enable && node->transparent);
+		assert(node->proto_ver == MQTT_PROTOCOL_VERSION_v5);
+		assert(node->parallel == NANO_CLUSTER_PARALLEL);
+		assert(node->forwards_count == 0);
+		assert(strcmp(node->clientid, "nanomq-cluster-n1") == 0);
+	}
+	assert(strcmp(config->bridge.nodes[2]->address,
+	           "mqtt-tcp://10.0.0.3:1883") == 0);
+
+	// sessions of peer links are known by their client id
+	cluster_peer_open(7, "nanomq-cluster-n2");
+	cluster_peer_open(8, "sensor-1");
+	cluster_peer_open(9, NULL);
+	assert(cluster_peer_pipe(7));
+	assert(cluster_peer_pipe(8) == false);
+	assert(cluster_peer_pipe(9) == false);
+	cluster_peer_open(10, "nanomq-cluster-n3");
+	cluster_peer_close(7);
+	assert(cluster_peer_pipe(7) == false);
+	assert(cluster_peer_pipe(10));
+
+	cluster_fini(config);
+	assert(cluster_enabled() == false);
+	assert(cluster_peer_pipe(10) == false);
+	assert(config->bridge.count == 1 && config->bridge.nodes == nodes);
+	assert(config->bridge_mode == false);
+	nng_free(config, sizeof(conf));
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include "include/connect_admit.h"
+#include "nng/supplemental/util/platform.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static nng_mtx *mtx;
+static int      resumed[8];
+static int      results[8];
+
+static void
+resume(void *arg, int rv)
+{
+	int i = (int) (intptr_t) arg;
+
+	nng_mtx_lock(mtx);
+	resumed[i]++;
+	results[i] = rv;
+	nng_mtx_unlock(mtx);
+}
+
+static int
+resumed_count(void)
+{
+	int n = 0;
+
+	nng_mtx_lock(mtx);
+	for (int i = 0; i < 8; i++) {
+		n += resumed[i];
+	}
+	nng_mtx_unlock(mtx);
+	return n;
+}
+
+int main()
+{
+	connect_admit_conf  c = { 0 };
+	connect_admit_stats st;
+
+	assert(nng_mtx_alloc(&mtx) == 0);
+
+	// admits everything while disabled or unlimited
+	assert(connect_admit_try(1883, resume, NULL) == 0);
+	c.pending = 2;
+	c.wait_ms = 300;
+	assert(connect_admit_init(&c) == 0);
+	assert(connect_admit_enabled());
+	assert(connect_admit_try(1883, resume, NULL) == 0);
+
+	// two at once, then two wait and the next is refused
+	c.rate  = 10;
+	c.burst = 2;
+	connect_admit_tune(&c);
+	connect_admit_stats_get(&st);
+	assert(st.limited);
+	assert(connect_admit_try(1883, resume, (void *) 0) == 0);
+	assert(connect_admit_try(8883, resume, (void *) 1) == 0);
+	assert(connect_admit_try(1883, resume, (void *) 2) == NNG_EAGAIN);
+	assert(connect_admit_try(8883, resume, (void *) 3) == NNG_EAGAIN);
+	assert(connect_admit_try(1883, resume, (void *) 4) == NNG_EBUSY);
+	connect_admit_stats_get(&st);
+	assert(st.pending == 2 && st.queued == 2 && st.refused == 1);
+
+	// ten a second, both get their token well within wait_ms
+	for (int i = 0; i < 50 && resumed_count() < 2; i++) {
+		nng_msleep(10);
+	}
+	assert(resumed[2] == 1 && results[2] == 0);
+	assert(resumed[3] == 1 && results[3] == 0);
+	connect_admit_stats_get(&st);
+	assert(st.pending == 0 && st.pending_max == 2 && st.admitted == 5);
+
+	// waiting past wait_ms is refused
+	c.rate = 1;
+	c.burst = 1;
+	connect_admit_tune(&c);
+	while (connect_admit_try(1883, resume, (void *) 5) == 0) {
+	}
+	nng_msleep(500);
+	assert(resumed[5] == 1 && results[5] == NNG_EBUSY);
+	connect_admit_stats_get(&st);
+	assert(st.expired == 1);
+
+	// lifting the limits lets the waiting ones in
+	assert(connect_admit_try(1883, resume, (void *) 6) == NNG_EAGAIN);
+	c.rate = 0;
+	connect_admit_tune(&c);
+	for (int i = 0; i < 50 && resumed[6] == 0; i++) {
+		nng_msleep(10);
+	}
+	assert(resumed[6] == 1 && results[6] == 0);
+	connect_admit_conf_get(&c);
+	assert(c.rate == 0 && c.pending == 2);
+
+	connect_admit_fini();
+	assert(connect_admit_enabled() == false);
+	nng_mtx_free(mtx);
+	return 0;
+}
@@ -0,0 +1,47 @@
+#include "include/cpu_affinity.h"
+#include "nng/nng.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main()
+{
+	cpu_list l;
+	cpu_list nodes[NANO_NUMA_MAX];
+	size_t   pinned;
+
+	assert(cpu_list_parse("0-3,8, 10-11", &l) == 0);
+	assert(cpu_list_count(&l) == 7);
+	assert(cpu_list_has(&l, 0) && cpu_list_has(&l, 3));
+	assert(!cpu_list_has(&l, 4) && cpu_list_has(&l, 8));
+	assert(cpu_list_has(&l, 11) && !cpu_list_has(&l, 12));
+	assert(!cpu_list_has(&l, -1) && !cpu_list_has(&l, NANO_CPU_MAX));
+
+	assert(cpu_list_parse("", &l) == NNG_EINVAL);
+	assert(cpu_list_parse("3-1", &l) == NNG_EINVAL);
+	assert(cpu_list_parse("1,", &l) == 0);
+	assert(cpu_list_parse("1-", &l) == NNG_EINVAL);
+	assert(cpu_list_parse("a", &l) == NNG_EINVAL);
+	assert(cpu_list_parse("99999", &l) == NNG_EINVAL);
+
+	// nothing pinned unless asked to
+	assert(cpu_affinity_apply(&pinned) == 0 && pinned == 0);
+
+#if NANO_PLATFORM_LINUX
+	assert(cpu_affinity_numa_nodes(nodes, NANO_NUMA_MAX) >= 1);
+	assert(cpu_list_count(&nodes[0]) >= 1);
+
+	// no nng threads in here, a valid rule pins none
+	setenv(cpu_group_env(CPU_GROUP_TASKQ), "numa", 1);
+	assert(cpu_affinity_apply(&pinned) == 0 && pinned == 0);
+	setenv(cpu_group_env(CPU_GROUP_TASKQ), "numa:999", 1);
+	assert(cpu_affinity_apply(&pinned) == NNG_EINVAL);
+	setenv(cpu_group_env(CPU_GROUP_TASKQ), "0-x", 1);
+	assert(cpu_affinity_apply(&pinned) == NNG_EINVAL);
+	unsetenv(cpu_group_env(CPU_GROUP_TASKQ));
+#else
+	(void) nodes;
+#endif
+	return 0;
+}
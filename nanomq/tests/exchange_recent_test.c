@@ -0,0 +1,98 @@
+#include "include/exchange_recent.h"
+#include "include/webhook_post.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/util/platform.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// key of the seq-th message of a worker within a ms
+static uint64_t
+key_of(uint64_t ms, uint32_t seq, uint32_t worker)
+{
+	return NANO_EXCHANGE_KEY_MIN(ms) |
+	    ((uint64_t) seq << NANO_EXCHANGE_KEY_WORKER_BITS) | worker;
+}
+
+int
+main()
+{
+	exchange_recent_msg  *msgs;
+	exchange_recent_stats st;
+	bool                  more;
+	uint64_t              now;
+
+	// off unless asked for
+	unsetenv("NANOMQ_EXCHANGE_RECENT");
+	assert(exchange_recent_init(2) == 0);
+	assert(exchange_recent_enabled() == (NANO_EXCHANGE_RECENT_LEN > 0));
+	exchange_recent_fini();
+	assert(exchange_recent_since() == UINT64_MAX);
+	assert(exchange_recent_put(0, 1, 0, "a", NULL, 0) == NNG_ECLOSED);
+
+	setenv("NANOMQ_EXCHANGE_RECENT", "4", 1);
+	setenv("NANOMQ_EXCHANGE_RECENT_MS", "1000", 1);
+	assert(exchange_recent_init(2) == 0);
+	assert(exchange_recent_enabled());
+	now = nng_timestamp();
+	assert(exchange_recent_since() <= NANO_EXCHANGE_KEY_MIN(now));
+
+	// two workers interleaved, answers come ordered by key
+	assert(exchange_recent_put(
+	           0, key_of(now, 0, 0), 0, "a/1", (uint8_t *) "x", 1) == 0);
+	assert(exchange_recent_put(
+	           1, key_of(now, 0, 1), 1, "b/1", (uint8_t *) "yy", 2) == 0);
+	assert(exchange_recent_put(0, key_of(now + 1, 0, 0), 0, "a/2", NULL, 0) ==
+	    0);
+	assert(exchange_recent_put(
+	           1, key_of(now + 2, 0, 1), 1, "b/2", (uint8_t *) "z", 1) == 0);
+	assert(exchange_recent_put(2, key_of(now, 1, 2), 0, "a", NULL, 0) ==
+	    NNG_EINVAL);
+
+	msgs = exchange_recent_query(0, UINT64_MAX, NULL, 10, &more);
+	assert(cvector_size(msgs) == 4 && !more);
+	assert(strcmp(msgs[0].topic, "a/1") == 0);
+	assert(strcmp(msgs[1].topic, "b/1") == 0 && msgs[1].exchange == 1);
+	assert(msgs[1].len == 2 && memcmp(msgs[1].payload, "yy", 2) == 0);
+	assert(strcmp(msgs[2].topic, "a/2") == 0 && msgs[2].len == 0);
+	assert(strcmp(msgs[3].topic, "b/2") == 0);
+	exchange_recent_free(msgs);
+
+	// a bounded range, a topic filter and a limit
+	msgs = exchange_recent_query(NANO_EXCHANGE_KEY_MIN(now + 1),
+	    NANO_EXCHANGE_KEY_MAX(now + 1), NULL, 10, &more);
+	assert(cvector_size(msgs) == 1 && strcmp(msgs[0].topic, "a/2") == 0);
+	exchange_recent_free(msgs);
+	msgs = exchange_recent_query(0, UINT64_MAX, "b/#", 10, &more);
+	assert(cvector_size(msgs) == 2 && !more);
+	exchange_recent_free(msgs);
+	msgs = exchange_recent_query(0, UINT64_MAX, NULL, 3, &more);
+	assert(cvector_size(msgs) == 3 && more);
+	assert(strcmp(msgs[2].topic, "a/2") == 0);
+	exchange_recent_free(msgs);
+	assert(exchange_recent_query(1, 0, NULL, 10, &more) == NULL);
+
+	// room for 4 per worker, the oldest go first
+	for (uint32_t i = 1; i <= 4; i++) {
+		assert(exchange_recent_put(
+		           0, key_of(now + 1, i, 0), 0, "a/3", NULL, 0) == 0);
+	}
+	assert(exchange_recent_since() == key_of(now + 1, 0, 0) + 1);
+	msgs = exchange_recent_query(0, UINT64_MAX, "a/#", 10, &more);
+	assert(cvector_size(msgs) == 4 && msgs[0].key == key_of(now + 1, 1, 0));
+	exchange_recent_free(msgs);
+
+	// and those out of the window
+	assert(exchange_recent_put(
+	           1, key_of(now + 1500, 0, 1), 1, "b/3", NULL, 0) == 0);
+	assert(exchange_recent_since() == key_of(now + 2, 0, 1) + 1);
+	msgs = exchange_recent_query(0, UINT64_MAX, "b/#", 10, &more);
+	assert(cvector_size(msgs) == 1 && strcmp(msgs[0].topic, "b/3") == 0);
+	exchange_recent_free(msgs);
+
+	exchange_recent_stat(&st);
+	assert(st.held == 5 && st.evicted == 4 && st.queries == 6);
+	exchange_recent_fini();
+	assert(!exchange_recent_enabled());
+	return 0;
+}
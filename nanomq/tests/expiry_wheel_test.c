@@ -0,0 +1,113 @@
+#include "include/expiry_wheel.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TICK 10
+#define TIMERS 1000
+
+typedef struct {
+	expiry_timer timer;
+	nng_time     deadline;
+	int          fired;
+} item;
+
+static nng_time prev_at; // last time after which nothing was due yet
+static nng_time now_at;
+static int      fired;
+
+static void
+expire(void *arg)
+{
+	item *it = arg;
+
+	// never early, and no later than the tick it fell into
+	assert(it->deadline <= now_at);
+	assert(it->deadline + TICK > prev_at);
+	it->fired++;
+	fired++;
+}
+
+static size_t
+advance(nng_time t)
+{
+	size_t n;
+
+	now_at = t;
+	n      = expiry_wheel_advance(t);
+	prev_at = t;
+	return n;
+}
+
+int main()
+{
+	static item items[TIMERS];
+	item        a = { 0 }, b = { 0 }, c = { 0 }, d = { 0 };
+	nng_time    base;
+
+	assert(expiry_wheel_add(&a.timer, 0, expire, &a) == NNG_ECLOSED);
+	assert(expiry_wheel_init(0) == NNG_EINVAL);
+	assert(expiry_wheel_init(TICK) == 0);
+	assert(expiry_wheel_enabled());
+
+	// deadlines far ahead so that the wheel thread never gets there, on
+	// tick boundaries so that they fire exactly at their deadline
+	base    = (nng_clock() + 10000) / TICK * TICK;
+	prev_at = base;
+	a.deadline = base + 50;
+	b.deadline = base + 5000;
+	c.deadline = base + 3600 * 1000;
+	d.deadline = base + (nng_time) 60 * 24 * 3600 * 1000; // past the span
+	assert(expiry_wheel_add(&a.timer, a.deadline, expire, &a) == 0);
+	assert(expiry_wheel_add(&a.timer, a.deadline, expire, &a) == NNG_EBUSY);
+	assert(expiry_wheel_add(&b.timer, b.deadline, expire, &b) == 0);
+	assert(expiry_wheel_add(&c.timer, c.deadline, expire, &c) == 0);
+	assert(expiry_wheel_add(&d.timer, d.deadline, expire, &d) == 0);
+	assert(expiry_wheel_count() == 4);
+
+	assert(advance(base + 40) == 0);
+	assert(advance(base + 50) == 1);
+	assert(a.fired == 1);
+	assert(expiry_wheel_cancel(&a.timer) == false);
+
+	assert(expiry_wheel_cancel(&c.timer));
+	assert(expiry_wheel_cancel(&c.timer) == false);
+	assert(advance(base + 4990) == 0);
+	assert(advance(base + 5000) == 1);
+	assert(b.fired == 1);
+	assert(advance(d.deadline - TICK) == 0);
+	assert(advance(d.deadline) == 1);
+	assert(d.fired == 1 && c.fired == 0);
+	assert(expiry_wheel_count() == 0);
+	assert(expiry_wheel_fired() == 3);
+
+	// spread over all levels, each must fire in the step its deadline is in
+	base = d.deadline;
+	srand(5);
+	for (int i = 0; i < TIMERS; i++) {
+		items[i].deadline =
+		    base + 1 + (nng_time) rand() % (3 * 24 * 3600 * 1000);
+		assert(expiry_wheel_add(&items[i].timer, items[i].deadline,
+		           expire, &items[i]) == 0);
+	}
+	// a tenth is cancelled at random
+	for (int i = 0; i < TIMERS; i += 10) {
+		assert(expiry_wheel_cancel(&items[i].timer));
+	}
+	fired = 0;
+	for (nng_time t = base; t <= base + 3 * 24 * 3600 * 1000 + 7000;
+	     t += 7000) {
+		advance(t);
+	}
+	assert(fired == TIMERS - TIMERS / 10);
+	for (int i = 0; i < TIMERS; i++) {
+		assert(items[i].fired == (i % 10 == 0 ? 0 : 1));
+	}
+	assert(expiry_wheel_count() == 0);
+
+	expiry_wheel_fini();
+	assert(expiry_wheel_enabled() == false);
+	printf("expiry wheel tests passed\n");
+	return 0;
+}
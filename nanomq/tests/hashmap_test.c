@@ -1,5 +1,8 @@
 #include "include/hashmap.h"
 #include <assert.h>
+#include <stdio.h>
+
+#define TEST_KEYS 20000
 
 int main()
 {
@@ -11,9 +14,11 @@ int main()
 	uint32_t   value1 = 1;
 	uint32_t   value2 = 2;
 	uint32_t   value3 = 3;
-    
+	char      *keys[TEST_KEYS];
+
 	hashmap = (hashmap_s *) malloc(sizeof(hashmap_s));
 
+	assert(nano_hashmap_create(3, hashmap) != 0);
 	assert(nano_hashmap_create(init_size, hashmap) == 0);
 
 	assert(nano_hashmap_put(hashmap, key1, strlen(key1), value1) == 0);
@@ -26,10 +31,40 @@ int main()
 
 	assert(nano_hashmap_remove(hashmap, key1, strlen(key1)) == 0);
 	assert(nano_hashmap_get(hashmap, key1, strlen(key1)) == HASHMAP_NULL);
+	assert(nano_hashmap_remove(hashmap, key1, strlen(key1)) != 0);
+
+	// every key stays visible while stripes resize under it
+	for (int i = 0; i < TEST_KEYS; i++) {
+		keys[i] = malloc(32);
+		snprintf(keys[i], 32, "client-%d", i);
+	}
+	for (uint32_t i = 0; i < TEST_KEYS; i++) {
+		assert(nano_hashmap_put(
+		           hashmap, keys[i], strlen(keys[i]), i + 1) == 0);
+		assert(nano_hashmap_get(hashmap, keys[0], strlen(keys[0])) == 1);
+	}
+	assert(nano_hashmap_num_entries(hashmap) == TEST_KEYS + 2);
+	for (uint32_t i = 0; i < TEST_KEYS; i++) {
+		assert(nano_hashmap_get(hashmap, keys[i], strlen(keys[i])) ==
+		    i + 1);
+	}
+	// an update moves the key, it is never found twice
+	assert(nano_hashmap_put(hashmap, keys[7], strlen(keys[7]), 99) == 0);
+	assert(nano_hashmap_get(hashmap, keys[7], strlen(keys[7])) == 99);
+	assert(nano_hashmap_remove(hashmap, keys[7], strlen(keys[7])) == 0);
+	assert(nano_hashmap_get(hashmap, keys[7], strlen(keys[7])) ==
+	    HASHMAP_NULL);
+	for (uint32_t i = 0; i < TEST_KEYS; i++) {
+		nano_hashmap_remove(hashmap, keys[i], strlen(keys[i]));
+	}
+	assert(nano_hashmap_num_entries(hashmap) == 2);
 
+	for (int i = 0; i < TEST_KEYS; i++) {
+		free(keys[i]);
+	}
 	nano_hashmap_destroy(hashmap);
 
 	free(hashmap);
 
 	return 0;
-}
\ No newline at end of file
+}
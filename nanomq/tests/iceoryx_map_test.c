@@ -0,0 +1,47 @@
+#include "include/iceoryx_map.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+int
+main()
+{
+	iceoryx_map_conf c;
+	uint32_t        *ids = NULL;
+
+	assert(iceoryx_map_parse("out:cam/+/raw=Cam/Front/frames/raw;"
+	                         "in:Radar/Rear/objects;;out:#=A/B/c",
+	           &c) == 0);
+	assert(c.count == 3);
+	assert(!c.entries[0].in && strcmp(c.entries[0].filter, "cam/+/raw") == 0);
+	assert(strcmp(c.entries[0].service, "Cam") == 0);
+	assert(strcmp(c.entries[0].instance, "Front") == 0);
+	assert(strcmp(c.entries[0].event, "frames/raw") == 0);
+	assert(c.entries[1].in && c.entries[1].filter == NULL);
+	assert(strcmp(c.entries[1].event, "objects") == 0);
+	assert(strcmp(c.entries[2].filter, "#") == 0);
+	iceoryx_map_conf_free(&c);
+	assert(c.count == 0);
+
+	assert(iceoryx_map_parse("out:a=S/I", &c) == NNG_EINVAL);
+	assert(iceoryx_map_parse("out:=S/I/e", &c) == NNG_EINVAL);
+	assert(iceoryx_map_parse("out:a=S//e", &c) == NNG_EINVAL);
+	assert(iceoryx_map_parse("in:S/I/", &c) == NNG_EINVAL);
+	assert(iceoryx_map_parse("up:S/I/e", &c) == NNG_EINVAL);
+	assert(iceoryx_map_parse("", &c) == 0 && c.count == 0);
+
+	// the mapping the broker always had, and a bad one falls back to it
+	unsetenv("NANOMQ_ICEORYX_MAP");
+	assert(iceoryx_map_conf_env(&c) == 0 && c.count == 2);
+	assert(strcmp(c.entries[0].filter, "ice/fwd") == 0);
+	assert(strcmp(c.entries[0].event, "ice/fwd") == 0);
+	assert(c.entries[1].in && strcmp(c.entries[1].event, "topic") == 0);
+	iceoryx_map_conf_free(&c);
+	setenv("NANOMQ_ICEORYX_MAP", "out:x", 1);
+	assert(iceoryx_map_conf_env(&c) == 0 && c.count == 2);
+	iceoryx_map_conf_free(&c);
+
+	assert(!iceoryx_map_enabled());
+	assert(iceoryx_map_forward(NULL, "ice/fwd", NULL, &ids) == 0);
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include "include/json_writer.h"
+#include <assert.h>
+#include <string.h>
+
+static void
+check(json_writer *w, const char *expect)
+{
+	nng_msg *msg = json_writer_take(w);
+
+	assert(msg != NULL);
+	assert(nng_msg_len(msg) == strlen(expect));
+	assert(strcmp(nng_msg_body(msg), expect) == 0);
+	nng_msg_free(msg);
+}
+
+int
+main()
+{
+	json_writer w;
+	char       *out;
+	char        big[1000];
+
+	json_writer_init(&w, 16);
+	json_write_begin(&w, '{');
+	json_field_u64(&w, "ts", 1697000000000ull);
+	json_field_str(&w, "topic", "a/\"b\"\\c\n\t\x01");
+	json_field_bool(&w, "retain", false);
+	json_field_i64(&w, "delta", -42);
+	json_field_str(&w, "from_client_id", NULL);
+	json_write_key(&w, "list");
+	json_write_begin(&w, '[');
+	json_write_u64(&w, 0);
+	json_write_begin(&w, '{');
+	json_write_end(&w, '}');
+	json_write_null(&w);
+	json_write_end(&w, ']');
+	json_write_end(&w, '}');
+	check(&w,
+	    "{\"ts\":1697000000000,\"topic\":\"a/\\\"b\\\"\\\\c\\n\\t\\u0001\","
+	    "\"retain\":false,\"delta\":-42,\"from_client_id\":null,"
+	    "\"list\":[0,{},null]}");
+
+	// zeroed, grown from nothing, with text the caller separates
+	memset(&w, 0, sizeof(w));
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	json_write_str(&w, "{\"data\":[");
+	for (int i = 0; i < 3; i++) {
+		json_write_begin(&w, '{');
+		json_field_str(&w, "k", big);
+		json_write_end(&w, '}');
+	}
+	json_write_str(&w, "]}");
+	assert(!w.failed && w.len == 9 + 3 * (8 + 999) + 2 + 2);
+	json_writer_fini(&w);
+
+	// a value filled in place
+	json_writer_init(&w, 0);
+	json_write_begin(&w, '{');
+	json_write_key(&w, "payload");
+	assert((out = json_write_string_reserve(&w, 600)) != NULL);
+	memset(out, 'p', 3);
+	json_write_string_commit(&w, 3);
+	json_field_i64(&w, "n", 7);
+	json_write_end(&w, '}');
+	check(&w, "{\"payload\":\"ppp\",\"n\":7}");
+
+	memset(&w, 0, sizeof(w));
+	assert(json_writer_take(&w) == NULL);
+	return 0;
+}
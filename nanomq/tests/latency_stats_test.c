@@ -0,0 +1,48 @@
+#include "include/latency_stats.h"
+#include <assert.h>
+
+int main()
+{
+	latency_hist   hist[LATENCY_STAGES];
+	latency_block *a;
+	latency_block *b;
+	int            sampled = 0;
+
+	assert(latency_block_alloc() == NULL);
+	assert(latency_stats_init() == 0);
+	a = latency_block_alloc();
+	b = latency_block_alloc();
+	assert(a != NULL && b != NULL);
+	assert(latency_sample(NULL) == false);
+
+	for (int i = 0; i < NANO_LATENCY_SAMPLE * 2; i++) {
+		sampled += latency_sample(a);
+	}
+	assert(sampled == 2);
+
+	// 1000 fast samples on one worker, 10 slow ones on another
+	for (uint64_t ns = 1000; ns < 2000; ns++) {
+		latency_record(a, LATENCY_PUB, ns);
+	}
+	for (int i = 0; i < 10; i++) {
+		latency_record(b, LATENCY_PUB, 1000000);
+	}
+	latency_collect(hist);
+	assert(hist[LATENCY_PUB].count == 1010);
+	assert(hist[LATENCY_TOTAL].count == 0);
+
+	// bucket bounds stay within a quarter of the value
+	uint64_t p50 = latency_quantile(&hist[LATENCY_PUB], 0.5);
+	uint64_t p999 = latency_quantile(&hist[LATENCY_PUB], 0.999);
+	assert(p50 >= 1500 && p50 <= 1500 * 5 / 4);
+	assert(p999 >= 1000000 && p999 <= 1000000 * 5 / 4);
+	assert(latency_quantile(&hist[LATENCY_TOTAL], 0.5) == 0);
+
+	assert(latency_count_below(&hist[LATENCY_PUB], 10) == 24);
+	assert(latency_count_below(&hist[LATENCY_PUB], 11) == 1000);
+	assert(latency_count_below(&hist[LATENCY_PUB], 30) == 1010);
+
+	latency_stats_fini();
+	assert(latency_stats_enabled() == false);
+	return 0;
+}
@@ -0,0 +1,58 @@
+#include "include/match_cache.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include <assert.h>
+
+int main()
+{
+	uint32_t *pipes = NULL;
+	cvector_push_back(pipes, 1);
+	cvector_push_back(pipes, 2);
+
+	// disabled cache never hits and never takes ownership
+	assert(match_cache_enabled() == false);
+	assert(match_cache_get("a/b") == NULL);
+	assert(match_cache_put("a/b", 0, pipes, false) == NULL);
+
+	assert(match_cache_init(3) != 0);
+	assert(match_cache_init(16) == 0);
+	assert(match_cache_enabled());
+
+	assert(match_cache_get("a/b") == NULL);
+	assert(match_cache_misses() == 1);
+
+	uint64_t           gen   = match_cache_generation();
+	match_cache_entry *entry = match_cache_put("a/b", gen, pipes, true);
+	assert(entry != NULL);
+	assert(entry->pipes == pipes);
+	match_cache_release(entry);
+
+	entry = match_cache_get("a/b");
+	assert(entry != NULL);
+	assert(cvector_size(entry->pipes) == 2);
+	assert(entry->pipes[1] == 2);
+	assert(entry->has_shared);
+	assert(match_cache_hits() == 1);
+
+	// a sub/unsub makes the entry stale, borrowed entry stays valid
+	match_cache_invalidate();
+	assert(match_cache_generation() == gen + 1);
+	assert(match_cache_get("a/b") == NULL);
+	assert(entry->pipes[0] == 1);
+	match_cache_release(entry);
+
+	// entries of an older generation are never served
+	pipes = NULL;
+	cvector_push_back(pipes, 3);
+	entry = match_cache_put("a/c", gen, pipes, false);
+	assert(entry != NULL);
+	match_cache_release(entry);
+	assert(match_cache_get("a/c") == NULL);
+
+	assert(match_cache_hits() == 1);
+	assert(match_cache_misses() == 3);
+
+	match_cache_fini();
+	assert(match_cache_enabled() == false);
+
+	return 0;
+}
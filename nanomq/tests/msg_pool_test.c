@@ -0,0 +1,56 @@
+#include "include/msg_pool.h"
+#include <assert.h>
+
+int main()
+{
+	msg_pool_stats st;
+	msg_pool      *p;
+	nng_msg       *a;
+	nng_msg       *b;
+	nng_msg       *c;
+
+	assert(msg_pool_alloc() == NULL);
+	// without a pool it is plain allocation
+	assert(msg_pool_get(NULL, &a, 10) == 0 && nng_msg_len(a) == 0);
+	msg_pool_put(NULL, a);
+
+	assert(msg_pool_init() == 0);
+	p = msg_pool_alloc();
+	assert(p != NULL);
+
+	// put back, cleared, and handed out again
+	assert(msg_pool_get(p, &a, 0) == 0);
+	assert(nng_msg_append(a, "abc", 3) == 0);
+	msg_pool_put(p, a);
+	assert(msg_pool_get(p, &b, 100) == 0);
+	assert(b == a && nng_msg_len(b) == 0);
+
+	// a grown message lands in the class it fills
+	assert(nng_msg_realloc(b, 2000) == 0);
+	msg_pool_put(p, b);
+	assert(msg_pool_get(p, &c, 4096) == 0);
+	assert(c != b);
+	msg_pool_put(p, c);
+	assert(msg_pool_get(p, &a, 1024) == 0);
+	assert(a == b);
+	msg_pool_stats_get(&st);
+	assert(st.pools == 1 && st.hits == 2 && st.misses == 2);
+	assert(st.cached == 1);
+	msg_pool_put(p, a);
+
+	// full classes and huge messages are freed
+	for (int i = 0; i < NANO_MSG_POOL_CAP_256; i++) {
+		assert(msg_pool_get(NULL, &a, 0) == 0);
+		msg_pool_put(p, a);
+	}
+	assert(msg_pool_get(NULL, &a, 1 << 20) == 0);
+	assert(nng_msg_realloc(a, 1 << 20) == 0);
+	msg_pool_put(p, a);
+	msg_pool_stats_get(&st);
+	assert(st.drops == 3);
+	assert(st.cached == NANO_MSG_POOL_CAP_256);
+
+	msg_pool_fini();
+	assert(msg_pool_enabled() == false);
+	return 0;
+}
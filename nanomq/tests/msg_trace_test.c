@@ -0,0 +1,92 @@
+#include "include/msg_trace.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t sampled[] =
+    "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01";
+static const uint8_t unsampled[] =
+    "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-00";
+static const uint8_t zero_id[] =
+    "00-00000000000000000000000000000000-00f067aa0ba902b7-01";
+
+int main()
+{
+	msg_trace *t;
+	msg_trace *u;
+	uint32_t   seq = 0;
+	char       tp[TRACE_PARENT_LEN];
+	char       tp2[TRACE_PARENT_LEN];
+	int        n;
+
+	// no endpoint, no tracing
+	assert(msg_trace_init() == 0);
+	assert(msg_trace_enabled() == false);
+	assert(msg_trace_begin(&seq, "a", NULL, NULL, 1, "c", 0) == NULL);
+
+	// nothing listens there, the export only fails
+	setenv("NANOMQ_TRACE_OTLP", "http://127.0.0.1:1/v1/traces", 1);
+	setenv("NANOMQ_TRACE_SAMPLE", "4", 1);
+	setenv("NANOMQ_TRACE_TOPICS", "hot/#=2,cold/+=0", 1);
+	assert(msg_trace_init() == 0);
+	assert(msg_trace_enabled());
+
+	// one in four of the rest
+	n = 0;
+	for (int i = 0; i < 16; i++) {
+		if ((t = msg_trace_begin(&seq, "x/y", NULL, NULL, 1, "c", 1)) !=
+		    NULL) {
+			msg_trace_end(t);
+			n++;
+		}
+	}
+	assert(n == 4);
+	assert(seq == 16);
+
+	// the first matching filter has its own rate, not counted in seq
+	n = 0;
+	for (int i = 0; i < 16; i++) {
+		if ((t = msg_trace_begin(&seq, "hot/1", NULL, NULL, 1, "c", 0)) !=
+		    NULL) {
+			msg_trace_end(t);
+			n++;
+		}
+		assert(msg_trace_begin(&seq, "cold/1", NULL, NULL, 1, "c", 0) ==
+		    NULL);
+	}
+	assert(n == 8);
+	assert(seq == 16);
+
+	// the publisher decides, and its trace id is kept
+	t = msg_trace_begin(&seq, "cold/1", NULL, sampled, 1, "c", 2);
+	assert(t != NULL);
+	msg_trace_parent(t, tp);
+	assert(memcmp(tp, sampled, 36) == 0);
+	assert(memcmp(tp + 36, sampled + 36, 16) != 0);
+	assert(memcmp(tp + 52, "-01", 3) == 0);
+	assert(msg_trace_begin(&seq, "x/y", NULL, unsampled, 1, "c", 0) ==
+	    NULL);
+	assert(seq == 16);
+
+	// one that does not parse is no parent
+	seq = 0;
+	u   = msg_trace_begin(&seq, "x/y", NULL, zero_id, 1, NULL, 0);
+	assert(u != NULL && seq == 1);
+	msg_trace_parent(u, tp2);
+	assert(memcmp(tp2, "00-", 3) == 0);
+	assert(memcmp(tp2 + 3, zero_id + 3, 32) != 0);
+
+	// events beyond NANO_TRACE_EVENTS are dropped quietly
+	for (int i = 0; i < NANO_TRACE_EVENTS + 4; i++) {
+		msg_trace_event(t, TRACE_MATCH, i);
+	}
+	msg_trace_end(t);
+	msg_trace_end(u);
+
+	assert(strcmp(msg_trace_event_name(TRACE_ACL), "acl") == 0);
+	assert(strcmp(msg_trace_event_name(TRACE_EVENT_KINDS), "unknown") == 0);
+
+	msg_trace_fini();
+	assert(msg_trace_enabled() == false);
+	return 0;
+}
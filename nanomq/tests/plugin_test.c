@@ -0,0 +1,70 @@
+#include "include/plugin.h"
+#include <assert.h>
+
+static int seq[16];
+static int nseq;
+
+static int
+first(void *data)
+{
+	(void) data;
+	seq[nseq++] = 1;
+	return 0;
+}
+
+static int
+second(void *data)
+{
+	(void) data;
+	seq[nseq++] = 2;
+	return 0;
+}
+
+static int
+last(void *data)
+{
+	seq[nseq++] = 3;
+	return *(int *) data;
+}
+
+static int
+batch(void **data, size_t n)
+{
+	(void) data;
+	seq[nseq++] = 100 + (int) n;
+	return 0;
+}
+
+int
+main()
+{
+	int   zero    = 0;
+	int   one     = 1;
+	void *data[3] = { &zero, &zero, &zero };
+
+	assert(!plugin_hook_has(HOOK_ON_ROUTE));
+	assert(plugin_hook_call(HOOK_ON_ROUTE, &zero) == 0);
+	assert(plugin_hook_register(HOOK_ON_ROUTE, second) == 0);
+	assert(plugin_hook_register_ordered(HOOK_ON_ROUTE, -1, first) == 0);
+	assert(plugin_hook_register_batch(HOOK_ON_ROUTE, 0, batch) == 0);
+	assert(plugin_hook_register_ordered(HOOK_ON_ROUTE, 5, last) == 0);
+	assert(plugin_hook_register(HOOK_POINT_NUM, first) == NNG_EINVAL);
+	assert(plugin_hook_has(HOOK_ON_ROUTE));
+	assert(!plugin_hook_has(HOOK_ON_DELIVER));
+
+	// by order, then as registered, a batch hook getting a batch of one
+	assert(plugin_hook_call(HOOK_ON_ROUTE, &zero) == 0);
+	assert(nseq == 4 && seq[0] == 1 && seq[1] == 2 && seq[2] == 101 &&
+	    seq[3] == 3);
+
+	// plain hooks once per element
+	nseq = 0;
+	assert(plugin_hook_call_batch(HOOK_ON_ROUTE, data, 3) == 0);
+	assert(nseq == 10 && seq[3] == 2 && seq[6] == 103 && seq[9] == 3);
+
+	nseq = 0;
+	assert(plugin_hook_call(HOOK_ON_ROUTE, &one) == 1);
+	plugins_clear();
+	assert(!plugin_hook_has(HOOK_ON_ROUTE));
+	return 0;
+}
@@ -0,0 +1,45 @@
+#include "include/proc_stats.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+int main()
+{
+	proc_sample ps;
+	proc_sample history[NANO_PROC_STATS_HISTORY];
+	size_t      n;
+
+	// nothing is sampled while disabled
+	assert(proc_stats_enabled() == false);
+	assert(proc_stats_latest(&ps) == false);
+	assert(proc_stats_history(history, NANO_PROC_STATS_HISTORY) == 0);
+
+	assert(proc_stats_init(NULL, 20) == 0);
+	assert(proc_stats_enabled());
+	nng_msleep(200);
+
+	assert(proc_stats_latest(&ps));
+	n = proc_stats_history(history, NANO_PROC_STATS_HISTORY);
+	assert(n >= 2 && n <= NANO_PROC_STATS_HISTORY);
+	// oldest first, the last one is the latest
+	for (size_t i = 1; i < n; i++) {
+		assert(history[i - 1].time <= history[i].time);
+	}
+	assert(history[n - 1].time <= ps.time);
+	assert(proc_stats_history(history, 1) == 1);
+
+#if NANO_PLATFORM_LINUX
+	assert(ps.memory > 0);
+	assert(ps.threads >= 1);
+	assert(ps.fds >= 1);
+#endif
+
+	assert(proc_stats_max(&ps));
+	for (size_t i = 0; i < n; i++) {
+		assert(history[i].memory <= ps.memory);
+	}
+
+	proc_stats_fini();
+	assert(proc_stats_enabled() == false);
+	return 0;
+}
@@ -0,0 +1,89 @@
+#include "include/profiler.h"
+#include <assert.h>
+#include <string.h>
+
+static volatile bool   spin_stop = false;
+static volatile double spin_sink = 0;
+
+static void
+spin(void *arg)
+{
+	nng_mtx *mtx = arg;
+
+	while (!spin_stop) {
+		prof_lock(PROF_LOCK_RULE, mtx);
+		for (int i = 0; i < 10000; i++) {
+			spin_sink += i * 0.5;
+		}
+		nng_mtx_unlock(mtx);
+	}
+}
+
+int main()
+{
+	prof_counters before;
+	prof_counters after;
+	prof_block   *a;
+	prof_block   *b;
+	nng_mtx      *mtx;
+	nng_thread   *thr[2];
+	char         *folded;
+	size_t        len;
+	uint64_t      samples;
+	uint64_t      dropped;
+	int           rv;
+
+	assert(prof_block_alloc() == NULL);
+	assert(prof_run(1, 99, &folded, &len, NULL, NULL, NULL, NULL) ==
+	    NNG_ENOTSUP);
+	assert(prof_init() == 0);
+	a = prof_block_alloc();
+	b = prof_block_alloc();
+	assert(a != NULL && b != NULL);
+
+	// states of two workers add up
+	prof_state(a, 1);
+	prof_state(a, 1);
+	prof_state(b, 1);
+	prof_state(b, 5);
+	prof_state(b, PROF_STATES); // out of range, ignored
+	prof_collect(&before);
+	assert(before.states[1] == 3);
+	assert(before.states[5] == 1);
+	assert(strcmp(prof_state_name(1), "RECV") == 0);
+	assert(strcmp(prof_lock_name(PROF_LOCK_RULE), "rule") == 0);
+
+	assert(prof_run(0, 99, &folded, &len, NULL, NULL, NULL, NULL) ==
+	    NNG_EINVAL);
+	assert(prof_run(1, 0, &folded, &len, NULL, NULL, NULL, NULL) ==
+	    NNG_EINVAL);
+
+	assert(nng_mtx_alloc(&mtx) == 0);
+	assert(nng_thread_create(&thr[0], spin, mtx) == 0);
+	assert(nng_thread_create(&thr[1], spin, mtx) == 0);
+	rv = prof_run(1, 199, &folded, &len, &samples, &dropped, &before,
+	    &after);
+	spin_stop = true;
+	nng_thread_destroy(thr[0]);
+	nng_thread_destroy(thr[1]);
+
+	// two threads on one lock take it many times, and wait on it
+	assert(after.locks[PROF_LOCK_RULE].acquired >
+	    before.locks[PROF_LOCK_RULE].acquired);
+	assert(after.locks[PROF_LOCK_HASHMAP].acquired == 0);
+	if (rv == 0) {
+		// a busy second of CPU time gets its ticks
+		assert(samples > 0);
+		assert(len == strlen(folded));
+		assert(len > 0 && folded[len - 1] == '\n');
+		nng_strfree(folded);
+	} else {
+		// a platform without an unwinder
+		assert(rv == NNG_ENOTSUP);
+	}
+
+	nng_mtx_free(mtx);
+	prof_fini();
+	assert(prof_enabled() == false);
+	return 0;
+}
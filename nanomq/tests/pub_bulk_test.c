@@ -0,0 +1,76 @@
+#include "include/pub_bulk.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nng/nng.h"
+
+static size_t
+put_record(uint8_t *p, uint8_t flags, const char *topic, const char *payload)
+{
+	size_t tl = strlen(topic);
+	size_t pl = strlen(payload);
+
+	p[0] = flags;
+	p[1] = (uint8_t) (tl >> 8);
+	p[2] = (uint8_t) tl;
+	memcpy(p + 3, topic, tl);
+	p[3 + tl] = (uint8_t) (pl >> 24);
+	p[4 + tl] = (uint8_t) (pl >> 16);
+	p[5 + tl] = (uint8_t) (pl >> 8);
+	p[6 + tl] = (uint8_t) pl;
+	memcpy(p + 7 + tl, payload, pl);
+	return 7 + tl + pl;
+}
+
+int main()
+{
+	pub_bulk_reader r;
+	pub_bulk_record rec;
+	uint8_t         buf[256];
+	size_t          len = 0;
+
+	// NDJSON, blank and CRLF lines
+	const char *nd = "{\"a\":1}\r\n\n{\"b\":2}\n{\"c\":3}";
+	pub_bulk_reader_init(&r, PUB_BULK_NDJSON, nd, strlen(nd));
+	assert(pub_bulk_next(&r, &rec) == 0);
+	assert(rec.payload_len == 7 && memcmp(rec.payload, "{\"a\":1}", 7) == 0);
+	assert(pub_bulk_next(&r, &rec) == 0);
+	assert(rec.payload_len == 7 && memcmp(rec.payload, "{\"b\":2}", 7) == 0);
+	assert(pub_bulk_next(&r, &rec) == 0);
+	assert(rec.payload_len == 7 && memcmp(rec.payload, "{\"c\":3}", 7) == 0);
+	assert(pub_bulk_next(&r, &rec) == NNG_ENOENT);
+
+	pub_bulk_reader_init(&r, PUB_BULK_NDJSON, NULL, 10);
+	assert(pub_bulk_next(&r, &rec) == NNG_ENOENT);
+
+	// binary, a bad QoS is skipped, an empty payload is fine
+	len += put_record(buf + len, 0x01, "a/b", "hello");
+	len += put_record(buf + len, 0x03, "a/c", "x");
+	len += put_record(buf + len, 0x04, "d", "");
+	pub_bulk_reader_init(&r, PUB_BULK_BINARY, buf, len);
+	assert(pub_bulk_next(&r, &rec) == 0);
+	assert(rec.qos == 1 && rec.retain == false);
+	assert(rec.topic_len == 3 && memcmp(rec.topic, "a/b", 3) == 0);
+	assert(rec.payload_len == 5 && memcmp(rec.payload, "hello", 5) == 0);
+	assert(pub_bulk_next(&r, &rec) == NNG_EINVAL);
+	assert(pub_bulk_next(&r, &rec) == 0);
+	assert(rec.qos == 0 && rec.retain == true);
+	assert(rec.topic_len == 1 && rec.payload_len == 0);
+	assert(pub_bulk_next(&r, &rec) == NNG_ENOENT);
+
+	// empty topic
+	len = put_record(buf, 0, "", "p");
+	pub_bulk_reader_init(&r, PUB_BULK_BINARY, buf, len);
+	assert(pub_bulk_next(&r, &rec) == NNG_EINVAL);
+	assert(pub_bulk_next(&r, &rec) == NNG_ENOENT);
+
+	// truncated anywhere in the record
+	len = put_record(buf, 0, "topic", "payload");
+	for (size_t cut = 1; cut < len; cut++) {
+		pub_bulk_reader_init(&r, PUB_BULK_BINARY, buf, cut);
+		assert(pub_bulk_next(&r, &rec) == NNG_EPROTO);
+		assert(r.off == 0);
+	}
+	return 0;
+}
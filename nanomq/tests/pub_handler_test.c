@@ -3,6 +3,7 @@
 
 #include "include/nanomq.h"
 #include "include/pub_handler.h"
+#include "nng/supplemental/nanolib/cvector.h"
 
 void
 test_handler_pub()
@@ -12,6 +13,8 @@ test_handler_pub()
 	nano_work *work;
 	work            = nng_alloc(sizeof(*work));
 	work->config    = NULL;
+	work->arena     = NULL;
+	work->mpool     = NULL;
 	work->pipe_ct   = nng_alloc(sizeof(struct pipe_content));
 	work->proto_ver = MQTT_PROTOCOL_VERSION_v311;
 	dbtree_create(&work->db);
@@ -184,6 +187,34 @@ main()
 	assert(strcmp(dest_data, "data") == 0);
 
 
+	/* test for decode_pub_view() */
+	struct pub_packet_struct *view = nng_zalloc(sizeof(*view));
+	nng_msg_set_cmd_type(msg, CMD_PUBLISH);
+	work->msg        = msg;
+	work->pub_packet = view;
+	rv_rc = decode_pub_view(work, MQTT_PROTOCOL_VERSION_v311);
+	assert(rv_rc == SUCCESS);
+	assert(view->payload_owned == false);
+	assert(view->payload.data == (uint8_t *) nng_msg_body(msg) + 9);
+	assert(strcmp(view->payload.data, "data") == 0);
+	assert(strcmp(view->var_header.publish.topic_name.body, "$MQTT") == 0);
+
+	// unchanged publish is encoded in place without touching the body
+	rv_bool = encode_pub_message(msg, work, PUBLISH);
+	assert(rv_bool == true);
+	assert(nng_msg_len(msg) == 13);
+	assert(memcmp(nng_msg_body(msg), topic, topic_len) == 0);
+
+	// rewritten topic moves only the variable header
+	pub_packet_set_topic(view, nng_strdup("a/b/c/d"), 7);
+	rv_bool = encode_pub_message(msg, work, PUBLISH);
+	assert(rv_bool == true);
+	assert(nng_msg_len(msg) == 15);
+	assert(memcmp((uint8_t *) nng_msg_body(msg) + 2, "a/b/c/d", 7) == 0);
+	assert(view->payload.data == (uint8_t *) nng_msg_body(msg) + 11);
+	assert(strcmp(view->payload.data, "data") == 0);
+	free_pub_packet(view);
+
 	/* test for free_pub_packet() */
 	free_pub_packet(pub_packet);
 	free_pub_packet(tpcError_pub_packet);
@@ -192,8 +223,27 @@ main()
 	/* test for init_pipe_content() */
 	struct pipe_content *pipe_ct = nng_zalloc(sizeof(*pipe_ct));
 	init_pipe_content(pipe_ct);
-	assert(pipe_ct->msg_infos == NULL);
+	assert(pipe_ct->pipes == NULL);
+	assert(pipe_ct->shared_pipes == NULL);
+	assert(pipe_content_count(pipe_ct) == 0);
+	free_pipe_content(pipe_ct);
 
+	/* test for pipe_content_dedup(), by scan and by hash set */
+	uint32_t *pids = NULL;
+	cvector_push_back(pids, 5);
+	cvector_push_back(pids, 0);
+	cvector_push_back(pids, 7);
+	cvector_push_back(pids, 5);
+	cvector_push_back(pids, 7);
+	assert(pipe_content_dedup(pids, NULL) == 2);
+	assert(cvector_size(pids) == 2 && pids[0] == 5 && pids[1] == 7);
+	for (uint32_t i = 0; i < 4 * NANO_PIPE_DEDUP_LINEAR; i++) {
+		cvector_push_back(pids, i % NANO_PIPE_DEDUP_LINEAR + 1);
+	}
+	assert(pipe_content_dedup(pids, NULL) == NANO_PIPE_DEDUP_LINEAR);
+	assert(pids[0] == 5 && pids[1] == 7 && pids[2] == 1);
+	cvector_free(pids);
+	assert(pipe_content_dedup(NULL, NULL) == 0);
 
 	nng_free(pipe_ct,sizeof(*pipe_ct));
 	nng_free(dest_data, left_len);
@@ -0,0 +1,81 @@
+#include "include/pub_quota.h"
+#include "nng/supplemental/util/platform.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+int main()
+{
+	pub_quota_conf  c = { 0 };
+	pub_quota_stats st;
+	nng_duration    wait;
+	int             passed;
+
+	// every PUBLISH passes without a rate
+	assert(pub_quota_init(&c) == 0);
+	assert(pub_quota_enabled() == false);
+	assert(pub_quota_check(1, 100, 0, &wait) == PUB_QUOTA_PASS);
+
+	c.msg_rate  = 10;
+	c.byte_rate = 1000;
+	c.policy    = PUB_QUOTA_DROP;
+	c.delay_ms  = 1000;
+	assert(pub_quota_init(&c) == 0);
+	assert(pub_quota_enabled());
+
+	// pipes without buckets are not limited
+	assert(pub_quota_check(9, 100000, 0, &wait) == PUB_QUOTA_PASS);
+
+	// one second of rate at once, then QoS 0 drops and QoS 1 waits
+	pub_quota_open(1, NULL);
+	for (passed = 0; pub_quota_check(1, 10, 0, &wait) == PUB_QUOTA_PASS;
+	     passed++) {
+	}
+	assert(passed == 10);
+	assert(pub_quota_check(1, 10, 0, &wait) == PUB_QUOTA_DROPPED);
+	assert(pub_quota_check(1, 10, 1, &wait) == PUB_QUOTA_WAIT);
+	assert(wait > 0 && wait <= 1000);
+
+	// the byte bucket counts as well
+	pub_quota_open(2, NULL);
+	assert(pub_quota_check(2, 1000, 0, &wait) == PUB_QUOTA_PASS);
+	assert(pub_quota_check(2, 1, 0, &wait) == PUB_QUOTA_DROPPED);
+
+	// refilled at the rate
+	nng_msleep(250);
+	assert(pub_quota_check(2, 200, 0, &wait) == PUB_QUOTA_PASS);
+	pub_quota_stats_get(&st);
+	assert(st.violations[PUB_QUOTA_DROP] == 3);
+	assert(st.violations[PUB_QUOTA_DELAY] == 1);
+	assert(st.clients == 2 && st.users == 0);
+	pub_quota_close(1);
+	pub_quota_close(2);
+	pub_quota_fini();
+
+	// clients of one username share its buckets
+	memset(&c, 0, sizeof(c));
+	c.user_msg_rate = 4;
+	c.policy        = PUB_QUOTA_DISCONNECT;
+	assert(pub_quota_init(&c) == 0);
+	pub_quota_open(1, "dev");
+	pub_quota_open(2, "dev");
+	pub_quota_open(3, "other");
+	pub_quota_stats_get(&st);
+	assert(st.clients == 3 && st.users == 2);
+	for (int i = 0; i < 4; i++) {
+		assert(pub_quota_check(1 + i % 2, 1, 0, &wait) ==
+		    PUB_QUOTA_PASS);
+	}
+	assert(pub_quota_check(2, 1, 0, &wait) == PUB_QUOTA_CLOSE);
+	assert(pub_quota_check(3, 1, 0, &wait) == PUB_QUOTA_PASS);
+	pub_quota_close(1);
+	pub_quota_close(2);
+	pub_quota_stats_get(&st);
+	assert(st.clients == 1 && st.users == 1);
+	assert(st.violations[PUB_QUOTA_DISCONNECT] == 1);
+	assert(strcmp(pub_quota_policy_name(PUB_QUOTA_DELAY), "delay") == 0);
+
+	pub_quota_fini();
+	assert(pub_quota_enabled() == false);
+	return 0;
+}
@@ -0,0 +1,113 @@
+#include "include/retain_index.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include <assert.h>
+#include <string.h>
+
+static nng_msg *
+msg_new(void)
+{
+	nng_msg *m;
+
+	assert(nng_msg_alloc(&m, 0) == 0);
+	return m;
+}
+
+// all a cursor still finds, limit at a time
+static size_t
+drain(retain_cursor *c, nng_msg ***msgs, size_t limit)
+{
+	size_t n, total = 0;
+
+	while ((n = retain_index_next(c, msgs, limit)) > 0) {
+		assert(n <= limit);
+		total += n;
+	}
+	retain_index_close(c);
+	return total;
+}
+
+static void
+msgs_free(nng_msg **msgs)
+{
+	for (size_t i = 0; i < cvector_size(msgs); i++) {
+		nng_msg_free(msgs[i]);
+	}
+	cvector_free(msgs);
+}
+
+int
+main()
+{
+	const char *topics[] = { "site/b/state", "other", "site/b", "$SYS/x",
+		"sitex/c", "site/a/state" };
+	nng_msg           *m[6];
+	nng_msg           *again = msg_new();
+	nng_msg          **msgs  = NULL;
+	retain_cursor     *c;
+	retain_index_stats st;
+
+	assert(retain_index_put("a", again) == NNG_ECLOSED);
+	assert(retain_index_open("a/#") == NULL);
+	assert(retain_index_init() == 0);
+
+	for (int i = 0; i < 6; i++) {
+		m[i] = msg_new();
+		assert(retain_index_put(topics[i], m[i]) == 0);
+	}
+	// replaced, the index drops its reference to the old one
+	assert(retain_index_put("site/a/state", again) == 0);
+	retain_index_stats_get(&st);
+	assert(st.topics == 6);
+
+	// exact and shared filters are left to the retain tree
+	assert(retain_index_open("site/b") == NULL);
+	assert(retain_index_open("site/b+/x") == NULL);
+	assert(retain_index_open("$share/g/site/#") == NULL);
+
+	// the run below site, in level order, in chunks
+	c = retain_index_open("site/#");
+	assert(c != NULL);
+	assert(retain_index_next(c, &msgs, 2) == 2);
+	assert(msgs[0] == again && msgs[1] == m[2]);
+	assert(retain_index_next(c, &msgs, 2) == 1);
+	assert(msgs[2] == m[0]);
+	assert(retain_index_next(c, &msgs, 2) == 0);
+	retain_index_close(c);
+	msgs_free(msgs);
+	msgs = NULL;
+
+	// no $ topics for a leading wildcard
+	assert(drain(retain_index_open("#"), &msgs, 4) == 5);
+	for (size_t i = 0; i < cvector_size(msgs); i++) {
+		assert(msgs[i] != m[3]);
+	}
+	msgs_free(msgs);
+	msgs = NULL;
+	assert(drain(retain_index_open("$SYS/#"), &msgs, 4) == 1);
+	msgs_free(msgs);
+	msgs = NULL;
+	assert(drain(retain_index_open("+/b/+"), &msgs, 4) == 1);
+	assert(msgs[0] == m[0]);
+	msgs_free(msgs);
+	msgs = NULL;
+
+	// the cursor resumes behind the last topic it saw
+	c = retain_index_open("site/+/state");
+	assert(retain_index_next(c, &msgs, 1) == 1 && msgs[0] == again);
+	retain_index_remove("site/a/state");
+	retain_index_remove("site/b");
+	assert(drain(c, &msgs, 1) == 1 && msgs[1] == m[0]);
+	msgs_free(msgs);
+	msgs = NULL;
+
+	retain_index_stats_get(&st);
+	assert(st.topics == 4 && st.scans == 5 && st.matched == 12);
+
+	retain_index_fini();
+	assert(!retain_index_enabled());
+	for (int i = 0; i < 6; i++) {
+		nng_msg_free(m[i]);
+	}
+	nng_msg_free(again);
+	return 0;
+}
@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "include/retain_log.h"
+
+#define TEST_SEG_SIZE 4096
+
+typedef struct {
+	int  count;
+	char topic[64];
+	char body[512];
+	char head[4];
+} loaded;
+
+static void
+load_cb(void *arg, const retain_log_rec *rec)
+{
+	loaded *l = arg;
+
+	l->count++;
+	snprintf(l->topic, sizeof(l->topic), "%s", rec->topic);
+	assert(rec->head_len == 2);
+	memcpy(l->head, rec->head, rec->head_len);
+	assert(rec->body_len < sizeof(l->body));
+	memcpy(l->body, rec->body, rec->body_len);
+	l->body[rec->body_len] = '\0';
+	assert(rec->proto_ver == 4);
+	assert(rec->expiry == 0);
+}
+
+static void
+cleanup(const char *dir)
+{
+	DIR           *d;
+	struct dirent *ent;
+	char           path[512];
+
+	if ((d = opendir(dir)) == NULL) {
+		return;
+	}
+	while ((ent = readdir(d)) != NULL) {
+		if (ent->d_name[0] != '.') {
+			snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+			unlink(path);
+		}
+	}
+	closedir(d);
+	rmdir(dir);
+}
+
+int
+main()
+{
+	char    dir[64];
+	char    body[400];
+	uint8_t head[] = { 0x31, 0x07 };
+	loaded  l      = { 0 };
+
+	snprintf(dir, sizeof(dir), "/tmp/nanomq_retain_log_test_%d", getpid());
+	cleanup(dir);
+
+	assert(retain_log_put("a/b", 4, head, 2, "x", 1, 0) == NNG_ECLOSED);
+	assert(retain_log_open(dir, 100) == NNG_EINVAL);
+	assert(retain_log_open(dir, TEST_SEG_SIZE) == 0);
+	assert(retain_log_enabled());
+
+	assert(retain_log_put("a/b", 4, head, 2, "hello", 5, 0) == 0);
+	assert(retain_log_put("a/c", 4, head, 2, "other", 5, 0) == 0);
+	assert(retain_log_put("a/b", 4, head, 2, "world", 5, 0) == 0);
+	assert(retain_log_del("a/c") == 0);
+	assert(retain_log_del("a/none") == 0);
+	assert(retain_log_live_count() == 1);
+	assert(retain_log_dead_bytes() > 0);
+	// a record must fit in one segment
+	memset(body, 'x', sizeof(body));
+	assert(retain_log_put("big", 4, head, 2, body, TEST_SEG_SIZE, 0) ==
+	    NNG_EMSGSIZE);
+	retain_log_close();
+	assert(retain_log_enabled() == false);
+
+	// warm restart only sees the latest state
+	assert(retain_log_open(dir, TEST_SEG_SIZE) == 0);
+	assert(retain_log_live_count() == 1);
+	assert(retain_log_load(load_cb, &l) == 0);
+	assert(l.count == 1);
+	assert(strcmp(l.topic, "a/b") == 0);
+	assert(strcmp(l.body, "world") == 0);
+	assert(memcmp(l.head, head, 2) == 0);
+
+	// overwrites spill over segments until compaction drops the garbage
+	for (int i = 0; i < 64; i++) {
+		body[0] = 'a' + i % 26;
+		assert(retain_log_put("a/b", 4, head, 2, body, sizeof(body), 0) ==
+		    0);
+	}
+	assert(retain_log_live_count() == 1);
+	assert(retain_log_dead_bytes() <= TEST_SEG_SIZE);
+	retain_log_close();
+
+	memset(&l, 0, sizeof(l));
+	assert(retain_log_open(dir, TEST_SEG_SIZE) == 0);
+	assert(retain_log_load(load_cb, &l) == 0);
+	assert(l.count == 1);
+	assert(l.body[0] == 'a' + 63 % 26);
+	assert(strlen(l.body) == sizeof(body));
+	retain_log_close();
+
+	cleanup(dir);
+	return 0;
+}
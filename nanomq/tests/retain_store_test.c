@@ -0,0 +1,104 @@
+#include <assert.h>
+#include <string.h>
+
+#include "include/nanomq.h"
+#include "include/pub_handler.h"
+#include "include/retain_store.h"
+
+static nng_msg *reaped;
+
+static void
+reap(void *arg, const char *topic, nng_msg *msg)
+{
+	assert(arg == &reaped);
+	assert(strcmp(topic, "$MQTT") == 0);
+	reaped = msg;
+	retain_store_remove(msg);
+}
+
+int
+main()
+{
+	nng_msg *msg, *expired, *wire, *again;
+
+	// topic: $MQTT, packetid: 5, data: data
+	uint8_t body[] = { 0x00, 0x05, 0x24, 0x4D, 0x51, 0x54, 0x54, 0x00,
+		0x05, 0x64, 0x61, 0x74, 0x61 };
+	struct fixed_header fix_hd = { 0 };
+	fix_hd.qos                 = 1;
+	fix_hd.retain              = 1;
+	fix_hd.packet_type         = PUBLISH;
+
+	nng_msg_alloc(&msg, 0);
+	nng_msg_append(msg, body, sizeof(body));
+	nng_msg_set_remaining_len(msg, sizeof(body));
+	nng_msg_header_append(msg, &fix_hd, sizeof(fix_hd));
+	nng_mqtt_msg_proto_data_alloc(msg);
+	nng_mqtt_msg_set_connect_proto_version(
+	    msg, MQTT_PROTOCOL_VERSION_v311);
+	nng_msg_dup(&expired, msg);
+
+	// disabled store tracks nothing
+	assert(retain_store_add(msg, "$MQTT", 0) == NNG_ECLOSED);
+	assert(retain_store_wire(msg, MQTT_PROTOCOL_VERSION_v311, &wire) ==
+	    NNG_ENOENT);
+
+	assert(retain_store_init(100) == NNG_EINVAL);
+	assert(retain_store_init(16) == 0);
+	assert(retain_store_enabled());
+
+	assert(retain_store_add(msg, "$MQTT", 0) == 0);
+	assert(retain_store_count() == 1);
+	assert(retain_store_bytes() == 0);
+
+	// image is encoded once and shared afterwards
+	assert(retain_store_wire(msg, MQTT_PROTOCOL_VERSION_v311, &wire) == 0);
+	assert(nng_msg_len(wire) == sizeof(body));
+	assert(memcmp(nng_msg_body(wire), body, sizeof(body)) == 0);
+	assert(retain_store_bytes() ==
+	    nng_msg_header_len(wire) + nng_msg_len(wire));
+	assert(retain_store_wire(msg, MQTT_PROTOCOL_VERSION_v311, &again) == 0);
+	assert(again == wire);
+	nng_msg_free(again);
+
+	// images outlive the entry while referenced
+	retain_store_remove(msg);
+	assert(retain_store_count() == 0);
+	assert(retain_store_bytes() == 0);
+	assert(retain_store_wire(msg, MQTT_PROTOCOL_VERSION_v311, &again) ==
+	    NNG_ENOENT);
+	assert(memcmp(nng_msg_body(wire), body, sizeof(body)) == 0);
+	nng_msg_free(wire);
+
+	assert(retain_store_add(expired, "$MQTT", 1) == 0);
+	nng_msleep(1100);
+	assert(retain_store_wire(
+	           expired, MQTT_PROTOCOL_VERSION_v311, &wire) == NNG_ETIMEDOUT);
+	retain_store_remove(expired);
+
+	// with the wheel running the reaper takes expired msgs out
+	assert(expiry_wheel_init(10) == 0);
+	retain_store_reaper(reap, &reaped);
+	assert(retain_store_add(expired, "$MQTT", 1) == 0);
+	assert(expiry_wheel_count() == 1);
+	nng_msleep(1200);
+	assert(reaped == expired);
+	assert(retain_store_count() == 0);
+	assert(retain_store_expired() == 1);
+
+	// a removed msg is never reaped
+	reaped = NULL;
+	assert(retain_store_add(msg, "$MQTT", 1) == 0);
+	retain_store_remove(msg);
+	assert(expiry_wheel_count() == 0);
+	nng_msleep(1200);
+	assert(reaped == NULL);
+
+	retain_store_fini();
+	assert(retain_store_enabled() == false);
+	expiry_wheel_fini();
+
+	nng_msg_free(expired);
+	nng_msg_free(msg);
+	return 0;
+}
@@ -0,0 +1,135 @@
+#include "include/rule_filter.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/util/platform.h"
+#include <assert.h>
+#include <string.h>
+
+static int freed;
+
+static void
+count_free(void *arg)
+{
+	(void) arg;
+	freed++;
+}
+
+static void
+add_rule(conf_rule *cr, char *topic, uint32_t id, bool enabled)
+{
+	rule r = { 0 };
+
+	r.topic   = topic;
+	r.rule_id = id;
+	r.enabled = enabled;
+	cvector_push_back(cr->rules, r);
+}
+
+static void
+compile_cb(void *arg)
+{
+	rule_filter_lock();
+	assert(rule_filter_compile(arg) == 0);
+	rule_filter_unlock();
+}
+
+static bool
+match(nano_work *work, rule_view *v, size_t i)
+{
+	rule_doc doc;
+	bool     hit;
+
+	rule_doc_init(&doc, work->pub_packet);
+	hit = rule_filter_match(work, &doc, v, i);
+	rule_doc_fini(&doc);
+	return hit;
+}
+
+int
+main()
+{
+	conf_rule          cr = { 0 };
+	rule_view          v;
+	rule_filter_stats  st;
+	nano_work         *work;
+	pub_packet_struct *pp;
+	uint32_t           idx[NANO_RULE_MATCH_MAX];
+	nng_thread        *thr;
+
+	// no table yet, nothing to match
+	rule_filter_enter(&v, 0);
+	assert(v.count == 0 && v.rules == NULL);
+	rule_filter_leave(&v);
+
+	assert(rule_filter_init() == 0);
+	add_rule(&cr, "a/+", 1, true);
+	add_rule(&cr, "b/#", 2, true);
+	add_rule(&cr, "a/b", 3, false);
+	assert(rule_filter_compile(&cr) == 0);
+	assert(rule_filter_version() == 1);
+
+	work = nng_zalloc(sizeof(*work));
+	pp   = nng_zalloc(sizeof(*pp));
+	pp->var_header.publish.topic_name.body = "a/b";
+	pp->var_header.publish.topic_name.len  = 3;
+	work->pub_packet                       = pp;
+
+	// disabled rules are indexed, matching skips them
+	rule_filter_enter(&v, 3);
+	assert(v.count == 3 && v.version == 1);
+	assert(rule_filter_lookup(&v, "a/b", NULL, idx, NANO_RULE_MATCH_MAX) ==
+	    2);
+	assert(idx[0] == 0 && idx[1] == 2);
+	assert(match(work, &v, 0));
+	assert(!match(work, &v, 1));
+	assert(!match(work, &v, 2));
+	rule_filter_leave(&v);
+
+	assert(rule_filter_stat(1, &st) == 0);
+	assert(st.enabled && st.evals == 1 && st.hits == 1);
+	assert(rule_filter_stat(2, &st) == 0);
+	assert(st.evals == 1 && st.hits == 0);
+	assert(rule_filter_stat(3, &st) == 0);
+	assert(!st.enabled && st.evals == 0);
+	assert(rule_filter_stat(4, &st) == NNG_ENOENT);
+
+	// switched in place, no new version
+	assert(rule_filter_enable(3, true) == 0);
+	assert(rule_filter_enable(4, true) == NNG_ENOENT);
+	rule_filter_enter(&v, 3);
+	assert(v.version == 1);
+	assert(match(work, &v, 2));
+	rule_filter_leave(&v);
+
+	// the next version keeps the counters, frees wait for the readers
+	cr.rules[2].enabled = true;
+	cvector_erase(cr.rules, 1);
+	rule_filter_defer(count_free, NULL);
+	rule_filter_enter(&v, 5);
+	assert(nng_thread_create(&thr, compile_cb, &cr) == 0);
+	nng_msleep(50);
+	assert(freed == 0);
+	assert(v.version == 1 && v.count == 3);
+	assert(match(work, &v, 0));
+	rule_filter_leave(&v);
+	nng_thread_destroy(thr);
+	assert(freed == 1);
+	assert(rule_filter_version() == 2);
+
+	assert(rule_filter_stat(1, &st) == 0);
+	assert(st.evals == 2 && st.hits == 2);
+	assert(rule_filter_stat(3, &st) == 0);
+	assert(st.enabled && st.hits == 1);
+	assert(rule_filter_stat(2, &st) == NNG_ENOENT);
+
+	rule_filter_enter(&v, 5);
+	assert(v.version == 2 && v.count == 2);
+	assert(v.rules[1].rule_id == 3);
+	rule_filter_leave(&v);
+
+	nng_free(work->rule_vals, sizeof(rule_value) * work->rule_vals_cap);
+	nng_free(pp, sizeof(*pp));
+	nng_free(work, sizeof(*work));
+	rule_filter_fini();
+	cvector_free(cr.rules);
+	return 0;
+}
@@ -0,0 +1,154 @@
+#include <assert.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "include/session_spill.h"
+
+static char   got[64][16];
+static size_t ngot;
+
+static void
+replay(void *arg, const session_spill_rec *rec)
+{
+	assert(arg == got);
+	assert(rec->head_len == 2 && rec->head[0] == 0x32);
+	assert(rec->cmd == 0x30 && rec->proto_ver == 4);
+	memcpy(got[ngot], rec->body, rec->body_len);
+	got[ngot++][rec->body_len] = '\0';
+}
+
+static int
+put(uint32_t pipe, const char *payload)
+{
+	uint8_t           head[2] = { 0x32, (uint8_t) strlen(payload) };
+	session_spill_rec rec     = {
+		.cmd       = 0x30,
+		.proto_ver = 4,
+		.head      = head,
+		.head_len  = sizeof(head),
+		.body      = (const uint8_t *) payload,
+		.body_len  = strlen(payload),
+	};
+	return session_spill_put(pipe, &rec);
+}
+
+static size_t
+files(const char *dir)
+{
+	DIR           *d;
+	struct dirent *ent;
+	size_t         n = 0;
+
+	if ((d = opendir(dir)) == NULL) {
+		return 0;
+	}
+	while ((ent = readdir(d)) != NULL) {
+		n += ent->d_name[0] != '.';
+	}
+	closedir(d);
+	return n;
+}
+
+int
+main()
+{
+	char                dir[64];
+	char                payload[16];
+	session_spill_conf  c = {
+		.msgs    = 2,
+		.mem     = 1 << 20,
+		.disk    = 1 << 20,
+		.segment = 256,
+	};
+	session_spill_stats st;
+
+	snprintf(dir, sizeof(dir), "/tmp/nanomq_session_test_%d", getpid());
+
+	assert(put(1, "x") == NNG_ENOENT);
+	assert(session_spill_init(dir, &c) == 0);
+	assert(session_spill_enabled());
+
+	// online pipes are sent to as usual
+	assert(put(1, "x") == NNG_ENOENT);
+	assert(session_spill_online("a", replay, got) == 0);
+
+	// the latest two stay in memory, older ones go to disk
+	assert(session_spill_offline(1, "a") == 0);
+	for (int i = 0; i < 40; i++) {
+		snprintf(payload, sizeof(payload), "a%d", i);
+		assert(put(1, payload) == 0);
+	}
+	assert(put(2, "x") == NNG_ENOENT);
+	session_spill_stats_get(&st);
+	assert(st.sessions == 1 && st.queued == 40 && st.spilled == 38);
+	assert(st.segments > 1 && st.disk > 0);
+	assert(files(dir) == st.segments);
+
+	// replayed oldest first across segments, which are dropped
+	assert(session_spill_online("a", replay, got) == 40);
+	for (int i = 0; i < (int) ngot; i++) {
+		snprintf(payload, sizeof(payload), "a%d", i);
+		assert(strcmp(got[i], payload) == 0);
+	}
+	assert(put(1, "x") == NNG_ENOENT);
+	session_spill_stats_get(&st);
+	assert(st.sessions == 0 && st.mem == 0 && st.replayed == 40);
+	assert(st.segments <= 1);
+	session_spill_fini();
+	assert(files(dir) == 0);
+
+	// past the memory budget the least recently queued session spills
+	c.msgs = 8;
+	c.mem  = 100;
+	assert(session_spill_init(dir, &c) == 0);
+	assert(session_spill_offline(2, "b") == 0);
+	assert(session_spill_offline(3, "c") == 0);
+	assert(put(2, "b0") == 0 && put(2, "b1") == 0);
+	session_spill_stats_get(&st);
+	assert(st.spilled == 0);
+	assert(put(3, "c0") == 0 && put(3, "c1") == 0 && put(3, "c2") == 0);
+	session_spill_stats_get(&st);
+	assert(st.spilled == 2 && st.mem <= c.mem);
+	assert(put(2, "b2") == 0);
+
+	ngot = 0;
+	assert(session_spill_online("b", replay, got) == 3);
+	assert(strcmp(got[0], "b0") == 0 && strcmp(got[2], "b2") == 0);
+	ngot = 0;
+	assert(session_spill_online("c", replay, got) == 3);
+	assert(strcmp(got[0], "c0") == 0 && strcmp(got[2], "c2") == 0);
+
+	// a reconnect with a new pipe id moves the session along
+	assert(session_spill_offline(4, "d") == 0);
+	assert(put(4, "d0") == 0);
+	assert(session_spill_offline(5, "d") == 0);
+	assert(put(4, "x") == NNG_ENOENT);
+	assert(put(5, "d1") == 0);
+	session_spill_discard("d");
+	session_spill_stats_get(&st);
+	assert(st.sessions == 0 && st.dropped == 2);
+	session_spill_fini();
+
+	// spent disk drops the oldest, the newest are kept
+	c.msgs = 1;
+	c.mem  = 1 << 20;
+	c.disk = 2 * 40;
+	assert(session_spill_init(dir, &c) == 0);
+	assert(session_spill_offline(6, "e") == 0);
+	assert(put(6, "e0") == 0);
+	assert(put(6, "e1") == 0);
+	assert(put(6, "e2") == 0);
+	assert(put(6, "e3") == NNG_ENOSPC);
+	ngot = 0;
+	assert(session_spill_online("e", replay, got) == 3);
+	assert(strcmp(got[0], "e0") == 0 && strcmp(got[1], "e1") == 0 &&
+	    strcmp(got[2], "e3") == 0);
+	session_spill_fini();
+	assert(session_spill_enabled() == false);
+	rmdir(dir);
+
+	printf("session spill tests passed\n");
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include "include/expiry_wheel.h"
+#include "include/session_takeover.h"
+#include "nng/supplemental/util/platform.h"
+#include <assert.h>
+
+static uint32_t released[8];
+static int      nreleased;
+
+static void
+release(void *arg, uint32_t pipe)
+{
+	assert(arg == released);
+	released[nreleased++] = pipe;
+}
+
+int
+main()
+{
+	takeover_stats st;
+
+	assert(expiry_wheel_init(10) == 0);
+	assert(session_takeover_init(release, released) == 0);
+
+	// taken over while the old pipe is still open
+	assert(session_takeover_connect(1, "c", false) == 0);
+	assert(session_takeover_connect(2, "c", false) == 1);
+	assert(session_takeover_disconnect(1, 20) == TAKEOVER_HANDED);
+	// its pipe is forgotten once it went away
+	assert(session_takeover_disconnect(1, 20) == TAKEOVER_CLOSE);
+
+	// and again after the new one went away too
+	assert(session_takeover_disconnect(2, 1000) == TAKEOVER_PARKED);
+	assert(session_takeover_connect(5, "c", false) == 2);
+
+	// no linger ends the session with its pipe
+	assert(session_takeover_disconnect(5, 0) == TAKEOVER_CLOSE);
+	assert(session_takeover_connect(6, "c", false) == 0);
+	assert(session_takeover_disconnect(6, 0) == TAKEOVER_CLOSE);
+
+	// parked until nobody came back in time
+	assert(session_takeover_connect(7, "d", false) == 0);
+	assert(session_takeover_disconnect(7, 20) == TAKEOVER_PARKED);
+	for (int i = 0; i < 100 && nreleased == 0; i++) {
+		nng_msleep(10);
+	}
+	assert(nreleased == 1 && released[0] == 7);
+	assert(session_takeover_connect(12, "d", false) == 0);
+	assert(session_takeover_disconnect(12, 0) == TAKEOVER_CLOSE);
+
+	// a clean start ends a parked session at once
+	assert(session_takeover_connect(8, "e", false) == 0);
+	assert(session_takeover_disconnect(8, 1000) == TAKEOVER_PARKED);
+	assert(session_takeover_connect(9, "e", true) == 0);
+	assert(nreleased == 2 && released[1] == 8);
+
+	// an open one with its own disconnect
+	assert(session_takeover_connect(10, "f", false) == 0);
+	assert(session_takeover_connect(11, "f", true) == 0);
+	assert(session_takeover_disconnect(10, 1000) == TAKEOVER_CLOSE);
+	assert(session_takeover_disconnect(11, 0) == TAKEOVER_CLOSE);
+	assert(session_takeover_disconnect(9, 0) == TAKEOVER_CLOSE);
+
+	session_takeover_stats_get(&st);
+	assert(st.takeovers == 2 && st.parked == 3 && st.expired == 1);
+	assert(st.sessions == 0);
+
+	expiry_wheel_fini();
+	session_takeover_fini();
+	assert(!session_takeover_enabled());
+	return 0;
+}
@@ -0,0 +1,131 @@
+#include "include/share_group.h"
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MEMBERS 12
+
+static void
+count_cb(const share_group_info *info, void *arg)
+{
+	size_t *n = arg;
+
+	if (info->group_len == 1 && info->group[0] == 'g') {
+		assert(strcmp(info->filter, "a/#") == 0);
+		*n = info->nmembers;
+	}
+}
+
+// pick for a tree that always returns member 1 of group g
+static uint32_t
+pick(const char *clientid)
+{
+	uint32_t *pipes = NULL;
+	uint32_t  p;
+
+	cvector_push_back(pipes, 1);
+	share_group_pick("a/b", pipes, clientid);
+	p = pipes[0];
+	cvector_free(pipes);
+	return p;
+}
+
+int main()
+{
+	uint32_t       hits[MEMBERS + 1];
+	share_strategy s;
+	size_t         n = 0;
+
+	assert(share_strategy_parse("sticky", &s) == 0 && s == SHARE_STICKY);
+	assert(share_strategy_parse("nope", &s) == NNG_EINVAL);
+	assert(strcmp(share_strategy_name(SHARE_LOCAL_FIRST), "local_first") == 0);
+
+	// nothing is changed while disabled
+	assert(share_group_enabled() == false);
+	share_group_join("$share/g/a/#", 1, "c1", "127.0.0.1");
+	assert(pick(NULL) == 1);
+
+	assert(share_group_init() == 0);
+	assert(share_group_default_strategy() == NANO_SHARE_STRATEGY);
+
+	// plain filters are not groups
+	share_group_join("a/#", 1, "c1", NULL);
+	share_group_foreach(count_cb, &n);
+	assert(n == 0);
+
+	for (uint32_t i = 1; i <= MEMBERS; i++) {
+		char cid[16];
+		snprintf(cid, sizeof(cid), "c%u", i);
+		// odd members are on the loopback
+		share_group_join("$share/g/a/#", i, cid,
+		    i % 2 ? "127.0.0.1" : "10.0.0.2");
+	}
+	share_group_join("$share/g/a/#", 1, "c1", "127.0.0.1");
+	share_group_foreach(count_cb, &n);
+	assert(n == MEMBERS);
+
+	// round robin spreads evenly instead of loading the first member
+	memset(hits, 0, sizeof(hits));
+	for (int i = 0; i < MEMBERS * 10; i++) {
+		hits[pick(NULL)]++;
+	}
+	for (int i = 1; i <= MEMBERS; i++) {
+		assert(hits[i] == 10);
+	}
+
+	// sticky keeps a publisher on one member
+	assert(share_group_set_strategy("g", SHARE_STICKY) == 0);
+	uint32_t first = pick("publisher-7");
+	for (int i = 0; i < 50; i++) {
+		assert(pick("publisher-7") == first);
+	}
+
+	// local first only picks loopback members
+	assert(share_group_set_strategy("g", SHARE_LOCAL_FIRST) == 0);
+	for (int i = 0; i < 50; i++) {
+		assert(pick(NULL) % 2 == 1);
+	}
+
+	// random and least inflight stay in the group
+	assert(share_group_set_strategy("g", SHARE_RANDOM) == 0);
+	for (int i = 0; i < 50; i++) {
+		uint32_t p = pick(NULL);
+		assert(p >= 1 && p <= MEMBERS);
+	}
+	assert(share_group_set_strategy("g", SHARE_LEAST_INFLIGHT) == 0);
+	for (int i = 0; i < 50; i++) {
+		uint32_t p = pick(NULL);
+		assert(p >= 1 && p <= MEMBERS);
+	}
+
+	// a group strategy survives a new default
+	assert(share_group_set_strategy(NULL, SHARE_RANDOM) == 0);
+	assert(share_group_set_strategy("g", SHARE_STICKY) == 0);
+	assert(share_group_set_strategy(NULL, SHARE_ROUND_ROBIN) == 0);
+	first = pick("publisher-7");
+	assert(pick("publisher-7") == first);
+
+	// left members are never picked, the last one takes the group along
+	for (uint32_t i = 2; i <= MEMBERS; i++) {
+		share_group_leave("$share/g/a/#", i);
+	}
+	for (int i = 0; i < 10; i++) {
+		assert(pick("publisher-7") == 1);
+	}
+	share_group_leave("$share/g/a/#", 1);
+	n = 0;
+	share_group_foreach(count_cb, &n);
+	assert(n == 0);
+
+	// a name set ahead applies to groups made later
+	share_group_join("$share/g/a/#", 5, "c5", NULL);
+	share_group_join("$share/g/a/#", 6, "c6", NULL);
+	first = pick("publisher-7");
+	assert(pick("publisher-7") == first);
+
+	share_group_fini();
+	assert(share_group_enabled() == false);
+	return 0;
+}
@@ -0,0 +1,62 @@
+#include "include/startup.h"
+#include <assert.h>
+#include <string.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+static int
+slow_init(void *arg)
+{
+	nng_msleep(200);
+	return *(int *) arg;
+}
+
+int
+main()
+{
+	startup_stat st[STARTUP_SUBSYSTEMS];
+	int          ok   = 0;
+	int          fail = NNG_ECONNREFUSED;
+
+	// nothing gates before init, tasks run in place
+	assert(!startup_enabled() && startup_ready(STARTUP_RULES));
+	assert(startup_run(STARTUP_RULES, slow_init, &fail) == fail);
+
+	assert(startup_init() == 0 && startup_enabled());
+	assert(startup_ready(STARTUP_BRIDGE));
+	startup_begin(STARTUP_LISTENER);
+	assert(!startup_ready(STARTUP_LISTENER));
+
+	assert(startup_run(STARTUP_RULES, slow_init, &ok) == 0);
+	assert(startup_run(STARTUP_BRIDGE, slow_init, &fail) == 0);
+	assert(startup_run(STARTUP_RULES, slow_init, &ok) == NNG_EBUSY);
+	startup_done(STARTUP_LISTENER, 0);
+	assert(startup_ready(STARTUP_LISTENER));
+	assert(!startup_ready(STARTUP_RULES) && !startup_ready(STARTUP_BRIDGE));
+
+	startup_stats_get(st);
+	assert(strcmp(st[STARTUP_RULES].name, "rule_engine") == 0);
+	assert(st[STARTUP_RULES].state == STARTUP_PENDING);
+	assert(st[STARTUP_WEBHOOK].state == STARTUP_OFF);
+
+	// both come up side by side
+	nng_msleep(400);
+	assert(startup_ready(STARTUP_RULES) && !startup_ready(STARTUP_BRIDGE));
+	startup_stats_get(st);
+	assert(st[STARTUP_BRIDGE].state == STARTUP_FAILED);
+	assert(st[STARTUP_BRIDGE].rv == NNG_ECONNREFUSED);
+	assert(st[STARTUP_RULES].ready_ms >= 200);
+	assert(st[STARTUP_RULES].ready_ms < 400);
+	assert(st[STARTUP_BRIDGE].ready_ms < 400);
+
+	// done without a begin counts from then
+	startup_done(STARTUP_WEBHOOK, 0);
+	startup_stats_get(st);
+	assert(st[STARTUP_WEBHOOK].state == STARTUP_READY);
+	assert(st[STARTUP_WEBHOOK].ready_ms == st[STARTUP_WEBHOOK].begin_ms);
+
+	startup_fini();
+	assert(!startup_enabled() && startup_ready(STARTUP_BRIDGE));
+	return 0;
+}
@@ -118,6 +118,22 @@ main()
 	rv = sub_ctx_del(work->db, del_topic_2, work->pid.id);
 	assert(rv == 0);
 
+	/* test for sub_ctx_qos() */
+	// a pipe with both a QoS 0 and a QoS 1 filter gets each at its own
+	char any[] = "a/#", one[] = "a/b", shared[] = "$share/g/c/+";
+	dbhash_insert_topic(3, any, 0);
+	dbhash_insert_topic(3, one, 1);
+	dbhash_insert_topic(3, shared, 2);
+	assert(sub_ctx_qos(3, "a/b", 1) == 1);
+	assert(sub_ctx_qos(3, "a/b", 2) == 1);
+	assert(sub_ctx_qos(3, "a/c", 1) == 0);
+	assert(sub_ctx_qos(3, "a/b", 0) == 0);
+	assert(sub_ctx_qos(3, "c/d", 2) == 2);
+	assert(sub_ctx_qos(3, "d", 1) == 0);
+	dbhash_del_topic(3, any);
+	dbhash_del_topic(3, one);
+	dbhash_del_topic(3, shared);
+
 	/* test for free sub_pkt() */
 	sub_pkt_free(work->sub_pkt);
 
@@ -0,0 +1,102 @@
+#include "include/sub_queue.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static int  changes;
+static bool last_slow;
+
+static void
+slow(uint32_t pipe, const sub_queue_state *st, void *arg)
+{
+	(void) pipe;
+	(void) arg;
+	changes++;
+	last_slow = st->slow;
+}
+
+int main()
+{
+	sub_queue_conf  c = { 0 };
+	sub_queue_state st;
+	sub_queue_stats ss;
+
+	// nothing is limited without a limit
+	assert(sub_queue_init(&c, slow, NULL) == 0);
+	assert(sub_queue_enabled() == false);
+	assert(sub_queue_check(1, 0) == SUB_QUEUE_SEND);
+
+	c.msgs      = 4;
+	c.policy[2] = SUB_QUEUE_POLICIES;
+	assert(sub_queue_init(&c, slow, NULL) == NNG_EINVAL);
+	c.policy[0] = SUB_QUEUE_DROP_NEWEST;
+	c.policy[1] = SUB_QUEUE_DROP_NEWEST;
+	c.policy[2] = SUB_QUEUE_DISCONNECT;
+	assert(sub_queue_init(&c, slow, NULL) == 0);
+	assert(sub_queue_enabled());
+	sub_queue_open(1);
+	sub_queue_open(2);
+
+	// only unacknowledged QoS 1/2 messages count, and only for pipes
+	// that were granted more than QoS 0
+	for (int i = 0; i < 10; i++) {
+		sub_queue_sent(1, 0);
+		sub_queue_sent(1, 2);
+	}
+	assert(sub_queue_get(1, &st) && st.msgs == 0);
+	sub_queue_granted(1, 1);
+	sub_queue_granted(2, 2);
+	for (int i = 0; i < 5; i++) {
+		sub_queue_sent(1, i % 2 + 1);
+		sub_queue_sent(2, 1);
+	}
+	sub_queue_acked(2);
+	sub_queue_sample();
+	assert(changes == 1 && last_slow);
+	assert(sub_queue_get(1, &st) && st.slow && st.msgs == 5);
+	assert(st.since != 0);
+	assert(sub_queue_get(2, &st) && !st.slow && st.msgs == 4);
+	assert(sub_queue_check(1, 0) == SUB_QUEUE_SKIP);
+	assert(sub_queue_check(1, 1) == SUB_QUEUE_SKIP);
+	assert(sub_queue_check(1, 2) == SUB_QUEUE_CLOSE);
+	assert(sub_queue_check(2, 2) == SUB_QUEUE_SEND);
+	assert(sub_queue_check(3, 0) == SUB_QUEUE_SEND);
+
+	// it stays slow until it is below half
+	sub_queue_acked(1);
+	sub_queue_acked(1);
+	sub_queue_sample();
+	assert(changes == 1);
+	sub_queue_acked(1);
+	sub_queue_sample();
+	assert(changes == 2 && !last_slow);
+	assert(sub_queue_check(1, 0) == SUB_QUEUE_SEND);
+	assert(sub_queue_get(1, &st) && !st.slow && st.dropped == 3);
+
+	// acks beyond what was counted do not go below zero
+	for (int i = 0; i < 4; i++) {
+		sub_queue_acked(1);
+	}
+	assert(sub_queue_get(1, &st) && st.msgs == 0);
+
+	sub_queue_stats_get(&ss);
+	assert(ss.slow == 0 && ss.slow_events == 1);
+	assert(ss.dropped[SUB_QUEUE_DROP_NEWEST] == 2);
+	assert(ss.dropped[SUB_QUEUE_DISCONNECT] == 1);
+
+	// a slow pipe going away is no longer counted
+	sub_queue_sent(2, 1);
+	sub_queue_sample();
+	assert(changes == 3 && last_slow);
+	sub_queue_close(2);
+	sub_queue_stats_get(&ss);
+	assert(ss.slow == 0);
+	assert(sub_queue_get(2, &st) == false);
+	assert(strcmp(sub_queue_policy_name(SUB_QUEUE_DISCONNECT),
+	           "disconnect") == 0);
+
+	sub_queue_close(1);
+	sub_queue_fini();
+	assert(sub_queue_enabled() == false);
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include "include/sub_reap.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t
+subscribers(dbtree *db, char *topic)
+{
+	uint32_t *pipes = dbtree_find_clients(db, topic);
+	size_t    n     = cvector_size(pipes);
+
+	cvector_free(pipes);
+	return n;
+}
+
+int
+main()
+{
+	dbtree        *db;
+	sub_reap_stats st;
+	char           a[] = "a/b";
+	char           c[] = "c/d";
+
+	dbtree_create(&db);
+	assert(db != NULL);
+
+	// inline when asked, nothing is ever dead
+	setenv("NANOMQ_SUB_REAP", "0", 1);
+	assert(sub_reap_init(db, 4, 1000) == 0);
+	assert(!sub_reap_enabled());
+	assert(sub_reap_put(1, a) == NNG_ECLOSED);
+	assert(!sub_reap_dead(1));
+	unsetenv("NANOMQ_SUB_REAP");
+
+	assert(sub_reap_init(NULL, 4, 1000) == NNG_EINVAL);
+	assert(sub_reap_init(db, 4, 1000) == 0);
+	assert(sub_reap_enabled());
+
+	dbtree_insert_client(db, a, 1);
+	dbtree_insert_client(db, a, 2);
+	dbtree_insert_client(db, c, 1);
+	assert(subscribers(db, a) == 2);
+
+	// dead from the first filter queued until the last is removed
+	assert(sub_reap_put(1, c) == 0);
+	assert(sub_reap_put(1, a) == 0);
+	assert(sub_reap_dead(1));
+	assert(!sub_reap_dead(2));
+	sub_reap_sync();
+	assert(!sub_reap_dead(1));
+	assert(subscribers(db, a) == 1);
+	assert(subscribers(db, c) == 0);
+
+	sub_reap_stats_get(&st);
+	assert(st.removed == 2 && st.batches >= 1 && st.batch_max <= 2);
+	assert(st.queued == 0 && st.dead == 0);
+
+	// a full batch goes without lingering, the rest on fini
+	for (uint32_t p = 3; p <= 6; p++) {
+		dbtree_insert_client(db, p == 3 ? c : a, p);
+	}
+	for (uint32_t p = 2; p <= 6; p++) {
+		assert(sub_reap_put(p, p == 3 ? c : a) == 0);
+	}
+	sub_reap_fini();
+	assert(!sub_reap_enabled());
+	assert(!sub_reap_dead(3));
+	assert(subscribers(db, a) == 0);
+	assert(subscribers(db, c) == 0);
+
+	dbtree_destory(db);
+	return 0;
+}
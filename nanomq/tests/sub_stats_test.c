@@ -0,0 +1,70 @@
+#include "include/sub_stats.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+int main()
+{
+	sub_stats ss;
+
+	// nothing is counted while disabled
+	assert(sub_stats_enabled() == false);
+	sub_stats_subscribe("a/b");
+	sub_stats_connect(1, 4);
+	sub_stats_get(&ss);
+	assert(ss.topics == 0 && ss.subscriptions == 0 && ss.connections == 0);
+
+	assert(sub_stats_init() == 0);
+	assert(sub_stats_enabled());
+
+	// topics count distinct filters, subscriptions every subscriber
+	sub_stats_subscribe("a/b");
+	sub_stats_subscribe("a/b");
+	sub_stats_subscribe("a/#");
+	sub_stats_subscribe("$share/g/a/b");
+	sub_stats_get(&ss);
+	assert(ss.topics == 3 && ss.subscriptions == 4 && ss.shared == 1);
+
+	sub_stats_unsubscribe("a/b");
+	sub_stats_unsubscribe("$share/g/a/b");
+	sub_stats_unsubscribe("not/there");
+	sub_stats_get(&ss);
+	assert(ss.topics == 2 && ss.subscriptions == 2 && ss.shared == 0);
+	sub_stats_unsubscribe("a/b");
+	sub_stats_get(&ss);
+	assert(ss.topics == 1 && ss.subscriptions == 1);
+
+	// enough filters to grow the table
+	for (int i = 0; i < 5000; i++) {
+		char topic[16];
+		snprintf(topic, sizeof(topic), "t/%d", i);
+		sub_stats_subscribe(topic);
+	}
+	sub_stats_get(&ss);
+	assert(ss.topics == 5001);
+	for (int i = 0; i < 5000; i++) {
+		char topic[16];
+		snprintf(topic, sizeof(topic), "t/%d", i);
+		sub_stats_unsubscribe(topic);
+	}
+	sub_stats_get(&ss);
+	assert(ss.topics == 1 && ss.subscriptions == 1);
+
+	// a pipe counts once, from its CONNACK until its disconnect
+	sub_stats_connect(1, 4);
+	sub_stats_connect(1, 4);
+	sub_stats_connect(2, 5);
+	sub_stats_connect(3, 3);
+	sub_stats_disconnect(9);
+	sub_stats_get(&ss);
+	assert(ss.connections == 3);
+	assert(ss.conn_v31 == 1 && ss.conn_v311 == 1 && ss.conn_v5 == 1);
+	sub_stats_disconnect(1);
+	sub_stats_disconnect(1);
+	sub_stats_get(&ss);
+	assert(ss.connections == 2 && ss.conn_v311 == 0);
+
+	sub_stats_fini();
+	assert(sub_stats_enabled() == false);
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include "include/sys_stats.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int  ticks;
+static char topic[SYS_STATS_TOPIC_LEN];
+
+static void
+publish(void *arg, const sys_stats_msg *msgs, size_t n)
+{
+	assert(arg == &ticks);
+	assert(n >= 4);
+	ticks++;
+	strcpy(topic, msgs[0].topic);
+}
+
+int main()
+{
+	sys_stats_sample prev = { 0 };
+	sys_stats_sample cur  = { 0 };
+	sys_stats_msg    msgs[SYS_STATS_MSGS];
+	size_t           n;
+
+	prev.time             = 1000;
+	prev.msg_in           = 100;
+	prev.msg_out          = 500;
+	cur.time              = 3000;
+	cur.msg_in            = 300;
+	cur.msg_out           = 400; // counters went back
+	cur.msg_drop          = 7;
+	cur.subs.connections  = 3;
+	cur.subs.conn_v5      = 2;
+	cur.subs.conn_v311    = 1;
+	cur.subs.subscriptions = 5;
+	cur.subs.topics       = 4;
+	cur.bridge_queue_depth = 12;
+	cur.slow_subscribers  = 1;
+
+	// no latency without the histograms
+	n = sys_stats_compose("edge-1", &prev, &cur, msgs, SYS_STATS_MSGS);
+	assert(n == 4);
+	assert(strcmp(msgs[0].topic, "$SYS/brokers/edge-1/messages") == 0);
+	assert(strstr(msgs[0].payload, "\"received\":300,") != NULL);
+	assert(strstr(msgs[0].payload, "\"received_rate\":100.00,") != NULL);
+	assert(strstr(msgs[0].payload, "\"sent_rate\":0.00,") != NULL);
+	assert(strstr(msgs[0].payload, "\"dropped_rate\":3.50}") != NULL);
+	assert(strcmp(msgs[1].topic, "$SYS/brokers/edge-1/connections") == 0);
+	assert(strcmp(msgs[1].payload,
+	           "{\"count\":3,\"v31\":0,\"v311\":1,\"v5\":2}") == 0);
+	assert(strcmp(msgs[2].topic, "$SYS/brokers/edge-1/subscriptions") == 0);
+	assert(strcmp(msgs[2].payload,
+	           "{\"count\":5,\"topics\":4,\"shared\":0}") == 0);
+	assert(strcmp(msgs[3].topic, "$SYS/brokers/edge-1/queues") == 0);
+	assert(strstr(msgs[3].payload, "\"bridge\":12,") != NULL);
+	assert(strstr(msgs[3].payload, "\"slow_subscribers\":1,") != NULL);
+
+	// the first sample has no rates
+	n = sys_stats_compose("edge-1", NULL, &cur, msgs, SYS_STATS_MSGS);
+	assert(n == 4);
+	assert(strstr(msgs[0].payload, "\"received_rate\":0.00,") != NULL);
+
+	cur.latency          = true;
+	cur.stages[0].count  = 10;
+	cur.stages[0].p50    = 1500;
+	cur.stages[0].p99    = 20000;
+	cur.stages[0].p999   = 40000;
+	n = sys_stats_compose("edge-1", &prev, &cur, msgs, SYS_STATS_MSGS);
+	assert(n == 5);
+	assert(strcmp(msgs[4].topic, "$SYS/brokers/edge-1/latency") == 0);
+	assert(msgs[4].payload[0] == '{');
+	assert(msgs[4].payload[strlen(msgs[4].payload) - 1] == '}');
+	assert(strstr(msgs[4].payload,
+	           "{\"count\":10,\"p50\":1.5,\"p99\":20.0,\"p999\":40.0}") !=
+	    NULL);
+
+	// cap is kept to, node names too long for a topic are skipped
+	assert(sys_stats_compose("edge-1", &prev, &cur, msgs, 2) == 2);
+	char long_node[SYS_STATS_TOPIC_LEN];
+	memset(long_node, 'n', sizeof(long_node) - 1);
+	long_node[sizeof(long_node) - 1] = '\0';
+	assert(sys_stats_compose(long_node, &prev, &cur, msgs, 5) == 0);
+
+	// off with an interval of 0
+	setenv("NANOMQ_SYS_INTERVAL", "0", 1);
+	assert(sys_stats_init(publish, &ticks) == 0);
+	assert(sys_stats_enabled() == false);
+
+	// wildcards and levels in the node name are replaced
+	setenv("NANOMQ_SYS_INTERVAL", "50", 1);
+	setenv("NANOMQ_SYS_NODE", "a/b+#", 1);
+	assert(sys_stats_init(publish, &ticks) == 0);
+	assert(sys_stats_enabled());
+	nng_msleep(280);
+	sys_stats_fini();
+	assert(sys_stats_enabled() == false);
+	assert(ticks >= 3);
+	assert(strcmp(topic, "$SYS/brokers/a_b__/messages") == 0);
+	n = ticks;
+	nng_msleep(100);
+	assert(ticks == (int) n);
+	return 0;
+}
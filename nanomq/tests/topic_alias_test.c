@@ -0,0 +1,124 @@
+#include "include/topic_alias.h"
+#include "nng/nng.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+int main()
+{
+	char   buf[64];
+	char   long_topic[200];
+	size_t len;
+
+	// nothing is kept while disabled
+	assert(topic_alias_enabled() == false);
+	assert(topic_alias_set(1, 1, "a/b", 3) == NNG_ECLOSED);
+	assert(topic_alias_get(1, 1, buf, sizeof(buf), &len) == NNG_ENOENT);
+
+	assert(topic_alias_init() == 0);
+	assert(topic_alias_enabled());
+
+	// alias 0 is not allowed by the spec
+	assert(topic_alias_set(1, 0, "a/b", 3) == NNG_EINVAL);
+
+	assert(topic_alias_set(1, 1, "a/b", 3) == 0);
+	assert(topic_alias_get(1, 1, buf, sizeof(buf), &len) == 0);
+	assert(len == 3 && strcmp(buf, "a/b") == 0);
+
+	// aliases are per pipe
+	assert(topic_alias_get(2, 1, buf, sizeof(buf), &len) == NNG_ENOENT);
+	assert(topic_alias_set(2, 1, "c/d", 3) == 0);
+	assert(topic_alias_get(1, 1, buf, sizeof(buf), &len) == 0);
+	assert(strcmp(buf, "a/b") == 0);
+
+	// redefined in place, and a large alias grows the table
+	assert(topic_alias_set(1, 1, "x/y/z", 5) == 0);
+	assert(topic_alias_get(1, 1, buf, sizeof(buf), &len) == 0);
+	assert(len == 5 && strcmp(buf, "x/y/z") == 0);
+	assert(topic_alias_set(1, 65535, "last", 4) == 0);
+	assert(topic_alias_get(1, 65535, buf, sizeof(buf), &len) == 0);
+	assert(strcmp(buf, "last") == 0);
+	assert(topic_alias_get(1, 1, buf, sizeof(buf), &len) == 0);
+	assert(strcmp(buf, "x/y/z") == 0);
+	assert(topic_alias_get(1, 200, buf, sizeof(buf), &len) == NNG_ENOENT);
+
+	// a short buffer reports the length needed
+	memset(long_topic, 't', sizeof(long_topic) - 1);
+	long_topic[sizeof(long_topic) - 1] = '\0';
+	assert(topic_alias_set(1, 7, long_topic, sizeof(long_topic) - 1) == 0);
+	assert(topic_alias_get(1, 7, buf, sizeof(buf), &len) == NNG_ENOSPC);
+	assert(len == sizeof(long_topic) - 1);
+
+	// released with the pipe
+	topic_alias_release(1);
+	topic_alias_release(1);
+	assert(topic_alias_get(1, 1, buf, sizeof(buf), &len) == NNG_ENOENT);
+	assert(topic_alias_get(2, 1, buf, sizeof(buf), &len) == 0);
+
+	// outbound aliases only for pipes that granted some
+	uint16_t alias, first;
+	uint32_t stamp, stale;
+	bool     known;
+	assert(topic_alias_out_begin(3, "site/area/line/robot", 20, &alias,
+	           &known, &stamp) == NNG_ENOENT);
+	assert(topic_alias_out_open(3, 0) == NNG_EINVAL);
+	assert(topic_alias_out_open(3, 2) == 0);
+	assert(topic_alias_out_begin(
+	           3, "a/b", 3, &alias, &known, &stamp) == NNG_ENOENT);
+
+	// defined again until a send of it went out
+	assert(topic_alias_out_begin(3, "site/area/line/robot", 20, &first,
+	           &known, &stale) == 0);
+	topic_alias_out_end(3, first, true);
+	assert(known == false && first == 1);
+	assert(topic_alias_out_begin(3, "site/area/line/robot", 20, &alias,
+	           &known, &stamp) == 0);
+	topic_alias_out_end(3, alias, true);
+	assert(known == false && alias == first && stamp == stale);
+	topic_alias_out_known(3, alias, stamp);
+	assert(topic_alias_out_begin(3, "site/area/line/robot", 20, &alias,
+	           &known, &stamp) == 0);
+	topic_alias_out_end(3, alias, true);
+	assert(known && alias == first);
+
+	// the least recently used alias is the one to go
+	assert(topic_alias_out_begin(3, "site/area/line/joint", 20, &alias,
+	           &known, &stale) == 0);
+	topic_alias_out_end(3, alias, true);
+	assert(known == false && alias == 2);
+	assert(topic_alias_out_begin(3, "site/area/line/robot", 20, &alias,
+	           &known, &stamp) == 0);
+	topic_alias_out_end(3, alias, true);
+	assert(known && alias == first);
+	assert(topic_alias_out_begin(3, "site/area/line/torque", 21, &alias,
+	           &known, &stamp) == 0);
+	topic_alias_out_end(3, alias, true);
+	assert(known == false && alias == 2 && stamp != stale);
+	// a send of the topic it had before tells nothing of the new one
+	topic_alias_out_known(3, alias, stale);
+	assert(topic_alias_out_begin(3, "site/area/line/torque", 21, &alias,
+	           &known, &stamp) == 0);
+	topic_alias_out_end(3, alias, true);
+	assert(known == false && alias == 2);
+	assert(topic_alias_out_begin(3, "site/area/line/joint", 20, &alias,
+	           &known, &stamp) == 0);
+	topic_alias_out_end(3, alias, true);
+	assert(known == false && alias == first);
+
+	// an alias that was never sent is not used again
+	assert(topic_alias_out_begin(3, "site/area/line/speed", 20, &alias,
+	           &known, &stamp) == 0);
+	topic_alias_out_end(3, alias, false);
+	assert(known == false);
+	assert(topic_alias_out_begin(3, "site/area/line/speed", 20, &alias,
+	           &known, &stamp) == 0);
+	topic_alias_out_end(3, alias, true);
+	assert(known == false);
+
+	// the inbound and outbound sides of a pipe are apart
+	assert(topic_alias_get(3, 1, buf, sizeof(buf), &len) == NNG_ENOENT);
+
+	topic_alias_fini();
+	assert(topic_alias_enabled() == false);
+	return 0;
+}
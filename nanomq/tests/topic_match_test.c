@@ -0,0 +1,76 @@
+#include "include/topic_match.h"
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include <assert.h>
+#include <string.h>
+
+static bool
+pattern_match(const char *filter, const char *topic)
+{
+	topic_pattern *p;
+	topic_levels   tl;
+	bool           rv;
+
+	assert(topic_pattern_compile(filter, &p) == 0);
+	topic_split(topic, strlen(topic), &tl);
+	rv = topic_pattern_match(p, topic, &tl);
+	topic_pattern_free(p);
+	return rv;
+}
+
+int main()
+{
+	topic_filter_set *s;
+	topic_pattern    *p;
+	uint32_t         *ids = NULL;
+	uint32_t          id;
+
+	assert(pattern_match("a/b", "a/b"));
+	assert(!pattern_match("a/b", "a/b/c"));
+	assert(!pattern_match("a/b", "a/c"));
+	assert(pattern_match("a/+/c", "a/b/c"));
+	assert(pattern_match("a/+", "a/"));
+	assert(!pattern_match("a/+", "a"));
+	assert(pattern_match("a/#", "a"));
+	assert(pattern_match("a/#", "a/b/c"));
+	assert(!pattern_match("a/#", "b"));
+	assert(pattern_match("#", "x/y"));
+	assert(pattern_match("a+/b", "a+/b"));
+	assert(topic_pattern_compile("a/#/b", &p) == NNG_EINVAL);
+
+	assert(topic_filter_set_alloc(&s) == 0);
+	assert(topic_filter_set_add(s, "a/#", 4) == 0);
+	assert(topic_filter_set_add(s, "a/+", 1) == 0);
+	assert(topic_filter_set_add(s, "a/b", 3) == 0);
+	assert(topic_filter_set_add(s, "x/y", 0) == 0);
+	assert(topic_filter_set_add(s, "#", 7) == 0);
+	assert(topic_filter_set_add(s, "+/b/#", 2) == 0);
+	assert(topic_filter_set_add(s, "#/b", 9) == NNG_EINVAL);
+	assert(topic_filter_set_count(s) == 6);
+
+	// every match, ascending
+	assert(topic_filter_set_match(s, "a/b", NULL, &ids) == 5);
+	assert(ids[0] == 1 && ids[1] == 2 && ids[2] == 3 && ids[3] == 4 &&
+	    ids[4] == 7);
+	cvector_clear(ids);
+	assert(topic_filter_set_match(s, "a", NULL, &ids) == 2);
+	assert(ids[0] == 4 && ids[1] == 7);
+	cvector_clear(ids);
+
+	// with the levels of the topic already at hand
+	topic_levels tl;
+	assert(topic_scan("x/y", 3, &tl) == 0);
+	assert(topic_filter_set_match(s, "x/y", &tl, &ids) == 2);
+	assert(ids[0] == 0 && ids[1] == 7);
+	cvector_free(ids);
+
+	assert(topic_filter_set_first(s, "q/b/z", NULL, &id) && id == 2);
+	assert(topic_filter_set_first(s, "x/y", &tl, &id) && id == 0);
+	topic_filter_set_free(s);
+
+	assert(topic_filter_set_alloc(&s) == 0);
+	assert(topic_filter_set_add(s, "a", 0) == 0);
+	assert(!topic_filter_set_first(s, "b", NULL, &id));
+	topic_filter_set_free(s);
+	return 0;
+}
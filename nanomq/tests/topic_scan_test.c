@@ -0,0 +1,70 @@
+#include "include/topic_scan.h"
+#include "nng/nng.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static int
+scan(const char *s, topic_levels *tl)
+{
+	return topic_scan(s, strlen(s), tl);
+}
+
+static void
+level_is(const topic_levels *tl, const char *t, uint32_t i, const char *want)
+{
+	size_t      len;
+	const char *p = topic_level(tl, t, i, &len);
+
+	assert(len == strlen(want) && memcmp(p, want, len) == 0);
+}
+
+int main()
+{
+	topic_levels tl;
+	topic_levels sp;
+	char         deep[512];
+	const char  *t;
+	size_t       n = 0;
+
+	// levels on both sides of the 16 byte chunks
+	t = "sensor/building-1/floor-02/room/temperature/";
+	assert(scan(t, &tl) == 0 && tl.n == 6);
+	level_is(&tl, t, 0, "sensor");
+	level_is(&tl, t, 4, "temperature");
+	level_is(&tl, t, 5, "");
+	topic_split(t, strlen(t), &sp);
+	assert(sp.n == tl.n && memcmp(sp.end, tl.end, 6 * sizeof(uint32_t)) == 0);
+
+	assert(topic_scan("", 0, &tl) == 0 && tl.n == 1);
+	level_is(&tl, "", 0, "");
+	assert(scan("/", &tl) == 0 && tl.n == 2);
+
+	// UTF-8 in and out of a chunk
+	t = "caf\xc3\xa9/\xe6\xb8\xa9\xe5\xba\xa6/0123456789abcdef\xf0\x9f\x98\x80";
+	assert(scan(t, &tl) == 0 && tl.n == 3);
+	level_is(&tl, t, 1, "\xe6\xb8\xa9\xe5\xba\xa6");
+
+	// wildcards, NUL, controls, overlong, surrogate, truncated
+	assert(scan("0123456789abcdef/a+b", &tl) == NNG_EINVAL);
+	assert(scan("0123456789abcde#", &tl) == NNG_EINVAL);
+	assert(topic_scan("0123456789\0abcdefgh", 19, &tl) == NNG_EINVAL);
+	assert(scan("a/\x01/b", &tl) == NNG_EINVAL);
+	assert(scan("a/\x7f/0123456789abcdef", &tl) == NNG_EINVAL);
+	assert(scan("\xc0\xaf", &tl) == NNG_EINVAL);
+	assert(scan("\xe0\x80\xaf", &tl) == NNG_EINVAL);
+	assert(scan("\xed\xa0\x80", &tl) == NNG_EINVAL);
+	assert(scan("0123456789abcde\xc3", &tl) == NNG_EINVAL);
+	assert(scan("\xf5\x80\x80\x80", &tl) == NNG_EINVAL);
+
+	// levels past the recorded ones are found again
+	for (int i = 0; i < NANO_TOPIC_LEVELS + 8; i++) {
+		n += (size_t) snprintf(deep + n, sizeof(deep) - n, "%s%d",
+		    i > 0 ? "/" : "", i);
+	}
+	assert(scan(deep, &tl) == 0 && tl.n == NANO_TOPIC_LEVELS + 8);
+	level_is(&tl, deep, NANO_TOPIC_LEVELS - 1, "31");
+	level_is(&tl, deep, NANO_TOPIC_LEVELS, "32");
+	level_is(&tl, deep, NANO_TOPIC_LEVELS + 7, "39");
+	return 0;
+}
@@ -0,0 +1,48 @@
+#include "include/traffic_stats.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+int main()
+{
+	traffic_client  tc;
+	traffic_topic   top[4];
+	traffic_topics *tt;
+
+	// nothing is counted while disabled
+	assert(traffic_stats_enabled() == false);
+	assert(traffic_topics_alloc() == NULL);
+	traffic_client_open(1);
+	assert(traffic_client_get(1, &tc) == false);
+
+	assert(traffic_stats_init() == 0);
+	assert(traffic_stats_enabled());
+
+	// pipes count from their CONNACK until the disconnect event
+	traffic_client_in(1, 10);
+	assert(traffic_client_get(1, &tc) == false);
+	traffic_client_open(1);
+	traffic_client_in(1, 10);
+	traffic_client_out(1, 20);
+	traffic_client_out(1, 20);
+	assert(traffic_client_get(1, &tc));
+	assert(tc.msg_in == 1 && tc.bytes_in == 10);
+	assert(tc.msg_out == 2 && tc.bytes_out == 40);
+	traffic_client_close(1);
+	assert(traffic_client_get(1, &tc) == false);
+
+	// more topics than slots, rates show once the window is over
+	tt = traffic_topics_alloc();
+	assert(tt != NULL);
+	for (int i = 0; i < NANO_TRAFFIC_TOPICS * 4; i++) {
+		char topic[16];
+		snprintf(topic, sizeof(topic), "t/%d", i);
+		traffic_topic_add(tt, topic, strlen(topic), 1);
+		traffic_topic_add(tt, "hot", strlen("hot"), 1);
+	}
+	assert(traffic_topic_top(top, 4) <= 4);
+
+	traffic_stats_fini();
+	assert(traffic_stats_enabled() == false);
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include "include/transform.h"
+#include "nng/supplemental/util/platform.h"
+#include <assert.h>
+#include <stdlib.h>
+
+static nng_atomic_int *ran;
+
+static void
+spin(void *arg)
+{
+	volatile uint64_t x = 0;
+
+	for (int i = 0; i < 100000; i++) {
+		x += (uint64_t) i;
+	}
+	nng_atomic_inc(ran);
+	nng_free(arg, 1);
+}
+
+static void
+block(void *arg)
+{
+	nng_mtx *mtx = arg;
+
+	nng_mtx_lock(mtx);
+	nng_mtx_unlock(mtx);
+	nng_atomic_inc(ran);
+}
+
+int
+main()
+{
+	transform_stats st;
+	nng_mtx        *gate;
+	uint64_t        since;
+	int             queued = 0;
+	int             full   = 0;
+
+	assert(nng_atomic_alloc(&ran) == 0);
+	assert(nng_mtx_alloc(&gate) == 0);
+
+	// nothing to hand over to before init
+	assert(transform_submit(TRANSFORM_WEBHOOK, spin, NULL) == NNG_ECLOSED);
+	assert(transform_init(1, 0, 8) == NNG_EINVAL);
+	assert(transform_init(1, 4, NANO_TRANSFORM_BATCH + 1) == NNG_EINVAL);
+	assert(transform_init(0, 4, 8) == 0 && !transform_enabled());
+
+	setenv("NANOMQ_TRANSFORM", "0", 1);
+	assert(transform_init(1, 4, 8) == 0 && !transform_enabled());
+	unsetenv("NANOMQ_TRANSFORM");
+	assert(transform_init(1, 4, 2) == 0 && transform_enabled());
+
+	// the one thread is held up, the queue fills and refuses
+	nng_mtx_lock(gate);
+	assert(transform_submit(TRANSFORM_RULE_SQL, block, gate) == 0);
+	while (queued + full < 16) {
+		void *p = nng_alloc(1);
+
+		if (transform_submit(TRANSFORM_WEBHOOK, spin, p) == 0) {
+			queued++;
+		} else {
+			// the caller runs it itself then
+			transform_run(TRANSFORM_WEBHOOK, spin, p);
+			full++;
+		}
+	}
+	assert(queued >= 3 && queued <= 5 && full > 0);
+	nng_mtx_unlock(gate);
+
+	since = transform_cpu_now();
+	spin(nng_alloc(1));
+	transform_account(TRANSFORM_RULE_JSON, since);
+
+	// the thread catches up once let go
+	transform_stats_get(TRANSFORM_WEBHOOK, &st);
+	assert(st.inlined == (uint64_t) full && st.overflow == (uint64_t) full);
+	assert(st.depth_max == 4 && st.depth <= 4);
+	transform_stats_get(TRANSFORM_RULE_JSON, &st);
+	assert(st.inlined == 1 && st.offloaded == 0 && st.cpu_ns > 0);
+	st.offloaded = 0;
+
+	for (int i = 0; i < 200 && st.offloaded < (uint64_t) queued; i++) {
+		nng_msleep(10);
+		transform_stats_get(TRANSFORM_WEBHOOK, &st);
+	}
+	assert(nng_atomic_get(ran) == 18);
+	assert(st.offloaded == (uint64_t) queued && st.cpu_ns > 0);
+	assert(st.depth == 0 && st.batches >= 3);
+	transform_stats_get(TRANSFORM_RULE_SQL, &st);
+	assert(st.offloaded == 1 && st.inlined == 0);
+
+	transform_fini();
+	assert(!transform_enabled());
+	assert(transform_submit(TRANSFORM_WEBHOOK, spin, NULL) == NNG_ECLOSED);
+
+	nng_mtx_free(gate);
+	nng_atomic_free(ran);
+	return 0;
+}
@@ -0,0 +1,132 @@
+#include "include/json_writer.h"
+#include "include/tree_view.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/mqtt_db.h"
+#include <assert.h>
+#include <string.h>
+
+#define FULL                                                                \
+	"[[{\"topic\":\"\",\"cld_cnt\":2,\"clientid\":[]}],"                 \
+	"[{\"topic\":\"a\",\"cld_cnt\":2,\"clientid\":[\"c1\"]},"            \
+	"{\"topic\":\"b\",\"cld_cnt\":0,\"clientid\":[\"c2\"]}],"            \
+	"[{\"topic\":\"x\",\"cld_cnt\":0,\"clientid\":[\"c3\",\"c4\"]},"     \
+	"{\"topic\":\"y\",\"cld_cnt\":1,\"clientid\":[]}],"                  \
+	"[{\"topic\":\"z\",\"cld_cnt\":0,\"clientid\":[\"c5\"]}]]"
+
+// a node of level i, as dbtree_get_tree() hands them out
+static void
+node_add(dbtree_info ****vn, size_t i, const char *topic, size_t cld,
+    const char *c1, const char *c2)
+{
+	dbtree_info *in = nng_zalloc(sizeof(dbtree_info));
+
+	in->topic   = nng_strdup(topic);
+	in->cld_cnt = cld;
+	if (c1 != NULL) {
+		cvector_push_back(in->clients, (char *) c1);
+	}
+	if (c2 != NULL) {
+		cvector_push_back(in->clients, (char *) c2);
+	}
+	while (cvector_size(*vn) <= i) {
+		cvector_push_back(*vn, NULL);
+	}
+	cvector_push_back((*vn)[i], in);
+}
+
+// "" -> a (c1) -> x (c3 c4), y -> z (c5); "" -> b (c2)
+static void **
+tree(const char *last)
+{
+	dbtree_info ***vn = NULL;
+
+	node_add(&vn, 0, "", 2, NULL, NULL);
+	node_add(&vn, 1, "a", 2, "c1", NULL);
+	node_add(&vn, 1, "b", 0, "c2", NULL);
+	node_add(&vn, 2, "x", 0, "c3", "c4");
+	node_add(&vn, 2, "y", 1, NULL, NULL);
+	node_add(&vn, 3, last, 0, "c5", NULL);
+	return (void **) vn;
+}
+
+static void
+check(const tree_view *v, const char *prefix, size_t depth, const char *expect)
+{
+	json_writer w = { 0 };
+
+	assert(tree_view_write(v, &w, prefix, depth) == 0);
+	assert(!w.failed && strcmp(w.buf, expect) == 0);
+	json_writer_fini(&w);
+}
+
+int
+main()
+{
+	json_writer     w = { 0 };
+	tree_view      *v, *v2, *v3;
+	tree_view_stats st;
+	dbtree_info  ***bad = NULL;
+
+	assert(tree_view_hold(1) == NULL);
+	assert(tree_view_init(-1) == NNG_EINVAL);
+	assert(tree_view_init(0) == 0);
+
+	// the first request builds it
+	assert(tree_view_hold(1) == NULL);
+	v = tree_view_publish(1, tree("z"));
+	assert(v != NULL);
+	check(v, NULL, 0, FULL);
+	check(v, "", 0, FULL);
+	check(v, NULL, 2,
+	    "[[{\"topic\":\"\",\"cld_cnt\":2,\"clientid\":[]}],"
+	    "[{\"topic\":\"a\",\"cld_cnt\":2,\"clientid\":[\"c1\"]},"
+	    "{\"topic\":\"b\",\"cld_cnt\":0,\"clientid\":[\"c2\"]}]]");
+	check(v, "a/y", 0,
+	    "[[{\"topic\":\"y\",\"cld_cnt\":1,\"clientid\":[]}],"
+	    "[{\"topic\":\"z\",\"cld_cnt\":0,\"clientid\":[\"c5\"]}]]");
+	check(v, "a", 1,
+	    "[[{\"topic\":\"a\",\"cld_cnt\":2,\"clientid\":[\"c1\"]}]]");
+	check(v, "b", 0,
+	    "[[{\"topic\":\"b\",\"cld_cnt\":0,\"clientid\":[\"c2\"]}]]");
+	assert(tree_view_write(v, &w, "c", 0) == NNG_ENOENT);
+	assert(tree_view_write(v, &w, "a/y/z/q", 0) == NNG_ENOENT);
+	json_writer_fini(&w);
+
+	// same generation, same snapshot
+	assert(tree_view_hold(1) == v);
+	tree_view_release(v);
+
+	// a new one is built once, the old one is served meanwhile
+	assert(tree_view_hold(2) == NULL);
+	assert(tree_view_hold(2) == v);
+	v2 = tree_view_publish(2, tree("z"));
+	assert(v2 != NULL && v2 != v);
+	assert(tree_view_hash(v2) == tree_view_hash(v));
+	check(v, NULL, 0, FULL);
+	tree_view_release(v);
+	tree_view_release(v);
+
+	assert(tree_view_hold(3) == NULL);
+	v3 = tree_view_publish(3, tree("w"));
+	assert(tree_view_hash(v3) != tree_view_hash(v2));
+	tree_view_release(v2);
+	tree_view_release(v3);
+
+	// levels that do not add up have no paths to filter by
+	assert(tree_view_hold(4) == NULL);
+	node_add(&bad, 0, "", 1, NULL, NULL);
+	node_add(&bad, 1, "a", 0, NULL, NULL);
+	node_add(&bad, 1, "b", 0, NULL, NULL);
+	v = tree_view_publish(4, (void **) bad);
+	assert(tree_view_write(v, &w, "a", 0) == NNG_ENOTSUP);
+	json_writer_fini(&w);
+	check(v, NULL, 1, "[[{\"topic\":\"\",\"cld_cnt\":1,\"clientid\":[]}]]");
+	tree_view_release(v);
+
+	tree_view_stats_get(&st);
+	assert(st.builds == 4 && st.served == 2 && st.nodes == 3);
+
+	tree_view_fini();
+	assert(!tree_view_enabled());
+	return 0;
+}
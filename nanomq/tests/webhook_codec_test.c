@@ -0,0 +1,99 @@
+#include "include/webhook_codec.h"
+#include "nng/nng.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the byte at a time encoder webhook_post.c used before
+static size_t
+reference(const uint8_t *in, size_t len, char *out, bool pad)
+{
+	const char abc[] =
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned int pos = 0, val = 0;
+	size_t       j   = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		val = (val << 8) | in[i];
+		pos += 8;
+		while (pos > 5) {
+			out[j++] = abc[val >> (pos -= 6)];
+			val &= ((1 << pos) - 1);
+		}
+	}
+	if (pos > 0) {
+		out[j++] = abc[val << (6 - pos)];
+	}
+	for (; pad && j % 4 != 0; j++) {
+		out[j] = '=';
+	}
+	if (!pad) {
+		for (size_t k = 0; k < j; k++) {
+			out[k] = out[k] == '+' ? 'A' : out[k] == '/' ? 'B' : out[k];
+		}
+	}
+	out[j] = '\0';
+	return j;
+}
+
+static void
+bench(const char *name, size_t (*enc)(const uint8_t *, size_t, char *),
+    const uint8_t *in, size_t len, char *out)
+{
+	int      rounds = 200;
+	nng_time start  = nng_clock();
+
+	for (int i = 0; i < rounds; i++) {
+		enc(in, len, out);
+	}
+	nng_duration ms = (nng_duration) (nng_clock() - start);
+	printf("%s: %zu bytes x %d in %d ms\n", name, len, rounds, (int) ms);
+}
+
+int
+main()
+{
+	size_t   max = 64 * 1024;
+	uint8_t *in  = malloc(max);
+	char    *out = malloc(WEBHOOK_BASE64_SIZE(max));
+	char    *exp = malloc(WEBHOOK_BASE64_SIZE(max));
+
+	assert(in != NULL && out != NULL && exp != NULL);
+	for (size_t i = 0; i < max; i++) {
+		in[i] = (uint8_t) rand();
+	}
+
+	assert(webhook_base64_encode((const uint8_t *) "messagei+/", 10, out) ==
+	    16);
+	assert(strcmp(out, "bWVzc2FnZWkrLw==") == 0);
+	assert(webhook_base62_encode((const uint8_t *) "messagei+/", 10, out) ==
+	    14);
+	assert(strcmp(out, "bWVzc2FnZWkrLw") == 0);
+	assert(webhook_base64_encode(in, 0, out) == 0 && out[0] == '\0');
+	assert(webhook_base62_encode(in, 0, out) == 0 && out[0] == '\0');
+
+	// every tail after every block size
+	for (size_t len = 1; len <= 200; len++) {
+		size_t n = reference(in, len, exp, true);
+		assert(n + 1 <= WEBHOOK_BASE64_SIZE(len));
+		assert(webhook_base64_encode(in, len, out) == n);
+		assert(memcmp(out, exp, n + 1) == 0);
+
+		n = reference(in, len, exp, false);
+		assert(n + 1 <= WEBHOOK_BASE62_SIZE(len));
+		assert(webhook_base62_encode(in, len, out) == n);
+		assert(memcmp(out, exp, n + 1) == 0);
+	}
+	assert(webhook_base64_encode(in + 1, max - 1, out) ==
+	    reference(in + 1, max - 1, exp, true));
+	assert(strcmp(out, exp) == 0);
+
+	bench("base64", webhook_base64_encode, in, max, out);
+	bench("base62", webhook_base62_encode, in, max, out);
+
+	free(in);
+	free(out);
+	free(exp);
+	return 0;
+}
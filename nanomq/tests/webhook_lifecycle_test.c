@@ -0,0 +1,105 @@
+#include "include/webhook_lifecycle.h"
+#include "nng/protocol/pipeline0/pull.h"
+#include "nng/protocol/pipeline0/push.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define URL "inproc://webhook_lifecycle_test"
+
+static char *
+recv_event(nng_socket pull)
+{
+	nng_msg *msg;
+	char    *s;
+
+	if (nng_recvmsg(pull, &msg, 0) != 0) {
+		return NULL;
+	}
+	s = malloc(nng_msg_len(msg) + 1);
+	memcpy(s, nng_msg_body(msg), nng_msg_len(msg));
+	s[nng_msg_len(msg)] = '\0';
+	nng_msg_free(msg);
+	return s;
+}
+
+int main()
+{
+	nng_socket           push;
+	nng_socket           pull;
+	hook_lifecycle_stats st;
+	char                *ev;
+	char                 id[32];
+
+	// off unless asked for
+	unsetenv("NANOMQ_WEBHOOK_LIFECYCLE");
+	assert(webhook_lifecycle_init() == 0);
+	assert(webhook_lifecycle_enabled() == (NANO_WEBHOOK_LIFECYCLE_MS > 0));
+	webhook_lifecycle_fini();
+
+	assert(nng_pull0_open(&pull) == 0);
+	assert(nng_push0_open(&push) == 0);
+	assert(nng_listen(pull, URL, NULL, 0) == 0);
+	assert(nng_dial(push, URL, NULL, 0) == 0);
+	assert(nng_socket_set_ms(pull, NNG_OPT_RECVTIMEO, 2000) == 0);
+
+	// a long window, flushed by hand
+	setenv("NANOMQ_WEBHOOK_LIFECYCLE", "60000", 1);
+	assert(webhook_lifecycle_init() == 0);
+	assert(webhook_lifecycle_enabled());
+	for (int i = 0; i < NANO_WEBHOOK_LIFECYCLE_IDS + 5; i++) {
+		snprintf(id, sizeof(id), "c%d", i);
+		assert(webhook_lifecycle_add(
+		           &push, HOOK_LIFECYCLE_CONNACK, id, i % 10 != 0) == 0);
+	}
+	assert(webhook_lifecycle_add(
+	           &push, HOOK_LIFECYCLE_DISCONNECT, "c\"1", false) == 0);
+	assert(webhook_lifecycle_add(&push, HOOK_LIFECYCLES, "x", true) != 0);
+	webhook_lifecycle_flush();
+
+	assert((ev = recv_event(pull)) != NULL);
+	assert(strncmp(ev,
+	           "{\"action\":\"client_connack_batch\","
+	           "\"clientids\":[\"c0\",\"c1\",",
+	           56) == 0);
+	snprintf(id, sizeof(id), "\"c%d\"]", NANO_WEBHOOK_LIFECYCLE_IDS - 1);
+	assert(strstr(ev, id) != NULL);
+	snprintf(id, sizeof(id), "\"c%d\"", NANO_WEBHOOK_LIFECYCLE_IDS);
+	assert(strstr(ev, id) == NULL);
+	snprintf(id, sizeof(id), "\"count\":%d,", NANO_WEBHOOK_LIFECYCLE_IDS + 5);
+	assert(strstr(ev, id) != NULL);
+	assert(strstr(ev, "\"window_ms\":60000,") != NULL);
+	assert(ev[strlen(ev) - 1] == '}');
+	free(ev);
+
+	assert((ev = recv_event(pull)) != NULL);
+	assert(strstr(ev, "\"action\":\"client_disconnected_batch\"") != NULL);
+	assert(strstr(ev, "\"clientids\":[\"c\\\"1\"]") != NULL);
+	assert(strstr(ev, "\"normal\":0,\"abnormal\":1,") != NULL);
+	free(ev);
+
+	webhook_lifecycle_stat(&st);
+	assert(st.events == NANO_WEBHOOK_LIFECYCLE_IDS + 6);
+	assert(st.summaries == 2);
+	assert(st.omitted == 5);
+	// nothing new, nothing sent
+	webhook_lifecycle_flush();
+	webhook_lifecycle_fini();
+
+	// the timer sends every window
+	setenv("NANOMQ_WEBHOOK_LIFECYCLE", "50", 1);
+	assert(webhook_lifecycle_init() == 0);
+	assert(webhook_lifecycle_add(
+	           &push, HOOK_LIFECYCLE_DISCONNECT, "late", true) == 0);
+	assert((ev = recv_event(pull)) != NULL);
+	assert(strstr(ev, "\"clientids\":[\"late\"]") != NULL);
+	assert(strstr(ev, "\"per_second\":20,") != NULL);
+	free(ev);
+	webhook_lifecycle_fini();
+	assert(webhook_lifecycle_enabled() == false);
+
+	nng_close(push);
+	nng_close(pull);
+	return 0;
+}
@@ -0,0 +1,63 @@
+#include "include/work_arena.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+int main()
+{
+	work_arena_stats st;
+	work_arena      *a;
+	work_arena      *b;
+	char            *s;
+	uint8_t         *p;
+	uint8_t         *q;
+
+	assert(work_arena_alloc() == NULL);
+	assert(work_arena_get(NULL, 16) == NULL);
+	work_arena_reset(NULL);
+	assert(work_arena_init() == 0);
+	a = work_arena_alloc();
+	b = work_arena_alloc();
+	assert(a != NULL && b != NULL);
+
+	// aligned bumps out of the first block
+	p = work_arena_get(a, 3);
+	q = work_arena_zget(a, 24);
+	assert(p != NULL && q == p + 8);
+	assert(((uintptr_t) q & (sizeof(uint64_t) - 1)) == 0);
+	for (int i = 0; i < 24; i++) {
+		assert(q[i] == 0);
+	}
+	s = work_arena_strndup(a, "a/b/c/d", 5);
+	assert(strcmp(s, "a/b/c") == 0);
+	work_arena_stats_get(&st);
+	assert(st.arenas == 2 && st.allocs == 3 && st.blocks == 2);
+
+	// the next message starts over
+	work_arena_reset(a);
+	assert(work_arena_get(a, 3) == p);
+
+	// outgrowing the block takes the heap, then the block grows to fit
+	for (int i = 0; i < 4; i++) {
+		assert(work_arena_get(a, NANO_WORK_ARENA_BLOCK / 2) != NULL);
+	}
+	work_arena_stats_get(&st);
+	assert(st.blocks == 4);
+	work_arena_reset(a);
+	for (int i = 0; i < 4; i++) {
+		assert(work_arena_get(a, NANO_WORK_ARENA_BLOCK / 2) != NULL);
+	}
+	work_arena_stats_get(&st);
+	assert(st.blocks == 5 && st.resets == 2);
+	assert(st.high > 2 * NANO_WORK_ARENA_BLOCK);
+	assert(st.reserved > 3 * NANO_WORK_ARENA_BLOCK);
+
+	// an idle work gives it back
+	work_arena_shrink(a);
+	work_arena_stats_get(&st);
+	assert(st.reserved == 2 * NANO_WORK_ARENA_BLOCK);
+
+	work_arena_fini();
+	assert(work_arena_enabled() == false);
+	return 0;
+}
@@ -0,0 +1,70 @@
+#include "include/work_lane.h"
+#include "nng/mqtt/packet.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+int main()
+{
+	work_lane_stats st;
+	void           *worker;
+	int             items[4];
+	int             a, b;
+
+	assert(work_lane_classify(CMD_SUBSCRIBE) == WORK_LANE_HEAVY);
+	assert(work_lane_classify(CMD_UNSUBSCRIBE) == WORK_LANE_HEAVY);
+	assert(work_lane_classify(CMD_PUBLISH) == WORK_LANE_PUBLISH);
+	assert(work_lane_classify(CMD_PUBACK) == WORK_LANE_CONTROL);
+
+	// everything runs where it was received while disabled
+	assert(work_lane_enabled() == false);
+	assert(work_lane_submit(&items[0], &worker) == NNG_ECLOSED);
+	assert(worker == NULL);
+	assert(work_lane_next(&a) == NULL);
+	assert(work_lane_init(0, 4) == NNG_EINVAL);
+
+	assert(work_lane_init(2, 2) == 0);
+	assert(work_lane_enabled());
+
+	// parked works get items handed over directly, newest parked first
+	assert(work_lane_next(&a) == NULL);
+	assert(work_lane_next(&a) == NULL); // parks once
+	assert(work_lane_next(&b) == NULL);
+	assert(work_lane_submit(&items[0], &worker) == 0 && worker == &b);
+	assert(work_lane_submit(&items[1], &worker) == 0 && worker == &a);
+
+	// both busy, items queue in order up to the depth
+	assert(work_lane_submit(&items[2], &worker) == 0 && worker == NULL);
+	assert(work_lane_submit(&items[3], &worker) == 0 && worker == NULL);
+	assert(work_lane_submit(&items[0], &worker) == NNG_EAGAIN);
+	work_lane_stats_get(WORK_LANE_HEAVY, &st);
+	assert(st.depth == 2 && st.depth_max == 2 && st.overflow == 1);
+	assert(st.handled == 4);
+
+	assert(work_lane_next(&a) == &items[2]);
+	assert(work_lane_next(&b) == &items[3]);
+	assert(work_lane_next(&a) == NULL);
+	work_lane_stats_get(WORK_LANE_HEAVY, &st);
+	assert(st.depth == 0 && st.depth_max == 2);
+
+	// the ring wraps around
+	for (int i = 0; i < 8; i++) {
+		assert(work_lane_submit(&items[i % 4], &worker) == 0);
+		if (worker == NULL) {
+			assert(work_lane_next(&b) == &items[i % 4]);
+		}
+	}
+
+	work_lane_count(WORK_LANE_PUBLISH);
+	work_lane_count(WORK_LANE_PUBLISH);
+	work_lane_count(WORK_LANE_CONTROL);
+	work_lane_stats_get(WORK_LANE_PUBLISH, &st);
+	assert(st.handled == 2 && st.depth == 0);
+	work_lane_stats_get(WORK_LANE_CONTROL, &st);
+	assert(st.handled == 1);
+	assert(strcmp(work_lane_name(WORK_LANE_HEAVY), "heavy") == 0);
+
+	work_lane_fini();
+	assert(work_lane_enabled() == false);
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include "include/work_pool.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static int resized;
+
+static size_t
+resize(int delta, void *arg)
+{
+	(void) arg;
+	if (delta != 0) {
+		resized = delta;
+	}
+	// retire one at a time like the broker
+	return delta > 0 ? (size_t) delta : (size_t) (delta < 0);
+}
+
+int main()
+{
+	work_pool_stats ws;
+	int             delta = 0;
+
+	// nothing is counted while disabled
+	assert(work_pool_enabled() == false);
+	work_pool_busy();
+	work_pool_stats_get(&ws);
+	assert(ws.size == 0 && ws.busy == 0);
+	assert(work_pool_step(100, 0) == 0);
+
+	// without a callback the pool stays at min
+	assert(work_pool_init(4, 8, NULL, NULL) == 0);
+	work_pool_stats_get(&ws);
+	assert(ws.min == 4 && ws.max == 4 && ws.size == 4 && !ws.elastic);
+	work_pool_fini();
+
+	assert(work_pool_init(4, 8, resize, NULL) == 0);
+	work_pool_stats_get(&ws);
+	assert(ws.elastic && ws.size == 4 && ws.max == 8);
+
+	// one hot window is not enough, a lukewarm one starts over
+	assert(work_pool_step(90, 0) == 0);
+	assert(work_pool_step(50, 0) == 0);
+	assert(work_pool_step(90, 0) == 0);
+	assert(work_pool_step(90, 0) == 1);
+	// a queue grows the pool however idle the works look
+	assert(work_pool_step(0, 3) == 0);
+	assert(work_pool_step(0, 3) == 1);
+	// never below min
+	for (int i = 0; i < 2 * NANO_WORK_POOL_SHRINK_AFTER; i++) {
+		assert(work_pool_step(0, 0) == 0);
+	}
+
+	// all works busy, the pool thread grows it after two windows
+	for (int i = 0; i < 4; i++) {
+		work_pool_busy();
+	}
+	work_pool_stats_get(&ws);
+	assert(ws.busy == 4);
+	nng_msleep(NANO_WORK_POOL_SAMPLE_MS * NANO_WORK_POOL_WINDOW *
+	        (NANO_WORK_POOL_GROW_AFTER + 1) +
+	    200);
+	work_pool_stats_get(&ws);
+	assert(resized == 1 && ws.grown >= 1 && ws.size >= 5);
+	assert(ws.utilization > NANO_WORK_POOL_LOW);
+	for (int i = 0; i < 4; i++) {
+		work_pool_idle();
+	}
+
+	// above min now, long enough idle asks to retire one
+	for (int i = 0; i <= NANO_WORK_POOL_SHRINK_AFTER && delta == 0; i++) {
+		delta = work_pool_step(0, 0);
+	}
+	assert(delta == -1);
+
+	work_pool_fini();
+	assert(work_pool_enabled() == false);
+	return 0;
+}
@@ -0,0 +1,510 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/topic_alias.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/idhash.h"
+#include "nng/supplemental/util/platform.h"
+
+#define TOPIC_ALIAS_MIN 16
+#define TOPIC_ALIAS_CAP 65536 // alias 0 is never used
+
+typedef struct {
+	size_t len;
+	char   topic[];
+} alias_topic;
+
+typedef struct {
+	uint32_t hash;
+	uint16_t prev;  // LRU neighbours, 0 ends the list
+	uint16_t next;
+	uint16_t chain; // next alias in the same bucket
+	bool     known; // a publish defining it was sent
+	uint32_t stamp; // of the assignment, see topic_alias_out_known
+	size_t   len;
+	char    *topic; // NULL while unassigned
+} out_slot;
+
+typedef struct {
+	uint16_t  max;
+	uint16_t  used;
+	uint16_t  head; // most recently used
+	uint16_t  tail;
+	uint16_t *buckets;
+	size_t    nbuckets;
+	out_slot  slots[]; // indexed by alias, 0 unused
+} alias_out;
+
+typedef struct {
+	alias_topic **topics;
+	size_t        cap;
+	alias_out    *out;
+} alias_table;
+
+typedef struct {
+	nng_mtx    *mtx;
+	nng_id_map *pipes;  // pipe id -> alias_table
+	uint32_t    stamps; // assignments on this shard so far
+} alias_shard;
+
+static struct {
+	alias_shard shards[NANO_TOPIC_ALIAS_SHARDS];
+	bool        enabled;
+} topic_alias_;
+
+static alias_shard *
+topic_alias_shard(uint32_t pipe)
+{
+	return &topic_alias_.shards[pipe & (NANO_TOPIC_ALIAS_SHARDS - 1)];
+}
+
+static void
+alias_out_free(alias_out *o)
+{
+	for (uint16_t i = 1; i <= o->used; i++) {
+		if (o->slots[i].topic != NULL) {
+			nng_free(o->slots[i].topic, o->slots[i].len + 1);
+		}
+	}
+	nng_free(o->buckets, sizeof(uint16_t) * o->nbuckets);
+	nng_free(o, sizeof(*o) + sizeof(out_slot) * (o->max + 1));
+}
+
+static void
+alias_table_free(alias_table *t)
+{
+	if (t->out != NULL) {
+		alias_out_free(t->out);
+	}
+	for (size_t i = 0; i < t->cap; i++) {
+		if (t->topics[i] != NULL) {
+			nng_free(t->topics[i],
+			    sizeof(alias_topic) + t->topics[i]->len + 1);
+		}
+	}
+	if (t->cap > 0) {
+		nng_free(t->topics, sizeof(alias_topic *) * t->cap);
+	}
+	nng_free(t, sizeof(*t));
+}
+
+int
+topic_alias_init(void)
+{
+	int rv;
+
+	if (topic_alias_.enabled) {
+		return 0;
+	}
+	for (size_t i = 0; i < NANO_TOPIC_ALIAS_SHARDS; i++) {
+		alias_shard *s = &topic_alias_.shards[i];
+		if ((rv = nng_mtx_alloc(&s->mtx)) != 0 ||
+		    (rv = nng_id_map_alloc(&s->pipes, 0, 0, 0)) != 0) {
+			topic_alias_fini();
+			return rv;
+		}
+	}
+	topic_alias_.enabled = true;
+	return 0;
+}
+
+static void
+alias_table_release(void *key, void *value, void *arg)
+{
+	(void) key;
+	(void) arg;
+	alias_table_free(value);
+}
+
+void
+topic_alias_fini(void)
+{
+	for (size_t i = 0; i < NANO_TOPIC_ALIAS_SHARDS; i++) {
+		alias_shard *s = &topic_alias_.shards[i];
+		if (s->pipes != NULL) {
+			nng_id_map_foreach2(s->pipes, alias_table_release, NULL);
+			nng_id_map_free(s->pipes);
+		}
+		if (s->mtx != NULL) {
+			nng_mtx_free(s->mtx);
+		}
+	}
+	memset(&topic_alias_, 0, sizeof(topic_alias_));
+}
+
+bool
+topic_alias_enabled(void)
+{
+	return topic_alias_.enabled;
+}
+
+// Make room for alias in t, doubling from TOPIC_ALIAS_MIN.
+static int
+alias_table_fit(alias_table *t, uint16_t alias)
+{
+	size_t        cap = t->cap == 0 ? TOPIC_ALIAS_MIN : t->cap;
+	alias_topic **topics;
+
+	if (alias < t->cap) {
+		return 0;
+	}
+	while (cap <= alias) {
+		cap *= 2;
+	}
+	if (cap > TOPIC_ALIAS_CAP) {
+		cap = TOPIC_ALIAS_CAP;
+	}
+	if ((topics = nng_zalloc(sizeof(alias_topic *) * cap)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	if (t->cap > 0) {
+		memcpy(topics, t->topics, sizeof(alias_topic *) * t->cap);
+		nng_free(t->topics, sizeof(alias_topic *) * t->cap);
+	}
+	t->topics = topics;
+	t->cap    = cap;
+	return 0;
+}
+
+// Table of pipe, made on first use, with the shard locked.
+static int
+alias_table_get(alias_shard *s, uint32_t pipe, alias_table **tp)
+{
+	alias_table *t;
+	int          rv;
+
+	if ((t = nng_id_get(s->pipes, pipe)) == NULL) {
+		if ((t = nng_zalloc(sizeof(*t))) == NULL) {
+			return NNG_ENOMEM;
+		}
+		if ((rv = nng_id_set(s->pipes, pipe, t)) != 0) {
+			nng_free(t, sizeof(*t));
+			return rv;
+		}
+	}
+	*tp = t;
+	return 0;
+}
+
+int
+topic_alias_set(uint32_t pipe, uint16_t alias, const char *topic, size_t len)
+{
+	alias_shard *s;
+	alias_table *t;
+	alias_topic *at;
+	int          rv;
+
+	if (!topic_alias_.enabled) {
+		return NNG_ECLOSED;
+	}
+	if (alias == 0) {
+		return NNG_EINVAL;
+	}
+	s = topic_alias_shard(pipe);
+	nng_mtx_lock(s->mtx);
+	if ((rv = alias_table_get(s, pipe, &t)) != 0) {
+		nng_mtx_unlock(s->mtx);
+		return rv;
+	}
+	// a client may point an alias at the same topic again and again
+	if (alias < t->cap && (at = t->topics[alias]) != NULL &&
+	    at->len == len && memcmp(at->topic, topic, len) == 0) {
+		nng_mtx_unlock(s->mtx);
+		return 0;
+	}
+	if ((rv = alias_table_fit(t, alias)) != 0 ||
+	    (at = nng_alloc(sizeof(*at) + len + 1)) == NULL) {
+		nng_mtx_unlock(s->mtx);
+		return rv != 0 ? rv : NNG_ENOMEM;
+	}
+	at->len = len;
+	memcpy(at->topic, topic, len);
+	at->topic[len] = '\0';
+	if (t->topics[alias] != NULL) {
+		nng_free(t->topics[alias],
+		    sizeof(alias_topic) + t->topics[alias]->len + 1);
+	}
+	t->topics[alias] = at;
+	nng_mtx_unlock(s->mtx);
+	return 0;
+}
+
+int
+topic_alias_get(
+    uint32_t pipe, uint16_t alias, char *buf, size_t cap, size_t *len)
+{
+	alias_shard *s;
+	alias_table *t;
+	alias_topic *at;
+	int          rv = 0;
+
+	if (!topic_alias_.enabled) {
+		return NNG_ENOENT;
+	}
+	s = topic_alias_shard(pipe);
+	nng_mtx_lock(s->mtx);
+	if ((t = nng_id_get(s->pipes, pipe)) == NULL || alias >= t->cap ||
+	    (at = t->topics[alias]) == NULL) {
+		nng_mtx_unlock(s->mtx);
+		return NNG_ENOENT;
+	}
+	*len = at->len;
+	if (at->len + 1 > cap) {
+		rv = NNG_ENOSPC;
+	} else {
+		memcpy(buf, at->topic, at->len + 1);
+	}
+	nng_mtx_unlock(s->mtx);
+	return rv;
+}
+
+void
+topic_alias_release(uint32_t pipe)
+{
+	alias_shard *s;
+	alias_table *t;
+
+	if (!topic_alias_.enabled) {
+		return;
+	}
+	s = topic_alias_shard(pipe);
+	nng_mtx_lock(s->mtx);
+	if ((t = nng_id_get(s->pipes, pipe)) != NULL) {
+		nng_id_remove(s->pipes, pipe);
+	}
+	nng_mtx_unlock(s->mtx);
+	if (t != NULL) {
+		alias_table_free(t);
+	}
+}
+
+static uint32_t
+topic_alias_hash(const char *topic, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (uint8_t) topic[i]) * 16777619u;
+	}
+	return h;
+}
+
+int
+topic_alias_out_open(uint32_t pipe, uint16_t max)
+{
+	alias_shard *s;
+	alias_table *t;
+	alias_out   *o;
+	size_t       n = 1;
+	int          rv;
+
+	if (!topic_alias_.enabled) {
+		return NNG_ECLOSED;
+	}
+	if (max > NANO_TOPIC_ALIAS_OUT_MAX) {
+		max = NANO_TOPIC_ALIAS_OUT_MAX;
+	}
+	if (max == 0) {
+		return NNG_EINVAL;
+	}
+	while (n < (size_t) max * 2) {
+		n *= 2;
+	}
+	if ((o = nng_zalloc(sizeof(*o) + sizeof(out_slot) * (max + 1))) ==
+	    NULL) {
+		return NNG_ENOMEM;
+	}
+	if ((o->buckets = nng_zalloc(sizeof(uint16_t) * n)) == NULL) {
+		nng_free(o, sizeof(*o) + sizeof(out_slot) * (max + 1));
+		return NNG_ENOMEM;
+	}
+	o->max      = max;
+	o->nbuckets = n;
+
+	s = topic_alias_shard(pipe);
+	nng_mtx_lock(s->mtx);
+	if ((rv = alias_table_get(s, pipe, &t)) != 0) {
+		nng_mtx_unlock(s->mtx);
+		alias_out_free(o);
+		return rv;
+	}
+	if (t->out != NULL) {
+		alias_out_free(t->out);
+	}
+	t->out = o;
+	nng_mtx_unlock(s->mtx);
+	return 0;
+}
+
+static void
+alias_out_unlink(alias_out *o, uint16_t a)
+{
+	out_slot *sl = &o->slots[a];
+
+	if (sl->prev != 0) {
+		o->slots[sl->prev].next = sl->next;
+	} else {
+		o->head = sl->next;
+	}
+	if (sl->next != 0) {
+		o->slots[sl->next].prev = sl->prev;
+	} else {
+		o->tail = sl->prev;
+	}
+	sl->prev = sl->next = 0;
+}
+
+static void
+alias_out_push(alias_out *o, uint16_t a)
+{
+	out_slot *sl = &o->slots[a];
+
+	sl->next = o->head;
+	if (o->head != 0) {
+		o->slots[o->head].prev = a;
+	} else {
+		o->tail = a;
+	}
+	o->head = a;
+}
+
+static void
+alias_out_append(alias_out *o, uint16_t a)
+{
+	out_slot *sl = &o->slots[a];
+
+	sl->prev = o->tail;
+	if (o->tail != 0) {
+		o->slots[o->tail].next = a;
+	} else {
+		o->head = a;
+	}
+	o->tail = a;
+}
+
+// Take the topic of alias a out of its bucket and free it.
+static void
+alias_out_drop(alias_out *o, uint16_t a)
+{
+	out_slot *sl = &o->slots[a];
+	uint16_t *ap = &o->buckets[sl->hash & (o->nbuckets - 1)];
+
+	if (sl->topic == NULL) {
+		return;
+	}
+	while (*ap != a) {
+		ap = &o->slots[*ap].chain;
+	}
+	*ap = sl->chain;
+	nng_free(sl->topic, sl->len + 1);
+	sl->topic = NULL;
+	sl->chain = 0;
+}
+
+int
+topic_alias_out_begin(uint32_t pipe, const char *topic, size_t len,
+    uint16_t *alias, bool *known, uint32_t *stamp)
+{
+	alias_shard *s;
+	alias_table *t;
+	alias_out   *o;
+	out_slot    *sl;
+	uint32_t     hash;
+	uint16_t     a;
+	char        *copy;
+
+	if (!topic_alias_.enabled || len < NANO_TOPIC_ALIAS_OUT_MIN_LEN) {
+		return NNG_ENOENT;
+	}
+	hash = topic_alias_hash(topic, len);
+	s    = topic_alias_shard(pipe);
+	nng_mtx_lock(s->mtx);
+	if ((t = nng_id_get(s->pipes, pipe)) == NULL || (o = t->out) == NULL) {
+		nng_mtx_unlock(s->mtx);
+		return NNG_ENOENT;
+	}
+	for (a = o->buckets[hash & (o->nbuckets - 1)]; a != 0;
+	     a = o->slots[a].chain) {
+		sl = &o->slots[a];
+		if (sl->hash == hash && sl->len == len &&
+		    memcmp(sl->topic, topic, len) == 0) {
+			alias_out_unlink(o, a);
+			alias_out_push(o, a);
+			*alias = a;
+			*known = sl->known;
+			*stamp = sl->stamp;
+			return 0;
+		}
+	}
+	if ((copy = nng_alloc(len + 1)) == NULL) {
+		nng_mtx_unlock(s->mtx);
+		return NNG_ENOMEM;
+	}
+	memcpy(copy, topic, len);
+	copy[len] = '\0';
+	if (o->used < o->max) {
+		a = ++o->used;
+	} else {
+		a = o->tail;
+		alias_out_unlink(o, a);
+		alias_out_drop(o, a);
+	}
+	sl        = &o->slots[a];
+	sl->hash  = hash;
+	sl->len   = len;
+	sl->topic = copy;
+	sl->known = false;
+	sl->stamp = ++s->stamps;
+	sl->chain = o->buckets[hash & (o->nbuckets - 1)];
+	o->buckets[hash & (o->nbuckets - 1)] = a;
+	alias_out_push(o, a);
+	*alias = a;
+	*known = false;
+	*stamp = sl->stamp;
+	return 0;
+}
+
+void
+topic_alias_out_end(uint32_t pipe, uint16_t alias, bool keep)
+{
+	alias_shard *s = topic_alias_shard(pipe);
+	alias_table *t;
+	alias_out   *o;
+
+	if (!keep && (t = nng_id_get(s->pipes, pipe)) != NULL &&
+	    (o = t->out) != NULL) {
+		// reused first, the client never learnt this one
+		alias_out_drop(o, alias);
+		alias_out_unlink(o, alias);
+		alias_out_append(o, alias);
+	}
+	nng_mtx_unlock(s->mtx);
+}
+
+void
+topic_alias_out_known(uint32_t pipe, uint16_t alias, uint32_t stamp)
+{
+	alias_shard *s = topic_alias_shard(pipe);
+	alias_table *t;
+	alias_out   *o;
+
+	if (!topic_alias_.enabled) {
+		return;
+	}
+	nng_mtx_lock(s->mtx);
+	// not if it went to another topic since
+	if ((t = nng_id_get(s->pipes, pipe)) != NULL && (o = t->out) != NULL &&
+	    alias != 0 && alias <= o->used && o->slots[alias].topic != NULL &&
+	    o->slots[alias].stamp == stamp) {
+		o->slots[alias].known = true;
+	}
+	nng_mtx_unlock(s->mtx);
+}
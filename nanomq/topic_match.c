@@ -0,0 +1,382 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/topic_match.h"
+#include "nng/nng.h"
+#include "nng/supplemental/nanolib/cvector.h"
+
+typedef struct {
+	uint32_t off; // into filter
+	uint32_t len;
+	bool     plus;
+} tp_level;
+
+struct topic_pattern {
+	char    *filter;
+	size_t   size;
+	uint32_t n;    // levels before a '#'
+	bool     rest; // ends with '#'
+	tp_level lv[];
+};
+
+typedef struct tf_node tf_node;
+struct tf_node {
+	char     *level; // NULL for the root and '+'
+	size_t    len;
+	uint32_t  hash;
+	tf_node **children; // cvector of the literal levels, sorted by hash
+	tf_node  *plus;
+	uint32_t *ids;  // cvector, filters ending here
+	uint32_t *rest; // cvector, filters ending with '#' right below
+};
+
+struct topic_filter_set {
+	tf_node root;
+	size_t  count;
+};
+
+typedef struct {
+	const char         *topic;
+	const topic_levels *tl;
+	uint32_t          **ids; // NULL when only the lowest is wanted
+	uint32_t            first;
+	bool                found;
+} tf_walk;
+
+// a '#' level has to be the last one
+static bool
+filter_valid(const char *filter)
+{
+	for (const char *h = filter; (h = strchr(h, '#')) != NULL; h++) {
+		if ((h == filter || h[-1] == '/') && h[1] == '/') {
+			return false;
+		}
+	}
+	return true;
+}
+
+int
+topic_pattern_compile(const char *filter, topic_pattern **pp)
+{
+	topic_pattern *p;
+	const char    *s;
+	const char    *end;
+	uint32_t       n = 1;
+	size_t         size;
+	size_t         len;
+
+	if (!filter_valid(filter)) {
+		return NNG_EINVAL;
+	}
+	for (s = filter; (s = strchr(s, '/')) != NULL; s++) {
+		n++;
+	}
+	size = sizeof(*p) + n * sizeof(tp_level);
+	if ((p = nng_zalloc(size)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	p->size = size;
+	if ((p->filter = nng_strdup(filter)) == NULL) {
+		nng_free(p, size);
+		return NNG_ENOMEM;
+	}
+	for (s = p->filter;; s = end + 1) {
+		end = strchr(s, '/');
+		len = end != NULL ? (size_t) (end - s) : strlen(s);
+		if (len == 1 && s[0] == '#') {
+			p->rest = true;
+			break;
+		}
+		p->lv[p->n].off  = (uint32_t) (s - p->filter);
+		p->lv[p->n].len  = (uint32_t) len;
+		p->lv[p->n].plus = len == 1 && s[0] == '+';
+		p->n++;
+		if (end == NULL) {
+			break;
+		}
+	}
+	*pp = p;
+	return 0;
+}
+
+void
+topic_pattern_free(topic_pattern *p)
+{
+	if (p != NULL) {
+		nng_strfree(p->filter);
+		nng_free(p, p->size);
+	}
+}
+
+bool
+topic_pattern_match(
+    const topic_pattern *p, const char *topic, const topic_levels *tl)
+{
+	const char *level;
+	size_t      len;
+
+	if (p->rest ? tl->n < p->n : tl->n != p->n) {
+		return false;
+	}
+	for (uint32_t i = 0; i < p->n; i++) {
+		if (p->lv[i].plus) {
+			continue;
+		}
+		level = topic_level(tl, topic, i, &len);
+		if (len != p->lv[i].len ||
+		    memcmp(level, p->filter + p->lv[i].off, len) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// FNV-1a
+static uint32_t
+tf_hash(const char *level, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (uint8_t) level[i]) * 16777619u;
+	}
+	return h;
+}
+
+// first child with a hash not below hash
+static size_t
+tf_lower(tf_node *const *children, uint32_t hash)
+{
+	size_t lo = 0;
+	size_t hi = cvector_size(children);
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (children[mid]->hash < hash) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static tf_node *
+tf_child_find(
+    const tf_node *node, const char *level, size_t len, uint32_t hash)
+{
+	for (size_t i = tf_lower(node->children, hash);
+	     i < cvector_size(node->children) &&
+	     node->children[i]->hash == hash;
+	     i++) {
+		tf_node *c = node->children[i];
+		if (c->len == len && memcmp(c->level, level, len) == 0) {
+			return c;
+		}
+	}
+	return NULL;
+}
+
+static tf_node *
+tf_child_add(tf_node *node, const char *level, size_t len)
+{
+	uint32_t hash = tf_hash(level, len);
+	tf_node *c;
+	size_t   at;
+	size_t   n;
+
+	if ((c = tf_child_find(node, level, len, hash)) != NULL) {
+		return c;
+	}
+	if ((c = nng_zalloc(sizeof(*c))) == NULL) {
+		return NULL;
+	}
+	if ((c->level = nng_alloc(len + 1)) == NULL) {
+		nng_free(c, sizeof(*c));
+		return NULL;
+	}
+	memcpy(c->level, level, len);
+	c->level[len] = '\0';
+	c->len        = len;
+	c->hash       = hash;
+
+	at = tf_lower(node->children, hash);
+	cvector_push_back(node->children, c);
+	n = cvector_size(node->children);
+	memmove(&node->children[at + 1], &node->children[at],
+	    (n - 1 - at) * sizeof(tf_node *));
+	node->children[at] = c;
+	return c;
+}
+
+static void
+tf_node_fini(tf_node *node)
+{
+	for (size_t i = 0; i < cvector_size(node->children); i++) {
+		tf_node_fini(node->children[i]);
+		nng_free(node->children[i], sizeof(tf_node));
+	}
+	if (node->plus != NULL) {
+		tf_node_fini(node->plus);
+		nng_free(node->plus, sizeof(tf_node));
+	}
+	cvector_free(node->children);
+	cvector_free(node->ids);
+	cvector_free(node->rest);
+	if (node->level != NULL) {
+		nng_free(node->level, node->len + 1);
+	}
+}
+
+int
+topic_filter_set_alloc(topic_filter_set **sp)
+{
+	if ((*sp = nng_zalloc(sizeof(topic_filter_set))) == NULL) {
+		return NNG_ENOMEM;
+	}
+	return 0;
+}
+
+void
+topic_filter_set_free(topic_filter_set *s)
+{
+	if (s != NULL) {
+		tf_node_fini(&s->root);
+		nng_free(s, sizeof(*s));
+	}
+}
+
+int
+topic_filter_set_add(topic_filter_set *s, const char *filter, uint32_t id)
+{
+	tf_node    *node  = &s->root;
+	const char *level = filter;
+	const char *end;
+	size_t      len;
+
+	if (!filter_valid(filter)) {
+		return NNG_EINVAL;
+	}
+	for (;; level = end + 1) {
+		end = strchr(level, '/');
+		len = end != NULL ? (size_t) (end - level) : strlen(level);
+		if (len == 1 && level[0] == '#') {
+			cvector_push_back(node->rest, id);
+			s->count++;
+			return 0;
+		}
+		if (len == 1 && level[0] == '+') {
+			if (node->plus == NULL &&
+			    (node->plus = nng_zalloc(sizeof(tf_node))) == NULL) {
+				return NNG_ENOMEM;
+			}
+			node = node->plus;
+		} else if ((node = tf_child_add(node, level, len)) == NULL) {
+			return NNG_ENOMEM;
+		}
+		if (end == NULL) {
+			break;
+		}
+	}
+	cvector_push_back(node->ids, id);
+	s->count++;
+	return 0;
+}
+
+size_t
+topic_filter_set_count(const topic_filter_set *s)
+{
+	return s->count;
+}
+
+static void
+tf_walk_add(tf_walk *w, const uint32_t *ids)
+{
+	for (size_t i = 0; i < cvector_size(ids); i++) {
+		if (w->ids != NULL) {
+			cvector_push_back(*w->ids, ids[i]);
+		} else if (!w->found || ids[i] < w->first) {
+			w->first = ids[i];
+			w->found = true;
+		}
+	}
+}
+
+// node was reached by the levels before level i, by all of them if i is n.
+static void
+tf_node_walk(const tf_node *node, uint32_t i, tf_walk *w)
+{
+	const tf_node *c;
+	const char    *level;
+	size_t         len;
+
+	tf_walk_add(w, node->rest);
+	if (i == w->tl->n) {
+		tf_walk_add(w, node->ids);
+		return;
+	}
+	if (cvector_size(node->children) > 0) {
+		level = topic_level(w->tl, w->topic, i, &len);
+		if ((c = tf_child_find(node, level, len, tf_hash(level, len))) !=
+		    NULL) {
+			tf_node_walk(c, i + 1, w);
+		}
+	}
+	if (node->plus != NULL) {
+		tf_node_walk(node->plus, i + 1, w);
+	}
+}
+
+static int
+tf_id_cmp(const void *a, const void *b)
+{
+	uint32_t ia = *(const uint32_t *) a;
+	uint32_t ib = *(const uint32_t *) b;
+
+	return ia < ib ? -1 : ia > ib;
+}
+
+size_t
+topic_filter_set_match(const topic_filter_set *s, const char *topic,
+    const topic_levels *tl, uint32_t **ids)
+{
+	topic_levels split;
+	tf_walk      w    = { .topic = topic, .tl = tl, .ids = ids };
+	size_t       base = cvector_size(*ids);
+	size_t       n;
+
+	if (tl == NULL) {
+		topic_split(topic, strlen(topic), &split);
+		w.tl = &split;
+	}
+	tf_node_walk(&s->root, 0, &w);
+	if ((n = cvector_size(*ids) - base) > 1) {
+		qsort(*ids + base, n, sizeof(uint32_t), tf_id_cmp);
+	}
+	return n;
+}
+
+bool
+topic_filter_set_first(const topic_filter_set *s, const char *topic,
+    const topic_levels *tl, uint32_t *id)
+{
+	topic_levels split;
+	tf_walk      w = { .topic = topic, .tl = tl };
+
+	if (tl == NULL) {
+		topic_split(topic, strlen(topic), &split);
+		w.tl = &split;
+	}
+	tf_node_walk(&s->root, 0, &w);
+	*id = w.first;
+	return w.found;
+}
@@ -0,0 +1,206 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/topic_scan.h"
+#include "nng/nng.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TOPIC_SCAN_SIMD
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define TOPIC_SCAN_SIMD
+#endif
+
+static inline void
+level_close(topic_levels *tl, uint32_t off)
+{
+	if (tl->n < NANO_TOPIC_LEVELS) {
+		tl->end[tl->n] = off;
+	}
+	tl->n++;
+}
+
+#ifdef TOPIC_SCAN_SIMD
+/*
+ * False unless the 16 bytes at p are printable ASCII other than wildcards,
+ * else bit k of *slash is set for a '/' at p[k].
+ */
+static inline bool
+chunk_scan(const uint8_t *p, uint32_t *slash)
+{
+#if defined(__SSE2__)
+	__m128i v = _mm_loadu_si128((const __m128i *) p);
+	// signed, so bytes from 0x80 on count as below 0x20
+	__m128i bad = _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(0x20)),
+	    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)),
+	        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('+')),
+	            _mm_cmpeq_epi8(v, _mm_set1_epi8('#')))));
+
+	if (_mm_movemask_epi8(bad) != 0) {
+		return false;
+	}
+	*slash = (uint32_t) _mm_movemask_epi8(
+	    _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+	return true;
+#else
+	static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2,
+		4, 8, 16, 32, 64, 128 };
+
+	uint8x16_t v   = vld1q_u8(p);
+	uint8x16_t bad = vorrq_u8(vcltq_u8(v, vdupq_n_u8(0x20)),
+	    vorrq_u8(vcgeq_u8(v, vdupq_n_u8(0x7f)),
+	        vorrq_u8(vceqq_u8(v, vdupq_n_u8('+')),
+	            vceqq_u8(v, vdupq_n_u8('#')))));
+	uint8x16_t s;
+
+	if (vmaxvq_u8(bad) != 0) {
+		return false;
+	}
+	s = vandq_u8(vceqq_u8(v, vdupq_n_u8('/')), vld1q_u8(bits));
+	*slash = vaddv_u8(vget_low_u8(s)) |
+	    (uint32_t) vaddv_u8(vget_high_u8(s)) << 8;
+	return true;
+#endif
+}
+#endif
+
+/*
+ * Length of the character at p, 0 if it is malformed or one MQTT does not
+ * allow: the checks of utf8_check().
+ */
+static size_t
+utf8_char(const uint8_t *p, size_t left)
+{
+	uint32_t cp;
+	size_t   n;
+
+	if (p[0] < 0x80) {
+		cp = p[0];
+		n  = 1;
+	} else if ((p[0] & 0xe0) == 0xc0 && p[0] >= 0xc2) {
+		cp = p[0] & 0x1f;
+		n  = 2;
+	} else if ((p[0] & 0xf0) == 0xe0) {
+		cp = p[0] & 0x0f;
+		n  = 3;
+	} else if ((p[0] & 0xf8) == 0xf0 && p[0] <= 0xf4) {
+		cp = p[0] & 0x07;
+		n  = 4;
+	} else {
+		return 0;
+	}
+	if (n > left) {
+		return 0;
+	}
+	for (size_t k = 1; k < n; k++) {
+		if ((p[k] & 0xc0) != 0x80) {
+			return 0;
+		}
+		cp = cp << 6 | (p[k] & 0x3f);
+	}
+	if ((n == 3 && cp < 0x800) ||
+	    (n == 4 && (cp < 0x10000 || cp > 0x10ffff)) ||
+	    (cp >= 0xd800 && cp <= 0xdfff) ||
+	    (cp >= 0xfdd0 && cp <= 0xfdef) || (cp & 0xfffe) == 0xfffe ||
+	    cp < 0x20 || (cp >= 0x7f && cp <= 0x9f)) {
+		return 0;
+	}
+	return n;
+}
+
+int
+topic_scan(const char *topic, size_t len, topic_levels *tl)
+{
+	const uint8_t *p = (const uint8_t *) topic;
+	size_t         i = 0;
+	size_t         n;
+	size_t         stop;
+
+	tl->len = (uint32_t) len;
+	tl->n   = 0;
+	while (i < len) {
+		stop = len;
+#ifdef TOPIC_SCAN_SIMD
+		if (len - i >= 16) {
+			uint32_t slash;
+
+			if (chunk_scan(p + i, &slash)) {
+				for (; slash != 0; slash &= slash - 1) {
+					level_close(
+					    tl, i + __builtin_ctz(slash));
+				}
+				i += 16;
+				continue;
+			}
+			// what stopped it is in these 16 bytes
+			stop = i + 16;
+		}
+#endif
+		while (i < stop) {
+			if (p[i] == '/') {
+				level_close(tl, i);
+				n = 1;
+			} else if (p[i] == '+' || p[i] == '#' ||
+			    (n = utf8_char(p + i, len - i)) == 0) {
+				tl->n = 0;
+				return NNG_EINVAL;
+			}
+			i += n;
+		}
+	}
+	level_close(tl, len);
+	return 0;
+}
+
+void
+topic_split(const char *topic, size_t len, topic_levels *tl)
+{
+	const char *p   = topic;
+	const char *end = topic + len;
+	const char *s;
+
+	tl->len = (uint32_t) len;
+	tl->n   = 0;
+	while (p < end && (s = memchr(p, '/', end - p)) != NULL) {
+		level_close(tl, s - topic);
+		p = s + 1;
+	}
+	level_close(tl, len);
+}
+
+// where level i ends, found again past the recorded ones
+static uint32_t
+level_end(const topic_levels *tl, const char *topic, uint32_t i)
+{
+	const char *s;
+	uint32_t    off;
+
+	if (i < NANO_TOPIC_LEVELS) {
+		return tl->end[i];
+	}
+	off = tl->end[NANO_TOPIC_LEVELS - 1];
+	for (uint32_t k = NANO_TOPIC_LEVELS; k <= i; k++) {
+		s   = memchr(topic + off + 1, '/', tl->len - off - 1);
+		off = s != NULL ? (uint32_t) (s - topic) : tl->len;
+	}
+	return off;
+}
+
+const char *
+topic_level(
+    const topic_levels *tl, const char *topic, uint32_t i, size_t *len)
+{
+	uint32_t start = i > 0 ? level_end(tl, topic, i - 1) + 1 : 0;
+
+	*len = level_end(tl, topic, i) - start;
+	return topic + start;
+}
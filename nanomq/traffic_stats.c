@@ -0,0 +1,379 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/traffic_stats.h"
+#include "nng/supplemental/util/idhash.h"
+
+// client entries are spread over striped maps by pipe id
+#define TRAFFIC_CLIENT_LOCKS 64
+
+typedef struct {
+	nng_mtx    *mtx;
+	nng_id_map *map;
+} traffic_stripe;
+
+typedef struct {
+	uint32_t hash;
+	uint32_t len; // 0 for a free slot
+	uint64_t msgs;
+	uint64_t bytes;
+	uint64_t error;
+	char     topic[NANO_TRAFFIC_TOPIC_LEN];
+} traffic_slot;
+
+struct traffic_topics {
+	traffic_topics *next;
+	nng_mtx        *mtx;
+	uint64_t        window;
+	uint64_t        last_window; // window of last, 0 when none
+	traffic_slot    cur[NANO_TRAFFIC_TOPICS];
+	traffic_slot    last[NANO_TRAFFIC_TOPICS];
+};
+
+static struct {
+	traffic_stripe  stripes[TRAFFIC_CLIENT_LOCKS];
+	nng_mtx        *mtx; // guards topics
+	traffic_topics *topics;
+	size_t          ntopics;
+	bool            enabled;
+} traffic_;
+
+static inline traffic_stripe *
+traffic_stripe_of(uint32_t pipe)
+{
+	return &traffic_.stripes[pipe % TRAFFIC_CLIENT_LOCKS];
+}
+
+static uint32_t
+traffic_hash(const char *topic, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (uint8_t) topic[i]) * 16777619u;
+	}
+	return h;
+}
+
+int
+traffic_stats_init(void)
+{
+	int rv;
+
+	if (traffic_.enabled) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&traffic_.mtx)) != 0) {
+		return rv;
+	}
+	for (size_t i = 0; i < TRAFFIC_CLIENT_LOCKS; i++) {
+		traffic_stripe *st = &traffic_.stripes[i];
+		if ((rv = nng_mtx_alloc(&st->mtx)) != 0 ||
+		    (rv = nng_id_map_alloc(&st->map, 0, 0, 0)) != 0) {
+			traffic_stats_fini();
+			return rv;
+		}
+	}
+	traffic_.enabled = true;
+	return 0;
+}
+
+static void
+traffic_client_free(void *key, void *value, void *arg)
+{
+	(void) key;
+	(void) arg;
+	nng_free(value, sizeof(traffic_client));
+}
+
+void
+traffic_stats_fini(void)
+{
+	traffic_topics *tt;
+
+	for (size_t i = 0; i < TRAFFIC_CLIENT_LOCKS; i++) {
+		traffic_stripe *st = &traffic_.stripes[i];
+		if (st->map != NULL) {
+			nng_id_map_foreach2(st->map, traffic_client_free, NULL);
+			nng_id_map_free(st->map);
+		}
+		if (st->mtx != NULL) {
+			nng_mtx_free(st->mtx);
+		}
+	}
+	while ((tt = traffic_.topics) != NULL) {
+		traffic_.topics = tt->next;
+		nng_mtx_free(tt->mtx);
+		nng_free(tt, sizeof(*tt));
+	}
+	if (traffic_.mtx != NULL) {
+		nng_mtx_free(traffic_.mtx);
+	}
+	memset(&traffic_, 0, sizeof(traffic_));
+}
+
+bool
+traffic_stats_enabled(void)
+{
+	return traffic_.enabled;
+}
+
+void
+traffic_client_open(uint32_t pipe)
+{
+	traffic_stripe *st;
+	traffic_client *tc;
+
+	if (!traffic_.enabled) {
+		return;
+	}
+	st = traffic_stripe_of(pipe);
+	nng_mtx_lock(st->mtx);
+	if (nng_id_get(st->map, pipe) == NULL &&
+	    (tc = nng_zalloc(sizeof(*tc))) != NULL &&
+	    nng_id_set(st->map, pipe, tc) != 0) {
+		nng_free(tc, sizeof(*tc));
+	}
+	nng_mtx_unlock(st->mtx);
+}
+
+void
+traffic_client_close(uint32_t pipe)
+{
+	traffic_stripe *st;
+	traffic_client *tc;
+
+	if (!traffic_.enabled) {
+		return;
+	}
+	st = traffic_stripe_of(pipe);
+	nng_mtx_lock(st->mtx);
+	if ((tc = nng_id_get(st->map, pipe)) != NULL) {
+		nng_id_remove(st->map, pipe);
+		nng_free(tc, sizeof(*tc));
+	}
+	nng_mtx_unlock(st->mtx);
+}
+
+void
+traffic_client_in(uint32_t pipe, size_t bytes)
+{
+	traffic_stripe *st;
+	traffic_client *tc;
+
+	if (!traffic_.enabled) {
+		return;
+	}
+	st = traffic_stripe_of(pipe);
+	nng_mtx_lock(st->mtx);
+	if ((tc = nng_id_get(st->map, pipe)) != NULL) {
+		tc->msg_in++;
+		tc->bytes_in += bytes;
+	}
+	nng_mtx_unlock(st->mtx);
+}
+
+void
+traffic_client_out(uint32_t pipe, size_t bytes)
+{
+	traffic_stripe *st;
+	traffic_client *tc;
+
+	if (!traffic_.enabled) {
+		return;
+	}
+	st = traffic_stripe_of(pipe);
+	nng_mtx_lock(st->mtx);
+	if ((tc = nng_id_get(st->map, pipe)) != NULL) {
+		tc->msg_out++;
+		tc->bytes_out += bytes;
+	}
+	nng_mtx_unlock(st->mtx);
+}
+
+bool
+traffic_client_get(uint32_t pipe, traffic_client *tc)
+{
+	traffic_stripe *st;
+	traffic_client *found;
+
+	if (!traffic_.enabled) {
+		return false;
+	}
+	st = traffic_stripe_of(pipe);
+	nng_mtx_lock(st->mtx);
+	if ((found = nng_id_get(st->map, pipe)) != NULL) {
+		*tc = *found;
+	}
+	nng_mtx_unlock(st->mtx);
+	return found != NULL;
+}
+
+traffic_topics *
+traffic_topics_alloc(void)
+{
+	traffic_topics *tt;
+
+	if (!traffic_.enabled) {
+		return NULL;
+	}
+	if ((tt = nng_zalloc(sizeof(*tt))) == NULL) {
+		return NULL;
+	}
+	if (nng_mtx_alloc(&tt->mtx) != 0) {
+		nng_free(tt, sizeof(*tt));
+		return NULL;
+	}
+	nng_mtx_lock(traffic_.mtx);
+	tt->next        = traffic_.topics;
+	traffic_.topics = tt;
+	traffic_.ntopics++;
+	nng_mtx_unlock(traffic_.mtx);
+	return tt;
+}
+
+// Start window w, keeping the one before it when that is w - 1.
+static void
+traffic_roll(traffic_topics *tt, uint64_t w)
+{
+	if (tt->window + 1 == w) {
+		memcpy(tt->last, tt->cur, sizeof(tt->cur));
+		tt->last_window = tt->window;
+	} else {
+		tt->last_window = 0;
+	}
+	memset(tt->cur, 0, sizeof(tt->cur));
+	tt->window = w;
+}
+
+void
+traffic_topic_add(
+    traffic_topics *tt, const char *topic, size_t len, size_t bytes)
+{
+	traffic_slot *slot = NULL;
+	traffic_slot *min;
+	uint64_t      w = nng_clock() / NANO_TRAFFIC_WINDOW_MS + 1;
+	uint32_t      hash;
+
+	if (tt == NULL || topic == NULL || len == 0) {
+		return;
+	}
+	if (len >= NANO_TRAFFIC_TOPIC_LEN) {
+		len = NANO_TRAFFIC_TOPIC_LEN - 1;
+	}
+	hash = traffic_hash(topic, len);
+
+	nng_mtx_lock(tt->mtx);
+	if (tt->window != w) {
+		traffic_roll(tt, w);
+	}
+	min = &tt->cur[0];
+	for (size_t i = 0; i < NANO_TRAFFIC_TOPICS; i++) {
+		traffic_slot *s = &tt->cur[i];
+		if (s->len == len && s->hash == hash &&
+		    memcmp(s->topic, topic, len) == 0) {
+			slot = s;
+			break;
+		}
+		if (s->msgs < min->msgs) {
+			min = s;
+		}
+	}
+	if (slot == NULL) {
+		// evict the smallest count, the newcomer inherits it as error
+		slot        = min;
+		slot->error = slot->msgs;
+		slot->hash  = hash;
+		slot->len   = len;
+		memcpy(slot->topic, topic, len);
+		slot->topic[len] = '\0';
+	}
+	slot->msgs++;
+	slot->bytes += bytes;
+	nng_mtx_unlock(tt->mtx);
+}
+
+static int
+traffic_topic_cmp(const void *a, const void *b)
+{
+	const traffic_topic *ta = a;
+	const traffic_topic *tb = b;
+
+	return ta->msgs < tb->msgs ? 1 : ta->msgs > tb->msgs ? -1 : 0;
+}
+
+// Add the used slots to merged, summing topics already in it.
+static size_t
+traffic_merge(traffic_topic *merged, size_t n, const traffic_slot *slots)
+{
+	for (size_t i = 0; i < NANO_TRAFFIC_TOPICS; i++) {
+		const traffic_slot *s = &slots[i];
+		size_t              j;
+
+		if (s->len == 0) {
+			continue;
+		}
+		for (j = 0; j < n; j++) {
+			if (strcmp(merged[j].topic, s->topic) == 0) {
+				break;
+			}
+		}
+		if (j == n) {
+			memcpy(merged[n].topic, s->topic, s->len + 1);
+			merged[n].msgs  = 0;
+			merged[n].bytes = 0;
+			merged[n].error = 0;
+			n++;
+		}
+		merged[j].msgs += s->msgs;
+		merged[j].bytes += s->bytes;
+		merged[j].error += s->error;
+	}
+	return n;
+}
+
+size_t
+traffic_topic_top(traffic_topic *top, size_t cap)
+{
+	traffic_topic *merged;
+	size_t         size;
+	size_t         n = 0;
+	uint64_t       w = nng_clock() / NANO_TRAFFIC_WINDOW_MS;
+
+	if (!traffic_.enabled || cap == 0) {
+		return 0;
+	}
+	nng_mtx_lock(traffic_.mtx);
+	size = sizeof(traffic_topic) * NANO_TRAFFIC_TOPICS * traffic_.ntopics;
+	if (size == 0 || (merged = nng_alloc(size)) == NULL) {
+		nng_mtx_unlock(traffic_.mtx);
+		return 0;
+	}
+	for (traffic_topics *tt = traffic_.topics; tt != NULL; tt = tt->next) {
+		nng_mtx_lock(tt->mtx);
+		if (tt->window == w) {
+			n = traffic_merge(merged, n, tt->cur);
+		} else if (tt->last_window == w && w != 0) {
+			n = traffic_merge(merged, n, tt->last);
+		}
+		nng_mtx_unlock(tt->mtx);
+	}
+	nng_mtx_unlock(traffic_.mtx);
+
+	qsort(merged, n, sizeof(traffic_topic), traffic_topic_cmp);
+	if (n > cap) {
+		n = cap;
+	}
+	memcpy(top, merged, sizeof(traffic_topic) * n);
+	nng_free(merged, size);
+	return n;
+}
@@ -0,0 +1,306 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "include/transform.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef struct {
+	transform_fn   fn;
+	void          *arg;
+	transform_kind kind;
+} transform_item;
+
+typedef struct {
+	nng_atomic_u64 *offloaded;
+	nng_atomic_u64 *inlined;
+	nng_atomic_u64 *overflow;
+	nng_atomic_u64 *cpu_ns;
+} transform_count;
+
+static struct {
+	nng_mtx         *mtx;
+	nng_cv          *cv; // threads, items queued or closing
+	nng_thread     **thrs;
+	size_t           nthrs;
+	transform_item  *queue; // ring
+	size_t           cap;
+	size_t           head;
+	size_t           len;
+	size_t           batch;
+	uint64_t         depth_max;
+	uint64_t         batches;
+	transform_count  count[TRANSFORMS]; // kept off the lock, hot path
+	bool             closing;
+	bool             enabled;
+} transform_;
+
+static const char *transform_names[TRANSFORMS] = {
+	"webhook",
+	"rule_json",
+	"rule_sql",
+};
+
+uint64_t
+transform_cpu_now(void)
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+		return (uint64_t) ts.tv_sec * 1000000000ull +
+		    (uint64_t) ts.tv_nsec;
+	}
+#endif
+	// wall time where threads have no clock of their own
+	return (uint64_t) nng_clock() * 1000000ull;
+}
+
+static void
+transform_cpu_add(transform_kind kind, uint64_t since)
+{
+	uint64_t now = transform_cpu_now();
+
+	if (now > since) {
+		nng_atomic_add64(transform_.count[kind].cpu_ns, now - since);
+	}
+}
+
+static void
+transform_thread(void *arg)
+{
+	transform_item items[NANO_TRANSFORM_BATCH];
+	size_t         n;
+
+	(void) arg;
+	nng_mtx_lock(transform_.mtx);
+	for (;;) {
+		while (!transform_.closing && transform_.len == 0) {
+			nng_cv_wait(transform_.cv);
+		}
+		if (transform_.len == 0) {
+			// closing and drained
+			break;
+		}
+		for (n = 0; n < transform_.batch && transform_.len > 0; n++) {
+			size_t h = transform_.head;
+
+			items[n]        = transform_.queue[h];
+			transform_.head = (h + 1) % transform_.cap;
+			transform_.len--;
+		}
+		transform_.batches++;
+		nng_mtx_unlock(transform_.mtx);
+
+		for (size_t i = 0; i < n; i++) {
+			transform_kind kind  = items[i].kind;
+			uint64_t       since = transform_cpu_now();
+
+			items[i].fn(items[i].arg);
+			transform_cpu_add(kind, since);
+			nng_atomic_inc64(transform_.count[kind].offloaded);
+		}
+
+		nng_mtx_lock(transform_.mtx);
+	}
+	nng_mtx_unlock(transform_.mtx);
+}
+
+int
+transform_submit(transform_kind kind, transform_fn fn, void *arg)
+{
+	if (!transform_.enabled || kind >= TRANSFORMS) {
+		return NNG_ECLOSED;
+	}
+	nng_mtx_lock(transform_.mtx);
+	if (transform_.closing) {
+		nng_mtx_unlock(transform_.mtx);
+		return NNG_ECLOSED;
+	}
+	if (transform_.len == transform_.cap) {
+		nng_mtx_unlock(transform_.mtx);
+		nng_atomic_inc64(transform_.count[kind].overflow);
+		return NNG_EAGAIN;
+	}
+	transform_.queue[(transform_.head + transform_.len) % transform_.cap] =
+	    (transform_item){ .fn = fn, .arg = arg, .kind = kind };
+	transform_.len++;
+	if (transform_.len > transform_.depth_max) {
+		transform_.depth_max = transform_.len;
+	}
+	nng_cv_wake1(transform_.cv);
+	nng_mtx_unlock(transform_.mtx);
+	return 0;
+}
+
+void
+transform_run(transform_kind kind, transform_fn fn, void *arg)
+{
+	uint64_t since = transform_cpu_now();
+
+	fn(arg);
+	transform_account(kind, since);
+}
+
+void
+transform_account(transform_kind kind, uint64_t since)
+{
+	if (!transform_.enabled || kind >= TRANSFORMS) {
+		return;
+	}
+	transform_cpu_add(kind, since);
+	nng_atomic_inc64(transform_.count[kind].inlined);
+}
+
+int
+transform_init(size_t threads, size_t depth, size_t batch)
+{
+	const char *s = getenv("NANOMQ_TRANSFORM");
+	int         rv;
+
+	if (transform_.enabled) {
+		return 0;
+	}
+	if (depth == 0 || batch == 0 || batch > NANO_TRANSFORM_BATCH) {
+		return NNG_EINVAL;
+	}
+	if (threads == 0 || (s != NULL && strcmp(s, "0") == 0)) {
+		return 0;
+	}
+	transform_.cap   = depth;
+	transform_.nthrs = threads;
+	transform_.batch = batch;
+	if ((transform_.queue = nng_zalloc(
+	         sizeof(transform_item) * depth)) == NULL ||
+	    (transform_.thrs = nng_zalloc(sizeof(nng_thread *) * threads)) ==
+	        NULL) {
+		transform_fini();
+		return NNG_ENOMEM;
+	}
+	if ((rv = nng_mtx_alloc(&transform_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&transform_.cv, transform_.mtx)) != 0) {
+		transform_fini();
+		return rv;
+	}
+	for (int i = 0; i < TRANSFORMS; i++) {
+		transform_count *c = &transform_.count[i];
+
+		if ((rv = nng_atomic_alloc64(&c->offloaded)) != 0 ||
+		    (rv = nng_atomic_alloc64(&c->inlined)) != 0 ||
+		    (rv = nng_atomic_alloc64(&c->overflow)) != 0 ||
+		    (rv = nng_atomic_alloc64(&c->cpu_ns)) != 0) {
+			transform_fini();
+			return rv;
+		}
+	}
+	for (size_t i = 0; i < threads; i++) {
+		if ((rv = nng_thread_create(
+		         &transform_.thrs[i], transform_thread, NULL)) != 0) {
+			transform_.thrs[i] = NULL;
+			transform_fini();
+			return rv;
+		}
+	}
+	transform_.enabled = true;
+	return 0;
+}
+
+// The threads run what is still queued before they exit.
+void
+transform_fini(void)
+{
+	uint64_t done = 0;
+
+	if (transform_.mtx != NULL) {
+		nng_mtx_lock(transform_.mtx);
+		transform_.closing = true;
+		nng_cv_wake(transform_.cv);
+		nng_mtx_unlock(transform_.mtx);
+	}
+	for (size_t i = 0; transform_.thrs != NULL && i < transform_.nthrs;
+	     i++) {
+		if (transform_.thrs[i] != NULL) {
+			nng_thread_destroy(transform_.thrs[i]);
+		}
+	}
+	for (int i = 0; i < TRANSFORMS; i++) {
+		transform_count *c = &transform_.count[i];
+
+		if (c->offloaded != NULL) {
+			done += nng_atomic_get64(c->offloaded);
+			nng_atomic_free64(c->offloaded);
+		}
+		if (c->inlined != NULL) {
+			nng_atomic_free64(c->inlined);
+		}
+		if (c->overflow != NULL) {
+			nng_atomic_free64(c->overflow);
+		}
+		if (c->cpu_ns != NULL) {
+			nng_atomic_free64(c->cpu_ns);
+		}
+	}
+	if (transform_.enabled) {
+		log_info("transform: %llu offloaded in %llu batches",
+		    (unsigned long long) done,
+		    (unsigned long long) transform_.batches);
+	}
+	if (transform_.thrs != NULL) {
+		nng_free(
+		    transform_.thrs, sizeof(nng_thread *) * transform_.nthrs);
+	}
+	if (transform_.queue != NULL) {
+		nng_free(
+		    transform_.queue, sizeof(transform_item) * transform_.cap);
+	}
+	if (transform_.cv != NULL) {
+		nng_cv_free(transform_.cv);
+	}
+	if (transform_.mtx != NULL) {
+		nng_mtx_free(transform_.mtx);
+	}
+	memset(&transform_, 0, sizeof(transform_));
+}
+
+bool
+transform_enabled(void)
+{
+	return transform_.enabled;
+}
+
+const char *
+transform_name(transform_kind kind)
+{
+	return kind < TRANSFORMS ? transform_names[kind] : "unknown";
+}
+
+void
+transform_stats_get(transform_kind kind, transform_stats *s)
+{
+	transform_count *c;
+
+	memset(s, 0, sizeof(*s));
+	if (!transform_.enabled || kind >= TRANSFORMS) {
+		return;
+	}
+	c            = &transform_.count[kind];
+	s->offloaded = nng_atomic_get64(c->offloaded);
+	s->inlined   = nng_atomic_get64(c->inlined);
+	s->overflow  = nng_atomic_get64(c->overflow);
+	s->cpu_ns    = nng_atomic_get64(c->cpu_ns);
+	nng_mtx_lock(transform_.mtx);
+	s->depth     = transform_.len;
+	s->depth_max = transform_.depth_max;
+	s->batches   = transform_.batches;
+	nng_mtx_unlock(transform_.mtx);
+}
@@ -0,0 +1,430 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/tree_view.h"
+#include "nng/supplemental/nanolib/cvector.h"
+#include "nng/supplemental/nanolib/mqtt_db.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef struct {
+	char   *topic;
+	char   *path; // the levels from the root down to this one
+	char  **clients;
+	size_t  nclients;
+	size_t  cld_cnt;
+} tv_node;
+
+typedef struct {
+	tv_node *nodes;
+	size_t   n;
+} tv_level;
+
+struct tree_view {
+	tv_level *levels;
+	size_t    nlevels;
+	size_t    nodes;
+	bool      paths; // false if the levels did not add up
+	uint64_t  gen;
+	uint64_t  hash;
+	nng_time  built;
+	int       ref;
+};
+
+static struct {
+	nng_mtx     *mtx;
+	tree_view   *cur;
+	nng_duration min_age;
+	bool         building;
+	uint64_t     builds;
+	uint64_t     served;
+	bool         enabled;
+} view_;
+
+static uint64_t
+tv_fnv(uint64_t h, const void *p, size_t n)
+{
+	const uint8_t *b = p;
+
+	for (size_t i = 0; i < n; i++) {
+		h ^= b[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+static uint64_t
+tv_fnv_str(uint64_t h, const char *s)
+{
+	// the NUL too, so "ab","c" and "a","bc" differ
+	return tv_fnv(h, s != NULL ? s : "", s != NULL ? strlen(s) + 1 : 1);
+}
+
+static void
+tv_free(tree_view *v)
+{
+	for (size_t i = 0; i < v->nlevels; i++) {
+		tv_level *l = &v->levels[i];
+
+		for (size_t j = 0; j < l->n; j++) {
+			for (size_t k = 0; k < l->nodes[j].nclients; k++) {
+				nng_strfree(l->nodes[j].clients[k]);
+			}
+			if (l->nodes[j].clients != NULL) {
+				nng_free(l->nodes[j].clients,
+				    l->nodes[j].nclients * sizeof(char *));
+			}
+			nng_strfree(l->nodes[j].topic);
+			nng_strfree(l->nodes[j].path);
+		}
+		if (l->nodes != NULL) {
+			nng_free(l->nodes, l->n * sizeof(tv_node));
+		}
+	}
+	if (v->levels != NULL) {
+		nng_free(v->levels, v->nlevels * sizeof(tv_level));
+	}
+	nng_free(v, sizeof(*v));
+}
+
+// the root is level 0 and has no topic level of its own
+static char *
+tv_path(size_t level, const char *parent, const char *topic)
+{
+	size_t plen, tlen;
+	char  *p;
+
+	if (level <= 1) {
+		return nng_strdup(level == 0 ? "" : topic);
+	}
+	plen = strlen(parent);
+	tlen = strlen(topic);
+	if ((p = nng_alloc(plen + tlen + 2)) == NULL) {
+		return NULL;
+	}
+	memcpy(p, parent, plen);
+	p[plen] = '/';
+	memcpy(p + plen + 1, topic, tlen + 1);
+	return p;
+}
+
+/*
+ * Levels come breadth first: the children of level i are level i + 1 in
+ * the order of their parents, cld_cnt of them each, so a node finds its
+ * parent by counting. A level that does not add up leaves the paths out.
+ */
+static int
+tv_copy(tree_view *v, dbtree_info ***vn)
+{
+	v->paths   = true;
+	v->nlevels = cvector_size(vn);
+	if (v->nlevels > 0 &&
+	    (v->levels = nng_zalloc(v->nlevels * sizeof(tv_level))) == NULL) {
+		v->nlevels = 0;
+		return NNG_ENOMEM;
+	}
+	v->hash = 14695981039346656037ull;
+	for (size_t i = 0; i < v->nlevels; i++) {
+		tv_level *l      = &v->levels[i];
+		tv_level *up     = i > 0 ? &v->levels[i - 1] : NULL;
+		size_t    parent = 0;
+		size_t    left   = 0;
+		size_t    n      = cvector_size(vn[i]);
+
+		if (up != NULL && up->n > 0) {
+			left = up->nodes[0].cld_cnt;
+		}
+		if (n > 0 &&
+		    (l->nodes = nng_zalloc(n * sizeof(tv_node))) == NULL) {
+			return NNG_ENOMEM;
+		}
+		l->n = n;
+		for (size_t j = 0; j < n; j++) {
+			dbtree_info *in = vn[i][j];
+			tv_node     *nd = &l->nodes[j];
+
+			while (up != NULL && left == 0 && ++parent < up->n) {
+				left = up->nodes[parent].cld_cnt;
+			}
+			if (up != NULL && parent >= up->n) {
+				v->paths = false;
+			}
+			nd->cld_cnt  = in->cld_cnt;
+			nd->nclients = cvector_size(in->clients);
+			if ((nd->topic = nng_strdup(
+			         in->topic != NULL ? in->topic : "")) == NULL ||
+			    (nd->nclients > 0 &&
+			        (nd->clients = nng_zalloc(
+			             nd->nclients * sizeof(char *))) == NULL)) {
+				nd->nclients = 0;
+				return NNG_ENOMEM;
+			}
+			for (size_t k = 0; k < nd->nclients; k++) {
+				// a pipe gone meanwhile has no client id
+				const char *id = in->clients[k];
+				if ((nd->clients[k] = nng_strdup(
+				         id != NULL ? id : "")) == NULL) {
+					return NNG_ENOMEM;
+				}
+				v->hash = tv_fnv_str(v->hash, id);
+			}
+			if (v->paths) {
+				nd->path = tv_path(i,
+				    up != NULL ? up->nodes[parent].path : NULL,
+				    nd->topic);
+				if (nd->path == NULL) {
+					return NNG_ENOMEM;
+				}
+			}
+			left    = left > 0 ? left - 1 : 0;
+			v->hash = tv_fnv_str(v->hash, nd->topic);
+			v->hash =
+			    tv_fnv(v->hash, &nd->cld_cnt, sizeof(nd->cld_cnt));
+			v->nodes++;
+		}
+		v->hash = tv_fnv(v->hash, &n, sizeof(n));
+	}
+	return 0;
+}
+
+static void
+tv_levels_free(dbtree_info ***vn)
+{
+	for (size_t i = 0; i < cvector_size(vn); i++) {
+		for (size_t j = 0; j < cvector_size(vn[i]); j++) {
+			nng_strfree(vn[i][j]->topic);
+			cvector_free(vn[i][j]->clients);
+			nng_free(vn[i][j], sizeof(dbtree_info));
+		}
+		cvector_free(vn[i]);
+	}
+	cvector_free(vn);
+}
+
+tree_view *
+tree_view_hold(uint64_t gen)
+{
+	tree_view *v;
+	nng_time   now = nng_clock();
+
+	if (!view_.enabled) {
+		return NULL;
+	}
+	nng_mtx_lock(view_.mtx);
+	if ((v = view_.cur) != NULL &&
+	    ((gen != 0 && v->gen == gen) || view_.building ||
+	        now < v->built + (nng_time) view_.min_age)) {
+		v->ref++;
+		view_.served++;
+	} else {
+		view_.building = true;
+		v              = NULL;
+	}
+	nng_mtx_unlock(view_.mtx);
+	return v;
+}
+
+tree_view *
+tree_view_publish(uint64_t gen, void **levels)
+{
+	dbtree_info ***vn = (dbtree_info ***) levels;
+	tree_view     *v, *old = NULL;
+
+	if ((v = nng_zalloc(sizeof(*v))) != NULL && tv_copy(v, vn) != 0) {
+		tv_free(v);
+		v = NULL;
+	}
+	tv_levels_free(vn);
+	if (!view_.enabled) {
+		if (v != NULL) {
+			v->ref = 1;
+		}
+		return v;
+	}
+
+	nng_mtx_lock(view_.mtx);
+	view_.building = false;
+	if (v != NULL) {
+		v->gen   = gen;
+		v->built = nng_clock();
+		v->ref   = 2; // the caller's and the current one's
+		old      = view_.cur;
+		view_.cur = v;
+		view_.builds++;
+		if (old != NULL && --old->ref > 0) {
+			old = NULL;
+		}
+	}
+	nng_mtx_unlock(view_.mtx);
+
+	if (old != NULL) {
+		tv_free(old);
+	}
+	return v;
+}
+
+void
+tree_view_release(tree_view *v)
+{
+	bool last;
+
+	if (v == NULL) {
+		return;
+	}
+	if (!view_.enabled) {
+		last = --v->ref == 0;
+	} else {
+		nng_mtx_lock(view_.mtx);
+		last = --v->ref == 0;
+		nng_mtx_unlock(view_.mtx);
+	}
+	if (last) {
+		tv_free(v);
+	}
+}
+
+uint64_t
+tree_view_hash(const tree_view *v)
+{
+	return v->hash;
+}
+
+static bool
+tv_under(const char *path, const char *prefix, size_t plen)
+{
+	return path != NULL && strncmp(path, prefix, plen) == 0 &&
+	    (path[plen] == '\0' || path[plen] == '/');
+}
+
+static void
+tv_write_node(json_writer *w, const tv_node *nd)
+{
+	json_write_begin(w, '{');
+	json_field_str(w, "topic", nd->topic);
+	json_field_u64(w, "cld_cnt", nd->cld_cnt);
+	json_write_key(w, "clientid");
+	json_write_begin(w, '[');
+	for (size_t k = 0; k < nd->nclients; k++) {
+		json_write_string(w, nd->clients[k], strlen(nd->clients[k]));
+	}
+	json_write_end(w, ']');
+	json_write_end(w, '}');
+}
+
+int
+tree_view_write(
+    const tree_view *v, json_writer *w, const char *prefix, size_t depth)
+{
+	size_t first = 0;
+	size_t plen  = 0;
+
+	if (prefix != NULL && *prefix != '\0') {
+		bool found = false;
+
+		if (!v->paths) {
+			return NNG_ENOTSUP;
+		}
+		// one level further down per separator, below the root
+		first = 1;
+		plen  = strlen(prefix);
+		for (size_t i = 0; i < plen; i++) {
+			first += prefix[i] == '/';
+		}
+		for (size_t j = 0; first < v->nlevels &&
+		     j < v->levels[first].n && !found; j++) {
+			found = strcmp(v->levels[first].nodes[j].path, prefix) == 0;
+		}
+		if (!found) {
+			return NNG_ENOENT;
+		}
+	}
+
+	json_write_begin(w, '[');
+	for (size_t i = first; i < v->nlevels; i++) {
+		const tv_level *l = &v->levels[i];
+		size_t          j = 0, end;
+
+		if (depth > 0 && i - first >= depth) {
+			break;
+		}
+
+		// those below the prefix are one run of each level, nothing
+		// further down once a level has none
+		while (plen > 0 && j < l->n &&
+		    !tv_under(l->nodes[j].path, prefix, plen)) {
+			j++;
+		}
+		for (end = j; end < l->n &&
+		     (plen == 0 || tv_under(l->nodes[end].path, prefix, plen));
+		     end++) {
+		}
+		if (j == end && i > first) {
+			break;
+		}
+		json_write_begin(w, '[');
+		for (; j < end; j++) {
+			tv_write_node(w, &l->nodes[j]);
+		}
+		json_write_end(w, ']');
+	}
+	json_write_end(w, ']');
+	return 0;
+}
+
+int
+tree_view_init(nng_duration min_age)
+{
+	int rv;
+
+	if (view_.enabled) {
+		return 0;
+	}
+	if (min_age < 0) {
+		return NNG_EINVAL;
+	}
+	if ((rv = nng_mtx_alloc(&view_.mtx)) != 0) {
+		return rv;
+	}
+	view_.min_age = min_age;
+	view_.enabled = true;
+	return 0;
+}
+
+void
+tree_view_fini(void)
+{
+	if (view_.cur != NULL) {
+		tree_view_release(view_.cur);
+	}
+	if (view_.mtx != NULL) {
+		nng_mtx_free(view_.mtx);
+	}
+	memset(&view_, 0, sizeof(view_));
+}
+
+bool
+tree_view_enabled(void)
+{
+	return view_.enabled;
+}
+
+void
+tree_view_stats_get(tree_view_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!view_.enabled) {
+		return;
+	}
+	nng_mtx_lock(view_.mtx);
+	s->builds = view_.builds;
+	s->served = view_.served;
+	s->nodes  = view_.cur != NULL ? view_.cur->nodes : 0;
+	nng_mtx_unlock(view_.mtx);
+}
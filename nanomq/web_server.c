@@ -9,6 +9,7 @@
 //
 
 #define INPROC_URL "inproc://rest"
+#define INPROC_SLOW_URL "inproc://rest_slow"
 
 #include "nng/nng.h"
 #include "nng/protocol/pair0/pair.h"
@@ -23,6 +24,9 @@
 #include "include/rest_api.h"
 #include "include/mqtt_api.h"
 #include "include/web_server.h"
+#include "include/auth_cache.h"
+#include "include/tree_view.h"
+#include "include/profiler.h"
 // #include "utils/log.h"
 
 typedef enum {
@@ -37,9 +41,25 @@ typedef struct rest_job {
 	nng_msg *        msg;      // request message
 	nng_aio *        aio;      // request flow
 	nng_ctx          ctx;      // context on the request socket
+	nng_atomic_int  *busy;     // claimed, NULL for jobs off the pool
 	struct rest_job *next;     // next on the freelist
 } rest_job;
 
+/*
+ * Requests are served in two lanes. Quick status endpoints are answered
+ * by callback driven workers, everything else by workers on their own
+ * threads, so a slow tree or config dump neither holds up a health check
+ * nor an nng taskq thread. A lane adds a worker whenever all of its
+ * workers are busy, up to NANO_REST_WORKERS_MAX.
+ */
+enum {
+	REST_LANE_FAST,
+	REST_LANE_SLOW,
+	REST_LANES,
+};
+
+typedef struct rest_lane rest_lane;
+
 struct rest_work {
 	enum {
 		SRV_INIT,
@@ -52,10 +72,27 @@ struct rest_work {
 	nng_ctx           ctx;
 	conf_http_server *conf;
 	nng_socket *client_sock; // client socket for post message to broker.
+	rest_lane  *lane;
+	nng_thread *thr; // slow lane only
 };
 
-static nng_socket        req_sock;
-static nng_mtx *         job_lock;
+struct rest_lane {
+	nng_socket        sock;
+	bool              threaded;
+	nng_mtx          *mtx; // adding a worker
+	nng_atomic_int   *busy;
+	nng_atomic_int   *size;
+	size_t            nworks;
+	struct rest_work *works[NANO_REST_WORKERS_MAX];
+	conf_http_server *conf;
+	nng_socket       *client_sock;
+};
+
+static nng_socket        req_sock[REST_LANES];
+static rest_lane         lanes[REST_LANES];
+static rest_job          job_pool[NANO_REST_JOBS];
+static nng_atomic_int *  job_hint;
+static nng_mtx *         job_lock; // jobs past the pool
 static rest_job *        job_freelist;
 static nng_mtx *         mtx_log;
 static nng_thread *      inproc_thr;
@@ -64,8 +101,9 @@ static conf_http_server *http_server_conf;
 static conf *            global_config;
 static nng_time          boot_time;
 
-static struct rest_work *alloc_work(nng_socket sock, conf_http_server *conf);
+static struct rest_work *alloc_work(rest_lane *lane);
 static void              inproc_cb(void *arg);
+static void              rest_work_thread(void *arg);
 static void              rest_job_cb(void *arg);
 
 static void
@@ -83,7 +121,11 @@ rest_recycle_job(rest_job *job)
 		nng_ctx_close(job->ctx);
 	}
 
-	nng_mtx_lock(job_lock);
+	if (job->busy != NULL) {
+		nng_atomic_set(job->busy, 0);
+		return;
+	}
+	PROF_LOCK(PROF_LOCK_REST_JOB, job_lock);
 	job->next    = job_freelist;
 	job_freelist = job;
 	nng_mtx_unlock(job_lock);
@@ -93,8 +135,25 @@ static rest_job *
 rest_get_job(void)
 {
 	rest_job *job;
+	int       hint = nng_atomic_get(job_hint);
+
+	// claim a free pool slot from where the last claim ended
+	for (int i = 0; i < NANO_REST_JOBS; i++) {
+		int n = (hint + i) % NANO_REST_JOBS;
+		job   = &job_pool[n];
+		if (!nng_atomic_cas(job->busy, 0, 1)) {
+			continue;
+		}
+		nng_atomic_set(job_hint, (n + 1) % NANO_REST_JOBS);
+		if (job->aio == NULL &&
+		    nng_aio_alloc(&job->aio, rest_job_cb, job) != 0) {
+			nng_atomic_set(job->busy, 0);
+			return (NULL);
+		}
+		return (job);
+	}
 
-	nng_mtx_lock(job_lock);
+	PROF_LOCK(PROF_LOCK_REST_JOB, job_lock);
 	if ((job = job_freelist) != NULL) {
 		job_freelist = job->next;
 		nng_mtx_unlock(job_lock);
@@ -175,6 +234,10 @@ rest_job_cb(void *arg)
 			nng_http_res_set_header(
 			    job->http_res, "Cookies", res_msg->token);
 		}
+		if (res_msg->etag_len > 0) {
+			nng_http_res_set_header(
+			    job->http_res, "ETag", res_msg->etag);
+		}
 
 		destory_http_msg(res_msg);
 		nng_msg_clear(job->msg);
@@ -193,6 +256,34 @@ rest_job_cb(void *arg)
 	}
 }
 
+// Status endpoints cheap enough to never wait behind a slow request.
+static int
+rest_lane_of(const char *uri)
+{
+	static const char *fast[] = { "brokers", "nodes", "metrics",
+		"prometheus", "latency", "resources", "ctrl" };
+	size_t len = strlen(REST_URI_ROOT);
+
+	if (uri == NULL || strncmp(uri, REST_URI_ROOT, len) != 0) {
+		return REST_LANE_FAST;
+	}
+	uri += len;
+	while (*uri == '/') {
+		uri++;
+	}
+	if (*uri == '\0' || *uri == '?') {
+		return REST_LANE_FAST;
+	}
+	for (size_t i = 0; i < sizeof(fast) / sizeof(fast[0]); i++) {
+		size_t n = strlen(fast[i]);
+		if (strncmp(uri, fast[i], n) == 0 &&
+		    (uri[n] == '\0' || uri[n] == '/' || uri[n] == '?')) {
+			return REST_LANE_FAST;
+		}
+	}
+	return REST_LANE_SLOW;
+}
+
 // Our rest server just takes the message body, creates a request ID
 // for it, and sends it on.  This runs in raw mode, so
 void
@@ -207,19 +298,21 @@ rest_handle(nng_aio *aio)
 	int              rv;
 	void *           data;
 
+	const char *uri    = nng_http_req_get_uri(req);
+	const char *method = nng_http_req_get_method(req);
+
 	if ((job = rest_get_job()) == NULL) {
 		nng_aio_finish(aio, NNG_ENOMEM);
 		return;
 	}
 	if (((rv = nng_http_res_alloc(&job->http_res)) != 0) ||
-	    ((rv = nng_ctx_open(&job->ctx, req_sock)) != 0)) {
+	    ((rv = nng_ctx_open(&job->ctx, req_sock[rest_lane_of(uri)])) !=
+	        0)) {
 		rest_recycle_job(job);
 		nng_aio_finish(aio, rv);
 		return;
 	}
 
-	const char *uri    = nng_http_req_get_uri(req);
-	const char *method = nng_http_req_get_method(req);
 	const char *content_type =
 	    nng_http_req_get_header(req, "Content-Type");
 	const char *token = nng_http_req_get_header(req, "Authorization");
@@ -228,6 +321,7 @@ rest_handle(nng_aio *aio)
 	http_msg recv_msg = { 0 };
 
 	put_http_msg(&recv_msg, content_type, method, uri, token, data, sz);
+	put_http_etag(&recv_msg, nng_http_req_get_header(req, "If-None-Match"));
 
 	if ((rv = nng_msg_alloc(&job->msg, sizeof(http_msg))) != 0) {
 		rest_http_fatal(job, "nng_msg_alloc: %s", rv);
@@ -255,6 +349,14 @@ rest_start(uint16_t port)
 		NANO_NNG_FATAL("nng_mtx_alloc", rv);
 	}
 	job_freelist = NULL;
+	if ((rv = nng_atomic_alloc(&job_hint)) != 0) {
+		NANO_NNG_FATAL("nng_atomic_alloc", rv);
+	}
+	for (size_t i = 0; i < NANO_REST_JOBS; i++) {
+		if ((rv = nng_atomic_alloc(&job_pool[i].busy)) != 0) {
+			NANO_NNG_FATAL("nng_atomic_alloc", rv);
+		}
+	}
 
 	// Set up some strings, etc.  We use the port number
 	// from the argument list.
@@ -264,15 +366,20 @@ rest_start(uint16_t port)
 		return;
 	}
 
-	// Create the REQ socket, and put it in raw mode, connected to
-	// the remote REP server (our inproc server in this case).
-	if ((rv = nng_req0_open(&req_sock)) != 0) {
+	// Create the REQ sockets, and put them in raw mode, connected to
+	// the remote REP server of each lane (our inproc server in this case).
+	if ((rv = nng_req0_open(&req_sock[REST_LANE_FAST])) != 0 ||
+	    (rv = nng_req0_open(&req_sock[REST_LANE_SLOW])) != 0) {
 		NANO_NNG_FATAL("nng_req0_open", rv);
 	}
-	if ((rv = nng_dial(req_sock, INPROC_URL, NULL, NNG_FLAG_NONBLOCK)) !=
-	    0) {
+	if ((rv = nng_dial(req_sock[REST_LANE_FAST], INPROC_URL, NULL,
+	         NNG_FLAG_NONBLOCK)) != 0) {
 		NANO_NNG_FATAL("nng_dial(" INPROC_URL ")", rv);
 	}
+	if ((rv = nng_dial(req_sock[REST_LANE_SLOW], INPROC_SLOW_URL, NULL,
+	         NNG_FLAG_NONBLOCK)) != 0) {
+		NANO_NNG_FATAL("nng_dial(" INPROC_SLOW_URL ")", rv);
+	}
 
 	// Get a suitable HTTP server instance.  This creates one
 	// if it doesn't already exist.
@@ -333,20 +440,83 @@ rest_start(uint16_t port)
 	nng_url_free(url);
 }
 
-void
-inproc_server(void *arg)
+// Called with the lane lock held, or before the lane takes requests.
+static void
+rest_lane_add(rest_lane *lane)
 {
-	conf_http_server * rest_conf = arg;
-	nng_socket         sock;
-	nng_socket         client_sock;
-	struct rest_work **works =
-	    nng_zalloc(rest_conf->parallel * sizeof(struct rest_work *));
+	struct rest_work *w;
+	int               rv;
+
+	if (lane->nworks >= NANO_REST_WORKERS_MAX) {
+		return;
+	}
+	w                            = alloc_work(lane);
+	lane->works[lane->nworks++] = w;
+	nng_atomic_inc(lane->size);
+	if (!lane->threaded) {
+		inproc_cb(w);
+	} else if ((rv = nng_thread_create(&w->thr, rest_work_thread, w)) !=
+	    0) {
+		NANO_NNG_FATAL("nng_thread_create", rv);
+	}
+}
 
+static void
+rest_lane_start(rest_lane *lane, const char *url, size_t workers,
+    bool threaded, conf_http_server *conf, nng_socket *client_sock)
+{
 	int rv;
-	if ((rv = nng_rep0_open(&sock)) != 0) {
+
+	if ((rv = nng_rep0_open(&lane->sock)) != 0) {
 		NANO_NNG_FATAL("nng_rep0_open", rv);
 	}
+	if ((rv = nng_mtx_alloc(&lane->mtx)) != 0 ||
+	    (rv = nng_atomic_alloc(&lane->busy)) != 0 ||
+	    (rv = nng_atomic_alloc(&lane->size)) != 0) {
+		NANO_NNG_FATAL("rest lane", rv);
+	}
+	lane->threaded    = threaded;
+	lane->conf        = conf;
+	lane->client_sock = client_sock;
+	if ((rv = nng_listen(lane->sock, url, NULL, 0)) != 0) {
+		NANO_NNG_FATAL("nng_listen", rv);
+	}
+	if (workers == 0) {
+		workers = 1;
+	}
+	for (size_t i = 0; i < workers; i++) {
+		rest_lane_add(lane);
+	}
+}
+
+// A worker took a request, add one more if that left none idle.
+static void
+rest_lane_busy(rest_lane *lane)
+{
+	nng_atomic_inc(lane->busy);
+	if (nng_atomic_get(lane->busy) < nng_atomic_get(lane->size)) {
+		return;
+	}
+	nng_mtx_lock(lane->mtx);
+	if (nng_atomic_get(lane->busy) >= (int) lane->nworks) {
+		rest_lane_add(lane);
+	}
+	nng_mtx_unlock(lane->mtx);
+}
+
+static void
+rest_lane_idle(rest_lane *lane)
+{
+	nng_atomic_dec_nv(lane->busy);
+}
 
+void
+inproc_server(void *arg)
+{
+	conf_http_server * rest_conf = arg;
+	static nng_socket  client_sock;
+
+	int rv;
 	if ((rv = nng_req0_open(&client_sock)) != 0) {
 		NANO_NNG_FATAL("nng_rep0_open", rv);
 	}
@@ -356,28 +526,31 @@ inproc_server(void *arg)
 		NANO_NNG_FATAL("nng_dial " INPROC_SERVER_URL, rv);
 	}
 
-	for (size_t i = 0; i < rest_conf->parallel; i++) {
-		works[i] = alloc_work(sock, rest_conf);
-
-		works[i]->client_sock = &client_sock;
-	}
-
-	if ((rv = nng_listen(sock, INPROC_URL, NULL, 0)) != 0) {
-		NANO_NNG_FATAL("nng_listen", rv);
-	}
-
-	for (size_t i = 0; i < rest_conf->parallel; i++) {
-		inproc_cb(works[i]);
-	}
+	rest_lane_start(&lanes[REST_LANE_FAST], INPROC_URL, rest_conf->parallel,
+	    false, rest_conf, &client_sock);
+	rest_lane_start(&lanes[REST_LANE_SLOW], INPROC_SLOW_URL,
+	    NANO_REST_SLOW_WORKERS, true, rest_conf, &client_sock);
 
 	for (;;) {
 		nng_msleep(3600000); // neither pause() nor sleep() portable
 	}
+}
 
-	for (size_t i = 0; i < rest_conf->parallel; i++) {
-		nng_free(works[i], sizeof(struct rest_work));
-	}
-	nng_free(works, rest_conf->parallel * sizeof(struct rest_work *));
+// Hand a request to the REST API and return the reply to send back.
+static nng_msg *
+rest_work_serve(struct rest_work *work, nng_msg *msg)
+{
+	nng_msg * rep;
+	http_msg *http_ct = (http_msg *) nng_msg_body(msg);
+	http_msg  res     = process_request(http_ct, work->conf, work->client_sock);
+
+	// response to client
+	nng_msg_alloc(&rep, sizeof(http_msg));
+	// TODO performace bottlenect here (Copy structure 3 times)
+	memcpy(nng_msg_body(rep), &res, sizeof(http_msg));
+	destory_http_msg(http_ct);
+	nng_msg_free(msg);
+	return rep;
 }
 
 static void
@@ -398,16 +571,9 @@ inproc_cb(void *arg)
 			NANO_NNG_FATAL("nng_ctx_recv", rv);
 		}
 
-		msg               = nng_aio_get_msg(work->aio);
-		http_msg *http_ct = (http_msg *) nng_msg_body(msg);
-		http_msg  res     = process_request(http_ct, work->conf, work->client_sock);
-
-		// response to client
-		nng_msg_alloc(&work->msg, sizeof(http_msg));
-		// TODO performace bottlenect here (Copy structure 3 times)
-		memcpy(nng_msg_body(work->msg), &res, sizeof(http_msg));
-		destory_http_msg(http_ct);
-		nng_msg_free(msg);
+		msg = nng_aio_get_msg(work->aio);
+		rest_lane_busy(work->lane);
+		work->msg = rest_work_serve(work, msg);
 
 		nng_aio_set_msg(work->aio, work->msg);
 		work->msg   = NULL;
@@ -416,6 +582,7 @@ inproc_cb(void *arg)
 		break;
 
 	case SRV_SEND:
+		rest_lane_idle(work->lane);
 		if ((rv = nng_aio_result(work->aio)) != 0) {
 			nng_msg_free(work->msg);
 			NANO_NNG_FATAL("nng_ctx_send", rv);
@@ -430,23 +597,57 @@ inproc_cb(void *arg)
 	}
 }
 
+static void
+rest_work_thread(void *arg)
+{
+	struct rest_work *work = arg;
+	nng_msg *         msg;
+	int               rv;
+
+	for (;;) {
+		nng_ctx_recv(work->ctx, work->aio);
+		nng_aio_wait(work->aio);
+		if ((rv = nng_aio_result(work->aio)) != 0) {
+			if (rv == NNG_ECLOSED) {
+				return;
+			}
+			NANO_NNG_FATAL("nng_ctx_recv", rv);
+		}
+
+		msg = nng_aio_get_msg(work->aio);
+		rest_lane_busy(work->lane);
+		nng_aio_set_msg(work->aio, rest_work_serve(work, msg));
+		nng_ctx_send(work->ctx, work->aio);
+		nng_aio_wait(work->aio);
+		rest_lane_idle(work->lane);
+		if ((rv = nng_aio_result(work->aio)) != 0) {
+			nng_msg_free(nng_aio_get_msg(work->aio));
+			NANO_NNG_FATAL("nng_ctx_send", rv);
+		}
+	}
+}
+
 static struct rest_work *
-alloc_work(nng_socket sock, conf_http_server *conf)
+alloc_work(rest_lane *lane)
 {
 	struct rest_work *w;
 	int               rv;
 
-	if ((w = nng_alloc(sizeof(*w))) == NULL) {
+	if ((w = nng_zalloc(sizeof(*w))) == NULL) {
 		NANO_NNG_FATAL("nng_alloc", NNG_ENOMEM);
 	}
-	if ((rv = nng_aio_alloc(&w->aio, inproc_cb, w)) != 0) {
+	// slow lane workers wait on their aio from their own thread
+	if ((rv = nng_aio_alloc(&w->aio, lane->threaded ? NULL : inproc_cb,
+	         w)) != 0) {
 		NANO_NNG_FATAL("nng_aio_alloc", rv);
 	}
-	if ((rv = nng_ctx_open(&w->ctx, sock)) != 0) {
+	if ((rv = nng_ctx_open(&w->ctx, lane->sock)) != 0) {
 		NANO_NNG_FATAL("nng_ctx_open", rv);
 	}
-	w->conf  = conf;
-	w->state = SRV_INIT;
+	w->conf        = lane->conf;
+	w->client_sock = lane->client_sock;
+	w->lane        = lane;
+	w->state       = SRV_INIT;
 	return (w);
 }
 
@@ -502,6 +703,12 @@ int
 start_rest_server(conf *conf)
 {
 	int rv;
+	if ((rv = auth_cache_init()) != 0) {
+		log_error("auth cache disabled: %d", rv);
+	}
+	if ((rv = tree_view_init(NANO_TREE_VIEW_MIN_MS)) != 0) {
+		log_error("topic tree snapshots disabled: %d", rv);
+	}
 	rv = nng_thread_create(&inproc_thr, inproc_server, &conf->http_server);
 	if (rv != 0) {
 		NANO_NNG_FATAL("cannot start inproc server", rv);
@@ -522,4 +729,6 @@ void
 stop_rest_server(void)
 {
 	nng_thread_destroy(inproc_thr);
+	auth_cache_fini();
+	tree_view_fini();
 }
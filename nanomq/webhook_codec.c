@@ -0,0 +1,133 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdbool.h>
+
+#include "include/webhook_codec.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static const char base64_abc[65] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char base62_abc[65] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789AB";
+
+#if defined(__SSSE3__)
+/*
+ * 12 bytes at in, 16 readable, to 16 characters at out. The bytes are
+ * spread to one 6 bit index per output byte, which goes to its character
+ * by an offset looked up for the range it falls in: A-Z, a-z, 0-9 and the
+ * two last characters of abc.
+ */
+static inline void
+encode_block(const uint8_t *in, char *out, __m128i offsets)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *) in);
+	__m128i hi;
+	__m128i lo;
+	__m128i idx;
+	__m128i range;
+
+	v  = _mm_shuffle_epi8(
+            v, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	hi = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)),
+	    _mm_set1_epi32(0x04000040));
+	lo = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)),
+	    _mm_set1_epi32(0x01000010));
+	idx = _mm_or_si128(hi, lo);
+
+	// 0 for a-z, 1 to 12 for the digits and the last two, 13 for A-Z
+	range = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+	range = _mm_or_si128(range,
+	    _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx),
+	        _mm_set1_epi8(13)));
+	_mm_storeu_si128((__m128i *) out,
+	    _mm_add_epi8(idx, _mm_shuffle_epi8(offsets, range)));
+}
+#endif
+
+static size_t
+encode(const uint8_t *in, size_t len, char *out, const char *abc, bool pad)
+{
+	size_t   i = 0;
+	size_t   j = 0;
+	uint32_t v;
+
+#if defined(__SSSE3__)
+	const char digit   = (char) (abc[52] - 52);
+	__m128i    offsets = _mm_setr_epi8((char) (abc[26] - 26), digit, digit,
+           digit, digit, digit, digit, digit, digit, digit, digit,
+           (char) (abc[62] - 62), (char) (abc[63] - 63), abc[0], 0, 0);
+
+	for (; len - i >= 16; i += 12, j += 16) {
+		encode_block(in + i, out + j, offsets);
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint8_t *t   = (const uint8_t *) abc;
+	uint8x16x4_t   tbl = { { vld1q_u8(t), vld1q_u8(t + 16),
+                vld1q_u8(t + 32), vld1q_u8(t + 48) } };
+
+	// 48 bytes deinterleaved into three vectors, 64 characters out
+	for (; len - i >= 48; i += 48, j += 64) {
+		uint8x16x3_t s = vld3q_u8(in + i);
+		uint8x16x4_t d;
+
+		d.val[0] = vshrq_n_u8(s.val[0], 2);
+		d.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(s.val[0], vdupq_n_u8(0x03)), 4),
+		    vshrq_n_u8(s.val[1], 4));
+		d.val[2] = vorrq_u8(vshlq_n_u8(vandq_u8(s.val[1], vdupq_n_u8(0x0f)), 2),
+		    vshrq_n_u8(s.val[2], 6));
+		d.val[3] = vandq_u8(s.val[2], vdupq_n_u8(0x3f));
+		for (int k = 0; k < 4; k++) {
+			d.val[k] = vqtbl4q_u8(tbl, d.val[k]);
+		}
+		vst4q_u8((uint8_t *) out + j, d);
+	}
+#endif
+	for (; len - i >= 3; i += 3) {
+		v        = (uint32_t) in[i] << 16 | (uint32_t) in[i + 1] << 8 |
+		    in[i + 2];
+		out[j++] = abc[v >> 18];
+		out[j++] = abc[(v >> 12) & 0x3f];
+		out[j++] = abc[(v >> 6) & 0x3f];
+		out[j++] = abc[v & 0x3f];
+	}
+	if (len - i > 0) {
+		v        = (uint32_t) in[i] << 16 |
+		    (len - i > 1 ? (uint32_t) in[i + 1] << 8 : 0);
+		out[j++] = abc[v >> 18];
+		out[j++] = abc[(v >> 12) & 0x3f];
+		if (len - i > 1) {
+			out[j++] = abc[(v >> 6) & 0x3f];
+		} else if (pad) {
+			out[j++] = '=';
+		}
+		if (pad) {
+			out[j++] = '=';
+		}
+	}
+	out[j] = '\0';
+	return j;
+}
+
+size_t
+webhook_base64_encode(const uint8_t *in, size_t len, char *out)
+{
+	return encode(in, len, out, base64_abc, true);
+}
+
+size_t
+webhook_base62_encode(const uint8_t *in, size_t len, char *out)
+{
+	return encode(in, len, out, base62_abc, false);
+}
@@ -13,7 +13,9 @@
 #include <time.h>
 #include <inttypes.h>
 
+#include "include/startup.h"
 #include "include/webhook_inproc.h"
+#include "include/webhook_pool.h"
 #include "nanomq.h"
 #include "nng/nng.h"
 #include "nng/protocol/pipeline0/pull.h"
@@ -28,6 +30,7 @@
 #include "nng/mqtt/mqtt_client.h"
 
 #ifdef SUPP_PARQUET
+#include "include/exchange_query.h"
 #include "nng/supplemental/nanolib/parquet.h"
 #endif
 
@@ -35,8 +38,6 @@
 #include "nng/supplemental/nanolib/blf.h"
 #endif
 
-#define NANO_LMQ_INIT_CAP 16
-
 // The server keeps a list of work items, sorted by expiration time,
 // so that we can use this to set the timeout to the correct value for
 // use in poll.
@@ -44,9 +45,6 @@ struct hook_work {
 	enum { HOOK_INIT, HOOK_RECV, HOOK_WAIT, HOOK_SEND } state;
 	nng_aio *      aio;
 	nng_msg *      msg;
-	nng_thread *   thread;
-	nng_mtx *      mtx;
-	nng_lmq *      lmq;
 	nng_socket     sock;
 	conf_web_hook *conf;
 	uint32_t       id;
@@ -58,6 +56,7 @@ struct hook_work {
 static void hook_work_cb(void *arg);
 
 static nng_thread     *hook_thr;
+static webhook_pool   *hook_pool             = NULL;
 static nng_atomic_int *hook_search_limit     = NULL;
 static nng_aio        *hook_search_reset_aio = NULL;
 
@@ -174,119 +173,16 @@ send_mqtt_msg_file(
 
 #endif
 
-static void
-send_msg(conf_web_hook *conf, nng_msg *msg)
-{
-	nng_http_client *client = NULL;
-	nng_http_conn   *conn   = NULL;
-	nng_url         *url    = NULL;
-	nng_aio         *aio    = NULL;
-	nng_http_req    *req    = NULL;
-	nng_http_res    *res    = NULL;
-	int              rv;
-
-	if (((rv = nng_url_parse(&url, conf->url)) != 0) ||
-	    ((rv = nng_http_client_alloc(&client, url)) != 0) ||
-	    ((rv = nng_http_req_alloc(&req, url)) != 0) ||
-	    ((rv = nng_http_res_alloc(&res)) != 0) ||
-	    ((rv = nng_aio_alloc(&aio, NULL, NULL)) != 0)) {
-		log_error("init failed: %s\n", nng_strerror(rv));
-		goto out;
-	}
-
-	// Start connection process...
-	nng_aio_set_timeout(aio, 1000);
-	nng_http_client_connect(client, aio);
-
-	// Wait for it to finish.
-	nng_aio_wait(aio);
-
-	if ((rv = nng_aio_result(aio)) != 0) {
-		log_error("Connect failed: %s", nng_strerror(rv));
-		nng_aio_finish_sync(aio, rv);
-		goto out;
-	}
-
-	// Get the connection, at the 0th output.
-	conn = nng_aio_get_output(aio, 0);
-
-	// Request is already set up with URL, and for GET via HTTP/1.1.
-	// The Host: header is already set up too.
-	// set_data(req, conf_req, params);
-	// Send the request, and wait for that to finish.
-	for (size_t i = 0; i < conf->header_count; i++) {
-		nng_http_req_add_header(
-		    req, conf->headers[i]->key, conf->headers[i]->value);
-	}
-
-	nng_http_req_set_method(req, "POST");
-	nng_http_req_set_data(req, nng_msg_body(msg), nng_msg_len(msg));
-	nng_http_conn_write_req(conn, req, aio);
-	nng_aio_set_timeout(aio, 1000);
-	nng_aio_wait(aio);
-	log_debug("webhook post result %d", nng_aio_result(aio));
-
-	if ((rv = nng_aio_result(aio)) != 0) {
-		log_error("Write req failed: %s", nng_strerror(rv));
-		nng_aio_finish_sync(aio, rv);
-		goto out;
-	}
-
-out:
-	if (url) {
-		nng_url_free(url);
-	}
-	if (conn) {
-		nng_http_conn_close(conn);
-	}
-	if (client) {
-		nng_http_client_free(client);
-	}
-	if (req) {
-		nng_http_req_free(req);
-	}
-	if (res) {
-		nng_http_res_free(res);
-	}
-	if (aio) {
-		nng_aio_free(aio);
-	}
-}
-
-// an independent thread of each work obj for sending HTTP msg
-static void
-thread_cb(void *arg)
+#ifdef SUPP_PARQUET
+static int
+hook_search_file(const exchange_query_file *file, void *arg)
 {
-	struct hook_work *w   = arg;
-	nng_lmq *         lmq = w->lmq;
-	nng_msg *         msg = NULL;
-	int               rv;
-
-	while (true) {
-		if (!nng_lmq_empty(lmq)) {
-			nng_mtx_lock(w->mtx);
-			rv = nng_lmq_get(lmq, &msg);
-			nng_mtx_unlock(w->mtx);
-			if (0 != rv)
-				continue;
-			// send webhook http requests
-			send_msg(w->conf, msg);
-			nng_msg_free(msg);
-		} else {
-			// try to reduce lmq cap
-			size_t lmq_len = nng_lmq_len(w->lmq);
-			if (lmq_len > (NANO_LMQ_INIT_CAP * 2)) {
-				size_t lmq_cap = nng_lmq_cap(w->lmq);
-				if (lmq_cap > (lmq_len * 2)) {
-					nng_mtx_lock(w->mtx);
-					nng_lmq_resize(w->lmq, lmq_cap / 2);
-					nng_mtx_unlock(w->mtx);
-				}
-			}
-			nng_msleep(10);
-		}
-	}
+	(void) arg;
+	log_info("parquet file %s holds keys %" PRIu64 "...%" PRIu64,
+	    file->path, file->start_key, file->end_key);
+	return 0;
 }
+#endif
 
 static void
 hook_work_cb(void *arg)
@@ -359,16 +255,12 @@ hook_work_cb(void *arg)
 		}
 
 		// TODO If it's a msg to webhook???
-		nng_mtx_lock(work->mtx);
-		if (nng_lmq_full(work->lmq)) {
-			size_t lmq_cap = nng_lmq_cap(work->lmq);
-			if ((rv = nng_lmq_resize(
-			         work->lmq, lmq_cap + (lmq_cap / 2))) != 0) {
-				NANO_NNG_FATAL("nng_lmq_resize mem error", rv);
-			}
+		if (hook_pool == NULL) {
+			nng_msg_free(work->msg);
+		} else if (webhook_pool_send(hook_pool, work->msg) ==
+		    NNG_EAGAIN) {
+			log_warn("webhook queue full, msg lost");
 		}
-		nng_lmq_put(work->lmq, work->msg);
-		nng_mtx_unlock(work->mtx);
 		work->msg   = NULL;
 		work->state = HOOK_RECV;
 		nng_recv_aio(work->sock, work->aio);
@@ -538,31 +430,13 @@ hook_work_cb(void *arg)
 			nng_free(msgs_res, sizeof(nng_msg *) * msgs_len);
 		}
 #ifdef SUPP_PARQUET
-		// Get file names and send to localhost to active handler
-		const char **parquet_fnames = NULL;
-		uint32_t parquet_sz = 0;
-		if (ekeystr) {
-			// fuzzing search
-			parquet_fnames = parquet_find_span(start_key, end_key, &parquet_sz);
-		} else {
-			// normal search
-			const char *parquet_fname = parquet_find(start_key);
-			if (parquet_fname) {
-				parquet_sz = 1;
-				parquet_fname = malloc(sizeof(char *) * parquet_sz);
-				parquet_fnames[0] = parquet_fname;
-			}
-		}
-		if (parquet_fnames) {
-			if (parquet_sz > 0) {
-				log_info("Ask parquet and found.");
-				// send_mqtt_msg_file(work->mqtt_sock, "file_transfer", parquet_fnames, parquet_sz);
-			}
-			for (int i=0; i<(int)parquet_sz; ++i)
-				nng_free((void *)parquet_fnames[i], 0);
-			nng_free(parquet_fnames, parquet_sz);
+		// Walk the parquet files holding the keys through the index
+		rv = exchange_query_span(start_key, ekeystr ? end_key : start_key,
+		    hook_search_file, NULL);
+		if (rv > 0) {
+			log_info("Ask parquet and found %d files.", rv);
+			// send_mqtt_msg_file(work->mqtt_sock, "file_transfer", parquet_fnames, parquet_sz);
 		}
-
 #endif
 #if defined (SUPP_BLF)
 		// Get file names and send to localhost to active handler
@@ -669,15 +543,6 @@ alloc_work(nng_socket sock, conf_web_hook *conf, conf_exchange *exconf,
 	if ((rv = nng_aio_alloc(&w->aio, hook_work_cb, w)) != 0) {
 		NANO_NNG_FATAL("nng_aio_alloc", rv);
 	}
-	if ((rv = nng_mtx_alloc(&w->mtx)) != 0) {
-		NANO_NNG_FATAL("nng_mtx_alloc", rv);
-	}
-	if ((rv = nng_lmq_alloc(&w->lmq, NANO_LMQ_INIT_CAP) != 0)) {
-		NANO_NNG_FATAL("nng_lmq_alloc", rv);
-	}
-	if ((rv = nng_thread_create(&w->thread, thread_cb, w)) != 0) {
-		NANO_NNG_FATAL("nng_thread_create", rv);
-	}
 
 	w->conf     = conf;
 	w->sock     = sock;
@@ -712,9 +577,16 @@ hook_cb(void *arg)
 	if (rv != 0) {
 		log_error("nng_pull0_open %d", rv);
 		nng_free(works, works_num * sizeof(struct hook_work *));
+		startup_done(STARTUP_WEBHOOK, rv);
 		return;
 	}
 
+	// http requests go out over the keep-alive connections of the pool
+	if (conf->web_hook.enable &&
+	    (rv = webhook_pool_alloc(&hook_pool, &conf->web_hook)) != 0) {
+		log_error("webhook pool init failed %d", rv);
+	}
+
 	for (i = 0; i < works_num; i++) {
 		works[i] = alloc_work(sock, &conf->web_hook, &conf->exchange, &conf->parquet);
 		works[i]->id = i;
@@ -743,18 +615,22 @@ hook_cb(void *arg)
 		// shares taskq threads with broker
 		hook_work_cb(works[i]);
 	}
+	startup_done(STARTUP_WEBHOOK, 0);
 
 	for (;;) {
 		nng_msleep(3600000); // neither pause() nor sleep() portable
 	}
 
 out:
+	startup_done(STARTUP_WEBHOOK, rv);
 	// Free hook search reset aio and limit atomic
 	if (hook_search_limit)
 		nng_atomic_free(hook_search_limit);
 	hook_search_limit = NULL;
 	nng_aio_stop(hook_search_reset_aio);
 	nng_aio_free(hook_search_reset_aio);
+	webhook_pool_free(hook_pool);
+	hook_pool = NULL;
 
 	for (i = 0; i < works_num; i++) {
 		nng_free(works[i], sizeof(struct hook_work));
@@ -765,11 +641,12 @@ out:
 int
 start_hook_service(conf *conf)
 {
+	// works dial the hook socket without waiting for it to listen
+	startup_begin(STARTUP_WEBHOOK);
 	int rv = nng_thread_create(&hook_thr, hook_cb, conf);
 	if (rv != 0) {
 		NANO_NNG_FATAL("nng_thread_create", rv);
 	}
-	nng_msleep(500);
 	return rv;
 }
 
@@ -0,0 +1,224 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/json_writer.h"
+#include "include/webhook_lifecycle.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/util/platform.h"
+
+// Room for the fields around the client ids of a summary.
+#define LIFECYCLE_JSON_HINT 4096
+
+typedef struct {
+	const char *action;
+	const char *ok_key;
+	const char *fail_key;
+	json_writer w; // open at the client id list while count > 0
+	uint64_t    count;
+	uint64_t    fails;
+	size_t      listed;
+} hook_lifecycle;
+
+static struct {
+	nng_mtx             *mtx;
+	nng_aio             *aio;
+	nng_duration         window;
+	nng_socket           sock; // of the first event, all dial the pool
+	hook_lifecycle       kinds[HOOK_LIFECYCLES];
+	hook_lifecycle_stats stats;
+	bool                 enabled;
+} lifecycle_ = {
+	.kinds = {
+	    [HOOK_LIFECYCLE_CONNACK] = { .action = "client_connack_batch",
+	        .ok_key = "success", .fail_key = "fail" },
+	    [HOOK_LIFECYCLE_DISCONNECT] = { .action = "client_disconnected_batch",
+	        .ok_key = "normal", .fail_key = "abnormal" },
+	},
+};
+
+static void
+lifecycle_tick(void *arg)
+{
+	(void) arg;
+	if (nng_aio_result(lifecycle_.aio) != 0) {
+		return;
+	}
+	webhook_lifecycle_flush();
+	nng_sleep_aio(lifecycle_.window, lifecycle_.aio);
+}
+
+int
+webhook_lifecycle_init(void)
+{
+	const char *s = getenv("NANOMQ_WEBHOOK_LIFECYCLE");
+	int         rv;
+
+	if (lifecycle_.enabled) {
+		return 0;
+	}
+	lifecycle_.window = NANO_WEBHOOK_LIFECYCLE_MS;
+	if (s != NULL && *s != '\0') {
+		char *end;
+		long  ms = strtol(s, &end, 10);
+		if (*end != '\0' || ms < 0) {
+			log_warn("NANOMQ_WEBHOOK_LIFECYCLE \"%s\" ignored", s);
+		} else {
+			lifecycle_.window = (nng_duration) ms;
+		}
+	}
+	if (lifecycle_.window == 0) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&lifecycle_.mtx)) != 0) {
+		return rv;
+	}
+	if ((rv = nng_aio_alloc(&lifecycle_.aio, lifecycle_tick, NULL)) != 0) {
+		nng_mtx_free(lifecycle_.mtx);
+		lifecycle_.mtx = NULL;
+		return rv;
+	}
+	memset(&lifecycle_.stats, 0, sizeof(lifecycle_.stats));
+	lifecycle_.enabled = true;
+	log_info("webhook lifecycle events summed up every %d ms",
+	    (int) lifecycle_.window);
+	nng_sleep_aio(lifecycle_.window, lifecycle_.aio);
+	return 0;
+}
+
+void
+webhook_lifecycle_fini(void)
+{
+	if (!lifecycle_.enabled) {
+		return;
+	}
+	// the last window is not sent, the hook sockets are closing
+	nng_aio_stop(lifecycle_.aio);
+	nng_aio_free(lifecycle_.aio);
+	lifecycle_.aio     = NULL;
+	lifecycle_.enabled = false;
+	memset(&lifecycle_.sock, 0, sizeof(lifecycle_.sock));
+	for (int k = 0; k < HOOK_LIFECYCLES; k++) {
+		hook_lifecycle *lc = &lifecycle_.kinds[k];
+
+		json_writer_fini(&lc->w);
+		lc->count  = 0;
+		lc->fails  = 0;
+		lc->listed = 0;
+	}
+	nng_mtx_free(lifecycle_.mtx);
+	lifecycle_.mtx = NULL;
+}
+
+bool
+webhook_lifecycle_enabled(void)
+{
+	return lifecycle_.enabled;
+}
+
+int
+webhook_lifecycle_add(nng_socket *sock, hook_lifecycle_kind kind,
+    const char *client_id, bool ok)
+{
+	hook_lifecycle *lc;
+
+	if (!lifecycle_.enabled || kind >= HOOK_LIFECYCLES) {
+		return NNG_ECLOSED;
+	}
+	lc = &lifecycle_.kinds[kind];
+	nng_mtx_lock(lifecycle_.mtx);
+	if (lifecycle_.sock.id == 0) {
+		lifecycle_.sock = *sock;
+	}
+	if (lc->count == 0) {
+		json_writer_init(&lc->w, LIFECYCLE_JSON_HINT);
+		json_write_begin(&lc->w, '{');
+		json_field_str(&lc->w, "action", lc->action);
+		json_write_key(&lc->w, "clientids");
+		json_write_begin(&lc->w, '[');
+	}
+	lc->count++;
+	if (!ok) {
+		lc->fails++;
+	}
+	if (lc->listed < NANO_WEBHOOK_LIFECYCLE_IDS) {
+		json_write_string(&lc->w, client_id,
+		    client_id != NULL ? strlen(client_id) : 0);
+		lc->listed++;
+	} else {
+		lifecycle_.stats.omitted++;
+	}
+	lifecycle_.stats.events++;
+	nng_mtx_unlock(lifecycle_.mtx);
+	return 0;
+}
+
+void
+webhook_lifecycle_flush(void)
+{
+	json_writer ws[HOOK_LIFECYCLES];
+	size_t      n = 0;
+	nng_socket  sock;
+	nng_msg    *msg;
+
+	if (!lifecycle_.enabled) {
+		return;
+	}
+	nng_mtx_lock(lifecycle_.mtx);
+	sock = lifecycle_.sock;
+	for (int k = 0; k < HOOK_LIFECYCLES; k++) {
+		hook_lifecycle *lc = &lifecycle_.kinds[k];
+		json_writer    *w  = &lc->w;
+
+		if (lc->count == 0) {
+			continue;
+		}
+		json_write_end(w, ']');
+		json_field_u64(w, "count", lc->count);
+		json_field_u64(w, lc->ok_key, lc->count - lc->fails);
+		json_field_u64(w, lc->fail_key, lc->fails);
+		json_field_u64(w, "window_ms", (uint64_t) lifecycle_.window);
+		json_field_u64(w, "per_second",
+		    lc->count * 1000 / (uint64_t) lifecycle_.window);
+		json_field_u64(w, "ts", nng_timestamp());
+		json_write_end(w, '}');
+		ws[n++] = *w;
+		memset(w, 0, sizeof(*w));
+		lc->count  = 0;
+		lc->fails  = 0;
+		lc->listed = 0;
+		lifecycle_.stats.summaries++;
+	}
+	nng_mtx_unlock(lifecycle_.mtx);
+
+	for (size_t i = 0; i < n; i++) {
+		if ((msg = json_writer_take(&ws[i])) == NULL) {
+			log_warn("webhook lifecycle summary dropped");
+			continue;
+		}
+		if (nng_sendmsg(sock, msg, NNG_FLAG_NONBLOCK) != 0) {
+			log_warn("webhook lifecycle summary dropped");
+			nng_msg_free(msg);
+		}
+	}
+}
+
+void
+webhook_lifecycle_stat(hook_lifecycle_stats *stats)
+{
+	if (!lifecycle_.enabled) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+	nng_mtx_lock(lifecycle_.mtx);
+	*stats = lifecycle_.stats;
+	nng_mtx_unlock(lifecycle_.mtx);
+}
@@ -0,0 +1,729 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(SUPP_WEBHOOK_GZIP)
+#include <zlib.h>
+#endif
+
+#include "include/webhook_pool.h"
+#include "nng/supplemental/http/http.h"
+#include "nng/supplemental/nanolib/log.h"
+#include "nng/supplemental/nanolib/utils.h"
+#include "nng/supplemental/util/platform.h"
+
+typedef enum {
+	HOOK_CONN_IDLE,
+	HOOK_CONN_DIALLING,
+	HOOK_CONN_BACKOFF, // dial_aio sleeps before the next attempt
+	HOOK_CONN_OPEN,
+} hook_conn_state;
+
+/*
+ * The requests of a connection form a ring starting at head: the first
+ * `written` of them wait for their response, the rest for the writer.
+ */
+typedef struct {
+	webhook_pool   *pool;
+	hook_conn_state state;
+	nng_http_conn  *conn;
+	nng_aio        *dial_aio;
+	nng_aio        *wr_aio;
+	nng_aio        *rd_aio;
+	nng_http_res   *res;
+	nng_http_req   *reqs[NANO_WEBHOOK_PIPELINE];
+	nng_msg        *msgs[NANO_WEBHOOK_PIPELINE];
+	size_t          head;
+	size_t          count;
+	size_t          written;
+	bool            writing;
+	bool            reading;
+	bool            closing; // conn is gone, reset once both aios are back
+	bool            last;    // the endpoint closes after this response
+	size_t          body_left;
+	nng_iov         iov;
+	char            body[512]; // response bodies are read and discarded
+	nng_time        used;
+} hook_conn;
+
+struct webhook_pool {
+	nng_url         *url;
+	nng_http_client *client;
+	nng_mtx         *mtx;
+	nng_lmq         *queue;
+	nng_aio         *idle_aio;
+	hook_conn       *conns;
+	size_t           size;
+	bool             closed;
+	uint32_t         open;
+	uint64_t         sent;
+	uint64_t         failed;
+	uint64_t         dropped;
+	uint64_t         dials;
+	nng_msg         *batch; // JSON array still open for more events
+	size_t           batch_events;
+	nng_time         batch_start;
+	nng_aio         *linger_aio;
+	bool             lingering;
+};
+
+static void hook_conn_close(hook_conn *c);
+static void hook_pool_kick(webhook_pool *pool);
+
+static inline nng_http_req *
+hook_conn_req(hook_conn *c, size_t i)
+{
+	return c->reqs[(c->head + i) % NANO_WEBHOOK_PIPELINE];
+}
+
+static inline nng_msg **
+hook_conn_msg(hook_conn *c, size_t i)
+{
+	return &c->msgs[(c->head + i) % NANO_WEBHOOK_PIPELINE];
+}
+
+static void
+hook_conn_dial(hook_conn *c)
+{
+	c->state = HOOK_CONN_DIALLING;
+	c->pool->dials++;
+	nng_aio_set_timeout(c->dial_aio, NANO_WEBHOOK_TIMEOUT_MS);
+	nng_http_client_connect(c->pool->client, c->dial_aio);
+}
+
+static void
+hook_conn_write(hook_conn *c)
+{
+	nng_msg *msg;
+
+	if (c->writing || c->closing || c->last || c->written == c->count) {
+		return;
+	}
+	msg = *hook_conn_msg(c, c->written);
+	nng_http_req_set_data(
+	    hook_conn_req(c, c->written), nng_msg_body(msg), nng_msg_len(msg));
+	c->writing = true;
+	nng_aio_set_timeout(c->wr_aio, NANO_WEBHOOK_TIMEOUT_MS);
+	nng_http_conn_write_req(c->conn, hook_conn_req(c, c->written), c->wr_aio);
+}
+
+static void
+hook_conn_read(hook_conn *c)
+{
+	if (c->reading || c->closing || c->written == 0) {
+		return;
+	}
+	// a parsed response cannot be parsed into again
+	nng_http_res_free(c->res);
+	if (nng_http_res_alloc(&c->res) != 0) {
+		c->res = NULL;
+		hook_conn_close(c);
+		return;
+	}
+	c->reading = true;
+	nng_aio_set_timeout(c->rd_aio, NANO_WEBHOOK_TIMEOUT_MS);
+	nng_http_conn_read_res(c->conn, c->res, c->rd_aio);
+}
+
+static void
+hook_conn_body(hook_conn *c)
+{
+	c->iov.iov_buf = c->body;
+	c->iov.iov_len =
+	    c->body_left < sizeof(c->body) ? c->body_left : sizeof(c->body);
+	c->reading = true;
+	nng_aio_set_iov(c->rd_aio, 1, &c->iov);
+	nng_aio_set_timeout(c->rd_aio, NANO_WEBHOOK_TIMEOUT_MS);
+	nng_http_conn_read_all(c->conn, c->rd_aio);
+}
+
+/*
+ * Requests never written go back to the queue, so do the pipelined ones
+ * when the endpoint announced the close; after an error they may have been
+ * handled already and are counted as failed instead.
+ */
+static void
+hook_conn_reset(hook_conn *c)
+{
+	webhook_pool *pool    = c->pool;
+	bool          requeue = c->last && !pool->closed;
+
+	for (size_t i = 0; i < c->count; i++) {
+		nng_msg **msg = hook_conn_msg(c, i);
+		if ((i >= c->written || requeue) && !pool->closed &&
+		    nng_lmq_put(pool->queue, *msg) == 0) {
+			*msg = NULL;
+			continue;
+		}
+		if (i < c->written) {
+			pool->failed++;
+		} else {
+			pool->dropped++;
+		}
+		nng_msg_free(*msg);
+		*msg = NULL;
+	}
+	c->head      = 0;
+	c->count     = 0;
+	c->written   = 0;
+	c->body_left = 0;
+	c->closing   = false;
+	c->last      = false;
+	c->state     = HOOK_CONN_IDLE;
+}
+
+static void
+hook_conn_close(hook_conn *c)
+{
+	if (c->conn != NULL) {
+		nng_http_conn_close(c->conn);
+		c->conn = NULL;
+		c->pool->open--;
+	}
+	c->closing = true;
+	if (!c->writing && !c->reading) {
+		hook_conn_reset(c);
+	}
+}
+
+static void
+hook_conn_dial_cb(void *arg)
+{
+	hook_conn    *c    = arg;
+	webhook_pool *pool = c->pool;
+	int           rv   = nng_aio_result(c->dial_aio);
+
+	nng_mtx_lock(pool->mtx);
+	if (pool->closed) {
+		if (rv == 0 && c->state == HOOK_CONN_DIALLING) {
+			nng_http_conn_close(nng_aio_get_output(c->dial_aio, 0));
+		}
+		c->state = HOOK_CONN_IDLE;
+		nng_mtx_unlock(pool->mtx);
+		return;
+	}
+	if (c->state == HOOK_CONN_BACKOFF) {
+		c->state = HOOK_CONN_IDLE;
+	} else if (rv != 0) {
+		log_warn("webhook connect to %s failed: %s", pool->url->u_rawurl,
+		    nng_strerror(rv));
+		c->state = HOOK_CONN_BACKOFF;
+		nng_sleep_aio(NANO_WEBHOOK_RETRY_MS, c->dial_aio);
+	} else {
+		c->conn  = nng_aio_get_output(c->dial_aio, 0);
+		c->state = HOOK_CONN_OPEN;
+		c->used  = nng_clock();
+		pool->open++;
+	}
+	hook_pool_kick(pool);
+	nng_mtx_unlock(pool->mtx);
+}
+
+static void
+hook_conn_wr_cb(void *arg)
+{
+	hook_conn    *c    = arg;
+	webhook_pool *pool = c->pool;
+	int           rv   = nng_aio_result(c->wr_aio);
+
+	nng_mtx_lock(pool->mtx);
+	c->writing = false;
+	if (c->closing) {
+		hook_conn_close(c);
+	} else if (rv != 0) {
+		log_warn("webhook request failed: %s", nng_strerror(rv));
+		hook_conn_close(c);
+	} else {
+		c->written++;
+		c->used = nng_clock();
+		hook_conn_read(c);
+		hook_conn_write(c);
+	}
+	hook_pool_kick(pool);
+	nng_mtx_unlock(pool->mtx);
+}
+
+// headers of a response are in, decide how to consume the rest of it
+static void
+hook_conn_headers(hook_conn *c)
+{
+	const char *hdr;
+
+	if (nng_http_res_get_status(c->res) >= 400) {
+		log_debug("webhook endpoint responded %d %s",
+		    nng_http_res_get_status(c->res),
+		    nng_http_res_get_reason(c->res));
+	}
+	if (((hdr = nng_http_res_get_header(c->res, "Connection")) != NULL &&
+	        nng_strcasecmp(hdr, "close") == 0) ||
+	    strcmp(nng_http_res_get_version(c->res), "HTTP/1.0") == 0) {
+		c->last = true;
+	}
+	// without a length the end of the body is unknown, give up the
+	// connection after this response
+	if (nng_http_res_get_header(c->res, "Transfer-Encoding") != NULL) {
+		c->last = true;
+	} else if ((hdr = nng_http_res_get_header(
+	                c->res, "Content-Length")) != NULL) {
+		c->body_left = (size_t) strtoul(hdr, NULL, 10);
+	}
+}
+
+static void
+hook_conn_rd_cb(void *arg)
+{
+	hook_conn    *c    = arg;
+	webhook_pool *pool = c->pool;
+	int           rv   = nng_aio_result(c->rd_aio);
+	nng_msg     **msg;
+
+	nng_mtx_lock(pool->mtx);
+	c->reading = false;
+	if (c->closing || rv != 0) {
+		if (!c->closing) {
+			log_warn("webhook response failed: %s", nng_strerror(rv));
+		}
+		hook_conn_close(c);
+		goto out;
+	}
+	if (c->body_left > 0 && c->iov.iov_len > 0) {
+		// a chunk of the body of the current response
+		c->body_left -= c->iov.iov_len;
+		c->iov.iov_len = 0;
+	} else {
+		hook_conn_headers(c);
+	}
+	if (c->body_left > 0) {
+		hook_conn_body(c);
+		goto out;
+	}
+
+	msg = hook_conn_msg(c, 0);
+	if (nng_http_res_get_status(c->res) >= 400) {
+		pool->failed++;
+	} else {
+		pool->sent++;
+	}
+	nng_msg_free(*msg);
+	*msg    = NULL;
+	c->head = (c->head + 1) % NANO_WEBHOOK_PIPELINE;
+	c->count--;
+	c->written--;
+	c->used = nng_clock();
+	if (c->last) {
+		hook_conn_close(c);
+	} else {
+		hook_conn_read(c);
+	}
+	hook_pool_kick(pool);
+out:
+	nng_mtx_unlock(pool->mtx);
+}
+
+// connections with nothing to send for NANO_WEBHOOK_IDLE_MS are closed
+static void
+hook_pool_idle_cb(void *arg)
+{
+	webhook_pool *pool = arg;
+	nng_time      now  = nng_clock();
+
+	nng_mtx_lock(pool->mtx);
+	if (pool->closed || nng_aio_result(pool->idle_aio) != 0) {
+		nng_mtx_unlock(pool->mtx);
+		return;
+	}
+	for (size_t i = 0; i < pool->size; i++) {
+		hook_conn *c = &pool->conns[i];
+		if (c->state == HOOK_CONN_OPEN && c->count == 0 &&
+		    !c->closing && now - c->used >= NANO_WEBHOOK_IDLE_MS) {
+			hook_conn_close(c);
+		}
+	}
+	nng_sleep_aio(NANO_WEBHOOK_IDLE_MS / 2, pool->idle_aio);
+	nng_mtx_unlock(pool->mtx);
+}
+
+/*
+ * Hand the queue out to open connections in bulk, least busy first: every
+ * round gives one message to each connection at the current fill level.
+ * Connections are dialled while all open ones are busy, one more for each
+ * NANO_WEBHOOK_PIPELINE messages still left over.
+ */
+static void
+hook_pool_kick(webhook_pool *pool)
+{
+	nng_msg *msg;
+	size_t   dialling = 0;
+	size_t   want     = 0;
+	bool     spare    = false;
+
+	if (pool->closed) {
+		return;
+	}
+	for (size_t level = 0; level < NANO_WEBHOOK_PIPELINE &&
+	     !nng_lmq_empty(pool->queue);
+	     level++) {
+		for (size_t i = 0; i < pool->size; i++) {
+			hook_conn *c = &pool->conns[i];
+			if (c->state != HOOK_CONN_OPEN || c->closing || c->last ||
+			    c->count > level) {
+				continue;
+			}
+			if (nng_lmq_get(pool->queue, &msg) != 0) {
+				break;
+			}
+			*hook_conn_msg(c, c->count) = msg;
+			c->count++;
+			hook_conn_write(c);
+		}
+	}
+
+	for (size_t i = 0; i < pool->size; i++) {
+		hook_conn *c = &pool->conns[i];
+		if (c->state == HOOK_CONN_DIALLING) {
+			dialling++;
+		} else if (c->state == HOOK_CONN_OPEN && c->count == 0) {
+			spare = true;
+		}
+	}
+	if (!spare) {
+		want = 1 + (nng_lmq_len(pool->queue) + NANO_WEBHOOK_PIPELINE - 1) /
+		    NANO_WEBHOOK_PIPELINE;
+	}
+	if (nng_lmq_empty(pool->queue) && want > 0) {
+		// busy but keeping up, grow by one connection at a time
+		want = 1;
+	}
+	for (size_t i = 0; i < pool->size && dialling < want; i++) {
+		if (pool->conns[i].state == HOOK_CONN_IDLE) {
+			hook_conn_dial(&pool->conns[i]);
+			dialling++;
+		}
+	}
+}
+
+#if defined(SUPP_WEBHOOK_GZIP)
+// replace the body of *msgp by its gzip encoding
+static int
+hook_gzip(nng_msg **msgp)
+{
+	nng_msg *out;
+	z_stream zs = { 0 };
+	uLong    bound;
+	int      rv;
+
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+	        Z_DEFAULT_STRATEGY) != Z_OK) {
+		return NNG_ENOMEM;
+	}
+	bound = deflateBound(&zs, (uLong) nng_msg_len(*msgp));
+	if ((rv = nng_msg_alloc(&out, bound)) != 0) {
+		deflateEnd(&zs);
+		return rv;
+	}
+	zs.next_in   = nng_msg_body(*msgp);
+	zs.avail_in  = (uInt) nng_msg_len(*msgp);
+	zs.next_out  = nng_msg_body(out);
+	zs.avail_out = (uInt) bound;
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&zs);
+		nng_msg_free(out);
+		return NNG_EINTERNAL;
+	}
+	nng_msg_chop(out, bound - zs.total_out);
+	deflateEnd(&zs);
+	nng_msg_free(*msgp);
+	*msgp = out;
+	return 0;
+}
+#endif
+
+// queue a request body carrying `events` events, compressed outside the lock
+static int
+hook_pool_put(webhook_pool *pool, nng_msg *msg, size_t events)
+{
+	int rv = 0;
+
+#if defined(SUPP_WEBHOOK_GZIP)
+	if ((rv = hook_gzip(&msg)) != 0) {
+		log_warn("webhook gzip failed: %s", nng_strerror(rv));
+	}
+#endif
+	nng_mtx_lock(pool->mtx);
+	if (pool->closed) {
+		rv = NNG_ECLOSED;
+	} else if (rv != 0 || nng_lmq_put(pool->queue, msg) != 0) {
+		pool->dropped += events;
+		rv = NNG_EAGAIN;
+	} else {
+		hook_pool_kick(pool);
+	}
+	nng_mtx_unlock(pool->mtx);
+	if (rv != 0) {
+		nng_msg_free(msg);
+	}
+	return rv;
+}
+
+#if NANO_WEBHOOK_BATCH_EVENTS > 1
+// close the JSON array of the open batch and hand it to the caller
+static nng_msg *
+hook_batch_take(webhook_pool *pool, size_t *events)
+{
+	nng_msg *msg = pool->batch;
+
+	if (msg == NULL || nng_msg_append(msg, "]", 1) != 0) {
+		return NULL;
+	}
+	*events            = pool->batch_events;
+	pool->batch        = NULL;
+	pool->batch_events = 0;
+	return msg;
+}
+
+/*
+ * Add the event of msg to the open batch. Returns a batch that is full and
+ * has to be posted, which may be the one before msg when msg did not fit.
+ */
+static nng_msg *
+hook_batch_add(webhook_pool *pool, nng_msg *msg, size_t *events)
+{
+	nng_msg *full = NULL;
+
+	if (pool->batch != NULL &&
+	    nng_msg_len(pool->batch) + nng_msg_len(msg) + 2 >
+	        NANO_WEBHOOK_BATCH_BYTES) {
+		full = hook_batch_take(pool, events);
+	}
+	if (pool->batch == NULL) {
+		if (nng_msg_alloc(&pool->batch, 0) != 0 ||
+		    nng_msg_append(pool->batch, "[", 1) != 0) {
+			nng_msg_free(pool->batch);
+			pool->batch = NULL;
+			pool->dropped++;
+			nng_msg_free(msg);
+			return full;
+		}
+		pool->batch_start = nng_clock();
+		if (!pool->lingering) {
+			pool->lingering = true;
+			nng_sleep_aio(NANO_WEBHOOK_BATCH_LINGER_MS, pool->linger_aio);
+		}
+	} else {
+		nng_msg_append(pool->batch, ",", 1);
+	}
+	if (nng_msg_append(pool->batch, nng_msg_body(msg), nng_msg_len(msg)) !=
+	    0) {
+		pool->dropped++;
+	} else {
+		pool->batch_events++;
+	}
+	nng_msg_free(msg);
+	if (full == NULL &&
+	    (pool->batch_events >= NANO_WEBHOOK_BATCH_EVENTS ||
+	        nng_msg_len(pool->batch) >= NANO_WEBHOOK_BATCH_BYTES)) {
+		full = hook_batch_take(pool, events);
+	}
+	return full;
+}
+#endif
+
+// a batch that did not fill up goes out NANO_WEBHOOK_BATCH_LINGER_MS late
+static void
+hook_pool_linger_cb(void *arg)
+{
+	webhook_pool *pool   = arg;
+	nng_msg      *msg    = NULL;
+	size_t        events = 0;
+
+	nng_mtx_lock(pool->mtx);
+	if (pool->closed || nng_aio_result(pool->linger_aio) != 0) {
+		pool->lingering = false;
+		nng_mtx_unlock(pool->mtx);
+		return;
+	}
+#if NANO_WEBHOOK_BATCH_EVENTS > 1
+	nng_time now = nng_clock();
+	if (pool->batch != NULL &&
+	    now - pool->batch_start < NANO_WEBHOOK_BATCH_LINGER_MS) {
+		// a newer batch than the one the timer was set for
+		nng_sleep_aio(
+		    (nng_duration) (pool->batch_start +
+		        NANO_WEBHOOK_BATCH_LINGER_MS - now),
+		    pool->linger_aio);
+		nng_mtx_unlock(pool->mtx);
+		return;
+	}
+	msg = hook_batch_take(pool, &events);
+#endif
+	pool->lingering = false;
+	nng_mtx_unlock(pool->mtx);
+	if (msg != NULL) {
+		hook_pool_put(pool, msg, events);
+	}
+}
+
+int
+webhook_pool_alloc(webhook_pool **poolp, conf_web_hook *conf)
+{
+	webhook_pool *pool;
+	size_t        size = conf->pool_size > 0 ? conf->pool_size : 1;
+	int           rv;
+
+	if ((pool = nng_zalloc(sizeof(*pool))) == NULL) {
+		return NNG_ENOMEM;
+	}
+	pool->size = size;
+	if (((rv = nng_url_parse(&pool->url, conf->url)) != 0) ||
+	    ((rv = nng_http_client_alloc(&pool->client, pool->url)) != 0) ||
+	    ((rv = nng_mtx_alloc(&pool->mtx)) != 0) ||
+	    ((rv = nng_lmq_alloc(&pool->queue, NANO_WEBHOOK_QUEUE_LEN)) != 0) ||
+	    ((rv = nng_aio_alloc(&pool->idle_aio, hook_pool_idle_cb, pool)) !=
+	        0) ||
+	    ((rv = nng_aio_alloc(
+	          &pool->linger_aio, hook_pool_linger_cb, pool)) != 0)) {
+		goto fail;
+	}
+	if ((pool->conns = nng_zalloc(sizeof(hook_conn) * size)) == NULL) {
+		rv = NNG_ENOMEM;
+		goto fail;
+	}
+	for (size_t i = 0; i < size; i++) {
+		hook_conn *c = &pool->conns[i];
+		c->pool      = pool;
+		if (((rv = nng_aio_alloc(&c->dial_aio, hook_conn_dial_cb, c)) !=
+		        0) ||
+		    ((rv = nng_aio_alloc(&c->wr_aio, hook_conn_wr_cb, c)) != 0) ||
+		    ((rv = nng_aio_alloc(&c->rd_aio, hook_conn_rd_cb, c)) != 0) ||
+		    ((rv = nng_http_res_alloc(&c->res)) != 0)) {
+			goto fail;
+		}
+		// reused for every message, only the body changes
+		for (size_t j = 0; j < NANO_WEBHOOK_PIPELINE; j++) {
+			if ((rv = nng_http_req_alloc(&c->reqs[j], pool->url)) !=
+			    0) {
+				goto fail;
+			}
+			nng_http_req_set_method(c->reqs[j], "POST");
+			for (size_t k = 0; k < conf->header_count; k++) {
+				nng_http_req_set_header(c->reqs[j],
+				    conf->headers[k]->key,
+				    conf->headers[k]->value);
+			}
+#if defined(SUPP_WEBHOOK_GZIP)
+			nng_http_req_set_header(
+			    c->reqs[j], "Content-Encoding", "gzip");
+#endif
+		}
+	}
+	nng_sleep_aio(NANO_WEBHOOK_IDLE_MS / 2, pool->idle_aio);
+	*poolp = pool;
+	return 0;
+
+fail:
+	webhook_pool_free(pool);
+	return rv;
+}
+
+void
+webhook_pool_free(webhook_pool *pool)
+{
+	nng_msg *msg;
+
+	if (pool == NULL) {
+		return;
+	}
+	if (pool->mtx != NULL) {
+		nng_mtx_lock(pool->mtx);
+		pool->closed = true;
+		for (size_t i = 0; pool->conns != NULL && i < pool->size; i++) {
+			if (pool->conns[i].state == HOOK_CONN_OPEN) {
+				hook_conn_close(&pool->conns[i]);
+			}
+		}
+		nng_mtx_unlock(pool->mtx);
+	}
+	nng_aio_stop(pool->idle_aio);
+	nng_aio_stop(pool->linger_aio);
+	for (size_t i = 0; pool->conns != NULL && i < pool->size; i++) {
+		hook_conn *c = &pool->conns[i];
+		nng_aio_stop(c->dial_aio);
+		nng_aio_stop(c->wr_aio);
+		nng_aio_stop(c->rd_aio);
+		hook_conn_reset(c);
+		nng_aio_free(c->dial_aio);
+		nng_aio_free(c->wr_aio);
+		nng_aio_free(c->rd_aio);
+		if (c->res != NULL) {
+			nng_http_res_free(c->res);
+		}
+		for (size_t j = 0; j < NANO_WEBHOOK_PIPELINE; j++) {
+			if (c->reqs[j] != NULL) {
+				nng_http_req_free(c->reqs[j]);
+			}
+		}
+	}
+	nng_free(pool->conns, sizeof(hook_conn) * pool->size);
+	if (pool->queue != NULL) {
+		while (nng_lmq_get(pool->queue, &msg) == 0) {
+			nng_msg_free(msg);
+		}
+		nng_lmq_free(pool->queue);
+	}
+	if (pool->batch != NULL) {
+		nng_msg_free(pool->batch);
+	}
+	nng_aio_free(pool->idle_aio);
+	nng_aio_free(pool->linger_aio);
+	if (pool->client != NULL) {
+		nng_http_client_free(pool->client);
+	}
+	if (pool->url != NULL) {
+		nng_url_free(pool->url);
+	}
+	if (pool->mtx != NULL) {
+		nng_mtx_free(pool->mtx);
+	}
+	nng_free(pool, sizeof(*pool));
+}
+
+int
+webhook_pool_send(webhook_pool *pool, nng_msg *msg)
+{
+#if NANO_WEBHOOK_BATCH_EVENTS > 1
+	size_t events = 0;
+
+	nng_mtx_lock(pool->mtx);
+	if (pool->closed) {
+		nng_mtx_unlock(pool->mtx);
+		nng_msg_free(msg);
+		return NNG_ECLOSED;
+	}
+	msg = hook_batch_add(pool, msg, &events);
+	nng_mtx_unlock(pool->mtx);
+	return msg == NULL ? 0 : hook_pool_put(pool, msg, events);
+#else
+	return hook_pool_put(pool, msg, 1);
+#endif
+}
+
+void
+webhook_pool_stat(webhook_pool *pool, webhook_pool_stats *stats)
+{
+	nng_mtx_lock(pool->mtx);
+	stats->conns   = pool->open;
+	stats->queued  = nng_lmq_len(pool->queue);
+	stats->sent    = pool->sent;
+	stats->failed  = pool->failed;
+	stats->dropped = pool->dropped;
+	stats->dials   = pool->dials;
+	nng_mtx_unlock(pool->mtx);
+}
@@ -9,14 +9,21 @@
 
 #include "include/webhook_post.h"
 #include "include/pub_handler.h"
+#include "include/json_writer.h"
+#include "include/topic_match.h"
+#include "include/webhook_codec.h"
+#include "include/webhook_lifecycle.h"
+#include "include/exchange_recent.h"
+#include "include/profiler.h"
+#include "include/transform.h"
 
 #include "nng/supplemental/util/platform.h"
-#include "nng/supplemental/nanolib/base64.h"
-#include "nng/supplemental/nanolib/cJSON.h"
 #include "nng/protocol/mqtt/mqtt_parser.h"
 #include "nng/supplemental/nanolib/log.h"
 
 #ifdef SUPP_PARQUET
+#include "include/exchange_query.h"
+#include "include/parquet_sink.h"
 #include "nng/supplemental/nanolib/parquet.h"
 #endif
 #ifdef SUPP_BLF
@@ -26,17 +33,38 @@
 static bool event_filter(conf_web_hook *hook_conf, webhook_event event);
 static bool event_filter_with_topic(
     conf_web_hook *hook_conf, webhook_event event, const char *topic);
-static void         set_char(char *out, unsigned int *index, char c);
-static unsigned int base62_encode(
-    const unsigned char *in, unsigned int inlen, char *out);
 
 static int flush_smsg_to_disk(nng_msg **smsg, size_t len, void *handle, nng_aio *aio, char *topic);
 
-#define BASE62_ENCODE_OUT_SIZE(s) ((unsigned int) ((((s) * 8) / 6) + 2))
+/*
+ * The events of the webhook rules, the topics of the message.publish ones
+ * and of the exchanges, compiled by hook_filter_init() and swapped in as a
+ * whole by hook_filter_reload(). Workers read the current table without a
+ * lock, the ones it replaced are kept until hook_filter_fini() as reloads
+ * are rare. Without a table the conf is walked as is.
+ */
+typedef struct hook_filter_table hook_filter_table;
+struct hook_filter_table {
+	uint32_t           events; // bit of the event of every rule
+	topic_filter_set  *publish;
+	bool               publish_any; // a rule without topic
+	topic_filter_set  *exchange;
+	hook_filter_table *retired;
+};
+
+static struct {
+	nng_mtx           *mtx;
+	hook_filter_table *table;
+} hook_filters;
 
 static bool
 event_filter(conf_web_hook *hook_conf, webhook_event event)
 {
+	hook_filter_table *t = hook_filters.table;
+
+	if (t != NULL) {
+		return event < 32 && (t->events & (1u << event)) != 0;
+	}
 	for (uint16_t i = 0; i < hook_conf->rule_count; i++) {
 		if (hook_conf->rules[i]->event == event) {
 			return true;
@@ -65,128 +93,231 @@ event_filter_with_topic(
 	return false;
 }
 
-static void
-set_char(char *out, unsigned int *index, char c)
+// whether a message.publish rule takes the topic of pub_packet
+static bool
+hook_publish_wanted(conf_web_hook *hook_conf, pub_packet_struct *pub_packet)
 {
-	unsigned int idx = *index;
-	switch (c) {
-	case 'i':
-		out[idx++] = 'i';
-		// out[idx++] = 'a';
-		break;
-	case '+':
-		// out[idx++] = 'i';
-		// out[idx++] = 'b';
-		out[idx++] = 'A';
-		break;
-	case '/':
-		// out[idx++] = 'i';
-		// out[idx++] = 'c';
-		out[idx++] = 'B';
-		break;
-	default:
-		out[idx++] = c;
-		break;
-	}
+	const char        *topic = pub_packet->var_header.publish.topic_name.body;
+	hook_filter_table *t     = hook_filters.table;
+	uint32_t           id;
 
-	*index = idx;
+	if (t == NULL) {
+		return event_filter_with_topic(hook_conf, MESSAGE_PUBLISH, topic);
+	}
+	return t->publish_any ||
+	    (topic != NULL &&
+	        topic_filter_set_first(t->publish, topic,
+	            pub_packet_levels(pub_packet), &id));
 }
 
-static unsigned int
-base62_encode(const unsigned char *in, unsigned int inlen, char *out)
+// Room for the fields around the payload of most events.
+#define HOOK_JSON_HINT 256
+
+// Hand the event to the webhook pool without a copy.
+static int
+hook_send(nng_socket *sock, json_writer *w)
 {
-	unsigned int i;
-	unsigned int j;
-	unsigned int pos = 0, val = 0;
-	const char   base62en[] =
-	    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	nng_msg *msg;
+	int      rv;
 
-	for (i = j = 0; i < inlen; i++) {
-		val = (val << 8) | (in[i] & 0xFF);
-		pos += 8;
-		while (pos > 5) {
-			char c = base62en[val >> (pos -= 6)];
-			set_char(out, &j, c);
-			val &= ((1 << pos) - 1);
-		}
+	if ((msg = json_writer_take(w)) == NULL) {
+		return NNG_ENOMEM;
 	}
-	if (pos > 0) {
-		char c = base62en[val << (6 - pos)];
-		set_char(out, &j, c);
+	if ((rv = nng_sendmsg(*sock, msg, NNG_FLAG_NONBLOCK)) != 0) {
+		nng_msg_free(msg);
 	}
-	return j;
+	return rv;
 }
 
-int
-webhook_msg_publish(nng_socket *sock, conf_web_hook *hook_conf,
-    pub_packet_struct *pub_packet, const char *username, const char *client_id)
+// room for the payload of a message.publish event, as encoded
+static size_t
+hook_payload_size(conf_web_hook *hook_conf, size_t len)
 {
-	if (!hook_conf->enable ||
-	    !event_filter_with_topic(hook_conf, MESSAGE_PUBLISH,
-	        pub_packet->var_header.publish.topic_name.body)) {
-		return -1;
+	switch (hook_conf->encode_payload) {
+	case plain:
+		return len;
+	case base64:
+		return WEBHOOK_BASE64_SIZE(len);
+	case base62:
+		return WEBHOOK_BASE62_SIZE(len);
+	default:
+		return 0;
 	}
+}
 
-	cJSON *obj = cJSON_CreateObject();
-
-	cJSON_AddNumberToObject(obj, "ts", nng_timestamp());
-	cJSON_AddStringToObject(
-	    obj, "topic", pub_packet->var_header.publish.topic_name.body);
-	cJSON_AddBoolToObject(obj, "retain", pub_packet->fixed_header.retain);
-	cJSON_AddNumberToObject(obj, "qos", pub_packet->fixed_header.qos);
-	cJSON_AddStringToObject(obj, "action", "message_publish");
-	cJSON_AddStringToObject(
-	    obj, "from_username", username == NULL ? "undefined" : username);
-	if (client_id) {
-		cJSON_AddStringToObject(obj, "from_client_id", client_id);
-	} else {
-		cJSON_AddNullToObject(obj, "from_client_id");
-	}
-	size_t out_size = 0;
-	char  *encode   = NULL;
-	size_t len      = 0;
-	switch (hook_conf->encode_payload) {
+static int
+hook_publish_send(nng_socket *sock, int encode, uint64_t ts,
+    const char *topic, bool retain, uint8_t qos, const char *username,
+    const char *client_id, const uint8_t *payload, size_t len, size_t size)
+{
+	json_writer w;
+	char       *out;
+
+	json_writer_init(&w, HOOK_JSON_HINT + size);
+	json_write_begin(&w, '{');
+	json_field_u64(&w, "ts", ts);
+	json_field_str(&w, "topic", topic);
+	json_field_bool(&w, "retain", retain);
+	json_field_u64(&w, "qos", qos);
+	json_field_str(&w, "action", "message_publish");
+	json_field_str(
+	    &w, "from_username", username == NULL ? "undefined" : username);
+	json_field_str(&w, "from_client_id", client_id);
+	switch (encode) {
 	case plain:
-		cJSON_AddStringToObject(
-		    obj, "payload", (const char *) pub_packet->payload.data);
+		json_write_key(&w, "payload");
+		json_write_string(&w, (const char *) payload, len);
 		break;
 	case base64:
-		out_size = BASE64_ENCODE_OUT_SIZE(pub_packet->payload.len);
-		encode   = nng_zalloc(out_size);
-		len      = base64_encode(
-		         pub_packet->payload.data, pub_packet->payload.len, encode);
-		if (len > 0) {
-			cJSON_AddStringToObject(obj, "payload", encode);
-		} else {
-			cJSON_AddNullToObject(obj, "payload");
-		}
-		nng_strfree(encode);
-		break;
 	case base62:
-		out_size = BASE62_ENCODE_OUT_SIZE(pub_packet->payload.len);
-		encode   = nng_zalloc(out_size);
-		len      = base62_encode(
-		         pub_packet->payload.data, pub_packet->payload.len, encode);
-		if (len > 0) {
-			cJSON_AddStringToObject(obj, "payload", encode);
-		} else {
-			cJSON_AddNullToObject(obj, "payload");
+		if (len == 0) {
+			json_field_null(&w, "payload");
+			break;
 		}
-		nng_strfree(encode);
+		json_write_key(&w, "payload");
+		if ((out = json_write_string_reserve(&w, size)) != NULL) {
+			len = encode == base64
+			    ? webhook_base64_encode(payload, len, out)
+			    : webhook_base62_encode(payload, len, out);
+		}
+		json_write_string_commit(&w, len);
 		break;
-
 	default:
 		break;
 	}
+	json_write_end(&w, '}');
 
-	char *json = cJSON_PrintUnformatted(obj);
+	return hook_send(sock, &w);
+}
 
-	int rv = nng_send(*sock, json, strlen(json), NNG_FLAG_NONBLOCK);
+/*
+ * A message.publish event for the transform stage. The payload is read
+ * from msg, held rather than copied, the strings follow the job.
+ */
+typedef struct {
+	nng_socket sock;
+	nng_msg   *msg;
+	size_t     off;
+	size_t     len;
+	size_t     size;
+	size_t     alloc;
+	uint64_t   ts;
+	int        encode;
+	bool       retain;
+	uint8_t    qos;
+	char      *username; // NULL as the client gave none
+	char      *client_id;
+	char       topic[];
+} hook_publish_job;
 
-	nng_strfree(json);
-	cJSON_Delete(obj);
+static void
+hook_publish_run(void *arg)
+{
+	hook_publish_job *job = arg;
+	int               rv;
+
+	rv = hook_publish_send(&job->sock, job->encode, job->ts, job->topic,
+	    job->retain, job->qos, job->username, job->client_id,
+	    (uint8_t *) nng_msg_body(job->msg) + job->off, job->len,
+	    job->size);
+	if (rv != 0) {
+		log_debug("message.publish webhook dropped: %d", rv);
+	}
+	nng_msg_free(job->msg);
+	nng_free(job, job->alloc);
+}
 
-	return rv;
+static char *
+hook_job_str(char **p, const char *s)
+{
+	size_t n = strlen(s) + 1;
+	char  *d = *p;
+
+	memcpy(d, s, n);
+	*p += n;
+	return d;
+}
+
+/*
+ * Hand the event to the transform stage when its encoding is worth a
+ * hand-over: base64 and base62 always, plain only from
+ * NANO_TRANSFORM_MIN_BYTES on, and only with the payload still in msg.
+ */
+static int
+hook_publish_offload(nng_socket *sock, conf_web_hook *hook_conf,
+    pub_packet_struct *pub_packet, nng_msg *msg, const char *username,
+    const char *client_id, size_t size)
+{
+	size_t            len = pub_packet->payload.len;
+	hook_publish_job *job;
+	const char       *topic;
+	uint8_t          *body;
+	size_t            alloc;
+	char             *p;
+
+	if (msg == NULL || !transform_enabled() || len == 0 ||
+	    pub_packet->payload_owned ||
+	    (hook_conf->encode_payload == plain &&
+	        len < NANO_TRANSFORM_MIN_BYTES)) {
+		return NNG_ENOTSUP;
+	}
+	body = nng_msg_body(msg);
+	if (pub_packet->payload.data < body ||
+	    pub_packet->payload.data + len > body + nng_msg_len(msg)) {
+		return NNG_ENOTSUP;
+	}
+	if ((topic = pub_packet->var_header.publish.topic_name.body) == NULL) {
+		topic = "";
+	}
+	alloc = sizeof(*job) + strlen(topic) + 1 +
+	    (client_id != NULL ? strlen(client_id) + 1 : 0) +
+	    (username != NULL ? strlen(username) + 1 : 0);
+	if ((job = nng_alloc(alloc)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	job->sock   = *sock;
+	job->msg    = msg;
+	job->off    = (size_t) (pub_packet->payload.data - body);
+	job->len    = len;
+	job->size   = size;
+	job->alloc  = alloc;
+	job->ts     = nng_timestamp();
+	job->encode = hook_conf->encode_payload;
+	job->retain = pub_packet->fixed_header.retain;
+	job->qos    = pub_packet->fixed_header.qos;
+	p           = job->topic;
+	hook_job_str(&p, topic);
+	job->client_id = client_id != NULL ? hook_job_str(&p, client_id) : NULL;
+	job->username  = username != NULL ? hook_job_str(&p, username) : NULL;
+
+	nng_msg_clone(msg);
+	if (transform_submit(TRANSFORM_WEBHOOK, hook_publish_run, job) != 0) {
+		// full, encoded here and now after all
+		transform_run(TRANSFORM_WEBHOOK, hook_publish_run, job);
+	}
+	return 0;
+}
+
+int
+webhook_msg_publish(nng_socket *sock, conf_web_hook *hook_conf,
+    pub_packet_struct *pub_packet, nng_msg *msg, const char *username,
+    const char *client_id)
+{
+	size_t size;
+
+	if (!hook_conf->enable || !hook_publish_wanted(hook_conf, pub_packet)) {
+		return -1;
+	}
+	size = hook_payload_size(hook_conf, pub_packet->payload.len);
+	if (hook_publish_offload(sock, hook_conf, pub_packet, msg, username,
+	        client_id, size) == 0) {
+		return 0;
+	}
+	return hook_publish_send(sock, hook_conf->encode_payload,
+	    nng_timestamp(), pub_packet->var_header.publish.topic_name.body,
+	    pub_packet->fixed_header.retain, pub_packet->fixed_header.qos,
+	    username, client_id, pub_packet->payload.data,
+	    pub_packet->payload.len, size);
 }
 
 int
@@ -194,30 +325,29 @@ webhook_client_connack(nng_socket *sock, conf_web_hook *hook_conf,
     uint8_t proto_ver, uint16_t keepalive, uint8_t reason,
     const char *username, const char *client_id)
 {
+	json_writer w;
+
 	if (!hook_conf->enable || !event_filter(hook_conf, CLIENT_CONNACK)) {
 		return -1;
 	}
+	if (webhook_lifecycle_enabled()) {
+		return webhook_lifecycle_add(
+		    sock, HOOK_LIFECYCLE_CONNACK, client_id, reason == SUCCESS);
+	}
 
-	cJSON *obj = cJSON_CreateObject();
-
-	cJSON_AddNumberToObject(obj, "proto_ver", proto_ver);
-	cJSON_AddNumberToObject(obj, "keepalive", keepalive);
+	json_writer_init(&w, HOOK_JSON_HINT);
+	json_write_begin(&w, '{');
+	json_field_u64(&w, "proto_ver", proto_ver);
+	json_field_u64(&w, "keepalive", keepalive);
 	// TODO get reason string
-	cJSON_AddStringToObject(
-	    obj, "conn_ack", reason == SUCCESS ? "success" : "fail");
-	cJSON_AddStringToObject(
-	    obj, "username", username == NULL ? "undefined" : username);
-	cJSON_AddStringToObject(obj, "clientid", client_id);
-	cJSON_AddStringToObject(obj, "action", "client_connack");
-
-	char *json = cJSON_PrintUnformatted(obj);
-
-	int rv = nng_send(*sock, json, strlen(json), NNG_FLAG_NONBLOCK);
-
-	nng_strfree(json);
-	cJSON_Delete(obj);
-
-	return rv;
+	json_field_str(&w, "conn_ack", reason == SUCCESS ? "success" : "fail");
+	json_field_str(
+	    &w, "username", username == NULL ? "undefined" : username);
+	json_field_str(&w, "clientid", client_id);
+	json_field_str(&w, "action", "client_connack");
+	json_write_end(&w, '}');
+
+	return hook_send(sock, &w);
 }
 
 int
@@ -225,161 +355,254 @@ webhook_client_disconnect(nng_socket *sock, conf_web_hook *hook_conf,
     uint8_t proto_ver, uint16_t keepalive, uint8_t reason,
     const char *username, const char *client_id)
 {
+	json_writer w;
+
 	if (!hook_conf->enable ||
 	    !event_filter(hook_conf, CLIENT_DISCONNECTED)) {
 		return -1;
 	}
+	if (webhook_lifecycle_enabled()) {
+		return webhook_lifecycle_add(sock, HOOK_LIFECYCLE_DISCONNECT,
+		    client_id, reason == SUCCESS);
+	}
 
-	cJSON *obj = cJSON_CreateObject();
+	json_writer_init(&w, HOOK_JSON_HINT);
+	json_write_begin(&w, '{');
 	// TODO get reason string
-	cJSON_AddStringToObject(
-	    obj, "reason", reason == SUCCESS ? "normal" : "abnormal");
-	cJSON_AddStringToObject(
-	    obj, "username", username == NULL ? "undefined" : username);
-	cJSON_AddStringToObject(obj, "clientid", client_id);
-	cJSON_AddStringToObject(obj, "action", "client_disconnected");
+	json_field_str(&w, "reason", reason == SUCCESS ? "normal" : "abnormal");
+	json_field_str(
+	    &w, "username", username == NULL ? "undefined" : username);
+	json_field_str(&w, "clientid", client_id);
+	json_field_str(&w, "action", "client_disconnected");
+	json_write_end(&w, '}');
+
+	return hook_send(sock, &w);
+}
 
-	char *json = cJSON_PrintUnformatted(obj);
+// Not one of the configurable events, sent whenever webhooks are on as
+// only brokers with subscriber queue limits produce it.
+int
+webhook_client_slow(nng_socket *sock, conf_web_hook *hook_conf,
+    const char *username, const char *client_id, uint64_t unacked_msgs)
+{
+	json_writer w;
 
-	int rv = nng_send(*sock, json, strlen(json), NNG_FLAG_NONBLOCK);
+	if (!hook_conf->enable) {
+		return -1;
+	}
 
-	nng_strfree(json);
-	cJSON_Delete(obj);
+	json_writer_init(&w, HOOK_JSON_HINT);
+	json_write_begin(&w, '{');
+	json_field_u64(&w, "unacked_msgs", unacked_msgs);
+	json_field_str(
+	    &w, "username", username == NULL ? "undefined" : username);
+	json_field_str(
+	    &w, "clientid", client_id == NULL ? "undefined" : client_id);
+	json_field_str(&w, "action", "client_slow");
+	json_write_end(&w, '}');
+
+	return hook_send(sock, &w);
+}
 
-	return rv;
+typedef struct {
+	nng_msg    *msg;
+	nng_socket *sock;
+} hook_ex_slot;
+
+/*
+ * Single producer ring of one worker: only that worker's hook_entry pushes,
+ * and only the holder of busy pops and drives the send aio, from there or
+ * from the aio callback. Neither side takes a lock.
+ */
+typedef struct {
+	struct work    *work;
+	nng_aio        *aio;
+	nng_atomic_u64 *head;
+	nng_atomic_u64 *tail;
+	nng_atomic_int *busy;
+	nng_atomic_u64 *stalls;
+	nng_atomic_u64 *dropped;
+	uint64_t        key_ms;  // last key of this worker, producer only
+	uint32_t        key_seq;
+	hook_ex_slot    slots[NANO_EXCHANGE_RING_LEN];
+} hook_ex_ring;
+
+static hook_ex_ring *ex_rings     = NULL;
+static uint64_t      ex_rings_num = 0;
+
+/*
+ * Exchange keys of one worker rise strictly: the wall clock in ms, never
+ * going back, then a sequence within that ms and the worker index. A
+ * sequence running out moves on to the next ms.
+ */
+static uint64_t
+hook_ex_ring_key(hook_ex_ring *ring, uint32_t worker)
+{
+	uint64_t now = nng_timestamp();
+
+	if (now > ring->key_ms) {
+		ring->key_ms  = now;
+		ring->key_seq = 0;
+	} else if (++ring->key_seq >> NANO_EXCHANGE_KEY_SEQ_BITS) {
+		ring->key_ms++;
+		ring->key_seq = 0;
+	}
+	return NANO_EXCHANGE_KEY_MIN(ring->key_ms) |
+	    (uint64_t) ring->key_seq << NANO_EXCHANGE_KEY_WORKER_BITS |
+	    (worker & ((1u << NANO_EXCHANGE_KEY_WORKER_BITS) - 1));
 }
 
-static inline uint64_t
-gen_hash_nearby_key(char *clientid, char *topic, uint32_t pid)
+// Send the next queued hand-off unless one is in flight already.
+static void
+hook_ex_ring_kick(hook_ex_ring *ring)
 {
-	uint64_t res = 0;
-	char buf[11]; // should be enough put a u32
-	sprintf(buf, "%d", pid);
+	uint64_t      head;
+	hook_ex_slot *slot;
 
-	char buf2[100]; // should be enough put the clienid and topic and pid
-	sprintf(buf2, "%s%s%s", clientid, topic, buf);
+	for (;;) {
+		if (!nng_atomic_cas(ring->busy, 0, 1)) {
+			return;
+		}
+		head = nng_atomic_get64(ring->head);
+		if (head != nng_atomic_get64(ring->tail)) {
+			break;
+		}
+		nng_atomic_set(ring->busy, 0);
+		// a push between the check and the release goes around again
+		if (head == nng_atomic_get64(ring->tail)) {
+			return;
+		}
+	}
+	slot = &ring->slots[head % NANO_EXCHANGE_RING_LEN];
+	nng_aio_set_msg(ring->aio, slot->msg);
+	slot->msg = NULL;
+	nng_atomic_set64(ring->head, head + 1);
+	nng_send_aio(*slot->sock, ring->aio);
+}
 
-	uint32_t key32 = DJBHash(buf2);
-	res = key32; res = res << 32; res += key32;
-	// log_info("%s - %s - %s => %lx %llx", clientid, topic, buf, key32, res);
-	// nng_time ts = nng_timestamp();
-	return res;
+static int
+hook_ex_ring_put(hook_ex_ring *ring, nng_socket *sock, nng_msg *msg)
+{
+	uint64_t      tail = nng_atomic_get64(ring->tail);
+	hook_ex_slot *slot;
+
+	if (tail - nng_atomic_get64(ring->head) >= NANO_EXCHANGE_RING_LEN) {
+		nng_atomic_inc64(ring->dropped);
+		nng_msg_free(msg);
+		return NNG_EAGAIN;
+	}
+	if (nng_atomic_get(ring->busy) != 0) {
+		nng_atomic_inc64(ring->stalls);
+	}
+	slot       = &ring->slots[tail % NANO_EXCHANGE_RING_LEN];
+	slot->msg  = msg;
+	slot->sock = sock;
+	nng_atomic_set64(ring->tail, tail + 1);
+	hook_ex_ring_kick(ring);
+	return 0;
 }
 
-static uint32_t g_inc_id = 0;
+// first exchange whose topic matches, count if none does
+static size_t
+hook_exchange_find(nano_work *work, const char *topic)
+{
+	conf_exchange     *ex_conf = &work->config->exchange;
+	hook_filter_table *t       = hook_filters.table;
+	uint32_t           id;
+
+	if (t != NULL) {
+		return topic_filter_set_first(t->exchange, topic,
+		           pub_packet_levels(work->pub_packet), &id)
+		    ? id
+		    : ex_conf->count;
+	}
+	for (size_t i = 0; i < ex_conf->count; i++) {
+		if (topic_filter(ex_conf->nodes[i]->topic, topic)) {
+			return i;
+		}
+	}
+	return ex_conf->count;
+}
+
+// sinks fed from the exchange: parquet, blf, the recent ring
+static inline bool
+hook_exchange_wanted(nano_work *work)
+{
+	return work->config->exchange.count > 0 &&
+	    (work->config->parquet.enable || work->config->blf.enable ||
+	        exchange_recent_enabled()) &&
+	    work->flag == CMD_PUBLISH &&
+	    nng_msg_get_type(work->msg) == CMD_PUBLISH;
+}
+
+/*
+ * Hand a PUBLISH to the first exchange whose topic matches, once for all
+ * sinks behind it. The exchange keys messages by their timestamp, which
+ * the original shares with retain and session copies (v5 expiry), so the
+ * exchange gets a carrier of its own holding just the payload. It is
+ * queued on the worker's ring rather than waited for.
+ */
+static void
+hook_exchange_ingest(nano_work *work)
+{
+	conf_exchange *ex_conf = &work->config->exchange;
+	hook_ex_ring  *ring;
+	char          *topic;
+	nng_msg       *msg;
+	uint8_t       *payload;
+	uint64_t       key;
+	size_t         len;
+	size_t         i;
+
+	topic = work->pub_packet->var_header.publish.topic_name.body;
+	if (topic == NULL) {
+		return;
+	}
+	if ((i = hook_exchange_find(work, topic)) == ex_conf->count) {
+		return;
+	}
+	payload = nng_msg_payload_ptr(work->msg);
+	len     = nng_msg_len(work->msg) -
+	    (size_t) (payload - (uint8_t *) nng_msg_body(work->msg));
+	if (nng_msg_alloc(&msg, len) != 0) {
+		log_error("exchange carrier alloc failed");
+		return;
+	}
+	memcpy(nng_msg_body(msg), payload, len);
+	nng_msg_set_payload_ptr(msg, nng_msg_body(msg));
+
+	if (work->ctx.id > work->config->parallel)
+		log_error("parallel %d idx %d", work->config->parallel,
+		    work->ctx.id); // shall be a bug if triggered
+
+	ring = &ex_rings[work->ctx.id - 1];
+	key  = hook_ex_ring_key(ring, work->ctx.id - 1);
+	nng_msg_set_timestamp(msg, (nng_time) key);
+	if (exchange_recent_enabled() &&
+	    exchange_recent_put(work->ctx.id - 1, key, (uint32_t) i, topic,
+	        payload, len) != 0) {
+		log_warn("exchange recent copy of ctx %d failed", work->ctx.id);
+	}
+	if (hook_ex_ring_put(ring, ex_conf->nodes[i]->sock, msg) != 0) {
+		log_warn("exchange ring of ctx %d full, msg dropped",
+		    work->ctx.id);
+	}
+}
 
 inline int
 hook_entry(nano_work *work, uint8_t reason)
 {
 	int            rv        = 0;
 	conf_web_hook *hook_conf = &work->config->web_hook;
-	conf_exchange *ex_conf   = &work->config->exchange;
 	conn_param    *cparam    = work->cparam;
 	nng_socket    *sock      = &work->hook_sock;
-	nng_socket    *ex_sock;
-	conf_parquet  *parquetconf = &work->config->parquet;
-	conf_blf      *blfconf     = &work->config->blf;
 
 	// process MQ msg first, only pub msg is valid
 	// discard online/offline event msg?
-	if (ex_conf->count > 0 && parquetconf->enable == true
-		&& (work->flag == CMD_PUBLISH)
-		&& nng_msg_get_type(work->msg) == CMD_PUBLISH) {
-		// dup msg for now, TODO or reuse it?
-		nng_msg *msg;
-		nng_msg_alloc(&msg, 0);
-		nng_msg_header_append(msg, nng_msg_header(work->msg), nng_msg_header_len(work->msg));
-		nng_msg_append(msg, nng_msg_body(work->msg), nng_msg_len(work->msg));
-
-		uint8_t *body_ptr = nng_msg_body(work->msg);
-		ptrdiff_t offset = (ptrdiff_t)(nng_msg_payload_ptr(work->msg) - body_ptr);
-		nng_msg_set_payload_ptr(msg, (uint8_t *)nng_msg_body(msg) + offset);
-
-		// cparam has cloned at outside of hook_entry
-		char *clientid = (char *)conn_param_get_clientid(work->cparam);
-		if (clientid == NULL)
-			goto done;
-		char *topic = work->pub_packet->var_header.publish.topic_name.body;
-		if (topic == NULL)
-			goto done;
-		nng_mtx_lock(hook_conf->ex_mtx);
-		uint32_t pid = g_inc_id ++;
-		nng_mtx_unlock(hook_conf->ex_mtx);
-
-		nng_time ts = (nng_time)gen_hash_nearby_key(clientid, topic, pid);
-		nng_msg_set_timestamp(msg, ts);
-
-		for (size_t i = 0; i < ex_conf->count; i++) {
-			if (topic_filter(ex_conf->nodes[i]->topic,
-			        work->pub_packet->var_header.publish.topic_name.body)) {
-
-				if (work->ctx.id > work->config->parallel)
-					log_error("parallel %d idx %d", work->config->parallel);	// shall be a bug if triggered
-
-				nng_aio *aio = hook_conf->saios[work->ctx.id-1];
-				nng_aio_wait(aio);
-
-				nng_msg_clone(msg);
-				nng_aio_set_msg(aio, msg);
-
-				ex_sock = ex_conf->nodes[i]->sock;
-				nng_send_aio(*ex_sock, aio);
-				break;
-			}
-		}
-		nng_msg_free(msg); // Cloned for each exchange before
-	}
-
-
-	if (ex_conf->count > 0 && blfconf->enable == true
-		&& (work->flag == CMD_PUBLISH)
-		&& nng_msg_get_type(work->msg) == CMD_PUBLISH) {
-		// dup msg for now, TODO or reuse it?
-		nng_msg *msg;
-		nng_msg_alloc(&msg, 0);
-		nng_msg_header_append(msg, nng_msg_header(work->msg), nng_msg_header_len(work->msg));
-		nng_msg_append(msg, nng_msg_body(work->msg), nng_msg_len(work->msg));
-
-		uint8_t *body_ptr = nng_msg_body(work->msg);
-		ptrdiff_t offset = (ptrdiff_t)(nng_msg_payload_ptr(work->msg) - body_ptr);
-		nng_msg_set_payload_ptr(msg, (uint8_t *)nng_msg_body(msg) + offset);
-
-		// cparam has cloned at outside of hook_entry
-		char *clientid = (char *)conn_param_get_clientid(work->cparam);
-		if (clientid == NULL)
-			goto done;
-		char *topic = work->pub_packet->var_header.publish.topic_name.body;
-		if (topic == NULL)
-			goto done;
-		nng_mtx_lock(hook_conf->ex_mtx);
-		uint32_t pid = g_inc_id ++;
-		nng_mtx_unlock(hook_conf->ex_mtx);
-
-		nng_time ts = (nng_time)gen_hash_nearby_key(clientid, topic, pid);
-		nng_msg_set_timestamp(msg, ts);
-
-		for (size_t i = 0; i < ex_conf->count; i++) {
-			if (topic_filter(ex_conf->nodes[i]->topic,
-			        work->pub_packet->var_header.publish.topic_name.body)) {
-
-				if (work->ctx.id > work->config->parallel)
-					log_error("parallel %d idx %d", work->config->parallel);	// shall be a bug if triggered
-
-				nng_aio *aio = hook_conf->saios[work->ctx.id-1];
-				nng_aio_wait(aio);
-
-				nng_msg_clone(msg);
-				nng_aio_set_msg(aio, msg);
-
-				ex_sock = ex_conf->nodes[i]->sock;
-				nng_send_aio(*ex_sock, aio);
-				break;
-			}
-		}
-		nng_msg_free(msg); // Cloned for each exchange before
+	if (hook_exchange_wanted(work)) {
+		hook_exchange_ingest(work);
 	}
 
-
 	if (!hook_conf->enable)
 		return 0;
 	switch (work->flag) {
@@ -392,7 +615,7 @@ hook_entry(nano_work *work, uint8_t reason)
 		break;
 	case CMD_PUBLISH:
 		rv = webhook_msg_publish(sock, hook_conf, work->pub_packet,
-		    (const char*)conn_param_get_username(cparam),
+		    work->msg, (const char*)conn_param_get_username(cparam),
 		    (const char*)conn_param_get_clientid(cparam));
 		break;
 	case CMD_DISCONNECT_EV:
@@ -409,7 +632,6 @@ hook_entry(nano_work *work, uint8_t reason)
 		break;
 	}
 
-done:
 	// Do not let online event msg trigger webhook
 	work->flag = 0;
 	return rv;
@@ -460,23 +682,6 @@ flush_smsg_to_disk(nng_msg **smsg, size_t len, void *handle, nng_aio *aio, char
 		len2 ++;
 	}
 
-#if defined(SUPP_PARQUET) || defined(SUPP_BLF)
-#ifdef SUPP_PARQUET
-	if (false == nng_aio_begin(aio)) {
-		log_error("nng aio begin failed");
-		return NNG_EBUSY;
-	}
-
-	if (len2 > 0)
-		log_warn("flush to parquet (%d) %lld...%lld", len2, keys[0],
-		    keys[len2 - 1]);
-	// write to disk
-	parquet_object *parquet_obj;
-	parquet_obj = parquet_object_alloc(
-	    keys, (uint8_t **) datas, lens, len2, aio, (void *) smsg);
-	parquet_obj->topic = topic;
-	parquet_write_batch_async(parquet_obj);
-#endif
 #if defined(SUPP_BLF)
 	if (false == nng_aio_begin(aio)) {
 		log_error("nng aio begin failed");
@@ -491,8 +696,6 @@ flush_smsg_to_disk(nng_msg **smsg, size_t len, void *handle, nng_aio *aio, char
 	blf_obj = blf_object_alloc(
 	    keys, (uint8_t **) datas, lens, len2, aio, (void *) smsg);
 	blf_write_batch_async(blf_obj);
-
-#endif
 #else
 	nng_free(keys, len);
 	nng_free(datas, len);
@@ -509,9 +712,8 @@ flush_smsg_to_disk(nng_msg **smsg, size_t len, void *handle, nng_aio *aio, char
 }
 
 static void
-send_exchange_cb(void *arg)
+hook_exchange_sent(struct work *w, nng_aio *aio)
 {
-	struct work *w = arg;
 	int          rv;
 
 	conf *nanomq_conf = w->config;
@@ -519,14 +721,15 @@ send_exchange_cb(void *arg)
 	conf_parquet  *parquet_conf = &nanomq_conf->parquet;
 	conf_blf  *blf_conf = &nanomq_conf->blf;
 
-	nng_aio *aio = hook_conf->saios[w->ctx.id-1];
+	nng_msg *msg = nng_aio_get_msg(aio);
+	nng_aio_set_msg(aio, NULL);
 
 	if ((rv = nng_aio_result(aio)) != 0) {
 		log_error("error %d in send to exchange", rv);
+		nng_msg_free(msg);
 		return;
 	}
 
-	nng_msg *msg = nng_aio_get_msg(aio);
 	if (!msg)
 		return;
 
@@ -538,31 +741,26 @@ send_exchange_cb(void *arg)
 	}
 
 	int *msgs_lenp = (int *)nng_msg_get_proto_data(msg);
-	int  msgs_len;
+	int  msgs_len = 0;
 	if (msgs_lenp)
 		msgs_len = *msgs_lenp;
 
 	char *topic = NULL;
 	topic = nng_msg_get_conn_param(msg);
 
-	// Flush to disk. Call Parquet
-	if (parquet_conf->enable || blf_conf->enable) {
-		if (parquet_conf->enable) {
-			nng_mtx_lock(hook_conf->ex_mtx);
-			rv = flush_smsg_to_disk(
-			    msgs_del, msgs_len, NULL, hook_conf->ex_aio, topic);
-			if (rv != 0)
-				log_error("flush error %d", rv);
-			nng_mtx_unlock(hook_conf->ex_mtx);
-		}
-		if (blf_conf->enable) {
-			nng_mtx_lock(hook_conf->ex_mtx);
-			rv = flush_smsg_to_disk(
-			    msgs_del, msgs_len, NULL, hook_conf->ex_aio, topic);
-			if (rv != 0)
-				log_error("flush error %d", rv);
-			nng_mtx_unlock(hook_conf->ex_mtx);
-		}
+	// Flush to disk. The parquet sink gathers its own batches
+#ifdef SUPP_PARQUET
+	if (parquet_conf->enable) {
+		parquet_sink_put(topic, msgs_del, msgs_len);
+	} else
+#endif
+	if (blf_conf->enable) {
+		PROF_LOCK(PROF_LOCK_EXCHANGE, hook_conf->ex_mtx);
+		rv = flush_smsg_to_disk(
+		    msgs_del, msgs_len, NULL, hook_conf->ex_aio, topic);
+		if (rv != 0)
+			log_error("flush error %d", rv);
+		nng_mtx_unlock(hook_conf->ex_mtx);
 	} else {
 		for (int i = 0; i < msgs_len; ++i)
 			if (msgs_del[i]) {
@@ -576,6 +774,16 @@ send_exchange_cb(void *arg)
 		nng_free(msgs_lenp, sizeof(int));
 }
 
+static void
+send_exchange_cb(void *arg)
+{
+	hook_ex_ring *ring = arg;
+
+	hook_exchange_sent(ring->work, ring->aio);
+	nng_atomic_set(ring->busy, 0);
+	hook_ex_ring_kick(ring);
+}
+
 // Better to be done in sync
 static void
 send_parquet_cb(void *arg)
@@ -609,6 +817,141 @@ send_parquet_cb(void *arg)
 	}
 }
 
+static void
+hook_filter_table_free(hook_filter_table *t)
+{
+	topic_filter_set_free(t->publish);
+	topic_filter_set_free(t->exchange);
+	nng_free(t, sizeof(*t));
+}
+
+static int
+hook_filter_build(conf_web_hook *hook_conf, conf_exchange *ex_conf,
+    hook_filter_table **tp)
+{
+	hook_filter_table *t;
+	int                rv;
+
+	if ((t = nng_zalloc(sizeof(*t))) == NULL) {
+		return NNG_ENOMEM;
+	}
+	if ((rv = topic_filter_set_alloc(&t->publish)) != 0 ||
+	    (rv = topic_filter_set_alloc(&t->exchange)) != 0) {
+		hook_filter_table_free(t);
+		return rv;
+	}
+	for (uint16_t i = 0; i < hook_conf->rule_count && rv == 0; i++) {
+		conf_web_hook_rule *r = hook_conf->rules[i];
+		if (r->event < 32) {
+			t->events |= 1u << r->event;
+		}
+		if (r->event != MESSAGE_PUBLISH) {
+			continue;
+		}
+		if (r->topic == NULL) {
+			t->publish_any = true;
+		} else {
+			rv = topic_filter_set_add(t->publish, r->topic, i);
+		}
+	}
+	for (size_t i = 0; i < ex_conf->count && rv == 0; i++) {
+		rv = topic_filter_set_add(
+		    t->exchange, ex_conf->nodes[i]->topic, (uint32_t) i);
+	}
+	if (rv != 0) {
+		hook_filter_table_free(t);
+		return rv;
+	}
+	*tp = t;
+	return 0;
+}
+
+static int
+hook_filter_swap(conf_web_hook *hook_conf, conf_exchange *ex_conf)
+{
+	hook_filter_table *t;
+	int                rv;
+
+	if (hook_filters.mtx == NULL &&
+	    (rv = nng_mtx_alloc(&hook_filters.mtx)) != 0) {
+		return rv;
+	}
+	if ((rv = hook_filter_build(hook_conf, ex_conf, &t)) != 0) {
+		return rv;
+	}
+	nng_mtx_lock(hook_filters.mtx);
+	t->retired         = hook_filters.table;
+	hook_filters.table = t;
+	nng_mtx_unlock(hook_filters.mtx);
+	return 0;
+}
+
+int
+hook_filter_init(conf *nanomq_conf)
+{
+	int rv;
+
+	if ((rv = hook_filter_swap(
+	         &nanomq_conf->web_hook, &nanomq_conf->exchange)) != 0) {
+		// matched from the conf instead
+		log_warn("hook topics not compiled: %d", rv);
+	}
+	return rv;
+}
+
+int
+hook_filter_reload(conf *cur_conf, conf *new_conf)
+{
+	conf_web_hook       *cur = &cur_conf->web_hook;
+	conf_web_hook       *new = &new_conf->web_hook;
+	conf_web_hook_rule **rules;
+	uint16_t             rule_count;
+	int                  rv;
+
+	if (!cur->enable || !new->enable) {
+		if (cur->enable != new->enable) {
+			log_warn("webhook %s by a restart only",
+			    new->enable ? "is started" : "is stopped");
+		}
+		return 0;
+	}
+	if (cur->url == NULL || new->url == NULL ||
+	    strcmp(cur->url, new->url) != 0) {
+		log_warn("webhook keeps its url until a restart");
+	}
+	// workers read the rules of the conf until a table is in place
+	if ((rv = hook_filter_swap(new, &cur_conf->exchange)) != 0) {
+		log_error("webhook rules reload failed: %d", rv);
+		return rv;
+	}
+	rules               = cur->rules;
+	rule_count          = cur->rule_count;
+	cur->rules          = new->rules;
+	cur->rule_count     = new->rule_count;
+	new->rules          = rules;
+	new->rule_count     = rule_count;
+	cur->encode_payload = new->encode_payload;
+	log_info("webhook: %u rules", (unsigned) cur->rule_count);
+	return 0;
+}
+
+void
+hook_filter_fini(void)
+{
+	hook_filter_table *t = hook_filters.table;
+	hook_filter_table *next;
+
+	while (t != NULL) {
+		next = t->retired;
+		hook_filter_table_free(t);
+		t = next;
+	}
+	if (hook_filters.mtx != NULL) {
+		nng_mtx_free(hook_filters.mtx);
+	}
+	memset(&hook_filters, 0, sizeof(hook_filters));
+}
+
 int
 hook_exchange_init(conf *nanomq_conf, uint64_t num_ctx)
 {
@@ -618,6 +961,22 @@ hook_exchange_init(conf *nanomq_conf, uint64_t num_ctx)
 	nng_aio_alloc(&hook_conf->ex_aio, send_parquet_cb, hook_conf);
 	hook_conf->saios = nng_alloc(sizeof(nng_aio *) * num_ctx);
 
+	ex_rings = nng_zalloc(sizeof(hook_ex_ring) * num_ctx);
+	if (hook_conf->saios == NULL || ex_rings == NULL) {
+		return NNG_ENOMEM;
+	}
+	for (uint64_t i = 0; i < num_ctx; i++) {
+		hook_ex_ring *ring = &ex_rings[i];
+		if (nng_atomic_alloc64(&ring->head) != 0 ||
+		    nng_atomic_alloc64(&ring->tail) != 0 ||
+		    nng_atomic_alloc(&ring->busy) != 0 ||
+		    nng_atomic_alloc64(&ring->stalls) != 0 ||
+		    nng_atomic_alloc64(&ring->dropped) != 0) {
+			return NNG_ENOMEM;
+		}
+	}
+	ex_rings_num = num_ctx;
+
 	return 0;
 }
 
@@ -630,7 +989,9 @@ hook_exchange_sender_init(conf *nanomq_conf, struct work **works, uint64_t num_c
 
 	for (int i = 0; i < num_ctx; ++i) {
 		nng_aio_alloc(
-		    &hook_conf->saios[i], send_exchange_cb, works[i]);
+		    &hook_conf->saios[i], send_exchange_cb, &ex_rings[i]);
+		ex_rings[i].work = works[i];
+		ex_rings[i].aio  = hook_conf->saios[i];
 	}
 
 #ifdef SUPP_PARQUET
@@ -638,6 +999,12 @@ hook_exchange_sender_init(conf *nanomq_conf, struct work **works, uint64_t num_c
 
 		log_info("init parquet_write_launcher");
 		parquet_write_launcher(parquet_conf);
+		if (parquet_sink_init(parquet_conf) != 0) {
+			log_error("parquet sink init failed");
+		}
+		if (exchange_query_init(parquet_conf) != 0) {
+			log_error("parquet query index init failed");
+		}
 	}
 #endif
 
@@ -651,3 +1018,15 @@ hook_exchange_sender_init(conf *nanomq_conf, struct work **works, uint64_t num_c
 	return 0;
 }
 
+void
+hook_exchange_stat(hook_exchange_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	for (uint64_t i = 0; i < ex_rings_num; i++) {
+		hook_ex_ring *ring = &ex_rings[i];
+		stats->queued += nng_atomic_get64(ring->tail) -
+		    nng_atomic_get64(ring->head);
+		stats->stalls += nng_atomic_get64(ring->stalls);
+		stats->dropped += nng_atomic_get64(ring->dropped);
+	}
+}
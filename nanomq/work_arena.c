@@ -0,0 +1,260 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/work_arena.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+#define ARENA_ALIGN sizeof(uint64_t)
+
+typedef struct arena_block arena_block;
+struct arena_block {
+	arena_block *next;
+	size_t       size;
+	size_t       used;
+	uint64_t     data[];
+};
+
+struct work_arena {
+	work_arena  *next;
+	arena_block *head; // blocks added for this message, then base
+	arena_block *base; // kept across resets
+	size_t       used; // by this message
+	size_t       reserved;
+	uint64_t     allocs;
+	uint64_t     bytes;
+	uint64_t     blocks;
+	uint64_t     resets;
+	size_t       high;
+};
+
+static struct {
+	nng_mtx    *mtx;
+	work_arena *arenas;
+	bool        enabled;
+} arena_;
+
+static arena_block *
+arena_block_alloc(size_t size)
+{
+	arena_block *b;
+
+	if ((b = nng_alloc(sizeof(*b) + size)) == NULL) {
+		return NULL;
+	}
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+static void
+arena_block_free(arena_block *b)
+{
+	nng_free(b, sizeof(*b) + b->size);
+}
+
+// Replace the base block by one of size, keeping the old one on failure.
+static void
+arena_rebase(work_arena *a, size_t size)
+{
+	arena_block *b;
+
+	if ((b = arena_block_alloc(size)) == NULL) {
+		return;
+	}
+	a->reserved += size;
+	a->reserved -= a->base->size;
+	a->blocks++;
+	arena_block_free(a->base);
+	a->base = a->head = b;
+}
+
+int
+work_arena_init(void)
+{
+	int rv;
+
+	if (arena_.enabled) {
+		return 0;
+	}
+	if ((rv = nng_mtx_alloc(&arena_.mtx)) != 0) {
+		return rv;
+	}
+	arena_.enabled = true;
+	return 0;
+}
+
+void
+work_arena_fini(void)
+{
+	work_arena  *a;
+	arena_block *b;
+
+	if (!arena_.enabled) {
+		return;
+	}
+	while ((a = arena_.arenas) != NULL) {
+		arena_.arenas = a->next;
+		while ((b = a->head) != NULL) {
+			a->head = b->next;
+			arena_block_free(b);
+		}
+		nng_free(a, sizeof(*a));
+	}
+	nng_mtx_free(arena_.mtx);
+	memset(&arena_, 0, sizeof(arena_));
+}
+
+bool
+work_arena_enabled(void)
+{
+	return arena_.enabled;
+}
+
+work_arena *
+work_arena_alloc(void)
+{
+	work_arena *a;
+
+	if (!arena_.enabled || (a = nng_zalloc(sizeof(*a))) == NULL) {
+		return NULL;
+	}
+	if ((a->base = arena_block_alloc(NANO_WORK_ARENA_BLOCK)) == NULL) {
+		nng_free(a, sizeof(*a));
+		return NULL;
+	}
+	a->head     = a->base;
+	a->reserved = NANO_WORK_ARENA_BLOCK;
+	a->blocks   = 1;
+	nng_mtx_lock(arena_.mtx);
+	a->next       = arena_.arenas;
+	arena_.arenas = a;
+	nng_mtx_unlock(arena_.mtx);
+	return a;
+}
+
+void *
+work_arena_get(work_arena *a, size_t size)
+{
+	arena_block *b;
+	void        *p;
+
+	if (a == NULL) {
+		return NULL;
+	}
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	b    = a->head;
+	if (b->size - b->used < size) {
+		if ((b = arena_block_alloc(size > NANO_WORK_ARENA_BLOCK
+		             ? size
+		             : NANO_WORK_ARENA_BLOCK)) == NULL) {
+			return NULL;
+		}
+		b->next = a->head;
+		a->head = b;
+		a->reserved += b->size;
+		a->blocks++;
+	}
+	p = (uint8_t *) b->data + b->used;
+	b->used += size;
+	a->used += size;
+	a->allocs++;
+	a->bytes += size;
+	return p;
+}
+
+void *
+work_arena_zget(work_arena *a, size_t size)
+{
+	void *p;
+
+	if ((p = work_arena_get(a, size)) != NULL) {
+		memset(p, 0, size);
+	}
+	return p;
+}
+
+char *
+work_arena_strndup(work_arena *a, const char *s, size_t len)
+{
+	char *p;
+
+	if ((p = work_arena_get(a, len + 1)) != NULL) {
+		memcpy(p, s, len);
+		p[len] = '\0';
+	}
+	return p;
+}
+
+void
+work_arena_reset(work_arena *a)
+{
+	arena_block *b;
+	size_t       grow;
+
+	if (a == NULL) {
+		return;
+	}
+	if (a->used > a->high) {
+		a->high = a->used;
+	}
+	if (a->head != a->base) {
+		while ((b = a->head) != a->base) {
+			a->head = b->next;
+			a->reserved -= b->size;
+			arena_block_free(b);
+		}
+		// messages like this one fit the base block from now on
+		grow = a->used < NANO_WORK_ARENA_MAX ? a->used
+		                                     : NANO_WORK_ARENA_MAX;
+		if (grow > a->base->size) {
+			arena_rebase(a, grow);
+		}
+	}
+	a->base->used = 0;
+	a->used       = 0;
+	a->resets++;
+}
+
+void
+work_arena_shrink(work_arena *a)
+{
+	if (a == NULL) {
+		return;
+	}
+	work_arena_reset(a);
+	if (a->base->size > NANO_WORK_ARENA_BLOCK) {
+		arena_rebase(a, NANO_WORK_ARENA_BLOCK);
+	}
+}
+
+void
+work_arena_stats_get(work_arena_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!arena_.enabled) {
+		return;
+	}
+	nng_mtx_lock(arena_.mtx);
+	for (work_arena *a = arena_.arenas; a != NULL; a = a->next) {
+		s->arenas++;
+		s->allocs += a->allocs;
+		s->bytes += a->bytes;
+		s->blocks += a->blocks;
+		s->resets += a->resets;
+		s->reserved += a->reserved;
+		if (a->high > s->high) {
+			s->high = a->high;
+		}
+	}
+	nng_mtx_unlock(arena_.mtx);
+}
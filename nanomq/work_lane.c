@@ -0,0 +1,201 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/work_lane.h"
+#include "nng/mqtt/packet.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+static struct {
+	nng_mtx        *mtx;
+	void          **queue; // ring of heavy items
+	size_t          cap;
+	size_t          head;
+	size_t          len;
+	void          **idle; // parked heavy works
+	size_t          nidle;
+	size_t          workers;
+	nng_atomic_u64 *handled[WORK_LANES]; // kept off the lock, hot path
+	work_lane_stats heavy;
+	bool            enabled;
+} work_lane_;
+
+static const char *work_lane_names[WORK_LANES] = {
+	"control",
+	"publish",
+	"heavy",
+};
+
+int
+work_lane_init(size_t workers, size_t depth)
+{
+	int rv;
+
+	if (work_lane_.enabled) {
+		return 0;
+	}
+	if (workers == 0 || depth == 0) {
+		return NNG_EINVAL;
+	}
+	if ((work_lane_.queue = nng_zalloc(sizeof(void *) * depth)) == NULL ||
+	    (work_lane_.idle = nng_zalloc(sizeof(void *) * workers)) == NULL) {
+		work_lane_.cap     = depth;
+		work_lane_.workers = workers;
+		work_lane_fini();
+		return NNG_ENOMEM;
+	}
+	work_lane_.cap     = depth;
+	work_lane_.workers = workers;
+	if ((rv = nng_mtx_alloc(&work_lane_.mtx)) != 0) {
+		work_lane_fini();
+		return rv;
+	}
+	for (int i = 0; i < WORK_LANES; i++) {
+		if ((rv = nng_atomic_alloc64(&work_lane_.handled[i])) != 0) {
+			work_lane_fini();
+			return rv;
+		}
+	}
+	work_lane_.enabled = true;
+	return 0;
+}
+
+// Queued items are owned by the caller, they are dropped here unseen.
+void
+work_lane_fini(void)
+{
+	if (work_lane_.queue != NULL) {
+		nng_free(work_lane_.queue, sizeof(void *) * work_lane_.cap);
+	}
+	if (work_lane_.idle != NULL) {
+		nng_free(work_lane_.idle, sizeof(void *) * work_lane_.workers);
+	}
+	for (int i = 0; i < WORK_LANES; i++) {
+		if (work_lane_.handled[i] != NULL) {
+			nng_atomic_free64(work_lane_.handled[i]);
+		}
+	}
+	if (work_lane_.mtx != NULL) {
+		nng_mtx_free(work_lane_.mtx);
+	}
+	memset(&work_lane_, 0, sizeof(work_lane_));
+}
+
+bool
+work_lane_enabled(void)
+{
+	return work_lane_.enabled;
+}
+
+work_lane_id
+work_lane_classify(uint8_t cmd)
+{
+	switch (cmd) {
+	case CMD_SUBSCRIBE:
+	case CMD_UNSUBSCRIBE:
+		return WORK_LANE_HEAVY;
+	case CMD_PUBLISH:
+	case CMD_PUBLISH_V5:
+		return WORK_LANE_PUBLISH;
+	default:
+		return WORK_LANE_CONTROL;
+	}
+}
+
+void
+work_lane_count(work_lane_id lane)
+{
+	if (!work_lane_.enabled || lane >= WORK_LANES) {
+		return;
+	}
+	nng_atomic_inc64(work_lane_.handled[lane]);
+}
+
+int
+work_lane_submit(void *item, void **worker)
+{
+	work_lane_stats *st = &work_lane_.heavy;
+
+	*worker = NULL;
+	if (!work_lane_.enabled) {
+		return NNG_ECLOSED;
+	}
+	nng_mtx_lock(work_lane_.mtx);
+	if (work_lane_.nidle > 0) {
+		*worker = work_lane_.idle[--work_lane_.nidle];
+	} else if (work_lane_.len == work_lane_.cap) {
+		st->overflow++;
+		nng_mtx_unlock(work_lane_.mtx);
+		return NNG_EAGAIN;
+	} else {
+		work_lane_.queue[(work_lane_.head + work_lane_.len) %
+		    work_lane_.cap] = item;
+		work_lane_.len++;
+		st->depth = work_lane_.len;
+		if (st->depth > st->depth_max) {
+			st->depth_max = st->depth;
+		}
+	}
+	nng_mtx_unlock(work_lane_.mtx);
+	nng_atomic_inc64(work_lane_.handled[WORK_LANE_HEAVY]);
+	return 0;
+}
+
+void *
+work_lane_next(void *worker)
+{
+	void *item = NULL;
+
+	if (!work_lane_.enabled) {
+		return NULL;
+	}
+	nng_mtx_lock(work_lane_.mtx);
+	if (work_lane_.len > 0) {
+		item            = work_lane_.queue[work_lane_.head];
+		work_lane_.head = (work_lane_.head + 1) % work_lane_.cap;
+		work_lane_.len--;
+		work_lane_.heavy.depth = work_lane_.len;
+	} else if (work_lane_.nidle < work_lane_.workers) {
+		// a send error may finish the aio twice, park once only
+		size_t i;
+		for (i = 0; i < work_lane_.nidle; i++) {
+			if (work_lane_.idle[i] == worker) {
+				break;
+			}
+		}
+		if (i == work_lane_.nidle) {
+			work_lane_.idle[work_lane_.nidle++] = worker;
+		}
+	}
+	nng_mtx_unlock(work_lane_.mtx);
+	return item;
+}
+
+void
+work_lane_stats_get(work_lane_id lane, work_lane_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!work_lane_.enabled || lane >= WORK_LANES) {
+		return;
+	}
+	if (lane == WORK_LANE_HEAVY) {
+		nng_mtx_lock(work_lane_.mtx);
+		*s = work_lane_.heavy;
+		nng_mtx_unlock(work_lane_.mtx);
+	}
+	s->handled = nng_atomic_get64(work_lane_.handled[lane]);
+}
+
+const char *
+work_lane_name(work_lane_id lane)
+{
+	return lane < WORK_LANES ? work_lane_names[lane] : "unknown";
+}
@@ -0,0 +1,242 @@
+//
+// Copyright 2023 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include <string.h>
+
+#include "include/work_lane.h"
+#include "include/work_pool.h"
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+static struct {
+	nng_mtx            *mtx;
+	nng_cv             *cv;
+	nng_thread         *thr;
+	nng_atomic_int     *busy;
+	work_pool_resize_cb cb;
+	void               *arg;
+	size_t              min;
+	size_t              max;
+	size_t              size;
+	size_t              retiring; // marked, still to reach a receive
+	unsigned            hot;      // windows in a row above HIGH
+	unsigned            cold;     // windows in a row below LOW
+	float               utilization;
+	uint64_t            grown;
+	uint64_t            shrunk;
+	bool                closing;
+	bool                enabled;
+} pool_;
+
+static int
+pool_step(float utilization, uint64_t queue_depth)
+{
+	size_t n;
+
+	if (utilization >= NANO_WORK_POOL_HIGH || queue_depth > 0) {
+		pool_.hot++;
+		pool_.cold = 0;
+	} else if (utilization <= NANO_WORK_POOL_LOW) {
+		pool_.cold++;
+		pool_.hot = 0;
+	} else {
+		pool_.hot  = 0;
+		pool_.cold = 0;
+	}
+	if (pool_.hot >= NANO_WORK_POOL_GROW_AFTER && pool_.size < pool_.max) {
+		pool_.hot = 0;
+		// a quarter more at once, bursts outrun single steps
+		n = pool_.size / 4 > 0 ? pool_.size / 4 : 1;
+		if (n > pool_.max - pool_.size) {
+			n = pool_.max - pool_.size;
+		}
+		return (int) n;
+	}
+	if (pool_.cold >= NANO_WORK_POOL_SHRINK_AFTER &&
+	    pool_.size - pool_.retiring > pool_.min) {
+		pool_.cold = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int
+work_pool_step(float utilization, uint64_t queue_depth)
+{
+	int delta;
+
+	if (!pool_.enabled) {
+		return 0;
+	}
+	nng_mtx_lock(pool_.mtx);
+	delta = pool_step(utilization, queue_depth);
+	nng_mtx_unlock(pool_.mtx);
+	return delta;
+}
+
+static void
+pool_thread_main(void *arg)
+{
+	uint64_t samples = 0;
+	unsigned n       = 0;
+
+	(void) arg;
+	nng_mtx_lock(pool_.mtx);
+	while (!pool_.closing) {
+		nng_time        until = nng_clock() + NANO_WORK_POOL_SAMPLE_MS;
+		work_lane_stats ls;
+		size_t          size;
+		size_t          done;
+		int             delta;
+
+		while (!pool_.closing && nng_clock() < until) {
+			nng_cv_until(pool_.cv, until);
+		}
+		if (pool_.closing) {
+			break;
+		}
+		samples += (uint64_t) nng_atomic_get(pool_.busy) * 100;
+		if (++n < NANO_WORK_POOL_WINDOW) {
+			continue;
+		}
+		size = pool_.size > 0 ? pool_.size : 1;
+		pool_.utilization = (float) samples / (float) (n * size);
+		samples           = 0;
+		n                 = 0;
+
+		if (pool_.max == pool_.min) {
+			continue;
+		}
+		work_lane_stats_get(WORK_LANE_HEAVY, &ls);
+		if ((delta = pool_step(pool_.utilization, ls.depth)) < 0) {
+			// marked works may retire before the callback returns
+			pool_.retiring += (size_t) -delta;
+		}
+		nng_mtx_unlock(pool_.mtx);
+		done = pool_.cb(delta, pool_.arg);
+		nng_mtx_lock(pool_.mtx);
+		if (delta > 0) {
+			pool_.size += done;
+			pool_.grown += done;
+		} else if (delta < 0) {
+			pool_.retiring -= (size_t) -delta - done;
+		}
+	}
+	nng_mtx_unlock(pool_.mtx);
+}
+
+int
+work_pool_init(size_t min, size_t max, work_pool_resize_cb cb, void *arg)
+{
+	int rv;
+
+	if (pool_.enabled) {
+		return 0;
+	}
+	pool_.min  = min;
+	pool_.max  = max > min ? max : min;
+	pool_.size = min;
+	pool_.cb   = cb;
+	pool_.arg  = arg;
+	if ((rv = nng_mtx_alloc(&pool_.mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&pool_.cv, pool_.mtx)) != 0 ||
+	    (rv = nng_atomic_alloc(&pool_.busy)) != 0) {
+		work_pool_fini();
+		return rv;
+	}
+	if (cb == NULL) {
+		pool_.max = min;
+	}
+	if ((rv = nng_thread_create(&pool_.thr, pool_thread_main, NULL)) !=
+	    0) {
+		pool_.thr = NULL;
+		work_pool_fini();
+		return rv;
+	}
+	pool_.enabled = true;
+	return 0;
+}
+
+void
+work_pool_fini(void)
+{
+	if (pool_.thr != NULL) {
+		nng_mtx_lock(pool_.mtx);
+		pool_.closing = true;
+		nng_cv_wake(pool_.cv);
+		nng_mtx_unlock(pool_.mtx);
+		nng_thread_destroy(pool_.thr);
+	}
+	if (pool_.busy != NULL) {
+		nng_atomic_free(pool_.busy);
+	}
+	if (pool_.cv != NULL) {
+		nng_cv_free(pool_.cv);
+	}
+	if (pool_.mtx != NULL) {
+		nng_mtx_free(pool_.mtx);
+	}
+	memset(&pool_, 0, sizeof(pool_));
+}
+
+bool
+work_pool_enabled(void)
+{
+	return pool_.enabled;
+}
+
+void
+work_pool_busy(void)
+{
+	if (pool_.enabled) {
+		nng_atomic_inc(pool_.busy);
+	}
+}
+
+void
+work_pool_idle(void)
+{
+	if (pool_.enabled) {
+		nng_atomic_dec_nv(pool_.busy);
+	}
+}
+
+void
+work_pool_retired(void)
+{
+	if (!pool_.enabled) {
+		return;
+	}
+	nng_mtx_lock(pool_.mtx);
+	if (pool_.retiring > 0) {
+		pool_.retiring--;
+		pool_.size--;
+		pool_.shrunk++;
+	}
+	nng_mtx_unlock(pool_.mtx);
+}
+
+void
+work_pool_stats_get(work_pool_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!pool_.enabled) {
+		return;
+	}
+	nng_mtx_lock(pool_.mtx);
+	s->min         = pool_.min;
+	s->max         = pool_.max;
+	s->size        = pool_.size - pool_.retiring;
+	s->utilization = pool_.utilization;
+	s->grown       = pool_.grown;
+	s->shrunk      = pool_.shrunk;
+	s->elastic     = pool_.max > pool_.min;
+	nng_mtx_unlock(pool_.mtx);
+	s->busy = nng_atomic_get(pool_.busy);
+}
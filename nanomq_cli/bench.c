@@ -1,7 +1,14 @@
 #if !defined(NANO_PLATFORM_WINDOWS) && defined(SUPP_BENCH)
 //TODO support windows later
 #include "include/nnb_opt.h"
+#include "include/lat_hist.h"
+#include "include/nnb_dist.h"
+#include "include/nnb_report.h"
+#include "include/nnb_scenario.h"
+#include <arpa/inet.h>
 #include <limits.h>
+#include <math.h>
+#include <signal.h>
 #include <nng/nng.h>
 #include <nng/supplemental/tls/tls.h>
 #include <nng/supplemental/util/options.h>
@@ -9,10 +16,20 @@
 #include "nng/supplemental/nanolib/utils.h"
 #include <stdarg.h>
 
+#if defined(SUPP_QUIC)
+#include <nng/mqtt/mqtt_quic_client.h>
+#endif
+
 #ifndef PARALLEL
 #define PARALLEL 8
 #endif
 
+// How late a message of --rate may go out before it counts as missed,
+// sleeps are in ms and wake late.
+#ifndef BENCH_SCHED_SLACK_US
+#define BENCH_SCHED_SLACK_US 2000
+#endif
+
 typedef struct {
 	nng_atomic_int *acnt;
 	nng_atomic_int *topic_cnt;
@@ -22,9 +39,10 @@ typedef struct {
 	nng_atomic_int *send_limit;
 	nng_atomic_int *last_send_cnt;
 	nng_atomic_int *index_cnt;
+	nng_atomic_int *missed; // messages of --rate sent late
 } bench_statistics;
 
-typedef enum { INIT, RECV, WAIT, SEND } nnb_state_flag_t;
+typedef enum { INIT, RECV, WAIT, SEND, SCHED } nnb_state_flag_t;
 
 typedef enum {
 	CONN,
@@ -38,6 +56,9 @@ struct work {
 	nng_time         last_send_ts; // last logical time stamp we send
 	nng_ctx          ctx;
 	nnb_state_flag_t state;
+	uint32_t         id;  // publisher id or sub connection of --latency
+	uint64_t         seq; // next sequence of pub --latency
+	uint64_t         due; // intended send time of --rate in us
 };
 
 static nnb_opt_flag_t opt_flag = CONN;
@@ -57,6 +78,347 @@ bench_count_init(bench_statistics *bs)
 	nng_atomic_alloc(&bs->send_limit);
 	nng_atomic_alloc(&bs->last_send_cnt);
 	nng_atomic_alloc(&bs->index_cnt);
+	nng_atomic_alloc(&bs->missed);
+}
+
+// Messages of one publisher on a topic as one subscriber got them.
+typedef struct {
+	uint32_t sub;
+	uint32_t pub;
+	uint64_t next; // one past the highest sequence
+	uint64_t received;
+} bench_stream;
+
+typedef struct {
+	char *        topic;
+	uint32_t      len;
+	lat_hist      hist;
+	bench_stream *streams;
+	size_t        nstreams;
+	uint64_t      reordered;
+} bench_topic;
+
+static struct {
+	nng_mtx *     mtx;
+	bench_topic **table; // open addressing on the topic
+	size_t        cap;
+	size_t        ntopics;
+	lat_hist      all;
+} bench_lat;
+
+static volatile sig_atomic_t bench_stop = 0;
+
+// The schedule of pub --rate for every connection together. Slots go out
+// in order whether or not the broker keeps up, so a slow broker makes
+// messages late instead of making the bench slower.
+static struct {
+	nng_mtx *mtx;
+	double   next; // intended time of the next message in us
+	double   gap;  // mean us between two
+	bool     poisson;
+} bench_sched;
+
+static void
+bench_put32(uint8_t *p, uint32_t v)
+{
+	for (int i = 3; i >= 0; i--, v >>= 8) {
+		p[i] = (uint8_t) v;
+	}
+}
+
+static void
+bench_put64(uint8_t *p, uint64_t v)
+{
+	for (int i = 7; i >= 0; i--, v >>= 8) {
+		p[i] = (uint8_t) v;
+	}
+}
+
+static uint64_t
+bench_get(const uint8_t *p, int n)
+{
+	uint64_t v = 0;
+
+	for (int i = 0; i < n; i++) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+// Stamps the encoded template of work right before the copy is sent.
+static void
+bench_stamp(struct work *work, uint64_t sent)
+{
+	uint8_t  stamp[NNB_STAMP_LEN];
+	uint32_t plen;
+	uint8_t *payload = nng_mqtt_msg_get_publish_payload(work->msg, &plen);
+
+	bench_put32(stamp, NNB_STAMP_MAGIC);
+	bench_put32(stamp + 4, work->id);
+	bench_put64(stamp + 8, work->seq++);
+	bench_put64(stamp + 16, sent);
+	memcpy(payload, stamp, sizeof(stamp));
+	// the encoded payload ends the body
+	memcpy((uint8_t *) nng_msg_body(work->msg) + nng_msg_len(work->msg) -
+	        plen,
+	    stamp, sizeof(stamp));
+}
+
+static size_t
+bench_hash(const char *topic, uint32_t len)
+{
+	uint32_t h = 2166136261u;
+
+	for (uint32_t i = 0; i < len; i++) {
+		h = (h ^ (uint8_t) topic[i]) * 16777619u;
+	}
+	return h;
+}
+
+// Caller holds bench_lat.mtx.
+static bench_topic **
+bench_topic_slot(bench_topic **table, size_t cap, const char *topic,
+    uint32_t len)
+{
+	size_t i = bench_hash(topic, len) & (cap - 1);
+
+	while (table[i] != NULL &&
+	    (table[i]->len != len || memcmp(table[i]->topic, topic, len) != 0)) {
+		i = (i + 1) & (cap - 1);
+	}
+	return &table[i];
+}
+
+// Caller holds bench_lat.mtx.
+static bench_topic *
+bench_topic_get(const char *topic, uint32_t len)
+{
+	bench_topic **slot;
+	bench_topic  *t;
+
+	if (bench_lat.ntopics * 2 >= bench_lat.cap) {
+		size_t        cap   = bench_lat.cap == 0 ? 64 : bench_lat.cap * 2;
+		bench_topic **table = calloc(cap, sizeof(*table));
+
+		if (table == NULL) {
+			return NULL;
+		}
+		for (size_t i = 0; i < bench_lat.cap; i++) {
+			if ((t = bench_lat.table[i]) != NULL) {
+				*bench_topic_slot(table, cap, t->topic, t->len) = t;
+			}
+		}
+		free(bench_lat.table);
+		bench_lat.table = table;
+		bench_lat.cap   = cap;
+	}
+	slot = bench_topic_slot(bench_lat.table, bench_lat.cap, topic, len);
+	if (*slot == NULL) {
+		if ((t = calloc(1, sizeof(*t))) == NULL ||
+		    (t->topic = malloc(len)) == NULL) {
+			free(t);
+			return NULL;
+		}
+		memcpy(t->topic, topic, len);
+		t->len = len;
+		*slot  = t;
+		bench_lat.ntopics++;
+	}
+	return *slot;
+}
+
+static bench_stream *
+bench_stream_get(bench_topic *t, uint32_t sub, uint32_t pub)
+{
+	bench_stream *s;
+
+	for (size_t i = 0; i < t->nstreams; i++) {
+		if (t->streams[i].sub == sub && t->streams[i].pub == pub) {
+			return &t->streams[i];
+		}
+	}
+	s = realloc(t->streams, sizeof(*s) * (t->nstreams + 1));
+	if (s == NULL) {
+		return NULL;
+	}
+	t->streams = s;
+	s          = &t->streams[t->nstreams++];
+	memset(s, 0, sizeof(*s));
+	s->sub = sub;
+	s->pub = pub;
+	return s;
+}
+
+// Records a message stamped by pub --latency as sub connection sub got it.
+static void
+bench_lat_record(uint32_t sub, nng_msg *msg)
+{
+	uint32_t      plen, tlen;
+	uint8_t      *p = nng_mqtt_msg_get_publish_payload(msg, &plen);
+	const char   *topic;
+	uint64_t      now, sent, seq, us;
+	bench_topic  *t;
+	bench_stream *s;
+
+	if (plen < NNB_STAMP_LEN || bench_get(p, 4) != NNB_STAMP_MAGIC) {
+		return;
+	}
+	now   = lat_now_us();
+	seq   = bench_get(p + 8, 8);
+	sent  = bench_get(p + 16, 8);
+	us    = now > sent ? now - sent : 0;
+	topic = nng_mqtt_msg_get_publish_topic(msg, &tlen);
+
+	nng_mtx_lock(bench_lat.mtx);
+	if ((t = bench_topic_get(topic, tlen)) != NULL &&
+	    (s = bench_stream_get(t, sub, (uint32_t) bench_get(p + 4, 4))) !=
+	        NULL) {
+		if (seq < s->next) {
+			t->reordered++;
+		} else {
+			s->next = seq + 1;
+		}
+		s->received++;
+		lat_hist_record(&t->hist, us);
+		lat_hist_record(&bench_lat.all, us);
+	}
+	nng_mtx_unlock(bench_lat.mtx);
+}
+
+static void
+bench_lat_print(const char *name, int len, const lat_hist *h,
+    uint64_t lost, uint64_t reordered)
+{
+	static const double pcts[] = { 50, 90, 99, 99.9 };
+	uint64_t            v[4];
+
+	lat_hist_percentiles(h, pcts, v, 4);
+	printf("%.*s: recv=%llu, lost=%llu, reordered=%llu, "
+	       "latency(us) p50=%llu, p90=%llu, p99=%llu, p999=%llu, "
+	       "max=%llu\n",
+	    len, name, (unsigned long long) h->total,
+	    (unsigned long long) lost, (unsigned long long) reordered,
+	    (unsigned long long) v[0], (unsigned long long) v[1],
+	    (unsigned long long) v[2], (unsigned long long) v[3],
+	    (unsigned long long) h->max);
+}
+
+// The end of a run, every topic and then all of them.
+static void
+bench_lat_report(void)
+{
+	uint64_t lost = 0, reordered = 0;
+
+	nng_mtx_lock(bench_lat.mtx);
+	for (size_t i = 0; i < bench_lat.cap; i++) {
+		bench_topic *t = bench_lat.table[i];
+		uint64_t     l = 0;
+
+		if (t == NULL) {
+			continue;
+		}
+		for (size_t j = 0; j < t->nstreams; j++) {
+			bench_stream *s = &t->streams[j];
+			// a redelivered qos 1 message counts twice
+			l += s->next > s->received ? s->next - s->received : 0;
+		}
+		bench_lat_print(t->topic, (int) t->len, &t->hist, l,
+		    t->reordered);
+		lost += l;
+		reordered += t->reordered;
+	}
+	bench_lat_print("total", 5, &bench_lat.all, lost, reordered);
+	nng_mtx_unlock(bench_lat.mtx);
+}
+
+// The run of pub, sub or conn as one group, at the last interval and the
+// one before.
+static nnb_result *bench_snap[2];
+
+// An interval, or the summary with a period of 0.
+static void
+bench_report(nng_time elapsed, nng_duration period)
+{
+	nnb_result       *now  = bench_snap[0];
+	nnb_group_result *g    = &now->groups[0];
+	int               sent = nng_atomic_get(statistics.send_cnt);
+
+	now->ngroups = 1;
+	now->elapsed = elapsed;
+	now->agents  = 1;
+	snprintf(g->name, sizeof(g->name), "%s",
+	    opt_flag == PUB ? "pub" : opt_flag == SUB ? "sub" : "conn");
+	g->connected = nng_atomic_get(statistics.acnt);
+	g->connects  = (uint64_t) g->connected;
+	g->sent      = opt_flag == PUB && sent > pub_opt->count
+	         ? (uint64_t) (sent - pub_opt->count)
+	         : 0;
+	g->recv = (uint64_t) nng_atomic_get(statistics.recv_cnt);
+	if (period == 0) {
+		if (opt_flag == SUB && sub_opt->latency) {
+			nng_mtx_lock(bench_lat.mtx);
+			g->latency = bench_lat.all;
+			nng_mtx_unlock(bench_lat.mtx);
+		}
+		nnb_report_summary(now);
+		return;
+	}
+	nnb_report_interval(now, bench_snap[1], period);
+	bench_snap[0] = bench_snap[1];
+	bench_snap[1] = now;
+}
+
+static void
+bench_sched_init(nnb_pub_opt *opt)
+{
+	if (nng_mtx_alloc(&bench_sched.mtx) != 0) {
+		nng_fatal("nng_mtx_alloc", NNG_ENOMEM);
+	}
+	bench_sched.gap     = 1000000.0 / opt->rate;
+	bench_sched.poisson = opt->poisson;
+	// from when the last client has been created
+	bench_sched.next = (double) lat_now_us() +
+	    (double) opt->count * opt->interval * 1000;
+}
+
+// The intended send time of the next message.
+static uint64_t
+bench_sched_take(void)
+{
+	uint64_t due;
+	double   u;
+
+	nng_mtx_lock(bench_sched.mtx);
+	due = (uint64_t) bench_sched.next;
+	if (bench_sched.poisson) {
+		u = ((double) nng_random() + 0.5) / 4294967296.0;
+		bench_sched.next += -log(u) * bench_sched.gap;
+	} else {
+		bench_sched.next += bench_sched.gap;
+	}
+	nng_mtx_unlock(bench_sched.mtx);
+	return due;
+}
+
+// Sleeps work until its due time, then goes to SCHED.
+static void
+bench_sched_wait(struct work *work)
+{
+	uint64_t now = lat_now_us();
+
+	work->due   = bench_sched_take();
+	work->state = SCHED;
+	nng_sleep_aio(work->due > now
+	        ? (nng_duration) ((work->due - now + 999) / 1000)
+	        : 0,
+	    work->aio);
+}
+
+static void
+bench_sigint(int sig)
+{
+	(void) sig;
+	bench_stop = 1;
 }
 
 static int
@@ -177,6 +539,9 @@ sub_cb(void *arg)
 		}
 		nng_atomic_inc(statistics.recv_cnt);
 		msg         = nng_aio_get_msg(work->aio);
+		if (sub_opt->latency) {
+			bench_lat_record(work->id, msg);
+		}
 		nng_msg_free(msg);
 		work->state = RECV;
 		nng_ctx_recv(work->ctx, work->aio);
@@ -214,7 +579,15 @@ pub_cb(void *arg)
 		memset(payload, 'A', pub_opt->size);
 		nng_mqtt_msg_set_publish_payload(
 		    work->msg, (uint8_t *) payload, pub_opt->size);
+		nng_free(payload, pub_opt->size);
 		nng_mqtt_msg_encode(work->msg);
+		if (pub_opt->rate > 0) {
+			bench_sched_wait(work);
+			break;
+		}
+		if (pub_opt->latency) {
+			bench_stamp(work, lat_now_us());
+		}
 
 		nng_msg_dup(&msg, work->msg);
 		nng_aio_set_msg(work->aio, msg);
@@ -224,7 +597,33 @@ pub_cb(void *arg)
 		nng_ctx_send(work->ctx, work->aio);
 		break;
 
+	case SCHED:
+		// latency counts from when it was due, not from when it went
+		if (lat_now_us() > work->due + BENCH_SCHED_SLACK_US) {
+			nng_atomic_inc(statistics.missed);
+		}
+		if (pub_opt->latency) {
+			bench_stamp(work, work->due);
+		}
+		nng_msg_dup(&msg, work->msg);
+		nng_aio_set_msg(work->aio, msg);
+		msg         = NULL;
+		work->state = WAIT;
+		nng_ctx_send(work->ctx, work->aio);
+		break;
+
 	case WAIT:
+		if (pub_opt->rate > 0) {
+			if ((rv = nng_aio_result(work->aio)) != 0) {
+				nng_fatal("nng_send_aio", rv);
+			}
+			nng_atomic_inc(statistics.send_cnt);
+			if (nng_atomic_get(statistics.send_cnt) <=
+			    nng_atomic_get(statistics.send_limit)) {
+				bench_sched_wait(work);
+			}
+			break;
+		}
 		work->state = SEND;
 		// NOTE: nng_sleep_aio will sleep for more than you wanted
 		if (pub_opt->interval_of_msg >= 1) {
@@ -257,6 +656,9 @@ pub_cb(void *arg)
 		    nng_atomic_get(statistics.send_limit)) {
 			break;
 		}
+		if (pub_opt->latency) {
+			bench_stamp(work, lat_now_us());
+		}
 		nng_msg_dup(&msg, work->msg);
 		nng_aio_set_msg(work->aio, msg);
 		msg         = NULL;
@@ -285,6 +687,8 @@ alloc_work(nng_socket sock, void cb(void *))
 		nng_fatal("nng_ctx_open", rv);
 	}
 	w->state = INIT;
+	w->id    = 0;
+	w->seq   = 0;
 	return (w);
 }
 
@@ -314,44 +718,154 @@ disconnect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 	printf("disconnected!\n");
 }
 
-int
-nnb_connect(nnb_conn_opt *opt)
+#if defined(SUPP_QUIC)
+static int
+quic_connect_cb(void *rmsg, void *arg)
 {
-	if (opt == NULL) {
-		fprintf(stderr, "Connection parameters init failed!\n");
-	}
+	nng_pipe p = NNG_PIPE_INITIALIZER;
 
-	char       url[255];
-	nng_socket sock;
-	nng_dialer dialer;
-	int        i;
-	int        rv;
+	(void) rmsg;
+	connect_cb(p, NNG_PIPE_EV_ADD_POST, arg);
+	return 0;
+}
+
+static int
+quic_disconnect_cb(void *rmsg, void *arg)
+{
+	nng_pipe p = NNG_PIPE_INITIALIZER;
+
+	(void) rmsg;
+	disconnect_cb(p, NNG_PIPE_EV_REM_POST, arg);
+	return 0;
+}
+#endif
 
-	if (opt->tls.enable) {
-		sprintf(url, "tls+mqtt-tcp://%s:%d", opt->host, opt->port);
+// Clients take the addresses of --ifaddr in turn as their source, so one
+// host gets past the ephemeral ports of a single address.
+static void
+bench_locaddr(nng_dialer dialer, const char *ifaddr)
+{
+	static uint32_t next = 0;
+	nng_sockaddr    sa;
+	char            addr[INET6_ADDRSTRLEN];
+	const char *    p;
+	uint32_t        n = 1;
+	size_t          len;
+	int             rv;
+
+	for (p = ifaddr; *p != '\0'; p++) {
+		n += *p == ',';
+	}
+	p = ifaddr;
+	for (uint32_t i = next++ % n; i > 0; i--) {
+		p = strchr(p, ',') + 1;
+	}
+	len = strcspn(p, ",");
+	if (len >= sizeof(addr)) {
+		len = sizeof(addr) - 1;
+	}
+	memcpy(addr, p, len);
+	addr[len] = '\0';
+
+	memset(&sa, 0, sizeof(sa));
+	if (inet_pton(AF_INET, addr, &sa.s_in.sa_addr) == 1) {
+		sa.s_in.sa_family = NNG_AF_INET;
+	} else if (inet_pton(AF_INET6, addr, sa.s_in6.sa_addr) == 1) {
+		sa.s_in6.sa_family = NNG_AF_INET6;
 	} else {
-		sprintf(url, "mqtt-tcp://%s:%d", opt->host, opt->port);
+		fprintf(stderr, "Error: invalid ifaddr %s\n", addr);
+		exit(EXIT_FAILURE);
 	}
+	if ((rv = nng_dialer_set_addr(dialer, NNG_OPT_LOCADDR, &sa)) != 0) {
+		nng_fatal("nng_dialer_set_addr", rv);
+	}
+}
 
-	rv = opt->version == 5 ? nng_mqttv5_client_open(&sock)
-	                       : nng_mqtt_client_open(&sock);
+// Opens a client of the version and its dialer to host:port over the
+// transport, the caller sets the connect message and starts it.
+static void
+bench_dial(nng_socket *sock, nng_dialer *dialer, const char *host,
+    int port, int version, nnb_transport tp, const tls_opt *tls,
+    const char *ifaddr)
+{
+	char url[255];
+	int  rv;
 
-	if (rv != 0) {
-		nng_fatal("nng_socket", rv);
+	switch (tp) {
+	case NNB_WS:
+		snprintf(url, sizeof(url), "%s://%s:%d/mqtt",
+		    tls->enable ? "wss" : "ws", host, port);
+		break;
+	case NNB_QUIC:
+		snprintf(url, sizeof(url), "mqtt-quic://%s:%d", host, port);
+		break;
+	default:
+		snprintf(url, sizeof(url), "%s://%s:%d",
+		    tls->enable ? "tls+mqtt-tcp" : "mqtt-tcp", host, port);
+		break;
 	}
 
-	if ((rv = nng_dialer_create(&dialer, sock, url)) != 0) {
+	if (tp == NNB_QUIC) {
+#if defined(SUPP_QUIC)
+		rv = version == 5 ? nng_mqttv5_quic_client_open(sock)
+		                  : nng_mqtt_quic_client_open(sock);
+		if (rv != 0) {
+			nng_fatal("nng_socket", rv);
+		}
+		if (version == 5) {
+			nng_mqttv5_quic_set_connect_cb(
+			    sock, quic_connect_cb, NULL);
+			nng_mqttv5_quic_set_disconnect_cb(
+			    sock, quic_disconnect_cb, NULL);
+		} else {
+			nng_mqtt_quic_set_connect_cb(
+			    sock, quic_connect_cb, NULL);
+			nng_mqtt_quic_set_disconnect_cb(
+			    sock, quic_disconnect_cb, NULL);
+		}
+#else
+		nng_fatal("nng_socket", NNG_ENOTSUP);
+#endif
+	} else {
+		rv = version == 5 ? nng_mqttv5_client_open(sock)
+		                  : nng_mqtt_client_open(sock);
+		if (rv != 0) {
+			nng_fatal("nng_socket", rv);
+		}
+		nng_mqtt_set_connect_cb(*sock, connect_cb, NULL);
+		nng_mqtt_set_disconnect_cb(*sock, disconnect_cb, NULL);
+	}
+
+	if ((rv = nng_dialer_create(dialer, *sock, url)) != 0) {
 		nng_fatal("nng_dialer_create", rv);
 	}
 
-	if (opt->tls.enable) {
-		if ((rv = init_dialer_tls(dialer, opt->tls.cacert,
-		              opt->tls.cert, opt->tls.key,
-		              opt->tls.keypass) != 0)) {
+	// quic does its own tls
+	if (tls->enable && tp != NNB_QUIC) {
+		if ((rv = init_dialer_tls(*dialer, tls->cacert, tls->cert,
+		         tls->key, tls->keypass)) != 0) {
 			nng_fatal("init_dialer_tls", rv);
 		}
 	}
 
+	if (ifaddr != NULL) {
+		bench_locaddr(*dialer, ifaddr);
+	}
+}
+
+int
+nnb_connect(nnb_conn_opt *opt)
+{
+	if (opt == NULL) {
+		fprintf(stderr, "Connection parameters init failed!\n");
+	}
+
+	nng_socket sock;
+	nng_dialer dialer;
+
+	bench_dial(&sock, &dialer, opt->host, opt->port, opt->version,
+	    opt->transport, &opt->tls, opt->ifaddr);
+
 	// Mqtt connect message
 	nng_msg *msg;
 	nng_mqtt_msg_alloc(&msg, 0);
@@ -360,9 +874,6 @@ nnb_connect(nnb_conn_opt *opt)
 	nng_mqtt_msg_set_connect_keep_alive(msg, opt->keepalive);
 	nng_mqtt_msg_set_connect_clean_session(msg, opt->clean);
 
-	nng_mqtt_set_connect_cb(sock, connect_cb, &sock);
-	nng_mqtt_set_disconnect_cb(sock, disconnect_cb, NULL);
-
 	if (opt->username) {
 		nng_mqtt_msg_set_connect_user_name(msg, opt->username);
 	}
@@ -382,41 +893,23 @@ nnb_subscribe(nnb_sub_opt *opt)
 		fprintf(stderr, "Connection parameters init failed!\n");
 	}
 
-	char         url[255];
+	static uint32_t nsubs = 0;
+
 	nng_socket   sock;
 	nng_dialer   dialer;
 	struct work *works[PARALLEL];
 	int          i;
-	int          rv;
-
-	if (opt->tls.enable) {
-		sprintf(url, "tls+mqtt-tcp://%s:%d", opt->host, opt->port);
-	} else {
-		sprintf(url, "mqtt-tcp://%s:%d", opt->host, opt->port);
-	}
+	// one receiver keeps the order of the broker for --latency
+	int nworks = opt->latency ? 1 : PARALLEL;
 
-	rv = opt->version == 5 ? nng_mqttv5_client_open(&sock)
-	                       : nng_mqtt_client_open(&sock);
+	bench_dial(&sock, &dialer, opt->host, opt->port, opt->version,
+	    opt->transport, &opt->tls, opt->ifaddr);
 
-	if (rv != 0) {
-		nng_fatal("nng_socket", rv);
-	}
-
-	for (i = 0; i < PARALLEL; i++) {
-		works[i] = alloc_work(sock, sub_cb);
-	}
-
-	if ((rv = nng_dialer_create(&dialer, sock, url)) != 0) {
-		nng_fatal("nng_dialer_create", rv);
-	}
-
-	if (opt->tls.enable) {
-		if ((rv = init_dialer_tls(dialer, opt->tls.cacert,
-		              opt->tls.cert, opt->tls.key,
-		              opt->tls.keypass) != 0)) {
-			nng_fatal("init_dialer_tls", rv);
-		}
+	for (i = 0; i < nworks; i++) {
+		works[i]     = alloc_work(sock, sub_cb);
+		works[i]->id = nsubs;
 	}
+	nsubs++;
 
 	opt_flag = SUB;
 	sub_opt  = opt;
@@ -429,9 +922,6 @@ nnb_subscribe(nnb_sub_opt *opt)
 	nng_mqtt_msg_set_connect_keep_alive(msg, opt->keepalive);
 	nng_mqtt_msg_set_connect_clean_session(msg, opt->clean);
 
-	nng_mqtt_set_connect_cb(sock, connect_cb, &sock);
-	nng_mqtt_set_disconnect_cb(sock, disconnect_cb, NULL);
-
 	if (opt->username) {
 		nng_mqtt_msg_set_connect_user_name(msg, opt->username);
 	}
@@ -445,7 +935,7 @@ nnb_subscribe(nnb_sub_opt *opt)
 	works[0]->msg = msg;
 
 	// printf("dialer start after\n");
-	for (i = 0; i < PARALLEL; i++) {
+	for (i = 0; i < nworks; i++) {
 		nng_atomic_set(statistics.index_cnt, i);
 		sub_cb(works[i]);
 	}
@@ -460,39 +950,15 @@ nnb_publish(nnb_pub_opt *opt)
 		fprintf(stderr, "Connection parameters init failed!\n");
 	}
 
-	char         url[255];
 	nng_socket   sock;
 	nng_dialer   dialer;
 	struct work *w;
-	int          i;
-	int          rv;
-
-	if (opt->tls.enable) {
-		sprintf(url, "tls+mqtt-tcp://%s:%d", opt->host, opt->port);
-	} else {
-		sprintf(url, "mqtt-tcp://%s:%d", opt->host, opt->port);
-	}
-
-	rv = opt->version == 5 ? nng_mqttv5_client_open(&sock)
-	                       : nng_mqtt_client_open(&sock);
 
-	if (rv != 0) {
-		nng_fatal("nng_socket", rv);
-	}
-
-	w = alloc_work(sock, pub_cb);
+	bench_dial(&sock, &dialer, opt->host, opt->port, opt->version,
+	    opt->transport, &opt->tls, opt->ifaddr);
 
-	if ((rv = nng_dialer_create(&dialer, sock, url)) != 0) {
-		nng_fatal("nng_dialer_create", rv);
-	}
-
-	if (opt->tls.enable) {
-		if ((rv = init_dialer_tls(dialer, opt->tls.cacert,
-		              opt->tls.cert, opt->tls.key,
-		              opt->tls.keypass) != 0)) {
-			nng_fatal("init_dialer_tls", rv);
-		}
-	}
+	w     = alloc_work(sock, pub_cb);
+	w->id = nng_random();
 
 	opt_flag = PUB;
 	pub_opt  = opt;
@@ -505,9 +971,6 @@ nnb_publish(nnb_pub_opt *opt)
 	nng_mqtt_msg_set_connect_keep_alive(msg, opt->keepalive);
 	nng_mqtt_msg_set_connect_clean_session(msg, opt->clean);
 
-	nng_mqtt_set_connect_cb(sock, connect_cb, &sock);
-	nng_mqtt_set_disconnect_cb(sock, disconnect_cb, NULL);
-
 	if (opt->username) {
 		nng_mqtt_msg_set_connect_user_name(msg, opt->username);
 	}
@@ -528,7 +991,9 @@ int
 bench_dflt(int argc, char **argv)
 {
 	fprintf(stderr,
-	    "Usage: nanomq_cli bench { pub | sub | conn } [--help]\n");
+	    "Usage: nanomq_cli bench { pub | sub | conn | scenario | agent | "
+	    "coordinator | compare } "
+	    "[--help]\n");
 	return 0;
 }
 
@@ -539,7 +1004,12 @@ bench_start(int argc, char **argv)
 		bench_dflt(argc, argv);
 		exit(EXIT_FAILURE);
 	}
+	nnb_report_args(&argc, argv);
 	bench_count_init(&statistics);
+	if ((bench_snap[0] = nng_zalloc(sizeof(nnb_result))) == NULL ||
+	    (bench_snap[1] = nng_zalloc(sizeof(nnb_result))) == NULL) {
+		nng_fatal("nng_alloc", NNG_ENOMEM);
+	}
 	nnb_pub_opt * p_opt;
 	nnb_sub_opt * s_opt;
 	nnb_conn_opt *c_opt;
@@ -550,16 +1020,33 @@ bench_start(int argc, char **argv)
 		} else {
 			nng_atomic_set(statistics.send_limit, p_opt->limit);
 		}
+		if (p_opt->rate > 0) {
+			bench_sched_init(p_opt);
+		}
 		for (int i = 0; i < p_opt->count; i++) {
 			nnb_publish(p_opt);
 			nng_msleep(p_opt->interval);
 		}
 	} else if (!strcmp(argv[2], "sub")) {
 		s_opt= nnb_sub_opt_init(argc, argv);
+		if (s_opt->latency) {
+			if (nng_mtx_alloc(&bench_lat.mtx) != 0) {
+				nng_fatal("nng_mtx_alloc", NNG_ENOMEM);
+			}
+			signal(SIGINT, bench_sigint);
+		}
 		for (int i = 0; i < s_opt->count; i++) {
 			nnb_subscribe(s_opt);
 			nng_msleep(s_opt->interval);
 		}
+	} else if (!strcmp(argv[2], "scenario")) {
+		return nnb_scenario_start(argc, argv);
+	} else if (!strcmp(argv[2], "agent")) {
+		return nnb_agent_start(argc, argv);
+	} else if (!strcmp(argv[2], "coordinator")) {
+		return nnb_coordinator_start(argc, argv);
+	} else if (!strcmp(argv[2], "compare")) {
+		return nnb_compare_start(argc, argv);
 	} else if (!strcmp(argv[2], "conn")) {
 		c_opt = nnb_conn_opt_init(argc, argv);
 		for (int i = 0; i < c_opt->count; i++) {
@@ -571,15 +1058,33 @@ bench_start(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	// a summary of the run once it is interrupted
+	if (!nnb_report_text()) {
+		signal(SIGINT, bench_sigint);
+	}
+	nng_time start = nng_clock();
+	nng_time last  = start;
 	for (;;) {
 		nng_msleep(1000); // neither pause() nor sleep() portable
+		nng_time now = nng_clock();
+		if (bench_stop ||
+		    (opt_flag == SUB && sub_opt->latency &&
+		        sub_opt->duration > 0 &&
+		        now - start >= (nng_time) sub_opt->duration * 1000)) {
+			if (nnb_report_text()) {
+				bench_lat_report();
+			} else {
+				bench_report(now - start, 0);
+			}
+			exit(EXIT_SUCCESS);
+		}
 		switch (opt_flag) {
 		case SUB:;
 			int c = nng_atomic_get(statistics.recv_cnt);
 			int l =
 			    nng_atomic_get(statistics.last_recv_cnt);
 			nng_atomic_set(statistics.last_recv_cnt, c);
-			if (c != l) {
+			if (c != l && nnb_report_text()) {
 				printf("recv: total=%d, "
 				       "rate=%d(msg/sec)\n",
 				    c, c - l);
@@ -589,7 +1094,15 @@ bench_start(int argc, char **argv)
 			c = nng_atomic_get(statistics.send_cnt);
 			l = nng_atomic_get(statistics.last_send_cnt);
 			nng_atomic_set(statistics.last_send_cnt, c);
-			if (c != l) {
+			if (!nnb_report_text()) {
+				break;
+			}
+			if (c != l && pub_opt->rate > 0) {
+				printf("sent: total=%d, "
+				       "rate=%d(msg/sec), missed=%d\n",
+				    c - pub_opt->count, c - l,
+				    nng_atomic_get(statistics.missed));
+			} else if (c != l) {
 				printf("sent: total=%d, "
 				       "rate=%d(msg/sec)\n",
 				    c - pub_opt->count, c - l);
@@ -598,6 +1111,8 @@ bench_start(int argc, char **argv)
 		default:
 			break;
 		}
+		bench_report(now - start, (nng_duration) (now - last));
+		last = now;
 	}
 
 	switch (opt_flag)
@@ -8,6 +8,7 @@
 //
 
 #include "client.h"
+#include "lat_hist.h"
 
 #include <ctype.h>
 #include <errno.h>
@@ -16,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "nng/mqtt/mqtt_client.h"
 #include "nng/nng.h"
@@ -68,6 +70,8 @@ struct client_opts {
 	uint16_t         keepalive;
 	bool             clean_session;
 	bool             stdin_line;
+	size_t           rate;    // msgs per second of all works, 0 unpaced
+	bool             latency; // stamp on pub, percentiles on sub
 	uint8_t *        msg;
 	size_t           msg_len;
 	uint8_t *        will_msg;
@@ -133,6 +137,8 @@ enum options {
 	OPT_MSG,
 	OPT_FILE,
 	OPT_STDIN_LINE,
+	OPT_RATE,
+	OPT_LATENCY,
 	// property options >>>>>>>>>>>>>
 	OPT_PAYLOAD_FORMAT_INDICATOR,
 	OPT_MESSAGE_EXPIRY_INTERVAL,
@@ -237,6 +243,8 @@ static nng_optspec cmd_opts[] = {
 	{ .o_name = "msg", .o_short = 'm', .o_val = OPT_MSG, .o_arg = true },
 	{ .o_name = "file", .o_short = 'f', .o_val = OPT_FILE, .o_arg = true },
 	{ .o_name = "stdin-line", .o_short = 'l', .o_val = OPT_STDIN_LINE },
+	{ .o_name = "rate", .o_val = OPT_RATE, .o_arg = true },
+	{ .o_name = "latency", .o_val = OPT_LATENCY },
 	{ .o_name  = "payload_format_indicator",
 	    .o_val = OPT_PAYLOAD_FORMAT_INDICATOR,
 	    .o_arg = true },
@@ -418,6 +426,139 @@ struct work {
 static void average_msgs(client_opts *opts, struct work **works);
 static void free_opts(void);
 
+// --latency puts this in front of the payload: a magic and the wall clock
+// of the send in microseconds, both big endian.
+#define CLIENT_STAMP_MAGIC 0x4e4d5154 // "NMQT"
+#define CLIENT_STAMP_LEN 12
+
+// Seconds between two reports of --rate and --latency.
+#define CLIENT_REPORT_INTERVAL 10
+
+static struct {
+	nng_mtx *mtx;
+	lat_hist hist;
+} latency;
+
+// Paces --rate for every work of every client. A work takes the next
+// slot and waits for its time, so the rate holds however many share it.
+static struct {
+	nng_mtx *mtx;
+	double   per_ms;
+	double   tokens;
+	nng_time last;
+} bucket;
+
+static nng_atomic_u64 *sent_cnt;
+static nng_atomic_int *works_left;
+
+static void
+put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t
+get_u32(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+	    ((uint32_t) p[2] << 8) | p[3];
+}
+
+static void
+client_stamp(uint8_t *p)
+{
+	uint64_t now = lat_now_us();
+
+	put_u32(p, CLIENT_STAMP_MAGIC);
+	put_u32(p + 4, (uint32_t) (now >> 32));
+	put_u32(p + 8, (uint32_t) now);
+}
+
+static void
+latency_record(const uint8_t *payload, uint32_t len)
+{
+	uint64_t sent, now, us;
+
+	if (len < CLIENT_STAMP_LEN || get_u32(payload) != CLIENT_STAMP_MAGIC) {
+		return;
+	}
+	sent = ((uint64_t) get_u32(payload + 4) << 32) | get_u32(payload + 8);
+	now  = lat_now_us();
+	// the clocks of both ends are not in sync
+	us = now > sent ? now - sent : 0;
+
+	nng_mtx_lock(latency.mtx);
+	lat_hist_record(&latency.hist, us);
+	nng_mtx_unlock(latency.mtx);
+}
+
+// Prints the percentiles since the last report and starts over.
+static void
+latency_report(void)
+{
+	static const double pcts[] = { 50, 90, 99, 99.9 };
+	uint64_t            vals[4];
+	uint64_t            total, max;
+
+	nng_mtx_lock(latency.mtx);
+	lat_hist_percentiles(&latency.hist, pcts, vals, 4);
+	total = latency.hist.total;
+	max   = latency.hist.max;
+	lat_hist_reset(&latency.hist);
+	nng_mtx_unlock(latency.mtx);
+
+	if (total > 0) {
+		console("latency of %llu msgs (us): p50 %llu p90 %llu p99 "
+		        "%llu p99.9 %llu max %llu\n",
+		    (unsigned long long) total, (unsigned long long) vals[0],
+		    (unsigned long long) vals[1], (unsigned long long) vals[2],
+		    (unsigned long long) vals[3], (unsigned long long) max);
+	}
+}
+
+// Takes a slot of --rate, returns the ms to wait for it.
+static nng_duration
+bucket_take(void)
+{
+	nng_time     now;
+	nng_duration wait = 0;
+
+	nng_mtx_lock(bucket.mtx);
+	now = nng_clock();
+	bucket.tokens += (double) (now - bucket.last) * bucket.per_ms;
+	// at most a burst of 10ms after idling
+	if (bucket.tokens > bucket.per_ms * 10 + 1) {
+		bucket.tokens = bucket.per_ms * 10 + 1;
+	}
+	bucket.last = now;
+	bucket.tokens -= 1;
+	if (bucket.tokens < 0) {
+		wait = (nng_duration) (-bucket.tokens / bucket.per_ms + 0.999);
+	}
+	nng_mtx_unlock(bucket.mtx);
+	return wait;
+}
+
+static void
+client_report(void)
+{
+	uint64_t sent;
+
+	if (opts->type == PUB && opts->rate > 0) {
+		sent = nng_atomic_get64(sent_cnt);
+		nng_atomic_sub64(sent_cnt, sent);
+		console("sent %llu msgs, %.1f msg/s\n",
+		    (unsigned long long) sent,
+		    (double) sent / CLIENT_REPORT_INTERVAL);
+	}
+	if (opts->type == SUB && opts->latency) {
+		latency_report();
+	}
+}
+
 void
 console(const char *fmt, ...)
 {
@@ -499,10 +640,19 @@ help(enum client_type type)
 		console("  -I, --interval <ms>              Interval of "
 		        "publishing "
 		        "message (ms) [default: 10]\n");
+		console("  --rate <num>                     Messages per second "
+		        "of all clients together, replaces --interval\n");
+		console("  --latency                        Stamp the send time "
+		        "into each message for the latency of sub\n");
 	} else {
 		console("  -I, --interval <ms>              Interval of "
 		       "establishing connection "
 		       "(ms) [default: 10]\n");
+		if (type == SUB) {
+			console("  --latency                        Report "
+			        "latency percentiles of messages stamped by "
+			        "pub --latency\n");
+		}
 	}
 
 	console("  -i, --identifier <identifier>    The client identifier "
@@ -763,6 +913,12 @@ client_parse_opts(int argc, char **argv, client_opts *opt)
 		case OPT_STDIN_LINE:
 			opt->stdin_line = true;
 			break;
+		case OPT_RATE:
+			opt->rate = long_arg(arg, 1, 10240000);
+			break;
+		case OPT_LATENCY:
+			opt->latency = true;
+			break;
 		}
 	}
 	switch (rv) {
@@ -1235,7 +1391,15 @@ publish_msg(client_opts *opt)
 		} 
 		opt->msg_len--;
 	}
-	nng_mqtt_msg_set_publish_payload(pubmsg, opt->msg, opt->msg_len);
+	if (opt->latency && opt->msg_len < CLIENT_STAMP_LEN) {
+		// room for the stamp
+		uint8_t pad[CLIENT_STAMP_LEN] = { 0 };
+		memcpy(pad, opt->msg, opt->msg_len);
+		nng_mqtt_msg_set_publish_payload(pubmsg, pad, sizeof(pad));
+	} else {
+		nng_mqtt_msg_set_publish_payload(
+		    pubmsg, opt->msg, opt->msg_len);
+	}
 	nng_mqtt_msg_set_publish_topic(pubmsg, opt->topic->val);
 	if (opt->version == MQTT_PROTOCOL_VERSION_v5) {
 		mqtt_property_dup(&props, opt->pub_properties);
@@ -1245,6 +1409,35 @@ publish_msg(client_opts *opt)
 	return pubmsg;
 }
 
+// The next copy of the template of work, stamped for --latency.
+static nng_msg *
+publish_dup(struct work *work)
+{
+	nng_msg *msg;
+	uint32_t plen;
+	uint8_t *payload;
+
+	if (work->opts->latency) {
+		payload = nng_mqtt_msg_get_publish_payload(work->msg, &plen);
+		client_stamp(payload);
+		if (!work->opts->stdin_line) {
+			// the encoded payload ends the body
+			client_stamp((uint8_t *) nng_msg_body(work->msg) +
+			    nng_msg_len(work->msg) - plen);
+		}
+	}
+	if (nng_msg_dup(&msg, work->msg) != 0) {
+		nng_fatal("nng_msg_dup", NNG_ENOMEM);
+	}
+	return msg;
+}
+
+static nng_duration
+publish_wait(struct work *work)
+{
+	return work->opts->rate > 0 ? bucket_take() : work->opts->interval;
+}
+
 void
 client_cb(void *arg)
 {
@@ -1256,12 +1449,17 @@ client_cb(void *arg)
 	case INIT:
 		switch (work->opts->type) {
 		case PUB:
+			if (work->msg != NULL) {
+				nng_msg_free(work->msg);
+			}
 			work->msg = publish_msg(work->opts);
-			nng_msg_dup(&msg, work->msg);
-			nng_aio_set_msg(work->aio, msg);
-			msg         = NULL;
-			work->state = SEND;
-			nng_ctx_send(work->ctx, work->aio);
+			if (!work->opts->stdin_line) {
+				// encoded once, every send is a copy
+				nng_mqtt_msg_encode(work->msg);
+			}
+			work->state = SEND_WAIT;
+			nng_sleep_aio(work->opts->rate > 0 ? bucket_take() : 0,
+			    work->aio);
 			break;
 		case SUB:
 		case CONN:
@@ -1298,7 +1496,11 @@ client_cb(void *arg)
 		const char *recv_topic =
 		    nng_mqtt_msg_get_publish_topic(msg, &topic_len);
 
-		if (topic_len > 0) {
+		if (work->opts->latency) {
+			latency_record(payload, payload_len);
+		}
+		if (topic_len > 0 &&
+		    (!work->opts->latency || work->opts->verbose)) {
 			console("%.*s: %.*s\n", topic_len, recv_topic,
 			    payload_len, (char *) payload);
 		}
@@ -1314,6 +1516,7 @@ client_cb(void *arg)
 			nng_msg_free(work->msg);
 			nng_fatal("nng_send_aio", rv);
 		}
+		nng_atomic_inc64(sent_cnt);
 
 		if (work->opts->stdin_line) {
 			work->state = INIT;
@@ -1321,12 +1524,10 @@ client_cb(void *arg)
 		} else {
 			work->msg_count--;
 			if (work->msg_count > 0) {
-				nng_msg_dup(&msg, work->msg);
-				nng_aio_set_msg(work->aio, msg);
-				msg         = NULL;
 				work->state = SEND_WAIT;
-				nng_sleep_aio(work->opts->interval, work->aio);
-			} else {
+				nng_sleep_aio(publish_wait(work), work->aio);
+			} else if (nng_atomic_dec_nv(works_left) == 0) {
+				// the last of all works of all clients
 				nng_fini();
 				exit(1);
 			}
@@ -1334,6 +1535,10 @@ client_cb(void *arg)
 		break;
 
 	case SEND_WAIT:
+		// copied only now so the stamp is the time of the send
+		msg = publish_dup(work);
+		nng_aio_set_msg(work->aio, msg);
+		msg         = NULL;
 		work->state = SEND;
 		nng_ctx_send(work->ctx, work->aio);
 		break;
@@ -1608,6 +1813,23 @@ client(int argc, char **argv, enum client_type type)
 		opts->version = 4;
 	}
 
+	if ((rv = nng_atomic_alloc64(&sent_cnt)) != 0 ||
+	    (rv = nng_atomic_alloc(&works_left)) != 0) {
+		nng_fatal("nng_atomic_alloc", rv);
+	}
+	nng_atomic_set(works_left, (int) (opts->clients * opts->parallel));
+	if (opts->rate > 0) {
+		if ((rv = nng_mtx_alloc(&bucket.mtx)) != 0) {
+			nng_fatal("nng_mtx_alloc", rv);
+		}
+		bucket.per_ms = (double) opts->rate / 1000;
+		bucket.tokens = 1;
+		bucket.last   = nng_clock();
+	}
+	if (opts->latency && (rv = nng_mtx_alloc(&latency.mtx)) != 0) {
+		nng_fatal("nng_mtx_alloc", rv);
+	}
+
 	struct connect_param **param =
 	    nng_zalloc(sizeof(struct connect_param *) * opts->clients);
 	nng_socket **socket = nng_zalloc(sizeof(nng_socket *) * opts->clients);
@@ -1639,7 +1861,8 @@ client(int argc, char **argv, enum client_type type)
 	}
 
 	for (;;) {
-		nng_msleep(1000);
+		nng_msleep(CLIENT_REPORT_INTERVAL * 1000);
+		client_report();
 	}
 
 	for (size_t j = 0; j < opts->clients; j++) {
@@ -33,14 +33,13 @@
 #include "web_server.h"
 #include "proxy.h"
 
-/* An array of one message (aka sample in dds terms) will be used. */
+/* An array of one message (aka sample in dds terms) will be written. */
 #define MAX_SAMPLES 1
 
 #define DDS_PROXY_DDSVERSION_USING "0.10.4"
 
 static int recv_cnt = 0;
 static int sent_cnt = 0;
-static int forward2mqtt_cnt = 0;
 
 static int  dds_client_init(dds_cli *cli, dds_gateway_conf *config);
 static int  dds_client(dds_cli *cli, mqtt_cli *mqttcli);
@@ -167,15 +166,25 @@ dds_inner_config(dds_gateway_dds *config)
 }
 
 static void
-dds_subcli_send(dds_subcli *scli, char *payload)
+dds_subcli_send(dds_subcli *scli, char *payload, uint32_t len)
 {
 	uint32_t rc = 0;
 	void    *samples[MAX_SAMPLES];
 
 	samples[0] = scli->handles->alloc();
-	cJSON *json = cJSON_Parse(payload);
-	scli->handles->mqtt2dds(json, samples[0]);
-	cJSON_Delete(json);
+	if (scli->payload == DDS_PAYLOAD_BINARY) {
+		if (scli->fast->unpack(
+		        (uint8_t *) payload, len, samples[0]) != 0) {
+			log_dds("[DDS] Drop %u bytes not a %s", len,
+			    scli->handles->desc->m_typename);
+			scli->handles->free(samples[0], DDS_FREE_ALL);
+			return;
+		}
+	} else {
+		cJSON *json = cJSON_Parse(payload);
+		scli->handles->mqtt2dds(json, samples[0]);
+		cJSON_Delete(json);
+	}
 	/* Send the msg received */
 	rc = dds_write(scli->scli, samples[0]);
 	if (rc != DDS_RETCODE_OK)
@@ -187,6 +196,18 @@ dds_subcli_send(dds_subcli *scli, char *payload)
 	scli->handles->free(samples[0], DDS_FREE_ALL);
 }
 
+static void
+dds_subcli_payload(dds_subcli *scli, const char *struct_name)
+{
+	scli->fast    = dds_get_fast(struct_name);
+	scli->payload = dds_payload_env();
+	if (scli->payload == DDS_PAYLOAD_BINARY && scli->fast == NULL) {
+		log_dds("WARNING No binary serializer for %s, using json",
+		    struct_name);
+		scli->payload = DDS_PAYLOAD_JSON;
+	}
+}
+
 static int
 dds_subcli_init(dds_subcli *scli, bool isrd, const char *topic, dds_entity_t participant, dds_entity_t parent, dds_listener_t* listener, dds_gateway_conf *config)
 {
@@ -209,6 +230,7 @@ dds_subcli_init(dds_subcli *scli, bool isrd, const char *topic, dds_entity_t par
 					log_dds("ERROR Invaild structure:%s", tl[i]->struct_name);
 					return -1;
 				}
+				scli->fwd = tl[i];
 				break;
 			}
 		}
@@ -219,6 +241,15 @@ dds_subcli_init(dds_subcli *scli, bool isrd, const char *topic, dds_entity_t par
 		}
 
 		scli->handles = dds_handles;
+		dds_subcli_payload(scli, scli->fwd->struct_name);
+
+		/* Queues to the MQTT thread, ready before the listener fires */
+		if (dds_ring_init(&scli->ring, DDS2MQTT_RING_LEN) != 0 ||
+		    dds_ring_init(&scli->pool, DDS2MQTT_RING_LEN) != 0) {
+			log_dds("ERROR No memory for the queue of topic:%s", topic);
+			dds_ring_fini(&scli->ring);
+			return -1;
+		}
 
 		/* Topic for reader */
 		topicr = dds_create_topic(
@@ -254,6 +285,7 @@ dds_subcli_init(dds_subcli *scli, bool isrd, const char *topic, dds_entity_t par
 					log_dds("ERROR Invaild structure:%s", tl[i]->struct_name);
 					return -1;
 				}
+				dds_subcli_payload(scli, tl[i]->struct_name);
 				break;
 			}
 		}
@@ -301,53 +333,63 @@ dds_subcli_init(dds_subcli *scli, bool isrd, const char *topic, dds_entity_t par
 static void
 dds_data_available(dds_entity_t rd, void *arg)
 {
-	dds_cli *cli = arg;
-	handle  *hd;
-	uint32_t rc = 0;
-	void *samples[MAX_SAMPLES];
-	dds_sample_info_t infos[MAX_SAMPLES];
+	dds_cli    *cli  = arg;
+	dds_subcli *scli = NULL;
+	dds_return_t rc;
+	uint32_t    n    = 0;
+	uint32_t    lost = 0;
 
-	nftp_vec *handleq = cli->handleq;
-
-	char *topic = NULL;
-	int   clidx = 0;
 	for (size_t i=0; i<cli->nsubrdclis; ++i) {
 		if (rd == cli->subrdclis[i]->scli) {
-			topic = strdup(cli->subrdclis[i]->ddsrecv_topic);
-			clidx = i;
+			scli = cli->subrdclis[i];
 			break;
 		}
 	}
 
-	if (topic == NULL) {
+	if (scli == NULL) {
 		log_dds("no topic found for dds reader: %d", rd);
 		return;
 	}
 
-	// dds_handler_set *dds_reader_handles = dds_get_handler(cli->config->forward.dds2mqtt[0]->struct_name);
-	// samples[0] = dds_reader_handles->alloc();
-	samples[0] = cli->subrdclis[clidx]->handles->alloc();
+	/* Every slot needs a sample to be loaned into, those the MQTT side
+	 * emptied come back on the pool before any new one is allocated. */
+	for (size_t i=0; i<DDS2MQTT_MAX_SAMPLES; ++i) {
+		if (scli->samples[i] != NULL)
+			continue;
+		if (dds_ring_pop(&scli->pool, &scli->samples[i], 1) == 0)
+			scli->samples[i] = scli->handles->alloc();
+	}
 
-	rc = dds_take(rd, samples, infos, MAX_SAMPLES, MAX_SAMPLES);
-	if (rc < 0)
+	rc = dds_take(rd, scli->samples, scli->infos, DDS2MQTT_MAX_SAMPLES,
+	    DDS2MQTT_MAX_SAMPLES);
+	if (rc < 0) {
 		DDS_FATAL("dds_take: %s\n", dds_strretcode(-rc));
+		return;
+	}
 
-	if ((rc > 0) && (infos[0].valid_data)) {
-		log_dds("[DDS] Sub recv struct %s, topic %s, cnt%d",
-		    cli->subrdclis[clidx]->handles->desc->m_typename,
-			cli->subrdclis[clidx]->ddsrecv_topic, ++recv_cnt);
-
-		/* Make a handle */
-		hd = mk_handle(HANDLE_TO_MQTT, samples[0], 0, topic);
+	for (int i=0; i<rc; ++i) {
+		if (!scli->infos[i].valid_data)
+			continue;
+		/* Ring full, keep the sample for the next take */
+		if (!dds_ring_push(&scli->ring, scli->samples[i])) {
+			lost++;
+			continue;
+		}
+		scli->samples[i] = NULL;
+		n++;
+	}
 
-		/* Put msg to handleq */
-		pthread_mutex_lock(&cli->mtx);
-		nftp_vec_append(handleq, (void *) hd);
-		pthread_cond_signal(&cli->cv);
-		pthread_mutex_unlock(&cli->mtx);
-	} else {
-		cli->subrdclis[clidx]->handles->free(samples[0], DDS_FREE_ALL);
-		free(topic);
+	if (n > 0) {
+		recv_cnt += n;
+		log_dds("[DDS] Sub recv %u of struct %s, topic %s, cnt%d", n,
+		    scli->handles->desc->m_typename, scli->ddsrecv_topic,
+		    recv_cnt);
+		mqtt_wake(cli->mqttcli);
+	}
+	if (lost > 0) {
+		scli->dropped += lost;
+		log_dds("WARNING queue of topic %s is full, %llu dropped",
+		    scli->ddsrecv_topic, (unsigned long long) scli->dropped);
 	}
 }
 
@@ -525,9 +567,10 @@ dds_client(dds_cli *cli, mqtt_cli *mqttcli)
 	fflush(stdout);
 
 	// Create readers for subscriber
+	cli->mqttcli = mqttcli;
 	cli->subrdclis = nng_alloc(sizeof(dds_subcli) * cli->config->forward.dds2mqtt_sz);
 	for (size_t i=0; i<cli->config->forward.dds2mqtt_sz; ++i) {
-		scli = nng_alloc(sizeof(*scli));
+		scli = nng_zalloc(sizeof(*scli));
 		status = dds_subcli_init(scli, true,
 		        cli->config->forward.dds2mqtt[i]->from, participant,
 		        subscriber, listener, cli->config);
@@ -595,21 +638,12 @@ dds_client(dds_cli *cli, mqtt_cli *mqttcli)
 				log_dds("ERROR no writer found for topic %s", dt->to);
 				break;
 			}
-			dds_subcli_send(scli, payload);
+			dds_subcli_send(scli, payload, len);
 
 			nng_msg_free(mqttmsg);
 			free(hd->topic);
 			free(hd);
 
-			break;
-		case HANDLE_TO_MQTT:
-			// Put to MQTTClient's handle queue
-			pthread_mutex_lock(&mqttcli->mtx);
-			nftp_vec_append(mqttcli->handleq, hd);
-			pthread_cond_signal(&mqttcli->cv);
-			pthread_mutex_unlock(&mqttcli->mtx);
-
-			log_dds("[DDS] Forward msg to mqtt, cnt %d", ++forward2mqtt_cnt);
 			break;
 		default:
 			log_dds("Unsupported handle type.\n");
@@ -14,6 +14,7 @@
 #include "vector.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 enum options {
 	OPT_DDS_HELP = 1,
@@ -341,4 +342,32 @@ dds_get_handler(const char *struct_name)
 	return NULL;
 }
 
+const dds_fast_set *
+dds_get_fast(const char *struct_name)
+{
+#if defined(SUPP_DDS_FAST_SERIAL)
+	for (size_t i = 0; i < dds_fast_map_sz; i++) {
+		if (strcmp(dds_fast_map[i].struct_name, struct_name) == 0) {
+			return &dds_fast_map[i];
+		}
+	}
+#else
+	(void) struct_name;
+#endif
+	return NULL;
+}
+
+dds_payload_type
+dds_payload_env(void)
+{
+	const char *s = getenv("NANOMQ_DDS_PAYLOAD");
+
+	if (s == NULL || *s == '\0' || strcmp(s, "json") == 0)
+		return DDS_PAYLOAD_JSON;
+	if (strcmp(s, "binary") == 0)
+		return DDS_PAYLOAD_BINARY;
+	log_dds("WARNING NANOMQ_DDS_PAYLOAD %s unknown, using json", s);
+	return DDS_PAYLOAD_JSON;
+}
+
 #endif
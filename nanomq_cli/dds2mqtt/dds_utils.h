@@ -29,11 +29,37 @@ typedef struct fixed_mqtt_msg {
 	uint32_t len;
 } fixed_mqtt_msg;
 
+// Payload of the MQTT side of a forward rule, NANOMQ_DDS_PAYLOAD
+// "json" (default) or "binary".
+typedef enum {
+	DDS_PAYLOAD_JSON,
+	DDS_PAYLOAD_BINARY,
+} dds_payload_type;
+
+// Typed serializers generated from the IDL by cmake/idl_fast_gen.py.
+// Binary is the members in order, little endian and unpadded, strings
+// as a u32 length then the bytes. Each returns the bytes written, or -1
+// when buf is too small or does not hold one whole sample.
+typedef struct {
+	const char *struct_name;
+	int (*to_json)(const void *sample, char *buf, size_t len);
+	int (*pack)(const void *sample, uint8_t *buf, size_t len);
+	int (*unpack)(const uint8_t *buf, size_t len, void *sample);
+} dds_fast_set;
+
+#if defined(SUPP_DDS_FAST_SERIAL)
+extern const dds_fast_set dds_fast_map[];
+extern const size_t       dds_fast_map_sz;
+#endif
+
 void  dds_handle_cmd(int argc, char **argv, dds_client_opts *opts);
 int   dds_cmd_parse_opts(int argc, char **argv, dds_client_opts *opts);
 void  dds_client_opts_fini(dds_client_opts *opts);
 char *dds_shm_xml(bool enable, const char *log_level);
 void  dds_set_shm_mode(dds_client_opts *opts);
 dds_handler_set *dds_get_handler(const char *struct_name);
+// NULL when the struct was left to the generic handlers.
+const dds_fast_set *dds_get_fast(const char *struct_name);
+dds_payload_type    dds_payload_env(void);
 
 #endif
@@ -317,41 +317,121 @@ mqtt_recv_loop(void *arg)
 	return NULL;
 }
 
+void
+mqtt_wake(mqtt_cli *cli)
+{
+	if (!__atomic_load_n(&cli->sleeping, __ATOMIC_SEQ_CST))
+		return;
+	pthread_mutex_lock(&cli->mtx);
+	pthread_cond_signal(&cli->cv);
+	pthread_mutex_unlock(&cli->mtx);
+}
+
+static bool
+dds_pending(dds_cli *ddscli)
+{
+	for (size_t i = 0; i < ddscli->nsubrdclis; ++i) {
+		if (dds_ring_len(&ddscli->subrdclis[i]->ring) > 0)
+			return true;
+	}
+	return false;
+}
+
+// The payload of sample in buf, 0 when the typed serializer is not up to
+// it and the generic handler should do.
+static int
+dds_fast_payload(dds_subcli *scli, void *sample, uint8_t *buf, size_t len)
+{
+	int n;
+
+	if (scli->fast == NULL)
+		return 0;
+	if (scli->payload == DDS_PAYLOAD_BINARY)
+		n = scli->fast->pack(sample, buf, len);
+	else
+		n = scli->fast->to_json(sample, (char *) buf, len);
+	return n < 0 ? 0 : n;
+}
+
+// Publish up to DDS2MQTT_MAX_SAMPLES of each reader, returns how many.
+static uint32_t
+dds_forward(mqtt_cli *cli, dds_cli *ddscli)
+{
+	static uint8_t buf[DDS2MQTT_PAYLOAD_MAX]; // mqtt_loop only
+	void    *batch[DDS2MQTT_MAX_SAMPLES];
+	uint32_t total = 0;
+
+	for (size_t i = 0; i < ddscli->nsubrdclis; ++i) {
+		dds_subcli        *scli = ddscli->subrdclis[i];
+		dds_handler_set   *hs   = scli->handles;
+		dds_gateway_topic *dt   = scli->fwd;
+		uint32_t n;
+
+		n = dds_ring_pop(&scli->ring, batch, DDS2MQTT_MAX_SAMPLES);
+		for (uint32_t j = 0; j < n; ++j) {
+			int len = dds_fast_payload(scli, batch[j], buf, sizeof(buf));
+
+			if (len > 0) {
+				mqtt_publish(cli, dt->to, 0, buf, len);
+			} else if (scli->payload == DDS_PAYLOAD_BINARY) {
+				log_dds("[MQTT] Drop %s larger than %d bytes",
+				    dt->struct_name, DDS2MQTT_PAYLOAD_MAX);
+			} else {
+				cJSON *json    = hs->dds2mqtt(batch[j]);
+				char  *payload = cJSON_PrintUnformatted(json);
+
+				cJSON_Delete(json);
+				if (payload != NULL) {
+					mqtt_publish(cli, dt->to, 0,
+					    (uint8_t *) payload, strlen(payload));
+					cJSON_free(payload);
+				}
+			}
+
+			// Empty it and hand it back to the reader
+			hs->free(batch[j], DDS_FREE_CONTENTS);
+			memset(batch[j], 0, hs->desc->m_size);
+			if (!dds_ring_push(&scli->pool, batch[j]))
+				hs->free(batch[j], DDS_FREE_ALL);
+		}
+		if (n > 0) {
+			sent_cnt += n;
+			log_dds("[MQTT] Sent %u to topic %s, struct %s, cnt%d", n,
+			    dt->to, dt->struct_name, sent_cnt);
+		}
+		total += n;
+	}
+
+	return total;
+}
+
 static void *
 mqtt_loop(void *arg)
 {
 	mqtt_cli      *cli = arg;
 	handle        *hd  = NULL;
-	nng_msg       *msg;
-	void          *ddsmsg;
-	fixed_mqtt_msg mqttmsg;
-	int            rv;
+	uint32_t       forwarded = 0;
 	dds_cli       *ddscli = cli->ddscli;
 
-	dds_gateway_conf *conf = cli->config;
-
 	while (cli->running) {
-		// If handle queue is not empty. Handle it first.
-		// Or we need to receive msgs from nng in a NONBLOCK way and
-		// put it to the handle queue. Wait cv when handle queue is
-		// empty.
+		// The handle queue only carries MQTT msgs to DDS now, samples
+		// from DDS wait on the ring of their reader. Sleep on cv when
+		// both are empty, a reader wakes us after filling its ring.
 		hd = NULL;
 
 		pthread_mutex_lock(&cli->mtx);
-		while (nftp_vec_len(cli->handleq) == 0)
-			pthread_cond_wait(&cli->cv, &cli->mtx);
+		if (forwarded == 0 && nftp_vec_len(cli->handleq) == 0) {
+			__atomic_store_n(&cli->sleeping, 1, __ATOMIC_SEQ_CST);
+			while (nftp_vec_len(cli->handleq) == 0 &&
+			    !dds_pending(ddscli))
+				pthread_cond_wait(&cli->cv, &cli->mtx);
+			__atomic_store_n(&cli->sleeping, 0, __ATOMIC_SEQ_CST);
+		}
 		if (nftp_vec_len(cli->handleq))
 			nftp_vec_pop(cli->handleq, (void **) &hd, NFTP_HEAD);
 		pthread_mutex_unlock(&cli->mtx);
 
-		if (hd)
-			goto work;
-
-		continue;
-
-	work:
-		switch (hd->type) {
-		case HANDLE_TO_DDS:
+		if (hd) {
 			// Put to DDSClient's handle queue
 			pthread_mutex_lock(&ddscli->mtx);
 			nftp_vec_append(ddscli->handleq, (void *) hd);
@@ -359,38 +439,9 @@ mqtt_loop(void *arg)
 			pthread_mutex_unlock(&ddscli->mtx);
 
 			log_dds("[MQTT] forward msg to dds, counter %d", ++forward2dds_cnt);
-			break;
-		case HANDLE_TO_MQTT:
-			// Translate DDS msg to MQTT format
-			ddsmsg = hd->data;
-
-			dds_handler_set *dds_handler;
-			dds_gateway_topic *dt = find_mqtt_topic(conf, hd->topic);
-
-			if (dt) {
-				dds_handler = dds_get_handler(dt->struct_name);
-				cJSON *json = dds_handler->dds2mqtt(ddsmsg);
-				dds_handler->free(ddsmsg, DDS_FREE_ALL);
-
-				mqttmsg.payload = cJSON_PrintUnformatted(json);
-				mqttmsg.len     = strlen(mqttmsg.payload);
-				cJSON_Delete(json);
-
-				log_dds("[MQTT] Sent topic %s, struct %s, cnt%d", dt->to,
-					dt->struct_name, ++sent_cnt);
-				mqtt_publish(cli, dt->to, 0,
-				    (uint8_t *)mqttmsg.payload, mqttmsg.len);
-				nng_free(mqttmsg.payload, mqttmsg.len);
-				mqttmsg.len = 0;
-			}
-
-			free(hd->topic);
-			free(hd);
-			break;
-		default:
-			log_dds("Unsupported handle type.\n");
-			break;
 		}
+
+		forwarded = dds_forward(cli, ddscli);
 	}
 
 	return NULL;
@@ -36,6 +36,7 @@ struct mqtt_cli {
 	nftp_vec       *handleq;
 	pthread_mutex_t mtx;
 	pthread_cond_t  cv;
+	int             sleeping; // set while the loop waits on cv
 
 	// dds client
 	void *ddscli;
@@ -58,6 +59,10 @@ int mqtt_publish(
 
 int mqtt_recvmsg(mqtt_cli *cli, nng_msg **msgp);
 
+// Called by a DDS reader after filling its ring, only locks if the
+// MQTT thread is asleep.
+void mqtt_wake(mqtt_cli *cli);
+
 // Return not just topic but also the struct_name
 dds_gateway_topic *find_dds_topic(dds_gateway_conf *conf, const char *mqtttopic);
 dds_gateway_topic *find_mqtt_topic(dds_gateway_conf *conf, const char *ddstopic);
@@ -0,0 +1,71 @@
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+#if defined(SUPP_DDS_PROXY)
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+#include "vector.h"
+
+int
+dds_ring_init(dds_ring *r, uint32_t cap)
+{
+	uint32_t sz = 2;
+
+	while (sz < cap)
+		sz <<= 1;
+	memset(r, 0, sizeof(*r));
+	if ((r->items = calloc(sz, sizeof(void *))) == NULL)
+		return (NFTP_ERR_MEM);
+	r->mask = sz - 1;
+	return (0);
+}
+
+void
+dds_ring_fini(dds_ring *r)
+{
+	free(r->items);
+	r->items = NULL;
+}
+
+bool
+dds_ring_push(dds_ring *r, void *item)
+{
+	uint32_t tail = r->tail;
+	uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	if (tail - head > r->mask)
+		return false;
+	r->items[tail & r->mask] = item;
+	// seq_cst so a consumer going to sleep either sees this item or is
+	// seen asleep by the producer
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_SEQ_CST);
+	return true;
+}
+
+uint32_t
+dds_ring_pop(dds_ring *r, void **items, uint32_t n)
+{
+	uint32_t head  = r->head;
+	uint32_t avail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) - head;
+
+	if (n > avail)
+		n = avail;
+	for (uint32_t i = 0; i < n; ++i)
+		items[i] = r->items[(head + i) & r->mask];
+	__atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+uint32_t
+dds_ring_len(dds_ring *r)
+{
+	return __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) -
+	    __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+}
+
+#endif
@@ -0,0 +1,40 @@
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+// A single producer, single consumer ring of pointers. One thread
+// pushes and one thread pops, neither takes a lock.
+//
+
+#ifndef DDS2MQTT_RING
+#define DDS2MQTT_RING
+
+#if defined(SUPP_DDS_PROXY)
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct dds_ring dds_ring;
+
+struct dds_ring {
+	void   **items;
+	uint32_t mask; // capacity - 1, capacity is a power of two
+	// own cache lines so the two sides do not bounce each other
+	char     pad0[64];
+	uint32_t head; // written by the consumer only
+	char     pad1[64];
+	uint32_t tail; // written by the producer only
+	char     pad2[64];
+};
+
+// cap is rounded up to a power of two. 0 or NFTP_ERR_MEM.
+int      dds_ring_init(dds_ring *r, uint32_t cap);
+void     dds_ring_fini(dds_ring *r);
+bool     dds_ring_push(dds_ring *r, void *item);
+uint32_t dds_ring_pop(dds_ring *r, void **items, uint32_t n);
+uint32_t dds_ring_len(dds_ring *r);
+
+#endif
+
+#endif
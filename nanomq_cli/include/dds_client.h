@@ -7,8 +7,10 @@
 #include <stdlib.h>
 
 #include "vector.h"
+#include "ring.h"
 #include "mqtt_client.h"
 #include "idl_convert.h"
+#include "dds_utils.h"
 
 #include "dds/dds.h"
 
@@ -26,6 +28,21 @@
 // #define DDS_DATA_ALLOC(name) DDS_TYPE_NAME_CAT(name, __alloc())
 // #define DDS_DATA_DESC(name) DDS_TYPE_NAME_CAT(name, _desc())
 
+// Samples one dds_take hands over at most.
+#ifndef DDS2MQTT_MAX_SAMPLES
+#define DDS2MQTT_MAX_SAMPLES 32
+#endif
+
+// Largest MQTT payload the typed serializers write.
+#ifndef DDS2MQTT_PAYLOAD_MAX
+#define DDS2MQTT_PAYLOAD_MAX 65536
+#endif
+
+// Samples a reader holds for the MQTT side before dropping.
+#ifndef DDS2MQTT_RING_LEN
+#define DDS2MQTT_RING_LEN 4096
+#endif
+
 // There is only one dds client. But we need to create more than
 // one dds readers and writers thus we could forward msgs to different
 // dds topic. Here we named those reader and writer dds_subcli.
@@ -43,6 +60,7 @@ struct dds_cli {
 	pthread_mutex_t mtx;
 	pthread_cond_t  cv;
 
+	mqtt_cli         *mqttcli;
 	dds_gateway_conf *config;
 };
 
@@ -53,6 +71,18 @@ struct dds_subcli {
 	char *ddsrecv_topic;
 
 	dds_handler_set *handles;
+	// typed, NULL leaves the payload to handles
+	const dds_fast_set *fast;
+	dds_payload_type    payload;
+
+	// Reader only. Taken samples go to the MQTT thread on ring and come
+	// back emptied on pool, fwd is the dds2mqtt rule of the reader.
+	dds_gateway_topic *fwd;
+	void              *samples[DDS2MQTT_MAX_SAMPLES];
+	dds_sample_info_t  infos[DDS2MQTT_MAX_SAMPLES];
+	dds_ring           ring;
+	dds_ring           pool;
+	uint64_t           dropped;
 
 	dds_gateway_conf *config;
 };
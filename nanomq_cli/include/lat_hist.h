@@ -0,0 +1,33 @@
+#ifndef NANOMQ_CLI_LAT_HIST_H
+#define NANOMQ_CLI_LAT_HIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Latencies in microseconds, 32 log-linear buckets per power of two,
+// which keeps every value within about 3% up to 2^37us.
+#define LAT_HIST_SUB_BITS 5
+#define LAT_HIST_SUB (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_EXPS 32
+#define LAT_HIST_BUCKETS (LAT_HIST_SUB + LAT_HIST_EXPS * LAT_HIST_SUB)
+
+// Not thread safe, callers that share one lock it.
+typedef struct {
+	uint64_t counts[LAT_HIST_BUCKETS];
+	uint64_t total;
+	uint64_t max;
+} lat_hist;
+
+// Wall clock, so two hosts only agree as well as their clocks do.
+extern uint64_t lat_now_us(void);
+
+extern void lat_hist_record(lat_hist *h, uint64_t us);
+extern void lat_hist_reset(lat_hist *h);
+// Adds the samples of src to dst, as if recorded there.
+extern void lat_hist_merge(lat_hist *dst, const lat_hist *src);
+
+// The values at n ascending percentiles into vals, 0 while empty.
+extern void lat_hist_percentiles(
+    const lat_hist *h, const double *pcts, uint64_t *vals, size_t n);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef NNB_DIST_H
+#define NNB_DIST_H
+
+#if !defined(NANO_PLATFORM_WINDOWS) && defined(SUPP_BENCH)
+
+/*
+ * One coordinator runs a scenario on many agents through a control
+ * broker:
+ *
+ *   nnb/agents/<id>         retained by an agent while it is there
+ *   nnb/run                 {run, start_at, scenario} to every agent
+ *   nnb/results/<run>/<id>  the nnb_result of one agent
+ *
+ * start_at is in ms of the wall clock, so the hosts need their clocks in
+ * sync for the runs to start together and for the latencies to hold.
+ */
+
+// nanomq_cli bench agent [-h host] [-p port] [--id id]
+extern int nnb_agent_start(int argc, char **argv);
+
+// nanomq_cli bench coordinator [-h host] [-p port] -n agents <file>
+extern int nnb_coordinator_start(int argc, char **argv);
+
+#endif
+
+#endif
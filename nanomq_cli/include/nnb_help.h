@@ -9,15 +9,18 @@ static char pub_info[] =
                        [-P <password>] [-t <topic>] [-s [<size>]]  \n\
                        [-q [<qos>]] [-r [<retain>]]                \n\
                        [-k [<keepalive>]] [-C [<clean>]]           \n\
-                       [-L [<limit>]] [-S [<ssl>]]                 \n\
+                       [-L [<limit>]] [-S [<ssl>]] [--latency]     \n\
+                       [--rate <rate>] [--arrival <arrival>]       \n\
                        [--certfile <certfile>]                     \n\
-                       [--keyfile <keyfile>] [--ws [<ws>]]         \n\
+                       [--keyfile <keyfile>]                       \n\
+                       [--transport <transport>]                   \n\
                        [--ifaddr <ifaddr>] [--prefix <prefix>]     \n\
                                                                    \n\
   --help                 help information                          \n\
   -h, --host             mqtt server hostname or IP address        \n\
                          [default: localhost]                      \n\
-  -p, --port             mqtt server port number [default: 1883]   \n\
+  -p, --port             mqtt server port number [default: 1883,   \n\
+                         8083 ws, 8084 wss, 14567 quic]            \n\
   -V, --version          mqtt protocol version: 3 | 4 | 5 [default:\n\
                          4]                                        \n\
   -c, --count            max count of clients [default: 200]       \n\
@@ -37,6 +40,12 @@ static char pub_info[] =
   -C, --clean            clean start [default: true]               \n\
   -L, --limit            The max message count to publish, 0 means \n\
                          unlimited [default: 0]                    \n\
+  --latency              stamp time and sequence into the payload  \n\
+                         for sub --latency, size is at least 24    \n\
+  --rate                 messages per second of all clients on a   \n\
+                         fixed schedule, replaces interval_of_msg  \n\
+  --arrival              arrivals of --rate: constant | poisson    \n\
+                         [default: constant]                       \n\
   -S, --ssl              ssl socoket for connecting to server      \n\
                          [default: false]                          \n\
   --cafile               ca certificate for authentication, if     \n\
@@ -47,8 +56,10 @@ static char pub_info[] =
                          required by server                        \n\
   --keypass              client private key's password for         \n\
                          authentication                            \n\
-  --ws                   websocket transport [default: false]      \n\
-  --ifaddr               local ipaddress or interface address      \n\
+  --transport            tcp | tls | ws | wss | quic, -S makes tcp \n\
+                         tls and ws wss [default: tcp]             \n\
+  --ifaddr               local addresses to connect from, comma    \n\
+                         separated, taken by clients in turn       \n\
   --prefix               client id prefix                          \n\
 ";
 
@@ -59,14 +70,17 @@ static char sub_info[] =
                        [-t <topic>] [-q [<qos>]] [-u <username>]    \n\
                        [-P <password>] [-k [<keepalive>]]           \n\
                        [-C [<clean>]] [-S [<ssl>]]                  \n\
+                       [--latency] [--duration <duration>]          \n\
                        [--certfile <certfile>]                      \n\
-                       [--keyfile <keyfile>] [--ws [<ws>]]          \n\
+                       [--keyfile <keyfile>]                        \n\
+                       [--transport <transport>]                    \n\
                        [--ifaddr <ifaddr>] [--prefix <prefix>]      \n\
                                                                     \n\
   --help             help information                               \n\
   -h, --host         mqtt server hostname or IP address [default:   \n\
                      localhost]                                     \n\
-  -p, --port         mqtt server port number [default: 1883]        \n\
+  -p, --port         mqtt server port number [default: 1883, 8083  \n\
+                     ws, 8084 wss, 14567 quic]                      \n\
   -V, --version      mqtt protocol version: 3 | 4 | 5 [default: 4]  \n\
   -c, --count        max count of clients [default: 200]            \n\
   -n, --startnumber  start number [default: 0]                      \n\
@@ -80,6 +94,10 @@ static char sub_info[] =
   -C, --clean        clean start [default: true]                    \n\
   -S, --ssl          ssl socoket for connecting to server           \n\
                      [default: false]                               \n\
+  --latency          latency, loss and reordering per topic of the  \n\
+                     messages of pub --latency, at the end of a run \n\
+  --duration         seconds of a run, 0 runs until interrupted     \n\
+                     [default: 0]                                   \n\
   --cafile           ca certificate for authentication, if          \n\
                      required by server                             \n\
   --certfile         client certificate for authentication, if      \n\
@@ -88,8 +106,10 @@ static char sub_info[] =
                      required by server                             \n\
   --keypass          client private key's password for              \n\
                      authentication                                 \n\
-  --ws               websocket transport [default: false]           \n\
-  --ifaddr           local ipaddress or interface address           \n\
+  --transport        tcp | tls | ws | wss | quic, -S makes tcp tls  \n\
+                     and ws wss [default: tcp]                      \n\
+  --ifaddr           local addresses to connect from, comma         \n\
+                     separated, taken by clients in turn            \n\
   --prefix           client id prefix			            \n\
 ";
 
@@ -101,12 +121,14 @@ static char conn_info[] =
                         [-k [<keepalive>]] [-C [<clean>]]           \n\
                         [-S [<ssl>]] [--certfile <certfile>]        \n\
                         [--keyfile <keyfile>] [--ifaddr <ifaddr>]   \n\
+                        [--transport <transport>]                   \n\
                         [--prefix <prefix>]                         \n\
                                                                     \n\
   --help             help information                               \n\
   -h, --host         mqtt server hostname or IP address [default:   \n\
                      localhost]                                     \n\
-  -p, --port         mqtt server port number [default: 1883]        \n\
+  -p, --port         mqtt server port number [default: 1883, 8083  \n\
+                     ws, 8084 wss, 14567 quic]                      \n\
   -V, --version      mqtt protocol version: 3 | 4 | 5 [default: 4]  \n\
   -c, --count        max count of clients [default: 200]            \n\
   -n, --startnumber  start number [default: 0]                      \n\
@@ -126,8 +148,63 @@ static char conn_info[] =
                      required by server                             \n\
   --keypass          client private key's password for              \n\
                      authentication                                 \n\
-  --ifaddr           local ipaddress or interface address           \n\
+  --transport        tcp | tls | ws | wss | quic, -S makes tcp tls  \n\
+                     and ws wss [default: tcp]                      \n\
+  --ifaddr           local addresses to connect from, comma         \n\
+                     separated, taken by clients in turn            \n\
   --prefix           client id prefix			            \n\
 ";
 
+static char scenario_info[] =
+    "nanomq_cli bench scenario <file>                                \n\
+                                                                    \n\
+  Runs the client groups of a HOCON scenario file side by side,    \n\
+  see etc/nanomq_bench_scenario.conf. Stats of every group are     \n\
+  printed each report seconds and once the run ends.               \n\
+";
+
+static char compare_info[] =
+    "nanomq_cli bench compare [--throughput <pct>] [--latency <pct>]  \n\
+                         <base> <new>                               \n\
+                                                                    \n\
+  Compares the summaries of two runs written with --format json,   \n\
+  group by group, and exits with 1 on a regression.                \n\
+                                                                    \n\
+  --throughput       drop of sent_rate or recv_rate allowed          \n\
+                     [default: 5]                                   \n\
+  --latency          rise of latency p50, p99 or p999 allowed        \n\
+                     [default: 10]                                  \n\
+";
+
+static char agent_info[] =
+    "nanomq_cli bench agent [--host <host>] [--port <port>] [--id <id>]\n\
+                                                                    \n\
+  Waits on a control broker for the runs of a coordinator, runs    \n\
+  their scenario and sends the result back. Stops after a run      \n\
+  interrupted with SIGINT.                                         \n\
+                                                                    \n\
+  -h, --host         control broker [default: localhost]            \n\
+  -p, --port         port of the control broker [default: 1883]     \n\
+  -u, --username     username of the control broker                 \n\
+  -P, --password     password of the control broker                 \n\
+  -i, --id           agent id [default: random]                     \n\
+";
+
+static char coordinator_info[] =
+    "nanomq_cli bench coordinator -n <agents> [--host <host>] <file>  \n\
+                                                                    \n\
+  Runs a scenario file on the agents of a control broker at once   \n\
+  and prints the merged stats of every group. The hosts need their \n\
+  clocks in sync, the scenario needs a duration.                   \n\
+                                                                    \n\
+  -h, --host         control broker [default: localhost]            \n\
+  -p, --port         port of the control broker [default: 1883]     \n\
+  -u, --username     username of the control broker                 \n\
+  -P, --password     password of the control broker                 \n\
+  -n, --agents       agents to wait for [default: 1]                \n\
+  -l, --lead         seconds from the run to its start [default: 5] \n\
+  -w, --wait         seconds to wait for agents, and for results    \n\
+                     past the end of the run [default: 60]          \n\
+";
+
 #endif
@@ -24,6 +24,12 @@ typedef struct {
 	char *keypass;
 } tls_opt;
 
+typedef enum {
+	NNB_TCP, // tls+mqtt-tcp with --ssl
+	NNB_WS,  // wss with --ssl
+	NNB_QUIC,
+} nnb_transport;
+
 typedef struct {
 	char *  host;
 	char *  username;
@@ -36,8 +42,9 @@ typedef struct {
 	int     keepalive;
 	bool    clean;
 	tls_opt tls;
+	nnb_transport transport;
+	char *        ifaddr; // local addresses, comma separated
 	// TODO future
-	// char	ifaddr[64];
 	// char	prefix[64];
 } nnb_conn_opt;
 
@@ -53,14 +60,21 @@ typedef struct {
 	int     interval;
 	int     keepalive;
 	int     qos;
+	int     duration; // seconds of a run, 0 until interrupted
 	bool    clean;
+	bool    latency;
 	tls_opt tls;
+	nnb_transport transport;
+	char *        ifaddr; // local addresses, comma separated
 	// TODO future
-	// bool	ws;
-	// char	ifaddr[64];
 	// char	prefix[64];
 } nnb_sub_opt;
 
+// What --latency puts in front of the payload: magic, publisher id,
+// sequence and send time in microseconds, all big endian.
+#define NNB_STAMP_MAGIC 0x4e4e424c // "NNBL"
+#define NNB_STAMP_LEN 24
+
 typedef struct {
 	char *  host;
 	char *  username;
@@ -72,16 +86,19 @@ typedef struct {
 	int     startnumber;
 	int     interval;
 	int     interval_of_msg;
+	int     rate; // msgs per second of all clients, replaces interval_of_msg
 	int     size;
 	int     limit;
 	int     keepalive;
 	int     qos;
 	bool    retain;
 	bool    clean;
+	bool    latency;
+	bool    poisson; // arrivals of --rate, constant gaps otherwise
 	tls_opt tls;
+	nnb_transport transport;
+	char *        ifaddr; // local addresses, comma separated
 	// TODO future
-	// bool	ws;
-	// char	ifaddr[64];
 	// char	prefix[64];
 } nnb_pub_opt;
 
@@ -108,8 +125,13 @@ static struct option long_options[] = {
 	{ "certfile", required_argument, NULL, 0 },
 	{ "keyfile", required_argument, NULL, 0 },
 	{ "keypass", required_argument, NULL, 0 },
+	{ "latency", no_argument, NULL, 0 },
+	{ "duration", required_argument, NULL, 0 },
+	{ "rate", required_argument, NULL, 0 },
+	{ "arrival", required_argument, NULL, 0 },
+	{ "transport", required_argument, NULL, 0 },
+	{ "ifaddr", required_argument, NULL, 0 },
 
-	//  { "ifaddr", 	required_argument, NULL, 0 },
 	//  { "prefix", 	required_argument, NULL, 0 },
 	{ "help", no_argument, NULL, 0 }, { NULL, 0, NULL, 0 }
 };
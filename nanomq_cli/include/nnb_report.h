@@ -0,0 +1,49 @@
+#ifndef NNB_REPORT_H
+#define NNB_REPORT_H
+
+#if !defined(NANO_PLATFORM_WINDOWS) && defined(SUPP_BENCH)
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nnb_scenario.h"
+
+typedef enum {
+	NNB_FORMAT_TEXT,
+	NNB_FORMAT_JSON, // one object per line
+	NNB_FORMAT_CSV,
+} nnb_format;
+
+/*
+ * Takes the options every mode shares out of argv before the mode parses
+ * the rest:
+ *
+ *   --format text|json|csv   what the intervals and the summary look like
+ *   --output <file>          where json and csv go [default: stdout]
+ *   --metrics <url>          REST API of the broker, e.g.
+ *                            http://localhost:8081/api/v4, its
+ *                            /prometheus is polled at every interval
+ *   --metrics-auth <u:p>     basic auth of the REST API
+ */
+extern void nnb_report_args(int *argc, char **argv);
+
+// Modes print their own text as they always did while this is true.
+extern bool nnb_report_text(void);
+
+/*
+ * One interval of a run, now and prev are the counters since the start
+ * at its end and at the end of the one before. Only the broker metrics
+ * are printed in text.
+ */
+extern void nnb_report_interval(
+    const nnb_result *now, const nnb_result *prev, uint64_t period);
+
+// The end of a run, text is nnb_result_print().
+extern void nnb_report_summary(const nnb_result *res);
+
+// nanomq_cli bench compare <base> <new>, exits 1 on a regression.
+extern int nnb_compare_start(int argc, char **argv);
+
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef NNB_SCENARIO_H
+#define NNB_SCENARIO_H
+
+#if !defined(NANO_PLATFORM_WINDOWS) && defined(SUPP_BENCH)
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lat_hist.h"
+
+// Client groups of one scenario file.
+#ifndef NNB_GROUPS
+#define NNB_GROUPS 32
+#endif
+
+typedef enum { NNB_IDLE, NNB_PUB, NNB_SUB } nnb_behaviour;
+
+/*
+ * Clients of a group connect one after another over ramp_up seconds from
+ * start, stay for hold seconds and leave over ramp_down seconds; a hold
+ * of 0 keeps them to the end of the run. With reconnect every client
+ * drops its connection after about that many seconds and dials again.
+ */
+typedef struct {
+	char         *name;
+	nnb_behaviour behaviour;
+	int           count;
+	int           start;
+	int           ramp_up;
+	int           hold;
+	int           ramp_down;
+	int           reconnect;
+	int           keepalive;
+	int           qos;
+	bool          retain;
+	bool          clean;
+	char         *topic;    // %i index, %u username, %c client id, %r random
+	int           random;   // %r is below this
+	int           interval; // ms between two publishes of one client
+	int           size_min; // payload bytes, uniform between min and max
+	int           size_max;
+	char         *username;
+	char         *password;
+} nnb_group;
+
+typedef struct {
+	char     *host;
+	int       port;
+	int       version;
+	int       duration; // seconds of the run, 0 until interrupted
+	int       report;   // seconds between two stats of the groups
+	nnb_group groups[NNB_GROUPS];
+	size_t    ngroups;
+} nnb_scenario;
+
+/*
+ * Counters of one group at the end of a run. Publishes of 12 bytes or
+ * more carry a stamp, latency is what a sub group saw of them.
+ */
+typedef struct {
+	char     name[64];
+	int      connected;
+	uint64_t connects;
+	uint64_t disconnects;
+	uint64_t sent;
+	uint64_t recv;
+	uint64_t errors;
+	lat_hist latency;
+} nnb_group_result;
+
+typedef struct {
+	nnb_group_result groups[NNB_GROUPS];
+	size_t           ngroups;
+	uint64_t         elapsed; // ms, the longest of the merged runs
+	int              agents;  // runs merged into it
+} nnb_result;
+
+// NNG_EINVAL with the reason on stderr.
+extern int  nnb_scenario_parse(char *text, size_t len, nnb_scenario *sc);
+extern void nnb_scenario_free(nnb_scenario *sc);
+
+/*
+ * Runs sc until its duration is over or SIGINT, starting at start_us of
+ * the wall clock (0 at once), and fills res. May be called again.
+ */
+extern int nnb_scenario_run(
+    nnb_scenario *sc, uint64_t start_us, nnb_result *res);
+
+// Adds res to total group by group, groups are matched by name.
+extern void  nnb_result_merge(nnb_result *total, const nnb_result *res);
+extern void  nnb_result_print(const nnb_result *res);
+// JSON with the histograms as [bucket, count, ...] of the used buckets.
+extern char *nnb_result_encode(const nnb_result *res);
+extern int   nnb_result_decode(const char *json, size_t len, nnb_result *res);
+
+// nanomq_cli bench scenario <file>
+extern int nnb_scenario_start(int argc, char **argv);
+
+#endif
+
+#endif
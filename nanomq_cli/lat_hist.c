@@ -0,0 +1,115 @@
+//
+// Copyright 2024 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#include "lat_hist.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "nng/nng.h"
+#include "nng/supplemental/util/platform.h"
+
+uint64_t
+lat_now_us(void)
+{
+#if defined(_WIN32)
+	return (uint64_t) nng_timestamp() * 1000;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static int
+lat_log2(uint64_t v)
+{
+	int e = 0;
+
+	while (v >>= 1) {
+		e++;
+	}
+	return e;
+}
+
+static size_t
+lat_index(uint64_t us)
+{
+	int e;
+
+	if (us < LAT_HIST_SUB) {
+		return (size_t) us;
+	}
+	e = lat_log2(us) - LAT_HIST_SUB_BITS;
+	if (e >= LAT_HIST_EXPS) {
+		return LAT_HIST_BUCKETS - 1;
+	}
+	return LAT_HIST_SUB + (size_t) e * LAT_HIST_SUB +
+	    ((us >> e) & (LAT_HIST_SUB - 1));
+}
+
+// The lowest value of bucket i.
+static uint64_t
+lat_value(size_t i)
+{
+	size_t e;
+
+	if (i < LAT_HIST_SUB) {
+		return i;
+	}
+	e = (i - LAT_HIST_SUB) / LAT_HIST_SUB;
+	return (uint64_t) (LAT_HIST_SUB + (i - LAT_HIST_SUB) % LAT_HIST_SUB)
+	    << e;
+}
+
+void
+lat_hist_record(lat_hist *h, uint64_t us)
+{
+	h->counts[lat_index(us)]++;
+	h->total++;
+	if (us > h->max) {
+		h->max = us;
+	}
+}
+
+void
+lat_hist_reset(lat_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void
+lat_hist_merge(lat_hist *dst, const lat_hist *src)
+{
+	for (size_t i = 0; i < LAT_HIST_BUCKETS; i++) {
+		dst->counts[i] += src->counts[i];
+	}
+	dst->total += src->total;
+	if (src->max > dst->max) {
+		dst->max = src->max;
+	}
+}
+
+void
+lat_hist_percentiles(
+    const lat_hist *h, const double *pcts, uint64_t *vals, size_t n)
+{
+	uint64_t seen = 0;
+	size_t   p    = 0;
+
+	memset(vals, 0, sizeof(*vals) * n);
+	for (size_t i = 0; i < LAT_HIST_BUCKETS && p < n && h->total > 0;
+	     i++) {
+		seen += h->counts[i];
+		while (p < n && seen >= h->total * pcts[p] / 100) {
+			vals[p++] = lat_value(i);
+		}
+	}
+}
@@ -50,19 +50,44 @@
 #define NFTP_TYPE_END 0x04
 #define NFTP_TYPE_GIVEME 0x05
 
-static char *fname_curr = NULL;
-static int   flen_curr  = 0;
+// Files one send takes, and one recv follows at a time.
+#ifndef NFTP_FILES
+#define NFTP_FILES 16
+#endif
+
+// Blocks in flight per file, the window adapts below --window.
+#ifndef NFTP_WINDOW
+#define NFTP_WINDOW 16
+#endif
+#ifndef NFTP_WINDOW_MAX
+#define NFTP_WINDOW_MAX 64
+#endif
+
+// Sent blocks between two writes of the resume bitmap.
+#ifndef NFTP_SAVE_EVERY
+#define NFTP_SAVE_EVERY 16
+#endif
 
+// Polls nextid has to stay put before recv asks for it again.
 #define STN 5
-static int stcnt      = 0;
-static int stats[STN] = { 0 };
+
+typedef struct {
+	char *name;
+	int   nextid;
+	int   same;
+} nftp_recv_file;
+
+static nftp_recv_file recv_files[NFTP_FILES];
+static nng_mtx       *recv_mtx;
 
 enum client_type { SEND = 1, RECV };
 
 typedef struct nftp_opts {
 	char *url;
-	char *path_to_file;
+	char *files[NFTP_FILES];
+	int   nfiles;
 	char *dir;
+	int   window;
 } nftp_opts;
 
 enum options {
@@ -70,6 +95,7 @@ enum options {
 	OPT_MQTT_URL,
 	OPT_PATH_TO_FILE,
 	OPT_DIR,
+	OPT_WINDOW,
 };
 
 static nng_optspec cmd_opts[] = {
@@ -77,6 +103,7 @@ static nng_optspec cmd_opts[] = {
 	{ .o_name = "url", .o_val = OPT_MQTT_URL, .o_arg = true },
 	{ .o_name = "file", .o_short = 'f', .o_val = OPT_PATH_TO_FILE, .o_arg = true },
 	{ .o_name = "dir", .o_short = 'd', .o_val = OPT_DIR, .o_arg = true },
+	{ .o_name = "window", .o_val = OPT_WINDOW, .o_arg = true },
 
 	{ .o_name = NULL, .o_val = 0 },
 };
@@ -94,11 +121,17 @@ print_help(enum client_type type)
 		    "\n");
 		printf("                               [default: "
 		       "mqtt-tcp://127.0.0.1:1883]\n");
-		printf("--file, -f                     Path to the file.\n");
+		printf("--file, -f                     Path to the file, "
+		       "repeat it to send up to %d files at once.\n",
+		    NFTP_FILES);
 		printf("--dir, -d                      Directory to save "
 		       "file, ended with '\'. [default: current directory]\n");
+		printf("--window <num>                 Blocks in flight per "
+		       "file at most. [default: %d, max: %d]\n",
+		    NFTP_WINDOW, NFTP_WINDOW_MAX);
 	} else if (type == SEND) {
-		printf("Usage: nanomq_cli nftp send --file <path2file> [--url "
+		printf("Usage: nanomq_cli nftp send --file <path2file> "
+		       "[--file <path2file> ...] [--window <num>] [--url "
 		       "<url4broker>]\n");
 	} else if (type == RECV) {
 		printf("Usage: nanomq_cli nftp recv [--dir <path4dir> --url "
@@ -106,28 +139,6 @@ print_help(enum client_type type)
 	}
 }
 
-static int
-stats_push(int v)
-{
-	for (int i = 0; i < stcnt; i++) {
-		if (stats[i] != v) {
-			stcnt    = 1;
-			stats[0] = v;
-		}
-	}
-	// All value in stack are equal to V
-	//
-	// If stack is full
-	if (stcnt == STN) {
-		stcnt = 0;
-		return v;
-	}
-	// If stack is not full
-	stats[stcnt] = v;
-	stcnt++;
-	return -1;
-}
-
 int keepRunning = 1;
 
 void
@@ -225,15 +236,12 @@ client_connect(nng_socket *sock, nng_dialer *dialer, const char *url,
 	return (0);
 }
 
-// Publish a message to the given topic and with the given QoS.
-int
-client_publish(nng_socket sock, const char *topic, uint8_t *payload,
-    uint32_t payload_len, uint8_t qos, bool verbose)
+static nng_msg *
+publish_msg(const char *topic, uint8_t *payload, uint32_t payload_len,
+    uint8_t qos)
 {
-	int rv;
-
-	// create a PUBLISH message
 	nng_msg *pubmsg;
+
 	nng_mqtt_msg_alloc(&pubmsg, 0);
 	nng_mqtt_msg_set_packet_type(pubmsg, NNG_MQTT_PUBLISH);
 	nng_mqtt_msg_set_publish_dup(pubmsg, 0);
@@ -242,6 +250,18 @@ client_publish(nng_socket sock, const char *topic, uint8_t *payload,
 	nng_mqtt_msg_set_publish_payload(
 	    pubmsg, (uint8_t *) payload, payload_len);
 	nng_mqtt_msg_set_publish_topic(pubmsg, topic);
+	return pubmsg;
+}
+
+// Publish a message to the given topic and with the given QoS.
+int
+client_publish(nng_socket sock, const char *topic, uint8_t *payload,
+    uint32_t payload_len, uint8_t qos, bool verbose)
+{
+	int rv;
+
+	// create a PUBLISH message
+	nng_msg *pubmsg = publish_msg(topic, payload, payload_len, qos);
 
 	// printf("Publishing to '%s' ...\n", topic);
 	if ((rv = nng_sendmsg(sock, pubmsg, NNG_FLAG_NONBLOCK)) != 0) {
@@ -251,7 +271,299 @@ client_publish(nng_socket sock, const char *topic, uint8_t *payload,
 	return rv;
 }
 
-static int g_wait = 1;
+// One file on its way out. Blocks go out through a window of slots, each
+// an aio with a publish out, and whatever completes pulls the next block.
+// The window moves with the throughput of the last round, and a failed
+// publish halves it. Blocks that made it are kept in a bitmap next to the
+// file so a send cut halfway starts again from the rest.
+typedef struct nftp_xfer nftp_xfer;
+
+typedef struct {
+	nftp_xfer *x;
+	nng_aio   *aio;
+	int        block;
+	bool       busy;
+} nftp_slot;
+
+struct nftp_xfer {
+	nng_socket sock;
+	char      *path;
+	char      *bmpath;
+	uint8_t   *bitmap;
+	size_t     blocks; // the last one is END
+	size_t     next;
+	size_t     todo;
+	size_t     done;
+	size_t     failed;
+	int        inflight;
+	int        window;
+	int        wmax;
+	size_t     round;
+	nng_time   round_start;
+	double     rate; // blocks per second of the last round
+	nng_mtx   *mtx;
+	nng_cv    *cv;
+	nftp_slot  slots[NFTP_WINDOW_MAX];
+};
+
+static nng_mtx *ack_mtx;
+static nng_cv  *ack_cv;
+static int      ack_cnt = 0;
+
+#define BIT_GET(bm, i) (((bm)[(i) / 8] >> ((i) % 8)) & 1)
+#define BIT_SET(bm, i) ((bm)[(i) / 8] |= (uint8_t) (1 << ((i) % 8)))
+
+static void
+xfer_bitmap_load(nftp_xfer *x)
+{
+	size_t len = (x->blocks + 7) / 8;
+	FILE  *fp;
+
+	if ((fp = fopen(x->bmpath, "rb")) == NULL) {
+		return;
+	}
+	if (fread(x->bitmap, 1, len, fp) != len || fgetc(fp) != EOF) {
+		// not this file, or not any more
+		memset(x->bitmap, 0, len);
+	}
+	fclose(fp);
+}
+
+// Caller holds x->mtx.
+static void
+xfer_bitmap_save(nftp_xfer *x)
+{
+	FILE *fp;
+
+	if ((fp = fopen(x->bmpath, "wb")) == NULL) {
+		return;
+	}
+	fwrite(x->bitmap, 1, (x->blocks + 7) / 8, fp);
+	fclose(fp);
+}
+
+// Caller holds x->mtx. Moves the window once per round of it.
+static void
+xfer_adapt(nftp_xfer *x, int rv)
+{
+	nng_time now = nng_clock();
+	double   rate;
+
+	if (rv != 0) {
+		x->window      = x->window > 1 ? x->window / 2 : 1;
+		x->round       = 0;
+		x->round_start = now;
+		return;
+	}
+	if (++x->round < (size_t) x->window) {
+		return;
+	}
+	rate = x->round * 1000.0 / (now > x->round_start ?
+	                                   now - x->round_start : 1);
+	if (rate > x->rate * 1.05 && x->window < x->wmax) {
+		x->window++;
+	} else if (rate < x->rate * 0.9 && x->window > 1) {
+		x->window -= (x->window + 3) / 4;
+	}
+	x->rate        = rate;
+	x->round       = 0;
+	x->round_start = now;
+}
+
+// Caller holds x->mtx. Takes free slots for the blocks the window allows
+// and returns how many, they are sent after unlocking.
+static int
+xfer_take(nftp_xfer *x, nftp_slot **picked)
+{
+	int n = 0;
+
+	while (x->inflight < x->window) {
+		while (x->next < x->blocks - 1 && BIT_GET(x->bitmap, x->next)) {
+			x->next++;
+		}
+		if (x->next >= x->blocks - 1) {
+			break;
+		}
+		for (int i = 0; i < x->wmax; i++) {
+			if (!x->slots[i].busy) {
+				x->slots[i].busy  = true;
+				x->slots[i].block = (int) x->next++;
+				picked[n++]       = &x->slots[i];
+				x->inflight++;
+				break;
+			}
+		}
+	}
+	return n;
+}
+
+static void
+xfer_send(nftp_slot *s)
+{
+	nftp_xfer *x = s->x;
+	char      *msg;
+	int        len;
+	int        rv;
+
+	if ((rv = nftp_proto_maker(x->path, NFTP_TYPE_FILE, 0, s->block, &msg,
+	         &len)) != 0) {
+		nng_aio_finish(s->aio, NNG_EINTERNAL);
+		return;
+	}
+	nng_aio_set_msg(s->aio,
+	    publish_msg(FTOPIC_BLOCKS, (uint8_t *) msg, (uint32_t) len, 1));
+	free(msg);
+	nng_send_aio(x->sock, s->aio);
+}
+
+static void
+xfer_cb(void *arg)
+{
+	nftp_slot *s = arg;
+	nftp_xfer *x = s->x;
+	nftp_slot *picked[NFTP_WINDOW_MAX];
+	nng_msg   *msg;
+	int        rv = nng_aio_result(s->aio);
+	int        n;
+
+	if (rv != 0 && (msg = nng_aio_get_msg(s->aio)) != NULL) {
+		nng_aio_set_msg(s->aio, NULL);
+		nng_msg_free(msg);
+	}
+
+	nng_mtx_lock(x->mtx);
+	s->busy = false;
+	x->inflight--;
+	x->done++;
+	if (rv != 0) {
+		// the receiver asks for it with a GIVEME later
+		x->failed++;
+	} else {
+		BIT_SET(x->bitmap, s->block);
+		if (x->done % NFTP_SAVE_EVERY == 0) {
+			xfer_bitmap_save(x);
+		}
+	}
+	xfer_adapt(x, rv);
+	if (x->done == x->todo) {
+		xfer_bitmap_save(x);
+		nng_cv_wake(x->cv);
+	}
+	n = xfer_take(x, picked);
+	nng_mtx_unlock(x->mtx);
+
+	for (int i = 0; i < n; i++) {
+		xfer_send(picked[i]);
+	}
+}
+
+static int
+xfer_init(nftp_xfer *x, nng_socket sock, char *path, int window)
+{
+	size_t len;
+	int    rv;
+
+	memset(x, 0, sizeof(*x));
+	x->sock = sock;
+	x->path = path;
+	x->wmax = window;
+	// slow start, the window grows as long as that pays
+	x->window = window < 4 ? window : 4;
+	if ((rv = nftp_file_blocks(path, &x->blocks)) != 0) {
+		return rv;
+	}
+	if (x->blocks == 0) {
+		return NNG_EINVAL;
+	}
+	len = strlen(path) + sizeof(".nftp");
+	if ((x->bmpath = nng_alloc(len)) == NULL ||
+	    (x->bitmap = nng_zalloc((x->blocks + 7) / 8)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	snprintf(x->bmpath, len, "%s.nftp", path);
+	xfer_bitmap_load(x);
+	for (size_t i = 0; i + 1 < x->blocks; i++) {
+		if (!BIT_GET(x->bitmap, i)) {
+			x->todo++;
+		}
+	}
+	if ((rv = nng_mtx_alloc(&x->mtx)) != 0 ||
+	    (rv = nng_cv_alloc(&x->cv, x->mtx)) != 0) {
+		return rv;
+	}
+	for (int i = 0; i < x->wmax; i++) {
+		x->slots[i].x = x;
+		if ((rv = nng_aio_alloc(
+		         &x->slots[i].aio, xfer_cb, &x->slots[i])) != 0) {
+			return rv;
+		}
+	}
+	return 0;
+}
+
+static void
+xfer_fini(nftp_xfer *x)
+{
+	for (int i = 0; i < x->wmax; i++) {
+		if (x->slots[i].aio != NULL) {
+			nng_aio_stop(x->slots[i].aio);
+			nng_aio_free(x->slots[i].aio);
+		}
+	}
+	if (x->cv != NULL) {
+		nng_cv_free(x->cv);
+	}
+	if (x->mtx != NULL) {
+		nng_mtx_free(x->mtx);
+	}
+	if (x->bitmap != NULL) {
+		nng_free(x->bitmap, (x->blocks + 7) / 8);
+	}
+	if (x->bmpath != NULL) {
+		nng_strfree(x->bmpath);
+	}
+}
+
+static void
+xfer_start(nftp_xfer *x)
+{
+	nftp_slot *picked[NFTP_WINDOW_MAX];
+	int        n;
+
+	nng_mtx_lock(x->mtx);
+	x->round_start = nng_clock();
+	n              = xfer_take(x, picked);
+	nng_mtx_unlock(x->mtx);
+	for (int i = 0; i < n; i++) {
+		xfer_send(picked[i]);
+	}
+}
+
+// Waits for every block of x, then sends the END. The bitmap goes with a
+// file sent through.
+static void
+xfer_finish(nftp_xfer *x)
+{
+	char *nftp_end_msg;
+	int   nftp_end_len;
+
+	nng_mtx_lock(x->mtx);
+	while (x->done < x->todo) {
+		nng_cv_wait(x->cv);
+	}
+	nng_mtx_unlock(x->mtx);
+
+	nftp_proto_maker(x->path, NFTP_TYPE_END, 0, (int) x->blocks - 1,
+	    &nftp_end_msg, &nftp_end_len);
+	client_publish(x->sock, FTOPIC_BLOCKS, (uint8_t *) nftp_end_msg,
+	    nftp_end_len, 1, 1);
+	free(nftp_end_msg);
+	if (x->failed == 0) {
+		remove(x->bmpath);
+	}
+	printf("file %s send done, %zu blocks, %zu failed, window %d\n",
+	    x->path, x->todo, x->failed, x->window);
+}
 
 void
 wait_ack_and_giveme(void *args)
@@ -277,7 +589,10 @@ wait_ack_and_giveme(void *args)
 		// printf("Received payload length %d \n", payload_len);
 
 		if (payload[0] == NFTP_TYPE_ACK) {
-			g_wait = 0;
+			nng_mtx_lock(ack_mtx);
+			ack_cnt++;
+			nng_cv_wake(ack_cv);
+			nng_mtx_unlock(ack_mtx);
 			nng_msg_free(msg);
 			continue;
 		}
@@ -305,55 +620,89 @@ wait_ack_and_giveme(void *args)
 	}
 }
 
+static void
+recv_file_add(char *fname)
+{
+	nng_mtx_lock(recv_mtx);
+	for (int i = 0; i < NFTP_FILES; i++) {
+		if (recv_files[i].name != NULL &&
+		    strcmp(recv_files[i].name, fname) == 0) {
+			// sent again, the codec starts it over
+			recv_files[i].same = 0;
+			free(fname);
+			nng_mtx_unlock(recv_mtx);
+			return;
+		}
+	}
+	for (int i = 0; i < NFTP_FILES; i++) {
+		if (recv_files[i].name == NULL) {
+			recv_files[i].name   = fname;
+			recv_files[i].nextid = -1;
+			recv_files[i].same   = 0;
+			nng_mtx_unlock(recv_mtx);
+			return;
+		}
+	}
+	nng_mtx_unlock(recv_mtx);
+	printf("%d files in progress, no GIVEME for %s\n", NFTP_FILES, fname);
+	free(fname);
+}
+
+// Asks for the first missing block of every file in progress once it has
+// not moved for STN polls, the window of the sender keeps it moving else.
 void
 ask_nextid(void *args)
 {
 	int        rv;
 	nng_socket sock = *(nng_socket *) args;
 	while (true) {
-		nng_msg *msg;
-		uint8_t *payload;
-		uint32_t payload_len;
-		int      blocks, nextid;
-
 		nng_msleep(100);
 
-		if (fname_curr == NULL) {
-			continue;
-		}
-
-		if ((rv = nftp_proto_recv_status(
-		         fname_curr, &blocks, &nextid)) != 0) {
-			printf("Done!!! The ctx of this file has been erase "
-			       "%s %d\n",
-			    fname_curr, rv);
-			free(fname_curr);
-			fname_curr = NULL;
-			continue;
-		}
-
-		if (nextid > blocks - 1) {
-			// no more giveme needed
-			printf("should not be here %d %d\n", nextid, blocks);
-			continue;
-		}
+		nng_mtx_lock(recv_mtx);
+		for (int i = 0; i < NFTP_FILES; i++) {
+			nftp_recv_file *f = &recv_files[i];
+			uint8_t        *payload;
+			uint32_t        payload_len;
+			int             blocks, nextid;
 
-		if (stats_push(nextid) < 0) {
-			continue;
-		}
-		// printf("ask nextid %d\n", nextid);
+			if (f->name == NULL) {
+				continue;
+			}
+			if ((rv = nftp_proto_recv_status(
+			         f->name, &blocks, &nextid)) != 0) {
+				printf("Done!!! The ctx of this file has been "
+				       "erase %s %d\n",
+				    f->name, rv);
+				free(f->name);
+				f->name = NULL;
+				continue;
+			}
+			if (nextid > blocks - 1) {
+				// no more giveme needed
+				continue;
+			}
+			if (nextid != f->nextid) {
+				f->nextid = nextid;
+				f->same   = 0;
+				continue;
+			}
+			if (++f->same < STN) {
+				continue;
+			}
+			f->same = 0;
 
-		rv = nftp_proto_maker(fname_curr, NFTP_TYPE_GIVEME, 0, nextid,
-		    (char **) &payload, (int *) &payload_len);
-		if (rv != 0) {
-			printf(
-			    "error in make giveme %s %d\n", fname_curr, rv);
-			continue;
+			rv = nftp_proto_maker(f->name, NFTP_TYPE_GIVEME, 0,
+			    nextid, (char **) &payload, (int *) &payload_len);
+			if (rv != 0) {
+				printf("error in make giveme %s %d\n", f->name,
+				    rv);
+				continue;
+			}
+			client_publish(sock, FTOPIC_GIVEME, (uint8_t *) payload,
+			    payload_len, 1, 1);
+			free(payload);
 		}
-
-		client_publish(sock, FTOPIC_GIVEME, (uint8_t *) payload,
-		    payload_len, 1, 1);
-		free(payload);
+		nng_mtx_unlock(recv_mtx);
 	}
 }
 
@@ -373,9 +722,10 @@ send_callback(nng_mqtt_client *client, nng_msg *msg, void *arg)
 static void
 set_default_opts(nftp_opts *n_opts)
 {
-	n_opts->url = FURL;
-	n_opts->path_to_file = NULL;
-	n_opts->dir          = NULL;
+	n_opts->url    = FURL;
+	n_opts->nfiles = 0;
+	n_opts->dir    = NULL;
+	n_opts->window = NFTP_WINDOW;
 }
 
 static void
@@ -384,8 +734,8 @@ free_opts(nftp_opts *n_opts)
 	if(strncmp(n_opts->url,FURL,25) != 0) {
 		nng_strfree(n_opts->url);
 	}
-	if (n_opts->path_to_file != NULL) {
-		nng_strfree(n_opts->path_to_file);
+	for (int i = 0; i < n_opts->nfiles; i++) {
+		nng_strfree(n_opts->files[i]);
 	}
 	if (n_opts->dir != NULL) {
 		nng_strfree(n_opts->dir);
@@ -418,11 +768,25 @@ client_parse_opts(int argc, char **argv, nftp_opts *n_opts, int client_type)
 			n_opts->url = nng_strdup(arg);
 			break;
 		case OPT_PATH_TO_FILE:
-			n_opts->path_to_file = nng_strdup(arg);
+			if (n_opts->nfiles == NFTP_FILES) {
+				printf("At most %d files, %s skipped\n",
+				    NFTP_FILES, arg);
+				break;
+			}
+			n_opts->files[n_opts->nfiles++] = nng_strdup(arg);
 			break;
 		case OPT_DIR:
 			n_opts->dir = nng_strdup(arg);
 			break;
+		case OPT_WINDOW:
+			n_opts->window = atoi(arg);
+			if (n_opts->window < 1 ||
+			    n_opts->window > NFTP_WINDOW_MAX) {
+				printf("Window %s out of range, using %d\n",
+				    arg, NFTP_WINDOW);
+				n_opts->window = NFTP_WINDOW;
+			}
+			break;
 		}
 	}
 	return 0;
@@ -444,7 +808,7 @@ nftp_client(const int argc, const char **argv, int client_type)
 	set_default_opts(n_opts);
 	client_parse_opts(argc, argv, n_opts, client_type);
 
-	if (client_type == SEND && n_opts->path_to_file == NULL) {
+	if (client_type == SEND && n_opts->nfiles == 0) {
 		print_help(SEND);
 		goto exit;
 	}
@@ -492,70 +856,78 @@ nftp_client(const int argc, const char **argv, int client_type)
 	    nng_mqtt_client_alloc(sock, &send_callback, true);
 	nng_mqtt_subscribe_async(client, subscriptions, count, NULL);
 	if (client_type == SEND) {
-		if (0 == nftp_file_exist(n_opts->path_to_file)) {
-			printf("%s is not exist\n", n_opts->path_to_file);
+		nftp_xfer *xfers;
+		int        nxfers = 0;
+
+		xfers = nng_zalloc(sizeof(nftp_xfer) * n_opts->nfiles);
+		if (xfers == NULL || nng_mtx_alloc(&ack_mtx) != 0 ||
+		    nng_cv_alloc(&ack_cv, ack_mtx) != 0) {
+			printf("Out of memory\n");
+			goto exit;
+		}
+		for (int i = 0; i < n_opts->nfiles; i++) {
+			char *path = n_opts->files[i];
+
+			if (0 == nftp_file_exist(path)) {
+				printf("%s is not exist\n", path);
+				continue;
+			}
+			if ((rv = xfer_init(&xfers[nxfers], sock, path,
+			         n_opts->window)) != 0) {
+				printf("%s skipped %d\n", path, rv);
+				xfer_fini(&xfers[nxfers]);
+				continue;
+			}
+			if (xfers[nxfers].todo + 1 < xfers[nxfers].blocks) {
+				printf("%s resumes, %zu of %zu blocks left\n",
+				    path, xfers[nxfers].todo,
+				    xfers[nxfers].blocks - 1);
+			}
+			nxfers++;
+		}
+		if (nxfers == 0) {
+			nng_free(xfers, sizeof(nftp_xfer) * n_opts->nfiles);
 			goto exit;
 		}
 		nng_thread *thr;
 		nng_thread_create(&thr, wait_ack_and_giveme, (void *) &sock);
 		nng_msleep(1000);
 
-		// Send a Hello
-		char *nftp_hello_msg = NULL;
-		int   nftp_hello_len = 0;
-		rv = nftp_proto_maker(n_opts->path_to_file, NFTP_TYPE_HELLO, 0,
-		    0, &nftp_hello_msg, &nftp_hello_len);
-		if (rv != 0)
-			printf("hello make rv %d\n", rv);
-		client_publish(sock, FTOPIC_HELLO, (uint8_t *) nftp_hello_msg,
-		    nftp_hello_len, 1, 1);
-		free(nftp_hello_msg);
-
-		// Wait an ACK
-		// printf("wait ack\n");
-		// TODO condition variable
-		while (g_wait == 1) {
-			nng_msleep(500);
+		// Send a Hello for each file
+		for (int i = 0; i < nxfers; i++) {
+			char *nftp_hello_msg = NULL;
+			int   nftp_hello_len = 0;
+			rv = nftp_proto_maker(xfers[i].path, NFTP_TYPE_HELLO,
+			    0, 0, &nftp_hello_msg, &nftp_hello_len);
+			if (rv != 0)
+				printf("hello make rv %d\n", rv);
+			client_publish(sock, FTOPIC_HELLO,
+			    (uint8_t *) nftp_hello_msg, nftp_hello_len, 1, 1);
+			free(nftp_hello_msg);
 		}
-		// printf("get ack and start\n");
-		// reset g_wait
-		g_wait = 1;
-
-		size_t blocks = 0;
-		rv = nftp_file_blocks(n_opts->path_to_file, &blocks);
-		if (rv != 0)
-			printf("blocks rv %d\n", rv);
-		nng_msleep(1000);
 
-		// Send FILEs and END
-		for (int i = 0; i < blocks - 1; ++i) {
-			char *nftp_file_msg;
-			int   nftp_file_len;
-			if (i % 10 == 0) {
-				printf("Cancel sending block %d to "
-				       "simulate poor network.\n",
-				    i);
-				continue;
-			}
-			nftp_proto_maker(n_opts->path_to_file, NFTP_TYPE_FILE,
-			    0, i, &nftp_file_msg, &nftp_file_len);
-			client_publish(sock, FTOPIC_BLOCKS,
-			    (uint8_t *) nftp_file_msg, nftp_file_len, 1, 1);
-			free(nftp_file_msg);
-			// Assume 1 Mbps bandwidth
-			// 1Mbps / 8bit * 32KB ~= 4 Packets/sec
-			nng_msleep(50);
+		// Wait an ACK for each
+		nng_mtx_lock(ack_mtx);
+		while (ack_cnt < nxfers) {
+			nng_cv_wait(ack_cv);
 		}
-		char *nftp_end_msg;
-		int   nftp_end_len;
-		nftp_proto_maker(n_opts->path_to_file, NFTP_TYPE_END, 0,
-		    blocks - 1, &nftp_end_msg, &nftp_end_len);
-		client_publish(sock, FTOPIC_BLOCKS, (uint8_t *) nftp_end_msg,
-		    nftp_end_len, 1, 1);
-		free(nftp_end_msg);
-		printf("file send done\n");
+		nng_mtx_unlock(ack_mtx);
+
+		// Send FILEs of all in parallel, then their ENDs
+		for (int i = 0; i < nxfers; i++) {
+			xfer_start(&xfers[i]);
+		}
+		for (int i = 0; i < nxfers; i++) {
+			xfer_finish(&xfers[i]);
+			xfer_fini(&xfers[i]);
+		}
+		nng_free(xfers, sizeof(nftp_xfer) * n_opts->nfiles);
 	} else if (client_type == RECV) {
 		nng_thread *thr;
+		if ((rv = nng_mtx_alloc(&recv_mtx)) != 0) {
+			printf("Out of memory\n");
+			goto exit;
+		}
 		nng_thread_create(&thr, ask_nextid, (void *) &sock);
 		nng_msleep(1000);
 		if (n_opts->dir != NULL) {
@@ -598,12 +970,10 @@ nftp_client(const int argc, const char **argv, int client_type)
 				nftp_proto_hello_get_fname((char *) payload,
 				    (int) payload_len, &fname_, &flen_);
 
-				fname_curr = strndup(fname_, flen_);
+				printf("file name %.*s ..\n", flen_, fname_);
+				// Ask_nextid follows it from now on
+				recv_file_add(strndup(fname_, flen_));
 				free(fname_);
-				// Ask_nextid start work until now. Ugly but
-				// works.
-
-				printf("file name %s ..\n", fname_curr);
 				// printf("reply ack\n");
 				client_publish(sock, FTOPIC_ACK,
 				    (uint8_t *) nftp_reply_msg, nftp_reply_len,
@@ -0,0 +1,555 @@
+//
+// Copyright 2024 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#if !defined(NANO_PLATFORM_WINDOWS) && defined(SUPP_BENCH)
+
+#include "include/nnb_dist.h"
+#include "include/nnb_help.h"
+#include "include/nnb_report.h"
+#include "include/nnb_scenario.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nng/mqtt/mqtt_client.h>
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+#include "nng/supplemental/nanolib/cJSON.h"
+#include "nng/supplemental/nanolib/file.h"
+
+#define NNB_DIST_AGENTS "nnb/agents/"
+#define NNB_DIST_RUN "nnb/run"
+#define NNB_DIST_RESULTS "nnb/results/"
+
+// Agents one coordinator keeps track of.
+#ifndef NNB_DIST_MAX_AGENTS
+#define NNB_DIST_MAX_AGENTS 1024
+#endif
+
+#define NNB_DIST_ID_LEN 64
+#define NNB_DIST_TOPIC_LEN 160
+
+typedef struct {
+	char *host;
+	int   port;
+	char *username;
+	char *password;
+	char *id;     // agent
+	int   agents; // coordinator, how many to run on
+	int   lead;   // seconds from the run message to the start
+	int   wait;   // seconds to wait for agents and results
+	char *file;
+} dist_opt;
+
+typedef struct {
+	nng_socket  sock;
+	const char *subs[2];
+	size_t      nsubs;
+	char        presence[NNB_DIST_TOPIC_LEN]; // agent only
+	const char *id;
+} dist_conn;
+
+typedef struct {
+	char   ids[NNB_DIST_MAX_AGENTS][NNB_DIST_ID_LEN];
+	size_t n;
+} dist_ids;
+
+static dist_opt dist_;
+
+static struct option dist_options[] = {
+	{ "host", required_argument, NULL, 'h' },
+	{ "port", required_argument, NULL, 'p' },
+	{ "username", required_argument, NULL, 'u' },
+	{ "password", required_argument, NULL, 'P' },
+	{ "id", required_argument, NULL, 'i' },
+	{ "agents", required_argument, NULL, 'n' },
+	{ "lead", required_argument, NULL, 'l' },
+	{ "wait", required_argument, NULL, 'w' },
+	{ "help", no_argument, NULL, 'H' },
+	{ NULL, 0, NULL, 0 },
+};
+
+static void
+dist_opt_parse(int argc, char **argv, const char *usage)
+{
+	int c;
+
+	dist_.host   = "localhost";
+	dist_.port   = 1883;
+	dist_.agents = 1;
+	dist_.lead   = 5;
+	dist_.wait   = 60;
+	// argv[2] stands in for the program name
+	while ((c = getopt_long(argc - 2, argv + 2, "h:p:u:P:i:n:l:w:",
+	            dist_options, NULL)) != -1) {
+		switch (c) {
+		case 'h':
+			dist_.host = optarg;
+			break;
+		case 'p':
+			dist_.port = atoi(optarg);
+			break;
+		case 'u':
+			dist_.username = optarg;
+			break;
+		case 'P':
+			dist_.password = optarg;
+			break;
+		case 'i':
+			dist_.id = optarg;
+			break;
+		case 'n':
+			dist_.agents = atoi(optarg);
+			break;
+		case 'l':
+			dist_.lead = atoi(optarg);
+			break;
+		case 'w':
+			dist_.wait = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s\n", usage);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind < argc - 2) {
+		dist_.file = argv[2 + optind];
+	}
+	if (dist_.port <= 0 || dist_.port > 65535 || dist_.agents < 1 ||
+	    dist_.agents > NNB_DIST_MAX_AGENTS || dist_.lead < 0 ||
+	    dist_.wait < 1 ||
+	    (dist_.id != NULL &&
+	        (strlen(dist_.id) >= NNB_DIST_ID_LEN ||
+	            strpbrk(dist_.id, "/+#") != NULL))) {
+		fprintf(stderr, "Usage: %s\n", usage);
+		exit(EXIT_FAILURE);
+	}
+}
+
+// true if id was not in ids yet
+static bool
+dist_ids_add(dist_ids *ids, const char *id, size_t len)
+{
+	if (len >= NNB_DIST_ID_LEN) {
+		len = NNB_DIST_ID_LEN - 1;
+	}
+	for (size_t i = 0; i < ids->n; i++) {
+		if (strncmp(ids->ids[i], id, len) == 0 &&
+		    ids->ids[i][len] == '\0') {
+			return false;
+		}
+	}
+	if (ids->n == NNB_DIST_MAX_AGENTS) {
+		return false;
+	}
+	memcpy(ids->ids[ids->n], id, len);
+	ids->ids[ids->n++][len] = '\0';
+	return true;
+}
+
+static void
+dist_ids_del(dist_ids *ids, const char *id, size_t len)
+{
+	for (size_t i = 0; i < ids->n; i++) {
+		if (strncmp(ids->ids[i], id, len) == 0 &&
+		    ids->ids[i][len] == '\0') {
+			memcpy(ids->ids[i], ids->ids[--ids->n], NNB_DIST_ID_LEN);
+			return;
+		}
+	}
+}
+
+static nng_msg *
+dist_publish_msg(
+    const char *topic, const void *data, size_t len, bool retain)
+{
+	nng_msg *msg;
+
+	nng_mqtt_msg_alloc(&msg, 0);
+	nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_PUBLISH);
+	nng_mqtt_msg_set_publish_qos(msg, 1);
+	nng_mqtt_msg_set_publish_retain(msg, retain);
+	nng_mqtt_msg_set_publish_topic(msg, topic);
+	nng_mqtt_msg_set_publish_payload(
+	    msg, (uint8_t *) data, (uint32_t) len);
+	return msg;
+}
+
+static void
+dist_connect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
+{
+	dist_conn          *dc     = arg;
+	int                 reason = 0;
+	nng_mqtt_topic_qos *topics_qos;
+	nng_msg            *msg;
+
+	nng_pipe_get_int(p, NNG_OPT_MQTT_CONNECT_REASON, &reason);
+	if (reason != 0) {
+		fprintf(stderr, "%s:%d refused the connection: %d\n",
+		    dist_.host, dist_.port, reason);
+		return;
+	}
+	// subscribed again on every reconnect, clean sessions forget them
+	topics_qos = nng_mqtt_topic_qos_array_create(dc->nsubs);
+	for (size_t i = 0; i < dc->nsubs; i++) {
+		nng_mqtt_topic_qos_array_set(
+		    topics_qos, i, dc->subs[i], 1, 1, 0, 0);
+	}
+	nng_mqtt_subscribe(dc->sock, topics_qos, dc->nsubs, NULL);
+	nng_mqtt_topic_qos_array_free(topics_qos, dc->nsubs);
+
+	if (dc->presence[0] != '\0') {
+		msg = dist_publish_msg(
+		    dc->presence, dc->id, strlen(dc->id), true);
+		if (nng_sendmsg(dc->sock, msg, NNG_FLAG_NONBLOCK) != 0) {
+			nng_msg_free(msg);
+		}
+	}
+}
+
+static void
+dist_open(dist_conn *dc, const char *client_id)
+{
+	nng_dialer dialer;
+	nng_msg   *msg;
+	char       url[300];
+	int        rv;
+
+	if ((rv = nng_mqtt_client_open(&dc->sock)) != 0) {
+		nng_fatal("nng_socket", rv);
+	}
+	snprintf(url, sizeof(url), "mqtt-tcp://%s:%d", dist_.host, dist_.port);
+	if ((rv = nng_dialer_create(&dialer, dc->sock, url)) != 0) {
+		nng_fatal("nng_dialer_create", rv);
+	}
+
+	nng_mqtt_msg_alloc(&msg, 0);
+	nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_CONNECT);
+	nng_mqtt_msg_set_connect_proto_version(msg, 4);
+	nng_mqtt_msg_set_connect_keep_alive(msg, 30);
+	nng_mqtt_msg_set_connect_clean_session(msg, true);
+	nng_mqtt_msg_set_connect_client_id(msg, client_id);
+	if (dist_.username != NULL) {
+		nng_mqtt_msg_set_connect_user_name(msg, dist_.username);
+	}
+	if (dist_.password != NULL) {
+		nng_mqtt_msg_set_connect_password(msg, dist_.password);
+	}
+	if (dc->presence[0] != '\0') {
+		// an agent that dies takes its presence with it
+		nng_mqtt_msg_set_connect_will_topic(msg, dc->presence);
+		nng_mqtt_msg_set_connect_will_msg(msg, (uint8_t *) "", 0);
+		nng_mqtt_msg_set_connect_will_qos(msg, 1);
+		nng_mqtt_msg_set_connect_will_retain(msg, true);
+	}
+	nng_mqtt_set_connect_cb(dc->sock, dist_connect_cb, dc);
+	nng_dialer_set_ptr(dialer, NNG_OPT_MQTT_CONNMSG, msg);
+	nng_socket_set_ms(dc->sock, NNG_OPT_RECVTIMEO, 1000);
+	nng_dialer_start(dialer, NNG_FLAG_NONBLOCK);
+}
+
+// The next PUBLISH, NNG_ETIMEDOUT once a second without one.
+static int
+dist_recv(dist_conn *dc, nng_msg **msgp)
+{
+	nng_msg *msg;
+	int      rv;
+
+	for (;;) {
+		if ((rv = nng_recvmsg(dc->sock, &msg, 0)) != 0) {
+			return rv;
+		}
+		if (nng_mqtt_msg_get_packet_type(msg) == NNG_MQTT_PUBLISH) {
+			*msgp = msg;
+			return 0;
+		}
+		nng_msg_free(msg);
+	}
+}
+
+// The topic of msg past prefix, NULL if it does not start with it.
+static const char *
+dist_topic_rest(nng_msg *msg, const char *prefix, uint32_t *len)
+{
+	uint32_t    tlen;
+	const char *topic = nng_mqtt_msg_get_publish_topic(msg, &tlen);
+	size_t      plen  = strlen(prefix);
+
+	if (topic == NULL || tlen < plen || memcmp(topic, prefix, plen) != 0) {
+		return NULL;
+	}
+	*len = tlen - (uint32_t) plen;
+	return topic + plen;
+}
+
+// Runs one run message, its result goes back even if the run failed.
+static int
+agent_run(dist_conn *dc, const char *json, uint32_t len)
+{
+	cJSON       *root  = cJSON_ParseWithLength(json, len);
+	cJSON       *run   = cJSON_GetObjectItem(root, "run");
+	cJSON       *start = cJSON_GetObjectItem(root, "start_at");
+	cJSON       *text  = cJSON_GetObjectItem(root, "scenario");
+	char         topic[NNB_DIST_TOPIC_LEN];
+	char        *out = NULL;
+	nnb_scenario sc;
+	nnb_result  *res;
+	nng_msg     *msg;
+	uint64_t     start_ms;
+	int          rv = 0;
+
+	if (!cJSON_IsString(run) || !cJSON_IsNumber(start) ||
+	    !cJSON_IsString(text) || strpbrk(run->valuestring, "/+#") != NULL ||
+	    strlen(run->valuestring) >= NNB_DIST_ID_LEN) {
+		fprintf(stderr, "Agent: ignored a malformed run\n");
+		cJSON_Delete(root);
+		return 0;
+	}
+	if ((res = nng_alloc(sizeof(*res))) == NULL) {
+		nng_fatal("nng_alloc", NNG_ENOMEM);
+	}
+	start_ms = (uint64_t) start->valuedouble;
+	if (nnb_scenario_parse(text->valuestring, strlen(text->valuestring),
+	        &sc) == 0) {
+		printf("Run %s starts in %llds\n", run->valuestring,
+		    (long long) (start_ms - lat_now_us() / 1000) / 1000);
+		fflush(stdout);
+		rv = nnb_scenario_run(&sc, start_ms * 1000, res);
+		nnb_result_print(res);
+		out = nnb_result_encode(res);
+		nnb_scenario_free(&sc);
+	}
+
+	snprintf(topic, sizeof(topic), NNB_DIST_RESULTS "%s/%s",
+	    run->valuestring, dc->id);
+	// a scenario this agent cannot run is reported as an empty result
+	msg = dist_publish_msg(topic, out != NULL ? out : "{}",
+	    out != NULL ? strlen(out) : 2, false);
+	if (nng_sendmsg(dc->sock, msg, 0) != 0) {
+		fprintf(stderr, "Agent: result of run %s not sent\n",
+		    run->valuestring);
+		nng_msg_free(msg);
+	}
+	cJSON_free(out);
+	nng_free(res, sizeof(*res));
+	cJSON_Delete(root);
+	return rv;
+}
+
+int
+nnb_agent_start(int argc, char **argv)
+{
+	dist_conn   dc = { 0 };
+	char        id[NNB_DIST_ID_LEN];
+	char        client_id[NNB_DIST_ID_LEN + 16];
+	nng_msg    *msg;
+	const char *payload;
+	uint32_t    len;
+	int         rv;
+
+	dist_opt_parse(argc, argv, agent_info);
+	if (dist_.id != NULL) {
+		snprintf(id, sizeof(id), "%s", dist_.id);
+	} else {
+		snprintf(id, sizeof(id), "%08x", nng_random());
+	}
+	snprintf(client_id, sizeof(client_id), "nnb-agent-%s", id);
+	snprintf(dc.presence, sizeof(dc.presence), NNB_DIST_AGENTS "%s", id);
+	dc.id      = id;
+	dc.subs[0] = NNB_DIST_RUN;
+	dc.nsubs   = 1;
+	dist_open(&dc, client_id);
+	printf("Agent %s waiting for runs on %s:%d\n", id, dist_.host,
+	    dist_.port);
+	fflush(stdout);
+
+	for (;;) {
+		if ((rv = dist_recv(&dc, &msg)) == NNG_ETIMEDOUT) {
+			continue;
+		} else if (rv != 0) {
+			nng_fatal("nng_recvmsg", rv);
+		}
+		if (dist_topic_rest(msg, NNB_DIST_RUN, &len) != NULL &&
+		    len == 0) {
+			payload = (const char *) nng_mqtt_msg_get_publish_payload(
+			    msg, &len);
+			rv = agent_run(&dc, payload, len);
+		}
+		nng_msg_free(msg);
+		// SIGINT ended the run and ends the agent
+		if (rv == NNG_EINTR) {
+			break;
+		}
+	}
+
+	msg = dist_publish_msg(dc.presence, "", 0, true);
+	if (nng_sendmsg(dc.sock, msg, 0) != 0) {
+		nng_msg_free(msg);
+	}
+	nng_close(dc.sock);
+	return 0;
+}
+
+// Waits for dist_.agents agents to be there, the run goes to all of them.
+static size_t
+coordinator_agents(dist_conn *dc, dist_ids *agents)
+{
+	nng_time    deadline = nng_clock() + (nng_time) dist_.wait * 1000;
+	nng_msg    *msg;
+	const char *id;
+	uint32_t    len, plen;
+	int         rv;
+
+	while (agents->n < (size_t) dist_.agents) {
+		if (nng_clock() >= deadline) {
+			fprintf(stderr, "Coordinator: %zu of %d agents after %ds\n",
+			    agents->n, dist_.agents, dist_.wait);
+			exit(EXIT_FAILURE);
+		}
+		if ((rv = dist_recv(dc, &msg)) == NNG_ETIMEDOUT) {
+			continue;
+		} else if (rv != 0) {
+			nng_fatal("nng_recvmsg", rv);
+		}
+		if ((id = dist_topic_rest(msg, NNB_DIST_AGENTS, &len)) != NULL &&
+		    len > 0) {
+			nng_mqtt_msg_get_publish_payload(msg, &plen);
+			if (plen == 0) {
+				dist_ids_del(agents, id, len);
+			} else if (dist_ids_add(agents, id, len)) {
+				printf("Agent %.*s is there\n", (int) len, id);
+			}
+		}
+		nng_msg_free(msg);
+	}
+	return agents->n;
+}
+
+int
+nnb_coordinator_start(int argc, char **argv)
+{
+	dist_conn    dc = { 0 };
+	nnb_scenario sc;
+	nnb_result  *total, *res;
+	dist_ids    *agents, *done;
+	char         run[16];
+	char         client_id[32];
+	char         results[NNB_DIST_TOPIC_LEN];
+	char        *data, *text, *json;
+	cJSON       *root;
+	nng_msg     *msg;
+	nng_time     deadline;
+	uint64_t     start_ms;
+	const char  *id, *payload;
+	uint32_t     len, plen;
+	size_t       size;
+	int          rv;
+
+	dist_opt_parse(argc, argv, coordinator_info);
+	if (dist_.file == NULL) {
+		fprintf(stderr, "Usage: %s\n", coordinator_info);
+		exit(EXIT_FAILURE);
+	}
+	if ((rv = nng_file_get(dist_.file, (void **) &data, &size)) != 0) {
+		fprintf(stderr, "Coordinator: cannot read %s: %s\n", dist_.file,
+		    nng_strerror(rv));
+		exit(EXIT_FAILURE);
+	}
+	// parsed here only to fail before the agents do
+	if ((text = nng_alloc(size + 1)) == NULL) {
+		nng_fatal("nng_alloc", NNG_ENOMEM);
+	}
+	memcpy(text, data, size);
+	text[size] = '\0';
+	rv         = nnb_scenario_parse(data, size, &sc);
+	nng_free(data, size);
+	if (rv != 0) {
+		exit(EXIT_FAILURE);
+	}
+	if (sc.duration == 0) {
+		fprintf(stderr, "Coordinator: the scenario needs a duration\n");
+		exit(EXIT_FAILURE);
+	}
+
+	agents = nng_zalloc(sizeof(*agents));
+	done   = nng_zalloc(sizeof(*done));
+	total  = nng_zalloc(sizeof(*total));
+	res    = nng_alloc(sizeof(*res));
+	if (agents == NULL || done == NULL || total == NULL || res == NULL) {
+		nng_fatal("nng_alloc", NNG_ENOMEM);
+	}
+	snprintf(run, sizeof(run), "%08x", nng_random());
+	snprintf(client_id, sizeof(client_id), "nnb-coordinator-%s", run);
+	snprintf(results, sizeof(results), NNB_DIST_RESULTS "%s/+", run);
+	dc.subs[0] = NNB_DIST_AGENTS "+";
+	dc.subs[1] = results;
+	dc.nsubs   = 2;
+	dist_open(&dc, client_id);
+	coordinator_agents(&dc, agents);
+
+	start_ms = lat_now_us() / 1000 + (uint64_t) dist_.lead * 1000;
+	root     = cJSON_CreateObject();
+	cJSON_AddStringToObject(root, "run", run);
+	cJSON_AddNumberToObject(root, "start_at", (double) start_ms);
+	cJSON_AddStringToObject(root, "scenario", text);
+	json = cJSON_PrintUnformatted(root);
+	cJSON_Delete(root);
+	msg = dist_publish_msg(NNB_DIST_RUN, json, strlen(json), false);
+	if ((rv = nng_sendmsg(dc.sock, msg, 0)) != 0) {
+		nng_fatal("nng_sendmsg", rv);
+	}
+	cJSON_free(json);
+	printf("Run %s on %zu agents starts in %ds for %ds\n", run, agents->n,
+	    dist_.lead, sc.duration);
+	fflush(stdout);
+
+	deadline = nng_clock() +
+	    (nng_time) (dist_.lead + sc.duration + dist_.wait) * 1000;
+	snprintf(results, sizeof(results), NNB_DIST_RESULTS "%s/", run);
+	while (done->n < agents->n && nng_clock() < deadline) {
+		if ((rv = dist_recv(&dc, &msg)) == NNG_ETIMEDOUT) {
+			continue;
+		} else if (rv != 0) {
+			nng_fatal("nng_recvmsg", rv);
+		}
+		// a redelivered result is only counted once
+		if ((id = dist_topic_rest(msg, results, &len)) != NULL &&
+		    dist_ids_add(done, id, len)) {
+			payload = (const char *) nng_mqtt_msg_get_publish_payload(
+			    msg, &plen);
+			if (nnb_result_decode(payload, plen, res) == 0 &&
+			    res->ngroups > 0) {
+				nnb_result_merge(total, res);
+				printf("Agent %.*s done\n", (int) len, id);
+			} else {
+				fprintf(stderr, "Agent %.*s could not run it\n",
+				    (int) len, id);
+			}
+		}
+		nng_msg_free(msg);
+	}
+	if (done->n < agents->n) {
+		fprintf(stderr, "Coordinator: %zu of %zu agents reported\n",
+		    done->n, agents->n);
+	}
+	nnb_report_summary(total);
+
+	nng_close(dc.sock);
+	nnb_scenario_free(&sc);
+	nng_free(text, size + 1);
+	nng_free(agents, sizeof(*agents));
+	nng_free(done, sizeof(*done));
+	nng_free(total, sizeof(*total));
+	nng_free(res, sizeof(*res));
+	return 0;
+}
+
+#endif
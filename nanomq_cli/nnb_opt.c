@@ -46,6 +46,61 @@ destory_tls(tls_opt *tls)
 	}
 }
 
+// --transport tcp | tls | ws | wss | quic
+static int
+transport_set(const char *arg, nnb_transport *tp, tls_opt *tls)
+{
+	if (!strcmp(arg, "tcp")) {
+		*tp = NNB_TCP;
+	} else if (!strcmp(arg, "tls")) {
+		*tp         = NNB_TCP;
+		tls->enable = true;
+	} else if (!strcmp(arg, "ws")) {
+		*tp = NNB_WS;
+	} else if (!strcmp(arg, "wss")) {
+		*tp         = NNB_WS;
+		tls->enable = true;
+	} else if (!strcmp(arg, "quic")) {
+		*tp = NNB_QUIC;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+// The port of the transport if -p is not given, and what it can not take.
+static void
+transport_check(nnb_transport tp, const tls_opt *tls, int *port,
+    const char *ifaddr, const char *usage)
+{
+	if (*port == 0) {
+		switch (tp) {
+		case NNB_WS:
+			*port = tls->enable ? 8084 : 8083;
+			break;
+		case NNB_QUIC:
+			*port = 14567;
+			break;
+		default:
+			*port = 1883;
+			break;
+		}
+	}
+	if (tp == NNB_QUIC && ifaddr != NULL) {
+		fprintf(stderr, "Error: --ifaddr is not supported by quic\n");
+		fprintf(stderr, "Usage: %s\n", usage);
+		exit(EXIT_FAILURE);
+	}
+#if !defined(SUPP_QUIC)
+	if (tp == NNB_QUIC) {
+		fprintf(stderr,
+		    "Error: nanomq_cli is built without quic, enable "
+		    "NNG_ENABLE_QUIC=ON in cmake first\n");
+		exit(EXIT_FAILURE);
+	}
+#endif
+}
+
 nnb_conn_opt *
 nnb_conn_opt_init(int argc, char **argv)
 {
@@ -55,7 +110,7 @@ nnb_conn_opt_init(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
-	opt->port        = 1883;
+	opt->port        = 0; // of the transport
 	opt->version     = 4;
 	opt->count       = 200;
 	opt->startnumber = 0;
@@ -65,9 +120,13 @@ nnb_conn_opt_init(int argc, char **argv)
 	opt->username    = NULL;
 	opt->password    = NULL;
 	opt->host        = NULL;
+	opt->transport   = NNB_TCP;
+	opt->ifaddr      = NULL;
 
 	init_tls(&opt->tls);
 	conn_opt_set(argc - 2, argv + 2, opt);
+	transport_check(opt->transport, &opt->tls, &opt->port, opt->ifaddr,
+	    conn_info);
 	if (opt->host == NULL) {
 		opt->host = nng_strdup("localhost");
 	}
@@ -97,6 +156,11 @@ nnb_conn_opt_destory(nnb_conn_opt *opt)
 			opt->password = NULL;
 		}
 
+		if (opt->ifaddr) {
+			nng_strfree(opt->ifaddr);
+			opt->ifaddr = NULL;
+		}
+
 		destory_tls(&opt->tls);
 
 		nng_free(opt, sizeof(nnb_conn_opt));
@@ -113,7 +177,7 @@ nnb_pub_opt_init(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
-	opt->port            = 1883;
+	opt->port            = 0; // of the transport
 	opt->version         = 4;
 	opt->count           = 200;
 	opt->size            = 256;
@@ -122,8 +186,11 @@ nnb_pub_opt_init(int argc, char **argv)
 	opt->interval        = 10;
 	opt->keepalive       = 300;
 	opt->interval_of_msg = 1000;
+	opt->rate            = 0;
+	opt->poisson         = false;
 	opt->retain          = false;
 	opt->clean           = true;
+	opt->latency         = false;
 	opt->username        = NULL;
 	opt->password        = NULL;
 	opt->host            = NULL;
@@ -133,10 +200,17 @@ nnb_pub_opt_init(int argc, char **argv)
 	opt->tls.cert        = NULL;
 	opt->tls.key         = NULL;
 	opt->tls.keypass     = NULL;
+	opt->transport       = NNB_TCP;
+	opt->ifaddr          = NULL;
 
 	init_tls(&opt->tls);
 
 	pub_opt_set(argc - 2, argv + 2, opt);
+	transport_check(opt->transport, &opt->tls, &opt->port, opt->ifaddr,
+	    pub_info);
+	if (opt->latency && opt->size < NNB_STAMP_LEN) {
+		opt->size = NNB_STAMP_LEN;
+	}
 	if (opt->host == NULL) {
 		opt->host = nng_strdup("localhost");
 	}
@@ -171,6 +245,11 @@ nnb_pub_opt_destory(nnb_pub_opt *opt)
 			opt->topic = NULL;
 		}
 
+		if (opt->ifaddr) {
+			nng_strfree(opt->ifaddr);
+			opt->ifaddr = NULL;
+		}
+
 		destory_tls(&opt->tls);
 		nng_free(opt, sizeof(nnb_pub_opt));
 		opt = NULL;
@@ -186,22 +265,28 @@ nnb_sub_opt_init(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
-	opt->port        = 1883;
+	opt->port        = 0; // of the transport
 	opt->version     = 4;
 	opt->count       = 200;
 	opt->startnumber = 0;
 	opt->interval    = 10;
 	opt->keepalive   = 300;
 	opt->qos         = 0;
+	opt->duration    = 0;
 	opt->clean       = true;
+	opt->latency     = false;
 	opt->username    = NULL;
 	opt->password    = NULL;
 	opt->host        = NULL;
 	opt->topic       = NULL;
+	opt->transport   = NNB_TCP;
+	opt->ifaddr      = NULL;
 
 	init_tls(&opt->tls);
 
 	sub_opt_set(argc - 2, argv + 2, opt);
+	transport_check(opt->transport, &opt->tls, &opt->port, opt->ifaddr,
+	    sub_info);
 	if (opt->topic == NULL) {
 		fprintf(stderr, "Error: topic required!\n");
 		fprintf(stderr, "Usage: %s\n", sub_info);
@@ -236,6 +321,11 @@ nnb_sub_opt_destory(nnb_sub_opt *opt)
 			opt->password = NULL;
 		}
 
+		if (opt->ifaddr) {
+			nng_strfree(opt->ifaddr);
+			opt->ifaddr = NULL;
+		}
+
 		destory_tls(&opt->tls);
 		nng_free(opt, sizeof(nnb_sub_opt));
 		opt = NULL;
@@ -355,6 +445,19 @@ conn_opt_set(int argc, char **argv, nnb_conn_opt *opt)
 			               "keepalive")) {
 				opt->keepalive = atoi(optarg);
 			} else if (!strcmp(long_options[option_index].name,
+			               "transport")) {
+				if (transport_set(optarg, &opt->transport,
+				        &opt->tls) != 0) {
+					fprintf(
+					    stderr, "Usage: %s\n", conn_info);
+					exit(EXIT_FAILURE);
+				}
+			} else if (!strcmp(long_options[option_index].name,
+			               "ifaddr")) {
+				if (opt->ifaddr) {
+					nng_strfree(opt->ifaddr);
+				}
+				opt->ifaddr = nng_strdup(optarg);			} else if (!strcmp(long_options[option_index].name,
 			               "ssl")) {
 				opt->tls.enable = true;
 			} else if (!strcmp(long_options[option_index].name,
@@ -562,6 +665,36 @@ pub_opt_set(int argc, char **argv, nnb_pub_opt *opt)
 			               "interval_of_msg")) {
 				opt->interval_of_msg = atoi(optarg);
 			} else if (!strcmp(long_options[option_index].name,
+			               "latency")) {
+				opt->latency = true;
+			} else if (!strcmp(long_options[option_index].name,
+			               "rate")) {
+				opt->rate = atoi(optarg);
+			} else if (!strcmp(long_options[option_index].name,
+			               "arrival")) {
+				if (!strcmp(optarg, "poisson")) {
+					opt->poisson = true;
+				} else if (!strcmp(optarg, "constant")) {
+					opt->poisson = false;
+				} else {
+					fprintf(
+					    stderr, "Usage: %s\n", pub_info);
+					exit(EXIT_FAILURE);
+				}
+			} else if (!strcmp(long_options[option_index].name,
+			               "transport")) {
+				if (transport_set(optarg, &opt->transport,
+				        &opt->tls) != 0) {
+					fprintf(
+					    stderr, "Usage: %s\n", pub_info);
+					exit(EXIT_FAILURE);
+				}
+			} else if (!strcmp(long_options[option_index].name,
+			               "ifaddr")) {
+				if (opt->ifaddr) {
+					nng_strfree(opt->ifaddr);
+				}
+				opt->ifaddr = nng_strdup(optarg);			} else if (!strcmp(long_options[option_index].name,
 			               "ssl")) {
 				opt->tls.enable = true;
 			} else if (!strcmp(long_options[option_index].name,
@@ -780,6 +913,25 @@ sub_opt_set(int argc, char **argv, nnb_sub_opt *opt)
 					exit(EXIT_FAILURE);
 				}
 			} else if (!strcmp(long_options[option_index].name,
+			               "latency")) {
+				opt->latency = true;
+			} else if (!strcmp(long_options[option_index].name,
+			               "duration")) {
+				opt->duration = atoi(optarg);
+			} else if (!strcmp(long_options[option_index].name,
+			               "transport")) {
+				if (transport_set(optarg, &opt->transport,
+				        &opt->tls) != 0) {
+					fprintf(
+					    stderr, "Usage: %s\n", sub_info);
+					exit(EXIT_FAILURE);
+				}
+			} else if (!strcmp(long_options[option_index].name,
+			               "ifaddr")) {
+				if (opt->ifaddr) {
+					nng_strfree(opt->ifaddr);
+				}
+				opt->ifaddr = nng_strdup(optarg);			} else if (!strcmp(long_options[option_index].name,
 			               "ssl")) {
 				opt->tls.enable = true;
 			} else if (!strcmp(long_options[option_index].name,
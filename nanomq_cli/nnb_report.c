@@ -0,0 +1,670 @@
+//
+// Copyright 2024 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#if !defined(NANO_PLATFORM_WINDOWS) && defined(SUPP_BENCH)
+
+#include "include/nnb_report.h"
+#include "include/nnb_help.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nng/nng.h>
+#include <nng/supplemental/http/http.h>
+#include <nng/supplemental/util/platform.h>
+#include "nng/supplemental/nanolib/base64.h"
+#include "nng/supplemental/nanolib/cJSON.h"
+#include "nng/supplemental/nanolib/file.h"
+
+// Broker metrics kept of one poll.
+#ifndef NNB_METRICS
+#define NNB_METRICS 64
+#endif
+
+// ms a poll of the broker may take, it holds up the interval.
+#ifndef NNB_METRICS_TIMEOUT
+#define NNB_METRICS_TIMEOUT 500
+#endif
+
+typedef struct {
+	char   name[96];
+	double value;
+} nnb_metric;
+
+// The broker metrics a csv row has a column for.
+static const char *report_columns[] = {
+	"nanomq_connections_count",
+	"nanomq_sessions_count",
+	"nanomq_subscribers_count",
+	"nanomq_messages_received",
+	"nanomq_messages_sent",
+	"nanomq_messages_dropped",
+	"nanomq_memory_usage",
+	"nanomq_cpu_usage",
+};
+
+#define NNB_COLUMNS (sizeof(report_columns) / sizeof(report_columns[0]))
+
+static struct {
+	nnb_format format;
+	FILE      *out; // NULL for stdout
+	char      *url; // <api>/prometheus
+	char      *auth;
+	bool       header; // of the csv, once
+	bool       warned; // about a broker that does not answer
+	bool       polled; // metrics hold the last poll
+	nnb_metric metrics[NNB_METRICS];
+	size_t     nmetrics;
+} report_;
+
+static FILE *
+report_out(void)
+{
+	return report_.out != NULL ? report_.out : stdout;
+}
+
+static void
+report_usage(const char *what)
+{
+	fprintf(stderr, "Bench: %s\n", what);
+	exit(EXIT_FAILURE);
+}
+
+void
+nnb_report_args(int *argc, char **argv)
+{
+	int n = 0;
+
+	for (int i = 0; i < *argc; i++) {
+		const char *a = argv[i];
+		const char *v = i + 1 < *argc ? argv[i + 1] : NULL;
+		size_t      len;
+
+		if (strcmp(a, "--format") == 0 && v != NULL) {
+			if (strcmp(v, "text") == 0) {
+				report_.format = NNB_FORMAT_TEXT;
+			} else if (strcmp(v, "json") == 0) {
+				report_.format = NNB_FORMAT_JSON;
+			} else if (strcmp(v, "csv") == 0) {
+				report_.format = NNB_FORMAT_CSV;
+			} else {
+				report_usage("--format is text, json or csv");
+			}
+			i++;
+		} else if (strcmp(a, "--output") == 0 && v != NULL) {
+			if ((report_.out = fopen(v, "w")) == NULL) {
+				report_usage("--output cannot be written");
+			}
+			i++;
+		} else if (strcmp(a, "--metrics") == 0 && v != NULL) {
+			len = strlen(v);
+			while (len > 0 && v[len - 1] == '/') {
+				len--;
+			}
+			if ((report_.url = nng_alloc(len + 12)) == NULL) {
+				nng_fatal("nng_alloc", NNG_ENOMEM);
+			}
+			snprintf(report_.url, len + 12, "%.*s/prometheus",
+			    (int) len, v);
+			i++;
+		} else if (strcmp(a, "--metrics-auth") == 0 && v != NULL) {
+			len = strlen(v);
+			if ((report_.auth = nng_zalloc(
+			         BASE64_ENCODE_OUT_SIZE(len) + 7)) == NULL) {
+				nng_fatal("nng_alloc", NNG_ENOMEM);
+			}
+			memcpy(report_.auth, "Basic ", 6);
+			base64_encode((const uint8_t *) v, len, report_.auth + 6);
+			i++;
+		} else {
+			argv[n++] = argv[i];
+		}
+	}
+	argv[n] = NULL;
+	*argc   = n;
+}
+
+bool
+nnb_report_text(void)
+{
+	return report_.format == NNB_FORMAT_TEXT;
+}
+
+// GET on url, the body comes back NUL terminated in len + 1 bytes.
+static int
+report_http_get(const char *url_str, char **body, size_t *len)
+{
+	nng_http_client *client = NULL;
+	nng_http_conn   *conn   = NULL;
+	nng_url         *url    = NULL;
+	nng_aio         *aio    = NULL;
+	nng_http_req    *req    = NULL;
+	nng_http_res    *res    = NULL;
+	const char      *hdr;
+	nng_iov          iov;
+	int              rv;
+
+	*body = NULL;
+	if (((rv = nng_url_parse(&url, url_str)) != 0) ||
+	    ((rv = nng_http_client_alloc(&client, url)) != 0) ||
+	    ((rv = nng_http_req_alloc(&req, url)) != 0) ||
+	    ((rv = nng_http_res_alloc(&res)) != 0) ||
+	    ((rv = nng_aio_alloc(&aio, NULL, NULL)) != 0)) {
+		goto out;
+	}
+	nng_aio_set_timeout(aio, NNB_METRICS_TIMEOUT);
+	nng_http_client_connect(client, aio);
+	nng_aio_wait(aio);
+	if ((rv = nng_aio_result(aio)) != 0) {
+		goto out;
+	}
+	conn = nng_aio_get_output(aio, 0);
+
+	if (report_.auth != NULL) {
+		nng_http_req_add_header(req, "Authorization", report_.auth);
+	}
+	nng_http_conn_write_req(conn, req, aio);
+	nng_aio_wait(aio);
+	if ((rv = nng_aio_result(aio)) != 0) {
+		goto out;
+	}
+	nng_http_conn_read_res(conn, res, aio);
+	nng_aio_wait(aio);
+	if ((rv = nng_aio_result(aio)) != 0) {
+		goto out;
+	}
+	// the REST API answers with a Content-Length, never chunked
+	if (nng_http_res_get_status(res) != NNG_HTTP_STATUS_OK ||
+	    (hdr = nng_http_res_get_header(res, "Content-Length")) == NULL ||
+	    (*len = strtoul(hdr, NULL, 10)) == 0) {
+		rv = NNG_EPROTO;
+		goto out;
+	}
+	if ((*body = nng_alloc(*len + 1)) == NULL) {
+		rv = NNG_ENOMEM;
+		goto out;
+	}
+	iov.iov_len = *len;
+	iov.iov_buf = *body;
+	nng_aio_set_iov(aio, 1, &iov);
+	nng_http_conn_read_all(conn, aio);
+	nng_aio_wait(aio);
+	if ((rv = nng_aio_result(aio)) != 0) {
+		nng_free(*body, *len + 1);
+		*body = NULL;
+		goto out;
+	}
+	(*body)[*len] = '\0';
+
+out:
+	if (url) {
+		nng_url_free(url);
+	}
+	if (conn) {
+		nng_http_conn_close(conn);
+	}
+	if (client) {
+		nng_http_client_free(client);
+	}
+	if (req) {
+		nng_http_req_free(req);
+	}
+	if (res) {
+		nng_http_res_free(res);
+	}
+	if (aio) {
+		nng_aio_free(aio);
+	}
+	return rv;
+}
+
+// Every "name value" sample of the prometheus text, labels in the name.
+static void
+report_poll(void)
+{
+	char  *body, *line, *save;
+	size_t len;
+	int    rv;
+
+	report_.polled = false;
+	if (report_.url == NULL) {
+		return;
+	}
+	if ((rv = report_http_get(report_.url, &body, &len)) != 0) {
+		if (!report_.warned) {
+			fprintf(stderr, "Bench: no metrics from %s: %s\n",
+			    report_.url, nng_strerror(rv));
+			report_.warned = true;
+		}
+		return;
+	}
+	report_.nmetrics = 0;
+	for (line = strtok_r(body, "\n", &save);
+	     line != NULL && report_.nmetrics < NNB_METRICS;
+	     line = strtok_r(NULL, "\n", &save)) {
+		nnb_metric *m;
+		char       *sp;
+
+		if (line[0] == '#' || (sp = strrchr(line, ' ')) == NULL) {
+			continue;
+		}
+		m = &report_.metrics[report_.nmetrics++];
+		snprintf(m->name, sizeof(m->name), "%.*s", (int) (sp - line),
+		    line);
+		m->value = strtod(sp + 1, NULL);
+	}
+	nng_free(body, len + 1);
+	report_.polled = true;
+}
+
+static double
+report_metric(const char *name)
+{
+	for (size_t i = 0; i < report_.nmetrics; i++) {
+		if (strcmp(report_.metrics[i].name, name) == 0) {
+			return report_.metrics[i].value;
+		}
+	}
+	return 0;
+}
+
+static void
+report_broker_text(void)
+{
+	if (!report_.polled) {
+		return;
+	}
+	// beside the text of the mode, which is on stdout
+	printf("broker: connections=%.0f, received=%.0f, sent=%.0f, "
+	    "dropped=%.0f, memory=%.0f, cpu=%.2f%%\n",
+	    report_metric("nanomq_connections_count"),
+	    report_metric("nanomq_messages_received"),
+	    report_metric("nanomq_messages_sent"),
+	    report_metric("nanomq_messages_dropped"),
+	    report_metric("nanomq_memory_usage"),
+	    report_metric("nanomq_cpu_usage"));
+}
+
+static void
+report_csv_header(void)
+{
+	FILE *f = report_out();
+
+	if (report_.header) {
+		return;
+	}
+	report_.header = true;
+	fprintf(f,
+	    "type,elapsed,group,connected,connects,disconnects,sent,"
+	    "sent_rate,recv,recv_rate,errors,p50,p90,p99,p999,max");
+	for (size_t i = 0; i < NNB_COLUMNS; i++) {
+		fprintf(f, ",%s", report_columns[i]);
+	}
+	fprintf(f, "\n");
+}
+
+// A group name is free text, quoted where csv needs it.
+static void
+report_csv_name(FILE *f, const char *name)
+{
+	if (strpbrk(name, ",\"\n") == NULL) {
+		fputs(name, f);
+		return;
+	}
+	fputc('"', f);
+	for (const char *p = name; *p != '\0'; p++) {
+		if (*p == '"') {
+			fputc('"', f);
+		}
+		fputc(*p, f);
+	}
+	fputc('"', f);
+}
+
+static void
+report_csv_row(const char *type, uint64_t elapsed, const nnb_group_result *g,
+    uint64_t sent_rate, uint64_t recv_rate, bool latency)
+{
+	static const double pcts[] = { 50, 90, 99, 99.9 };
+	uint64_t            v[4];
+	FILE               *f = report_out();
+
+	fprintf(f, "%s,%llu,", type, (unsigned long long) elapsed);
+	report_csv_name(f, g->name);
+	fprintf(f, ",%d,%llu,%llu,%llu,%llu,%llu,%llu,%llu", g->connected,
+	    (unsigned long long) g->connects,
+	    (unsigned long long) g->disconnects,
+	    (unsigned long long) g->sent, (unsigned long long) sent_rate,
+	    (unsigned long long) g->recv, (unsigned long long) recv_rate,
+	    (unsigned long long) g->errors);
+	if (latency && g->latency.total > 0) {
+		lat_hist_percentiles(&g->latency, pcts, v, 4);
+		fprintf(f, ",%llu,%llu,%llu,%llu,%llu",
+		    (unsigned long long) v[0], (unsigned long long) v[1],
+		    (unsigned long long) v[2], (unsigned long long) v[3],
+		    (unsigned long long) g->latency.max);
+	} else {
+		fprintf(f, ",,,,,");
+	}
+	for (size_t i = 0; i < NNB_COLUMNS; i++) {
+		if (report_.polled) {
+			fprintf(f, ",%g", report_metric(report_columns[i]));
+		} else {
+			fprintf(f, ",");
+		}
+	}
+	fprintf(f, "\n");
+}
+
+static cJSON *
+report_json_group(const nnb_group_result *g, uint64_t sent_rate,
+    uint64_t recv_rate, bool latency)
+{
+	static const double pcts[] = { 50, 90, 99, 99.9 };
+	uint64_t            v[4];
+	cJSON              *obj = cJSON_CreateObject();
+	cJSON              *lat;
+
+	cJSON_AddStringToObject(obj, "name", g->name);
+	cJSON_AddNumberToObject(obj, "connected", g->connected);
+	cJSON_AddNumberToObject(obj, "connects", (double) g->connects);
+	cJSON_AddNumberToObject(obj, "disconnects", (double) g->disconnects);
+	cJSON_AddNumberToObject(obj, "sent", (double) g->sent);
+	cJSON_AddNumberToObject(obj, "sent_rate", (double) sent_rate);
+	cJSON_AddNumberToObject(obj, "recv", (double) g->recv);
+	cJSON_AddNumberToObject(obj, "recv_rate", (double) recv_rate);
+	cJSON_AddNumberToObject(obj, "errors", (double) g->errors);
+	if (latency && g->latency.total > 0) {
+		lat_hist_percentiles(&g->latency, pcts, v, 4);
+		lat = cJSON_CreateObject();
+		cJSON_AddNumberToObject(lat, "count", (double) g->latency.total);
+		cJSON_AddNumberToObject(lat, "p50", (double) v[0]);
+		cJSON_AddNumberToObject(lat, "p90", (double) v[1]);
+		cJSON_AddNumberToObject(lat, "p99", (double) v[2]);
+		cJSON_AddNumberToObject(lat, "p999", (double) v[3]);
+		cJSON_AddNumberToObject(lat, "max", (double) g->latency.max);
+		cJSON_AddItemToObject(obj, "latency", lat);
+	}
+	return obj;
+}
+
+static void
+report_json_print(cJSON *root)
+{
+	char *json;
+
+	if (report_.polled) {
+		cJSON *broker = cJSON_CreateObject();
+
+		for (size_t i = 0; i < report_.nmetrics; i++) {
+			cJSON_AddNumberToObject(broker,
+			    report_.metrics[i].name, report_.metrics[i].value);
+		}
+		cJSON_AddItemToObject(root, "broker", broker);
+	}
+	json = cJSON_PrintUnformatted(root);
+	fprintf(report_out(), "%s\n", json);
+	cJSON_free(json);
+	cJSON_Delete(root);
+}
+
+static uint64_t
+report_rate(uint64_t now, uint64_t prev, uint64_t period)
+{
+	return now > prev && period > 0 ? (now - prev) * 1000 / period : 0;
+}
+
+void
+nnb_report_interval(
+    const nnb_result *now, const nnb_result *prev, uint64_t period)
+{
+	cJSON *root   = NULL;
+	cJSON *groups = NULL;
+
+	report_poll();
+	if (report_.format == NNB_FORMAT_TEXT) {
+		report_broker_text();
+		fflush(stdout);
+		return;
+	}
+	if (report_.format == NNB_FORMAT_CSV) {
+		report_csv_header();
+	} else {
+		root = cJSON_CreateObject();
+		cJSON_AddStringToObject(root, "type", "interval");
+		cJSON_AddNumberToObject(root, "elapsed", (double) now->elapsed);
+		cJSON_AddNumberToObject(root, "period", (double) period);
+		groups = cJSON_AddArrayToObject(root, "groups");
+	}
+	for (size_t i = 0; i < now->ngroups; i++) {
+		const nnb_group_result *g = &now->groups[i];
+		const nnb_group_result *p =
+		    i < prev->ngroups ? &prev->groups[i] : NULL;
+		uint64_t sent_rate =
+		    report_rate(g->sent, p != NULL ? p->sent : 0, period);
+		uint64_t recv_rate =
+		    report_rate(g->recv, p != NULL ? p->recv : 0, period);
+
+		if (root == NULL) {
+			report_csv_row("interval", now->elapsed, g, sent_rate,
+			    recv_rate, false);
+		} else {
+			cJSON_AddItemToArray(groups,
+			    report_json_group(g, sent_rate, recv_rate, false));
+		}
+	}
+	if (root != NULL) {
+		report_json_print(root);
+	}
+	fflush(report_out());
+}
+
+void
+nnb_report_summary(const nnb_result *res)
+{
+	cJSON *root   = NULL;
+	cJSON *groups = NULL;
+
+	report_poll();
+	if (report_.format == NNB_FORMAT_TEXT) {
+		nnb_result_print(res);
+		report_broker_text();
+		fflush(stdout);
+		return;
+	}
+	if (report_.format == NNB_FORMAT_CSV) {
+		report_csv_header();
+	} else {
+		root = cJSON_CreateObject();
+		cJSON_AddStringToObject(root, "type", "summary");
+		cJSON_AddNumberToObject(root, "elapsed", (double) res->elapsed);
+		cJSON_AddNumberToObject(root, "agents", res->agents);
+		groups = cJSON_AddArrayToObject(root, "groups");
+	}
+	for (size_t i = 0; i < res->ngroups; i++) {
+		const nnb_group_result *g = &res->groups[i];
+		uint64_t sent_rate = report_rate(g->sent, 0, res->elapsed);
+		uint64_t recv_rate = report_rate(g->recv, 0, res->elapsed);
+
+		if (root == NULL) {
+			report_csv_row("summary", res->elapsed, g, sent_rate,
+			    recv_rate, true);
+		} else {
+			cJSON_AddItemToArray(groups,
+			    report_json_group(g, sent_rate, recv_rate, true));
+		}
+	}
+	if (root != NULL) {
+		report_json_print(root);
+	}
+	fflush(report_out());
+}
+
+// The last summary of a --format json output.
+static cJSON *
+compare_load(const char *path)
+{
+	cJSON *summary = NULL;
+	char  *data;
+	size_t size;
+	int    rv;
+
+	if ((rv = nng_file_get(path, (void **) &data, &size)) != 0) {
+		fprintf(stderr, "Compare: cannot read %s: %s\n", path,
+		    nng_strerror(rv));
+		return NULL;
+	}
+	for (size_t off = 0; off < size;) {
+		char  *nl  = memchr(data + off, '\n', size - off);
+		size_t len = nl != NULL ? (size_t) (nl - data) - off : size - off;
+		cJSON *obj = len > 0 ? cJSON_ParseWithLength(data + off, len)
+		                     : NULL;
+		cJSON *type = cJSON_GetObjectItem(obj, "type");
+
+		if (cJSON_IsString(type) &&
+		    strcmp(type->valuestring, "summary") == 0) {
+			cJSON_Delete(summary);
+			summary = obj;
+		} else {
+			cJSON_Delete(obj);
+		}
+		off += len + 1;
+	}
+	nng_free(data, size);
+	if (summary == NULL) {
+		fprintf(stderr, "Compare: no summary in %s\n", path);
+	}
+	return summary;
+}
+
+static cJSON *
+compare_group(cJSON *summary, const char *name)
+{
+	cJSON *g;
+
+	cJSON_ArrayForEach(g, cJSON_GetObjectItem(summary, "groups"))
+	{
+		cJSON *n = cJSON_GetObjectItem(g, "name");
+
+		if (cJSON_IsString(n) && strcmp(n->valuestring, name) == 0) {
+			return g;
+		}
+	}
+	return NULL;
+}
+
+static double
+compare_value(cJSON *group, const char *key)
+{
+	cJSON *obj = group;
+	cJSON *item;
+
+	if (strncmp(key, "latency.", 8) == 0) {
+		obj = cJSON_GetObjectItem(group, "latency");
+		key += 8;
+	}
+	item = cJSON_GetObjectItem(obj, key);
+	return cJSON_IsNumber(item) ? item->valuedouble : 0;
+}
+
+int
+nnb_compare_start(int argc, char **argv)
+{
+	static const struct {
+		const char *key;
+		bool        lower_worse;
+	} metrics[] = {
+		{ "sent_rate", true },
+		{ "recv_rate", true },
+		{ "latency.p50", false },
+		{ "latency.p99", false },
+		{ "latency.p999", false },
+	};
+	const char *files[2];
+	int         nfiles      = 0;
+	double      throughput  = 5;
+	double      latency     = 10;
+	int         regressions = 0;
+	cJSON      *base, *next, *g;
+
+	for (int i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "--throughput") == 0 && i + 1 < argc) {
+			throughput = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+			latency = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--help") != 0 && argv[i][0] != '-' &&
+		    nfiles < 2) {
+			files[nfiles++] = argv[i];
+		} else {
+			nfiles = -1;
+			break;
+		}
+	}
+	if (nfiles != 2) {
+		fprintf(stderr, "Usage: %s\n", compare_info);
+		return 2;
+	}
+	if ((base = compare_load(files[0])) == NULL) {
+		return 2;
+	}
+	if ((next = compare_load(files[1])) == NULL) {
+		cJSON_Delete(base);
+		return 2;
+	}
+
+	printf("%-24s %-14s %14s %14s %9s\n", "group", "metric", "base",
+	    "new", "change");
+	cJSON_ArrayForEach(g, cJSON_GetObjectItem(base, "groups"))
+	{
+		cJSON      *name = cJSON_GetObjectItem(g, "name");
+		cJSON      *n;
+		const char *s;
+
+		if (!cJSON_IsString(name)) {
+			continue;
+		}
+		s = name->valuestring;
+		if ((n = compare_group(next, s)) == NULL) {
+			printf("%-24s missing in %s  REGRESSION\n", s, files[1]);
+			regressions++;
+			continue;
+		}
+		for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]);
+		     i++) {
+			double b = compare_value(g, metrics[i].key);
+			double v = compare_value(n, metrics[i].key);
+			double change;
+			bool   bad;
+
+			// nothing to hold the new run against
+			if (b <= 0) {
+				continue;
+			}
+			change = (v - b) * 100 / b;
+			bad    = metrics[i].lower_worse ? change < -throughput
+			                                : change > latency;
+			printf("%-24s %-14s %14.0f %14.0f %+8.1f%%%s\n", s,
+			    metrics[i].key, b, v, change,
+			    bad ? "  REGRESSION" : "");
+			regressions += bad;
+		}
+	}
+	cJSON_Delete(base);
+	cJSON_Delete(next);
+	if (regressions > 0) {
+		printf("%d regression(s), throughput -%g%%, latency +%g%% "
+		       "allowed\n",
+		    regressions, throughput, latency);
+		return 1;
+	}
+	return 0;
+}
+
+#endif
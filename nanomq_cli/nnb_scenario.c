@@ -0,0 +1,1006 @@
+//
+// Copyright 2024 NanoMQ Team, Inc. <jaylin@emqx.io>
+//
+// This software is supplied under the terms of the MIT License, a
+// copy of which should be located in the distribution where this
+// file was obtained (LICENSE.txt).  A copy of the license may also be
+// found online at https://opensource.org/licenses/MIT.
+//
+
+#if !defined(NANO_PLATFORM_WINDOWS) && defined(SUPP_BENCH)
+
+#include "include/nnb_scenario.h"
+#include "include/nnb_help.h"
+#include "include/nnb_report.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nng/mqtt/mqtt_client.h>
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+#include "nng/supplemental/nanolib/cJSON.h"
+#include "nng/supplemental/nanolib/file.h"
+#include "nng/supplemental/nanolib/hocon.h"
+
+// The clients are walked for ramps and reconnects this often.
+#ifndef NNB_TICK_MS
+#define NNB_TICK_MS 100
+#endif
+
+#define NNB_TOPIC_LEN 256
+
+// Publishes of 12 bytes or more start with it and the send time in us.
+#define NNB_SC_MAGIC 0x4e4e4253u // "NNBS"
+#define NNB_SC_STAMP_LEN 12
+
+typedef struct {
+	nng_atomic_int *connected;
+	nng_atomic_u64 *connects;
+	nng_atomic_u64 *disconnects;
+	nng_atomic_u64 *sent;
+	nng_atomic_u64 *recv;
+	nng_atomic_u64 *errors;
+	char           *payload; // size_max bytes every publish takes from
+	nng_mtx        *mtx;
+	lat_hist        latency; // under mtx
+} nnb_group_stats;
+
+typedef enum { SC_INIT, SC_WAIT, SC_SEND, SC_SUBSCRIBE, SC_RECV } sc_state;
+
+typedef struct {
+	nnb_group       *g;
+	nnb_group_stats *st;
+	uint32_t         index;
+	nng_socket       sock;
+	nng_ctx          ctx;
+	nng_aio         *aio; // pub and sub only
+	sc_state         state;
+	bool             open;
+	bool             done; // ramped down
+	nng_time         connect_at;
+	nng_time         down_at;      // 0 to the end
+	nng_time         reconnect_at; // 0 never
+	char             id[64];
+} nnb_client;
+
+static volatile sig_atomic_t sc_stop = 0;
+
+static int
+sc_int(cJSON *obj, const char *key, int *val, int min, int max)
+{
+	cJSON *item = cJSON_GetObjectItem(obj, key);
+
+	if (item == NULL) {
+		return 0;
+	}
+	if (!cJSON_IsNumber(item) || item->valuedouble < min ||
+	    item->valuedouble > max) {
+		fprintf(stderr, "Scenario: %s must be in [%d, %d]\n", key, min,
+		    max);
+		return NNG_EINVAL;
+	}
+	*val = item->valueint;
+	return 0;
+}
+
+static int
+sc_bool(cJSON *obj, const char *key, bool *val)
+{
+	cJSON *item = cJSON_GetObjectItem(obj, key);
+
+	if (item == NULL) {
+		return 0;
+	}
+	if (!cJSON_IsBool(item)) {
+		fprintf(stderr, "Scenario: %s must be true or false\n", key);
+		return NNG_EINVAL;
+	}
+	*val = cJSON_IsTrue(item);
+	return 0;
+}
+
+static int
+sc_str(cJSON *obj, const char *key, char **val)
+{
+	cJSON *item = cJSON_GetObjectItem(obj, key);
+
+	if (item == NULL) {
+		return 0;
+	}
+	if (!cJSON_IsString(item)) {
+		fprintf(stderr, "Scenario: %s must be a string\n", key);
+		return NNG_EINVAL;
+	}
+	nng_strfree(*val);
+	if ((*val = nng_strdup(item->valuestring)) == NULL) {
+		return NNG_ENOMEM;
+	}
+	return 0;
+}
+
+// size = 256 or size = { min = 16, max = 1024 }
+static int
+sc_size(cJSON *obj, nnb_group *g)
+{
+	cJSON *item = cJSON_GetObjectItem(obj, "size");
+	int    rv;
+
+	if (item != NULL && cJSON_IsObject(item)) {
+		if ((rv = sc_int(item, "min", &g->size_min, 0, 268435455)) !=
+		        0 ||
+		    (rv = sc_int(item, "max", &g->size_max, 0, 268435455)) !=
+		        0) {
+			return rv;
+		}
+	} else if ((rv = sc_int(obj, "size", &g->size_min, 0, 268435455)) ==
+	    0) {
+		g->size_max = g->size_min;
+	} else {
+		return rv;
+	}
+	if (g->size_min > g->size_max) {
+		fprintf(stderr, "Scenario: size min above max\n");
+		return NNG_EINVAL;
+	}
+	return 0;
+}
+
+static int
+sc_group_parse(cJSON *obj, nnb_group *g)
+{
+	char *behaviour = NULL;
+	int   rv;
+
+	g->behaviour = NNB_IDLE;
+	g->count     = 1;
+	g->keepalive = 300;
+	g->clean     = true;
+	g->random    = 1000;
+	g->interval  = 1000;
+	g->size_min  = 256;
+	g->size_max  = 256;
+	if ((rv = sc_str(obj, "name", &g->name)) != 0 ||
+	    (rv = sc_str(obj, "behaviour", &behaviour)) != 0 ||
+	    (rv = sc_int(obj, "count", &g->count, 1, 10000000)) != 0 ||
+	    (rv = sc_int(obj, "start", &g->start, 0, 86400)) != 0 ||
+	    (rv = sc_int(obj, "ramp_up", &g->ramp_up, 0, 86400)) != 0 ||
+	    (rv = sc_int(obj, "hold", &g->hold, 0, 86400)) != 0 ||
+	    (rv = sc_int(obj, "ramp_down", &g->ramp_down, 0, 86400)) != 0 ||
+	    (rv = sc_int(obj, "reconnect", &g->reconnect, 0, 86400)) != 0 ||
+	    (rv = sc_int(obj, "keepalive", &g->keepalive, 0, 65535)) != 0 ||
+	    (rv = sc_int(obj, "qos", &g->qos, 0, 2)) != 0 ||
+	    (rv = sc_bool(obj, "retain", &g->retain)) != 0 ||
+	    (rv = sc_bool(obj, "clean", &g->clean)) != 0 ||
+	    (rv = sc_str(obj, "topic", &g->topic)) != 0 ||
+	    (rv = sc_int(obj, "random", &g->random, 1, INT32_MAX)) != 0 ||
+	    (rv = sc_int(obj, "interval", &g->interval, 1, 86400000)) != 0 ||
+	    (rv = sc_size(obj, g)) != 0 ||
+	    (rv = sc_str(obj, "username", &g->username)) != 0 ||
+	    (rv = sc_str(obj, "password", &g->password)) != 0) {
+		nng_strfree(behaviour);
+		return rv;
+	}
+	if (behaviour == NULL || strcmp(behaviour, "idle") == 0) {
+		g->behaviour = NNB_IDLE;
+	} else if (strcmp(behaviour, "pub") == 0) {
+		g->behaviour = NNB_PUB;
+	} else if (strcmp(behaviour, "sub") == 0) {
+		g->behaviour = NNB_SUB;
+	} else {
+		fprintf(stderr, "Scenario: behaviour %s is not idle, pub or sub\n",
+		    behaviour);
+		rv = NNG_EINVAL;
+	}
+	nng_strfree(behaviour);
+	if (rv == 0 && g->name == NULL && (g->name = nng_strdup("group")) ==
+	        NULL) {
+		rv = NNG_ENOMEM;
+	}
+	if (rv == 0 && g->behaviour != NNB_IDLE && g->topic == NULL) {
+		fprintf(stderr, "Scenario: group %s needs a topic\n", g->name);
+		rv = NNG_EINVAL;
+	}
+	return rv;
+}
+
+int
+nnb_scenario_parse(char *text, size_t len, nnb_scenario *sc)
+{
+	cJSON *root = hocon_parse_str(text, len);
+	cJSON *groups;
+	cJSON *item;
+	int    rv;
+
+	memset(sc, 0, sizeof(*sc));
+	sc->port    = 1883;
+	sc->version = 4;
+	sc->report  = 10;
+	if (!cJSON_IsObject(root)) {
+		fprintf(stderr, "Scenario: not a hocon document\n");
+		cJSON_Delete(root);
+		return NNG_EINVAL;
+	}
+	if ((rv = sc_str(root, "host", &sc->host)) != 0 ||
+	    (rv = sc_int(root, "port", &sc->port, 1, 65535)) != 0 ||
+	    (rv = sc_int(root, "version", &sc->version, 3, 5)) != 0 ||
+	    (rv = sc_int(root, "duration", &sc->duration, 0, 604800)) != 0 ||
+	    (rv = sc_int(root, "report", &sc->report, 1, 3600)) != 0) {
+		goto out;
+	}
+	if (sc->version == 3) {
+		sc->version = 4;
+	}
+	groups = cJSON_GetObjectItem(root, "groups");
+	if (!cJSON_IsArray(groups) || cJSON_GetArraySize(groups) == 0) {
+		fprintf(stderr, "Scenario: groups must be a list of groups\n");
+		rv = NNG_EINVAL;
+		goto out;
+	}
+	cJSON_ArrayForEach(item, groups)
+	{
+		if (sc->ngroups == NNB_GROUPS) {
+			fprintf(stderr, "Scenario: more than %d groups\n",
+			    NNB_GROUPS);
+			rv = NNG_EINVAL;
+			goto out;
+		}
+		if ((rv = sc_group_parse(item, &sc->groups[sc->ngroups++])) !=
+		    0) {
+			goto out;
+		}
+	}
+	if (sc->host == NULL && (sc->host = nng_strdup("localhost")) == NULL) {
+		rv = NNG_ENOMEM;
+	}
+
+out:
+	cJSON_Delete(root);
+	if (rv != 0) {
+		nnb_scenario_free(sc);
+	}
+	return rv;
+}
+
+void
+nnb_scenario_free(nnb_scenario *sc)
+{
+	for (size_t i = 0; i < sc->ngroups; i++) {
+		nnb_group *g = &sc->groups[i];
+
+		nng_strfree(g->name);
+		nng_strfree(g->topic);
+		nng_strfree(g->username);
+		nng_strfree(g->password);
+	}
+	nng_strfree(sc->host);
+	memset(sc, 0, sizeof(*sc));
+}
+
+static nnb_scenario    sc_;
+static nnb_group_stats sc_stats[NNB_GROUPS];
+static nnb_client     *sc_clients;
+static size_t          sc_nclients;
+
+// The topic template of c, %r is new for every message.
+static void
+sc_topic(nnb_client *c, char *buf, size_t len)
+{
+	const char *t = c->g->topic;
+	size_t      n = 0;
+
+	while (*t != '\0' && n + 1 < len) {
+		int w = 0;
+
+		if (t[0] == '%' && t[1] != '\0') {
+			switch (t[1]) {
+			case 'i':
+				w = snprintf(buf + n, len - n, "%u", c->index);
+				break;
+			case 'u':
+				w = snprintf(buf + n, len - n, "%s",
+				    c->g->username != NULL ? c->g->username
+				                           : "undefined");
+				break;
+			case 'c':
+				w = snprintf(buf + n, len - n, "%s", c->id);
+				break;
+			case 'r':
+				w = snprintf(buf + n, len - n, "%u",
+				    nng_random() % (uint32_t) c->g->random);
+				break;
+			default:
+				break;
+			}
+		}
+		if (w > 0) {
+			n = n + w < len ? n + w : len - 1;
+			t += 2;
+		} else {
+			buf[n++] = *t++;
+		}
+	}
+	buf[n] = '\0';
+}
+
+static void
+sc_stamp(uint8_t *p)
+{
+	uint64_t now = lat_now_us();
+
+	for (int i = 0; i < 4; i++) {
+		p[i] = (uint8_t) (NNB_SC_MAGIC >> (24 - 8 * i));
+	}
+	for (int i = 0; i < 8; i++) {
+		p[4 + i] = (uint8_t) (now >> (56 - 8 * i));
+	}
+}
+
+static void
+sc_latency(nnb_group_stats *st, nng_msg *msg)
+{
+	uint32_t len;
+	uint8_t *p     = nng_mqtt_msg_get_publish_payload(msg, &len);
+	uint32_t magic = 0;
+	uint64_t sent  = 0;
+	uint64_t now;
+
+	if (p == NULL || len < NNB_SC_STAMP_LEN) {
+		return;
+	}
+	for (int i = 0; i < 4; i++) {
+		magic = magic << 8 | p[i];
+	}
+	for (int i = 0; i < 8; i++) {
+		sent = sent << 8 | p[4 + i];
+	}
+	if (magic != NNB_SC_MAGIC) {
+		return;
+	}
+	now = lat_now_us();
+	nng_mtx_lock(st->mtx);
+	// publishers on other hosts are as far off as the clocks
+	lat_hist_record(&st->latency, now > sent ? now - sent : 0);
+	nng_mtx_unlock(st->mtx);
+}
+
+static nng_msg *
+sc_publish_msg(nnb_client *c)
+{
+	nnb_group *g    = c->g;
+	uint32_t   size = (uint32_t) g->size_min;
+	char       topic[NNB_TOPIC_LEN];
+	nng_msg   *msg;
+	uint8_t   *payload;
+	uint32_t   len;
+
+	if (g->size_max > g->size_min) {
+		size += nng_random() % (uint32_t) (g->size_max - g->size_min + 1);
+	}
+	sc_topic(c, topic, sizeof(topic));
+	nng_mqtt_msg_alloc(&msg, 0);
+	nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_PUBLISH);
+	nng_mqtt_msg_set_publish_qos(msg, g->qos);
+	nng_mqtt_msg_set_publish_retain(msg, g->retain);
+	nng_mqtt_msg_set_publish_topic(msg, topic);
+	nng_mqtt_msg_set_publish_payload(
+	    msg, (uint8_t *) c->st->payload, size);
+	// the payload was copied, the stamp goes into the copy
+	payload = nng_mqtt_msg_get_publish_payload(msg, &len);
+	if (payload != NULL && len >= NNB_SC_STAMP_LEN) {
+		sc_stamp(payload);
+	}
+	return msg;
+}
+
+static nng_msg *
+sc_subscribe_msg(nnb_client *c)
+{
+	char     topic[NNB_TOPIC_LEN];
+	nng_msg *msg;
+
+	sc_topic(c, topic, sizeof(topic));
+	nng_mqtt_topic_qos topic_qos[] = {
+		{ .qos     = c->g->qos,
+		    .topic = { .buf = (uint8_t *) topic,
+		        .length     = strlen(topic) } },
+	};
+	nng_mqtt_msg_alloc(&msg, 0);
+	nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_SUBSCRIBE);
+	nng_mqtt_msg_set_subscribe_topics(msg, topic_qos, 1);
+	return msg;
+}
+
+static void
+sc_client_cb(void *arg)
+{
+	nnb_client *c = arg;
+	nnb_group  *g = c->g;
+	nng_msg    *msg;
+	int         rv = 0;
+
+	if (c->state != SC_INIT) {
+		rv = nng_aio_result(c->aio);
+	}
+	// every msg taken from the aio is cleared, whatever is left is ours
+	if (rv != 0 && (msg = nng_aio_get_msg(c->aio)) != NULL) {
+		nng_aio_set_msg(c->aio, NULL);
+		nng_msg_free(msg);
+	}
+	// closed for a reconnect or the ramp down
+	if (rv == NNG_ECLOSED || rv == NNG_ECANCELED) {
+		return;
+	}
+
+	switch (c->state) {
+	case SC_INIT:
+		if (g->behaviour == NNB_PUB) {
+			// spreads the first publishes over one interval
+			c->state = SC_WAIT;
+			nng_sleep_aio(
+			    nng_random() % (uint32_t) g->interval, c->aio);
+		} else {
+			nng_aio_set_msg(c->aio, sc_subscribe_msg(c));
+			c->state = SC_SUBSCRIBE;
+			nng_ctx_send(c->ctx, c->aio);
+		}
+		break;
+
+	case SC_WAIT:
+		nng_aio_set_msg(c->aio, sc_publish_msg(c));
+		c->state = SC_SEND;
+		nng_ctx_send(c->ctx, c->aio);
+		break;
+
+	case SC_SEND:
+		if (rv != 0) {
+			nng_atomic_inc64(c->st->errors);
+		} else {
+			nng_aio_set_msg(c->aio, NULL);
+			nng_atomic_inc64(c->st->sent);
+		}
+		c->state = SC_WAIT;
+		nng_sleep_aio(g->interval, c->aio);
+		break;
+
+	case SC_SUBSCRIBE:
+		if (rv != 0) {
+			nng_atomic_inc64(c->st->errors);
+			c->state = SC_INIT;
+			nng_sleep_aio(1000, c->aio);
+			break;
+		}
+		nng_aio_set_msg(c->aio, NULL);
+		c->state = SC_RECV;
+		nng_ctx_recv(c->ctx, c->aio);
+		break;
+
+	case SC_RECV:
+		if (rv != 0) {
+			// subscribes again once connected
+			nng_atomic_inc64(c->st->errors);
+			c->state = SC_INIT;
+			nng_sleep_aio(1000, c->aio);
+			break;
+		}
+		msg = nng_aio_get_msg(c->aio);
+		nng_aio_set_msg(c->aio, NULL);
+		sc_latency(c->st, msg);
+		nng_msg_free(msg);
+		nng_atomic_inc64(c->st->recv);
+		nng_ctx_recv(c->ctx, c->aio);
+		break;
+	}
+}
+
+static void
+sc_connect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
+{
+	nnb_client *c = arg;
+
+	nng_atomic_inc(c->st->connected);
+	nng_atomic_inc64(c->st->connects);
+}
+
+static void
+sc_disconnect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
+{
+	nnb_client *c = arg;
+
+	nng_atomic_dec(c->st->connected);
+	nng_atomic_inc64(c->st->disconnects);
+}
+
+static void
+sc_client_open(nnb_client *c, nng_time now)
+{
+	nnb_group *g = c->g;
+	nng_dialer dialer;
+	nng_msg   *msg;
+	char       url[300];
+	int        rv;
+
+	rv = sc_.version == 5 ? nng_mqttv5_client_open(&c->sock)
+	                      : nng_mqtt_client_open(&c->sock);
+	if (rv != 0) {
+		nng_fatal("nng_socket", rv);
+	}
+	snprintf(url, sizeof(url), "mqtt-tcp://%s:%d", sc_.host, sc_.port);
+	if ((rv = nng_dialer_create(&dialer, c->sock, url)) != 0) {
+		nng_fatal("nng_dialer_create", rv);
+	}
+
+	nng_mqtt_msg_alloc(&msg, 0);
+	nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_CONNECT);
+	nng_mqtt_msg_set_connect_proto_version(msg, sc_.version);
+	nng_mqtt_msg_set_connect_keep_alive(msg, g->keepalive);
+	nng_mqtt_msg_set_connect_clean_session(msg, g->clean);
+	nng_mqtt_msg_set_connect_client_id(msg, c->id);
+	if (g->username != NULL) {
+		nng_mqtt_msg_set_connect_user_name(msg, g->username);
+	}
+	if (g->password != NULL) {
+		nng_mqtt_msg_set_connect_password(msg, g->password);
+	}
+	nng_mqtt_set_connect_cb(c->sock, sc_connect_cb, c);
+	nng_mqtt_set_disconnect_cb(c->sock, sc_disconnect_cb, c);
+	nng_dialer_set_ptr(dialer, NNG_OPT_MQTT_CONNMSG, msg);
+	nng_dialer_start(dialer, NNG_FLAG_NONBLOCK);
+
+	c->open         = true;
+	c->reconnect_at = 0;
+	if (g->reconnect > 0) {
+		// jittered so the churn does not come in waves
+		c->reconnect_at = now + g->reconnect * 500 +
+		    nng_random() % ((uint32_t) g->reconnect * 1000 + 1);
+	}
+	if (g->behaviour != NNB_IDLE) {
+		if ((rv = nng_ctx_open(&c->ctx, c->sock)) != 0) {
+			nng_fatal("nng_ctx_open", rv);
+		}
+		c->state = SC_INIT;
+		sc_client_cb(c);
+	}
+}
+
+static void
+sc_client_close(nnb_client *c)
+{
+	nng_close(c->sock);
+	if (c->aio != NULL) {
+		nng_aio_stop(c->aio);
+	}
+	c->open = false;
+}
+
+static void
+sc_sigint(int sig)
+{
+	(void) sig;
+	sc_stop = 1;
+}
+
+static void
+sc_stats_init(nnb_group_stats *st, nnb_group *g)
+{
+	memset(st, 0, sizeof(*st));
+	if (nng_atomic_alloc(&st->connected) != 0 ||
+	    nng_atomic_alloc64(&st->connects) != 0 ||
+	    nng_atomic_alloc64(&st->disconnects) != 0 ||
+	    nng_atomic_alloc64(&st->sent) != 0 ||
+	    nng_atomic_alloc64(&st->recv) != 0 ||
+	    nng_atomic_alloc64(&st->errors) != 0 ||
+	    nng_mtx_alloc(&st->mtx) != 0 ||
+	    (st->payload = nng_alloc(g->size_max + 1)) == NULL) {
+		nng_fatal("nng_atomic_alloc", NNG_ENOMEM);
+	}
+	memset(st->payload, 'A', g->size_max);
+}
+
+static void
+sc_stats_fini(nnb_group_stats *st, nnb_group *g)
+{
+	nng_atomic_free(st->connected);
+	nng_atomic_free64(st->connects);
+	nng_atomic_free64(st->disconnects);
+	nng_atomic_free64(st->sent);
+	nng_atomic_free64(st->recv);
+	nng_atomic_free64(st->errors);
+	nng_mtx_free(st->mtx);
+	nng_free(st->payload, g->size_max + 1);
+}
+
+// Lays the clients of every group out on the time line of the run.
+static void
+sc_clients_init(void)
+{
+	size_t n = 0;
+
+	sc_nclients = 0;
+	for (size_t i = 0; i < sc_.ngroups; i++) {
+		sc_nclients += sc_.groups[i].count;
+	}
+	if ((sc_clients = calloc(sc_nclients, sizeof(nnb_client))) == NULL) {
+		nng_fatal("calloc", NNG_ENOMEM);
+	}
+	for (size_t i = 0; i < sc_.ngroups; i++) {
+		nnb_group *g = &sc_.groups[i];
+
+		sc_stats_init(&sc_stats[i], g);
+		for (int k = 0; k < g->count; k++) {
+			nnb_client *c = &sc_clients[n++];
+			int         rv;
+
+			c->g          = g;
+			c->st         = &sc_stats[i];
+			c->index      = (uint32_t) k;
+			c->connect_at = (nng_time) g->start * 1000 +
+			    (nng_time) g->ramp_up * 1000 * k / g->count;
+			if (g->hold > 0) {
+				c->down_at = (nng_time) (g->start + g->ramp_up +
+				                 g->hold) *
+				        1000 +
+				    (nng_time) g->ramp_down * 1000 * k / g->count +
+				    1;
+			}
+			snprintf(c->id, sizeof(c->id), "nnb-%s-%d", g->name, k);
+			if (g->behaviour != NNB_IDLE &&
+			    (rv = nng_aio_alloc(&c->aio, sc_client_cb, c)) !=
+			        0) {
+				nng_fatal("nng_aio_alloc", rv);
+			}
+		}
+	}
+}
+
+static void
+sc_tick(nng_time now)
+{
+	for (size_t i = 0; i < sc_nclients; i++) {
+		nnb_client *c = &sc_clients[i];
+
+		if (c->done) {
+			continue;
+		}
+		if (!c->open) {
+			if (now >= c->connect_at) {
+				sc_client_open(c, now);
+			}
+		} else if (c->down_at != 0 && now >= c->down_at) {
+			sc_client_close(c);
+			c->done = true;
+		} else if (c->reconnect_at != 0 && now >= c->reconnect_at) {
+			// dials again on the next tick
+			sc_client_close(c);
+			c->connect_at = now;
+		}
+	}
+}
+
+static void
+sc_result(nnb_result *res, nng_time elapsed)
+{
+	memset(res, 0, sizeof(*res));
+	res->ngroups = sc_.ngroups;
+	res->elapsed = elapsed;
+	res->agents  = 1;
+	for (size_t i = 0; i < sc_.ngroups; i++) {
+		nnb_group_stats  *st = &sc_stats[i];
+		nnb_group_result *r  = &res->groups[i];
+
+		snprintf(r->name, sizeof(r->name), "%s", sc_.groups[i].name);
+		r->connected   = nng_atomic_get(st->connected);
+		r->connects    = nng_atomic_get64(st->connects);
+		r->disconnects = nng_atomic_get64(st->disconnects);
+		r->sent        = nng_atomic_get64(st->sent);
+		r->recv        = nng_atomic_get64(st->recv);
+		r->errors      = nng_atomic_get64(st->errors);
+		nng_mtx_lock(st->mtx);
+		r->latency = st->latency;
+		nng_mtx_unlock(st->mtx);
+	}
+}
+
+// The counters of this report and of the last, main thread only.
+static nnb_result *sc_snap[2];
+
+static void
+sc_report(nng_time elapsed, nng_duration period)
+{
+	nnb_result *now  = sc_snap[0];
+	nnb_result *prev = sc_snap[1];
+
+	sc_result(now, elapsed);
+	if (nnb_report_text()) {
+		printf("-- %llus\n", (unsigned long long) elapsed / 1000);
+	}
+	for (size_t i = 0; i < now->ngroups && nnb_report_text(); i++) {
+		nnb_group_result *r = &now->groups[i];
+		nnb_group_result *p = &prev->groups[i];
+
+		printf("%s: connected=%d, connects=%llu, disconnects=%llu, "
+		       "sent=%llu(%llu msg/sec), recv=%llu(%llu msg/sec), "
+		       "errors=%llu\n",
+		    r->name, r->connected, (unsigned long long) r->connects,
+		    (unsigned long long) r->disconnects,
+		    (unsigned long long) r->sent,
+		    (unsigned long long) (r->sent - p->sent) * 1000 / period,
+		    (unsigned long long) r->recv,
+		    (unsigned long long) (r->recv - p->recv) * 1000 / period,
+		    (unsigned long long) r->errors);
+	}
+	nnb_report_interval(now, prev, period);
+	sc_snap[0] = prev;
+	sc_snap[1] = now;
+}
+
+int
+nnb_scenario_run(nnb_scenario *sc, uint64_t start_us, nnb_result *res)
+{
+	nng_time begin, now, last;
+	uint64_t us;
+
+	// borrowed, the groups stay with the caller
+	sc_     = *sc;
+	sc_stop = 0;
+	if ((sc_snap[0] = nng_zalloc(sizeof(nnb_result))) == NULL ||
+	    (sc_snap[1] = nng_zalloc(sizeof(nnb_result))) == NULL) {
+		nng_fatal("nng_alloc", NNG_ENOMEM);
+	}
+	sc_clients_init();
+	signal(SIGINT, sc_sigint);
+	while (!sc_stop && (us = lat_now_us()) < start_us) {
+		nng_msleep(start_us - us > NNB_TICK_MS * 1000
+		        ? NNB_TICK_MS
+		        : (nng_duration) ((start_us - us) / 1000));
+	}
+
+	begin = last = now = nng_clock();
+	while (!sc_stop) {
+		nng_msleep(NNB_TICK_MS);
+		now = nng_clock();
+		sc_tick(now - begin);
+		if (sc_.duration > 0 &&
+		    now - begin >= (nng_time) sc_.duration * 1000) {
+			break;
+		}
+		if (now - last >= (nng_time) sc_.report * 1000) {
+			sc_report(now - begin, (nng_duration) (now - last));
+			last = now;
+		}
+	}
+	sc_result(res, now - begin);
+	signal(SIGINT, SIG_DFL);
+
+	for (size_t i = 0; i < sc_nclients; i++) {
+		if (sc_clients[i].open) {
+			sc_client_close(&sc_clients[i]);
+		}
+		if (sc_clients[i].aio != NULL) {
+			nng_aio_free(sc_clients[i].aio);
+		}
+	}
+	for (size_t i = 0; i < sc_.ngroups; i++) {
+		sc_stats_fini(&sc_stats[i], &sc_.groups[i]);
+	}
+	free(sc_clients);
+	nng_free(sc_snap[0], sizeof(nnb_result));
+	nng_free(sc_snap[1], sizeof(nnb_result));
+	sc_clients  = NULL;
+	sc_nclients = 0;
+	memset(&sc_, 0, sizeof(sc_));
+	return sc_stop ? NNG_EINTR : 0;
+}
+
+void
+nnb_result_merge(nnb_result *total, const nnb_result *res)
+{
+	for (size_t i = 0; i < res->ngroups; i++) {
+		const nnb_group_result *r = &res->groups[i];
+		nnb_group_result       *t = NULL;
+
+		for (size_t k = 0; k < total->ngroups && t == NULL; k++) {
+			if (strcmp(total->groups[k].name, r->name) == 0) {
+				t = &total->groups[k];
+			}
+		}
+		if (t == NULL) {
+			if (total->ngroups == NNB_GROUPS) {
+				continue;
+			}
+			t = &total->groups[total->ngroups++];
+			memcpy(t->name, r->name, sizeof(t->name));
+		}
+		t->connected += r->connected;
+		t->connects += r->connects;
+		t->disconnects += r->disconnects;
+		t->sent += r->sent;
+		t->recv += r->recv;
+		t->errors += r->errors;
+		lat_hist_merge(&t->latency, &r->latency);
+	}
+	if (res->elapsed > total->elapsed) {
+		total->elapsed = res->elapsed;
+	}
+	total->agents += res->agents;
+}
+
+void
+nnb_result_print(const nnb_result *res)
+{
+	static const double pcts[] = { 50, 90, 99, 99.9 };
+	uint64_t            elapsed = res->elapsed > 0 ? res->elapsed : 1;
+	uint64_t            v[4];
+
+	if (res->agents > 1) {
+		printf("== %llus, %d agents\n",
+		    (unsigned long long) res->elapsed / 1000, res->agents);
+	} else {
+		printf("== %llus\n", (unsigned long long) res->elapsed / 1000);
+	}
+	for (size_t i = 0; i < res->ngroups; i++) {
+		const nnb_group_result *r = &res->groups[i];
+
+		printf("%s: connected=%d, connects=%llu, disconnects=%llu, "
+		       "sent=%llu(%llu msg/sec), recv=%llu(%llu msg/sec), "
+		       "errors=%llu",
+		    r->name, r->connected, (unsigned long long) r->connects,
+		    (unsigned long long) r->disconnects,
+		    (unsigned long long) r->sent,
+		    (unsigned long long) (r->sent * 1000 / elapsed),
+		    (unsigned long long) r->recv,
+		    (unsigned long long) (r->recv * 1000 / elapsed),
+		    (unsigned long long) r->errors);
+		if (r->latency.total > 0) {
+			lat_hist_percentiles(&r->latency, pcts, v, 4);
+			printf(", latency(us) p50=%llu, p90=%llu, p99=%llu, "
+			       "p999=%llu, max=%llu",
+			    (unsigned long long) v[0], (unsigned long long) v[1],
+			    (unsigned long long) v[2], (unsigned long long) v[3],
+			    (unsigned long long) r->latency.max);
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+char *
+nnb_result_encode(const nnb_result *res)
+{
+	cJSON *root   = cJSON_CreateObject();
+	cJSON *groups = cJSON_AddArrayToObject(root, "groups");
+	char  *json;
+
+	cJSON_AddNumberToObject(root, "elapsed", (double) res->elapsed);
+	cJSON_AddNumberToObject(root, "agents", res->agents);
+	for (size_t i = 0; i < res->ngroups; i++) {
+		const nnb_group_result *r   = &res->groups[i];
+		cJSON                  *obj = cJSON_CreateObject();
+		cJSON                  *hist;
+
+		cJSON_AddStringToObject(obj, "name", r->name);
+		cJSON_AddNumberToObject(obj, "connected", r->connected);
+		cJSON_AddNumberToObject(obj, "connects", (double) r->connects);
+		cJSON_AddNumberToObject(
+		    obj, "disconnects", (double) r->disconnects);
+		cJSON_AddNumberToObject(obj, "sent", (double) r->sent);
+		cJSON_AddNumberToObject(obj, "recv", (double) r->recv);
+		cJSON_AddNumberToObject(obj, "errors", (double) r->errors);
+		cJSON_AddNumberToObject(obj, "max", (double) r->latency.max);
+		hist = cJSON_AddArrayToObject(obj, "latency");
+		for (size_t b = 0; b < LAT_HIST_BUCKETS; b++) {
+			if (r->latency.counts[b] == 0) {
+				continue;
+			}
+			cJSON_AddItemToArray(hist, cJSON_CreateNumber((double) b));
+			cJSON_AddItemToArray(hist,
+			    cJSON_CreateNumber((double) r->latency.counts[b]));
+		}
+		cJSON_AddItemToArray(groups, obj);
+	}
+	json = cJSON_PrintUnformatted(root);
+	cJSON_Delete(root);
+	return json;
+}
+
+static uint64_t
+sc_u64(cJSON *obj, const char *key)
+{
+	cJSON *item = cJSON_GetObjectItem(obj, key);
+
+	return cJSON_IsNumber(item) && item->valuedouble > 0
+	    ? (uint64_t) item->valuedouble
+	    : 0;
+}
+
+int
+nnb_result_decode(const char *json, size_t len, nnb_result *res)
+{
+	cJSON *root = cJSON_ParseWithLength(json, len);
+	cJSON *groups;
+	cJSON *obj;
+	int    rv = 0;
+
+	memset(res, 0, sizeof(*res));
+	groups = cJSON_GetObjectItem(root, "groups");
+	if (!cJSON_IsObject(root) || !cJSON_IsArray(groups)) {
+		cJSON_Delete(root);
+		return NNG_EINVAL;
+	}
+	res->elapsed = sc_u64(root, "elapsed");
+	res->agents  = (int) sc_u64(root, "agents");
+	cJSON_ArrayForEach(obj, groups)
+	{
+		cJSON            *name = cJSON_GetObjectItem(obj, "name");
+		cJSON            *hist = cJSON_GetObjectItem(obj, "latency");
+		nnb_group_result *r;
+
+		if (res->ngroups == NNB_GROUPS || !cJSON_IsString(name)) {
+			rv = NNG_EINVAL;
+			break;
+		}
+		r = &res->groups[res->ngroups++];
+		snprintf(r->name, sizeof(r->name), "%s", name->valuestring);
+		r->connected   = (int) sc_u64(obj, "connected");
+		r->connects    = sc_u64(obj, "connects");
+		r->disconnects = sc_u64(obj, "disconnects");
+		r->sent        = sc_u64(obj, "sent");
+		r->recv        = sc_u64(obj, "recv");
+		r->errors      = sc_u64(obj, "errors");
+		r->latency.max = sc_u64(obj, "max");
+		// [bucket, count] pairs
+		for (cJSON *b = cJSON_IsArray(hist) ? hist->child : NULL;
+		     b != NULL && b->next != NULL; b = b->next->next) {
+			cJSON *n = b->next;
+
+			if (!cJSON_IsNumber(b) || b->valuedouble < 0 ||
+			    b->valuedouble >= LAT_HIST_BUCKETS ||
+			    !cJSON_IsNumber(n) || n->valuedouble < 0) {
+				rv = NNG_EINVAL;
+				break;
+			}
+			r->latency.counts[(size_t) b->valuedouble] +=
+			    (uint64_t) n->valuedouble;
+			r->latency.total += (uint64_t) n->valuedouble;
+		}
+	}
+	cJSON_Delete(root);
+	return rv;
+}
+
+int
+nnb_scenario_start(int argc, char **argv)
+{
+	nnb_scenario sc;
+	nnb_result  *res;
+	char        *text;
+	size_t       len;
+	int          rv;
+
+	if (argc < 4 || strcmp(argv[3], "--help") == 0) {
+		fprintf(stderr, "Usage: %s\n", scenario_info);
+		exit(EXIT_FAILURE);
+	}
+	if ((rv = nng_file_get(argv[3], (void **) &text, &len)) != 0) {
+		fprintf(stderr, "Scenario: cannot read %s: %s\n", argv[3],
+		    nng_strerror(rv));
+		exit(EXIT_FAILURE);
+	}
+	rv = nnb_scenario_parse(text, len, &sc);
+	nng_free(text, len);
+	if (rv != 0) {
+		exit(EXIT_FAILURE);
+	}
+	if ((res = nng_alloc(sizeof(*res))) == NULL) {
+		nng_fatal("nng_alloc", NNG_ENOMEM);
+	}
+	nnb_scenario_run(&sc, 0, res);
+	nnb_report_summary(res);
+	nng_free(res, sizeof(*res));
+	nnb_scenario_free(&sc);
+	return 0;
+}
+
+#endif
@@ -53,6 +53,9 @@ struct nng_proxy_opts {
 	enum nng_proto   type;
 	bool             verbose;
 	size_t           parallel;
+	size_t           nng_parallel;  // contexts from NNG to MQTT
+	size_t           mqtt_parallel; // contexts from MQTT to NNG
+	bool             ordered;
 	nng_atomic_u64 * msg_count; // caculate how many msg has been conveyed
 	size_t           interval;
 	uint8_t          version;
@@ -92,6 +95,9 @@ enum options {
 	OPT_HELP = 1,
 	OPT_VERBOSE,
 	OPT_PARALLEL,
+	OPT_NNG_PARALLEL,
+	OPT_MQTT_PARALLEL,
+	OPT_ORDERED,
 	OPT_MSGCOUNT,
 	OPT_CLIENTS,
 	OPT_INTERVAL,
@@ -129,6 +135,9 @@ static nng_optspec cmd_opts[] = {
 	    .o_short = 'n',
 	    .o_val   = OPT_PARALLEL,
 	    .o_arg   = true },
+	{ .o_name = "nng-parallel", .o_val = OPT_NNG_PARALLEL, .o_arg = true },
+	{ .o_name = "mqtt-parallel", .o_val = OPT_MQTT_PARALLEL, .o_arg = true },
+	{ .o_name = "ordered", .o_val = OPT_ORDERED },
 	{ .o_name    = "interval",
 	    .o_short = 'i',
 	    .o_val   = OPT_INTERVAL,
@@ -189,14 +198,38 @@ static nng_optspec cmd_opts[] = {
 	{ .o_name = NULL, .o_val = 0 },
 };
 
+// Messages a lane holds while its aio has one out.
+#ifndef NNG_PROXY_QUEUE_LEN
+#define NNG_PROXY_QUEUE_LEN 256
+#endif
+
+struct work;
+
+// The sending half of a direction, see struct direction.
+struct lane {
+	nng_mtx *       mtx;
+	nng_aio *       aio;
+	nng_ctx         ctx; // to MQTT a lane sends on a context of its own
+	nng_socket      nsocket;
+	bool            to_mqtt;
+	nng_msg *       queue[NNG_PROXY_QUEUE_LEN];
+	size_t          head;
+	size_t          len;
+	bool            busy;    // aio has a message out
+	struct work *   blocked; // waits with its msg for room
+	nng_proxy_opts *nng_opts;
+};
+
 struct work {
-	enum { INIT, RECV, RECV_MQTT, RECV_NNG, SEND_MQTT, SEND_NNG } state;
+	enum { INIT, RECV_MQTT, RECV_NNG } state;
 	uint8_t      mode;
 	nng_aio *    aio;
 	nng_msg *    msg;
 	nng_ctx      ctx;
 	nng_ctx	     proxy_ctx;
 	nng_socket   nsocket;
+	struct lane **lanes;
+	size_t       nlanes;
 	nng_proxy_opts *nng_opts;
 };
 
@@ -240,6 +273,12 @@ help(enum nng_proto type)
 	       "the client [default: 4]\n");
 	printf("  -n, --parallel             	   The number of parallel for "
 	       "proxy client [default: 1]\n");
+	printf("  --nng-parallel <num>             Contexts forwarding NNG to "
+	       "MQTT [default: --parallel]\n");
+	printf("  --mqtt-parallel <num>            Contexts forwarding MQTT to "
+	       "NNG [default: --parallel]\n");
+	printf("  --ordered                        Keep the messages of an MQTT "
+	       "topic in order [default: false]\n");
 	printf("  -v, --verbose              	   Enable verbose mode\n");
 	printf("  -u, --user <user>                The username for MQTT "
 	       "authentication\n");
@@ -327,6 +366,15 @@ nng_client_parse_opts(int argc, char **argv, nng_proxy_opts *nng_opts)
 		case OPT_PARALLEL:
 			nng_opts->parallel = intarg(arg, 1024000);
 			break;
+		case OPT_NNG_PARALLEL:
+			nng_opts->nng_parallel = intarg(arg, 1024000);
+			break;
+		case OPT_MQTT_PARALLEL:
+			nng_opts->mqtt_parallel = intarg(arg, 1024000);
+			break;
+		case OPT_ORDERED:
+			nng_opts->ordered = true;
+			break;
                 //TODO tasq number
 		case OPT_VERSION:
 			nng_opts->version = intarg(arg, 4);
@@ -475,6 +523,15 @@ nng_client_parse_opts(int argc, char **argv, nng_proxy_opts *nng_opts)
 	if (!nng_opts->mqtt_url) {
 		nng_opts->mqtt_url = nng_strdup("mqtt-tcp://127.0.0.1:1883");
 	}
+	if (nng_opts->parallel == 0) {
+		nng_opts->parallel = 1;
+	}
+	if (nng_opts->nng_parallel == 0) {
+		nng_opts->nng_parallel = nng_opts->parallel;
+	}
+	if (nng_opts->mqtt_parallel == 0) {
+		nng_opts->mqtt_parallel = nng_opts->parallel;
+	}
         if (!nng_opts->nng_url) {
                 fatal("NNG url is invalid.");
 		return -1;
@@ -633,11 +690,160 @@ nng_publish_msg(nng_proxy_opts *nng_opts, nng_msg *msg)
 	return pubmsg;
 }
 
+// The payload of a received PUBLISH is a view into its body, so the
+// message goes on to NNG as it is with everything in front trimmed off.
+static nng_msg *
+nng_forward_msg(nng_msg *msg, uint8_t *payload, uint32_t payload_len)
+{
+	uint8_t *body = nng_msg_body(msg);
+	nng_msg *nmsg;
+	int      rv;
+
+	if (payload != NULL && payload >= body &&
+	    payload + payload_len == body + nng_msg_len(msg)) {
+		nng_msg_trim(msg, (size_t) (payload - body));
+		nng_msg_header_clear(msg);
+		return msg;
+	}
+	if (((rv = nng_msg_alloc(&nmsg, 0)) != 0) ||
+	    ((rv = nng_msg_append(nmsg, payload, payload_len)) != 0)) {
+		fatal("%s", nng_strerror(rv));
+	}
+	nng_msg_free(msg);
+	return nmsg;
+}
+
+static uint32_t
+topic_hash(const char *topic, uint32_t len)
+{
+	uint32_t h = 2166136261u;
+
+	for (uint32_t i = 0; i < len; i++) {
+		h = (h ^ (uint8_t) topic[i]) * 16777619u;
+	}
+	return h;
+}
+
+static void work_recv(struct work *work);
+
+// Caller holds lane->mtx and a message is queued.
+static nng_msg *
+lane_pop(struct lane *lane)
+{
+	nng_msg *msg = lane->queue[lane->head];
+
+	lane->head = (lane->head + 1) % NNG_PROXY_QUEUE_LEN;
+	lane->len--;
+	return msg;
+}
+
+// Caller holds lane->mtx and there is room.
+static void
+lane_push(struct lane *lane, nng_msg *msg)
+{
+	lane->queue[(lane->head + lane->len) % NNG_PROXY_QUEUE_LEN] = msg;
+	lane->len++;
+}
+
+// Only the one that set lane->busy sends, outside lane->mtx.
+static void
+lane_send(struct lane *lane, nng_msg *msg)
+{
+	nng_aio_set_msg(lane->aio, msg);
+	if (lane->to_mqtt) {
+		nng_ctx_send(lane->ctx, lane->aio);
+	} else {
+		nng_send_aio(lane->nsocket, lane->aio);
+	}
+}
+
+// Queues msg, false when the lane is full and work has to wait with it.
+static bool
+lane_put(struct lane *lane, struct work *work, nng_msg *msg)
+{
+	nng_msg *next = NULL;
+
+	nng_mtx_lock(lane->mtx);
+	if (lane->len == NNG_PROXY_QUEUE_LEN) {
+		work->msg     = msg;
+		lane->blocked = work;
+		nng_mtx_unlock(lane->mtx);
+		return false;
+	}
+	lane_push(lane, msg);
+	if (!lane->busy) {
+		lane->busy = true;
+		next       = lane_pop(lane);
+	}
+	nng_mtx_unlock(lane->mtx);
+	if (next != NULL) {
+		lane_send(lane, next);
+	}
+	return true;
+}
+
+static void
+lane_cb(void *arg)
+{
+	struct lane *lane = arg;
+	struct work *work = NULL;
+	nng_msg     *next = NULL;
+	int          rv;
+
+	if ((rv = nng_aio_result(lane->aio)) != 0) {
+		nng_msg_free(nng_aio_get_msg(lane->aio));
+		nng_aio_set_msg(lane->aio, NULL);
+		if (lane->nng_opts->verbose) {
+			printf("%s send failed: %s\n",
+			    lane->to_mqtt ? "MQTT" : "NNG", nng_strerror(rv));
+		}
+	} else {
+		nng_atomic_inc64(lane->nng_opts->msg_count);
+	}
+
+	nng_mtx_lock(lane->mtx);
+	if (lane->len > 0) {
+		next = lane_pop(lane);
+	} else {
+		lane->busy = false;
+	}
+	// only a full lane blocks, the pop made room
+	if (lane->blocked != NULL) {
+		work          = lane->blocked;
+		lane->blocked = NULL;
+		lane_push(lane, work->msg);
+		work->msg = NULL;
+	}
+	nng_mtx_unlock(lane->mtx);
+
+	if (next != NULL) {
+		lane_send(lane, next);
+	}
+	if (work != NULL) {
+		work_recv(work);
+	}
+}
+
+static void
+work_recv(struct work *work)
+{
+	if (work->state == RECV_MQTT) {
+		nng_ctx_recv(work->ctx, work->aio);
+	} else if (work->nng_opts->type == PAIR1 ||
+	    work->nng_opts->type == PAIR0) {
+		nng_recv_aio(work->nsocket, work->aio);
+	} else {
+		nng_ctx_recv(work->proxy_ctx, work->aio);
+	}
+}
+
 void
 nng_client_cb(void *arg)
 {
 	struct work *work = arg;
+	struct lane *lane;
 	nng_msg *    msg  = NULL;
+	nng_msg *    pubmsg;
 	int          rv;
 
 	switch (work->state) {
@@ -645,60 +851,53 @@ nng_client_cb(void *arg)
 		switch (work->nng_opts->type) {
 		case PUB0:
 			work->state = RECV_MQTT;
-			nng_ctx_recv(work->ctx, work->aio);
 			break;
 		case SUB0:
 		case CONN:
 			work->state = RECV_NNG;
-			nng_ctx_recv(work->proxy_ctx, work->aio);
 			break;
 		case PAIR1:
 		case PAIR0:
 			if (work->mode == 1) {
 				work->state = RECV_NNG;
-				nng_recv_aio(work->nsocket, work->aio);
 			} else if (work->mode == 0) {
 				work->state = RECV_MQTT;
-				nng_ctx_recv(work->ctx, work->aio);
 			}
-
 			break;
 		default:
-			break;
+			return;
 		}
+		work_recv(work);
 		break;
 
 	case RECV_NNG:
 		if ((rv = nng_aio_result(work->aio)) != 0) {
 			nng_fatal("nng_recv_aio", rv);
-			work->state = RECV;
-			nng_ctx_recv(work->proxy_ctx, work->aio);
+			work_recv(work);
 			break;
 		}
-		work->msg   = nng_aio_get_msg(work->aio);
+		msg = nng_aio_get_msg(work->aio);
 		if (proxy_opts->verbose) {
-			printf("NNG msg : %s\n",
-			    (char *) nng_msg_body(work->msg));
+			printf("NNG msg : %.*s\n", (int) nng_msg_len(msg),
+			    (char *) nng_msg_body(msg));
 		}
 
-		msg = nng_publish_msg(work->nng_opts, work->msg);
-		nng_msg_free(work->msg);
-		work->msg = msg;
-		nng_aio_set_msg(work->aio, work->msg);
-		work->state = SEND_MQTT;
-		nng_ctx_send(work->ctx, work->aio);
+		pubmsg = nng_publish_msg(work->nng_opts, msg);
+		nng_msg_free(msg);
+		// every NNG message goes to the one MQTT topic, one lane
+		// keeps them in order
+		if (lane_put(work->lanes[0], work, pubmsg)) {
+			work_recv(work);
+		}
 		break;
 
 	case RECV_MQTT:
 		if ((rv = nng_aio_result(work->aio)) != 0) {
 			nng_fatal("nng_recv_aio", rv);
-			work->state = RECV;
-			nng_ctx_recv(work->ctx, work->aio);
+			work_recv(work);
 			break;
 		}
-		work->msg   = nng_aio_get_msg(work->aio);
-		msg = work->msg;
-		work->msg = NULL;
+		msg = nng_aio_get_msg(work->aio);
 		uint32_t payload_len;
 		uint8_t *payload =
 		    nng_mqtt_msg_get_publish_payload(msg, &payload_len);
@@ -710,36 +909,13 @@ nng_client_cb(void *arg)
 			    payload_len, (char *) payload);
 		}
 
-		if (((rv = nng_msg_alloc(&work->msg, 0)) != 0) ||
-		    ((rv = nng_msg_append(work->msg, payload, payload_len)) !=
-		        0)) {
-			fatal("%s", nng_strerror(rv));
+		// a topic sticks to one lane, so its messages stay in order
+		lane = work->lanes[work->nlanes > 1 ?
+		        topic_hash(recv_topic, topic_len) % work->nlanes : 0];
+		msg  = nng_forward_msg(msg, payload, payload_len);
+		if (lane_put(lane, work, msg)) {
+			work_recv(work);
 		}
-		nng_msg_free(msg);
-
-		work->state = SEND_NNG;
-		nng_aio_set_msg(work->aio, work->msg);
-		nng_send_aio(work->nsocket, work->aio);
-		break;
-
-	case SEND_MQTT:
-		if ((rv = nng_aio_result(work->aio)) != 0) {
-			nng_msg_free(work->msg);
-			nng_fatal("nng_send_aio", rv);
-		}
-		work->state = RECV_NNG;
-		if (proxy_opts->type == PAIR1 || proxy_opts->type == PAIR0) {
-			nng_recv_aio(work->nsocket, work->aio);
-			break;
-		}
-
-		nng_ctx_recv(work->proxy_ctx, work->aio);
-		break;
-
-	case SEND_NNG:
-		//recv next mqtt msg
-		work->state = RECV_MQTT;
-		nng_ctx_recv(work->ctx, work->aio);
 		break;
 
 	default:
@@ -828,12 +1004,13 @@ disconnect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 }
 
 static struct work *
-nng_alloc_work(nng_socket sock, nng_socket psock, nng_proxy_opts *nng_opts, uint8_t mode)
+nng_alloc_work(nng_socket sock, nng_socket psock, nng_proxy_opts *nng_opts,
+    uint8_t mode, struct lane **lanes, size_t nlanes)
 {
 	struct work *w;
 	int          rv;
 
-	if ((w = nng_alloc(sizeof(*w))) == NULL) {
+	if ((w = nng_zalloc(sizeof(*w))) == NULL) {
 		nng_fatal("nng_alloc", NNG_ENOMEM);
 	}
 	if ((rv = nng_aio_alloc(&w->aio, nng_client_cb, w)) != 0) {
@@ -861,27 +1038,136 @@ nng_alloc_work(nng_socket sock, nng_socket psock, nng_proxy_opts *nng_opts, uint
 		break;
 	}
 
-	w->nng_opts  = nng_opts;
-	w->state = INIT;
-	w->mode  = mode;
+	w->nng_opts = nng_opts;
+	w->state    = INIT;
+	w->mode     = mode;
+	w->lanes    = lanes;
+	w->nlanes   = nlanes;
 	return (w);
 }
 
+static struct lane *
+nng_alloc_lane(nng_socket sock, nng_socket psock, nng_proxy_opts *nng_opts,
+    bool to_mqtt)
+{
+	struct lane *l;
+	int          rv;
+
+	if ((l = nng_zalloc(sizeof(*l))) == NULL) {
+		nng_fatal("nng_alloc", NNG_ENOMEM);
+	}
+	if ((rv = nng_mtx_alloc(&l->mtx)) != 0) {
+		nng_fatal("nng_mtx_alloc", rv);
+	}
+	if ((rv = nng_aio_alloc(&l->aio, lane_cb, l)) != 0) {
+		nng_fatal("nng_aio_alloc", rv);
+	}
+	if (to_mqtt && (rv = nng_ctx_open(&l->ctx, sock)) != 0) {
+		nng_fatal("nng_ctx_open", rv);
+	}
+	l->to_mqtt  = to_mqtt;
+	l->nsocket  = psock;
+	l->nng_opts = nng_opts;
+	return (l);
+}
+
 static void
-create_client(nng_socket *sock, nng_socket psock, struct work **works,
-    size_t nwork, struct connect_param *param, uint8_t mode)
+nng_free_lane(struct lane *l)
 {
-	int        rv;
-	nng_dialer dialer;
-	nng_socket s;
+	nng_aio_stop(l->aio);
+	nng_aio_free(l->aio);
+	while (l->len > 0) {
+		nng_msg_free(lane_pop(l));
+	}
+	nng_mtx_free(l->mtx);
+	nng_free(l, sizeof(*l));
+}
 
-	if ((rv = nng_mqtt_client_open(sock)) != 0) {
-		nng_fatal("nng_socket", rv);
+static void
+nng_free_work(struct work *w)
+{
+	nng_aio_stop(w->aio);
+	nng_aio_free(w->aio);
+	if (w->msg) {
+		nng_msg_free(w->msg);
+		w->msg = NULL;
 	}
+	nng_free(w, sizeof(*w));
+}
 
-	for (size_t i = 0; i < proxy_opts->parallel; i++) {
-		works[i] = nng_alloc_work(*sock, psock, proxy_opts, mode);
+/*
+ * One direction of the proxy: the works receive and hand each message to
+ * a lane, a lane sends what it queued back to back while the works are
+ * already receiving again. Unordered, every work has a lane of its own.
+ * Ordered, one work receives and spreads the messages over all lanes by
+ * MQTT topic, so a topic keeps its order.
+ */
+struct direction {
+	struct work **works;
+	size_t        nworks;
+	struct lane **lanes;
+	size_t        nlanes;
+};
+
+static void
+nng_alloc_direction(struct direction *d, nng_socket sock, nng_socket psock,
+    size_t parallel, bool to_mqtt)
+{
+	uint8_t mode = to_mqtt ? 1 : 0;
+
+	// all NNG messages go to one MQTT topic, ordered that is one lane
+	d->nlanes = proxy_opts->ordered && to_mqtt ? 1 : parallel;
+	d->nworks = proxy_opts->ordered ? 1 : parallel;
+	d->lanes  = nng_zalloc(d->nlanes * sizeof(struct lane *));
+	d->works  = nng_zalloc(d->nworks * sizeof(struct work *));
+	if (d->lanes == NULL || d->works == NULL) {
+		nng_fatal("nng_alloc", NNG_ENOMEM);
+	}
+	for (size_t i = 0; i < d->nlanes; i++) {
+		d->lanes[i] = nng_alloc_lane(sock, psock, proxy_opts, to_mqtt);
+	}
+	for (size_t i = 0; i < d->nworks; i++) {
+		if (proxy_opts->ordered) {
+			d->works[i] = nng_alloc_work(sock, psock, proxy_opts,
+			    mode, d->lanes, d->nlanes);
+		} else {
+			d->works[i] = nng_alloc_work(
+			    sock, psock, proxy_opts, mode, &d->lanes[i], 1);
+		}
+	}
+}
+
+static void
+nng_start_direction(struct direction *d)
+{
+	for (size_t i = 0; i < d->nworks; i++) {
+		nng_client_cb(d->works[i]);
+	}
+}
+
+static void
+nng_free_direction(struct direction *d)
+{
+	for (size_t i = 0; i < d->nworks; i++) {
+		nng_free_work(d->works[i]);
 	}
+	for (size_t i = 0; i < d->nlanes; i++) {
+		nng_free_lane(d->lanes[i]);
+	}
+	if (d->works != NULL) {
+		nng_free(d->works, d->nworks * sizeof(struct work *));
+	}
+	if (d->lanes != NULL) {
+		nng_free(d->lanes, d->nlanes * sizeof(struct lane *));
+	}
+	memset(d, 0, sizeof(*d));
+}
+
+static void
+create_client(nng_socket *sock, struct connect_param *param)
+{
+	int        rv;
+	nng_dialer dialer;
 
 	nng_msg *conn_msg = connect_msg(proxy_opts);
 
@@ -946,14 +1232,11 @@ nng_proxy_client(int argc, char **argv, enum nng_proto type)
 	proxy_opts->type = type;
 
 	nng_client_parse_opts(argc, argv, proxy_opts);
-	struct connect_param *param = nng_zalloc(sizeof(struct connect_param *));
+	struct connect_param *param = nng_zalloc(sizeof(struct connect_param));
 	//mqtt socket
-	nng_socket *socket = nng_zalloc(sizeof(nng_socket *));
-	struct work **works =
-	    nng_zalloc(proxy_opts->parallel * sizeof(struct work *));
-
-	param  = nng_zalloc(sizeof(struct connect_param));
-	socket = nng_zalloc(sizeof(nng_socket));
+	nng_socket *     socket = nng_zalloc(sizeof(nng_socket));
+	struct direction up     = { 0 };
+	struct direction down   = { 0 };
 	switch (proxy_opts->type) {
 	case SUB0:
 		if ((rv = nng_sub0_open(&s)) != 0) {
@@ -1003,43 +1286,32 @@ nng_proxy_client(int argc, char **argv, enum nng_proto type)
 	default:
 		break;
 	}
-	create_client(socket, s, works, proxy_opts->parallel, param, 0);
-	for (size_t i = 0; i < proxy_opts->parallel; i++) {
-		nng_client_cb(works[i]);
+	if ((rv = nng_mqtt_client_open(socket)) != 0) {
+		nng_fatal("nng_socket", rv);
 	}
-	if (proxy_opts->type == PAIR1 || proxy_opts->type == PAIR0) {
-		struct work **works2 =
-		    nng_zalloc(proxy_opts->parallel * sizeof(struct work *));
-		for (size_t i = 0; i < proxy_opts->parallel; i++) {
-			works2[i] =
-			    nng_alloc_work(*socket, s, proxy_opts, 1);
-		}
-		for (size_t i = 0; i < proxy_opts->parallel; i++) {
-			// Recv from nng pair1 - send to MQTT 
-			nng_client_cb(works2[i]);
-		}
+	// NNG to MQTT, then MQTT to NNG
+	if (proxy_opts->type != PUB0) {
+		nng_alloc_direction(&up, *socket, s, proxy_opts->nng_parallel,
+		    true);
+	}
+	if (proxy_opts->type == PUB0 || proxy_opts->type == PAIR1 ||
+	    proxy_opts->type == PAIR0) {
+		nng_alloc_direction(&down, *socket, s,
+		    proxy_opts->mqtt_parallel, false);
 	}
+	create_client(socket, param);
+	nng_start_direction(&up);
+	nng_start_direction(&down);
 
 	while (!nng_atomic_get_bool(exit_signal)) {
 		nng_msleep(1000);
 	}
 
+	nng_free_direction(&up);
+	nng_free_direction(&down);
 	nng_free(param, sizeof(struct connect_param));
 	nng_free(socket, sizeof(nng_socket));
 
-	for (size_t k = 0; k < proxy_opts->parallel; k++) {
-		nng_aio_free(works[k]->aio);
-		if (works[k]->msg) {
-			nng_msg_free(works[k]->msg);
-			works[k]->msg = NULL;
-		}
-
-		nng_free(works[k], sizeof(struct work));
-	}
-	nng_free(works, proxy_opts->parallel * sizeof(struct work *));
-	nng_free(param, sizeof(struct connect_param *));
-	nng_free(socket, sizeof(nng_socket *));
-
 	nng_client0_stop(argc, argv);
 }
 
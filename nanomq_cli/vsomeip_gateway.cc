@@ -18,17 +18,34 @@
 #ifndef VSOMEIP_ENABLE_SIGNAL_HANDLING
 #include <csignal>
 #endif
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <thread>
+#include <vector>
 #include <vsomeip/internal/logger.hpp>
 #include <vsomeip/vsomeip.hpp>
 
 #define LOG_INF VSOMEIP_INFO
 #define LOG_ERR VSOMEIP_ERROR
+#define LOG_DBG VSOMEIP_DEBUG
+
+// SOME/IP events one service instance holds for the publishers before
+// dropping.
+#ifndef VSOMEIP_GW_QUEUE_LEN
+#define VSOMEIP_GW_QUEUE_LEN 1024
+#endif
+
+// Seconds between two counter logs, 0 for none.
+#ifndef VSOMEIP_GW_STATS_INTERVAL
+#define VSOMEIP_GW_STATS_INTERVAL 10
+#endif
 
 typedef enum { INIT, RECV, WAIT, SEND } work_state;
 struct work {
@@ -38,50 +55,226 @@ struct work {
 	nng_ctx    ctx;
 };
 
+// A SOME/IP event turned PUBLISH, waiting for a publisher.
+struct someip_event {
+	nng_msg *msg;
+	uint64_t stamp; // us, when it was queued
+};
+
+// Publishes the queued events on a ctx of its own, all of them run side
+// by side so one slow send does not hold back the rest.
+struct pub_work {
+	nng_aio *aio;
+	nng_ctx  ctx;
+	uint64_t stamp;
+};
+
 enum options {
 	OPT_HELP = 1,
 	OPT_CONFFILE,
+	OPT_BENCH,
+	OPT_BENCH_SIZE,
 };
 
 static nng_optspec cmd_opts[] = {
 	{ .o_name = "help", .o_short = 'h', .o_val = OPT_HELP },
 	{ .o_name = "conf", .o_val = OPT_CONFFILE, .o_arg = true },
+	{ .o_name = "bench", .o_val = OPT_BENCH, .o_arg = true },
+	{ .o_name = "bench-size", .o_val = OPT_BENCH_SIZE, .o_arg = true },
 	{ .o_name = NULL, .o_val = 0 },
 };
 
 static char help_info[] =
-    "Usage: nanomq_cli vsomeip_gateway [--conf <path>]\n\n"
-    "  --conf <path>  The path of a specified nanomq_vsomeip_gateway.conf "
-    "file \n";
+    "Usage: nanomq_cli vsomeip_gateway [--conf <path>] [--bench <count> "
+    "[--bench-size <bytes>]]\n\n"
+    "  --conf <path>        The path of a specified "
+    "nanomq_vsomeip_gateway.conf file \n"
+    "  --bench <count>      Publish count generated events through the "
+    "MQTT side, print the throughput and latency, then exit\n"
+    "  --bench-size <bytes> Payload size of the generated events "
+    "(default 64)\n";
+
+static long bench_count = 0;
+static long bench_size  = 64;
 
 static vsomeip_gateway_conf *conf_g = NULL;
 static int                   nwork  = 32;
 
 static bool is_available = false;
 
-int
-client_publish(nng_socket sock, const char *topic, uint8_t *payload,
-    uint32_t payload_len, uint8_t qos, bool verbose)
+static struct {
+	std::mutex mtx;
+	// keyed by service << 16 | instance, served round robin
+	std::map<uint32_t, std::deque<someip_event>> queues;
+	uint32_t               last;
+	std::vector<pub_work *> idle;
+} gw_;
+
+static struct {
+	std::atomic<uint64_t> events;    // SOME/IP to MQTT
+	std::atomic<uint64_t> published;
+	std::atomic<uint64_t> dropped;   // queue full
+	std::atomic<uint64_t> failed;    // MQTT send failed
+	std::atomic<uint64_t> lat_sum;   // us, queued to sent
+	std::atomic<uint64_t> lat_max;
+	std::atomic<uint64_t> requests;  // MQTT to SOME/IP
+	std::atomic<uint64_t> req_dropped;
+} gw_stats;
+
+static std::atomic<bool> mqtt_connected(false);
+
+static uint64_t
+gw_now_us()
 {
-	LOG_INF << "Send publish: '" << payload << "' to '" << topic << "'";
-	int rv;
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+	    std::chrono::steady_clock::now().time_since_epoch())
+	    .count();
+}
 
-	// create a PUBLISH message
+static nng_msg *
+gw_publish_msg(const char *topic, const uint8_t *payload, uint32_t len)
+{
 	nng_msg *pubmsg;
-	nng_mqtt_msg_alloc(&pubmsg, 0);
+
+	if (nng_mqtt_msg_alloc(&pubmsg, 0) != 0) {
+		return NULL;
+	}
 	nng_mqtt_msg_set_packet_type(pubmsg, NNG_MQTT_PUBLISH);
 	nng_mqtt_msg_set_publish_dup(pubmsg, 0);
-	nng_mqtt_msg_set_publish_qos(pubmsg, qos);
+	nng_mqtt_msg_set_publish_qos(pubmsg, 0);
 	nng_mqtt_msg_set_publish_retain(pubmsg, 0);
-	nng_mqtt_msg_set_publish_payload(
-	    pubmsg, (uint8_t *) payload, payload_len);
+	nng_mqtt_msg_set_publish_payload(pubmsg, (uint8_t *) payload, len);
 	nng_mqtt_msg_set_publish_topic(pubmsg, topic);
+	return pubmsg;
+}
 
-	if ((rv = nng_sendmsg(sock, pubmsg, NNG_FLAG_NONBLOCK)) != 0) {
-		LOG_ERR << "nng_sendmsg" << rv;
+// Caller holds gw_.mtx. The next event after the last queue served.
+static bool
+gw_take(someip_event *ev)
+{
+	if (gw_.queues.empty()) {
+		return false;
 	}
+	auto it = gw_.queues.upper_bound(gw_.last);
+	for (size_t n = 0; n < gw_.queues.size(); n++, it++) {
+		if (it == gw_.queues.end()) {
+			it = gw_.queues.begin();
+		}
+		if (!it->second.empty()) {
+			*ev = it->second.front();
+			it->second.pop_front();
+			gw_.last = it->first;
+			return true;
+		}
+	}
+	return false;
+}
 
-	return rv;
+static void
+gw_send(pub_work *w, const someip_event &ev)
+{
+	w->stamp = ev.stamp;
+	nng_aio_set_msg(w->aio, ev.msg);
+	nng_ctx_send(w->ctx, w->aio);
+}
+
+static void
+gw_pub_cb(void *arg)
+{
+	pub_work    *w = reinterpret_cast<pub_work *>(arg);
+	someip_event ev;
+	int          rv;
+
+	if ((rv = nng_aio_result(w->aio)) != 0) {
+		nng_msg_free(nng_aio_get_msg(w->aio));
+		gw_stats.failed++;
+		LOG_DBG << "Publish failed " << rv;
+	} else {
+		uint64_t lat = gw_now_us() - w->stamp;
+		uint64_t max = gw_stats.lat_max.load();
+
+		gw_stats.published++;
+		gw_stats.lat_sum += lat;
+		while (lat > max && !gw_stats.lat_max.compare_exchange_weak(max, lat))
+			;
+	}
+	if (rv == NNG_ECLOSED) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lk(gw_.mtx);
+	if (!gw_take(&ev)) {
+		gw_.idle.push_back(w);
+		return;
+	}
+	lk.unlock();
+	gw_send(w, ev);
+}
+
+// From the vsomeip dispatcher, queue a PUBLISH of payload on pub_topic
+// and start an idle publisher on it if any.
+static void
+gw_enqueue(uint16_t service, uint16_t instance, const uint8_t *payload,
+    uint32_t len)
+{
+	someip_event ev;
+	pub_work    *w;
+
+	gw_stats.events++;
+	if ((ev.msg = gw_publish_msg(conf_g->pub_topic, payload, len)) ==
+	    NULL) {
+		gw_stats.dropped++;
+		return;
+	}
+	ev.stamp = gw_now_us();
+
+	std::unique_lock<std::mutex> lk(gw_.mtx);
+	auto &q = gw_.queues[(uint32_t) service << 16 | instance];
+	if (q.size() >= VSOMEIP_GW_QUEUE_LEN) {
+		lk.unlock();
+		nng_msg_free(ev.msg);
+		gw_stats.dropped++;
+		return;
+	}
+	q.push_back(ev);
+	if (gw_.idle.empty()) {
+		return;
+	}
+	w = gw_.idle.back();
+	gw_.idle.pop_back();
+	if (!gw_take(&ev)) {
+		gw_.idle.push_back(w);
+		return;
+	}
+	lk.unlock();
+	gw_send(w, ev);
+}
+
+static size_t
+gw_queued()
+{
+	std::lock_guard<std::mutex> lk(gw_.mtx);
+	size_t                      n = 0;
+
+	for (auto &q : gw_.queues) {
+		n += q.second.size();
+	}
+	return n;
+}
+
+static void
+gw_stats_log()
+{
+	uint64_t published = gw_stats.published.load();
+
+	LOG_INF << "someip->mqtt events " << gw_stats.events.load()
+	        << " published " << published << " queued " << gw_queued()
+	        << " dropped " << gw_stats.dropped.load() << " failed "
+	        << gw_stats.failed.load() << " latency avg "
+	        << (published ? gw_stats.lat_sum.load() / published : 0)
+	        << "us max " << gw_stats.lat_max.load()
+	        << "us; mqtt->someip requests " << gw_stats.requests.load()
+	        << " dropped " << gw_stats.req_dropped.load();
 }
 
 class vsomeip_client {
@@ -185,8 +378,6 @@ class vsomeip_client {
 		rq->set_payload(pl);
 		// Send the request to the service. Response will be delivered
 		// to the registered message handler
-		std::string s(pl_data.begin(), pl_data.end());
-		LOG_INF << "Send request: '" << s << "'";
 		app_->send(rq);
 	}
 
@@ -201,8 +392,9 @@ class vsomeip_client {
 			case vsomeip_v3::message_type_e::MT_RESPONSE:
 			case vsomeip_v3::message_type_e::MT_NOTIFICATION:
 				pl =  _response->get_payload();
-				client_publish(*conf_g->sock, conf_g->pub_topic,
-				    (uint8_t *) pl->get_data(), pl->get_length(), 0, false);
+				gw_enqueue(_response->get_service(),
+				    _response->get_instance(),
+				    (uint8_t *) pl->get_data(), pl->get_length());
 				break;
 			default:
 				LOG_ERR << "Unsupport Recv response type: '" << (int)_response->get_message_type() << "'";
@@ -245,6 +437,7 @@ handle_signal(int _signal)
 void
 disconnect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 {
+	mqtt_connected = false;
 	LOG_INF << __FUNCTION__ << ": disconnected!";
 }
 
@@ -288,6 +481,7 @@ connect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 	if (rv != 0) {
 		LOG_ERR << "nng_sendmsg" << rv;
 	}
+	mqtt_connected = true;
 }
 
 int
@@ -296,21 +490,21 @@ check_recv(nng_msg *msg)
 
 	// Get PUBLISH payload and topic from msg;
 	uint32_t p_len;
-	uint32_t t_len;
 
-	uint8_t    *p = nng_mqtt_msg_get_publish_payload(msg, &p_len);
-	const char *t = nng_mqtt_msg_get_publish_topic(msg, &t_len);
-
-	std::string payload(p, p + p_len);
-	std::string topic(t, t + t_len);
-	LOG_INF << "Recv message: '" << payload << "' from '" << topic << "'";
+	if (nng_mqtt_msg_get_packet_type(msg) != NNG_MQTT_PUBLISH) {
+		nng_msg_free(msg);
+		return 0;
+	}
+	uint8_t *p = nng_mqtt_msg_get_publish_payload(msg, &p_len);
 
 	if (p_len > 0) {
-		if (is_available) {
+		if (is_available && vc_ptr != nullptr) {
+			gw_stats.requests++;
 			vc_ptr->send_message(
 			    std::vector<uint8_t>(p, p + p_len));
 		} else {
-			LOG_ERR << "Dropped message, due to service is "
+			gw_stats.req_dropped++;
+			LOG_DBG << "Dropped message, due to service is "
 			           "unavailable";
 		}
 	}
@@ -333,17 +527,23 @@ vsomeip_gateway_sub_cb(void *arg)
 		break;
 	case RECV:
 		if ((rv = nng_aio_result(work->aio)) != 0) {
-			// nng_msg_free(work->msg);
-			LOG_ERR << "nng_send_aio" << rv;
+			LOG_ERR << "nng_recv_aio" << rv;
+			if (rv == NNG_ECLOSED) {
+				break;
+			}
+			nng_ctx_recv(work->ctx, work->aio);
+			break;
 		}
 		msg = nng_aio_get_msg(work->aio);
 
+		// Receive the next one while this goes to SOME/IP, the works
+		// dispatch side by side
+		work->state = RECV;
+		nng_ctx_recv(work->ctx, work->aio);
+
 		if (-1 == check_recv(msg)) {
 			abort();
 		}
-
-		work->state = RECV;
-		nng_ctx_recv(work->ctx, work->aio);
 		break;
 	default:
 		LOG_ERR << "bad state!" << NNG_ESTATE ;
@@ -371,6 +571,26 @@ proxy_alloc_work(nng_socket sock)
 	return (w);
 }
 
+static pub_work *
+gw_alloc_pub_work(nng_socket sock)
+{
+	pub_work *w;
+	int       rv;
+
+	if ((w = reinterpret_cast<pub_work *>(nng_alloc(sizeof(*w)))) ==
+	    NULL) {
+		LOG_ERR << "nng_alloc" << NNG_ENOMEM;
+		return NULL;
+	}
+	if ((rv = nng_aio_alloc(&w->aio, gw_pub_cb, w)) != 0 ||
+	    (rv = nng_ctx_open(&w->ctx, sock)) != 0) {
+		LOG_ERR << "pub work " << rv;
+		nng_free(w, sizeof(*w));
+		return NULL;
+	}
+	return w;
+}
+
 int
 client(const char *url, nng_socket *sock_ret)
 {
@@ -389,6 +609,13 @@ client(const char *url, nng_socket *sock_ret)
 	for (int i = 0; i < nwork; i++) {
 		works[i] = proxy_alloc_work(sock);
 	}
+	for (int i = 0; i < nwork; i++) {
+		pub_work *w = gw_alloc_pub_work(sock);
+
+		if (w != NULL) {
+			gw_.idle.push_back(w);
+		}
+	}
 
 	// Mqtt connect message
 	nng_msg *msg;
@@ -422,12 +649,80 @@ client(const char *url, nng_socket *sock_ret)
 	return 0;
 }
 
+static void
+gw_stats_thread(std::atomic<bool> *running)
+{
+	uint64_t last = 0;
+
+	while (running->load()) {
+		for (int i = 0; i < VSOMEIP_GW_STATS_INTERVAL * 10 && running->load(); i++) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		uint64_t now = gw_stats.events.load() + gw_stats.requests.load();
+		if (now != last) {
+			gw_stats_log();
+			last = now;
+		}
+	}
+}
+
+// Publish bench_count generated events through the publishers as fast
+// as the queue takes them, no SOME/IP service involved.
+static int
+gw_bench()
+{
+	std::vector<uint8_t> payload(bench_size, 'x');
+	uint64_t             begin;
+	uint64_t             elapsed;
+
+	for (int i = 0; i < 50 && !mqtt_connected; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	if (!mqtt_connected) {
+		LOG_ERR << "Bench: not connected to " << conf_g->mqtt_url;
+		return 1;
+	}
+	LOG_INF << "Bench: " << bench_count << " events of " << bench_size
+	        << " bytes over " << nwork << " publishers";
+
+	begin = gw_now_us();
+	for (long i = 0; i < bench_count; i++) {
+		// wait for room instead of dropping, it measures the senders
+		while (gw_queued() >= VSOMEIP_GW_QUEUE_LEN) {
+			std::this_thread::yield();
+		}
+		gw_enqueue(0, 0, payload.data(), payload.size());
+	}
+	while (gw_stats.published + gw_stats.failed + gw_stats.dropped <
+	    (uint64_t) bench_count) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	elapsed = gw_now_us() - begin;
+
+	gw_stats_log();
+	LOG_INF << "Bench: " << bench_count << " events in " << elapsed / 1000
+	        << "ms, " << std::fixed << std::setprecision(0)
+	        << (elapsed ? bench_count * 1e6 / elapsed : 0) << " msg/s";
+	return gw_stats.published == (uint64_t) bench_count ? 0 : 1;
+}
+
 int
 vsomeip_gateway(vsomeip_gateway_conf *conf)
 {
-	nng_socket sock;
+	nng_socket        sock;
+	std::atomic<bool> running(true);
+	int               rv;
+
 	client(conf->mqtt_url, &sock);
 	conf->sock = &sock;
+	if (bench_count > 0) {
+		return gw_bench();
+	}
+
+	std::thread stats;
+	if (VSOMEIP_GW_STATS_INTERVAL > 0) {
+		stats = std::thread(gw_stats_thread, &running);
+	}
 	vsomeip_client vc;
 #ifndef VSOMEIP_ENABLE_SIGNAL_HANDLING
 	vc_ptr = &vc;
@@ -436,10 +731,16 @@ vsomeip_gateway(vsomeip_gateway_conf *conf)
 #endif
 	if (vc.init()) {
 		vc.start();
-		return 0;
+		rv = 0;
 	} else {
-		return 1;
+		rv = 1;
 	}
+	running = false;
+	if (stats.joinable()) {
+		stats.join();
+	}
+	gw_stats_log();
+	return rv;
 }
 
 static void
@@ -507,7 +808,9 @@ vsomeip_gateway_conf_check_and_set(vsomeip_gateway_conf *conf)
 		LOG_INF << "Set default mqtt-url: " <<  conf->mqtt_url;
 	}
 
-	nwork = conf->parallel;
+	if (conf->parallel > 0) {
+		nwork = conf->parallel;
+	}
 
 	conf_g = conf;
 	return 0;
@@ -531,6 +834,15 @@ vsomeip_gateway_parse_opts(int argc, char **argv, vsomeip_gateway_conf *config)
 		case OPT_CONFFILE:
 			config->path = nng_strdup(arg);
 			break;
+		case OPT_BENCH:
+			bench_count = atol(arg);
+			break;
+		case OPT_BENCH_SIZE:
+			bench_size = atol(arg);
+			if (bench_size < 0) {
+				bench_size = 0;
+			}
+			break;
 		default:
 			break;
 		}
@@ -3,6 +3,7 @@
 #include "nng/nng.h"
 #include "nng/supplemental/nanolib/conf.h"
 #include "nng/supplemental/util/options.h"
+#include "nng/supplemental/util/platform.h"
 #include <zmq.h>
 #include "web_server.h"
 
@@ -13,23 +14,39 @@ struct work {
 	nng_ctx  ctx;
 };
 
+// ZMQ frames published to MQTT per wakeup of the receiving loop.
+#ifndef ZMQ_GW_BATCH
+#define ZMQ_GW_BATCH 64
+#endif
+
 enum options {
 	OPT_HELP = 1,
 	OPT_CONFFILE,
+	OPT_SNDHWM,
+	OPT_RCVHWM,
 };
 
 static nng_optspec cmd_opts[] = {
 	{ .o_name = "help", .o_short = 'h', .o_val = OPT_HELP },
 	{ .o_name = "conf", .o_val = OPT_CONFFILE, .o_arg = true },
+	{ .o_name = "sndhwm", .o_val = OPT_SNDHWM, .o_arg = true },
+	{ .o_name = "rcvhwm", .o_val = OPT_RCVHWM, .o_arg = true },
 	{ .o_name = NULL, .o_val = 0 },
 };
 
 static char help_info[] =
-    "Usage: nanomq_cli zmq_gateway [--conf <path>]\n\n"
-    "  --conf <path>  The path of a specified nanomq configuration file \n";
+    "Usage: nanomq_cli zmq_gateway [--conf <path>] [--sndhwm <n>] "
+    "[--rcvhwm <n>]\n\n"
+    "  --conf <path>  The path of a specified nanomq configuration file \n"
+    "  --sndhwm <n>   High water mark of the ZMQ sender, in messages\n"
+    "  --rcvhwm <n>   High water mark of the ZMQ receiver, in messages\n";
 
 static zmq_gateway_conf *conf_g = NULL;
 static int               nwork  = 32;
+static int               sndhwm = -1; // -1 leaves the ZMQ default
+static int               rcvhwm = -1;
+// ZMQ sockets are not thread safe, the works take turns on the sender
+static nng_mtx *zmq_sender_mtx = NULL;
 
 void
 proxy_fatal(const char *msg, int rv)
@@ -85,24 +102,53 @@ connect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 	}
 }
 
+// ZMQ is done with the frame, possibly on its own io thread.
+static void
+zmq_frame_free(void *data, void *hint)
+{
+	(void) data;
+	nng_msg_free(hint);
+}
+
+// Hands the payload of msg to ZMQ without copying, msg is freed once ZMQ
+// has sent it. Errors are reported and the message dropped.
 int
 check_recv(nng_msg *msg)
 {
+	uint32_t  payload_len;
+	uint8_t  *payload;
+	zmq_msg_t frame;
 
-	// Get PUBLISH payload and topic from msg;
-	uint32_t payload_len;
-	uint32_t topic_len;
-
-	uint8_t *payload = nng_mqtt_msg_get_publish_payload(msg, &payload_len);
-	const char *topic = nng_mqtt_msg_get_publish_topic(msg, &topic_len);
-	// printf("RECV: '%.*s' FROM: '%.*s'\n", payload_len,
-	//     (char *) payload, topic_len, topic);
+	if (nng_mqtt_msg_get_packet_type(msg) != NNG_MQTT_PUBLISH) {
+		nng_msg_free(msg);
+		return 0;
+	}
+	payload = nng_mqtt_msg_get_publish_payload(msg, &payload_len);
+	if (zmq_msg_init_data(
+	        &frame, payload, payload_len, zmq_frame_free, msg) != 0) {
+		fprintf(stderr, "zmq_msg_init_data: %s\n",
+		    zmq_strerror(zmq_errno()));
+		nng_msg_free(msg);
+		return 0;
+	}
 
+	nng_mtx_lock(zmq_sender_mtx);
 	if (conf_g->zmq_pub_pre) {
-		zmq_send(conf_g->zmq_sender, (void *) conf_g->zmq_pub_pre,
-		    strlen(conf_g->zmq_pub_pre), ZMQ_SNDMORE);
+		zmq_msg_t pre;
+
+		// constant for the whole run, nothing to free
+		zmq_msg_init_data(&pre, (void *) conf_g->zmq_pub_pre,
+		    strlen(conf_g->zmq_pub_pre), NULL, NULL);
+		if (zmq_msg_send(&pre, conf_g->zmq_sender, ZMQ_SNDMORE) < 0) {
+			zmq_msg_close(&pre);
+		}
 	}
-	zmq_send(conf_g->zmq_sender, (void *) payload, payload_len, 0);
+	if (zmq_msg_send(&frame, conf_g->zmq_sender, 0) < 0) {
+		fprintf(stderr, "zmq_msg_send: %s\n",
+		    zmq_strerror(zmq_errno()));
+		zmq_msg_close(&frame);
+	}
+	nng_mtx_unlock(zmq_sender_mtx);
 
 	return 0;
 }
@@ -121,17 +167,19 @@ gateway_sub_cb(void *arg)
 		break;
 	case RECV:
 		if ((rv = nng_aio_result(work->aio)) != 0) {
-			nng_msg_free(work->msg);
-			proxy_fatal("nng_send_aio", rv);
+			proxy_fatal("nng_recv_aio", rv);
+			if (rv != NNG_ECLOSED) {
+				nng_ctx_recv(work->ctx, work->aio);
+			}
+			break;
 		}
 		msg = nng_aio_get_msg(work->aio);
 
-		if (-1 == check_recv(msg)) {
-			abort();
-		}
-
+		// Receive the next one while this goes to ZMQ
 		work->state = RECV;
 		nng_ctx_recv(work->ctx, work->aio);
+
+		check_recv(msg);
 		break;
 	default:
 		proxy_fatal("bad state!", NNG_ESTATE);
@@ -249,6 +297,12 @@ zmq_gateway(zmq_gateway_conf *conf)
 		sender   = zmq_socket(context, ZMQ_REQ);
 	}
 
+	if (rcvhwm >= 0) {
+		zmq_setsockopt(receiver, ZMQ_RCVHWM, &rcvhwm, sizeof(rcvhwm));
+	}
+	if (sndhwm >= 0) {
+		zmq_setsockopt(sender, ZMQ_SNDHWM, &sndhwm, sizeof(sndhwm));
+	}
 	zmq_connect(receiver, conf->zmq_sub_url);
 	if (conf->zmq_sub_pre == NULL) {
 		conf->zmq_sub_pre = "";
@@ -259,19 +313,36 @@ zmq_gateway(zmq_gateway_conf *conf)
 	// zmq_bind(sender, conf->zmq_listen_url);
 	zmq_connect(sender, conf->zmq_pub_url);
 	conf->zmq_sender = sender;
+	if (nng_mtx_alloc(&zmq_sender_mtx) != 0) {
+		proxy_fatal("nng_mtx_alloc", NNG_ENOMEM);
+		return -1;
+	}
 	client(conf->mqtt_url, &sock);
 
+	zmq_msg_t batch[ZMQ_GW_BATCH];
+
 	while (1) {
-		zmq_msg_t message;
-		zmq_msg_init(&message);
-		zmq_msg_recv(&message, receiver, 0);
-		int more = zmq_msg_more(&message);
-		// printf("recv: %.*s\n", (int) zmq_msg_size(&message), (char*)
-		// zmq_msg_data(&message));
-		client_publish(sock, conf->pub_topic,
-		    (uint8_t *) zmq_msg_data(&message), zmq_msg_size(&message),
-		    0, false);
-		zmq_msg_close(&message);
+		int n = 0;
+
+		// Block for the first frame, then take what is already there
+		zmq_msg_init(&batch[n]);
+		if (zmq_msg_recv(&batch[n], receiver, 0) < 0) {
+			zmq_msg_close(&batch[n]);
+			continue;
+		}
+		for (n = 1; n < ZMQ_GW_BATCH; n++) {
+			zmq_msg_init(&batch[n]);
+			if (zmq_msg_recv(&batch[n], receiver, ZMQ_DONTWAIT) < 0) {
+				zmq_msg_close(&batch[n]);
+				break;
+			}
+		}
+		for (int i = 0; i < n; i++) {
+			client_publish(sock, conf->pub_topic,
+			    (uint8_t *) zmq_msg_data(&batch[i]),
+			    zmq_msg_size(&batch[i]), 0, false);
+			zmq_msg_close(&batch[i]);
+		}
 	}
 
 	zmq_close(receiver);
@@ -320,7 +391,9 @@ gateway_conf_check_and_set(zmq_gateway_conf *conf)
 		printf("Set default zmq-sub-url: %s\n", conf->zmq_sub_url);
 	}
 
-	nwork  = conf->parallel;
+	if (conf->parallel > 0) {
+		nwork = conf->parallel;
+	}
 	conf_g = conf;
 	return 0;
 }
@@ -343,6 +416,12 @@ gateway_parse_opts(int argc, char **argv, zmq_gateway_conf *config)
 		case OPT_CONFFILE:
 			config->path = nng_strdup(arg);
 			break;
+		case OPT_SNDHWM:
+			sndhwm = atoi(arg);
+			break;
+		case OPT_RCVHWM:
+			rcvhwm = atoi(arg);
+			break;
 		default:
 			break;
 		}